@@ -0,0 +1,391 @@
+#ifndef PROTON_DATA_HPP
+#define PROTON_DATA_HPP 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/codec.h>
+#include <proton/types.hpp>
+#include <proton/error.hpp>
+#include <map>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @file
+ *
+ * Typed encoding and decoding of ::pn_data_t.
+ *
+ * The AMQP type of a value is chosen from its C++ type when the code
+ * is compiled, by the codec<T> specialization for it, so putting and
+ * getting a value is a direct call to the matching pn_data_put_* or
+ * pn_data_get_* function:
+ *
+ * | C++                         | AMQP                                |
+ * |-----------------------------|-------------------------------------|
+ * | bool                        | boolean                             |
+ * | int8_t ... uint64_t         | byte ... ulong, by size and sign    |
+ * | float, double               | float, double                       |
+ * | std::string                 | string (symbol also gets)           |
+ * | symbol                      | symbol (string also gets)           |
+ * | bytes, bytes_view           | binary (string and symbol also get) |
+ * | std::vector<T>              | list (array also gets)              |
+ * | std::map<K, V>              | map                                 |
+ *
+ * Any integer type gets from any AMQP integer whose value fits it. A
+ * bytes_view that is got refers into the ::pn_data_t, so is only
+ * valid until it is next changed.
+ *
+ * Support for another type is added by specializing codec.
+ *
+ * @ingroup cpp
+ */
+
+namespace proton {
+
+/**
+ * Puts and gets values of type T at the current node of a
+ * ::pn_data_t, throwing error on failure.
+ */
+template <class T, class Enable = void>
+struct codec;
+
+namespace internal {
+
+inline void put_check(pn_data_t *data, int code) {
+    check(code, pn_data_error(data));
+}
+
+inline error type_error(pn_type_t expected, pn_type_t got) {
+    std::string what = "expected ";
+    what += pn_type_name(expected);
+    what += ", got ";
+    what += pn_type_name(got);
+    return error(what, PN_ARG_ERR);
+}
+
+inline void expect(pn_data_t *data, pn_type_t type) {
+    pn_type_t got = pn_data_type(data);
+    if (got != type) throw type_error(type, got);
+}
+
+template <size_t Size, bool Signed> struct integer;
+template <> struct integer<1, true> {
+    static const pn_type_t type = PN_BYTE;
+    static int put(pn_data_t *d, int64_t v) { return pn_data_put_byte(d, (int8_t) v); }
+};
+template <> struct integer<1, false> {
+    static const pn_type_t type = PN_UBYTE;
+    static int put(pn_data_t *d, uint64_t v) { return pn_data_put_ubyte(d, (uint8_t) v); }
+};
+template <> struct integer<2, true> {
+    static const pn_type_t type = PN_SHORT;
+    static int put(pn_data_t *d, int64_t v) { return pn_data_put_short(d, (int16_t) v); }
+};
+template <> struct integer<2, false> {
+    static const pn_type_t type = PN_USHORT;
+    static int put(pn_data_t *d, uint64_t v) { return pn_data_put_ushort(d, (uint16_t) v); }
+};
+template <> struct integer<4, true> {
+    static const pn_type_t type = PN_INT;
+    static int put(pn_data_t *d, int64_t v) { return pn_data_put_int(d, (int32_t) v); }
+};
+template <> struct integer<4, false> {
+    static const pn_type_t type = PN_UINT;
+    static int put(pn_data_t *d, uint64_t v) { return pn_data_put_uint(d, (uint32_t) v); }
+};
+template <> struct integer<8, true> {
+    static const pn_type_t type = PN_LONG;
+    static int put(pn_data_t *d, int64_t v) { return pn_data_put_long(d, v); }
+};
+template <> struct integer<8, false> {
+    static const pn_type_t type = PN_ULONG;
+    static int put(pn_data_t *d, uint64_t v) { return pn_data_put_ulong(d, v); }
+};
+
+// any AMQP integer node, which is signed if *negative is set on return
+inline uint64_t get_integer(pn_data_t *data, pn_type_t expected, bool *negative) {
+    int64_t s;
+    *negative = false;
+    switch (pn_data_type(data)) {
+      case PN_UBYTE: return pn_data_get_ubyte(data);
+      case PN_USHORT: return pn_data_get_ushort(data);
+      case PN_UINT: return pn_data_get_uint(data);
+      case PN_ULONG: return pn_data_get_ulong(data);
+      case PN_BYTE: s = pn_data_get_byte(data); break;
+      case PN_SHORT: s = pn_data_get_short(data); break;
+      case PN_INT: s = pn_data_get_int(data); break;
+      case PN_LONG: s = pn_data_get_long(data); break;
+      default: throw type_error(expected, pn_data_type(data));
+    }
+    *negative = s < 0;
+    return (uint64_t) s;
+}
+
+}
+
+template <class T>
+struct codec<T, typename std::enable_if<std::is_integral<T>::value &&
+                                        !std::is_same<T, bool>::value>::type> {
+    typedef internal::integer<sizeof(T), std::is_signed<T>::value> amqp;
+
+    static void put(pn_data_t *data, T value) {
+        internal::put_check(data, amqp::put(data, value));
+    }
+
+    static T get(pn_data_t *data) {
+        bool negative;
+        uint64_t value = internal::get_integer(data, amqp::type, &negative);
+        bool fits = negative
+            ? std::is_signed<T>::value &&
+              (int64_t) value >= (int64_t) std::numeric_limits<T>::min()
+            : value <= (uint64_t) std::numeric_limits<T>::max();
+        if (!fits) throw error("integer out of range", PN_OVERFLOW);
+        return (T) value;
+    }
+};
+
+template <> struct codec<bool> {
+    static void put(pn_data_t *data, bool value) {
+        internal::put_check(data, pn_data_put_bool(data, value));
+    }
+    static bool get(pn_data_t *data) {
+        internal::expect(data, PN_BOOL);
+        return pn_data_get_bool(data);
+    }
+};
+
+template <> struct codec<float> {
+    static void put(pn_data_t *data, float value) {
+        internal::put_check(data, pn_data_put_float(data, value));
+    }
+    static float get(pn_data_t *data) {
+        internal::expect(data, PN_FLOAT);
+        return pn_data_get_float(data);
+    }
+};
+
+template <> struct codec<double> {
+    static void put(pn_data_t *data, double value) {
+        internal::put_check(data, pn_data_put_double(data, value));
+    }
+    static double get(pn_data_t *data) {
+        if (pn_data_type(data) == PN_FLOAT) return pn_data_get_float(data);
+        internal::expect(data, PN_DOUBLE);
+        return pn_data_get_double(data);
+    }
+};
+
+template <> struct codec<bytes_view> {
+    static void put(pn_data_t *data, bytes_view value) {
+        internal::put_check(data, pn_data_put_binary(data, value));
+    }
+    static bytes_view get(pn_data_t *data) {
+        pn_type_t type = pn_data_type(data);
+        if (type != PN_STRING && type != PN_SYMBOL) internal::expect(data, PN_BINARY);
+        return pn_data_get_bytes(data);
+    }
+};
+
+template <> struct codec<bytes> {
+    static void put(pn_data_t *data, const bytes &value) {
+        codec<bytes_view>::put(data, value.view());
+    }
+    static bytes get(pn_data_t *data) {
+        return bytes(codec<bytes_view>::get(data));
+    }
+};
+
+template <> struct codec<std::string> {
+    static void put(pn_data_t *data, const std::string &value) {
+        internal::put_check(data, pn_data_put_string(data, bytes_view(value)));
+    }
+    static std::string get(pn_data_t *data) {
+        if (pn_data_type(data) != PN_SYMBOL) internal::expect(data, PN_STRING);
+        return bytes_view(pn_data_get_bytes(data)).str();
+    }
+};
+
+template <> struct codec<symbol> {
+    static void put(pn_data_t *data, const symbol &value) {
+        internal::put_check(data, pn_data_put_symbol(data, bytes_view(value.name)));
+    }
+    static symbol get(pn_data_t *data) {
+        if (pn_data_type(data) != PN_STRING) internal::expect(data, PN_SYMBOL);
+        return symbol(bytes_view(pn_data_get_bytes(data)).str());
+    }
+};
+
+template <class T, class A> struct codec<std::vector<T, A> > {
+    static void put(pn_data_t *data, const std::vector<T, A> &value) {
+        internal::put_check(data, pn_data_put_list(data));
+        pn_data_enter(data);
+        for (typename std::vector<T, A>::const_iterator i = value.begin(); i != value.end(); ++i) {
+            codec<T>::put(data, *i);
+        }
+        pn_data_exit(data);
+    }
+
+    static std::vector<T, A> get(pn_data_t *data) {
+        size_t count;
+        bool described = false;
+        if (pn_data_type(data) == PN_ARRAY) {
+            count = pn_data_get_array(data);
+            described = pn_data_is_array_described(data);
+        } else {
+            internal::expect(data, PN_LIST);
+            count = pn_data_get_list(data);
+        }
+        std::vector<T, A> value;
+        value.reserve(count);
+        pn_data_enter(data);
+        if (described) pn_data_next(data);
+        while (count-- && pn_data_next(data)) {
+            value.push_back(codec<T>::get(data));
+        }
+        pn_data_exit(data);
+        return value;
+    }
+};
+
+template <class K, class V, class C, class A> struct codec<std::map<K, V, C, A> > {
+    static void put(pn_data_t *data, const std::map<K, V, C, A> &value) {
+        internal::put_check(data, pn_data_put_map(data));
+        pn_data_enter(data);
+        for (typename std::map<K, V, C, A>::const_iterator i = value.begin(); i != value.end(); ++i) {
+            codec<K>::put(data, i->first);
+            codec<V>::put(data, i->second);
+        }
+        pn_data_exit(data);
+    }
+
+    static std::map<K, V, C, A> get(pn_data_t *data) {
+        internal::expect(data, PN_MAP);
+        size_t count = pn_data_get_map(data) / 2;
+        std::map<K, V, C, A> value;
+        pn_data_enter(data);
+        while (count-- && pn_data_next(data)) {
+            K key = codec<K>::get(data);
+            if (!pn_data_next(data)) break;
+            value[key] = codec<V>::get(data);
+        }
+        pn_data_exit(data);
+        return value;
+    }
+};
+
+/**
+ * Borrows a ::pn_data_t, such as the body of a message, to encode and
+ * decode values in it.
+ */
+class data_ref {
+  public:
+    explicit data_ref(pn_data_t *data) : data_(data) {}
+
+    pn_data_t *get() const { return data_; }
+
+    void clear() { pn_data_clear(data_); }
+    void rewind() { pn_data_rewind(data_); }
+    bool next() { return pn_data_next(data_); }
+    bool empty() const { return pn_data_size(data_) == 0; }
+
+    /** The type of the current node, or -1 if there is none. */
+    pn_type_t type() const { return pn_data_type(data_); }
+
+    /** Puts a value after the current node. */
+    template <class T> data_ref &put(const T &value) {
+        codec<T>::put(data_, value);
+        return *this;
+    }
+
+    data_ref &put(const char *value) { return put(std::string(value)); }
+
+    /** Gets the value at the current node. */
+    template <class T> T get() const { return codec<T>::get(data_); }
+
+    /** Gets the first value, as for a message body. */
+    template <class T> T value() {
+        rewind();
+        if (!next()) throw error("no value", PN_UNDERFLOW);
+        return get<T>();
+    }
+
+    /** Replaces the content with a value. */
+    template <class T> void assign(const T &value) {
+        clear();
+        put(value);
+    }
+
+    /** Replaces the content with a copy of another's. */
+    void copy(data_ref src) {
+        clear();
+        internal::put_check(data_, pn_data_copy(data_, src.data_));
+    }
+
+    /** Encodes the content into out, sized exactly for it. */
+    void encode(bytes &out) const {
+        ssize_t size = check(pn_data_encoded_size(data_), pn_data_error(data_));
+        out.resize(size);
+        check(pn_data_encode(data_, out.data(), size), pn_data_error(data_));
+    }
+
+    bytes encode() const {
+        bytes out;
+        encode(out);
+        return out;
+    }
+
+    /** Decodes one value after the current node, returning the bytes used. */
+    size_t decode(bytes_view in) {
+        return check(pn_data_decode(data_, in.data(), in.size()), pn_data_error(data_));
+    }
+
+  protected:
+    pn_data_t *data_;
+};
+
+/**
+ * An owned ::pn_data_t, freed on destruction. It can be moved but not
+ * copied; data_ref::copy makes a copy explicitly.
+ */
+class data : public data_ref {
+  public:
+    explicit data(size_t capacity = 16) : data_ref(pn_data(capacity)) {
+        if (!data_) throw std::bad_alloc();
+    }
+    data(data &&other) : data_ref(other.data_) { other.data_ = 0; }
+    ~data() { if (data_) pn_data_free(data_); }
+
+    data &operator=(data &&other) {
+        std::swap(data_, other.data_);
+        return *this;
+    }
+
+  private:
+    data(const data &);
+    data &operator=(const data &);
+};
+
+}
+
+#endif /* data.hpp */
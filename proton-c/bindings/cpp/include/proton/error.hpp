@@ -0,0 +1,74 @@
+#ifndef PROTON_ERROR_HPP
+#define PROTON_ERROR_HPP 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/types.h>
+#include <proton/error.h>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @file
+ *
+ * Errors raised by the C++ binding.
+ *
+ * @ingroup cpp
+ */
+
+namespace proton {
+
+/**
+ * Thrown where the C API would return an error code.
+ */
+class error : public std::runtime_error {
+  public:
+    explicit error(const std::string &what, int code = PN_ERR)
+        : std::runtime_error(what), code_(code) {}
+
+    /** The PN_* code from the C API. */
+    int code() const { return code_; }
+
+  private:
+    int code_;
+};
+
+/**
+ * Throws an error for a negative code, using the text of detail if it
+ * has any, and returns other codes unchanged.
+ */
+inline ssize_t check(ssize_t code, pn_error_t *detail = 0) {
+    if (code < 0) {
+        std::string what = pn_code((int) code);
+        const char *text = detail ? pn_error_text(detail) : 0;
+        if (text && *text) {
+            what += ": ";
+            what += text;
+        }
+        throw error(what, (int) code);
+    }
+    return code;
+}
+
+}
+
+#endif /* error.hpp */
@@ -0,0 +1,295 @@
+#ifndef PROTON_HANDLER_HPP
+#define PROTON_HANDLER_HPP 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/event.h>
+#include <proton/connection.h>
+#include <proton/session.h>
+#include <proton/link.h>
+#include <proton/reactor.h>
+#include <new>
+#include <utility>
+
+/**
+ * @file
+ *
+ * Event handlers dispatched statically.
+ *
+ * A handler derives from handler<Self> and hides the on_* members for
+ * the events it wants; the rest fall through to on_unhandled. Layers
+ * are combined with chain, in place of pn_handler_add children, and
+ * the whole chain is given to the reactor as one ::pn_handler_t by
+ * make_handler. Each event then costs one call through a function
+ * pointer into the chain, and every layer below that is called
+ * directly, so the compiler can inline the layers and drop the events
+ * they ignore:
+ *
+ *     struct receiver : proton::handler<receiver> {
+ *         void on_delivery(pn_event_t *e) { ... }
+ *     };
+ *
+ *     typedef proton::chain<proton::handshaker, proton::flowcontroller, receiver> stack;
+ *     pn_handler_t *h = proton::make_handler(stack(proton::handshaker(),
+ *                                                  proton::flowcontroller(1024),
+ *                                                  receiver()));
+ *     pn_reactor_set_handler(reactor, h);
+ *     pn_decref(h);
+ *
+ * C handlers such as pn_iohandler can still take part as a c_handler
+ * layer.
+ *
+ * @ingroup cpp
+ */
+
+#define PN_CPP_EVENTS(X)                                        \
+    X(PN_REACTOR_INIT, on_reactor_init)                         \
+    X(PN_REACTOR_QUIESCED, on_reactor_quiesced)                 \
+    X(PN_REACTOR_FINAL, on_reactor_final)                       \
+    X(PN_TIMER_TASK, on_timer_task)                             \
+    X(PN_CONNECTION_INIT, on_connection_init)                   \
+    X(PN_CONNECTION_BOUND, on_connection_bound)                 \
+    X(PN_CONNECTION_UNBOUND, on_connection_unbound)             \
+    X(PN_CONNECTION_LOCAL_OPEN, on_connection_local_open)       \
+    X(PN_CONNECTION_REMOTE_OPEN, on_connection_remote_open)     \
+    X(PN_CONNECTION_LOCAL_CLOSE, on_connection_local_close)     \
+    X(PN_CONNECTION_REMOTE_CLOSE, on_connection_remote_close)   \
+    X(PN_CONNECTION_FINAL, on_connection_final)                 \
+    X(PN_SESSION_INIT, on_session_init)                         \
+    X(PN_SESSION_LOCAL_OPEN, on_session_local_open)             \
+    X(PN_SESSION_REMOTE_OPEN, on_session_remote_open)           \
+    X(PN_SESSION_LOCAL_CLOSE, on_session_local_close)           \
+    X(PN_SESSION_REMOTE_CLOSE, on_session_remote_close)         \
+    X(PN_SESSION_FINAL, on_session_final)                       \
+    X(PN_LINK_INIT, on_link_init)                               \
+    X(PN_LINK_LOCAL_OPEN, on_link_local_open)                   \
+    X(PN_LINK_REMOTE_OPEN, on_link_remote_open)                 \
+    X(PN_LINK_LOCAL_CLOSE, on_link_local_close)                 \
+    X(PN_LINK_REMOTE_CLOSE, on_link_remote_close)               \
+    X(PN_LINK_LOCAL_DETACH, on_link_local_detach)               \
+    X(PN_LINK_REMOTE_DETACH, on_link_remote_detach)             \
+    X(PN_LINK_FLOW, on_link_flow)                               \
+    X(PN_LINK_FINAL, on_link_final)                             \
+    X(PN_DELIVERY, on_delivery)                                 \
+    X(PN_TRANSPORT, on_transport)                               \
+    X(PN_TRANSPORT_ERROR, on_transport_error)                   \
+    X(PN_TRANSPORT_HEAD_CLOSED, on_transport_head_closed)       \
+    X(PN_TRANSPORT_TAIL_CLOSED, on_transport_tail_closed)       \
+    X(PN_TRANSPORT_CLOSED, on_transport_closed)                 \
+    X(PN_SELECTABLE_INIT, on_selectable_init)                   \
+    X(PN_SELECTABLE_UPDATED, on_selectable_updated)             \
+    X(PN_SELECTABLE_READABLE, on_selectable_readable)           \
+    X(PN_SELECTABLE_WRITABLE, on_selectable_writable)           \
+    X(PN_SELECTABLE_ERROR, on_selectable_error)                 \
+    X(PN_SELECTABLE_EXPIRED, on_selectable_expired)             \
+    X(PN_SELECTABLE_FINAL, on_selectable_final)
+
+namespace proton {
+
+/**
+ * The base of a statically dispatched handler. Self is the derived
+ * class, whose on_* members are found without virtual calls.
+ */
+template <class Self>
+class handler {
+  public:
+    /** Calls the on_* member of Self for the event's type. */
+    void on_event(pn_event_t *event, pn_event_type_t type) {
+        Self &self = static_cast<Self &>(*this);
+        switch (type) {
+#define PN_CPP_CASE(TYPE, NAME) case TYPE: self.NAME(event); break;
+            PN_CPP_EVENTS(PN_CPP_CASE)
+#undef PN_CPP_CASE
+          default: self.on_unhandled(event); break;
+        }
+    }
+
+#define PN_CPP_DEFAULT(TYPE, NAME) \
+    void NAME(pn_event_t *event) { static_cast<Self &>(*this).on_unhandled(event); }
+    PN_CPP_EVENTS(PN_CPP_DEFAULT)
+#undef PN_CPP_DEFAULT
+
+    /** Called for the events Self does not handle; does nothing. */
+    void on_unhandled(pn_event_t *) {}
+};
+
+/**
+ * Dispatches each event to every layer in turn, first to last, as a
+ * ::pn_handler_t does to itself and then its children.
+ */
+template <class... Layers> class chain;
+
+template <> class chain<> {
+  public:
+    void on_event(pn_event_t *, pn_event_type_t) {}
+};
+
+template <class First, class... Rest>
+class chain<First, Rest...> : private chain<Rest...> {
+  public:
+    chain() {}
+    explicit chain(First first, Rest... rest)
+        : chain<Rest...>(std::move(rest)...), first_(std::move(first)) {}
+
+    void on_event(pn_event_t *event, pn_event_type_t type) {
+        first_.on_event(event, type);
+        chain<Rest...>::on_event(event, type);
+    }
+
+    First &first() { return first_; }
+    chain<Rest...> &rest() { return *this; }
+
+  private:
+    First first_;
+};
+
+/**
+ * A layer that dispatches to a C handler, which it holds a reference
+ * to.
+ */
+class c_handler {
+  public:
+    explicit c_handler(pn_handler_t *handler) : handler_(handler) { pn_incref(handler_); }
+    c_handler(const c_handler &other) : handler_(other.handler_) { pn_incref(handler_); }
+    ~c_handler() { pn_decref(handler_); }
+
+    c_handler &operator=(c_handler other) {
+        std::swap(handler_, other.handler_);
+        return *this;
+    }
+
+    void on_event(pn_event_t *event, pn_event_type_t type) {
+        pn_handler_dispatch(handler_, event, type);
+    }
+
+    pn_handler_t *get() const { return handler_; }
+
+  private:
+    pn_handler_t *handler_;
+};
+
+/**
+ * Opens and closes whatever the peer does, like ::pn_handshaker.
+ */
+class handshaker : public handler<handshaker> {
+  public:
+    void on_connection_remote_open(pn_event_t *event) {
+        pn_connection_t *conn = pn_event_connection(event);
+        if (pn_connection_state(conn) & PN_LOCAL_UNINIT) pn_connection_open(conn);
+    }
+
+    void on_session_remote_open(pn_event_t *event) {
+        pn_session_t *ssn = pn_event_session(event);
+        if (pn_session_state(ssn) & PN_LOCAL_UNINIT) pn_session_open(ssn);
+    }
+
+    void on_link_remote_open(pn_event_t *event) {
+        pn_link_t *link = pn_event_link(event);
+        if (pn_link_state(link) & PN_LOCAL_UNINIT) {
+            pn_terminus_copy(pn_link_source(link), pn_link_remote_source(link));
+            pn_terminus_copy(pn_link_target(link), pn_link_remote_target(link));
+            pn_link_open(link);
+        }
+    }
+
+    void on_connection_remote_close(pn_event_t *event) {
+        pn_connection_t *conn = pn_event_connection(event);
+        if (!(pn_connection_state(conn) & PN_LOCAL_CLOSED)) pn_connection_close(conn);
+    }
+
+    void on_session_remote_close(pn_event_t *event) {
+        pn_session_t *ssn = pn_event_session(event);
+        if (!(pn_session_state(ssn) & PN_LOCAL_CLOSED)) pn_session_close(ssn);
+    }
+
+    void on_link_remote_close(pn_event_t *event) {
+        pn_link_t *link = pn_event_link(event);
+        if (!(pn_link_state(link) & PN_LOCAL_CLOSED)) pn_link_close(link);
+    }
+};
+
+/**
+ * Keeps each receiver's credit topped up to a fixed window, like
+ * ::pn_flowcontroller. The autotuning variant has per link state, so
+ * stays a c_handler over ::pn_flowcontroller_autotune.
+ */
+class flowcontroller : public handler<flowcontroller> {
+  public:
+    // a window of 1 doesn't work because we won't necessarily get
+    // notified when the one allowed delivery is settled
+    explicit flowcontroller(int window = 1024) : window_(window > 1 ? window : 2), drained_(0) {}
+
+    void on_link_local_open(pn_event_t *event) { topup(event); }
+    void on_link_remote_open(pn_event_t *event) { topup(event); }
+    void on_link_flow(pn_event_t *event) { topup(event); }
+    void on_delivery(pn_event_t *event) { topup(event); }
+
+  private:
+    void topup(pn_event_t *event) {
+        pn_link_t *link = pn_event_link(event);
+        if (pn_link_is_receiver(link)) {
+            drained_ += pn_link_drained(link);
+            if (!drained_) pn_link_flow(link, window_ - pn_link_credit(link));
+        }
+    }
+
+    int window_;
+    int drained_;
+};
+
+namespace internal {
+
+template <class H>
+void dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+    static_cast<H *>(pn_handler_mem(handler))->on_event(event, type);
+}
+
+template <class H>
+void finalize(pn_handler_t *handler) {
+    static_cast<H *>(pn_handler_mem(handler))->~H();
+}
+
+}
+
+/**
+ * Makes a ::pn_handler_t that holds h and passes it every event. The
+ * caller owns the reference returned, as from ::pn_handler.
+ */
+template <class H>
+pn_handler_t *make_handler(H h) {
+    static_assert(alignof(H) <= alignof(void *), "handler over aligned for pn_handler_mem");
+    pn_handler_t *handler = pn_handler_new(&internal::dispatch<H>, sizeof(H), &internal::finalize<H>);
+    new (pn_handler_mem(handler)) H(std::move(h));
+    return handler;
+}
+
+/** The H held by a handler from make_handler<H>. */
+template <class H>
+H &handler_of(pn_handler_t *handler) {
+    return *static_cast<H *>(pn_handler_mem(handler));
+}
+
+}
+
+#undef PN_CPP_EVENTS
+
+#endif /* handler.hpp */
@@ -0,0 +1,188 @@
+#ifndef PROTON_MESSAGE_HPP
+#define PROTON_MESSAGE_HPP 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/message.h>
+#include <proton/types.hpp>
+#include <proton/error.hpp>
+#include <proton/data.hpp>
+#include <string>
+
+/**
+ * @file
+ *
+ * An owned AMQP message.
+ *
+ * @ingroup cpp
+ */
+
+namespace proton {
+
+/**
+ * Owns a ::pn_message_t and frees it on destruction.
+ *
+ * A message is moved rather than copied, so handing one on costs a
+ * pointer; copy() makes a copy explicitly. The string properties are
+ * read as bytes_view, straight from the message without a copy, and
+ * so are only valid until the message is next changed. The sections
+ * are data_ref into the message, to use with the typed codec.
+ */
+class message {
+  public:
+    message() : msg_(pn_message()) {
+        if (!msg_) throw std::bad_alloc();
+    }
+    message(message &&other) : msg_(other.msg_) { other.msg_ = 0; }
+    ~message() { if (msg_) pn_message_free(msg_); }
+
+    message &operator=(message &&other) {
+        std::swap(msg_, other.msg_);
+        return *this;
+    }
+
+    /** Takes ownership of msg. */
+    explicit message(pn_message_t *msg) : msg_(msg) {}
+
+    pn_message_t *get() const { return msg_; }
+
+    /** Gives up ownership, leaving this message empty. */
+    pn_message_t *release() {
+        pn_message_t *msg = msg_;
+        msg_ = 0;
+        return msg;
+    }
+
+    /** A copy of the message, made by encoding and decoding it. */
+    message copy() const {
+        bytes buf;
+        encode(buf);
+        message result;
+        result.decode(buf);
+        return result;
+    }
+
+    void clear() { pn_message_clear(msg_); }
+
+    bool durable() const { return pn_message_is_durable(msg_); }
+    void durable(bool value) { check(pn_message_set_durable(msg_, value), error_()); }
+
+    uint8_t priority() const { return pn_message_get_priority(msg_); }
+    void priority(uint8_t value) { check(pn_message_set_priority(msg_, value), error_()); }
+
+    pn_millis_t ttl() const { return pn_message_get_ttl(msg_); }
+    void ttl(pn_millis_t value) { check(pn_message_set_ttl(msg_, value), error_()); }
+
+    bool first_acquirer() const { return pn_message_is_first_acquirer(msg_); }
+    void first_acquirer(bool value) { check(pn_message_set_first_acquirer(msg_, value), error_()); }
+
+    uint32_t delivery_count() const { return pn_message_get_delivery_count(msg_); }
+    void delivery_count(uint32_t value) { check(pn_message_set_delivery_count(msg_, value), error_()); }
+
+    bool inferred() const { return pn_message_is_inferred(msg_); }
+    void inferred(bool value) { check(pn_message_set_inferred(msg_, value), error_()); }
+
+    bytes_view user_id() const { return pn_message_get_user_id(msg_); }
+    void user_id(bytes_view value) { check(pn_message_set_user_id(msg_, value), error_()); }
+
+    bytes_view address() const { return pn_message_get_address_bytes(msg_); }
+    void address(const std::string &value) { check(pn_message_set_address(msg_, value.c_str()), error_()); }
+
+    bytes_view subject() const { return pn_message_get_subject_bytes(msg_); }
+    void subject(const std::string &value) { check(pn_message_set_subject(msg_, value.c_str()), error_()); }
+
+    bytes_view reply_to() const { return pn_message_get_reply_to_bytes(msg_); }
+    void reply_to(const std::string &value) { check(pn_message_set_reply_to(msg_, value.c_str()), error_()); }
+
+    bytes_view content_type() const { return pn_message_get_content_type_bytes(msg_); }
+    void content_type(const std::string &value) {
+        check(pn_message_set_content_type(msg_, value.c_str()), error_());
+    }
+
+    bytes_view content_encoding() const { return pn_message_get_content_encoding_bytes(msg_); }
+    void content_encoding(const std::string &value) {
+        check(pn_message_set_content_encoding(msg_, value.c_str()), error_());
+    }
+
+    pn_timestamp_t creation_time() const { return pn_message_get_creation_time(msg_); }
+    void creation_time(pn_timestamp_t value) { check(pn_message_set_creation_time(msg_, value), error_()); }
+
+    pn_timestamp_t expiry_time() const { return pn_message_get_expiry_time(msg_); }
+    void expiry_time(pn_timestamp_t value) { check(pn_message_set_expiry_time(msg_, value), error_()); }
+
+    bytes_view group_id() const { return pn_message_get_group_id_bytes(msg_); }
+    void group_id(const std::string &value) { check(pn_message_set_group_id(msg_, value.c_str()), error_()); }
+
+    pn_sequence_t group_sequence() const { return pn_message_get_group_sequence(msg_); }
+    void group_sequence(pn_sequence_t value) { check(pn_message_set_group_sequence(msg_, value), error_()); }
+
+    bytes_view reply_to_group_id() const { return pn_message_get_reply_to_group_id_bytes(msg_); }
+    void reply_to_group_id(const std::string &value) {
+        check(pn_message_set_reply_to_group_id(msg_, value.c_str()), error_());
+    }
+
+    data_ref id() { return data_ref(pn_message_id(msg_)); }
+    data_ref correlation_id() { return data_ref(pn_message_correlation_id(msg_)); }
+    data_ref instructions() { return data_ref(pn_message_instructions(msg_)); }
+    data_ref annotations() { return data_ref(pn_message_annotations(msg_)); }
+    data_ref properties() { return data_ref(pn_message_properties(msg_)); }
+    data_ref body() { return data_ref(pn_message_body(msg_)); }
+
+    /** Encodes the message into out, growing it as need be. */
+    void encode(bytes &out) const {
+        pn_rwbytes_t *buf = out.buffer();
+        out.resize(check(pn_message_encode2(msg_, buf), error_()));
+    }
+
+    bytes encode() const {
+        bytes out;
+        encode(out);
+        return out;
+    }
+
+    /** Decodes the message, copying what it needs from in. */
+    void decode(bytes_view in) {
+        check(pn_message_decode(msg_, in.data(), in.size()), error_());
+    }
+
+    /**
+     * Decodes the message without copying its content, which is
+     * referred to in place, so in must be left unchanged until the
+     * message is cleared, decoded again or destroyed; see
+     * ::pn_message_decode_borrowed.
+     */
+    void decode_borrowed(bytes_view in) {
+        check(pn_message_decode_borrowed(msg_, in.data(), in.size()), error_());
+    }
+
+  private:
+    message(const message &);
+    message &operator=(const message &);
+
+    pn_error_t *error_() const { return pn_message_error(msg_); }
+
+    pn_message_t *msg_;
+};
+
+}
+
+#endif /* message.hpp */
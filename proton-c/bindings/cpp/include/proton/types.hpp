@@ -0,0 +1,203 @@
+#ifndef PROTON_TYPES_HPP
+#define PROTON_TYPES_HPP 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/types.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <utility>
+
+/**
+ * @file
+ *
+ * Value types shared by the C++ binding.
+ *
+ * @defgroup cpp C++ binding
+ * @{
+ */
+
+namespace proton {
+
+/**
+ * A borrowed, read only run of bytes, in the manner of
+ * std::string_view.
+ *
+ * A bytes_view does not own what it refers to, so it is only valid
+ * for as long as the ::pn_message_t, ::pn_data_t or buffer it was
+ * taken from is unchanged.
+ */
+class bytes_view {
+  public:
+    bytes_view() : start_(0), size_(0) {}
+    bytes_view(const char *start, size_t size) : start_(start), size_(size) {}
+    bytes_view(const char *str) : start_(str), size_(str ? std::strlen(str) : 0) {}
+    bytes_view(const std::string &str) : start_(str.data()), size_(str.size()) {}
+    bytes_view(pn_bytes_t bytes) : start_(bytes.start), size_(bytes.size) {}
+
+    const char *data() const { return start_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const char *begin() const { return start_; }
+    const char *end() const { return start_ + size_; }
+    char operator[](size_t i) const { return start_[i]; }
+
+    /** A copy of the bytes. */
+    std::string str() const { return std::string(start_, size_); }
+    operator pn_bytes_t() const { return pn_bytes(size_, start_); }
+
+    friend bool operator==(bytes_view a, bytes_view b) {
+        return a.size_ == b.size_ && (a.size_ == 0 || std::memcmp(a.start_, b.start_, a.size_) == 0);
+    }
+    friend bool operator!=(bytes_view a, bytes_view b) { return !(a == b); }
+
+  private:
+    const char *start_;
+    size_t size_;
+};
+
+/**
+ * An owned, growable run of bytes.
+ *
+ * The memory is held in a ::pn_rwbytes_t allocated with malloc, so it
+ * can be handed to C calls that grow it, such as
+ * ::pn_message_encode2, without an intermediate copy. Moving a bytes
+ * moves the memory, and copying copies it.
+ */
+class bytes {
+  public:
+    bytes() : buf_(pn_rwbytes(0, 0)), size_(0) {}
+    explicit bytes(bytes_view view) : buf_(pn_rwbytes(0, 0)), size_(0) { assign(view); }
+    bytes(const bytes &other) : buf_(pn_rwbytes(0, 0)), size_(0) { assign(other.view()); }
+    bytes(bytes &&other) : buf_(other.buf_), size_(other.size_) {
+        other.buf_ = pn_rwbytes(0, 0);
+        other.size_ = 0;
+    }
+    ~bytes() { std::free(buf_.start); }
+
+    bytes &operator=(bytes other) {
+        swap(other);
+        return *this;
+    }
+
+    void swap(bytes &other) {
+        std::swap(buf_, other.buf_);
+        std::swap(size_, other.size_);
+    }
+
+    const char *data() const { return buf_.start; }
+    char *data() { return buf_.start; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return buf_.size; }
+    bool empty() const { return size_ == 0; }
+
+    bytes_view view() const { return bytes_view(buf_.start, size_); }
+    operator bytes_view() const { return view(); }
+    std::string str() const { return view().str(); }
+
+    /** Ensures room for at least n bytes, keeping the content. */
+    void reserve(size_t n) {
+        if (n <= buf_.size) return;
+        char *start = static_cast<char *>(std::realloc(buf_.start, n));
+        if (!start) throw std::bad_alloc();
+        buf_ = pn_rwbytes(n, start);
+    }
+
+    /** Sets the size, growing the memory if need be; new bytes are unset. */
+    void resize(size_t n) {
+        reserve(n);
+        size_ = n;
+    }
+
+    void assign(bytes_view view) {
+        resize(view.size());
+        if (view.size()) std::memmove(buf_.start, view.data(), view.size());
+    }
+
+    void clear() { size_ = 0; }
+
+    /** The underlying buffer, for C calls that fill or grow it. */
+    pn_rwbytes_t *buffer() { return &buf_; }
+
+  private:
+    pn_rwbytes_t buf_;
+    size_t size_;
+};
+
+/** A string encoded as an AMQP symbol rather than a string. */
+struct symbol {
+    std::string name;
+
+    symbol() {}
+    explicit symbol(const std::string &n) : name(n) {}
+    explicit symbol(const char *n) : name(n) {}
+
+    friend bool operator==(const symbol &a, const symbol &b) { return a.name == b.name; }
+    friend bool operator<(const symbol &a, const symbol &b) { return a.name < b.name; }
+};
+
+/**
+ * Owns a C object and frees it on destruction, moving but never
+ * copying it.
+ */
+template <class T, void (*Free)(T *)>
+class handle {
+  public:
+    handle() : ptr_(0) {}
+    explicit handle(T *ptr) : ptr_(ptr) {}
+    handle(handle &&other) : ptr_(other.release()) {}
+    ~handle() { if (ptr_) Free(ptr_); }
+
+    handle &operator=(handle &&other) {
+        reset(other.release());
+        return *this;
+    }
+
+    T *get() const { return ptr_; }
+    explicit operator bool() const { return ptr_ != 0; }
+
+    T *release() {
+        T *ptr = ptr_;
+        ptr_ = 0;
+        return ptr;
+    }
+
+    void reset(T *ptr = 0) {
+        if (ptr_ && ptr_ != ptr) Free(ptr_);
+        ptr_ = ptr;
+    }
+
+  private:
+    handle(const handle &);
+    handle &operator=(const handle &);
+
+    T *ptr_;
+};
+
+}
+
+/** @}
+ */
+
+#endif /* types.hpp */
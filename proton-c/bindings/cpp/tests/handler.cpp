@@ -0,0 +1,161 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/handler.hpp>
+#include <proton/handlers.h>
+#include <proton/delivery.h>
+#include <proton/transport.h>
+#include <cstdlib>
+
+#define assert(E) ((E) ? 0 : (abort(), 0))
+
+static int live = 0;
+
+struct counter : proton::handler<counter> {
+  int deliveries, unhandled;
+
+  counter() : deliveries(0), unhandled(0) { live++; }
+  counter(const counter &other) : deliveries(other.deliveries), unhandled(other.unhandled) { live++; }
+  ~counter() { live--; }
+
+  void on_delivery(pn_event_t *) { deliveries++; }
+  void on_unhandled(pn_event_t *) { unhandled++; }
+};
+
+// push data from one transport to another
+static int xfer(pn_transport_t *src, pn_transport_t *dest)
+{
+  ssize_t out = pn_transport_pending(src);
+  if (out > 0) {
+    ssize_t in = pn_transport_capacity(dest);
+    if (in > 0) {
+      size_t count = (size_t) (out < in ? out : in);
+      pn_transport_push(dest, pn_transport_head(src), count);
+      pn_transport_pop(src, count);
+      return (int) count;
+    }
+  }
+  return 0;
+}
+
+struct peers {
+  pn_connection_t *client, *server;
+  pn_transport_t *tclient, *tserver;
+  pn_collector_t *collector;
+
+  peers() {
+    client = pn_connection();
+    server = pn_connection();
+    tclient = pn_transport();
+    tserver = pn_transport();
+    pn_transport_set_server(tserver);
+    collector = pn_collector();
+    pn_connection_collect(server, collector);
+    pn_transport_bind(tclient, client);
+    pn_transport_bind(tserver, server);
+  }
+
+  ~peers() {
+    pn_transport_unbind(tclient);
+    pn_transport_unbind(tserver);
+    pn_connection_free(client);
+    pn_connection_free(server);
+    pn_transport_free(tclient);
+    pn_transport_free(tserver);
+    pn_collector_free(collector);
+  }
+
+  // moves bytes both ways and hands the server's events to h until
+  // nothing more happens
+  void run(pn_handler_t *h) {
+    bool busy = true;
+    while (busy) {
+      busy = false;
+      while (xfer(tclient, tserver) + xfer(tserver, tclient)) busy = true;
+      pn_event_t *event;
+      while ((event = pn_collector_peek(collector))) {
+        pn_handler_dispatch(h, event, pn_event_type(event));
+        pn_collector_pop(collector);
+        busy = true;
+      }
+    }
+  }
+
+  pn_link_t *sender() {
+    pn_connection_open(client);
+    pn_session_t *ssn = pn_session(client);
+    pn_session_open(ssn);
+    pn_link_t *snd = pn_sender(ssn, "sender");
+    pn_terminus_set_address(pn_link_target(snd), "queue");
+    pn_link_open(snd);
+    return snd;
+  }
+};
+
+static void test_chain(void)
+{
+  typedef proton::chain<proton::handshaker, proton::flowcontroller, counter> stack;
+  {
+    peers p;
+    pn_handler_t *h = proton::make_handler(stack(proton::handshaker(), proton::flowcontroller(10), counter()));
+    stack &s = proton::handler_of<stack>(h);
+    pn_link_t *snd = p.sender();
+    p.run(h);
+
+    // the handshaker opened everything and the flowcontroller gave credit
+    assert(pn_connection_state(p.client) == (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(pn_link_state(snd) == (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(pn_link_credit(snd) == 10);
+
+    pn_delivery(snd, pn_dtag("tag", 3));
+    pn_link_send(snd, "hello", 5);
+    pn_link_advance(snd);
+    p.run(h);
+    counter &c = s.rest().rest().first();
+    assert(c.deliveries == 1 && c.unhandled > 0);
+
+    // the server's credit is topped up again on delivery
+    pn_link_t *rcv = pn_link_head(p.server, 0);
+    assert(pn_link_credit(rcv) == 10);
+    pn_decref(h);
+  }
+  assert(live == 0);
+}
+
+static void test_c_layer(void)
+{
+  peers p;
+  pn_handler_t *fc = pn_flowcontroller(5);
+  typedef proton::chain<proton::handshaker, proton::c_handler> stack;
+  pn_handler_t *h = proton::make_handler(stack(proton::handshaker(), proton::c_handler(fc)));
+  pn_decref(fc);
+  pn_link_t *snd = p.sender();
+  p.run(h);
+  assert(pn_link_credit(snd) == 5);
+  pn_decref(h);
+}
+
+int main(int argc, char **argv)
+{
+  test_chain();
+  test_c_layer();
+  return 0;
+}
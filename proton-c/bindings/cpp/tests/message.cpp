@@ -0,0 +1,135 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/message.hpp>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#define assert(E) ((E) ? 0 : (abort(), 0))
+
+using namespace proton;
+
+template <class T> static bool throws(T (data_ref::*get)() const, data_ref d, int code)
+{
+  try {
+    (d.*get)();
+  } catch (const error &e) {
+    return e.code() == code;
+  }
+  return false;
+}
+
+static void test_codec(void)
+{
+  data d;
+  std::map<std::string, int32_t> m;
+  m["one"] = 1;
+  m["two"] = 2;
+  std::vector<std::string> l;
+  l.push_back("a");
+  l.push_back("b");
+  d.put(true).put((int8_t) -1).put((uint16_t) 300).put((int64_t) 1 << 40).put(1.5)
+    .put("str").put(symbol("sym")).put(bytes_view("bin", 3)).put(m).put(l);
+
+  d.rewind();
+  assert(d.next() && d.type() == PN_BOOL && d.get<bool>());
+  assert(d.next() && d.type() == PN_BYTE && d.get<int8_t>() == -1);
+  assert(d.next() && d.type() == PN_USHORT && d.get<uint16_t>() == 300);
+  // integers widen, and narrow only when the value fits
+  assert(d.get<int32_t>() == 300 && d.get<uint64_t>() == 300);
+  assert(throws(&data_ref::get<uint8_t>, d, PN_OVERFLOW));
+  assert(d.next() && d.type() == PN_LONG && d.get<int64_t>() == (int64_t) 1 << 40);
+  assert(d.next() && d.type() == PN_DOUBLE && d.get<double>() == 1.5);
+  assert(throws(&data_ref::get<bool>, d, PN_ARG_ERR));
+  assert(d.next() && d.type() == PN_STRING && d.get<std::string>() == "str");
+  assert(d.next() && d.type() == PN_SYMBOL && d.get<symbol>() == symbol("sym"));
+  assert(d.next() && d.type() == PN_BINARY && d.get<bytes_view>() == "bin");
+  assert(d.next() && d.type() == PN_MAP);
+  assert((d.get<std::map<std::string, int32_t> >() == m));
+  assert(d.next() && d.type() == PN_LIST && d.get<std::vector<std::string> >() == l);
+  assert(!d.next());
+
+  data copy;
+  assert(copy.decode(d.encode()) > 0);
+  assert(copy.value<bool>());
+}
+
+static void test_message(void)
+{
+  message msg;
+  msg.address("queue");
+  msg.subject("hello");
+  msg.durable(true);
+  msg.priority(7);
+  msg.user_id(bytes_view("user\0id", 7));
+  msg.id().assign((uint64_t) 42);
+  std::map<std::string, std::string> props;
+  props["key"] = "value";
+  msg.properties().assign(props);
+  msg.body().assign(std::string(1000, 'x'));
+
+  bytes buf = msg.encode();
+  assert(buf.size() > 1000 && buf.capacity() >= buf.size());
+
+  message decoded;
+  decoded.decode_borrowed(buf);
+  // borrowed fields are read in place in the encoded bytes
+  assert(decoded.address() == "queue");
+  assert(decoded.address().data() >= buf.data() && decoded.address().end() <= buf.data() + buf.size());
+  assert(decoded.subject() == "hello");
+  assert(decoded.durable() && decoded.priority() == 7);
+  assert(decoded.user_id() == bytes_view("user\0id", 7));
+  assert(decoded.id().value<uint64_t>() == 42);
+  assert((decoded.properties().value<std::map<std::string, std::string> >() == props));
+  assert(decoded.body().value<bytes_view>().size() == 1000);
+
+  // moving hands on the same pn_message_t
+  pn_message_t *impl = decoded.get();
+  message moved(std::move(decoded));
+  assert(moved.get() == impl && decoded.get() == 0);
+  std::vector<message> queue;
+  queue.push_back(std::move(moved));
+  assert(queue.back().get() == impl);
+
+  message copy = queue.back().copy();
+  assert(copy.get() != impl && copy.subject() == "hello");
+
+  // bytes reuse their memory across encodes
+  const char *start = buf.data();
+  copy.encode(buf);
+  assert(buf.data() == start);
+
+  try {
+    message().decode(bytes_view("garbage", 7));
+    assert(false);
+  } catch (const error &e) {
+    assert(e.code() < 0);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  test_codec();
+  test_message();
+  return 0;
+}
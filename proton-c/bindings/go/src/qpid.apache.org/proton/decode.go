@@ -0,0 +1,456 @@
+/*
+Licensed to the Apache Software Foundation (ASF) under one
+or more contributor license agreements.  See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  The ASF licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+
+package proton
+
+// #include <proton/codec.h>
+import "C"
+
+import (
+	"encoding/binary"
+	"math"
+	"unsafe"
+)
+
+//
+// Decoding the common AMQP types straight from bytes, without a pn_data_t and
+// so without a cgo call per value.
+//
+// This only ever succeeds where get would give the same result. Anything it
+// does not handle, including bad or incomplete data and values that do not
+// convert to the target, is left to the pn_data_t path to decode or report.
+//
+
+// atom is a value read from the bytes, or the elements of a list or map.
+type atom struct {
+	code  C.pn_type_t
+	i     int64   // byte, short, int, long
+	u     uint64  // bool, ubyte, ushort, uint, ulong, char
+	f     float64 // float, double
+	bytes []byte  // binary, string, symbol, the elements of a list or map
+	count int     // of a list or map
+}
+
+// fastUnmarshal decodes the value at the start of bytes into v, returning the
+// bytes it took up, or false if it is left to the pn_data_t path.
+func fastUnmarshal(bytes []byte, v interface{}) (int, bool) {
+	a, n, ok := readAtom(bytes)
+	if !ok || !store(v, &a) {
+		return 0, false
+	}
+	return n, true
+}
+
+// readAtom reads the value at the start of bytes.
+func readAtom(b []byte) (a atom, n int, ok bool) {
+	if len(b) < 1 {
+		return
+	}
+	code := b[0]
+	fixed := 0 // width of a fixed width value
+	switch code {
+	case codeTrue:
+		a.code, a.u = C.PN_BOOL, 1
+	case codeFalse:
+		a.code = C.PN_BOOL
+	case codeUint0:
+		a.code = C.PN_UINT
+	case codeUlong0:
+		a.code = C.PN_ULONG
+	case codeList0:
+		a.code = C.PN_LIST
+	case codeBoolean:
+		a.code, fixed = C.PN_BOOL, 1
+	case codeUbyte:
+		a.code, fixed = C.PN_UBYTE, 1
+	case codeByte:
+		a.code, fixed = C.PN_BYTE, 1
+	case codeSmallUint:
+		a.code, fixed = C.PN_UINT, 1
+	case codeSmallUlong:
+		a.code, fixed = C.PN_ULONG, 1
+	case codeSmallInt:
+		a.code, fixed = C.PN_INT, 1
+	case codeSmallLong:
+		a.code, fixed = C.PN_LONG, 1
+	case codeUshort:
+		a.code, fixed = C.PN_USHORT, 2
+	case codeShort:
+		a.code, fixed = C.PN_SHORT, 2
+	case codeUint:
+		a.code, fixed = C.PN_UINT, 4
+	case codeInt:
+		a.code, fixed = C.PN_INT, 4
+	case codeFloat:
+		a.code, fixed = C.PN_FLOAT, 4
+	case codeChar:
+		a.code, fixed = C.PN_CHAR, 4
+	case codeUlong:
+		a.code, fixed = C.PN_ULONG, 8
+	case codeLong:
+		a.code, fixed = C.PN_LONG, 8
+	case codeDouble:
+		a.code, fixed = C.PN_DOUBLE, 8
+	case codeBinary8, codeBinary32:
+		a.code = C.PN_BINARY
+		return readVariable(b, a)
+	case codeString8, codeString32:
+		a.code = C.PN_STRING
+		return readVariable(b, a)
+	case codeSymbol8, codeSymbol32:
+		a.code = C.PN_SYMBOL
+		return readVariable(b, a)
+	case codeList8, codeList32:
+		a.code = C.PN_LIST
+		return readCompound(b, a)
+	case codeMap8, codeMap32:
+		a.code = C.PN_MAP
+		return readCompound(b, a)
+	default:
+		return
+	}
+	if len(b) < 1+fixed {
+		return
+	}
+	switch fixed {
+	case 1:
+		a.u, a.i = uint64(b[1]), int64(int8(b[1]))
+	case 2:
+		u := binary.BigEndian.Uint16(b[1:])
+		a.u, a.i = uint64(u), int64(int16(u))
+	case 4:
+		u := binary.BigEndian.Uint32(b[1:])
+		a.u, a.i, a.f = uint64(u), int64(int32(u)), float64(math.Float32frombits(u))
+	case 8:
+		u := binary.BigEndian.Uint64(b[1:])
+		a.u, a.i, a.f = u, int64(u), math.Float64frombits(u)
+	}
+	if code == codeBoolean && a.u > 1 {
+		a.u = 1
+	}
+	return a, 1 + fixed, true
+}
+
+// readSize reads the one or four byte size or count that follows a code, by
+// whether the code's high nibble is even, 0xa, 0xc or 0xe, or odd.
+func readSize(b []byte, at int) (size int, n int, ok bool) {
+	if b[0]&0x10 == 0 {
+		if len(b) < at+1 {
+			return
+		}
+		return int(b[at]), 1, true
+	}
+	if len(b) < at+4 {
+		return
+	}
+	u := binary.BigEndian.Uint32(b[at:])
+	if uint64(u) > uint64(len(b)) {
+		return
+	}
+	return int(u), 4, true
+}
+
+func readVariable(b []byte, a atom) (atom, int, bool) {
+	size, n, ok := readSize(b, 1)
+	if !ok || len(b) < 1+n+size {
+		return a, 0, false
+	}
+	a.bytes = b[1+n : 1+n+size]
+	return a, 1 + n + size, true
+}
+
+func readCompound(b []byte, a atom) (atom, int, bool) {
+	size, n, ok := readSize(b, 1)
+	if !ok || size < n || len(b) < 1+n+size {
+		return a, 0, false
+	}
+	count, _, ok := readSize(b, 1+n)
+	if !ok {
+		return a, 0, false
+	}
+	a.count = count
+	a.bytes = b[1+2*n : 1+n+size]
+	return a, 1 + n + size, true
+}
+
+// elements reads the elements of a list or map, which must fill it exactly.
+func elements(a *atom, each func(e *atom) bool) bool {
+	b := a.bytes
+	for i := 0; i < a.count; i++ {
+		e, n, ok := readAtom(b)
+		if !ok || !each(&e) {
+			return false
+		}
+		b = b[n:]
+	}
+	return len(b) == 0
+}
+
+// signed is the value of an integer that get stores in a signed integer of
+// the given bits, or false if it does not.
+func signed(a *atom, bits uintptr) (int64, bool) {
+	switch a.code {
+	case C.PN_CHAR:
+		return int64(a.u), true
+	case C.PN_BYTE:
+		return a.i, true
+	case C.PN_SHORT:
+		return a.i, bits >= 16
+	case C.PN_INT:
+		return a.i, bits >= 32
+	case C.PN_LONG:
+		return a.i, bits >= 64
+	}
+	return 0, false
+}
+
+// unsigned is the value of an integer that get stores in an unsigned integer
+// of the given bits, or false if it does not.
+func unsigned(a *atom, bits uintptr) (uint64, bool) {
+	switch a.code {
+	case C.PN_CHAR, C.PN_UBYTE:
+		return a.u, true
+	case C.PN_USHORT:
+		return a.u, bits >= 16
+	case C.PN_UINT:
+		return a.u, bits >= 32
+	case C.PN_ULONG:
+		return a.u, bits >= 64
+	}
+	return 0, false
+}
+
+func isBytes(a *atom) bool {
+	return a.code == C.PN_STRING || a.code == C.PN_SYMBOL || a.code == C.PN_BINARY
+}
+
+// store converts a into the value v points to, as get would.
+func store(v interface{}, a *atom) (ok bool) {
+	switch v := v.(type) {
+	case *bool:
+		if ok = a.code == C.PN_BOOL; ok {
+			*v = a.u != 0
+		}
+	case *int8:
+		var i int64
+		if i, ok = signed(a, 8); ok {
+			*v = int8(i)
+		}
+	case *int16:
+		var i int64
+		if i, ok = signed(a, 16); ok {
+			*v = int16(i)
+		}
+	case *int32:
+		var i int64
+		if i, ok = signed(a, 32); ok {
+			*v = int32(i)
+		}
+	case *int64:
+		var i int64
+		if i, ok = signed(a, 64); ok {
+			*v = i
+		}
+	case *int:
+		var i int64
+		if i, ok = signed(a, 8*unsafe.Sizeof(0)); ok {
+			*v = int(i)
+		}
+	case *uint8:
+		var u uint64
+		if u, ok = unsigned(a, 8); ok {
+			*v = uint8(u)
+		}
+	case *uint16:
+		var u uint64
+		if u, ok = unsigned(a, 16); ok {
+			*v = uint16(u)
+		}
+	case *uint32:
+		var u uint64
+		if u, ok = unsigned(a, 32); ok {
+			*v = uint32(u)
+		}
+	case *uint64:
+		var u uint64
+		if u, ok = unsigned(a, 64); ok {
+			*v = u
+		}
+	case *uint:
+		var u uint64
+		if u, ok = unsigned(a, 8*unsafe.Sizeof(0)); ok {
+			*v = uint(u)
+		}
+	case *float32:
+		if ok = a.code == C.PN_FLOAT; ok {
+			*v = float32(a.f)
+		}
+	case *float64:
+		if ok = a.code == C.PN_FLOAT || a.code == C.PN_DOUBLE; ok {
+			*v = a.f
+		}
+	case *string:
+		if ok = isBytes(a); ok {
+			*v = string(a.bytes)
+		}
+	case *[]byte:
+		if ok = isBytes(a); ok {
+			*v = append([]byte{}, a.bytes...)
+		}
+	case *interface{}:
+		return storeInterface(v, a)
+	case *Map:
+		var m Map
+		if m, ok = storeMap(a); ok {
+			*v = m
+		}
+	case *map[string]interface{}:
+		if a.code != C.PN_MAP || a.count%2 != 0 {
+			return false
+		}
+		m := make(map[string]interface{}, a.count/2)
+		var key string
+		i := 0
+		ok = elements(a, func(e *atom) bool {
+			i++
+			if i%2 == 1 {
+				return store(&key, e)
+			}
+			var val interface{}
+			if !storeInterface(&val, e) {
+				return false
+			}
+			m[key] = val
+			return true
+		})
+		if ok {
+			*v = m
+		}
+	case *List:
+		var l List
+		if l, ok = storeList(a); ok {
+			*v = l
+		}
+	case *[]interface{}:
+		var l List
+		if l, ok = storeList(a); ok {
+			*v = l
+		}
+	case *[]string:
+		if a.code != C.PN_LIST {
+			return false
+		}
+		l := make([]string, a.count)
+		i := 0
+		ok = elements(a, func(e *atom) bool {
+			i++
+			return store(&l[i-1], e)
+		})
+		if ok {
+			*v = l
+		}
+	}
+	return
+}
+
+// storeInterface converts a as get would into an interface{}, by its AMQP type.
+func storeInterface(v *interface{}, a *atom) bool {
+	switch a.code {
+	case C.PN_BOOL:
+		*v = a.u != 0
+	case C.PN_UBYTE, C.PN_CHAR:
+		*v = uint8(a.u)
+	case C.PN_BYTE:
+		*v = int8(a.i)
+	case C.PN_USHORT:
+		*v = uint16(a.u)
+	case C.PN_SHORT:
+		*v = int16(a.i)
+	case C.PN_UINT:
+		*v = uint32(a.u)
+	case C.PN_INT:
+		*v = int32(a.i)
+	case C.PN_ULONG:
+		*v = a.u
+	case C.PN_LONG:
+		*v = a.i
+	case C.PN_FLOAT:
+		*v = float32(a.f)
+	case C.PN_DOUBLE:
+		*v = a.f
+	case C.PN_BINARY:
+		*v = append([]byte{}, a.bytes...)
+	case C.PN_STRING, C.PN_SYMBOL:
+		*v = string(a.bytes)
+	case C.PN_MAP:
+		m, ok := storeMap(a)
+		if !ok {
+			return false
+		}
+		*v = m
+	case C.PN_LIST:
+		l, ok := storeList(a)
+		if !ok {
+			return false
+		}
+		*v = l
+	default:
+		return false
+	}
+	return true
+}
+
+func storeMap(a *atom) (Map, bool) {
+	if a.code != C.PN_MAP || a.count%2 != 0 {
+		return nil, false
+	}
+	m := make(Map, a.count/2)
+	var key interface{}
+	i := 0
+	ok := elements(a, func(e *atom) bool {
+		i++
+		if i%2 == 1 {
+			// a key that cannot be hashed is left to get to report
+			if e.code == C.PN_BINARY || e.code == C.PN_MAP || e.code == C.PN_LIST {
+				return false
+			}
+			return storeInterface(&key, e)
+		}
+		var val interface{}
+		if !storeInterface(&val, e) {
+			return false
+		}
+		m[key] = val
+		return true
+	})
+	return m, ok
+}
+
+func storeList(a *atom) (List, bool) {
+	if a.code != C.PN_LIST {
+		return nil, false
+	}
+	l := make(List, a.count)
+	i := 0
+	ok := elements(a, func(e *atom) bool {
+		i++
+		return storeInterface(&l[i-1], e)
+	})
+	return l, ok
+}
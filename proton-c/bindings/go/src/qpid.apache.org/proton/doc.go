@@ -27,6 +27,8 @@ AMQP 1.0 compliant endpoint.
 Encoding and decoding AMQP data follows the pattern of the standard
 encoding/json and encoding/xml packages.The mapping between AMQP and Go types is
 described in the documentation of the Marshal and Unmarshal functions.
+
+An Engine exchanges messages over a single connection, see NewEngine.
 */
 package proton
 
@@ -0,0 +1,244 @@
+/*
+Licensed to the Apache Software Foundation (ASF) under one
+or more contributor license agreements.  See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  The ASF licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+
+package proton
+
+import (
+	"encoding/binary"
+	"math"
+	"unsafe"
+)
+
+//
+// Encoding the common Go types straight to bytes, without a pn_data_t and
+// so without a cgo call per value. The encoding is the one proton's own
+// encoder chooses, so either path gives the same bytes.
+//
+
+// AMQP format codes
+const (
+	codeDescribed  = 0x00
+	codeNull       = 0x40
+	codeTrue       = 0x41
+	codeFalse      = 0x42
+	codeUint0      = 0x43
+	codeUlong0     = 0x44
+	codeList0      = 0x45
+	codeUbyte      = 0x50
+	codeByte       = 0x51
+	codeSmallUint  = 0x52
+	codeSmallUlong = 0x53
+	codeSmallInt   = 0x54
+	codeSmallLong  = 0x55
+	codeBoolean    = 0x56
+	codeUshort     = 0x60
+	codeShort      = 0x61
+	codeUint       = 0x70
+	codeInt        = 0x71
+	codeFloat      = 0x72
+	codeChar       = 0x73
+	codeUlong      = 0x80
+	codeLong       = 0x81
+	codeDouble     = 0x82
+	codeBinary8    = 0xa0
+	codeString8    = 0xa1
+	codeSymbol8    = 0xa3
+	codeBinary32   = 0xb0
+	codeString32   = 0xb1
+	codeSymbol32   = 0xb3
+	codeList8      = 0xc0
+	codeMap8       = 0xc1
+	codeList32     = 0xd0
+	codeMap32      = 0xd1
+)
+
+/*
+MarshalAppend appends the AMQP encoding of v to bytes and returns the extended
+slice. Types are converted as for Marshal.
+
+Booleans, numbers, strings, []byte, and Map, List, map[string]interface{},
+[]interface{} and []string holding them are encoded directly into bytes, so
+encoding into a reused buffer does not allocate. Other types are encoded through
+the proton C library.
+*/
+func MarshalAppend(bytes []byte, v interface{}) ([]byte, error) {
+	if out, ok := appendValue(bytes, v); ok {
+		return out, nil
+	}
+	encoded, err := marshalData(make([]byte, minEncode), v)
+	if err != nil {
+		return bytes, err
+	}
+	return append(bytes, encoded...), nil
+}
+
+// appendValue appends the encoding of v to bytes, returning false if v is
+// not, or holds something that is not, one of the types encoded here.
+func appendValue(bytes []byte, v interface{}) ([]byte, bool) {
+	switch v := v.(type) {
+	case bool:
+		if v {
+			return append(bytes, codeTrue), true
+		}
+		return append(bytes, codeFalse), true
+	case int8:
+		return append(bytes, codeByte, byte(v)), true
+	case int16:
+		return appendUint16(append(bytes, codeShort), uint16(v)), true
+	case int32:
+		return appendInt(bytes, v), true
+	case int64:
+		return appendLong(bytes, v), true
+	case int:
+		if unsafe.Sizeof(0) == 8 {
+			return appendLong(bytes, int64(v)), true
+		}
+		return appendInt(bytes, int32(v)), true
+	case uint8:
+		return append(bytes, codeUbyte, v), true
+	case uint16:
+		return appendUint16(append(bytes, codeUshort), v), true
+	case uint32:
+		return appendUint(bytes, v), true
+	case uint64:
+		return appendUlong(bytes, v), true
+	case uint:
+		if unsafe.Sizeof(0) == 8 {
+			return appendUlong(bytes, uint64(v)), true
+		}
+		return appendUint(bytes, uint32(v)), true
+	case float32:
+		return appendUint32(append(bytes, codeFloat), math.Float32bits(v)), true
+	case float64:
+		return appendUint64(append(bytes, codeDouble), math.Float64bits(v)), true
+	case string:
+		return appendString(bytes, codeString8, codeString32, v), true
+	case []byte:
+		if len(v) < 256 {
+			return append(append(bytes, codeBinary8, byte(len(v))), v...), true
+		}
+		return append(appendUint32(append(bytes, codeBinary32), uint32(len(v))), v...), true
+	case Map:
+		start, bytes := startCompound(bytes, codeMap32)
+		for key, val := range v {
+			var ok bool
+			if bytes, ok = appendValue(bytes, key); !ok {
+				return bytes, false
+			}
+			if bytes, ok = appendValue(bytes, val); !ok {
+				return bytes, false
+			}
+		}
+		return endCompound(bytes, start, 2*len(v)), true
+	case map[string]interface{}:
+		start, bytes := startCompound(bytes, codeMap32)
+		for key, val := range v {
+			bytes = appendString(bytes, codeString8, codeString32, key)
+			var ok bool
+			if bytes, ok = appendValue(bytes, val); !ok {
+				return bytes, false
+			}
+		}
+		return endCompound(bytes, start, 2*len(v)), true
+	case List:
+		return appendList(bytes, v)
+	case []interface{}:
+		return appendList(bytes, v)
+	case []string:
+		start, bytes := startCompound(bytes, codeList32)
+		for _, s := range v {
+			bytes = appendString(bytes, codeString8, codeString32, s)
+		}
+		return endCompound(bytes, start, len(v)), true
+	}
+	return bytes, false
+}
+
+func appendList(bytes []byte, l []interface{}) ([]byte, bool) {
+	start, bytes := startCompound(bytes, codeList32)
+	for _, v := range l {
+		var ok bool
+		if bytes, ok = appendValue(bytes, v); !ok {
+			return bytes, false
+		}
+	}
+	return endCompound(bytes, start, len(l)), true
+}
+
+// startCompound appends the code of a list or map and room for its size and
+// count, returning where they go.
+func startCompound(bytes []byte, code byte) (int, []byte) {
+	bytes = append(bytes, code)
+	return len(bytes), append(bytes, 0, 0, 0, 0, 0, 0, 0, 0)
+}
+
+// endCompound fills in the size and count of the list or map at start.
+func endCompound(bytes []byte, start int, count int) []byte {
+	binary.BigEndian.PutUint32(bytes[start:], uint32(len(bytes)-start-4))
+	binary.BigEndian.PutUint32(bytes[start+4:], uint32(count))
+	return bytes
+}
+
+func appendInt(bytes []byte, i int32) []byte {
+	if -128 <= i && i <= 127 {
+		return append(bytes, codeSmallInt, byte(i))
+	}
+	return appendUint32(append(bytes, codeInt), uint32(i))
+}
+
+func appendLong(bytes []byte, l int64) []byte {
+	if -128 <= l && l <= 127 {
+		return append(bytes, codeSmallLong, byte(l))
+	}
+	return appendUint64(append(bytes, codeLong), uint64(l))
+}
+
+func appendUint(bytes []byte, u uint32) []byte {
+	if u < 256 {
+		return append(bytes, codeSmallUint, byte(u))
+	}
+	return appendUint32(append(bytes, codeUint), u)
+}
+
+func appendUlong(bytes []byte, u uint64) []byte {
+	if u < 256 {
+		return append(bytes, codeSmallUlong, byte(u))
+	}
+	return appendUint64(append(bytes, codeUlong), u)
+}
+
+func appendString(bytes []byte, code8 byte, code32 byte, s string) []byte {
+	if len(s) < 256 {
+		return append(append(bytes, code8, byte(len(s))), s...)
+	}
+	return append(appendUint32(append(bytes, code32), uint32(len(s))), s...)
+}
+
+func appendUint16(bytes []byte, u uint16) []byte {
+	return append(bytes, byte(u>>8), byte(u))
+}
+
+func appendUint32(bytes []byte, u uint32) []byte {
+	return append(bytes, byte(u>>24), byte(u>>16), byte(u>>8), byte(u))
+}
+
+func appendUint64(bytes []byte, u uint64) []byte {
+	return append(bytes, byte(u>>56), byte(u>>48), byte(u>>40), byte(u>>32),
+		byte(u>>24), byte(u>>16), byte(u>>8), byte(u))
+}
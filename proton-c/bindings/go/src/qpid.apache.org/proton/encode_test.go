@@ -0,0 +1,187 @@
+/*
+Licensed to the Apache Software Foundation (ASF) under one
+or more contributor license agreements.  See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  The ASF licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+
+// Test that the Go encoding and decoding agree with proton's.
+package proton
+
+import (
+	"bytes"
+	"math"
+	"reflect"
+	"strings"
+	"testing"
+)
+
+// Values with one encoding, so maps have at most one entry
+var fastValues = []interface{}{
+	true, false,
+	int8(-128), int8(127), int16(-300), int32(-129), int32(-128), int32(127), int32(128),
+	int64(math.MinInt64), int64(-1), int64(200), -5, 1 << 40,
+	uint8(255), uint16(65535), uint32(255), uint32(256), uint64(0), uint64(1 << 63), uint(7),
+	float32(0.125), math.Inf(-1),
+	"", "abc", strings.Repeat("x", 255), strings.Repeat("y", 256),
+	[]byte{}, []byte("bin\000ary"), bytes.Repeat([]byte("z"), 300),
+	Map{}, Map{"one": int32(1)}, Map{int64(2): List{"two", Map{true: uint8(1)}}},
+	map[string]interface{}{"key": []string{"a", "b"}},
+	List{}, List{int32(32), "foo", true, List{float32(1.5)}},
+	[]interface{}{uint16(1), []byte("b")},
+	[]string{strings.Repeat("s", 1000)},
+}
+
+func TestEncodeSameAsProton(t *testing.T) {
+	for _, v := range fastValues {
+		got, ok := appendValue(nil, v)
+		if !ok {
+			t.Errorf("%#v not encoded in Go", v)
+			continue
+		}
+		want, err := marshalData(make([]byte, minEncode), v)
+		assertNil(err)
+		if !bytes.Equal(want, got) {
+			t.Errorf("%#v: %x != %x", v, got, want)
+		}
+	}
+}
+
+func TestDecodeSameAsProton(t *testing.T) {
+	for _, v := range fastValues {
+		encoded, err := Marshal(v)
+		assertNil(err)
+		// into the value's own type and into an interface{}
+		for _, target := range []reflect.Type{reflect.TypeOf(v), reflect.TypeOf((*interface{})(nil)).Elem()} {
+			got := reflect.New(target)
+			n, ok := fastUnmarshal(encoded, got.Interface())
+			if target.Kind() != reflect.Interface && !ok {
+				t.Errorf("%#v not decoded in Go", v)
+				continue
+			}
+			if !ok {
+				continue
+			}
+			want := reflect.New(target)
+			assertEqual(len(encoded), n)
+			assertEqual(len(encoded), unmarshalData(encoded, want.Interface()))
+			assertEqual(want.Interface(), got.Interface())
+		}
+	}
+}
+
+func TestDecodeCompatible(t *testing.T) {
+	// Go decodes what get decodes, and leaves what get refuses
+	encoded, err := Marshal(List{uint8(1), int16(-2), uint32(3), int32(-4), "five"})
+	assertNil(err)
+	var l List
+	_, err = Unmarshal(encoded, &l)
+	assertNil(err)
+	for _, target := range []interface{}{new(int8), new(uint8), new(int16), new(uint16),
+		new(int32), new(uint32), new(int64), new(uint64), new(int), new(uint),
+		new(float32), new(float64), new(string), new([]byte), new(bool)} {
+		for _, v := range l {
+			encoded, _ := Marshal(v)
+			want := reflect.New(reflect.TypeOf(target).Elem()).Interface()
+			_, wantErr := func() (n int, err error) {
+				defer doRecover(&err)
+				return unmarshalData(encoded, want), nil
+			}()
+			_, ok := fastUnmarshal(encoded, target)
+			if ok != (wantErr == nil) {
+				t.Errorf("%T from %#v: Go %v, proton %v", target, v, ok, wantErr)
+			} else if ok {
+				assertEqual(want, target)
+			}
+		}
+	}
+}
+
+func TestDecodeLeftToProton(t *testing.T) {
+	// incomplete, bad or unusual data is left to the pn_data_t path
+	encoded, _ := Marshal(List{int32(1), "two"})
+	for i := 0; i < len(encoded); i++ {
+		var l List
+		if _, ok := fastUnmarshal(encoded[:i], &l); ok {
+			t.Errorf("decoded %d of %d bytes", i, len(encoded))
+		}
+	}
+	var i interface{}
+	if _, ok := fastUnmarshal([]byte{codeNull}, &i); ok {
+		t.Error("decoded null")
+	}
+	// a binary key is left to get, which cannot hash it
+	encoded, _ = marshalData(make([]byte, minEncode), Map{"k": "v"})
+	encoded[9] = codeBinary8
+	if _, ok := fastUnmarshal(encoded, &i); ok {
+		t.Error("decoded a binary key")
+	}
+}
+
+func TestMarshalAppend(t *testing.T) {
+	buf := []byte("prefix")
+	buf, err := MarshalAppend(buf, "foo")
+	assertNil(err)
+	// a typed map goes through proton
+	buf, err = MarshalAppend(buf, map[int32]string{1: "one"})
+	assertNil(err)
+	d := NewDecoder(bytes.NewReader(buf[len("prefix"):]))
+	var s string
+	var m map[int32]string
+	assertNil(d.Decode(&s))
+	assertNil(d.Decode(&m))
+	assertEqual("foo", s)
+	assertEqual(map[int32]string{1: "one"}, m)
+
+	_, err = MarshalAppend(nil, complex(1, 1))
+	if err == nil || !strings.Contains(err.Error(), "cannot marshal") {
+		t.Error(err)
+	}
+}
+
+var benchValue = map[string]interface{}{
+	"id": "message-id-1234", "priority": int32(4), "durable": true,
+	"body": []byte(strings.Repeat("x", 100)), "tags": []string{"a", "b", "c"},
+}
+
+func BenchmarkMarshalAppend(b *testing.B) {
+	buf := make([]byte, 0, 1024)
+	for i := 0; i < b.N; i++ {
+		buf, _ = MarshalAppend(buf[:0], benchValue)
+	}
+}
+
+func BenchmarkMarshalData(b *testing.B) {
+	buf := make([]byte, 1024)
+	for i := 0; i < b.N; i++ {
+		marshalData(buf, benchValue)
+	}
+}
+
+func BenchmarkUnmarshal(b *testing.B) {
+	encoded, _ := Marshal(benchValue)
+	for i := 0; i < b.N; i++ {
+		var m map[string]interface{}
+		Unmarshal(encoded, &m)
+	}
+}
+
+func BenchmarkUnmarshalData(b *testing.B) {
+	encoded, _ := Marshal(benchValue)
+	for i := 0; i < b.N; i++ {
+		var m map[string]interface{}
+		unmarshalData(encoded, &m)
+	}
+}
@@ -0,0 +1,807 @@
+/*
+Licensed to the Apache Software Foundation (ASF) under one
+or more contributor license agreements.  See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  The ASF licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+
+package proton
+
+// #include <stdlib.h>
+// #include <proton/engine.h>
+// #include <proton/message.h>
+// #include <proton/transport.h>
+import "C"
+
+import (
+	"encoding/binary"
+	"fmt"
+	"net"
+	"os"
+	"sync/atomic"
+	"time"
+	"unsafe"
+)
+
+//
+// Running an AMQP connection over a net.Conn.
+//
+// Proton is not thread safe, so each connection's proton objects belong to
+// the goroutine running its Engine, and other goroutines reach them through
+// Inject. The socket is read and written by two more goroutines, which wait in
+// Go's netpoller rather than holding an OS thread, and hand the bytes to and
+// from the transport over channels. Proton is only ever called to do work, so
+// many thousands of connections cost goroutines, not threads.
+//
+
+// Credit a Receiver keeps open when none is asked for, and that links the peer
+// opens are given.
+const defaultCapacity = 100
+
+// Size of the buffer each connection reads into.
+const ioSize = 64 * 1024
+
+// Disposition is the outcome of a delivery, as the receiver settled it.
+type Disposition uint64
+
+const (
+	Accepted Disposition = C.PN_ACCEPTED
+	Rejected Disposition = C.PN_REJECTED
+	Released Disposition = C.PN_RELEASED
+	Modified Disposition = C.PN_MODIFIED
+)
+
+func (d Disposition) String() string {
+	switch d {
+	case Accepted:
+		return "accepted"
+	case Rejected:
+		return "rejected"
+	case Released:
+		return "released"
+	case Modified:
+		return "modified"
+	}
+	return fmt.Sprintf("disposition(%#x)", uint64(d))
+}
+
+// Outcome is what became of a message sent: its disposition, or the error
+// that stopped it being settled.
+type Outcome struct {
+	Disposition Disposition
+	Error       error
+}
+
+// Message is an AMQP message: where it is sent and its body, which is
+// converted as for Marshal and Unmarshal.
+type Message struct {
+	Address string
+	Body    interface{}
+}
+
+var containers int64
+
+// Engine runs one AMQP connection over a net.Conn.
+type Engine struct {
+	conn       net.Conn
+	connection *C.pn_connection_t
+	transport  *C.pn_transport_t
+	collector  *C.pn_collector_t
+	session    *C.pn_session_t
+	message    *C.pn_message_t
+	encoded    []byte
+
+	inject    chan func()
+	input     chan []byte
+	inputDone chan struct{}
+	output    chan []byte
+	written   chan error
+	outbuf    []byte // taken from the transport, to be written
+	staged    bool   // outbuf is waiting to be handed to write
+	writing   bool   // write has outbuf
+	done      chan struct{}
+	err       error
+
+	links    map[*C.pn_link_t]interface{} // *Sender or *Receiver
+	incoming []interface{}                // links the peer opened, not yet taken
+	accept   chan interface{}
+	names    int
+}
+
+// NewEngine returns an engine for a connection over conn, as the server end
+// if server is true. Run it to exchange messages over it.
+func NewEngine(conn net.Conn, server bool) (*Engine, error) {
+	e := &Engine{
+		conn:       conn,
+		connection: C.pn_connection(),
+		transport:  C.pn_transport(),
+		collector:  C.pn_collector(),
+		message:    C.pn_message(),
+		encoded:    make([]byte, minEncode),
+		inject:     make(chan func()),
+		input:      make(chan []byte),
+		inputDone:  make(chan struct{}),
+		output:     make(chan []byte),
+		written:    make(chan error, 1),
+		outbuf:     make([]byte, ioSize),
+		done:       make(chan struct{}),
+		links:      make(map[*C.pn_link_t]interface{}),
+		accept:     make(chan interface{}),
+	}
+	if e.connection == nil || e.transport == nil || e.collector == nil || e.message == nil {
+		e.free()
+		return nil, errorf("cannot allocate a connection")
+	}
+	if server {
+		C.pn_transport_set_server(e.transport)
+	}
+	container := C.CString(fmt.Sprintf("go-%d-%d", os.Getpid(), atomic.AddInt64(&containers, 1)))
+	C.pn_connection_set_container(e.connection, container)
+	C.free(unsafe.Pointer(container))
+	C.pn_connection_collect(e.connection, e.collector)
+	if C.pn_transport_bind(e.transport, e.connection) != 0 {
+		e.free()
+		return nil, errorf("cannot bind the transport")
+	}
+	if !server {
+		C.pn_connection_open(e.connection)
+	}
+	return e, nil
+}
+
+func (e *Engine) free() {
+	if e.transport != nil {
+		C.pn_transport_unbind(e.transport)
+		C.pn_transport_free(e.transport)
+	}
+	if e.connection != nil {
+		C.pn_connection_free(e.connection)
+	}
+	if e.collector != nil {
+		C.pn_collector_free(e.collector)
+	}
+	if e.message != nil {
+		C.pn_message_free(e.message)
+	}
+}
+
+// Run runs the connection until it is closed, and returns the error that
+// closed it, if any.
+func (e *Engine) Run() error {
+	go e.read()
+	go e.write()
+	input := e.input
+	timer := time.NewTimer(time.Hour)
+	// until the last of the output is written too
+	for !bool(C.pn_transport_closed(e.transport)) || e.staged || e.writing {
+		e.process()
+		output := e.flush()
+		var accept chan<- interface{}
+		var link interface{}
+		if len(e.incoming) > 0 {
+			accept, link = e.accept, e.incoming[0]
+		}
+		e.tick(timer)
+		select {
+		case bytes, ok := <-input:
+			if ok {
+				e.push(bytes)
+				e.inputDone <- struct{}{}
+			} else {
+				input = nil
+				// unless the peer's close already closed it
+				if C.pn_transport_capacity(e.transport) >= 0 {
+					C.pn_transport_close_tail(e.transport)
+				}
+			}
+		case output <- e.outbuf:
+			e.staged, e.writing = false, true
+		case err := <-e.written:
+			e.writing = false
+			if err != nil {
+				// and stop reading too
+				e.fail(err)
+				C.pn_transport_close_head(e.transport)
+				e.conn.Close()
+			}
+		case f := <-e.inject:
+			f()
+		case accept <- link:
+			e.incoming = e.incoming[1:]
+		case <-timer.C:
+		}
+	}
+	timer.Stop()
+	if e.err == nil {
+		e.err = transportError(e.transport)
+	}
+	e.conn.Close()
+	close(e.done)
+	e.closeLinks(e.stopped())
+	e.free()
+	return e.err
+}
+
+// Done is closed once the engine has stopped.
+func (e *Engine) Done() <-chan struct{} {
+	return e.done
+}
+
+// Error is the error that stopped the engine, once it is Done.
+func (e *Engine) Error() error {
+	<-e.done
+	return e.err
+}
+
+// Inject runs f in the engine's goroutine, which owns the connection's proton
+// objects, and returns at once. It fails if the engine has stopped.
+func (e *Engine) Inject(f func()) error {
+	select {
+	case e.inject <- f:
+		return nil
+	case <-e.done:
+		return e.stopped()
+	}
+}
+
+// injectWait runs f in the engine's goroutine and waits for it.
+func (e *Engine) injectWait(f func() error) error {
+	result := make(chan error, 1)
+	if err := e.Inject(func() { result <- f() }); err != nil {
+		return err
+	}
+	select {
+	case err := <-result:
+		return err
+	case <-e.done:
+		return e.stopped()
+	}
+}
+
+// Close closes the connection, with err as its error condition if it is not
+// nil. Run returns once the peer has closed it too.
+func (e *Engine) Close(err error) {
+	e.Inject(func() {
+		if err != nil {
+			setCondition(C.pn_connection_condition(e.connection), err)
+		}
+		C.pn_connection_close(e.connection)
+	})
+}
+
+// Incoming returns the links that the peer opens, as a *Sender for a link
+// that the peer receives from or a *Receiver for one it sends to. They are
+// opened with this end's terminus the same as the peer's.
+func (e *Engine) Incoming() <-chan interface{} {
+	return e.accept
+}
+
+// Sender opens a link for sending messages to address.
+func (e *Engine) Sender(address string) (s *Sender, err error) {
+	err = e.injectWait(func() error {
+		link := e.newLink(func(s *C.pn_session_t, n *C.char) *C.pn_link_t { return C.pn_sender(s, n) }, "sender")
+		setAddress(C.pn_link_target(link), address)
+		s = e.newSender(link)
+		C.pn_link_open(link)
+		return nil
+	})
+	return
+}
+
+// Receiver opens a link for receiving messages from address, with credit
+// for capacity messages that have not been received yet.
+func (e *Engine) Receiver(address string, capacity int) (r *Receiver, err error) {
+	if capacity <= 0 {
+		capacity = defaultCapacity
+	}
+	err = e.injectWait(func() error {
+		link := e.newLink(func(s *C.pn_session_t, n *C.char) *C.pn_link_t { return C.pn_receiver(s, n) }, "receiver")
+		setAddress(C.pn_link_source(link), address)
+		r = e.newReceiver(link, capacity)
+		C.pn_link_open(link)
+		return nil
+	})
+	return
+}
+
+func (e *Engine) stopped() error {
+	if e.err != nil {
+		return e.err
+	}
+	return errorf("connection closed")
+}
+
+func (e *Engine) fail(err error) {
+	if e.err == nil {
+		e.err = err
+	}
+}
+
+func (e *Engine) defaultSession() *C.pn_session_t {
+	if e.session == nil {
+		e.session = C.pn_session(e.connection)
+		C.pn_session_open(e.session)
+	}
+	return e.session
+}
+
+// newLink returns a new link, of a kind made by newFn, with a new name.
+func (e *Engine) newLink(newFn func(*C.pn_session_t, *C.char) *C.pn_link_t, kind string) *C.pn_link_t {
+	e.names++
+	name := C.CString(fmt.Sprintf("%s-%d", kind, e.names))
+	defer C.free(unsafe.Pointer(name))
+	return newFn(e.defaultSession(), name)
+}
+
+// read hands what it reads from the socket to Run, and closes the input at
+// the end.
+func (e *Engine) read() {
+	buf := make([]byte, ioSize)
+	for {
+		n, err := e.conn.Read(buf)
+		if n > 0 {
+			select {
+			case e.input <- buf[:n]:
+				<-e.inputDone
+			case <-e.done:
+				return
+			}
+		}
+		if err != nil {
+			close(e.input)
+			return
+		}
+	}
+}
+
+// write writes what Run hands it to the socket.
+func (e *Engine) write() {
+	for {
+		select {
+		case bytes := <-e.output:
+			_, err := e.conn.Write(bytes)
+			e.written <- err
+		case <-e.done:
+			return
+		}
+	}
+}
+
+// push gives the transport the bytes read.
+func (e *Engine) push(bytes []byte) {
+	for len(bytes) > 0 {
+		n := int(C.pn_transport_push(e.transport, (*C.char)(unsafe.Pointer(&bytes[0])), C.size_t(len(bytes))))
+		if n <= 0 {
+			// the transport has closed its input, the rest is not wanted
+			return
+		}
+		bytes = bytes[n:]
+	}
+}
+
+// flush takes the transport's output to be written, unless a write is under
+// way, and returns the channel to hand it over on, or nil if there is none.
+func (e *Engine) flush() chan<- []byte {
+	if e.writing {
+		return nil
+	}
+	if e.staged {
+		return e.output
+	}
+	pending := int(C.pn_transport_pending(e.transport))
+	if pending < 0 {
+		if tcp, ok := e.conn.(*net.TCPConn); ok {
+			tcp.CloseWrite()
+		}
+		return nil
+	}
+	if pending == 0 {
+		return nil
+	}
+	if pending > cap(e.outbuf) {
+		e.outbuf = make([]byte, pending)
+	}
+	e.outbuf = e.outbuf[:pending]
+	copy(e.outbuf, (*[1 << 30]byte)(unsafe.Pointer(C.pn_transport_head(e.transport)))[:pending:pending])
+	C.pn_transport_pop(e.transport, C.size_t(pending))
+	e.staged = true
+	return e.output
+}
+
+// tick lets the transport check its idle timeouts, and sets timer for when it
+// next needs to.
+func (e *Engine) tick(timer *time.Timer) {
+	now := time.Now().UnixNano() / int64(time.Millisecond)
+	deadline := int64(C.pn_transport_tick(e.transport, C.pn_timestamp_t(now)))
+	if deadline > 0 {
+		timer.Reset(time.Duration(deadline-now) * time.Millisecond)
+	}
+}
+
+// process handles the events the connection has collected.
+func (e *Engine) process() {
+	for {
+		event := C.pn_collector_peek(e.collector)
+		if event == nil {
+			return
+		}
+		switch C.pn_event_type(event) {
+		case C.PN_CONNECTION_REMOTE_OPEN:
+			if C.pn_connection_state(e.connection)&C.PN_LOCAL_UNINIT != 0 {
+				C.pn_connection_open(e.connection)
+			}
+		case C.PN_CONNECTION_REMOTE_CLOSE:
+			e.fail(conditionError(C.pn_connection_remote_condition(e.connection)))
+			C.pn_connection_close(e.connection)
+		case C.PN_SESSION_REMOTE_OPEN:
+			session := C.pn_event_session(event)
+			if C.pn_session_state(session)&C.PN_LOCAL_UNINIT != 0 {
+				C.pn_session_open(session)
+			}
+		case C.PN_SESSION_REMOTE_CLOSE:
+			C.pn_session_close(C.pn_event_session(event))
+		case C.PN_LINK_REMOTE_OPEN:
+			e.remoteOpen(C.pn_event_link(event))
+		case C.PN_LINK_REMOTE_CLOSE:
+			link := C.pn_event_link(event)
+			e.closeLink(link, conditionError(C.pn_link_remote_condition(link)))
+			C.pn_link_close(link)
+		case C.PN_LINK_FLOW:
+			if s, ok := e.links[C.pn_event_link(event)].(*Sender); ok {
+				s.flush()
+			}
+		case C.PN_DELIVERY:
+			delivery := C.pn_event_delivery(event)
+			switch l := e.links[C.pn_delivery_link(delivery)].(type) {
+			case *Sender:
+				l.settled(delivery)
+			case *Receiver:
+				l.deliver(delivery)
+			}
+		case C.PN_TRANSPORT_ERROR:
+			e.fail(transportError(e.transport))
+		}
+		C.pn_collector_pop(e.collector)
+	}
+}
+
+// remoteOpen opens a link that the peer opened, to be taken from Incoming.
+func (e *Engine) remoteOpen(link *C.pn_link_t) {
+	if C.pn_link_state(link)&C.PN_LOCAL_UNINIT == 0 {
+		return
+	}
+	C.pn_terminus_copy(C.pn_link_source(link), C.pn_link_remote_source(link))
+	C.pn_terminus_copy(C.pn_link_target(link), C.pn_link_remote_target(link))
+	if bool(C.pn_link_is_sender(link)) {
+		e.incoming = append(e.incoming, e.newSender(link))
+	} else {
+		e.incoming = append(e.incoming, e.newReceiver(link, defaultCapacity))
+	}
+	C.pn_link_open(link)
+}
+
+func (e *Engine) closeLink(link *C.pn_link_t, err error) {
+	if err == nil {
+		err = errorf("link closed")
+	}
+	switch l := e.links[link].(type) {
+	case *Sender:
+		l.close(err)
+	case *Receiver:
+		l.close(err)
+	}
+	delete(e.links, link)
+}
+
+func (e *Engine) closeLinks(err error) {
+	for link := range e.links {
+		e.closeLink(link, err)
+	}
+}
+
+// encode encodes m with the engine's pn_message_t, into bytes that are valid
+// until the next call.
+func (e *Engine) encode(m *Message) ([]byte, error) {
+	C.pn_message_clear(e.message)
+	if m.Address != "" {
+		address := C.CString(m.Address)
+		C.pn_message_set_address(e.message, address)
+		C.free(unsafe.Pointer(address))
+	}
+	if m.Body != nil {
+		body, err := Marshal(m.Body)
+		if err != nil {
+			return nil, err
+		}
+		if n := C.pn_data_decode(C.pn_message_body(e.message), (*C.char)(unsafe.Pointer(&body[0])), C.size_t(len(body))); n < 0 {
+			return nil, errorf("encode body: %s", pnErrorName(int(n)))
+		}
+	}
+	for {
+		size := C.size_t(len(e.encoded))
+		err := int(C.pn_message_encode(e.message, (*C.char)(unsafe.Pointer(&e.encoded[0])), &size))
+		if err == int(C.PN_OVERFLOW) && int(size) > len(e.encoded) {
+			e.encoded = make([]byte, size)
+			continue
+		}
+		if err != 0 {
+			return nil, errorf("encode message: %s", pnErrorName(err))
+		}
+		return e.encoded[:size], nil
+	}
+}
+
+// decode decodes bytes into a Message with the engine's pn_message_t.
+func (e *Engine) decode(bytes []byte) (m Message, err error) {
+	if len(bytes) == 0 {
+		return m, errorf("empty message")
+	}
+	if n := C.pn_message_decode(e.message, (*C.char)(unsafe.Pointer(&bytes[0])), C.size_t(len(bytes))); n != 0 {
+		return m, errorf("decode message: %s", pnErrorName(int(n)))
+	}
+	if address := C.pn_message_get_address(e.message); address != nil {
+		m.Address = C.GoString(address)
+	}
+	body := C.pn_message_body(e.message)
+	C.pn_data_rewind(body)
+	if size := int(C.pn_data_encoded_size(body)); size > 0 {
+		if size > len(e.encoded) {
+			e.encoded = make([]byte, size)
+		}
+		n := int(C.pn_data_encode(body, (*C.char)(unsafe.Pointer(&e.encoded[0])), C.size_t(size)))
+		if n < 0 {
+			return m, errorf("decode body: %s", pnErrorName(n))
+		}
+		_, err = Unmarshal(e.encoded[:n], &m.Body)
+	}
+	return
+}
+
+// Sender is a link that sends messages.
+type Sender struct {
+	engine *Engine
+	link   *C.pn_link_t
+	queue  []sending                           // waiting for credit
+	sent   map[*C.pn_delivery_t]chan<- Outcome // waiting to be settled
+	tag    uint64
+	err    error
+}
+
+type sending struct {
+	bytes   []byte
+	outcome chan<- Outcome
+}
+
+func (e *Engine) newSender(link *C.pn_link_t) *Sender {
+	s := &Sender{engine: e, link: link, sent: make(map[*C.pn_delivery_t]chan<- Outcome)}
+	e.links[link] = s
+	return s
+}
+
+// Send sends m, as soon as the link has credit for it, and returns a channel
+// that gets its outcome once the receiver settles it. Messages wait in the
+// engine until they have credit, so a sender that outruns its receiver should
+// wait for outcomes.
+func (s *Sender) Send(m Message) (<-chan Outcome, error) {
+	outcome := make(chan Outcome, 1)
+	err := s.engine.injectWait(func() error {
+		if s.err != nil {
+			return s.err
+		}
+		bytes, err := s.engine.encode(&m)
+		if err != nil {
+			return err
+		}
+		s.queue = append(s.queue, sending{append([]byte(nil), bytes...), outcome})
+		s.flush()
+		return nil
+	})
+	if err != nil {
+		return nil, err
+	}
+	return outcome, nil
+}
+
+// flush sends what the link has credit for.
+func (s *Sender) flush() {
+	for len(s.queue) > 0 && C.pn_link_credit(s.link) > 0 {
+		m := s.queue[0]
+		s.queue[0] = sending{}
+		s.queue = s.queue[1:]
+		var tag [8]byte
+		s.tag++
+		binary.BigEndian.PutUint64(tag[:], s.tag)
+		delivery := C.pn_delivery(s.link, C.pn_dtag((*C.char)(unsafe.Pointer(&tag[0])), 8))
+		if len(m.bytes) > 0 {
+			C.pn_link_send(s.link, (*C.char)(unsafe.Pointer(&m.bytes[0])), C.size_t(len(m.bytes)))
+		}
+		C.pn_link_advance(s.link)
+		s.sent[delivery] = m.outcome
+	}
+}
+
+// settled reports the outcome of a delivery the receiver has settled.
+func (s *Sender) settled(delivery *C.pn_delivery_t) {
+	if !bool(C.pn_delivery_settled(delivery)) {
+		return
+	}
+	if outcome, ok := s.sent[delivery]; ok {
+		outcome <- Outcome{Disposition: Disposition(C.pn_delivery_remote_state(delivery))}
+		delete(s.sent, delivery)
+	}
+	C.pn_delivery_settle(delivery)
+}
+
+func (s *Sender) close(err error) {
+	s.err = err
+	for _, m := range s.queue {
+		m.outcome <- Outcome{Error: err}
+	}
+	s.queue = nil
+	for delivery, outcome := range s.sent {
+		outcome <- Outcome{Error: err}
+		delete(s.sent, delivery)
+	}
+}
+
+// Close closes the link.
+func (s *Sender) Close() error {
+	return s.engine.injectWait(func() error {
+		C.pn_link_close(s.link)
+		s.engine.closeLink(s.link, nil)
+		return nil
+	})
+}
+
+// Receiver is a link that receives messages.
+type Receiver struct {
+	engine   *Engine
+	link     *C.pn_link_t
+	messages chan *Received
+	overflow []*Received // delivered beyond the credit given
+	err      error
+}
+
+// Received is a message received, to be settled with Accept, Reject or
+// Release.
+type Received struct {
+	Message  Message
+	receiver *Receiver
+	delivery *C.pn_delivery_t
+}
+
+func (e *Engine) newReceiver(link *C.pn_link_t, capacity int) *Receiver {
+	r := &Receiver{engine: e, link: link, messages: make(chan *Received, capacity)}
+	e.links[link] = r
+	C.pn_link_flow(link, C.int(capacity))
+	return r
+}
+
+// Receive waits for the next message, and gives the link credit for another.
+func (r *Receiver) Receive() (*Received, error) {
+	m, ok := <-r.messages
+	if !ok {
+		return nil, r.err
+	}
+	r.engine.Inject(func() {
+		if r.err != nil {
+			return
+		}
+		if len(r.overflow) > 0 {
+			r.messages <- r.overflow[0]
+			r.overflow = r.overflow[1:]
+		} else {
+			C.pn_link_flow(r.link, 1)
+		}
+	})
+	return m, nil
+}
+
+// deliver hands a delivery to Receive once all of it has arrived.
+func (r *Receiver) deliver(delivery *C.pn_delivery_t) {
+	if !bool(C.pn_delivery_readable(delivery)) || bool(C.pn_delivery_partial(delivery)) {
+		return
+	}
+	bytes := make([]byte, int(C.pn_delivery_pending(delivery)))
+	if len(bytes) > 0 {
+		C.pn_link_recv(r.link, (*C.char)(unsafe.Pointer(&bytes[0])), C.size_t(len(bytes)))
+	}
+	C.pn_link_advance(r.link)
+	m, err := r.engine.decode(bytes)
+	if err != nil {
+		// nobody could make sense of it
+		setCondition(C.pn_disposition_condition(C.pn_delivery_local(delivery)), err)
+		C.pn_delivery_update(delivery, C.PN_REJECTED)
+		C.pn_delivery_settle(delivery)
+		C.pn_link_flow(r.link, 1)
+		return
+	}
+	received := &Received{m, r, delivery}
+	select {
+	case r.messages <- received:
+	default:
+		r.overflow = append(r.overflow, received)
+	}
+}
+
+func (r *Receiver) close(err error) {
+	if r.err == nil {
+		r.err = err
+		close(r.messages)
+	}
+}
+
+// Close closes the link. Messages already received can still be settled.
+func (r *Receiver) Close() error {
+	return r.engine.injectWait(func() error {
+		C.pn_link_close(r.link)
+		r.engine.closeLink(r.link, nil)
+		return nil
+	})
+}
+
+// Accept settles the message as accepted.
+func (m *Received) Accept() error {
+	return m.settle(Accepted)
+}
+
+// Reject settles the message as rejected.
+func (m *Received) Reject() error {
+	return m.settle(Rejected)
+}
+
+// Release settles the message as released, for it to be sent again.
+func (m *Received) Release() error {
+	return m.settle(Released)
+}
+
+func (m *Received) settle(d Disposition) error {
+	return m.receiver.engine.Inject(func() {
+		C.pn_delivery_update(m.delivery, C.uint64_t(d))
+		C.pn_delivery_settle(m.delivery)
+	})
+}
+
+func setAddress(terminus *C.pn_terminus_t, address string) {
+	if address != "" {
+		cAddress := C.CString(address)
+		C.pn_terminus_set_address(terminus, cAddress)
+		C.free(unsafe.Pointer(cAddress))
+	}
+}
+
+func setCondition(condition *C.pn_condition_t, err error) {
+	name := C.CString("amqp:internal-error")
+	description := C.CString(err.Error())
+	C.pn_condition_set_name(condition, name)
+	C.pn_condition_set_description(condition, description)
+	C.free(unsafe.Pointer(name))
+	C.free(unsafe.Pointer(description))
+}
+
+func conditionError(condition *C.pn_condition_t) error {
+	if !bool(C.pn_condition_is_set(condition)) {
+		return nil
+	}
+	description := C.pn_condition_get_description(condition)
+	if description == nil {
+		return errorf("%s", C.GoString(C.pn_condition_get_name(condition)))
+	}
+	return errorf("%s: %s", C.GoString(C.pn_condition_get_name(condition)), C.GoString(description))
+}
+
+func transportError(transport *C.pn_transport_t) error {
+	return conditionError(C.pn_transport_condition(transport))
+}
@@ -0,0 +1,187 @@
+/*
+Licensed to the Apache Software Foundation (ASF) under one
+or more contributor license agreements.  See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  The ASF licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+
+// Test connections between engines.
+package proton
+
+import (
+	"fmt"
+	"net"
+	"sync"
+	"testing"
+)
+
+// engines returns a client and a server engine connected to each other,
+// already running.
+func engines(t testing.TB, tcp bool) (client *Engine, server *Engine) {
+	var c, s net.Conn
+	if tcp {
+		l, err := net.Listen("tcp", "127.0.0.1:0")
+		assertNil(err)
+		defer l.Close()
+		c, err = net.Dial("tcp", l.Addr().String())
+		assertNil(err)
+		s, err = l.Accept()
+		assertNil(err)
+	} else {
+		c, s = net.Pipe()
+	}
+	client, err := NewEngine(c, false)
+	assertNil(err)
+	server, err = NewEngine(s, true)
+	assertNil(err)
+	go client.Run()
+	go server.Run()
+	return
+}
+
+func TestEngineSend(t *testing.T) {
+	client, server := engines(t, true)
+	s, err := client.Sender("queue")
+	assertNil(err)
+	var outcomes []<-chan Outcome
+	for i := 0; i < 1000; i++ {
+		outcome, err := s.Send(Message{Body: Map{"n": int64(i), "s": fmt.Sprint(i)}})
+		assertNil(err)
+		outcomes = append(outcomes, outcome)
+	}
+
+	r := (<-server.Incoming()).(*Receiver)
+	for i := 0; i < 1000; i++ {
+		m, err := r.Receive()
+		assertNil(err)
+		assertEqual(Map{"n": int64(i), "s": fmt.Sprint(i)}, m.Message.Body)
+		if i == 7 {
+			assertNil(m.Reject())
+		} else {
+			assertNil(m.Accept())
+		}
+	}
+	for i, outcome := range outcomes {
+		o := <-outcome
+		assertNil(o.Error)
+		if i == 7 {
+			assertEqual(Rejected, o.Disposition)
+		} else {
+			assertEqual(Accepted, o.Disposition)
+		}
+	}
+
+	client.Close(nil)
+	assertNil(client.Error())
+	assertNil(server.Error())
+	if _, err := s.Send(Message{Body: "late"}); err == nil {
+		t.Error("sent on a closed connection")
+	}
+}
+
+func TestEngineReceive(t *testing.T) {
+	client, server := engines(t, false)
+	r, err := client.Receiver("topic", 2)
+	assertNil(err)
+	s := (<-server.Incoming()).(*Sender)
+	var outcomes []<-chan Outcome
+	for i := 0; i < 10; i++ {
+		outcome, err := s.Send(Message{Address: "topic", Body: int32(i)})
+		assertNil(err)
+		outcomes = append(outcomes, outcome)
+	}
+	for i := 0; i < 10; i++ {
+		m, err := r.Receive()
+		assertNil(err)
+		assertEqual(Message{Address: "topic", Body: int32(i)}, m.Message)
+		assertNil(m.Release())
+	}
+	for _, outcome := range outcomes {
+		assertEqual(Outcome{Disposition: Released}, <-outcome)
+	}
+
+	// closing the link ends the receiver
+	assertNil(s.Close())
+	if _, err := r.Receive(); err == nil {
+		t.Error("received on a closed link")
+	}
+	server.Close(fmt.Errorf("bye"))
+	<-client.Done()
+	<-server.Done()
+	if err := client.Error(); err == nil || err.Error() != "proton: amqp:internal-error: bye" {
+		t.Error(err)
+	}
+}
+
+func TestEngineMany(t *testing.T) {
+	// many connections at once, each its own goroutines
+	var wg sync.WaitGroup
+	for c := 0; c < 500; c++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			client, server := engines(t, false)
+			s, err := client.Sender("")
+			assertNil(err)
+			var outcomes []<-chan Outcome
+			for i := 0; i < 10; i++ {
+				outcome, err := s.Send(Message{Body: "hello"})
+				assertNil(err)
+				outcomes = append(outcomes, outcome)
+			}
+			r := (<-server.Incoming()).(*Receiver)
+			for i := 0; i < 10; i++ {
+				m, err := r.Receive()
+				assertNil(err)
+				m.Accept()
+			}
+			for _, outcome := range outcomes {
+				assertEqual(Outcome{Disposition: Accepted}, <-outcome)
+			}
+			client.Close(nil)
+			assertNil(client.Error())
+		}()
+	}
+	wg.Wait()
+}
+
+func BenchmarkEngine(b *testing.B) {
+	client, server := engines(b, true)
+	s, _ := client.Sender("queue")
+	r := (<-server.Incoming()).(*Receiver)
+	done := make(chan struct{})
+	go func() {
+		for i := 0; i < b.N; i++ {
+			m, _ := r.Receive()
+			m.Accept()
+		}
+		close(done)
+	}()
+	outcomes := make(chan (<-chan Outcome), 1000)
+	go func() {
+		for outcome := range outcomes {
+			<-outcome
+		}
+	}()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		outcome, _ := s.Send(Message{Body: "message"})
+		outcomes <- outcome
+	}
+	<-done
+	close(outcomes)
+	client.Close(nil)
+	client.Error()
+}
@@ -61,6 +61,9 @@ Go types are encoded as follows
  |List                                 |list, may have mixed types  values          |
  +-------------------------------------+--------------------------------------------+
 
+The common types, see MarshalAppend, are encoded in Go; the rest go through a
+proton pn_data_t.
+
 TODO types
 
 Go: array, slice, struct
@@ -74,26 +77,34 @@ func Marshal(v interface{}) (bytes []byte, err error) {
 	return marshal(make([]byte, minEncode), v)
 }
 
+// marshal encodes v into bytesIn if it fits, otherwise into a new slice.
 func marshal(bytesIn []byte, v interface{}) (bytes []byte, err error) {
+	if bytes, ok := appendValue(bytesIn[:0], v); ok {
+		return bytes, nil
+	}
+	return marshalData(bytesIn, v)
+}
+
+// marshalData encodes v through a pn_data_t, for the types or values that
+// appendValue does not encode itself.
+func marshalData(bytesIn []byte, v interface{}) (bytes []byte, err error) {
 	defer doRecover(&err)
 	data := C.pn_data(0)
 	defer C.pn_data_free(data)
 	put(data, v)
-	// FIXME aconway 2015-03-11: get size from proton.
-	bytes = bytesIn
-	for {
-		n := int(C.pn_data_encode(data, (*C.char)(unsafe.Pointer(&bytes[0])), C.size_t(cap(bytes))))
-		if n != int(C.PN_EOS) {
-			if n < 0 {
-				err = errorf(pnErrorName(n))
-			} else {
-				bytes = bytes[0:n]
-			}
-			return
-		}
-		bytes = make([]byte, cap(bytes)*2)
+	size := int(C.pn_data_encoded_size(data))
+	if size < 0 {
+		return nil, errorf(pnErrorName(size))
 	}
-	return
+	bytes = bytesIn[:cap(bytesIn)]
+	if len(bytes) < size || len(bytes) == 0 {
+		bytes = make([]byte, size+1)
+	}
+	n := int(C.pn_data_encode(data, (*C.char)(unsafe.Pointer(&bytes[0])), C.size_t(len(bytes))))
+	if n < 0 {
+		return nil, errorf(pnErrorName(n))
+	}
+	return bytes[0:n], nil
 }
 
 func put(data *C.pn_data_t, v interface{}) {
@@ -68,11 +68,9 @@ func (d *Decoder) Buffered() io.Reader {
 //
 func (d *Decoder) Decode(v interface{}) (err error) {
 	defer doRecover(&err)
-	data := C.pn_data(0)
-	defer C.pn_data_free(data)
 	var n int
 	for n == 0 && err == nil {
-		n = unmarshal(data, d.buffer.Bytes(), v)
+		n = unmarshal(d.buffer.Bytes(), v)
 		if n == 0 { // n == 0 means not enough data, read more
 			err = d.more()
 			if err != nil {
@@ -141,9 +139,7 @@ Go: array, struct.
 */
 func Unmarshal(bytes []byte, v interface{}) (n int, err error) {
 	defer doRecover(&err)
-	data := C.pn_data(0)
-	defer C.pn_data_free(data)
-	n = unmarshal(data, bytes, v)
+	n = unmarshal(bytes, v)
 	if n == 0 {
 		err = errorf("not enough data")
 	}
@@ -167,9 +163,23 @@ func (d *Decoder) more() error {
 // unmarshal decodes from bytes and converts into the value pointed to by v.
 // Used by Unmarshal and Decode
 //
+// The common types are decoded in Go, see fastUnmarshal, and everything else
+// through a pn_data_t.
+//
 // Returns the number of bytes decoded or 0 if not enough data.
 //
-func unmarshal(data *C.pn_data_t, bytes []byte, v interface{}) (n int) {
+func unmarshal(bytes []byte, v interface{}) (n int) {
+	if n, ok := fastUnmarshal(bytes, v); ok {
+		return n
+	}
+	return unmarshalData(bytes, v)
+}
+
+// unmarshalData decodes through a pn_data_t, for the types or values that
+// fastUnmarshal does not decode itself.
+func unmarshalData(bytes []byte, v interface{}) (n int) {
+	data := C.pn_data(0)
+	defer C.pn_data_free(data)
 	n = decode(data, bytes)
 	if n == 0 {
 		return 0
@@ -282,6 +292,8 @@ func get(data *C.pn_data_t, v interface{}) {
 			*v = uint64(C.pn_data_get_ubyte(data))
 		case C.PN_USHORT:
 			*v = uint64(C.pn_data_get_ushort(data))
+		case C.PN_UINT:
+			*v = uint64(C.pn_data_get_uint(data))
 		case C.PN_ULONG:
 			*v = uint64(C.pn_data_get_ulong(data))
 		default:
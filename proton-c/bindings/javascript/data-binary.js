@@ -97,17 +97,22 @@ Data['Binary'] = function(value, start) { // Data.Binary Constructor.
         if (Data.isArray(value) ||
             (hasArrayBuffer && value instanceof ArrayBuffer) || 
             (value.buffer && hasArrayBuffer && value.buffer instanceof ArrayBuffer)) {
-            value = new Uint8Array(value);
+            if (hasArrayBuffer && value instanceof ArrayBuffer) {
+                value = new Uint8Array(value); // A view, not a copy.
+            } else if (value.BYTES_PER_ELEMENT === 1) {
+                // A view of the bytes of a byte sized TypedArray, not a copy.
+                value = new Uint8Array(value.buffer, value.byteOffset, value.length);
+            } else if (!Data.isArray(value)) {
+                value = new Uint8Array(value); // Converts each element to a byte.
+            }
             size = value.length;
             start = _malloc(size); // Allocate storage from emscripten heap.
             Module['HEAPU8'].set(value, start); // Copy the data to the emscripten heap.
         } else if (Data.isString(value)) { // Create Binary from native string
-            value = unescape(encodeURIComponent(value)); // Create a C-like UTF representation.
+            value = intArrayFromString(value, true); // UTF-8 bytes, true means don't add NULL.
             size = value.length;
             start = _malloc(size); // Allocate storage from emscripten heap.
-            for (var i = 0; i < size; i++) {
-                setValue(start + i, value.charCodeAt(i), 'i8', 1);
-            }
+            Module['HEAPU8'].set(value, start); // Copy the bytes in one go.
         } else { // Create unpopulated Binary of specified size.
             // If the type is not a number by this point then an unrecognised data
             // type has been passed so we create a zero length Binary.
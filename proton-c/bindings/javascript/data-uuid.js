@@ -39,11 +39,7 @@
 Data['Uuid'] = function(u) { // Data.Uuid Constructor.
     // Helper to copy from emscriptem allocated storage into JavaScript Array.
     function _p2a(p) {
-        var uuid = new Array(16);
-        for (var i = 0; i < 16; i++) {
-            uuid[i] = getValue(p + i, 'i8') & 0xFF; // & 0xFF converts to unsigned.
-        }
-        return uuid;
+        return Array.prototype.slice.call(Module['HEAPU8'].subarray(p, p + 16));
     };
 
     if (!u) { // Generate UUID using emscriptem's uuid_generate implementation.
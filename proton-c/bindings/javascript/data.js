@@ -363,21 +363,16 @@ _Data_['type'] = function() {
  * @returns {proton.Data.Binary} a representation of the data encoded in AMQP format.
  */
 _Data_['encode'] = function() {
-    var size = 1024;
-    while (true) {
-        var bytes = _malloc(size); // Allocate storage from emscripten heap.
-        var cd = _pn_data_encode(this._data, bytes, size);
-
-        if (cd === Module['Error']['OVERFLOW']) {
-            _free(bytes);
-            size *= 2;
-        } else if (cd >= 0) {
-            return new Data['Binary'](cd, bytes);
-        } else {
-            _free(bytes);
-            this._check(cd);
-            return;
-        }
+    // Size the buffer exactly, so the data is encoded once however big it is.
+    var size = this._check(_pn_data_encoded_size(this._data));
+    var bytes = _malloc(size ? size : 1); // Allocate storage from emscripten heap.
+    var cd = _pn_data_encode(this._data, bytes, size);
+    if (cd >= 0) {
+        return new Data['Binary'](cd, bytes);
+    } else {
+        _free(bytes);
+        this._check(cd);
+        return;
     }
 };
 
@@ -399,8 +394,10 @@ _Data_['decode'] = function(encoded) {
     var consumed = this._check(_pn_data_decode(this._data, start, size));
 
     size = size - consumed;
-    start = _malloc(size); // Allocate storage from emscripten heap.
-    _memcpy(start, encoded.start + consumed, size);
+    if (size > 0) { // Only copy when there is a remainder.
+        start = _malloc(size); // Allocate storage from emscripten heap.
+        _memcpy(start, encoded.start + consumed, size);
+    }
 
     encoded['free'](); // Free the original Binary.
     return size > 0 ? new Data['Binary'](size, start) : null;
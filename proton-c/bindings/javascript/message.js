@@ -804,8 +804,7 @@ _Message_['encode'] = function() {
         var size = getValue(sizeptr, 'i32'); // Dereference the real size value;
 
         if (err === Module['Error']['OVERFLOW']) {
-            _free(bytes);
-            size *= 2;
+            _free(bytes); // size is now the size needed, so retry just the once.
         } else if (err >= 0) {
             // Tidy up the memory that we allocated on emscripten's stack.
             Runtime.stackRestore(sp);
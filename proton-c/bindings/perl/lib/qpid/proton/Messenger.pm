@@ -179,6 +179,19 @@ sub put {
     return $tracker;
 }
 
+# Puts each hash in the array ref as a message, which is quicker than
+# putting Message objects one at a time. See perl.i for the keys a hash
+# may hold. Returns the number of messages put.
+sub put_batch {
+    my ($self) = @_;
+    my $impl = $self->{_impl};
+    my $hashes = $_[1];
+
+    my $rc = cproton_perl::pn_messenger_put_hashes($impl, $hashes);
+    qpid::proton::check_for_error($rc, $self);
+    return $rc;
+}
+
 sub get_outgoing_tracker {
     my ($self) = @_;
     my $impl = $self->{_impl};
@@ -210,6 +223,19 @@ sub get {
     return $tracker;
 }
 
+# Gets up to n messages, returning a hash for each, which is quicker
+# than getting Message objects one at a time.
+sub get_batch {
+    my ($self) = @_;
+    my $impl = $self->{_impl};
+    my $n = $_[1] || 1;
+    my @hashes;
+
+    my $rc = cproton_perl::pn_messenger_get_hashes($impl, $n, \@hashes);
+    qpid::proton::check_for_error($rc, $self) unless $rc == $cproton_perl::PN_EOS;
+    return @hashes;
+}
+
 sub get_incoming_tracker {
     my ($self) = @_;
     my $impl = $self->{_impl};
@@ -210,4 +210,227 @@ ssize_t pn_transport_input(pn_transport_t *transport, char *STRING, size_t LENGT
 %}
 %ignore pn_delivery_tag;
 
+// Moves whole messages between hashes and the messenger in one call,
+// rather than one call per field. A hash may hold address, subject,
+// reply_to, content_type, content_encoding, group_id, reply_to_group_id,
+// id, correlation_id, durable, priority, ttl, properties, instructions,
+// annotations and body; values are typed as Message->set_body does.
+%{
+  static int pni_perl_put(pn_data_t *data, SV *sv) {
+    if (!sv || !SvOK(sv)) {
+      return pn_data_put_null(data);
+    } else if (SvROK(sv) && SvTYPE(SvRV(sv)) == SVt_PVHV) {
+      HV *hv = (HV *) SvRV(sv);
+      HE *he;
+      int err = pn_data_put_map(data);
+      if (err) return err;
+      pn_data_enter(data);
+      hv_iterinit(hv);
+      while (!err && (he = hv_iternext(hv))) {
+        I32 len;
+        char *key = hv_iterkey(he, &len);
+        err = pn_data_put_string(data, pn_bytes(len, key));
+        if (!err) err = pni_perl_put(data, hv_iterval(hv, he));
+      }
+      pn_data_exit(data);
+      return err;
+    } else if (SvROK(sv) && SvTYPE(SvRV(sv)) == SVt_PVAV) {
+      AV *av = (AV *) SvRV(sv);
+      I32 i;
+      int err = pn_data_put_list(data);
+      if (err) return err;
+      pn_data_enter(data);
+      for (i = 0; !err && i <= av_len(av); i++) {
+        SV **item = av_fetch(av, i, 0);
+        err = pni_perl_put(data, item ? *item : NULL);
+      }
+      pn_data_exit(data);
+      return err;
+    } else if (SvNIOK(sv)) {
+      NV nv = SvNV(sv);
+      if (!SvIOK(sv) && nv != (NV)(IV) nv) {
+        return pn_data_put_float(data, nv);
+      }
+      IV iv = SvIV(sv);
+      if (iv >= INT32_MIN && iv <= INT32_MAX) {
+        return pn_data_put_int(data, iv);
+      }
+      return pn_data_put_long(data, iv);
+    } else {
+      STRLEN len;
+      char *ptr = SvPV(sv, len);
+      return pn_data_put_string(data, pn_bytes(len, ptr));
+    }
+  }
+
+  static SV *pni_perl_get(pn_data_t *data) {
+    switch (pn_data_type(data)) {
+    case PN_BOOL: return newSViv(pn_data_get_bool(data));
+    case PN_UBYTE: return newSVuv(pn_data_get_ubyte(data));
+    case PN_BYTE: return newSViv(pn_data_get_byte(data));
+    case PN_USHORT: return newSVuv(pn_data_get_ushort(data));
+    case PN_SHORT: return newSViv(pn_data_get_short(data));
+    case PN_UINT: return newSVuv(pn_data_get_uint(data));
+    case PN_INT: return newSViv(pn_data_get_int(data));
+    case PN_CHAR: return newSVuv(pn_data_get_char(data));
+    case PN_ULONG: return newSVuv(pn_data_get_ulong(data));
+    case PN_LONG: return newSViv(pn_data_get_long(data));
+    case PN_TIMESTAMP: return newSViv(pn_data_get_timestamp(data));
+    case PN_FLOAT: return newSVnv(pn_data_get_float(data));
+    case PN_DOUBLE: return newSVnv(pn_data_get_double(data));
+    case PN_BINARY:
+    case PN_STRING:
+    case PN_SYMBOL: {
+      pn_bytes_t bytes = pn_data_get_bytes(data);
+      return newSVpvn(bytes.start, bytes.size);
+    }
+    case PN_LIST: {
+      size_t count = pn_data_get_list(data);
+      AV *av = newAV();
+      pn_data_enter(data);
+      while (count-- && pn_data_next(data)) {
+        av_push(av, pni_perl_get(data));
+      }
+      pn_data_exit(data);
+      return newRV_noinc((SV *) av);
+    }
+    case PN_MAP: {
+      size_t count = pn_data_get_map(data) / 2;
+      HV *hv = newHV();
+      pn_data_enter(data);
+      while (count-- && pn_data_next(data)) {
+        SV *key = pni_perl_get(data);
+        SV *value = pn_data_next(data) ? pni_perl_get(data) : newSV(0);
+        hv_store_ent(hv, key, value, 0);
+        SvREFCNT_dec(key);
+      }
+      pn_data_exit(data);
+      return newRV_noinc((SV *) hv);
+    }
+    default:
+      return newSV(0);
+    }
+  }
+
+  static const char *pni_perl_string(HV *hv, const char *key) {
+    SV **sv = hv_fetch(hv, key, strlen(key), 0);
+    return sv && SvOK(*sv) ? SvPV_nolen(*sv) : NULL;
+  }
+
+  static int pni_perl_data(pn_data_t *data, HV *hv, const char *key) {
+    SV **sv = hv_fetch(hv, key, strlen(key), 0);
+    pn_data_clear(data);
+    return sv && SvOK(*sv) ? pni_perl_put(data, *sv) : 0;
+  }
+
+  static int pni_perl_fill(pn_message_t *msg, HV *hv) {
+    SV **sv;
+    int err;
+    pn_message_set_address(msg, pni_perl_string(hv, "address"));
+    pn_message_set_subject(msg, pni_perl_string(hv, "subject"));
+    pn_message_set_reply_to(msg, pni_perl_string(hv, "reply_to"));
+    pn_message_set_content_type(msg, pni_perl_string(hv, "content_type"));
+    pn_message_set_content_encoding(msg, pni_perl_string(hv, "content_encoding"));
+    pn_message_set_group_id(msg, pni_perl_string(hv, "group_id"));
+    pn_message_set_reply_to_group_id(msg, pni_perl_string(hv, "reply_to_group_id"));
+    if ((sv = hv_fetch(hv, "durable", 7, 0))) pn_message_set_durable(msg, SvTRUE(*sv));
+    if ((sv = hv_fetch(hv, "priority", 8, 0))) pn_message_set_priority(msg, SvUV(*sv));
+    if ((sv = hv_fetch(hv, "ttl", 3, 0))) pn_message_set_ttl(msg, SvUV(*sv));
+    if ((err = pni_perl_data(pn_message_id(msg), hv, "id"))) return err;
+    if ((err = pni_perl_data(pn_message_correlation_id(msg), hv, "correlation_id"))) return err;
+    if ((err = pni_perl_data(pn_message_properties(msg), hv, "properties"))) return err;
+    if ((err = pni_perl_data(pn_message_instructions(msg), hv, "instructions"))) return err;
+    if ((err = pni_perl_data(pn_message_annotations(msg), hv, "annotations"))) return err;
+    return pni_perl_data(pn_message_body(msg), hv, "body");
+  }
+
+  static void pni_perl_store_string(HV *hv, const char *key, const char *value) {
+    if (value) hv_store(hv, key, strlen(key), newSVpv(value, 0), 0);
+  }
+
+  static void pni_perl_store_data(HV *hv, const char *key, pn_data_t *data) {
+    pn_data_rewind(data);
+    if (pn_data_next(data)) hv_store(hv, key, strlen(key), pni_perl_get(data), 0);
+  }
+
+  static SV *pni_perl_hash(pn_message_t *msg) {
+    HV *hv = newHV();
+    pni_perl_store_string(hv, "address", pn_message_get_address(msg));
+    pni_perl_store_string(hv, "subject", pn_message_get_subject(msg));
+    pni_perl_store_string(hv, "reply_to", pn_message_get_reply_to(msg));
+    pni_perl_store_string(hv, "content_type", pn_message_get_content_type(msg));
+    pni_perl_store_string(hv, "content_encoding", pn_message_get_content_encoding(msg));
+    pni_perl_store_string(hv, "group_id", pn_message_get_group_id(msg));
+    pni_perl_store_string(hv, "reply_to_group_id", pn_message_get_reply_to_group_id(msg));
+    hv_store(hv, "durable", 7, newSViv(pn_message_is_durable(msg)), 0);
+    hv_store(hv, "priority", 8, newSVuv(pn_message_get_priority(msg)), 0);
+    hv_store(hv, "ttl", 3, newSVuv(pn_message_get_ttl(msg)), 0);
+    pni_perl_store_data(hv, "id", pn_message_id(msg));
+    pni_perl_store_data(hv, "correlation_id", pn_message_correlation_id(msg));
+    pni_perl_store_data(hv, "properties", pn_message_properties(msg));
+    pni_perl_store_data(hv, "instructions", pn_message_instructions(msg));
+    pni_perl_store_data(hv, "annotations", pn_message_annotations(msg));
+    pni_perl_store_data(hv, "body", pn_message_body(msg));
+    return newRV_noinc((SV *) hv);
+  }
+%}
+
+%inline %{
+  // puts each hash in the array ref as a message, see pn_messenger_put_batch
+  int pn_messenger_put_hashes(pn_messenger_t *messenger, SV *hashes) {
+    AV *av;
+    pn_message_t **msgs;
+    size_t i, n;
+    int err = 0;
+
+    if (!SvROK(hashes) || SvTYPE(SvRV(hashes)) != SVt_PVAV) return PN_ARG_ERR;
+    av = (AV *) SvRV(hashes);
+    n = av_len(av) + 1;
+    if (!n) return 0;
+    msgs = (pn_message_t **) malloc(n * sizeof(pn_message_t *));
+    for (i = 0; i < n; i++) {
+      SV **item = av_fetch(av, i, 0);
+      msgs[i] = pn_message();
+      if (!err) {
+        if (!item || !SvROK(*item) || SvTYPE(SvRV(*item)) != SVt_PVHV) {
+          err = PN_ARG_ERR;
+        } else {
+          err = pni_perl_fill(msgs[i], (HV *) SvRV(*item));
+        }
+      }
+    }
+    if (!err) err = pn_messenger_put_batch(messenger, msgs, n);
+    for (i = 0; i < n; i++) {
+      pn_message_free(msgs[i]);
+    }
+    free(msgs);
+    return err;
+  }
+
+  // gets up to n messages, pushing a hash for each onto the array ref, see
+  // pn_messenger_get_batch
+  int pn_messenger_get_hashes(pn_messenger_t *messenger, int n, SV *hashes) {
+    AV *av;
+    pn_message_t **msgs;
+    int i, got;
+
+    if (n <= 0) return 0;
+    if (!SvROK(hashes) || SvTYPE(SvRV(hashes)) != SVt_PVAV) return PN_ARG_ERR;
+    av = (AV *) SvRV(hashes);
+    msgs = (pn_message_t **) malloc(n * sizeof(pn_message_t *));
+    for (i = 0; i < n; i++) {
+      msgs[i] = pn_message();
+    }
+    got = pn_messenger_get_batch(messenger, msgs, n);
+    for (i = 0; i < got; i++) {
+      av_push(av, pni_perl_hash(msgs[i]));
+    }
+    for (i = 0; i < n; i++) {
+      pn_message_free(msgs[i]);
+    }
+    free(msgs);
+    return got;
+  }
+%}
+
 %include "proton/cproton.i"
@@ -127,3 +127,11 @@ $messenger->set_incoming_window($incoming_window);
 ok($messenger->get_incoming_window() == int($incoming_window),
    'Incoming window can be positive');
 
+
+# batches
+ok($messenger->put_batch([]) == 0, 'An empty batch puts nothing');
+
+{
+    my @hashes = $messenger->get_batch(10);
+    ok(scalar(@hashes) == 0, 'Nothing is got from an empty queue');
+}
@@ -241,4 +241,298 @@ ssize_t pn_sasl_send(pn_sasl_t *sasl, char *STRING, size_t LENGTH);
     zval_copy_ctor($result);
 }
 
+//
+// whole messages to and from arrays in one call, rather than one call per field
+//
+// An array may hold address, subject, reply_to, content_type,
+// content_encoding, group_id, reply_to_group_id, id, correlation_id,
+// durable, priority, ttl, properties, instructions, annotations and body.
+// Null, booleans, integers, doubles, strings and arrays (as maps) are
+// converted as Data::put_object does; objects such as Binary or Symbol are
+// refused with PN_ARG_ERR, and binary and symbols are got as plain strings.
+//
+%{
+  static int pni_php_put(pn_data_t *data, zval *zv) {
+    switch (Z_TYPE_P(zv)) {
+    case IS_NULL: return pn_data_put_null(data);
+    case IS_BOOL: return pn_data_put_bool(data, Z_BVAL_P(zv));
+    case IS_LONG: return pn_data_put_long(data, Z_LVAL_P(zv));
+    case IS_DOUBLE: return pn_data_put_double(data, Z_DVAL_P(zv));
+    case IS_STRING: return pn_data_put_string(data, pn_bytes(Z_STRLEN_P(zv), Z_STRVAL_P(zv)));
+    case IS_ARRAY: {
+      HashTable *ht = Z_ARRVAL_P(zv);
+      HashPosition pos;
+      zval **entry;
+      int err = pn_data_put_map(data);
+      if (err) return err;
+      pn_data_enter(data);
+      zend_hash_internal_pointer_reset_ex(ht, &pos);
+      while (!err && zend_hash_get_current_data_ex(ht, (void **) &entry, &pos) == SUCCESS) {
+        char *key;
+        uint key_len;
+        ulong index;
+        if (zend_hash_get_current_key_ex(ht, &key, &key_len, &index, 0, &pos) == HASH_KEY_IS_STRING) {
+          err = pn_data_put_string(data, pn_bytes(key_len - 1, key));
+        } else {
+          err = pn_data_put_long(data, index);
+        }
+        if (!err) err = pni_php_put(data, *entry);
+        zend_hash_move_forward_ex(ht, &pos);
+      }
+      pn_data_exit(data);
+      return err;
+    }
+    default:
+      return PN_ARG_ERR;
+    }
+  }
+
+  static zval *pni_php_get(pn_data_t *data) {
+    zval *zv;
+    MAKE_STD_ZVAL(zv);
+    switch (pn_data_type(data)) {
+    case PN_BOOL: ZVAL_BOOL(zv, pn_data_get_bool(data)); break;
+    case PN_UBYTE: ZVAL_LONG(zv, pn_data_get_ubyte(data)); break;
+    case PN_BYTE: ZVAL_LONG(zv, pn_data_get_byte(data)); break;
+    case PN_USHORT: ZVAL_LONG(zv, pn_data_get_ushort(data)); break;
+    case PN_SHORT: ZVAL_LONG(zv, pn_data_get_short(data)); break;
+    case PN_UINT: ZVAL_LONG(zv, pn_data_get_uint(data)); break;
+    case PN_INT: ZVAL_LONG(zv, pn_data_get_int(data)); break;
+    case PN_CHAR: ZVAL_LONG(zv, pn_data_get_char(data)); break;
+    case PN_ULONG: ZVAL_LONG(zv, pn_data_get_ulong(data)); break;
+    case PN_LONG: ZVAL_LONG(zv, pn_data_get_long(data)); break;
+    case PN_TIMESTAMP: ZVAL_LONG(zv, pn_data_get_timestamp(data)); break;
+    case PN_FLOAT: ZVAL_DOUBLE(zv, pn_data_get_float(data)); break;
+    case PN_DOUBLE: ZVAL_DOUBLE(zv, pn_data_get_double(data)); break;
+    case PN_BINARY:
+    case PN_STRING:
+    case PN_SYMBOL: {
+      pn_bytes_t bytes = pn_data_get_bytes(data);
+      ZVAL_STRINGL(zv, bytes.start, bytes.size, 1);
+      break;
+    }
+    case PN_LIST: {
+      size_t count = pn_data_get_list(data);
+      array_init(zv);
+      pn_data_enter(data);
+      while (count-- && pn_data_next(data)) {
+        add_next_index_zval(zv, pni_php_get(data));
+      }
+      pn_data_exit(data);
+      break;
+    }
+    case PN_MAP: {
+      size_t count = pn_data_get_map(data) / 2;
+      array_init(zv);
+      pn_data_enter(data);
+      while (count-- && pn_data_next(data)) {
+        // as get_php_map does, string keys stay strings and the rest are indexes
+        zval *key = pni_php_get(data);
+        zval *value;
+        if (pn_data_next(data)) {
+          value = pni_php_get(data);
+        } else {
+          MAKE_STD_ZVAL(value);
+          ZVAL_NULL(value);
+        }
+        switch (Z_TYPE_P(key)) {
+        case IS_STRING:
+          add_assoc_zval_ex(zv, Z_STRVAL_P(key), Z_STRLEN_P(key) + 1, value);
+          break;
+        case IS_DOUBLE:
+          add_index_zval(zv, (long) Z_DVAL_P(key), value);
+          break;
+        case IS_LONG:
+        case IS_BOOL:
+          add_index_zval(zv, Z_LVAL_P(key), value);
+          break;
+        default:
+          add_assoc_zval_ex(zv, "", 1, value);
+          break;
+        }
+        zval_ptr_dtor(&key);
+      }
+      pn_data_exit(data);
+      break;
+    }
+    default:
+      ZVAL_NULL(zv);
+      break;
+    }
+    return zv;
+  }
+
+  static zval *pni_php_find(HashTable *ht, const char *key) {
+    zval **zv;
+    if (zend_hash_find(ht, key, strlen(key) + 1, (void **) &zv) == SUCCESS && Z_TYPE_PP(zv) != IS_NULL) {
+      return *zv;
+    }
+    return NULL;
+  }
+
+  // converts a copy, leaving the caller's array as it was
+  static void pni_php_set_string(pn_message_t *msg, int (*set)(pn_message_t *, const char *),
+                                 HashTable *ht, const char *key) {
+    zval *zv = pni_php_find(ht, key);
+    zval tmp;
+    if (!zv) {
+      set(msg, NULL);
+    } else if (Z_TYPE_P(zv) == IS_STRING) {
+      set(msg, Z_STRVAL_P(zv));
+    } else {
+      tmp = *zv;
+      zval_copy_ctor(&tmp);
+      convert_to_string(&tmp);
+      set(msg, Z_STRVAL(tmp));
+      zval_dtor(&tmp);
+    }
+  }
+
+  static long pni_php_long(zval *zv) {
+    zval tmp;
+    if (Z_TYPE_P(zv) == IS_LONG) return Z_LVAL_P(zv);
+    tmp = *zv;
+    zval_copy_ctor(&tmp);
+    convert_to_long(&tmp);
+    return Z_LVAL(tmp);
+  }
+
+  static int pni_php_data(pn_data_t *data, HashTable *ht, const char *key) {
+    zval *zv = pni_php_find(ht, key);
+    pn_data_clear(data);
+    return zv ? pni_php_put(data, zv) : 0;
+  }
+
+  static int pni_php_fill(pn_message_t *msg, HashTable *ht) {
+    zval *zv;
+    int err;
+    pni_php_set_string(msg, pn_message_set_address, ht, "address");
+    pni_php_set_string(msg, pn_message_set_subject, ht, "subject");
+    pni_php_set_string(msg, pn_message_set_reply_to, ht, "reply_to");
+    pni_php_set_string(msg, pn_message_set_content_type, ht, "content_type");
+    pni_php_set_string(msg, pn_message_set_content_encoding, ht, "content_encoding");
+    pni_php_set_string(msg, pn_message_set_group_id, ht, "group_id");
+    pni_php_set_string(msg, pn_message_set_reply_to_group_id, ht, "reply_to_group_id");
+    if ((zv = pni_php_find(ht, "durable"))) pn_message_set_durable(msg, zend_is_true(zv));
+    if ((zv = pni_php_find(ht, "priority"))) pn_message_set_priority(msg, pni_php_long(zv));
+    if ((zv = pni_php_find(ht, "ttl"))) pn_message_set_ttl(msg, pni_php_long(zv));
+    if ((err = pni_php_data(pn_message_id(msg), ht, "id"))) return err;
+    if ((err = pni_php_data(pn_message_correlation_id(msg), ht, "correlation_id"))) return err;
+    if ((err = pni_php_data(pn_message_properties(msg), ht, "properties"))) return err;
+    if ((err = pni_php_data(pn_message_instructions(msg), ht, "instructions"))) return err;
+    if ((err = pni_php_data(pn_message_annotations(msg), ht, "annotations"))) return err;
+    return pni_php_data(pn_message_body(msg), ht, "body");
+  }
+
+  static void pni_php_add_string(zval *array, const char *key, const char *value) {
+    if (value) add_assoc_string(array, (char *) key, (char *) value, 1);
+  }
+
+  static void pni_php_add_data(zval *array, const char *key, pn_data_t *data) {
+    pn_data_rewind(data);
+    if (pn_data_next(data)) add_assoc_zval(array, (char *) key, pni_php_get(data));
+  }
+
+  static zval *pni_php_array(pn_message_t *msg) {
+    zval *array;
+    MAKE_STD_ZVAL(array);
+    array_init(array);
+    pni_php_add_string(array, "address", pn_message_get_address(msg));
+    pni_php_add_string(array, "subject", pn_message_get_subject(msg));
+    pni_php_add_string(array, "reply_to", pn_message_get_reply_to(msg));
+    pni_php_add_string(array, "content_type", pn_message_get_content_type(msg));
+    pni_php_add_string(array, "content_encoding", pn_message_get_content_encoding(msg));
+    pni_php_add_string(array, "group_id", pn_message_get_group_id(msg));
+    pni_php_add_string(array, "reply_to_group_id", pn_message_get_reply_to_group_id(msg));
+    add_assoc_bool(array, "durable", pn_message_is_durable(msg));
+    add_assoc_long(array, "priority", pn_message_get_priority(msg));
+    add_assoc_long(array, "ttl", pn_message_get_ttl(msg));
+    pni_php_add_data(array, "id", pn_message_id(msg));
+    pni_php_add_data(array, "correlation_id", pn_message_correlation_id(msg));
+    pni_php_add_data(array, "properties", pn_message_properties(msg));
+    pni_php_add_data(array, "instructions", pn_message_instructions(msg));
+    pni_php_add_data(array, "annotations", pn_message_annotations(msg));
+    pni_php_add_data(array, "body", pn_message_body(msg));
+    return array;
+  }
+%}
+
+%typemap(in) zval *PHP_ARRAY {
+    $1 = *$input;
+}
+
+%typemap(in,numinputs=0) zval **OUTPUT_ARRAY (zval *array = 0) {
+    $1 = &array;
+}
+%typemap(argout,fragment="t_output_helper") zval **OUTPUT_ARRAY {
+    t_output_helper(&$result, *($1));   // append it to output array
+}
+
+// in PHP:   count = pn_messenger_put_hashes(messenger, array(array(...), ...));
+//
+%inline %{
+  int pn_messenger_put_hashes(pn_messenger_t *messenger, zval *PHP_ARRAY) {
+    HashTable *ht;
+    HashPosition pos;
+    zval **entry;
+    pn_message_t **msgs;
+    size_t i, n;
+    int err = 0;
+
+    if (Z_TYPE_P(PHP_ARRAY) != IS_ARRAY) return PN_ARG_ERR;
+    ht = Z_ARRVAL_P(PHP_ARRAY);
+    n = zend_hash_num_elements(ht);
+    if (!n) return 0;
+    msgs = (pn_message_t **) emalloc(n * sizeof(pn_message_t *));
+    i = 0;
+    zend_hash_internal_pointer_reset_ex(ht, &pos);
+    while (zend_hash_get_current_data_ex(ht, (void **) &entry, &pos) == SUCCESS) {
+      msgs[i] = pn_message();
+      if (!err) {
+        if (Z_TYPE_PP(entry) != IS_ARRAY) {
+          err = PN_ARG_ERR;
+        } else {
+          err = pni_php_fill(msgs[i], Z_ARRVAL_PP(entry));
+        }
+      }
+      i++;
+      zend_hash_move_forward_ex(ht, &pos);
+    }
+    if (!err) err = pn_messenger_put_batch(messenger, msgs, n);
+    for (i = 0; i < n; i++) {
+      pn_message_free(msgs[i]);
+    }
+    efree(msgs);
+    return err;
+  }
+%}
+
+// in PHP:   array = pn_messenger_get_hashes(messenger, N);
+//           array[0] = count || error code
+//           array[1] = array of up to N messages as arrays
+//
+%inline %{
+  int pn_messenger_get_hashes(pn_messenger_t *messenger, int n, zval **OUTPUT_ARRAY) {
+    pn_message_t **msgs;
+    int i, got = 0;
+
+    MAKE_STD_ZVAL(*OUTPUT_ARRAY);
+    array_init(*OUTPUT_ARRAY);
+    if (n <= 0) return 0;
+    msgs = (pn_message_t **) emalloc(n * sizeof(pn_message_t *));
+    for (i = 0; i < n; i++) {
+      msgs[i] = pn_message();
+    }
+    got = pn_messenger_get_batch(messenger, msgs, n);
+    for (i = 0; i < got; i++) {
+      add_next_index_zval(*OUTPUT_ARRAY, pni_php_array(msgs[i]));
+    }
+    for (i = 0; i < n; i++) {
+      pn_message_free(msgs[i]);
+    }
+    efree(msgs);
+    return got;
+  }
+%}
+
 %include "proton/cproton.i"
@@ -138,6 +138,13 @@ class Messenger
     return $this->outgoing_tracker();
   }
 
+  // puts each array in $messages as a message, which is quicker than
+  // putting Message objects one at a time; see php.i for the keys an
+  // array may hold
+  public function put_batch($messages) {
+    return $this->_check(pn_messenger_put_hashes($this->impl, $messages));
+  }
+
   public function send($n = -1) {
     $this->_check(pn_messenger_send($this->impl, $n));
   }
@@ -156,6 +163,15 @@ class Messenger
     return $this->incoming_tracker();
   }
 
+  // gets up to $n messages as arrays, which is quicker than getting
+  // Message objects one at a time
+  public function get_batch($n = 1) {
+    list($count, $messages) = pn_messenger_get_hashes($this->impl, $n);
+    if ($count == PN_EOS) return array();
+    $this->_check($count);
+    return $messages;
+  }
+
   public function accept($tracker = null) {
     if ($tracker == null) {
       $tracker = $this->incoming_tracker();
@@ -61,4 +61,8 @@ round_trip(1234);
 round_trip(3.14159);
 round_trip(array("pi" => 3.14159, "blueberry-pi" => "yummy"));
 
+$mng = new Messenger();
+assert($mng->put_batch(array()) == 0);
+assert(count($mng->get_batch(10)) == 0);
+
 ?>
@@ -32,6 +32,42 @@
 #include <proton/handlers.h>
 %}
 
+// Built with -threads, a wrapped call would hand over the GIL and take
+// it back again, which costs more than most calls do and lets other
+// threads' handlers in between every two of them. So only the calls
+// that may wait, on I/O, the clock or other threads, let it go. Anything
+// that calls back into python while they wait takes it back to do so.
+%feature("nothread");
+%feature("nothread", "0") pn_reactor_process;
+%feature("nothread", "0") pn_reactor_run;
+%feature("nothread", "0") pn_reactor_stop;
+%feature("nothread", "0") pn_reactor_acceptor;
+%feature("nothread", "0") pn_reactor_group_start;
+%feature("nothread", "0") pn_reactor_group_stop;
+%feature("nothread", "0") pn_reactor_group_free;
+%feature("nothread", "0") pn_reactor_group_acceptor;
+%feature("nothread", "0") pn_selector_select;
+%feature("nothread", "0") pn_connect;
+%feature("nothread", "0") pn_listen;
+%feature("nothread", "0") pn_accept;
+%feature("nothread", "0") pn_connect_unix;
+%feature("nothread", "0") pn_listen_unix;
+%feature("nothread", "0") pn_send;
+%feature("nothread", "0") pn_recv;
+%feature("nothread", "0") pn_read;
+%feature("nothread", "0") pn_write;
+%feature("nothread", "0") pn_messenger_start;
+%feature("nothread", "0") pn_messenger_stop;
+%feature("nothread", "0") pn_messenger_work;
+%feature("nothread", "0") pn_messenger_send;
+%feature("nothread", "0") pn_messenger_recv;
+%feature("nothread", "0") pn_messenger_put;
+%feature("nothread", "0") pn_messenger_get;
+%feature("nothread", "0") pn_messenger_subscribe;
+%feature("nothread", "0") pn_messenger_subscribe_ttl;
+%feature("nothread", "0") pn_messenger_set_threads;
+%feature("nothread", "0") pn_messenger_free;
+
 %include <cstring.i>
 
 %cstring_output_withsize(char *OUTPUT, size_t *OUTPUT_SIZE)
@@ -85,12 +121,108 @@
 
 %apply pn_uuid_t { pn_decimal128_t };
 
-int pn_message_encode(pn_message_t *msg, char *OUTPUT, size_t *OUTPUT_SIZE);
+// bytes passed in from anything with the buffer protocol, e.g. a str,
+// a bytearray or a memoryview of part of one, without copying them
+%typemap(arginit) (const char *BUFFER, size_t BUFFER_SIZE) {
+  view$argnum.obj = NULL;
+}
+
+%typemap(in) (const char *BUFFER, size_t BUFFER_SIZE) (Py_buffer view) {
+  if (PyObject_GetBuffer($input, &view, PyBUF_SIMPLE) < 0) {
+    return NULL;
+  }
+  $1 = (const char *) view.buf;
+  $2 = view.len;
+}
+
+%typemap(freearg) (const char *BUFFER, size_t BUFFER_SIZE) {
+  PyBuffer_Release(&view$argnum);
+}
+
+// the batch calls of the messenger take a list of messages, None
+// standing for NULL
+%typemap(in) (pn_message_t **msgs, size_t n) {
+  if (!PyList_Check($input)) {
+    PyErr_SetString(PyExc_TypeError, "expected a list of messages");
+    return NULL;
+  }
+  $2 = PyList_Size($input);
+  $1 = (pn_message_t **) malloc(($2 ? $2 : 1) * sizeof(pn_message_t *));
+  size_t i;
+  for (i = 0; i < $2; i++) {
+    PyObject *item = PyList_GetItem($input, i);
+    if (item == Py_None) {
+      $1[i] = NULL;
+    } else if (SWIG_ConvertPtr(item, (void **) &$1[i], $descriptor(pn_message_t *), 0) == -1) {
+      free($1);
+      return NULL;
+    }
+  }
+}
+
+%typemap(freearg) (pn_message_t **msgs, size_t n) {
+  free($1);
+}
+
+%rename(pn_message_encode) wrap_pn_message_encode;
+%inline %{
+  int wrap_pn_message_encode(pn_message_t *msg, char *OUTPUT, size_t *OUTPUT_SIZE) {
+    int err = pn_message_encode(msg, OUTPUT, OUTPUT_SIZE);
+    // on overflow the size is what would have fitted, not what the
+    // buffer holds
+    if (err) {
+      *OUTPUT_SIZE = 0;
+    }
+    return err;
+  }
+%}
 %ignore pn_message_encode;
 
-ssize_t pn_link_send(pn_link_t *transport, char *STRING, size_t LENGTH);
+// the message encoded into a string of exactly its size, as (err, bytes),
+// so that a message is encoded at most twice however big it is
+%inline %{
+  PyObject *pn_message_encode_bytes(pn_message_t *msg) {
+    char small[256];
+    size_t size = sizeof(small);
+    int err = pn_message_encode(msg, small, &size);
+    if (!err) {
+      return Py_BuildValue("(iN)", 0, PyString_FromStringAndSize(small, size));
+    }
+    if (err == PN_OVERFLOW) {
+      PyObject *bytes = PyString_FromStringAndSize(NULL, size);
+      if (!bytes) {
+        return NULL;
+      }
+      err = pn_message_encode(msg, PyString_AS_STRING(bytes), &size);
+      if (!err) {
+        return Py_BuildValue("(iN)", 0, bytes);
+      }
+      Py_DECREF(bytes);
+    }
+    return Py_BuildValue("(iO)", err, Py_None);
+  }
+%}
+
+int pn_message_decode(pn_message_t *msg, const char *BUFFER, size_t BUFFER_SIZE);
+%ignore pn_message_decode;
+
+ssize_t pn_link_send(pn_link_t *transport, const char *BUFFER, size_t BUFFER_SIZE);
 %ignore pn_link_send;
 
+// receives into a writable buffer, e.g. a bytearray or a memoryview of
+// part of one, returning the number of bytes received or an error code
+%inline %{
+  PyObject *pn_link_recv_into(pn_link_t *link, PyObject *buffer) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(buffer, &view, PyBUF_WRITABLE) < 0) {
+      return NULL;
+    }
+    ssize_t n = pn_link_recv(link, (char *) view.buf, view.len);
+    PyBuffer_Release(&view);
+    return PyInt_FromSsize_t(n);
+  }
+%}
+
 %rename(pn_link_recv) wrap_pn_link_recv;
 %inline %{
   int wrap_pn_link_recv(pn_link_t *link, char *OUTPUT, size_t *OUTPUT_SIZE) {
@@ -105,7 +237,7 @@ ssize_t pn_link_send(pn_link_t *transport, char *STRING, size_t LENGTH);
 %}
 %ignore pn_link_recv;
 
-ssize_t pn_transport_push(pn_transport_t *transport, char *STRING, size_t LENGTH);
+ssize_t pn_transport_push(pn_transport_t *transport, const char *BUFFER, size_t BUFFER_SIZE);
 %ignore pn_transport_push;
 
 %rename(pn_transport_peek) wrap_pn_transport_peek;
@@ -141,7 +273,7 @@ ssize_t pn_transport_push(pn_transport_t *transport, char *STRING, size_t LENGTH
 %}
 %ignore pn_delivery_tag;
 
-ssize_t pn_data_decode(pn_data_t *data, char *STRING, size_t LENGTH);
+ssize_t pn_data_decode(pn_data_t *data, const char *BUFFER, size_t BUFFER_SIZE);
 %ignore pn_data_decode;
 
 %rename(pn_data_encode) wrap_pn_data_encode;
@@ -158,6 +290,198 @@ ssize_t pn_data_decode(pn_data_t *data, char *STRING, size_t LENGTH);
 %}
 %ignore pn_data_encode;
 
+// the data encoded into a string of exactly its size, as (err, bytes)
+%inline %{
+  PyObject *pn_data_encode_bytes(pn_data_t *data) {
+    ssize_t size = pn_data_encoded_size(data);
+    if (size < 0) {
+      return Py_BuildValue("(iO)", (int) size, Py_None);
+    }
+    PyObject *bytes = PyString_FromStringAndSize(NULL, size);
+    if (!bytes) {
+      return NULL;
+    }
+    ssize_t n = pn_data_encode(data, PyString_AS_STRING(bytes), size);
+    if (n < 0) {
+      Py_DECREF(bytes);
+      return Py_BuildValue("(iO)", (int) n, Py_None);
+    }
+    return Py_BuildValue("(iN)", 0, bytes);
+  }
+%}
+
+// Converts whole python values to and from data in one call, rather
+// than one call per value. The builtin types are converted here, and
+// anything else, e.g. a symbol or a Described, is handed to a fallback
+// in python, which calls back in for whatever it holds.
+%{
+  // a python exception has been raised
+  #define PNI_PY_RAISED (-1000)
+
+  static int pni_py_put(pn_data_t *data, PyObject *obj, PyObject *fallback);
+  static PyObject *pni_py_get(pn_data_t *data, PyObject *fallback);
+
+  static int pni_py_put_map(pn_data_t *data, PyObject *dict, PyObject *fallback) {
+    int err = pn_data_put_map(data);
+    if (err) return err;
+    pn_data_enter(data);
+    Py_ssize_t pos = 0;
+    PyObject *key, *value;
+    while (!err && PyDict_Next(dict, &pos, &key, &value)) {
+      // the fallback may run any python
+      Py_INCREF(key);
+      Py_INCREF(value);
+      err = pni_py_put(data, key, fallback);
+      if (!err) err = pni_py_put(data, value, fallback);
+      Py_DECREF(key);
+      Py_DECREF(value);
+    }
+    pn_data_exit(data);
+    return err;
+  }
+
+  static int pni_py_put_list(pn_data_t *data, PyObject *seq, PyObject *fallback) {
+    int err = pn_data_put_list(data);
+    if (err) return err;
+    pn_data_enter(data);
+    for (Py_ssize_t i = 0; !err && i < PySequence_Fast_GET_SIZE(seq); i++) {
+      PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+      Py_INCREF(item);
+      err = pni_py_put(data, item, fallback);
+      Py_DECREF(item);
+    }
+    pn_data_exit(data);
+    return err;
+  }
+
+  static int pni_py_put(pn_data_t *data, PyObject *obj, PyObject *fallback) {
+    if (obj == Py_None) {
+      return pn_data_put_null(data);
+    } else if (PyBool_Check(obj)) {
+      return pn_data_put_bool(data, obj == Py_True);
+    } else if (PyInt_CheckExact(obj)) {
+      return pn_data_put_long(data, PyInt_AS_LONG(obj));
+    } else if (PyLong_CheckExact(obj)) {
+      PY_LONG_LONG l = PyLong_AsLongLong(obj);
+      if (l == -1 && PyErr_Occurred()) return PNI_PY_RAISED;
+      return pn_data_put_long(data, l);
+    } else if (PyFloat_CheckExact(obj)) {
+      return pn_data_put_double(data, PyFloat_AS_DOUBLE(obj));
+    } else if (PyString_CheckExact(obj)) {
+      return pn_data_put_binary(data, pn_bytes(PyString_GET_SIZE(obj), PyString_AS_STRING(obj)));
+    } else if (PyUnicode_CheckExact(obj)) {
+      PyObject *utf8 = PyUnicode_AsUTF8String(obj);
+      if (!utf8) return PNI_PY_RAISED;
+      int err = pn_data_put_string(data, pn_bytes(PyString_GET_SIZE(utf8), PyString_AS_STRING(utf8)));
+      Py_DECREF(utf8);
+      return err;
+    } else if (PyDict_CheckExact(obj)) {
+      return pni_py_put_map(data, obj, fallback);
+    } else if (PyList_CheckExact(obj) || PyTuple_CheckExact(obj)) {
+      return pni_py_put_list(data, obj, fallback);
+    } else {
+      PyObject *result = PyObject_CallFunctionObjArgs(fallback, obj, NULL);
+      if (!result) return PNI_PY_RAISED;
+      Py_DECREF(result);
+      return 0;
+    }
+  }
+
+  static PyObject *pni_py_get_list(pn_data_t *data, PyObject *fallback) {
+    PyObject *list = PyList_New(0);
+    if (!list) return NULL;
+    pn_data_enter(data);
+    while (pn_data_next(data)) {
+      PyObject *item = pni_py_get(data, fallback);
+      if (!item || PyList_Append(list, item)) {
+        Py_XDECREF(item);
+        Py_DECREF(list);
+        list = NULL;
+        break;
+      }
+      Py_DECREF(item);
+    }
+    pn_data_exit(data);
+    return list;
+  }
+
+  static PyObject *pni_py_get_map(pn_data_t *data, PyObject *fallback) {
+    PyObject *dict = PyDict_New();
+    if (!dict) return NULL;
+    pn_data_enter(data);
+    while (pn_data_next(data)) {
+      PyObject *key = pni_py_get(data, fallback);
+      PyObject *value = NULL;
+      if (key) {
+        if (pn_data_next(data)) {
+          value = pni_py_get(data, fallback);
+        } else {
+          Py_INCREF(Py_None);
+          value = Py_None;
+        }
+      }
+      int err = !key || !value || PyDict_SetItem(dict, key, value);
+      Py_XDECREF(key);
+      Py_XDECREF(value);
+      if (err) {
+        Py_DECREF(dict);
+        dict = NULL;
+        break;
+      }
+    }
+    pn_data_exit(data);
+    return dict;
+  }
+
+  static PyObject *pni_py_get(pn_data_t *data, PyObject *fallback) {
+    switch (pn_data_type(data)) {
+    case PN_NULL:
+      Py_RETURN_NONE;
+    case PN_BOOL:
+      return PyBool_FromLong(pn_data_get_bool(data));
+    case PN_INT:
+      return PyInt_FromLong(pn_data_get_int(data));
+    case PN_LONG: {
+      int64_t l = pn_data_get_long(data);
+      if (l >= LONG_MIN && l <= LONG_MAX) {
+        return PyInt_FromLong((long) l);
+      }
+      return PyLong_FromLongLong(l);
+    }
+    case PN_DOUBLE:
+      return PyFloat_FromDouble(pn_data_get_double(data));
+    case PN_BINARY: {
+      pn_bytes_t bytes = pn_data_get_binary(data);
+      return PyString_FromStringAndSize(bytes.start, bytes.size);
+    }
+    case PN_STRING: {
+      pn_bytes_t bytes = pn_data_get_string(data);
+      return PyUnicode_DecodeUTF8(bytes.start, bytes.size, "strict");
+    }
+    case PN_LIST:
+      return pni_py_get_list(data, fallback);
+    case PN_MAP:
+      return pni_py_get_map(data, fallback);
+    default:
+      return PyObject_CallFunctionObjArgs(fallback, NULL);
+    }
+  }
+%}
+
+%inline %{
+  PyObject *pn_data_put_pyobject(pn_data_t *data, PyObject *obj, PyObject *fallback) {
+    int err = pni_py_put(data, obj, fallback);
+    if (err == PNI_PY_RAISED) {
+      return NULL;
+    }
+    return PyInt_FromLong(err);
+  }
+
+  PyObject *pn_data_get_pyobject(pn_data_t *data, PyObject *fallback) {
+    return pni_py_get(data, fallback);
+  }
+%}
+
 %rename(pn_sasl_recv) wrap_pn_sasl_recv;
 %inline %{
   int wrap_pn_sasl_recv(pn_sasl_t *sasl, char *OUTPUT, size_t *OUTPUT_SIZE) {
@@ -505,6 +505,25 @@ first message.
     self._check(pn_messenger_put(self._mng, message._msg))
     return pn_messenger_outgoing_tracker(self._mng)
 
+  def put_batch(self, messages):
+    """
+    Places several L{Messages<Message>} onto the outgoing queue with a
+    single call, as if L{put} was called for each of them in turn.
+    Consecutive L{Messages<Message>} with the same address share the
+    work of routing them.
+
+    @type messages: list
+    @param messages: the messages to place in the outgoing queue
+    @return: a tracker for the last message
+    """
+    for m in messages:
+      m._pre_encode()
+    impls = [m._msg for m in messages]
+    n = self._check(pn_messenger_put_batch(self._mng, impls))
+    if n < len(impls):
+      self._check(pn_messenger_errno(self._mng))
+    return pn_messenger_outgoing_tracker(self._mng)
+
   def status(self, tracker):
     """
     Gets the last known remote state of the delivery associated with
@@ -627,6 +646,29 @@ first message.
       message._post_decode()
     return pn_messenger_incoming_tracker(self._mng)
 
+  def get_batch(self, messages):
+    """
+    Moves messages from the head of the incoming queue into the
+    supplied L{Message} objects with a single call, as if L{get} was
+    called for each of them in turn. A None entry discards the
+    corresponding message.
+
+    The incoming tracker refers to the last message retrieved.
+
+    @type messages: list
+    @param messages: the destination message objects
+    @return: the number of messages retrieved
+    """
+    impls = [m._msg if m is not None else None for m in messages]
+    n = pn_messenger_get_batch(self._mng, impls)
+    if n == PN_EOS:
+      return 0
+    self._check(n)
+    for m in messages[:n]:
+      if m is not None:
+        m._post_decode()
+    return n
+
   def accept(self, tracker=None):
     """
     Signal the sender that you have acted on the L{Message}
@@ -1080,18 +1122,16 @@ The group-id for any replies.
 
   def encode(self):
     self._pre_encode()
-    sz = 16
-    while True:
-      err, data = pn_message_encode(self._msg, sz)
-      if err == PN_OVERFLOW:
-        sz *= 2
-        continue
-      else:
-        self._check(err)
-        return data
+    err, data = pn_message_encode_bytes(self._msg)
+    self._check(err)
+    return data
 
   def decode(self, data):
-    self._check(pn_message_decode(self._msg, data, len(data)))
+    """
+    Decodes the message from data, which may be anything with the
+    buffer protocol, e.g. a str, a bytearray or a memoryview.
+    """
+    self._check(pn_message_decode(self._msg, data))
     self._post_decode()
 
   def send(self, sender, tag=None):
@@ -1119,7 +1159,11 @@ The group-id for any replies.
     if link.is_sender: return None
     dlv = link.current
     if not dlv or dlv.partial: return None
-    encoded = link.recv(dlv.pending)
+    # straight into a buffer of the right size, which is decoded in place
+    encoded = bytearray(dlv.pending)
+    n = link.recv_into(encoded)
+    if n is not None and n < len(encoded):
+      encoded = memoryview(encoded)[:n]
     link.advance()
     # the sender has already forgotten about the delivery, so we might
     # as well too
@@ -1525,15 +1569,9 @@ class Data:
     """
     Returns a representation of the data encoded in AMQP format.
     """
-    size = 1024
-    while True:
-      cd, enc = pn_data_encode(self._data, size)
-      if cd == PN_OVERFLOW:
-        size *= 2
-      elif cd >= 0:
-        return enc
-      else:
-        self._check(cd)
+    cd, enc = pn_data_encode_bytes(self._data)
+    self._check(cd)
+    return enc
 
   def decode(self, encoded):
     """
@@ -1541,7 +1579,8 @@ class Data:
     number of bytes consumed.
 
     @type encoded: binary
-    @param encoded: AMQP encoded binary data
+    @param encoded: AMQP encoded binary data, or anything with the
+    buffer protocol, e.g. a bytearray or a memoryview
     """
     return self._check(pn_data_decode(self._data, encoded))
 
@@ -2183,10 +2222,18 @@ class Data:
 
 
   def put_object(self, obj):
+    # the builtin types, and containers of them, are put in one call,
+    # which hands anything else to _put_mapped
+    self._check(pn_data_put_pyobject(self._data, obj, self._put_mapped))
+
+  def _put_mapped(self, obj):
     putter = self.put_mappings[obj.__class__]
     putter(self, obj)
 
   def get_object(self):
+    return pn_data_get_pyobject(self._data, self._get_mapped)
+
+  def _get_mapped(self):
     type = self.type()
     if type is None: return None
     getter = self.get_mappings.get(type)
@@ -2526,6 +2573,13 @@ class Session(Wrapper, Endpoint):
   def incoming_bytes(self):
     return pn_session_incoming_bytes(self._impl)
 
+  @property
+  def metrics(self):
+    """A snapshot of the session's metrics, a pn_session_metrics_t."""
+    metrics = pn_session_metrics_t()
+    pn_session_metrics(self._impl, metrics)
+    return metrics
+
   def open(self):
     pn_session_open(self._impl)
 
@@ -2676,6 +2730,26 @@ class Link(Wrapper, Endpoint):
     """The amount of oustanding credit on this link."""
     return pn_link_credit(self._impl)
 
+  @property
+  def metrics(self):
+    """A snapshot of the link's metrics, a pn_link_metrics_t."""
+    metrics = pn_link_metrics_t()
+    pn_link_metrics(self._impl, metrics)
+    return metrics
+
+  def track_latency(self, track=True):
+    """Time the link's deliveries, see the latency property."""
+    pn_link_track_latency(self._impl, track)
+
+  @property
+  def latency(self):
+    """A snapshot of the link's latencies, a pn_link_latency_t, or None
+    if they are not tracked."""
+    latency = pn_link_latency_t()
+    if pn_link_latency(self._impl, latency):
+      return latency
+    return None
+
   @property
   def available(self):
     return pn_link_available(self._impl)
@@ -2834,7 +2908,9 @@ class Sender(Link):
 
   def stream(self, bytes):
     """
-    Send specified bytes as part of the current delivery
+    Send specified bytes as part of the current delivery. The bytes
+    may be anything with the buffer protocol, e.g. a str, a bytearray
+    or a memoryview of part of one.
     """
     return self._check(pn_link_send(self._impl, bytes))
 
@@ -2880,6 +2956,21 @@ class Receiver(Link):
       self._check(n)
       return bytes
 
+  def recv_into(self, buffer):
+    """
+    Receives bytes of the current delivery into a writable buffer,
+    e.g. a bytearray or a memoryview of part of one, so that they are
+    copied only the once.
+
+    @return: the number of bytes received, or None at the end of the
+    delivery
+    """
+    n = pn_link_recv_into(self._impl, buffer)
+    if n == PN_EOS:
+      return None
+    else:
+      return self._check(n)
+
   def drain(self, n):
     pn_link_drain(self._impl, n)
 
@@ -3266,6 +3357,13 @@ The idle timeout of the connection (float, in seconds).
   def frames_input(self):
     return pn_transport_get_frames_input(self._impl)
 
+  @property
+  def metrics(self):
+    """A snapshot of the transport's metrics, a pn_transport_metrics_t."""
+    metrics = pn_transport_metrics_t()
+    pn_transport_metrics(self._impl, metrics)
+    return metrics
+
   def sasl(self):
     return SASL(self)
 
@@ -768,6 +768,29 @@ module Qpid # :nodoc:
         type_.put(self, value);
       end
 
+      # Puts a value of any mapped type, converting a whole Hash or Array in
+      # one native call. Values the native code does not convert, e.g. a
+      # Described, are put through their Mapping.
+      def object=(value)
+        @put_mapped ||= lambda do |v|
+          if v.is_a?(::Array)
+            v.proton_put(self)
+          else
+            mapping = Mapping.for_class(v.class)
+            raise TypeError, "cannot put #{v.class}" if mapping.nil?
+            mapping.put(self, v)
+          end
+        end
+        check(Cproton.pn_data_put_rbobject(@data, value, @put_mapped))
+      end
+
+      # Gets the current node as a single object, converting a whole map or
+      # list in one native call.
+      def object
+        @get_mapped ||= lambda { type.get(self) }
+        Cproton.pn_data_get_rbobject(@data, @get_mapped)
+      end
+
       private
 
       def valid_uuid?(value)
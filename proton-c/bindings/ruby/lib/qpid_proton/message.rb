@@ -61,12 +61,12 @@ module Qpid # :nodoc:
         @properties = {}
         props = Qpid::Proton::Data.new(Cproton::pn_message_properties(@impl))
         if props.next
-          @properties = props.type.get(props)
+          @properties = props.object
         end
         @instructions = nil
         insts = Qpid::Proton::Data.new(Cproton::pn_message_instructions(@impl))
         if insts.next
-          @instructions = insts.type.get(insts)
+          @instructions = insts.object
         end
         @annotations = nil
         annts = Qpid::Proton::Data.new(Cproton::pn_message_annotations(@impl))
@@ -76,7 +76,7 @@ module Qpid # :nodoc:
         @body = nil
         body = Qpid::Proton::Data.new(Cproton::pn_message_body(@impl))
         if body.next
-          @body = body.type.get(body)
+          @body = body.object
         end
       end
 
@@ -99,13 +99,10 @@ module Qpid # :nodoc:
         # encode elements from the message
         props = Qpid::Proton::Data.new(Cproton::pn_message_properties(@impl))
         props.clear
-        Qpid::Proton::Mapping.for_class(@properties.class).put(props, @properties) unless @properties.empty?
+        props.object = @properties unless @properties.empty?
         insts = Qpid::Proton::Data.new(Cproton::pn_message_instructions(@impl))
         insts.clear
-        if !@instructions.nil?
-          mapping = Qpid::Proton::Mapping.for_class(@instructions.class)
-          mapping.put(insts, @instructions)
-        end
+        insts.object = @instructions if !@instructions.nil?
         annts = Qpid::Proton::Data.new(Cproton::pn_message_annotations(@impl))
         annts.clear
         if !@annotations.nil?
@@ -114,10 +111,7 @@ module Qpid # :nodoc:
         end
         body = Qpid::Proton::Data.new(Cproton::pn_message_body(@impl))
         body.clear
-        if !@body.nil?
-          mapping = Qpid::Proton::Mapping.for_class(@body.class)
-          mapping.put(body, @body)
-        end
+        body.object = @body if !@body.nil?
       end
 
       # Creates a new +Message+ instance.
@@ -300,151 +300,247 @@ bool pn_ssl_get_cipher_name(pn_ssl_t *ssl, char *OUTPUT, size_t MAX_OUTPUT_SIZE)
 bool pn_ssl_get_protocol_name(pn_ssl_t *ssl, char *OUTPUT, size_t MAX_OUTPUT_SIZE);
 %ignore pn_ssl_get_protocol_name;
 
-%inline %{
-#if defined(RUBY20) || defined(RUBY21)
-
-  typedef void *non_blocking_return_t;
-#define RB_BLOCKING_CALL rb_thread_call_without_gvl
-
-#elif defined(RUBY19)
-
-    typedef VALUE non_blocking_return_t;
-#define RB_BLOCKING_CALL rb_thread_blocking_region
-
-#endif
-  %}
-
-%rename(pn_messenger_send) wrap_pn_messenger_send;
-%rename(pn_messenger_recv) wrap_pn_messenger_recv;
-%rename(pn_messenger_work) wrap_pn_messenger_work;
-
-%inline %{
-
-#if defined(RB_BLOCKING_CALL)
-
-    static non_blocking_return_t pn_messenger_send_no_gvl(void *args) {
-    VALUE result = Qnil;
-    pn_messenger_t *messenger = (pn_messenger_t *)((void **)args)[0];
-    int *limit = (int *)((void **)args)[1];
-
-    int rc = pn_messenger_send(messenger, *limit);
-
-    result = INT2NUM(rc);
-    return (non_blocking_return_t )result;
+// Converts whole ruby values to and from data in one call, rather than
+// one call per value. Nil, booleans, integers, floats, strings, symbols,
+// and hashes and arrays of them are converted here, and anything else,
+// e.g. a Described or a UUID, is handed to a fallback in ruby, which
+// calls back in for whatever it holds.
+%{
+#include <ruby/encoding.h>
+
+  static VALUE pni_rb_utf_string = Qnil;
+  static VALUE pni_rb_binary_string = Qnil;
+
+  static int pni_rb_put(pn_data_t *data, VALUE obj, VALUE fallback);
+
+  // as Mapping::STRING does, binary or invalid UTF-8 is put as binary, the
+  // rest as a string; returns 1 for other encodings, which are left to it
+  static int pni_rb_put_string(pn_data_t *data, VALUE str) {
+    pn_bytes_t bytes = pn_bytes(RSTRING_LEN(str), RSTRING_PTR(str));
+    int encoding = ENCODING_GET(str);
+    if (encoding == rb_ascii8bit_encindex()) {
+      return pn_data_put_binary(data, bytes);
+    } else if (encoding == rb_utf8_encindex() || encoding == rb_usascii_encindex()) {
+      if (rb_enc_str_coderange(str) == ENC_CODERANGE_BROKEN) {
+        return pn_data_put_binary(data, bytes);
+      }
+      return pn_data_put_string(data, bytes);
     }
+    return 1;
+  }
 
-    static non_blocking_return_t pn_messenger_recv_no_gvl(void *args) {
-    VALUE result = Qnil;
-    pn_messenger_t *messenger = (pn_messenger_t *)((void **)args)[0];
-    int *limit = (int *)((void **)args)[1];
-
-    int rc = pn_messenger_recv(messenger, *limit);
+  typedef struct {
+    pn_data_t *data;
+    VALUE fallback;
+    int err;
+  } pni_rb_put_t;
+
+  static int pni_rb_put_pair(VALUE key, VALUE value, VALUE arg) {
+    pni_rb_put_t *put = (pni_rb_put_t *) arg;
+    put->err = pni_rb_put(put->data, key, put->fallback);
+    if (!put->err) put->err = pni_rb_put(put->data, value, put->fallback);
+    return put->err ? ST_STOP : ST_CONTINUE;
+  }
 
-    result = INT2NUM(rc);
-    return (non_blocking_return_t )result;
+  static int pni_rb_put(pn_data_t *data, VALUE obj, VALUE fallback) {
+    VALUE klass = rb_obj_class(obj);
+    int err = 1;
+    if (NIL_P(obj)) {
+      return pn_data_put_null(data);
+    } else if (obj == Qtrue || obj == Qfalse) {
+      return pn_data_put_bool(data, obj == Qtrue);
+    } else if (FIXNUM_P(obj) || TYPE(obj) == T_BIGNUM) {
+      return pn_data_put_long(data, NUM2LL(obj));
+    } else if (TYPE(obj) == T_FLOAT) {
+      return pn_data_put_double(data, NUM2DBL(obj));
+    } else if (klass == rb_cString) {
+      err = pni_rb_put_string(data, obj);
+    } else if (SYMBOL_P(obj)) {
+      err = pni_rb_put_string(data, rb_sym_to_s(obj));
+    } else if (klass == rb_cHash) {
+      pni_rb_put_t put = {data, fallback, 0};
+      err = pn_data_put_map(data);
+      if (err) return err;
+      pn_data_enter(data);
+      rb_hash_foreach(obj, pni_rb_put_pair, (VALUE) &put);
+      pn_data_exit(data);
+      return put.err;
+    } else if (klass == rb_cArray &&
+               NIL_P(rb_attr_get(obj, rb_intern("@proton_array_header")))) {
+      long i;
+      err = pn_data_put_list(data);
+      if (err) return err;
+      pn_data_enter(data);
+      for (i = 0; i < RARRAY_LEN(obj) && !err; i++) {
+        err = pni_rb_put(data, rb_ary_entry(obj, i), fallback);
+      }
+      pn_data_exit(data);
+      return err;
+    }
+    if (err == 1) {
+      // the fallback raises if the put fails
+      rb_funcall(fallback, rb_intern("call"), 1, obj);
+      err = 0;
+    }
+    return err;
   }
 
-    static non_blocking_return_t pn_messenger_work_no_gvl(void *args) {
-      VALUE result = Qnil;
-      pn_messenger_t *messenger = (pn_messenger_t *)((void **)args)[0];
-      int *timeout = (int *)((void **)args)[1];
+  static VALUE pni_rb_get(pn_data_t *data, VALUE fallback) {
+    switch (pn_data_type(data)) {
+    case PN_NULL: return Qnil;
+    case PN_BOOL: return pn_data_get_bool(data) ? Qtrue : Qfalse;
+    case PN_UBYTE: return UINT2NUM(pn_data_get_ubyte(data));
+    case PN_BYTE: return INT2NUM(pn_data_get_byte(data));
+    case PN_USHORT: return UINT2NUM(pn_data_get_ushort(data));
+    case PN_SHORT: return INT2NUM(pn_data_get_short(data));
+    case PN_UINT: return UINT2NUM(pn_data_get_uint(data));
+    case PN_INT: return INT2NUM(pn_data_get_int(data));
+    case PN_CHAR: return UINT2NUM(pn_data_get_char(data));
+    case PN_ULONG: return ULL2NUM(pn_data_get_ulong(data));
+    case PN_LONG: return LL2NUM(pn_data_get_long(data));
+    case PN_TIMESTAMP: return LL2NUM(pn_data_get_timestamp(data));
+    case PN_FLOAT: return rb_float_new(pn_data_get_float(data));
+    case PN_DOUBLE: return rb_float_new(pn_data_get_double(data));
+    case PN_BINARY: {
+      pn_bytes_t bytes = pn_data_get_binary(data);
+      VALUE str = rb_str_new(bytes.start, bytes.size);
+      if (NIL_P(pni_rb_binary_string)) {
+        pni_rb_binary_string = rb_path2class("Qpid::Proton::BinaryString");
+        rb_gc_register_address(&pni_rb_binary_string);
+      }
+      return rb_class_new_instance(1, &str, pni_rb_binary_string);
+    }
+    case PN_STRING: {
+      pn_bytes_t bytes = pn_data_get_string(data);
+      VALUE str = rb_enc_str_new(bytes.start, bytes.size, rb_utf8_encoding());
+      if (NIL_P(pni_rb_utf_string)) {
+        pni_rb_utf_string = rb_path2class("Qpid::Proton::UTFString");
+        rb_gc_register_address(&pni_rb_utf_string);
+      }
+      return rb_class_new_instance(1, &str, pni_rb_utf_string);
+    }
+    case PN_SYMBOL: {
+      pn_bytes_t bytes = pn_data_get_symbol(data);
+      return rb_str_new(bytes.start, bytes.size);
+    }
+    case PN_LIST: {
+      size_t i, count = pn_data_get_list(data);
+      VALUE list = rb_ary_new2(count);
+      pn_data_enter(data);
+      for (i = 0; i < count && pn_data_next(data); i++) {
+        rb_ary_push(list, pni_rb_get(data, fallback));
+      }
+      pn_data_exit(data);
+      return list;
+    }
+    case PN_MAP: {
+      size_t i, count = pn_data_get_map(data) / 2;
+      VALUE map = rb_hash_new();
+      pn_data_enter(data);
+      for (i = 0; i < count && pn_data_next(data); i++) {
+        VALUE key = pni_rb_get(data, fallback);
+        VALUE value = pn_data_next(data) ? pni_rb_get(data, fallback) : Qnil;
+        rb_hash_aset(map, key, value);
+      }
+      pn_data_exit(data);
+      return map;
+    }
+    default:
+      return rb_funcall(fallback, rb_intern("call"), 0);
+    }
+  }
+%}
 
-      int rc = pn_messenger_work(messenger, *timeout);
+%inline %{
+  // puts obj, calling fallback with each value not converted here
+  int pn_data_put_rbobject(pn_data_t *data, VALUE obj, VALUE fallback) {
+    return pni_rb_put(data, obj, fallback);
+  }
 
-      result = INT2NUM(rc);
-      return (non_blocking_return_t )result;
-    }
+  // gets the current node, calling fallback for each node not converted here
+  VALUE pn_data_get_rbobject(pn_data_t *data, VALUE fallback) {
+    return pni_rb_get(data, fallback);
+  }
+%}
 
+// The calls that can wait release the GVL, so that other ruby threads run
+// meanwhile, and a ruby interrupt, e.g. Thread#kill or a signal, wakes
+// the messenger with pn_messenger_interrupt.
+%{
+#include <ruby/version.h>
+#if RUBY_API_VERSION_MAJOR >= 2
+#include <ruby/thread.h>
 #endif
 
-  int wrap_pn_messenger_send(pn_messenger_t *messenger, int limit) {
-    int result = 0;
+  typedef struct {
+    int (*call)(pn_messenger_t *, int);
+    pn_messenger_t *messenger;
+    int arg;
+    int result;
+  } pni_rb_blocking_t;
+
+  static void *pni_rb_blocking_call(void *arg) {
+    pni_rb_blocking_t *blocking = (pni_rb_blocking_t *) arg;
+    blocking->result = blocking->call(blocking->messenger, blocking->arg);
+    return NULL;
+  }
 
-#if defined(RB_BLOCKING_CALL)
+  static void pni_rb_blocking_interrupt(void *arg) {
+    pn_messenger_interrupt(((pni_rb_blocking_t *) arg)->messenger);
+  }
 
-    // only release the gil if we're blocking
-    if(pn_messenger_is_blocking(messenger)) {
-      VALUE rc;
-      void* args[2];
+#if RUBY_API_VERSION_MAJOR < 2 && defined(RUBY19)
+  static VALUE pni_rb_blocking_region(void *arg) {
+    pni_rb_blocking_call(arg);
+    return Qnil;
+  }
+#endif
 
-      args[0] = messenger;
-      args[1] = &limit;
+  static int pni_rb_without_gvl(int (*call)(pn_messenger_t *, int), pn_messenger_t *messenger, int arg) {
+    pni_rb_blocking_t blocking;
+    blocking.call = call;
+    blocking.messenger = messenger;
+    blocking.arg = arg;
+    blocking.result = 0;
+#if RUBY_API_VERSION_MAJOR >= 2
+    rb_thread_call_without_gvl(pni_rb_blocking_call, &blocking,
+                               pni_rb_blocking_interrupt, &blocking);
+#elif defined(RUBY19)
+    rb_thread_blocking_region(pni_rb_blocking_region, &blocking,
+                              pni_rb_blocking_interrupt, &blocking);
+#else
+    pni_rb_blocking_call(&blocking);
+#endif
+    return blocking.result;
+  }
+%}
 
-      rc = RB_BLOCKING_CALL(pn_messenger_send_no_gvl,
-                            &args, RUBY_UBF_PROCESS, NULL);
+%rename(pn_messenger_send) wrap_pn_messenger_send;
+%rename(pn_messenger_recv) wrap_pn_messenger_recv;
+%rename(pn_messenger_work) wrap_pn_messenger_work;
 
-      if(RTEST(rc))
-        {
-          result = FIX2INT(rc);
-        }
+%inline %{
+  int wrap_pn_messenger_send(pn_messenger_t *messenger, int limit) {
+    // only release the gvl if it can block
+    if (pn_messenger_is_blocking(messenger)) {
+      return pni_rb_without_gvl(pn_messenger_send, messenger, limit);
     }
-
-#else // !defined(RB_BLOCKING_CALL)
-    result = pn_messenger_send(messenger, limit);
-#endif // defined(RB_BLOCKING_CALL)
-
-    return result;
+    return pn_messenger_send(messenger, limit);
   }
 
   int wrap_pn_messenger_recv(pn_messenger_t *messenger, int limit) {
-    int result = 0;
-
-#if defined(RB_BLOCKING_CALL)
-    // only release the gil if we're blocking
-    if(pn_messenger_is_blocking(messenger)) {
-      VALUE rc;
-      void* args[2];
-
-      args[0] = messenger;
-      args[1] = &limit;
-
-      rc = RB_BLOCKING_CALL(pn_messenger_recv_no_gvl,
-                            &args, RUBY_UBF_PROCESS, NULL);
-
-      if(RTEST(rc))
-        {
-          result = FIX2INT(rc);
-        }
-
-    } else {
-      result = pn_messenger_recv(messenger, limit);
+    if (pn_messenger_is_blocking(messenger)) {
+      return pni_rb_without_gvl(pn_messenger_recv, messenger, limit);
     }
-#else // !defined(RB_BLOCKING_CALL)
-    result = pn_messenger_recv(messenger, limit);
-#endif // defined(RB_BLOCKING_CALL)
-
-      return result;
+    return pn_messenger_recv(messenger, limit);
   }
 
   int wrap_pn_messenger_work(pn_messenger_t *messenger, int timeout) {
-    int result = 0;
-
-#if defined(RB_BLOCKING_CALL)
-    // only release the gil if we're blocking
-    if(timeout) {
-      VALUE rc;
-      void* args[2];
-
-      args[0] = messenger;
-      args[1] = &timeout;
-
-      rc = RB_BLOCKING_CALL(pn_messenger_work_no_gvl,
-                            &args, RUBY_UBF_PROCESS, NULL);
-
-      if(RTEST(rc))
-        {
-          result = FIX2INT(rc);
-        }
-    } else {
-      result = pn_messenger_work(messenger, timeout);
+    if (timeout) {
+      return pni_rb_without_gvl(pn_messenger_work, messenger, timeout);
     }
-#else
-    result = pn_messenger_work(messenger, timeout);
-#endif
-
-    return result;
+    return pn_messenger_work(messenger, timeout);
   }
-
 %}
 
 %ignore pn_messenger_send;
@@ -486,6 +486,23 @@ module Qpid
         end
       end
 
+      it "can hold a nested object" do
+        value = {"list" => [1, 2.5, nil, true, "text"],
+                 "map" => {"key" => random_string(16)},
+                 3 => Qpid::Proton::BinaryString.new("\x00\xff".b)}
+        @data.object = value
+        @data.rewind
+        @data.next
+        expect(@data.object).to eq(value)
+      end
+
+      it "puts what it does not convert through its mapping" do
+        @data.object = [Qpid::Proton::UTFString.new("text"), Time.at(1000)]
+        @data.rewind
+        @data.next
+        expect(@data.object).to eq(["text", 1000])
+      end
+
     end
 
   end
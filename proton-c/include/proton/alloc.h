@@ -0,0 +1,149 @@
+#ifndef PROTON_ALLOC_H
+#define PROTON_ALLOC_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/import_export.h>
+#include <proton/error.h>
+#include <proton/object.h>
+#include <proton/type_compat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file
+ *
+ * Allocation hooks, and counters by the part of the library that
+ * allocates.
+ *
+ * Everything the library allocates for itself goes through the
+ * allocator set with pn_set_allocator(), the C library's unless one is
+ * set.
+ *
+ * The counters are only kept by a library built with
+ * ENABLE_ALLOCATION_TRACKING, which sends the library's allocations
+ * through an allocator that counts them. Otherwise every counter stays
+ * zero and pn_alloc_tracking() is false. Objects are counted under
+ * the subsystem of their class, the memory they allocate for
+ * themselves under the subsystem that allocates it.
+ *
+ * The counters only grow, so what an operation allocates is the
+ * difference between snapshots taken before and after it.
+ *
+ * @defgroup alloc Allocation counters
+ * @{
+ */
+
+typedef enum {
+  PN_ALLOC_OBJECT,      /**< objects of no other subsystem */
+  PN_ALLOC_STRING,      /**< pn_string_t and its bytes */
+  PN_ALLOC_COLLECTION,  /**< lists, maps, hashes and iterators */
+  PN_ALLOC_RECORD,      /**< records and their fields */
+  PN_ALLOC_EVENT,       /**< collectors and events */
+  PN_ALLOC_BUFFER,      /**< pn_buffer_t and its bytes */
+  PN_ALLOC_CODEC,       /**< pn_data_t, encoders, decoders and arenas */
+  PN_ALLOC_ENGINE,      /**< connections, sessions, links and deliveries */
+  PN_ALLOC_TRANSPORT,   /**< transports and their buffers */
+  PN_ALLOC_MESSAGE,     /**< messages */
+  PN_ALLOC_MESSENGER,   /**< messengers, their stores and shards */
+  PN_ALLOC_REACTOR,     /**< reactors, handlers, timers and tasks */
+  PN_ALLOC_IO,          /**< selectors, selectables, resolvers and their buffers */
+  PN_ALLOC_SUBSYSTEMS   /**< the number of subsystems */
+} pn_alloc_subsystem_t;
+
+typedef struct {
+  uint64_t allocations;    /**< blocks allocated */
+  uint64_t reallocations;  /**< blocks resized */
+  uint64_t frees;          /**< blocks freed */
+  uint64_t bytes;          /**< bytes asked for by allocations and resizes */
+} pn_alloc_counters_t;
+
+/**
+ * Whether the library was built to count its allocations.
+ */
+PN_EXTERN bool pn_alloc_tracking(void);
+
+/**
+ * The name of a subsystem, e.g. "string" for ::PN_ALLOC_STRING.
+ */
+PN_EXTERN const char *pn_alloc_subsystem_name(pn_alloc_subsystem_t subsystem);
+
+/**
+ * Take a snapshot of a subsystem's counters.
+ *
+ * May be called from any thread, the counters of a subsystem other
+ * threads are allocating for may be a few operations apart.
+ *
+ * @param[in] subsystem a subsystem, or ::PN_ALLOC_SUBSYSTEMS for the
+ * total
+ * @param[out] counters filled with the counters
+ */
+PN_EXTERN void pn_alloc_counters(pn_alloc_subsystem_t subsystem, pn_alloc_counters_t *counters);
+
+/**
+ * Append a table of the counters of every subsystem that allocated to
+ * dst, one line each.
+ *
+ * @return zero, or an error code if dst could not grow
+ */
+PN_EXTERN int pn_alloc_dump(pn_string_t *dst);
+
+/**
+ * The hooks of an allocator. Each gets the allocator's context and
+ * otherwise behaves like the C library call it replaces: reallocate
+ * of NULL allocates, and deallocate is never given NULL.
+ */
+typedef struct {
+  void *(*allocate)(void *context, size_t size);
+  void *(*reallocate)(void *context, void *ptr, size_t size);
+  void (*deallocate)(void *context, void *ptr);
+  void *context;
+} pn_allocator_t;
+
+/**
+ * Send every allocation the library makes through allocator, or
+ * through the C library's again if allocator is NULL. The hooks are
+ * copied.
+ *
+ * Memory must be freed by the allocator that allocated it, so this
+ * must be called before the library allocates anything, typically
+ * first thing in main, and not while any thread is using the
+ * library. The hooks may be called from any thread using the library,
+ * an allocator that keeps an arena per thread, e.g. to keep each
+ * reactor thread's memory on its NUMA node, picks the arena itself.
+ *
+ * Memory allocated by libraries proton uses, e.g. OpenSSL, is not
+ * affected.
+ *
+ * @return zero, or PN_ARG_ERR if a hook is missing
+ */
+PN_EXTERN int pn_set_allocator(const pn_allocator_t *allocator);
+
+/** @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* alloc.h */
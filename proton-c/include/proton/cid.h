@@ -44,6 +44,7 @@ typedef enum {
   CID_pn_link,
   CID_pn_delivery,
   CID_pn_transport,
+  CID_pn_sasl_verifier,
 
   CID_pn_message,
 
@@ -51,8 +52,10 @@ typedef enum {
   CID_pn_handler,
   CID_pn_timer,
   CID_pn_task,
+  CID_pn_reactor_group,
 
   CID_pn_io,
+  CID_pn_socket_options,
   CID_pn_selector,
   CID_pn_selectable,
 
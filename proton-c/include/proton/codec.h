@@ -465,8 +465,37 @@ PN_EXTERN bool pn_data_enter(pn_data_t *data);
  */
 PN_EXTERN bool pn_data_exit(pn_data_t *data);
 
+/**
+ * Look up a string or symbol key among the remaining key/value pairs
+ * of a map, starting after the current node. If the key is found the
+ * current node is set to its value, otherwise to the last node of the
+ * map.
+ *
+ * Looking up in a large map from its start more than once, without
+ * modifying the data in between, builds an index for the map so that
+ * further lookups take constant time.
+ *
+ * @param data a pn_data object entered into a map
+ * @param name the key to look up
+ * @return true iff the key was found with a value
+ */
 PN_EXTERN bool pn_data_lookup(pn_data_t *data, const char *name);
 
+/**
+ * Look up several string or symbol keys of a map in one go, as
+ * ::pn_data_lookup() does for one of them. The current node is left
+ * unchanged.
+ *
+ * @param data a pn_data object entered into a map
+ * @param names the keys to look up
+ * @param count the number of keys
+ * @param values filled in with the point of each key's value, for use
+ *        with ::pn_data_restore(), or zero for a key that is not found
+ * @return the number of keys found
+ */
+PN_EXTERN size_t pn_data_lookup_keys(pn_data_t *data, const char **names, size_t count,
+                                     pn_handle_t *values);
+
 /**
  * Access the type of the current node. Returns an undefined value if
  * there is no current node.
@@ -520,6 +549,19 @@ PN_EXTERN ssize_t pn_data_encode(pn_data_t *data, char *bytes, size_t size);
  */
 PN_EXTERN ssize_t pn_data_encoded_size(pn_data_t *data);
 
+/**
+ * Controls whether ::pn_data_decode decodes lazily. In lazy mode the
+ * elements of a decoded list or map are kept in encoded form until
+ * the list or map is entered, and lists and maps that are never
+ * entered are copied and re-encoded without being decoded at all.
+ * Malformed elements are then only reported when the enclosing list
+ * or map is entered. Lazy mode is off by default.
+ *
+ * @param data a pn_data_t object
+ * @param lazy true to decode lazily
+ */
+PN_EXTERN void pn_data_set_lazy(pn_data_t *data, bool lazy);
+
 /**
  * Decodes a single value from the contents of the AMQP data stream
  * into the current data object. Note that if the pn_data_t object is
@@ -618,6 +660,28 @@ PN_EXTERN int pn_data_put_map(pn_data_t *data);
  */
 PN_EXTERN int pn_data_put_array(pn_data_t *data, bool described, pn_type_t type);
 
+/**
+ * Puts an undescribed array of fixed width values into a pn_data_t in
+ * a single operation. The values are copied from host memory and are
+ * held as one contiguous block rather than as a node per element.
+ * Only fixed width element types (numeric types, char, timestamp,
+ * decimals and uuid) are supported.
+ *
+ * @code
+ *   double samples[1024];
+ *   ...
+ *   pn_data_put_array_values(data, PN_DOUBLE, samples, 1024);
+ * @endcode
+ *
+ * @param data a pn_data_t object
+ * @param type the type of the array elements
+ * @param values the element values in host representation
+ * @param count the number of elements
+ *
+ * @return zero on success or an error code on failure
+ */
+PN_EXTERN int pn_data_put_array_values(pn_data_t *data, pn_type_t type, const void *values, size_t count);
+
 /**
  * Puts a described value into a pn_data_t object. A described node
  * has two children, the descriptor and the value. These are specified
@@ -960,6 +1024,21 @@ PN_EXTERN bool pn_data_is_array_described(pn_data_t *data);
  */
 PN_EXTERN pn_type_t pn_data_get_array_type(pn_data_t *data);
 
+/**
+ * Copies up to @var count elements of the current array node into
+ * host memory. The array must be of the given fixed width element
+ * type. Any descriptor is skipped.
+ *
+ * @param data a pn_data_t object
+ * @param type the element type of the array
+ * @param values the destination for the element values
+ * @param count the maximum number of elements to copy
+ *
+ * @return the number of elements copied or an error code if the
+ * current node is not an array of the given type
+ */
+PN_EXTERN ssize_t pn_data_get_array_values(pn_data_t *data, pn_type_t type, void *values, size_t count);
+
 /**
  * Checks if the current node is a described value. The descriptor and
  * value may be accessed by entering the described value node.
@@ -432,6 +432,42 @@ PN_EXTERN pn_data_t *pn_connection_remote_properties(pn_connection_t *connection
  */
 PN_EXTERN pn_transport_t *pn_connection_transport(pn_connection_t *connection);
 
+/**
+ * Get the incoming budget of a connection measured in bytes.
+ *
+ * @param[in] connection the connection object
+ * @return the incoming budget in bytes, or zero if there is none
+ */
+PN_EXTERN size_t pn_connection_get_incoming_budget(pn_connection_t *connection);
+
+/**
+ * Bound the message data a connection buffers across all of its
+ * sessions.
+ *
+ * Each session's incoming window is limited to an even share of what
+ * is left of the budget, though never below one frame, so the budget
+ * may be overrun by up to a frame per session. Once the
+ * budget is reached every window is closed and no more link credit
+ * is given to the peer, until the data buffered has been read down
+ * to half the budget. The credit granted with ::pn_link_flow in the
+ * meantime is then sent. This works alongside the incoming capacity
+ * of each session, whichever is tighter applies. The default of zero
+ * sets no budget.
+ *
+ * @param[in] connection the connection object
+ * @param[in] budget the incoming budget in bytes
+ */
+PN_EXTERN void pn_connection_set_incoming_budget(pn_connection_t *connection, size_t budget);
+
+/**
+ * Get the number of bytes received on a connection and not yet read,
+ * as counted against its incoming budget.
+ *
+ * @param[in] connection the connection object
+ * @return the bytes buffered across all sessions
+ */
+PN_EXTERN size_t pn_connection_incoming_bytes(pn_connection_t *connection);
+
 /** @}
  */
 
@@ -0,0 +1,242 @@
+#ifndef PROTON_CONNECTION_DRIVER_H
+#define PROTON_CONNECTION_DRIVER_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/import_export.h>
+#include <proton/type_compat.h>
+#include <proton/types.h>
+#include <proton/event.h>
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ *
+ * Connection driver API for the proton Engine.
+ *
+ * A connection driver ties a connection, its transport and a collector
+ * together so that an event loop of the application's own, rather
+ * than the reactor, can do the IO for the connection. The loop reads
+ * into the buffer from ::pn_connection_driver_read_buffer() and
+ * reports what it read with ::pn_connection_driver_read_done(), writes
+ * what ::pn_connection_driver_write_buffer() gives it and reports what
+ * was written with ::pn_connection_driver_write_done(), and calls
+ * ::pn_connection_driver_tick() by the deadline it returns. The events
+ * that result are handled one at a time from
+ * ::pn_connection_driver_next_event().
+ *
+ * The buffers are the transport's own, so nothing is copied on the
+ * way in or out, and a read or write can be left outstanding while
+ * the loop does something else, such as with a completion based API
+ * like io_uring or IOCP. A buffer is valid until the matching done
+ * call, and no other call may be made on the driver in between except
+ * for the other direction's buffer and done.
+ *
+ * A driver is not thread safe, but it has no thread of its own, so
+ * different drivers can be run on different threads.
+ *
+ * @defgroup connection_driver Connection Driver
+ * @ingroup engine
+ * @{
+ */
+
+/**
+ * The connection, transport and collector a driver ties together.
+ *
+ * The fields may be used directly, for example to configure the
+ * transport before it is bound, but the collector's events must only
+ * be taken through ::pn_connection_driver_next_event().
+ */
+typedef struct pn_connection_driver_t {
+  pn_connection_t *connection;
+  pn_transport_t *transport;
+  pn_collector_t *collector;
+  bool handling;   // the collector's head event has been handed out
+} pn_connection_driver_t;
+
+/**
+ * Set up a driver.
+ *
+ * The connection and transport are bound once the application has
+ * handled the driver's PN_CONNECTION_INIT event, so they can be
+ * configured in that event's handler, or before any events are taken
+ * with ::pn_connection_driver_bind() called afterwards.
+ *
+ * @param[in] driver the driver to set up
+ * @param[in] connection the connection to drive, or NULL for a new one.
+ * The driver owns the connection.
+ * @param[in] transport the transport to use, or NULL for a new one.
+ * The driver owns the transport.
+ * @return 0 on success, or an error code, which leaves nothing for
+ * ::pn_connection_driver_destroy() to do
+ */
+PN_EXTERN int pn_connection_driver_init(pn_connection_driver_t *driver,
+                                        pn_connection_t *connection,
+                                        pn_transport_t *transport);
+
+/**
+ * Bind the driver's connection and transport now, rather than once
+ * PN_CONNECTION_INIT is handled.
+ *
+ * @param[in] driver a driver
+ * @return 0 on success, or the error from ::pn_transport_bind()
+ */
+PN_EXTERN int pn_connection_driver_bind(pn_connection_driver_t *driver);
+
+/**
+ * Free the driver's connection, transport and collector.
+ *
+ * @param[in] driver a driver, which is left cleared
+ */
+PN_EXTERN void pn_connection_driver_destroy(pn_connection_driver_t *driver);
+
+/**
+ * The buffer to read input into.
+ *
+ * @param[in] driver a driver
+ * @return the space the transport has for input, empty if it wants no
+ * more input for now, or for good once its read side is closed
+ */
+PN_EXTERN pn_rwbytes_t pn_connection_driver_read_buffer(pn_connection_driver_t *driver);
+
+/**
+ * Report that input was read into the read buffer and process it.
+ *
+ * @param[in] driver a driver
+ * @param[in] size the number of bytes read, from the start of the
+ * buffer
+ */
+PN_EXTERN void pn_connection_driver_read_done(pn_connection_driver_t *driver, size_t size);
+
+/**
+ * Report that there will be no more input, for example because the
+ * peer closed its side of the socket.
+ *
+ * @param[in] driver a driver
+ */
+PN_EXTERN void pn_connection_driver_read_close(pn_connection_driver_t *driver);
+
+/**
+ * The output to write.
+ *
+ * @param[in] driver a driver
+ * @return the bytes the transport has to send, empty if there are none
+ * for now, or for good once its write side is closed
+ */
+PN_EXTERN pn_bytes_t pn_connection_driver_write_buffer(pn_connection_driver_t *driver);
+
+/**
+ * Report that output from the write buffer was written.
+ *
+ * @param[in] driver a driver
+ * @param[in] size the number of bytes written, from the start of the
+ * buffer
+ */
+PN_EXTERN void pn_connection_driver_write_done(pn_connection_driver_t *driver, size_t size);
+
+/**
+ * Report that no more output can be written, for example because the
+ * socket failed.
+ *
+ * @param[in] driver a driver
+ */
+PN_EXTERN void pn_connection_driver_write_close(pn_connection_driver_t *driver);
+
+/**
+ * Close both the read and the write side.
+ *
+ * @param[in] driver a driver
+ */
+PN_EXTERN void pn_connection_driver_close(pn_connection_driver_t *driver);
+
+/**
+ * Run the transport's timers, such as for heartbeats and idle
+ * timeouts.
+ *
+ * @param[in] driver a driver
+ * @param[in] now the current time in milliseconds
+ * @return zero if there are no timers, otherwise the time by which
+ * this must be called again
+ */
+PN_EXTERN pn_timestamp_t pn_connection_driver_tick(pn_connection_driver_t *driver,
+                                                   pn_timestamp_t now);
+
+/**
+ * The next event to handle.
+ *
+ * The event returned before is done with by this call, and events
+ * coming from it, such as connection and transport ones going on to
+ * bind or release the driver, take effect then.
+ *
+ * @param[in] driver a driver
+ * @return the next event, or NULL if there is none until more IO is
+ * done or the endpoints are changed
+ */
+PN_EXTERN pn_event_t *pn_connection_driver_next_event(pn_connection_driver_t *driver);
+
+/**
+ * Whether ::pn_connection_driver_next_event() has an event to return.
+ *
+ * @param[in] driver a driver
+ * @return true if there is an event to handle
+ */
+PN_EXTERN bool pn_connection_driver_has_event(pn_connection_driver_t *driver);
+
+/**
+ * Whether the driver is done with, once both sides are closed and the
+ * PN_TRANSPORT_CLOSED event has been handled.
+ *
+ * @param[in] driver a driver
+ * @return true if the driver has nothing more to do and can be
+ * destroyed
+ */
+PN_EXTERN bool pn_connection_driver_finished(pn_connection_driver_t *driver);
+
+/**
+ * Set an error on the transport's condition and close both sides, for
+ * example when the socket could not be connected or failed.
+ *
+ * @param[in] driver a driver
+ * @param[in] name the condition name, such as "proton:io"
+ * @param[in] fmt a printf style format for the description
+ */
+PN_EXTERN void pn_connection_driver_errorf(pn_connection_driver_t *driver, const char *name,
+                                           const char *fmt, ...);
+
+/**
+ * The va_list form of ::pn_connection_driver_errorf().
+ */
+PN_EXTERN void pn_connection_driver_verrorf(pn_connection_driver_t *driver, const char *name,
+                                            const char *fmt, va_list ap);
+
+/** @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* connection_driver.h */
@@ -617,6 +617,7 @@ typedef unsigned long int uintptr_t;
 %include "proton/disposition.h"
 %ignore pn_transport_vlogf;
 %include "proton/transport.h"
+%include "proton/metrics.h"
 %include "proton/event.h"
 
 %contract pn_message_free(pn_message_t *msg)
@@ -114,6 +114,29 @@ PN_EXTERN pn_record_t *pn_delivery_attachments(pn_delivery_t *delivery);
  */
 PN_EXTERN pn_delivery_tag_t pn_delivery_tag(pn_delivery_t *delivery);
 
+/**
+ * Get the message format of a delivery.
+ *
+ * Zero is the standard AMQP message format. Outgoing deliveries have
+ * the format they were given with ::pn_delivery_set_message_format,
+ * incoming ones the format the peer sent.
+ *
+ * @param[in] delivery a delivery object
+ * @return the message format
+ */
+PN_EXTERN uint32_t pn_delivery_message_format(pn_delivery_t *delivery);
+
+/**
+ * Set the message format of an outgoing delivery, such as
+ * ::PN_MESSAGE_FORMAT_BATCH for several messages packed by
+ * ::pn_message_encode_batch. It has to be set before the first of the
+ * delivery's data is sent.
+ *
+ * @param[in] delivery a delivery object
+ * @param[in] format the message format
+ */
+PN_EXTERN void pn_delivery_set_message_format(pn_delivery_t *delivery, uint32_t format);
+
 /**
  * Get the parent link for a delivery object.
  *
@@ -176,6 +199,57 @@ PN_EXTERN bool pn_delivery_settled(pn_delivery_t *delivery);
  */
 PN_EXTERN size_t pn_delivery_pending(pn_delivery_t *delivery);
 
+/**
+ * Get a contiguous view of the pending message data for a delivery.
+ *
+ * The view points into the delivery's buffer and is valid until the
+ * data is consumed or more data arrives for the delivery. Buffered
+ * data that has wrapped or that is held in several segments is moved
+ * into place first, so prefer ::pn_link_recv_peek or
+ * ::pn_delivery_segment when several views will do.
+ *
+ * @param[in] delivery a delivery object
+ * @return a view of the pending message data
+ */
+PN_EXTERN pn_bytes_t pn_delivery_pending_bytes(pn_delivery_t *delivery);
+
+/**
+ * Get the number of segments the pending data of a delivery is held in.
+ *
+ * Large incoming deliveries are held as a list of segments rather than
+ * in one contiguous buffer. There is always at least one segment,
+ * though it may be empty.
+ *
+ * @param[in] delivery a delivery object
+ * @return the number of segments
+ */
+PN_EXTERN size_t pn_delivery_segments(pn_delivery_t *delivery);
+
+/**
+ * Get a view of one segment of the pending data of a delivery.
+ *
+ * Segments are in order, and together they hold exactly
+ * ::pn_delivery_pending bytes. The view is valid until the data is
+ * consumed or more data arrives for the delivery.
+ *
+ * @param[in] delivery a delivery object
+ * @param[in] index the segment index
+ * @return a view of the segment, empty if the index is out of range
+ */
+PN_EXTERN pn_bytes_t pn_delivery_segment(pn_delivery_t *delivery, size_t index);
+
+/**
+ * Hint the total size of an incoming delivery.
+ *
+ * Room for the rest of the message is reserved in one allocation, so
+ * the data still to arrive is written straight into place without
+ * further segments or copying.
+ *
+ * @param[in] delivery an incoming delivery object
+ * @param[in] size the expected size of the whole message in bytes
+ */
+PN_EXTERN void pn_delivery_expect(pn_delivery_t *delivery, size_t size);
+
 /**
  * Check if a delivery only has partial message data.
  *
@@ -299,6 +373,52 @@ PN_EXTERN pn_delivery_t *pn_work_head(pn_connection_t *connection);
  */
 PN_EXTERN pn_delivery_t *pn_work_next(pn_delivery_t *delivery);
 
+/**
+ * Get the first link on the connection with deliveries that have
+ * pending operations.
+ *
+ * The connection keeps a list of just these links, so an application
+ * serving each link from its own task can find the links to run
+ * without walking every delivery.
+ *
+ * @param[in] connection the connection
+ * @return the first link with work, else NULL if none
+ */
+PN_EXTERN pn_link_t *pn_work_link_head(pn_connection_t *connection);
+
+/**
+ * Get the next link on the connection with deliveries that have
+ * pending operations.
+ *
+ * @param[in] link the previous link retrieved from either
+ *                 pn_work_link_head or pn_work_link_next
+ * @return the next link with work, else NULL if none. If @p link has
+ * had all its work done since it was retrieved, the walk starts over
+ * from pn_work_link_head.
+ */
+PN_EXTERN pn_link_t *pn_work_link_next(pn_link_t *link);
+
+/**
+ * Get the first delivery on a link that has pending operations, the
+ * same deliveries pn_work_head and pn_work_next find on the link's
+ * connection, without looking at any other link's.
+ *
+ * @param[in] link the link
+ * @return the first delivery on the link that needs to be serviced,
+ * else NULL if none
+ */
+PN_EXTERN pn_delivery_t *pn_link_work_head(pn_link_t *link);
+
+/**
+ * Get the next delivery on the same link that has pending operations.
+ *
+ * @param[in] delivery the previous delivery retrieved from either
+ *                     pn_link_work_head or pn_link_work_next
+ * @return the next delivery on the link that has pending operations,
+ * else NULL if none
+ */
+PN_EXTERN pn_delivery_t *pn_link_work_next(pn_delivery_t *delivery);
+
 /** @}
  */
 
@@ -38,5 +38,6 @@
 #include <proton/delivery.h>
 #include <proton/event.h>
 #include <proton/transport.h>
+#include <proton/metrics.h>
 
 #endif /* engine.h */
@@ -334,6 +334,28 @@ PN_EXTERN void pn_collector_free(pn_collector_t *collector);
  */
 PN_EXTERN void pn_collector_release(pn_collector_t *collector);
 
+/**
+ * Choose whether a collector records events of a given type.
+ *
+ * A collector records every type of event until told otherwise. Events
+ * of a type that is not recorded are elided by ::pn_collector_put
+ * before anything is allocated for them.
+ *
+ * @param[in] collector a collector object
+ * @param[in] type the event type
+ * @param[in] subscribe true to record events of this type
+ */
+PN_EXTERN void pn_collector_subscribe(pn_collector_t *collector, pn_event_type_t type, bool subscribe);
+
+/**
+ * Check whether a collector records events of a given type.
+ *
+ * @param[in] collector a collector object
+ * @param[in] type the event type
+ * @return true if events of this type are recorded
+ */
+PN_EXTERN bool pn_collector_subscribed(pn_collector_t *collector, pn_event_type_t type);
+
 /**
  * Place a new event on a collector.
  *
@@ -342,6 +364,11 @@ PN_EXTERN void pn_collector_release(pn_collector_t *collector);
  * cases an event of the given type and context can be elided. When
  * this happens, this operation will return a NULL pointer.
  *
+ * Events are elided when their type is not subscribed to, when they
+ * repeat the last event, and for ::PN_DELIVERY, ::PN_LINK_FLOW,
+ * ::PN_TRANSPORT and ::PN_SELECTABLE_UPDATED, when an event of the
+ * same type and context is already pending behind the head event.
+ *
  * @param[in] collector a collector object
  * @param[in] type the event type
  * @param[in] context the event context
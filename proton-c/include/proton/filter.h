@@ -0,0 +1,144 @@
+#ifndef PROTON_FILTER_H
+#define PROTON_FILTER_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/import_export.h>
+#include <proton/error.h>
+#include <proton/terminus.h>
+#include <proton/type_compat.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ *
+ * Message selector API.
+ *
+ * A filter is a JMS style message selector, such as
+ * "color = 'red' AND weight BETWEEN 10 AND 20", compiled once and
+ * then matched against encoded messages. Matching reads only the
+ * header, properties and application properties sections, and only
+ * decodes the fields the selector names, so a message need not be
+ * decoded with ::pn_message_decode to be filtered.
+ *
+ * The selector supports the SQL-92 subset of JMS: the comparison and
+ * arithmetic operators, AND, OR and NOT, [NOT] BETWEEN, [NOT] LIKE
+ * with an optional ESCAPE, [NOT] IN with string literals, IS [NOT]
+ * NULL, and string, numeric and boolean literals. Comparisons with a
+ * missing property are unknown, as in SQL, and a message is only
+ * selected when the selector is true.
+ *
+ * An identifier names an application property, except for the JMS
+ * header names JMSDeliveryMode, JMSPriority, JMSMessageID,
+ * JMSCorrelationID, JMSTimestamp, JMSExpiration, JMSXUserID,
+ * JMSXGroupID, JMSXGroupSeq and JMSXDeliveryCount, which name the
+ * corresponding header and properties fields.
+ *
+ * A filter keeps the state of the match under way, so a filter must
+ * only be used by one thread at a time.
+ *
+ * @defgroup filter Filter
+ * @ingroup message
+ * @{
+ */
+
+/**
+ * A compiled message selector.
+ */
+typedef struct pn_filter_t pn_filter_t;
+
+/**
+ * Create a filter that selects every message until a selector is
+ * compiled into it.
+ *
+ * @return a new filter
+ */
+PN_EXTERN pn_filter_t *pn_filter(void);
+
+/**
+ * Free a filter.
+ *
+ * @param[in] filter a filter, or NULL
+ */
+PN_EXTERN void pn_filter_free(pn_filter_t *filter);
+
+/**
+ * Compile a selector into a filter, replacing any compiled before.
+ *
+ * @param[in] filter a filter
+ * @param[in] selector the selector text, or NULL or an empty selector
+ * to select every message
+ * @return zero on success, or PN_ARG_ERR if the selector is not valid,
+ * which leaves a description in ::pn_filter_error() and the filter
+ * selecting every message
+ */
+PN_EXTERN int pn_filter_compile(pn_filter_t *filter, const char *selector);
+
+/**
+ * Compile the selector of a link source's filter set.
+ *
+ * The selector is the string of the filter described by
+ * apache.org:selector-filter:string, or the equivalent code
+ * 0x0000468C00000004. A filter set without one selects every message.
+ *
+ * @param[in] filter a filter
+ * @param[in] terminus the terminus whose ::pn_terminus_filter() holds
+ * the selector
+ * @return as for ::pn_filter_compile()
+ */
+PN_EXTERN int pn_filter_compile_terminus(pn_filter_t *filter, pn_terminus_t *terminus);
+
+/**
+ * Match an encoded message against a filter.
+ *
+ * The bytes are only read up to the end of the application properties
+ * section, so a delivery may be matched once the front of the message
+ * has arrived.
+ *
+ * @param[in] filter a filter
+ * @param[in] bytes the encoded message
+ * @param[in] size the size of the encoded message
+ * @return 1 if the message is selected, 0 if not, or an error code if
+ * a section the selector needs is malformed
+ */
+PN_EXTERN int pn_filter_match(pn_filter_t *filter, const char *bytes, size_t size);
+
+/**
+ * The error from the last compile or match.
+ *
+ * @param[in] filter a filter
+ * @return the filter's error, only valid until the filter is freed
+ */
+PN_EXTERN pn_error_t *pn_filter_error(pn_filter_t *filter);
+
+/** @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* filter.h */
@@ -48,6 +48,23 @@ PN_EXTERN pn_handshaker_t *pn_handshaker(void);
 PN_EXTERN pn_iohandler_t *pn_iohandler(void);
 PN_EXTERN pn_flowcontroller_t *pn_flowcontroller(int window);
 
+/**
+ * Create a flow controller that batches credit and sizes it to a
+ * memory budget.
+ *
+ * Credit is topped up to a link's window only once half of it has been
+ * used, rather than after every delivery. If @p budget is not zero, the
+ * receivers of a connection share it between them in proportion to how
+ * quickly each consumes its deliveries, evenly until that is known. A
+ * link's window is its share divided by its average delivery size,
+ * between 2 and @p window.
+ *
+ * @param[in] window the largest credit window of a link
+ * @param[in] budget bytes the receivers of a connection may buffer, or
+ * zero for no limit
+ */
+PN_EXTERN pn_flowcontroller_t *pn_flowcontroller_autotune(int window, size_t budget);
+
 /** @}
  */
 
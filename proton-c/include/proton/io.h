@@ -26,6 +26,7 @@
 #include <proton/error.h>
 #include <sys/types.h>
 #include <proton/type_compat.h>
+#include <proton/types.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -92,12 +93,96 @@ typedef struct pn_io_t pn_io_t;
  */
 typedef struct pn_selector_t pn_selector_t;
 
+/**
+ * A ::pn_socket_options_t holds tuning for the sockets of a
+ * ::pn_io_t, or of a single acceptor or reactor connection. Options
+ * that are not set keep the platform's default, except that Nagle's
+ * algorithm is disabled unless turned back on. Options the platform
+ * does not have are ignored.
+ */
+typedef struct pn_socket_options_t pn_socket_options_t;
+
+PN_EXTERN pn_socket_options_t *pn_socket_options(void);
+PN_EXTERN void pn_socket_options_free(pn_socket_options_t *options);
+
+/** Set the kernel send and receive buffer sizes (SO_SNDBUF,
+ * SO_RCVBUF), zero leaves a size alone. A receive buffer large enough
+ * for a long fat link must be set before the connection is made,
+ * which is why these options are applied when the socket is created.
+ */
+PN_EXTERN void pn_socket_options_set_buffers(pn_socket_options_t *options, int send, int receive);
+
+/** Disable Nagle's algorithm (TCP_NODELAY), the default. */
+PN_EXTERN void pn_socket_options_set_nodelay(pn_socket_options_t *options, bool nodelay);
+
+/** Acknowledge received data at once rather than delaying the ACK
+ * (TCP_QUICKACK, Linux only).
+ */
+PN_EXTERN void pn_socket_options_set_quickack(pn_socket_options_t *options, bool quickack);
+
+/** Hold writes back until a full segment can be sent, or 200ms have
+ * passed (TCP_CORK on Linux, TCP_NOPUSH on BSD). This trades latency
+ * for fewer, fuller packets on bulk links and overrides nodelay.
+ */
+PN_EXTERN void pn_socket_options_set_cork(pn_socket_options_t *options, bool cork);
+
+/** Limit the data queued in the kernel that has not been sent yet
+ * (TCP_NOTSENT_LOWAT), keeping the backlog in the transport where it
+ * can still be reprioritised.
+ */
+PN_EXTERN void pn_socket_options_set_notsent_lowat(pn_socket_options_t *options, int bytes);
+
+/** Busy poll the device for this many microseconds on a read that
+ * would otherwise block (SO_BUSY_POLL, Linux only).
+ */
+PN_EXTERN void pn_socket_options_set_busy_poll(pn_socket_options_t *options, int usecs);
+
+/** Turn on TCP keepalive (SO_KEEPALIVE). The first probe is sent after
+ * idle seconds without traffic, then every interval seconds until
+ * count probes went unanswered. Zero keeps the system default for
+ * that parameter.
+ */
+PN_EXTERN void pn_socket_options_set_keepalive(pn_socket_options_t *options, bool keepalive,
+                                               int idle, int interval, int count);
+
+/** Send output of at least threshold bytes without copying it into
+ * the kernel (SO_ZEROCOPY and MSG_ZEROCOPY, Linux only), zero turns
+ * it off. The kernel then reads the transport's output buffer itself,
+ * so the buffer is held until the socket reports the send done. This
+ * saves the copy for large messages but costs more than it saves for
+ * small ones, so pick a threshold in the tens of kilobytes. Only
+ * reactor connections use it, and not with the io_uring selector.
+ */
+PN_EXTERN void pn_socket_options_set_zerocopy(pn_socket_options_t *options, int threshold);
+
+/** Apply the options to a socket from this io.
+ *
+ * @return 0 on success, or an error code also recorded on io. All the
+ *         options are tried even if one fails.
+ */
+PN_EXTERN int pn_socket_options_apply(pn_io_t *io, pn_socket_options_t *options, pn_socket_t socket);
+
 PN_EXTERN pn_io_t *pn_io(void);
 PN_EXTERN void pn_io_free(pn_io_t *io);
 PN_EXTERN pn_error_t *pn_io_error(pn_io_t *io);
 PN_EXTERN pn_socket_t pn_connect(pn_io_t *io, const char *host, const char *port);
 PN_EXTERN pn_socket_t pn_listen(pn_io_t *io, const char *host, const char *port);
 PN_EXTERN pn_socket_t pn_accept(pn_io_t *io, pn_socket_t socket, char *name, size_t size);
+
+/** Connect to, or listen on, a local (Unix domain) socket.
+ *
+ * Co-located peers avoid the TCP stack this way. Connections accepted
+ * from such a listener are named after its path. On Linux a path
+ * starting with '@' names a socket in the abstract namespace. Listening
+ * replaces a socket file left at path. Socket options do not apply to
+ * local sockets.
+ *
+ * @return the socket, or PN_INVALID_SOCKET with the error set on io,
+ *         also where local sockets are not supported
+ */
+PN_EXTERN pn_socket_t pn_connect_unix(pn_io_t *io, const char *path);
+PN_EXTERN pn_socket_t pn_listen_unix(pn_io_t *io, const char *path);
+
 PN_EXTERN void pn_close(pn_io_t *io, pn_socket_t socket);
 PN_EXTERN ssize_t pn_send(pn_io_t *io, pn_socket_t socket, const void *buf, size_t size);
 PN_EXTERN ssize_t pn_recv(pn_io_t *io, pn_socket_t socket, void *buf, size_t size);
@@ -107,6 +192,22 @@ PN_EXTERN ssize_t pn_write(pn_io_t *io, pn_socket_t socket, const void *buf, siz
 PN_EXTERN bool pn_wouldblock(pn_io_t *io);
 PN_EXTERN pn_selector_t *pn_io_selector(pn_io_t *io);
 
+/** The options applied to every socket pn_listen(), pn_connect() and
+ * pn_accept() create. Changing the options affects later sockets only.
+ */
+PN_EXTERN pn_socket_options_t *pn_io_get_socket_options(pn_io_t *io);
+PN_EXTERN void pn_io_set_socket_options(pn_io_t *io, pn_socket_options_t *options);
+
+/** How long, in milliseconds, pn_connect() keeps using the address a
+ * host name resolved to before looking it up again. This spares the
+ * DNS server when many connections to the same hosts are made, e.g.
+ * while reconnecting. The system resolver does not report the TTL of
+ * the records, so pick one no longer than theirs. Zero, the default,
+ * looks the name up every time.
+ */
+PN_EXTERN pn_millis_t pn_io_get_resolve_ttl(pn_io_t *io);
+PN_EXTERN void pn_io_set_resolve_ttl(pn_io_t *io, pn_millis_t ttl);
+
 #ifdef __cplusplus
 }
 #endif
@@ -386,6 +386,29 @@ PN_EXTERN bool pn_link_advance(pn_link_t *link);
  */
 PN_EXTERN int pn_link_credit(pn_link_t *link);
 
+/**
+ * Get the incoming high-water mark of a receiving link.
+ *
+ * @param[in] receiver a receiving link object
+ * @return the incoming high-water mark in bytes, or zero if unset
+ */
+PN_EXTERN size_t pn_link_get_incoming_high_water(pn_link_t *receiver);
+
+/**
+ * Set the incoming high-water mark of a receiving link.
+ *
+ * While any delivery on the link has this many bytes or more buffered,
+ * the session issues no further incoming window, so a peer streaming a
+ * large message is held back until the application reads the delivery
+ * down again. This relies on the session window being measured in
+ * frames, so the transport needs a maximum frame size. The default of
+ * zero sets no mark.
+ *
+ * @param[in] receiver a receiving link object
+ * @param[in] high_water the incoming high-water mark in bytes
+ */
+PN_EXTERN void pn_link_set_incoming_high_water(pn_link_t *receiver, size_t high_water);
+
 /**
  * Get the number of queued deliveries for a link.
  *
@@ -565,6 +588,22 @@ PN_EXTERN pn_delivery_t *pn_unsettled_head(pn_link_t *link);
  */
 PN_EXTERN pn_delivery_t *pn_unsettled_next(pn_delivery_t *delivery);
 
+/**
+ * Settle a link's unsettled deliveries up to and including a given one.
+ *
+ * Every delivery on the link from the oldest unsettled one through @p
+ * last is updated to @p state, unless that is zero, and settled, just
+ * as by ::pn_delivery_update and ::pn_delivery_settle. The deliveries
+ * are handed to the transport in order, so a run of consecutive
+ * delivery ids is acknowledged with a single disposition frame.
+ *
+ * @param[in] link a link object
+ * @param[in] last the last delivery to settle, which must belong to link
+ * @param[in] state the disposition to apply, or zero to leave it as is
+ * @return the number of deliveries settled
+ */
+PN_EXTERN size_t pn_link_settle_upto(pn_link_t *link, pn_delivery_t *last, uint64_t state);
+
 /**
  * @defgroup sender Sender
  * @{
@@ -589,6 +628,79 @@ PN_EXTERN void pn_link_offered(pn_link_t *sender, int credit);
  */
 PN_EXTERN ssize_t pn_link_send(pn_link_t *sender, const char *bytes, size_t n);
 
+/**
+ * Callback releasing bytes handed to ::pn_link_adopt.
+ */
+typedef void (*pn_link_release_t)(void *context);
+
+/**
+ * Send message data for the current delivery on a link without
+ * copying it.
+ *
+ * The delivery keeps a reference to the caller's bytes, which must
+ * stay valid and unchanged until @p release has been called with
+ * @p context. The transport frames straight from this memory and
+ * calls @p release once the last of it has been written out, or when
+ * the delivery is freed, whichever comes first.
+ *
+ * A delivery holds one adopted buffer at a time. Adopting another or
+ * calling ::pn_link_send copies the bytes still pending from the
+ * previous one and releases it early.
+ *
+ * @param[in] sender a sender link object
+ * @param[in] bytes the start of the message data
+ * @param[in] n the number of bytes of message data
+ * @param[in] release called once the bytes are no longer referenced
+ * @param[in] context passed to @p release
+ * @return the number of bytes adopted, or an error code; unless all n
+ * bytes were adopted the caller keeps them and @p release is not called
+ */
+PN_EXTERN ssize_t pn_link_adopt(pn_link_t *sender, const char *bytes, size_t n,
+                                pn_link_release_t release, void *context);
+
+/**
+ * Send the bytes of a string as message data for the current delivery
+ * on a link without copying them.
+ *
+ * This is ::pn_link_adopt with the delivery holding a reference to
+ * @p payload until its bytes have been written out. One payload, such
+ * as a message encoded once, can be sent this way on any number of
+ * links, and each delivery then costs only its own frames. The payload
+ * must not be changed while deliveries refer to it. If connections on
+ * other threads also send it, ::pn_share it before the first send.
+ *
+ * @param[in] sender a sender link object
+ * @param[in] payload the message data
+ * @return the number of bytes sent, or an error code
+ */
+PN_EXTERN ssize_t pn_link_send_shared(pn_link_t *sender, pn_string_t *payload);
+
+/**
+ * Send part of a file as message data for the current delivery on a
+ * link.
+ *
+ * The file is read a window at a time as the transport frames it,
+ * through a memory mapping where the platform has one, so a body of
+ * any size costs the same memory and its bytes are copied once, from
+ * the page cache into the transport's output. The descriptor is
+ * duplicated, so the caller may close its own straight away, but the
+ * range must not be cut short or changed until the delivery has sent
+ * it.
+ *
+ * Bytes already sent on the delivery go out first. Nothing more can
+ * be sent on the delivery until the file has been, though it can be
+ * given to ::pn_link_advance.
+ *
+ * @param[in] sender a sender link object
+ * @param[in] fd a regular file open for reading
+ * @param[in] offset where in the file the message data starts
+ * @param[in] size the number of bytes of message data
+ * @return the number of bytes queued, PN_ARG_ERR if the file is not
+ * that long, PN_STATE_ERR if the delivery is still sending a file, or
+ * another error code
+ */
+PN_EXTERN ssize_t pn_link_send_file(pn_link_t *sender, int fd, int64_t offset, size_t size);
+
 //PN_EXTERN void pn_link_abort(pn_sender_t *sender);
 
 /** @} */
@@ -646,6 +758,38 @@ PN_EXTERN void pn_link_set_drain(pn_link_t *receiver, bool drain);
  */
 PN_EXTERN ssize_t pn_link_recv(pn_link_t *receiver, char *bytes, size_t n);
 
+/**
+ * Look at message data for the current delivery on a link without
+ * copying it out.
+ *
+ * The data stays in the delivery's own buffer and may wrap around
+ * inside it, so it is described by up to two views: @p head followed
+ * by @p wrap. For a large delivery held in several segments only the
+ * first segment is described, so this may be less than
+ * ::pn_delivery_pending. Both views remain valid until the next call to
+ * ::pn_link_recv, ::pn_link_recv_consume or ::pn_transport_push on
+ * the owning transport. Peeking does not consume anything; use
+ * ::pn_link_recv_consume once the data has been processed.
+ *
+ * @param[in] receiver a receiving link object
+ * @param[out] head the first run of buffered data
+ * @param[out] wrap the remaining run of buffered data, possibly empty
+ * @return the number of bytes available, PN_EOS, or an error code
+ */
+PN_EXTERN ssize_t pn_link_recv_peek(pn_link_t *receiver, pn_bytes_t *head, pn_bytes_t *wrap);
+
+/**
+ * Discard message data previously seen with ::pn_link_recv_peek or
+ * ::pn_delivery_pending_bytes.
+ *
+ * This releases session window exactly as ::pn_link_recv does.
+ *
+ * @param[in] receiver a receiving link object
+ * @param[in] n the number of bytes to consume
+ * @return the number of bytes consumed, PN_EOS, or an error code
+ */
+PN_EXTERN ssize_t pn_link_recv_consume(pn_link_t *receiver, size_t n);
+
 /**
  * Check if a link is currently draining.
  *
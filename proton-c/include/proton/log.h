@@ -27,6 +27,7 @@
 
 #include <proton/import_export.h>
 #include <proton/type_compat.h>
+#include <stddef.h>
 
 /** Callback for customized logging. */
 typedef void (*pn_logger_t)(const char *message);
@@ -47,4 +48,28 @@ PN_EXTERN void pn_log_enable(bool enabled);
  */
 PN_EXTERN void pn_log_logger(pn_logger_t logger);
 
+/** Write log and trace output from a background thread.
+ *
+ * Log messages and the trace of transports using the default tracer
+ * are copied into buffers of capacity bytes, one for each transport
+ * and one shared by pn_logf(), and a background thread formats and
+ * writes them. Frames are traced as their encoded bytes, they are only
+ * formatted by the background thread, so tracing costs the transport
+ * little more than a copy. When a buffer is full its records are
+ * dropped and counted rather than waited for.
+ *
+ * With this on, the logger is called from the background thread.
+ * Transports with a tracer of their own are not affected. A capacity
+ * of zero stops the thread once it has written out what is buffered,
+ * as happens at exit. This must not be called by several threads at
+ * once.
+ *
+ * @param capacity the size of each buffer, rounded up to a power of two
+ * @return zero, or an error code if the thread could not be started
+ */
+PN_EXTERN int pn_log_async(size_t capacity);
+
+/** The number of log and trace records dropped due to full buffers. */
+PN_EXTERN uint64_t pn_log_dropped(void);
+
 #endif
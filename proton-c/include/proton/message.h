@@ -54,6 +54,14 @@ typedef struct pn_message_t pn_message_t;
  */
 #define PN_DEFAULT_PRIORITY (4)
 
+/**
+ * Flags selecting the sections decoded by ::pn_message_decode_head.
+ */
+#define PN_MESSAGE_HEADER (1 << 0)
+#define PN_MESSAGE_DELIVERY_ANNOTATIONS (1 << 1)
+#define PN_MESSAGE_MESSAGE_ANNOTATIONS (1 << 2)
+#define PN_MESSAGE_PROPERTIES (1 << 3)
+
 /**
  * Construct a new ::pn_message_t.
  *
@@ -345,6 +353,19 @@ PN_EXTERN int            pn_message_set_user_id           (pn_message_t *msg, pn
  */
 PN_EXTERN const char *   pn_message_get_address           (pn_message_t *msg);
 
+/**
+ * Get the address for a message as a ::pn_bytes_t.
+ *
+ * Unlike ::pn_message_get_address this does not copy a address that still
+ * refers into the bytes given to ::pn_message_decode_borrowed. The
+ * result is valid until the message is modified, cleared or decoded
+ * again, and for a borrowed message only as long as those bytes are.
+ *
+ * @param[in] msg a message object
+ * @return the address of the message, with a NULL start if unset
+ */
+PN_EXTERN pn_bytes_t pn_message_get_address_bytes(pn_message_t *msg);
+
 /**
  * Set the address for a message.
  *
@@ -375,6 +396,19 @@ PN_EXTERN int            pn_message_set_address           (pn_message_t *msg, co
  */
 PN_EXTERN const char *   pn_message_get_subject           (pn_message_t *msg);
 
+/**
+ * Get the subject for a message as a ::pn_bytes_t.
+ *
+ * Unlike ::pn_message_get_subject this does not copy a subject that still
+ * refers into the bytes given to ::pn_message_decode_borrowed. The
+ * result is valid until the message is modified, cleared or decoded
+ * again, and for a borrowed message only as long as those bytes are.
+ *
+ * @param[in] msg a message object
+ * @return the subject of the message, with a NULL start if unset
+ */
+PN_EXTERN pn_bytes_t pn_message_get_subject_bytes(pn_message_t *msg);
+
 /**
  * Set the subject for a message.
  *
@@ -405,6 +439,19 @@ PN_EXTERN int            pn_message_set_subject           (pn_message_t *msg, co
  */
 PN_EXTERN const char *   pn_message_get_reply_to          (pn_message_t *msg);
 
+/**
+ * Get the reply to for a message as a ::pn_bytes_t.
+ *
+ * Unlike ::pn_message_get_reply_to this does not copy a reply to that still
+ * refers into the bytes given to ::pn_message_decode_borrowed. The
+ * result is valid until the message is modified, cleared or decoded
+ * again, and for a borrowed message only as long as those bytes are.
+ *
+ * @param[in] msg a message object
+ * @return the reply to of the message, with a NULL start if unset
+ */
+PN_EXTERN pn_bytes_t pn_message_get_reply_to_bytes(pn_message_t *msg);
+
 /**
  * Set the reply_to for a message.
  *
@@ -475,6 +522,19 @@ PN_EXTERN int            pn_message_set_correlation_id    (pn_message_t *msg, pn
  */
 PN_EXTERN const char *   pn_message_get_content_type      (pn_message_t *msg);
 
+/**
+ * Get the content type for a message as a ::pn_bytes_t.
+ *
+ * Unlike ::pn_message_get_content_type this does not copy a content type that still
+ * refers into the bytes given to ::pn_message_decode_borrowed. The
+ * result is valid until the message is modified, cleared or decoded
+ * again, and for a borrowed message only as long as those bytes are.
+ *
+ * @param[in] msg a message object
+ * @return the content type of the message, with a NULL start if unset
+ */
+PN_EXTERN pn_bytes_t pn_message_get_content_type_bytes(pn_message_t *msg);
+
 /**
  * Set the content_type for a message.
  *
@@ -505,6 +565,19 @@ PN_EXTERN int            pn_message_set_content_type      (pn_message_t *msg, co
  */
 PN_EXTERN const char *   pn_message_get_content_encoding  (pn_message_t *msg);
 
+/**
+ * Get the content encoding for a message as a ::pn_bytes_t.
+ *
+ * Unlike ::pn_message_get_content_encoding this does not copy a content encoding that still
+ * refers into the bytes given to ::pn_message_decode_borrowed. The
+ * result is valid until the message is modified, cleared or decoded
+ * again, and for a borrowed message only as long as those bytes are.
+ *
+ * @param[in] msg a message object
+ * @return the content encoding of the message, with a NULL start if unset
+ */
+PN_EXTERN pn_bytes_t pn_message_get_content_encoding_bytes(pn_message_t *msg);
+
 /**
  * Set the content_encoding for a message.
  *
@@ -579,6 +652,19 @@ PN_EXTERN int            pn_message_set_creation_time     (pn_message_t *msg, pn
  */
 PN_EXTERN const char *   pn_message_get_group_id          (pn_message_t *msg);
 
+/**
+ * Get the group id for a message as a ::pn_bytes_t.
+ *
+ * Unlike ::pn_message_get_group_id this does not copy a group id that still
+ * refers into the bytes given to ::pn_message_decode_borrowed. The
+ * result is valid until the message is modified, cleared or decoded
+ * again, and for a borrowed message only as long as those bytes are.
+ *
+ * @param[in] msg a message object
+ * @return the group id of the message, with a NULL start if unset
+ */
+PN_EXTERN pn_bytes_t pn_message_get_group_id_bytes(pn_message_t *msg);
+
 /**
  * Set the group_id for a message.
  *
@@ -633,6 +719,19 @@ PN_EXTERN int            pn_message_set_group_sequence    (pn_message_t *msg, pn
  */
 PN_EXTERN const char *   pn_message_get_reply_to_group_id (pn_message_t *msg);
 
+/**
+ * Get the reply to group id for a message as a ::pn_bytes_t.
+ *
+ * Unlike ::pn_message_get_reply_to_group_id this does not copy a reply to group id that still
+ * refers into the bytes given to ::pn_message_decode_borrowed. The
+ * result is valid until the message is modified, cleared or decoded
+ * again, and for a borrowed message only as long as those bytes are.
+ *
+ * @param[in] msg a message object
+ * @return the reply to group id of the message, with a NULL start if unset
+ */
+PN_EXTERN pn_bytes_t pn_message_get_reply_to_group_id_bytes(pn_message_t *msg);
+
 /**
  * Set the reply_to_group_id for a message.
  *
@@ -723,6 +822,51 @@ PN_EXTERN pn_data_t *pn_message_body(pn_message_t *msg);
  */
 PN_EXTERN int pn_message_decode(pn_message_t *msg, const char *bytes, size_t size);
 
+/**
+ * Decode message content without copying it.
+ *
+ * This behaves like ::pn_message_decode except that string and binary
+ * properties and the instructions, annotations, application properties
+ * and body sections are only located, not copied. The message refers
+ * to the provided bytes, which must remain valid and unmodified until
+ * the message is cleared, freed or decoded again (for example the
+ * bytes of a received delivery that has not yet been settled).
+ *
+ * A borrowed field is copied into the message the first time it is
+ * requested as a C string or ::pn_data_t, or when it is set. The
+ * _bytes accessors such as ::pn_message_get_address_bytes and
+ * ::pn_message_get_user_id return the borrowed bytes directly, and
+ * ::pn_message_encode writes borrowed sections without decoding them.
+ *
+ * @param[in] msg a message object
+ * @param[in] bytes the start of the encoded AMQP data
+ * @param[in] size the size of the encoded AMQP data
+ * @return zero on success or an error code on failure
+ */
+PN_EXTERN int pn_message_decode_borrowed(pn_message_t *msg, const char *bytes, size_t size);
+
+/**
+ * Decode only the leading sections of a message.
+ *
+ * The header, delivery annotations, message annotations and
+ * properties sections selected by @p sections are decoded as
+ * ::pn_message_decode_borrowed would decode them, and the others are
+ * skipped. Decoding stops at the first application properties, body
+ * or footer section, whose offset is returned so that the remainder
+ * of the encoded message can be forwarded as is, for example after
+ * the output of ::pn_message_encode for the modified head.
+ *
+ * @param[in] msg a message object
+ * @param[in] bytes the start of the encoded AMQP data
+ * @param[in] size the size of the encoded AMQP data
+ * @param[in] sections a mask of PN_MESSAGE_HEADER,
+ * PN_MESSAGE_DELIVERY_ANNOTATIONS, PN_MESSAGE_MESSAGE_ANNOTATIONS and
+ * PN_MESSAGE_PROPERTIES
+ * @return the offset of the first undecoded section or an error code
+ */
+PN_EXTERN ssize_t pn_message_decode_head(pn_message_t *msg, const char *bytes, size_t size,
+                                         int sections);
+
 /**
  * Encode/save message content as AMQP formatted binary data.
  *
@@ -733,11 +877,65 @@ PN_EXTERN int pn_message_decode(pn_message_t *msg, const char *bytes, size_t siz
  * @param[in] msg a message object
  * @param[in] bytes the start of empty buffer space
  * @param[in] size the amount of empty buffer space
- * @param[out] size the amount of data written
+ * @param[out] size the amount of data written, or the amount of
+ * space required if the operation fails with ::PN_OVERFLOW
  * @return zero on success or an error code on failure
  */
 PN_EXTERN int pn_message_encode(pn_message_t *msg, char *bytes, size_t *size);
 
+/**
+ * Encode a message into a growable buffer.
+ *
+ * The encoded size is computed before anything is written, and the
+ * buffer is grown with realloc to exactly that size if it is too
+ * small, so the message is encoded only once. The buffer may start
+ * out empty with a NULL start, and its memory is owned by the caller.
+ *
+ * @param[in] msg a message object
+ * @param[in,out] buf the buffer to encode into
+ * @return the number of bytes encoded or an error code on failure
+ */
+PN_EXTERN ssize_t pn_message_encode2(pn_message_t *msg, pn_rwbytes_t *buf);
+
+/**
+ * The message format of a delivery holding several messages, each
+ * encoded in a data section of its own, as ::pn_message_encode_batch
+ * packs them.
+ */
+#define PN_MESSAGE_FORMAT_BATCH (0x80013700)
+
+/**
+ * Append a message to a batch in a growable buffer.
+ *
+ * The message is encoded once, in a data section placed at @p offset,
+ * and the buffer is grown with realloc, doubling, if it is too small.
+ * The size of the buffer is its capacity; the batch ends at the offset
+ * returned, which is where the next message goes. A batch is sent as
+ * one delivery with the ::PN_MESSAGE_FORMAT_BATCH message format, and
+ * taken apart again with ::pn_message_batch_next.
+ *
+ * @param[in] msg a message object
+ * @param[in,out] buf the buffer holding the batch
+ * @param[in] offset the end of the batch so far, zero for a new one
+ * @return the new end of the batch or an error code on failure
+ */
+PN_EXTERN ssize_t pn_message_encode_batch(pn_message_t *msg, pn_rwbytes_t *buf, size_t offset);
+
+/**
+ * Find the first message in a batch.
+ *
+ * @p encoded is set to the encoded message, which can be given to
+ * ::pn_message_decode. The rest of the batch follows the bytes
+ * consumed.
+ *
+ * @param[in] bytes the start of the batch
+ * @param[in] size the size of the batch
+ * @param[out] encoded the first message of the batch
+ * @return the number of bytes consumed, ::PN_EOS when the batch is
+ * empty, or an error code if it does not start with a data section
+ */
+PN_EXTERN ssize_t pn_message_batch_next(const char *bytes, size_t size, pn_bytes_t *encoded);
+
 /** @}
  */
 
@@ -29,6 +29,7 @@
 #include <proton/terminus.h>
 #include <proton/link.h>
 #include <proton/transport.h>
+#include <proton/metrics.h>
 #include <proton/ssl.h>
 
 #ifdef __cplusplus
@@ -82,6 +83,11 @@ extern "C" {
  *  - 127.0.0.1:1234
  *  - amqps://127.0.0.1:1234
  *
+ * With the amqp+unix and amqps+unix schemes the domain is the path of
+ * a local socket, with each '/' written as %2F::
+ *
+ *  - amqp+unix://%2Ftmp%2Fbroker.sock/incoming
+ *
  * Sending & Receiving Messages
  * ============================
  *
@@ -305,6 +311,18 @@ PN_EXTERN bool pn_messenger_is_blocking(pn_messenger_t *messenger);
  */
 PN_EXTERN int pn_messenger_set_blocking(pn_messenger_t *messenger, bool blocking);
 
+/**
+ * Tune the sockets of a messenger.
+ *
+ * The options apply to every socket the messenger listens, accepts or
+ * connects with from now on.
+ *
+ * @param[in] messenger a messenger object
+ * @param[in] options the socket options, or NULL for the defaults
+ * @return an error code or zero if there is no error
+ */
+PN_EXTERN int pn_messenger_set_socket_options(pn_messenger_t *messenger, pn_socket_options_t *options);
+
 /**
  * Check if a messenger is in passive mode.
  *
@@ -331,6 +349,105 @@ PN_EXTERN bool pn_messenger_is_passive(pn_messenger_t *messenger);
  */
 PN_EXTERN int pn_messenger_set_passive(pn_messenger_t *messenger, bool passive);
 
+/**
+ * Get the number of I/O threads a messenger uses.
+ *
+ * See ::pn_messenger_set_threads() for details.
+ *
+ * @param[in] messenger a messenger object
+ * @return the number of threads
+ */
+PN_EXTERN int pn_messenger_get_threads(pn_messenger_t *messenger);
+
+/**
+ * Set the number of I/O threads a messenger uses.
+ *
+ * By default a messenger does all of its I/O from the thread calling
+ * into it. With more than one thread, ::pn_messenger_start() starts
+ * that many threads and spreads the messenger's connections over
+ * them, each connection being served by one thread. The calling
+ * thread only encodes and decodes messages, so a messenger talking to
+ * many peers can make use of several cores.
+ *
+ * A threaded messenger behaves like any other with these exceptions:
+ *
+ *  - errors found while sending, such as a peer that cannot be
+ *    reached, are reported by the next call to ::pn_messenger_send(),
+ *    ::pn_messenger_recv(), ::pn_messenger_work() or
+ *    ::pn_messenger_stop() rather than by ::pn_messenger_put()
+ *  - an explicit credit passed to ::pn_messenger_recv() is granted
+ *    to every thread, so up to that many messages may arrive per thread
+ *  - all connections accepted by a listening subscription are served
+ *    by the same thread
+ *  - ::pn_messenger_selectable(), ::pn_messenger_delivery(),
+ *    ::pn_messenger_get_link() and ::pn_messenger_tracker_link()
+ *    return NULL, and ::pn_subscription_address() is not available
+ *  - the messenger cannot be passive
+ *
+ * A threaded messenger is still not thread safe: apart from
+ * ::pn_messenger_interrupt() it must only be used by one thread at a
+ * time.
+ *
+ * @param[in] messenger a messenger object
+ * @param[in] threads the number of threads, one to do all I/O from
+ * the calling thread
+ * @return an error code or zero on success, it is an error to change
+ * the number of threads of a messenger that was started with threads
+ */
+PN_EXTERN int pn_messenger_set_threads(pn_messenger_t *messenger, int threads);
+
+/**
+ * Get the number of messages a threaded messenger decodes ahead.
+ *
+ * See ::pn_messenger_set_prefetch() for details.
+ *
+ * @param[in] messenger a messenger object
+ * @return the number of messages, zero when decoding is left to
+ * ::pn_messenger_get()
+ */
+PN_EXTERN int pn_messenger_get_prefetch(pn_messenger_t *messenger);
+
+/**
+ * Set the number of messages a threaded messenger decodes ahead.
+ *
+ * By default ::pn_messenger_get() decodes each message on the calling
+ * thread. With a prefetch, the messenger's threads decode up to that
+ * many received messages while the application is busy with earlier
+ * ones, and ::pn_messenger_get() only has to hand a decoded message
+ * over. The prefetch is shared out between the threads when the
+ * messenger is started, and has no effect on a messenger without
+ * threads, see ::pn_messenger_set_threads().
+ *
+ * @param[in] messenger a messenger object
+ * @param[in] prefetch the number of messages, zero to turn prefetching off
+ * @return an error code or zero on success, it is an error to change
+ * the prefetch of a messenger that was started with threads
+ */
+PN_EXTERN int pn_messenger_set_prefetch(pn_messenger_t *messenger, int prefetch);
+
+/**
+ * Keep the messages a messenger sends in a journal on disk.
+ *
+ * Each message put afterwards is appended to the journal in the given
+ * directory, and the messages put since the last pass are written to
+ * disk before ::pn_messenger_process() sends anything. A message stays
+ * in the journal until it is accepted, rejected or settled. Messages
+ * that were released, modified or could not be sent at all are kept,
+ * and are put again by the next messenger to use the directory.
+ *
+ * The journal is read when it is set, and the messages a previous
+ * messenger left in it are put again right away, so it is best set
+ * after ::pn_messenger_start() and once the routes are in place. Only
+ * one messenger may use a directory at a time, and a messenger with a
+ * journal cannot use threads, see ::pn_messenger_set_threads().
+ *
+ * @param[in] messenger a messenger object
+ * @param[in] directory an existing directory for the journal's files
+ * @return the number of messages recovered from the journal, or an
+ * error code
+ */
+PN_EXTERN int pn_messenger_set_journal(pn_messenger_t *messenger, const char *directory);
+
 /** Frees a Messenger.
  *
  * @param[in] messenger the messenger to free (or NULL), no longer
@@ -536,6 +653,32 @@ PN_EXTERN const char *pn_subscription_address(pn_subscription_t *sub);
  */
 PN_EXTERN int pn_messenger_put(pn_messenger_t *messenger, pn_message_t *msg);
 
+/**
+ * Puts several messages onto the messenger's outgoing queue.
+ *
+ * This behaves like calling ::pn_messenger_put() for each message in
+ * turn, except that consecutive messages with the same address share
+ * a single route resolution, address rewrite and link lookup.
+ *
+ * ::pn_messenger_outgoing_tracker() refers to the last message put.
+ *
+ * With the ::PN_FLAGS_BATCH_MESSAGES flag, each run of consecutive
+ * messages with the same address is also packed into as few deliveries
+ * as possible, so that small messages share their transfer frames,
+ * disposition and tracker. Every message of a packed delivery has the
+ * same status. ::pn_messenger_get unpacks such deliveries however the
+ * receiving messenger's flags are set.
+ *
+ * @param[in] messenger a messenger object
+ * @param[in] msgs the messages to put on the messenger's outgoing queue
+ * @param[in] n the number of messages in msgs
+ * @return the number of messages put, or an error code if the first
+ *         one could not be put; if fewer than n were put, the error
+ *         for the next one is available from ::pn_messenger_error()
+ * @see error.h
+ */
+PN_EXTERN int pn_messenger_put_batch(pn_messenger_t *messenger, pn_message_t **msgs, size_t n);
+
 /**
  * Track the status of a delivery.
  *
@@ -703,6 +846,19 @@ PN_EXTERN int pn_messenger_recv(pn_messenger_t *messenger, int limit);
  */
 PN_EXTERN int pn_messenger_receiving(pn_messenger_t *messenger);
 
+/**
+ * Get the metrics of a messenger's connections.
+ *
+ * The metrics of all the connections the messenger has made or
+ * accepted are added up, including those that have been closed since.
+ * For a messenger using threads the connections of every thread are
+ * included.
+ *
+ * @param[in] messenger the messenger
+ * @param[out] metrics filled with the totals
+ */
+PN_EXTERN void pn_messenger_metrics(pn_messenger_t *messenger, pn_transport_metrics_t *metrics);
+
 /**
  * Get the next message from the head of a messenger's incoming queue.
  *
@@ -719,6 +875,27 @@ PN_EXTERN int pn_messenger_receiving(pn_messenger_t *messenger);
  */
 PN_EXTERN int pn_messenger_get(pn_messenger_t *messenger, pn_message_t *message);
 
+/**
+ * Retrieves several messages from the head of the incoming queue.
+ *
+ * This behaves like calling ::pn_messenger_get() for each message in
+ * turn, stopping early when the queue runs out. A NULL entry in msgs
+ * discards the corresponding message.
+ *
+ * ::pn_messenger_incoming_tracker() refers to the last message
+ * retrieved, so settling it with PN_CUMULATIVE covers the batch.
+ *
+ * @param[in] messenger a messenger object
+ * @param[out] msgs upon return the first messages contain those retrieved
+ * @param[in] n the number of messages in msgs
+ * @return the number of messages retrieved, ::PN_EOS if the queue was
+ *         empty, or an error code if the first one could not be
+ *         decoded; a decode error that stops a later message is
+ *         available from ::pn_messenger_error()
+ * @see error.h
+ */
+PN_EXTERN int pn_messenger_get_batch(pn_messenger_t *messenger, pn_message_t **msgs, size_t n);
+
 /**
  * Get a tracker for the message most recently retrieved by
  * ::pn_messenger_get().
@@ -960,10 +1137,23 @@ PN_EXTERN pn_timestamp_t pn_messenger_deadline(pn_messenger_t *messenger);
             to pn_messenger_start should check that                            \
             any defined routes are valid */
 
+#define PN_FLAGS_COARSE_CLOCK                                                  \
+  (0x2) /** Messenger flag to read the time from the                           \
+            system tick where the platform has a                               \
+            cheaper clock for that, so times may be                            \
+            a few milliseconds behind */
+
+#define PN_FLAGS_BATCH_MESSAGES                                                \
+  (0x4) /** Messenger flag to pack consecutive                                 \
+            messages with the same address given to                            \
+            pn_messenger_put_batch into one delivery                           \
+            of the PN_MESSAGE_FORMAT_BATCH format */
+
 /** Sets control flags to enable additional function for the Messenger.
  *
  * @param[in] messenger the messenger
- * @param[in] flags 0 or PN_FLAGS_CHECK_ROUTES
+ * @param[in] flags 0 or any of PN_FLAGS_CHECK_ROUTES, PN_FLAGS_COARSE_CLOCK
+ * and PN_FLAGS_BATCH_MESSAGES
  *
  * @return an error code of zero if there is no error
  */
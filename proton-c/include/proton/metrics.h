@@ -0,0 +1,192 @@
+#ifndef PROTON_METRICS_H
+#define PROTON_METRICS_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/import_export.h>
+#include <proton/type_compat.h>
+#include <proton/types.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file
+ *
+ * Counters kept by the engine for every transport, session and link.
+ *
+ * The counters are plain fields updated as frames go through the
+ * engine, so they are always on. A snapshot is read with
+ * pn_transport_metrics(), pn_session_metrics() and pn_link_metrics()
+ * from the thread driving the transport. A connection's metrics are
+ * those of the transport it is bound to.
+ *
+ * @defgroup metrics Metrics
+ * @ingroup engine
+ * @{
+ */
+
+/**
+ * The number of buckets in a ::pn_histogram_t.
+ */
+#define PN_HISTOGRAM_BUCKETS (32)
+
+/**
+ * A distribution of sizes.
+ *
+ * Bucket i counts the values from 2^i up to but not including
+ * 2^(i+1), the first bucket also counts zero and the last one every
+ * value from 2^(PN_HISTOGRAM_BUCKETS-1) up.
+ */
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[PN_HISTOGRAM_BUCKETS];
+} pn_histogram_t;
+
+/**
+ * Estimate a percentile of a histogram.
+ *
+ * @param[in] histogram the histogram
+ * @param[in] percentile between 0 and 100
+ * @return the upper bound of the bucket holding the percentile, never
+ *         more than the largest value seen, 0 for an empty histogram
+ */
+PN_EXTERN uint64_t pn_histogram_percentile(const pn_histogram_t *histogram, double percentile);
+
+/**
+ * What a transport, and so its connection, has been through.
+ */
+typedef struct {
+  uint64_t bytes_input;
+  uint64_t bytes_output;
+  uint64_t frames_input;
+  uint64_t frames_output;
+  pn_histogram_t input_frame_sizes;   /**< in bytes, with the frame header */
+  pn_histogram_t output_frame_sizes;  /**< in bytes, with the frame header */
+  size_t input_high_water;   /**< the most input buffered at once */
+  size_t output_high_water;  /**< the most encoded output waiting at once */
+  uint64_t process_count;    /**< the times the engine turned work into frames */
+  uint64_t process_nanos;    /**< the time that took, in nanoseconds */
+} pn_transport_metrics_t;
+
+/**
+ * What a session has been through.
+ */
+typedef struct {
+  uint64_t incoming_transfers;
+  uint64_t outgoing_transfers;
+  uint64_t window_stalls;   /**< the times the peer's window held transfers back */
+  size_t incoming_bytes;    /**< received and not yet read */
+  size_t outgoing_bytes;    /**< written and not yet sent */
+} pn_session_metrics_t;
+
+/**
+ * What a link has been through.
+ */
+typedef struct {
+  uint64_t deliveries;      /**< sent or received in full */
+  uint64_t bytes;           /**< of delivery payload sent or received */
+  uint64_t credit_stalls;   /**< the times a sender had to wait for credit */
+} pn_link_metrics_t;
+
+/**
+ * How long a link's deliveries spent in each part of their life, in
+ * microseconds.
+ */
+typedef struct {
+  /** sender: from pn_link_advance() until the last transfer frame is written */
+  pn_histogram_t queueing;
+  /** sender: from there until the first disposition from the peer */
+  pn_histogram_t round_trip;
+  /** receiver: from the last transfer frame until the delivery is first
+      updated or settled */
+  pn_histogram_t processing;
+} pn_link_latency_t;
+
+/**
+ * Take a snapshot of a transport's metrics.
+ *
+ * @param[in] transport a transport object
+ * @param[out] metrics filled with the transport's metrics
+ */
+PN_EXTERN void pn_transport_metrics(pn_transport_t *transport, pn_transport_metrics_t *metrics);
+
+/**
+ * Take a snapshot of a session's metrics.
+ *
+ * @param[in] session a session object
+ * @param[out] metrics filled with the session's metrics
+ */
+PN_EXTERN void pn_session_metrics(pn_session_t *session, pn_session_metrics_t *metrics);
+
+/**
+ * Take a snapshot of a link's metrics.
+ *
+ * @param[in] link a link object
+ * @param[out] metrics filled with the link's metrics
+ */
+PN_EXTERN void pn_link_metrics(pn_link_t *link, pn_link_metrics_t *metrics);
+
+/**
+ * Time the deliveries of a link.
+ *
+ * Latency tracking is off by default, as it reads the clock a couple
+ * of times for every delivery. Turning it off drops what has been
+ * measured so far.
+ *
+ * @param[in] link a link object
+ * @param[in] track true to time deliveries
+ */
+PN_EXTERN void pn_link_track_latency(pn_link_t *link, bool track);
+
+/**
+ * Take a snapshot of a link's latencies.
+ *
+ * @param[in] link a link object
+ * @param[out] latency filled with the link's latencies
+ * @return false, leaving latency alone, if latency is not tracked
+ */
+PN_EXTERN bool pn_link_latency(pn_link_t *link, pn_link_latency_t *latency);
+
+/**
+ * Add up transport metrics.
+ *
+ * Counters and histograms are summed, for the high water marks the
+ * larger one is kept.
+ *
+ * @param[in,out] total the metrics to add to
+ * @param[in] metrics the metrics to add
+ */
+PN_EXTERN void pn_transport_metrics_add(pn_transport_metrics_t *total,
+                                        const pn_transport_metrics_t *metrics);
+
+/** @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* metrics.h */
@@ -44,6 +44,7 @@ typedef struct pn_hash_t pn_hash_t;
 typedef void *(*pn_iterator_next_t)(void *state);
 typedef struct pn_iterator_t pn_iterator_t;
 typedef struct pn_record_t pn_record_t;
+typedef struct pn_pool_t pn_pool_t;
 
 struct pn_class_t {
   const char *name;
@@ -152,6 +153,40 @@ PREFIX ## _t *PREFIX ## _new(void) {                                      \
     PREFIX ## _inspect                          \
 }
 
+/*
+ * A pooled class keeps the memory of freed instances on a freelist,
+ * up to HIGH_WATER of them, and reuses it for new instances instead of
+ * going back to malloc. PN_POOL() defines the class's pool and its
+ * newinst and free, PN_POOLED_CLASS() is PN_CLASS() using them.
+ * Metaclasses can use PREFIX_pool_new and PREFIX_pool_free directly.
+ */
+#define PN_POOL(PREFIX, HIGH_WATER)                                       \
+static pn_pool_t *PREFIX ## _pool;                                        \
+                                                                          \
+static void *PREFIX ## _pool_new(const pn_class_t *clazz, size_t size) {  \
+  return pn_pool_alloc(&PREFIX ## _pool, HIGH_WATER, clazz, size);        \
+}                                                                         \
+                                                                          \
+static void PREFIX ## _pool_free(void *object) {                          \
+  pn_pool_release(PREFIX ## _pool, object);                               \
+}
+
+#define PN_POOLED_CLASS(PREFIX) {               \
+    #PREFIX,                                    \
+    CID_ ## PREFIX,                             \
+    PREFIX ## _pool_new,                        \
+    PREFIX ## _initialize,                      \
+    pn_object_incref,                           \
+    pn_object_decref,                           \
+    pn_object_refcount,                         \
+    PREFIX ## _finalize,                        \
+    PREFIX ## _pool_free,                       \
+    pn_object_reify,                            \
+    PREFIX ## _hashcode,                        \
+    PREFIX ## _compare,                         \
+    PREFIX ## _inspect                          \
+}
+
 PN_EXTERN pn_cid_t pn_class_id(const pn_class_t *clazz);
 PN_EXTERN const char *pn_class_name(const pn_class_t *clazz);
 PN_EXTERN void *pn_class_new(const pn_class_t *clazz, size_t size);
@@ -176,6 +211,25 @@ PN_EXTERN int pn_object_refcount(void *object);
 PN_EXTERN void pn_object_decref(void *object);
 PN_EXTERN void pn_object_free(void *object);
 
+// pn_object_new() and pn_object_free() for a pooled class, the pool is
+// made by the first allocation and lives as long as the process
+PN_EXTERN void *pn_pool_alloc(pn_pool_t **pool, size_t high_water, const pn_class_t *clazz, size_t size);
+PN_EXTERN void pn_pool_release(pn_pool_t *pool, void *object);
+
+/*
+ * The pool of a pooled class, NULL if the class is not pooled or has
+ * not made an instance yet. Pools are safe to use from any thread.
+ * Raising or lowering the high water mark tunes how much memory a
+ * class may keep, zero stops it keeping any. The hits are allocations
+ * served from the freelist, the misses those that went to malloc.
+ */
+PN_EXTERN pn_pool_t *pn_class_pool(const pn_class_t *clazz);
+PN_EXTERN size_t pn_pool_high_water(pn_pool_t *pool);
+PN_EXTERN void pn_pool_set_high_water(pn_pool_t *pool, size_t high_water);
+PN_EXTERN size_t pn_pool_cached(pn_pool_t *pool);
+PN_EXTERN size_t pn_pool_hits(pn_pool_t *pool);
+PN_EXTERN size_t pn_pool_misses(pn_pool_t *pool);
+
 PN_EXTERN void *pn_incref(void *object);
 PN_EXTERN int pn_decref(void *object);
 PN_EXTERN int pn_refcount(void *object);
@@ -186,6 +240,30 @@ PN_EXTERN intptr_t pn_compare(void *a, void *b);
 PN_EXTERN bool pn_equals(void *a, void *b);
 PN_EXTERN int pn_inspect(void *object, pn_string_t *dst);
 
+/*
+ * An object made with pn_object_new() counts its references with
+ * plain integers, so only one thread may hold it at a time. Marking it
+ * shared makes pn_incref(), pn_decref() and pn_refcount() atomic for
+ * that object, so that references to it can be held and released by
+ * several threads, for instance to pass an encoded message from a
+ * producer thread to the reactor's without copying it:
+ *
+ *  - mark the object shared before a second thread can see it, the
+ *    mark cannot be taken back
+ *  - only the count is atomic: the object must not be modified once
+ *    shared, and it should be one whose reads do not change it, such
+ *    as a pn_string_t
+ *  - objects it refers to are not shared with it, a thread that takes
+ *    a reference to them has to share them too
+ *  - the finalizer runs on whichever thread drops the last reference,
+ *    use pn_decref() rather than pn_free() to release a shared object
+ *
+ * Objects of other classes are left alone and pn_shared() is false for
+ * them.
+ */
+PN_EXTERN void *pn_share(void *object);
+PN_EXTERN bool pn_shared(void *object);
+
 #define PN_REFCOUNT (0x1)
 
 PN_EXTERN pn_list_t *pn_list(const pn_class_t *clazz, size_t capacity);
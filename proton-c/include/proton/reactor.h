@@ -25,7 +25,9 @@
 #include <proton/import_export.h>
 #include <proton/type_compat.h>
 #include <proton/event.h>
+#include <proton/sasl.h>
 #include <proton/selectable.h>
+#include <proton/metrics.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -46,6 +48,7 @@ typedef struct pn_reactor_t pn_reactor_t;
 typedef struct pn_acceptor_t pn_acceptor_t;
 typedef struct pn_timer_t pn_timer_t;
 typedef struct pn_task_t pn_task_t;
+typedef struct pn_reactor_group_t pn_reactor_group_t;
 
 PN_EXTERN pn_handler_t *pn_handler(void (*dispatch)(pn_handler_t *, pn_event_t *, pn_event_type_t));
 PN_EXTERN pn_handler_t *pn_handler_new(void (*dispatch)(pn_handler_t *, pn_event_t *, pn_event_type_t), size_t size,
@@ -60,6 +63,44 @@ PN_EXTERN pn_reactor_t *pn_reactor(void);
 PN_EXTERN pn_record_t *pn_reactor_attachments(pn_reactor_t *reactor);
 PN_EXTERN pn_millis_t pn_reactor_get_timeout(pn_reactor_t *reactor);
 PN_EXTERN void pn_reactor_set_timeout(pn_reactor_t *reactor, pn_millis_t timeout);
+
+/**
+ * Output that handlers produce is sent once the reactor has processed
+ * all pending events, so that a burst of small writes goes out in one
+ * send. A non-zero latency bounds how long output may wait when a
+ * burst of events takes longer than that to process. The default of
+ * zero only flushes at the end of each burst.
+ */
+PN_EXTERN pn_millis_t pn_reactor_get_flush_latency(pn_reactor_t *reactor);
+PN_EXTERN void pn_reactor_set_flush_latency(pn_reactor_t *reactor, pn_millis_t latency);
+
+/**
+ * Budgets that keep one busy connection from holding up the others.
+ * A pass of ::pn_reactor_process() that has dispatched the event
+ * budget, or run for the time budget in milliseconds, sends what is
+ * waiting to go out, takes in the input and timers that are ready
+ * without waiting and returns. With a connection budget, a connection
+ * that has had that many events dispatched in the current round has
+ * the rest held back until the others have had theirs, so connections
+ * are served in turn. A connection's events always stay in order. The
+ * defaults of zero set no limit.
+ */
+PN_EXTERN int pn_reactor_get_event_budget(pn_reactor_t *reactor);
+PN_EXTERN void pn_reactor_set_event_budget(pn_reactor_t *reactor, int events);
+PN_EXTERN pn_millis_t pn_reactor_get_time_budget(pn_reactor_t *reactor);
+PN_EXTERN void pn_reactor_set_time_budget(pn_reactor_t *reactor, pn_millis_t time);
+PN_EXTERN int pn_reactor_get_connection_budget(pn_reactor_t *reactor);
+PN_EXTERN void pn_reactor_set_connection_budget(pn_reactor_t *reactor, int events);
+
+/**
+ * The reactor reads the clock once each time round its loop, and
+ * pn_reactor_now returns that time to the handlers, timers and
+ * transport ticks of the iteration. A coarse clock reads the system
+ * tick where the platform has a cheaper clock for that, so times may be
+ * a few milliseconds behind.
+ */
+PN_EXTERN bool pn_reactor_get_coarse_clock(pn_reactor_t *reactor);
+PN_EXTERN void pn_reactor_set_coarse_clock(pn_reactor_t *reactor, bool coarse);
 PN_EXTERN pn_timestamp_t pn_reactor_mark(pn_reactor_t *reactor);
 PN_EXTERN pn_timestamp_t pn_reactor_now(pn_reactor_t *reactor);
 PN_EXTERN void pn_reactor_yield(pn_reactor_t *reactor);
@@ -71,11 +112,19 @@ PN_EXTERN pn_handler_t *pn_reactor_get_handler(pn_reactor_t *reactor);
 PN_EXTERN void pn_reactor_set_handler(pn_reactor_t *reactor, pn_handler_t *handler);
 PN_EXTERN pn_io_t *pn_reactor_io(pn_reactor_t *reactor);
 PN_EXTERN pn_list_t *pn_reactor_children(pn_reactor_t *reactor);
+// the metrics of the reactor's connections added up
+PN_EXTERN void pn_reactor_metrics(pn_reactor_t *reactor, pn_transport_metrics_t *metrics);
 PN_EXTERN pn_selectable_t *pn_reactor_selectable(pn_reactor_t *reactor);
 PN_EXTERN void pn_reactor_update(pn_reactor_t *reactor, pn_selectable_t *selectable);
 PN_EXTERN pn_acceptor_t *pn_reactor_acceptor(pn_reactor_t *reactor, const char *host, const char *port,
                                              pn_handler_t *handler);
 PN_EXTERN pn_connection_t *pn_reactor_connection(pn_reactor_t *reactor, pn_handler_t *handler);
+/**
+ * Tune the socket a reactor connection connects with, on top of the
+ * reactor io's own options. This must be set before the connection is
+ * bound to its transport.
+ */
+PN_EXTERN void pn_reactor_connection_set_socket_options(pn_connection_t *connection, pn_socket_options_t *options);
 PN_EXTERN int pn_reactor_wakeup(pn_reactor_t *reactor);
 PN_EXTERN void pn_reactor_start(pn_reactor_t *reactor);
 PN_EXTERN bool pn_reactor_quiesced(pn_reactor_t *reactor);
@@ -84,7 +133,116 @@ PN_EXTERN void pn_reactor_stop(pn_reactor_t *reactor);
 PN_EXTERN void pn_reactor_run(pn_reactor_t *reactor);
 PN_EXTERN pn_task_t *pn_reactor_schedule(pn_reactor_t *reactor, int delay, pn_handler_t *handler);
 
+/**
+ * Hand a handler to a reactor from any thread.
+ *
+ * This is the only reactor operation that may be called from a thread
+ * other than the one running the reactor. The handler receives a
+ * ::PN_TIMER_TASK event on the reactor's thread as soon as the reactor
+ * wakes up. The caller's reference to the handler is transferred to
+ * the reactor, so the caller must not touch the handler after posting
+ * it.
+ *
+ * Posting does not take a lock, and handlers posted by any number of
+ * threads are dispatched in the order they were posted. However many
+ * handlers are posted between two wakeups, only the first writes to
+ * the reactor's wakeup pipe.
+ *
+ * @param[in] reactor the reactor to run the handler on
+ * @param[in] handler the handler to dispatch
+ * @return 0 on success, or an error code if the reactor could not be woken
+ */
+PN_EXTERN int pn_reactor_post(pn_reactor_t *reactor, pn_handler_t *handler);
+
+/**
+ * Create a group of reactors, each of which will be run on its own
+ * thread by ::pn_reactor_group_start().
+ *
+ * Until the group is started each member reactor may be configured
+ * from the calling thread, e.g. by setting its handler. Once started,
+ * a member reactor may only be touched from its own thread, or through
+ * ::pn_reactor_post().
+ */
+PN_EXTERN pn_reactor_group_t *pn_reactor_group(size_t size);
+PN_EXTERN void pn_reactor_group_free(pn_reactor_group_t *group);
+PN_EXTERN size_t pn_reactor_group_size(pn_reactor_group_t *group);
+PN_EXTERN pn_reactor_t *pn_reactor_group_get(pn_reactor_group_t *group, size_t index);
+
+/**
+ * Pin the thread of a member reactor to a CPU, replacing any node set
+ * with ::pn_reactor_group_set_node().
+ *
+ * The memory for a reactor's connections, their transports, buffers
+ * and events, is allocated on its thread, so once pinned it usually
+ * comes from the node the thread runs on. A member pinned to one CPU
+ * also asks the kernel, where it supports it (SO_INCOMING_CPU), to
+ * give its shard of a group acceptor the connections received on that
+ * CPU. This must be called before the group is started, and takes
+ * effect when it is.
+ *
+ * @param[in] group a reactor group
+ * @param[in] index the member reactor
+ * @param[in] cpu the CPU, or -1 to leave the member unpinned
+ * @return zero, PN_ARG_ERR for a bad index, or PN_STATE_ERR once the
+ * group has started
+ */
+PN_EXTERN int pn_reactor_group_set_cpu(pn_reactor_group_t *group, size_t index, int cpu);
 
+/**
+ * Pin the thread of a member reactor to the CPUs of a NUMA node,
+ * replacing any CPU set with ::pn_reactor_group_set_cpu().
+ *
+ * @param[in] group a reactor group
+ * @param[in] index the member reactor
+ * @param[in] node the node, or -1 to leave the member unpinned
+ * @return zero, PN_ARG_ERR for a bad index, or PN_STATE_ERR once the
+ * group has started
+ */
+PN_EXTERN int pn_reactor_group_set_node(pn_reactor_group_t *group, size_t index, int node);
+
+/**
+ * Listen on behalf of the whole group.
+ *
+ * Where the platform supports it (SO_REUSEPORT) each member reactor
+ * listens on its own socket bound to the address, and the kernel
+ * spreads incoming connections across them. Otherwise the listening
+ * socket is serviced by the first reactor in the group and accepted
+ * connections are handed to the member reactors in round robin order.
+ * Either way each connection is set up on, and stays with, one member
+ * reactor, using that reactor's handler. The acceptor returned is the
+ * first reactor's, all of them are closed when the group is stopped.
+ * This must be called before the group is started.
+ */
+PN_EXTERN pn_acceptor_t *pn_reactor_group_acceptor(pn_reactor_group_t *group, const char *host, const char *port);
+
+/**
+ * Start a thread running each member reactor. Member reactors keep
+ * running even when they have nothing to do until the group is
+ * stopped. If a member cannot be pinned as asked, for example because
+ * the CPU does not exist, the group is stopped again and PN_ERR
+ * returned.
+ */
+PN_EXTERN int pn_reactor_group_start(pn_reactor_group_t *group);
+
+/**
+ * Close the group's acceptors, ask each member reactor to finish once
+ * it has nothing left to do and wait for all of the group's threads to
+ * exit.
+ */
+PN_EXTERN void pn_reactor_group_stop(pn_reactor_group_t *group);
+
+
+/**
+ * Check the credentials of clients accepted by a pn_reactor_acceptor()
+ * with the given verifier instead of admitting them anonymously.
+ */
+PN_EXTERN void pn_acceptor_set_sasl_verifier(pn_acceptor_t *acceptor, pn_sasl_verifier_t *verifier);
+
+/**
+ * Tune the sockets the acceptor accepts. This applies on top of the
+ * reactor io's own options, see ::pn_io_set_socket_options().
+ */
+PN_EXTERN void pn_acceptor_set_socket_options(pn_acceptor_t *acceptor, pn_socket_options_t *options);
 PN_EXTERN void pn_acceptor_close(pn_acceptor_t *acceptor);
 
 PN_EXTERN pn_timer_t *pn_timer(pn_collector_t *collector);
@@ -95,6 +253,17 @@ PN_EXTERN int pn_timer_tasks(pn_timer_t *timer);
 
 PN_EXTERN pn_record_t *pn_task_attachments(pn_task_t *task);
 
+/**
+ * Cancel a scheduled task, so no ::PN_TIMER_TASK event is issued for
+ * it. A task whose event has already been issued is unaffected.
+ *
+ * The timer holds the only reference to a pending task, and lets go
+ * of it when the task fires or is cancelled, so a caller that keeps a
+ * task to cancel later must hold a reference of its own with
+ * pn_incref().
+ */
+PN_EXTERN void pn_task_cancel(pn_task_t *task);
+
 PN_EXTERN pn_reactor_t *pn_class_reactor(const pn_class_t *clazz, void *object);
 PN_EXTERN pn_reactor_t *pn_object_reactor(void *object);
 PN_EXTERN pn_reactor_t *pn_event_reactor(pn_event_t *event);
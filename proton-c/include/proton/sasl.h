@@ -186,6 +186,77 @@ PN_EXTERN void pn_sasl_done(pn_sasl_t *sasl, pn_sasl_outcome_t outcome);
  */
 PN_EXTERN pn_sasl_outcome_t pn_sasl_outcome(pn_sasl_t *sasl);
 
+/** An external check of the credentials received by a SASL server.
+ *
+ * A verifier lets a server hand the client's initial response to an
+ * authentication backend (LDAP, Kerberos, Cyrus SASL ...) without
+ * blocking the thread driving the transport. A single verifier can be
+ * shared by any number of server transports.
+ */
+typedef struct pn_sasl_verifier_t pn_sasl_verifier_t;
+
+/** Start the verification of a client's initial response.
+ *
+ * Called on the transport's thread once the client has chosen a
+ * mechanism. The response is only valid for the duration of the call.
+ * The verifier must eventually call pn_sasl_verified() for the
+ * transport, either before returning or later from any thread; the
+ * transport is kept alive until it does.
+ *
+ * @param[in] transport the transport being authenticated
+ * @param[in] mechanism the mechanism chosen by the client
+ * @param[in] response the client's initial response
+ * @param[in] size the number of octets in response
+ * @param[in] context the context given to pn_sasl_verifier()
+ */
+typedef void (*pn_sasl_verify_t)(pn_transport_t *transport, const char *mechanism,
+                                 const char *response, size_t size, void *context);
+
+/** Create a verifier.
+ * @param[in] mechanisms the mechanisms offered by servers using the
+ *                       verifier, separated by space
+ * @param[in] verify called to check each client's initial response
+ * @param[in] context passed to every call of verify
+ * @return a new verifier, to be released with pn_sasl_verifier_free()
+ */
+PN_EXTERN pn_sasl_verifier_t *pn_sasl_verifier(const char *mechanisms, pn_sasl_verify_t verify, void *context);
+
+/** Release a verifier.
+ * Transports already using the verifier keep it alive until they are
+ * freed.
+ * @param[in] verifier the verifier to release
+ */
+PN_EXTERN void pn_sasl_verifier_free(pn_sasl_verifier_t *verifier);
+
+/** Remember successfully verified credentials.
+ * Up to size responses that passed verification are kept for ttl
+ * milliseconds, a client presenting one of them again is accepted
+ * without calling the verifier. This absorbs bursts of reconnects.
+ * Only a digest of each response is held, keyed with a secret chosen
+ * at random for the verifier, and wiped when it leaves the cache. The cache is off by
+ * default, a size or ttl of zero turns it off again.
+ * @param[in] verifier the verifier to configure
+ * @param[in] size the maximum number of cached responses
+ * @param[in] ttl how long a response stays cached, in milliseconds
+ */
+PN_EXTERN void pn_sasl_verifier_cache(pn_sasl_verifier_t *verifier, size_t size, pn_millis_t ttl);
+
+/** Have a server SASL layer check credentials with a verifier.
+ * This also offers the verifier's mechanisms to the client.
+ * @param[in] sasl the SASL layer to configure
+ * @param[in] verifier the verifier to use
+ */
+PN_EXTERN void pn_sasl_set_verifier(pn_sasl_t *sasl, pn_sasl_verifier_t *verifier);
+
+/** Report the result of a verification.
+ * May be called from any thread. If the transport was set up by a
+ * reactor, the reactor is woken to send the outcome, otherwise it is
+ * sent the next time the transport is processed.
+ * @param[in] transport the transport passed to the pn_sasl_verify_t
+ * @param[in] outcome the result of the verification
+ */
+PN_EXTERN void pn_sasl_verified(pn_transport_t *transport, pn_sasl_outcome_t outcome);
+
 /** @} */
 
 #ifdef __cplusplus
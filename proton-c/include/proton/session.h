@@ -205,13 +205,99 @@ PN_EXTERN size_t pn_session_get_incoming_capacity(pn_session_t *session);
  * The incoming capacity of a session determines how much incoming
  * message data the session will buffer. Note that if this value is
  * less than the negotiated frame size of the transport, it will be
- * rounded up to one full frame.
+ * rounded up to one full frame. The default of zero sets no limit, so
+ * the incoming window is left wide open.
  *
  * @param[in] session the session object
  * @param[in] capacity the incoming capacity for the session
  */
 PN_EXTERN void pn_session_set_incoming_capacity(pn_session_t *session, size_t capacity);
 
+/**
+ * Get the incoming low-water mark of the session measured in bytes.
+ *
+ * @param[in] session the session object
+ * @return the incoming low-water mark of the session in bytes
+ */
+PN_EXTERN size_t pn_session_get_incoming_low_water(pn_session_t *session);
+
+/**
+ * Set the incoming low-water mark for a session object.
+ *
+ * Once the incoming window of the session has fallen to this many
+ * bytes, the window is refreshed as soon as freed capacity would lift
+ * it back above the mark, rather than only after it has closed. This
+ * keeps data flowing over links with a long round trip. The default
+ * of zero refreshes the window only once it is used up.
+ *
+ * @param[in] session the session object
+ * @param[in] low_water the incoming low-water mark in bytes
+ */
+PN_EXTERN void pn_session_set_incoming_low_water(pn_session_t *session, size_t low_water);
+
+/**
+ * Get the limit up to which the incoming capacity of a session is
+ * autotuned.
+ *
+ * @param[in] session the session object
+ * @return the autotuning limit in bytes, or zero if autotuning is off
+ */
+PN_EXTERN size_t pn_session_get_incoming_autotune(pn_session_t *session);
+
+/**
+ * Autotune the incoming capacity of a session.
+ *
+ * Each window refresh is timed by the round trip until the peer
+ * starts using the window it opened. When the peer ran out of window
+ * in that time the capacity is doubled, up to @p max_capacity, and
+ * when a round trip carried far less data than the capacity it is
+ * halved, down to the capacity set with
+ * ::pn_session_set_incoming_capacity. While autotuning, the
+ * low-water mark is kept at half the capacity or more, so the window
+ * is refreshed about a round trip ahead of closing.
+ *
+ * @param[in] session the session object
+ * @param[in] max_capacity the largest incoming capacity in bytes, or
+ * zero to turn autotuning off
+ */
+PN_EXTERN void pn_session_set_incoming_autotune(pn_session_t *session, size_t max_capacity);
+
+/**
+ * Get the outgoing high-water mark of the session measured in bytes.
+ *
+ * @param[in] session the session object
+ * @return the outgoing high-water mark in bytes, or zero if unset
+ */
+PN_EXTERN size_t pn_session_get_outgoing_high_water(pn_session_t *session);
+
+/**
+ * Set the outgoing high-water mark for a session object.
+ *
+ * This bounds ::pn_session_outgoing_room, so a sender streaming a
+ * large message never has more than this many bytes buffered. It
+ * does not limit ::pn_link_send itself. The default of zero leaves
+ * only the peer's window as the bound.
+ *
+ * @param[in] session the session object
+ * @param[in] high_water the outgoing high-water mark in bytes
+ */
+PN_EXTERN void pn_session_set_outgoing_high_water(pn_session_t *session, size_t high_water);
+
+/**
+ * Get the number of bytes a sender on the session should buffer next.
+ *
+ * This is what the peer's incoming window will take once everything
+ * already buffered has been framed, further bounded by the outgoing
+ * high-water mark. A sender streaming a large message writes at most
+ * this much with ::pn_link_send and waits for the next
+ * ::PN_LINK_FLOW event when it is zero. Those events are issued as
+ * buffered data goes out and as the peer opens its window.
+ *
+ * @param[in] session a session object
+ * @return the number of bytes there is room for, SIZE_MAX if unbounded
+ */
+PN_EXTERN size_t pn_session_outgoing_room(pn_session_t *session);
+
 /**
  * Get the number of outgoing bytes currently buffered by a session.
  *
@@ -217,6 +217,103 @@ PN_EXTERN int pn_ssl_domain_set_peer_authentication(pn_ssl_domain_t *domain,
  */
 PN_EXTERN int pn_ssl_domain_allow_unsecured_client(pn_ssl_domain_t *domain);
 
+/** Bound the number of client sessions a domain keeps for resumption.
+ *
+ * Sessions saved by connections that were given a session id (see
+ * ::pn_ssl_init) are kept in a cache on the domain until they expire.
+ * Once the cache is full, the least recently saved session is dropped
+ * to make room.  The default size is 4096, and a size of zero disables
+ * the cache.
+ *
+ * @param[in] domain the domain whose cache is bounded.
+ * @param[in] size the maximum number of sessions to keep.
+ * @return 0 on success
+ */
+PN_EXTERN int pn_ssl_domain_set_session_cache_size(pn_ssl_domain_t *domain, size_t size);
+
+/** Get the number of session lookups that found a session to resume.
+ *
+ * @param[in] domain the domain to query.
+ * @return the number of cache hits since the domain was created.
+ */
+PN_EXTERN uint64_t pn_ssl_domain_session_cache_hits(pn_ssl_domain_t *domain);
+
+/** Get the number of session lookups that found nothing to resume.
+ *
+ * @param[in] domain the domain to query.
+ * @return the number of cache misses since the domain was created.
+ */
+PN_EXTERN uint64_t pn_ssl_domain_session_cache_misses(pn_ssl_domain_t *domain);
+
+/** Size the session cache a server domain resumes sessions from.
+ *
+ * The cache is shared, and safely so, by every connection using the
+ * domain, whatever thread it runs on.  Servers running several
+ * reactors should therefore give them all the same domain.  A size of
+ * zero disables the cache, leaving session tickets (see
+ * ::pn_ssl_domain_add_session_ticket_key) as the only way to resume.
+ *
+ * @param[in] domain the server domain to configure.
+ * @param[in] size the maximum number of sessions to cache.
+ * @return 0 on success
+ */
+PN_EXTERN int pn_ssl_domain_set_server_session_cache(pn_ssl_domain_t *domain, size_t size);
+
+/** Add a key for protecting the session tickets a server issues.
+ *
+ * Without a key each domain protects its tickets with a random key of
+ * its own, so tickets only resume against the process that issued
+ * them.  Servers behind a load balancer should all be given the same
+ * keys.
+ *
+ * The key is 48 bytes: a 16 byte key name, a 16 byte HMAC secret and
+ * a 16 byte AES key.  The most recently added key protects new
+ * tickets.  The three keys before it are still accepted, and tickets
+ * protected by them are reissued under the new key, which allows keys
+ * to be rotated without failing resumption.
+ *
+ * @param[in] domain the server domain to configure.
+ * @param[in] key the key material.
+ * @param[in] size the size of the key, which must be 48.
+ * @return 0 on success
+ */
+PN_EXTERN int pn_ssl_domain_add_session_ticket_key(pn_ssl_domain_t *domain,
+                                                   const char *key, size_t size);
+
+/** Run the public key operations of the TLS handshake on worker threads.
+ *
+ * Each step of a handshake is handed to one of count threads owned by
+ * the domain, and the connection is put aside until the step is done,
+ * so a busy server can keep serving its established connections while
+ * new ones are being set up.  Only connections run by a reactor are
+ * offloaded this way, others do their handshake inline as before.
+ *
+ * The workers may only be started once, before the domain is used.
+ *
+ * @param[in] domain the domain to configure.
+ * @param[in] count the number of worker threads, zero leaves the
+ * handshake inline.
+ * @return 0 on success
+ */
+PN_EXTERN int pn_ssl_domain_set_handshake_workers(pn_ssl_domain_t *domain, size_t count);
+
+/** Hand the record layer of established connections to the kernel.
+ *
+ * Once the handshake is done, the keys of a TLS 1.2 AES-GCM session
+ * are given to the socket (Linux kernel TLS), which then encrypts and
+ * decrypts in place of openssl, and the data no longer passes through
+ * user space buffers to be encrypted.  Only connections run by a
+ * reactor can be offloaded.  Where the kernel lacks the tls module, or
+ * the session uses another protocol or cipher, the connection stays
+ * in user space as before.  Offloaded connections cannot renegotiate.
+ *
+ * @param[in] domain the domain to configure.
+ * @param[in] enable true to offload connections when possible.
+ * @return 0 on success, or -1 if kernel TLS is not supported by this
+ * build, which it is only when configured with ENABLE_KTLS.
+ */
+PN_EXTERN int pn_ssl_domain_set_kernel_tls(pn_ssl_domain_t *domain, bool enable);
+
 /** Create a new SSL session object associated with a transport.
  *
  * A transport must have an SSL object in order to "speak" SSL over its connection. This
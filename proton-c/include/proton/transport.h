@@ -185,6 +185,135 @@ PN_EXTERN void pn_transport_set_tracer(pn_transport_t *transport, pn_tracer_t tr
  */
 PN_EXTERN pn_tracer_t pn_transport_get_tracer(pn_transport_t *transport);
 
+/**
+ * Performatives for pn_transport_trace_performatives(), one bit each.
+ */
+#define PN_TRACE_OPEN        (1 << 0)
+#define PN_TRACE_BEGIN       (1 << 1)
+#define PN_TRACE_ATTACH      (1 << 2)
+#define PN_TRACE_FLOW        (1 << 3)
+#define PN_TRACE_TRANSFER    (1 << 4)
+#define PN_TRACE_DISPOSITION (1 << 5)
+#define PN_TRACE_DETACH      (1 << 6)
+#define PN_TRACE_END         (1 << 7)
+#define PN_TRACE_CLOSE       (1 << 8)
+
+/**
+ * Only trace one in every n frames.
+ *
+ * Frames are counted separately in each direction and the filters
+ * below only apply to the frames picked. This holds for both
+ * ::PN_TRACE_FRM and ::PN_TRACE_RAW, so a frame picked for one is
+ * picked for the other. An n of 0 or 1 traces every frame.
+ *
+ * @param[in] transport a transport object
+ * @param[in] n the sampling interval
+ */
+PN_EXTERN void pn_transport_trace_sample(pn_transport_t *transport, uint32_t n);
+
+/**
+ * Only trace the given performatives.
+ *
+ * @param[in] transport a transport object
+ * @param[in] mask PN_TRACE_OPEN, PN_TRACE_ATTACH etc. or'ed together,
+ *                 0 for all frames including SASL
+ */
+PN_EXTERN void pn_transport_trace_performatives(pn_transport_t *transport, uint32_t mask);
+
+/**
+ * Only trace frames on the given channel.
+ *
+ * @param[in] transport a transport object
+ * @param[in] channel the channel, or -1 for all of them
+ */
+PN_EXTERN void pn_transport_trace_channel(pn_transport_t *transport, int channel);
+
+/**
+ * Only trace frames for the given link handle.
+ *
+ * Frames without a handle, such as begin or disposition, are left out
+ * as well. Combine with pn_transport_trace_channel() to pick a single
+ * link, handles are only unique within a session.
+ *
+ * @param[in] transport a transport object
+ * @param[in] handle the handle, or -1 for all of them
+ */
+PN_EXTERN void pn_transport_trace_handle(pn_transport_t *transport, int64_t handle);
+
+/**
+ * Only trace detach, end and close frames that carry an error.
+ *
+ * @param[in] transport a transport object
+ * @param[in] errors true to only trace frames with an error
+ */
+PN_EXTERN void pn_transport_trace_errors(pn_transport_t *transport, bool errors);
+
+/**
+ * Callback receiving the frames traced with ::PN_TRACE_RAW.
+ *
+ * The frame is passed as it is on the wire, header included, and is
+ * only valid for the duration of the call.
+ */
+typedef void (*pn_frame_tracer_t)(pn_transport_t *transport, const char *frame, size_t size,
+                                  bool outgoing);
+
+/**
+ * Hand raw frames to a callback instead of logging them.
+ *
+ * With a frame tracer the frames traced by ::PN_TRACE_RAW are neither
+ * quoted nor formatted, which keeps tracing cheap enough to leave on
+ * under load. Unlike ::PN_TRACE_FRM it does not slow down the encoding
+ * and decoding of frames either.
+ *
+ * @param[in] transport a transport object
+ * @param[in] tracer the frame tracer, or NULL to log raw frames again
+ */
+PN_EXTERN void pn_transport_set_frame_tracer(pn_transport_t *transport, pn_frame_tracer_t tracer);
+
+/**
+ * Capture what the transport reads and writes to a file.
+ *
+ * The bytes are captured as the AMQP layer sees them, below any SASL
+ * or SSL, and each read or write is timestamped. The file is appended
+ * to through a memory mapping where the platform has one, which keeps
+ * capturing cheap enough for a live transport. proton-dump prints
+ * captures and replays them through a transport of its own.
+ *
+ * Start the capture before the transport reads or writes anything,
+ * after pn_transport_set_server() for a server, for a capture that can
+ * be replayed. Capturing stops when the transport is freed, when
+ * writing fails or when this is called again.
+ *
+ * @param[in] transport a transport object
+ * @param[in] path the file to create or truncate, NULL to stop capturing
+ * @return 0 on success, or an error code if the file could not be
+ * created, which leaves the transport not capturing
+ */
+PN_EXTERN int pn_transport_capture(pn_transport_t *transport, const char *path);
+
+/**
+ * Compress what the transport sends, if the peer does the same.
+ *
+ * The transport offers compression in its open and, where the peer's
+ * open offers it too, deflates everything each side sends after the
+ * opens. Output is flushed whenever the frames queued so far have all
+ * been compressed, so nothing waits on more to come. This pays off on
+ * slow links carrying compressible bodies, at the cost of some CPU and
+ * a few hundred kilobytes per connection. Captures still hold the
+ * frames uncompressed.
+ *
+ * Set this before the transport reads or writes anything, as with
+ * pn_ssl().
+ *
+ * @param[in] transport a transport object
+ * @param[in] level the zlib level from 1, fastest, to 9, smallest, or
+ * 0, the default, not to offer compression
+ * @return 0 on success, PN_ARG_ERR for a level out of range,
+ * PN_STATE_ERR once the transport has started, or PN_ERR if proton was
+ * built without zlib
+ */
+PN_EXTERN int pn_transport_set_compression(pn_transport_t *transport, int level);
+
 /**
  * Get the application context that is associated with a transport object.
  *
@@ -287,6 +416,10 @@ PN_EXTERN uint32_t pn_transport_get_max_frame(pn_transport_t *transport);
 /**
  * Set the maximum frame size of a transport.
  *
+ * This is the largest frame the peer may send, and the input buffer
+ * grows to hold one such frame. The default is 16KiB, and zero allows
+ * frames of any size.
+ *
  * @param[in] transport a transport object
  * @param[in] size the maximum frame size for the transport object
  */
@@ -320,6 +453,29 @@ PN_EXTERN pn_millis_t pn_transport_get_idle_timeout(pn_transport_t *transport);
  */
 PN_EXTERN void pn_transport_set_idle_timeout(pn_transport_t *transport, pn_millis_t timeout);
 
+/**
+ * Get the compaction timeout for a transport.
+ *
+ * @param[in] transport a transport object
+ * @return the compaction timeout in milliseconds, zero if disabled
+ */
+PN_EXTERN pn_millis_t pn_transport_get_compact_timeout(pn_transport_t *transport);
+
+/**
+ * Set the compaction timeout for a transport.
+ *
+ * Once a transport has seen no input or output for this long, the
+ * next ::pn_transport_tick gives back its io buffers and shrinks its
+ * other working storage. Everything is reacquired as soon as there is
+ * something to read or write, so this only trades a little work on
+ * wakeup for much less memory held by idle connections. A zero
+ * timeout, the default, disables compaction.
+ *
+ * @param[in] transport a transport object
+ * @param[in] timeout the compaction timeout in milliseconds
+ */
+PN_EXTERN void pn_transport_set_compact_timeout(pn_transport_t *transport, pn_millis_t timeout);
+
 /**
  * Get the idle timeout for a transport's remote peer.
  *
@@ -65,6 +65,13 @@ typedef struct {
 
 PN_EXTERN pn_bytes_t pn_bytes(size_t size, const char *start);
 
+typedef struct {
+  size_t size;
+  char *start;
+} pn_rwbytes_t;
+
+PN_EXTERN pn_rwbytes_t pn_rwbytes(size_t size, char *start);
+
 /** @}
  */
 
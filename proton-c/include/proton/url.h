@@ -40,6 +40,11 @@ typedef struct pn_url_t pn_url_t;
 PN_EXTERN pn_url_t *pn_url(void);
 
 /** Parse a string URL as a pn_url_t.
+ *
+ * With a scheme ending in "+unix", e.g. amqp+unix://%2Ftmp%2Fbroker.sock/queue,
+ * the host is the path of a local socket with '/' escaped as %2F, and
+ * there is no port.
+ *
  *@param[in] url A URL string.
  *@return The parsed pn_url_t or NULL if url is not a valid URL string.
  */
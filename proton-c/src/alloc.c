@@ -0,0 +1,215 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/cid.h>
+#include <proton/error.h>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "platform_fmt.h"
+#include "alloc_private.h"
+#include "thread.h"
+
+static const char *pni_subsystem_names[PN_ALLOC_SUBSYSTEMS] = {
+  "object",
+  "string",
+  "collection",
+  "record",
+  "event",
+  "buffer",
+  "codec",
+  "engine",
+  "transport",
+  "message",
+  "messenger",
+  "reactor",
+  "io"
+};
+
+typedef struct {
+  uint64_t allocations;
+  uint64_t reallocations;
+  uint64_t frees;
+  uint64_t bytes;
+} pni_counters_t;
+
+static pni_counters_t pni_counters[PN_ALLOC_SUBSYSTEMS];
+
+static pn_allocator_t pni_hooks;
+const pn_allocator_t *pni_allocator = NULL;
+
+int pn_set_allocator(const pn_allocator_t *allocator)
+{
+  if (!allocator) {
+    pni_allocator = NULL;
+    return 0;
+  }
+  if (!allocator->allocate || !allocator->reallocate || !allocator->deallocate) {
+    return PN_ARG_ERR;
+  }
+  pni_hooks = *allocator;
+  pni_allocator = &pni_hooks;
+  return 0;
+}
+
+void *pni_allocator_calloc(size_t count, size_t size)
+{
+  if (size && count > SIZE_MAX / size) return NULL;
+  void *ptr = pni_allocator->allocate(pni_allocator->context, count * size);
+  if (ptr) memset(ptr, 0, count * size);
+  return ptr;
+}
+
+#ifdef PN_TRACK_ALLOCATIONS
+
+void *pni_mem_malloc(pn_alloc_subsystem_t subsystem, size_t size)
+{
+  assert(subsystem < PN_ALLOC_SUBSYSTEMS);
+  pni_atomic_add64(&pni_counters[subsystem].allocations, 1);
+  pni_atomic_add64(&pni_counters[subsystem].bytes, size);
+  return pni_sys_malloc(size);
+}
+
+void *pni_mem_calloc(pn_alloc_subsystem_t subsystem, size_t count, size_t size)
+{
+  assert(subsystem < PN_ALLOC_SUBSYSTEMS);
+  pni_atomic_add64(&pni_counters[subsystem].allocations, 1);
+  pni_atomic_add64(&pni_counters[subsystem].bytes, count * size);
+  return pni_sys_calloc(count, size);
+}
+
+void *pni_mem_realloc(pn_alloc_subsystem_t subsystem, void *ptr, size_t size)
+{
+  assert(subsystem < PN_ALLOC_SUBSYSTEMS);
+  // growing from nothing is an allocation like any other
+  pni_atomic_add64(ptr ? &pni_counters[subsystem].reallocations
+                       : &pni_counters[subsystem].allocations, 1);
+  pni_atomic_add64(&pni_counters[subsystem].bytes, size);
+  return pni_sys_realloc(ptr, size);
+}
+
+void pni_mem_free(pn_alloc_subsystem_t subsystem, void *ptr)
+{
+  assert(subsystem < PN_ALLOC_SUBSYSTEMS);
+  if (!ptr) return;
+  pni_atomic_add64(&pni_counters[subsystem].frees, 1);
+  pni_sys_free(ptr);
+}
+
+bool pn_alloc_tracking(void)
+{
+  return true;
+}
+
+#else
+
+bool pn_alloc_tracking(void)
+{
+  return false;
+}
+
+#endif
+
+pn_alloc_subsystem_t pni_alloc_subsystem(const pn_class_t *clazz)
+{
+  switch (pn_class_id(clazz)) {
+  case CID_pn_string:
+    return PN_ALLOC_STRING;
+  case CID_pn_list:
+  case CID_pn_map:
+  case CID_pn_hash:
+    return PN_ALLOC_COLLECTION;
+  case CID_pn_record:
+    return PN_ALLOC_RECORD;
+  case CID_pn_collector:
+  case CID_pn_event:
+    return PN_ALLOC_EVENT;
+  case CID_pn_encoder:
+  case CID_pn_decoder:
+  case CID_pn_data:
+    return PN_ALLOC_CODEC;
+  case CID_pn_connection:
+  case CID_pn_session:
+  case CID_pn_link:
+  case CID_pn_delivery:
+    return PN_ALLOC_ENGINE;
+  case CID_pn_transport:
+  case CID_pn_sasl_verifier:
+    return PN_ALLOC_TRANSPORT;
+  case CID_pn_message:
+    return PN_ALLOC_MESSAGE;
+  case CID_pn_reactor:
+  case CID_pn_handler:
+  case CID_pn_timer:
+  case CID_pn_task:
+  case CID_pn_reactor_group:
+    return PN_ALLOC_REACTOR;
+  case CID_pn_io:
+  case CID_pn_socket_options:
+  case CID_pn_selector:
+  case CID_pn_selectable:
+    return PN_ALLOC_IO;
+  default:
+    return PN_ALLOC_OBJECT;
+  }
+}
+
+const char *pn_alloc_subsystem_name(pn_alloc_subsystem_t subsystem)
+{
+  if (subsystem >= PN_ALLOC_SUBSYSTEMS) return "total";
+  return pni_subsystem_names[subsystem];
+}
+
+void pn_alloc_counters(pn_alloc_subsystem_t subsystem, pn_alloc_counters_t *counters)
+{
+  assert(counters);
+  counters->allocations = 0;
+  counters->reallocations = 0;
+  counters->frees = 0;
+  counters->bytes = 0;
+  int first = subsystem < PN_ALLOC_SUBSYSTEMS ? (int) subsystem : 0;
+  int last = subsystem < PN_ALLOC_SUBSYSTEMS ? (int) subsystem : PN_ALLOC_SUBSYSTEMS - 1;
+  for (int i = first; i <= last; i++) {
+    counters->allocations += pni_atomic_get64(&pni_counters[i].allocations);
+    counters->reallocations += pni_atomic_get64(&pni_counters[i].reallocations);
+    counters->frees += pni_atomic_get64(&pni_counters[i].frees);
+    counters->bytes += pni_atomic_get64(&pni_counters[i].bytes);
+  }
+}
+
+int pn_alloc_dump(pn_string_t *dst)
+{
+  assert(dst);
+  int err = pn_string_addf(dst, "%-12s %14s %14s %14s %16s\n", "subsystem", "allocations",
+                           "reallocations", "frees", "bytes");
+  for (int i = 0; !err && i <= PN_ALLOC_SUBSYSTEMS; i++) {
+    pn_alloc_counters_t counters;
+    pn_alloc_counters((pn_alloc_subsystem_t) i, &counters);
+    if (i < PN_ALLOC_SUBSYSTEMS && !counters.allocations && !counters.reallocations &&
+        !counters.frees) {
+      continue;
+    }
+    err = pn_string_addf(dst, "%-12s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %16" PRIu64 "\n",
+                         pn_alloc_subsystem_name((pn_alloc_subsystem_t) i), counters.allocations,
+                         counters.reallocations, counters.frees, counters.bytes);
+  }
+  return err;
+}
@@ -0,0 +1,82 @@
+#ifndef _PROTON_ALLOC_PRIVATE_H
+#define _PROTON_ALLOC_PRIVATE_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/alloc.h>
+#include <stdlib.h>
+
+/*
+ * The library allocates through these, which are the allocator's hooks
+ * if one is set and otherwise the C library's own, counted by
+ * subsystem if it is built with ENABLE_ALLOCATION_TRACKING. With no
+ * allocator set the only cost is the test for one.
+ */
+
+// the allocator set with pn_set_allocator(), NULL for the C library
+extern const pn_allocator_t *pni_allocator;
+
+// calloc in terms of the allocator's hooks
+void *pni_allocator_calloc(size_t count, size_t size);
+
+#define pni_sys_malloc(SIZE) \
+  (pni_allocator ? pni_allocator->allocate(pni_allocator->context, (SIZE)) : malloc(SIZE))
+#define pni_sys_calloc(COUNT, SIZE) \
+  (pni_allocator ? pni_allocator_calloc((COUNT), (SIZE)) : calloc((COUNT), (SIZE)))
+#define pni_sys_realloc(PTR, SIZE) \
+  (pni_allocator ? pni_allocator->reallocate(pni_allocator->context, (PTR), (SIZE)) \
+                 : realloc((PTR), (SIZE)))
+
+static inline void pni_sys_free(void *ptr)
+{
+  if (!pni_allocator) {
+    free(ptr);
+  } else if (ptr) {
+    pni_allocator->deallocate(pni_allocator->context, ptr);
+  }
+}
+
+#ifdef PN_TRACK_ALLOCATIONS
+
+void *pni_mem_malloc(pn_alloc_subsystem_t subsystem, size_t size);
+void *pni_mem_calloc(pn_alloc_subsystem_t subsystem, size_t count, size_t size);
+void *pni_mem_realloc(pn_alloc_subsystem_t subsystem, void *ptr, size_t size);
+void pni_mem_free(pn_alloc_subsystem_t subsystem, void *ptr);
+
+#define pni_malloc(SUBSYSTEM, SIZE) pni_mem_malloc(SUBSYSTEM, SIZE)
+#define pni_calloc(SUBSYSTEM, COUNT, SIZE) pni_mem_calloc(SUBSYSTEM, COUNT, SIZE)
+#define pni_realloc(SUBSYSTEM, PTR, SIZE) pni_mem_realloc(SUBSYSTEM, PTR, SIZE)
+#define pni_free(SUBSYSTEM, PTR) pni_mem_free(SUBSYSTEM, PTR)
+
+#else
+
+#define pni_malloc(SUBSYSTEM, SIZE) pni_sys_malloc(SIZE)
+#define pni_calloc(SUBSYSTEM, COUNT, SIZE) pni_sys_calloc(COUNT, SIZE)
+#define pni_realloc(SUBSYSTEM, PTR, SIZE) pni_sys_realloc(PTR, SIZE)
+#define pni_free(SUBSYSTEM, PTR) pni_sys_free(PTR)
+
+#endif
+
+// the subsystem an instance of clazz is counted under
+pn_alloc_subsystem_t pni_alloc_subsystem(const pn_class_t *clazz);
+
+#endif /* alloc_private.h */
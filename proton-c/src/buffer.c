@@ -29,29 +29,139 @@
 
 #include "buffer.h"
 #include "util.h"
+#include "alloc_private.h"
+
+// storage for pooled buffers comes in a few fixed size classes, anything
+// bigger than the largest class is allocated directly
+#define PNI_BUFFER_CLASSES (4)
+
+static const size_t pni_buffer_class_size[PNI_BUFFER_CLASSES] = {64, 256, 4*1024, 64*1024};
+// how many free blocks of each class a pool holds on to
+static const size_t pni_buffer_class_limit[PNI_BUFFER_CLASSES] = {256, 64, 16, 4};
+
+typedef struct pni_block_t {
+  struct pni_block_t *next;
+} pni_block_t;
+
+struct pn_buffer_pool_t {
+  pni_block_t *blocks[PNI_BUFFER_CLASSES];
+  size_t count[PNI_BUFFER_CLASSES];
+  size_t hits;
+  size_t misses;
+};
 
 struct pn_buffer_t {
+  pn_buffer_pool_t *pool;
   size_t capacity;
   size_t start;
   size_t size;
   char *bytes;
 };
 
-pn_buffer_t *pn_buffer(size_t capacity)
+pn_buffer_pool_t *pn_buffer_pool(void)
 {
-  pn_buffer_t *buf = (pn_buffer_t *) malloc(sizeof(pn_buffer_t));
-  buf->capacity = capacity;
+  pn_buffer_pool_t *pool =
+    (pn_buffer_pool_t *) pni_calloc(PN_ALLOC_BUFFER, 1, sizeof(pn_buffer_pool_t));
+  return pool;
+}
+
+void pn_buffer_pool_free(pn_buffer_pool_t *pool)
+{
+  if (pool) {
+    for (int i = 0; i < PNI_BUFFER_CLASSES; i++) {
+      while (pool->blocks[i]) {
+        pni_block_t *block = pool->blocks[i];
+        pool->blocks[i] = block->next;
+        pni_free(PN_ALLOC_BUFFER, block);
+      }
+    }
+    pni_free(PN_ALLOC_BUFFER, pool);
+  }
+}
+
+size_t pn_buffer_pool_hits(pn_buffer_pool_t *pool)
+{
+  return pool->hits;
+}
+
+size_t pn_buffer_pool_misses(pn_buffer_pool_t *pool)
+{
+  return pool->misses;
+}
+
+// the class for storage of the given capacity, or -1 if it is too big
+static int pni_buffer_class(size_t capacity)
+{
+  for (int i = 0; i < PNI_BUFFER_CLASSES; i++) {
+    if (capacity <= pni_buffer_class_size[i]) return i;
+  }
+  return -1;
+}
+
+static size_t pni_buffer_round(pn_buffer_t *buf, size_t capacity)
+{
+  if (buf->pool) {
+    int c = pni_buffer_class(capacity);
+    if (c >= 0) return pni_buffer_class_size[c];
+  }
+  return capacity;
+}
+
+static char *pni_buffer_alloc(pn_buffer_pool_t *pool, size_t capacity)
+{
+  if (pool) {
+    int c = pni_buffer_class(capacity);
+    if (c >= 0) {
+      pni_block_t *block = pool->blocks[c];
+      if (block) {
+        pool->blocks[c] = block->next;
+        pool->count[c]--;
+        pool->hits++;
+        return (char *) block;
+      }
+      pool->misses++;
+      return (char *) pni_malloc(PN_ALLOC_BUFFER, pni_buffer_class_size[c]);
+    }
+  }
+  return (char *) pni_malloc(PN_ALLOC_BUFFER, capacity);
+}
+
+static void pni_buffer_release(pn_buffer_pool_t *pool, char *bytes, size_t capacity)
+{
+  if (pool && bytes) {
+    int c = pni_buffer_class(capacity);
+    if (c >= 0 && pool->count[c] < pni_buffer_class_limit[c]) {
+      pni_block_t *block = (pni_block_t *) bytes;
+      block->next = pool->blocks[c];
+      pool->blocks[c] = block;
+      pool->count[c]++;
+      return;
+    }
+  }
+  pni_free(PN_ALLOC_BUFFER, bytes);
+}
+
+pn_buffer_t *pn_buffer_pooled(pn_buffer_pool_t *pool, size_t capacity)
+{
+  pn_buffer_t *buf = (pn_buffer_t *) pni_malloc(PN_ALLOC_BUFFER, sizeof(pn_buffer_t));
+  buf->pool = pool;
+  buf->capacity = capacity ? pni_buffer_round(buf, capacity) : 0;
   buf->start = 0;
   buf->size = 0;
-  buf->bytes = capacity ? (char *) malloc(capacity) : NULL;
+  buf->bytes = capacity ? pni_buffer_alloc(pool, buf->capacity) : NULL;
   return buf;
 }
 
+pn_buffer_t *pn_buffer(size_t capacity)
+{
+  return pn_buffer_pooled(NULL, capacity);
+}
+
 void pn_buffer_free(pn_buffer_t *buf)
 {
   if (buf) {
-    free(buf->bytes);
-    free(buf);
+    pni_buffer_release(buf->pool, buf->bytes, buf->capacity);
+    pni_free(PN_ALLOC_BUFFER, buf);
   }
 }
 
@@ -128,19 +238,35 @@ int pn_buffer_ensure(pn_buffer_t *buf, size_t size)
 {
   size_t old_capacity = buf->capacity;
   size_t old_head = pn_buffer_head(buf);
+  size_t old_tail = pn_buffer_tail(buf);
   bool wrapped = pn_buffer_wrapped(buf);
 
   while (pn_buffer_available(buf) < size) {
-    buf->capacity = 2*(buf->capacity ? buf->capacity : 16);
+    buf->capacity = pni_buffer_round(buf, 2*(buf->capacity ? buf->capacity : 16));
   }
 
   if (buf->capacity != old_capacity) {
-    buf->bytes = (char *) realloc(buf->bytes, buf->capacity);
-
-    if (wrapped) {
-      size_t n = old_capacity - old_head;
-      memmove(buf->bytes + buf->capacity - n, buf->bytes + old_head, n);
-      buf->start = buf->capacity - n;
+    if (buf->pool && pni_buffer_class(old_capacity) >= 0) {
+      // pooled storage can't be realloced, move the contents across
+      char *bytes = pni_buffer_alloc(buf->pool, buf->capacity);
+      if (wrapped) {
+        size_t n = old_capacity - old_head;
+        memcpy(bytes + buf->capacity - n, buf->bytes + old_head, n);
+        memcpy(bytes, buf->bytes, old_tail);
+        buf->start = buf->capacity - n;
+      } else if (buf->size) {
+        memcpy(bytes + old_head, buf->bytes + old_head, buf->size);
+      }
+      pni_buffer_release(buf->pool, buf->bytes, old_capacity);
+      buf->bytes = bytes;
+    } else {
+      buf->bytes = (char *) pni_realloc(PN_ALLOC_BUFFER, buf->bytes, buf->capacity);
+
+      if (wrapped) {
+        size_t n = old_capacity - old_head;
+        memmove(buf->bytes + buf->capacity - n, buf->bytes + old_head, n);
+        buf->start = buf->capacity - n;
+      }
     }
   }
 
@@ -238,6 +364,21 @@ void pn_buffer_clear(pn_buffer_t *buf)
   buf->size = 0;
 }
 
+// give back the storage of an empty buffer that has grown past capacity
+int pn_buffer_shrink(pn_buffer_t *buf, size_t capacity)
+{
+  if (buf->size) return PN_STATE_ERR;
+  capacity = pni_buffer_round(buf, capacity);
+  if (buf->capacity <= capacity) return 0;
+  char *bytes = pni_buffer_alloc(buf->pool, capacity);
+  if (!bytes) return PN_ERR;
+  pni_buffer_release(buf->pool, buf->bytes, buf->capacity);
+  buf->bytes = bytes;
+  buf->capacity = capacity;
+  buf->start = 0;
+  return 0;
+}
+
 static void pn_buffer_rotate (pn_buffer_t *buf, size_t sz) {
   if (sz == 0) return;
 
@@ -259,16 +400,39 @@ static void pn_buffer_rotate (pn_buffer_t *buf, size_t sz) {
 
 int pn_buffer_defrag(pn_buffer_t *buf)
 {
-  pn_buffer_rotate(buf, buf->start);
+  if (pn_buffer_wrapped(buf)) {
+    pn_buffer_rotate(buf, buf->start);
+  } else if (buf->start) {
+    memmove(buf->bytes, buf->bytes + buf->start, buf->size);
+  }
   buf->start = 0;
   return 0;
 }
 
+// the contents are the head segment followed by the wrap segment, the
+// wrap segment is only non empty when the contents wrap around the end
+// of the underlying storage
+size_t pn_buffer_segments(pn_buffer_t *buf, pn_bytes_t *head, pn_bytes_t *wrap)
+{
+  if (buf && buf->size) {
+    *head = pn_bytes(pn_buffer_head_size(buf), buf->bytes + pn_buffer_head(buf));
+    *wrap = pn_bytes(pn_buffer_tail_size(buf), buf->bytes);
+    return buf->size;
+  } else {
+    *head = pn_bytes(0, NULL);
+    *wrap = pn_bytes(0, NULL);
+    return 0;
+  }
+}
+
 pn_bytes_t pn_buffer_bytes(pn_buffer_t *buf)
 {
   if (buf) {
-    pn_buffer_defrag(buf);
-    return pn_bytes(buf->size, buf->bytes);
+    // only contents that wrap need to be moved to be contiguous
+    if (pn_buffer_wrapped(buf)) {
+      pn_buffer_defrag(buf);
+    }
+    return pn_bytes(buf->size, buf->bytes + buf->start);
   } else {
     return pn_bytes(0, NULL);
   }
@@ -35,8 +35,15 @@ typedef struct {
 } pn_buffer_memory_t;
 
 typedef struct pn_buffer_t pn_buffer_t;
+typedef struct pn_buffer_pool_t pn_buffer_pool_t;
+
+PN_EXTERN pn_buffer_pool_t *pn_buffer_pool(void);
+PN_EXTERN void pn_buffer_pool_free(pn_buffer_pool_t *pool);
+PN_EXTERN size_t pn_buffer_pool_hits(pn_buffer_pool_t *pool);
+PN_EXTERN size_t pn_buffer_pool_misses(pn_buffer_pool_t *pool);
 
 PN_EXTERN pn_buffer_t *pn_buffer(size_t capacity);
+PN_EXTERN pn_buffer_t *pn_buffer_pooled(pn_buffer_pool_t *pool, size_t capacity);
 PN_EXTERN void pn_buffer_free(pn_buffer_t *buf);
 PN_EXTERN size_t pn_buffer_size(pn_buffer_t *buf);
 PN_EXTERN size_t pn_buffer_capacity(pn_buffer_t *buf);
@@ -47,7 +54,9 @@ PN_EXTERN int pn_buffer_prepend(pn_buffer_t *buf, const char *bytes, size_t size
 PN_EXTERN size_t pn_buffer_get(pn_buffer_t *buf, size_t offset, size_t size, char *dst);
 PN_EXTERN int pn_buffer_trim(pn_buffer_t *buf, size_t left, size_t right);
 PN_EXTERN void pn_buffer_clear(pn_buffer_t *buf);
+PN_EXTERN int pn_buffer_shrink(pn_buffer_t *buf, size_t capacity);
 PN_EXTERN int pn_buffer_defrag(pn_buffer_t *buf);
+PN_EXTERN size_t pn_buffer_segments(pn_buffer_t *buf, pn_bytes_t *head, pn_bytes_t *wrap);
 PN_EXTERN pn_bytes_t pn_buffer_bytes(pn_buffer_t *buf);
 PN_EXTERN pn_buffer_memory_t pn_buffer_memory(pn_buffer_t *buf);
 PN_EXTERN int pn_buffer_print(pn_buffer_t *buf);
@@ -0,0 +1,151 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "arena.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "alloc_private.h"
+
+#define PNI_ARENA_ALIGN (2 * sizeof(void *))
+#define PNI_ARENA_MIN_BLOCK (256)
+
+struct pni_arena_block_t {
+  pni_arena_block_t *next;
+  size_t size;
+};
+
+static size_t pni_arena_round(size_t size)
+{
+  return (size + PNI_ARENA_ALIGN - 1) & ~(PNI_ARENA_ALIGN - 1);
+}
+
+// the usable space follows the header, kept aligned
+static char *pni_arena_space(pni_arena_block_t *block)
+{
+  return (char *) block + pni_arena_round(sizeof(pni_arena_block_t));
+}
+
+static pni_arena_block_t *pni_arena_block(pni_arena_t *arena, size_t size)
+{
+  pni_arena_block_t *block = (pni_arena_block_t *)
+    pni_malloc(PN_ALLOC_CODEC, pni_arena_round(sizeof(pni_arena_block_t)) + size);
+  if (!block) return NULL;
+  block->size = size;
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->start = pni_arena_space(block);
+  arena->size = size;
+  arena->used = 0;
+  return block;
+}
+
+static void pni_arena_release(pni_arena_t *arena)
+{
+  pni_arena_block_t *block = arena->blocks;
+  while (block) {
+    pni_arena_block_t *next = block->next;
+    pni_free(PN_ALLOC_CODEC, block);
+    block = next;
+  }
+  arena->blocks = NULL;
+}
+
+void pni_arena_init(pni_arena_t *arena, void *initial, size_t size)
+{
+  // the initial block only counts as far as it is aligned
+  size_t skew = initial ? (size_t) -(uintptr_t) initial & (PNI_ARENA_ALIGN - 1) : 0;
+  if (skew > size) skew = size;
+  arena->initial = initial ? (char *) initial + skew : NULL;
+  arena->initial_size = (size - skew) & ~(PNI_ARENA_ALIGN - 1);
+  arena->blocks = NULL;
+  arena->start = arena->initial;
+  arena->size = arena->initial_size;
+  arena->used = 0;
+  arena->total = 0;
+  arena->last = NULL;
+}
+
+void pni_arena_fini(pni_arena_t *arena)
+{
+  pni_arena_release(arena);
+}
+
+void *pni_arena_alloc(pni_arena_t *arena, size_t size)
+{
+  size = pni_arena_round(size);
+  if (size > arena->size - arena->used) {
+    size_t block = 2 * arena->size;
+    if (block < PNI_ARENA_MIN_BLOCK) block = PNI_ARENA_MIN_BLOCK;
+    if (block < size) block = size;
+    if (!pni_arena_block(arena, block)) return NULL;
+  }
+  char *ptr = arena->start + arena->used;
+  arena->used += size;
+  arena->total += size;
+  arena->last = ptr;
+  return ptr;
+}
+
+void *pni_arena_realloc(pni_arena_t *arena, void *ptr, size_t old_size, size_t size)
+{
+  if (!ptr) return pni_arena_alloc(arena, size);
+
+  old_size = pni_arena_round(old_size);
+  size_t rounded = pni_arena_round(size);
+  if (ptr == arena->last) {
+    size_t offset = (char *) ptr - arena->start;
+    if (rounded <= arena->size - offset) {
+      arena->used = offset + rounded;
+      arena->total = arena->total - old_size + rounded;
+      return ptr;
+    }
+  }
+
+  void *moved = pni_arena_alloc(arena, size);
+  if (moved) memcpy(moved, ptr, old_size < rounded ? old_size : rounded);
+  return moved;
+}
+
+void pni_arena_reset(pni_arena_t *arena)
+{
+  // unless one heap block held everything, the heap blocks are merged
+  // into one that would have
+  bool merge = arena->blocks && (arena->blocks->next || arena->blocks->size < arena->total);
+  if (merge) {
+    size_t total = arena->total;
+    pni_arena_release(arena);
+    if (total > arena->initial_size) {
+      if (!pni_arena_block(arena, total)) {
+        arena->start = arena->initial;
+        arena->size = arena->initial_size;
+      }
+    } else {
+      arena->start = arena->initial;
+      arena->size = arena->initial_size;
+    }
+  }
+  arena->used = 0;
+  arena->total = 0;
+  arena->last = NULL;
+}
@@ -0,0 +1,55 @@
+#ifndef _PROTON_ARENA_H
+#define _PROTON_ARENA_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <stddef.h>
+
+// A bump allocator for memory whose lifetime ends all at once. There is
+// no per allocation free: everything is released by pni_arena_reset,
+// after which the arena's blocks are merged into one that holds what
+// was used, so a workload of a steady size stops touching the heap.
+//
+// An arena may start with a block supplied by its owner, such as space
+// allocated alongside the owning object, which it never frees.
+
+typedef struct pni_arena_block_t pni_arena_block_t;
+
+typedef struct {
+  char *initial;
+  size_t initial_size;
+  pni_arena_block_t *blocks;  // heap blocks, newest first
+  char *start;                // the block being allocated from
+  size_t size;
+  size_t used;
+  size_t total;               // bytes allocated since the last reset
+  char *last;                 // the latest allocation, which may grow in place
+} pni_arena_t;
+
+void pni_arena_init(pni_arena_t *arena, void *initial, size_t size);
+void pni_arena_fini(pni_arena_t *arena);
+void *pni_arena_alloc(pni_arena_t *arena, size_t size);
+// grows or shrinks an allocation, in place when it is the latest one
+void *pni_arena_realloc(pni_arena_t *arena, void *ptr, size_t old_size, size_t size);
+void pni_arena_reset(pni_arena_t *arena);
+
+#endif /* arena.h */
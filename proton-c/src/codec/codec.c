@@ -37,7 +37,9 @@
 #include "decoder.h"
 #include "encoder.h"
 #include "data.h"
+#include "format.h"
 #include "../log_private.h"
+#include "alloc_private.h"
 
 const char *pn_type_name(pn_type_t type)
 {
@@ -84,7 +86,12 @@ static inline void pni_atom_init(pn_atom_t *atom, pn_type_t type)
 static void pn_data_finalize(void *object)
 {
   pn_data_t *data = (pn_data_t *) object;
-  free(data->nodes);
+  if (data->in_arena) {
+    pni_arena_fini(&data->arena);
+  } else {
+    pni_free(PN_ALLOC_CODEC, data->nodes);
+  }
+  pni_free(PN_ALLOC_CODEC, data->index.slots);
   pn_buffer_free(data->buf);
   pn_free(data->str);
   pn_error_free(data->error);
@@ -278,7 +285,20 @@ int pni_inspect_enter(void *ctx, pn_data_t *data, pni_node_t *node)
     return pn_string_addf(str, "@");
   case PN_ARRAY:
     // XXX: need to fix for described arrays
-    return pn_string_addf(str, "@%s[", pn_type_name(node->type));
+    err = pn_string_addf(str, "@%s[", pn_type_name(node->type));
+    if (err) return err;
+    if (node->packed) {
+      size_t width = pni_type_width(node->type);
+      const char *values = pni_node_block(data, node);
+      for (size_t i = 0; i < node->data_size / width; i++) {
+        pn_atom_t value;
+        value.type = node->type;
+        memcpy(&value.u, values + i * width, width);
+        if (i) if ((err = pn_string_addf(str, ", "))) return err;
+        if ((err = pni_inspect_atom(&value, str))) return err;
+      }
+    }
+    return 0;
   case PN_LIST:
     return pn_string_addf(str, "[");
   case PN_MAP:
@@ -353,10 +373,14 @@ int pni_inspect_exit(void *ctx, pn_data_t *data, pni_node_t *node)
   return 0;
 }
 
+static int pni_data_expand_all(pn_data_t *data);
+
 static int pn_data_inspect(void *obj, pn_string_t *dst)
 {
   pn_data_t *data = (pn_data_t *) obj;
 
+  int err = pni_data_expand_all(data);
+  if (err) return err;
   return pni_data_traverse(data, pni_inspect_enter, pni_inspect_exit, dst);
 }
 
@@ -364,18 +388,35 @@ static int pn_data_inspect(void *obj, pn_string_t *dst)
 #define pn_data_hashcode NULL
 #define pn_data_compare NULL
 
-pn_data_t *pn_data(size_t capacity)
+// arena instances are sized to their nodes, only the others are pooled
+PN_POOL(pn_data, 256)
+
+static pn_data_t *pni_data(size_t capacity, bool in_arena)
 {
-  static const pn_class_t clazz = PN_CLASS(pn_data);
-  pn_data_t *data = (pn_data_t *) pn_class_new(&clazz, sizeof(pn_data_t));
+  static const pn_class_t clazz = PN_POOLED_CLASS(pn_data);
+  // with slack for aligning the nodes
+  size_t inline_size = in_arena ? capacity * sizeof(pni_node_t) + 2 * sizeof(void *) : 0;
+  pn_data_t *data = (pn_data_t *) pn_class_new(&clazz, sizeof(pn_data_t) + inline_size);
   data->capacity = capacity;
   data->size = 0;
-  data->nodes = capacity ? (pni_node_t *) malloc(capacity * sizeof(pni_node_t)) : NULL;
+  data->in_arena = in_arena;
+  if (in_arena) {
+    pni_arena_init(&data->arena, data + 1, inline_size);
+    size_t size = capacity * sizeof(pni_node_t);
+    data->nodes = size ? (pni_node_t *) pni_arena_alloc(&data->arena, size) : NULL;
+    if (capacity && !data->nodes) data->capacity = 0;
+  } else {
+    pni_arena_init(&data->arena, NULL, 0);
+    data->nodes =
+      capacity ? (pni_node_t *) pni_malloc(PN_ALLOC_CODEC, capacity * sizeof(pni_node_t)) : NULL;
+  }
   data->buf = pn_buffer(64);
   data->parent = 0;
   data->current = 0;
   data->base_parent = 0;
   data->base_current = 0;
+  data->lazy = false;
+  memset(&data->index, 0, sizeof(data->index));
   data->decoder = pn_decoder();
   data->encoder = pn_encoder();
   data->error = pn_error();
@@ -383,6 +424,16 @@ pn_data_t *pn_data(size_t capacity)
   return data;
 }
 
+pn_data_t *pn_data(size_t capacity)
+{
+  return pni_data(capacity, false);
+}
+
+pn_data_t *pni_data_arena(size_t capacity)
+{
+  return pni_data(capacity, true);
+}
+
 void pn_data_free(pn_data_t *data)
 {
   pn_free(data);
@@ -411,14 +462,34 @@ void pn_data_clear(pn_data_t *data)
     data->current = 0;
     data->base_parent = 0;
     data->base_current = 0;
+    data->index.map = 0;
     pn_buffer_clear(data->buf);
+    if (data->in_arena) {
+      // the reset arena has room for as many nodes as were last used
+      pni_arena_reset(&data->arena);
+      size_t size = data->capacity * sizeof(pni_node_t);
+      data->nodes = size ? (pni_node_t *) pni_arena_alloc(&data->arena, size) : NULL;
+      if (!data->nodes) data->capacity = 0;
+    }
   }
 }
 
 int pn_data_grow(pn_data_t *data)
 {
-  data->capacity = 2*(data->capacity ? data->capacity : 2);
-  data->nodes = (pni_node_t *) realloc(data->nodes, data->capacity * sizeof(pni_node_t));
+  size_t capacity = 2*(data->capacity ? (size_t) data->capacity : 2);
+  if (capacity > PNI_NID_MAX) capacity = PNI_NID_MAX;
+  if (capacity <= data->capacity) return PN_OVERFLOW;
+  pni_node_t *nodes;
+  if (data->in_arena) {
+    nodes = (pni_node_t *) pni_arena_realloc(&data->arena, data->nodes,
+                                             data->capacity * sizeof(pni_node_t),
+                                             capacity * sizeof(pni_node_t));
+  } else {
+    nodes = (pni_node_t *) pni_realloc(PN_ALLOC_CODEC, data->nodes, capacity * sizeof(pni_node_t));
+  }
+  if (!nodes) return PN_ERR;
+  data->capacity = capacity;
+  data->nodes = nodes;
   return 0;
 }
 
@@ -447,13 +518,26 @@ void pn_data_rebase(pn_data_t *data, char *base)
 {
   for (unsigned i = 0; i < data->size; i++) {
     pni_node_t *node = &data->nodes[i];
-    if (node->data) {
-      pn_bytes_t *bytes = pn_data_bytes(data, node);
+    pn_bytes_t *bytes = node->data ? pn_data_bytes(data, node) : NULL;
+    if (bytes) {
       bytes->start = base + node->data_offset;
     }
   }
 }
 
+// appends raw bytes to the buffer, returning their offset
+static ssize_t pni_data_store(pn_data_t *data, const char *bytes, size_t size)
+{
+  size_t oldcap = pn_buffer_capacity(data->buf);
+  size_t offset = pn_buffer_size(data->buf);
+  int err = pn_buffer_append(data->buf, bytes, size);
+  if (err) return err;
+  if (pn_buffer_capacity(data->buf) != oldcap) {
+    pn_data_rebase(data, pn_buffer_memory(data->buf).start);
+  }
+  return offset;
+}
+
 int pn_data_intern_node(pn_data_t *data, pni_node_t *node)
 {
   pn_bytes_t *bytes = pn_data_bytes(data, node);
@@ -474,14 +558,116 @@ int pn_data_intern_node(pn_data_t *data, pni_node_t *node)
   return 0;
 }
 
-int pn_data_vfill(pn_data_t *data, const char *fmt, va_list ap)
+// opcodes beyond the single character codes of a format
+#define PNI_OP_END (0x00)
+#define PNI_OP_DESCRIBED_ARRAY (0x80)   // "@?D" when filling
+#define PNI_OP_SYMBOLS (0x81)           // "*s" when filling
+#define PNI_OP_BAD (0x82)               // followed by the unrecognized code
+#define PNI_OP_BAD_STAR (0x83)          // "*" without a recognized code
+#define PNI_OP_BAD_QUESTION (0x84)      // "?" with nothing following it
+
+// Compiles fmt into ops, resolving everything that depends on the
+// neighbouring codes. An invalid code compiles to an opcode that fails
+// when reached, so that the codes before it still take effect as they
+// always have. Needs room for strlen(fmt) + 2 opcodes.
+static bool pni_format_compile(const char *fmt, bool scan, uint8_t *ops, size_t capacity)
+{
+  if (strlen(fmt) + 2 > capacity) return false;
+
+  char code = 0;
+  for (const char *c = fmt; *c; c++) {
+    code = *c;
+    switch (code) {
+    case 'n': case 'o': case 'B': case 'b': case 'H': case 'h':
+    case 'I': case 'i': case 'L': case 'l': case 't': case 'f':
+    case 'd': case 'z': case 'S': case 's': case 'D': case 'C':
+    case '{': case '}': case ']':
+      *(ops++) = code;
+      break;
+    case 'T':
+    case '*':
+      if (scan) goto bad;
+      if (code == 'T') {
+        *(ops++) = code;
+      } else if (c[1] == 's') {
+        *(ops++) = PNI_OP_SYMBOLS;
+        c++;
+      } else {
+        *(ops++) = PNI_OP_BAD_STAR;
+        goto end;
+      }
+      break;
+    case 'c':
+    case '.':
+      if (!scan) goto bad;
+      *(ops++) = code;
+      break;
+    case '@':
+      // a described array has always been spelt with the D as the
+      // second code after the @, skipping the first
+      if (!scan && c[1] && c[2] == 'D') {
+        *(ops++) = PNI_OP_DESCRIBED_ARRAY;
+        c++;
+      } else {
+        *(ops++) = code;
+      }
+      break;
+    case '[':
+      // when filling, the list of an array follows its type
+      if (scan || c == fmt || c[-1] != 'T') {
+        *(ops++) = code;
+      }
+      break;
+    case '?':
+      if (scan && (!c[1] || c[1] == '?')) {
+        *(ops++) = PNI_OP_BAD_QUESTION;
+        goto end;
+      }
+      *(ops++) = code;
+      break;
+    default:
+      goto bad;
+    }
+  }
+  goto end;
+
+ bad:
+  *(ops++) = PNI_OP_BAD;
+  *(ops++) = (uint8_t) code;
+ end:
+  *ops = PNI_OP_END;
+  return true;
+}
+
+// closes any described values and absent (?) values just completed
+static void pni_fill_unwind(pn_data_t *data)
+{
+  pni_node_t *parent = pn_data_node(data, data->parent);
+  while (parent) {
+    if (parent->atom.type == PN_DESCRIBED && parent->children == 2) {
+      pn_data_exit(data);
+      parent = pn_data_node(data, data->parent);
+    } else if (parent->atom.type == PN_NULL && parent->children == 1) {
+      pn_data_exit(data);
+      pni_node_t *current = pn_data_node(data, data->current);
+      current->down = 0;
+      current->children = 0;
+      parent = pn_data_node(data, data->parent);
+    } else {
+      break;
+    }
+  }
+}
+
+static int pni_data_vfill_ops(pn_data_t *data, const uint8_t *ops, va_list ap)
 {
   int err = 0;
-  while (*fmt) {
-    char code = *(fmt++);
-    if (!code) return 0;
+  for (;;) {
+    uint8_t code = *(ops++);
 
     switch (code) {
+    case PNI_OP_END:
+      return 0;
     case 'n':
       err = pn_data_put_null(data);
       break;
@@ -565,24 +751,14 @@ int pn_data_vfill(pn_data_t *data, const char *fmt, va_list ap)
       }
       break;
     case '@':
-      {
-        bool described;
-        if (*(fmt + 1) == 'D') {
-          fmt++;
-          described = true;
-        } else {
-          described = false;
-        }
-        err = pn_data_put_array(data, described, (pn_type_t) 0);
-        pn_data_enter(data);
-      }
+    case PNI_OP_DESCRIBED_ARRAY:
+      err = pn_data_put_array(data, code == PNI_OP_DESCRIBED_ARRAY, (pn_type_t) 0);
+      pn_data_enter(data);
       break;
     case '[':
-      if (*(fmt - 2) != 'T') {
-        err = pn_data_put_list(data);
-        if (err) return err;
-        pn_data_enter(data);
-      }
+      err = pn_data_put_list(data);
+      if (err) return err;
+      pn_data_enter(data);
       break;
     case '{':
       err = pn_data_put_map(data);
@@ -601,32 +777,26 @@ int pn_data_vfill(pn_data_t *data, const char *fmt, va_list ap)
         pn_data_enter(data);
       }
       break;
-    case '*':
+    case PNI_OP_SYMBOLS:
       {
         int count = va_arg(ap, int);
-        void *ptr = va_arg(ap, void *);
-
-        char c = *(fmt++);
-
-        switch (c)
+        char **sptr = va_arg(ap, char **);
+        for (int i = 0; i < count; i++)
         {
-        case 's':
-          {
-            char **sptr = (char **) ptr;
-            for (int i = 0; i < count; i++)
-            {
-              char *sym = *(sptr++);
-              err = pn_data_fill(data, "s", sym);
-              if (err) return err;
-            }
+          char *sym = *(sptr++);
+          if (sym) {
+            err = pn_data_put_symbol(data, pn_bytes(strlen(sym), sym));
+          } else {
+            err = pn_data_put_null(data);
           }
-          break;
-        default:
-          pn_logf("unrecognized * code: 0x%.2X '%c'", code, code);
-          return PN_ARG_ERR;
+          if (err) return err;
+          pni_fill_unwind(data);
         }
       }
       break;
+    case PNI_OP_BAD_STAR:
+      pn_logf("unrecognized * code: 0x%.2X '%c'", '*', '*');
+      return PN_ARG_ERR;
     case 'C':
       {
         pn_data_t *src = va_arg(ap, pn_data_t *);
@@ -640,30 +810,52 @@ int pn_data_vfill(pn_data_t *data, const char *fmt, va_list ap)
       }
       break;
     default:
-      pn_logf("unrecognized fill code: 0x%.2X '%c'", code, code);
-      return PN_ARG_ERR;
+      {
+        char bad = (char) *ops;
+        pn_logf("unrecognized fill code: 0x%.2X '%c'", bad, bad);
+        return PN_ARG_ERR;
+      }
     }
 
     if (err) return err;
 
-    pni_node_t *parent = pn_data_node(data, data->parent);
-    while (parent) {
-      if (parent->atom.type == PN_DESCRIBED && parent->children == 2) {
-        pn_data_exit(data);
-        parent = pn_data_node(data, data->parent);
-      } else if (parent->atom.type == PN_NULL && parent->children == 1) {
-        pn_data_exit(data);
-        pni_node_t *current = pn_data_node(data, data->current);
-        current->down = 0;
-        current->children = 0;
-        parent = pn_data_node(data, data->parent);
-      } else {
-        break;
-      }
-    }
+    pni_fill_unwind(data);
   }
+}
 
-  return 0;
+int pn_data_vfill(pn_data_t *data, const char *fmt, va_list ap)
+{
+  uint8_t local[PNI_FORMAT_MAX];
+  uint8_t *ops = local;
+  size_t capacity = strlen(fmt) + 2;
+  if (capacity > sizeof(local)) {
+    ops = (uint8_t *) pni_malloc(PN_ALLOC_CODEC, capacity);
+    if (!ops) return PN_ERR;
+  }
+  pni_format_compile(fmt, false, ops, capacity);
+  int err = pni_data_vfill_ops(data, ops, ap);
+  if (ops != local) pni_free(PN_ALLOC_CODEC, ops);
+  return err;
+}
+
+int pni_data_vfill_format(pn_data_t *data, pni_format_t *format, va_list ap)
+{
+  if (!format->compiled) {
+    // a format too long to compile in place is compiled on every use
+    if (!pni_format_compile(format->fmt, false, format->ops, PNI_FORMAT_MAX))
+      return pn_data_vfill(data, format->fmt, ap);
+    format->compiled = true;
+  }
+  return pni_data_vfill_ops(data, format->ops, ap);
+}
+
+int pni_data_fill_format(pn_data_t *data, pni_format_t *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  int err = pni_data_vfill_format(data, format, ap);
+  va_end(ap);
+  return err;
 }
 
 
@@ -697,7 +889,7 @@ static bool pn_scan_next(pn_data_t *data, pn_type_t *type, bool suspend)
 
 pni_node_t *pn_data_peek(pn_data_t *data);
 
-int pn_data_vscan(pn_data_t *data, const char *fmt, va_list ap)
+static int pni_data_vscan_ops(pn_data_t *data, const uint8_t *ops, va_list ap)
 {
   pn_data_rewind(data);
   bool *scanarg = NULL;
@@ -706,8 +898,9 @@ int pn_data_vscan(pn_data_t *data, const char *fmt, va_list ap)
   int count_level = -1;
   int resume_count = 0;
 
-  while (*fmt) {
-    char code = *(fmt++);
+  for (;;) {
+    uint8_t code = *(ops++);
+    if (code == PNI_OP_END) return 0;
 
     bool found = false;
     pn_type_t type;
@@ -1027,10 +1220,10 @@ int pn_data_vscan(pn_data_t *data, const char *fmt, va_list ap)
       if (resume_count && level == count_level) resume_count--;
       break;
     case '?':
-      if (!*fmt || *fmt == '?')
-        return pn_error_format(data->error, PN_ARG_ERR, "codes must follow a ?");
       scanarg = va_arg(ap, bool *);
       break;
+    case PNI_OP_BAD_QUESTION:
+      return pn_error_format(data->error, PN_ARG_ERR, "codes must follow a ?");
     case 'C':
       {
         pn_data_t *dst = va_arg(ap, pn_data_t *);
@@ -1054,7 +1247,10 @@ int pn_data_vscan(pn_data_t *data, const char *fmt, va_list ap)
       if (resume_count && level == count_level) resume_count--;
       break;
     default:
-      return pn_error_format(data->error, PN_ARG_ERR, "unrecognized scan code: 0x%.2X '%c'", code, code);
+      {
+        char bad = (char) *ops;
+        return pn_error_format(data->error, PN_ARG_ERR, "unrecognized scan code: 0x%.2X '%c'", bad, bad);
+      }
     }
 
     if (scanarg && code != '?') {
@@ -1062,8 +1258,40 @@ int pn_data_vscan(pn_data_t *data, const char *fmt, va_list ap)
       scanarg = NULL;
     }
   }
+}
 
-  return 0;
+int pn_data_vscan(pn_data_t *data, const char *fmt, va_list ap)
+{
+  uint8_t local[PNI_FORMAT_MAX];
+  uint8_t *ops = local;
+  size_t capacity = strlen(fmt) + 2;
+  if (capacity > sizeof(local)) {
+    ops = (uint8_t *) pni_malloc(PN_ALLOC_CODEC, capacity);
+    if (!ops) return PN_ERR;
+  }
+  pni_format_compile(fmt, true, ops, capacity);
+  int err = pni_data_vscan_ops(data, ops, ap);
+  if (ops != local) pni_free(PN_ALLOC_CODEC, ops);
+  return err;
+}
+
+int pni_data_vscan_format(pn_data_t *data, pni_format_t *format, va_list ap)
+{
+  if (!format->compiled) {
+    if (!pni_format_compile(format->fmt, true, format->ops, PNI_FORMAT_MAX))
+      return pn_data_vscan(data, format->fmt, ap);
+    format->compiled = true;
+  }
+  return pni_data_vscan_ops(data, format->ops, ap);
+}
+
+int pni_data_scan_format(pn_data_t *data, pni_format_t *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  int err = pni_data_vscan_format(data, format, ap);
+  va_end(ap);
+  return err;
 }
 
 int pn_data_scan(pn_data_t *data, const char *fmt, ...)
@@ -1107,6 +1335,7 @@ int pn_data_resize(pn_data_t *data, size_t size)
 {
   if (!data || size > data->capacity) return PN_ARG_ERR;
   data->size = size;
+  data->index.map = 0;
   return 0;
 }
 
@@ -1119,7 +1348,7 @@ size_t pn_data_id(pn_data_t *data, pni_node_t *node)
 pni_node_t *pn_data_new(pn_data_t *data)
 {
   if (data->capacity <= data->size) {
-    pn_data_grow(data);
+    if (pn_data_grow(data)) return NULL;
   }
   pni_node_t *node = pn_data_node(data, ++(data->size));
   node->next = 0;
@@ -1156,7 +1385,7 @@ pn_handle_t pn_data_point(pn_data_t *data)
   if (data->current) {
     return data->current;
   } else {
-    return -data->parent;
+    return (pn_handle_t) -((pn_shandle_t) data->parent);
   }
 }
 
@@ -1297,9 +1526,150 @@ size_t pn_data_siblings(pn_data_t *data)
   }
 }
 
+pni_node_t *pn_data_add(pn_data_t *data);
+
+void pn_data_set_lazy(pn_data_t *data, bool lazy)
+{
+  data->lazy = lazy;
+}
+
+bool pni_data_is_lazy(pn_data_t *data)
+{
+  return data->lazy;
+}
+
+int pni_data_put_lazy(pn_data_t *data, pn_type_t type, size_t count,
+                      const char *bytes, size_t size)
+{
+  pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
+  node->atom.type = type;
+
+  // elements of a lazy node that is being expanded already live in
+  // our buffer and can be referred to where they are, so long as they
+  // lie within it
+  pn_buffer_memory_t mem = pn_buffer_memory(data->buf);
+  ssize_t offset;
+  if (mem.start && bytes >= mem.start && bytes < mem.start + pn_buffer_capacity(data->buf)) {
+    if (size > pn_buffer_size(data->buf) - (size_t) (bytes - mem.start)) return PN_ARG_ERR;
+    offset = bytes - mem.start;
+  } else {
+    offset = pni_data_store(data, bytes, size);
+    if (offset < 0) return offset;
+  }
+  node->lazy = true;
+  node->children = count;
+  node->data_offset = offset;
+  node->data_size = size;
+  return 0;
+}
+
+// decodes the elements of a lazy list or map into child nodes.  If they
+// do not decode the node is left as it was, and marked so that it is
+// neither entered nor encoded
+static int pni_data_expand(pn_data_t *data, pni_nid_t id)
+{
+  pni_node_t *node = pn_data_node(data, id);
+  if (node->invalid) {
+    return pn_error_format(data->error, PN_ARG_ERR, "malformed %s", pn_type_name(node->atom.type));
+  }
+  size_t offset = node->data_offset;
+  size_t size = node->data_size;
+  size_t count = node->children;
+  pni_nid_t nodes = data->size;
+  size_t used = pn_buffer_size(data->buf);
+  node->lazy = false;
+  node->children = 0;
+  node->data_offset = 0;
+  node->data_size = 0;
+
+  // decoding never interns more bytes than it reads, so reserving
+  // that much up front keeps the encoded elements from moving
+  size_t oldcap = pn_buffer_capacity(data->buf);
+  int err = pn_buffer_ensure(data->buf, size);
+  if (err) return err;
+  if (pn_buffer_capacity(data->buf) != oldcap) {
+    pn_data_rebase(data, pn_buffer_memory(data->buf).start);
+  }
+  const char *bytes = pn_buffer_memory(data->buf).start + offset;
+
+  pni_nid_t parent = data->parent;
+  pni_nid_t current = data->current;
+  data->parent = id;
+  data->current = 0;
+  err = pn_decoder_decode_elements(data->decoder, bytes, size, data, count);
+  data->parent = parent;
+  data->current = current;
+  if (err) {
+    // the children decoded so far were added last, drop them again
+    data->size = nodes;
+    data->index.map = 0;
+    pn_buffer_trim(data->buf, 0, pn_buffer_size(data->buf) - used);
+    node = pn_data_node(data, id);
+    node->down = 0;
+    node->lazy = true;
+    node->invalid = true;
+    node->children = count;
+    node->data_offset = offset;
+    node->data_size = size;
+    return pn_error_format(data->error, err, "malformed %s", pn_type_name(node->atom.type));
+  }
+  return 0;
+}
+
+static int pni_data_expand_all(pn_data_t *data)
+{
+  for (pni_nid_t i = 1; i <= data->size; i++) {
+    if (pn_data_node(data, i)->lazy) {
+      int err = pni_data_expand(data, i);
+      if (err) return err;
+    }
+  }
+  return 0;
+}
+
+// expands a packed array into one child node per element so that it
+// may be navigated and modified like any other array
+static int pni_data_unpack(pn_data_t *data, pni_nid_t id)
+{
+  pni_node_t *node = pn_data_node(data, id);
+  pn_type_t type = node->type;
+  size_t width = pni_type_width(type);
+  size_t offset = node->data_offset;
+  size_t count = node->data_size / width;
+  node->packed = false;
+  node->data_offset = 0;
+  node->data_size = 0;
+
+  pni_nid_t parent = data->parent;
+  pni_nid_t current = data->current;
+  data->parent = id;
+  data->current = 0;
+  for (size_t i = 0; i < count; i++) {
+    pni_node_t *child = pn_data_add(data);
+    if (child == NULL) {
+      data->parent = parent;
+      data->current = current;
+      return PN_OVERFLOW;
+    }
+    child->atom.type = type;
+    memcpy(&child->atom.u, pn_buffer_memory(data->buf).start + offset + i * width, width);
+  }
+  data->parent = parent;
+  data->current = current;
+  return 0;
+}
+
 bool pn_data_enter(pn_data_t *data)
 {
   if (data->current) {
+    pni_node_t *node = pn_data_current(data);
+    // either one may move the nodes, leaving node behind
+    if (node->packed) {
+      if (pni_data_unpack(data, data->current)) return false;
+    } else if (node->lazy) {
+      if (pni_data_expand(data, data->current)) return false;
+    }
     data->parent = data->current;
     data->current = 0;
     return true;
@@ -1320,23 +1690,117 @@ bool pn_data_exit(pn_data_t *data)
   }
 }
 
-bool pn_data_lookup(pn_data_t *data, const char *name)
+// maps with fewer keys are scanned rather than indexed
+#define PNI_INDEX_MIN_KEYS (16)
+
+static uint32_t pni_key_hash(const char *start, size_t size)
 {
-  while (pn_data_next(data)) {
-    pn_type_t type = pn_data_type(data);
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (uint8_t) start[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
 
-    switch (type) {
-    case PN_STRING:
-    case PN_SYMBOL:
-      {
-        pn_bytes_t bytes = pn_data_get_bytes(data);
-        if (strlen(name) == bytes.size && !strncmp(name, bytes.start, bytes.size)) {
-          return pn_data_next(data);
-        }
+static inline bool pni_key_equals(pni_node_t *node, const char *name, size_t size)
+{
+  if (node->atom.type != PN_STRING && node->atom.type != PN_SYMBOL) return false;
+  pn_bytes_t bytes = node->atom.u.as_bytes;
+  return bytes.size == size && !memcmp(bytes.start, name, size);
+}
+
+static bool pni_index_build(pn_data_t *data, pni_nid_t map)
+{
+  pni_data_index_t *index = &data->index;
+  size_t keys = (pn_data_node(data, map)->children + 1) / 2;
+  size_t capacity = 4 * PNI_INDEX_MIN_KEYS;
+  while (capacity < 2 * keys) capacity *= 2;
+  if (capacity > index->capacity) {
+    pni_nid_t *slots = (pni_nid_t *) pni_realloc(PN_ALLOC_CODEC, index->slots,
+                                                  capacity * sizeof(pni_nid_t));
+    if (!slots) return false;
+    index->slots = slots;
+    index->capacity = capacity;
+  }
+  memset(index->slots, 0, capacity * sizeof(pni_nid_t));
+  size_t mask = capacity - 1;
+
+  pni_nid_t last = 0;
+  for (pni_nid_t key = pn_data_node(data, map)->down; key; ) {
+    pni_node_t *node = pn_data_node(data, key);
+    last = key;
+    if (node->atom.type == PN_STRING || node->atom.type == PN_SYMBOL) {
+      pn_bytes_t bytes = node->atom.u.as_bytes;
+      size_t slot = pni_key_hash(bytes.start, bytes.size) & mask;
+      // the first of any duplicate keys is the one a scan finds
+      while (index->slots[slot] &&
+             !pni_key_equals(pn_data_node(data, index->slots[slot]), bytes.start, bytes.size)) {
+        slot = (slot + 1) & mask;
       }
-      break;
-    default:
-      break;
+      if (!index->slots[slot]) index->slots[slot] = key;
+    }
+    if (node->next) last = node->next;
+    key = node->next ? pn_data_node(data, node->next)->next : 0;
+  }
+  index->last = last;
+  index->built = true;
+  return true;
+}
+
+// the index for the map being looked up in from its start, if it is
+// worth having, building it on the second lookup
+static pni_data_index_t *pni_data_index(pn_data_t *data, bool now)
+{
+  if (data->current || !data->parent) return NULL;
+  pni_node_t *parent = pn_data_node(data, data->parent);
+  if (parent->atom.type != PN_MAP || parent->children < 2 * PNI_INDEX_MIN_KEYS) return NULL;
+  pni_data_index_t *index = &data->index;
+  if (index->map != data->parent) {
+    index->map = data->parent;
+    index->built = false;
+  } else if (!index->built) {
+    now = true;
+  }
+  if (!index->built && now && !pni_index_build(data, data->parent)) {
+    index->map = 0;
+    return NULL;
+  }
+  return index->built ? index : NULL;
+}
+
+static pni_nid_t pni_index_find(pn_data_t *data, pni_data_index_t *index,
+                                const char *name, size_t size)
+{
+  size_t mask = index->capacity - 1;
+  size_t slot = pni_key_hash(name, size) & mask;
+  while (index->slots[slot]) {
+    if (pni_key_equals(pn_data_node(data, index->slots[slot]), name, size)) {
+      return index->slots[slot];
+    }
+    slot = (slot + 1) & mask;
+  }
+  return 0;
+}
+
+bool pn_data_lookup(pn_data_t *data, const char *name)
+{
+  size_t size = strlen(name);
+  pni_data_index_t *index = pni_data_index(data, false);
+  if (index) {
+    pni_nid_t key = pni_index_find(data, index, name, size);
+    if (key) {
+      data->current = key;
+      return pn_data_next(data);
+    }
+    data->current = index->last;
+    return false;
+  }
+
+  while (pn_data_next(data)) {
+    if (pni_key_equals(pn_data_current(data), name, size)) {
+      return pn_data_next(data);
     }
 
     // skip the value
@@ -1346,6 +1810,52 @@ bool pn_data_lookup(pn_data_t *data, const char *name)
   return false;
 }
 
+// the names compared in one pass of a scan
+#define PNI_LOOKUP_BATCH (16)
+
+size_t pn_data_lookup_keys(pn_data_t *data, const char **names, size_t count,
+                           pn_handle_t *values)
+{
+  pni_nid_t parent = data->parent;
+  pni_nid_t current = data->current;
+  size_t found = 0;
+  for (size_t i = 0; i < count; i++) values[i] = 0;
+
+  pni_data_index_t *index = count > 1 ? pni_data_index(data, true) : NULL;
+  if (index) {
+    for (size_t i = 0; i < count; i++) {
+      pni_nid_t key = pni_index_find(data, index, names[i], strlen(names[i]));
+      pni_nid_t value = key ? pn_data_node(data, key)->next : 0;
+      if (value) {
+        values[i] = value;
+        found++;
+      }
+    }
+    return found;
+  }
+
+  for (size_t start = 0; start < count; start += PNI_LOOKUP_BATCH) {
+    size_t batch = count - start < PNI_LOOKUP_BATCH ? count - start : PNI_LOOKUP_BATCH;
+    size_t sizes[PNI_LOOKUP_BATCH];
+    for (size_t i = 0; i < batch; i++) sizes[i] = strlen(names[start + i]);
+    size_t left = batch;
+    while (left && pn_data_next(data)) {
+      pni_node_t *key = pn_data_current(data);
+      if (!pn_data_next(data)) break;
+      for (size_t i = 0; i < batch; i++) {
+        if (!values[start + i] && pni_key_equals(key, names[start + i], sizes[i])) {
+          values[start + i] = data->current;
+          left--;
+        }
+      }
+    }
+    found += batch - left;
+    data->parent = parent;
+    data->current = current;
+  }
+  return found;
+}
+
 void pn_data_dump(pn_data_t *data)
 {
   printf("{current=%" PN_ZI ", parent=%" PN_ZI "}\n", (size_t) data->current, (size_t) data->parent);
@@ -1376,6 +1886,7 @@ pni_node_t *pn_data_add(pn_data_t *data)
       node = pn_data_node(data, current->next);
     } else {
       node = pn_data_new(data);
+      if (!node) return NULL;
       // refresh the pointers in case we grew
       current = pn_data_current(data);
       parent = pn_data_node(data, data->parent);
@@ -1394,6 +1905,7 @@ pni_node_t *pn_data_add(pn_data_t *data)
       node = pn_data_node(data, parent->down);
     } else {
       node = pn_data_new(data);
+      if (!node) return NULL;
       // refresh the pointers in case we grew
       parent = pn_data_node(data, data->parent);
       node->prev = 0;
@@ -1405,6 +1917,7 @@ pni_node_t *pn_data_add(pn_data_t *data)
     node = pn_data_node(data, 1);
   } else {
     node = pn_data_new(data);
+    if (!node) return NULL;
     node->prev = 0;
     node->parent = 0;
   }
@@ -1412,9 +1925,14 @@ pni_node_t *pn_data_add(pn_data_t *data)
   node->down = 0;
   node->children = 0;
   node->data = false;
+  node->packed = false;
+  node->lazy = false;
+  node->invalid = false;
   node->data_offset = 0;
   node->data_size = 0;
   data->current = pn_data_id(data, node);
+  // any change to the tree may change the indexed map
+  data->index.map = 0;
   return node;
 }
 
@@ -1436,6 +1954,7 @@ ssize_t pn_data_decode(pn_data_t *data, const char *bytes, size_t size)
 int pn_data_put_list(pn_data_t *data)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_LIST;
   return 0;
 }
@@ -1443,6 +1962,7 @@ int pn_data_put_list(pn_data_t *data)
 int pn_data_put_map(pn_data_t *data)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_MAP;
   return 0;
 }
@@ -1450,12 +1970,97 @@ int pn_data_put_map(pn_data_t *data)
 int pn_data_put_array(pn_data_t *data, bool described, pn_type_t type)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_ARRAY;
   node->described = described;
   node->type = type;
   return 0;
 }
 
+size_t pni_type_width(pn_type_t type)
+{
+  switch (type) {
+  case PN_UBYTE:
+  case PN_BYTE:
+    return 1;
+  case PN_USHORT:
+  case PN_SHORT:
+    return 2;
+  case PN_UINT:
+  case PN_INT:
+  case PN_CHAR:
+  case PN_FLOAT:
+  case PN_DECIMAL32:
+    return 4;
+  case PN_ULONG:
+  case PN_LONG:
+  case PN_TIMESTAMP:
+  case PN_DOUBLE:
+  case PN_DECIMAL64:
+    return 8;
+  case PN_DECIMAL128:
+  case PN_UUID:
+    return 16;
+  default:
+    return 0;
+  }
+}
+
+int pni_data_put_packed(pn_data_t *data, pn_type_t type, const char *values,
+                        size_t count, char **stored)
+{
+  size_t width = pni_type_width(type);
+  if (!width) return PN_ARG_ERR;
+  if (count > (SIZE_MAX / width)) return PN_OVERFLOW;
+  pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
+  node->atom.type = PN_ARRAY;
+  node->described = false;
+  node->type = type;
+
+  ssize_t offset = pni_data_store(data, values, count * width);
+  if (offset < 0) return offset;
+  node->packed = true;
+  node->data_offset = offset;
+  node->data_size = count * width;
+  if (stored) *stored = pni_node_block(data, node);
+  return 0;
+}
+
+int pn_data_put_array_values(pn_data_t *data, pn_type_t type, const void *values, size_t count)
+{
+  return pni_data_put_packed(data, type, (const char *) values, count, NULL);
+}
+
+ssize_t pn_data_get_array_values(pn_data_t *data, pn_type_t type, void *values, size_t count)
+{
+  pni_node_t *node = pn_data_current(data);
+  size_t width = pni_type_width(type);
+  if (!node || node->atom.type != PN_ARRAY || node->type != type || !width) {
+    return PN_ARG_ERR;
+  }
+
+  char *dst = (char *) values;
+  if (node->packed) {
+    size_t n = node->data_size / width;
+    if (n > count) n = count;
+    memcpy(dst, pni_node_block(data, node), n * width);
+    return n;
+  }
+
+  size_t n = 0;
+  pni_node_t *child = pn_data_node(data, node->down);
+  if (child && node->described) {
+    child = pn_data_node(data, child->next);
+  }
+  for (; child && n < count; child = pn_data_node(data, child->next)) {
+    if (child->atom.type != type) return PN_ARG_ERR;
+    memcpy(dst + n * width, &child->atom.u, width);
+    n++;
+  }
+  return n;
+}
+
 void pni_data_set_array_type(pn_data_t *data, pn_type_t type)
 {
   pni_node_t *array = pn_data_current(data);
@@ -1465,6 +2070,7 @@ void pni_data_set_array_type(pn_data_t *data, pn_type_t type)
 int pn_data_put_described(pn_data_t *data)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_DESCRIBED;
   return 0;
 }
@@ -1472,6 +2078,7 @@ int pn_data_put_described(pn_data_t *data)
 int pn_data_put_null(pn_data_t *data)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   pni_atom_init(&node->atom, PN_NULL);
   return 0;
 }
@@ -1479,6 +2086,7 @@ int pn_data_put_null(pn_data_t *data)
 int pn_data_put_bool(pn_data_t *data, bool b)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_BOOL;
   node->atom.u.as_bool = b;
   return 0;
@@ -1487,6 +2095,7 @@ int pn_data_put_bool(pn_data_t *data, bool b)
 int pn_data_put_ubyte(pn_data_t *data, uint8_t ub)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_UBYTE;
   node->atom.u.as_ubyte = ub;
   return 0;
@@ -1495,6 +2104,7 @@ int pn_data_put_ubyte(pn_data_t *data, uint8_t ub)
 int pn_data_put_byte(pn_data_t *data, int8_t b)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_BYTE;
   node->atom.u.as_byte = b;
   return 0;
@@ -1503,6 +2113,7 @@ int pn_data_put_byte(pn_data_t *data, int8_t b)
 int pn_data_put_ushort(pn_data_t *data, uint16_t us)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_USHORT;
   node->atom.u.as_ushort = us;
   return 0;
@@ -1511,6 +2122,7 @@ int pn_data_put_ushort(pn_data_t *data, uint16_t us)
 int pn_data_put_short(pn_data_t *data, int16_t s)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_SHORT;
   node->atom.u.as_short = s;
   return 0;
@@ -1519,6 +2131,7 @@ int pn_data_put_short(pn_data_t *data, int16_t s)
 int pn_data_put_uint(pn_data_t *data, uint32_t ui)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_UINT;
   node->atom.u.as_uint = ui;
   return 0;
@@ -1527,6 +2140,7 @@ int pn_data_put_uint(pn_data_t *data, uint32_t ui)
 int pn_data_put_int(pn_data_t *data, int32_t i)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_INT;
   node->atom.u.as_int = i;
   return 0;
@@ -1535,6 +2149,7 @@ int pn_data_put_int(pn_data_t *data, int32_t i)
 int pn_data_put_char(pn_data_t *data, pn_char_t c)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_CHAR;
   node->atom.u.as_char = c;
   return 0;
@@ -1543,6 +2158,7 @@ int pn_data_put_char(pn_data_t *data, pn_char_t c)
 int pn_data_put_ulong(pn_data_t *data, uint64_t ul)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_ULONG;
   node->atom.u.as_ulong = ul;
   return 0;
@@ -1551,6 +2167,7 @@ int pn_data_put_ulong(pn_data_t *data, uint64_t ul)
 int pn_data_put_long(pn_data_t *data, int64_t l)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_LONG;
   node->atom.u.as_long = l;
   return 0;
@@ -1559,6 +2176,7 @@ int pn_data_put_long(pn_data_t *data, int64_t l)
 int pn_data_put_timestamp(pn_data_t *data, pn_timestamp_t t)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_TIMESTAMP;
   node->atom.u.as_timestamp = t;
   return 0;
@@ -1567,6 +2185,7 @@ int pn_data_put_timestamp(pn_data_t *data, pn_timestamp_t t)
 int pn_data_put_float(pn_data_t *data, float f)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_FLOAT;
   node->atom.u.as_float = f;
   return 0;
@@ -1575,6 +2194,7 @@ int pn_data_put_float(pn_data_t *data, float f)
 int pn_data_put_double(pn_data_t *data, double d)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_DOUBLE;
   node->atom.u.as_double = d;
   return 0;
@@ -1583,6 +2203,7 @@ int pn_data_put_double(pn_data_t *data, double d)
 int pn_data_put_decimal32(pn_data_t *data, pn_decimal32_t d)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_DECIMAL32;
   node->atom.u.as_decimal32 = d;
   return 0;
@@ -1591,6 +2212,7 @@ int pn_data_put_decimal32(pn_data_t *data, pn_decimal32_t d)
 int pn_data_put_decimal64(pn_data_t *data, pn_decimal64_t d)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_DECIMAL64;
   node->atom.u.as_decimal64 = d;
   return 0;
@@ -1599,6 +2221,7 @@ int pn_data_put_decimal64(pn_data_t *data, pn_decimal64_t d)
 int pn_data_put_decimal128(pn_data_t *data, pn_decimal128_t d)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_DECIMAL128;
   memmove(node->atom.u.as_decimal128.bytes, d.bytes, 16);
   return 0;
@@ -1607,6 +2230,7 @@ int pn_data_put_decimal128(pn_data_t *data, pn_decimal128_t d)
 int pn_data_put_uuid(pn_data_t *data, pn_uuid_t u)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_UUID;
   memmove(node->atom.u.as_uuid.bytes, u.bytes, 16);
   return 0;
@@ -1615,6 +2239,7 @@ int pn_data_put_uuid(pn_data_t *data, pn_uuid_t u)
 int pn_data_put_binary(pn_data_t *data, pn_bytes_t bytes)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_BINARY;
   node->atom.u.as_bytes = bytes;
   return pn_data_intern_node(data, node);
@@ -1623,6 +2248,7 @@ int pn_data_put_binary(pn_data_t *data, pn_bytes_t bytes)
 int pn_data_put_string(pn_data_t *data, pn_bytes_t string)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_STRING;
   node->atom.u.as_bytes = string;
   return pn_data_intern_node(data, node);
@@ -1631,6 +2257,7 @@ int pn_data_put_string(pn_data_t *data, pn_bytes_t string)
 int pn_data_put_symbol(pn_data_t *data, pn_bytes_t symbol)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom.type = PN_SYMBOL;
   node->atom.u.as_bytes = symbol;
   return pn_data_intern_node(data, node);
@@ -1639,6 +2266,7 @@ int pn_data_put_symbol(pn_data_t *data, pn_bytes_t symbol)
 int pn_data_put_atom(pn_data_t *data, pn_atom_t atom)
 {
   pni_node_t *node = pn_data_add(data);
+  if (node == NULL) return PN_OVERFLOW;
   node->atom = atom;
   return pn_data_intern_node(data, node);
 }
@@ -1667,7 +2295,9 @@ size_t pn_data_get_array(pn_data_t *data)
 {
   pni_node_t *node = pn_data_current(data);
   if (node && node->atom.type == PN_ARRAY) {
-    if (node->described) {
+    if (node->packed) {
+      return node->data_size / pni_type_width(node->type);
+    } else if (node->described) {
       return node->children - 1;
     } else {
       return node->children;
@@ -1980,6 +2610,17 @@ int pn_data_appendn(pn_data_t *data, pn_data_t *src, int limit)
       break;
 
     pn_type_t type = pn_data_type(src);
+    pni_node_t *node = pn_data_current(src);
+    if (node->lazy) {
+      // lists and maps that were never entered are copied still encoded
+      err = node->invalid
+        ? pn_error_format(data->error, PN_ARG_ERR, "malformed %s", pn_type_name(type))
+        : pni_data_put_lazy(data, type, node->children,
+                            pni_node_block(src, node), node->data_size);
+      if (level == 0) count++;
+      if (err) { pn_data_restore(src, point); return err; }
+      continue;
+    }
     switch (type) {
     case PN_NULL:
       err = pn_data_put_null(data);
@@ -2074,6 +2715,15 @@ int pn_data_appendn(pn_data_t *data, pn_data_t *src, int limit)
       level++;
       break;
     case PN_ARRAY:
+      if (pn_data_current(src)->packed) {
+        pni_node_t *array = pn_data_current(src);
+        pn_type_t atype = array->type;
+        size_t width = pni_type_width(atype);
+        err = pni_data_put_packed(data, atype, pni_node_block(src, array),
+                                  array->data_size / width, NULL);
+        if (level == 0) count++;
+        break;
+      }
       err = pn_data_put_array(data, pn_data_is_array_described(src),
                               pn_data_get_array_type(src));
       if (level == 0) count++;
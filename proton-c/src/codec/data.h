@@ -23,10 +23,12 @@
  */
 
 #include "buffer.h"
+#include "arena.h"
 #include "decoder.h"
 #include "encoder.h"
 
-typedef uint16_t pni_nid_t;
+typedef uint32_t pni_nid_t;
+#define PNI_NID_MAX (UINT32_MAX)
 
 typedef struct {
   char *start;
@@ -43,8 +45,23 @@ typedef struct {
   bool described;
   bool data;
   bool small;
+  bool packed;
+  // for lists and maps still in encoded form, and those whose elements
+  // turned out not to decode
+  bool lazy;
+  bool invalid;
 } pni_node_t;
 
+// a hash of the string and symbol keys of one map, built once the map
+// is looked up in more than once
+typedef struct {
+  pni_nid_t *slots;    // key nids, 0 where empty
+  size_t capacity;     // a power of two
+  pni_nid_t map;       // the map last looked up in, 0 for none
+  pni_nid_t last;      // its last child, where a miss leaves off
+  bool built;
+} pni_data_index_t;
+
 struct pn_data_t {
   pni_node_t *nodes;
   pn_buffer_t *buf;
@@ -58,6 +75,11 @@ struct pn_data_t {
   pni_nid_t current;
   pni_nid_t base_parent;
   pni_nid_t base_current;
+  bool lazy;
+  pni_data_index_t index;
+  // nodes come from the arena rather than the heap when set
+  bool in_arena;
+  pni_arena_t arena;
 };
 
 static inline pni_node_t * pn_data_node(pn_data_t *data, pni_nid_t nd) 
@@ -65,6 +87,24 @@ static inline pni_node_t * pn_data_node(pn_data_t *data, pni_nid_t nd)
   return nd ? (data->nodes + nd - 1) : NULL;
 }
 
+// the out of line contents of a packed array or lazy list or map
+static inline char *pni_node_block(pn_data_t *data, pni_node_t *node)
+{
+  return pn_buffer_memory(data->buf).start + node->data_offset;
+}
+
+// Creates a pn_data_t whose nodes are allocated from an arena that
+// starts out inside the pn_data_t itself, with room for capacity nodes,
+// and is reset by pn_data_clear. Suited to the trees that are refilled
+// for every frame or message.
+pn_data_t *pni_data_arena(size_t capacity);
+
+size_t pni_type_width(pn_type_t type);
+int pni_data_put_packed(pn_data_t *data, pn_type_t type, const char *values,
+                        size_t count, char **stored);
+int pni_data_put_lazy(pn_data_t *data, pn_type_t type, size_t count,
+                      const char *bytes, size_t size);
+
 int pni_data_traverse(pn_data_t *data,
                       int (*enter)(void *ctx, pn_data_t *data, pni_node_t *node),
                       int (*exit)(void *ctx, pn_data_t *data, pni_node_t *node),
@@ -24,6 +24,7 @@
 #include <proton/codec.h>
 #include "encodings.h"
 #include "decoder.h"
+#include "swap.h"
 
 #include <string.h>
 
@@ -52,9 +53,11 @@ static void pn_decoder_finalize(void *obj) {
 #define pn_decoder_compare NULL
 #define pn_decoder_inspect NULL
 
+PN_POOL(pn_decoder, 256)
+
 pn_decoder_t *pn_decoder()
 {
-  static const pn_class_t clazz = PN_CLASS(pn_decoder);
+  static const pn_class_t clazz = PN_POOLED_CLASS(pn_decoder);
   return (pn_decoder_t *) pn_class_new(&clazz, sizeof(pn_decoder_t));
 }
 
@@ -192,6 +195,39 @@ static inline pn_type_t pn_code2type(uint8_t code)
 int pn_decoder_decode_type(pn_decoder_t *decoder, pn_data_t *data, uint8_t *code);
 int pn_decoder_single(pn_decoder_t *decoder, pn_data_t *data);
 void pni_data_set_array_type(pn_data_t *data, pn_type_t type);
+size_t pni_type_width(pn_type_t type);
+int pni_data_put_packed(pn_data_t *data, pn_type_t type, const char *values,
+                        size_t count, char **stored);
+bool pni_data_is_lazy(pn_data_t *data);
+int pni_data_put_lazy(pn_data_t *data, pn_type_t type, size_t count,
+                      const char *bytes, size_t size);
+
+// the array element constructors whose encoded width is the width of
+// the host value, suitable for storing as a packed array
+static size_t pni_packed_width(uint8_t code)
+{
+  switch (code) {
+  case PNE_UBYTE:
+  case PNE_BYTE:
+  case PNE_USHORT:
+  case PNE_SHORT:
+  case PNE_UINT:
+  case PNE_INT:
+  case PNE_UTF32:
+  case PNE_FLOAT:
+  case PNE_DECIMAL32:
+  case PNE_ULONG:
+  case PNE_LONG:
+  case PNE_MS64:
+  case PNE_DOUBLE:
+  case PNE_DECIMAL64:
+  case PNE_DECIMAL128:
+  case PNE_UUID:
+    return pni_type_width(pn_code2type(code));
+  default:
+    return 0;
+  }
+}
 
 int pn_decoder_decode_value(pn_decoder_t *decoder, pn_data_t *data, uint8_t code)
 {
@@ -373,6 +409,7 @@ int pn_decoder_decode_value(pn_decoder_t *decoder, pn_data_t *data, uint8_t code
     case PNE_ARRAY32:
     case PNE_LIST32:
     case PNE_MAP32:
+      if (pn_decoder_remaining(decoder) < 8) return PN_UNDERFLOW;
       size = pn_decoder_readf32(decoder);
       count = pn_decoder_readf32(decoder);
       break;
@@ -380,12 +417,42 @@ int pn_decoder_decode_value(pn_decoder_t *decoder, pn_data_t *data, uint8_t code
       return PN_ARG_ERR;
     }
 
+    // every list or map element takes at least a byte
+    if (code != PNE_ARRAY8 && code != PNE_ARRAY32 && count > pn_decoder_remaining(decoder))
+      return PN_UNDERFLOW;
+
+    if (count && code != PNE_ARRAY8 && code != PNE_ARRAY32 && pni_data_is_lazy(data)) {
+      // keep the elements encoded until the list or map is entered
+      size_t header = (code == PNE_LIST8 || code == PNE_MAP8) ? 1 : 4;
+      if (size < header) return PN_ARG_ERR;
+      size -= header;
+      if (pn_decoder_remaining(decoder) < size) return PN_UNDERFLOW;
+      pn_type_t type = (code == PNE_LIST8 || code == PNE_LIST32) ? PN_LIST : PN_MAP;
+      err = pni_data_put_lazy(data, type, count, decoder->position, size);
+      if (err) return err;
+      decoder->position += size;
+      return 0;
+    }
+
     switch (code)
     {
     case PNE_ARRAY8:
     case PNE_ARRAY32:
       {
+        if (pn_decoder_remaining(decoder) < 1) return PN_UNDERFLOW;
         uint8_t next = *decoder->position;
+        size_t width = pni_packed_width(next);
+        if (width) {
+          // fixed width elements are stored as one block
+          decoder->position++;
+          if (count > pn_decoder_remaining(decoder) / width) return PN_UNDERFLOW;
+          char *values;
+          err = pni_data_put_packed(data, pn_code2type(next), decoder->position, count, &values);
+          if (err) return err;
+          pni_swap_copy(values, values, width, count);
+          decoder->position += width * count;
+          return 0;
+        }
         bool described = (next == PNE_DESCRIPTOR);
         err = pn_data_put_array(data, described, (pn_type_t) 0);
         if (err) return err;
@@ -396,6 +463,10 @@ int pn_decoder_decode_value(pn_decoder_t *decoder, pn_data_t *data, uint8_t code
         if (e) return e;
         pn_type_t type = pn_code2type(acode);
         if ((int)type < 0) return (int)type;
+        // only zero width elements can outnumber the bytes left, and
+        // those are held to the size of the whole input
+        if ((acode & 0xf0) == 0x40 ? count > decoder->size : count > pn_decoder_remaining(decoder))
+          return PN_UNDERFLOW;
         for (size_t i = 0; i < count; i++)
         {
           e = pn_decoder_decode_value(decoder, data, acode);
@@ -492,3 +563,62 @@ ssize_t pn_decoder_decode(pn_decoder_t *decoder, const char *src, size_t size, p
 
   return decoder->position - decoder->input;
 }
+
+// returns the encoded size of the value at src without decoding it
+ssize_t pn_decoder_skip(const char *src, size_t size)
+{
+  if (!size) return PN_UNDERFLOW;
+  uint8_t code = src[0];
+  if (code == PNE_DESCRIPTOR) {
+    ssize_t descriptor = pn_decoder_skip(src + 1, size - 1);
+    if (descriptor < 0) return descriptor;
+    ssize_t value = pn_decoder_skip(src + 1 + descriptor, size - 1 - descriptor);
+    if (value < 0) return value;
+    return 1 + descriptor + value;
+  }
+
+  size_t width;
+  switch (code & 0xF0) {
+  case 0x40: width = 0; break;
+  case 0x50: width = 1; break;
+  case 0x60: width = 2; break;
+  case 0x70: width = 4; break;
+  case 0x80: width = 8; break;
+  case 0x90: width = 16; break;
+  case 0xA0:
+  case 0xC0:
+  case 0xE0:
+    // one byte size prefix
+    if (size < 2) return PN_UNDERFLOW;
+    width = 1 + (uint8_t) src[1];
+    break;
+  case 0xB0:
+  case 0xD0:
+  case 0xF0:
+    // four byte size prefix
+    if (size < 5) return PN_UNDERFLOW;
+    width = 4 + ((uint32_t) (uint8_t) src[1] << 24 | (uint32_t) (uint8_t) src[2] << 16 |
+                 (uint32_t) (uint8_t) src[3] << 8 | (uint32_t) (uint8_t) src[4]);
+    break;
+  default:
+    return PN_ARG_ERR;
+  }
+
+  if (size - 1 < width) return PN_UNDERFLOW;
+  return 1 + width;
+}
+
+int pn_decoder_decode_elements(pn_decoder_t *decoder, const char *src, size_t size,
+                               pn_data_t *dst, size_t count)
+{
+  decoder->input = src;
+  decoder->size = size;
+  decoder->position = src;
+
+  for (size_t i = 0; i < count; i++) {
+    int err = pn_decoder_single(decoder, dst);
+    if (err) return err;
+  }
+
+  return 0;
+}
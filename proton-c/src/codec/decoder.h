@@ -26,5 +26,8 @@ typedef struct pn_decoder_t pn_decoder_t;
 
 pn_decoder_t *pn_decoder(void);
 ssize_t pn_decoder_decode(pn_decoder_t *decoder, const char *src, size_t size, pn_data_t *dst);
+int pn_decoder_decode_elements(pn_decoder_t *decoder, const char *src, size_t size,
+                               pn_data_t *dst, size_t count);
+ssize_t pn_decoder_skip(const char *src, size_t size);
 
 #endif /* decoder.h */
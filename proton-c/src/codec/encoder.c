@@ -24,6 +24,7 @@
 #include <proton/codec.h>
 #include "encodings.h"
 #include "encoder.h"
+#include "swap.h"
 
 #include <string.h>
 
@@ -54,9 +55,11 @@ static void pn_encoder_finalize(void *obj) {
 #define pn_encoder_compare NULL
 #define pn_encoder_inspect NULL
 
+PN_POOL(pn_encoder, 256)
+
 pn_encoder_t *pn_encoder()
 {
-  static const pn_class_t clazz = PN_CLASS(pn_encoder);
+  static const pn_class_t clazz = PN_POOLED_CLASS(pn_encoder);
   return (pn_encoder_t *) pn_class_new(&clazz, sizeof(pn_encoder_t));
 }
 
@@ -223,6 +226,17 @@ static inline void pn_encoder_writev32(pn_encoder_t *encoder, const pn_bytes_t *
   encoder->position += value->size;
 }
 
+// writes count host order values of the given width in network order
+static inline void pn_encoder_writen(pn_encoder_t *encoder, const char *values,
+                                     size_t width, size_t count)
+{
+  size_t size = width * count;
+  if (pn_encoder_remaining(encoder) >= size) {
+    pni_swap_copy(encoder->position, values, width, count);
+  }
+  encoder->position += size;
+}
+
 /* True if node is an element of an array - not the descriptor. */
 static bool pn_is_in_array(pn_data_t *data, pni_node_t *parent, pni_node_t *node) {
   return (parent && parent->atom.type == PN_ARRAY) /* In array */
@@ -253,6 +267,10 @@ static int pni_encoder_enter(void *ctx, pn_data_t *data, pni_node_t *node)
   uint8_t code;
   conv_t c;
 
+  if (node->invalid) {
+    return pn_error_format(data->error, PN_ARG_ERR, "malformed %s", pn_type_name(atom->type));
+  }
+
   /** In an array we don't write the code before each element, only the first. */
   if (pn_is_in_array(data, parent, node)) {
     code = pn_type2code(encoder, parent->type);
@@ -302,6 +320,13 @@ static int pni_encoder_enter(void *ctx, pn_data_t *data, pni_node_t *node)
     node->small = false;
     // we'll backfill the size on exit
     encoder->position += 4;
+    if (node->packed) {
+      size_t width = pni_type_width(node->type);
+      pn_encoder_writef32(encoder, node->data_size / width);
+      pn_encoder_writef8(encoder, pn_type2code(encoder, node->type));
+      pn_encoder_writen(encoder, pni_node_block(data, node), width, node->data_size / width);
+      return 0;
+    }
     pn_encoder_writef32(encoder, node->described ? node->children - 1 : node->children);
     if (node->described)
       pn_encoder_writef8(encoder, 0);
@@ -313,6 +338,12 @@ static int pni_encoder_enter(void *ctx, pn_data_t *data, pni_node_t *node)
     // we'll backfill the size later
     encoder->position += 4;
     pn_encoder_writef32(encoder, node->children);
+    if (node->lazy) {
+      // the elements were never decoded, copy them across as they are
+      if (pn_encoder_remaining(encoder) >= node->data_size)
+        memmove(encoder->position, pni_node_block(data, node), node->data_size);
+      encoder->position += node->data_size;
+    }
     return 0;
   default:
     return pn_error_format(data->error, PN_ERR, "unrecognized encoding: %u", code);
@@ -328,7 +359,8 @@ static int pni_encoder_exit(void *ctx, pn_data_t *data, pni_node_t *node)
 
   switch (node->atom.type) {
   case PN_ARRAY:
-    if ((node->described && node->children == 1) || (!node->described && node->children == 0)) {
+    if (!node->packed &&
+        ((node->described && node->children == 1) || (!node->described && node->children == 0))) {
       pn_encoder_writef8(encoder, pn_type2code(encoder, node->type));
     }
   case PN_LIST:
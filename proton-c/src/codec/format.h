@@ -0,0 +1,54 @@
+#ifndef _PROTON_FORMAT_H
+#define _PROTON_FORMAT_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/codec.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// A pn_data_fill or pn_data_scan format compiled into opcodes the first
+// time it is used, so that a constant format is parsed only once rather
+// than on every call. Declare one per call site with static storage:
+//
+//   static pni_format_t format = PNI_FORMAT("DL[oIIo]");
+//   err = pni_data_fill_format(data, &format, ...);
+//
+// The same format must not be used for both filling and scanning.
+
+#define PNI_FORMAT_MAX (64)
+
+typedef struct {
+  const char *fmt;
+  bool compiled;
+  uint8_t ops[PNI_FORMAT_MAX];
+} pni_format_t;
+
+#define PNI_FORMAT(FMT) {(FMT), false, {0}}
+
+int pni_data_vfill_format(pn_data_t *data, pni_format_t *format, va_list ap);
+int pni_data_fill_format(pn_data_t *data, pni_format_t *format, ...);
+int pni_data_vscan_format(pn_data_t *data, pni_format_t *format, va_list ap);
+int pni_data_scan_format(pn_data_t *data, pni_format_t *format, ...);
+
+#endif /* format.h */
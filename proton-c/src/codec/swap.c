@@ -0,0 +1,152 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "swap.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// The vector kernels reverse the bytes of each value, so are only used
+// where the host is little endian. On x86 they are compiled for their
+// own instruction set and chosen at runtime.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PNI_SWAP_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+#define PNI_SWAP_NEON 1
+#include <arm_neon.h>
+#endif
+
+static void pni_swap_scalar(char *dst, const char *src, size_t width, size_t count)
+{
+  const uint8_t *in = (const uint8_t *) src;
+  size_t i;
+  switch (width) {
+  case 2:
+    for (i = 0; i < count; i++) {
+      uint16_t v = (uint16_t) in[2*i] << 8 | in[2*i + 1];
+      memcpy(dst + 2*i, &v, 2);
+    }
+    break;
+  case 4:
+    for (i = 0; i < count; i++) {
+      uint32_t v = (uint32_t) in[4*i] << 24 | (uint32_t) in[4*i + 1] << 16 |
+        (uint32_t) in[4*i + 2] << 8 | in[4*i + 3];
+      memcpy(dst + 4*i, &v, 4);
+    }
+    break;
+  case 8:
+    for (i = 0; i < count; i++) {
+      uint64_t v = (uint64_t) in[8*i] << 56 | (uint64_t) in[8*i + 1] << 48 |
+        (uint64_t) in[8*i + 2] << 40 | (uint64_t) in[8*i + 3] << 32 |
+        (uint64_t) in[8*i + 4] << 24 | (uint64_t) in[8*i + 5] << 16 |
+        (uint64_t) in[8*i + 6] << 8 | in[8*i + 7];
+      memcpy(dst + 8*i, &v, 8);
+    }
+    break;
+  default:
+    if (dst != src) memmove(dst, src, width * count);
+    break;
+  }
+}
+
+#ifdef PNI_SWAP_X86
+
+// shuffles reversing each 2, 4 and 8 byte lane of a 16 byte vector
+static const uint8_t pni_swap_masks[3][16] = {
+  {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+  {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+  {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8}
+};
+
+static const uint8_t *pni_swap_mask(size_t width)
+{
+  return pni_swap_masks[width == 2 ? 0 : (width == 4 ? 1 : 2)];
+}
+
+// each kernel returns how many of the size bytes it converted
+__attribute__((target("ssse3")))
+static size_t pni_swap_ssse3(char *dst, const char *src, size_t width, size_t size)
+{
+  const __m128i mask = _mm_loadu_si128((const __m128i *) pni_swap_mask(width));
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_shuffle_epi8(v, mask));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t pni_swap_avx2(char *dst, const char *src, size_t width, size_t size)
+{
+  const __m256i mask = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128((const __m128i *) pni_swap_mask(width)));
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (src + i));
+    _mm256_storeu_si256((__m256i *) (dst + i), _mm256_shuffle_epi8(v, mask));
+  }
+  return i;
+}
+
+#endif
+
+#ifdef PNI_SWAP_NEON
+
+static size_t pni_swap_neon(char *dst, const char *src, size_t width, size_t size)
+{
+  const uint8_t *in = (const uint8_t *) src;
+  uint8_t *out = (uint8_t *) dst;
+  size_t i = 0;
+  switch (width) {
+  case 2:
+    for (; i + 16 <= size; i += 16) vst1q_u8(out + i, vrev16q_u8(vld1q_u8(in + i)));
+    break;
+  case 4:
+    for (; i + 16 <= size; i += 16) vst1q_u8(out + i, vrev32q_u8(vld1q_u8(in + i)));
+    break;
+  case 8:
+    for (; i + 16 <= size; i += 16) vst1q_u8(out + i, vrev64q_u8(vld1q_u8(in + i)));
+    break;
+  }
+  return i;
+}
+
+#endif
+
+void pni_swap_copy(char *dst, const char *src, size_t width, size_t count)
+{
+  size_t size = width * count;
+  size_t done = 0;
+  if (size >= 16 && (width == 2 || width == 4 || width == 8)) {
+#if defined(PNI_SWAP_X86)
+    if (size >= 32 && __builtin_cpu_supports("avx2")) {
+      done = pni_swap_avx2(dst, src, width, size);
+    } else if (__builtin_cpu_supports("ssse3")) {
+      done = pni_swap_ssse3(dst, src, width, size);
+    }
+#elif defined(PNI_SWAP_NEON)
+    done = pni_swap_neon(dst, src, width, size);
+#endif
+  }
+  pni_swap_scalar(dst + done, src + done, width, (size - done) / width);
+}
@@ -0,0 +1,33 @@
+#ifndef _PROTON_SWAP_H
+#define _PROTON_SWAP_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <stddef.h>
+
+// Copies count values of the given width from src to dst, converting
+// each between host and network byte order. Widths other than 2, 4 and
+// 8 are copied as they are. The copy may be in place, but dst and src
+// must not otherwise overlap.
+void pni_swap_copy(char *dst, const char *src, size_t width, size_t count);
+
+#endif /* swap.h */
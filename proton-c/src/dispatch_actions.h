@@ -23,6 +23,7 @@
  */
 
 #include "dispatcher/dispatcher.h"
+#include "transport/performatives.h"
 
 #define AMQP_FRAME_TYPE (0)
 #define SASL_FRAME_TYPE (1)
@@ -39,6 +40,11 @@ int pn_do_detach(pn_transport_t *transport, uint8_t frame_type, uint16_t channel
 int pn_do_end(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload);
 int pn_do_close(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload);
 
+/* AMQP actions for already decoded performatives */
+int pni_do_transfer(pn_transport_t *transport, uint16_t channel, const pni_transfer_t *transfer, const pn_bytes_t *payload);
+int pni_do_flow(pn_transport_t *transport, uint16_t channel, const pni_flow_t *flow);
+int pni_do_disposition(pn_transport_t *transport, uint16_t channel, const pni_disposition_t *disposition);
+
 /* SASL actions */
 int pn_do_init(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload);
 int pn_do_mechanisms(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload);
@@ -26,6 +26,8 @@
 #include "engine/engine-internal.h"
 
 #include "dispatch_actions.h"
+#include "transport/compress.h"
+#include "probes.h"
 
 int pni_bad_frame(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload) {
   pn_transport_logf(transport, "Error dispatching frame: type: %d: Unknown performative", frame_type);
@@ -74,6 +76,49 @@ static inline int pni_dispatch_action(pn_transport_t* transport, uint64_t lcode,
   return action(transport, frame_type, channel, args, payload);
 }
 
+// Decode the hot performatives straight from the frame bytes into their
+// typed form, skipping the pn_data_t tree. Returns false if the frame
+// needs the generic path, e.g. because frames are being traced.
+static bool pni_dispatch_direct(pn_transport_t *transport, pn_frame_t frame, int *err)
+{
+  uint64_t lcode;
+  if (frame.type != AMQP_FRAME_TYPE || (transport->trace & PN_TRACE_FRM) ||
+      !pni_decode_descriptor(frame.payload, frame.size, &lcode)) {
+    return false;
+  }
+
+  size_t n;
+  pn_bytes_t payload;
+  switch (lcode) {
+  case TRANSFER:
+    {
+      pni_transfer_t transfer;
+      if (!(n = pni_decode_transfer(frame.payload, frame.size, &transfer))) return false;
+      payload = pn_bytes(frame.size - n, frame.size > n ? frame.payload + n : NULL);
+      pn_data_clear(transport->disp_data);
+      *err = pni_do_transfer(transport, frame.channel, &transfer, &payload);
+      return true;
+    }
+  case FLOW:
+    {
+      pni_flow_t flow;
+      if (!(n = pni_decode_flow(frame.payload, frame.size, &flow))) return false;
+      *err = pni_do_flow(transport, frame.channel, &flow);
+      return true;
+    }
+  case DISPOSITION:
+    {
+      pni_disposition_t disposition;
+      if (!(n = pni_decode_disposition(frame.payload, frame.size, &disposition))) return false;
+      pn_data_clear(transport->disp_data);
+      *err = pni_do_disposition(transport, frame.channel, &disposition);
+      return true;
+    }
+  default:
+    return false;
+  }
+}
+
 static int pni_dispatch_frame(pn_transport_t * transport, pn_data_t *args, pn_frame_t frame)
 {
   if (frame.size == 0) { // ignore null frames
@@ -82,6 +127,11 @@ static int pni_dispatch_frame(pn_transport_t * transport, pn_data_t *args, pn_fr
     return 0;
   }
 
+  int direct_err;
+  if (pni_dispatch_direct(transport, frame, &direct_err)) {
+    return direct_err;
+  }
+
   ssize_t dsize = pn_data_decode(args, frame.payload, frame.size);
   if (dsize < 0) {
     pn_string_format(transport->scratch,
@@ -98,7 +148,8 @@ static int pni_dispatch_frame(pn_transport_t * transport, pn_data_t *args, pn_fr
   // if we get a symbol we should map it to the numeric value and dispatch on that
   uint64_t lcode;
   bool scanned;
-  int e = pn_data_scan(args, "D?L.", &scanned, &lcode);
+  static pni_format_t format = PNI_FORMAT("D?L.");
+  int e = pni_data_scan_format(args, &format, &scanned, &lcode);
   if (e) {
     pn_transport_log(transport, "Scan error");
     return e;
@@ -132,7 +183,20 @@ ssize_t pn_dispatcher_input(pn_transport_t *transport, const char *bytes, size_t
       read += n;
       available -= n;
       transport->input_frames_ct += 1;
+      pni_histogram_add(&transport->metrics.input_frame_sizes, n);
+      if (transport->trace & PN_TRACE_RAW) {
+        pn_do_raw_trace(transport, frame.channel, IN, frame.payload, frame.size,
+                        bytes + read - n, n);
+      }
+      if (frame.type == PNI_COMPRESS_FRAME_TYPE) {
+        // what follows has to go through the layer below first
+        int e = pni_compress_input_started(transport);
+        if (e) return e;
+        break;
+      }
+      PNI_PROBE3(frame_in, transport, frame.channel, n);
       int e = pni_dispatch_frame(transport, transport->args, frame);
+      PNI_PROBE3(frame_in_done, transport, frame.channel, e);
       if (e) return e;
     } else {
       break;
@@ -147,9 +211,9 @@ ssize_t pn_dispatcher_input(pn_transport_t *transport, const char *bytes, size_t
 ssize_t pn_dispatcher_output(pn_transport_t *transport, char *bytes, size_t size)
 {
     int n = transport->available < size ? transport->available : size;
-    memmove(bytes, transport->output, n);
-    memmove(transport->output, transport->output + n, transport->available - n);
+    memmove(bytes, transport->output + transport->offset, n);
     transport->available -= n;
+    transport->offset = transport->available ? transport->offset + n : 0;
     // XXX: need to check for errors
     return n;
 }
@@ -0,0 +1,174 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/connection_driver.h>
+#include <proton/connection.h>
+#include <proton/condition.h>
+#include <proton/error.h>
+#include <proton/object.h>
+#include <proton/transport.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int pn_connection_driver_init(pn_connection_driver_t *driver, pn_connection_t *connection,
+                              pn_transport_t *transport)
+{
+  assert(driver);
+  memset(driver, 0, sizeof(*driver));
+  driver->connection = connection ? connection : pn_connection();
+  driver->transport = transport ? transport : pn_transport();
+  driver->collector = pn_collector();
+  if (!driver->connection || !driver->transport || !driver->collector) {
+    pn_connection_driver_destroy(driver);
+    return PN_ERR;
+  }
+  pn_connection_collect(driver->connection, driver->collector);
+  return 0;
+}
+
+int pn_connection_driver_bind(pn_connection_driver_t *driver)
+{
+  assert(driver);
+  if (pn_transport_connection(driver->transport)) return 0;
+  return pn_transport_bind(driver->transport, driver->connection);
+}
+
+void pn_connection_driver_destroy(pn_connection_driver_t *driver)
+{
+  assert(driver);
+  if (driver->transport) {
+    pn_transport_unbind(driver->transport);
+    pn_transport_free(driver->transport);
+  }
+  if (driver->connection) pn_connection_free(driver->connection);
+  if (driver->collector) pn_collector_free(driver->collector);
+  memset(driver, 0, sizeof(*driver));
+}
+
+pn_rwbytes_t pn_connection_driver_read_buffer(pn_connection_driver_t *driver)
+{
+  ssize_t capacity = pn_transport_capacity(driver->transport);
+  if (capacity <= 0) return pn_rwbytes(0, NULL);
+  return pn_rwbytes(capacity, pn_transport_tail(driver->transport));
+}
+
+void pn_connection_driver_read_done(pn_connection_driver_t *driver, size_t size)
+{
+  if (size) pn_transport_process(driver->transport, size);
+}
+
+void pn_connection_driver_read_close(pn_connection_driver_t *driver)
+{
+  if (pn_transport_capacity(driver->transport) >= 0) {
+    pn_transport_close_tail(driver->transport);
+  }
+}
+
+pn_bytes_t pn_connection_driver_write_buffer(pn_connection_driver_t *driver)
+{
+  ssize_t pending = pn_transport_pending(driver->transport);
+  if (pending <= 0) return pn_bytes(0, NULL);
+  return pn_bytes(pending, pn_transport_head(driver->transport));
+}
+
+void pn_connection_driver_write_done(pn_connection_driver_t *driver, size_t size)
+{
+  if (size) pn_transport_pop(driver->transport, size);
+}
+
+void pn_connection_driver_write_close(pn_connection_driver_t *driver)
+{
+  if (pn_transport_pending(driver->transport) >= 0) {
+    pn_transport_close_head(driver->transport);
+  }
+}
+
+void pn_connection_driver_close(pn_connection_driver_t *driver)
+{
+  pn_connection_driver_read_close(driver);
+  pn_connection_driver_write_close(driver);
+}
+
+pn_timestamp_t pn_connection_driver_tick(pn_connection_driver_t *driver, pn_timestamp_t now)
+{
+  return pn_transport_tick(driver->transport, now);
+}
+
+pn_event_t *pn_connection_driver_next_event(pn_connection_driver_t *driver)
+{
+  if (driver->handling) {
+    pn_event_t *handled = pn_collector_peek(driver->collector);
+    driver->handling = false;
+    if (handled) {
+      pn_event_type_t type = pn_event_type(handled);
+      pn_collector_pop(driver->collector);
+      switch (type) {
+      case PN_CONNECTION_INIT:
+        // the application has had its chance to configure the transport
+        pn_connection_driver_bind(driver);
+        break;
+      case PN_TRANSPORT_CLOSED:
+        // nothing happens after this
+        pn_collector_release(driver->collector);
+        return NULL;
+      default:
+        break;
+      }
+    }
+  }
+  pn_event_t *event = pn_collector_peek(driver->collector);
+  driver->handling = event != NULL;
+  return event;
+}
+
+bool pn_connection_driver_has_event(pn_connection_driver_t *driver)
+{
+  pn_event_t *event = pn_collector_peek(driver->collector);
+  // the event handed out last is still the collector's head
+  return event && (!driver->handling || pn_collector_more(driver->collector));
+}
+
+bool pn_connection_driver_finished(pn_connection_driver_t *driver)
+{
+  return pn_transport_closed(driver->transport) &&
+    !pn_connection_driver_has_event(driver);
+}
+
+void pn_connection_driver_verrorf(pn_connection_driver_t *driver, const char *name,
+                                  const char *fmt, va_list ap)
+{
+  char description[1024];
+  vsnprintf(description, sizeof(description), fmt, ap);
+  pn_condition_t *condition = pn_transport_condition(driver->transport);
+  pn_condition_set_name(condition, name);
+  pn_condition_set_description(condition, description);
+  pn_connection_driver_close(driver);
+}
+
+void pn_connection_driver_errorf(pn_connection_driver_t *driver, const char *name,
+                                 const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  pn_connection_driver_verrorf(driver, name, fmt, ap);
+  va_end(ap);
+}
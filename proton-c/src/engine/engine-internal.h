@@ -26,7 +26,13 @@
 #include <proton/engine.h>
 #include <proton/types.h>
 #include "buffer.h"
+#include "codec/format.h"
 #include "dispatcher/dispatcher.h"
+#include "log_private.h"
+#include "mapped.h"
+#include "object/symtab.h"
+#include "transport/capture.h"
+#include "transport/frame_pool.h"
 #include "util.h"
 
 typedef enum pn_endpoint_type_t {CONNECTION, SESSION, SENDER, RECEIVER} pn_endpoint_type_t;
@@ -50,6 +56,8 @@ struct pn_endpoint_t {
   pn_endpoint_t *transport_next;
   pn_endpoint_t *transport_prev;
   int refcount; // when this hits zero we generate a final event
+  void *handler;     // the reactor's resolution of this endpoint's handler,
+  int handler_epoch; // valid while no handler has been set since
   bool modified;
   bool freed;
   bool referenced;
@@ -61,11 +69,33 @@ typedef struct {
   bool init;
 } pn_delivery_state_t;
 
+// In flight deliveries are kept in a ring indexed by delivery id, which
+// covers the ids from lwm up to next. Should the oldest unsettled
+// deliveries hold the ring open too wide, they are moved to a hash.
 typedef struct {
   pn_sequence_t next;
-  pn_hash_t *deliveries;
+  pn_sequence_t lwm;
+  pn_delivery_t **ring;
+  size_t capacity;
+  size_t count;
+  pn_hash_t *overflow;
 } pn_delivery_map_t;
 
+// Sessions by channel and links by handle. Peers number them densely
+// from zero, so they are kept in an array indexed by number, with any
+// beyond the array's limit in a hash. A map that numbers its own
+// entries hands out those freed again before new ones.
+typedef struct {
+  void **slots;
+  uint32_t *free;     // freed numbers below size, the latest last
+  size_t capacity;
+  size_t size;        // every number in use is below this
+  size_t count;
+  size_t free_count;
+  pn_hash_t *overflow;
+  bool allocates;
+} pn_alias_map_t;
+
 typedef struct {
   // XXX: stop using negative numbers
   uint32_t local_handle;
@@ -74,6 +104,17 @@ typedef struct {
   pn_sequence_t link_credit;
 } pn_link_state_t;
 
+#define PNI_DISP_MAX (16)
+
+// a run of delivery ids awaiting the same disposition
+typedef struct {
+  uint64_t code;
+  pn_sequence_t first;
+  pn_sequence_t last;
+  bool settled;
+  bool role;
+} pni_disp_range_t;
+
 typedef struct {
   // XXX: stop using negative numbers
   uint16_t local_channel;
@@ -86,15 +127,20 @@ typedef struct {
   pn_sequence_t remote_incoming_window;
   pn_sequence_t outgoing_transfer_count;
   pn_sequence_t outgoing_window;
-  pn_hash_t *local_handles;
-  pn_hash_t *remote_handles;
-
-  uint64_t disp_code;
-  bool disp_settled;
-  bool disp_type;
-  pn_sequence_t disp_first;
-  pn_sequence_t disp_last;
-  bool disp;
+  pn_alias_map_t local_handles;
+  pn_alias_map_t remote_handles;
+
+  // pending dispositions, oldest first
+  pni_disp_range_t disp[PNI_DISP_MAX];
+  size_t disp_count;
+
+  // window autotuning, a refresh is measured from when it is sent until
+  // the first transfer beyond the limit it extended arrives, which is
+  // one round trip
+  pn_sequence_t tune_limit;
+  size_t tune_bytes;
+  bool tune_pending;
+  bool tune_stalled;
 } pn_session_state_t;
 
 #include <proton/sasl.h>
@@ -107,18 +153,51 @@ typedef struct pn_io_layer_t {
   size_t (*buffered_output)(struct pn_transport_t *);  // how much output is held
 } pn_io_layer_t;
 
+extern const pn_io_layer_t pni_setup_layer;
 extern const pn_io_layer_t pni_passthru_layer;
+void pni_io_layer_remove(struct pn_transport_t *transport, unsigned int layer);
 extern const pn_io_layer_t ssl_layer;
+extern const pn_io_layer_t pni_compress_layer;
 extern const pn_io_layer_t sasl_header_layer;
 extern const pn_io_layer_t sasl_write_header_layer;
 
 typedef struct pni_sasl_t pni_sasl_t;
 typedef struct pni_ssl_t pni_ssl_t;
+typedef struct pni_compress_t pni_compress_t;
+
+// the largest incoming frame a transport accepts unless told otherwise,
+// build with PN_DEFAULT_MAX_FRAME_SIZE=0 to accept frames of any size
+#ifndef PN_DEFAULT_MAX_FRAME_SIZE
+#define PN_DEFAULT_MAX_FRAME_SIZE (16*1024)
+#endif
+
+// the size of the transport's raw input and output buffers, input
+// only ever grows past this to hold a single larger frame
+#define PNI_IO_BUFFER_SIZE (16*1024)
+// the most output buffers a transport sets aside for zerocopy sends,
+// after that output waits for the kernel to finish with the oldest
+#define PNI_PINNED_BUFFERS (32)
+
+typedef struct {
+  char *buf;
+  size_t size;
+  uint32_t pins;
+} pni_pinned_buffer_t;
 
 struct pn_transport_t {
   pn_tracer_t tracer;
+  pni_log_ring_t *log_ring;  // the trace, with pn_log_async()
+  pn_frame_tracer_t frame_tracer;
+  pn_data_t *trace_args;  // performatives of raw frames, for the filters
+  uint32_t trace_sample;
+  uint32_t trace_performatives;
+  int64_t trace_handle;
+  int trace_channel;
+  bool trace_errors;
+  pni_capture_t *capture;  // see pn_transport_capture()
   pni_sasl_t *sasl;
   pni_ssl_t *ssl;
+  pni_compress_t *compress;  // see pn_transport_set_compression()
   pn_connection_t *connection;  // reference counted
   char *remote_container;
   char *remote_hostname;
@@ -126,15 +205,13 @@ struct pn_transport_t {
   pn_data_t *remote_desired_capabilities;
   pn_data_t *remote_properties;
   pn_data_t *disp_data;
-  //#define PN_DEFAULT_MAX_FRAME_SIZE (16*1024)
-#define PN_DEFAULT_MAX_FRAME_SIZE (0)  /* for now, allow unlimited size */
   uint32_t   local_max_frame;
   uint32_t   remote_max_frame;
   pn_condition_t remote_condition;
   pn_condition_t condition;
   pn_error_t *error;
 
-#define PN_IO_LAYER_CT 3
+#define PN_IO_LAYER_CT 4
   const pn_io_layer_t *io_layers[PN_IO_LAYER_CT];
 
   /* dead remote detection */
@@ -147,8 +224,14 @@ struct pn_transport_t {
   pn_timestamp_t keepalive_deadline;
   uint64_t last_bytes_output;
 
-  pn_hash_t *local_channels;
-  pn_hash_t *remote_channels;
+  /* idle compaction */
+  pn_millis_t compact_timeout;
+  pn_timestamp_t compact_deadline;
+  uint64_t compact_bytes;
+  bool compacted;
+
+  pn_alias_map_t local_channels;
+  pn_alias_map_t remote_channels;
 
 
   /* scratch area */
@@ -158,6 +241,7 @@ struct pn_transport_t {
   pn_buffer_t *frame;  // frame under construction
   // Temporary
   size_t capacity;
+  size_t offset;    /* start of the raw bytes pending output */
   size_t available; /* number of raw bytes pending output */
   char *output;
 
@@ -166,14 +250,35 @@ struct pn_transport_t {
   uint64_t bytes_output;
   uint64_t output_frames_ct;
   uint64_t input_frames_ct;
+  pn_transport_metrics_t metrics;  // the rest of them
+
+  /* raw buffers are drawn from here when set */
+  pni_frame_pool_t *frame_pool;
+
+  /* asks the owner to look at the transport again, from any thread */
+  pni_transport_wake_t wake;
+  void *wake_context;
+
+  /* the owner's socket when kernel TLS may be used on it, and the
+     PNI_KTLS_* directions the kernel does the record layer of */
+  pn_socket_t socket;
+  int kernel_tls;
 
   /* output buffered for send */
   size_t output_size;
+  size_t output_offset;
   size_t output_pending;
   char *output_buf;
-
-  /* input from peer */
+  /* zerocopy sends the kernel may still read popped output for, the
+     buffer is neither moved nor reused until they are done */
+  uint32_t output_pins;
+  /* earlier output buffers still pinned, oldest first */
+  pni_pinned_buffer_t *output_retired;
+  size_t output_retired_count;
+
+  /* input from peer, pending bytes start at input_offset */
   size_t input_size;
+  size_t input_offset;
   size_t input_pending;
   char *input_buf;
 
@@ -194,21 +299,31 @@ struct pn_transport_t {
   bool posted_idle_timeout;
   bool server;
   bool halt;
+  bool input_held;      // a layer left input pending until it could tell what it is for
 
   bool referenced;
 };
 
+// modified endpoints of one kind, in the order they were modified
+typedef struct {
+  pn_endpoint_t *transport_head;
+  pn_endpoint_t *transport_tail;
+} pni_transport_queue_t;
+
 struct pn_connection_t {
   pn_endpoint_t endpoint;
   pn_endpoint_t *endpoint_head;
   pn_endpoint_t *endpoint_tail;
-  pn_endpoint_t *transport_head;  // reference counted
-  pn_endpoint_t *transport_tail;
+  // kept apart by kind so each phase of pn_process only walks the
+  // endpoints it can act on
+  pni_transport_queue_t modified_connection;
+  pni_transport_queue_t modified_sessions;
+  pni_transport_queue_t modified_links;
   pn_list_t *sessions;
   pn_list_t *freed;
   pn_transport_t *transport;
-  pn_delivery_t *work_head;
-  pn_delivery_t *work_tail;
+  pn_link_t *worklink_head;  // links with deliveries on their work lists
+  pn_link_t *worklink_tail;
   pn_delivery_t *tpwork_head;  // reference counted
   pn_delivery_t *tpwork_tail;
   pn_string_t *container;
@@ -219,20 +334,36 @@ struct pn_connection_t {
   pn_collector_t *collector;
   pn_record_t *context;
   pn_list_t *delivery_pool;
+  pn_buffer_pool_t *buffer_pool;
+  pni_symtab_t *symbols;  // link names, addresses and condition names
+  size_t incoming_bytes;   // across all sessions
+  size_t incoming_budget;
+  bool budget_stalled;     // reached the budget and not yet drained to half
+  // the events the reactor has dispatched for the connection in its
+  // current round
+  unsigned int dispatch_round;
+  int dispatched;
 };
 
 struct pn_session_t {
   pn_endpoint_t endpoint;
   pn_connection_t *connection;  // reference counted
   pn_list_t *links;
+  pn_hash_t *link_names;  // the links by interned name and direction
   pn_list_t *freed;
   pn_record_t *context;
   size_t incoming_capacity;
+  size_t incoming_base_capacity; // as set by the application
+  size_t incoming_max_capacity;  // autotuning limit, zero when off
+  size_t incoming_low_water;
+  size_t outgoing_high_water;
   pn_sequence_t incoming_bytes;
   pn_sequence_t outgoing_bytes;
   pn_sequence_t incoming_deliveries;
   pn_sequence_t outgoing_deliveries;
   pn_session_state_t state;
+  pn_session_metrics_t metrics;
+  bool window_stalled;
 };
 
 struct pn_terminus_t {
@@ -261,12 +392,19 @@ struct pn_link_t {
   pn_delivery_t *unsettled_head;
   pn_delivery_t *unsettled_tail;
   pn_delivery_t *current;
+  pn_delivery_t *work_head;  // deliveries with work, of this link only
+  pn_delivery_t *work_tail;
+  pn_link_t *worklink_next;  // on the connection while work_head is set
+  pn_link_t *worklink_prev;
   pn_record_t *context;
   size_t unsettled_count;
+  size_t incoming_high_water;
   pn_sequence_t available;
   pn_sequence_t credit;
   pn_sequence_t queued;
   int drained; // number of drained credits
+  pn_link_metrics_t metrics;
+  pn_link_latency_t *latency;  // when tracked
   uint8_t snd_settle_mode;
   uint8_t rcv_settle_mode;
   uint8_t remote_snd_settle_mode;
@@ -274,6 +412,7 @@ struct pn_link_t {
   bool drain_flag_mode; // receiver only
   bool drain;
   bool detached;
+  bool credit_stalled;
 };
 
 struct pn_disposition_t {
@@ -288,11 +427,14 @@ struct pn_disposition_t {
   bool settled;
 };
 
+// tags are nearly always a few bytes, and are kept in the delivery
+// itself up to this size
+#define PNI_TAG_INLINE (16)
+
+// what the engine touches for every delivery comes first, to share
+// a cache line; the dispositions are only read when they change
 struct pn_delivery_t {
-  pn_disposition_t local;
-  pn_disposition_t remote;
   pn_link_t *link;  // reference counted
-  pn_buffer_t *tag;
   pn_delivery_t *unsettled_next;
   pn_delivery_t *unsettled_prev;
   pn_delivery_t *work_next;
@@ -300,22 +442,51 @@ struct pn_delivery_t {
   pn_delivery_t *tpwork_next;
   pn_delivery_t *tpwork_prev;
   pn_delivery_state_t state;
-  pn_buffer_t *bytes;
-  pn_record_t *context;
   bool updated;
   bool settled; // tracks whether we're in the unsettled list or not
   bool work;
   bool tpwork;
   bool done;
   bool referenced;
+  pn_buffer_t *bytes;
+  pn_bytes_t tag; // in tag_inline, or tag_heap when too long for it
+  char tag_inline[PNI_TAG_INLINE];
+  char *tag_heap;
+  size_t tag_capacity; // of tag_heap
+  pn_buffer_t **segments; // filled segments of a large incoming delivery, read before bytes
+  size_t segment_head;
+  size_t segment_count;
+  size_t segment_capacity;
+  size_t segment_bytes;
+  pn_bytes_t adopted; // caller owned bytes, sent after those in bytes
+  pn_link_release_t release;
+  void *release_context;
+  pni_file_range_t *file; // the rest of a file body, read into adopted a window at a time
+  pn_record_t *context;
+  uint64_t stamp;  // when the current stage began, with latency tracking
+  uint32_t message_format;
+  pn_disposition_t local;
+  pn_disposition_t remote;
 };
 
+// incoming data beyond this is held in a list of segments rather than
+// one ever growing buffer
+#define PNI_SEGMENT_SIZE (64*1024)
+
 #define PN_SET_LOCAL(OLD, NEW)                                          \
   (OLD) = ((OLD) & PN_REMOTE_MASK) | (NEW)
 
 #define PN_SET_REMOTE(OLD, NEW)                                         \
   (OLD) = ((OLD) & PN_LOCAL_MASK) | (NEW)
 
+void pni_delivery_release(pn_delivery_t *delivery);
+int pni_delivery_refill(pn_delivery_t *delivery);
+void pni_delivery_append(pn_delivery_t *delivery, const char *bytes, size_t size);
+bool pni_session_window_low(pn_session_t *ssn);
+void pni_session_received(pn_session_t *ssn, size_t size);
+void pni_session_released(pn_session_t *ssn, size_t size);
+// the first of the session's links with the given interned name
+pn_link_t *pni_session_link(pn_session_t *ssn, pn_string_t *name, bool sender);
 void pn_link_dump(pn_link_t *link);
 
 void pn_dump(pn_connection_t *conn);
@@ -339,10 +510,25 @@ void pn_ep_incref(pn_endpoint_t *endpoint);
 void pn_ep_decref(pn_endpoint_t *endpoint);
 
 int pn_post_frame(pn_transport_t *transport, uint8_t type, uint16_t ch, const char *fmt, ...);
+int pni_post_frame(pn_transport_t *transport, uint8_t type, uint16_t ch, pni_format_t *format, ...);
 
 typedef enum {IN, OUT} pn_dir_t;
 
 void pn_do_trace(pn_transport_t *transport, uint16_t ch, pn_dir_t dir,
                  pn_data_t *args, const char *payload, size_t size);
+void pni_histogram_add(pn_histogram_t *histogram, uint64_t value);
+// ends the stage of a delivery begun at its stamp, and starts the next
+// one unless next is false
+void pni_delivery_stage(pn_delivery_t *delivery, pn_histogram_t *histogram, bool next);
+
+// a zerocopy send of the head was made, it is popped as usual
+void pni_transport_pin_output(pn_transport_t *transport);
+void pni_transport_unpin_output(pn_transport_t *transport, uint32_t sends);
+uint32_t pni_transport_output_pins(pn_transport_t *transport);
+
+// frame is a whole frame as written to or read from the wire,
+// performative and size its encoded performative
+void pn_do_raw_trace(pn_transport_t *transport, uint16_t ch, pn_dir_t dir,
+                     const char *performative, size_t size, const char *frame, size_t n);
 
 #endif /* engine-internal.h */
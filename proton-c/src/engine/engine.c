@@ -31,6 +31,7 @@
 #include "platform.h"
 #include "platform_fmt.h"
 #include "transport/transport.h"
+#include "alloc_private.h"
 
 // endpoints
 
@@ -161,9 +162,13 @@ void pn_connection_unbound(pn_connection_t *connection)
     // connection has been freed prior to unbinding, thus it
     // cannot be re-assigned to a new transport.  Clear the
     // transport work lists to allow the connection to be freed.
-    while (connection->transport_head) {
-        pn_clear_modified(connection, connection->transport_head);
+    while (connection->modified_links.transport_head) {
+      pn_clear_modified(connection, connection->modified_links.transport_head);
     }
+    while (connection->modified_sessions.transport_head) {
+      pn_clear_modified(connection, connection->modified_sessions.transport_head);
+    }
+    pn_clear_modified(connection, &connection->endpoint);
     while (connection->tpwork_head) {
       pn_clear_tpwork(connection->tpwork_head);
     }
@@ -196,18 +201,81 @@ pn_transport_t *pn_connection_transport(pn_connection_t *connection)
   return connection->transport;
 }
 
+// stall once the budget is reached, and once drained to half of it look
+// at every receiver again so the credit and windows held back go out
+static void pni_connection_budget(pn_connection_t *conn)
+{
+  size_t budget = conn->incoming_budget;
+  if (budget && conn->incoming_bytes >= budget) {
+    conn->budget_stalled = true;
+  } else if (conn->budget_stalled && (!budget || conn->incoming_bytes <= budget/2)) {
+    conn->budget_stalled = false;
+    size_t nsessions = pn_list_size(conn->sessions);
+    for (size_t i = 0; i < nsessions; i++) {
+      pn_session_t *ssn = (pn_session_t *) pn_list_get(conn->sessions, i);
+      size_t nlinks = pn_list_size(ssn->links);
+      for (size_t j = 0; j < nlinks; j++) {
+        pn_link_t *link = (pn_link_t *) pn_list_get(ssn->links, j);
+        if (link->endpoint.type == RECEIVER) {
+          pn_modified(conn, &link->endpoint, false);
+        }
+      }
+    }
+    pn_modified(conn, &conn->endpoint, true);
+  }
+}
+
+size_t pn_connection_get_incoming_budget(pn_connection_t *connection)
+{
+  assert(connection);
+  return connection->incoming_budget;
+}
+
+void pn_connection_set_incoming_budget(pn_connection_t *connection, size_t budget)
+{
+  assert(connection);
+  connection->incoming_budget = budget;
+  pni_connection_budget(connection);
+}
+
+size_t pn_connection_incoming_bytes(pn_connection_t *connection)
+{
+  assert(connection);
+  return connection->incoming_bytes;
+}
+
+void pni_session_received(pn_session_t *ssn, size_t size)
+{
+  ssn->incoming_bytes += size;
+  ssn->connection->incoming_bytes += size;
+  if (ssn->connection->incoming_budget) {
+    pni_connection_budget(ssn->connection);
+  }
+}
+
+void pni_session_released(pn_session_t *ssn, size_t size)
+{
+  ssn->incoming_bytes -= size;
+  ssn->connection->incoming_bytes -= size;
+  if (ssn->connection->budget_stalled) {
+    pni_connection_budget(ssn->connection);
+  }
+}
+
+// the strings and info are created when first set, most conditions
+// never are
 void pn_condition_init(pn_condition_t *condition)
 {
-  condition->name = pn_string(NULL);
-  condition->description = pn_string(NULL);
-  condition->info = pn_data(0);
+  condition->name = NULL;
+  condition->description = NULL;
+  condition->info = NULL;
 }
 
 void pn_condition_tini(pn_condition_t *condition)
 {
   pn_data_free(condition->info);
   pn_free(condition->description);
-  pn_free(condition->name);
+  pn_decref(condition->name);
 }
 
 void pn_add_session(pn_connection_t *conn, pn_session_t *ssn)
@@ -280,11 +348,27 @@ void pn_session_set_context(pn_session_t *session, void *context)
 }
 
 
+// names are interned objects, so their low bit is free to tell
+// senders from receivers
+static uintptr_t pni_link_key(pn_string_t *name, bool sender)
+{
+  return (uintptr_t) name | (sender ? 1 : 0);
+}
+
+pn_link_t *pni_session_link(pn_session_t *ssn, pn_string_t *name, bool sender)
+{
+  return (pn_link_t *) pn_hash_get(ssn->link_names, pni_link_key(name, sender));
+}
+
 void pn_add_link(pn_session_t *ssn, pn_link_t *link)
 {
   pn_list_add(ssn->links, link);
   link->session = ssn;
   pn_ep_incref(&ssn->endpoint);
+  uintptr_t key = pni_link_key(link->name, link->endpoint.type == SENDER);
+  if (!pn_hash_get(ssn->link_names, key)) {
+    pn_hash_put(ssn->link_names, key, link);
+  }
 }
 
 void pn_remove_link(pn_session_t *ssn, pn_link_t *link)
@@ -292,6 +376,19 @@ void pn_remove_link(pn_session_t *ssn, pn_link_t *link)
   if (pn_list_remove(ssn->links, link)) {
     pn_ep_decref(&ssn->endpoint);
     LL_REMOVE(ssn->connection, endpoint, &link->endpoint);
+    bool sender = link->endpoint.type == SENDER;
+    uintptr_t key = pni_link_key(link->name, sender);
+    if (pn_hash_get(ssn->link_names, key) == link) {
+      pn_hash_del(ssn->link_names, key);
+      // another link may have the same name
+      for (size_t i = 0; i < pn_list_size(ssn->links); i++) {
+        pn_link_t *other = (pn_link_t *) pn_list_get(ssn->links, i);
+        if (other->name == link->name && (other->endpoint.type == SENDER) == sender) {
+          pn_hash_put(ssn->link_names, key, other);
+          break;
+        }
+      }
+    }
   }
 }
 
@@ -318,7 +415,7 @@ void pn_link_detach(pn_link_t *link)
 
 void pn_terminus_free(pn_terminus_t *terminus)
 {
-  pn_free(terminus->address);
+  pn_decref(terminus->address);
   pn_free(terminus->properties);
   pn_free(terminus->capabilities);
   pn_free(terminus->outcomes);
@@ -378,6 +475,8 @@ void pn_endpoint_init(pn_endpoint_t *endpoint, int type, pn_connection_t *conn)
   endpoint->modified = false;
   endpoint->freed = false;
   endpoint->refcount = 1;
+  endpoint->handler = NULL;
+  endpoint->handler_epoch = 0;
   //fprintf(stderr, "initting 0x%lx\n", (uintptr_t) endpoint);
 
   LL_ADD(conn, endpoint, endpoint);
@@ -479,6 +578,8 @@ static void pn_connection_finalize(void *object)
   pn_free(conn->properties);
   pn_endpoint_tini(endpoint);
   pn_free(conn->delivery_pool);
+  pn_buffer_pool_free(conn->buffer_pool);
+  pn_free(conn->symbols);
 }
 
 #define pn_connection_initialize NULL
@@ -495,13 +596,14 @@ pn_connection_t *pn_connection(void)
   conn->endpoint_head = NULL;
   conn->endpoint_tail = NULL;
   pn_endpoint_init(&conn->endpoint, CONNECTION, conn);
-  conn->transport_head = NULL;
-  conn->transport_tail = NULL;
+  memset(&conn->modified_connection, 0, sizeof(pni_transport_queue_t));
+  memset(&conn->modified_sessions, 0, sizeof(pni_transport_queue_t));
+  memset(&conn->modified_links, 0, sizeof(pni_transport_queue_t));
   conn->sessions = pn_list(PN_WEAKREF, 0);
   conn->freed = pn_list(PN_WEAKREF, 0);
   conn->transport = NULL;
-  conn->work_head = NULL;
-  conn->work_tail = NULL;
+  conn->worklink_head = NULL;
+  conn->worklink_tail = NULL;
   conn->tpwork_head = NULL;
   conn->tpwork_tail = NULL;
   conn->container = pn_string(NULL);
@@ -512,6 +614,13 @@ pn_connection_t *pn_connection(void)
   conn->collector = NULL;
   conn->context = pn_record();
   conn->delivery_pool = pn_list(PN_OBJECT, 0);
+  conn->buffer_pool = pn_buffer_pool();
+  conn->symbols = pni_symtab();
+  conn->incoming_bytes = 0;
+  conn->incoming_budget = 0;
+  conn->budget_stalled = false;
+  conn->dispatch_round = 0;
+  conn->dispatched = 0;
 
   return conn;
 }
@@ -616,20 +725,52 @@ const char *pn_connection_remote_hostname(pn_connection_t *connection)
   return connection->transport ? connection->transport->remote_hostname : NULL;
 }
 
+// the work list is kept per link, with the links that have any listed
+// on the connection, so one link's work is found without walking the rest
+
 pn_delivery_t *pn_work_head(pn_connection_t *connection)
 {
   assert(connection);
-  return connection->work_head;
+  return connection->worklink_head ? connection->worklink_head->work_head : NULL;
 }
 
 pn_delivery_t *pn_work_next(pn_delivery_t *delivery)
 {
   assert(delivery);
 
-  if (delivery->work)
-    return delivery->work_next;
-  else
+  if (!delivery->work)
     return pn_work_head(delivery->link->session->connection);
+  if (delivery->work_next)
+    return delivery->work_next;
+  pn_link_t *next = delivery->link->worklink_next;
+  return next ? next->work_head : NULL;
+}
+
+pn_link_t *pn_work_link_head(pn_connection_t *connection)
+{
+  assert(connection);
+  return connection->worklink_head;
+}
+
+pn_link_t *pn_work_link_next(pn_link_t *link)
+{
+  assert(link);
+  // a link taken off the list since starts the walk over
+  if (!link->work_head)
+    return link->session->connection->worklink_head;
+  return link->worklink_next;
+}
+
+pn_delivery_t *pn_link_work_head(pn_link_t *link)
+{
+  assert(link);
+  return link->work_head;
+}
+
+pn_delivery_t *pn_link_work_next(pn_delivery_t *delivery)
+{
+  assert(delivery);
+  return delivery->work ? delivery->work_next : delivery->link->work_head;
 }
 
 void pn_add_work(pn_connection_t *connection, pn_delivery_t *delivery)
@@ -637,7 +778,9 @@ void pn_add_work(pn_connection_t *connection, pn_delivery_t *delivery)
   if (!delivery->work)
   {
     assert(!delivery->local.settled);   // never allow settled deliveries
-    LL_ADD(connection, work, delivery);
+    pn_link_t *link = delivery->link;
+    if (!link->work_head) LL_ADD(connection, worklink, link);
+    LL_ADD(link, work, delivery);
     delivery->work = true;
   }
 }
@@ -646,7 +789,9 @@ void pn_clear_work(pn_connection_t *connection, pn_delivery_t *delivery)
 {
   if (delivery->work)
   {
-    LL_REMOVE(connection, work, delivery);
+    pn_link_t *link = delivery->link;
+    LL_REMOVE(link, work, delivery);
+    if (!link->work_head) LL_REMOVE(connection, worklink, link);
     delivery->work = false;
   }
 }
@@ -697,23 +842,44 @@ void pn_clear_tpwork(pn_delivery_t *delivery)
   }
 }
 
-void pn_dump(pn_connection_t *conn)
+static pni_transport_queue_t *pni_transport_queue(pn_connection_t *connection, pn_endpoint_t *endpoint)
+{
+  switch (endpoint->type) {
+  case CONNECTION:
+    return &connection->modified_connection;
+  case SESSION:
+    return &connection->modified_sessions;
+  default:
+    return &connection->modified_links;
+  }
+}
+
+static const char *pni_dump_queue(pni_transport_queue_t *queue, const char *sep)
 {
-  pn_endpoint_t *endpoint = conn->transport_head;
+  pn_endpoint_t *endpoint = queue->transport_head;
   while (endpoint)
   {
-    printf("%p", (void *) endpoint);
+    printf("%s%p", sep, (void *) endpoint);
     endpoint = endpoint->transport_next;
-    if (endpoint)
-      printf(" -> ");
+    sep = " -> ";
   }
+  return sep;
+}
+
+void pn_dump(pn_connection_t *conn)
+{
+  const char *sep = "";
+  sep = pni_dump_queue(&conn->modified_connection, sep);
+  sep = pni_dump_queue(&conn->modified_sessions, sep);
+  pni_dump_queue(&conn->modified_links, sep);
   printf("\n");
 }
 
 void pn_modified(pn_connection_t *connection, pn_endpoint_t *endpoint, bool emit)
 {
   if (!endpoint->modified) {
-    LL_ADD(connection, transport, endpoint);
+    pni_transport_queue_t *queue = pni_transport_queue(connection, endpoint);
+    LL_ADD(queue, transport, endpoint);
     endpoint->modified = true;
   }
 
@@ -726,7 +892,8 @@ void pn_modified(pn_connection_t *connection, pn_endpoint_t *endpoint, bool emit
 void pn_clear_modified(pn_connection_t *connection, pn_endpoint_t *endpoint)
 {
   if (endpoint->modified) {
-    LL_REMOVE(connection, transport, endpoint);
+    pni_transport_queue_t *queue = pni_transport_queue(connection, endpoint);
+    LL_REMOVE(queue, transport, endpoint);
     endpoint->transport_next = NULL;
     endpoint->transport_prev = NULL;
     endpoint->modified = false;
@@ -879,7 +1046,8 @@ static bool pni_preserve_child(pn_endpoint_t *endpoint)
     pn_decref(parent);
     return true;
   } else {
-    LL_REMOVE(conn, transport, endpoint);
+    pni_transport_queue_t *queue = pni_transport_queue(conn, endpoint);
+    LL_REMOVE(queue, transport, endpoint);
     return false;
   }
 }
@@ -895,18 +1063,19 @@ static void pn_session_finalize(void *object)
 
   pn_free(session->context);
   pni_free_children(session->links, session->freed);
+  pn_free(session->link_names);
   pn_endpoint_tini(endpoint);
   pn_delivery_map_free(&session->state.incoming);
   pn_delivery_map_free(&session->state.outgoing);
-  pn_free(session->state.local_handles);
-  pn_free(session->state.remote_handles);
+  pn_alias_map_free(&session->state.local_handles);
+  pn_alias_map_free(&session->state.remote_handles);
   pn_remove_session(session->connection, session);
   pn_list_remove(session->connection->freed, session);
 
   if (session->connection->transport) {
     pn_transport_t *transport = session->connection->transport;
-    pn_hash_del(transport->local_channels, session->state.local_channel);
-    pn_hash_del(transport->remote_channels, session->state.remote_channel);
+    pn_alias_map_del(&transport->local_channels, session->state.local_channel);
+    pn_alias_map_del(&transport->remote_channels, session->state.remote_channel);
   }
 
   if (endpoint->referenced) {
@@ -914,7 +1083,9 @@ static void pn_session_finalize(void *object)
   }
 }
 
-#define pn_session_new pn_object_new
+PN_POOL(pn_session, 16)
+
+#define pn_session_new pn_session_pool_new
 #define pn_session_refcount pn_object_refcount
 #define pn_session_decref pn_object_decref
 #define pn_session_reify pn_object_reify
@@ -926,7 +1097,7 @@ static void pn_session_finalize(void *object)
 pn_session_t *pn_session(pn_connection_t *conn)
 {
   assert(conn);
-#define pn_session_free pn_object_free
+#define pn_session_free pn_session_pool_free
   static const pn_class_t clazz = PN_METACLASS(pn_session);
 #undef pn_session_free
   pn_session_t *ssn = (pn_session_t *) pn_class_new(&clazz, sizeof(pn_session_t));
@@ -935,13 +1106,20 @@ pn_session_t *pn_session(pn_connection_t *conn)
   pn_endpoint_init(&ssn->endpoint, SESSION, conn);
   pn_add_session(conn, ssn);
   ssn->links = pn_list(PN_WEAKREF, 0);
+  ssn->link_names = pn_hash(PN_WEAKREF, 0, 0.75);
   ssn->freed = pn_list(PN_WEAKREF, 0);
   ssn->context = pn_record();
-  ssn->incoming_capacity = 1024*1024;
+  ssn->incoming_capacity = 0;
+  ssn->incoming_base_capacity = ssn->incoming_capacity;
+  ssn->incoming_max_capacity = 0;
+  ssn->incoming_low_water = 0;
+  ssn->outgoing_high_water = 0;
   ssn->incoming_bytes = 0;
   ssn->outgoing_bytes = 0;
   ssn->incoming_deliveries = 0;
   ssn->outgoing_deliveries = 0;
+  memset(&ssn->metrics, 0, sizeof(ssn->metrics));
+  ssn->window_stalled = false;
 
   // begin transport state
   memset(&ssn->state, 0, sizeof(ssn->state));
@@ -949,8 +1127,8 @@ pn_session_t *pn_session(pn_connection_t *conn)
   ssn->state.remote_channel = (uint16_t)-1;
   pn_delivery_map_init(&ssn->state.incoming, 0);
   pn_delivery_map_init(&ssn->state.outgoing, 0);
-  ssn->state.local_handles = pn_hash(PN_WEAKREF, 0, 0.75);
-  ssn->state.remote_handles = pn_hash(PN_WEAKREF, 0, 0.75);
+  pn_alias_map_init(&ssn->state.local_handles, true);
+  pn_alias_map_init(&ssn->state.remote_handles, false);
   // end transport state
 
   pn_collector_put(conn->collector, PN_OBJECT, ssn, PN_SESSION_INIT);
@@ -975,7 +1153,7 @@ void pn_session_unbound(pn_session_t* ssn)
   assert(ssn);
   ssn->state.local_channel = (uint16_t)-1;
   ssn->state.remote_channel = (uint16_t)-1;
-  ssn->incoming_bytes = 0;
+  pni_session_released(ssn, ssn->incoming_bytes);
   ssn->outgoing_bytes = 0;
   ssn->incoming_deliveries = 0;
   ssn->outgoing_deliveries = 0;
@@ -992,6 +1170,59 @@ void pn_session_set_incoming_capacity(pn_session_t *ssn, size_t capacity)
   assert(ssn);
   // XXX: should this trigger a flow?
   ssn->incoming_capacity = capacity;
+  ssn->incoming_base_capacity = capacity;
+  if (ssn->incoming_max_capacity && ssn->incoming_max_capacity < capacity) {
+    ssn->incoming_max_capacity = capacity;
+  }
+}
+
+size_t pn_session_get_incoming_low_water(pn_session_t *ssn)
+{
+  assert(ssn);
+  return ssn->incoming_low_water;
+}
+
+void pn_session_set_incoming_low_water(pn_session_t *ssn, size_t low_water)
+{
+  assert(ssn);
+  ssn->incoming_low_water = low_water;
+}
+
+size_t pn_session_get_outgoing_high_water(pn_session_t *ssn)
+{
+  assert(ssn);
+  return ssn->outgoing_high_water;
+}
+
+void pn_session_set_outgoing_high_water(pn_session_t *ssn, size_t high_water)
+{
+  assert(ssn);
+  ssn->outgoing_high_water = high_water;
+}
+
+size_t pn_session_get_incoming_autotune(pn_session_t *ssn)
+{
+  assert(ssn);
+  return ssn->incoming_max_capacity;
+}
+
+void pn_session_set_incoming_autotune(pn_session_t *ssn, size_t max_capacity)
+{
+  assert(ssn);
+  if (max_capacity) {
+    ssn->incoming_max_capacity = pn_max(max_capacity, ssn->incoming_base_capacity);
+  } else {
+    ssn->incoming_max_capacity = 0;
+    ssn->incoming_capacity = ssn->incoming_base_capacity;
+  }
+}
+
+void pn_session_metrics(pn_session_t *ssn, pn_session_metrics_t *metrics)
+{
+  assert(ssn);
+  *metrics = ssn->metrics;
+  metrics->incoming_bytes = ssn->incoming_bytes;
+  metrics->outgoing_bytes = ssn->outgoing_bytes;
 }
 
 size_t pn_session_outgoing_bytes(pn_session_t *ssn)
@@ -1061,17 +1292,20 @@ static void pn_link_finalize(void *object)
   pn_terminus_free(&link->target);
   pn_terminus_free(&link->remote_source);
   pn_terminus_free(&link->remote_target);
-  pn_free(link->name);
+  pn_decref(link->name);
+  pni_free(PN_ALLOC_ENGINE, link->latency);
   pn_endpoint_tini(endpoint);
   pn_remove_link(link->session, link);
-  pn_hash_del(link->session->state.local_handles, link->state.local_handle);
-  pn_hash_del(link->session->state.remote_handles, link->state.remote_handle);
+  pn_alias_map_del(&link->session->state.local_handles, link->state.local_handle);
+  pn_alias_map_del(&link->session->state.remote_handles, link->state.remote_handle);
   pn_list_remove(link->session->freed, link);
   if (endpoint->referenced) {
     pn_decref(link->session);
   }
 }
 
+PN_POOL(pn_link, 64)
+
 #define pn_link_refcount pn_object_refcount
 #define pn_link_decref pn_object_decref
 #define pn_link_reify pn_object_reify
@@ -1082,28 +1316,33 @@ static void pn_link_finalize(void *object)
 
 pn_link_t *pn_link_new(int type, pn_session_t *session, const char *name)
 {
-#define pn_link_new pn_object_new
-#define pn_link_free pn_object_free
+#define pn_link_new pn_link_pool_new
+#define pn_link_free pn_link_pool_free
   static const pn_class_t clazz = PN_METACLASS(pn_link);
 #undef pn_link_new
 #undef pn_link_free
   pn_link_t *link = (pn_link_t *) pn_class_new(&clazz, sizeof(pn_link_t));
 
   pn_endpoint_init(&link->endpoint, type, session->connection);
+  // interned so that attaches can find the link by comparing pointers
+  link->name = pni_intern(session->connection->symbols,
+                          pn_bytes(name ? strlen(name) : 0, name));
   pn_add_link(session, link);
   pn_incref(session);  // keep session until link finalized
-  link->name = pn_string(name);
   pn_terminus_init(&link->source, PN_SOURCE);
   pn_terminus_init(&link->target, PN_TARGET);
   pn_terminus_init(&link->remote_source, PN_UNSPECIFIED);
   pn_terminus_init(&link->remote_target, PN_UNSPECIFIED);
   link->unsettled_head = link->unsettled_tail = link->current = NULL;
+  link->work_head = link->work_tail = NULL;
+  link->worklink_next = link->worklink_prev = NULL;
   link->unsettled_count = 0;
   link->available = 0;
   link->credit = 0;
   link->queued = 0;
   link->drain = false;
   link->drain_flag_mode = true;
+  link->incoming_high_water = 0;
   link->drained = 0;
   link->context = pn_record();
   link->snd_settle_mode = PN_SND_MIXED;
@@ -1111,6 +1350,9 @@ pn_link_t *pn_link_new(int type, pn_session_t *session, const char *name)
   link->remote_snd_settle_mode = PN_SND_MIXED;
   link->remote_rcv_settle_mode = PN_RCV_FIRST;
   link->detached = false;
+  memset(&link->metrics, 0, sizeof(link->metrics));
+  link->latency = NULL;
+  link->credit_stalled = false;
 
   // begin transport state
   link->state.local_handle = -1;
@@ -1182,6 +1424,8 @@ const char *pn_terminus_get_address(pn_terminus_t *terminus)
 int pn_terminus_set_address(pn_terminus_t *terminus, const char *address)
 {
   assert(terminus);
+  int err = pni_unshare(&terminus->address);
+  if (err) return err;
   return pn_string_set(terminus->address, address);
 }
 
@@ -1356,6 +1600,80 @@ static bool pni_preserve_delivery(pn_delivery_t *delivery)
   return !delivery->local.settled || (conn->transport && (delivery->state.init || delivery->tpwork));
 }
 
+static void pni_delivery_clear_segments(pn_delivery_t *delivery)
+{
+  for (size_t i = delivery->segment_head; i < delivery->segment_count; i++) {
+    pn_buffer_free(delivery->segments[i]);
+  }
+  delivery->segment_head = 0;
+  delivery->segment_count = 0;
+  delivery->segment_bytes = 0;
+}
+
+// retire the buffer being filled to the segment list and carry on in a
+// fresh one of the given capacity
+static void pni_delivery_push_segment(pn_delivery_t *delivery, size_t capacity)
+{
+  pn_buffer_t *tail = delivery->bytes;
+  pn_buffer_pool_t *pool = delivery->link->session->connection->buffer_pool;
+  if (pn_buffer_size(tail)) {
+    PN_ENSURE(PN_ALLOC_ENGINE, delivery->segments, delivery->segment_capacity, delivery->segment_count + 1, pn_buffer_t *);
+    delivery->segments[delivery->segment_count++] = tail;
+    delivery->segment_bytes += pn_buffer_size(tail);
+  } else {
+    pn_buffer_free(tail);
+  }
+  delivery->bytes = pn_buffer_pooled(pool, capacity);
+}
+
+void pni_delivery_append(pn_delivery_t *delivery, const char *bytes, size_t size)
+{
+  pn_buffer_t *tail = delivery->bytes;
+  if (pn_buffer_available(tail) < size && pn_buffer_size(tail) + size > PNI_SEGMENT_SIZE) {
+    pni_delivery_push_segment(delivery, pn_max(size, (size_t) PNI_SEGMENT_SIZE));
+  }
+  pn_buffer_append(delivery->bytes, bytes, size);
+}
+
+// the buffer that incoming data is read from first
+static pn_buffer_t *pni_delivery_front(pn_delivery_t *delivery)
+{
+  if (delivery->segment_head < delivery->segment_count) {
+    return delivery->segments[delivery->segment_head];
+  } else {
+    return delivery->bytes;
+  }
+}
+
+static void pni_delivery_trim(pn_delivery_t *delivery, size_t size)
+{
+  while (size && delivery->segment_head < delivery->segment_count) {
+    pn_buffer_t *segment = delivery->segments[delivery->segment_head];
+    size_t n = pn_min(size, pn_buffer_size(segment));
+    pn_buffer_trim(segment, n, 0);
+    delivery->segment_bytes -= n;
+    size -= n;
+    if (!pn_buffer_size(segment)) {
+      pn_buffer_free(segment);
+      delivery->segment_head++;
+    }
+  }
+  if (delivery->segment_head == delivery->segment_count) {
+    delivery->segment_head = 0;
+    delivery->segment_count = 0;
+  }
+  pn_buffer_trim(delivery->bytes, size, 0);
+}
+
+static void pni_delivery_close_file(pn_delivery_t *delivery)
+{
+  if (delivery->file) {
+    pni_file_range_close(delivery->file);
+    delivery->file = NULL;
+    delivery->adopted = pn_bytes(0, NULL);
+  }
+}
+
 static void pn_delivery_finalize(void *object)
 {
   pn_delivery_t *delivery = (pn_delivery_t *) object;
@@ -1374,13 +1692,17 @@ static void pn_delivery_finalize(void *object)
     referenced = delivery->referenced;
 
     pn_clear_tpwork(delivery);
+    pn_clear_work(link->session->connection, delivery);
     LL_REMOVE(link, unsettled, delivery);
     pn_delivery_map_del(pn_link_is_sender(link)
                         ? &link->session->state.outgoing
                         : &link->session->state.incoming,
                         delivery);
-    pn_buffer_clear(delivery->tag);
+    delivery->tag = pn_bytes(0, NULL);
     pn_buffer_clear(delivery->bytes);
+    pni_delivery_clear_segments(delivery);
+    pni_delivery_release(delivery);
+    pni_delivery_close_file(delivery);
     pn_record_clear(delivery->context);
     delivery->settled = true;
     pn_connection_t *conn = link->session->connection;
@@ -1395,9 +1717,13 @@ static void pn_delivery_finalize(void *object)
   }
 
   if (!pooled) {
+    pni_delivery_release(delivery);
+    pni_delivery_close_file(delivery);
     pn_free(delivery->context);
-    pn_buffer_free(delivery->tag);
+    pni_free(PN_ALLOC_ENGINE, delivery->tag_heap);
     pn_buffer_free(delivery->bytes);
+    pni_delivery_clear_segments(delivery);
+    pni_free(PN_ALLOC_ENGINE, delivery->segments);
     pn_disposition_finalize(&delivery->local);
     pn_disposition_finalize(&delivery->remote);
   }
@@ -1407,10 +1733,12 @@ static void pn_delivery_finalize(void *object)
   }
 }
 
+// the data and annotations are only needed by outcomes other than
+// accepted and released, so are created when first used
 static void pn_disposition_init(pn_disposition_t *ds)
 {
-  ds->data = pn_data(0);
-  ds->annotations = pn_data(0);
+  ds->data = NULL;
+  ds->annotations = NULL;
   pn_condition_init(&ds->condition);
 }
 
@@ -1427,6 +1755,23 @@ static void pn_disposition_clear(pn_disposition_t *ds)
   pn_condition_clear(&ds->condition);
 }
 
+static int pni_delivery_set_tag(pn_delivery_t *delivery, pn_delivery_tag_t tag)
+{
+  char *dst = delivery->tag_inline;
+  if (tag.size > PNI_TAG_INLINE) {
+    if (tag.size > delivery->tag_capacity) {
+      char *heap = (char *) pni_realloc(PN_ALLOC_ENGINE, delivery->tag_heap, tag.size);
+      if (!heap) return PN_ERR;
+      delivery->tag_heap = heap;
+      delivery->tag_capacity = tag.size;
+    }
+    dst = delivery->tag_heap;
+  }
+  if (tag.size) memcpy(dst, tag.start, tag.size);
+  delivery->tag = pn_bytes(tag.size, dst);
+  return 0;
+}
+
 #define pn_delivery_new pn_object_new
 #define pn_delivery_refcount pn_object_refcount
 #define pn_delivery_decref pn_object_decref
@@ -1446,8 +1791,19 @@ pn_delivery_t *pn_delivery(pn_link_t *link, pn_delivery_tag_t tag)
     static const pn_class_t clazz = PN_METACLASS(pn_delivery);
     delivery = (pn_delivery_t *) pn_class_new(&clazz, sizeof(pn_delivery_t));
     if (!delivery) return NULL;
-    delivery->tag = pn_buffer(16);
-    delivery->bytes = pn_buffer(64);
+    pn_buffer_pool_t *buffers = link->session->connection->buffer_pool;
+    delivery->tag_heap = NULL;
+    delivery->tag_capacity = 0;
+    delivery->bytes = pn_buffer_pooled(buffers, 64);
+    delivery->segments = NULL;
+    delivery->segment_head = 0;
+    delivery->segment_count = 0;
+    delivery->segment_capacity = 0;
+    delivery->segment_bytes = 0;
+    delivery->adopted = pn_bytes(0, NULL);
+    delivery->release = NULL;
+    delivery->release_context = NULL;
+    delivery->file = NULL;
     pn_disposition_init(&delivery->local);
     pn_disposition_init(&delivery->remote);
     delivery->context = pn_record();
@@ -1456,8 +1812,9 @@ pn_delivery_t *pn_delivery(pn_link_t *link, pn_delivery_tag_t tag)
   }
   delivery->link = link;
   pn_incref(delivery->link);  // keep link until finalized
-  pn_buffer_clear(delivery->tag);
-  pn_buffer_append(delivery->tag, tag.start, tag.size);
+  if (pni_delivery_set_tag(delivery, tag)) {
+    delivery->tag = pn_bytes(0, NULL);
+  }
   pn_disposition_clear(&delivery->local);
   pn_disposition_clear(&delivery->remote);
   delivery->updated = false;
@@ -1472,6 +1829,8 @@ pn_delivery_t *pn_delivery(pn_link_t *link, pn_delivery_tag_t tag)
   delivery->tpwork = false;
   pn_buffer_clear(delivery->bytes);
   delivery->done = false;
+  delivery->stamp = 0;
+  delivery->message_format = 0;
   pn_record_clear(delivery->context);
 
   // begin delivery state
@@ -1501,7 +1860,7 @@ bool pn_delivery_buffered(pn_delivery_t *delivery)
     if (state->sent) {
       return false;
     } else {
-      return delivery->done || (pn_buffer_size(delivery->bytes) > 0);
+      return delivery->done || pn_delivery_pending(delivery) > 0;
     }
   } else {
     return false;
@@ -1540,7 +1899,7 @@ bool pn_is_current(pn_delivery_t *delivery)
 void pn_delivery_dump(pn_delivery_t *d)
 {
   char tag[1024];
-  pn_bytes_t bytes = pn_buffer_bytes(d->tag);
+  pn_bytes_t bytes = d->tag;
   pn_quote_data(tag, 1024, bytes.start, bytes.size);
   printf("{tag=%s, local.type=%" PRIu64 ", remote.type=%" PRIu64 ", local.settled=%u, "
          "remote.settled=%u, updated=%u, current=%u, writable=%u, readable=%u, "
@@ -1577,6 +1936,9 @@ uint64_t pn_disposition_type(pn_disposition_t *disposition)
 pn_data_t *pn_disposition_data(pn_disposition_t *disposition)
 {
   assert(disposition);
+  if (!disposition->data) {
+    disposition->data = pn_data(0);
+  }
   return disposition->data;
 }
 
@@ -1631,6 +1993,9 @@ void pn_disposition_set_undeliverable(pn_disposition_t *disposition, bool undeli
 pn_data_t *pn_disposition_annotations(pn_disposition_t *disposition)
 {
   assert(disposition);
+  if (!disposition->annotations) {
+    disposition->annotations = pn_data(0);
+  }
   return disposition->annotations;
 }
 
@@ -1643,13 +2008,24 @@ pn_condition_t *pn_disposition_condition(pn_disposition_t *disposition)
 pn_delivery_tag_t pn_delivery_tag(pn_delivery_t *delivery)
 {
   if (delivery) {
-    pn_bytes_t tag = pn_buffer_bytes(delivery->tag);
-    return pn_dtag(tag.start, tag.size);
+    return pn_dtag(delivery->tag.start, delivery->tag.size);
   } else {
     return pn_dtag(0, 0);
   }
 }
 
+uint32_t pn_delivery_message_format(pn_delivery_t *delivery)
+{
+  assert(delivery);
+  return delivery->message_format;
+}
+
+void pn_delivery_set_message_format(pn_delivery_t *delivery, uint32_t format)
+{
+  assert(delivery);
+  delivery->message_format = format;
+}
+
 pn_delivery_t *pn_link_current(pn_link_t *link)
 {
   if (!link) return NULL;
@@ -1658,6 +2034,7 @@ pn_delivery_t *pn_link_current(pn_link_t *link)
 
 void pn_advance_sender(pn_link_t *link)
 {
+  if (link->latency) link->current->stamp = pn_i_nanos();
   link->current->done = true;
   link->queued++;
   link->credit--;
@@ -1673,10 +2050,11 @@ void pn_advance_receiver(pn_link_t *link)
   link->session->incoming_deliveries--;
 
   pn_delivery_t *current = link->current;
-  link->session->incoming_bytes -= pn_buffer_size(current->bytes);
+  pni_session_released(link->session, pn_delivery_pending(current));
   pn_buffer_clear(current->bytes);
+  pni_delivery_clear_segments(current);
 
-  if (!link->session->state.incoming_window) {
+  if (pni_session_window_low(link->session)) {
     pn_add_tpwork(current);
   }
 
@@ -1701,11 +2079,59 @@ bool pn_link_advance(pn_link_t *link)
   }
 }
 
+void pn_link_metrics(pn_link_t *link, pn_link_metrics_t *metrics)
+{
+  assert(link);
+  *metrics = link->metrics;
+}
+
+void pn_link_track_latency(pn_link_t *link, bool track)
+{
+  assert(link);
+  if (track && !link->latency) {
+    link->latency = (pn_link_latency_t *) pni_calloc(PN_ALLOC_ENGINE, 1, sizeof(pn_link_latency_t));
+  } else if (!track && link->latency) {
+    pni_free(PN_ALLOC_ENGINE, link->latency);
+    link->latency = NULL;
+    // deliveries on their way are no longer timed
+    for (pn_delivery_t *d = link->unsettled_head; d; d = d->unsettled_next) {
+      d->stamp = 0;
+    }
+  }
+}
+
+bool pn_link_latency(pn_link_t *link, pn_link_latency_t *latency)
+{
+  assert(link);
+  if (!link->latency) return false;
+  *latency = *link->latency;
+  return true;
+}
+
+void pni_delivery_stage(pn_delivery_t *delivery, pn_histogram_t *histogram, bool next)
+{
+  uint64_t now = pn_i_nanos();
+  pni_histogram_add(histogram, (now - delivery->stamp) / 1000);
+  delivery->stamp = next ? now : 0;
+}
+
 int pn_link_credit(pn_link_t *link)
 {
   return link ? link->credit : 0;
 }
 
+size_t pn_link_get_incoming_high_water(pn_link_t *receiver)
+{
+  assert(receiver);
+  return receiver->incoming_high_water;
+}
+
+void pn_link_set_incoming_high_water(pn_link_t *receiver, size_t high_water)
+{
+  assert(receiver);
+  receiver->incoming_high_water = high_water;
+}
+
 int pn_link_available(pn_link_t *link)
 {
   return link ? link->available : 0;
@@ -1770,6 +2196,9 @@ void pn_delivery_settle(pn_delivery_t *delivery)
     if (pn_is_current(delivery)) {
       pn_link_advance(link);
     }
+    if (delivery->stamp && link->endpoint.type == RECEIVER) {
+      pni_delivery_stage(delivery, &link->latency->processing, false);
+    }
 
     link->unsettled_count--;
     delivery->local.settled = true;
@@ -1780,22 +2209,150 @@ void pn_delivery_settle(pn_delivery_t *delivery)
   }
 }
 
+size_t pn_link_settle_upto(pn_link_t *link, pn_delivery_t *last, uint64_t state)
+{
+  assert(link);
+  assert(last);
+  assert(last->link == link);
+  // a delivery the transport has finished with is no longer listed
+  if (last->settled) return 0;
+
+  pn_connection_t *connection = link->session->connection;
+  size_t count = 0;
+  pn_delivery_t *delivery = link->unsettled_head;
+  while (delivery) {
+    pn_delivery_t *next = delivery == last ? NULL : delivery->unsettled_next;
+    if (!delivery->local.settled) {
+      if (pn_is_current(delivery)) {
+        pn_link_advance(link);
+      }
+      if (state) {
+        delivery->local.type = state;
+      }
+      if (delivery->stamp && link->endpoint.type == RECEIVER) {
+        pni_delivery_stage(delivery, &link->latency->processing, false);
+      }
+      link->unsettled_count--;
+      delivery->local.settled = true;
+      // queued in id order, so the transport can send one ranged
+      // disposition for the whole run
+      if (!delivery->tpwork) {
+        LL_ADD(connection, tpwork, delivery);
+        delivery->tpwork = true;
+      }
+      pn_clear_work(connection, delivery);
+      pn_incref(delivery);
+      pn_decref(delivery);
+      count++;
+    }
+    delivery = next;
+  }
+
+  if (count) {
+    pn_modified(connection, &connection->endpoint, true);
+  }
+  return count;
+}
+
 void pn_link_offered(pn_link_t *sender, int credit)
 {
   sender->available = credit;
 }
 
+void pni_delivery_release(pn_delivery_t *delivery)
+{
+  pn_link_release_t release = delivery->release;
+  if (release) {
+    void *context = delivery->release_context;
+    delivery->adopted = pn_bytes(0, NULL);
+    delivery->release = NULL;
+    delivery->release_context = NULL;
+    release(context);
+  }
+}
+
+// read the next window of a file body into adopted once the last one
+// has gone out, closing the file after its last
+int pni_delivery_refill(pn_delivery_t *delivery)
+{
+  if (!delivery->file || delivery->adopted.size) return 0;
+  if (!pni_file_range_remaining(delivery->file)) {
+    pni_delivery_close_file(delivery);
+    return 0;
+  }
+  return pni_file_range_next(delivery->file, &delivery->adopted);
+}
+
+// keep the bytes in order by copying in what is left of an adopted
+// buffer before anything is queued behind it
+static void pni_delivery_spill(pn_delivery_t *delivery)
+{
+  if (delivery->release) {
+    pn_buffer_append(delivery->bytes, delivery->adopted.start, delivery->adopted.size);
+    pni_delivery_release(delivery);
+  }
+}
+
 ssize_t pn_link_send(pn_link_t *sender, const char *bytes, size_t n)
 {
   pn_delivery_t *current = pn_link_current(sender);
   if (!current) return PN_EOS;
+  if (current->file) return PN_STATE_ERR;
   if (!bytes || !n) return 0;
+  pni_delivery_spill(current);
   pn_buffer_append(current->bytes, bytes, n);
   sender->session->outgoing_bytes += n;
   pn_add_tpwork(current);
   return n;
 }
 
+ssize_t pn_link_adopt(pn_link_t *sender, const char *bytes, size_t n,
+                      pn_link_release_t release, void *context)
+{
+  if (!release) return PN_ARG_ERR;
+  pn_delivery_t *current = pn_link_current(sender);
+  if (!current) return PN_EOS;
+  if (current->file) return PN_STATE_ERR;
+  if (!bytes || !n) return 0;
+  pni_delivery_spill(current);
+  current->adopted = pn_bytes(n, bytes);
+  current->release = release;
+  current->release_context = context;
+  sender->session->outgoing_bytes += n;
+  pn_add_tpwork(current);
+  return n;
+}
+
+static void pni_payload_release(void *payload)
+{
+  pn_decref(payload);
+}
+
+ssize_t pn_link_send_shared(pn_link_t *sender, pn_string_t *payload)
+{
+  if (!payload) return PN_ARG_ERR;
+  pn_incref(payload);
+  ssize_t n = pn_link_adopt(sender, pn_string_get(payload), pn_string_size(payload),
+                            pni_payload_release, payload);
+  if (n <= 0) pn_decref(payload);
+  return n;
+}
+
+ssize_t pn_link_send_file(pn_link_t *sender, int fd, int64_t offset, size_t size)
+{
+  pn_delivery_t *current = pn_link_current(sender);
+  if (!current) return PN_EOS;
+  if (current->file) return PN_STATE_ERR;
+  if (!size) return 0;
+  pni_file_range_t *file = pni_file_range(fd, offset, size);
+  if (!file) return errno == EINVAL ? PN_ARG_ERR : PN_ERR;
+  // read once what is queued ahead of it has gone out
+  current->file = file;
+  sender->session->outgoing_bytes += size;
+  pn_add_tpwork(current);
+  return size;
+}
+
 int pn_link_drained(pn_link_t *link)
 {
   assert(link);
@@ -1816,19 +2373,65 @@ int pn_link_drained(pn_link_t *link)
   return drained;
 }
 
+static void pni_link_consumed(pn_link_t *receiver, pn_delivery_t *delivery, size_t size)
+{
+  pni_delivery_trim(delivery, size);
+  pni_session_released(receiver->session, size);
+  if (pni_session_window_low(receiver->session)) {
+    pn_add_tpwork(delivery);
+  }
+}
+
 ssize_t pn_link_recv(pn_link_t *receiver, char *bytes, size_t n)
 {
   if (!receiver) return PN_ARG_ERR;
 
   pn_delivery_t *delivery = receiver->current;
   if (delivery) {
-    size_t size = pn_buffer_get(delivery->bytes, 0, n, bytes);
-    pn_buffer_trim(delivery->bytes, size, 0);
+    size_t size = 0;
+    for (size_t i = delivery->segment_head; i < delivery->segment_count && size < n; i++) {
+      size += pn_buffer_get(delivery->segments[i], 0, n - size, bytes + size);
+    }
+    size += pn_buffer_get(delivery->bytes, 0, n - size, bytes + size);
     if (size) {
-      receiver->session->incoming_bytes -= size;
-      if (!receiver->session->state.incoming_window) {
-        pn_add_tpwork(delivery);
-      }
+      pni_link_consumed(receiver, delivery, size);
+      return size;
+    } else {
+      return delivery->done ? PN_EOS : 0;
+    }
+  } else {
+    return PN_STATE_ERR;
+  }
+}
+
+ssize_t pn_link_recv_peek(pn_link_t *receiver, pn_bytes_t *head, pn_bytes_t *wrap)
+{
+  if (!receiver || !head || !wrap) return PN_ARG_ERR;
+
+  pn_delivery_t *delivery = receiver->current;
+  if (delivery) {
+    size_t size = pn_buffer_segments(pni_delivery_front(delivery), head, wrap);
+    if (size) {
+      return size;
+    } else {
+      return delivery->done ? PN_EOS : 0;
+    }
+  } else {
+    *head = pn_bytes(0, NULL);
+    *wrap = pn_bytes(0, NULL);
+    return PN_STATE_ERR;
+  }
+}
+
+ssize_t pn_link_recv_consume(pn_link_t *receiver, size_t n)
+{
+  if (!receiver) return PN_ARG_ERR;
+
+  pn_delivery_t *delivery = receiver->current;
+  if (delivery) {
+    size_t size = pn_min(n, pn_delivery_pending(delivery));
+    if (size) {
+      pni_link_consumed(receiver, delivery, size);
       return size;
     } else {
       return delivery->done ? PN_EOS : 0;
@@ -1925,6 +2528,9 @@ void pn_delivery_update(pn_delivery_t *delivery, uint64_t state)
 {
   if (!delivery) return;
   delivery->local.type = state;
+  if (delivery->stamp && delivery->link->endpoint.type == RECEIVER) {
+    pni_delivery_stage(delivery, &delivery->link->latency->processing, false);
+  }
   pn_add_tpwork(delivery);
 }
 
@@ -1948,7 +2554,52 @@ bool pn_delivery_readable(pn_delivery_t *delivery)
 
 size_t pn_delivery_pending(pn_delivery_t *delivery)
 {
-  return pn_buffer_size(delivery->bytes);
+  return delivery->segment_bytes + pn_buffer_size(delivery->bytes) + delivery->adopted.size +
+    (delivery->file ? pni_file_range_remaining(delivery->file) : 0);
+}
+
+pn_bytes_t pn_delivery_pending_bytes(pn_delivery_t *delivery)
+{
+  assert(delivery);
+  if (delivery->segment_count) {
+    // a single view needs the segments gathered into one buffer
+    pn_buffer_t *tail = delivery->bytes;
+    pn_buffer_ensure(tail, delivery->segment_bytes);
+    for (size_t i = delivery->segment_count; i > delivery->segment_head; i--) {
+      pn_bytes_t segment = pn_buffer_bytes(delivery->segments[i - 1]);
+      pn_buffer_prepend(tail, segment.start, segment.size);
+    }
+    pni_delivery_clear_segments(delivery);
+  }
+  return pn_buffer_bytes(delivery->bytes);
+}
+
+size_t pn_delivery_segments(pn_delivery_t *delivery)
+{
+  assert(delivery);
+  return delivery->segment_count - delivery->segment_head + 1;
+}
+
+pn_bytes_t pn_delivery_segment(pn_delivery_t *delivery, size_t index)
+{
+  assert(delivery);
+  size_t count = delivery->segment_count - delivery->segment_head;
+  if (index < count) {
+    return pn_buffer_bytes(delivery->segments[delivery->segment_head + index]);
+  } else if (index == count) {
+    return pn_buffer_bytes(delivery->bytes);
+  } else {
+    return pn_bytes(0, NULL);
+  }
+}
+
+void pn_delivery_expect(pn_delivery_t *delivery, size_t size)
+{
+  assert(delivery);
+  size_t pending = pn_delivery_pending(delivery);
+  if (size > pending && size - pending > pn_buffer_available(delivery->bytes)) {
+    pni_delivery_push_segment(delivery, size - pending);
+  }
 }
 
 bool pn_delivery_partial(pn_delivery_t *delivery)
@@ -1995,44 +2646,61 @@ pn_condition_t *pn_link_remote_condition(pn_link_t *link)
 
 bool pn_condition_is_set(pn_condition_t *condition)
 {
-  return condition && pn_string_get(condition->name);
+  return condition && condition->name && pn_string_get(condition->name);
 }
 
 void pn_condition_clear(pn_condition_t *condition)
 {
   assert(condition);
-  pn_string_clear(condition->name);
-  pn_string_clear(condition->description);
+  // a shared name is let go of rather than cleared
+  pni_unshare(&condition->name);
+  if (condition->name) pn_string_clear(condition->name);
+  if (condition->description) pn_string_clear(condition->description);
   pn_data_clear(condition->info);
 }
 
 const char *pn_condition_get_name(pn_condition_t *condition)
 {
   assert(condition);
-  return pn_string_get(condition->name);
+  return condition->name ? pn_string_get(condition->name) : NULL;
 }
 
 int pn_condition_set_name(pn_condition_t *condition, const char *name)
 {
   assert(condition);
+  int err = pni_unshare(&condition->name);
+  if (err) return err;
+  if (!condition->name) {
+    if (!name) return 0;
+    condition->name = pn_string(NULL);
+    if (!condition->name) return PN_ERR;
+  }
   return pn_string_set(condition->name, name);
 }
 
 const char *pn_condition_get_description(pn_condition_t *condition)
 {
   assert(condition);
-  return pn_string_get(condition->description);
+  return condition->description ? pn_string_get(condition->description) : NULL;
 }
 
 int pn_condition_set_description(pn_condition_t *condition, const char *description)
 {
   assert(condition);
+  if (!condition->description) {
+    if (!description) return 0;
+    condition->description = pn_string(NULL);
+    if (!condition->description) return PN_ERR;
+  }
   return pn_string_set(condition->description, description);
 }
 
 pn_data_t *pn_condition_info(pn_condition_t *condition)
 {
   assert(condition);
+  if (!condition->info) {
+    condition->info = pn_data(0);
+  }
   return condition->info;
 }
 
@@ -25,6 +25,7 @@
 #include <assert.h>
 #include "util.h"
 #include "platform.h"
+#include "alloc_private.h"
 
 struct pn_error_t {
   char *text;
@@ -34,7 +35,7 @@ struct pn_error_t {
 
 pn_error_t *pn_error()
 {
-  pn_error_t *error = (pn_error_t *) malloc(sizeof(pn_error_t));
+  pn_error_t *error = (pn_error_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pn_error_t));
   error->code = 0;
   error->text = NULL;
   error->root = NULL;
@@ -44,8 +45,8 @@ pn_error_t *pn_error()
 void pn_error_free(pn_error_t *error)
 {
   if (error) {
-    free(error->text);
-    free(error);
+    pni_free(PN_ALLOC_OBJECT, error->text);
+    pni_free(PN_ALLOC_OBJECT, error);
   }
 }
 
@@ -53,7 +54,7 @@ void pn_error_clear(pn_error_t *error)
 {
   if (error) {
     error->code = 0;
-    free(error->text);
+    pni_free(PN_ALLOC_OBJECT, error->text);
     error->text = NULL;
     error->root = NULL;
   }
@@ -2,10 +2,23 @@
 #include <proton/event.h>
 #include <assert.h>
 
+#define PNI_EVENT_BIT(TYPE) ((uint64_t) 1 << (TYPE))
+
+// events that only say something has changed, so one pending event
+// for a context stands for any number
+#define PNI_COALESCED (PNI_EVENT_BIT(PN_DELIVERY) | PNI_EVENT_BIT(PN_LINK_FLOW) | \
+                       PNI_EVENT_BIT(PN_TRANSPORT) | PNI_EVENT_BIT(PN_SELECTABLE_UPDATED))
+
 struct pn_collector_t {
   pn_list_t *pool;
   pn_event_t *head;
   pn_event_t *tail;
+  // events held back for a later round, see pni_collector_defer
+  pn_event_t *deferred_head;
+  pn_event_t *deferred_tail;
+  // the oldest pending coalesced event of each context
+  pn_hash_t *pending;
+  uint64_t subscribed;
   bool freed;
 };
 
@@ -15,7 +28,9 @@ struct pn_event_t {
   void *context;    // depends on clazz
   pn_record_t *attachments;
   pn_event_t *next;
+  pn_event_t *peer; // next pending coalesced event of the same context
   pn_event_type_t type;
+  bool holds_pool;  // whether the event has its own reference to pool
 };
 
 static void pn_collector_initialize(pn_collector_t *collector)
@@ -23,16 +38,24 @@ static void pn_collector_initialize(pn_collector_t *collector)
   collector->pool = pn_list(PN_OBJECT, 0);
   collector->head = NULL;
   collector->tail = NULL;
+  collector->deferred_head = NULL;
+  collector->deferred_tail = NULL;
+  collector->pending = pn_hash(PN_VOID, 0, 0.75);
+  collector->subscribed = ~(uint64_t) 0;
   collector->freed = false;
 }
 
+bool pni_collector_resume(pn_collector_t *collector);
+
 static void pn_collector_drain(pn_collector_t *collector)
 {
   assert(collector);
 
-  while (pn_collector_peek(collector)) {
-    pn_collector_pop(collector);
-  }
+  do {
+    while (pn_collector_peek(collector)) {
+      pn_collector_pop(collector);
+    }
+  } while (pni_collector_resume(collector));
 
   assert(!collector->head);
   assert(!collector->tail);
@@ -48,6 +71,7 @@ static void pn_collector_finalize(pn_collector_t *collector)
 {
   pn_collector_drain(collector);
   pn_decref(collector->pool);
+  pn_decref(collector->pending);
 }
 
 static int pn_collector_inspect(pn_collector_t *collector, pn_string_t *dst)
@@ -98,6 +122,22 @@ void pn_collector_release(pn_collector_t *collector)
   }
 }
 
+void pn_collector_subscribe(pn_collector_t *collector, pn_event_type_t type, bool subscribe)
+{
+  assert(collector);
+  if (subscribe) {
+    collector->subscribed |= PNI_EVENT_BIT(type);
+  } else {
+    collector->subscribed &= ~PNI_EVENT_BIT(type);
+  }
+}
+
+bool pn_collector_subscribed(pn_collector_t *collector, pn_event_type_t type)
+{
+  assert(collector);
+  return collector->subscribed & PNI_EVENT_BIT(type);
+}
+
 pn_event_t *pn_event(void);
 
 pn_event_t *pn_collector_put(pn_collector_t *collector,
@@ -114,11 +154,28 @@ pn_event_t *pn_collector_put(pn_collector_t *collector,
     return NULL;
   }
 
+  if (!(collector->subscribed & PNI_EVENT_BIT(type))) {
+    return NULL;
+  }
+
   pn_event_t *tail = collector->tail;
   if (tail && tail->type == type && tail->context == context) {
     return NULL;
   }
 
+  bool coalesced = PNI_COALESCED & PNI_EVENT_BIT(type);
+  pn_event_t *peer = NULL;
+  if (coalesced) {
+    peer = (pn_event_t *) pn_hash_get(collector->pending, (uintptr_t) context);
+    for (pn_event_t *e = peer; e; e = e->peer) {
+      // the head may already be being handled, so it can't stand for
+      // a later change
+      if (e->type == type && e != collector->head) {
+        return NULL;
+      }
+    }
+  }
+
   clazz = clazz->reify(context);
 
   pn_event_t *event = (pn_event_t *) pn_list_pop(collector->pool);
@@ -127,8 +184,8 @@ pn_event_t *pn_collector_put(pn_collector_t *collector,
     event = pn_event();
   }
 
+  // borrowed from the collector for as long as the event is queued
   event->pool = collector->pool;
-  pn_incref(event->pool);
 
   if (tail) {
     tail->next = event;
@@ -143,6 +200,15 @@ pn_event_t *pn_collector_put(pn_collector_t *collector,
   event->type = type;
   pn_class_incref(clazz, event->context);
 
+  if (coalesced) {
+    if (peer) {
+      while (peer->peer) peer = peer->peer;
+      peer->peer = event;
+    } else {
+      pn_hash_put(collector->pending, (uintptr_t) context, event);
+    }
+  }
+
   return event;
 }
 
@@ -164,10 +230,65 @@ bool pn_collector_pop(pn_collector_t *collector)
     collector->tail = NULL;
   }
 
+  // whoever else still holds the event needs the pool to outlive the
+  // collector
+  if (pn_refcount(event) > 1) {
+    pn_incref(event->pool);
+    event->holds_pool = true;
+  }
+
+  // being the oldest pending event, the head is first for its context
+  if (PNI_COALESCED & PNI_EVENT_BIT(event->type)) {
+    assert(pn_hash_get(collector->pending, (uintptr_t) event->context) == event);
+    if (event->peer) {
+      pn_hash_put(collector->pending, (uintptr_t) event->context, event->peer);
+      event->peer = NULL;
+    } else {
+      pn_hash_del(collector->pending, (uintptr_t) event->context);
+    }
+  }
+
   pn_decref(event);
   return true;
 }
 
+// holds the head back until pni_collector_resume, or all of the queue
+// for nothing to be taken as being handled meanwhile. An event must be
+// deferred along with every later one of its context.
+void pni_collector_defer(pn_collector_t *collector, bool all)
+{
+  pn_event_t *head = collector->head;
+  pn_event_t *last = all ? collector->tail : head;
+  assert(head);
+  collector->head = last->next;
+  if (!collector->head) {
+    collector->tail = NULL;
+  }
+  last->next = NULL;
+  if (collector->deferred_tail) {
+    collector->deferred_tail->next = head;
+  } else {
+    collector->deferred_head = head;
+  }
+  collector->deferred_tail = last;
+}
+
+// puts the deferred events back in front, ahead of anything of their
+// contexts put since
+bool pni_collector_resume(pn_collector_t *collector)
+{
+  pn_event_t *head = collector->deferred_head;
+  if (!head) return false;
+  collector->deferred_tail->next = collector->head;
+  if (!collector->tail) {
+    collector->tail = collector->deferred_tail;
+  }
+  collector->head = head;
+  collector->deferred_head = NULL;
+  collector->deferred_tail = NULL;
+  return true;
+}
+
 bool pn_collector_more(pn_collector_t *collector)
 {
   assert(collector);
@@ -181,7 +302,10 @@ static void pn_event_initialize(pn_event_t *event)
   event->clazz = NULL;
   event->context = NULL;
   event->next = NULL;
-  event->attachments = pn_record();
+  event->peer = NULL;
+  event->holds_pool = false;
+  // most events are never given attachments
+  event->attachments = NULL;
 }
 
 static void pn_event_finalize(pn_event_t *event) {
@@ -191,20 +315,27 @@ static void pn_event_finalize(pn_event_t *event) {
   }
 
   pn_list_t *pool = event->pool;
+  bool holds_pool = event->holds_pool;
 
-  if (pool && pn_refcount(pool) > 1) {
+  // a borrowed pool is alive, an owned one only while the collector is
+  if (pool && (!holds_pool || pn_refcount(pool) > 1)) {
     event->pool = NULL;
     event->type = PN_EVENT_NONE;
     event->clazz = NULL;
     event->context = NULL;
     event->next = NULL;
-    pn_record_clear(event->attachments);
+    event->holds_pool = false;
+    if (event->attachments) {
+      pn_record_clear(event->attachments);
+    }
     pn_list_add(pool, event);
   } else {
     pn_decref(event->attachments);
   }
 
-  pn_decref(pool);
+  if (holds_pool) {
+    pn_decref(pool);
+  }
 }
 
 static int pn_event_inspect(pn_event_t *event, pn_string_t *dst)
@@ -259,6 +390,9 @@ void *pn_event_context(pn_event_t *event)
 pn_record_t *pn_event_attachments(pn_event_t *event)
 {
   assert(event);
+  if (!event->attachments) {
+    event->attachments = pn_record();
+  }
   return event->attachments;
 }
 
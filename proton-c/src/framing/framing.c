@@ -87,7 +87,15 @@ size_t pn_read_frame(pn_frame_t *frame, const char *bytes, size_t available)
 
 size_t pn_write_frame(char *bytes, size_t available, pn_frame_t frame)
 {
-  size_t size = AMQP_HEADER_SIZE + frame.ex_size + frame.size;
+  return pn_write_frame_body(bytes, available, frame, NULL, 0);
+}
+
+// writes a frame whose payload is frame.payload followed by body, so a
+// transfer's message data can be copied straight from the delivery
+size_t pn_write_frame_body(char *bytes, size_t available, pn_frame_t frame,
+                           const char *body, size_t body_size)
+{
+  size_t size = AMQP_HEADER_SIZE + frame.ex_size + frame.size + body_size;
   if (size <= available)
   {
     pn_i_write32(&bytes[0], size);
@@ -98,6 +106,9 @@ size_t pn_write_frame(char *bytes, size_t available, pn_frame_t frame)
 
     memmove(bytes + AMQP_HEADER_SIZE, frame.extended, frame.ex_size);
     memmove(bytes + 4*doff, frame.payload, frame.size);
+    if (body_size) {
+      memcpy(bytes + 4*doff + frame.size, body, body_size);
+    }
     return size;
   } else {
     return 0;
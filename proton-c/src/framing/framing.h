@@ -44,6 +44,8 @@ typedef struct {
 
 PN_EXTERN size_t pn_read_frame(pn_frame_t *frame, const char *bytes, size_t available);
 PN_EXTERN size_t pn_write_frame(char *bytes, size_t size, pn_frame_t frame);
+PN_EXTERN size_t pn_write_frame_body(char *bytes, size_t size, pn_frame_t frame,
+                                     const char *body, size_t body_size);
 
 #ifdef __cplusplus
 }
@@ -19,13 +19,19 @@
  *
  */
 
+#include <proton/connection.h>
+#include <proton/session.h>
 #include <proton/link.h>
+#include <proton/delivery.h>
+#include <proton/object.h>
 #include <proton/handlers.h>
 #include <assert.h>
 
 typedef struct {
   int window;
   int drained;
+  size_t budget;
+  bool autotune;
 } pni_flowcontroller_t;
 
 pni_flowcontroller_t *pni_flowcontroller(pn_handler_t *handler) {
@@ -37,6 +43,119 @@ static void pni_topup(pn_link_t *link, int window) {
   pn_link_flow(link, delta);
 }
 
+// per connection totals the budget is shared out by
+typedef struct {
+  int receivers;
+  double rate; // sum of the receivers' consumption rates
+} pni_conn_flow_t;
+
+// per receiver state of an autotuning flow controller
+typedef struct {
+  double rate;         // deliveries consumed per second, smoothed
+  pn_timestamp_t mark; // when credit was last topped up
+  size_t size;         // running average of the delivery size
+  int window;
+  int credit;          // credit right after the last top up
+} pni_link_flow_t;
+
+#define CID_pni_conn_flow CID_pn_object
+#define pni_conn_flow_initialize NULL
+#define pni_conn_flow_finalize NULL
+#define pni_conn_flow_hashcode NULL
+#define pni_conn_flow_compare NULL
+#define pni_conn_flow_inspect NULL
+
+#define CID_pni_link_flow CID_pn_object
+#define pni_link_flow_initialize NULL
+#define pni_link_flow_finalize NULL
+#define pni_link_flow_hashcode NULL
+#define pni_link_flow_compare NULL
+#define pni_link_flow_inspect NULL
+
+PN_HANDLE(PNI_CONN_FLOW)
+PN_HANDLE(PNI_LINK_FLOW)
+
+static pni_conn_flow_t *pni_conn_flow(pn_connection_t *conn) {
+  pn_record_t *record = pn_connection_attachments(conn);
+  pni_conn_flow_t *cf = (pni_conn_flow_t *) pn_record_get(record, PNI_CONN_FLOW);
+  if (!cf) {
+    static const pn_class_t clazz = PN_CLASS(pni_conn_flow);
+    cf = (pni_conn_flow_t *) pn_class_new(&clazz, sizeof(pni_conn_flow_t));
+    cf->receivers = 0;
+    cf->rate = 0;
+    pn_record_def(record, PNI_CONN_FLOW, PN_OBJECT);
+    pn_record_set(record, PNI_CONN_FLOW, cf);
+    pn_decref(cf);
+  }
+  return cf;
+}
+
+static pni_link_flow_t *pni_link_flow(pni_flowcontroller_t *fc, pn_link_t *link) {
+  pn_record_t *record = pn_link_attachments(link);
+  pni_link_flow_t *lf = (pni_link_flow_t *) pn_record_get(record, PNI_LINK_FLOW);
+  if (!lf) {
+    static const pn_class_t clazz = PN_CLASS(pni_link_flow);
+    lf = (pni_link_flow_t *) pn_class_new(&clazz, sizeof(pni_link_flow_t));
+    lf->rate = 0;
+    lf->mark = 0;
+    lf->size = 0;
+    lf->window = fc->window;
+    lf->credit = 0;
+    pn_record_def(record, PNI_LINK_FLOW, PN_OBJECT);
+    pn_record_set(record, PNI_LINK_FLOW, lf);
+    pn_decref(lf);
+    pni_conn_flow(pn_session_connection(pn_link_session(link)))->receivers++;
+  }
+  return lf;
+}
+
+static void pni_autotune(pni_flowcontroller_t *fc, pn_link_t *link, pn_event_t *event) {
+  pni_link_flow_t *lf = pni_link_flow(fc, link);
+  pn_delivery_t *delivery = pn_event_delivery(event);
+  if (delivery && !pn_delivery_partial(delivery)) {
+    size_t size = pn_delivery_pending(delivery);
+    if (size) {
+      lf->size = lf->size ? (7*lf->size + size)/8 : size;
+    }
+  }
+
+  // top up only once half the window has been used
+  int credit = pn_link_credit(link);
+  if (credit > lf->window/2) return;
+
+  pni_conn_flow_t *cf = pni_conn_flow(pn_session_connection(pn_link_session(link)));
+  pn_reactor_t *reactor = pn_event_reactor(event);
+  if (reactor) {
+    pn_timestamp_t now = pn_reactor_now(reactor);
+    if (lf->mark) {
+      double elapsed = now > lf->mark ? now - lf->mark : 1;
+      double rate = 1000.0*(lf->credit - credit)/elapsed;
+      double smoothed = lf->rate ? (3*lf->rate + rate)/4 : rate;
+      cf->rate += smoothed - lf->rate;
+      lf->rate = smoothed;
+    }
+    lf->mark = now;
+  }
+
+  // receivers share the budget by how quickly they consume, evenly
+  // until that is known
+  int window = fc->window;
+  if (fc->budget && lf->size) {
+    double share = cf->rate > 0 ? lf->rate/cf->rate : 1.0/cf->receivers;
+    double limit = share*fc->budget/lf->size;
+    if (limit < window) {
+      window = limit > 2 ? (int) limit : 2;
+    }
+  }
+
+  lf->window = window;
+  if (window > credit) {
+    pn_link_flow(link, window - credit);
+    credit = window;
+  }
+  lf->credit = credit;
+}
+
 static void pn_flowcontroller_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
   pni_flowcontroller_t *fc = pni_flowcontroller(handler);
   int window = fc->window;
@@ -50,7 +169,21 @@ static void pn_flowcontroller_dispatch(pn_handler_t *handler, pn_event_t *event,
     if (pn_link_is_receiver(link)) {
       fc->drained += pn_link_drained(link);
       if (!fc->drained) {
-        pni_topup(link, window);
+        if (fc->autotune) {
+          pni_autotune(fc, link, event);
+        } else {
+          pni_topup(link, window);
+        }
+      }
+    }
+    break;
+  case PN_LINK_FINAL:
+    if (fc->autotune) {
+      pni_link_flow_t *lf = (pni_link_flow_t *) pn_record_get(pn_link_attachments(link), PNI_LINK_FLOW);
+      if (lf) {
+        pni_conn_flow_t *cf = pni_conn_flow(pn_session_connection(pn_link_session(link)));
+        cf->receivers--;
+        cf->rate -= lf->rate;
       }
     }
     break;
@@ -67,5 +200,15 @@ pn_flowcontroller_t *pn_flowcontroller(int window) {
   pni_flowcontroller_t *fc = pni_flowcontroller(handler);
   fc->window = window;
   fc->drained = 0;
+  fc->budget = 0;
+  fc->autotune = false;
+  return handler;
+}
+
+pn_flowcontroller_t *pn_flowcontroller_autotune(int window, size_t budget) {
+  pn_flowcontroller_t *handler = pn_flowcontroller(window);
+  pni_flowcontroller_t *fc = pni_flowcontroller(handler);
+  fc->budget = budget;
+  fc->autotune = true;
   return handler;
 }
@@ -28,11 +28,8 @@ static void *pni_selector_handle = NULL;
 
 #define PN_SELECTOR ((pn_handle_t) &pni_selector_handle)
 
-void pni_handle_quiesced(pn_reactor_t *reactor, pn_selector_t *selector) {
-  // check if we are still quiesced, other handlers of
-  // PN_REACTOR_QUIESCED could have produced more events to process
-  if (!pn_reactor_quiesced(reactor)) { return; }
-  pn_selector_select(selector, pn_reactor_get_timeout(reactor));
+static void pni_handle_ready(pn_reactor_t *reactor, pn_selector_t *selector, int timeout) {
+  pn_selector_select(selector, timeout);
   pn_selectable_t *sel;
   int events;
   pn_reactor_mark(reactor);
@@ -50,9 +47,26 @@ void pni_handle_quiesced(pn_reactor_t *reactor, pn_selector_t *selector) {
       pn_selectable_error(sel);
     }
   }
+}
+
+void pni_handle_quiesced(pn_reactor_t *reactor, pn_selector_t *selector) {
+  // check if we are still quiesced, other handlers of
+  // PN_REACTOR_QUIESCED could have produced more events to process
+  if (!pn_reactor_quiesced(reactor)) { return; }
+  pni_handle_ready(reactor, selector, pn_reactor_get_timeout(reactor));
   pn_reactor_yield(reactor);
 }
 
+// services whatever IO and timers are ready without waiting, for the
+// reactor to call when it stops short of quiescing
+void pni_handle_poll(pn_reactor_t *reactor) {
+  pn_record_t *record = pn_reactor_attachments(reactor);
+  pn_selector_t *selector = (pn_selector_t *) pn_record_get(record, PN_SELECTOR);
+  if (selector) {
+    pni_handle_ready(reactor, selector, 0);
+  }
+}
+
 void pni_handle_transport(pn_reactor_t *reactor, pn_event_t *event);
 void pni_handle_open(pn_reactor_t *reactor, pn_event_t *event);
 void pni_handle_bound(pn_reactor_t *reactor, pn_event_t *event);
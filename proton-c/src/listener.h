@@ -0,0 +1,60 @@
+#ifndef _PROTON_SRC_LISTENER_H
+#define _PROTON_SRC_LISTENER_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/io.h>
+
+/*
+ * Sharded listening: several sockets bound to the same address, each
+ * with its own accept queue, between which the kernel spreads incoming
+ * connections. This lets each thread of a reactor group accept on its
+ * own without passing connections around.
+ */
+
+/** Listen like pn_listen(), on a socket that pni_listen_share() can
+ * share. Where sharing is not supported this is a plain listener.
+ *
+ * @internal
+ */
+pn_socket_t pni_listen_shareable(pn_io_t *io, const char *host, const char *port);
+
+/** Open another listener on the address a shareable listener is bound
+ * to.
+ *
+ * @return the new listener, or PN_INVALID_SOCKET with the error set on
+ *         io if the listener can not be shared
+ * @internal
+ */
+pn_socket_t pni_listen_share(pn_io_t *io, pn_socket_t listener);
+
+/** Prefer this listener, among those sharing its address, for the
+ * connections whose packets the kernel handles on cpu, so that a
+ * thread pinned there accepts them.
+ *
+ * @return zero, or an error code with the error set on io if the
+ *         platform cannot steer connections
+ * @internal
+ */
+int pni_listen_steer(pn_io_t *io, pn_socket_t listener, int cpu);
+
+#endif /* listener.h */
@@ -17,10 +17,19 @@
  * under the License.
  */
 
+
 #include <proton/log.h>
+#include <proton/codec.h>
+#include <proton/error.h>
 #include <proton/object.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log_private.h"
+#include "platform_fmt.h"
+#include "thread.h"
 #include "util.h"
+#include "alloc_private.h"
 
 
 static void stderr_logger(const char *message) {
@@ -47,10 +56,349 @@ void pn_log_logger(pn_logger_t new_logger) {
     if (!logger) pn_log_enable(false);
 }
 
+/*
+ * With pn_log_async() each transport writes its trace into a ring of
+ * its own and pn_logf() writes into a shared one. A ring has a single
+ * producer at a time, so it needs no lock, and a single consumer, the
+ * writer thread, which formats the records and writes them out.
+ */
+
+// the most payload a frame record keeps, as much as is ever shown
+#define PNI_LOG_PAYLOAD (1024)
+#define PNI_LOG_ALIGN(SIZE) (((SIZE) + 7) & ~((size_t) 7))
+
+typedef enum {PNI_LOG_PAD, PNI_LOG_TEXT, PNI_LOG_FRAME} pni_log_kind_t;
+
+typedef struct {
+  uint32_t size;        // of the whole record, padding included
+  uint8_t kind;
+  uint8_t out;
+  uint16_t channel;
+  uint32_t args;        // bytes of encoded frame body that follow
+  uint32_t payload;     // bytes of payload the frame had
+  const void *source;   // the transport, NULL for pn_logf()
+} pni_log_record_t;
+
+#define PNI_LOG_HEADER PNI_LOG_ALIGN(sizeof(pni_log_record_t))
+
+struct pni_log_ring_t {
+  pni_log_ring_t *next;
+  char *bytes;
+  int capacity;         // a power of two
+  int volatile head;    // advanced by the writer
+  int volatile tail;    // advanced by the producer
+  int volatile dropped;
+  int reported;         // drops the writer already wrote out
+  bool closed;          // the producer is gone
+};
+
+static struct {
+  pni_mutex_t *lock;        // guards rings and dropped
+  pni_mutex_t *shared_lock; // serializes the writers of shared
+  pni_semaphore_t *wake;
+  pni_thread_t *thread;
+  pni_log_ring_t *rings;
+  pni_log_ring_t *shared;
+  size_t capacity;
+  uint64_t dropped;         // by rings that were freed
+  int volatile stopping;
+} pni_log;
+
+// the writer thread while it runs
+static void *volatile pni_log_writer = NULL;
+
+static pni_log_ring_t *pni_log_ring(void)
+{
+  pni_log_ring_t *ring = (pni_log_ring_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pni_log_ring_t));
+  if (!ring) return NULL;
+  ring->bytes = (char *) pni_malloc(PN_ALLOC_OBJECT, pni_log.capacity);
+  if (!ring->bytes) {
+    pni_free(PN_ALLOC_OBJECT, ring);
+    return NULL;
+  }
+  ring->capacity = (int) pni_log.capacity;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->dropped = 0;
+  ring->reported = 0;
+  ring->closed = false;
+  pni_mutex_lock(pni_log.lock);
+  ring->next = pni_log.rings;
+  pni_log.rings = ring;
+  pni_mutex_unlock(pni_log.lock);
+  return ring;
+}
+
+// space for a record of size bytes at *position, NULL if the ring is
+// full. The record is published by advancing the tail past it.
+static char *pni_log_reserve(pni_log_ring_t *ring, size_t size, unsigned *position)
+{
+  unsigned capacity = (unsigned) ring->capacity;
+  unsigned tail = (unsigned) ring->tail;
+  unsigned head = (unsigned) pni_atomic_get(&ring->head);
+  unsigned offset = tail & (capacity - 1);
+  unsigned contiguous = capacity - offset;
+  // a record does not wrap, the end of the ring is padded instead
+  size_t need = size + (contiguous < size ? contiguous : 0);
+  if (size > capacity / 2 || capacity - (tail - head) < need) {
+    pni_atomic_add(&ring->dropped, 1);
+    return NULL;
+  }
+  if (contiguous < size) {
+    // the size and kind always fit, records are 8 byte aligned
+    pni_log_record_t *pad = (pni_log_record_t *) (ring->bytes + offset);
+    pad->size = contiguous;
+    pad->kind = PNI_LOG_PAD;
+    tail += contiguous;
+    offset = 0;
+  }
+  *position = tail;
+  return ring->bytes + offset;
+}
+
+static bool pni_log_ready(pni_log_ring_t **ring)
+{
+  if (!pni_atomic_load(&pni_log_writer)) return false;
+  if (!*ring) *ring = pni_log_ring();
+  return *ring != NULL;
+}
+
+bool pni_log_text(pni_log_ring_t **ring, const void *source, const char *message)
+{
+  if (!pni_log_ready(ring)) return false;
+  size_t length = strlen(message);
+  unsigned position;
+  size_t size = PNI_LOG_ALIGN(PNI_LOG_HEADER + length + 1);
+  char *bytes = pni_log_reserve(*ring, size, &position);
+  if (bytes) {
+    pni_log_record_t *record = (pni_log_record_t *) bytes;
+    record->size = size;
+    record->kind = PNI_LOG_TEXT;
+    record->source = source;
+    memcpy(bytes + PNI_LOG_HEADER, message, length + 1);
+    pni_atomic_set(&(*ring)->tail, (int) (position + size));
+  }
+  return true;
+}
+
+bool pni_log_frame(pni_log_ring_t **ring, const void *source, uint16_t channel, bool out,
+                   pn_data_t *args, const char *payload, size_t size)
+{
+  if (!pni_log_ready(ring)) return false;
+  ssize_t encoded = pn_data_encoded_size(args);
+  if (encoded < 0) return false;
+  size_t kept = size < PNI_LOG_PAYLOAD ? size : PNI_LOG_PAYLOAD;
+  size_t total = PNI_LOG_ALIGN(PNI_LOG_HEADER + encoded + kept);
+  unsigned position;
+  char *bytes = pni_log_reserve(*ring, total, &position);
+  if (bytes) {
+    pni_log_record_t *record = (pni_log_record_t *) bytes;
+    record->size = total;
+    record->kind = PNI_LOG_FRAME;
+    record->out = out;
+    record->channel = channel;
+    record->args = encoded;
+    record->payload = size;
+    record->source = source;
+    pn_data_encode(args, bytes + PNI_LOG_HEADER, encoded);
+    memcpy(bytes + PNI_LOG_HEADER + encoded, payload, kept);
+    pni_atomic_set(&(*ring)->tail, (int) (position + total));
+  }
+  return true;
+}
+
+void pni_log_ring_free(pni_log_ring_t *ring)
+{
+  if (!ring) return;
+  pni_mutex_lock(pni_log.lock);
+  if (pni_log.thread) {
+    // the writer frees the ring once it has written it out
+    ring->closed = true;
+  } else {
+    pni_log_ring_t **link = &pni_log.rings;
+    while (*link != ring) link = &(*link)->next;
+    *link = ring->next;
+    pni_log.dropped += pni_atomic_get(&ring->dropped);
+    pni_free(PN_ALLOC_OBJECT, ring->bytes);
+    pni_free(PN_ALLOC_OBJECT, ring);
+  }
+  pni_mutex_unlock(pni_log.lock);
+}
+
+static void pni_log_emit(pni_log_record_t *record, pn_data_t *data, pn_string_t *str)
+{
+  const char *bytes = (const char *) record + PNI_LOG_HEADER;
+  if (record->kind == PNI_LOG_TEXT) {
+    if (record->source) {
+      fprintf(stderr, "[%p]:%s\n", record->source, bytes);
+    } else if (logger) {
+      logger(bytes);
+    }
+    return;
+  }
+
+  pn_string_format(str, "%u %s ", record->channel, record->out ? "->" : "<-");
+  pn_data_clear(data);
+  if (record->args) pn_data_decode(data, bytes, record->args);
+  pn_inspect(data, str);
+  if (pn_data_size(data) == 0) {
+    pn_string_addf(str, "(EMPTY FRAME)");
+  }
+  if (record->payload) {
+    size_t kept = record->payload < PNI_LOG_PAYLOAD ? record->payload : PNI_LOG_PAYLOAD;
+    char buf[1024];
+    int e = pn_quote_data(buf, 1024, bytes + record->args, kept);
+    bool truncated = e == PN_OVERFLOW || kept < record->payload;
+    pn_string_addf(str, " (%" PN_ZU ") \"%s\"%s", (size_t) record->payload, buf,
+                   truncated ? "... (truncated)" : "");
+  }
+  fprintf(stderr, "[%p]:%s\n", record->source, pn_string_get(str));
+}
+
+// write out what the ring holds, true if there was anything
+static bool pni_log_drain(pni_log_ring_t *ring, pn_data_t *data, pn_string_t *str)
+{
+  unsigned mask = (unsigned) ring->capacity - 1;
+  unsigned head = (unsigned) ring->head;
+  unsigned tail = (unsigned) pni_atomic_get(&ring->tail);
+  bool drained = head != tail;
+  while (head != tail) {
+    pni_log_record_t *record = (pni_log_record_t *) (ring->bytes + (head & mask));
+    head += record->size;
+    if (record->kind != PNI_LOG_PAD) {
+      pni_log_emit(record, data, str);
+    }
+    pni_atomic_set(&ring->head, (int) head);
+  }
+
+  int dropped = pni_atomic_get(&ring->dropped);
+  if (dropped != ring->reported) {
+    pn_string_format(str, "%d log records dropped", dropped - ring->reported);
+    if (logger) logger(pn_string_get(str));
+    ring->reported = dropped;
+  }
+  return drained;
+}
+
+// drain every ring, freeing the ones whose producer is gone
+static bool pni_log_sweep(pn_data_t *data, pn_string_t *str)
+{
+  bool drained = false;
+  pni_mutex_lock(pni_log.lock);
+  pni_log_ring_t *rings = pni_log.rings;
+  pni_mutex_unlock(pni_log.lock);
+  // rings are only ever added at the head, and only freed here
+  for (pni_log_ring_t *ring = rings; ring; ring = ring->next) {
+    drained |= pni_log_drain(ring, data, str);
+  }
+
+  pni_mutex_lock(pni_log.lock);
+  pni_log_ring_t **link = &pni_log.rings;
+  while (*link) {
+    pni_log_ring_t *ring = *link;
+    if (ring->closed && ring->head == pni_atomic_get(&ring->tail)) {
+      *link = ring->next;
+      pni_log.dropped += pni_atomic_get(&ring->dropped);
+      pni_free(PN_ALLOC_OBJECT, ring->bytes);
+      pni_free(PN_ALLOC_OBJECT, ring);
+    } else {
+      link = &ring->next;
+    }
+  }
+  pni_mutex_unlock(pni_log.lock);
+  return drained;
+}
+
+static void pni_log_run(void *context)
+{
+  pn_data_t *data = pn_data(16);
+  pn_string_t *str = pn_string(NULL);
+  while (!pni_atomic_get(&pni_log.stopping)) {
+    if (!pni_log_sweep(data, str)) {
+      pni_semaphore_wait_for(pni_log.wake, 10);
+    }
+  }
+  // whatever was logged before stopping is still written
+  pni_log_sweep(data, str);
+  pn_free(data);
+  pn_free(str);
+}
+
+static void pni_log_stop(void)
+{
+  if (!pni_log.thread) return;
+  pni_atomic_exchange(&pni_log_writer, NULL);
+  pni_atomic_set(&pni_log.stopping, 1);
+  pni_semaphore_post(pni_log.wake);
+  pni_thread_join(pni_log.thread);
+  pni_mutex_lock(pni_log.lock);
+  pni_log.thread = NULL;
+  pni_mutex_unlock(pni_log.lock);
+  pni_atomic_set(&pni_log.stopping, 0);
+}
+
+int pn_log_async(size_t capacity)
+{
+  pni_log_stop();
+  if (!capacity) return 0;
+
+  if (!pni_log.lock) {
+    pni_log.lock = pni_mutex();
+    pni_log.shared_lock = pni_mutex();
+    pni_log.wake = pni_semaphore();
+    if (!pni_log.lock || !pni_log.shared_lock || !pni_log.wake) return PN_ERR;
+    atexit(pni_log_stop);
+  }
+
+  size_t size = 1024;
+  while (size < capacity) size *= 2;
+  pni_log.capacity = size;
+  pni_mutex_lock(pni_log.lock);
+  pni_log.thread = pni_thread(pni_log_run, NULL);
+  pni_mutex_unlock(pni_log.lock);
+  if (!pni_log.thread) return PN_ERR;
+  pni_atomic_exchange(&pni_log_writer, pni_log.thread);
+  return 0;
+}
+
+uint64_t pn_log_dropped(void)
+{
+  if (!pni_log.lock) return 0;
+  pni_mutex_lock(pni_log.lock);
+  uint64_t dropped = pni_log.dropped;
+  for (pni_log_ring_t *ring = pni_log.rings; ring; ring = ring->next) {
+    dropped += pni_atomic_get(&ring->dropped);
+  }
+  pni_mutex_unlock(pni_log.lock);
+  return dropped;
+}
+
 void pn_vlogf_impl(const char *fmt, va_list ap) {
-    pn_string_t *msg = pn_string("");
-    pn_string_vformat(msg, fmt, ap);
-    fprintf(stderr, "%s\n", pn_string_get(msg));
+    char buf[1024];
+    va_list copy;
+    va_copy(copy, ap);
+    int size = vsnprintf(buf, sizeof(buf), fmt, copy);
+    va_end(copy);
+    if (size < 0) return;
+
+    pn_string_t *msg = NULL;
+    const char *message = buf;
+    if ((size_t) size >= sizeof(buf)) {
+        msg = pn_string("");
+        pn_string_vformat(msg, fmt, ap);
+        message = pn_string_get(msg);
+    }
+
+    bool queued = false;
+    if (pni_atomic_load(&pni_log_writer)) {
+        pni_mutex_lock(pni_log.shared_lock);
+        queued = pni_log_text(&pni_log.shared, NULL, message);
+        pni_mutex_unlock(pni_log.shared_lock);
+    }
+    if (!queued && logger) {
+        logger(message);
+    }
+    pn_free(msg);
 }
 
 /**@internal
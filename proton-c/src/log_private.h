@@ -24,6 +24,7 @@
  * Log messages that are not associated with a transport.
  */
 
+#include <proton/codec.h>
 #include <proton/log.h>
 #include <stdarg.h>
 
@@ -49,6 +50,20 @@ PN_EXTERN void pn_logf_impl(const char* fmt, ...);
 /**@internal*/
 PN_EXTERN void pn_vlogf_impl(const char *fmt, va_list ap);
 
+/*
+ * While pn_log_async() is on these copy a record into *ring, making
+ * the ring on first use, and return true. Otherwise they return false
+ * and the caller writes the output itself. Only one thread at a time
+ * may write to a ring.
+ */
+typedef struct pni_log_ring_t pni_log_ring_t;
+
+bool pni_log_text(pni_log_ring_t **ring, const void *source, const char *message);
+bool pni_log_frame(pni_log_ring_t **ring, const void *source, uint16_t channel, bool out,
+                   pn_data_t *args, const char *payload, size_t size);
+// what was written to the ring is still written out
+void pni_log_ring_free(pni_log_ring_t *ring);
+
 
 
 #endif
@@ -0,0 +1,127 @@
+#ifndef _PROTON_MAPPED_H
+#define _PROTON_MAPPED_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/import_export.h>
+#include <proton/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An append only file, written through a memory mapping where the
+ * platform has one so that appending is a copy rather than a system
+ * call.
+ */
+
+typedef struct pni_mapped_t pni_mapped_t;
+
+/** Create or truncate the file at path.
+ *
+ * @return the file, or NULL with errno set if it could not be created
+ * @internal
+ */
+pni_mapped_t *pni_mapped(const char *path);
+
+/** Append size bytes to the file.
+ *
+ * @return zero, or PN_ERR with errno set if the file could not grow
+ * @internal
+ */
+int pni_mapped_append(pni_mapped_t *mapped, const char *bytes, size_t size);
+
+/** Wait until what was appended is on disk.
+ *
+ * @return zero, or PN_ERR with errno set if it could not be written
+ * @internal
+ */
+int pni_mapped_sync(pni_mapped_t *mapped);
+
+/** Close the file, leaving it as long as what was appended.
+ *
+ * @internal
+ */
+void pni_mapped_close(pni_mapped_t *mapped);
+
+/*
+ * A whole file mapped read only, for tools that look at large files
+ * in no particular order.
+ */
+
+typedef struct pni_view_t pni_view_t;
+
+/** Map the file at path.
+ *
+ * @return the view, or NULL with errno set if it could not be mapped
+ * @internal
+ */
+PN_EXTERN pni_view_t *pni_view(const char *path);
+
+/** The contents of the file, valid until the view is closed.
+ *
+ * @internal
+ */
+PN_EXTERN pn_bytes_t pni_view_bytes(pni_view_t *view);
+
+PN_EXTERN void pni_view_close(pni_view_t *view);
+
+/*
+ * A range of an open file read a window at a time, mapped where the
+ * platform can so that its bytes come straight from the page cache.
+ */
+
+typedef struct pni_file_range_t pni_file_range_t;
+
+/** Read size bytes of fd from offset on. The descriptor is duplicated
+ * and can be closed by the caller.
+ *
+ * @return the range, or NULL with errno set if the file is not that
+ * long or could not be duplicated
+ * @internal
+ */
+pni_file_range_t *pni_file_range(int fd, int64_t offset, size_t size);
+
+/** The next window of the range, valid until the next call or close.
+ * The window before it is let go of.
+ *
+ * @return zero with an empty window at the end of the range, or
+ * PN_ERR with errno set if it could not be read, such as when the file
+ * was cut short
+ * @internal
+ */
+int pni_file_range_next(pni_file_range_t *range, pn_bytes_t *window);
+
+/** The bytes of the range not yet in a window.
+ *
+ * @internal
+ */
+size_t pni_file_range_remaining(pni_file_range_t *range);
+
+void pni_file_range_close(pni_file_range_t *range);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* mapped.h */
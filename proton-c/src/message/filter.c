@@ -0,0 +1,1372 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/filter.h>
+#include <proton/codec.h>
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "protocol.h"
+#include "codec/decoder.h"
+#include "encodings.h"
+#include "alloc_private.h"
+
+#define PNI_SELECTOR_FILTER_SYM "apache.org:selector-filter:string"
+#define PNI_SELECTOR_FILTER_CODE ((uint64_t) 0x0000468C00000004ULL)
+
+// how deeply parentheses, NOT and signs may nest
+#define PNI_FILTER_NESTING (256)
+
+typedef enum {
+  PNI_FILTER_NULL,      // unknown, as for a missing property
+  PNI_FILTER_BOOL,
+  PNI_FILTER_LONG,
+  PNI_FILTER_DOUBLE,
+  PNI_FILTER_STRING
+} pni_filter_type_t;
+
+typedef struct {
+  pni_filter_type_t type;
+  union {
+    bool b;
+    int64_t l;
+    double d;
+    pn_bytes_t s;
+  } u;
+} pni_filter_value_t;
+
+typedef enum {
+  PNI_OP_CONST,     // push constants[arg]
+  PNI_OP_LOAD,      // push the value of names[arg]
+  PNI_OP_JFALSE,    // jump to arg if the top is false, keeping it
+  PNI_OP_JTRUE,     // jump to arg if the top is true, keeping it
+  PNI_OP_AND,
+  PNI_OP_OR,
+  PNI_OP_NOT,
+  PNI_OP_EQ,
+  PNI_OP_NE,
+  PNI_OP_LT,
+  PNI_OP_LE,
+  PNI_OP_GT,
+  PNI_OP_GE,
+  PNI_OP_ADD,
+  PNI_OP_SUB,
+  PNI_OP_MUL,
+  PNI_OP_DIV,
+  PNI_OP_NEG,
+  PNI_OP_BETWEEN,   // value, low and high
+  PNI_OP_LIKE,      // the pattern is constants[arg], count is the escape + 1 or 0
+  PNI_OP_IN,        // the strings are constants[arg] to constants[arg + count]
+  PNI_OP_ISNULL
+} pni_filter_code_t;
+
+typedef struct {
+  uint8_t code;
+  uint32_t arg;
+  uint32_t count;
+} pni_filter_op_t;
+
+// where a name's value comes from
+enum {
+  PNI_FILTER_HEADER,
+  PNI_FILTER_PROPERTIES,
+  PNI_FILTER_APPLICATION,
+  PNI_FILTER_SOURCES
+};
+
+// how a header or properties field is given to the selector
+enum {
+  PNI_FILTER_AS_IS,
+  PNI_FILTER_MODE,      // durable as PERSISTENT or NON_PERSISTENT
+  PNI_FILTER_PRIORITY,  // 4 when missing
+  PNI_FILTER_COUNT,     // the deliveries so far, counting this one
+  PNI_FILTER_BINARY     // binary as a string
+};
+
+typedef struct {
+  pn_bytes_t name;
+  uint8_t source;
+  uint8_t field;        // the position in the header or properties list
+  uint8_t conversion;
+} pni_filter_name_t;
+
+static const struct {
+  const char *name;
+  uint8_t source;
+  uint8_t field;
+  uint8_t conversion;
+} pni_filter_jms[] = {
+  {"JMSDeliveryMode", PNI_FILTER_HEADER, HEADER_DURABLE, PNI_FILTER_MODE},
+  {"JMSPriority", PNI_FILTER_HEADER, HEADER_PRIORITY, PNI_FILTER_PRIORITY},
+  {"JMSXDeliveryCount", PNI_FILTER_HEADER, HEADER_DELIVERY_COUNT, PNI_FILTER_COUNT},
+  {"JMSMessageID", PNI_FILTER_PROPERTIES, PROPERTIES_MESSAGE_ID, PNI_FILTER_AS_IS},
+  {"JMSXUserID", PNI_FILTER_PROPERTIES, PROPERTIES_USER_ID, PNI_FILTER_BINARY},
+  {"JMSCorrelationID", PNI_FILTER_PROPERTIES, PROPERTIES_CORRELATION_ID, PNI_FILTER_AS_IS},
+  {"JMSExpiration", PNI_FILTER_PROPERTIES, PROPERTIES_ABSOLUTE_EXPIRY_TIME, PNI_FILTER_AS_IS},
+  {"JMSTimestamp", PNI_FILTER_PROPERTIES, PROPERTIES_CREATION_TIME, PNI_FILTER_AS_IS},
+  {"JMSXGroupID", PNI_FILTER_PROPERTIES, PROPERTIES_GROUP_ID, PNI_FILTER_AS_IS},
+  {"JMSXGroupSeq", PNI_FILTER_PROPERTIES, PROPERTIES_GROUP_SEQUENCE, PNI_FILTER_AS_IS}
+};
+
+struct pn_filter_t {
+  pn_error_t *error;
+  char *text;                   // the selector, its strings unescaped in place
+  pni_filter_op_t *code;
+  size_t code_count;
+  size_t code_capacity;
+  pni_filter_value_t *constants;
+  size_t constant_count;
+  size_t constant_capacity;
+  pni_filter_name_t *names;
+  size_t name_count;
+  size_t name_capacity;
+  pni_filter_value_t *stack;
+  size_t stack_size;
+  // the message being matched
+  pni_filter_value_t *values;   // of the names, once their source is loaded
+  const char *bytes;             // of the sections not yet scanned
+  size_t size;
+  pn_bytes_t sections[PNI_FILTER_SOURCES];
+  bool scanned;                 // up to the body
+  int loaded;                   // a mask of the loaded sources
+};
+
+pn_filter_t *pn_filter(void)
+{
+  pn_filter_t *filter = (pn_filter_t *) pni_calloc(PN_ALLOC_MESSAGE, 1, sizeof(pn_filter_t));
+  if (!filter) return NULL;
+  filter->error = pn_error();
+  if (!filter->error) {
+    pni_free(PN_ALLOC_MESSAGE, filter);
+    return NULL;
+  }
+  return filter;
+}
+
+static void pni_filter_reset(pn_filter_t *filter)
+{
+  pni_free(PN_ALLOC_MESSAGE, filter->text);
+  pni_free(PN_ALLOC_MESSAGE, filter->stack);
+  pni_free(PN_ALLOC_MESSAGE, filter->values);
+  filter->text = NULL;
+  filter->stack = NULL;
+  filter->values = NULL;
+  filter->code_count = 0;
+  filter->constant_count = 0;
+  filter->name_count = 0;
+  filter->stack_size = 0;
+}
+
+void pn_filter_free(pn_filter_t *filter)
+{
+  if (!filter) return;
+  pni_filter_reset(filter);
+  pni_free(PN_ALLOC_MESSAGE, filter->code);
+  pni_free(PN_ALLOC_MESSAGE, filter->constants);
+  pni_free(PN_ALLOC_MESSAGE, filter->names);
+  pn_error_free(filter->error);
+  pni_free(PN_ALLOC_MESSAGE, filter);
+}
+
+pn_error_t *pn_filter_error(pn_filter_t *filter)
+{
+  assert(filter);
+  return filter->error;
+}
+
+// compiling
+
+typedef enum {
+  PNI_TOK_END,
+  PNI_TOK_NAME,
+  PNI_TOK_STRING,
+  PNI_TOK_NUMBER,
+  PNI_TOK_AND,
+  PNI_TOK_OR,
+  PNI_TOK_NOT,
+  PNI_TOK_BETWEEN,
+  PNI_TOK_LIKE,
+  PNI_TOK_ESCAPE,
+  PNI_TOK_IN,
+  PNI_TOK_IS,
+  PNI_TOK_NULL,
+  PNI_TOK_TRUE,
+  PNI_TOK_FALSE,
+  PNI_TOK_EQ,
+  PNI_TOK_NE,
+  PNI_TOK_LT,
+  PNI_TOK_LE,
+  PNI_TOK_GT,
+  PNI_TOK_GE,
+  PNI_TOK_PLUS,
+  PNI_TOK_MINUS,
+  PNI_TOK_STAR,
+  PNI_TOK_SLASH,
+  PNI_TOK_LPAREN,
+  PNI_TOK_RPAREN,
+  PNI_TOK_COMMA
+} pni_filter_token_t;
+
+static const struct {
+  const char *word;
+  pni_filter_token_t token;
+} pni_filter_keywords[] = {
+  {"AND", PNI_TOK_AND}, {"OR", PNI_TOK_OR}, {"NOT", PNI_TOK_NOT},
+  {"BETWEEN", PNI_TOK_BETWEEN}, {"LIKE", PNI_TOK_LIKE}, {"ESCAPE", PNI_TOK_ESCAPE},
+  {"IN", PNI_TOK_IN}, {"IS", PNI_TOK_IS}, {"NULL", PNI_TOK_NULL},
+  {"TRUE", PNI_TOK_TRUE}, {"FALSE", PNI_TOK_FALSE}
+};
+
+// what an expression gives, so conditions and values are not mixed up
+typedef enum {
+  PNI_KIND_CONDITION,
+  PNI_KIND_VALUE,
+  PNI_KIND_ANY          // a property, which may be either
+} pni_filter_kind_t;
+
+typedef struct {
+  pn_filter_t *filter;
+  const char *input;
+  char *position;       // after the current token
+  char *start;          // of the current token
+  pni_filter_token_t token;
+  pn_bytes_t text;      // of a name, or the unescaped string
+  pni_filter_value_t value;
+  size_t depth;         // of the stack at this point of the program
+  int nesting;
+  int err;
+} pni_compiler_t;
+
+static void pni_filter_fail(pni_compiler_t *c, const char *what)
+{
+  if (c->err) return;
+  c->err = PN_ARG_ERR;
+  pn_error_format(c->filter->error, PN_ARG_ERR, "selector: %s at offset %d", what,
+                  (int) (c->start - c->input));
+}
+
+static bool pni_filter_name_char(char ch)
+{
+  return isalnum((unsigned char) ch) || ch == '_' || ch == '$' || (unsigned char) ch >= 0x80;
+}
+
+static void pni_filter_number(pni_compiler_t *c, char *p)
+{
+  bool real = false;
+  if (!(p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))) {
+    char *q = p;
+    while (isdigit((unsigned char) *q)) q++;
+    real = *q == '.' || *q == 'e' || *q == 'E';
+  }
+
+  char *end;
+  errno = 0;
+  if (real) {
+    c->value.type = PNI_FILTER_DOUBLE;
+    c->value.u.d = strtod(p, &end);
+  } else {
+    c->value.type = PNI_FILTER_LONG;
+    c->value.u.l = strtoll(p, &end, 0);
+  }
+  if (errno == ERANGE) {
+    pni_filter_fail(c, "number out of range");
+    return;
+  }
+  switch (*end) {
+  case 'l':
+  case 'L':
+    if (real) break;
+    end++;
+    break;
+  case 'f':
+  case 'F':
+  case 'd':
+  case 'D':
+    if (!real) c->value.u.d = (double) c->value.u.l;
+    c->value.type = PNI_FILTER_DOUBLE;
+    end++;
+    break;
+  }
+  if (pni_filter_name_char(*end) || *end == '.') {
+    pni_filter_fail(c, "malformed number");
+    return;
+  }
+  c->token = PNI_TOK_NUMBER;
+  c->position = end;
+}
+
+static void pni_filter_lex(pni_compiler_t *c)
+{
+  char *p = c->position;
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '\f') p++;
+  c->start = p;
+
+  if (!*p) {
+    c->token = PNI_TOK_END;
+  } else if (pni_filter_name_char(*p) && !isdigit((unsigned char) *p)) {
+    char *name = p;
+    while (pni_filter_name_char(*p)) p++;
+    c->text = pn_bytes(p - name, name);
+    c->token = PNI_TOK_NAME;
+    for (size_t i = 0; i < sizeof(pni_filter_keywords)/sizeof(pni_filter_keywords[0]); i++) {
+      const char *word = pni_filter_keywords[i].word;
+      size_t j = 0;
+      while (j < c->text.size && word[j] && toupper((unsigned char) name[j]) == word[j]) j++;
+      if (j == c->text.size && !word[j]) {
+        c->token = pni_filter_keywords[i].token;
+        break;
+      }
+    }
+  } else if (isdigit((unsigned char) *p) || (*p == '.' && isdigit((unsigned char) p[1]))) {
+    pni_filter_number(c, p);
+    return;
+  } else if (*p == '\'') {
+    // a doubled quote stands for one
+    char *string = ++p;
+    char *out = string;
+    for (;;) {
+      if (!*p) {
+        pni_filter_fail(c, "unterminated string");
+        return;
+      }
+      if (*p == '\'') {
+        if (p[1] != '\'') break;
+        p++;
+      }
+      *out++ = *p++;
+    }
+    p++;
+    c->text = pn_bytes(out - string, string);
+    c->token = PNI_TOK_STRING;
+  } else {
+    switch (*p++) {
+    case '=': c->token = PNI_TOK_EQ; break;
+    case '<':
+      if (*p == '>') {
+        c->token = PNI_TOK_NE;
+        p++;
+      } else if (*p == '=') {
+        c->token = PNI_TOK_LE;
+        p++;
+      } else {
+        c->token = PNI_TOK_LT;
+      }
+      break;
+    case '>':
+      if (*p == '=') {
+        c->token = PNI_TOK_GE;
+        p++;
+      } else {
+        c->token = PNI_TOK_GT;
+      }
+      break;
+    case '+': c->token = PNI_TOK_PLUS; break;
+    case '-': c->token = PNI_TOK_MINUS; break;
+    case '*': c->token = PNI_TOK_STAR; break;
+    case '/': c->token = PNI_TOK_SLASH; break;
+    case '(': c->token = PNI_TOK_LPAREN; break;
+    case ')': c->token = PNI_TOK_RPAREN; break;
+    case ',': c->token = PNI_TOK_COMMA; break;
+    default:
+      pni_filter_fail(c, "unexpected character");
+      return;
+    }
+  }
+  c->position = p;
+}
+
+static bool pni_filter_accept(pni_compiler_t *c, pni_filter_token_t token)
+{
+  if (c->err || c->token != token) return false;
+  pni_filter_lex(c);
+  return true;
+}
+
+static void pni_filter_expect(pni_compiler_t *c, pni_filter_token_t token, const char *what)
+{
+  if (!pni_filter_accept(c, token)) pni_filter_fail(c, what);
+}
+
+// appends an instruction, returning where it is
+static size_t pni_filter_emit(pni_compiler_t *c, pni_filter_code_t code, uint32_t arg,
+                              uint32_t count)
+{
+  pn_filter_t *filter = c->filter;
+  if (c->err) return 0;
+  if (filter->code_count == filter->code_capacity) {
+    size_t capacity = filter->code_capacity ? 2*filter->code_capacity : 16;
+    pni_filter_op_t *ops = (pni_filter_op_t *)
+      pni_realloc(PN_ALLOC_MESSAGE, filter->code, capacity*sizeof(pni_filter_op_t));
+    if (!ops) {
+      pni_filter_fail(c, "out of memory");
+      return 0;
+    }
+    filter->code = ops;
+    filter->code_capacity = capacity;
+  }
+
+  switch (code) {
+  case PNI_OP_CONST:
+  case PNI_OP_LOAD:
+    c->depth++;
+    break;
+  case PNI_OP_BETWEEN:
+    c->depth -= 2;
+    break;
+  case PNI_OP_AND:
+  case PNI_OP_OR:
+  case PNI_OP_EQ:
+  case PNI_OP_NE:
+  case PNI_OP_LT:
+  case PNI_OP_LE:
+  case PNI_OP_GT:
+  case PNI_OP_GE:
+  case PNI_OP_ADD:
+  case PNI_OP_SUB:
+  case PNI_OP_MUL:
+  case PNI_OP_DIV:
+    c->depth--;
+    break;
+  default:
+    break;
+  }
+  if (c->depth > filter->stack_size) filter->stack_size = c->depth;
+
+  pni_filter_op_t *op = &filter->code[filter->code_count];
+  op->code = code;
+  op->arg = arg;
+  op->count = count;
+  return filter->code_count++;
+}
+
+static uint32_t pni_filter_constant(pni_compiler_t *c, pni_filter_value_t value)
+{
+  pn_filter_t *filter = c->filter;
+  if (c->err) return 0;
+  if (filter->constant_count == filter->constant_capacity) {
+    size_t capacity = filter->constant_capacity ? 2*filter->constant_capacity : 8;
+    pni_filter_value_t *constants = (pni_filter_value_t *)
+      pni_realloc(PN_ALLOC_MESSAGE, filter->constants, capacity*sizeof(pni_filter_value_t));
+    if (!constants) {
+      pni_filter_fail(c, "out of memory");
+      return 0;
+    }
+    filter->constants = constants;
+    filter->constant_capacity = capacity;
+  }
+  filter->constants[filter->constant_count] = value;
+  return filter->constant_count++;
+}
+
+static uint32_t pni_filter_string(pni_compiler_t *c, pn_bytes_t text)
+{
+  pni_filter_value_t value;
+  value.type = PNI_FILTER_STRING;
+  value.u.s = text;
+  return pni_filter_constant(c, value);
+}
+
+// each name has one slot however often it is used
+static uint32_t pni_filter_name(pni_compiler_t *c, pn_bytes_t text)
+{
+  pn_filter_t *filter = c->filter;
+  for (size_t i = 0; i < filter->name_count; i++) {
+    pn_bytes_t name = filter->names[i].name;
+    if (name.size == text.size && !memcmp(name.start, text.start, text.size)) return i;
+  }
+  if (c->err) return 0;
+
+  if (filter->name_count == filter->name_capacity) {
+    size_t capacity = filter->name_capacity ? 2*filter->name_capacity : 8;
+    pni_filter_name_t *names = (pni_filter_name_t *)
+      pni_realloc(PN_ALLOC_MESSAGE, filter->names, capacity*sizeof(pni_filter_name_t));
+    if (!names) {
+      pni_filter_fail(c, "out of memory");
+      return 0;
+    }
+    filter->names = names;
+    filter->name_capacity = capacity;
+  }
+
+  pni_filter_name_t *name = &filter->names[filter->name_count];
+  name->name = text;
+  name->source = PNI_FILTER_APPLICATION;
+  name->field = 0;
+  name->conversion = PNI_FILTER_AS_IS;
+  for (size_t i = 0; i < sizeof(pni_filter_jms)/sizeof(pni_filter_jms[0]); i++) {
+    const char *jms = pni_filter_jms[i].name;
+    if (strlen(jms) == text.size && !memcmp(jms, text.start, text.size)) {
+      name->source = pni_filter_jms[i].source;
+      name->field = pni_filter_jms[i].field;
+      name->conversion = pni_filter_jms[i].conversion;
+      break;
+    }
+  }
+  return filter->name_count++;
+}
+
+static void pni_filter_condition(pni_compiler_t *c, pni_filter_kind_t kind)
+{
+  if (kind == PNI_KIND_VALUE) pni_filter_fail(c, "expected a condition");
+}
+
+static void pni_filter_operand(pni_compiler_t *c, pni_filter_kind_t kind)
+{
+  if (kind == PNI_KIND_CONDITION) pni_filter_fail(c, "expected a value");
+}
+
+static bool pni_filter_nest(pni_compiler_t *c)
+{
+  if (++c->nesting > PNI_FILTER_NESTING) {
+    pni_filter_fail(c, "too deeply nested");
+    return false;
+  }
+  return true;
+}
+
+static pni_filter_kind_t pni_filter_or(pni_compiler_t *c);
+
+static pni_filter_kind_t pni_filter_primary(pni_compiler_t *c)
+{
+  pni_filter_kind_t kind = PNI_KIND_VALUE;
+  pni_filter_value_t value;
+  switch (c->token) {
+  case PNI_TOK_NUMBER:
+    pni_filter_emit(c, PNI_OP_CONST, pni_filter_constant(c, c->value), 0);
+    break;
+  case PNI_TOK_STRING:
+    pni_filter_emit(c, PNI_OP_CONST, pni_filter_string(c, c->text), 0);
+    break;
+  case PNI_TOK_TRUE:
+  case PNI_TOK_FALSE:
+    value.type = PNI_FILTER_BOOL;
+    value.u.b = c->token == PNI_TOK_TRUE;
+    pni_filter_emit(c, PNI_OP_CONST, pni_filter_constant(c, value), 0);
+    kind = PNI_KIND_CONDITION;
+    break;
+  case PNI_TOK_NAME:
+    pni_filter_emit(c, PNI_OP_LOAD, pni_filter_name(c, c->text), 0);
+    kind = PNI_KIND_ANY;
+    break;
+  case PNI_TOK_LPAREN:
+    if (!pni_filter_nest(c)) return kind;
+    pni_filter_lex(c);
+    kind = pni_filter_or(c);
+    c->nesting--;
+    pni_filter_expect(c, PNI_TOK_RPAREN, "expected )");
+    return kind;
+  default:
+    pni_filter_fail(c, "expected a value");
+    return kind;
+  }
+  pni_filter_lex(c);
+  return kind;
+}
+
+static pni_filter_kind_t pni_filter_unary(pni_compiler_t *c)
+{
+  if (c->token != PNI_TOK_PLUS && c->token != PNI_TOK_MINUS) return pni_filter_primary(c);
+  bool minus = c->token == PNI_TOK_MINUS;
+  if (!pni_filter_nest(c)) return PNI_KIND_VALUE;
+  pni_filter_lex(c);
+  pni_filter_operand(c, pni_filter_unary(c));
+  c->nesting--;
+  if (minus) pni_filter_emit(c, PNI_OP_NEG, 0, 0);
+  return PNI_KIND_VALUE;
+}
+
+static pni_filter_kind_t pni_filter_product(pni_compiler_t *c)
+{
+  pni_filter_kind_t kind = pni_filter_unary(c);
+  while (!c->err && (c->token == PNI_TOK_STAR || c->token == PNI_TOK_SLASH)) {
+    pni_filter_code_t code = c->token == PNI_TOK_STAR ? PNI_OP_MUL : PNI_OP_DIV;
+    pni_filter_operand(c, kind);
+    pni_filter_lex(c);
+    pni_filter_operand(c, pni_filter_unary(c));
+    pni_filter_emit(c, code, 0, 0);
+    kind = PNI_KIND_VALUE;
+  }
+  return kind;
+}
+
+static pni_filter_kind_t pni_filter_sum(pni_compiler_t *c)
+{
+  pni_filter_kind_t kind = pni_filter_product(c);
+  while (!c->err && (c->token == PNI_TOK_PLUS || c->token == PNI_TOK_MINUS)) {
+    pni_filter_code_t code = c->token == PNI_TOK_PLUS ? PNI_OP_ADD : PNI_OP_SUB;
+    pni_filter_operand(c, kind);
+    pni_filter_lex(c);
+    pni_filter_operand(c, pni_filter_product(c));
+    pni_filter_emit(c, code, 0, 0);
+    kind = PNI_KIND_VALUE;
+  }
+  return kind;
+}
+
+static pni_filter_kind_t pni_filter_is(pni_compiler_t *c)
+{
+  pni_filter_lex(c);
+  bool negate = pni_filter_accept(c, PNI_TOK_NOT);
+  pni_filter_expect(c, PNI_TOK_NULL, "expected NULL");
+  pni_filter_emit(c, PNI_OP_ISNULL, 0, 0);
+  if (negate) pni_filter_emit(c, PNI_OP_NOT, 0, 0);
+  return PNI_KIND_CONDITION;
+}
+
+// the escape must be followed by the character it escapes
+static bool pni_filter_pattern(pn_bytes_t pattern, int escape)
+{
+  for (size_t i = 0; i < pattern.size; i++) {
+    if ((unsigned char) pattern.start[i] == escape && ++i == pattern.size) return false;
+  }
+  return true;
+}
+
+// [NOT] BETWEEN, LIKE or IN
+static pni_filter_kind_t pni_filter_membership(pni_compiler_t *c, pni_filter_kind_t kind)
+{
+  bool negate = pni_filter_accept(c, PNI_TOK_NOT);
+  pni_filter_operand(c, kind);
+  if (pni_filter_accept(c, PNI_TOK_BETWEEN)) {
+    pni_filter_operand(c, pni_filter_sum(c));
+    pni_filter_expect(c, PNI_TOK_AND, "expected AND");
+    pni_filter_operand(c, pni_filter_sum(c));
+    pni_filter_emit(c, PNI_OP_BETWEEN, 0, 0);
+  } else if (pni_filter_accept(c, PNI_TOK_LIKE)) {
+    pn_bytes_t pattern = c->text;
+    pni_filter_expect(c, PNI_TOK_STRING, "expected a pattern");
+    uint32_t escape = 0;
+    if (pni_filter_accept(c, PNI_TOK_ESCAPE)) {
+      if (c->token != PNI_TOK_STRING || c->text.size != 1) {
+        pni_filter_fail(c, "expected a one character escape");
+      } else {
+        escape = 1 + (unsigned char) c->text.start[0];
+        pni_filter_lex(c);
+      }
+    }
+    if (!pni_filter_pattern(pattern, (int) escape - 1)) {
+      pni_filter_fail(c, "escape at the end of the pattern");
+    }
+    pni_filter_emit(c, PNI_OP_LIKE, pni_filter_string(c, pattern), escape);
+  } else if (pni_filter_accept(c, PNI_TOK_IN)) {
+    pni_filter_expect(c, PNI_TOK_LPAREN, "expected (");
+    uint32_t first = c->filter->constant_count;
+    uint32_t count = 0;
+    do {
+      if (c->token == PNI_TOK_STRING) {
+        pni_filter_string(c, c->text);
+        count++;
+      }
+      pni_filter_expect(c, PNI_TOK_STRING, "expected a string");
+    } while (pni_filter_accept(c, PNI_TOK_COMMA));
+    pni_filter_expect(c, PNI_TOK_RPAREN, "expected )");
+    pni_filter_emit(c, PNI_OP_IN, first, count);
+  } else {
+    pni_filter_fail(c, "expected BETWEEN, LIKE or IN");
+  }
+  if (negate) pni_filter_emit(c, PNI_OP_NOT, 0, 0);
+  return PNI_KIND_CONDITION;
+}
+
+static pni_filter_kind_t pni_filter_predicate(pni_compiler_t *c)
+{
+  pni_filter_kind_t kind = pni_filter_sum(c);
+  if (c->err) return kind;
+
+  pni_filter_code_t code;
+  switch (c->token) {
+  case PNI_TOK_EQ: code = PNI_OP_EQ; break;
+  case PNI_TOK_NE: code = PNI_OP_NE; break;
+  case PNI_TOK_LT: code = PNI_OP_LT; break;
+  case PNI_TOK_LE: code = PNI_OP_LE; break;
+  case PNI_TOK_GT: code = PNI_OP_GT; break;
+  case PNI_TOK_GE: code = PNI_OP_GE; break;
+  case PNI_TOK_IS:
+    return pni_filter_is(c);
+  case PNI_TOK_NOT:
+  case PNI_TOK_BETWEEN:
+  case PNI_TOK_LIKE:
+  case PNI_TOK_IN:
+    return pni_filter_membership(c, kind);
+  default:
+    return kind;
+  }
+
+  pni_filter_lex(c);
+  pni_filter_sum(c);
+  pni_filter_emit(c, code, 0, 0);
+  return PNI_KIND_CONDITION;
+}
+
+static pni_filter_kind_t pni_filter_not(pni_compiler_t *c)
+{
+  if (c->token != PNI_TOK_NOT) return pni_filter_predicate(c);
+  if (!pni_filter_nest(c)) return PNI_KIND_CONDITION;
+  pni_filter_lex(c);
+  pni_filter_condition(c, pni_filter_not(c));
+  c->nesting--;
+  pni_filter_emit(c, PNI_OP_NOT, 0, 0);
+  return PNI_KIND_CONDITION;
+}
+
+// the right hand side is skipped once the left decides the result
+static pni_filter_kind_t pni_filter_and(pni_compiler_t *c)
+{
+  pni_filter_kind_t kind = pni_filter_not(c);
+  while (!c->err && c->token == PNI_TOK_AND) {
+    pni_filter_condition(c, kind);
+    size_t jump = pni_filter_emit(c, PNI_OP_JFALSE, 0, 0);
+    pni_filter_lex(c);
+    pni_filter_condition(c, pni_filter_not(c));
+    pni_filter_emit(c, PNI_OP_AND, 0, 0);
+    if (!c->err) c->filter->code[jump].arg = c->filter->code_count;
+    kind = PNI_KIND_CONDITION;
+  }
+  return kind;
+}
+
+static pni_filter_kind_t pni_filter_or(pni_compiler_t *c)
+{
+  pni_filter_kind_t kind = pni_filter_and(c);
+  while (!c->err && c->token == PNI_TOK_OR) {
+    pni_filter_condition(c, kind);
+    size_t jump = pni_filter_emit(c, PNI_OP_JTRUE, 0, 0);
+    pni_filter_lex(c);
+    pni_filter_condition(c, pni_filter_and(c));
+    pni_filter_emit(c, PNI_OP_OR, 0, 0);
+    if (!c->err) c->filter->code[jump].arg = c->filter->code_count;
+    kind = PNI_KIND_CONDITION;
+  }
+  return kind;
+}
+
+static int pni_filter_compile(pn_filter_t *filter, const char *selector, size_t size)
+{
+  pni_filter_reset(filter);
+  pn_error_clear(filter->error);
+  if (!selector) return 0;
+
+  filter->text = (char *) pni_malloc(PN_ALLOC_MESSAGE, size + 1);
+  if (!filter->text) return pn_error_format(filter->error, PN_ERR, "selector: out of memory");
+  memcpy(filter->text, selector, size);
+  filter->text[size] = '\0';
+
+  pni_compiler_t c;
+  memset(&c, 0, sizeof(c));
+  c.filter = filter;
+  c.input = filter->text;
+  c.position = filter->text;
+  pni_filter_lex(&c);
+  if (!c.err && c.token == PNI_TOK_END) {
+    pni_filter_reset(filter);
+    return 0;
+  }
+  pni_filter_kind_t kind = pni_filter_or(&c);
+  if (c.token != PNI_TOK_END) pni_filter_fail(&c, "unexpected token");
+  pni_filter_condition(&c, kind);
+
+  if (!c.err) {
+    filter->stack = (pni_filter_value_t *)
+      pni_malloc(PN_ALLOC_MESSAGE, filter->stack_size*sizeof(pni_filter_value_t));
+    filter->values = (pni_filter_value_t *)
+      pni_calloc(PN_ALLOC_MESSAGE, filter->name_count ? filter->name_count : 1,
+                 sizeof(pni_filter_value_t));
+    if (!filter->stack || !filter->values) pni_filter_fail(&c, "out of memory");
+  }
+  if (c.err) {
+    pni_filter_reset(filter);
+    return c.err;
+  }
+  return 0;
+}
+
+int pn_filter_compile(pn_filter_t *filter, const char *selector)
+{
+  assert(filter);
+  return pni_filter_compile(filter, selector, selector ? strlen(selector) : 0);
+}
+
+int pn_filter_compile_terminus(pn_filter_t *filter, pn_terminus_t *terminus)
+{
+  assert(filter && terminus);
+  pn_data_t *filters = pn_terminus_filter(terminus);
+  pn_bytes_t selector = pn_bytes(0, NULL);
+  pn_data_rewind(filters);
+  if (pn_data_next(filters) && pn_data_type(filters) == PN_MAP) {
+    pn_data_enter(filters);
+    // the keys are only names, the descriptor says what a filter is
+    while (!selector.start && pn_data_next(filters) && pn_data_next(filters)) {
+      if (pn_data_type(filters) != PN_DESCRIBED) continue;
+      pn_data_enter(filters);
+      pn_data_next(filters);
+      bool match = false;
+      if (pn_data_type(filters) == PN_ULONG) {
+        match = pn_data_get_ulong(filters) == PNI_SELECTOR_FILTER_CODE;
+      } else if (pn_data_type(filters) == PN_SYMBOL) {
+        pn_bytes_t symbol = pn_data_get_symbol(filters);
+        match = symbol.size == strlen(PNI_SELECTOR_FILTER_SYM) &&
+          !memcmp(symbol.start, PNI_SELECTOR_FILTER_SYM, symbol.size);
+      }
+      if (match && pn_data_next(filters) && pn_data_type(filters) == PN_STRING) {
+        selector = pn_data_get_string(filters);
+        if (!selector.start) selector.start = "";
+      }
+      pn_data_exit(filters);
+    }
+  }
+  pn_data_rewind(filters);
+  return pni_filter_compile(filter, selector.start, selector.size);
+}
+
+// matching
+
+static inline uint16_t pni_filter_read16(const char *bytes)
+{
+  const uint8_t *b = (const uint8_t *) bytes;
+  return (uint16_t) b[0] << 8 | b[1];
+}
+
+static inline uint32_t pni_filter_read32(const char *bytes)
+{
+  const uint8_t *b = (const uint8_t *) bytes;
+  return (uint32_t) b[0] << 24 | (uint32_t) b[1] << 16 | (uint32_t) b[2] << 8 | b[3];
+}
+
+static inline uint64_t pni_filter_read64(const char *bytes)
+{
+  return (uint64_t) pni_filter_read32(bytes) << 32 | pni_filter_read32(bytes + 4);
+}
+
+// the value of an encoding whose size has been checked, anything a
+// selector cannot compare is unknown
+static void pni_filter_read(const char *bytes, size_t size, pni_filter_value_t *value)
+{
+  value->type = PNI_FILTER_LONG;
+  switch ((uint8_t) bytes[0]) {
+  case PNE_TRUE:
+  case PNE_FALSE:
+    value->type = PNI_FILTER_BOOL;
+    value->u.b = (uint8_t) bytes[0] == PNE_TRUE;
+    break;
+  case PNE_BOOLEAN:
+    value->type = PNI_FILTER_BOOL;
+    value->u.b = bytes[1] != 0;
+    break;
+  case PNE_UINT0:
+  case PNE_ULONG0:
+    value->u.l = 0;
+    break;
+  case PNE_UBYTE:
+  case PNE_SMALLUINT:
+  case PNE_SMALLULONG:
+    value->u.l = (uint8_t) bytes[1];
+    break;
+  case PNE_BYTE:
+  case PNE_SMALLINT:
+  case PNE_SMALLLONG:
+    value->u.l = (int8_t) bytes[1];
+    break;
+  case PNE_USHORT:
+    value->u.l = pni_filter_read16(bytes + 1);
+    break;
+  case PNE_SHORT:
+    value->u.l = (int16_t) pni_filter_read16(bytes + 1);
+    break;
+  case PNE_UINT:
+    value->u.l = pni_filter_read32(bytes + 1);
+    break;
+  case PNE_INT:
+    value->u.l = (int32_t) pni_filter_read32(bytes + 1);
+    break;
+  case PNE_ULONG:
+  case PNE_LONG:
+  case PNE_MS64:
+    value->u.l = (int64_t) pni_filter_read64(bytes + 1);
+    break;
+  case PNE_FLOAT: {
+    uint32_t bits = pni_filter_read32(bytes + 1);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    value->type = PNI_FILTER_DOUBLE;
+    value->u.d = f;
+    break;
+  }
+  case PNE_DOUBLE: {
+    uint64_t bits = pni_filter_read64(bytes + 1);
+    value->type = PNI_FILTER_DOUBLE;
+    memcpy(&value->u.d, &bits, sizeof(value->u.d));
+    break;
+  }
+  case PNE_STR8_UTF8:
+  case PNE_SYM8:
+    value->type = PNI_FILTER_STRING;
+    value->u.s = pn_bytes(size - 2, (char *) bytes + 2);
+    break;
+  case PNE_STR32_UTF8:
+  case PNE_SYM32:
+    value->type = PNI_FILTER_STRING;
+    value->u.s = pn_bytes(size - 5, (char *) bytes + 5);
+    break;
+  default:
+    value->type = PNI_FILTER_NULL;
+    break;
+  }
+}
+
+static void pni_filter_default(const pni_filter_name_t *name, pni_filter_value_t *value)
+{
+  value->type = PNI_FILTER_LONG;
+  switch (name->conversion) {
+  case PNI_FILTER_MODE:
+    value->type = PNI_FILTER_STRING;
+    value->u.s = pn_bytes(14, "NON_PERSISTENT");
+    break;
+  case PNI_FILTER_PRIORITY:
+    value->u.l = 4;
+    break;
+  case PNI_FILTER_COUNT:
+    value->u.l = 1;
+    break;
+  default:
+    value->type = PNI_FILTER_NULL;
+    break;
+  }
+}
+
+static void pni_filter_field(const pni_filter_name_t *name, const char *bytes, size_t size,
+                             pni_filter_value_t *value)
+{
+  pni_filter_value_t field;
+  pni_filter_read(bytes, size, &field);
+  switch (name->conversion) {
+  case PNI_FILTER_MODE:
+    if (field.type != PNI_FILTER_BOOL) return;
+    value->type = PNI_FILTER_STRING;
+    value->u.s = field.u.b ? pn_bytes(10, "PERSISTENT") : pn_bytes(14, "NON_PERSISTENT");
+    return;
+  case PNI_FILTER_COUNT:
+    if (field.type != PNI_FILTER_LONG) return;
+    value->type = PNI_FILTER_LONG;
+    value->u.l = field.u.l + 1;
+    return;
+  case PNI_FILTER_BINARY:
+    if ((uint8_t) bytes[0] == PNE_VBIN8) {
+      field.type = PNI_FILTER_STRING;
+      field.u.s = pn_bytes(size - 2, (char *) bytes + 2);
+    } else if ((uint8_t) bytes[0] == PNE_VBIN32) {
+      field.type = PNI_FILTER_STRING;
+      field.u.s = pn_bytes(size - 5, (char *) bytes + 5);
+    }
+    break;
+  default:
+    break;
+  }
+  if (field.type != PNI_FILTER_NULL) *value = field;
+}
+
+// the element count of a list or map, and the offset of the first
+static ssize_t pni_filter_enter(const char *bytes, size_t size, size_t *count)
+{
+  switch ((uint8_t) bytes[0]) {
+  case PNE_LIST0:
+    *count = 0;
+    return 1;
+  case PNE_LIST8:
+  case PNE_MAP8:
+    if (size < 3) return PN_UNDERFLOW;
+    *count = (uint8_t) bytes[2];
+    return 3;
+  case PNE_LIST32:
+  case PNE_MAP32:
+    if (size < 9) return PN_UNDERFLOW;
+    *count = pni_filter_read32(bytes + 5);
+    return 9;
+  default:
+    return PN_ARG_ERR;
+  }
+}
+
+// locates sections until the source's is found, never looking at the
+// body, and at nothing past the source's section
+static int pni_filter_scan(pn_filter_t *filter, int source)
+{
+  while (!filter->scanned && !filter->sections[source].start) {
+    const char *bytes = filter->bytes;
+    size_t size = filter->size;
+    if (!size || (uint8_t) bytes[0] != PNE_DESCRIPTOR) break;
+    ssize_t dsize = pn_decoder_skip(bytes + 1, size - 1);
+    if (dsize < 0) return dsize;
+    uint64_t code;
+    switch ((uint8_t) bytes[1]) {
+    case PNE_SMALLULONG: code = (uint8_t) bytes[2]; break;
+    case PNE_ULONG: code = pni_filter_read64(bytes + 2); break;
+    default: code = 0; break;
+    }
+    if (code < HEADER || code > APPLICATION_PROPERTIES) break;
+
+    const char *value = bytes + 1 + dsize;
+    size_t available = size - 1 - dsize;
+    ssize_t used = pn_decoder_skip(value, available);
+    if (used < 0) return used;
+    switch (code) {
+    case HEADER:
+      filter->sections[PNI_FILTER_HEADER] = pn_bytes(used, (char *) value);
+      break;
+    case PROPERTIES:
+      filter->sections[PNI_FILTER_PROPERTIES] = pn_bytes(used, (char *) value);
+      break;
+    case APPLICATION_PROPERTIES:
+      filter->sections[PNI_FILTER_APPLICATION] = pn_bytes(used, (char *) value);
+      filter->scanned = true;
+      break;
+    default:
+      break;
+    }
+    filter->bytes = value + used;
+    filter->size = available - used;
+  }
+  if (!filter->sections[source].start) filter->scanned = true;
+  return 0;
+}
+
+// reads the values of all the names with the source, decoding nothing
+// else
+static int pni_filter_load(pn_filter_t *filter, int source)
+{
+  int err = pni_filter_scan(filter, source);
+  if (err) return err;
+  filter->loaded |= 1 << source;
+
+  size_t pending = 0;
+  for (size_t i = 0; i < filter->name_count; i++) {
+    if (filter->names[i].source != source) continue;
+    pni_filter_default(&filter->names[i], &filter->values[i]);
+    pending++;
+  }
+
+  pn_bytes_t section = filter->sections[source];
+  if (!section.start) return 0;
+  size_t count;
+  ssize_t offset = pni_filter_enter(section.start, section.size, &count);
+  if (offset < 0) return offset;
+  const char *bytes = section.start + offset;
+  size_t size = section.size - offset;
+
+  for (size_t i = 0; i < count && pending; i++) {
+    ssize_t n = pn_decoder_skip(bytes, size);
+    if (n < 0) return n;
+    if (source == PNI_FILTER_APPLICATION) {
+      pni_filter_value_t key;
+      pni_filter_read(bytes, n, &key);
+      bytes += n;
+      size -= n;
+      n = pn_decoder_skip(bytes, size);
+      if (n < 0) return n;
+      i++;
+      for (size_t j = 0; key.type == PNI_FILTER_STRING && j < filter->name_count; j++) {
+        pni_filter_name_t *name = &filter->names[j];
+        if (name->source == source && name->name.size == key.u.s.size &&
+            !memcmp(name->name.start, key.u.s.start, key.u.s.size)) {
+          pni_filter_read(bytes, n, &filter->values[j]);
+          pending--;
+          break;
+        }
+      }
+    } else {
+      for (size_t j = 0; j < filter->name_count; j++) {
+        pni_filter_name_t *name = &filter->names[j];
+        if (name->source == source && name->field == i) {
+          pni_filter_field(name, bytes, n, &filter->values[j]);
+          pending--;
+        }
+      }
+    }
+    bytes += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// three valued logic: 1 is true, 0 false and -1 unknown
+static inline int pni_filter_truth(const pni_filter_value_t *value)
+{
+  return value->type == PNI_FILTER_BOOL ? value->u.b : -1;
+}
+
+static inline void pni_filter_bool(pni_filter_value_t *value, int truth)
+{
+  value->type = truth < 0 ? PNI_FILTER_NULL : PNI_FILTER_BOOL;
+  value->u.b = truth > 0;
+}
+
+static inline bool pni_filter_numeric(const pni_filter_value_t *value)
+{
+  return value->type == PNI_FILTER_LONG || value->type == PNI_FILTER_DOUBLE;
+}
+
+static inline double pni_filter_double(const pni_filter_value_t *value)
+{
+  return value->type == PNI_FILTER_LONG ? (double) value->u.l : value->u.d;
+}
+
+// strings and booleans are only equal or not, and a comparison with a
+// missing value or one of another type is unknown
+static int pni_filter_compare(pni_filter_code_t code, const pni_filter_value_t *a,
+                              const pni_filter_value_t *b)
+{
+  int order;
+  if (pni_filter_numeric(a) && pni_filter_numeric(b)) {
+    if (a->type == PNI_FILTER_LONG && b->type == PNI_FILTER_LONG) {
+      order = (a->u.l > b->u.l) - (a->u.l < b->u.l);
+    } else {
+      double x = pni_filter_double(a);
+      double y = pni_filter_double(b);
+      if (x != x || y != y) return code == PNI_OP_NE;
+      order = (x > y) - (x < y);
+    }
+  } else if (a->type == b->type && (a->type == PNI_FILTER_STRING || a->type == PNI_FILTER_BOOL)) {
+    if (code != PNI_OP_EQ && code != PNI_OP_NE) return -1;
+    if (a->type == PNI_FILTER_BOOL) {
+      order = a->u.b != b->u.b;
+    } else {
+      order = a->u.s.size != b->u.s.size || memcmp(a->u.s.start, b->u.s.start, a->u.s.size);
+    }
+  } else {
+    return -1;
+  }
+
+  switch (code) {
+  case PNI_OP_EQ: return order == 0;
+  case PNI_OP_NE: return order != 0;
+  case PNI_OP_LT: return order < 0;
+  case PNI_OP_LE: return order <= 0;
+  case PNI_OP_GT: return order > 0;
+  default: return order >= 0;
+  }
+}
+
+// long arithmetic wraps rather than overflowing
+static void pni_filter_arithmetic(pni_filter_code_t code, pni_filter_value_t *a,
+                                  const pni_filter_value_t *b)
+{
+  if (!pni_filter_numeric(a) || !pni_filter_numeric(b)) {
+    a->type = PNI_FILTER_NULL;
+    return;
+  }
+  if (a->type == PNI_FILTER_LONG && b->type == PNI_FILTER_LONG) {
+    uint64_t x = a->u.l;
+    uint64_t y = b->u.l;
+    switch (code) {
+    case PNI_OP_ADD: a->u.l = (int64_t) (x + y); break;
+    case PNI_OP_SUB: a->u.l = (int64_t) (x - y); break;
+    case PNI_OP_MUL: a->u.l = (int64_t) (x * y); break;
+    default:
+      if (!b->u.l) {
+        a->type = PNI_FILTER_NULL;
+      } else if (b->u.l == -1) {
+        a->u.l = (int64_t) (0 - x);
+      } else {
+        a->u.l /= b->u.l;
+      }
+      break;
+    }
+    return;
+  }
+  double x = pni_filter_double(a);
+  double y = pni_filter_double(b);
+  a->type = PNI_FILTER_DOUBLE;
+  switch (code) {
+  case PNI_OP_ADD: a->u.d = x + y; break;
+  case PNI_OP_SUB: a->u.d = x - y; break;
+  case PNI_OP_MUL: a->u.d = x * y; break;
+  default: a->u.d = x / y; break;
+  }
+}
+
+// the offset of the character after the one at i
+static inline size_t pni_filter_next_char(pn_bytes_t s, size_t i)
+{
+  i++;
+  while (i < s.size && ((uint8_t) s.start[i] & 0xC0) == 0x80) i++;
+  return i;
+}
+
+// % matches any run of characters and _ any one, backtracking to the
+// last % on a mismatch
+static bool pni_filter_like(pn_bytes_t s, pn_bytes_t p, int escape)
+{
+  size_t si = 0, pi = 0;
+  size_t star = (size_t) -1, mark = 0;
+  while (si < s.size) {
+    if (pi < p.size) {
+      char ch = p.start[pi];
+      if (escape >= 0 && (unsigned char) ch == escape && pi + 1 < p.size) {
+        if (s.start[si] == p.start[pi + 1]) {
+          si++;
+          pi += 2;
+          continue;
+        }
+      } else if (ch == '%') {
+        star = ++pi;
+        mark = si;
+        continue;
+      } else if (ch == '_') {
+        si = pni_filter_next_char(s, si);
+        pi++;
+        continue;
+      } else if (s.start[si] == ch) {
+        si++;
+        pi++;
+        continue;
+      }
+    }
+    if (star == (size_t) -1) return false;
+    pi = star;
+    mark = pni_filter_next_char(s, mark);
+    si = mark;
+  }
+  while (pi < p.size && p.start[pi] == '%' && escape != '%') pi++;
+  return pi == p.size;
+}
+
+static int pni_filter_run(pn_filter_t *filter)
+{
+  pni_filter_value_t *stack = filter->stack;
+  size_t top = 0;
+  size_t pc = 0;
+  while (pc < filter->code_count) {
+    const pni_filter_op_t *op = &filter->code[pc++];
+    pni_filter_value_t *a = top ? &stack[top - 1] : NULL;
+    switch ((pni_filter_code_t) op->code) {
+    case PNI_OP_CONST:
+      stack[top++] = filter->constants[op->arg];
+      break;
+    case PNI_OP_LOAD: {
+      int source = filter->names[op->arg].source;
+      if (!(filter->loaded & (1 << source))) {
+        int err = pni_filter_load(filter, source);
+        if (err) return err;
+      }
+      stack[top++] = filter->values[op->arg];
+      break;
+    }
+    case PNI_OP_JFALSE:
+      if (pni_filter_truth(a) == 0) pc = op->arg;
+      break;
+    case PNI_OP_JTRUE:
+      if (pni_filter_truth(a) == 1) pc = op->arg;
+      break;
+    case PNI_OP_AND: {
+      int x = pni_filter_truth(&stack[top - 2]);
+      int y = pni_filter_truth(a);
+      top--;
+      pni_filter_bool(&stack[top - 1], (!x || !y) ? 0 : (x > 0 && y > 0) ? 1 : -1);
+      break;
+    }
+    case PNI_OP_OR: {
+      int x = pni_filter_truth(&stack[top - 2]);
+      int y = pni_filter_truth(a);
+      top--;
+      pni_filter_bool(&stack[top - 1], (x > 0 || y > 0) ? 1 : (!x && !y) ? 0 : -1);
+      break;
+    }
+    case PNI_OP_NOT: {
+      int x = pni_filter_truth(a);
+      pni_filter_bool(a, x < 0 ? -1 : !x);
+      break;
+    }
+    case PNI_OP_EQ:
+    case PNI_OP_NE:
+    case PNI_OP_LT:
+    case PNI_OP_LE:
+    case PNI_OP_GT:
+    case PNI_OP_GE:
+      top--;
+      pni_filter_bool(&stack[top - 1], pni_filter_compare((pni_filter_code_t) op->code,
+                                                          &stack[top - 1], a));
+      break;
+    case PNI_OP_ADD:
+    case PNI_OP_SUB:
+    case PNI_OP_MUL:
+    case PNI_OP_DIV:
+      top--;
+      pni_filter_arithmetic((pni_filter_code_t) op->code, &stack[top - 1], a);
+      break;
+    case PNI_OP_NEG:
+      if (a->type == PNI_FILTER_LONG) {
+        a->u.l = (int64_t) (0 - (uint64_t) a->u.l);
+      } else if (a->type == PNI_FILTER_DOUBLE) {
+        a->u.d = -a->u.d;
+      } else {
+        a->type = PNI_FILTER_NULL;
+      }
+      break;
+    case PNI_OP_BETWEEN: {
+      top -= 2;
+      pni_filter_value_t *x = &stack[top - 1];
+      int low = pni_filter_compare(PNI_OP_GE, x, &stack[top]);
+      int high = pni_filter_compare(PNI_OP_LE, x, &stack[top + 1]);
+      pni_filter_bool(x, (!low || !high) ? 0 : (low > 0 && high > 0) ? 1 : -1);
+      break;
+    }
+    case PNI_OP_LIKE:
+      if (a->type == PNI_FILTER_STRING) {
+        pni_filter_bool(a, pni_filter_like(a->u.s, filter->constants[op->arg].u.s,
+                                           (int) op->count - 1));
+      } else {
+        a->type = PNI_FILTER_NULL;
+      }
+      break;
+    case PNI_OP_IN:
+      if (a->type == PNI_FILTER_STRING) {
+        bool found = false;
+        for (uint32_t i = 0; i < op->count && !found; i++) {
+          pn_bytes_t s = filter->constants[op->arg + i].u.s;
+          found = s.size == a->u.s.size && !memcmp(s.start, a->u.s.start, s.size);
+        }
+        pni_filter_bool(a, found);
+      } else {
+        a->type = PNI_FILTER_NULL;
+      }
+      break;
+    case PNI_OP_ISNULL:
+      pni_filter_bool(a, a->type == PNI_FILTER_NULL);
+      break;
+    }
+  }
+  return top && pni_filter_truth(&stack[0]) == 1;
+}
+
+int pn_filter_match(pn_filter_t *filter, const char *bytes, size_t size)
+{
+  assert(filter && (bytes || !size));
+  if (!filter->code_count) return 1;
+  filter->bytes = bytes;
+  filter->size = size;
+  filter->scanned = false;
+  filter->loaded = 0;
+  memset(filter->sections, 0, sizeof(filter->sections));
+  int result = pni_filter_run(filter);
+  if (result < 0) pn_error_format(filter->error, result, "message: malformed section");
+  return result;
+}
@@ -29,8 +29,15 @@
 #include <stdio.h>
 #include <assert.h>
 #include "protocol.h"
+#include "buffer.h"
+#include "codec/data.h"
+#include "codec/decoder.h"
+#include "codec/format.h"
+#include "message/message.h"
+#include "encodings.h"
 #include "util.h"
 #include "platform_fmt.h"
+#include "alloc_private.h"
 
 ssize_t pn_message_data(char *dst, size_t available, const char *src, size_t size)
 {
@@ -48,6 +55,31 @@ ssize_t pn_message_data(char *dst, size_t available, const char *src, size_t siz
 
 // message
 
+// fields that may still refer into an encoded message, either the
+// bytes given to pn_message_decode_borrowed or our copy of the bytes
+// given to pn_message_decode
+typedef enum {
+  PNI_USER_ID,
+  PNI_ADDRESS,
+  PNI_SUBJECT,
+  PNI_REPLY_TO,
+  PNI_CONTENT_TYPE,
+  PNI_CONTENT_ENCODING,
+  PNI_GROUP_ID,
+  PNI_REPLY_TO_GROUP_ID,
+  PNI_INSTRUCTIONS,
+  PNI_ANNOTATIONS,
+  PNI_PROPERTIES,
+  PNI_BODY,
+  // the encoded header and properties, unset once they are modified
+  PNI_HEADER_SECTION,
+  PNI_PROPERTIES_SECTION,
+  PNI_VIEW_COUNT
+} pni_view_t;
+
+// every string, data object, buffer and the error are created the
+// first time they are needed, so a message costs one allocation until
+// it is used
 struct pn_message_t {
   pn_timestamp_t expiry_time;
   pn_timestamp_t creation_time;
@@ -63,6 +95,7 @@ struct pn_message_t {
   pn_string_t *reply_to_group_id;
 
   pn_data_t *data;
+  pn_buffer_t *encoded;
   pn_data_t *instructions;
   pn_data_t *annotations;
   pn_data_t *properties;
@@ -71,6 +104,9 @@ struct pn_message_t {
   pn_parser_t *parser;
   pn_error_t *error;
 
+  // a view with a non NULL start takes precedence over the owned field
+  pn_bytes_t views[PNI_VIEW_COUNT];
+
   pn_sequence_t group_sequence;
   pn_millis_t ttl;
   uint32_t delivery_count;
@@ -96,6 +132,7 @@ void pn_message_finalize(void *obj)
   pn_data_free(msg->id);
   pn_data_free(msg->correlation_id);
   pn_data_free(msg->data);
+  pn_buffer_free(msg->encoded);
   pn_data_free(msg->instructions);
   pn_data_free(msg->annotations);
   pn_data_free(msg->properties);
@@ -104,15 +141,144 @@ void pn_message_finalize(void *obj)
   pn_error_free(msg->error);
 }
 
+static pn_error_t *pni_message_error(pn_message_t *msg)
+{
+  if (!msg->error) {
+    msg->error = pn_error();
+  }
+  return msg->error;
+}
+
+// the data a whole message is encoded from and decoded into
+static pn_data_t *pni_message_scratch(pn_message_t *msg)
+{
+  if (!msg->data) {
+    msg->data = pni_data_arena(16);
+    // sections such as the application properties are often only copied
+    pn_data_set_lazy(msg->data, true);
+  }
+  return msg->data;
+}
+
+static pn_data_t *pni_message_atom_field(pn_data_t **data)
+{
+  if (!*data) {
+    *data = pn_data(1);
+  }
+  return *data;
+}
+
+static pn_atom_t pni_message_get_atom(pn_data_t *data)
+{
+  if (data) {
+    return pn_data_get_atom(data);
+  } else {
+    pn_atom_t atom = {PN_NULL};
+    return atom;
+  }
+}
+
+static const char *pni_string_get(pn_string_t *string)
+{
+  return string ? pn_string_get(string) : NULL;
+}
+
+static size_t pni_string_size(pn_string_t *string)
+{
+  return string ? pn_string_size(string) : 0;
+}
+
+static pn_string_t *pni_message_string(pn_message_t *msg, pni_view_t field, pn_string_t **string)
+{
+  pn_bytes_t *view = &msg->views[field];
+  if (view->start) {
+    if (!*string) {
+      *string = pn_string(NULL);
+    }
+    pn_string_setn(*string, view->start, view->size);
+    *view = pn_bytes(0, NULL);
+  }
+  return *string;
+}
+
+static pn_bytes_t pni_message_bytes(pn_message_t *msg, pni_view_t field, pn_string_t *string)
+{
+  pn_bytes_t *view = &msg->views[field];
+  if (view->start) {
+    return *view;
+  } else {
+    return pn_bytes(pni_string_size(string), (char *) pni_string_get(string));
+  }
+}
+
+// setting a field that was never set to NULL allocates nothing
+static int pni_message_set_string(pn_message_t *msg, pni_view_t field, pn_string_t **string,
+                                  pn_bytes_t value)
+{
+  msg->views[PNI_PROPERTIES_SECTION] = pn_bytes(0, NULL);
+  msg->views[field] = pn_bytes(0, NULL);
+  if (!*string) {
+    if (!value.start) return 0;
+    *string = pn_string(NULL);
+  }
+  return pn_string_setn(*string, value.start, value.size);
+}
+
+static pn_bytes_t pni_cstr(const char *str)
+{
+  return pn_bytes(str ? strlen(str) : 0, (char *) str);
+}
+
+static pn_data_t *pni_message_section(pn_message_t *msg, pni_view_t field, pn_data_t **section)
+{
+  if (!*section) {
+    *section = pni_data_arena(16);
+  }
+  pn_data_t *data = *section;
+  pn_bytes_t *view = &msg->views[field];
+  if (view->start) {
+    pn_data_clear(data);
+    ssize_t used = pn_data_decode(data, view->start, view->size);
+    if (used < 0) {
+      pn_error_format(pni_message_error(msg), used, "data error: %s", pn_data_error(data));
+    }
+    pn_data_rewind(data);
+    *view = pn_bytes(0, NULL);
+  }
+  return data;
+}
+
+static void pni_message_materialize_strings(pn_message_t *msg)
+{
+  pni_message_string(msg, PNI_USER_ID, &msg->user_id);
+  pni_message_string(msg, PNI_ADDRESS, &msg->address);
+  pni_message_string(msg, PNI_SUBJECT, &msg->subject);
+  pni_message_string(msg, PNI_REPLY_TO, &msg->reply_to);
+  pni_message_string(msg, PNI_CONTENT_TYPE, &msg->content_type);
+  pni_message_string(msg, PNI_CONTENT_ENCODING, &msg->content_encoding);
+  pni_message_string(msg, PNI_GROUP_ID, &msg->group_id);
+  pni_message_string(msg, PNI_REPLY_TO_GROUP_ID, &msg->reply_to_group_id);
+}
+
+static void pni_message_materialize(pn_message_t *msg)
+{
+  pni_message_materialize_strings(msg);
+  pni_message_section(msg, PNI_INSTRUCTIONS, &msg->instructions);
+  pni_message_section(msg, PNI_ANNOTATIONS, &msg->annotations);
+  pni_message_section(msg, PNI_PROPERTIES, &msg->properties);
+  pni_message_section(msg, PNI_BODY, &msg->body);
+}
+
 int pn_message_inspect(void *obj, pn_string_t *dst)
 {
   pn_message_t *msg = (pn_message_t *) obj;
+  pni_message_materialize(msg);
   int err = pn_string_addf(dst, "Message{");
   if (err) return err;
 
   bool comma = false;
 
-  if (pn_string_get(msg->address)) {
+  if (pni_string_get(msg->address)) {
     err = pn_string_addf(dst, "address=");
     if (err) return err;
     err = pn_inspect(msg->address, dst);
@@ -162,7 +328,7 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->user_id)) {
+  if (pni_string_get(msg->user_id)) {
     err = pn_string_addf(dst, "user_id=");
     if (err) return err;
     err = pn_inspect(msg->user_id, dst);
@@ -172,7 +338,7 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->subject)) {
+  if (pni_string_get(msg->subject)) {
     err = pn_string_addf(dst, "subject=");
     if (err) return err;
     err = pn_inspect(msg->subject, dst);
@@ -182,7 +348,7 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->reply_to)) {
+  if (pni_string_get(msg->reply_to)) {
     err = pn_string_addf(dst, "reply_to=");
     if (err) return err;
     err = pn_inspect(msg->reply_to, dst);
@@ -202,7 +368,7 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->content_type)) {
+  if (pni_string_get(msg->content_type)) {
     err = pn_string_addf(dst, "content_type=");
     if (err) return err;
     err = pn_inspect(msg->content_type, dst);
@@ -212,7 +378,7 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->content_encoding)) {
+  if (pni_string_get(msg->content_encoding)) {
     err = pn_string_addf(dst, "content_encoding=");
     if (err) return err;
     err = pn_inspect(msg->content_encoding, dst);
@@ -234,7 +400,7 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->group_id)) {
+  if (pni_string_get(msg->group_id)) {
     err = pn_string_addf(dst, "group_id=");
     if (err) return err;
     err = pn_inspect(msg->group_id, dst);
@@ -250,7 +416,7 @@ int pn_message_inspect(void *obj, pn_string_t *dst)
     comma = true;
   }
 
-  if (pn_string_get(msg->reply_to_group_id)) {
+  if (pni_string_get(msg->reply_to_group_id)) {
     err = pn_string_addf(dst, "reply_to_group_id=");
     if (err) return err;
     err = pn_inspect(msg->reply_to_group_id, dst);
@@ -327,29 +493,31 @@ pn_message_t *pn_message()
   msg->ttl = 0;
   msg->first_acquirer = false;
   msg->delivery_count = 0;
-  msg->id = pn_data(1);
-  msg->user_id = pn_string(NULL);
-  msg->address = pn_string(NULL);
-  msg->subject = pn_string(NULL);
-  msg->reply_to = pn_string(NULL);
-  msg->correlation_id = pn_data(1);
-  msg->content_type = pn_string(NULL);
-  msg->content_encoding = pn_string(NULL);
+  msg->id = NULL;
+  msg->user_id = NULL;
+  msg->address = NULL;
+  msg->subject = NULL;
+  msg->reply_to = NULL;
+  msg->correlation_id = NULL;
+  msg->content_type = NULL;
+  msg->content_encoding = NULL;
   msg->expiry_time = 0;
   msg->creation_time = 0;
-  msg->group_id = pn_string(NULL);
+  msg->group_id = NULL;
   msg->group_sequence = 0;
-  msg->reply_to_group_id = pn_string(NULL);
+  msg->reply_to_group_id = NULL;
 
   msg->inferred = false;
-  msg->data = pn_data(16);
-  msg->instructions = pn_data(16);
-  msg->annotations = pn_data(16);
-  msg->properties = pn_data(16);
-  msg->body = pn_data(16);
+  msg->data = NULL;
+  msg->encoded = NULL;
+  msg->instructions = NULL;
+  msg->annotations = NULL;
+  msg->properties = NULL;
+  msg->body = NULL;
 
   msg->parser = NULL;
-  msg->error = pn_error();
+  msg->error = NULL;
+  memset(msg->views, 0, sizeof(msg->views));
   return msg;
 }
 
@@ -366,36 +534,37 @@ void pn_message_clear(pn_message_t *msg)
   msg->first_acquirer = false;
   msg->delivery_count = 0;
   pn_data_clear(msg->id);
-  pn_string_clear(msg->user_id);
-  pn_string_clear(msg->address);
-  pn_string_clear(msg->subject);
-  pn_string_clear(msg->reply_to);
+  if (msg->user_id) pn_string_clear(msg->user_id);
+  if (msg->address) pn_string_clear(msg->address);
+  if (msg->subject) pn_string_clear(msg->subject);
+  if (msg->reply_to) pn_string_clear(msg->reply_to);
   pn_data_clear(msg->correlation_id);
-  pn_string_clear(msg->content_type);
-  pn_string_clear(msg->content_encoding);
+  if (msg->content_type) pn_string_clear(msg->content_type);
+  if (msg->content_encoding) pn_string_clear(msg->content_encoding);
   msg->expiry_time = 0;
   msg->creation_time = 0;
-  pn_string_clear(msg->group_id);
+  if (msg->group_id) pn_string_clear(msg->group_id);
   msg->group_sequence = 0;
-  pn_string_clear(msg->reply_to_group_id);
+  if (msg->reply_to_group_id) pn_string_clear(msg->reply_to_group_id);
   msg->inferred = false;
   pn_data_clear(msg->data);
   pn_data_clear(msg->instructions);
   pn_data_clear(msg->annotations);
   pn_data_clear(msg->properties);
   pn_data_clear(msg->body);
+  memset(msg->views, 0, sizeof(msg->views));
 }
 
 int pn_message_errno(pn_message_t *msg)
 {
   assert(msg);
-  return pn_error_code(msg->error);
+  return msg->error ? pn_error_code(msg->error) : 0;
 }
 
 pn_error_t *pn_message_error(pn_message_t *msg)
 {
   assert(msg);
-  return msg->error;
+  return pni_message_error(msg);
 }
 
 bool pn_message_is_inferred(pn_message_t *msg)
@@ -428,6 +597,7 @@ bool pn_message_is_durable(pn_message_t *msg)
 int pn_message_set_durable(pn_message_t *msg, bool durable)
 {
   assert(msg);
+  msg->views[PNI_HEADER_SECTION] = pn_bytes(0, NULL);
   msg->durable = durable;
   return 0;
 }
@@ -441,6 +611,7 @@ uint8_t pn_message_get_priority(pn_message_t *msg)
 int pn_message_set_priority(pn_message_t *msg, uint8_t priority)
 {
   assert(msg);
+  msg->views[PNI_HEADER_SECTION] = pn_bytes(0, NULL);
   msg->priority = priority;
   return 0;
 }
@@ -453,6 +624,7 @@ pn_millis_t pn_message_get_ttl(pn_message_t *msg)
 int pn_message_set_ttl(pn_message_t *msg, pn_millis_t ttl)
 {
   assert(msg);
+  msg->views[PNI_HEADER_SECTION] = pn_bytes(0, NULL);
   msg->ttl = ttl;
   return 0;
 }
@@ -465,6 +637,7 @@ bool pn_message_is_first_acquirer(pn_message_t *msg)
 int pn_message_set_first_acquirer(pn_message_t *msg, bool first)
 {
   assert(msg);
+  msg->views[PNI_HEADER_SECTION] = pn_bytes(0, NULL);
   msg->first_acquirer = first;
   return 0;
 }
@@ -477,6 +650,7 @@ uint32_t pn_message_get_delivery_count(pn_message_t *msg)
 int pn_message_set_delivery_count(pn_message_t *msg, uint32_t count)
 {
   assert(msg);
+  msg->views[PNI_HEADER_SECTION] = pn_bytes(0, NULL);
   msg->delivery_count = count;
   return 0;
 }
@@ -484,111 +658,134 @@ int pn_message_set_delivery_count(pn_message_t *msg, uint32_t count)
 pn_data_t *pn_message_id(pn_message_t *msg)
 {
   assert(msg);
-  return msg->id;
+  // the caller may modify it
+  msg->views[PNI_PROPERTIES_SECTION] = pn_bytes(0, NULL);
+  return pni_message_atom_field(&msg->id);
 }
 pn_atom_t pn_message_get_id(pn_message_t *msg)
 {
   assert(msg);
-  return pn_data_get_atom(msg->id);
+  return pni_message_get_atom(msg->id);
 }
 int pn_message_set_id(pn_message_t *msg, pn_atom_t id)
 {
   assert(msg);
-  pn_data_rewind(msg->id);
-  return pn_data_put_atom(msg->id, id);
-}
-
-static pn_bytes_t pn_string_get_bytes(pn_string_t *string)
-{
-  return pn_bytes(pn_string_size(string), (char *) pn_string_get(string));
-}
-
-static int pn_string_set_bytes(pn_string_t *string, pn_bytes_t bytes)
-{
-  return pn_string_setn(string, bytes.start, bytes.size);
+  msg->views[PNI_PROPERTIES_SECTION] = pn_bytes(0, NULL);
+  pn_data_t *data = pni_message_atom_field(&msg->id);
+  pn_data_rewind(data);
+  return pn_data_put_atom(data, id);
 }
 
 pn_bytes_t pn_message_get_user_id(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get_bytes(msg->user_id);
+  return pni_message_bytes(msg, PNI_USER_ID, msg->user_id);
 }
 int pn_message_set_user_id(pn_message_t *msg, pn_bytes_t user_id)
 {
   assert(msg);
-  return pn_string_set_bytes(msg->user_id, user_id);
+  return pni_message_set_string(msg, PNI_USER_ID, &msg->user_id, user_id);
 }
 
 const char *pn_message_get_address(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->address);
+  return pni_string_get(pni_message_string(msg, PNI_ADDRESS, &msg->address));
+}
+pn_bytes_t pn_message_get_address_bytes(pn_message_t *msg)
+{
+  assert(msg);
+  return pni_message_bytes(msg, PNI_ADDRESS, msg->address);
 }
 int pn_message_set_address(pn_message_t *msg, const char *address)
 {
   assert(msg);
-  return pn_string_set(msg->address, address);
+  return pni_message_set_string(msg, PNI_ADDRESS, &msg->address, pni_cstr(address));
 }
 
 const char *pn_message_get_subject(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->subject);
+  return pni_string_get(pni_message_string(msg, PNI_SUBJECT, &msg->subject));
+}
+pn_bytes_t pn_message_get_subject_bytes(pn_message_t *msg)
+{
+  assert(msg);
+  return pni_message_bytes(msg, PNI_SUBJECT, msg->subject);
 }
 int pn_message_set_subject(pn_message_t *msg, const char *subject)
 {
   assert(msg);
-  return pn_string_set(msg->subject, subject);
+  return pni_message_set_string(msg, PNI_SUBJECT, &msg->subject, pni_cstr(subject));
 }
 
 const char *pn_message_get_reply_to(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->reply_to);
+  return pni_string_get(pni_message_string(msg, PNI_REPLY_TO, &msg->reply_to));
+}
+pn_bytes_t pn_message_get_reply_to_bytes(pn_message_t *msg)
+{
+  assert(msg);
+  return pni_message_bytes(msg, PNI_REPLY_TO, msg->reply_to);
 }
 int pn_message_set_reply_to(pn_message_t *msg, const char *reply_to)
 {
   assert(msg);
-  return pn_string_set(msg->reply_to, reply_to);
+  return pni_message_set_string(msg, PNI_REPLY_TO, &msg->reply_to, pni_cstr(reply_to));
 }
 
 pn_data_t *pn_message_correlation_id(pn_message_t *msg)
 {
   assert(msg);
-  return msg->correlation_id;
+  // the caller may modify it
+  msg->views[PNI_PROPERTIES_SECTION] = pn_bytes(0, NULL);
+  return pni_message_atom_field(&msg->correlation_id);
 }
 pn_atom_t pn_message_get_correlation_id(pn_message_t *msg)
 {
   assert(msg);
-  return pn_data_get_atom(msg->correlation_id);
+  return pni_message_get_atom(msg->correlation_id);
 }
 int pn_message_set_correlation_id(pn_message_t *msg, pn_atom_t atom)
 {
   assert(msg);
-  pn_data_rewind(msg->correlation_id);
-  return pn_data_put_atom(msg->correlation_id, atom);
+  msg->views[PNI_PROPERTIES_SECTION] = pn_bytes(0, NULL);
+  pn_data_t *data = pni_message_atom_field(&msg->correlation_id);
+  pn_data_rewind(data);
+  return pn_data_put_atom(data, atom);
 }
 
 const char *pn_message_get_content_type(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->content_type);
+  return pni_string_get(pni_message_string(msg, PNI_CONTENT_TYPE, &msg->content_type));
+}
+pn_bytes_t pn_message_get_content_type_bytes(pn_message_t *msg)
+{
+  assert(msg);
+  return pni_message_bytes(msg, PNI_CONTENT_TYPE, msg->content_type);
 }
 int pn_message_set_content_type(pn_message_t *msg, const char *type)
 {
   assert(msg);
-  return pn_string_set(msg->content_type, type);
+  return pni_message_set_string(msg, PNI_CONTENT_TYPE, &msg->content_type, pni_cstr(type));
 }
 
 const char *pn_message_get_content_encoding(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->content_encoding);
+  return pni_string_get(pni_message_string(msg, PNI_CONTENT_ENCODING, &msg->content_encoding));
+}
+pn_bytes_t pn_message_get_content_encoding_bytes(pn_message_t *msg)
+{
+  assert(msg);
+  return pni_message_bytes(msg, PNI_CONTENT_ENCODING, msg->content_encoding);
 }
 int pn_message_set_content_encoding(pn_message_t *msg, const char *encoding)
 {
   assert(msg);
-  return pn_string_set(msg->content_encoding, encoding);
+  return pni_message_set_string(msg, PNI_CONTENT_ENCODING, &msg->content_encoding, pni_cstr(encoding));
 }
 
 pn_timestamp_t pn_message_get_expiry_time(pn_message_t *msg)
@@ -599,6 +796,7 @@ pn_timestamp_t pn_message_get_expiry_time(pn_message_t *msg)
 int pn_message_set_expiry_time(pn_message_t *msg, pn_timestamp_t time)
 {
   assert(msg);
+  msg->views[PNI_PROPERTIES_SECTION] = pn_bytes(0, NULL);
   msg->expiry_time = time;
   return 0;
 }
@@ -611,6 +809,7 @@ pn_timestamp_t pn_message_get_creation_time(pn_message_t *msg)
 int pn_message_set_creation_time(pn_message_t *msg, pn_timestamp_t time)
 {
   assert(msg);
+  msg->views[PNI_PROPERTIES_SECTION] = pn_bytes(0, NULL);
   msg->creation_time = time;
   return 0;
 }
@@ -618,12 +817,17 @@ int pn_message_set_creation_time(pn_message_t *msg, pn_timestamp_t time)
 const char *pn_message_get_group_id(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->group_id);
+  return pni_string_get(pni_message_string(msg, PNI_GROUP_ID, &msg->group_id));
+}
+pn_bytes_t pn_message_get_group_id_bytes(pn_message_t *msg)
+{
+  assert(msg);
+  return pni_message_bytes(msg, PNI_GROUP_ID, msg->group_id);
 }
 int pn_message_set_group_id(pn_message_t *msg, const char *group_id)
 {
   assert(msg);
-  return pn_string_set(msg->group_id, group_id);
+  return pni_message_set_string(msg, PNI_GROUP_ID, &msg->group_id, pni_cstr(group_id));
 }
 
 pn_sequence_t pn_message_get_group_sequence(pn_message_t *msg)
@@ -634,6 +838,7 @@ pn_sequence_t pn_message_get_group_sequence(pn_message_t *msg)
 int pn_message_set_group_sequence(pn_message_t *msg, pn_sequence_t n)
 {
   assert(msg);
+  msg->views[PNI_PROPERTIES_SECTION] = pn_bytes(0, NULL);
   msg->group_sequence = n;
   return 0;
 }
@@ -641,182 +846,373 @@ int pn_message_set_group_sequence(pn_message_t *msg, pn_sequence_t n)
 const char *pn_message_get_reply_to_group_id(pn_message_t *msg)
 {
   assert(msg);
-  return pn_string_get(msg->reply_to_group_id);
+  return pni_string_get(pni_message_string(msg, PNI_REPLY_TO_GROUP_ID, &msg->reply_to_group_id));
+}
+pn_bytes_t pn_message_get_reply_to_group_id_bytes(pn_message_t *msg)
+{
+  assert(msg);
+  return pni_message_bytes(msg, PNI_REPLY_TO_GROUP_ID, msg->reply_to_group_id);
 }
 int pn_message_set_reply_to_group_id(pn_message_t *msg, const char *reply_to_group_id)
 {
   assert(msg);
-  return pn_string_set(msg->reply_to_group_id, reply_to_group_id);
+  return pni_message_set_string(msg, PNI_REPLY_TO_GROUP_ID, &msg->reply_to_group_id, pni_cstr(reply_to_group_id));
 }
 
-int pn_message_decode(pn_message_t *msg, const char *bytes, size_t size)
+// the string, symbol or binary value of a borrowed field
+static pn_bytes_t pni_message_view(const char *field, size_t size)
 {
-  assert(msg && bytes && size);
+  switch ((uint8_t) field[0]) {
+  case PNE_VBIN8:
+  case PNE_STR8_UTF8:
+  case PNE_SYM8:
+    return pn_bytes(size - 2, (char *) field + 2);
+  case PNE_VBIN32:
+  case PNE_STR32_UTF8:
+  case PNE_SYM32:
+    return pn_bytes(size - 5, (char *) field + 5);
+  default:
+    return pn_bytes(0, NULL);
+  }
+}
+
+static int pni_message_borrow_properties(pn_message_t *msg, const char *value, size_t size)
+{
+  static const int views[] = {-1, PNI_USER_ID, PNI_ADDRESS, PNI_SUBJECT, PNI_REPLY_TO, -1,
+                              PNI_CONTENT_TYPE, PNI_CONTENT_ENCODING, -1, -1, PNI_GROUP_ID,
+                              -1, PNI_REPLY_TO_GROUP_ID};
+  const uint8_t *header = (const uint8_t *) value;
+  size_t count;
+  switch (header[0]) {
+  case PNE_LIST0:
+    return 0;
+  case PNE_LIST8:
+    if (size < 3) return PN_UNDERFLOW;
+    count = header[2];
+    value += 3;
+    size -= 3;
+    break;
+  case PNE_LIST32:
+    if (size < 9) return PN_UNDERFLOW;
+    count = (size_t) header[5] << 24 | header[6] << 16 | header[7] << 8 | header[8];
+    value += 9;
+    size -= 9;
+    break;
+  default:
+    return PN_ARG_ERR;
+  }
+
+  for (size_t i = 0; i < count && size; i++) {
+    ssize_t n = pn_decoder_skip(value, size);
+    if (n < 0) return n;
+    bool null = ((uint8_t) value[0] == PNE_NULL);
+    if (i < sizeof(views)/sizeof(views[0]) && views[i] >= 0) {
+      msg->views[views[i]] = pni_message_view(value, n);
+    } else if (!null && (i == 0 || i == 5)) {
+      ssize_t used = pn_data_decode(pni_message_atom_field(i ? &msg->correlation_id : &msg->id), value, n);
+      if (used < 0) return used;
+    } else if (!null && (i == 8 || i == 9 || i == 11)) {
+      pn_data_clear(msg->data);
+      ssize_t used = pn_data_decode(msg->data, value, n);
+      if (used < 0) return used;
+      pn_data_rewind(msg->data);
+      pn_data_next(msg->data);
+      if (i == 11 && pn_data_type(msg->data) == PN_UINT) {
+        msg->group_sequence = pn_data_get_uint(msg->data);
+      } else if (pn_data_type(msg->data) == PN_TIMESTAMP) {
+        if (i == 8) {
+          msg->expiry_time = pn_data_get_timestamp(msg->data);
+        } else {
+          msg->creation_time = pn_data_get_timestamp(msg->data);
+        }
+      }
+    }
+    value += n;
+    size -= n;
+  }
+
+  return 0;
+}
 
+// borrows the sections in the mask, returning the offset of the
+// first section of the bare message body when head is set
+static ssize_t pni_message_borrow(pn_message_t *msg, const char *bytes, size_t size,
+                                  int mask, bool head)
+{
+  static pni_format_t header_format = PNI_FORMAT("D.[oBIoI]");
+  const char *start = bytes;
   pn_message_clear(msg);
+  pni_message_scratch(msg);
 
   while (size) {
-    pn_data_clear(msg->data);
-    ssize_t used = pn_data_decode(msg->data, bytes, size);
-    if (used < 0) return pn_error_format(msg->error, used, "data error: %s",
-                                         pn_data_error(msg->data));
-    size -= used;
-    bytes += used;
-    bool scanned;
-    uint64_t desc;
-    int err = pn_data_scan(msg->data, "D?L.", &scanned, &desc);
-    if (err) return pn_error_format(msg->error, err, "data error: %s",
-                                    pn_data_error(msg->data));
-    if (!scanned) {
-      desc = 0;
+    ssize_t used = pn_decoder_skip(bytes, size);
+    if (used < 0) return pn_error_format(pni_message_error(msg), used, "data error: malformed section");
+
+    uint64_t desc = 0;
+    const char *value = bytes;
+    size_t value_size = used;
+    if ((uint8_t) bytes[0] == PNE_DESCRIPTOR) {
+      ssize_t dsize = pn_decoder_skip(bytes + 1, used - 1);
+      pn_data_clear(msg->data);
+      if (pn_data_decode(msg->data, bytes + 1, dsize) == dsize) {
+        pn_data_rewind(msg->data);
+        pn_data_next(msg->data);
+        if (pn_data_type(msg->data) == PN_ULONG) {
+          desc = pn_data_get_ulong(msg->data);
+        }
+      }
+      value = bytes + 1 + dsize;
+      value_size = used - 1 - dsize;
     }
 
-    pn_data_rewind(msg->data);
-    pn_data_next(msg->data);
-    pn_data_enter(msg->data);
-    pn_data_next(msg->data);
+    if (head) {
+      // unrequested head sections are passed over like a footer
+      bool stop = false;
+      switch (desc) {
+      case HEADER:
+        if (!(mask & PN_MESSAGE_HEADER)) desc = FOOTER;
+        break;
+      case DELIVERY_ANNOTATIONS:
+        if (!(mask & PN_MESSAGE_DELIVERY_ANNOTATIONS)) desc = FOOTER;
+        break;
+      case MESSAGE_ANNOTATIONS:
+        if (!(mask & PN_MESSAGE_MESSAGE_ANNOTATIONS)) desc = FOOTER;
+        break;
+      case PROPERTIES:
+        if (!(mask & PN_MESSAGE_PROPERTIES)) desc = FOOTER;
+        break;
+      default:
+        stop = true;
+        break;
+      }
+      if (stop) break;
+    }
 
+    int err = 0;
     switch (desc) {
     case HEADER:
-      pn_data_scan(msg->data, "D.[oBIoI]", &msg->durable, &msg->priority,
-                   &msg->ttl, &msg->first_acquirer, &msg->delivery_count);
+      msg->views[PNI_HEADER_SECTION] = pn_bytes(value_size, (char *) value);
+      pn_data_clear(msg->data);
+      err = pn_data_decode(msg->data, bytes, used);
+      if (err < 0) break;
+      pn_data_rewind(msg->data);
+      pn_data_next(msg->data);
+      pn_data_enter(msg->data);
+      pn_data_next(msg->data);
+      err = pni_data_scan_format(msg->data, &header_format, &msg->durable, &msg->priority,
+                                 &msg->ttl, &msg->first_acquirer, &msg->delivery_count);
       break;
     case PROPERTIES:
-      {
-        pn_bytes_t user_id, address, subject, reply_to, ctype, cencoding,
-          group_id, reply_to_group_id;
-        pn_data_clear(msg->id);
-        pn_data_clear(msg->correlation_id);
-        err = pn_data_scan(msg->data, "D.[CzSSSCssttSIS]", msg->id,
-                           &user_id, &address, &subject, &reply_to,
-                           msg->correlation_id, &ctype, &cencoding,
-                           &msg->expiry_time, &msg->creation_time, &group_id,
-                           &msg->group_sequence, &reply_to_group_id);
-        if (err) return pn_error_format(msg->error, err, "data error: %s",
-                                        pn_data_error(msg->data));
-        err = pn_string_set_bytes(msg->user_id, user_id);
-        if (err) return pn_error_format(msg->error, err, "error setting user_id");
-        err = pn_string_setn(msg->address, address.start, address.size);
-        if (err) return pn_error_format(msg->error, err, "error setting address");
-        err = pn_string_setn(msg->subject, subject.start, subject.size);
-        if (err) return pn_error_format(msg->error, err, "error setting subject");
-        err = pn_string_setn(msg->reply_to, reply_to.start, reply_to.size);
-        if (err) return pn_error_format(msg->error, err, "error setting reply_to");
-        err = pn_string_setn(msg->content_type, ctype.start, ctype.size);
-        if (err) return pn_error_format(msg->error, err, "error setting content_type");
-        err = pn_string_setn(msg->content_encoding, cencoding.start,
-                             cencoding.size);
-        if (err) return pn_error_format(msg->error, err, "error setting content_encoding");
-        err = pn_string_setn(msg->group_id, group_id.start, group_id.size);
-        if (err) return pn_error_format(msg->error, err, "error setting group_id");
-        err = pn_string_setn(msg->reply_to_group_id, reply_to_group_id.start,
-                             reply_to_group_id.size);
-        if (err) return pn_error_format(msg->error, err, "error setting reply_to_group_id");
-      }
+      msg->views[PNI_PROPERTIES_SECTION] = pn_bytes(value_size, (char *) value);
+      err = pni_message_borrow_properties(msg, value, value_size);
       break;
     case DELIVERY_ANNOTATIONS:
-      pn_data_narrow(msg->data);
-      err = pn_data_copy(msg->instructions, msg->data);
-      if (err) return err;
+      msg->views[PNI_INSTRUCTIONS] = pn_bytes(value_size, (char *) value);
       break;
     case MESSAGE_ANNOTATIONS:
-      pn_data_narrow(msg->data);
-      err = pn_data_copy(msg->annotations, msg->data);
-      if (err) return err;
+      msg->views[PNI_ANNOTATIONS] = pn_bytes(value_size, (char *) value);
       break;
     case APPLICATION_PROPERTIES:
-      pn_data_narrow(msg->data);
-      err = pn_data_copy(msg->properties, msg->data);
-      if (err) return err;
+      msg->views[PNI_PROPERTIES] = pn_bytes(value_size, (char *) value);
       break;
     case DATA:
     case AMQP_SEQUENCE:
     case AMQP_VALUE:
-      pn_data_narrow(msg->data);
-      err = pn_data_copy(msg->body, msg->data);
-      if (err) return err;
+      msg->views[PNI_BODY] = pn_bytes(value_size, (char *) value);
       break;
     case FOOTER:
       break;
     default:
-      err = pn_data_copy(msg->body, msg->data);
-      if (err) return err;
+      msg->views[PNI_BODY] = pn_bytes(used, (char *) bytes);
       break;
     }
+    if (err < 0) return pn_error_format(pni_message_error(msg), err, "data error: %s",
+                                        pn_data_error(msg->data));
+
+    size -= used;
+    bytes += used;
   }
 
   pn_data_clear(msg->data);
-  return 0;
+  return bytes - start;
 }
 
-int pn_message_encode(pn_message_t *msg, char *bytes, size_t *size)
+int pn_message_decode(pn_message_t *msg, const char *bytes, size_t size)
 {
-  if (!msg || !bytes || !size || !*size) return PN_ARG_ERR;
+  assert(msg && bytes && size);
 
-  pn_data_clear(msg->data);
+  // sections are borrowed from a private copy of the encoding, so those
+  // that are never modified can be encoded again without any work
+  if (!msg->encoded) {
+    msg->encoded = pn_buffer(0);
+  }
+  pn_buffer_clear(msg->encoded);
+  int err = pn_buffer_append(msg->encoded, bytes, size);
+  if (err) return pn_error_format(pni_message_error(msg), err, "error copying message");
+  pn_bytes_t copy = pn_buffer_bytes(msg->encoded);
+  ssize_t used = pni_message_borrow(msg, copy.start, copy.size, 0, false);
+  return used < 0 ? (int) used : 0;
+}
 
-  int err = pn_data_fill(msg->data, "DL[oB?IoI]", HEADER, msg->durable,
-                         msg->priority, msg->ttl, msg->ttl, msg->first_acquirer,
-                         msg->delivery_count);
+void pni_message_move(pn_message_t *dst, pn_message_t *src)
+{
+  assert(dst && src);
+  pn_message_t tmp = *dst;
+  *dst = *src;
+  *src = tmp;
+
+  // swap the data objects back, they are seen by the application
+  pn_data_t **sections[] = {&dst->id, &dst->correlation_id, &dst->instructions,
+                            &dst->annotations, &dst->properties, &dst->body};
+  pn_data_t **others[] = {&src->id, &src->correlation_id, &src->instructions,
+                          &src->annotations, &src->properties, &src->body};
+  for (size_t i = 0; i < sizeof(sections)/sizeof(sections[0]); i++) {
+    pn_data_t *moved = *sections[i];
+    *sections[i] = *others[i];
+    *others[i] = moved;
+    if (pn_data_size(moved)) {
+      if (!*sections[i]) {
+        *sections[i] = i < 2 ? pn_data(1) : pni_data_arena(16);
+      }
+      pn_data_copy(*sections[i], moved);
+    } else {
+      pn_data_clear(*sections[i]);
+    }
+  }
+  pn_error_t *error = dst->error;
+  dst->error = src->error;
+  src->error = error;
+  pn_error_clear(dst->error);
+}
+
+int pn_message_decode_borrowed(pn_message_t *msg, const char *bytes, size_t size)
+{
+  assert(msg && bytes && size);
+  ssize_t err = pni_message_borrow(msg, bytes, size, 0, false);
+  return err < 0 ? (int) err : 0;
+}
+
+ssize_t pn_message_decode_head(pn_message_t *msg, const char *bytes, size_t size, int sections)
+{
+  assert(msg && bytes);
+  return pni_message_borrow(msg, bytes, size, sections, true);
+}
+
+// appends a section that is still a view of a borrowed encoding
+static int pni_message_put_view(pn_message_t *msg, uint64_t code, pni_view_t field)
+{
+  pn_bytes_t view = msg->views[field];
+  pn_data_put_described(msg->data);
+  pn_data_enter(msg->data);
+  pn_data_put_ulong(msg->data, code);
+  ssize_t used = pn_data_decode(msg->data, view.start, view.size);
+  pn_data_exit(msg->data);
+  return used < 0 ? (int) used : 0;
+}
+
+// builds the sections of the message in msg->data
+static int pni_message_fill(pn_message_t *msg)
+{
+  if (msg->inferred) {
+    pni_message_section(msg, PNI_BODY, &msg->body);
+  }
+
+  pn_data_clear(pni_message_scratch(msg));
+
+  int err;
+  if (msg->views[PNI_HEADER_SECTION].start) {
+    err = pni_message_put_view(msg, HEADER, PNI_HEADER_SECTION);
+  } else {
+    static pni_format_t format = PNI_FORMAT("DL[oB?IoI]");
+    err = pni_data_fill_format(msg->data, &format, HEADER, msg->durable,
+                               msg->priority, msg->ttl, msg->ttl, msg->first_acquirer,
+                               msg->delivery_count);
+  }
   if (err)
-    return pn_error_format(msg->error, err, "data error: %s",
+    return pn_error_format(pni_message_error(msg), err, "data error: %s",
                            pn_data_error(msg->data));
 
-  if (pn_data_size(msg->instructions)) {
+  if (msg->views[PNI_INSTRUCTIONS].start) {
+    err = pni_message_put_view(msg, DELIVERY_ANNOTATIONS, PNI_INSTRUCTIONS);
+    if (err)
+      return pn_error_format(pni_message_error(msg), err, "data error: %s",
+                             pn_data_error(msg->data));
+  } else if (pn_data_size(msg->instructions)) {
     pn_data_put_described(msg->data);
     pn_data_enter(msg->data);
     pn_data_put_ulong(msg->data, DELIVERY_ANNOTATIONS);
     pn_data_rewind(msg->instructions);
     err = pn_data_append(msg->data, msg->instructions);
     if (err)
-      return pn_error_format(msg->error, err, "data error: %s",
+      return pn_error_format(pni_message_error(msg), err, "data error: %s",
                              pn_data_error(msg->data));
     pn_data_exit(msg->data);
   }
 
-  if (pn_data_size(msg->annotations)) {
+  if (msg->views[PNI_ANNOTATIONS].start) {
+    err = pni_message_put_view(msg, MESSAGE_ANNOTATIONS, PNI_ANNOTATIONS);
+    if (err)
+      return pn_error_format(pni_message_error(msg), err, "data error: %s",
+                             pn_data_error(msg->data));
+  } else if (pn_data_size(msg->annotations)) {
     pn_data_put_described(msg->data);
     pn_data_enter(msg->data);
     pn_data_put_ulong(msg->data, MESSAGE_ANNOTATIONS);
     pn_data_rewind(msg->annotations);
     err = pn_data_append(msg->data, msg->annotations);
     if (err)
-      return pn_error_format(msg->error, err, "data error: %s",
+      return pn_error_format(pni_message_error(msg), err, "data error: %s",
                              pn_data_error(msg->data));
     pn_data_exit(msg->data);
   }
 
-  err = pn_data_fill(msg->data, "DL[CzSSSCssttSIS]", PROPERTIES,
-                     msg->id,
-                     pn_string_size(msg->user_id), pn_string_get(msg->user_id),
-                     pn_string_get(msg->address),
-                     pn_string_get(msg->subject),
-                     pn_string_get(msg->reply_to),
-                     msg->correlation_id,
-                     pn_string_get(msg->content_type),
-                     pn_string_get(msg->content_encoding),
-                     msg->expiry_time,
-                     msg->creation_time,
-                     pn_string_get(msg->group_id),
-                     msg->group_sequence,
-                     pn_string_get(msg->reply_to_group_id));
+  if (msg->views[PNI_PROPERTIES_SECTION].start) {
+    err = pni_message_put_view(msg, PROPERTIES, PNI_PROPERTIES_SECTION);
+  } else {
+    pni_message_materialize_strings(msg);
+    static pni_format_t format = PNI_FORMAT("DL[CzSSSCssttSIS]");
+    err = pni_data_fill_format(msg->data, &format, PROPERTIES,
+                               msg->id,
+                               pni_string_size(msg->user_id), pni_string_get(msg->user_id),
+                               pni_string_get(msg->address),
+                               pni_string_get(msg->subject),
+                               pni_string_get(msg->reply_to),
+                               msg->correlation_id,
+                               pni_string_get(msg->content_type),
+                               pni_string_get(msg->content_encoding),
+                               msg->expiry_time,
+                               msg->creation_time,
+                               pni_string_get(msg->group_id),
+                               msg->group_sequence,
+                               pni_string_get(msg->reply_to_group_id));
+  }
   if (err)
-    return pn_error_format(msg->error, err, "data error: %s",
+    return pn_error_format(pni_message_error(msg), err, "data error: %s",
                            pn_data_error(msg->data));
 
-  if (pn_data_size(msg->properties)) {
+  if (msg->views[PNI_PROPERTIES].start) {
+    err = pni_message_put_view(msg, APPLICATION_PROPERTIES, PNI_PROPERTIES);
+    if (err)
+      return pn_error_format(pni_message_error(msg), err, "data error: %s",
+                             pn_data_error(msg->data));
+  } else if (pn_data_size(msg->properties)) {
     pn_data_put_described(msg->data);
     pn_data_enter(msg->data);
     pn_data_put_ulong(msg->data, APPLICATION_PROPERTIES);
     pn_data_rewind(msg->properties);
     err = pn_data_append(msg->data, msg->properties);
     if (err)
-      return pn_error_format(msg->error, err, "data error: %s",
+      return pn_error_format(pni_message_error(msg), err, "data error: %s",
                              pn_data_error(msg->data));
     pn_data_exit(msg->data);
   }
 
-  if (pn_data_size(msg->body)) {
+  if (msg->views[PNI_BODY].start) {
+    err = pni_message_put_view(msg, AMQP_VALUE, PNI_BODY);
+    if (err)
+      return pn_error_format(pni_message_error(msg), err, "data error: %s",
+                             pn_data_error(msg->data));
+  } else if (pn_data_size(msg->body)) {
     pn_data_rewind(msg->body);
     pn_data_next(msg->body);
     pn_type_t body_type = pn_data_type(msg->body);
@@ -842,43 +1238,175 @@ int pn_message_encode(pn_message_t *msg, char *bytes, size_t *size)
     pn_data_append(msg->data, msg->body);
   }
 
-  size_t remaining = *size;
-  ssize_t encoded = pn_data_encode(msg->data, bytes, remaining);
+  return 0;
+}
+
+int pn_message_encode(pn_message_t *msg, char *bytes, size_t *size)
+{
+  if (!msg || !bytes || !size || !*size) return PN_ARG_ERR;
+
+  int err = pni_message_fill(msg);
+  if (err) return err;
+
+  ssize_t encoded = pn_data_encode(msg->data, bytes, *size);
   if (encoded < 0) {
     if (encoded == PN_OVERFLOW) {
+      // let the caller grow its buffer to fit in one step
+      ssize_t required = pn_data_encoded_size(msg->data);
+      if (required > 0) *size = required;
+      pn_data_clear(msg->data);
       return encoded;
     } else {
-      return pn_error_format(msg->error, encoded, "data error: %s",
+      return pn_error_format(pni_message_error(msg), encoded, "data error: %s",
                              pn_data_error(msg->data));
     }
   }
 
-  bytes += encoded;
-  remaining -= encoded;
-
-  *size -= remaining;
+  *size = encoded;
 
   pn_data_clear(msg->data);
 
   return 0;
 }
 
+ssize_t pn_message_encode2(pn_message_t *msg, pn_rwbytes_t *buf)
+{
+  if (!msg || !buf) return PN_ARG_ERR;
+
+  int err = pni_message_fill(msg);
+  if (err) return err;
+
+  ssize_t size = pn_data_encoded_size(msg->data);
+  if (size < 0) {
+    return pn_error_format(pni_message_error(msg), size, "data error: %s",
+                           pn_data_error(msg->data));
+  }
+  if ((size_t) size > buf->size || !buf->start) {
+    char *start = (char *) pni_realloc(PN_ALLOC_MESSAGE, buf->start, size ? size : 1);
+    if (!start) return pn_error_format(pni_message_error(msg), PN_ERR, "out of memory");
+    buf->start = start;
+    buf->size = size;
+  }
+
+  ssize_t encoded = pn_data_encode(msg->data, buf->start, buf->size);
+  pn_data_clear(msg->data);
+  if (encoded < 0) {
+    return pn_error_format(pni_message_error(msg), encoded, "data error: %s",
+                           pn_data_error(msg->data));
+  }
+  return encoded;
+}
+
+// a batch is a run of data sections, each holding one encoded message
+
+static uint32_t pni_batch_read32(const uint8_t *bytes)
+{
+  return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) |
+    ((uint32_t) bytes[2] << 8) | bytes[3];
+}
+
+ssize_t pn_message_encode_batch(pn_message_t *msg, pn_rwbytes_t *buf, size_t offset)
+{
+  if (!msg || !buf || offset > buf->size) return PN_ARG_ERR;
+
+  int err = pni_message_fill(msg);
+  if (err) return err;
+
+  ssize_t size = pn_data_encoded_size(msg->data);
+  if (size < 0) {
+    return pn_error_format(pni_message_error(msg), size, "data error: %s",
+                           pn_data_error(msg->data));
+  }
+  size_t head = size < 256 ? 5 : 8;
+  size_t end = offset + head + size;
+  if (end > buf->size || !buf->start) {
+    // grown geometrically, as a batch is usually built up one message
+    // at a time
+    size_t capacity = buf->size ? buf->size : 256;
+    while (capacity < end) capacity *= 2;
+    char *start = (char *) pni_realloc(PN_ALLOC_MESSAGE, buf->start, capacity);
+    if (!start) return pn_error_format(pni_message_error(msg), PN_ERR, "out of memory");
+    buf->start = start;
+    buf->size = capacity;
+  }
+
+  uint8_t *section = (uint8_t *) buf->start + offset;
+  section[0] = PNE_DESCRIPTOR;
+  section[1] = PNE_SMALLULONG;
+  section[2] = DATA;
+  if (head == 5) {
+    section[3] = PNE_VBIN8;
+    section[4] = (uint8_t) size;
+  } else {
+    section[3] = PNE_VBIN32;
+    section[4] = (uint8_t) (size >> 24);
+    section[5] = (uint8_t) (size >> 16);
+    section[6] = (uint8_t) (size >> 8);
+    section[7] = (uint8_t) size;
+  }
+
+  ssize_t encoded = pn_data_encode(msg->data, (char *) section + head, size);
+  pn_data_clear(msg->data);
+  if (encoded < 0) {
+    return pn_error_format(pni_message_error(msg), encoded, "data error: %s",
+                           pn_data_error(msg->data));
+  }
+  return end;
+}
+
+ssize_t pn_message_batch_next(const char *bytes, size_t size, pn_bytes_t *encoded)
+{
+  if (!encoded || (size && !bytes)) return PN_ARG_ERR;
+  if (!size) return PN_EOS;
+
+  const uint8_t *section = (const uint8_t *) bytes;
+  size_t position;
+  if (size >= 3 && section[0] == PNE_DESCRIPTOR && section[1] == PNE_SMALLULONG &&
+      section[2] == DATA) {
+    position = 3;
+  } else if (size >= 10 && section[0] == PNE_DESCRIPTOR && section[1] == PNE_ULONG &&
+             ((uint64_t) pni_batch_read32(section + 2) << 32 |
+              pni_batch_read32(section + 6)) == DATA) {
+    position = 10;
+  } else {
+    return PN_ERR;
+  }
+
+  size_t length;
+  if (position + 2 <= size && section[position] == PNE_VBIN8) {
+    length = section[position + 1];
+    position += 2;
+  } else if (position + 5 <= size && section[position] == PNE_VBIN32) {
+    length = pni_batch_read32(section + position + 1);
+    position += 5;
+  } else if (position < size && section[position] != PNE_VBIN8 &&
+             section[position] != PNE_VBIN32) {
+    return PN_ERR;
+  } else {
+    return PN_UNDERFLOW;
+  }
+  if (length > size - position) return PN_UNDERFLOW;
+
+  *encoded = pn_bytes(length, bytes + position);
+  return position + length;
+}
+
 pn_data_t *pn_message_instructions(pn_message_t *msg)
 {
-  return msg ? msg->instructions : NULL;
+  return msg ? pni_message_section(msg, PNI_INSTRUCTIONS, &msg->instructions) : NULL;
 }
 
 pn_data_t *pn_message_annotations(pn_message_t *msg)
 {
-  return msg ? msg->annotations : NULL;
+  return msg ? pni_message_section(msg, PNI_ANNOTATIONS, &msg->annotations) : NULL;
 }
 
 pn_data_t *pn_message_properties(pn_message_t *msg)
 {
-  return msg ? msg->properties : NULL;
+  return msg ? pni_message_section(msg, PNI_PROPERTIES, &msg->properties) : NULL;
 }
 
 pn_data_t *pn_message_body(pn_message_t *msg)
 {
-  return msg ? msg->body : NULL;
+  return msg ? pni_message_section(msg, PNI_BODY, &msg->body) : NULL;
 }
@@ -0,0 +1,33 @@
+#ifndef _PROTON_MESSAGE_H
+#define _PROTON_MESSAGE_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include <proton/message.h>
+
+// give dst the contents of src and src those of dst, as if src had
+// been decoded into dst. The data objects stay with their message, so
+// pointers an application holds remain valid.
+void pni_message_move(pn_message_t *dst, pn_message_t *src);
+
+#endif /* message.h */
@@ -0,0 +1,489 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/error.h>
+#include <proton/object.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "journal.h"
+#include "mapped.h"
+#include "platform_fmt.h"
+#include "util.h"
+#include "alloc_private.h"
+
+// A segment is the magic followed by records of
+//
+//   size:32 check:32 type:8 id:64
+//
+// and for a put then format:32 address-size:32 address encoded, with
+// the address NUL terminated. The size covers the whole record and the
+// check is the FNV-1a hash of everything after it, so a record torn by
+// a crash ends its segment. Segments are removed oldest first once
+// every message put in them is done, and the head file holds the
+// number of the oldest one left.
+
+#define PNI_JOURNAL_MAGIC ("PNJRNL\x00\x01")
+#define PNI_JOURNAL_HEADER (8)
+#define PNI_JOURNAL_RECORD (17)
+#define PNI_JOURNAL_PUT (PNI_JOURNAL_RECORD + 8)
+#define PNI_JOURNAL_SEGMENT ((size_t) 16*1024*1024)
+#define PNI_FNV_BASIS (2166136261u)
+
+typedef enum {
+  PNI_RECORD_PUT = 1,
+  PNI_RECORD_DONE = 2
+} pni_record_type_t;
+
+typedef struct {
+  uint64_t number;
+  uint64_t first;  // no message put in it has a lower id
+  size_t live;     // put in it and not yet done
+} pni_segment_t;
+
+struct pni_journal_t {
+  pn_string_t *directory;
+  pn_string_t *path;
+  pn_string_t *other;
+  pni_mapped_t *tail;
+  size_t tail_size;
+  size_t segment_size;
+  pni_segment_t *segments;  // oldest first, the last is the tail
+  size_t count;
+  size_t capacity;
+  uint64_t next_id;
+  bool dirty;
+};
+
+static void pni_write32(char *bytes, uint32_t value)
+{
+  bytes[0] = (char) (value >> 24);
+  bytes[1] = (char) (value >> 16);
+  bytes[2] = (char) (value >> 8);
+  bytes[3] = (char) value;
+}
+
+static void pni_write64(char *bytes, uint64_t value)
+{
+  pni_write32(bytes, (uint32_t) (value >> 32));
+  pni_write32(bytes + 4, (uint32_t) value);
+}
+
+static uint32_t pni_read32(const char *bytes)
+{
+  const unsigned char *b = (const unsigned char *) bytes;
+  return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | b[3];
+}
+
+static uint64_t pni_read64(const char *bytes)
+{
+  return ((uint64_t) pni_read32(bytes) << 32) | pni_read32(bytes + 4);
+}
+
+static uint32_t pni_fnv(uint32_t hash, const char *bytes, size_t size)
+{
+  const unsigned char *b = (const unsigned char *) bytes;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ b[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static const char *pni_journal_path(pni_journal_t *journal, pn_string_t *path, const char *name)
+{
+  pn_string_format(path, "%s/%s", pn_string_get(journal->directory), name);
+  return pn_string_get(path);
+}
+
+static const char *pni_segment_path(pni_journal_t *journal, uint64_t number)
+{
+  pn_string_format(journal->path, "%s/%020" PRIu64 ".seg",
+                   pn_string_get(journal->directory), number);
+  return pn_string_get(journal->path);
+}
+
+pni_journal_t *pni_journal(const char *directory)
+{
+  pni_journal_t *journal = (pni_journal_t *) pni_malloc(PN_ALLOC_MESSENGER, sizeof(pni_journal_t));
+  if (!journal) return NULL;
+  journal->directory = pn_string(directory);
+  journal->path = pn_string(NULL);
+  journal->other = pn_string(NULL);
+  journal->tail = NULL;
+  journal->tail_size = 0;
+  journal->segment_size = PNI_JOURNAL_SEGMENT;
+  journal->segments = NULL;
+  journal->count = 0;
+  journal->capacity = 0;
+  journal->next_id = 1;
+  journal->dirty = false;
+  return journal;
+}
+
+void pni_journal_free(pni_journal_t *journal)
+{
+  if (!journal) return;
+  pni_journal_commit(journal);
+  if (journal->tail) pni_mapped_close(journal->tail);
+  pni_free(PN_ALLOC_MESSENGER, journal->segments);
+  pn_free(journal->directory);
+  pn_free(journal->path);
+  pn_free(journal->other);
+  pni_free(PN_ALLOC_MESSENGER, journal);
+}
+
+void pni_journal_set_segment_size(pni_journal_t *journal, size_t size)
+{
+  journal->segment_size = size;
+}
+
+static pni_segment_t *pni_journal_segment(pni_journal_t *journal, uint64_t number)
+{
+  if (journal->count == journal->capacity) {
+    size_t capacity = journal->capacity ? 2*journal->capacity : 8;
+    pni_segment_t *segments = (pni_segment_t *)
+      pni_realloc(PN_ALLOC_MESSENGER, journal->segments, capacity*sizeof(pni_segment_t));
+    if (!segments) return NULL;
+    journal->segments = segments;
+    journal->capacity = capacity;
+  }
+  pni_segment_t *segment = &journal->segments[journal->count++];
+  segment->number = number;
+  segment->first = journal->next_id;
+  segment->live = 0;
+  return segment;
+}
+
+// the head is written aside and then moved into place, so a reader that
+// finds both takes the lower
+static int pni_journal_write_head(pni_journal_t *journal, uint64_t number)
+{
+  char bytes[8];
+  pni_write64(bytes, number);
+  const char *aside = pni_journal_path(journal, journal->other, "head.new");
+  pni_mapped_t *file = pni_mapped(aside);
+  if (!file) return PN_ERR;
+  int err = pni_mapped_append(file, bytes, 8);
+  if (!err) err = pni_mapped_sync(file);
+  pni_mapped_close(file);
+  if (err) return err;
+  const char *head = pni_journal_path(journal, journal->path, "head");
+  remove(head);
+  return rename(aside, head) ? PN_ERR : 0;
+}
+
+static bool pni_journal_read_head(pni_journal_t *journal, const char *name, uint64_t *number)
+{
+  pni_view_t *view = pni_view(pni_journal_path(journal, journal->path, name));
+  if (!view) return false;
+  pn_bytes_t bytes = pni_view_bytes(view);
+  bool ok = bytes.size == 8;
+  if (ok) *number = pni_read64(bytes.start);
+  pni_view_close(view);
+  return ok;
+}
+
+// remove the segments at the old end that hold nothing live, never the
+// tail
+static void pni_journal_retire(pni_journal_t *journal)
+{
+  size_t retired = 0;
+  while (retired + 1 < journal->count && !journal->segments[retired].live) {
+    retired++;
+  }
+  if (!retired) return;
+  if (pni_journal_write_head(journal, journal->segments[retired].number)) return;
+  for (size_t i = 0; i < retired; i++) {
+    remove(pni_segment_path(journal, journal->segments[i].number));
+  }
+  journal->count -= retired;
+  memmove(journal->segments, journal->segments + retired, journal->count*sizeof(pni_segment_t));
+}
+
+static int pni_journal_start(pni_journal_t *journal, uint64_t number)
+{
+  pni_mapped_t *tail = pni_mapped(pni_segment_path(journal, number));
+  if (!tail) return PN_ERR;
+  if (pni_mapped_append(tail, PNI_JOURNAL_MAGIC, PNI_JOURNAL_HEADER) ||
+      !pni_journal_segment(journal, number)) {
+    pni_mapped_close(tail);
+    return PN_ERR;
+  }
+  journal->tail = tail;
+  journal->tail_size = PNI_JOURNAL_HEADER;
+  return 0;
+}
+
+// close the tail once it is full, or once an append to it failed part
+// way so that nothing follows the torn record
+static void pni_journal_close_tail(pni_journal_t *journal)
+{
+  if (journal->dirty) pni_mapped_sync(journal->tail);
+  pni_mapped_close(journal->tail);
+  journal->tail = NULL;
+  journal->dirty = false;
+}
+
+static int pni_journal_tail(pni_journal_t *journal)
+{
+  if (journal->tail && journal->tail_size < journal->segment_size) return 0;
+  if (journal->tail) pni_journal_close_tail(journal);
+  uint64_t number = journal->count ? journal->segments[journal->count - 1].number + 1 : 0;
+  int err = pni_journal_start(journal, number);
+  if (!err) pni_journal_retire(journal);
+  return err;
+}
+
+typedef struct {
+  uint64_t id;
+  const char *address;
+  uint32_t format;
+  pn_bytes_t encoded;
+  size_t segment;
+  bool live;
+} pni_recovered_t;
+
+typedef struct {
+  pni_recovered_t *records;
+  size_t count;
+  size_t capacity;
+  pn_hash_t *ids;  // id to index + 1 of those not yet done
+  pni_view_t **views;
+  size_t nviews;
+  size_t vcapacity;
+} pni_recovery_t;
+
+static bool pni_recovery_grow(void **array, size_t *capacity, size_t count, size_t size)
+{
+  if (count < *capacity) return true;
+  size_t grown = *capacity ? 2*(*capacity) : 32;
+  void *resized = pni_realloc(PN_ALLOC_MESSENGER, *array, grown*size);
+  if (!resized) return false;
+  *array = resized;
+  *capacity = grown;
+  return true;
+}
+
+static int pni_journal_scan(pni_journal_t *journal, pn_bytes_t bytes, pni_recovery_t *recovery)
+{
+  size_t segment = journal->count - 1;
+  if (bytes.size < PNI_JOURNAL_HEADER ||
+      memcmp(bytes.start, PNI_JOURNAL_MAGIC, PNI_JOURNAL_HEADER)) {
+    // created but never written to, or torn before the magic was whole
+    size_t i = 0;
+    while (i < pn_min(bytes.size, PNI_JOURNAL_HEADER) && bytes.start[i] == PNI_JOURNAL_MAGIC[i]) i++;
+    while (i < pn_min(bytes.size, PNI_JOURNAL_HEADER) && !bytes.start[i]) i++;
+    if (i == pn_min(bytes.size, PNI_JOURNAL_HEADER)) return 0;
+    errno = EINVAL;
+    return PN_ERR;
+  }
+
+  size_t offset = PNI_JOURNAL_HEADER;
+  bool first = true;
+  while (bytes.size - offset >= PNI_JOURNAL_RECORD) {
+    const char *record = bytes.start + offset;
+    size_t size = pni_read32(record);
+    if (size < PNI_JOURNAL_RECORD || size > bytes.size - offset) break;
+    if (pni_read32(record + 4) != pni_fnv(PNI_FNV_BASIS, record + 8, size - 8)) break;
+    uint8_t type = (uint8_t) record[8];
+    uint64_t id = pni_read64(record + 9);
+
+    if (type == PNI_RECORD_PUT) {
+      if (size < PNI_JOURNAL_PUT) break;
+      size_t asize = pni_read32(record + 21);
+      if (!asize || asize > size - PNI_JOURNAL_PUT || record[PNI_JOURNAL_PUT + asize - 1]) break;
+      if (!pni_recovery_grow((void **) &recovery->records, &recovery->capacity,
+                             recovery->count, sizeof(pni_recovered_t))) {
+        return PN_ERR;
+      }
+      pni_recovered_t *r = &recovery->records[recovery->count++];
+      r->id = id;
+      r->address = record + PNI_JOURNAL_PUT;
+      r->format = pni_read32(record + 17);
+      r->encoded = pn_bytes(size - PNI_JOURNAL_PUT - asize, record + PNI_JOURNAL_PUT + asize);
+      r->segment = segment;
+      r->live = true;
+      pn_hash_put(recovery->ids, (uintptr_t) id, (void *) (uintptr_t) recovery->count);
+      // done looks messages up by the first id put in each segment, which
+      // was not known when the segment was found
+      if (first) journal->segments[segment].first = id;
+      first = false;
+      journal->segments[segment].live++;
+    } else if (type == PNI_RECORD_DONE) {
+      uintptr_t index = (uintptr_t) pn_hash_get(recovery->ids, (uintptr_t) id);
+      if (index) {
+        pni_recovered_t *r = &recovery->records[index - 1];
+        r->live = false;
+        journal->segments[r->segment].live--;
+        pn_hash_del(recovery->ids, (uintptr_t) id);
+      }
+    } else {
+      break;
+    }
+
+    if (id >= journal->next_id) journal->next_id = id + 1;
+    offset += size;
+  }
+  return 0;
+}
+
+int pni_journal_open(pni_journal_t *journal, pni_journal_recover_t recover, void *context)
+{
+  uint64_t head = 0, aside = 0;
+  bool has_head = pni_journal_read_head(journal, "head", &head);
+  bool has_aside = pni_journal_read_head(journal, "head.new", &aside);
+  uint64_t first = has_head ? head : aside;
+  uint64_t last = first;
+  if (has_head && has_aside) {
+    first = pn_min(head, aside);
+    last = pn_max(head, aside);
+  }
+
+  pni_recovery_t recovery;
+  memset(&recovery, 0, sizeof(recovery));
+  recovery.ids = pn_hash(PN_VOID, 0, 0.75);
+  int err = 0;
+  uint64_t number;
+  // the segments before the newer head may be gone already
+  for (number = first; ; number++) {
+    pni_view_t *view = pni_view(pni_segment_path(journal, number));
+    if (!view) {
+      if (errno != ENOENT) err = PN_ERR;
+      if (!err && number < last) continue;
+      break;
+    }
+    if (!pni_recovery_grow((void **) &recovery.views, &recovery.vcapacity,
+                           recovery.nviews, sizeof(pni_view_t *)) ||
+        !pni_journal_segment(journal, number)) {
+      pni_view_close(view);
+      err = PN_ERR;
+      break;
+    }
+    recovery.views[recovery.nviews++] = view;
+    err = pni_journal_scan(journal, pni_view_bytes(view), &recovery);
+    if (err) break;
+  }
+
+  // new messages go to a segment of their own, started before any
+  // recovered message can be done with
+  if (!err) err = pni_journal_start(journal, number);
+
+  int recovered = 0;
+  for (size_t i = 0; !err && i < recovery.count; i++) {
+    pni_recovered_t *r = &recovery.records[i];
+    if (!r->live) continue;
+    recover(context, r->id, r->address, r->format, r->encoded);
+    recovered++;
+  }
+
+  for (size_t i = 0; i < recovery.nviews; i++) {
+    pni_view_close(recovery.views[i]);
+  }
+  pni_free(PN_ALLOC_MESSENGER, recovery.views);
+  pni_free(PN_ALLOC_MESSENGER, recovery.records);
+  pn_free(recovery.ids);
+  if (err) return err;
+
+  pni_journal_retire(journal);
+  return recovered;
+}
+
+uint64_t pni_journal_put(pni_journal_t *journal, const char *address, uint32_t format,
+                         pn_bytes_t encoded)
+{
+  if (pni_journal_tail(journal)) return 0;
+  if (!address) address = "";
+  size_t asize = strlen(address) + 1;
+  size_t size = PNI_JOURNAL_PUT + asize + encoded.size;
+  if (size > UINT32_MAX) {
+    errno = EFBIG;
+    return 0;
+  }
+
+  uint64_t id = journal->next_id;
+  char header[PNI_JOURNAL_PUT];
+  pni_write32(header, (uint32_t) size);
+  header[8] = PNI_RECORD_PUT;
+  pni_write64(header + 9, id);
+  pni_write32(header + 17, format);
+  pni_write32(header + 21, (uint32_t) asize);
+  uint32_t check = pni_fnv(PNI_FNV_BASIS, header + 8, PNI_JOURNAL_PUT - 8);
+  check = pni_fnv(check, address, asize);
+  check = pni_fnv(check, encoded.start, encoded.size);
+  pni_write32(header + 4, check);
+
+  if (pni_mapped_append(journal->tail, header, PNI_JOURNAL_PUT) ||
+      pni_mapped_append(journal->tail, address, asize) ||
+      pni_mapped_append(journal->tail, encoded.start, encoded.size)) {
+    pni_journal_close_tail(journal);
+    return 0;
+  }
+  journal->next_id++;
+  journal->tail_size += size;
+  journal->segments[journal->count - 1].live++;
+  journal->dirty = true;
+  return id;
+}
+
+int pni_journal_done(pni_journal_t *journal, uint64_t id)
+{
+  if (!id || !journal->count) return 0;
+
+  // the message is in the last segment started before it was put
+  size_t lo = 0, hi = journal->count;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo)/2;
+    if (journal->segments[mid].first <= id) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  pni_segment_t *segment = &journal->segments[lo];
+  if (segment->first > id || !segment->live) return 0;
+  segment->live--;
+
+  // a done that never reaches the disk only means the message is sent
+  // again after a restart
+  int err = pni_journal_tail(journal);
+  if (!err) {
+    char record[PNI_JOURNAL_RECORD];
+    pni_write32(record, PNI_JOURNAL_RECORD);
+    record[8] = PNI_RECORD_DONE;
+    pni_write64(record + 9, id);
+    pni_write32(record + 4, pni_fnv(PNI_FNV_BASIS, record + 8, PNI_JOURNAL_RECORD - 8));
+    err = pni_mapped_append(journal->tail, record, PNI_JOURNAL_RECORD);
+    if (err) {
+      pni_journal_close_tail(journal);
+    } else {
+      journal->tail_size += PNI_JOURNAL_RECORD;
+    }
+  }
+  pni_journal_retire(journal);
+  return err;
+}
+
+int pni_journal_commit(pni_journal_t *journal)
+{
+  if (!journal->dirty || !journal->tail) return 0;
+  journal->dirty = false;
+  return pni_mapped_sync(journal->tail);
+}
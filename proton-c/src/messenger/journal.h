@@ -0,0 +1,53 @@
+#ifndef _PROTON_JOURNAL_H
+#define _PROTON_JOURNAL_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/import_export.h>
+#include <proton/types.h>
+
+// An append only journal of encoded messages on disk, kept in segment
+// files that go once every message in them is done with.
+
+typedef struct pni_journal_t pni_journal_t;
+
+// called for each message a previous run put and never finished, in
+// the order they were put, encoded is only valid during the call
+typedef void (*pni_journal_recover_t)(void *context, uint64_t id, const char *address,
+                                      uint32_t format, pn_bytes_t encoded);
+
+PN_EXTERN pni_journal_t *pni_journal(const char *directory);
+PN_EXTERN void pni_journal_free(pni_journal_t *journal);
+// a new segment is started once the tail holds this much, 16MiB unless
+// set before opening
+PN_EXTERN void pni_journal_set_segment_size(pni_journal_t *journal, size_t size);
+// read what the directory holds, then start a new segment to append to
+PN_EXTERN int pni_journal_open(pni_journal_t *journal, pni_journal_recover_t recover, void *context);
+// the id of the message appended, or zero with errno set
+PN_EXTERN uint64_t pni_journal_put(pni_journal_t *journal, const char *address, uint32_t format,
+                                   pn_bytes_t encoded);
+PN_EXTERN int pni_journal_done(pni_journal_t *journal, uint64_t id);
+// wait until the messages put so far are on disk, done records go along
+// with them rather than being waited for on their own
+PN_EXTERN int pni_journal_commit(pni_journal_t *journal);
+
+#endif /* journal.h */
@@ -39,15 +39,29 @@
 #include "platform.h"
 #include "platform_fmt.h"
 #include "store.h"
+#include "journal.h"
 #include "transform.h"
 #include "subscription.h"
+#include "shard.h"
+#include "messenger.h"
 #include "selectable.h"
+#include "wakeup.h"
 #include "../log_private.h"
+#include "alloc_private.h"
 
 typedef struct pn_link_ctx_t pn_link_ctx_t;
 
+// an intrusive queue of receiving links, see the LL_ macros
+typedef struct {
+  pn_link_ctx_t *queue_head;
+  pn_link_ctx_t *queue_tail;
+  size_t size;
+} pni_link_queue_t;
+
 typedef struct {
   pn_string_t *text;
+  pn_string_t *source; // what text held before parsing, while parsed
+  bool parsed;
   bool passive;
   char *scheme;
   char *user;
@@ -75,17 +89,25 @@ struct pn_messenger_t {
   pn_io_t *io;
   pn_list_t *pending; // pending selectables
   pn_selectable_t *interruptor;
-  pn_socket_t ctrl[2];
+  pni_wakeup_t ctrl;
   pn_list_t *listeners;
   pn_list_t *connections;
+  pn_map_t *connection_index; // key or remote container to connection
+  pn_string_t *connection_key;
   pn_selector_t *selector;
   pn_collector_t *collector;
-  pn_list_t *credited;
-  pn_list_t *blocked;
+  pni_link_queue_t credited; // least recently received from first
+  pni_link_queue_t blocked;  // out of credit they used
+  pni_link_queue_t idle;     // drained of credit they did not use
   pn_timestamp_t next_drain;
+  pn_timestamp_t now; // read once each pass of pn_messenger_process
+  struct pn_connection_ctx_t **ticks; // min heap on tick deadline
+  size_t tick_count;
+  size_t tick_capacity;
   uint64_t next_tag;
   pni_store_t *outgoing;
   pni_store_t *incoming;
+  pni_journal_t *journal;  // of the outgoing messages
   pn_list_t *subscriptions;
   pn_subscription_t *incoming_subscription;
   pn_error_t *error;
@@ -95,6 +117,7 @@ struct pn_messenger_t {
   pn_tracker_t incoming_tracker;
   pn_string_t *original;
   pn_string_t *rewritten;
+  pn_string_t *routed;
   pn_string_t *domain;
   int timeout;
   int send_threshold;
@@ -110,6 +133,12 @@ struct pn_messenger_t {
   pn_rcv_settle_mode_t rcv_settle_mode;
   pn_tracer_t tracer;
   pn_ssl_verify_mode_t ssl_peer_authentication_mode;
+  int threads;
+  int prefetch;
+  pni_shards_t *shards;  // once started with threads
+  pni_shards_t *owner;   // of a shard
+  int shard;
+  pn_transport_metrics_t reclaimed;  // of the connections already gone
   bool blocking;
   bool passive;
   bool interrupted;
@@ -133,7 +162,17 @@ typedef struct {
   pn_ssl_domain_t *domain;
 } pn_listener_ctx_t;
 
-typedef struct {
+// the capability of a peer that routes messages by their to field, so
+// one anonymous link carries messages for any address
+#define PNI_ANONYMOUS_RELAY ("ANONYMOUS-RELAY")
+// named sender links kept per connection when the peer relays
+#define PNI_NAMED_LINKS (32)
+// addresses recently sent through the relay, and how often one is
+// sent to before it gets a link of its own
+#define PNI_RECENT (64)
+#define PNI_HOT (8)
+
+typedef struct pn_connection_ctx_t {
   CTX_HEAD
   pn_connection_t *connection;
   char *address;
@@ -142,7 +181,17 @@ typedef struct {
   char *pass;
   char *host;
   char *port;
+  pn_string_t *key;
+  pn_string_t *alias;
   pn_listener_ctx_t *listener;
+  pn_timestamp_t deadline; // when the transport next wants a tick
+  size_t tick;             // position in the ticks heap plus one
+  pn_link_t *relay;        // the anonymous sender
+  struct pn_link_ctx_t *named_head; // named senders, least recently used first
+  struct pn_link_ctx_t *named_tail;
+  size_t named;
+  uint32_t recent[PNI_RECENT];      // hash and count of each, see pni_address_hot()
+  int relays;              // whether the peer offers a relay, zero until known
 } pn_connection_ctx_t;
 
 static pn_connection_ctx_t *pni_context(pn_selectable_t *sel)
@@ -153,6 +202,85 @@ static pn_connection_ctx_t *pni_context(pn_selectable_t *sel)
   return ctx;
 }
 
+static bool pni_tick_before(pn_messenger_t *m, size_t a, size_t b)
+{
+  return m->ticks[a]->deadline < m->ticks[b]->deadline;
+}
+
+static void pni_tick_place(pn_messenger_t *m, size_t i, pn_connection_ctx_t *ctx)
+{
+  m->ticks[i] = ctx;
+  ctx->tick = i + 1;
+}
+
+static void pni_tick_sift(pn_messenger_t *m, size_t i)
+{
+  pn_connection_ctx_t *ctx = m->ticks[i];
+  while (i > 0 && ctx->deadline < m->ticks[(i - 1)/2]->deadline) {
+    pni_tick_place(m, i, m->ticks[(i - 1)/2]);
+    i = (i - 1)/2;
+  }
+  while (true) {
+    size_t c = 2*i + 1;
+    if (c >= m->tick_count) break;
+    if (c + 1 < m->tick_count && pni_tick_before(m, c + 1, c)) c++;
+    if (m->ticks[c]->deadline >= ctx->deadline) break;
+    pni_tick_place(m, i, m->ticks[c]);
+    i = c;
+  }
+  pni_tick_place(m, i, ctx);
+}
+
+static pn_timestamp_t pni_messenger_mark(pn_messenger_t *m)
+{
+  m->now = (m->flags & PN_FLAGS_COARSE_CLOCK) ? pn_i_now_coarse() : pn_i_now();
+  return m->now;
+}
+
+// (re)schedule the tick of a connection's transport, a zero deadline
+// takes the connection out of the heap
+static void pni_tick_schedule(pn_messenger_t *m, pn_connection_ctx_t *ctx, pn_timestamp_t deadline)
+{
+  if (!ctx->tick) {
+    if (!deadline) return;
+    if (m->tick_count == m->tick_capacity) {
+      size_t capacity = m->tick_capacity ? 2*m->tick_capacity : 16;
+      pn_connection_ctx_t **ticks = (pn_connection_ctx_t **)
+        pni_realloc(PN_ALLOC_MESSENGER, m->ticks, capacity*sizeof(pn_connection_ctx_t *));
+      // without room the connection is not ticked until it reschedules
+      if (!ticks) return;
+      m->ticks = ticks;
+      m->tick_capacity = capacity;
+    }
+    ctx->deadline = deadline;
+    pni_tick_place(m, m->tick_count++, ctx);
+    pni_tick_sift(m, m->tick_count - 1);
+  } else if (deadline) {
+    ctx->deadline = deadline;
+    pni_tick_sift(m, ctx->tick - 1);
+  } else {
+    size_t i = ctx->tick - 1;
+    ctx->tick = 0;
+    ctx->deadline = 0;
+    pn_connection_ctx_t *last = m->ticks[--m->tick_count];
+    if (i < m->tick_count) {
+      pni_tick_place(m, i, last);
+      pni_tick_sift(m, i);
+    }
+  }
+}
+
+// tick the connection's transport now and schedule the next tick it
+// asks for
+static void pni_connection_tick(pn_connection_ctx_t *ctx, pn_timestamp_t now)
+{
+  pn_transport_t *transport = pn_connection_transport(ctx->connection);
+  pn_timestamp_t deadline = transport ? pn_transport_tick(transport, now) : 0;
+  // a deadline that has already passed is retried on the next pass
+  if (deadline && deadline <= now) deadline = now + 1;
+  pni_tick_schedule(ctx->messenger, ctx, deadline);
+}
+
 static pn_transport_t *pni_transport(pn_selectable_t *sel)
 {
   return pn_connection_transport(pni_context(sel)->connection);
@@ -192,7 +320,12 @@ static pn_timestamp_t pni_connection_deadline(pn_selectable_t *sel)
   return ctx->messenger->next_drain;
 }
 
-static void pni_connection_update(pn_selectable_t *sel) {
+// true if the interest changed from what the selector was last given
+static bool pni_connection_update(pn_selectable_t *sel) {
+  bool reading = pn_selectable_is_reading(sel);
+  bool writing = pn_selectable_is_writing(sel);
+  pn_timestamp_t deadline = pn_selectable_get_deadline(sel);
+  bool terminal = pn_selectable_is_terminal(sel);
   ssize_t c = pni_connection_capacity(sel);
   pn_selectable_set_reading(sel, c > 0);
   ssize_t p = pni_connection_pending(sel);
@@ -201,6 +334,10 @@ static void pni_connection_update(pn_selectable_t *sel) {
   if (c < 0 && p < 0) {
     pn_selectable_terminate(sel);
   }
+  return reading != pn_selectable_is_reading(sel) ||
+    writing != pn_selectable_is_writing(sel) ||
+    deadline != pn_selectable_get_deadline(sel) ||
+    terminal != pn_selectable_is_terminal(sel);
 }
 
 #include <errno.h>
@@ -222,8 +359,11 @@ void pni_modified(pn_ctx_t *ctx)
 
 void pni_conn_modified(pn_connection_ctx_t *ctx)
 {
-  pni_connection_update(ctx->selectable);
-  pni_modified((pn_ctx_t *) ctx);
+  // the selector only hears about real changes, each of which can cost
+  // a system call with epoll or kqueue
+  if (pni_connection_update(ctx->selectable)) {
+    pni_modified((pn_ctx_t *) ctx);
+  }
 }
 
 void pni_lnr_modified(pn_listener_ctx_t *lnr)
@@ -255,6 +395,9 @@ static void pni_connection_readable(pn_selectable_t *sel)
       int err = pn_transport_process(transport, (size_t)n);
       if (err)
         pn_error_copy(messenger->error, pn_transport_error(transport));
+      // input can bring the peer's idle timeout, which moves the next
+      // tick earlier
+      pni_connection_tick(context, messenger->now);
     }
   }
 
@@ -305,6 +448,8 @@ static void pni_connection_finalize(pn_selectable_t *sel)
   pn_socket_t fd = pn_selectable_get_fd(sel);
   pn_close(ctx->messenger->io, fd);
   pn_list_remove(ctx->messenger->pending, sel);
+  // a connection going away is progress for pn_messenger_work()
+  ctx->messenger->worked = true;
   pni_messenger_reclaim(ctx->messenger, ctx->connection);
 }
 
@@ -324,6 +469,7 @@ static void pni_listener_readable(pn_selectable_t *sel)
   const char *scheme = pn_subscription_scheme(sub);
   char name[1024];
   pn_socket_t sock = pn_accept(ctx->messenger->io, pn_selectable_get_fd(sel), name, 1024);
+  if (sock == PN_INVALID_SOCKET) return;
 
   pn_transport_t *t = pn_transport();
   pn_transport_set_server(t);
@@ -349,6 +495,7 @@ static void pni_listener_finalize(pn_selectable_t *sel)
   pn_messenger_t *messenger = lnr->messenger;
   pn_close(messenger->io, pn_selectable_get_fd(sel));
   pn_list_remove(messenger->pending, sel);
+  messenger->worked = true;
   pn_listener_ctx_free(messenger, lnr);
 }
 
@@ -357,6 +504,11 @@ static bool pn_streq(const char *a, const char *b)
   return a == b || (a && b && !strcmp(a, b));
 }
 
+static bool pni_secure_scheme(const char *scheme)
+{
+  return scheme && (!strcmp(scheme, "amqps") || !strcmp(scheme, "amqps+unix"));
+}
+
 static const char *default_port(const char *scheme)
 {
   if (scheme && pn_streq(scheme, "amqps"))
@@ -370,7 +522,9 @@ static pn_listener_ctx_t *pn_listener_ctx(pn_messenger_t *messenger,
                                           const char *host,
                                           const char *port)
 {
-  pn_socket_t socket = pn_listen(messenger->io, host, port ? port : default_port(scheme));
+  pn_socket_t socket = pni_unix_scheme(scheme)
+    ? pn_listen_unix(messenger->io, host)
+    : pn_listen(messenger->io, host, port ? port : default_port(scheme));
   if (socket == PN_INVALID_SOCKET) {
     pn_error_copy(messenger->error, pn_io_error(messenger->io));
     pn_error_format(messenger->error, PN_ERR, "CONNECTION ERROR (%s:%s): %s\n",
@@ -397,7 +551,7 @@ static pn_listener_ctx_t *pn_listener_ctx(pn_messenger_t *messenger,
     }
   }
 
-  if (!(scheme && !strcmp(scheme, "amqps"))) {
+  if (!pni_secure_scheme(scheme)) {
     pn_ssl_domain_allow_unsecured_client(ctx->domain);
   }
 
@@ -425,8 +579,8 @@ static void pn_listener_ctx_free(pn_messenger_t *messenger, pn_listener_ctx_t *c
 {
   pn_list_remove(messenger->listeners, ctx);
   // XXX: subscriptions are freed when the messenger is freed pn_subscription_free(ctx->subscription);
-  free(ctx->host);
-  free(ctx->port);
+  pni_free(PN_ALLOC_MESSENGER, ctx->host);
+  pni_free(PN_ALLOC_MESSENGER, ctx->port);
   pn_ssl_domain_free(ctx->domain);
   pn_free(ctx);
 }
@@ -443,7 +597,7 @@ static pn_connection_ctx_t *pn_connection_ctx(pn_messenger_t *messenger,
 {
   pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
   assert(!ctx);
-  ctx = (pn_connection_ctx_t *) malloc(sizeof(pn_connection_ctx_t));
+  ctx = (pn_connection_ctx_t *) pni_malloc(PN_ALLOC_MESSENGER, sizeof(pn_connection_ctx_t));
   ctx->messenger = messenger;
   ctx->connection = conn;
   pn_selectable_t *sel = pn_selectable();
@@ -462,7 +616,20 @@ static pn_connection_ctx_t *pn_connection_ctx(pn_messenger_t *messenger,
   ctx->pass = pn_strdup(pass);
   ctx->host = pn_strdup(host);
   ctx->port = pn_strdup(port);
+  ctx->key = NULL;
+  ctx->alias = NULL;
   ctx->listener = lnr;
+  ctx->deadline = 0;
+  ctx->tick = 0;
+  ctx->relay = NULL;
+  ctx->named_head = NULL;
+  ctx->named_tail = NULL;
+  ctx->named = 0;
+  memset(ctx->recent, 0, sizeof(ctx->recent));
+  ctx->relays = 0;
+  // the transport is bound right after, tick it on the next pass to
+  // learn when it needs ticking
+  pni_tick_schedule(messenger, ctx, messenger->now);
   pn_connection_set_context(conn, ctx);
   return ctx;
 }
@@ -471,24 +638,20 @@ static void pn_connection_ctx_free(pn_connection_t *conn)
 {
   pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
   if (ctx) {
+    pni_tick_schedule(ctx->messenger, ctx, 0);
     pni_selectable_set_context(ctx->selectable, NULL);
-    free(ctx->scheme);
-    free(ctx->user);
-    free(ctx->pass);
-    free(ctx->host);
-    free(ctx->port);
-    free(ctx);
+    pni_free(PN_ALLOC_MESSENGER, ctx->scheme);
+    pni_free(PN_ALLOC_MESSENGER, ctx->user);
+    pni_free(PN_ALLOC_MESSENGER, ctx->pass);
+    pni_free(PN_ALLOC_MESSENGER, ctx->host);
+    pni_free(PN_ALLOC_MESSENGER, ctx->port);
+    pn_free(ctx->key);
+    pn_free(ctx->alias);
+    pni_free(PN_ALLOC_MESSENGER, ctx);
     pn_connection_set_context(conn, NULL);
   }
 }
 
-#define OUTGOING (0x0000000000000000)
-#define INCOMING (0x1000000000000000)
-
-#define pn_tracker(direction, sequence) ((direction) | (sequence))
-#define pn_tracker_direction(tracker) ((tracker) & (0x1000000000000000))
-#define pn_tracker_sequence(tracker) ((pn_sequence_t) ((tracker) & (0x00000000FFFFFFFF)))
-
 static char *build_name(const char *name)
 {
   if (name) {
@@ -500,8 +663,42 @@ static char *build_name(const char *name)
 
 struct pn_link_ctx_t {
   pn_subscription_t *subscription;
+  pn_link_t *link;
+  pni_link_queue_t *queued; // whichever of the messenger's queues holds the link
+  pn_link_ctx_t *queue_next;
+  pn_link_ctx_t *queue_prev;
+  pn_string_t *held; // of a sender, the address of the messages waiting for credit
+  pn_link_ctx_t *named_next;
+  pn_link_ctx_t *named_prev;
+  bool named;        // on the connection's list of named senders
+  bool relay;        // the connection's anonymous sender
+  bool evicted;      // closed to make room, freed once the peer closes it too
 };
 
+static void pni_link_enqueue(pni_link_queue_t *queue, pn_link_ctx_t *ctx)
+{
+  assert(!ctx->queued);
+  LL_ADD(queue, queue, ctx);
+  ctx->queued = queue;
+  queue->size++;
+}
+
+static void pni_link_dequeue(pn_link_ctx_t *ctx)
+{
+  pni_link_queue_t *queue = ctx->queued;
+  if (!queue) return;
+  LL_REMOVE(queue, queue, ctx);
+  ctx->queue_next = NULL;
+  ctx->queue_prev = NULL;
+  ctx->queued = NULL;
+  queue->size--;
+}
+
+static pn_link_ctx_t *pni_link_ctx(pn_link_t *link)
+{
+  return (pn_link_ctx_t *) pn_link_get_context(link);
+}
+
 // compute the maximum amount of credit each receiving link is
 // entitled to.  The actual credit given to the link depends on what
 // amount of credit is actually available.
@@ -518,11 +715,17 @@ static void link_ctx_setup( pn_messenger_t *messenger,
 {
   if (pn_link_is_receiver(link)) {
     messenger->receivers++;
-    pn_link_ctx_t *ctx = (pn_link_ctx_t *) calloc(1, sizeof(pn_link_ctx_t));
+    pn_link_ctx_t *ctx = (pn_link_ctx_t *) pni_calloc(PN_ALLOC_MESSENGER, 1, sizeof(pn_link_ctx_t));
     assert( ctx );
     assert( !pn_link_get_context(link) );
     pn_link_set_context( link, ctx );
-    pn_list_add(messenger->blocked, link);
+    ctx->link = link;
+    pni_link_enqueue(&messenger->blocked, ctx);
+  } else {
+    pn_link_ctx_t *ctx = (pn_link_ctx_t *) pni_calloc(PN_ALLOC_MESSENGER, 1, sizeof(pn_link_ctx_t));
+    assert( ctx );
+    pn_link_set_context( link, ctx );
+    ctx->link = link;
   }
 }
 
@@ -538,18 +741,135 @@ static void link_ctx_release( pn_messenger_t *messenger, pn_link_t *link )
       assert( messenger->draining > 0 );
       messenger->draining--;
     }
-    pn_list_remove(messenger->credited, link);
-    pn_list_remove(messenger->blocked, link);
+    pni_link_dequeue(ctx);
     pn_link_set_context( link, NULL );
-    free( ctx );
+    pni_free(PN_ALLOC_MESSENGER, ctx);
+  } else {
+    pn_link_ctx_t *ctx = (pn_link_ctx_t *) pn_link_get_context( link );
+    if (!ctx) return;
+    pn_connection_ctx_t *cctx = (pn_connection_ctx_t *)
+      pn_connection_get_context(pn_session_connection(pn_link_session(link)));
+    if (cctx && ctx->named) {
+      LL_REMOVE(cctx, named, ctx);
+      cctx->named--;
+    }
+    if (cctx && cctx->relay == link) {
+      // a peer that closes the relay does not want it used again
+      cctx->relay = NULL;
+      cctx->relays = -1;
+    }
+    pn_link_set_context( link, NULL );
+    pn_free(ctx->held);
+    pni_free(PN_ALLOC_MESSENGER, ctx);
+  }
+}
+
+// leave the messages for address queued until the sender has credit,
+// unless it already waits for another address that still has some
+static bool pni_link_hold(pn_messenger_t *messenger, pn_link_t *sender, const char *address)
+{
+  pn_link_ctx_t *ctx = pni_link_ctx(sender);
+  // the relay carries many addresses, what it is given goes out at once
+  if (!ctx || ctx->relay) return false;
+  if (!ctx->held) {
+    ctx->held = pn_string(address);
+  } else if (!pn_streq(pn_string_get(ctx->held), address)) {
+    if (pni_store_get(messenger->outgoing, pn_string_get(ctx->held))) return false;
+    pn_string_set(ctx->held, address);
+  }
+  return true;
+}
+
+static bool pni_offers(pn_data_t *capabilities, const char *capability)
+{
+  size_t size = strlen(capability);
+  pn_data_rewind(capabilities);
+  // a single symbol or an array of them
+  if (pn_data_next(capabilities) && pn_data_type(capabilities) == PN_ARRAY) {
+    pn_data_enter(capabilities);
+  } else {
+    pn_data_rewind(capabilities);
+  }
+  while (pn_data_next(capabilities)) {
+    if (pn_data_type(capabilities) == PN_SYMBOL) {
+      pn_bytes_t symbol = pn_data_get_symbol(capabilities);
+      if (symbol.size == size && !memcmp(symbol.start, capability, size)) return true;
+    }
+  }
+  return false;
+}
+
+static bool pni_connection_relays(pn_connection_ctx_t *ctx)
+{
+  if (!ctx->relays && (pn_connection_state(ctx->connection) & PN_REMOTE_ACTIVE)) {
+    pn_data_t *offered = pn_connection_remote_offered_capabilities(ctx->connection);
+    ctx->relays = pni_offers(offered, PNI_ANONYMOUS_RELAY) ? 1 : -1;
+  }
+  return ctx->relays > 0;
+}
+
+// An address is hot once it has been sent through the relay PNI_HOT
+// times without another address taking its slot in between. A slot
+// holds the address's hash above the low four bits and the count in them.
+static bool pni_address_hot(pn_connection_ctx_t *ctx, const char *name)
+{
+  uint32_t hash = 2166136261u;
+  for (const char *c = name; *c; c++) {
+    hash = (hash ^ (unsigned char) *c) * 16777619u;
+  }
+  uint32_t tag = (hash & ~(uint32_t) 0xf) | 0x10;
+  uint32_t *slot = &ctx->recent[hash % PNI_RECENT];
+  uint32_t count = (*slot & ~(uint32_t) 0xf) == tag ? (*slot & 0xf) + 1 : 1;
+  if (count >= PNI_HOT) {
+    *slot = 0;
+    return true;
+  }
+  *slot = tag | count;
+  return false;
+}
+
+static void pni_named_touch(pn_connection_ctx_t *cctx, pn_link_ctx_t *ctx)
+{
+  if (ctx && ctx->named && ctx != cctx->named_tail) {
+    LL_REMOVE(cctx, named, ctx);
+    LL_ADD(cctx, named, ctx);
+  }
+}
+
+static void pni_named_add(pn_connection_ctx_t *cctx, pn_link_ctx_t *ctx)
+{
+  LL_ADD(cctx, named, ctx);
+  ctx->named = true;
+  cctx->named++;
+}
+
+// with a relay to fall back on, the least recently used named senders
+// that have nothing in flight are closed to keep within PNI_NAMED_LINKS
+static void pni_named_trim(pn_messenger_t *messenger, pn_connection_ctx_t *cctx)
+{
+  if (cctx->named <= PNI_NAMED_LINKS || !pni_connection_relays(cctx)) return;
+
+  pn_link_ctx_t *lru = cctx->named_head;
+  while (lru && lru != cctx->named_tail && cctx->named > PNI_NAMED_LINKS) {
+    pn_link_ctx_t *next = lru->named_next;
+    pn_link_t *link = lru->link;
+    bool held = lru->held && pni_store_get(messenger->outgoing, pn_string_get(lru->held));
+    if (!pn_link_unsettled(link) && !pn_link_queued(link) && !held) {
+      LL_REMOVE(cctx, named, lru);
+      lru->named = false;
+      lru->evicted = true;
+      cctx->named--;
+      pn_link_close(link);
+    }
+    lru = next;
   }
 }
 
 static void pni_interruptor_readable(pn_selectable_t *sel)
 {
   pn_messenger_t *messenger = (pn_messenger_t *) pni_selectable_get_context(sel);
-  char buf[1024];
-  pn_read(messenger->io, pn_selectable_get_fd(sel), buf, 1024);
+  pni_wakeup_read(messenger->io, &messenger->ctrl);
+  pni_wakeup_clear(&messenger->ctrl);
   messenger->interrupted = true;
 }
 
@@ -561,7 +881,7 @@ static void pni_interruptor_finalize(pn_selectable_t *sel)
 
 pn_messenger_t *pn_messenger(const char *name)
 {
-  pn_messenger_t *m = (pn_messenger_t *) malloc(sizeof(pn_messenger_t));
+  pn_messenger_t *m = (pn_messenger_t *) pni_malloc(PN_ALLOC_MESSENGER, sizeof(pn_messenger_t));
 
   if (m) {
     m->name = build_name(name);
@@ -581,15 +901,15 @@ pn_messenger_t *pn_messenger(const char *name)
     pn_selectable_on_finalize(m->interruptor, pni_interruptor_finalize);
     pn_list_add(m->pending, m->interruptor);
     m->interrupted = false;
-    // Explicitly initialise pipe file descriptors to invalid values in case pipe
-    // fails, if we don't do this m->ctrl[0] could default to 0 - which is stdin.
-    m->ctrl[0] = -1;
-    m->ctrl[1] = -1;
-    pn_pipe(m->io, m->ctrl);
-    pn_selectable_set_fd(m->interruptor, m->ctrl[0]);
+    // if this fails the fds are left invalid rather than defaulting to
+    // 0, which is stdin
+    pni_wakeup_init(m->io, &m->ctrl);
+    pn_selectable_set_fd(m->interruptor, pni_wakeup_fd(&m->ctrl));
     pni_selectable_set_context(m->interruptor, m);
     m->listeners = pn_list(PN_WEAKREF, 0);
     m->connections = pn_list(PN_WEAKREF, 0);
+    m->connection_index = pn_map(PN_OBJECT, PN_VOID, 0, 0.75);
+    m->connection_key = pn_string(NULL);
     m->selector = pn_io_selector(m->io);
     m->collector = pn_collector();
     m->credit_mode = LINK_CREDIT_EXPLICIT;
@@ -598,9 +918,13 @@ pn_messenger_t *pn_messenger(const char *name)
     m->distributed = 0;
     m->receivers = 0;
     m->draining = 0;
-    m->credited = pn_list(PN_WEAKREF, 0);
-    m->blocked = pn_list(PN_WEAKREF, 0);
+    memset(&m->credited, 0, sizeof(pni_link_queue_t));
+    memset(&m->blocked, 0, sizeof(pni_link_queue_t));
+    memset(&m->idle, 0, sizeof(pni_link_queue_t));
     m->next_drain = 0;
+    m->ticks = NULL;
+    m->tick_count = 0;
+    m->tick_capacity = 0;
     m->next_tag = 0;
     m->outgoing = pni_store();
     m->incoming = pni_store();
@@ -612,20 +936,60 @@ pn_messenger_t *pn_messenger(const char *name)
     m->outgoing_tracker = 0;
     m->incoming_tracker = 0;
     m->address.text = pn_string(NULL);
+    m->address.source = pn_string(NULL);
+    m->address.parsed = false;
     m->original = pn_string(NULL);
     m->rewritten = pn_string(NULL);
+    m->routed = pn_string(NULL);
     m->domain = pn_string(NULL);
     m->connection_error = 0;
     m->flags = 0;
+    pni_messenger_mark(m);
     m->snd_settle_mode = PN_SND_SETTLED;
     m->rcv_settle_mode = PN_RCV_FIRST;
     m->tracer = NULL;
     m->ssl_peer_authentication_mode = PN_SSL_VERIFY_PEER_NAME;
+    m->threads = 1;
+    m->prefetch = 0;
+    m->shards = NULL;
+    m->owner = NULL;
+    m->journal = NULL;
+    m->shard = 0;
+    memset(&m->reclaimed, 0, sizeof(m->reclaimed));
   }
 
   return m;
 }
 
+pn_messenger_t *pni_messenger_shard(pn_messenger_t *messenger, pni_shards_t *owner, int index)
+{
+  pn_messenger_t *shard = pn_messenger(messenger->name);
+  if (!shard) return NULL;
+  pn_messenger_set_certificate(shard, messenger->certificate);
+  pn_messenger_set_private_key(shard, messenger->private_key);
+  pn_messenger_set_password(shard, messenger->password);
+  pn_messenger_set_trusted_certificates(shard, messenger->trusted_certificates);
+  pn_io_set_socket_options(shard->io, pn_io_get_socket_options(messenger->io));
+  pni_store_set_window(shard->outgoing, pni_store_get_window(messenger->outgoing));
+  pni_store_set_window(shard->incoming, pni_store_get_window(messenger->incoming));
+  pn_transform_copy(shard->routes, messenger->routes);
+  shard->timeout = messenger->timeout;
+  shard->blocking = false;
+  shard->flags = messenger->flags;
+  shard->snd_settle_mode = messenger->snd_settle_mode;
+  shard->rcv_settle_mode = messenger->rcv_settle_mode;
+  shard->tracer = messenger->tracer;
+  shard->ssl_peer_authentication_mode = messenger->ssl_peer_authentication_mode;
+  shard->owner = owner;
+  shard->shard = index;
+  return shard;
+}
+
+bool pni_messenger_is_shard(pn_messenger_t *messenger)
+{
+  return messenger->owner != NULL;
+}
+
 int pni_messenger_add_subscription(pn_messenger_t *messenger, pn_subscription_t *subscription)
 {
   return pn_list_add(messenger->subscriptions, subscription);
@@ -639,7 +1003,7 @@ const char *pn_messenger_name(pn_messenger_t *messenger)
 
 int pn_messenger_set_certificate(pn_messenger_t *messenger, const char *certificate)
 {
-  if (messenger->certificate) free(messenger->certificate);
+  if (messenger->certificate) pni_free(PN_ALLOC_MESSENGER, messenger->certificate);
   messenger->certificate = pn_strdup(certificate);
   return 0;
 }
@@ -651,7 +1015,7 @@ const char *pn_messenger_get_certificate(pn_messenger_t *messenger)
 
 int pn_messenger_set_private_key(pn_messenger_t *messenger, const char *private_key)
 {
-  if (messenger->private_key) free(messenger->private_key);
+  if (messenger->private_key) pni_free(PN_ALLOC_MESSENGER, messenger->private_key);
   messenger->private_key = pn_strdup(private_key);
   return 0;
 }
@@ -663,7 +1027,7 @@ const char *pn_messenger_get_private_key(pn_messenger_t *messenger)
 
 int pn_messenger_set_password(pn_messenger_t *messenger, const char *password)
 {
-  if (messenger->password) free(messenger->password);
+  if (messenger->password) pni_free(PN_ALLOC_MESSENGER, messenger->password);
   messenger->password = pn_strdup(password);
   return 0;
 }
@@ -675,7 +1039,8 @@ const char *pn_messenger_get_password(pn_messenger_t *messenger)
 
 int pn_messenger_set_trusted_certificates(pn_messenger_t *messenger, const char *trusted_certificates)
 {
-  if (messenger->trusted_certificates) free(messenger->trusted_certificates);
+  if (messenger->trusted_certificates)
+    pni_free(PN_ALLOC_MESSENGER, messenger->trusted_certificates);
   messenger->trusted_certificates = pn_strdup(trusted_certificates);
   return 0;
 }
@@ -709,6 +1074,13 @@ int pn_messenger_set_blocking(pn_messenger_t *messenger, bool blocking)
   return 0;
 }
 
+int pn_messenger_set_socket_options(pn_messenger_t *messenger, pn_socket_options_t *options)
+{
+  assert(messenger);
+  pn_io_set_socket_options(messenger->io, options);
+  return 0;
+}
+
 bool pn_messenger_is_passive(pn_messenger_t *messenger)
 {
   assert(messenger);
@@ -721,9 +1093,53 @@ int pn_messenger_set_passive(pn_messenger_t *messenger, bool passive)
   return 0;
 }
 
+int pn_messenger_set_threads(pn_messenger_t *messenger, int threads)
+{
+  if (!messenger || threads < 1) return PN_ARG_ERR;
+  if (messenger->shards) {
+    return pn_error_format(messenger->error, PN_STATE_ERR,
+                           "threads must be set before the messenger is started");
+  }
+  messenger->threads = threads;
+  return 0;
+}
+
+int pn_messenger_get_threads(pn_messenger_t *messenger)
+{
+  assert(messenger);
+  return messenger->threads;
+}
+
+int pn_messenger_set_prefetch(pn_messenger_t *messenger, int prefetch)
+{
+  if (!messenger || prefetch < 0) return PN_ARG_ERR;
+  if (messenger->shards) {
+    return pn_error_format(messenger->error, PN_STATE_ERR,
+                           "prefetch must be set before the messenger is started");
+  }
+  messenger->prefetch = prefetch;
+  return 0;
+}
+
+int pn_messenger_get_prefetch(pn_messenger_t *messenger)
+{
+  assert(messenger);
+  return messenger->prefetch;
+}
+
+// the timeout of pn_messenger_sync(), and its result for the result of
+// waiting that long
+#define pni_sync_timeout(messenger) ((messenger)->blocking ? (messenger)->timeout : 0)
+
+static int pni_synced(pn_messenger_t *messenger, int err)
+{
+  return (!messenger->blocking && err == PN_TIMEOUT) ? PN_INPROGRESS : err;
+}
+
 pn_selectable_t *pn_messenger_selectable(pn_messenger_t *messenger)
 {
   assert(messenger);
+  if (messenger->shards) return NULL;
   pn_messenger_process_events(messenger);
   pn_list_t *p = messenger->pending;
   size_t n = pn_list_size(p);
@@ -760,34 +1176,42 @@ static void pni_reclaim(pn_messenger_t *messenger)
 void pn_messenger_free(pn_messenger_t *messenger)
 {
   if (messenger) {
+    pni_shards_free(messenger->shards);
     pn_free(messenger->domain);
+    pn_free(messenger->routed);
     pn_free(messenger->rewritten);
     pn_free(messenger->original);
     pn_free(messenger->address.text);
-    free(messenger->name);
-    free(messenger->certificate);
-    free(messenger->private_key);
-    free(messenger->password);
-    free(messenger->trusted_certificates);
+    pn_free(messenger->address.source);
+    pni_free(PN_ALLOC_MESSENGER, messenger->name);
+    pni_free(PN_ALLOC_MESSENGER, messenger->certificate);
+    pni_free(PN_ALLOC_MESSENGER, messenger->private_key);
+    pni_free(PN_ALLOC_MESSENGER, messenger->password);
+    pni_free(PN_ALLOC_MESSENGER, messenger->trusted_certificates);
+    // events still queued hold references to the transports of
+    // connections that did not stop, drop them before the transports
+    // are freed
+    pn_collector_release(messenger->collector);
     pni_reclaim(messenger);
     pn_free(messenger->pending);
     pn_selectable_free(messenger->interruptor);
-    pn_close(messenger->io, messenger->ctrl[0]);
-    pn_close(messenger->io, messenger->ctrl[1]);
+    pni_wakeup_fini(messenger->io, &messenger->ctrl);
     pn_free(messenger->listeners);
     pn_free(messenger->connections);
+    pn_free(messenger->connection_index);
+    pni_free(PN_ALLOC_MESSENGER, messenger->ticks);
+    pn_free(messenger->connection_key);
     pn_selector_free(messenger->selector);
     pn_collector_free(messenger->collector);
     pn_error_free(messenger->error);
     pni_store_free(messenger->incoming);
     pni_store_free(messenger->outgoing);
+    pni_journal_free(messenger->journal);
     pn_free(messenger->subscriptions);
     pn_free(messenger->rewrites);
     pn_free(messenger->routes);
-    pn_free(messenger->credited);
-    pn_free(messenger->blocked);
     pn_free(messenger->io);
-    free(messenger);
+    pni_free(PN_ALLOC_MESSENGER, messenger);
   }
 }
 
@@ -827,44 +1251,46 @@ bool pn_messenger_flow(pn_messenger_t *messenger)
     return false;
   }
 
+  // links that ran out of the credit they were given are served
+  // first and in full, links that were drained because they did not
+  // use theirs only get enough to show they are receiving again
   const int batch = per_link_credit(messenger);
-  while (messenger->credit > 0 && pn_list_size(messenger->blocked)) {
-    pn_link_t *link = (pn_link_t *) pn_list_get(messenger->blocked, 0);
-    pn_list_del(messenger->blocked, 0, 1);
+  while (messenger->credit > 0 && (messenger->blocked.size || messenger->idle.size)) {
+    bool idle = !messenger->blocked.size;
+    pn_link_ctx_t *ctx = idle ? messenger->idle.queue_head : messenger->blocked.queue_head;
+    pni_link_dequeue(ctx);
 
-    const int more = pn_min( messenger->credit, batch );
+    const int more = idle ? 1 : pn_min( messenger->credit, batch );
     messenger->distributed += more;
     messenger->credit -= more;
-    pn_link_flow(link, more);
-    pn_list_add(messenger->credited, link);
+    pn_link_flow(ctx->link, more);
+    pni_link_enqueue(&messenger->credited, ctx);
     updated = true;
   }
 
-  if (!pn_list_size(messenger->blocked)) {
+  if (!messenger->blocked.size && !messenger->idle.size) {
     messenger->next_drain = 0;
   } else {
     // not enough credit for all links
     if (!messenger->draining) {
       pn_logf("%s: let's drain", messenger->name);
       if (messenger->next_drain == 0) {
-        messenger->next_drain = pn_i_now() + 250;
+        messenger->next_drain = messenger->now + 250;
         pn_logf("%s: initializing next_drain", messenger->name);
-      } else if (messenger->next_drain <= pn_i_now()) {
-        // initiate drain, free up at most enough to satisfy blocked
+      } else if (messenger->next_drain <= messenger->now) {
+        // initiate drain, free up at most enough to satisfy blocked,
+        // starting with the links that have gone longest without a
+        // message
         messenger->next_drain = 0;
-        int needed = pn_list_size(messenger->blocked) * batch;
-        for (size_t i = 0; i < pn_list_size(messenger->credited); i++) {
-          pn_link_t *link = (pn_link_t *) pn_list_get(messenger->credited, i);
-          if (!pn_link_get_drain(link)) {
-            pn_link_set_drain(link, true);
-            needed -= pn_link_remote_credit(link);
+        int needed = messenger->blocked.size * batch + messenger->idle.size;
+        for (pn_link_ctx_t *ctx = messenger->credited.queue_head; ctx && needed > 0;
+             ctx = ctx->queue_next) {
+          if (!pn_link_get_drain(ctx->link)) {
+            pn_link_set_drain(ctx->link, true);
+            needed -= pn_link_remote_credit(ctx->link);
             messenger->draining++;
             updated = true;
           }
-
-          if (needed <= 0) {
-            break;
-          }
         }
       } else {
         pn_logf("%s: delaying", messenger->name);
@@ -881,7 +1307,7 @@ static int pn_transport_config(pn_messenger_t *messenger,
   pn_transport_t *transport = pn_connection_transport(connection);
   if (messenger->tracer)
     pn_transport_set_tracer(transport, messenger->tracer);
-  if (ctx->scheme && !strcmp(ctx->scheme, "amqps")) {
+  if (pni_secure_scheme(ctx->scheme)) {
     pn_ssl_domain_t *d = pn_ssl_domain(PN_SSL_MODE_CLIENT);
     if (messenger->certificate && messenger->private_key) {
       int err = pn_ssl_domain_set_credentials( d, messenger->certificate,
@@ -952,13 +1378,16 @@ static void pn_condition_report(const char *pfx, pn_condition_t *condition)
 int pni_pump_in(pn_messenger_t *messenger, const char *address, pn_link_t *receiver)
 {
   pn_delivery_t *d = pn_link_current(receiver);
-  if (!pn_delivery_readable(d) && !pn_delivery_partial(d)) {
+  // a message spanning frames stays with the delivery until its last
+  // frame, so only whole messages are queued
+  if (!pn_delivery_readable(d) || pn_delivery_partial(d)) {
     return 0;
   }
 
-  pni_entry_t *entry = pni_store_put(messenger->incoming, address);
+  pni_entry_t *entry = pni_store_put(messenger->incoming, address, PN_DEFAULT_PRIORITY);
   pn_buffer_t *buf = pni_entry_bytes(entry);
   pni_entry_set_delivery(entry, d);
+  pni_entry_set_format(entry, pn_delivery_message_format(d));
 
   pn_link_ctx_t *ctx = (pn_link_ctx_t *) pn_link_get_context( receiver );
   pni_entry_set_context(entry, ctx ? ctx->subscription : NULL);
@@ -985,7 +1414,7 @@ int pni_pump_in(pn_messenger_t *messenger, const char *address, pn_link_t *recei
     messenger->distributed--;
 
     // replenish if low (< 20% maximum batch) and credit available
-    if (!pn_link_get_drain(link) && pn_list_size(messenger->blocked) == 0 &&
+    if (!pn_link_get_drain(link) && !messenger->blocked.size && !messenger->idle.size &&
         messenger->credit > 0) {
       const int max = per_link_credit(messenger);
       const int lo_thresh = (int)(max * 0.2 + 0.5);
@@ -997,16 +1426,20 @@ int pni_pump_in(pn_messenger_t *messenger, const char *address, pn_link_t *recei
         pn_link_flow(link, more);
       }
     }
-    // check if blocked
-    if (pn_list_index(messenger->blocked, link) < 0 &&
-        pn_link_remote_credit(link) == 0) {
-      pn_list_remove(messenger->credited, link);
-      if (pn_link_get_drain(link)) {
-        pn_link_set_drain(link, false);
-        assert(messenger->draining > 0);
-        messenger->draining--;
+    // check if blocked, otherwise the link is now the most recently
+    // active one
+    if (ctx->queued == &messenger->credited) {
+      pni_link_dequeue(ctx);
+      if (pn_link_remote_credit(link) == 0) {
+        if (pn_link_get_drain(link)) {
+          pn_link_set_drain(link, false);
+          assert(messenger->draining > 0);
+          messenger->draining--;
+        }
+        pni_link_enqueue(&messenger->blocked, ctx);
+      } else {
+        pni_link_enqueue(&messenger->credited, ctx);
       }
-      pn_list_add(messenger->blocked, link);
     }
   }
 
@@ -1041,6 +1474,18 @@ void pni_messenger_reclaim_link(pn_messenger_t *messenger, pn_link_t *link)
   link_ctx_release(messenger, link);
 }
 
+static void pni_connection_unindex(pn_messenger_t *messenger, pn_connection_t *conn)
+{
+  pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
+  if (!ctx) return;
+  if (ctx->key && pn_map_get(messenger->connection_index, ctx->key) == conn) {
+    pn_map_del(messenger->connection_index, ctx->key);
+  }
+  if (ctx->alias && pn_map_get(messenger->connection_index, ctx->alias) == conn) {
+    pn_map_del(messenger->connection_index, ctx->alias);
+  }
+}
+
 void pni_messenger_reclaim(pn_messenger_t *messenger, pn_connection_t *conn)
 {
   if (!conn) return;
@@ -1052,8 +1497,19 @@ void pni_messenger_reclaim(pn_messenger_t *messenger, pn_connection_t *conn)
   }
 
   pn_list_remove(messenger->connections, conn);
+  pni_connection_unindex(messenger, conn);
+  pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
+  if (messenger->owner && ctx && ctx->listener) {
+    pni_shards_unalias(messenger->owner, pn_connection_remote_container(conn), messenger->shard);
+  }
   pn_connection_ctx_free(conn);
-  pn_transport_free(pn_connection_transport(conn));
+  pn_transport_t *transport = pn_connection_transport(conn);
+  if (transport) {
+    pn_transport_metrics_t metrics;
+    pn_transport_metrics(transport, &metrics);
+    pn_transport_metrics_add(&messenger->reclaimed, &metrics);
+  }
+  pn_transport_free(transport);
   pn_connection_free(conn);
 }
 
@@ -1073,6 +1529,10 @@ pn_connection_t *pn_messenger_connection(pn_messenger_t *messenger,
 
   pn_connection_set_container(connection, messenger->name);
   pn_connection_set_hostname(connection, host);
+  // a messenger takes whatever arrives on any link, so it relays
+  pn_bytes_t relay = pn_bytes(strlen(PNI_ANONYMOUS_RELAY), PNI_ANONYMOUS_RELAY);
+  pn_data_put_symbol(pn_connection_offered_capabilities(connection), relay);
+  pn_data_put_symbol(pn_connection_desired_capabilities(connection), relay);
 
   pn_list_add(messenger->connections, connection);
 
@@ -1088,6 +1548,12 @@ void pn_messenger_process_connection(pn_messenger_t *messenger, pn_event_t *even
     pn_connection_open(conn);
   }
 
+  // replies to a peer that connected to a shard have to go through it
+  if (messenger->owner && ctx->listener &&
+      pn_event_type(event) == PN_CONNECTION_REMOTE_OPEN) {
+    pni_shards_alias(messenger->owner, pn_connection_remote_container(conn), messenger->shard);
+  }
+
   if (pn_connection_state(conn) == (PN_LOCAL_ACTIVE | PN_REMOTE_CLOSED)) {
     pn_condition_t *condition = pn_connection_remote_condition(conn);
     pn_condition_report("CONNECTION", condition);
@@ -1100,6 +1566,7 @@ void pn_messenger_process_connection(pn_messenger_t *messenger, pn_event_t *even
       pn_close(messenger->io, pn_selectable_get_fd(ctx->selectable));
       pn_socket_t sock = pn_connect(messenger->io, host, buf);
       pn_selectable_set_fd(ctx->selectable, sock);
+      pni_modified((pn_ctx_t *) ctx);
       pn_transport_unbind(pn_connection_transport(conn));
       pn_connection_reset(conn);
       pn_transport_t *t = pn_transport();
@@ -1156,6 +1623,9 @@ void pn_messenger_process_link(pn_messenger_t *messenger, pn_event_t *event)
       pn_link_close(link);
       pni_messenger_reclaim_link(messenger, link);
       pn_link_free(link);
+    } else if (pni_link_ctx(link) && pni_link_ctx(link)->evicted) {
+      pni_messenger_reclaim_link(messenger, link);
+      pn_link_free(link);
     }
   }
 }
@@ -1167,7 +1637,15 @@ void pn_messenger_process_flow(pn_messenger_t *messenger, pn_event_t *event)
   pn_link_t *link = pn_event_link(event);
 
   if (pn_link_is_sender(link)) {
-    pni_pump_out(messenger, pn_terminus_get_address(pn_link_target(link)), link);
+    // the store picks the message each unit of credit goes to
+    pn_link_ctx_t *ctx = pni_link_ctx(link);
+    if (ctx && ctx->relay) return;
+    const char *address = ctx && ctx->held ? pn_string_get(ctx->held)
+      : pn_terminus_get_address(pn_link_target(link));
+    int err;
+    do {
+      err = pni_pump_out(messenger, address, link);
+    } while (!err && pn_link_credit(link) > 0 && pni_store_get(messenger->outgoing, address));
   } else {
     // account for any credit left over after draining links has completed
     if (pn_link_get_drain(link)) {
@@ -1178,8 +1656,10 @@ void pn_messenger_process_flow(pn_messenger_t *messenger, pn_event_t *event)
         messenger->credit += drained;
         pn_link_set_drain(link, false);
         messenger->draining--;
-        pn_list_remove(messenger->credited, link);
-        pn_list_add(messenger->blocked, link);
+        pn_link_ctx_t *ctx = pni_link_ctx(link);
+        pni_link_dequeue(ctx);
+        // credit left over means the link had nothing to receive
+        pni_link_enqueue(drained ? &messenger->idle : &messenger->blocked, ctx);
       }
     }
   }
@@ -1211,6 +1691,8 @@ void pn_messenger_process_transport(pn_messenger_t *messenger, pn_event_t *event
   pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
   if (ctx) {
     pni_conn_modified(ctx);
+    // what was queued or unsettled may now be gone, leaving senders to close
+    pni_named_trim(messenger, ctx);
   }
 }
 
@@ -1286,44 +1768,44 @@ int pn_messenger_process_events(pn_messenger_t *messenger)
 
 /**
  * Function to invoke AMQP related timer events, such as a heartbeat to prevent
- * remote_idle timeout events
+ * remote_idle timeout events. Only the connections whose transports are due
+ * are ticked, each one is rescheduled for the deadline its tick returns.
  */
 static void pni_messenger_tick(pn_messenger_t *messenger)
 {
-  for (size_t i = 0; i < pn_list_size(messenger->connections); i++) {
-    pn_connection_t *connection =
-        (pn_connection_t *)pn_list_get(messenger->connections, i);
-    pn_transport_t *transport = pn_connection_transport(connection);
-    if (transport) {
-      pn_transport_tick(transport, pn_i_now());
-
-      // if there is pending data, such as an empty heartbeat frame, call
-      // process events. This should kick off the chain of selectables for
-      // reading/writing.
-      ssize_t pending = pn_transport_pending(transport);
-      if (pending > 0) {
-        pn_connection_ctx_t *cctx =
-            (pn_connection_ctx_t *)pn_connection_get_context(connection);
-        pn_messenger_process_events(messenger);
-        pn_messenger_flow(messenger);
-        pni_conn_modified(pni_context(cctx->selectable));
-      }
+  pn_timestamp_t now = messenger->now;
+  while (messenger->tick_count && messenger->ticks[0]->deadline <= now) {
+    pn_connection_ctx_t *cctx = messenger->ticks[0];
+    pni_connection_tick(cctx, now);
+
+    // if there is pending data, such as an empty heartbeat frame, call
+    // process events. This should kick off the chain of selectables for
+    // reading/writing.
+    pn_transport_t *transport = pn_connection_transport(cctx->connection);
+    if (transport && pn_transport_pending(transport) > 0) {
+      pn_messenger_process_events(messenger);
+      pn_messenger_flow(messenger);
+      pni_conn_modified(cctx);
     }
   }
 }
 
 int pn_messenger_process(pn_messenger_t *messenger)
 {
-  bool doMessengerTick = true;
   pn_selectable_t *sel;
   int events;
+  pni_messenger_mark(messenger);
+  // what was put since the last pass is on disk before any of it can
+  // go out
+  if (messenger->journal && pni_journal_commit(messenger->journal)) {
+    return pn_i_error_from_errno(messenger->error, "journal error");
+  }
   while ((sel = pn_selector_next(messenger->selector, &events))) {
     if (events & PN_READABLE) {
       pn_selectable_readable(sel);
     }
     if (events & PN_WRITABLE) {
       pn_selectable_writable(sel);
-      doMessengerTick = false;
     }
     if (events & PN_EXPIRED) {
       pn_selectable_expired(sel);
@@ -1331,9 +1813,7 @@ int pn_messenger_process(pn_messenger_t *messenger)
   }
   // ensure timer events are processed. Cannot call this inside the while loop
   // as the timer events are not seen by the selector
-  if (doMessengerTick) {
-    pni_messenger_tick(messenger);
-  }
+  pni_messenger_tick(messenger);
   if (messenger->interrupted) {
     messenger->interrupted = false;
     return PN_INTR;
@@ -1345,8 +1825,10 @@ int pn_messenger_process(pn_messenger_t *messenger)
 pn_timestamp_t pn_messenger_deadline(pn_messenger_t *messenger)
 {
   // If the scheduler detects credit imbalance on the links, wake up
-  // in time to service credit drain
-  return messenger->next_drain;
+  // in time to service credit drain, or for the first transport tick
+  if (messenger->shards) return 0;
+  pn_timestamp_t tick = messenger->tick_count ? messenger->ticks[0]->deadline : 0;
+  return pn_timestamp_min(messenger->next_drain, tick);
 }
 
 int pni_wait(pn_messenger_t *messenger, int timeout)
@@ -1383,12 +1865,12 @@ int pn_messenger_tsync(pn_messenger_t *messenger, bool (*predicate)(pn_messenger
     return pred ? 0 : PN_INPROGRESS;
   }
 
-  pn_timestamp_t now = pn_i_now();
-  long int deadline = now + timeout;
+  long int deadline = pni_messenger_mark(messenger) + timeout;
   bool pred;
 
   while (true) {
     int error = pn_messenger_process(messenger);
+    pn_timestamp_t now = messenger->now;
     pred = predicate(messenger);
     if (error == PN_INTR) {
       return pred ? 0 : PN_INTR;
@@ -1407,10 +1889,6 @@ int pn_messenger_tsync(pn_messenger_t *messenger, bool (*predicate)(pn_messenger
     }
     error = pni_wait(messenger, remaining);
     if (error) return error;
-
-    if (timeout >= 0) {
-      now = pn_i_now();
-    }
   }
 
   return pred ? 0 : PN_TIMEOUT;
@@ -1439,6 +1917,24 @@ int pn_messenger_start(pn_messenger_t *messenger)
 {
   if (!messenger) return PN_ARG_ERR;
 
+  if (messenger->threads > 1 && !messenger->shards) {
+    if (messenger->passive) {
+      return pn_error_format(messenger->error, PN_STATE_ERR,
+                             "a passive messenger cannot use threads");
+    }
+    if (messenger->journal) {
+      return pn_error_format(messenger->error, PN_STATE_ERR,
+                             "a journaled messenger cannot use threads");
+    }
+    // the shards make the connections, so routes are only checked
+    // once they are used
+    messenger->shards = pni_shards(messenger, messenger->threads);
+    if (!messenger->shards) {
+      return pn_error_format(messenger->error, PN_ERR, "unable to start threads");
+    }
+    return 0;
+  }
+
   int error = 0;
 
   // When checking of routes is required we attempt to resolve each route
@@ -1513,6 +2009,7 @@ int pn_messenger_start(pn_messenger_t *messenger)
 
 bool pn_messenger_stopped(pn_messenger_t *messenger)
 {
+  if (messenger->shards) return pni_shards_stopped(messenger->shards);
   return pn_list_size(messenger->connections) == 0 && pn_list_size(messenger->listeners) == 0;
 }
 
@@ -1520,6 +2017,11 @@ int pn_messenger_stop(pn_messenger_t *messenger)
 {
   if (!messenger) return PN_ARG_ERR;
 
+  if (messenger->shards) {
+    int err = pni_shards_stop(messenger->shards, pni_sync_timeout(messenger));
+    return pni_synced(messenger, err);
+  }
+
   for (size_t i = 0; i < pn_list_size(messenger->connections); i++) {
     pn_connection_t *conn = (pn_connection_t *) pn_list_get(messenger->connections, i);
     pn_link_t *link = pn_link_head(conn, PN_LOCAL_ACTIVE);
@@ -1559,13 +2061,78 @@ static void pni_parse(pn_address_t *address)
 static int pni_route(pn_messenger_t *messenger, const char *address)
 {
   pn_address_t *addr = &messenger->address;
-  int err = pn_transform_apply(messenger->routes, address, addr->text);
+  int err = pn_transform_apply(messenger->routes, address, messenger->routed);
   if (err) return pn_error_format(messenger->error, PN_ERR,
                                   "transformation error");
+  const char *routed = pn_string_get(messenger->routed);
+  if (addr->parsed && pn_streq(routed, pn_string_get(addr->source))) {
+    return 0;
+  }
+  pn_string_set(addr->text, routed);
+  pn_string_set(addr->source, routed);
   pni_parse(addr);
+  addr->parsed = true;
   return 0;
 }
 
+// the fields of an address a connection was made for, NULL fields are
+// told apart from empty ones; the separators keep keys apart from the
+// remote container names also held by the index
+static void pni_connection_key(pn_string_t *key, const char *scheme, const char *user,
+                               const char *pass, const char *host, const char *port)
+{
+  const char *fields[] = {scheme, user, pass, host, port};
+  pn_string_set(key, "");
+  for (size_t i = 0; i < sizeof(fields)/sizeof(fields[0]); i++) {
+    if (fields[i]) {
+      pn_string_addf(key, "+%s\x1f", fields[i]);
+    } else {
+      pn_string_addf(key, "-\x1f");
+    }
+  }
+}
+
+// the name a peer that connected to us is known by
+static void pni_connection_domain(pn_string_t *domain, const char *user,
+                                  const char *host, const char *port)
+{
+  pn_string_set(domain, "");
+
+  if (user) {
+    pn_string_addf(domain, "%s@", user);
+  }
+  pn_string_addf(domain, "%s", host);
+  if (port) {
+    pn_string_addf(domain, ":%s", port);
+  }
+}
+
+// the shard of the connection address resolves to
+static int pni_messenger_shard_of(pn_messenger_t *messenger, const char *address)
+{
+  int err = pni_route(messenger, address);
+  if (err) return err;
+  pn_address_t *addr = &messenger->address;
+  pni_connection_key(messenger->connection_key, addr->scheme, addr->user, addr->pass,
+                     addr->host, addr->port);
+  pni_connection_domain(messenger->domain, addr->user, addr->host, addr->port);
+  return pni_shards_pick(messenger->shards, messenger->connection_key, messenger->domain);
+}
+
+static void pni_connection_alias(pn_messenger_t *messenger, pn_connection_t *conn,
+                                 const char *container)
+{
+  pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
+  if (ctx->alias) {
+    if (pn_map_get(messenger->connection_index, ctx->alias) == conn) {
+      pn_map_del(messenger->connection_index, ctx->alias);
+    }
+    pn_free(ctx->alias);
+  }
+  ctx->alias = pn_string(container);
+  pn_map_put(messenger->connection_index, ctx->alias, conn);
+}
+
 pn_connection_t *pn_messenger_resolve(pn_messenger_t *messenger, const char *address, char **name)
 {
   assert(messenger);
@@ -1595,31 +2162,31 @@ pn_connection_t *pn_messenger_resolve(pn_messenger_t *messenger, const char *add
     return NULL;
   }
 
-  pn_string_set(domain, "");
+  pni_connection_domain(domain, user, host, port);
 
-  if (user) {
-    pn_string_addf(domain, "%s@", user);
-  }
-  pn_string_addf(domain, "%s", host);
-  if (port) {
-    pn_string_addf(domain, ":%s", port);
-  }
+  pn_string_t *key = messenger->connection_key;
+  pni_connection_key(key, scheme, user, pass, host, port);
+  pn_connection_t *indexed =
+    (pn_connection_t *) pn_map_get(messenger->connection_index, key);
+  if (indexed) return indexed;
 
+  // a peer that connected to us under the name we are after
+  indexed = (pn_connection_t *) pn_map_get(messenger->connection_index, domain);
+  if (indexed && pn_streq(pn_connection_remote_container(indexed), pn_string_get(domain))) {
+    return indexed;
+  }
   for (size_t i = 0; i < pn_list_size(messenger->connections); i++) {
     pn_connection_t *connection = (pn_connection_t *) pn_list_get(messenger->connections, i);
-    pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(connection);
-    if (pn_streq(scheme, ctx->scheme) && pn_streq(user, ctx->user) &&
-        pn_streq(pass, ctx->pass) && pn_streq(host, ctx->host) &&
-        pn_streq(port, ctx->port)) {
-      return connection;
-    }
     const char *container = pn_connection_remote_container(connection);
     if (pn_streq(container, pn_string_get(domain))) {
+      pni_connection_alias(messenger, connection, container);
       return connection;
     }
   }
 
-  pn_socket_t sock = pn_connect(messenger->io, host, port ? port : default_port(scheme));
+  pn_socket_t sock = pni_unix_scheme(scheme)
+    ? pn_connect_unix(messenger->io, host)
+    : pn_connect(messenger->io, host, port ? port : default_port(scheme));
   if (sock == PN_INVALID_SOCKET) {
     pn_error_copy(messenger->error, pn_io_error(messenger->io));
     pn_error_format(messenger->error, PN_ERR, "CONNECTION ERROR (%s:%s): %s\n",
@@ -1634,6 +2201,8 @@ pn_connection_t *pn_messenger_resolve(pn_messenger_t *messenger, const char *add
   pn_transport_bind(transport, connection);
   pn_decref(transport);
   pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(connection);
+  ctx->key = pn_string(pn_string_get(key));
+  pn_map_put(messenger->connection_index, ctx->key, connection);
   pn_selectable_t *sel = ctx->selectable;
   err = pn_transport_config(messenger, connection);
   if (err) {
@@ -1650,13 +2219,15 @@ pn_connection_t *pn_messenger_resolve(pn_messenger_t *messenger, const char *add
 PN_EXTERN pn_link_t *pn_messenger_get_link(pn_messenger_t *messenger,
                                            const char *address, bool sender)
 {
+  if (messenger->shards) return NULL;
   char *name = NULL;
   pn_connection_t *connection = pn_messenger_resolve(messenger, address, &name);
   if (!connection) return NULL;
 
   pn_link_t *link = pn_link_head(connection, PN_LOCAL_ACTIVE);
   while (link) {
-    if (pn_link_is_sender(link) == sender) {
+    pn_link_ctx_t *lctx = pni_link_ctx(link);
+    if (pn_link_is_sender(link) == sender && !(lctx && lctx->relay)) {
       const char *terminus = pn_link_is_sender(link) ?
         pn_terminus_get_address(pn_link_target(link)) :
         pn_terminus_get_address(pn_link_source(link));
@@ -1678,14 +2249,22 @@ pn_link_t *pn_messenger_link(pn_messenger_t *messenger, const char *address,
   pn_connection_ctx_t *cctx =
       (pn_connection_ctx_t *)pn_connection_get_context(connection);
 
+  if (sender) pni_named_trim(messenger, cctx);
   pn_link_t *link = pn_messenger_get_link(messenger, address, sender);
-  if (link)
+  if (link) {
+    if (sender) pni_named_touch(cctx, pni_link_ctx(link));
     return link;
+  }
+
+  // once the peer is known to relay, only hot addresses get a link
+  bool relay = sender && name && !pn_streq(name, "#") && pni_connection_relays(cctx) &&
+    !pni_address_hot(cctx, name);
+  if (relay && cctx->relay) return cctx->relay;
 
   pn_session_t *ssn = pn_session(connection);
   pn_session_open(ssn);
   if (sender) {
-    link = pn_sender(ssn, "sender-xxx");
+    link = pn_sender(ssn, relay ? "relay" : "sender-xxx");
   } else {
     if (name) {
       link = pn_receiver(ssn, name);
@@ -1701,7 +2280,9 @@ pn_link_t *pn_messenger_link(pn_messenger_t *messenger, const char *address,
     pn_link_set_rcv_settle_mode(link, messenger->rcv_settle_mode);
   }
   // XXX
-  if (pn_streq(name, "#")) {
+  if (relay) {
+    // an anonymous target, each message goes where its to field says
+  } else if (pn_streq(name, "#")) {
     if (pn_link_is_sender(link)) {
       pn_terminus_set_dynamic(pn_link_target(link), true);
     } else {
@@ -1712,6 +2293,12 @@ pn_link_t *pn_messenger_link(pn_messenger_t *messenger, const char *address,
     pn_terminus_set_address(pn_link_source(link), name);
   }
   link_ctx_setup( messenger, connection, link );
+  if (relay) {
+    pni_link_ctx(link)->relay = true;
+    cctx->relay = link;
+  } else if (sender) {
+    pni_named_add(cctx, pni_link_ctx(link));
+  }
 
   if (timeout > 0) {
     pn_terminus_set_expiry_policy(pn_link_target(link), PN_EXPIRE_WITH_LINK);
@@ -1751,6 +2338,12 @@ pn_subscription_t *pn_messenger_subscribe_ttl(pn_messenger_t *messenger,
                                               const char *source,
                                               pn_seconds_t timeout)
 {
+  if (messenger->shards) {
+    int index = pni_messenger_shard_of(messenger, source);
+    if (index < 0) return NULL;
+    return pni_shards_subscribe(messenger->shards, index, source, timeout);
+  }
+
   pni_route(messenger, source);
   if (pn_error_code(messenger->error)) return NULL;
 
@@ -1782,6 +2375,7 @@ int pn_messenger_get_outgoing_window(pn_messenger_t *messenger)
 int pn_messenger_set_outgoing_window(pn_messenger_t *messenger, int window)
 {
   pni_store_set_window(messenger->outgoing, window);
+  if (messenger->shards) pni_shards_set_window(messenger->shards, true, window);
   return 0;
 }
 
@@ -1793,6 +2387,7 @@ int pn_messenger_get_incoming_window(pn_messenger_t *messenger)
 int pn_messenger_set_incoming_window(pn_messenger_t *messenger, int window)
 {
   pni_store_set_window(messenger->incoming, window);
+  if (messenger->shards) pni_shards_set_window(messenger->shards, false, window);
   return 0;
 }
 
@@ -1806,7 +2401,7 @@ static void outward_munge(pn_messenger_t *mng, pn_message_t *msg)
   if (len > 1 && address[0] == '~' && address[1] == '/') {
     unsigned needed = len + strlen(mng->name) + 9;
     if (needed > sizeof(stackbuf)) {
-      heapbuf = (char *) malloc(needed);
+      heapbuf = (char *) pni_malloc(PN_ALLOC_MESSENGER, needed);
       buf = heapbuf;
     }
     sprintf(buf, "amqp://%s/%s", mng->name, address + 2);
@@ -1814,7 +2409,7 @@ static void outward_munge(pn_messenger_t *mng, pn_message_t *msg)
   } else if (len == 1 && address[0] == '~') {
     unsigned needed = strlen(mng->name) + 8;
     if (needed > sizeof(stackbuf)) {
-      heapbuf = (char *) malloc(needed);
+      heapbuf = (char *) pni_malloc(PN_ALLOC_MESSENGER, needed);
       buf = heapbuf;
     }
     sprintf(buf, "amqp://%s", mng->name);
@@ -1841,10 +2436,7 @@ int pni_pump_out(pn_messenger_t *messenger, const char *address, pn_link_t *send
     return 0;
   }
 
-  pn_buffer_t *buf = pni_entry_bytes(entry);
-  pn_bytes_t bytes = pn_buffer_bytes(buf);
-  const char *encoded = bytes.start;
-  size_t size = bytes.size;
+  pn_rwbytes_t encoded = pni_entry_take_encoded(entry);
 
   // XXX: proper tag
   char tag[8];
@@ -1852,8 +2444,14 @@ int pni_pump_out(pn_messenger_t *messenger, const char *address, pn_link_t *send
   uint64_t next = messenger->next_tag++;
   *((uint64_t *) ptr) = next;
   pn_delivery_t *d = pn_delivery(sender, pn_dtag(tag, 8));
+  pn_delivery_set_message_format(d, pni_entry_get_format(entry));
   pni_entry_set_delivery(entry, d);
-  ssize_t n = pn_link_send(sender, encoded, size);
+  // the delivery takes the encoded message over rather than copying it
+  ssize_t n = pn_link_adopt(sender, encoded.start, encoded.size, free, encoded.start);
+  if (n != (ssize_t) encoded.size) {
+    n = pn_link_send(sender, encoded.start, encoded.size);
+    pni_free(PN_ALLOC_MESSENGER, encoded.start);
+  }
   if (n < 0) {
     pni_entry_free(entry);
     return pn_error_format(messenger->error, n, "send error: %s",
@@ -1868,21 +2466,21 @@ int pni_pump_out(pn_messenger_t *messenger, const char *address, pn_link_t *send
 static void pni_default_rewrite(pn_messenger_t *messenger, const char *address,
                                 pn_string_t *dst)
 {
-  pn_address_t *addr = &messenger->address;
+  // the user and password are cut out where they lie, leaving the
+  // routed address parsed for the next send
   if (address && strstr(address, "@")) {
-    int err = pn_string_set(addr->text, address);
-    if (err) assert(false);
-    pni_parse(addr);
-    if (addr->user || addr->pass)
-    {
-      pn_string_format(messenger->rewritten, "%s%s%s%s%s%s%s",
-                       addr->scheme ? addr->scheme : "",
-                       addr->scheme ? "://" : "",
-                       addr->host,
-                       addr->port ? ":" : "",
-                       addr->port ? addr->port : "",
-                       addr->name ? "/" : "",
-                       addr->name ? addr->name : "");
+    if (address != pn_string_get(dst)) pn_string_set(dst, address);
+    char *text = pn_string_buffer(dst);
+    size_t size = pn_string_size(dst);
+    pni_url_parts_t parts;
+    pni_url_split(text, size, &parts);
+    if (parts.user.start) {
+      pn_bytes_t last = parts.pass.start ? parts.pass : parts.user;
+      size_t from = parts.user.start - text;
+      size_t to = last.start + last.size + 1 - text;
+      if (text[to] == '~') to++;
+      memmove(text + from, text + to, size - to + 1);
+      pn_string_resize(dst, size - (to - from));
     }
   }
 }
@@ -1907,56 +2505,212 @@ static void pni_restore(pn_messenger_t *messenger, pn_message_t *msg)
   pn_message_set_address(msg, pn_string_get(messenger->original));
 }
 
-int pn_messenger_put(pn_messenger_t *messenger, pn_message_t *msg)
+// queue an encoded message, or a batch of them, sender and same as for
+// pni_messenger_put(), journaled is the id of a message recovered from
+// the journal or zero for a new one
+static int pni_messenger_store(pn_messenger_t *messenger, const char *address,
+                               pn_rwbytes_t encoded, uint32_t format, uint8_t priority,
+                               uint64_t journaled, pn_link_t **sender, bool same)
 {
-  if (!messenger) return PN_ARG_ERR;
-  if (!msg) return pn_error_set(messenger->error, PN_ARG_ERR, "null message");
-  outward_munge(messenger, msg);
-  const char *address = pn_message_get_address(msg);
-
-  pni_entry_t *entry = pni_store_put(messenger->outgoing, address);
-  if (!entry)
+  pni_entry_t *entry = pni_store_put(messenger->outgoing, address, priority);
+  if (!entry) {
+    pni_free(PN_ALLOC_MESSENGER, encoded.start);
     return pn_error_format(messenger->error, PN_ERR, "store error");
+  }
 
   messenger->outgoing_tracker = pn_tracker(OUTGOING, pni_entry_track(entry));
-  pn_buffer_t *buf = pni_entry_bytes(entry);
+  pni_entry_set_encoded(entry, encoded);
+  pni_entry_set_format(entry, format);
+  if (journaled) {
+    pni_entry_set_journaled(entry, journaled);
+  } else if (pni_entry_journal(entry)) {
+    pni_entry_set_status(entry, PN_STATUS_ABORTED);
+    pni_entry_free(entry);
+    return pn_i_error_from_errno(messenger->error, "journal error");
+  }
 
-  pni_rewrite(messenger, msg);
-  while (true) {
-    char *encoded = pn_buffer_memory(buf).start;
-    size_t size = pn_buffer_capacity(buf);
-    int err = pn_message_encode(msg, encoded, &size);
-    if (err == PN_OVERFLOW) {
-      err = pn_buffer_ensure(buf, 2*pn_buffer_capacity(buf));
-      if (err) {
-        pni_entry_free(entry);
-        pni_restore(messenger, msg);
-        return pn_error_format(messenger->error, err, "put: error growing buffer");
-      }
-    } else if (err) {
-      pni_restore(messenger, msg);
-      return pn_error_format(messenger->error, err, "encode error: %s",
-                             pn_message_error(msg));
+  if (!same) {
+    *sender = pn_messenger_target(messenger, address, 0);
+  }
+  if (!*sender) {
+    int err = pn_error_code(messenger->error);
+    if (err) {
+      return err;
+    } else if (messenger->connection_error) {
+      return pni_bump_out(messenger, address);
     } else {
-      pni_restore(messenger, msg);
-      pn_buffer_append(buf, encoded, size); // XXX
-      pn_link_t *sender = pn_messenger_target(messenger, address, 0);
-      if (!sender) {
-        int err = pn_error_code(messenger->error);
-        if (err) {
-          return err;
-        } else if (messenger->connection_error) {
-          return pni_bump_out(messenger, address);
+      return 0;
+    }
+  } else if (pn_link_credit(*sender) <= 0 && pni_link_hold(messenger, *sender, address)) {
+    // held back so that the store picks by priority once credit comes
+    return 0;
+  } else {
+    int err = pni_pump_out(messenger, address, *sender);
+    if (err) *sender = NULL;
+    return err;
+  }
+}
+
+int pni_messenger_put_encoded(pn_messenger_t *messenger, const char *address,
+                              pn_rwbytes_t encoded, uint8_t priority)
+{
+  pn_link_t *sender = NULL;
+  return pni_messenger_store(messenger, address, encoded, 0, priority, 0, &sender, false);
+}
+
+static void pni_messenger_recover(void *context, uint64_t id, const char *address,
+                                  uint32_t format, pn_bytes_t encoded)
+{
+  pn_messenger_t *messenger = (pn_messenger_t *) context;
+  pn_rwbytes_t copy = pn_rwbytes(encoded.size,
+                                 (char *) pni_malloc(PN_ALLOC_MESSENGER, encoded.size));
+  if (encoded.size && !copy.start) return;
+  if (encoded.size) memcpy(copy.start, encoded.start, encoded.size);
+  pn_link_t *sender = NULL;
+  // the journal does not keep the priority
+  pni_messenger_store(messenger, address, copy, format, PN_DEFAULT_PRIORITY, id, &sender, false);
+}
+
+int pn_messenger_set_journal(pn_messenger_t *messenger, const char *directory)
+{
+  if (!messenger || !directory) return PN_ARG_ERR;
+  if (messenger->journal || messenger->threads > 1 || messenger->shards) {
+    return pn_error_format(messenger->error, PN_STATE_ERR,
+                           "a journal is set once, on a messenger without threads");
+  }
+  pni_journal_t *journal = pni_journal(directory);
+  if (!journal) return pn_error_format(messenger->error, PN_ERR, "journal error");
+  messenger->journal = journal;
+  pni_store_set_journal(messenger->outgoing, journal);
+  int recovered = pni_journal_open(journal, pni_messenger_recover, messenger);
+  if (recovered < 0) {
+    pni_store_set_journal(messenger->outgoing, NULL);
+    messenger->journal = NULL;
+    pni_journal_free(journal);
+    return pn_i_error_from_errno(messenger->error, "journal error");
+  }
+  return recovered;
+}
+
+// A non NULL *sender is the link the previous message of a batch went
+// to, it and the previous rewrite are reused while the address repeats.
+static int pni_messenger_put(pn_messenger_t *messenger, pn_message_t *msg,
+                             pn_link_t **sender)
+{
+  if (!msg) return pn_error_set(messenger->error, PN_ARG_ERR, "null message");
+  outward_munge(messenger, msg);
+  const char *address = pn_message_get_address(msg);
+  bool same = *sender && pn_streq(address, pn_string_get(messenger->original));
+
+  pn_rwbytes_t encoded = pn_rwbytes(0, NULL);
+  if (same) {
+    pn_message_set_address(msg, pn_string_get(messenger->rewritten));
+  } else {
+    pni_rewrite(messenger, msg);
+  }
+  ssize_t size = pn_message_encode2(msg, &encoded);
+  pni_restore(messenger, msg);
+  if (size < 0) {
+    pni_free(PN_ALLOC_MESSENGER, encoded.start);
+    return pn_error_format(messenger->error, size, "encode error: %s",
+                           pn_message_error(msg));
+  }
+  encoded.size = size;
+
+  if (messenger->shards) {
+    int index = pni_messenger_shard_of(messenger, address);
+    if (index < 0) {
+      pni_free(PN_ALLOC_MESSENGER, encoded.start);
+      return index;
+    }
+    return pni_shards_put(messenger->shards, index, address, encoded,
+                          pn_message_get_priority(msg), &messenger->outgoing_tracker);
+  }
+
+  return pni_messenger_store(messenger, address, encoded, 0, pn_message_get_priority(msg), 0,
+                             sender, same);
+}
+
+// the most a batch of packed messages grows to before it is sent
+#define PNI_BATCH_SIZE (64*1024)
+
+// with PN_FLAGS_BATCH_MESSAGES, consecutive messages with the same
+// address are packed into one delivery
+static int pni_messenger_put_packed(pn_messenger_t *messenger, pn_message_t **msgs, size_t n)
+{
+  pn_link_t *sender = NULL;
+  size_t i = 0;
+  int err = 0;
+  while (i < n && !err) {
+    size_t first = i;
+    bool same = false;
+    uint8_t priority = msgs[i] ? pn_message_get_priority(msgs[i]) : PN_DEFAULT_PRIORITY;
+    pn_rwbytes_t batch = pn_rwbytes(0, NULL);
+    size_t used = 0;
+    while (i < n && used < PNI_BATCH_SIZE) {
+      pn_message_t *msg = msgs[i];
+      if (!msg) {
+        err = pn_error_set(messenger->error, PN_ARG_ERR, "null message");
+        break;
+      }
+      outward_munge(messenger, msg);
+      const char *address = pn_message_get_address(msg);
+      if (i == first) {
+        same = sender && pn_streq(address, pn_string_get(messenger->original));
+        if (same) {
+          pn_message_set_address(msg, pn_string_get(messenger->rewritten));
         } else {
-          return 0;
+          pni_rewrite(messenger, msg);
         }
+      } else if (pn_streq(address, pn_string_get(messenger->original)) &&
+                 pn_message_get_priority(msg) == priority) {
+        pn_message_set_address(msg, pn_string_get(messenger->rewritten));
       } else {
-        return pni_pump_out(messenger, address, sender);
+        break;
+      }
+      ssize_t end = pn_message_encode_batch(msg, &batch, used);
+      pni_restore(messenger, msg);
+      if (end < 0) {
+        err = pn_error_format(messenger->error, end, "encode error: %s",
+                              pn_message_error(msg));
+        break;
       }
+      used = end;
+      i++;
+    }
+
+    if (i > first) {
+      int serr = pni_messenger_store(messenger, pn_string_get(messenger->original),
+                                     pn_rwbytes(used, batch.start), PN_MESSAGE_FORMAT_BATCH,
+                                     priority, 0, &sender, same);
+      if (!err) err = serr;
+    } else {
+      pni_free(PN_ALLOC_MESSENGER, batch.start);
     }
   }
+  return err ? (i ? (int) i : err) : (int) n;
+}
 
-  return PN_ERR;
+int pn_messenger_put(pn_messenger_t *messenger, pn_message_t *msg)
+{
+  if (!messenger) return PN_ARG_ERR;
+  pn_link_t *sender = NULL;
+  return pni_messenger_put(messenger, msg, &sender);
+}
+
+int pn_messenger_put_batch(pn_messenger_t *messenger, pn_message_t **msgs, size_t n)
+{
+  if (!messenger) return PN_ARG_ERR;
+  if (!msgs && n) return pn_error_set(messenger->error, PN_ARG_ERR, "null messages");
+  if ((messenger->flags & PN_FLAGS_BATCH_MESSAGES) && !messenger->shards) {
+    return pni_messenger_put_packed(messenger, msgs, n);
+  }
+  pn_link_t *sender = NULL;
+  for (size_t i = 0; i < n; i++) {
+    int err = pni_messenger_put(messenger, msgs[i], &sender);
+    if (err) return i ? (int) i : err;
+  }
+  return (int) n;
 }
 
 pn_tracker_t pn_messenger_outgoing_tracker(pn_messenger_t *messenger)
@@ -1976,6 +2730,7 @@ pni_store_t *pn_tracker_store(pn_messenger_t *messenger, pn_tracker_t tracker)
 
 pn_status_t pn_messenger_status(pn_messenger_t *messenger, pn_tracker_t tracker)
 {
+  if (messenger->shards) return pni_shards_status(messenger->shards, tracker);
   pni_store_t *store = pn_tracker_store(messenger, tracker);
   pni_entry_t *e = pni_store_entry(store, pn_tracker_sequence(tracker));
   if (e) {
@@ -1988,6 +2743,7 @@ pn_status_t pn_messenger_status(pn_messenger_t *messenger, pn_tracker_t tracker)
 pn_delivery_t *pn_messenger_delivery(pn_messenger_t *messenger,
                                      pn_tracker_t tracker)
 {
+  if (messenger->shards) return NULL;
   pni_store_t *store = pn_tracker_store(messenger, tracker);
   pni_entry_t *e = pni_store_entry(store, pn_tracker_sequence(tracker));
   if (e) {
@@ -1999,6 +2755,7 @@ pn_delivery_t *pn_messenger_delivery(pn_messenger_t *messenger,
 
 bool pn_messenger_buffered(pn_messenger_t *messenger, pn_tracker_t tracker)
 {
+  if (messenger->shards) return pni_shards_buffered(messenger->shards, tracker);
   pni_store_t *store = pn_tracker_store(messenger, tracker);
   pni_entry_t *e = pni_store_entry(store, pn_tracker_sequence(tracker));
   if (e) {
@@ -2016,12 +2773,12 @@ bool pn_messenger_buffered(pn_messenger_t *messenger, pn_tracker_t tracker)
 
 int pn_messenger_settle(pn_messenger_t *messenger, pn_tracker_t tracker, int flags)
 {
+  if (messenger->shards) return pni_shards_settle(messenger->shards, tracker, flags);
   pni_store_t *store = pn_tracker_store(messenger, tracker);
   return pni_store_update(store, pn_tracker_sequence(tracker), PN_STATUS_UNKNOWN, flags, true, true);
 }
 
-// true if all pending output has been sent to peer
-bool pn_messenger_sent(pn_messenger_t *messenger)
+int pni_messenger_unsent(pn_messenger_t *messenger, bool *quiesced)
 {
   int total = pni_store_size(messenger->outgoing);
 
@@ -2032,7 +2789,7 @@ bool pn_messenger_sent(pn_messenger_t *messenger)
     pn_transport_t *transport = pn_connection_transport(conn);
     if (transport) {
       if (!pn_transport_quiesced(transport)) {
-        return false;
+        *quiesced = false;
       }
     }
 
@@ -2053,7 +2810,15 @@ bool pn_messenger_sent(pn_messenger_t *messenger)
     }
   }
 
-  return total <= messenger->send_threshold;
+  return total;
+}
+
+// true if all pending output has been sent to peer
+bool pn_messenger_sent(pn_messenger_t *messenger)
+{
+  bool quiesced = true;
+  int total = pni_messenger_unsent(messenger, &quiesced);
+  return quiesced && total <= messenger->send_threshold;
 }
 
 bool pn_messenger_rcvd(pn_messenger_t *messenger)
@@ -2086,6 +2851,7 @@ static bool work_pred(pn_messenger_t *messenger) {
 
 int pn_messenger_work(pn_messenger_t *messenger, int timeout)
 {
+  if (messenger->shards) return pni_shards_work(messenger->shards, timeout);
   messenger->worked = false;
   int err = pn_messenger_tsync(messenger, work_pred, timeout);
   if (err) {
@@ -2111,16 +2877,16 @@ int pni_messenger_work(pn_messenger_t *messenger)
 int pn_messenger_interrupt(pn_messenger_t *messenger)
 {
   assert(messenger);
-  ssize_t n = pn_write(messenger->io, messenger->ctrl[1], "x", 1);
-  if (n <= 0) {
-    return n;
-  } else {
-    return 0;
-  }
+  if (messenger->shards) return pni_shards_interrupt(messenger->shards);
+  return pni_wakeup_signal(messenger->io, &messenger->ctrl);
 }
 
 int pn_messenger_send(pn_messenger_t *messenger, int n)
 {
+  if (messenger->shards) {
+    int err = pni_shards_send(messenger->shards, n, pni_sync_timeout(messenger));
+    return pni_synced(messenger, err);
+  }
   if (n == -1) {
     messenger->send_threshold = 0;
   } else {
@@ -2131,9 +2897,25 @@ int pn_messenger_send(pn_messenger_t *messenger, int n)
   return pn_messenger_sync(messenger, pn_messenger_sent);
 }
 
+static int pni_messenger_recv_shards(pn_messenger_t *messenger, int n)
+{
+  pni_shards_t *shards = messenger->shards;
+  if (messenger->blocking && pni_shards_stopped(shards))
+    return pn_error_format(messenger->error, PN_STATE_ERR, "no valid sources");
+  int err = pni_shards_recv(shards, n, pni_sync_timeout(messenger));
+  err = pni_synced(messenger, err);
+  if (err) return err;
+  if (!pni_shards_incoming(shards) && messenger->blocking && pni_shards_stopped(shards)) {
+    return pn_error_format(messenger->error, PN_STATE_ERR, "no valid sources");
+  } else {
+    return 0;
+  }
+}
+
 int pn_messenger_recv(pn_messenger_t *messenger, int n)
 {
   if (!messenger) return PN_ARG_ERR;
+  if (messenger->shards) return pni_messenger_recv_shards(messenger, n);
   if (messenger->blocking && !pn_list_size(messenger->listeners)
       && !pn_list_size(messenger->connections))
     return pn_error_format(messenger->error, PN_STATE_ERR, "no valid sources");
@@ -2163,41 +2945,141 @@ int pn_messenger_recv(pn_messenger_t *messenger, int n)
   }
 }
 
+void pni_messenger_metrics(pn_messenger_t *messenger, pn_transport_metrics_t *total)
+{
+  pn_transport_metrics_add(total, &messenger->reclaimed);
+  size_t n = pn_list_size(messenger->connections);
+  for (size_t i = 0; i < n; i++) {
+    pn_connection_t *conn = (pn_connection_t *) pn_list_get(messenger->connections, i);
+    pn_transport_t *transport = pn_connection_transport(conn);
+    if (transport) {
+      pn_transport_metrics_t metrics;
+      pn_transport_metrics(transport, &metrics);
+      pn_transport_metrics_add(total, &metrics);
+    }
+  }
+}
+
+void pn_messenger_metrics(pn_messenger_t *messenger, pn_transport_metrics_t *metrics)
+{
+  assert(messenger);
+  memset(metrics, 0, sizeof(*metrics));
+  if (messenger->shards) {
+    pni_shards_metrics(messenger->shards, metrics);
+  } else {
+    pni_messenger_metrics(messenger, metrics);
+  }
+}
+
 int pn_messenger_receiving(pn_messenger_t *messenger)
 {
   assert(messenger);
+  if (messenger->shards) return pni_shards_receiving(messenger->shards);
   return messenger->credit + messenger->distributed;
 }
 
+// the next message of an incoming entry, the messages of a batch are
+// handed out one at a time and the entry goes with the last of them
+static int pni_incoming_next(pni_entry_t *entry, pn_bytes_t *encoded, size_t *consumed)
+{
+  pn_bytes_t bytes = pn_buffer_bytes(pni_entry_bytes(entry));
+  *consumed = bytes.size;
+  if (pni_entry_get_format(entry) != PN_MESSAGE_FORMAT_BATCH) {
+    *encoded = bytes;
+    return 0;
+  }
+  ssize_t n = pn_message_batch_next(bytes.start, bytes.size, encoded);
+  if (n < 0) return (int) n;
+  *consumed = n;
+  return 0;
+}
+
+static void pni_incoming_consume(pni_entry_t *entry, size_t consumed)
+{
+  pn_buffer_t *buf = pni_entry_bytes(entry);
+  if (consumed < pn_buffer_size(buf)) {
+    pn_buffer_trim(buf, consumed, 0);
+  } else {
+    pni_entry_free(entry);
+  }
+}
+
+int pni_messenger_take(pn_messenger_t *messenger, pn_rwbytes_t *encoded,
+                       pn_tracker_t *tracker, pn_subscription_t **subscription)
+{
+  pni_entry_t *entry = pni_store_get(messenger->incoming, NULL);
+  if (!entry) return PN_EOS;
+
+  pn_bytes_t bytes;
+  size_t consumed;
+  int err = pni_incoming_next(entry, &bytes, &consumed);
+  if (err) {
+    pni_incoming_consume(entry, consumed);
+    return pn_error_format(messenger->error, err, "error unpacking batch: %s", pn_code(err));
+  }
+  char *copy = (char *) pni_malloc(PN_ALLOC_MESSENGER, bytes.size ? bytes.size : 1);
+  if (!copy) {
+    pni_incoming_consume(entry, consumed);
+    return pn_error_format(messenger->error, PN_ERR, "allocation failed");
+  }
+  memcpy(copy, bytes.start, bytes.size);
+  *encoded = pn_rwbytes(bytes.size, copy);
+  *tracker = pn_tracker(INCOMING, pni_entry_track(entry));
+  *subscription = (pn_subscription_t *) pni_entry_get_context(entry);
+  pni_incoming_consume(entry, consumed);
+  return 0;
+}
+
+static int pni_messenger_get_shards(pn_messenger_t *messenger, pn_message_t *msg)
+{
+  int err = pni_shards_get(messenger->shards, msg, &messenger->incoming_tracker,
+                           &messenger->incoming_subscription);
+  if (err && err != PN_EOS) {
+    err = pn_error_format(messenger->error, err, "error decoding message: %s",
+                          pn_message_error(msg));
+  }
+  return err;
+}
+
 int pn_messenger_get(pn_messenger_t *messenger, pn_message_t *msg)
 {
   if (!messenger) return PN_ARG_ERR;
+  if (messenger->shards) return pni_messenger_get_shards(messenger, msg);
 
   pni_entry_t *entry = pni_store_get(messenger->incoming, NULL);
   // XXX: need to drain credit before returning EOS
   if (!entry) return PN_EOS;
 
   messenger->incoming_tracker = pn_tracker(INCOMING, pni_entry_track(entry));
-  pn_buffer_t *buf = pni_entry_bytes(entry);
-  pn_bytes_t bytes = pn_buffer_bytes(buf);
-  const char *encoded = bytes.start;
-  size_t size = bytes.size;
-
   messenger->incoming_subscription = (pn_subscription_t *) pni_entry_get_context(entry);
 
+  pn_bytes_t encoded;
+  size_t consumed;
+  int err = pni_incoming_next(entry, &encoded, &consumed);
+  if (err) {
+    pni_incoming_consume(entry, consumed);
+    return pn_error_format(messenger->error, err, "error unpacking batch: %s", pn_code(err));
+  }
   if (msg) {
-    int err = pn_message_decode(msg, encoded, size);
-    pni_entry_free(entry);
-    if (err) {
-      return pn_error_format(messenger->error, err, "error decoding message: %s",
-                             pn_message_error(msg));
-    } else {
-      return 0;
-    }
-  } else {
-    pni_entry_free(entry);
-    return 0;
+    err = pn_message_decode(msg, encoded.start, encoded.size);
   }
+  pni_incoming_consume(entry, consumed);
+  if (err) {
+    return pn_error_format(messenger->error, err, "error decoding message: %s",
+                           pn_message_error(msg));
+  }
+  return 0;
+}
+
+int pn_messenger_get_batch(pn_messenger_t *messenger, pn_message_t **msgs, size_t n)
+{
+  if (!messenger) return PN_ARG_ERR;
+  if (!msgs && n) return pn_error_set(messenger->error, PN_ARG_ERR, "null messages");
+  for (size_t i = 0; i < n; i++) {
+    int err = pn_messenger_get(messenger, msgs[i]);
+    if (err) return i ? (int) i : err;
+  }
+  return (int) n;
 }
 
 pn_tracker_t pn_messenger_incoming_tracker(pn_messenger_t *messenger)
@@ -2219,6 +3101,9 @@ int pn_messenger_accept(pn_messenger_t *messenger, pn_tracker_t tracker, int fla
                            "invalid tracker, incoming tracker required");
   }
 
+  if (messenger->shards) {
+    return pni_shards_update(messenger->shards, tracker, PN_STATUS_ACCEPTED, flags);
+  }
   return pni_store_update(messenger->incoming, pn_tracker_sequence(tracker),
                           PN_STATUS_ACCEPTED, flags, false, false);
 }
@@ -2230,6 +3115,9 @@ int pn_messenger_reject(pn_messenger_t *messenger, pn_tracker_t tracker, int fla
                            "invalid tracker, incoming tracker required");
   }
 
+  if (messenger->shards) {
+    return pni_shards_update(messenger->shards, tracker, PN_STATUS_REJECTED, flags);
+  }
   return pni_store_update(messenger->incoming, pn_tracker_sequence(tracker),
                           PN_STATUS_REJECTED, flags, false, false);
 }
@@ -2237,6 +3125,7 @@ int pn_messenger_reject(pn_messenger_t *messenger, pn_tracker_t tracker, int fla
 PN_EXTERN pn_link_t *pn_messenger_tracker_link(pn_messenger_t *messenger,
                                                pn_tracker_t tracker)
 {
+  if (messenger->shards) return NULL;
   pni_store_t *store = pn_tracker_store(messenger, tracker);
   pni_entry_t *e = pni_store_entry(store, pn_tracker_sequence(tracker));
   if (e) {
@@ -2265,6 +3154,9 @@ int pn_messenger_queued(pn_messenger_t *messenger, bool sender)
         }
       } else if (!sender) {
         result += pn_link_queued(link);
+        // a message still arriving is not yet on the incoming queue
+        pn_delivery_t *d = pn_link_current(link);
+        if (d && pn_delivery_partial(d)) result--;
       }
       link = pn_link_next(link, PN_LOCAL_ACTIVE);
     }
@@ -2275,17 +3167,20 @@ int pn_messenger_queued(pn_messenger_t *messenger, bool sender)
 
 int pn_messenger_outgoing(pn_messenger_t *messenger)
 {
+  if (messenger->shards) return pni_shards_outgoing(messenger->shards);
   return pni_store_size(messenger->outgoing) + pn_messenger_queued(messenger, true);
 }
 
 int pn_messenger_incoming(pn_messenger_t *messenger)
 {
+  if (messenger->shards) return pni_shards_incoming(messenger->shards);
   return pni_store_size(messenger->incoming) + pn_messenger_queued(messenger, false);
 }
 
 int pn_messenger_route(pn_messenger_t *messenger, const char *pattern, const char *address)
 {
   pn_transform_rule(messenger->routes, pattern, address);
+  if (messenger->shards) pni_shards_route(messenger->shards, pattern, address);
   return 0;
 }
 
@@ -2299,9 +3194,10 @@ PN_EXTERN int pn_messenger_set_flags(pn_messenger_t *messenger, const int flags)
 {
   if (!messenger)
     return PN_ARG_ERR;
-  if (flags != 0 && (flags ^ PN_FLAGS_CHECK_ROUTES) != 0)
+  if (flags & ~(PN_FLAGS_CHECK_ROUTES | PN_FLAGS_COARSE_CLOCK | PN_FLAGS_BATCH_MESSAGES))
     return PN_ARG_ERR;
   messenger->flags = flags;
+  pni_messenger_mark(messenger);
   return 0;
 }
 
@@ -26,5 +26,7 @@
 
 int pni_messenger_add_subscription(pn_messenger_t *messenger, pn_subscription_t *subscription);
 int pni_messenger_work(pn_messenger_t *messenger);
+// true for the messengers a threaded messenger drives from its threads
+bool pni_messenger_is_shard(pn_messenger_t *messenger);
 
 #endif /* messenger.h */
@@ -0,0 +1,954 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/error.h>
+#include <proton/object.h>
+
+#include <proton/message.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "shard.h"
+#include "message/message.h"
+#include "platform.h"
+#include "thread.h"
+#include "util.h"
+#include "alloc_private.h"
+
+typedef struct pni_put_t pni_put_t;
+
+// a message on its way to a shard
+struct pni_put_t {
+  pni_put_t *next;
+  char *address;
+  pn_rwbytes_t encoded;
+  uint8_t priority;
+};
+
+typedef struct pni_got_t pni_got_t;
+
+// a message a shard received, tracked by the shard
+struct pni_got_t {
+  pni_got_t *next;
+  pn_rwbytes_t encoded;   // unless decoded into message
+  pn_message_t *message;  // of the shard's prefetch, if any
+  pn_tracker_t tracker;
+  pn_subscription_t *subscription;
+  int shard;
+};
+
+typedef void (*pni_call_t)(pn_messenger_t *messenger, void *context);
+
+typedef struct {
+  pni_shards_t *shards;
+  pn_messenger_t *messenger;
+  pni_thread_t *thread;
+  void *volatile puts;
+  // gots with a prefetch message the front is done with
+  void *volatile spare;
+  // owned by the thread: spares taken off spare and the number of
+  // prefetch messages made
+  pni_got_t *pool;
+  int made;
+  pni_semaphore_t *returned;
+  pni_mutex_t *lock;
+  // set by the front, guarded by lock
+  pni_call_t call;
+  void *context;
+  int credit;
+  unsigned grant;
+  bool exit;
+  // published by the shard, guarded by lock
+  pn_error_t *error;
+  pn_sequence_t taken;
+  unsigned worked;
+  int outgoing;
+  int incoming;
+  int unsent;
+  int receiving;
+  bool quiesced;
+  bool stopped;
+  // puts handed over by the front, also the next outgoing sequence
+  // of the shard's own store
+  pn_sequence_t given;
+} pni_shard_t;
+
+typedef struct {
+  int shard;
+  pn_tracker_t tracker;
+} pni_slot_t;
+
+// the shard and shard tracker of each tracker from lwm up to hwm,
+// windowed like a store
+typedef struct {
+  pni_slot_t *slots;
+  size_t capacity;
+  int window;
+  pn_sequence_t lwm;
+  pn_sequence_t hwm;
+} pni_ring_t;
+
+struct pni_shards_t {
+  pn_messenger_t *messenger;
+  pni_shard_t *shards;
+  int count;
+  int prefetch;  // per shard
+  void *volatile got;
+  void *volatile waiting;
+  void *volatile interrupted;
+  pni_semaphore_t *progress;
+  // remote containers of connections accepted by a shard
+  pni_mutex_t *lock;
+  pn_map_t *aliases;
+  // received messages taken off got, oldest first
+  pni_got_t *head;
+  pni_got_t *tail;
+  size_t backlog;
+  pni_ring_t outgoing;
+  pni_ring_t incoming;
+};
+
+static inline pni_slot_t *pni_ring_slot(pni_ring_t *ring, pn_sequence_t id)
+{
+  return &ring->slots[(uint32_t) id & (ring->capacity - 1)];
+}
+
+static pni_slot_t *pni_ring_find(pni_ring_t *ring, pn_sequence_t id)
+{
+  bool tracking = (id - ring->lwm >= 0) && (ring->hwm - id > 0);
+  return tracking ? pni_ring_slot(ring, id) : NULL;
+}
+
+static bool pni_ring_grow(pni_ring_t *ring)
+{
+  size_t capacity = ring->capacity ? 2*ring->capacity : 16;
+  pni_slot_t *slots = (pni_slot_t *) pni_malloc(PN_ALLOC_MESSENGER, capacity * sizeof(pni_slot_t));
+  if (!slots) return false;
+  for (pn_sequence_t id = ring->lwm; ring->hwm - id > 0; id++) {
+    slots[(uint32_t) id & (capacity - 1)] = *pni_ring_slot(ring, id);
+  }
+  pni_free(PN_ALLOC_MESSENGER, ring->slots);
+  ring->slots = slots;
+  ring->capacity = capacity;
+  return true;
+}
+
+static pn_sequence_t pni_ring_track(pni_ring_t *ring, int shard, pn_tracker_t tracker)
+{
+  if ((size_t) (ring->hwm - ring->lwm) == ring->capacity && !pni_ring_grow(ring)) {
+    ring->lwm++;
+  }
+  pn_sequence_t id = ring->hwm++;
+  pni_slot_t *slot = pni_ring_slot(ring, id);
+  slot->shard = shard;
+  slot->tracker = tracker;
+  if (ring->window >= 0) {
+    while (ring->hwm - ring->lwm > ring->window) {
+      ring->lwm++;
+    }
+  }
+  return id;
+}
+
+static void pni_shards_notify(pni_shards_t *shards)
+{
+  if (pni_atomic_exchange(&shards->waiting, NULL)) {
+    pni_semaphore_post(shards->progress);
+  }
+}
+
+// make what the shard's messenger is up to visible to the front
+static void pni_shard_publish(pni_shard_t *shard, pn_sequence_t taken, bool worked, int err)
+{
+  pn_messenger_t *messenger = shard->messenger;
+  bool quiesced = true;
+  int unsent = pni_messenger_unsent(messenger, &quiesced);
+  int outgoing = pn_messenger_outgoing(messenger);
+  int incoming = pn_messenger_incoming(messenger);
+  int receiving = pn_messenger_receiving(messenger);
+  bool stopped = pn_messenger_stopped(messenger);
+  pn_error_t *error = pn_messenger_error(messenger);
+
+  pni_mutex_lock(shard->lock);
+  shard->taken = taken;
+  shard->quiesced = quiesced;
+  shard->unsent = unsent;
+  shard->outgoing = outgoing;
+  shard->incoming = incoming;
+  shard->receiving = receiving;
+  shard->stopped = stopped;
+  if (worked) shard->worked++;
+  if (!pn_error_code(shard->error)) {
+    if (pn_error_code(error)) {
+      pn_error_copy(shard->error, error);
+    } else if (err < 0 && err != PN_INTR && err != PN_TIMEOUT && err != PN_INPROGRESS) {
+      pn_error_set(shard->error, err, "shard failed");
+    }
+  }
+  pni_mutex_unlock(shard->lock);
+
+  pn_error_clear(error);
+  pni_shards_notify(shard->shards);
+}
+
+static pn_sequence_t pni_shard_drain(pni_shard_t *shard)
+{
+  pni_put_t *put = (pni_put_t *) pni_atomic_exchange(&shard->puts, NULL);
+  pni_put_t *fifo = NULL;
+  while (put) {
+    pni_put_t *next = put->next;
+    put->next = fifo;
+    fifo = put;
+    put = next;
+  }
+  pn_sequence_t count = 0;
+  while (fifo) {
+    pni_put_t *next = fifo->next;
+    // failures are reported through the messenger's error
+    pni_messenger_put_encoded(shard->messenger, fifo->address, fifo->encoded, fifo->priority);
+    pni_free(PN_ALLOC_MESSENGER, fifo->address);
+    pni_free(PN_ALLOC_MESSENGER, fifo);
+    fifo = next;
+    count++;
+  }
+  return count;
+}
+
+static void pni_got_free(pni_got_t *got)
+{
+  pni_free(PN_ALLOC_MESSENGER, got->encoded.start);
+  pn_message_free(got->message);
+  pni_free(PN_ALLOC_MESSENGER, got);
+}
+
+// a got to hand a message over with, carrying a prefetch message
+// while the shard has any left
+static pni_got_t *pni_shard_got(pni_shard_t *shard)
+{
+  if (!shard->pool) {
+    shard->pool = (pni_got_t *) pni_atomic_exchange(&shard->spare, NULL);
+  }
+  pni_got_t *got = shard->pool;
+  if (got) {
+    shard->pool = got->next;
+    return got;
+  }
+  got = (pni_got_t *) pni_malloc(PN_ALLOC_MESSENGER, sizeof(pni_got_t));
+  if (!got) return NULL;
+  got->encoded.start = NULL;
+  got->encoded.size = 0;
+  got->message = NULL;
+  if (shard->made < shard->shards->prefetch) {
+    got->message = pn_message();
+    if (got->message) shard->made++;
+  }
+  return got;
+}
+
+// hand everything received to the front
+static bool pni_shard_hand(pni_shard_t *shard)
+{
+  pni_shards_t *shards = shard->shards;
+  bool handed = false;
+  while (true) {
+    pni_got_t *got = pni_shard_got(shard);
+    if (!got) break;
+    if (pni_messenger_take(shard->messenger, &got->encoded, &got->tracker, &got->subscription)) {
+      if (got->message) {
+        got->next = shard->pool;
+        shard->pool = got;
+      } else {
+        pni_free(PN_ALLOC_MESSENGER, got);
+      }
+      break;
+    }
+    // a message that does not decode is left for the front to fail on
+    if (got->message &&
+        !pn_message_decode(got->message, got->encoded.start, got->encoded.size)) {
+      pni_free(PN_ALLOC_MESSENGER, got->encoded.start);
+      got->encoded.start = NULL;
+      got->encoded.size = 0;
+    }
+    got->shard = (int) (shard - shards->shards);
+    do {
+      got->next = (pni_got_t *) pni_atomic_load(&shards->got);
+    } while (!pni_atomic_cas(&shards->got, got->next, got));
+    handed = true;
+  }
+  return handed;
+}
+
+static void pni_shard_run(void *context)
+{
+  pni_shard_t *shard = (pni_shard_t *) context;
+  pn_messenger_t *messenger = shard->messenger;
+  pn_sequence_t taken = 0;
+  unsigned granted = 0;
+
+  while (true) {
+    pn_sequence_t drained = pni_shard_drain(shard);
+    taken += drained;
+
+    pni_mutex_lock(shard->lock);
+    pni_call_t call = shard->call;
+    void *call_context = shard->context;
+    shard->call = NULL;
+    bool grant = shard->grant != granted;
+    int credit = shard->credit;
+    granted = shard->grant;
+    bool exit = shard->exit;
+    pni_mutex_unlock(shard->lock);
+
+    if (exit) break;
+
+    if (call) {
+      call(messenger, call_context);
+      pni_shard_publish(shard, taken, true, 0);
+      pni_semaphore_post(shard->returned);
+    }
+    if (grant) {
+      pn_messenger_recv(messenger, credit);
+    }
+
+    // interrupted by the front whenever it has something for us
+    bool busy = drained || call || grant;
+    int err = pn_messenger_work(messenger, busy ? 0 : -1);
+    bool handed = pni_shard_hand(shard);
+    pni_shard_publish(shard, taken, busy || handed || err > 0, err);
+  }
+}
+
+// run call on the shard's thread
+static void pni_shard_call(pni_shard_t *shard, pni_call_t call, void *context)
+{
+  pni_mutex_lock(shard->lock);
+  shard->call = call;
+  shard->context = context;
+  pni_mutex_unlock(shard->lock);
+  pn_messenger_interrupt(shard->messenger);
+  pni_semaphore_wait(shard->returned);
+}
+
+static void pni_shard_exit(pni_shard_t *shard)
+{
+  pni_mutex_lock(shard->lock);
+  shard->exit = true;
+  pni_mutex_unlock(shard->lock);
+  pn_messenger_interrupt(shard->messenger);
+}
+
+static void pni_shard_fini(pni_shard_t *shard)
+{
+  if (shard->thread) pni_thread_join(shard->thread);
+  pni_put_t *put = (pni_put_t *) shard->puts;
+  while (put) {
+    pni_put_t *next = put->next;
+    pni_free(PN_ALLOC_MESSENGER, put->encoded.start);
+    pni_free(PN_ALLOC_MESSENGER, put->address);
+    pni_free(PN_ALLOC_MESSENGER, put);
+    put = next;
+  }
+  pni_got_t *lists[] = {shard->pool, (pni_got_t *) shard->spare};
+  for (int i = 0; i < 2; i++) {
+    pni_got_t *got = lists[i];
+    while (got) {
+      pni_got_t *next = got->next;
+      pni_got_free(got);
+      got = next;
+    }
+  }
+  pn_messenger_free(shard->messenger);
+  if (shard->returned) pni_semaphore_free(shard->returned);
+  if (shard->lock) pni_mutex_free(shard->lock);
+  pn_error_free(shard->error);
+}
+
+pni_shards_t *pni_shards(pn_messenger_t *messenger, int count)
+{
+  assert(count > 0);
+  pni_shards_t *shards = (pni_shards_t *) pni_malloc(PN_ALLOC_MESSENGER, sizeof(pni_shards_t));
+  if (!shards) return NULL;
+  shards->messenger = messenger;
+  shards->count = 0;
+  shards->prefetch = (pn_messenger_get_prefetch(messenger) + count - 1) / count;
+  shards->got = NULL;
+  shards->waiting = NULL;
+  shards->interrupted = NULL;
+  shards->progress = pni_semaphore();
+  shards->lock = pni_mutex();
+  shards->aliases = pn_map(PN_OBJECT, PN_VOID, 0, 0.75);
+  shards->head = NULL;
+  shards->tail = NULL;
+  shards->backlog = 0;
+  pni_ring_t outgoing = {NULL, 0, pn_messenger_get_outgoing_window(messenger), 0, 0};
+  pni_ring_t incoming = {NULL, 0, pn_messenger_get_incoming_window(messenger), 0, 0};
+  shards->outgoing = outgoing;
+  shards->incoming = incoming;
+  shards->shards = (pni_shard_t *) pni_calloc(PN_ALLOC_MESSENGER, count, sizeof(pni_shard_t));
+  if (!shards->shards || !shards->progress || !shards->lock) {
+    pni_shards_free(shards);
+    return NULL;
+  }
+
+  for (int i = 0; i < count; i++) {
+    pni_shard_t *shard = &shards->shards[i];
+    shards->count++;
+    shard->shards = shards;
+    shard->messenger = pni_messenger_shard(messenger, shards, i);
+    shard->returned = pni_semaphore();
+    shard->lock = pni_mutex();
+    shard->error = pn_error();
+    shard->quiesced = true;
+    shard->stopped = true;
+    if (!shard->messenger || !shard->returned || !shard->lock) {
+      pni_shards_free(shards);
+      return NULL;
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    pni_shard_t *shard = &shards->shards[i];
+    shard->thread = pni_thread(pni_shard_run, shard);
+    if (!shard->thread) {
+      pni_shards_free(shards);
+      return NULL;
+    }
+  }
+
+  return shards;
+}
+
+void pni_shards_free(pni_shards_t *shards)
+{
+  if (!shards) return;
+
+  for (int i = 0; i < shards->count; i++) {
+    if (shards->shards[i].thread) pni_shard_exit(&shards->shards[i]);
+  }
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_fini(&shards->shards[i]);
+  }
+  pni_free(PN_ALLOC_MESSENGER, shards->shards);
+
+  pni_got_t *got = (pni_got_t *) shards->got;
+  while (got) {
+    pni_got_t *next = got->next;
+    pni_got_free(got);
+    got = next;
+  }
+  got = shards->head;
+  while (got) {
+    pni_got_t *next = got->next;
+    pni_got_free(got);
+    got = next;
+  }
+
+  pni_free(PN_ALLOC_MESSENGER, shards->outgoing.slots);
+  pni_free(PN_ALLOC_MESSENGER, shards->incoming.slots);
+  pn_free(shards->aliases);
+  if (shards->lock) pni_mutex_free(shards->lock);
+  if (shards->progress) pni_semaphore_free(shards->progress);
+  pni_free(PN_ALLOC_MESSENGER, shards);
+}
+
+int pni_shards_pick(pni_shards_t *shards, pn_string_t *key, pn_string_t *domain)
+{
+  pni_mutex_lock(shards->lock);
+  uintptr_t alias = (uintptr_t) pn_map_get(shards->aliases, domain);
+  pni_mutex_unlock(shards->lock);
+  if (alias) return (int) alias - 1;
+  return (int) (pn_hashcode(key) % (uintptr_t) shards->count);
+}
+
+void pni_shards_alias(pni_shards_t *shards, const char *container, int index)
+{
+  if (!container) return;
+  pn_string_t *alias = pn_string(container);
+  pni_mutex_lock(shards->lock);
+  pn_map_put(shards->aliases, alias, (void *) (uintptr_t) (index + 1));
+  pni_mutex_unlock(shards->lock);
+  pn_decref(alias);
+}
+
+void pni_shards_unalias(pni_shards_t *shards, const char *container, int index)
+{
+  if (!container) return;
+  pn_string_t *alias = pn_string(container);
+  pni_mutex_lock(shards->lock);
+  if ((uintptr_t) pn_map_get(shards->aliases, alias) == (uintptr_t) (index + 1)) {
+    pn_map_del(shards->aliases, alias);
+  }
+  pni_mutex_unlock(shards->lock);
+  pn_decref(alias);
+}
+
+int pni_shards_put(pni_shards_t *shards, int index, const char *address,
+                   pn_rwbytes_t encoded, uint8_t priority, pn_tracker_t *tracker)
+{
+  assert(index >= 0 && index < shards->count);
+  pni_shard_t *shard = &shards->shards[index];
+  pni_put_t *put = (pni_put_t *) pni_malloc(PN_ALLOC_MESSENGER, sizeof(pni_put_t));
+  char *copy = pn_strdup(address);
+  if (!put || (address && !copy)) {
+    pni_free(PN_ALLOC_MESSENGER, put);
+    pni_free(PN_ALLOC_MESSENGER, copy);
+    pni_free(PN_ALLOC_MESSENGER, encoded.start);
+    return pn_error_format(pn_messenger_error(shards->messenger), PN_ERR,
+                           "allocation failed");
+  }
+  put->address = copy;
+  put->encoded = encoded;
+  put->priority = priority;
+
+  // the shard's store tracks its puts in the order they are given
+  pn_tracker_t own = pn_tracker(OUTGOING, shard->given++);
+  *tracker = pn_tracker(OUTGOING, pni_ring_track(&shards->outgoing, index, own));
+
+  do {
+    put->next = (pni_put_t *) pni_atomic_load(&shard->puts);
+  } while (!pni_atomic_cas(&shard->puts, put->next, put));
+  return pn_messenger_interrupt(shard->messenger);
+}
+
+// move what the shards have received onto the backlog
+static void pni_shards_pull(pni_shards_t *shards)
+{
+  pni_got_t *got = (pni_got_t *) pni_atomic_exchange(&shards->got, NULL);
+  if (!got) return;
+  pni_got_t *head = NULL;
+  pni_got_t *tail = got;
+  while (got) {
+    pni_got_t *next = got->next;
+    got->next = head;
+    head = got;
+    got = next;
+    shards->backlog++;
+  }
+  if (shards->tail) {
+    shards->tail->next = head;
+  } else {
+    shards->head = head;
+  }
+  shards->tail = tail;
+}
+
+int pni_shards_get(pni_shards_t *shards, pn_message_t *msg, pn_tracker_t *tracker,
+                   pn_subscription_t **subscription)
+{
+  pni_shards_pull(shards);
+  pni_got_t *got = shards->head;
+  if (!got) return PN_EOS;
+  shards->head = got->next;
+  if (!shards->head) shards->tail = NULL;
+  shards->backlog--;
+
+  *tracker = pn_tracker(INCOMING, pni_ring_track(&shards->incoming, got->shard, got->tracker));
+  *subscription = got->subscription;
+
+  int err = 0;
+  if (msg) {
+    if (got->encoded.start) {
+      err = pn_message_decode(msg, got->encoded.start, got->encoded.size);
+    } else {
+      pni_message_move(msg, got->message);
+    }
+  }
+
+  if (got->message) {
+    // the prefetch message goes back to its shard, holding whatever
+    // msg held
+    pni_free(PN_ALLOC_MESSENGER, got->encoded.start);
+    got->encoded.start = NULL;
+    pni_shard_t *shard = &shards->shards[got->shard];
+    do {
+      got->next = (pni_got_t *) pni_atomic_load(&shard->spare);
+    } while (!pni_atomic_cas(&shard->spare, got->next, got));
+  } else {
+    pni_got_free(got);
+  }
+  return err;
+}
+
+// the first error a shard ran into, moved to the messenger
+static int pni_shards_error(pni_shards_t *shards)
+{
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_t *shard = &shards->shards[i];
+    pni_mutex_lock(shard->lock);
+    int err = pn_error_code(shard->error);
+    if (err) {
+      pn_error_copy(pn_messenger_error(shards->messenger), shard->error);
+      pn_error_clear(shard->error);
+    }
+    pni_mutex_unlock(shard->lock);
+    if (err) return err;
+  }
+  return 0;
+}
+
+typedef bool (*pni_done_t)(pni_shards_t *shards, void *context);
+
+static int pni_shards_wait(pni_shards_t *shards, pni_done_t done, void *context, int timeout)
+{
+  pn_timestamp_t deadline = pn_i_now() + timeout;
+  while (true) {
+    // announce the wait before looking, so no progress goes unnoticed
+    pni_atomic_exchange(&shards->waiting, shards);
+    bool interrupted = pni_atomic_exchange(&shards->interrupted, NULL) != NULL;
+    int err = pni_shards_error(shards);
+    if (err) return err;
+    if (done(shards, context)) return 0;
+    if (interrupted) return PN_INTR;
+
+    int remaining = -1;
+    if (timeout >= 0) {
+      pn_timestamp_t now = pn_i_now();
+      if (now >= deadline) return PN_TIMEOUT;
+      remaining = deadline - now;
+    }
+    pni_semaphore_wait_for(shards->progress, remaining);
+  }
+}
+
+int pni_shards_outgoing(pni_shards_t *shards)
+{
+  int total = 0;
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_t *shard = &shards->shards[i];
+    pni_mutex_lock(shard->lock);
+    total += (shard->given - shard->taken) + shard->outgoing;
+    pni_mutex_unlock(shard->lock);
+  }
+  return total;
+}
+
+int pni_shards_incoming(pni_shards_t *shards)
+{
+  pni_shards_pull(shards);
+  int total = shards->backlog;
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_t *shard = &shards->shards[i];
+    pni_mutex_lock(shard->lock);
+    total += shard->incoming;
+    pni_mutex_unlock(shard->lock);
+  }
+  return total;
+}
+
+int pni_shards_receiving(pni_shards_t *shards)
+{
+  int total = 0;
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_t *shard = &shards->shards[i];
+    pni_mutex_lock(shard->lock);
+    total += shard->receiving;
+    pni_mutex_unlock(shard->lock);
+  }
+  return total;
+}
+
+static void pni_call_metrics(pn_messenger_t *messenger, void *context)
+{
+  pni_messenger_metrics(messenger, (pn_transport_metrics_t *) context);
+}
+
+void pni_shards_metrics(pni_shards_t *shards, pn_transport_metrics_t *total)
+{
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_call(&shards->shards[i], pni_call_metrics, total);
+  }
+}
+
+static bool pni_shards_sent(pni_shards_t *shards, void *context)
+{
+  int threshold = *(int *) context;
+  int total = 0;
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_t *shard = &shards->shards[i];
+    pni_mutex_lock(shard->lock);
+    bool quiesced = shard->quiesced;
+    total += (shard->given - shard->taken) + shard->unsent;
+    pni_mutex_unlock(shard->lock);
+    if (!quiesced) return false;
+  }
+  return total <= threshold;
+}
+
+int pni_shards_send(pni_shards_t *shards, int n, int timeout)
+{
+  int threshold = 0;
+  if (n != -1) {
+    threshold = pni_shards_outgoing(shards) - n;
+    if (threshold < 0) threshold = 0;
+  }
+  return pni_shards_wait(shards, pni_shards_sent, &threshold, timeout);
+}
+
+static bool pni_shards_rcvd(pni_shards_t *shards, void *context)
+{
+  return shards->head || pni_atomic_load(&shards->got) || pni_shards_stopped(shards);
+}
+
+int pni_shards_recv(pni_shards_t *shards, int n, int timeout)
+{
+  // the front cannot tell which shards the messages will come from,
+  // so each is granted all of an explicit credit
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_t *shard = &shards->shards[i];
+    pni_mutex_lock(shard->lock);
+    shard->credit = n;
+    shard->grant++;
+    pni_mutex_unlock(shard->lock);
+    pn_messenger_interrupt(shard->messenger);
+  }
+  return pni_shards_wait(shards, pni_shards_rcvd, NULL, timeout);
+}
+
+static unsigned pni_shards_worked(pni_shards_t *shards)
+{
+  unsigned worked = 0;
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_t *shard = &shards->shards[i];
+    pni_mutex_lock(shard->lock);
+    worked += shard->worked;
+    pni_mutex_unlock(shard->lock);
+  }
+  return worked;
+}
+
+static bool pni_shards_progressed(pni_shards_t *shards, void *context)
+{
+  return pni_shards_worked(shards) != *(unsigned *) context;
+}
+
+int pni_shards_work(pni_shards_t *shards, int timeout)
+{
+  unsigned worked = pni_shards_worked(shards);
+  int err = pni_shards_wait(shards, pni_shards_progressed, &worked, timeout);
+  return err ? err : 1;
+}
+
+static void pni_call_stop(pn_messenger_t *messenger, void *context)
+{
+  pn_messenger_stop(messenger);
+}
+
+static bool pni_shards_done(pni_shards_t *shards, void *context)
+{
+  return pni_shards_stopped(shards);
+}
+
+int pni_shards_stop(pni_shards_t *shards, int timeout)
+{
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_call(&shards->shards[i], pni_call_stop, NULL);
+  }
+  return pni_shards_wait(shards, pni_shards_done, NULL, timeout);
+}
+
+bool pni_shards_stopped(pni_shards_t *shards)
+{
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_t *shard = &shards->shards[i];
+    pni_mutex_lock(shard->lock);
+    bool stopped = shard->stopped && shard->given == shard->taken;
+    pni_mutex_unlock(shard->lock);
+    if (!stopped) return false;
+  }
+  return true;
+}
+
+int pni_shards_interrupt(pni_shards_t *shards)
+{
+  pni_atomic_exchange(&shards->interrupted, shards);
+  pni_semaphore_post(shards->progress);
+  return 0;
+}
+
+typedef struct {
+  const char *source;
+  pn_seconds_t timeout;
+  pn_subscription_t *subscription;
+  pn_error_t *error;
+} pni_subscribe_t;
+
+static void pni_call_subscribe(pn_messenger_t *messenger, void *context)
+{
+  pni_subscribe_t *subscribe = (pni_subscribe_t *) context;
+  subscribe->subscription =
+    pn_messenger_subscribe_ttl(messenger, subscribe->source, subscribe->timeout);
+  if (!subscribe->subscription) {
+    pn_error_copy(subscribe->error, pn_messenger_error(messenger));
+  }
+}
+
+pn_subscription_t *pni_shards_subscribe(pni_shards_t *shards, int index,
+                                        const char *source, pn_seconds_t timeout)
+{
+  assert(index >= 0 && index < shards->count);
+  pni_subscribe_t subscribe = {source, timeout, NULL, pn_messenger_error(shards->messenger)};
+  pni_shard_call(&shards->shards[index], pni_call_subscribe, &subscribe);
+  return subscribe.subscription;
+}
+
+typedef struct {
+  const char *pattern;
+  const char *address;
+} pni_route_t;
+
+static void pni_call_route(pn_messenger_t *messenger, void *context)
+{
+  pni_route_t *route = (pni_route_t *) context;
+  pn_messenger_route(messenger, route->pattern, route->address);
+}
+
+void pni_shards_route(pni_shards_t *shards, const char *pattern, const char *address)
+{
+  pni_route_t route = {pattern, address};
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_call(&shards->shards[i], pni_call_route, &route);
+  }
+}
+
+typedef struct {
+  bool outgoing;
+  int window;
+} pni_window_t;
+
+static void pni_call_window(pn_messenger_t *messenger, void *context)
+{
+  pni_window_t *window = (pni_window_t *) context;
+  if (window->outgoing) {
+    pn_messenger_set_outgoing_window(messenger, window->window);
+  } else {
+    pn_messenger_set_incoming_window(messenger, window->window);
+  }
+}
+
+void pni_shards_set_window(pni_shards_t *shards, bool outgoing, int window)
+{
+  pni_window_t call = {outgoing, window};
+  if (outgoing) {
+    shards->outgoing.window = window;
+  } else {
+    shards->incoming.window = window;
+  }
+  for (int i = 0; i < shards->count; i++) {
+    pni_shard_call(&shards->shards[i], pni_call_window, &call);
+  }
+}
+
+typedef struct {
+  pn_tracker_t tracker;
+  pn_status_t status;
+  int flags;
+  int result;
+  bool buffered;
+} pni_update_t;
+
+static void pni_call_status(pn_messenger_t *messenger, void *context)
+{
+  pni_update_t *update = (pni_update_t *) context;
+  update->status = pn_messenger_status(messenger, update->tracker);
+}
+
+static void pni_call_buffered(pn_messenger_t *messenger, void *context)
+{
+  pni_update_t *update = (pni_update_t *) context;
+  update->buffered = pn_messenger_buffered(messenger, update->tracker);
+}
+
+static void pni_call_settle(pn_messenger_t *messenger, void *context)
+{
+  pni_update_t *update = (pni_update_t *) context;
+  update->result = pn_messenger_settle(messenger, update->tracker, update->flags);
+}
+
+static void pni_call_update(pn_messenger_t *messenger, void *context)
+{
+  pni_update_t *update = (pni_update_t *) context;
+  if (update->status == PN_STATUS_ACCEPTED) {
+    update->result = pn_messenger_accept(messenger, update->tracker, update->flags);
+  } else {
+    update->result = pn_messenger_reject(messenger, update->tracker, update->flags);
+  }
+}
+
+static pni_ring_t *pni_shards_ring(pni_shards_t *shards, pn_tracker_t tracker)
+{
+  return pn_tracker_direction(tracker) == OUTGOING ? &shards->outgoing : &shards->incoming;
+}
+
+pn_status_t pni_shards_status(pni_shards_t *shards, pn_tracker_t tracker)
+{
+  pni_slot_t *slot = pni_ring_find(pni_shards_ring(shards, tracker), pn_tracker_sequence(tracker));
+  if (!slot) return PN_STATUS_UNKNOWN;
+  pni_update_t update = {slot->tracker, PN_STATUS_UNKNOWN, 0, 0, false};
+  pni_shard_call(&shards->shards[slot->shard], pni_call_status, &update);
+  return update.status;
+}
+
+bool pni_shards_buffered(pni_shards_t *shards, pn_tracker_t tracker)
+{
+  pni_slot_t *slot = pni_ring_find(pni_shards_ring(shards, tracker), pn_tracker_sequence(tracker));
+  if (!slot) return false;
+  pni_update_t update = {slot->tracker, PN_STATUS_UNKNOWN, 0, 0, false};
+  pni_shard_call(&shards->shards[slot->shard], pni_call_buffered, &update);
+  return update.buffered;
+}
+
+// apply call to the tracker, or for a cumulative update to the latest
+// tracker up to it of every shard
+static int pni_shards_apply(pni_shards_t *shards, pn_tracker_t tracker, pn_status_t status,
+                            int flags, pni_call_t call)
+{
+  pni_ring_t *ring = pni_shards_ring(shards, tracker);
+  pn_sequence_t id = pn_tracker_sequence(tracker);
+  if (!pni_ring_find(ring, id)) return 0;
+
+  int pending = (flags & PN_CUMULATIVE) ? shards->count : 1;
+  bool *done = (bool *) pni_calloc(PN_ALLOC_MESSENGER, shards->count, sizeof(bool));
+  if (!done) return PN_ERR;
+  int result = 0;
+  for (pn_sequence_t i = id; pending && i - ring->lwm >= 0; i--) {
+    pni_slot_t *slot = pni_ring_slot(ring, i);
+    if (done[slot->shard]) continue;
+    done[slot->shard] = true;
+    pending--;
+    pni_update_t update = {slot->tracker, status, flags, 0, false};
+    pni_shard_call(&shards->shards[slot->shard], call, &update);
+    if (update.result && !result) result = update.result;
+  }
+  pni_free(PN_ALLOC_MESSENGER, done);
+  return result;
+}
+
+int pni_shards_settle(pni_shards_t *shards, pn_tracker_t tracker, int flags)
+{
+  return pni_shards_apply(shards, tracker, PN_STATUS_UNKNOWN, flags, pni_call_settle);
+}
+
+int pni_shards_update(pni_shards_t *shards, pn_tracker_t tracker, pn_status_t status,
+                      int flags)
+{
+  return pni_shards_apply(shards, tracker, status, flags, pni_call_update);
+}
@@ -0,0 +1,110 @@
+#ifndef _PROTON_SHARD_H
+#define _PROTON_SHARD_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/messenger.h>
+#include <proton/object.h>
+
+#define OUTGOING (0x0000000000000000)
+#define INCOMING (0x1000000000000000)
+
+#define pn_tracker(direction, sequence) ((direction) | (sequence))
+#define pn_tracker_direction(tracker) ((tracker) & (0x1000000000000000))
+#define pn_tracker_sequence(tracker) ((pn_sequence_t) ((tracker) & (0x00000000FFFFFFFF)))
+
+/*
+ * A threaded messenger spreads its connections over shards. Each
+ * shard is an ordinary non blocking messenger driven by a thread of
+ * its own, the threaded messenger only keeps the trackers and hands
+ * messages to and from the shards through lock free stacks. Anything
+ * else it needs from a shard runs on the shard's thread as a call.
+ */
+
+typedef struct pni_shards_t pni_shards_t;
+
+/*
+ * Used by the shards, implemented by the messenger.
+ */
+
+// a messenger configured like messenger, to serve as one of its shards
+pn_messenger_t *pni_messenger_shard(pn_messenger_t *messenger, pni_shards_t *owner, int index);
+// queue a message that was already rewritten and encoded, the
+// messenger takes over the encoded bytes
+int pni_messenger_put_encoded(pn_messenger_t *messenger, const char *address,
+                              pn_rwbytes_t encoded, uint8_t priority);
+// the oldest incoming message, as a copy of its encoded bytes
+int pni_messenger_take(pn_messenger_t *messenger, pn_rwbytes_t *encoded,
+                       pn_tracker_t *tracker, pn_subscription_t **subscription);
+// the number of messages pn_messenger_sent() waits for, quiesced is
+// cleared if a transport still has output to generate
+int pni_messenger_unsent(pn_messenger_t *messenger, bool *quiesced);
+// add the metrics of messenger's connections to total
+void pni_messenger_metrics(pn_messenger_t *messenger, pn_transport_metrics_t *total);
+
+/*
+ * Used by the messenger.
+ */
+
+// start count shards, the trackers are windowed like messenger's and
+// the shards decode ahead as much as its prefetch allows
+pni_shards_t *pni_shards(pn_messenger_t *messenger, int count);
+void pni_shards_free(pni_shards_t *shards);
+
+// the shard for connections with the given key, or the shard a peer
+// calling itself domain connected to
+int pni_shards_pick(pni_shards_t *shards, pn_string_t *key, pn_string_t *domain);
+void pni_shards_alias(pni_shards_t *shards, const char *container, int index);
+void pni_shards_unalias(pni_shards_t *shards, const char *container, int index);
+
+int pni_shards_put(pni_shards_t *shards, int index, const char *address,
+                   pn_rwbytes_t encoded, uint8_t priority, pn_tracker_t *tracker);
+// the oldest message received, decoded into msg unless msg is NULL,
+// PN_EOS if there is none
+int pni_shards_get(pni_shards_t *shards, pn_message_t *msg, pn_tracker_t *tracker,
+                   pn_subscription_t **subscription);
+
+// as for a messenger, timeouts in milliseconds and negative for none
+int pni_shards_send(pni_shards_t *shards, int n, int timeout);
+int pni_shards_recv(pni_shards_t *shards, int n, int timeout);
+int pni_shards_work(pni_shards_t *shards, int timeout);
+int pni_shards_stop(pni_shards_t *shards, int timeout);
+bool pni_shards_stopped(pni_shards_t *shards);
+int pni_shards_interrupt(pni_shards_t *shards);
+
+int pni_shards_outgoing(pni_shards_t *shards);
+int pni_shards_incoming(pni_shards_t *shards);
+int pni_shards_receiving(pni_shards_t *shards);
+void pni_shards_metrics(pni_shards_t *shards, pn_transport_metrics_t *total);
+
+pn_subscription_t *pni_shards_subscribe(pni_shards_t *shards, int index,
+                                        const char *source, pn_seconds_t timeout);
+void pni_shards_route(pni_shards_t *shards, const char *pattern, const char *address);
+void pni_shards_set_window(pni_shards_t *shards, bool outgoing, int window);
+
+pn_status_t pni_shards_status(pni_shards_t *shards, pn_tracker_t tracker);
+bool pni_shards_buffered(pni_shards_t *shards, pn_tracker_t tracker);
+int pni_shards_settle(pni_shards_t *shards, pn_tracker_t tracker, int flags);
+int pni_shards_update(pni_shards_t *shards, pn_tracker_t tracker, pn_status_t status,
+                      int flags);
+
+#endif /* shard.h */
@@ -30,39 +30,73 @@
 #include <string.h>
 #include "util.h"
 #include "store.h"
+#include "journal.h"
+#include "alloc_private.h"
 
 typedef struct pni_stream_t pni_stream_t;
 
+static void pni_stream_free(pni_stream_t *stream);
+
 struct pni_store_t {
-  pni_stream_t *streams;
+  pn_map_t *streams;
+  pn_string_t *key;
+  pni_stream_t *last;
   pni_entry_t *store_head;
   pni_entry_t *store_tail;
-  pn_hash_t *tracked;
+  // tracked entries by id, the slot of id is id & (capacity - 1) for
+  // ids from lwm up to hwm
+  pni_entry_t **tracked;
+  size_t capacity;
   size_t size;
   int window;
   pn_sequence_t lwm;
   pn_sequence_t hwm;
+  pni_journal_t *journal;
+  // entries put in the journal and not yet done, each holds a reference
+  pni_entry_t *journaled_head;
+  pni_entry_t *journaled_tail;
 };
 
+// priorities above the last band share it
+#define PNI_STORE_BANDS (10)
+
+// the entries of one priority of a stream, in the order they were put
+typedef struct {
+  pni_entry_t *stream_head;
+  pni_entry_t *stream_tail;
+  uint64_t pass;  // when the band is next due, in the stream's own time
+} pni_band_t;
+
+// Each band is served in proportion to a weight that doubles with each
+// step up in priority, by stride scheduling: the band with the lowest
+// pass goes next and then moves its pass on by its stride, so high
+// priorities go first under load without starving the low ones.
 struct pni_stream_t {
   pni_store_t *store;
   pn_string_t *address;
-  pni_entry_t *stream_head;
-  pni_entry_t *stream_tail;
-  pni_stream_t *next;
+  pni_band_t bands[PNI_STORE_BANDS];
+  uint64_t now;  // the pass of the band served last
+  size_t size;
 };
 
 struct pni_entry_t {
+  pni_store_t *store;
   pni_stream_t *stream;
   pni_entry_t *stream_next;
   pni_entry_t *stream_prev;
   pni_entry_t *store_next;
   pni_entry_t *store_prev;
+  pni_entry_t *journaled_next;
+  pni_entry_t *journaled_prev;
   pn_buffer_t *bytes;
+  pn_rwbytes_t encoded;
   pn_delivery_t *delivery;
   void *context;
   pn_status_t status;
   pn_sequence_t id;
+  uint64_t journal_id;
+  uint32_t format;
+  uint8_t band;
   bool free;
 };
 
@@ -79,17 +113,23 @@ void pni_entry_finalize(void *object)
 
 pni_store_t *pni_store()
 {
-  pni_store_t *store = (pni_store_t *) malloc(sizeof(pni_store_t));
+  pni_store_t *store = (pni_store_t *) pni_malloc(PN_ALLOC_MESSENGER, sizeof(pni_store_t));
   if (!store) return NULL;
 
   store->size = 0;
-  store->streams = NULL;
+  store->streams = pn_map(PN_OBJECT, PN_VOID, 0, 0.75);
+  store->key = pn_string(NULL);
+  store->last = NULL;
   store->store_head = NULL;
   store->store_tail = NULL;
   store->window = 0;
   store->lwm = 0;
   store->hwm = 0;
-  store->tracked = pn_hash(PN_OBJECT, 0, 0.75);
+  store->tracked = NULL;
+  store->capacity = 0;
+  store->journal = NULL;
+  store->journaled_head = NULL;
+  store->journaled_tail = NULL;
 
   return store;
 }
@@ -105,44 +145,49 @@ pni_stream_t *pni_stream(pni_store_t *store, const char *address, bool create)
   assert(store);
   assert(address);
 
-  pni_stream_t *prev = NULL;
-  pni_stream_t *stream = store->streams;
-  while (stream) {
-    if (!strcmp(pn_string_get(stream->address), address)) {
-      return stream;
-    }
-    prev = stream;
-    stream = stream->next;
+  // puts tend to come in runs to one address
+  pni_stream_t *last = store->last;
+  if (last && !strcmp(pn_string_get(last->address), address)) {
+    return last;
   }
 
-  if (create) {
-    stream = (pni_stream_t *) malloc(sizeof(pni_stream_t));
+  pn_string_set(store->key, address);
+  pni_stream_t *stream = (pni_stream_t *) pn_map_get(store->streams, store->key);
+
+  if (!stream && create) {
+    stream = (pni_stream_t *) pni_malloc(PN_ALLOC_MESSENGER, sizeof(pni_stream_t));
+    if (!stream) return NULL;
     stream->store = store;
     stream->address = pn_string(address);
-    stream->stream_head = NULL;
-    stream->stream_tail = NULL;
-    stream->next = NULL;
+    memset(stream->bands, 0, sizeof(stream->bands));
+    stream->now = 0;
+    stream->size = 0;
+    pn_map_put(store->streams, stream->address, stream);
+  }
 
-    if (prev) {
-      prev->next = stream;
-    } else {
-      store->streams = stream;
+  if (stream) {
+    store->last = stream;
+    // the previous stream was only kept for being the last one
+    if (last && !last->size) {
+      pni_stream_free(last);
     }
   }
 
   return stream;
 }
 
-pni_stream_t *pni_stream_head(pni_store_t *store)
-{
-  assert(store);
-  return store->streams;
-}
-
-pni_stream_t *pni_stream_next(pni_stream_t *stream)
+// empty streams are reclaimed, except for the last one used, which is
+// likely to be used again right away
+static void pni_stream_free(pni_stream_t *stream)
 {
-  assert(stream);
-  return stream->next;
+  pni_store_t *store = stream->store;
+  assert(!stream->size);
+  if (store->last == stream) {
+    store->last = NULL;
+  }
+  pn_map_del(store->streams, stream->address);
+  pn_free(stream->address);
+  pni_free(PN_ALLOC_MESSENGER, stream);
 }
 
 void pni_entry_free(pni_entry_t *entry)
@@ -150,39 +195,55 @@ void pni_entry_free(pni_entry_t *entry)
   if (!entry) return;
   pni_stream_t *stream = entry->stream;
   pni_store_t *store = stream->store;
-  LL_REMOVE(stream, stream, entry);
+  pni_band_t *band = &stream->bands[entry->band];
+  // leaving from the front of its band is being served
+  if (entry == LL_HEAD(band, stream)) {
+    stream->now = band->pass;
+    band->pass += (uint64_t) 1 << (PNI_STORE_BANDS - 1 - entry->band);
+  }
+  LL_REMOVE(band, stream, entry);
+  stream->size--;
   LL_REMOVE(store, store, entry);
   entry->free = true;
+  entry->stream = NULL;
+  if (!stream->size && stream != store->last) {
+    pni_stream_free(stream);
+  }
 
   pn_buffer_free(entry->bytes);
   entry->bytes = NULL;
+  pni_free(PN_ALLOC_MESSENGER, entry->encoded.start);
+  entry->encoded = pn_rwbytes(0, NULL);
   pn_decref(entry);
   store->size--;
 }
 
-void pni_stream_free(pni_stream_t *stream)
+void pni_store_free(pni_store_t *store)
 {
-  if (!stream) return;
+  if (!store) return;
+  // what is still journaled is left for the next run to recover
+  pni_entry_t *journaled;
+  while ((journaled = LL_HEAD(store, journaled))) {
+    LL_REMOVE(store, journaled, journaled);
+    journaled->journal_id = 0;
+    pn_decref(journaled);
+  }
+  for (pn_sequence_t id = store->lwm; store->hwm - id > 0; id++) {
+    pni_entry_t *tracked = pni_store_entry(store, id);
+    if (tracked) pn_decref(tracked);
+  }
+  pni_free(PN_ALLOC_MESSENGER, store->tracked);
   pni_entry_t *entry;
-  while ((entry = LL_HEAD(stream, stream))) {
+  while ((entry = LL_HEAD(store, store))) {
     pni_entry_free(entry);
   }
-  pn_free(stream->address);
-  stream->address = NULL;
-  free(stream);
-}
-
-void pni_store_free(pni_store_t *store)
-{
-  if (!store) return;
-  pn_free(store->tracked);
-  pni_stream_t *stream = store->streams;
-  while (stream) {
-    pni_stream_t *next = stream->next;
-    pni_stream_free(stream);
-    stream = next;
+  if (store->last) {
+    pni_stream_free(store->last);
   }
-  free(store);
+  assert(!pn_map_size(store->streams));
+  pn_free(store->streams);
+  pn_free(store->key);
+  pni_free(PN_ALLOC_MESSENGER, store);
 }
 
 pni_stream_t *pni_stream_put(pni_store_t *store, const char *address)
@@ -203,7 +264,7 @@ pni_stream_t *pni_stream_get(pni_store_t *store, const char *address)
 #define pni_entry_compare NULL
 #define pni_entry_inspect NULL
 
-pni_entry_t *pni_store_put(pni_store_t *store, const char *address)
+pni_entry_t *pni_store_put(pni_store_t *store, const char *address, uint8_t priority)
 {
   assert(store);
   static const pn_class_t clazz = PN_CLASS(pni_entry);
@@ -213,16 +274,29 @@ pni_entry_t *pni_store_put(pni_store_t *store, const char *address)
   if (!stream) return NULL;
   pni_entry_t *entry = (pni_entry_t *) pn_class_new(&clazz, sizeof(pni_entry_t));
   if (!entry) return NULL;
+  entry->store = store;
   entry->stream = stream;
   entry->free = false;
   entry->stream_next = NULL;
   entry->stream_prev = NULL;
   entry->store_next = NULL;
   entry->store_prev = NULL;
+  entry->journaled_next = NULL;
+  entry->journaled_prev = NULL;
   entry->delivery = NULL;
-  entry->bytes = pn_buffer(64);
+  entry->bytes = NULL;
+  entry->encoded = pn_rwbytes(0, NULL);
   entry->status = PN_STATUS_UNKNOWN;
-  LL_ADD(stream, stream, entry);
+  entry->journal_id = 0;
+  entry->format = 0;
+  entry->band = priority < PNI_STORE_BANDS ? priority : PNI_STORE_BANDS - 1;
+  pni_band_t *band = &stream->bands[entry->band];
+  // a band that was idle is due now, it gets no credit for the wait
+  if (!LL_HEAD(band, stream) && band->pass < stream->now) {
+    band->pass = stream->now;
+  }
+  LL_ADD(band, stream, entry);
+  stream->size++;
   LL_ADD(store, store, entry);
   store->size++;
   return entry;
@@ -234,7 +308,15 @@ pni_entry_t *pni_store_get(pni_store_t *store, const char *address)
   if (address) {
     pni_stream_t *stream = pni_stream_get(store, address);
     if (!stream) return NULL;
-    return LL_HEAD(stream, stream);
+    // the lowest pass goes first, the higher priority on a tie
+    pni_band_t *next = NULL;
+    for (int i = PNI_STORE_BANDS - 1; i >= 0; i--) {
+      pni_band_t *band = &stream->bands[i];
+      if (LL_HEAD(band, stream) && (!next || band->pass < next->pass)) {
+        next = band;
+      }
+    }
+    return next ? LL_HEAD(next, stream) : NULL;
   } else {
     return LL_HEAD(store, store);
   }
@@ -243,9 +325,27 @@ pni_entry_t *pni_store_get(pni_store_t *store, const char *address)
 pn_buffer_t *pni_entry_bytes(pni_entry_t *entry)
 {
   assert(entry);
+  if (!entry->bytes) {
+    entry->bytes = pn_buffer(64);
+  }
   return entry->bytes;
 }
 
+void pni_entry_set_encoded(pni_entry_t *entry, pn_rwbytes_t encoded)
+{
+  assert(entry);
+  pni_free(PN_ALLOC_MESSENGER, entry->encoded.start);
+  entry->encoded = encoded;
+}
+
+pn_rwbytes_t pni_entry_take_encoded(pni_entry_t *entry)
+{
+  assert(entry);
+  pn_rwbytes_t encoded = entry->encoded;
+  entry->encoded = pn_rwbytes(0, NULL);
+  return encoded;
+}
+
 pn_status_t pni_entry_get_status(pni_entry_t *entry)
 {
   assert(entry);
@@ -283,6 +383,18 @@ void pni_entry_set_context(pni_entry_t *entry, void *context)
   entry->context = context;
 }
 
+void pni_entry_set_format(pni_entry_t *entry, uint32_t format)
+{
+  assert(entry);
+  entry->format = format;
+}
+
+uint32_t pni_entry_get_format(pni_entry_t *entry)
+{
+  assert(entry);
+  return entry->format;
+}
+
 void *pni_entry_get_context(pni_entry_t *entry)
 {
   assert(entry);
@@ -311,6 +423,46 @@ static pn_status_t disp2status(uint64_t disp)
   return (pn_status_t) 0;
 }
 
+void pni_store_set_journal(pni_store_t *store, pni_journal_t *journal)
+{
+  assert(store);
+  store->journal = journal;
+}
+
+void pni_entry_set_journaled(pni_entry_t *entry, uint64_t id)
+{
+  assert(entry && !entry->journal_id && id);
+  pni_store_t *store = entry->store;
+  entry->journal_id = id;
+  LL_ADD(store, journaled, entry);
+  pn_incref(entry);
+}
+
+int pni_entry_journal(pni_entry_t *entry)
+{
+  assert(entry);
+  pni_store_t *store = entry->store;
+  if (!store->journal) return 0;
+  pn_bytes_t encoded = pn_bytes(entry->encoded.size, entry->encoded.start);
+  uint64_t id = pni_journal_put(store->journal, pn_string_get(entry->stream->address),
+                                entry->format, encoded);
+  if (!id) return PN_ERR;
+  pni_entry_set_journaled(entry, id);
+  return 0;
+}
+
+// the message is done with once the peer took it or turned it down for
+// good, or once it is settled without knowing, this may drop the last
+// reference to the entry
+static void pni_entry_retire(pni_entry_t *entry)
+{
+  if (!entry->journal_id) return;
+  pni_store_t *store = entry->store;
+  pni_journal_done(store->journal, entry->journal_id);
+  entry->journal_id = 0;
+  LL_REMOVE(store, journaled, entry);
+  pn_decref(entry);
+}
 
 void pni_entry_updated(pni_entry_t *entry)
 {
@@ -329,6 +481,10 @@ void pni_entry_updated(pni_entry_t *entry)
     } else {
       entry->status = PN_STATUS_PENDING;
     }
+    if (entry->status == PN_STATUS_ACCEPTED || entry->status == PN_STATUS_REJECTED ||
+        entry->status == PN_STATUS_SETTLED) {
+      pni_entry_retire(entry);
+    }
   }
 }
 
@@ -338,10 +494,9 @@ pn_sequence_t pni_entry_id(pni_entry_t *entry)
   return entry->id;
 }
 
-pni_entry_t *pni_store_entry(pni_store_t *store, pn_sequence_t id)
+static inline pni_entry_t **pni_store_slot(pni_store_t *store, pn_sequence_t id)
 {
-  assert(store);
-  return (pni_entry_t *) pn_hash_get(store->tracked, id);
+  return &store->tracked[(uint32_t) id & (store->capacity - 1)];
 }
 
 bool pni_store_tracking(pni_store_t *store, pn_sequence_t id)
@@ -349,21 +504,53 @@ bool pni_store_tracking(pni_store_t *store, pn_sequence_t id)
   return (id - store->lwm >= 0) && (store->hwm - id > 0);
 }
 
+pni_entry_t *pni_store_entry(pni_store_t *store, pn_sequence_t id)
+{
+  assert(store);
+  return pni_store_tracking(store, id) ? *pni_store_slot(store, id) : NULL;
+}
+
+static void pni_store_untrack(pni_store_t *store, pn_sequence_t id)
+{
+  pni_entry_t **slot = pni_store_slot(store, id);
+  pni_entry_t *tracked = *slot;
+  if (tracked) {
+    *slot = NULL;
+    pn_decref(tracked);
+  }
+}
+
+static bool pni_store_grow(pni_store_t *store)
+{
+  size_t capacity = store->capacity ? 2*store->capacity : 16;
+  pni_entry_t **tracked =
+    (pni_entry_t **) pni_calloc(PN_ALLOC_MESSENGER, capacity, sizeof(pni_entry_t *));
+  if (!tracked) return false;
+  for (pn_sequence_t id = store->lwm; store->hwm - id > 0; id++) {
+    tracked[(uint32_t) id & (capacity - 1)] = *pni_store_slot(store, id);
+  }
+  pni_free(PN_ALLOC_MESSENGER, store->tracked);
+  store->tracked = tracked;
+  store->capacity = capacity;
+  return true;
+}
+
 pn_sequence_t pni_entry_track(pni_entry_t *entry)
 {
   assert(entry);
 
   pni_store_t *store = entry->stream->store;
+  if ((size_t) (store->hwm - store->lwm) == store->capacity && !pni_store_grow(store)) {
+    // too many to track, the oldest become untracked
+    pni_store_untrack(store, store->lwm++);
+  }
   entry->id = store->hwm++;
-  pn_hash_put(store->tracked, entry->id, entry);
+  pn_incref(entry);
+  *pni_store_slot(store, entry->id) = entry;
 
   if (store->window >= 0) {
     while (store->hwm - store->lwm > store->window) {
-      pni_entry_t *e = pni_store_entry(store, store->lwm);
-      if (e) {
-        pn_hash_del(store->tracked, store->lwm);
-      }
-      store->lwm++;
+      pni_store_untrack(store, store->lwm++);
     }
   }
 
@@ -414,13 +601,13 @@ int pni_store_update(pni_store_t *store, pn_sequence_t id, pn_status_t status,
         if (d) {
           pn_delivery_settle(d);
         }
-        pn_hash_del(store->tracked, e->id);
+        pni_entry_retire(e);
+        pni_store_untrack(store, i);
       }
     }
   }
 
-  while (store->hwm - store->lwm > 0 &&
-         !pn_hash_get(store->tracked, store->lwm)) {
+  while (store->hwm - store->lwm > 0 && !*pni_store_slot(store, store->lwm)) {
     store->lwm++;
   }
 
@@ -23,6 +23,7 @@
  */
 
 #include "buffer.h"
+#include "journal.h"
 
 typedef struct pni_store_t pni_store_t;
 typedef struct pni_entry_t pni_entry_t;
@@ -30,17 +31,32 @@ typedef struct pni_entry_t pni_entry_t;
 pni_store_t *pni_store(void);
 void pni_store_free(pni_store_t *store);
 size_t pni_store_size(pni_store_t *store);
-pni_entry_t *pni_store_put(pni_store_t *store, const char *address);
+// entries then put in the journal stay there until they are done with
+void pni_store_set_journal(pni_store_t *store, pni_journal_t *journal);
+// the entries of an address are got higher priorities first, with
+// each priority given a share so the low ones still move
+pni_entry_t *pni_store_put(pni_store_t *store, const char *address, uint8_t priority);
+// the next entry due for an address, or the oldest of all for NULL
 pni_entry_t *pni_store_get(pni_store_t *store, const char *address);
 
 pn_buffer_t *pni_entry_bytes(pni_entry_t *entry);
+// the entry owns encoded.start (a malloc'd block) until it is taken back
+void pni_entry_set_encoded(pni_entry_t *entry, pn_rwbytes_t encoded);
+pn_rwbytes_t pni_entry_take_encoded(pni_entry_t *entry);
 pn_status_t pni_entry_get_status(pni_entry_t *entry);
 void pni_entry_set_status(pni_entry_t *entry, pn_status_t status);
 pn_delivery_t *pni_entry_get_delivery(pni_entry_t *entry);
 void pni_entry_set_delivery(pni_entry_t *entry, pn_delivery_t *delivery);
 void pni_entry_set_context(pni_entry_t *entry, void *context);
 void *pni_entry_get_context(pni_entry_t *entry);
+// the message format of the entry's delivery
+void pni_entry_set_format(pni_entry_t *entry, uint32_t format);
+uint32_t pni_entry_get_format(pni_entry_t *entry);
 void pni_entry_updated(pni_entry_t *entry);
+// put the encoded message in the store's journal, if it has one
+int pni_entry_journal(pni_entry_t *entry);
+// the entry was recovered from the journal as id
+void pni_entry_set_journaled(pni_entry_t *entry, uint64_t id);
 void pni_entry_free(pni_entry_t *entry);
 
 pn_sequence_t pni_entry_track(pni_entry_t *entry);
@@ -126,6 +126,8 @@ int pni_subscription_set_address(pn_subscription_t *sub, const char *address)
 const char *pn_subscription_address(pn_subscription_t *sub)
 {
   assert(sub);
+  // only the shard's own thread may look at the address
+  if (pni_messenger_is_shard(sub->messenger)) return NULL;
   while (!pn_string_get(sub->address)) {
     int err = pni_messenger_work(sub->messenger);
     if (err < 0) {
@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include "transform.h"
+#include "util.h"
 
 typedef struct {
   const char *start;
@@ -39,10 +40,29 @@ typedef struct {
 typedef struct {
   pn_string_t *pattern;
   pn_string_t *substitution;
+  // the literal text every match starts with
+  size_t prefix;
 } pn_rule_t;
 
+// results of recent applications, least recently used first
+#define PNI_TRANSFORM_CACHE_MAX (256)
+
+typedef struct pni_cached_t pni_cached_t;
+
+struct pni_cached_t {
+  pn_string_t *src;
+  pn_string_t *dst;
+  pni_cached_t *lru_next;
+  pni_cached_t *lru_prev;
+  bool matched;
+};
+
 struct pn_transform_t {
   pn_list_t *rules;
+  pn_map_t *cache;
+  pn_string_t *key;
+  pni_cached_t *lru_head;
+  pni_cached_t *lru_tail;
   pn_matcher_t matcher;
   bool matched;
 };
@@ -66,13 +86,42 @@ pn_rule_t *pn_rule(const char *pattern, const char *substitution)
   pn_rule_t *rule = (pn_rule_t *) pn_class_new(&clazz, sizeof(pn_rule_t));
   rule->pattern = pn_string(pattern);
   rule->substitution = pn_string(substitution);
+  rule->prefix = pattern ? strcspn(pattern, "%*") : 0;
   return rule;
 }
 
+static void pni_cached_finalize(void *object)
+{
+  pni_cached_t *cached = (pni_cached_t *) object;
+  pn_free(cached->src);
+  pn_free(cached->dst);
+}
+
+#define CID_pni_cached CID_pn_object
+#define pni_cached_initialize NULL
+#define pni_cached_hashcode NULL
+#define pni_cached_compare NULL
+#define pni_cached_inspect NULL
+
+static pni_cached_t *pni_cached(const char *src, pn_string_t *dst, bool matched)
+{
+  static const pn_class_t clazz = PN_CLASS(pni_cached);
+  pni_cached_t *cached = (pni_cached_t *) pn_class_new(&clazz, sizeof(pni_cached_t));
+  if (!cached) return NULL;
+  cached->src = pn_string(src);
+  cached->dst = pn_string(pn_string_get(dst));
+  cached->lru_next = NULL;
+  cached->lru_prev = NULL;
+  cached->matched = matched;
+  return cached;
+}
+
 static void pn_transform_finalize(void *object)
 {
   pn_transform_t *transform = (pn_transform_t *) object;
   pn_free(transform->rules);
+  pn_free(transform->cache);
+  pn_free(transform->key);
 }
 
 #define CID_pn_transform CID_pn_object
@@ -86,10 +135,23 @@ pn_transform_t *pn_transform()
   static const pn_class_t clazz = PN_CLASS(pn_transform);
   pn_transform_t *transform = (pn_transform_t *) pn_class_new(&clazz, sizeof(pn_transform_t));
   transform->rules = pn_list(PN_OBJECT, 0);
+  transform->cache = pn_map(PN_OBJECT, PN_OBJECT, 0, 0.75);
+  transform->key = pn_string(NULL);
+  transform->lru_head = NULL;
+  transform->lru_tail = NULL;
   transform->matched = false;
   return transform;
 }
 
+static void pni_transform_flush(pn_transform_t *transform)
+{
+  pni_cached_t *cached;
+  while ((cached = LL_HEAD(transform, lru))) {
+    LL_REMOVE(transform, lru, cached);
+    pn_map_del(transform->cache, cached->src);
+  }
+}
+
 void pn_transform_rule(pn_transform_t *transform, const char *pattern,
                        const char *substitution)
 {
@@ -97,6 +159,7 @@ void pn_transform_rule(pn_transform_t *transform, const char *pattern,
   pn_rule_t *rule = pn_rule(pattern, substitution);
   pn_list_add(transform->rules, rule);
   pn_decref(rule);
+  pni_transform_flush(transform);
 }
 
 static void pni_sub(pn_matcher_t *matcher, size_t group, const char *text, size_t matched)
@@ -206,13 +269,16 @@ static size_t pni_substitute(pn_matcher_t *matcher, const char *pattern, char *d
   return result;
 }
 
-int pn_transform_apply(pn_transform_t *transform, const char *src,
-                       pn_string_t *dst)
+static int pni_transform_apply(pn_transform_t *transform, const char *src,
+                               pn_string_t *dst)
 {
+  const char *text = src ? src : "";
   for (size_t i = 0; i < pn_list_size(transform->rules); i++)
   {
     pn_rule_t *rule = (pn_rule_t *) pn_list_get(transform->rules, i);
-    if (pni_match(&transform->matcher, pn_string_get(rule->pattern), src)) {
+    const char *pattern = pn_string_get(rule->pattern);
+    if (strncmp(pattern, text, rule->prefix)) continue;
+    if (pni_match(&transform->matcher, pattern, src)) {
       transform->matched = true;
       if (!pn_string_get(rule->substitution)) {
         return pn_string_set(dst, NULL);
@@ -236,6 +302,40 @@ int pn_transform_apply(pn_transform_t *transform, const char *src,
   return pn_string_set(dst, src);
 }
 
+int pn_transform_apply(pn_transform_t *transform, const char *src,
+                       pn_string_t *dst)
+{
+  if (!src || !pn_list_size(transform->rules)) {
+    return pni_transform_apply(transform, src, dst);
+  }
+
+  pn_string_set(transform->key, src);
+  pni_cached_t *cached = (pni_cached_t *) pn_map_get(transform->cache, transform->key);
+  if (cached) {
+    if (cached != LL_TAIL(transform, lru)) {
+      LL_REMOVE(transform, lru, cached);
+      LL_ADD(transform, lru, cached);
+    }
+    transform->matched = cached->matched;
+    return pn_string_set(dst, pn_string_get(cached->dst));
+  }
+
+  int err = pni_transform_apply(transform, src, dst);
+  if (err) return err;
+
+  cached = pni_cached(src, dst, transform->matched);
+  if (!cached) return 0;
+  pn_map_put(transform->cache, cached->src, cached);
+  pn_decref(cached);
+  LL_ADD(transform, lru, cached);
+  if (pn_map_size(transform->cache) > PNI_TRANSFORM_CACHE_MAX) {
+    pni_cached_t *oldest = LL_HEAD(transform, lru);
+    LL_REMOVE(transform, lru, oldest);
+    pn_map_del(transform->cache, oldest->src);
+  }
+  return 0;
+}
+
 bool pn_transform_matched(pn_transform_t *transform)
 {
   return transform->matched;
@@ -252,3 +352,12 @@ int pn_transform_get_substitutions(pn_transform_t *transform,
 
   return size;
 }
+
+void pn_transform_copy(pn_transform_t *dst, pn_transform_t *src)
+{
+  for (size_t i = 0; i < pn_list_size(src->rules); i++) {
+    pn_rule_t *rule = (pn_rule_t *) pn_list_get(src->rules, i);
+    pn_transform_rule(dst, pn_string_get(rule->pattern),
+                      pn_string_get(rule->substitution));
+  }
+}
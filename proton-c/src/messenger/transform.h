@@ -35,5 +35,7 @@ int pn_transform_apply(pn_transform_t *transform, const char *src,
 bool pn_transform_matched(pn_transform_t *transform);
 int pn_transform_get_substitutions(pn_transform_t *transform,
                                    pn_list_t *substitutions);
+// appends the rules of src to dst
+void pn_transform_copy(pn_transform_t *dst, pn_transform_t *src);
 
 #endif /* transform.h */
@@ -22,6 +22,7 @@
 #include <proton/object.h>
 #include <stdlib.h>
 #include <assert.h>
+#include "alloc_private.h"
 
 struct pn_iterator_t {
   pn_iterator_next_t next;
@@ -40,7 +41,7 @@ static void pn_iterator_initialize(void *object)
 static void pn_iterator_finalize(void *object)
 {
   pn_iterator_t *it = (pn_iterator_t *) object;
-  free(it->state);
+  pni_free(PN_ALLOC_COLLECTION, it->state);
 }
 
 #define CID_pn_iterator CID_pn_object
@@ -61,7 +62,7 @@ void  *pn_iterator_start(pn_iterator_t *iterator, pn_iterator_next_t next,
   assert(next);
   iterator->next = next;
   if (iterator->size < size) {
-    iterator->state = realloc(iterator->state, size);
+    iterator->state = pni_realloc(PN_ALLOC_COLLECTION, iterator->state, size);
   }
   return iterator->state;
 }
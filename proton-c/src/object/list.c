@@ -22,6 +22,7 @@
 #include <proton/object.h>
 #include <stdlib.h>
 #include <assert.h>
+#include "alloc_private.h"
 
 struct pn_list_t {
   const pn_class_t *clazz;
@@ -57,7 +58,8 @@ void pn_list_ensure(pn_list_t *list, size_t capacity)
   if (list->capacity < capacity) {
     size_t newcap = list->capacity;
     while (newcap < capacity) { newcap *= 2; }
-    list->elements = (void **) realloc(list->elements, newcap * sizeof(void *));
+    list->elements =
+      (void **) pni_realloc(PN_ALLOC_COLLECTION, list->elements, newcap * sizeof(void *));
     assert(list->elements);
     list->capacity = newcap;
   }
@@ -204,7 +206,7 @@ static void pn_list_finalize(void *object)
   for (size_t i = 0; i < list->size; i++) {
     pn_class_decref(list->clazz, pn_list_get(list, i));
   }
-  free(list->elements);
+  pni_free(PN_ALLOC_COLLECTION, list->elements);
 }
 
 static uintptr_t pn_list_hashcode(void *object)
@@ -260,14 +262,16 @@ static int pn_list_inspect(void *obj, pn_string_t *dst)
 
 #define pn_list_initialize NULL
 
+PN_POOL(pn_list, 128)
+
 pn_list_t *pn_list(const pn_class_t *clazz, size_t capacity)
 {
-  static const pn_class_t list_clazz = PN_CLASS(pn_list);
+  static const pn_class_t list_clazz = PN_POOLED_CLASS(pn_list);
 
   pn_list_t *list = (pn_list_t *) pn_class_new(&list_clazz, sizeof(pn_list_t));
   list->clazz = clazz;
   list->capacity = capacity ? capacity : 16;
-  list->elements = (void **) malloc(list->capacity * sizeof(void *));
+  list->elements = (void **) pni_malloc(PN_ALLOC_COLLECTION, list->capacity * sizeof(void *));
   list->size = 0;
   return list;
 }
@@ -20,44 +20,55 @@
  */
 
 #include <proton/object.h>
+#include <proton/error.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include "alloc_private.h"
 
-#define PNI_ENTRY_FREE (0)
-#define PNI_ENTRY_LINK (1)
-#define PNI_ENTRY_TAIL (2)
+// An open addressing table with linear probing. Alongside the entries is
+// a control byte per slot, holding either the low 7 bits of the key's
+// hash or a marker, so a probe only looks at a key whose hash is likely
+// to match. Deleted slots are left as tombstones rather than moving
+// other entries, so deleting while iterating is safe.
+#define PNI_CTRL_EMPTY (0x80)
+#define PNI_CTRL_DELETED (0xFE)
 
 typedef struct {
   void *key;
   void *value;
-  size_t next;
-  uint8_t state;
 } pni_entry_t;
 
 struct pn_map_t {
   const pn_class_t *key;
   const pn_class_t *value;
   pni_entry_t *entries;
-  size_t capacity;
-  size_t addressable;
+  uint8_t *ctrl;
+  size_t capacity;   // always a power of two
   size_t size;
+  size_t deleted;
   uintptr_t (*hashcode)(void *key);
   bool (*equals)(void *a, void *b);
   float load_factor;
 };
 
+static inline bool pni_ctrl_full(uint8_t ctrl)
+{
+  return !(ctrl & 0x80);
+}
+
 static void pn_map_finalize(void *object)
 {
   pn_map_t *map = (pn_map_t *) object;
 
   for (size_t i = 0; i < map->capacity; i++) {
-    if (map->entries[i].state != PNI_ENTRY_FREE) {
+    if (pni_ctrl_full(map->ctrl[i])) {
       pn_class_decref(map->key, map->entries[i].key);
       pn_class_decref(map->value, map->entries[i].value);
     }
   }
 
-  free(map->entries);
+  pni_free(PN_ALLOC_COLLECTION, map->entries);
 }
 
 static uintptr_t pn_map_hashcode(void *object)
@@ -67,7 +78,7 @@ static uintptr_t pn_map_hashcode(void *object)
   uintptr_t hashcode = 0;
 
   for (size_t i = 0; i < map->capacity; i++) {
-    if (map->entries[i].state != PNI_ENTRY_FREE) {
+    if (pni_ctrl_full(map->ctrl[i])) {
       void *key = map->entries[i].key;
       void *value = map->entries[i].value;
       hashcode += pn_hashcode(key) ^ pn_hashcode(value);
@@ -77,16 +88,19 @@ static uintptr_t pn_map_hashcode(void *object)
   return hashcode;
 }
 
-static void pni_map_allocate(pn_map_t *map)
+// the entries and their control bytes share one allocation
+static bool pni_map_allocate(pn_map_t *map, size_t capacity)
 {
-  map->entries = (pni_entry_t *) malloc(map->capacity * sizeof (pni_entry_t));
-  for (size_t i = 0; i < map->capacity; i++) {
-    map->entries[i].key = NULL;
-    map->entries[i].value = NULL;
-    map->entries[i].next = 0;
-    map->entries[i].state = PNI_ENTRY_FREE;
-  }
+  pni_entry_t *entries =
+    (pni_entry_t *) pni_malloc(PN_ALLOC_COLLECTION, capacity * (sizeof(pni_entry_t) + 1));
+  if (!entries) return false;
+  map->entries = entries;
+  map->ctrl = (uint8_t *) (entries + capacity);
+  memset(map->ctrl, PNI_CTRL_EMPTY, capacity);
+  map->capacity = capacity;
   map->size = 0;
+  map->deleted = 0;
+  return true;
 }
 
 static int pn_map_inspect(void *obj, pn_string_t *dst)
@@ -118,21 +132,28 @@ static int pn_map_inspect(void *obj, pn_string_t *dst)
 #define pn_map_initialize NULL
 #define pn_map_compare NULL
 
+PN_POOL(pn_map, 128)
+
 pn_map_t *pn_map(const pn_class_t *key, const pn_class_t *value,
                  size_t capacity, float load_factor)
 {
-  static const pn_class_t clazz = PN_CLASS(pn_map);
+  static const pn_class_t clazz = PN_POOLED_CLASS(pn_map);
 
   pn_map_t *map = (pn_map_t *) pn_class_new(&clazz, sizeof(pn_map_t));
   map->key = key;
   map->value = value;
-  map->capacity = capacity ? capacity : 16;
-  map->addressable = (size_t) (map->capacity * 0.86);
-  if (!map->addressable) map->addressable = map->capacity;
+  // a probe always ends at an empty slot, so one must remain
+  if (!(load_factor > 0 && load_factor < 0.9)) load_factor = 0.875;
   map->load_factor = load_factor;
   map->hashcode = pn_hashcode;
   map->equals = pn_equals;
-  pni_map_allocate(map);
+  size_t slots = 8;
+  while (slots < (capacity ? capacity : 16) / load_factor) slots *= 2;
+  if (!pni_map_allocate(map, slots)) {
+    map->entries = NULL;
+    map->ctrl = NULL;
+    map->capacity = 0;
+  }
   return map;
 }
 
@@ -142,113 +163,99 @@ size_t pn_map_size(pn_map_t *map)
   return map->size;
 }
 
-static float pni_map_load(pn_map_t *map)
+// spreads the hash over all its bits, since identity hashes of small
+// ints and pointers vary only in a few
+static inline uintptr_t pni_map_mix(uintptr_t hash)
 {
-  return ((float) map->size) / ((float) map->addressable);
+#if UINTPTR_MAX > 0xFFFFFFFF
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+#else
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bU;
+  hash ^= hash >> 13;
+#endif
+  return hash;
 }
 
-static bool pni_map_ensure(pn_map_t *map, size_t capacity)
+// the slot holding key, or if there is none and slot is not NULL, the
+// first slot key could be inserted into
+static pni_entry_t *pni_map_find(pn_map_t *map, void *key, uintptr_t hash, size_t *slot)
 {
-  float load = pni_map_load(map);
-  if (capacity <= map->capacity && load <= map->load_factor) {
-    return false;
+  if (!map->capacity) return NULL;
+  size_t mask = map->capacity - 1;
+  uint8_t tag = hash & 0x7F;
+  size_t i = (hash >> 7) & mask;
+  size_t insert = map->capacity;
+  while (true) {
+    uint8_t ctrl = map->ctrl[i];
+    if (ctrl == tag && map->equals(map->entries[i].key, key)) {
+      return &map->entries[i];
+    } else if (ctrl == PNI_CTRL_EMPTY) {
+      if (slot) *slot = insert == map->capacity ? i : insert;
+      return NULL;
+    } else if (ctrl == PNI_CTRL_DELETED && insert == map->capacity) {
+      insert = i;
+    }
+    i = (i + 1) & mask;
   }
+}
 
-  size_t oldcap = map->capacity;
-
-  while (map->capacity < capacity || pni_map_load(map) > map->load_factor) {
-    map->capacity *= 2;
-    map->addressable = (size_t) (0.86 * map->capacity);
-  }
+// rebuilds the table, growing it if it is too full of live entries
+// rather than of tombstones
+static bool pni_map_rehash(pn_map_t *map)
+{
+  size_t capacity = map->capacity ? map->capacity : 8;
+  while (map->size + 1 > capacity * map->load_factor / 2) capacity *= 2;
 
   pni_entry_t *entries = map->entries;
-  pni_map_allocate(map);
-
-  for (size_t i = 0; i < oldcap; i++) {
-    if (entries[i].state != PNI_ENTRY_FREE) {
-      void *key = entries[i].key;
-      void *value = entries[i].value;
-      pn_map_put(map, key, value);
-    }
+  uint8_t *ctrl = map->ctrl;
+  size_t oldcap = map->capacity;
+  size_t size = map->size;
+  if (!pni_map_allocate(map, capacity)) {
+    map->entries = entries;
+    map->ctrl = ctrl;
+    return false;
   }
 
   for (size_t i = 0; i < oldcap; i++) {
-    if (entries[i].state != PNI_ENTRY_FREE) {
-      void *key = entries[i].key;
-      void *value = entries[i].value;
-      pn_class_decref(map->key, key);
-      pn_class_decref(map->value, value);
+    if (pni_ctrl_full(ctrl[i])) {
+      uintptr_t hash = pni_map_mix(map->hashcode(entries[i].key));
+      size_t slot;
+      pni_map_find(map, entries[i].key, hash, &slot);
+      map->ctrl[slot] = hash & 0x7F;
+      map->entries[slot] = entries[i];
     }
   }
+  map->size = size;
 
-  free(entries);
+  pni_free(PN_ALLOC_COLLECTION, entries);
   return true;
 }
 
-static pni_entry_t *pni_map_entry(pn_map_t *map, void *key, pni_entry_t **pprev, bool create)
+int pn_map_put(pn_map_t *map, void *key, void *value)
 {
-  uintptr_t hashcode = map->hashcode(key);
-
-  pni_entry_t *entry = &map->entries[hashcode % map->addressable];
-  pni_entry_t *prev = NULL;
-
-  if (entry->state == PNI_ENTRY_FREE) {
-    if (create) {
-      entry->state = PNI_ENTRY_TAIL;
-      entry->key = key;
-      pn_class_incref(map->key, key);
-      map->size++;
-      return entry;
-    } else {
-      return NULL;
-    }
-  }
-
-  while (true) {
-    if (map->equals(entry->key, key)) {
-      if (pprev) *pprev = prev;
-      return entry;
-    }
-
-    if (entry->state == PNI_ENTRY_TAIL) {
-      break;
-    } else {
-      prev = entry;
-      entry = &map->entries[entry->next];
-    }
-  }
-
-  if (create) {
-    if (pni_map_ensure(map, map->size + 1)) {
-      // if we had to grow the table we need to start over
-      return pni_map_entry(map, key, pprev, create);
-    }
-
-    size_t empty = 0;
-    for (size_t i = 0; i < map->capacity; i++) {
-      size_t idx = map->capacity - i - 1;
-      if (map->entries[idx].state == PNI_ENTRY_FREE) {
-        empty = idx;
-        break;
-      }
+  assert(map);
+  uintptr_t hash = pni_map_mix(map->hashcode(key));
+  size_t slot = 0;
+  pni_entry_t *entry = pni_map_find(map, key, hash, &slot);
+  if (!entry) {
+    // only filling an empty slot brings the next probe's end closer
+    if (!map->capacity ||
+        (map->ctrl[slot] == PNI_CTRL_EMPTY &&
+         map->size + map->deleted + 1 > map->capacity * map->load_factor)) {
+      if (!pni_map_rehash(map)) return PN_ERR;
+      pni_map_find(map, key, hash, &slot);
     }
-    entry->next = empty;
-    entry->state = PNI_ENTRY_LINK;
-    map->entries[empty].state = PNI_ENTRY_TAIL;
-    map->entries[empty].key = key;
+    if (map->ctrl[slot] == PNI_CTRL_DELETED) map->deleted--;
+    map->ctrl[slot] = hash & 0x7F;
+    entry = &map->entries[slot];
+    entry->key = key;
+    entry->value = NULL;
     pn_class_incref(map->key, key);
-    if (pprev) *pprev = entry;
     map->size++;
-    return &map->entries[empty];
-  } else {
-    return NULL;
   }
-}
-
-int pn_map_put(pn_map_t *map, void *key, void *value)
-{
-  assert(map);
-  pni_entry_t *entry = pni_map_entry(map, key, NULL, true);
   void *dref_val = entry->value;
   entry->value = value;
   pn_class_incref(map->value, value);
@@ -259,29 +266,26 @@ int pn_map_put(pn_map_t *map, void *key, void *value)
 void *pn_map_get(pn_map_t *map, void *key)
 {
   assert(map);
-  pni_entry_t *entry = pni_map_entry(map, key, NULL, false);
+  pni_entry_t *entry = pni_map_find(map, key, pni_map_mix(map->hashcode(key)), NULL);
   return entry ? entry->value : NULL;
 }
 
 void pn_map_del(pn_map_t *map, void *key)
 {
   assert(map);
-  pni_entry_t *prev = NULL;
-  pni_entry_t *entry = pni_map_entry(map, key, &prev, false);
+  pni_entry_t *entry = pni_map_find(map, key, pni_map_mix(map->hashcode(key)), NULL);
   if (entry) {
+    size_t i = entry - map->entries;
     void *dref_key = entry->key;
     void *dref_value = entry->value;
-    if (prev) {
-      prev->next = entry->next;
-      prev->state = entry->state;
-    } else if (entry->next) {
-      assert(entry->state == PNI_ENTRY_LINK);
-      pni_entry_t *next = &map->entries[entry->next];
-      *entry = *next;
-      entry = next;
+    // no probe continues past an empty slot, so a slot just before
+    // one can be emptied rather than left as a tombstone
+    if (map->ctrl[(i + 1) & (map->capacity - 1)] == PNI_CTRL_EMPTY) {
+      map->ctrl[i] = PNI_CTRL_EMPTY;
+    } else {
+      map->ctrl[i] = PNI_CTRL_DELETED;
+      map->deleted++;
     }
-    entry->state = PNI_ENTRY_FREE;
-    entry->next = 0;
     entry->key = NULL;
     entry->value = NULL;
     map->size--;
@@ -295,7 +299,7 @@ pn_handle_t pn_map_head(pn_map_t *map)
   assert(map);
   for (size_t i = 0; i < map->capacity; i++)
   {
-    if (map->entries[i].state != PNI_ENTRY_FREE) {
+    if (pni_ctrl_full(map->ctrl[i])) {
       return i + 1;
     }
   }
@@ -306,7 +310,7 @@ pn_handle_t pn_map_head(pn_map_t *map)
 pn_handle_t pn_map_next(pn_map_t *map, pn_handle_t entry)
 {
   for (size_t i = entry; i < map->capacity; i++) {
-    if (map->entries[i].state != PNI_ENTRY_FREE) {
+    if (pni_ctrl_full(map->ctrl[i])) {
       return i + 1;
     }
   }
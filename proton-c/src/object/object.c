@@ -23,6 +23,9 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#include "thread.h"
+#include "alloc_private.h"
+
 #define pn_object_initialize NULL
 #define pn_object_finalize NULL
 #define pn_object_inspect NULL
@@ -33,12 +36,15 @@ const pn_class_t PNI_OBJECT = PN_CLASS(pn_object);
 const pn_class_t *PN_OBJECT = &PNI_OBJECT;
 
 #define pn_void_initialize NULL
-static void *pn_void_new(const pn_class_t *clazz, size_t size) { return malloc(size); }
+static void *pn_void_new(const pn_class_t *clazz, size_t size)
+{
+  return pni_malloc(PN_ALLOC_OBJECT, size);
+}
 static void pn_void_incref(void *object) {}
 static void pn_void_decref(void *object) {}
 static int pn_void_refcount(void *object) { return -1; }
 #define pn_void_finalize NULL
-static void pn_void_free(void *object) { free(object); }
+static void pn_void_free(void *object) { pni_free(PN_ALLOC_OBJECT, object); }
 static const pn_class_t *pn_void_reify(void *object) { return PN_VOID; }
 uintptr_t pn_void_hashcode(void *object) { return (uintptr_t) object; }
 intptr_t pn_void_compare(void *a, void *b) { return (intptr_t) a - (intptr_t) b; }
@@ -47,6 +53,38 @@ int pn_void_inspect(void *object, pn_string_t *dst) { return pn_string_addf(dst,
 const pn_class_t PNI_VOID = PN_METACLASS(pn_void);
 const pn_class_t *PN_VOID = &PNI_VOID;
 
+typedef struct {
+  const pn_class_t *clazz;
+  int refcount;
+  bool shared;  // refcount is changed atomically
+  bool pooled;  // the memory can go back to the class's pool
+} pni_head_t;
+
+#define pni_head(PTR) \
+  (((pni_head_t *) (PTR)) - 1)
+
+// whether the class counts references in the object header
+#define pni_counted(CLAZZ) \
+  ((CLAZZ)->incref == pn_object_incref && (CLAZZ)->decref == pn_object_decref && \
+   (CLAZZ)->refcount == pn_object_refcount)
+
+// the header of an object made by pn_object_new whose class counts
+// references in it, otherwise NULL. Either way clazz is reified.
+static inline pni_head_t *pni_counted_head(const pn_class_t **clazz, void *object)
+{
+  const pn_class_t *reified = *clazz;
+  if (reified->reify != pn_object_reify) {
+    reified = reified->reify(object);
+    if (reified->reify != pn_object_reify) {
+      *clazz = reified;
+      return NULL;
+    }
+  }
+  pni_head_t *head = pni_head(object);
+  *clazz = head->clazz;
+  return pni_counted(head->clazz) ? head : NULL;
+}
+
 const char *pn_class_name(const pn_class_t *clazz)
 {
   return clazz->name;
@@ -71,8 +109,14 @@ void *pn_class_incref(const pn_class_t *clazz, void *object)
 {
   assert(clazz);
   if (object) {
-    clazz = clazz->reify(object);
-    clazz->incref(object);
+    pni_head_t *head = pni_counted_head(&clazz, object);
+    if (!head) {
+      clazz->incref(object);
+    } else if (head->shared) {
+      pni_atomic_add(&head->refcount, 1);
+    } else {
+      head->refcount++;
+    }
   }
   return object;
 }
@@ -80,7 +124,14 @@ void *pn_class_incref(const pn_class_t *clazz, void *object)
 int pn_class_refcount(const pn_class_t *clazz, void *object)
 {
   assert(clazz);
-  clazz = clazz->reify(object);
+  if (object) {
+    pni_head_t *head = pni_counted_head(&clazz, object);
+    if (head) {
+      return head->shared ? pni_atomic_add(&head->refcount, 0) : head->refcount;
+    }
+  } else {
+    clazz = clazz->reify(object);
+  }
   return clazz->refcount(object);
 }
 
@@ -89,7 +140,21 @@ int pn_class_decref(const pn_class_t *clazz, void *object)
   assert(clazz);
 
   if (object) {
-    clazz = clazz->reify(object);
+    pni_head_t *head = pni_counted_head(&clazz, object);
+    if (head) {
+      int rc = head->shared ? pni_atomic_add(&head->refcount, -1) : --head->refcount;
+      assert(rc >= 0);
+      if (rc > 0) return rc;
+      if (clazz->finalize) {
+        clazz->finalize(object);
+        // check the refcount again in case the finalizer created a
+        // new reference
+        if (pn_class_refcount(clazz, object)) return 0;
+      }
+      clazz->free(object);
+      return 0;
+    }
+
     clazz->decref(object);
     int rc = clazz->refcount(object);
     if (rc == 0) {
@@ -190,20 +255,15 @@ int pn_class_inspect(const pn_class_t *clazz, void *object, pn_string_t *dst)
   return pn_string_addf(dst, "%s<%p>", name, object);
 }
 
-typedef struct {
-  const pn_class_t *clazz;
-  int refcount;
-} pni_head_t;
-
-#define pni_head(PTR) \
-  (((pni_head_t *) (PTR)) - 1)
-
 void *pn_object_new(const pn_class_t *clazz, size_t size)
 {
-  pni_head_t *head = (pni_head_t *) malloc(sizeof(pni_head_t) + size);
+  pni_head_t *head = (pni_head_t *) pni_malloc(pni_alloc_subsystem(clazz),
+                                               sizeof(pni_head_t) + size);
   void *object = head + 1;
   head->clazz = clazz;
   head->refcount = 1;
+  head->shared = false;
+  head->pooled = false;
   return object;
 }
 
@@ -219,27 +279,202 @@ const pn_class_t *pn_object_reify(void *object)
 void pn_object_incref(void *object)
 {
   if (object) {
-    pni_head(object)->refcount++;
+    pni_head_t *head = pni_head(object);
+    if (head->shared) {
+      pni_atomic_add(&head->refcount, 1);
+    } else {
+      head->refcount++;
+    }
   }
 }
 
 int pn_object_refcount(void *object)
 {
   assert(object);
-  return pni_head(object)->refcount;
+  pni_head_t *head = pni_head(object);
+  return head->shared ? pni_atomic_add(&head->refcount, 0) : head->refcount;
 }
 
 void pn_object_decref(void *object)
 {
   pni_head_t *head = pni_head(object);
-  assert(head->refcount > 0);
-  head->refcount--;
+  int rc = head->shared ? pni_atomic_add(&head->refcount, -1) : --head->refcount;
+  assert(rc >= 0);
+  (void) rc;
 }
 
 void pn_object_free(void *object)
 {
   pni_head_t *head = pni_head(object);
-  free(head);
+  pni_free(pni_alloc_subsystem(head->clazz), head);
+}
+
+struct pn_pool_t {
+  const pn_class_t *clazz;
+  pn_pool_t *next;        // in the list of all pools
+  void *volatile lock;
+  void *cached;           // linked through their first word
+  size_t count;
+  size_t size;            // only instances of this size are pooled
+  size_t high_water;
+  size_t hits;
+  size_t misses;
+};
+
+static void *volatile pni_pools = NULL;
+
+// the critical sections are a few pointer updates, spinning is
+// cheaper than a mutex and needs no initialization
+static void pni_pool_lock(pn_pool_t *pool)
+{
+  while (pni_atomic_exchange(&pool->lock, pool)) {}
+}
+
+static void pni_pool_unlock(pn_pool_t *pool)
+{
+  pni_atomic_exchange(&pool->lock, NULL);
+}
+
+static pn_pool_t *pni_pool(pn_pool_t **pool, size_t high_water, const pn_class_t *clazz, size_t size)
+{
+  pn_pool_t *made = (pn_pool_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pn_pool_t));
+  if (!made) return NULL;
+  made->clazz = clazz;
+  made->lock = NULL;
+  made->cached = NULL;
+  made->count = 0;
+  made->size = size;
+  made->high_water = high_water;
+  made->hits = 0;
+  made->misses = 0;
+  // another thread may have made the pool first
+  if (!pni_atomic_cas((void *volatile *) pool, NULL, made)) {
+    pni_free(PN_ALLOC_OBJECT, made);
+    return (pn_pool_t *) pni_atomic_load((void *volatile *) pool);
+  }
+  void *next;
+  do {
+    next = pni_atomic_load(&pni_pools);
+    made->next = (pn_pool_t *) next;
+  } while (!pni_atomic_cas(&pni_pools, next, made));
+  return made;
+}
+
+void *pn_pool_alloc(pn_pool_t **pool, size_t high_water, const pn_class_t *clazz, size_t size)
+{
+  pn_pool_t *p = (pn_pool_t *) pni_atomic_load((void *volatile *) pool);
+  if (!p) p = pni_pool(pool, high_water, clazz, size);
+  if (!p || p->size != size) {
+    return pn_object_new(clazz, size);
+  }
+
+  pni_pool_lock(p);
+  pni_head_t *head = (pni_head_t *) p->cached;
+  if (head) {
+    p->cached = *(void **) (head + 1);
+    p->count--;
+    p->hits++;
+  } else {
+    p->misses++;
+  }
+  pni_pool_unlock(p);
+
+  if (!head) {
+    // room for the freelist link, even in an empty instance
+    size_t room = size < sizeof(void *) ? sizeof(void *) : size;
+    head = (pni_head_t *) pni_malloc(pni_alloc_subsystem(clazz),
+                                     sizeof(pni_head_t) + room);
+    if (!head) return NULL;
+  }
+  head->clazz = clazz;
+  head->refcount = 1;
+  head->shared = false;
+  head->pooled = true;
+  return head + 1;
+}
+
+void pn_pool_release(pn_pool_t *pool, void *object)
+{
+  pni_head_t *head = pni_head(object);
+  if (head->pooled) {
+    assert(pool);
+    pni_pool_lock(pool);
+    bool keep = pool->count < pool->high_water;
+    if (keep) {
+      *(void **) object = pool->cached;
+      pool->cached = head;
+      pool->count++;
+    }
+    pni_pool_unlock(pool);
+    if (keep) return;
+  }
+  pni_free(pni_alloc_subsystem(head->clazz), head);
+}
+
+pn_pool_t *pn_class_pool(const pn_class_t *clazz)
+{
+  pn_pool_t *pool = (pn_pool_t *) pni_atomic_load(&pni_pools);
+  while (pool && pool->clazz != clazz) {
+    pool = pool->next;
+  }
+  return pool;
+}
+
+size_t pn_pool_high_water(pn_pool_t *pool)
+{
+  assert(pool);
+  pni_pool_lock(pool);
+  size_t high_water = pool->high_water;
+  pni_pool_unlock(pool);
+  return high_water;
+}
+
+void pn_pool_set_high_water(pn_pool_t *pool, size_t high_water)
+{
+  assert(pool);
+  void *trimmed = NULL;
+  pni_pool_lock(pool);
+  pool->high_water = high_water;
+  while (pool->count > high_water) {
+    pni_head_t *head = (pni_head_t *) pool->cached;
+    pool->cached = *(void **) (head + 1);
+    pool->count--;
+    *(void **) (head + 1) = trimmed;
+    trimmed = head;
+  }
+  pni_pool_unlock(pool);
+  while (trimmed) {
+    pni_head_t *head = (pni_head_t *) trimmed;
+    trimmed = *(void **) (head + 1);
+    pni_free(pni_alloc_subsystem(head->clazz), head);
+  }
+}
+
+size_t pn_pool_cached(pn_pool_t *pool)
+{
+  assert(pool);
+  pni_pool_lock(pool);
+  size_t count = pool->count;
+  pni_pool_unlock(pool);
+  return count;
+}
+
+size_t pn_pool_hits(pn_pool_t *pool)
+{
+  assert(pool);
+  pni_pool_lock(pool);
+  size_t hits = pool->hits;
+  pni_pool_unlock(pool);
+  return hits;
+}
+
+size_t pn_pool_misses(pn_pool_t *pool)
+{
+  assert(pool);
+  pni_pool_lock(pool);
+  size_t misses = pool->misses;
+  pni_pool_unlock(pool);
+  return misses;
 }
 
 void *pn_incref(void *object)
@@ -257,6 +492,20 @@ int pn_refcount(void *object)
   return pn_class_refcount(PN_OBJECT, object);
 }
 
+void *pn_share(void *object)
+{
+  if (object) {
+    pni_head_t *head = pni_head(object);
+    if (pni_counted(head->clazz)) head->shared = true;
+  }
+  return object;
+}
+
+bool pn_shared(void *object)
+{
+  return object && pni_head(object)->shared;
+}
+
 void pn_free(void *object)
 {
   pn_class_free(PN_OBJECT, object);
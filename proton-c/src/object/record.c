@@ -23,6 +23,9 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#include "record.h"
+#include "alloc_private.h"
+
 typedef struct {
   pn_handle_t key;
   const pn_class_t *clazz;
@@ -30,6 +33,7 @@ typedef struct {
 } pni_field_t;
 
 struct pn_record_t {
+  pni_field_t slots[PNI_RECORD_SLOTS];
   size_t size;
   size_t capacity;
   pni_field_t *fields;
@@ -38,6 +42,11 @@ struct pn_record_t {
 static void pn_record_initialize(void *object)
 {
   pn_record_t *record = (pn_record_t *) object;
+  for (size_t i = 0; i < PNI_RECORD_SLOTS; i++) {
+    record->slots[i].key = i;
+    record->slots[i].clazz = NULL;
+    record->slots[i].value = NULL;
+  }
   record->size = 0;
   record->capacity = 0;
   record->fields = NULL;
@@ -46,26 +55,37 @@ static void pn_record_initialize(void *object)
 static void pn_record_finalize(void *object)
 {
   pn_record_t *record = (pn_record_t *) object;
+  for (size_t i = 0; i < PNI_RECORD_SLOTS; i++) {
+    pni_field_t *v = &record->slots[i];
+    if (v->clazz) pn_class_decref(v->clazz, v->value);
+  }
   for (size_t i = 0; i < record->size; i++) {
     pni_field_t *v = &record->fields[i];
     pn_class_decref(v->clazz, v->value);
   }
-  free(record->fields);
+  pni_free(PN_ALLOC_RECORD, record->fields);
 }
 
 #define pn_record_hashcode NULL
 #define pn_record_compare NULL
 #define pn_record_inspect NULL
 
+PN_POOL(pn_record, 64)
+
 pn_record_t *pn_record(void)
 {
-  static const pn_class_t clazz = PN_CLASS(pn_record);
+  static const pn_class_t clazz = PN_POOLED_CLASS(pn_record);
   pn_record_t *record = (pn_record_t *) pn_class_new(&clazz, sizeof(pn_record_t));
   pn_record_def(record, PN_LEGCTX, PN_VOID);
   return record;
 }
 
+// a slot is defined once it has a class
 static pni_field_t *pni_record_find(pn_record_t *record, pn_handle_t key) {
+  if (key < PNI_RECORD_SLOTS) {
+    pni_field_t *field = &record->slots[key];
+    return field->clazz ? field : NULL;
+  }
   for (size_t i = 0; i < record->size; i++) {
     pni_field_t *field = &record->fields[i];
     if (field->key == key) {
@@ -78,7 +98,8 @@ static pni_field_t *pni_record_find(pn_record_t *record, pn_handle_t key) {
 static pni_field_t *pni_record_create(pn_record_t *record) {
   record->size++;
   if (record->size > record->capacity) {
-    record->fields = (pni_field_t *) realloc(record->fields, record->size * sizeof(pni_field_t));
+    record->fields = (pni_field_t *) pni_realloc(PN_ALLOC_RECORD, record->fields,
+                                                 record->size * sizeof(pni_field_t));
     record->capacity = record->size;
   }
   pni_field_t *field = &record->fields[record->size - 1];
@@ -96,6 +117,8 @@ void pn_record_def(pn_record_t *record, pn_handle_t key, const pn_class_t *clazz
   pni_field_t *field = pni_record_find(record, key);
   if (field) {
     assert(field->clazz == clazz);
+  } else if (key < PNI_RECORD_SLOTS) {
+    record->slots[key].clazz = clazz;
   } else {
     field = pni_record_create(record);
     field->key = key;
@@ -141,6 +164,12 @@ void pn_record_set(pn_record_t *record, pn_handle_t key, void *value)
 void pn_record_clear(pn_record_t *record)
 {
   assert(record);
+  for (size_t i = 0; i < PNI_RECORD_SLOTS; i++) {
+    pni_field_t *field = &record->slots[i];
+    if (field->clazz) pn_class_decref(field->clazz, field->value);
+    field->clazz = NULL;
+    field->value = NULL;
+  }
   for (size_t i = 0; i < record->size; i++) {
     pni_field_t *field = &record->fields[i];
     pn_class_decref(field->clazz, field->value);
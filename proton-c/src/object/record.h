@@ -0,0 +1,34 @@
+#ifndef _PROTON_SRC_RECORD_H
+#define _PROTON_SRC_RECORD_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/object.h>
+
+// Keys looked up on every event are small integers rather than the
+// address of a PN_HANDLE, so a record can keep them in fixed slots
+// instead of searching its fields. PN_LEGCTX is slot zero.
+#define PNI_RECORD_HANDLER ((pn_handle_t) 1)
+#define PNI_RECORD_REACTOR ((pn_handle_t) 2)
+#define PNI_RECORD_SLOTS (3)
+
+#endif /* src/record.h */
@@ -29,19 +29,25 @@
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
+#include "alloc_private.h"
 
 #define PNI_NULL_SIZE (-1)
+// short strings, including their terminator, are kept in the object
+#define PNI_INLINE_SIZE (24)
 
 struct pn_string_t {
   char *bytes;
   ssize_t size;       // PNI_NULL_SIZE (-1) means null
   size_t capacity;
+  char inline_bytes[PNI_INLINE_SIZE];
 };
 
 static void pn_string_finalize(void *object)
 {
   pn_string_t *string = (pn_string_t *) object;
-  free(string->bytes);
+  if (string->bytes != string->inline_bytes) {
+    pni_free(PN_ALLOC_STRING, string->bytes);
+  }
 }
 
 static uintptr_t pn_string_hashcode(void *object)
@@ -104,12 +110,14 @@ pn_string_t *pn_string(const char *bytes)
 #define pn_string_initialize NULL
 
 
+PN_POOL(pn_string, 256)
+
 pn_string_t *pn_stringn(const char *bytes, size_t n)
 {
-  static const pn_class_t clazz = PN_CLASS(pn_string);
+  static const pn_class_t clazz = PN_POOLED_CLASS(pn_string);
   pn_string_t *string = (pn_string_t *) pn_class_new(&clazz, sizeof(pn_string_t));
-  string->capacity = n ? n * sizeof(char) : 16;
-  string->bytes = (char *) malloc(string->capacity);
+  string->bytes = string->inline_bytes;
+  string->capacity = PNI_INLINE_SIZE;
   pn_string_setn(string, bytes, n);
   return string;
 }
@@ -141,16 +149,22 @@ int pn_string_set(pn_string_t *string, const char *bytes)
 
 int pn_string_grow(pn_string_t *string, size_t capacity)
 {
-  bool grow = false;
-  while (string->capacity < (capacity*sizeof(char) + 1)) {
-    string->capacity *= 2;
-    grow = true;
+  size_t grown = string->capacity;
+  while (grown < (capacity*sizeof(char) + 1)) {
+    grown *= 2;
   }
 
-  if (grow) {
-    char *growed = (char *) realloc(string->bytes, string->capacity);
+  if (grown != string->capacity) {
+    char *growed;
+    if (string->bytes == string->inline_bytes) {
+      growed = (char *) pni_malloc(PN_ALLOC_STRING, grown);
+      if (growed) memcpy(growed, string->inline_bytes, PNI_INLINE_SIZE);
+    } else {
+      growed = (char *) pni_realloc(PN_ALLOC_STRING, string->bytes, grown);
+    }
     if (growed) {
       string->bytes = growed;
+      string->capacity = grown;
     } else {
       return PN_ERR;
     }
@@ -0,0 +1,114 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/error.h>
+#include <proton/object.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "symtab.h"
+
+// the table is only swept once it holds this many strings
+#define PNI_SYMTAB_SWEEP (64)
+
+struct pni_symtab_t {
+  pn_map_t *strings;    // each interned string maps to itself
+  pn_string_t *key;     // for lookups
+  size_t sweep;         // the size at which to drop unused strings
+};
+
+static void pni_symtab_initialize(void *object)
+{
+  pni_symtab_t *symtab = (pni_symtab_t *) object;
+  symtab->strings = pn_map(PN_OBJECT, PN_WEAKREF, 0, 0.75);
+  symtab->key = pn_string(NULL);
+  symtab->sweep = PNI_SYMTAB_SWEEP;
+}
+
+static void pni_symtab_finalize(void *object)
+{
+  pni_symtab_t *symtab = (pni_symtab_t *) object;
+  pn_free(symtab->strings);
+  pn_free(symtab->key);
+}
+
+#define CID_pni_symtab CID_pn_object
+#define pni_symtab_hashcode NULL
+#define pni_symtab_compare NULL
+#define pni_symtab_inspect NULL
+
+pni_symtab_t *pni_symtab(void)
+{
+  static const pn_class_t clazz = PN_CLASS(pni_symtab);
+  return (pni_symtab_t *) pn_class_new(&clazz, sizeof(pni_symtab_t));
+}
+
+pn_string_t *pni_interned(pni_symtab_t *symtab, pn_bytes_t bytes)
+{
+  if (!symtab || !bytes.start) return NULL;
+  pn_string_setn(symtab->key, bytes.start, bytes.size);
+  return (pn_string_t *) pn_map_get(symtab->strings, symtab->key);
+}
+
+// drop the strings only the table references
+static void pni_symtab_sweep(pni_symtab_t *symtab)
+{
+  pn_map_t *strings = symtab->strings;
+  for (pn_handle_t entry = pn_map_head(strings); entry; entry = pn_map_next(strings, entry)) {
+    pn_string_t *string = (pn_string_t *) pn_map_key(strings, entry);
+    if (pn_refcount(string) == 1) {
+      pn_map_del(strings, string);
+    }
+  }
+  size_t size = pn_map_size(strings);
+  symtab->sweep = size < PNI_SYMTAB_SWEEP ? PNI_SYMTAB_SWEEP : 2*size;
+}
+
+pn_string_t *pni_intern(pni_symtab_t *symtab, pn_bytes_t bytes)
+{
+  if (!symtab || !bytes.start) {
+    return pn_stringn(bytes.start, bytes.size);
+  }
+
+  pn_string_t *string = pni_interned(symtab, bytes);
+  if (string) {
+    return (pn_string_t *) pn_incref(string);
+  }
+
+  if (pn_map_size(symtab->strings) >= symtab->sweep) {
+    pni_symtab_sweep(symtab);
+  }
+  string = pn_stringn(bytes.start, bytes.size);
+  pn_map_put(symtab->strings, string, string);
+  return string;
+}
+
+int pni_unshare(pn_string_t **string)
+{
+  assert(string);
+  if (*string && pn_refcount(*string) > 1) {
+    pn_string_t *own = pn_string(NULL);
+    if (!own) return PN_ERR;
+    pn_decref(*string);
+    *string = own;
+  }
+  return 0;
+}
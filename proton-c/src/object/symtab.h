@@ -0,0 +1,52 @@
+#ifndef _PROTON_SRC_SYMTAB_H
+#define _PROTON_SRC_SYMTAB_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/object.h>
+#include <proton/types.h>
+
+/*
+ * A table of interned strings, for the symbols and names a connection
+ * sees over and over. Interned strings are shared with the table and
+ * must not be changed, two of them are equal exactly when they are the
+ * same string. The table drops strings nothing else references once it
+ * has grown, so its size follows the strings in use.
+ */
+
+typedef struct pni_symtab_t pni_symtab_t;
+
+pni_symtab_t *pni_symtab(void);
+
+// the interned string equal to bytes, made if there is none yet, with
+// a reference for the caller. A NULL table or null bytes give a string
+// of the caller's own.
+pn_string_t *pni_intern(pni_symtab_t *symtab, pn_bytes_t bytes);
+// the interned string equal to bytes, NULL if there is none. No
+// reference is taken.
+pn_string_t *pni_interned(pni_symtab_t *symtab, pn_bytes_t bytes);
+
+// give string a fresh string of its own if it is shared, so that it can
+// be changed
+int pni_unshare(pn_string_t **string);
+
+#endif /* src/symtab.h */
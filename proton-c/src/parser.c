@@ -26,6 +26,7 @@
 #include <string.h>
 #include <ctype.h>
 #include "platform.h"
+#include "alloc_private.h"
 
 struct pn_parser_t {
   pn_scanner_t *scanner;
@@ -37,7 +38,7 @@ struct pn_parser_t {
 
 pn_parser_t *pn_parser()
 {
-  pn_parser_t *parser = (pn_parser_t *) malloc(sizeof(pn_parser_t));
+  pn_parser_t *parser = (pn_parser_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pn_parser_t));
   parser->scanner = pn_scanner();
   parser->atoms = NULL;
   parser->size = 0;
@@ -49,7 +50,7 @@ void pn_parser_ensure(pn_parser_t *parser, size_t size)
 {
   while (parser->capacity - parser->size < size) {
     parser->capacity = parser->capacity ? 2 * parser->capacity : 1024;
-    parser->atoms = (char *) realloc(parser->atoms, parser->capacity);
+    parser->atoms = (char *) pni_realloc(PN_ALLOC_OBJECT, parser->atoms, parser->capacity);
   }
 }
 
@@ -81,8 +82,8 @@ void pn_parser_free(pn_parser_t *parser)
 {
   if (parser) {
     pn_scanner_free(parser->scanner);
-    free(parser->atoms);
-    free(parser);
+    pni_free(PN_ALLOC_OBJECT, parser->atoms);
+    pni_free(PN_ALLOC_OBJECT, parser);
   }
 }
 
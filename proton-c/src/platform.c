@@ -21,6 +21,7 @@
 
 #include "platform.h"
 #include "util.h"
+#include "alloc_private.h"
 
 /* Allow for systems that do not implement clock_gettime()*/
 #ifdef USE_CLOCK_GETTIME
@@ -31,6 +32,24 @@ pn_timestamp_t pn_i_now(void)
   if (clock_gettime(CLOCK_REALTIME, &now)) pni_fatal("clock_gettime() failed\n");
   return ((pn_timestamp_t)now.tv_sec) * 1000 + (now.tv_nsec / 1000000);
 }
+
+pn_timestamp_t pn_i_now_coarse(void)
+{
+#ifdef CLOCK_REALTIME_COARSE
+  struct timespec now;
+  if (clock_gettime(CLOCK_REALTIME_COARSE, &now)) pni_fatal("clock_gettime() failed\n");
+  return ((pn_timestamp_t)now.tv_sec) * 1000 + (now.tv_nsec / 1000000);
+#else
+  return pn_i_now();
+#endif
+}
+
+uint64_t pn_i_nanos(void)
+{
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now)) pni_fatal("clock_gettime() failed\n");
+  return ((uint64_t)now.tv_sec) * 1000000000 + now.tv_nsec;
+}
 #elif defined(USE_WIN_FILETIME)
 #include <windows.h>
 pn_timestamp_t pn_i_now(void)
@@ -43,6 +62,21 @@ pn_timestamp_t pn_i_now(void)
   // Convert to milliseconds and adjust base epoch
   return t.QuadPart / 10000 - 11644473600000;
 }
+
+// the system time is only updated once a tick already
+pn_timestamp_t pn_i_now_coarse(void)
+{
+  return pn_i_now();
+}
+
+uint64_t pn_i_nanos(void)
+{
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (uint64_t) (count.QuadPart / frequency.QuadPart) * 1000000000 +
+    (uint64_t) (count.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+}
 #else
 #include <sys/time.h>
 pn_timestamp_t pn_i_now(void)
@@ -51,13 +85,25 @@ pn_timestamp_t pn_i_now(void)
   if (gettimeofday(&now, NULL)) pni_fatal("gettimeofday failed\n");
   return ((pn_timestamp_t)now.tv_sec) * 1000 + (now.tv_usec / 1000);
 }
+
+pn_timestamp_t pn_i_now_coarse(void)
+{
+  return pn_i_now();
+}
+
+uint64_t pn_i_nanos(void)
+{
+  struct timeval now;
+  if (gettimeofday(&now, NULL)) pni_fatal("gettimeofday failed\n");
+  return ((uint64_t)now.tv_sec) * 1000000000 + now.tv_usec * 1000;
+}
 #endif
 
 #ifdef USE_UUID_GENERATE
 #include <uuid/uuid.h>
 #include <stdlib.h>
 char* pn_i_genuuid(void) {
-    char *generated = (char *) malloc(37*sizeof(char));
+    char *generated = (char *) pni_malloc(PN_ALLOC_OBJECT, 37*sizeof(char));
     uuid_t uuid;
     uuid_generate(uuid);
     uuid_unparse(uuid, generated);
@@ -89,6 +135,52 @@ char* pn_i_genuuid(void) {
 #error "Don't know how to generate uuid strings on this platform"
 #endif
 
+#ifdef USE_GETRANDOM
+#include <sys/random.h>
+int pn_i_random(void *buf, size_t size) {
+  char *p = (char *) buf;
+  while (size) {
+    ssize_t n = getrandom(p, size, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+#elif USE_WIN_RANDOM
+#include <windows.h>
+#include <bcrypt.h>
+int pn_i_random(void *buf, size_t size) {
+  NTSTATUS status = BCryptGenRandom(NULL, (PUCHAR) buf, (ULONG) size, BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+  return BCRYPT_SUCCESS(status) ? 0 : -1;
+}
+#elif USE_DEV_URANDOM
+#include <fcntl.h>
+#include <unistd.h>
+int pn_i_random(void *buf, size_t size) {
+  int fd = open("/dev/urandom", O_RDONLY);
+  if (fd < 0) return -1;
+  char *p = (char *) buf;
+  while (size) {
+    ssize_t n = read(fd, p, size);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      close(fd);
+      return -1;
+    }
+    p += n;
+    size -= n;
+  }
+  close(fd);
+  return 0;
+}
+#else
+#error "Don't know how to get secure random bytes on this platform"
+#endif
+
 #ifdef USE_STRERROR_R
 #include <string.h>
 static void pn_i_strerror(int errnum, char *buf, size_t buflen) {
@@ -39,6 +39,21 @@ extern "C" {
  */
 pn_timestamp_t pn_i_now(void);
 
+/** Get the current time as pn_i_now does, but only to the resolution
+ * of the system tick where the platform has a cheaper clock for that.
+ *
+ * @return current time
+ * @internal
+ */
+pn_timestamp_t pn_i_now_coarse(void);
+
+/** Get a monotonic time in nanoseconds, for measuring intervals.
+ *
+ * @return nanoseconds since an arbitrary point in the past
+ * @internal
+ */
+PN_EXTERN uint64_t pn_i_nanos(void);
+
 /** Generate a UUID in string format.
  *
  * Returns a newly generated UUID in the standard 36 char format.
@@ -50,6 +65,15 @@ pn_timestamp_t pn_i_now(void);
  */
 char* pn_i_genuuid(void);
 
+/** Fill a buffer with bytes from the system's secure random source.
+ *
+ * @param[out] buf the buffer to fill
+ * @param[in] size the number of bytes wanted
+ * @return zero, or -1 if the source could not supply them
+ * @internal
+ */
+int pn_i_random(void *buf, size_t size);
+
 /** Generate system error message.
  *
  * Populate the proton error structure based on the last system error
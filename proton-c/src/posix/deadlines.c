@@ -0,0 +1,169 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include "deadlines.h"
+#include "alloc_private.h"
+
+#define PNI_UNQUEUED ((size_t) -1)
+
+void pni_deadlines_init(pni_deadlines_t *d)
+{
+  d->heap = NULL;
+  d->size = 0;
+  d->capacity = 0;
+  d->deadlines = NULL;
+  d->positions = NULL;
+  d->slots = 0;
+}
+
+void pni_deadlines_fini(pni_deadlines_t *d)
+{
+  pni_free(PN_ALLOC_IO, d->heap);
+  pni_free(PN_ALLOC_IO, d->deadlines);
+  pni_free(PN_ALLOC_IO, d->positions);
+}
+
+static void pni_deadlines_ensure(pni_deadlines_t *d, size_t slot)
+{
+  if (slot < d->slots) return;
+  size_t slots = d->slots ? d->slots : 16;
+  while (slots <= slot) slots *= 2;
+  d->deadlines = (pn_timestamp_t *) pni_realloc(PN_ALLOC_IO, d->deadlines, slots*sizeof(pn_timestamp_t));
+  d->positions = (size_t *) pni_realloc(PN_ALLOC_IO, d->positions, slots*sizeof(size_t));
+  for (size_t i = d->slots; i < slots; i++) {
+    d->deadlines[i] = 0;
+    d->positions[i] = PNI_UNQUEUED;
+  }
+  d->slots = slots;
+}
+
+static void pni_deadlines_place(pni_deadlines_t *d, size_t pos, size_t slot)
+{
+  d->heap[pos] = slot;
+  d->positions[slot] = pos;
+}
+
+static void pni_deadlines_up(pni_deadlines_t *d, size_t pos)
+{
+  size_t slot = d->heap[pos];
+  pn_timestamp_t deadline = d->deadlines[slot];
+  while (pos > 0) {
+    size_t parent = (pos - 1)/2;
+    if (d->deadlines[d->heap[parent]] <= deadline) break;
+    pni_deadlines_place(d, pos, d->heap[parent]);
+    pos = parent;
+  }
+  pni_deadlines_place(d, pos, slot);
+}
+
+static void pni_deadlines_down(pni_deadlines_t *d, size_t pos)
+{
+  size_t slot = d->heap[pos];
+  pn_timestamp_t deadline = d->deadlines[slot];
+  while (true) {
+    size_t child = 2*pos + 1;
+    if (child >= d->size) break;
+    if (child + 1 < d->size && d->deadlines[d->heap[child + 1]] < d->deadlines[d->heap[child]]) {
+      child++;
+    }
+    if (deadline <= d->deadlines[d->heap[child]]) break;
+    pni_deadlines_place(d, pos, d->heap[child]);
+    pos = child;
+  }
+  pni_deadlines_place(d, pos, slot);
+}
+
+static void pni_deadlines_unqueue(pni_deadlines_t *d, size_t slot)
+{
+  size_t pos = d->positions[slot];
+  d->positions[slot] = PNI_UNQUEUED;
+  size_t last = --d->size;
+  if (pos != last) {
+    size_t moved = d->heap[last];
+    pni_deadlines_place(d, pos, moved);
+    pni_deadlines_up(d, pos);
+    pni_deadlines_down(d, d->positions[moved]);
+  }
+}
+
+void pni_deadlines_set(pni_deadlines_t *d, size_t slot, pn_timestamp_t deadline)
+{
+  pni_deadlines_ensure(d, slot);
+  pn_timestamp_t old = d->deadlines[slot];
+  if (old == deadline) return;
+  d->deadlines[slot] = deadline;
+
+  if (!old) {
+    if (d->capacity <= d->size) {
+      d->capacity = d->capacity ? 2*d->capacity : 16;
+      d->heap = (size_t *) pni_realloc(PN_ALLOC_IO, d->heap, d->capacity*sizeof(size_t));
+    }
+    pni_deadlines_place(d, d->size++, slot);
+    pni_deadlines_up(d, d->size - 1);
+  } else if (!deadline) {
+    pni_deadlines_unqueue(d, slot);
+  } else if (deadline < old) {
+    pni_deadlines_up(d, d->positions[slot]);
+  } else {
+    pni_deadlines_down(d, d->positions[slot]);
+  }
+}
+
+pn_timestamp_t pni_deadlines_get(pni_deadlines_t *d, size_t slot)
+{
+  return slot < d->slots ? d->deadlines[slot] : 0;
+}
+
+void pni_deadlines_move(pni_deadlines_t *d, size_t from, size_t to)
+{
+  pni_deadlines_ensure(d, from > to ? from : to);
+  assert(!d->deadlines[to]);
+  d->deadlines[to] = d->deadlines[from];
+  d->positions[to] = d->positions[from];
+  d->deadlines[from] = 0;
+  d->positions[from] = PNI_UNQUEUED;
+  if (d->positions[to] != PNI_UNQUEUED) {
+    d->heap[d->positions[to]] = to;
+  }
+}
+
+pn_timestamp_t pni_deadlines_next(pni_deadlines_t *d)
+{
+  return d->size ? d->deadlines[d->heap[0]] : 0;
+}
+
+static void pni_deadlines_visit(pni_deadlines_t *d, size_t pos, pn_timestamp_t now,
+                                void (*expired)(void *, size_t), void *context)
+{
+  // only subtrees whose root has expired can contain expired slots
+  if (pos >= d->size || d->deadlines[d->heap[pos]] > now) return;
+  expired(context, d->heap[pos]);
+  pni_deadlines_visit(d, 2*pos + 1, now, expired, context);
+  pni_deadlines_visit(d, 2*pos + 2, now, expired, context);
+}
+
+void pni_deadlines_expired(pni_deadlines_t *d, pn_timestamp_t now,
+                           void (*expired)(void *context, size_t slot), void *context)
+{
+  pni_deadlines_visit(d, 0, now, expired, context);
+}
@@ -0,0 +1,53 @@
+#ifndef _PROTON_SRC_DEADLINES_H
+#define _PROTON_SRC_DEADLINES_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/types.h>
+
+/*
+ * An indexed binary min-heap of deadlines, keyed by selector slot.
+ *
+ * Setting, clearing and moving a slot's deadline costs O(log N), the
+ * nearest deadline is available in O(1), and visiting the expired
+ * slots costs O(expired).
+ */
+
+typedef struct {
+  size_t *heap;               // slots ordered by deadline
+  size_t size;
+  size_t capacity;
+  pn_timestamp_t *deadlines;  // deadline, indexed by slot
+  size_t *positions;          // heap position, indexed by slot
+  size_t slots;
+} pni_deadlines_t;
+
+void pni_deadlines_init(pni_deadlines_t *deadlines);
+void pni_deadlines_fini(pni_deadlines_t *deadlines);
+void pni_deadlines_set(pni_deadlines_t *deadlines, size_t slot, pn_timestamp_t deadline);
+pn_timestamp_t pni_deadlines_get(pni_deadlines_t *deadlines, size_t slot);
+void pni_deadlines_move(pni_deadlines_t *deadlines, size_t from, size_t to);
+pn_timestamp_t pni_deadlines_next(pni_deadlines_t *deadlines);
+void pni_deadlines_expired(pni_deadlines_t *deadlines, pn_timestamp_t now,
+                           void (*expired)(void *context, size_t slot), void *context);
+
+#endif /* deadlines.h */
@@ -19,6 +19,10 @@
  *
  */
 
+#ifdef USE_ACCEPT4
+#define _GNU_SOURCE
+#endif
+
 #include <proton/io.h>
 #include <proton/object.h>
 #include <proton/selector.h>
@@ -33,9 +37,34 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <assert.h>
+#ifdef USE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#define PNI_ZEROCOPY 1
+#endif
+#ifdef USE_KTLS
+#include <linux/tls.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
 
 #include "platform.h"
+#include "thread.h"
+#include "wakeup.h"
+#include "listener.h"
+#include "socket_options.h"
+#include "resolver.h"
+#ifdef USE_IO_URING
+#include "uring.h"
+#endif
 
 #define MAX_HOST (1024)
 #define MAX_SERV (64)
@@ -45,6 +74,8 @@ struct pn_io_t {
   char serv[MAX_SERV];
   pn_error_t *error;
   pn_selector_t *selector;
+  pn_socket_options_t *options;
+  pni_addr_cache_t *cache;
   bool wouldblock;
 };
 
@@ -54,12 +85,16 @@ void pn_io_initialize(void *obj)
   io->error = pn_error();
   io->wouldblock = false;
   io->selector = NULL;
+  io->options = NULL;
+  io->cache = pni_addr_cache();
 }
 
 void pn_io_finalize(void *obj)
 {
   pn_io_t *io = (pn_io_t *) obj;
   pn_error_free(io->error);
+  pn_decref(io->options);
+  pni_addr_cache_free(io->cache);
 }
 
 #define pn_io_hashcode NULL
@@ -84,6 +119,77 @@ pn_error_t *pn_io_error(pn_io_t *io)
   return io->error;
 }
 
+pn_socket_options_t *pn_io_get_socket_options(pn_io_t *io)
+{
+  assert(io);
+  return io->options;
+}
+
+void pn_io_set_socket_options(pn_io_t *io, pn_socket_options_t *options)
+{
+  assert(io);
+  pn_incref(options);
+  pn_decref(io->options);
+  io->options = options;
+}
+
+pni_addr_cache_t *pni_io_addr_cache(pn_io_t *io)
+{
+  return io->cache;
+}
+
+pn_millis_t pn_io_get_resolve_ttl(pn_io_t *io)
+{
+  assert(io);
+  return pni_addr_cache_get_ttl(io->cache);
+}
+
+void pn_io_set_resolve_ttl(pn_io_t *io, pn_millis_t ttl)
+{
+  assert(io);
+  pni_addr_cache_set_ttl(io->cache, ttl);
+}
+
+bool pni_numeric_host(const char *host)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_flags = AI_NUMERICHOST;
+  struct addrinfo *addr;
+  if (getaddrinfo(host, NULL, &hints, &addr)) return false;
+  freeaddrinfo(addr);
+  return true;
+}
+
+int pni_resolve_host(const char *host, char *numeric, size_t size, char *error, size_t esize)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *addr;
+  int code = getaddrinfo(host, NULL, &hints, &addr);
+  if (!code) {
+    code = getnameinfo(addr->ai_addr, addr->ai_addrlen, numeric, size, NULL, 0, NI_NUMERICHOST);
+    freeaddrinfo(addr);
+  }
+  if (code) {
+    snprintf(error, esize, "getaddrinfo(%s): %s", host, gai_strerror(code));
+    return PN_ERR;
+  }
+  return 0;
+}
+
+// remember what a name resolved to, for the next connect
+static void pni_remember(pn_io_t *io, const char *host, struct addrinfo *addr)
+{
+  char numeric[PNI_NUMERIC_HOST_MAX];
+  if (!pni_addr_cache_get_ttl(io->cache)) return;
+  if (getnameinfo(addr->ai_addr, addr->ai_addrlen, numeric, sizeof(numeric), NULL, 0, NI_NUMERICHOST))
+    return;
+  if (strcmp(numeric, host))
+    pni_addr_cache_put(io->cache, host, numeric, pn_i_now());
+}
+
 int pn_pipe(pn_io_t *io, pn_socket_t *dest)
 {
   int n = pipe(dest);
@@ -94,22 +200,85 @@ int pn_pipe(pn_io_t *io, pn_socket_t *dest)
   return n;
 }
 
-static void pn_configure_sock(pn_io_t *io, pn_socket_t sock) {
-  // this would be nice, but doesn't appear to exist on linux
-  /*
-  int set = 1;
-  if (!setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(int))) {
-    pn_i_error_from_errno(io->error, "setsockopt");
-  };
-  */
+int pni_wakeup_init(pn_io_t *io, pni_wakeup_t *wakeup)
+{
+  wakeup->pending = NULL;
+#ifdef USE_EVENTFD
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    wakeup->fds[0] = wakeup->fds[1] = PN_INVALID_SOCKET;
+    return pn_i_error_from_errno(io->error, "eventfd");
+  }
+  wakeup->fds[0] = wakeup->fds[1] = fd;
+  return 0;
+#else
+  if (pipe(wakeup->fds)) {
+    wakeup->fds[0] = wakeup->fds[1] = PN_INVALID_SOCKET;
+    return pn_i_error_from_errno(io->error, "pipe");
+  }
+  // a spurious readable must not block the reader
+  fcntl(wakeup->fds[0], F_SETFL, fcntl(wakeup->fds[0], F_GETFL) | O_NONBLOCK);
+  return 0;
+#endif
+}
+
+void pni_wakeup_fini(pn_io_t *io, pni_wakeup_t *wakeup)
+{
+  if (wakeup->fds[0] != PN_INVALID_SOCKET) {
+    close(wakeup->fds[0]);
+  }
+  if (wakeup->fds[1] != PN_INVALID_SOCKET && wakeup->fds[1] != wakeup->fds[0]) {
+    close(wakeup->fds[1]);
+  }
+  wakeup->fds[0] = wakeup->fds[1] = PN_INVALID_SOCKET;
+}
+
+pn_socket_t pni_wakeup_fd(pni_wakeup_t *wakeup)
+{
+  return wakeup->fds[0];
+}
+
+int pni_wakeup_signal(pn_io_t *io, pni_wakeup_t *wakeup)
+{
+  if (pni_atomic_exchange(&wakeup->pending, wakeup)) {
+    return 0;
+  }
+#ifdef USE_EVENTFD
+  uint64_t one = 1;
+  ssize_t n = write(wakeup->fds[1], &one, sizeof(one));
+#else
+  ssize_t n = write(wakeup->fds[1], "x", 1);
+#endif
+  return n < 0 ? PN_ERR : 0;
+}
+
+void pni_wakeup_read(pn_io_t *io, pni_wakeup_t *wakeup)
+{
+#ifdef USE_EVENTFD
+  uint64_t count;
+  ssize_t n = read(wakeup->fds[0], &count, sizeof(count));
+#else
+  char buf[64];
+  ssize_t n = read(wakeup->fds[0], buf, sizeof(buf));
+#endif
+  (void) n;
+}
+
+bool pni_wakeup_clear(pni_wakeup_t *wakeup)
+{
+  return pni_atomic_exchange(&wakeup->pending, NULL) != NULL;
+}
 
+static void pn_configure_nonblocking(pn_io_t *io, pn_socket_t sock) {
   int flags = fcntl(sock, F_GETFL);
   flags |= O_NONBLOCK;
 
   if (fcntl(sock, F_SETFL, flags) < 0) {
     pn_i_error_from_errno(io->error, "fcntl");
   }
+}
 
+static void pn_configure_nodelay(pn_io_t *io, pn_socket_t sock) {
   //
   // Disable the Nagle algorithm on TCP connections.
   //
@@ -122,20 +291,73 @@ static void pn_configure_sock(pn_io_t *io, pn_socket_t sock) {
   }
 }
 
-static inline int pn_create_socket(int af);
+static void pn_configure_sock(pn_io_t *io, pn_socket_t sock) {
+  // this would be nice, but doesn't appear to exist on linux
+  /*
+  int set = 1;
+  if (!setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(int))) {
+    pn_i_error_from_errno(io->error, "setsockopt");
+  };
+  */
 
-pn_socket_t pn_listen(pn_io_t *io, const char *host, const char *port)
+  pn_configure_nonblocking(io, sock);
+  pn_configure_nodelay(io, sock);
+}
+
+static int pni_setsockopt(pn_io_t *io, pn_socket_t sock, int level, int name, int value)
 {
-  struct addrinfo *addr;
-  int code = getaddrinfo(host, port, NULL, &addr);
-  if (code) {
-    pn_error_format(io->error, PN_ERR, "getaddrinfo(%s, %s): %s\n", host, port, gai_strerror(code));
-    return PN_INVALID_SOCKET;
+  if (setsockopt(sock, level, name, &value, sizeof(value)) == -1) {
+    return pn_i_error_from_errno(io->error, "setsockopt");
   }
+  return 0;
+}
 
-  pn_socket_t sock = pn_create_socket(addr->ai_family);
+int pn_socket_options_apply(pn_io_t *io, pn_socket_options_t *options, pn_socket_t sock)
+{
+  assert(io);
+  int err = 0;
+  if (!options) return 0;
+  if (options->send_buffer >= 0 && pni_setsockopt(io, sock, SOL_SOCKET, SO_SNDBUF, options->send_buffer)) err = PN_ERR;
+  if (options->receive_buffer >= 0 && pni_setsockopt(io, sock, SOL_SOCKET, SO_RCVBUF, options->receive_buffer)) err = PN_ERR;
+  if (options->nodelay >= 0 && pni_setsockopt(io, sock, IPPROTO_TCP, TCP_NODELAY, options->nodelay)) err = PN_ERR;
+#ifdef TCP_QUICKACK
+  if (options->quickack >= 0 && pni_setsockopt(io, sock, IPPROTO_TCP, TCP_QUICKACK, options->quickack)) err = PN_ERR;
+#endif
+#if defined(TCP_CORK)
+  if (options->cork >= 0 && pni_setsockopt(io, sock, IPPROTO_TCP, TCP_CORK, options->cork)) err = PN_ERR;
+#elif defined(TCP_NOPUSH)
+  if (options->cork >= 0 && pni_setsockopt(io, sock, IPPROTO_TCP, TCP_NOPUSH, options->cork)) err = PN_ERR;
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+  if (options->notsent_lowat >= 0 && pni_setsockopt(io, sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, options->notsent_lowat)) err = PN_ERR;
+#endif
+#ifdef SO_BUSY_POLL
+  if (options->busy_poll >= 0 && pni_setsockopt(io, sock, SOL_SOCKET, SO_BUSY_POLL, options->busy_poll)) err = PN_ERR;
+#endif
+#ifdef PNI_ZEROCOPY
+  if (options->zerocopy >= 0 && pni_setsockopt(io, sock, SOL_SOCKET, SO_ZEROCOPY, options->zerocopy > 0)) err = PN_ERR;
+#endif
+  if (options->keepalive >= 0 && pni_setsockopt(io, sock, SOL_SOCKET, SO_KEEPALIVE, options->keepalive)) err = PN_ERR;
+#if defined(TCP_KEEPIDLE)
+  if (options->keepidle >= 0 && pni_setsockopt(io, sock, IPPROTO_TCP, TCP_KEEPIDLE, options->keepidle)) err = PN_ERR;
+#elif defined(TCP_KEEPALIVE)
+  if (options->keepidle >= 0 && pni_setsockopt(io, sock, IPPROTO_TCP, TCP_KEEPALIVE, options->keepidle)) err = PN_ERR;
+#endif
+#ifdef TCP_KEEPINTVL
+  if (options->keepintvl >= 0 && pni_setsockopt(io, sock, IPPROTO_TCP, TCP_KEEPINTVL, options->keepintvl)) err = PN_ERR;
+#endif
+#ifdef TCP_KEEPCNT
+  if (options->keepcnt >= 0 && pni_setsockopt(io, sock, IPPROTO_TCP, TCP_KEEPCNT, options->keepcnt)) err = PN_ERR;
+#endif
+  return err;
+}
+
+static inline int pn_create_socket(int af);
+
+static pn_socket_t pni_listen_addr(pn_io_t *io, const struct sockaddr *addr, socklen_t addrlen, bool shared)
+{
+  pn_socket_t sock = pn_create_socket(addr->sa_family);
   if (sock == PN_INVALID_SOCKET) {
-    freeaddrinfo(addr);
     pn_i_error_from_errno(io->error, "pn_create_socket");
     return PN_INVALID_SOCKET;
   }
@@ -143,37 +365,168 @@ pn_socket_t pn_listen(pn_io_t *io, const char *host, const char *port)
   int optval = 1;
   if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == -1) {
     pn_i_error_from_errno(io->error, "setsockopt");
-    freeaddrinfo(addr);
     close(sock);
     return PN_INVALID_SOCKET;
   }
 
-  if (bind(sock, addr->ai_addr, addr->ai_addrlen) == -1) {
-    pn_i_error_from_errno(io->error, "bind");
-    freeaddrinfo(addr);
+  // accepted sockets inherit the buffer sizes, which fix the window
+  // scale offered in the handshake
+  if (addr->sa_family != AF_UNIX)
+    pn_socket_options_apply(io, io->options, sock);
+
+#ifdef SO_REUSEPORT
+  if (shared && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+    pn_i_error_from_errno(io->error, "setsockopt");
     close(sock);
     return PN_INVALID_SOCKET;
   }
+#endif
 
-  freeaddrinfo(addr);
+  if (bind(sock, addr, addrlen) == -1) {
+    pn_i_error_from_errno(io->error, "bind");
+    close(sock);
+    return PN_INVALID_SOCKET;
+  }
 
-  if (listen(sock, 50) == -1) {
+  if (listen(sock, SOMAXCONN) == -1) {
     pn_i_error_from_errno(io->error, "listen");
     close(sock);
     return PN_INVALID_SOCKET;
   }
 
+  // accepting until the queue is empty must not block
+  pn_configure_nonblocking(io, sock);
   return sock;
 }
 
-pn_socket_t pn_connect(pn_io_t *io, const char *host, const char *port)
+static pn_socket_t pni_listen(pn_io_t *io, const char *host, const char *port, bool shared)
 {
   struct addrinfo *addr;
   int code = getaddrinfo(host, port, NULL, &addr);
+  if (code) {
+    pn_error_format(io->error, PN_ERR, "getaddrinfo(%s, %s): %s\n", host, port, gai_strerror(code));
+    return PN_INVALID_SOCKET;
+  }
+
+  pn_socket_t sock = pni_listen_addr(io, addr->ai_addr, addr->ai_addrlen, shared);
+  freeaddrinfo(addr);
+  return sock;
+}
+
+pn_socket_t pn_listen(pn_io_t *io, const char *host, const char *port)
+{
+  return pni_listen(io, host, port, false);
+}
+
+pn_socket_t pni_listen_shareable(pn_io_t *io, const char *host, const char *port)
+{
+#ifdef SO_REUSEPORT
+  return pni_listen(io, host, port, true);
+#else
+  return pni_listen(io, host, port, false);
+#endif
+}
+
+pn_socket_t pni_listen_share(pn_io_t *io, pn_socket_t listener)
+{
+#ifdef SO_REUSEPORT
+  // bind to the address actually bound, which fixes an ephemeral port
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof(addr);
+  if (getsockname(listener, (struct sockaddr *) &addr, &addrlen) == -1) {
+    pn_i_error_from_errno(io->error, "getsockname");
+    return PN_INVALID_SOCKET;
+  }
+  return pni_listen_addr(io, (struct sockaddr *) &addr, addrlen, true);
+#else
+  pn_error_format(io->error, PN_ERR, "pni_listen_share: not supported");
+  return PN_INVALID_SOCKET;
+#endif
+}
+
+int pni_listen_steer(pn_io_t *io, pn_socket_t listener, int cpu)
+{
+#ifdef SO_INCOMING_CPU
+  if (setsockopt(listener, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+    return pn_i_error_from_errno(io->error, "setsockopt SO_INCOMING_CPU");
+  }
+  return 0;
+#else
+  return pn_error_format(io->error, PN_ERR, "pni_listen_steer: not supported");
+#endif
+}
+
+static int pni_unix_addr(pn_io_t *io, const char *path, struct sockaddr_un *addr, socklen_t *addrlen)
+{
+  size_t len = strlen(path);
+  if (!len || len >= sizeof(addr->sun_path)) {
+    return pn_error_format(io->error, PN_ARG_ERR, "invalid local socket path: %s", path);
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  memcpy(addr->sun_path, path, len);
+  *addrlen = offsetof(struct sockaddr_un, sun_path) + len + 1;
+#ifdef __linux__
+  if (path[0] == '@') {
+    // abstract names are not terminated
+    addr->sun_path[0] = '\0';
+    *addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+  }
+#endif
+  return 0;
+}
+
+pn_socket_t pn_listen_unix(pn_io_t *io, const char *path)
+{
+  struct sockaddr_un addr;
+  socklen_t addrlen;
+  if (pni_unix_addr(io, path, &addr, &addrlen)) return PN_INVALID_SOCKET;
+
+  // a listener that went away leaves its socket file behind
+  struct stat st;
+  if (addr.sun_path[0] && stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+  return pni_listen_addr(io, (struct sockaddr *) &addr, addrlen, false);
+}
+
+pn_socket_t pn_connect_unix(pn_io_t *io, const char *path)
+{
+  struct sockaddr_un addr;
+  socklen_t addrlen;
+  if (pni_unix_addr(io, path, &addr, &addrlen)) return PN_INVALID_SOCKET;
+
+  pn_socket_t sock = pn_create_socket(AF_UNIX);
+  if (sock == PN_INVALID_SOCKET) {
+    pn_i_error_from_errno(io->error, "pn_create_socket");
+    return PN_INVALID_SOCKET;
+  }
+  pn_configure_nonblocking(io, sock);
+
+  // there is no handshake, a local connect completes or fails at once
+  if (connect(sock, (struct sockaddr *) &addr, addrlen) == -1) {
+    pn_i_error_from_errno(io->error, "connect");
+    close(sock);
+    return PN_INVALID_SOCKET;
+  }
+  return sock;
+}
+
+pn_socket_t pn_connect(pn_io_t *io, const char *host, const char *port)
+{
+  return pni_connect(io, host, port, NULL);
+}
+
+pn_socket_t pni_connect(pn_io_t *io, const char *host, const char *port, pn_socket_options_t *options)
+{
+  char numeric[PNI_NUMERIC_HOST_MAX];
+  bool cached = pni_addr_cache_get(io->cache, host, pn_i_now(), numeric, sizeof(numeric));
+  struct addrinfo *addr;
+  int code = getaddrinfo(cached ? numeric : host, port, NULL, &addr);
   if (code) {
     pn_error_format(io->error, PN_ERR, "getaddrinfo(%s, %s): %s", host, port, gai_strerror(code));
     return PN_INVALID_SOCKET;
   }
+  if (!cached) pni_remember(io, host, addr);
 
   pn_socket_t sock = pn_create_socket(addr->ai_family);
   if (sock == PN_INVALID_SOCKET) {
@@ -183,6 +536,8 @@ pn_socket_t pn_connect(pn_io_t *io, const char *host, const char *port)
   }
 
   pn_configure_sock(io, sock);
+  pn_socket_options_apply(io, io->options, sock);
+  pn_socket_options_apply(io, options, sock);
 
   if (connect(sock, addr->ai_addr, addr->ai_addrlen) == -1) {
     if (errno != EINPROGRESS) {
@@ -198,14 +553,45 @@ pn_socket_t pn_connect(pn_io_t *io, const char *host, const char *port)
   return sock;
 }
 
+static void pni_unix_name(pn_socket_t listener, char *name, size_t size)
+{
+  struct sockaddr_un addr;
+  socklen_t addrlen = sizeof(addr);
+  memset(&addr, 0, sizeof(addr));
+  if (getsockname(listener, (struct sockaddr *) &addr, &addrlen) == -1 ||
+      addrlen <= offsetof(struct sockaddr_un, sun_path)) {
+    snprintf(name, size, "unix");
+    return;
+  }
+  size_t len = addrlen - offsetof(struct sockaddr_un, sun_path);
+  const char *path = addr.sun_path;
+  if (!path[0]) {
+    snprintf(name, size, "@%.*s", (int) len - 1, path + 1);
+  } else {
+    snprintf(name, size, "%.*s", (int) strnlen(path, len), path);
+  }
+}
+
 pn_socket_t pn_accept(pn_io_t *io, pn_socket_t socket, char *name, size_t size)
 {
-  struct sockaddr_in addr = {0};
-  addr.sin_family = AF_UNSPEC;
+  struct sockaddr_storage addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.ss_family = AF_UNSPEC;
   socklen_t addrlen = sizeof(addr);
+#ifdef USE_ACCEPT4
+  pn_socket_t sock = accept4(socket, (struct sockaddr *) &addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
   pn_socket_t sock = accept(socket, (struct sockaddr *) &addr, &addrlen);
+#endif
+  io->wouldblock = sock == PN_INVALID_SOCKET && (errno == EAGAIN || errno == EWOULDBLOCK);
   if (sock == PN_INVALID_SOCKET) {
-    pn_i_error_from_errno(io->error, "accept");
+    if (!io->wouldblock) pn_i_error_from_errno(io->error, "accept");
+    return sock;
+  } else if (addr.ss_family == AF_UNIX) {
+#ifndef USE_ACCEPT4
+    pn_configure_nonblocking(io, sock);
+#endif
+    pni_unix_name(socket, name, size);
     return sock;
   } else {
     int code;
@@ -215,7 +601,12 @@ pn_socket_t pn_accept(pn_io_t *io, pn_socket_t socket, char *name, size_t size)
         pn_i_error_from_errno(io->error, "close");
       return PN_INVALID_SOCKET;
     } else {
+#ifdef USE_ACCEPT4
+      pn_configure_nodelay(io, sock);
+#else
       pn_configure_sock(io, sock);
+#endif
+      pn_socket_options_apply(io, io->options, sock);
       snprintf(name, size, "%s:%s", io->host, io->serv);
       return sock;
     }
@@ -225,18 +616,20 @@ pn_socket_t pn_accept(pn_io_t *io, pn_socket_t socket, char *name, size_t size)
 /* Abstract away turning off SIGPIPE */
 #ifdef MSG_NOSIGNAL
 ssize_t pn_send(pn_io_t *io, pn_socket_t socket, const void *buf, size_t len) {
-  ssize_t count = send(socket, buf, len, MSG_NOSIGNAL);
+  ssize_t count;
+#ifdef USE_IO_URING
+  if (!io->selector || !pni_uring_send(io->selector, socket, buf, len, &count))
+#endif
+  count = send(socket, buf, len, MSG_NOSIGNAL);
   io->wouldblock = (errno == EAGAIN || errno == EWOULDBLOCK);
   if (count < 0) { pn_i_error_from_errno(io->error, "send"); }
   return count;
 }
 
+// getprotobyname is not thread safe, and tcp is always IPPROTO_TCP
 static inline int pn_create_socket(int af) {
-  struct protoent * pe_tcp = getprotobyname("tcp");
-  if (pe_tcp == NULL) {
-    return -1;
-  }
-  return socket(af, SOCK_STREAM, pe_tcp->p_proto);
+  if (af == AF_UNIX) return socket(af, SOCK_STREAM, 0);
+  return socket(af, SOCK_STREAM, IPPROTO_TCP);
 }
 #elif defined(SO_NOSIGPIPE)
 ssize_t pn_send(pn_io_t *io, pn_socket_t socket, const void *buf, size_t size) {
@@ -247,13 +640,12 @@ ssize_t pn_send(pn_io_t *io, pn_socket_t socket, const void *buf, size_t size) {
 }
 
 static inline int pn_create_socket(int af) {
-  struct protoent * pe_tcp;
   int sock;
-  pe_tcp = getprotobyname("tcp");
-  if (pe_tcp == NULL) {
-    return -1;
+  if (af == AF_UNIX) {
+    sock = socket(af, SOCK_STREAM, 0);
+  } else {
+    sock = socket(af, SOCK_STREAM, IPPROTO_TCP);
   }
-  sock = socket(af, SOCK_STREAM, pe_tcp->p_proto);
   if (sock == -1) return sock;
 
   int optval = 1;
@@ -267,9 +659,111 @@ static inline int pn_create_socket(int af) {
 #error "Don't know how to turn off SIGPIPE on this platform"
 #endif
 
+ssize_t pni_send_zerocopy(pn_io_t *io, pn_socket_t socket, const void *buf, size_t size,
+                          bool *pinned)
+{
+  *pinned = false;
+#ifdef PNI_ZEROCOPY
+  ssize_t count = send(socket, buf, size, MSG_NOSIGNAL | MSG_ZEROCOPY);
+  // ENOBUFS is the limit on pinned memory, that send is copied instead
+  if (count >= 0 || errno != ENOBUFS) {
+    io->wouldblock = count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    if (count < 0) { pn_i_error_from_errno(io->error, "send"); }
+    *pinned = count > 0;
+    return count;
+  }
+#endif
+  return pn_send(io, socket, buf, size);
+}
+
+bool pni_zerocopy_enabled(pn_io_t *io, pn_socket_t socket)
+{
+#if defined(PNI_ZEROCOPY) && !defined(USE_IO_URING)
+  // without SO_ZEROCOPY on, MSG_ZEROCOPY is ignored and no completion
+  // would ever come
+  int value = 0;
+  socklen_t len = sizeof(value);
+  return !getsockopt(socket, SOL_SOCKET, SO_ZEROCOPY, &value, &len) && value;
+#else
+  // the io_uring selector does not hand the error queue on
+  return false;
+#endif
+}
+
+uint32_t pni_zerocopy_reap(pn_io_t *io, pn_socket_t socket)
+{
+  uint32_t done = 0;
+#ifdef PNI_ZEROCOPY
+  while (true) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) break;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) continue;
+      struct sock_extended_err err;
+      memcpy(&err, CMSG_DATA(cm), sizeof(err));
+      // a range of sends, numbered in the order they were made
+      if (err.ee_origin == SO_EE_ORIGIN_ZEROCOPY && !err.ee_errno) {
+        done += err.ee_data - err.ee_info + 1;
+      }
+    }
+  }
+#endif
+  return done;
+}
+
+bool pni_kernel_tls_enabled(pn_io_t *io)
+{
+#if defined(USE_KTLS) && !defined(USE_IO_URING)
+  return true;
+#else
+  // io_uring receives do not hand the record type on
+  return false;
+#endif
+}
+
+ssize_t pni_recv_tls(pn_io_t *io, pn_socket_t socket, void *buf, size_t size)
+{
+#ifdef USE_KTLS
+  char control[CMSG_SPACE(sizeof(unsigned char))];
+  struct iovec iov = { buf, size };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t count = recvmsg(socket, &msg, 0);
+  io->wouldblock = count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  if (count < 0) { pn_i_error_from_errno(io->error, "recvmsg"); return count; }
+  // a record other than application data comes on its own
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+  if (cm && cm->cmsg_level == SOL_TLS && cm->cmsg_type == TLS_GET_RECORD_TYPE) {
+    unsigned char type = *CMSG_DATA(cm);
+    const unsigned char *alert = (const unsigned char *) buf;
+    if (type == 21 && count == 2 && alert[1] == 0) return 0;   // close_notify
+    if (type != 23) {
+      pn_error_format(io->error, PN_ERR, "recvmsg: unexpected TLS record of type %d", type);
+      return -1;
+    }
+  }
+  return count;
+#else
+  return pn_recv(io, socket, buf, size);
+#endif
+}
+
 ssize_t pn_recv(pn_io_t *io, pn_socket_t socket, void *buf, size_t size)
 {
-  ssize_t count = recv(socket, buf, size, 0);
+  ssize_t count;
+#ifdef USE_IO_URING
+  if (!io->selector || !pni_uring_recv(io->selector, socket, buf, size, &count))
+#endif
+  count = recv(socket, buf, size, 0);
   io->wouldblock = count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
   if (count < 0) { pn_i_error_from_errno(io->error, "recv"); }
   return count;
@@ -287,6 +781,9 @@ ssize_t pn_read(pn_io_t *io, pn_socket_t socket, void *buf, size_t size)
 
 void pn_close(pn_io_t *io, pn_socket_t socket)
 {
+#ifdef USE_IO_URING
+  if (io->selector && pni_uring_close(io->selector, socket)) return;
+#endif
   close(socket);
 }
 
@@ -0,0 +1,303 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/error.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped.h"
+#include "util.h"
+#include "alloc_private.h"
+
+// the file grows a window at a time and only the window being written
+// is mapped, the size is a multiple of any page size
+#define PNI_MAPPED_WINDOW ((size_t) 1024*1024)
+
+struct pni_mapped_t {
+  int fd;
+  char *window;
+  off_t offset;   // of the window in the file
+  size_t used;    // of the window
+};
+
+pni_mapped_t *pni_mapped(const char *path)
+{
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return NULL;
+  pni_mapped_t *mapped = (pni_mapped_t *) pni_malloc(PN_ALLOC_TRANSPORT, sizeof(pni_mapped_t));
+  if (!mapped) {
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+  mapped->fd = fd;
+  mapped->window = NULL;
+  mapped->offset = 0;
+  mapped->used = 0;
+  return mapped;
+}
+
+static int pni_mapped_advance(pni_mapped_t *mapped)
+{
+  if (mapped->window) {
+    munmap(mapped->window, PNI_MAPPED_WINDOW);
+    mapped->window = NULL;
+    mapped->offset += PNI_MAPPED_WINDOW;
+  }
+  mapped->used = 0;
+#ifdef __linux__
+  // reserve the blocks, a full disk is then an error here rather than
+  // a SIGBUS when the window is written
+  int err = posix_fallocate(mapped->fd, mapped->offset, PNI_MAPPED_WINDOW);
+  if (err) {
+    errno = err;
+    return PN_ERR;
+  }
+#else
+  if (ftruncate(mapped->fd, mapped->offset + PNI_MAPPED_WINDOW)) return PN_ERR;
+#endif
+  void *window = mmap(NULL, PNI_MAPPED_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, mapped->fd,
+                      mapped->offset);
+  if (window == MAP_FAILED) return PN_ERR;
+  mapped->window = (char *) window;
+  return 0;
+}
+
+int pni_mapped_append(pni_mapped_t *mapped, const char *bytes, size_t size)
+{
+  while (size) {
+    if (!mapped->window || mapped->used == PNI_MAPPED_WINDOW) {
+      int err = pni_mapped_advance(mapped);
+      if (err) return err;
+    }
+    size_t n = pn_min(size, PNI_MAPPED_WINDOW - mapped->used);
+    memcpy(mapped->window + mapped->used, bytes, n);
+    mapped->used += n;
+    bytes += n;
+    size -= n;
+  }
+  return 0;
+}
+
+int pni_mapped_sync(pni_mapped_t *mapped)
+{
+  // the windows already unmapped are still in the page cache, so the
+  // file is synced as a whole
+  if (mapped->window && msync(mapped->window, mapped->used, MS_SYNC)) return PN_ERR;
+#ifdef __linux__
+  if (fdatasync(mapped->fd)) return PN_ERR;
+#else
+  if (fsync(mapped->fd)) return PN_ERR;
+#endif
+  return 0;
+}
+
+void pni_mapped_close(pni_mapped_t *mapped)
+{
+  if (!mapped) return;
+  if (mapped->window) {
+    munmap(mapped->window, PNI_MAPPED_WINDOW);
+  }
+  // cut off the unwritten end of the last window
+  if (ftruncate(mapped->fd, mapped->offset + mapped->used)) {
+    // nothing to be done, the reader stops at the zeroes
+  }
+  close(mapped->fd);
+  pni_free(PN_ALLOC_TRANSPORT, mapped);
+}
+
+struct pni_view_t {
+  void *start;
+  size_t size;
+};
+
+pni_view_t *pni_view(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat st;
+  if (fstat(fd, &st)) {
+    close(fd);
+    return NULL;
+  }
+  if ((uint64_t) st.st_size > (size_t) -1) {
+    close(fd);
+    errno = EFBIG;
+    return NULL;
+  }
+  pni_view_t *view = (pni_view_t *) pni_malloc(PN_ALLOC_IO, sizeof(pni_view_t));
+  if (!view) {
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+  view->start = NULL;
+  view->size = st.st_size;
+  // an empty file cannot be mapped, and need not be
+  if (view->size) {
+    void *start = mmap(NULL, view->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (start == MAP_FAILED) {
+      int err = errno;
+      close(fd);
+      pni_free(PN_ALLOC_IO, view);
+      errno = err;
+      return NULL;
+    }
+    view->start = start;
+  }
+  // the mapping outlives the descriptor
+  close(fd);
+  return view;
+}
+
+pn_bytes_t pni_view_bytes(pni_view_t *view)
+{
+  return pn_bytes(view->size, (const char *) view->start);
+}
+
+void pni_view_close(pni_view_t *view)
+{
+  if (!view) return;
+  if (view->start) munmap(view->start, view->size);
+  pni_free(PN_ALLOC_IO, view);
+}
+
+struct pni_file_range_t {
+  int fd;
+  int64_t offset;     // of the next byte to read
+  size_t remaining;
+  void *map;          // the current window's mapping
+  size_t map_size;
+  char *buf;          // read into when the file cannot be mapped
+};
+
+pni_file_range_t *pni_file_range(int fd, int64_t offset, size_t size)
+{
+  struct stat st;
+  if (fstat(fd, &st)) return NULL;
+  if (offset < 0 || (uint64_t) st.st_size < (uint64_t) offset + size) {
+    errno = EINVAL;
+    return NULL;
+  }
+  pni_file_range_t *range = (pni_file_range_t *) pni_malloc(PN_ALLOC_IO, sizeof(pni_file_range_t));
+  if (!range) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  range->fd = dup(fd);
+  if (range->fd < 0) {
+    int err = errno;
+    pni_free(PN_ALLOC_IO, range);
+    errno = err;
+    return NULL;
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(range->fd, offset, size, POSIX_FADV_SEQUENTIAL);
+#endif
+  range->offset = offset;
+  range->remaining = size;
+  range->map = NULL;
+  range->map_size = 0;
+  range->buf = NULL;
+  return range;
+}
+
+static void pni_file_range_unmap(pni_file_range_t *range)
+{
+  if (range->map) {
+    munmap(range->map, range->map_size);
+    range->map = NULL;
+  }
+}
+
+int pni_file_range_next(pni_file_range_t *range, pn_bytes_t *window)
+{
+  pni_file_range_unmap(range);
+  *window = pn_bytes(0, NULL);
+  if (!range->remaining) return 0;
+
+  // windows start on a page, so the first may be short
+  static size_t page = 0;
+  if (!page) page = sysconf(_SC_PAGESIZE);
+  size_t skip = range->offset % page;
+  size_t n = pn_min(range->remaining, PNI_MAPPED_WINDOW - skip);
+
+  // a mapping past the end of the file faults when it is read, so a
+  // file cut short since the send is an error here instead
+  struct stat st;
+  if (fstat(range->fd, &st)) return PN_ERR;
+  if ((uint64_t) st.st_size < (uint64_t) range->offset + n) {
+    errno = EIO;
+    return PN_ERR;
+  }
+
+  const char *start = NULL;
+  if (!range->buf) {
+    void *map = mmap(NULL, skip + n, PROT_READ, MAP_SHARED, range->fd, range->offset - skip);
+    if (map != MAP_FAILED) {
+      range->map = map;
+      range->map_size = skip + n;
+      start = (const char *) map + skip;
+    } else {
+      // such as a file on a filesystem that cannot be mapped
+      range->buf = (char *) pni_malloc(PN_ALLOC_IO, PNI_MAPPED_WINDOW);
+      if (!range->buf) {
+        errno = ENOMEM;
+        return PN_ERR;
+      }
+    }
+  }
+  if (!start) {
+    size_t got = 0;
+    while (got < n) {
+      ssize_t r = pread(range->fd, range->buf + got, n - got, range->offset + got);
+      if (r < 0 && errno == EINTR) continue;
+      if (r <= 0) {
+        if (!r) errno = EIO;
+        return PN_ERR;
+      }
+      got += r;
+    }
+    start = range->buf;
+  }
+
+  range->offset += n;
+  range->remaining -= n;
+  *window = pn_bytes(n, start);
+  return 0;
+}
+
+size_t pni_file_range_remaining(pni_file_range_t *range)
+{
+  return range->remaining;
+}
+
+void pni_file_range_close(pni_file_range_t *range)
+{
+  if (!range) return;
+  pni_file_range_unmap(range);
+  close(range->fd);
+  pni_free(PN_ALLOC_IO, range->buf);
+  pni_free(PN_ALLOC_IO, range);
+}
@@ -27,10 +27,12 @@
 #include "platform.h"
 #include "selectable.h"
 #include "util.h"
+#include "deadlines.h"
+#include "alloc_private.h"
 
 struct pn_selector_t {
   struct pollfd *fds;
-  pn_timestamp_t *deadlines;
+  pni_deadlines_t deadlines;
   size_t capacity;
   pn_list_t *selectables;
   size_t current;
@@ -42,7 +44,7 @@ void pn_selector_initialize(void *obj)
 {
   pn_selector_t *selector = (pn_selector_t *) obj;
   selector->fds = NULL;
-  selector->deadlines = NULL;
+  pni_deadlines_init(&selector->deadlines);
   selector->capacity = 0;
   selector->selectables = pn_list(PN_WEAKREF, 0);
   selector->current = 0;
@@ -53,8 +55,8 @@ void pn_selector_initialize(void *obj)
 void pn_selector_finalize(void *obj)
 {
   pn_selector_t *selector = (pn_selector_t *) obj;
-  free(selector->fds);
-  free(selector->deadlines);
+  pni_free(PN_ALLOC_IO, selector->fds);
+  pni_deadlines_fini(&selector->deadlines);
   pn_free(selector->selectables);
   pn_error_free(selector->error);
 }
@@ -81,8 +83,7 @@ void pn_selector_add(pn_selector_t *selector, pn_selectable_t *selectable)
     size_t size = pn_list_size(selector->selectables);
 
     if (selector->capacity < size) {
-      selector->fds = (struct pollfd *) realloc(selector->fds, size*sizeof(struct pollfd));
-      selector->deadlines = (pn_timestamp_t *) realloc(selector->deadlines, size*sizeof(pn_timestamp_t));
+      selector->fds = (struct pollfd *) pni_realloc(PN_ALLOC_IO, selector->fds, size*sizeof(struct pollfd));
       selector->capacity = size;
     }
 
@@ -105,7 +106,16 @@ void pn_selector_update(pn_selector_t *selector, pn_selectable_t *selectable)
   if (pn_selectable_is_writing(selectable)) {
     selector->fds[idx].events |= POLLOUT;
   }
-  selector->deadlines[idx] = pn_selectable_get_deadline(selectable);
+  pni_deadlines_set(&selector->deadlines, idx, pn_selectable_get_deadline(selectable));
+}
+
+static void pni_selector_move(pn_selector_t *selector, size_t from, size_t to)
+{
+  pn_selectable_t *sel = (pn_selectable_t *) pn_list_get(selector->selectables, from);
+  pn_list_set(selector->selectables, to, sel);
+  selector->fds[to] = selector->fds[from];
+  pni_deadlines_move(&selector->deadlines, from, to);
+  pni_selectable_set_index(sel, to);
 }
 
 void pn_selector_remove(pn_selector_t *selector, pn_selectable_t *selectable)
@@ -115,19 +125,26 @@ void pn_selector_remove(pn_selector_t *selector, pn_selectable_t *selectable)
 
   int idx = pni_selectable_get_index(selectable);
   assert(idx >= 0);
-  pn_list_del(selector->selectables, idx, 1);
-  size_t size = pn_list_size(selector->selectables);
-  for (size_t i = idx; i < size; i++) {
-    pn_selectable_t *sel = (pn_selectable_t *) pn_list_get(selector->selectables, i);
-    pni_selectable_set_index(sel, i);
-    selector->fds[i] = selector->fds[i + 1];
-  }
-
-  pni_selectable_set_index(selectable, -1);
+  pni_deadlines_set(&selector->deadlines, idx, 0);
 
-  if (selector->current >= (size_t) idx) {
+  size_t hole = idx;
+  if (hole < selector->current) {
+    // keep the slots pn_selector_next has already visited below
+    // current so that the slot swapped in from the end is not skipped
     selector->current--;
+    if (hole != selector->current) {
+      pni_selector_move(selector, selector->current, hole);
+      hole = selector->current;
+    }
+  }
+
+  size_t last = pn_list_size(selector->selectables) - 1;
+  if (hole != last) {
+    pni_selector_move(selector, last, hole);
   }
+  pn_list_pop(selector->selectables);
+
+  pni_selectable_set_index(selectable, -1);
 }
 
 size_t pn_selector_size(pn_selector_t *selector) {
@@ -142,13 +159,7 @@ int pn_selector_select(pn_selector_t *selector, int timeout)
   size_t size = pn_list_size(selector->selectables);
 
   if (timeout) {
-    pn_timestamp_t deadline = 0;
-    for (size_t i = 0; i < size; i++) {
-      pn_timestamp_t d = selector->deadlines[i];
-      if (d)
-        deadline = (deadline == 0) ? d : pn_min(deadline, d);
-    }
-
+    pn_timestamp_t deadline = pni_deadlines_next(&selector->deadlines);
     if (deadline) {
       pn_timestamp_t now = pn_i_now();
       int64_t delta = deadline - now;
@@ -179,7 +190,7 @@ pn_selectable_t *pn_selector_next(pn_selector_t *selector, int *events)
   while (selector->current < size) {
     pn_selectable_t *sel = (pn_selectable_t *) pn_list_get(l, selector->current);
     struct pollfd *pfd = &selector->fds[selector->current];
-    pn_timestamp_t deadline = selector->deadlines[selector->current];
+    pn_timestamp_t deadline = pni_deadlines_get(&selector->deadlines, selector->current);
     int ev = 0;
     if (pfd->revents & POLLIN) {
       ev |= PN_READABLE;
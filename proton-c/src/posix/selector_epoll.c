@@ -0,0 +1,309 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/selector.h>
+#include <proton/error.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "platform.h"
+#include "selectable.h"
+#include "util.h"
+#include "deadlines.h"
+#include "alloc_private.h"
+
+// per selectable state, indexed by the selectable's index
+typedef struct {
+  pn_socket_t fd;           // fd as currently registered with epoll
+  uint32_t interest;        // events as currently registered with epoll
+  int events;               // PN_* events gathered by the last select
+  size_t epoch;             // last select this slot was reported for
+} pni_slot_t;
+
+struct pn_selector_t {
+  int epfd;
+  pni_slot_t *slots;
+  size_t capacity;
+  pn_list_t *selectables;
+  struct epoll_event *fired;
+  size_t fired_capacity;
+  pn_selectable_t **ready;
+  size_t ready_capacity;
+  size_t ready_count;
+  size_t current;
+  size_t epoch;
+  pni_deadlines_t deadlines;
+  pn_timestamp_t awoken;
+  pn_error_t *error;
+};
+
+void pn_selector_initialize(void *obj)
+{
+  pn_selector_t *selector = (pn_selector_t *) obj;
+  selector->epfd = epoll_create1(EPOLL_CLOEXEC);
+  selector->slots = NULL;
+  selector->capacity = 0;
+  selector->selectables = pn_list(PN_WEAKREF, 0);
+  selector->fired = NULL;
+  selector->fired_capacity = 0;
+  selector->ready = NULL;
+  selector->ready_capacity = 0;
+  selector->ready_count = 0;
+  selector->current = 0;
+  selector->epoch = 1;
+  pni_deadlines_init(&selector->deadlines);
+  selector->awoken = 0;
+  selector->error = pn_error();
+  if (selector->epfd < 0) {
+    pn_i_error_from_errno(selector->error, "epoll_create1");
+  }
+}
+
+void pn_selector_finalize(void *obj)
+{
+  pn_selector_t *selector = (pn_selector_t *) obj;
+  if (selector->epfd >= 0) {
+    close(selector->epfd);
+  }
+  pni_free(PN_ALLOC_IO, selector->slots);
+  pni_free(PN_ALLOC_IO, selector->fired);
+  pni_free(PN_ALLOC_IO, selector->ready);
+  pni_deadlines_fini(&selector->deadlines);
+  pn_free(selector->selectables);
+  pn_error_free(selector->error);
+}
+
+#define pn_selector_hashcode NULL
+#define pn_selector_compare NULL
+#define pn_selector_inspect NULL
+
+pn_selector_t *pni_selector(void)
+{
+  static const pn_class_t clazz = PN_CLASS(pn_selector);
+  pn_selector_t *selector = (pn_selector_t *) pn_class_new(&clazz, sizeof(pn_selector_t));
+  return selector;
+}
+
+static void pni_epoll_ctl(pn_selector_t *selector, int op, pn_socket_t fd,
+                          uint32_t interest, pn_selectable_t *selectable)
+{
+  struct epoll_event ev = {0};
+  ev.events = interest;
+  ev.data.ptr = selectable;
+  if (epoll_ctl(selector->epfd, op, fd, &ev) == -1) {
+    pn_i_error_from_errno(selector->error, "epoll_ctl");
+  }
+}
+
+void pn_selector_add(pn_selector_t *selector, pn_selectable_t *selectable)
+{
+  assert(selector);
+  assert(selectable);
+  assert(pni_selectable_get_index(selectable) < 0);
+
+  if (pni_selectable_get_index(selectable) < 0) {
+    pn_list_add(selector->selectables, selectable);
+    size_t size = pn_list_size(selector->selectables);
+    PN_ENSURE(PN_ALLOC_IO, selector->slots, selector->capacity, size, pni_slot_t);
+
+    pni_slot_t *slot = &selector->slots[size - 1];
+    slot->fd = PN_INVALID_SOCKET;
+    slot->interest = 0;
+    slot->events = 0;
+    slot->epoch = 0;
+    pni_selectable_set_index(selectable, size - 1);
+  }
+
+  pn_selector_update(selector, selectable);
+}
+
+void pn_selector_update(pn_selector_t *selector, pn_selectable_t *selectable)
+{
+  int idx = pni_selectable_get_index(selectable);
+  assert(idx >= 0);
+  pni_slot_t *slot = &selector->slots[idx];
+  pn_socket_t fd = pn_selectable_get_fd(selectable);
+  uint32_t interest = 0;
+  if (pn_selectable_is_reading(selectable)) {
+    interest |= EPOLLIN;
+  }
+  if (pn_selectable_is_writing(selectable)) {
+    interest |= EPOLLOUT;
+  }
+
+  // only talk to the kernel when the registration actually changes
+  if (fd != slot->fd) {
+    if (slot->fd != PN_INVALID_SOCKET) {
+      pni_epoll_ctl(selector, EPOLL_CTL_DEL, slot->fd, 0, selectable);
+    }
+    // invalid sockets are ignored, just as poll does
+    if (fd != PN_INVALID_SOCKET) {
+      pni_epoll_ctl(selector, EPOLL_CTL_ADD, fd, interest, selectable);
+    }
+    slot->fd = fd;
+    slot->interest = interest;
+  } else if (interest != slot->interest) {
+    if (fd != PN_INVALID_SOCKET) {
+      pni_epoll_ctl(selector, EPOLL_CTL_MOD, fd, interest, selectable);
+    }
+    slot->interest = interest;
+  }
+
+  pni_deadlines_set(&selector->deadlines, idx, pn_selectable_get_deadline(selectable));
+}
+
+void pn_selector_remove(pn_selector_t *selector, pn_selectable_t *selectable)
+{
+  assert(selector);
+  assert(selectable);
+
+  int idx = pni_selectable_get_index(selectable);
+  assert(idx >= 0);
+  pni_slot_t *slot = &selector->slots[idx];
+  if (slot->fd != PN_INVALID_SOCKET) {
+    struct epoll_event ev = {0};
+    // the fd may already have been closed, in which case the kernel
+    // has dropped it for us
+    epoll_ctl(selector->epfd, EPOLL_CTL_DEL, slot->fd, &ev);
+  }
+
+  // forget any pending readiness for this selectable
+  if (slot->epoch == selector->epoch) {
+    for (size_t i = 0; i < selector->ready_count; i++) {
+      if (selector->ready[i] == selectable) {
+        selector->ready[i] = NULL;
+      }
+    }
+  }
+
+  // swap the last selectable into the vacated slot
+  pni_deadlines_set(&selector->deadlines, idx, 0);
+  size_t last = pn_list_size(selector->selectables) - 1;
+  if ((size_t) idx != last) {
+    pn_selectable_t *moved = (pn_selectable_t *) pn_list_get(selector->selectables, last);
+    pn_list_set(selector->selectables, idx, moved);
+    selector->slots[idx] = selector->slots[last];
+    pni_deadlines_move(&selector->deadlines, last, idx);
+    pni_selectable_set_index(moved, idx);
+  }
+  pn_list_pop(selector->selectables);
+
+  pni_selectable_set_index(selectable, -1);
+}
+
+size_t pn_selector_size(pn_selector_t *selector) {
+  assert(selector);
+  return pn_list_size(selector->selectables);
+}
+
+static void pni_selector_ready(pn_selector_t *selector, pn_selectable_t *selectable, int events)
+{
+  pni_slot_t *slot = &selector->slots[pni_selectable_get_index(selectable)];
+  if (slot->epoch != selector->epoch) {
+    PN_ENSURE(PN_ALLOC_IO, selector->ready, selector->ready_capacity, selector->ready_count + 1, pn_selectable_t *);
+    selector->ready[selector->ready_count++] = selectable;
+    slot->epoch = selector->epoch;
+    slot->events = 0;
+  }
+  slot->events |= events;
+}
+
+static void pni_selector_expired(void *context, size_t idx)
+{
+  pn_selector_t *selector = (pn_selector_t *) context;
+  pn_selectable_t *sel = (pn_selectable_t *) pn_list_get(selector->selectables, idx);
+  pni_selector_ready(selector, sel, PN_EXPIRED);
+}
+
+int pn_selector_select(pn_selector_t *selector, int timeout)
+{
+  assert(selector);
+
+  size_t size = pn_list_size(selector->selectables);
+
+  if (timeout) {
+    pn_timestamp_t deadline = pni_deadlines_next(&selector->deadlines);
+    if (deadline) {
+      pn_timestamp_t now = pn_i_now();
+      int64_t delta = deadline - now;
+      if (delta < 0) {
+        timeout = 0;
+      } else if (delta < timeout) {
+        timeout = delta;
+      }
+    }
+  }
+
+  // anything left over from the previous select is discarded
+  selector->epoch++;
+  selector->ready_count = 0;
+  selector->current = 0;
+
+  PN_ENSURE(PN_ALLOC_IO, selector->fired, selector->fired_capacity, pn_max(size, (size_t) 1), struct epoll_event);
+
+  int error = 0;
+  int result = epoll_wait(selector->epfd, selector->fired, (int) selector->fired_capacity, timeout);
+  if (result == -1) {
+    error = pn_i_error_from_errno(selector->error, "epoll_wait");
+  } else {
+    for (int i = 0; i < result; i++) {
+      struct epoll_event *ev = &selector->fired[i];
+      pn_selectable_t *sel = (pn_selectable_t *) ev->data.ptr;
+      int events = 0;
+      if (ev->events & EPOLLIN) {
+        events |= PN_READABLE;
+      }
+      if (ev->events & (EPOLLERR | EPOLLHUP)) {
+        events |= PN_ERROR;
+      }
+      if (ev->events & EPOLLOUT) {
+        events |= PN_WRITABLE;
+      }
+      pni_selector_ready(selector, sel, events);
+    }
+    selector->awoken = pn_i_now();
+    pni_deadlines_expired(&selector->deadlines, selector->awoken, pni_selector_expired, selector);
+  }
+
+  return error;
+}
+
+pn_selectable_t *pn_selector_next(pn_selector_t *selector, int *events)
+{
+  while (selector->current < selector->ready_count) {
+    pn_selectable_t *sel = selector->ready[selector->current++];
+    if (!sel) continue;
+    pni_slot_t *slot = &selector->slots[pni_selectable_get_index(sel)];
+    if (slot->events) {
+      *events = slot->events;
+      return sel;
+    }
+  }
+
+  return NULL;
+}
+
+void pn_selector_free(pn_selector_t *selector)
+{
+  assert(selector);
+  pn_free(selector);
+}
@@ -0,0 +1,1036 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/selector.h>
+#include <proton/error.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "platform.h"
+#include "selectable.h"
+#include "util.h"
+#include "deadlines.h"
+#include "uring.h"
+#include "alloc_private.h"
+
+// Connected stream sockets are driven entirely through the ring: a
+// multishot recv keeps filling buffers from a ring of provided buffers,
+// and sends are staged per connection and go out with the next select,
+// so a busy reactor makes one system call per select however many
+// connections it serves. Anything else (listeners, the wakeup fd, or
+// every fd when the kernel lacks multishot recv) is watched with one
+// shot polls and read and written with the usual system calls.
+
+#define URING_ENTRIES (256)
+#define URING_CQ_ENTRIES (4096)
+#define URING_BUFFERS (256)           // a power of two
+#define URING_BUFFER_SIZE (16384)
+#define URING_SEND_MAX (65536)        // staged output per connection
+#define URING_LINGER (1000)           // ms to flush output when freed
+
+enum { URING_RECV = 1, URING_SEND, URING_POLL };
+enum { URING_IDLE, URING_ARMED, URING_CANCELLING };
+
+typedef struct {
+  uint16_t bid;
+  uint32_t size;
+  uint32_t offset;
+} pni_uring_chunk_t;
+
+typedef struct pni_uring_conn_t pni_uring_conn_t;
+
+// per fd state, outlives the selectable when the kernel still holds
+// requests for it or unsent output
+struct pni_uring_conn_t {
+  pn_socket_t fd;
+  dev_t dev;
+  ino_t ino;
+  int slot;                   // the selectable's index, -1 once removed
+  bool mapped;                // found by fd, until pn_close
+  bool dirty;                 // on the selector's dirty list
+  bool starved;               // the recv stopped for lack of buffers
+  bool stream;                // data goes through the ring
+  bool closing;               // close the fd once the output is gone
+  int ops;                    // requests the kernel has yet to finish
+  int recv;
+  bool eof;
+  int recv_error;
+  pni_uring_chunk_t *chunks;  // received, not yet read
+  size_t chunk_head;
+  size_t chunk_count;
+  size_t chunk_capacity;
+  char *flight;               // being sent, must not move
+  size_t flight_size;
+  size_t flight_offset;
+  size_t flight_capacity;
+  bool sending;
+  char *staged;               // waiting for the flight to land
+  size_t staged_size;
+  size_t staged_capacity;
+  int send_error;
+  int poll;
+  uint32_t poll_mask;
+  uint32_t revents;
+  pni_uring_conn_t *prev;
+  pni_uring_conn_t *next;
+};
+
+// per selectable state, indexed by the selectable's index
+typedef struct {
+  pni_uring_conn_t *conn;
+  int interest;               // PN_READABLE and PN_WRITABLE
+  int events;                 // PN_* events gathered by the last select
+  size_t epoch;               // last select this slot was reported for
+} pni_slot_t;
+
+struct pn_selector_t {
+  int ring;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_queued;         // our tail, ahead of the kernel's
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  struct io_uring_buf_ring *buf_ring;
+  char *buffers;
+  uint16_t buf_tail;
+  bool multishot;
+  pni_uring_conn_t **fds;     // indexed by fd
+  size_t fds_capacity;
+  pni_uring_conn_t *conns;
+  pni_uring_conn_t **dirty;
+  size_t dirty_count;
+  size_t dirty_capacity;
+  pni_uring_conn_t **starved;
+  size_t starved_count;
+  size_t starved_capacity;
+  pni_slot_t *slots;
+  size_t capacity;
+  pn_list_t *selectables;
+  pn_selectable_t **ready;
+  size_t ready_capacity;
+  size_t ready_count;
+  size_t current;
+  size_t epoch;
+  pni_deadlines_t deadlines;
+  pn_timestamp_t awoken;
+  pn_error_t *error;
+};
+
+static int pni_uring_register(pn_selector_t *selector, unsigned op, void *arg, unsigned count)
+{
+  return (int) syscall(__NR_io_uring_register, selector->ring, op, arg, count);
+}
+
+static int pni_uring_setup(pn_selector_t *selector)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  params.cq_entries = URING_CQ_ENTRIES;
+  selector->ring = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  if (selector->ring < 0 && errno == EINVAL) {
+    // older kernels refuse the flags they do not know
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_ENTRIES;
+    selector->ring = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  }
+  if (selector->ring < 0) {
+    return pn_i_error_from_errno(selector->error, "io_uring_setup");
+  }
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    return pn_error_format(selector->error, PN_ERR, "io_uring: kernel lacks timed waits");
+  }
+
+  selector->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  selector->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    selector->sq_ring_size = pn_max(selector->sq_ring_size, selector->cq_ring_size);
+  }
+  selector->sq_ring = mmap(NULL, selector->sq_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, selector->ring, IORING_OFF_SQ_RING);
+  if (selector->sq_ring == MAP_FAILED) {
+    selector->sq_ring = NULL;
+    return pn_i_error_from_errno(selector->error, "mmap");
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    selector->cq_ring = selector->sq_ring;
+  } else {
+    selector->cq_ring = mmap(NULL, selector->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, selector->ring, IORING_OFF_CQ_RING);
+    if (selector->cq_ring == MAP_FAILED) {
+      selector->cq_ring = NULL;
+      return pn_i_error_from_errno(selector->error, "mmap");
+    }
+  }
+  selector->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  selector->sqes = (struct io_uring_sqe *) mmap(NULL, selector->sqes_size, PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, selector->ring, IORING_OFF_SQES);
+  if (selector->sqes == MAP_FAILED) {
+    selector->sqes = NULL;
+    return pn_i_error_from_errno(selector->error, "mmap");
+  }
+
+  char *sq = (char *) selector->sq_ring;
+  char *cq = (char *) selector->cq_ring;
+  selector->sq_head = (unsigned *) (sq + params.sq_off.head);
+  selector->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  selector->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+  selector->sq_entries = params.sq_entries;
+  selector->sq_queued = *selector->sq_tail;
+  unsigned *array = (unsigned *) (sq + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; i++) {
+    array[i] = i;
+  }
+  selector->cq_head = (unsigned *) (cq + params.cq_off.head);
+  selector->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  selector->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+  selector->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  // without provided buffers everything is watched with polls
+  size_t ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+  void *buf_ring = NULL;
+  if (posix_memalign(&buf_ring, sysconf(_SC_PAGESIZE), ring_size)) return 0;
+  selector->buffers = (char *) pni_malloc(PN_ALLOC_IO, (size_t) URING_BUFFERS * URING_BUFFER_SIZE);
+  if (!selector->buffers) {
+    pni_free(PN_ALLOC_IO, buf_ring);
+    return 0;
+  }
+  memset(buf_ring, 0, ring_size);
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uintptr_t) buf_ring;
+  reg.ring_entries = URING_BUFFERS;
+  reg.bgid = 0;
+  if (pni_uring_register(selector, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    pni_free(PN_ALLOC_IO, buf_ring);
+    pni_free(PN_ALLOC_IO, selector->buffers);
+    selector->buffers = NULL;
+    return 0;
+  }
+  selector->buf_ring = (struct io_uring_buf_ring *) buf_ring;
+  for (unsigned i = 0; i < URING_BUFFERS; i++) {
+    struct io_uring_buf *buf = &selector->buf_ring->bufs[i];
+    buf->addr = (uintptr_t) (selector->buffers + (size_t) i * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = i;
+  }
+  selector->buf_tail = URING_BUFFERS;
+  __atomic_store_n(&selector->buf_ring->tail, selector->buf_tail, __ATOMIC_RELEASE);
+  selector->multishot = true;
+  return 0;
+}
+
+// submit whatever is queued, and when reaping collect the completions
+// waiting for at most timeout ms as for poll
+static int pni_uring_enter(pn_selector_t *selector, bool reap, int timeout)
+{
+  unsigned queued = selector->sq_queued - __atomic_load_n(selector->sq_head, __ATOMIC_ACQUIRE);
+  __atomic_store_n(selector->sq_tail, selector->sq_queued, __ATOMIC_RELEASE);
+  if (!queued && !reap) return 0;
+
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  unsigned flags = IORING_ENTER_EXT_ARG;
+  unsigned min_complete = 0;
+  if (reap) {
+    // completions are only posted when we enter, even if not waiting
+    flags |= IORING_ENTER_GETEVENTS;
+    min_complete = timeout ? 1 : 0;
+    if (timeout > 0) {
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = (timeout % 1000) * 1000000LL;
+      arg.ts = (uintptr_t) &ts;
+    }
+  }
+  int rc = (int) syscall(__NR_io_uring_enter, selector->ring, queued, min_complete, flags,
+                         &arg, sizeof(arg));
+  if (rc < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+    return pn_i_error_from_errno(selector->error, "io_uring_enter");
+  }
+  return 0;
+}
+
+static struct io_uring_sqe *pni_uring_sqe(pn_selector_t *selector)
+{
+  if (selector->sq_queued - __atomic_load_n(selector->sq_head, __ATOMIC_ACQUIRE) >= selector->sq_entries) {
+    pni_uring_enter(selector, false, 0);
+    // the completion queue is backed up, let the kernel catch up
+    while (selector->sq_queued - __atomic_load_n(selector->sq_head, __ATOMIC_ACQUIRE) >= selector->sq_entries) {
+      pni_uring_enter(selector, true, 1);
+    }
+  }
+  struct io_uring_sqe *sqe = &selector->sqes[selector->sq_queued & selector->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  selector->sq_queued++;
+  return sqe;
+}
+
+static uint64_t pni_uring_data(pni_uring_conn_t *conn, int op)
+{
+  return (uint64_t) (uintptr_t) conn | op;
+}
+
+static void pni_uring_cancel(pn_selector_t *selector, pni_uring_conn_t *conn, int op)
+{
+  struct io_uring_sqe *sqe = pni_uring_sqe(selector);
+  sqe->opcode = op == URING_POLL ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = pni_uring_data(conn, op);
+  sqe->user_data = 0;
+}
+
+static void pni_uring_dirty(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  if (conn->dirty) return;
+  PN_ENSURE(PN_ALLOC_IO, selector->dirty, selector->dirty_capacity, selector->dirty_count + 1, pni_uring_conn_t *);
+  selector->dirty[selector->dirty_count++] = conn;
+  conn->dirty = true;
+}
+
+static void pni_uring_recycle(pn_selector_t *selector, uint16_t bid)
+{
+  struct io_uring_buf *buf = &selector->buf_ring->bufs[selector->buf_tail & (URING_BUFFERS - 1)];
+  buf->addr = (uintptr_t) (selector->buffers + (size_t) bid * URING_BUFFER_SIZE);
+  buf->len = URING_BUFFER_SIZE;
+  buf->bid = bid;
+  selector->buf_tail++;
+  __atomic_store_n(&selector->buf_ring->tail, selector->buf_tail, __ATOMIC_RELEASE);
+
+  // whoever ran dry can receive again
+  for (size_t i = 0; i < selector->starved_count; i++) {
+    selector->starved[i]->starved = false;
+    pni_uring_dirty(selector, selector->starved[i]);
+  }
+  selector->starved_count = 0;
+}
+
+static void pni_uring_discard(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  for (size_t i = 0; i < conn->chunk_count; i++) {
+    pni_uring_recycle(selector, conn->chunks[conn->chunk_head + i].bid);
+  }
+  conn->chunk_head = 0;
+  conn->chunk_count = 0;
+}
+
+static pni_uring_conn_t *pni_uring_lookup(pn_selector_t *selector, pn_socket_t fd)
+{
+  if (fd < 0 || (size_t) fd >= selector->fds_capacity) return NULL;
+  return selector->fds[fd];
+}
+
+static void pni_uring_unmap(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  if (!conn->mapped) return;
+  selector->fds[conn->fd] = NULL;
+  conn->mapped = false;
+}
+
+static void pni_uring_release(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  if (conn->mapped || conn->slot >= 0 || conn->dirty || conn->starved || conn->ops) return;
+  if (conn->closing && conn->fd != PN_INVALID_SOCKET) return;
+  pni_uring_discard(selector, conn);
+  if (conn->prev) {
+    conn->prev->next = conn->next;
+  } else {
+    selector->conns = conn->next;
+  }
+  if (conn->next) conn->next->prev = conn->prev;
+  pni_free(PN_ALLOC_IO, conn->chunks);
+  pni_free(PN_ALLOC_IO, conn->flight);
+  pni_free(PN_ALLOC_IO, conn->staged);
+  pni_free(PN_ALLOC_IO, conn);
+}
+
+// stop everything the kernel is doing for a connection
+static void pni_uring_quiesce(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  pni_uring_unmap(selector, conn);
+  conn->closing = true;
+  if (conn->recv == URING_ARMED) {
+    pni_uring_cancel(selector, conn, URING_RECV);
+    conn->recv = URING_CANCELLING;
+  }
+  if (conn->poll == URING_ARMED) {
+    pni_uring_cancel(selector, conn, URING_POLL);
+    conn->poll = URING_CANCELLING;
+  }
+  pni_uring_discard(selector, conn);
+  pni_uring_dirty(selector, conn);
+}
+
+static void pni_uring_forget(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  pni_uring_quiesce(selector, conn);
+  // the fd is not ours to close
+  conn->fd = PN_INVALID_SOCKET;
+}
+
+static pni_uring_conn_t *pni_uring_conn(pn_selector_t *selector, pn_socket_t fd)
+{
+  struct stat st;
+  if (fstat(fd, &st)) {
+    st.st_dev = 0;
+    st.st_ino = 0;
+  }
+  pni_uring_conn_t *conn = pni_uring_lookup(selector, fd);
+  if (conn) {
+    if (conn->dev == st.st_dev && conn->ino == st.st_ino) return conn;
+    // the fd was closed behind our back and has been reused
+    pni_uring_forget(selector, conn);
+  }
+
+  conn = (pni_uring_conn_t *) pni_calloc(PN_ALLOC_IO, 1, sizeof(pni_uring_conn_t));
+  if (!conn) return NULL;
+  conn->fd = fd;
+  conn->dev = st.st_dev;
+  conn->ino = st.st_ino;
+  conn->slot = -1;
+  conn->recv = URING_IDLE;
+  conn->poll = URING_IDLE;
+
+  if (selector->multishot) {
+    int type = 0, listening = 0;
+    socklen_t len = sizeof(type);
+    if (!getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) && type == SOCK_STREAM) {
+      len = sizeof(listening);
+      conn->stream = !getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) && !listening;
+    }
+  }
+
+  PN_ENSUREZ(PN_ALLOC_IO, selector->fds, selector->fds_capacity, (size_t) fd + 1, pni_uring_conn_t *);
+  selector->fds[fd] = conn;
+  conn->mapped = true;
+  conn->next = selector->conns;
+  if (conn->next) conn->next->prev = conn;
+  selector->conns = conn;
+  return conn;
+}
+
+static int pni_uring_interest(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  if (conn->slot < 0 || conn->closing) return 0;
+  return selector->slots[conn->slot].interest;
+}
+
+static void pni_uring_send_flight(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  struct io_uring_sqe *sqe = pni_uring_sqe(selector);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = conn->fd;
+  sqe->addr = (uintptr_t) (conn->flight + conn->flight_offset);
+  sqe->len = conn->flight_size - conn->flight_offset;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = pni_uring_data(conn, URING_SEND);
+  conn->ops++;
+}
+
+// the staged output takes off once the previous flight has landed, one
+// send at a time keeps the stream in order
+static void pni_uring_send_staged(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  if (conn->sending || !conn->staged_size) return;
+  char *buf = conn->flight;
+  size_t capacity = conn->flight_capacity;
+  conn->flight = conn->staged;
+  conn->flight_capacity = conn->staged_capacity;
+  conn->flight_size = conn->staged_size;
+  conn->flight_offset = 0;
+  conn->staged = buf;
+  conn->staged_capacity = capacity;
+  conn->staged_size = 0;
+  conn->sending = true;
+  pni_uring_send_flight(selector, conn);
+}
+
+// bring the kernel's requests for a connection in line with what its
+// selectable is interested in
+static void pni_uring_sync(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  int interest = pni_uring_interest(selector, conn);
+  if (conn->stream) {
+    bool want = (interest & PN_READABLE) && !conn->eof && !conn->recv_error;
+    if (want && conn->recv == URING_IDLE && !conn->starved) {
+      struct io_uring_sqe *sqe = pni_uring_sqe(selector);
+      sqe->opcode = IORING_OP_RECV;
+      sqe->fd = conn->fd;
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = 0;
+      sqe->user_data = pni_uring_data(conn, URING_RECV);
+      conn->ops++;
+      conn->recv = URING_ARMED;
+    } else if (!want && conn->recv == URING_ARMED) {
+      pni_uring_cancel(selector, conn, URING_RECV);
+      conn->recv = URING_CANCELLING;
+    }
+  } else {
+    uint32_t want = 0;
+    if (interest & PN_READABLE) want |= POLLIN;
+    if (interest & PN_WRITABLE) want |= POLLOUT;
+    if (want && conn->poll == URING_IDLE) {
+      struct io_uring_sqe *sqe = pni_uring_sqe(selector);
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = conn->fd;
+      sqe->poll32_events = want;
+      sqe->user_data = pni_uring_data(conn, URING_POLL);
+      conn->ops++;
+      conn->poll = URING_ARMED;
+      conn->poll_mask = want;
+    } else if (conn->poll == URING_ARMED && (!want || (want & ~conn->poll_mask))) {
+      pni_uring_cancel(selector, conn, URING_POLL);
+      conn->poll = URING_CANCELLING;
+    }
+  }
+}
+
+static bool pni_uring_unsynced(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  int interest = pni_uring_interest(selector, conn);
+  if (conn->stream) {
+    bool want = (interest & PN_READABLE) && !conn->eof && !conn->recv_error;
+    return (want && conn->recv == URING_IDLE && !conn->starved) || (!want && conn->recv == URING_ARMED);
+  } else {
+    return interest ? conn->poll == URING_IDLE : conn->poll == URING_ARMED;
+  }
+}
+
+static int pni_uring_events(pn_selector_t *selector, pni_uring_conn_t *conn)
+{
+  int interest = pni_uring_interest(selector, conn);
+  int events = 0;
+  if (conn->stream) {
+    if ((interest & PN_READABLE) && (conn->chunk_count || conn->eof || conn->recv_error)) {
+      events |= PN_READABLE;
+    }
+    if ((interest & PN_WRITABLE) && (conn->send_error || conn->staged_size < URING_SEND_MAX)) {
+      events |= PN_WRITABLE;
+    }
+  } else {
+    if ((interest & PN_READABLE) && (conn->revents & POLLIN)) events |= PN_READABLE;
+    if ((interest & PN_WRITABLE) && (conn->revents & POLLOUT)) events |= PN_WRITABLE;
+    if (interest && (conn->revents & (POLLERR | POLLHUP))) events |= PN_ERROR;
+  }
+  return events;
+}
+
+static void pni_uring_close_fd(pni_uring_conn_t *conn)
+{
+  close(conn->fd);
+  conn->fd = PN_INVALID_SOCKET;
+}
+
+static void pni_uring_recv_done(pn_selector_t *selector, pni_uring_conn_t *conn, struct io_uring_cqe *cqe)
+{
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe->res > 0 && !conn->closing) {
+      if (conn->chunk_head + conn->chunk_count == conn->chunk_capacity && conn->chunk_head) {
+        memmove(conn->chunks, conn->chunks + conn->chunk_head, conn->chunk_count * sizeof(pni_uring_chunk_t));
+        conn->chunk_head = 0;
+      }
+      PN_ENSURE(PN_ALLOC_IO, conn->chunks, conn->chunk_capacity, conn->chunk_head + conn->chunk_count + 1, pni_uring_chunk_t);
+      pni_uring_chunk_t *chunk = &conn->chunks[conn->chunk_head + conn->chunk_count++];
+      chunk->bid = bid;
+      chunk->size = cqe->res;
+      chunk->offset = 0;
+    } else {
+      pni_uring_recycle(selector, bid);
+    }
+  } else if (cqe->res == 0) {
+    conn->eof = true;
+  } else if (cqe->res == -ENOBUFS) {
+    if (!conn->starved) {
+      PN_ENSURE(PN_ALLOC_IO, selector->starved, selector->starved_capacity, selector->starved_count + 1, pni_uring_conn_t *);
+      selector->starved[selector->starved_count++] = conn;
+      conn->starved = true;
+    }
+  } else if (cqe->res == -EINVAL && !conn->chunk_count && !conn->eof) {
+    // no multishot recv in this kernel, fall back to polling
+    selector->multishot = false;
+    conn->stream = false;
+  } else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+    conn->recv_error = -cqe->res;
+  }
+
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    conn->recv = URING_IDLE;
+    conn->ops--;
+  }
+}
+
+static void pni_uring_send_done(pn_selector_t *selector, pni_uring_conn_t *conn, struct io_uring_cqe *cqe)
+{
+  if (cqe->res < 0) {
+    conn->send_error = cqe->res == -ECANCELED ? EPIPE : -cqe->res;
+    conn->sending = false;
+    conn->staged_size = 0;
+  } else {
+    conn->flight_offset += cqe->res;
+    if (conn->flight_offset < conn->flight_size) {
+      // a short send, the rest goes before anything staged since
+      pni_uring_send_flight(selector, conn);
+    } else {
+      conn->sending = false;
+      pni_uring_send_staged(selector, conn);
+    }
+  }
+  conn->ops--;
+  if (conn->closing && !conn->sending && conn->fd != PN_INVALID_SOCKET) {
+    pni_uring_close_fd(conn);
+  }
+}
+
+static void pni_uring_poll_done(pn_selector_t *selector, pni_uring_conn_t *conn, struct io_uring_cqe *cqe)
+{
+  if (cqe->res >= 0) {
+    conn->revents |= cqe->res;
+  } else if (cqe->res != -ECANCELED) {
+    conn->revents |= POLLERR;
+  }
+  conn->poll = URING_IDLE;
+  conn->ops--;
+}
+
+static void pni_uring_reap(pn_selector_t *selector)
+{
+  unsigned head = *selector->cq_head;
+  unsigned tail = __atomic_load_n(selector->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &selector->cqes[head & selector->cq_mask];
+    pni_uring_conn_t *conn = (pni_uring_conn_t *) (uintptr_t) (cqe->user_data & ~(uint64_t) 7);
+    int op = (int) (cqe->user_data & 7);
+    if (conn) {
+      switch (op) {
+      case URING_RECV: pni_uring_recv_done(selector, conn, cqe); break;
+      case URING_SEND: pni_uring_send_done(selector, conn, cqe); break;
+      case URING_POLL: pni_uring_poll_done(selector, conn, cqe); break;
+      }
+      pni_uring_dirty(selector, conn);
+    }
+    head++;
+    if (head == tail) {
+      __atomic_store_n(selector->cq_head, head, __ATOMIC_RELEASE);
+      tail = __atomic_load_n(selector->cq_tail, __ATOMIC_ACQUIRE);
+    }
+  }
+}
+
+void pn_selector_initialize(void *obj)
+{
+  pn_selector_t *selector = (pn_selector_t *) obj;
+  memset(selector, 0, sizeof(*selector));
+  selector->ring = -1;
+  selector->selectables = pn_list(PN_WEAKREF, 0);
+  selector->epoch = 1;
+  pni_deadlines_init(&selector->deadlines);
+  selector->error = pn_error();
+  pni_uring_setup(selector);
+}
+
+void pn_selector_finalize(void *obj)
+{
+  pn_selector_t *selector = (pn_selector_t *) obj;
+
+  // give the output of closed connections a chance to get out
+  if (selector->ring >= 0 && selector->sqes) {
+    pn_timestamp_t deadline = pn_i_now() + URING_LINGER;
+    while (true) {
+      bool sending = false;
+      for (pni_uring_conn_t *conn = selector->conns; conn; conn = conn->next) {
+        if (conn->closing && conn->sending) sending = true;
+      }
+      pn_timestamp_t now = pn_i_now();
+      if (!sending || now >= deadline) break;
+      pni_uring_enter(selector, true, (int) (deadline - now));
+      pni_uring_reap(selector);
+    }
+
+    // the kernel must be done with our buffers before they are freed
+    struct io_uring_sqe *sqe = pni_uring_sqe(selector);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = 0;
+    deadline = pn_i_now() + URING_LINGER;
+    while (true) {
+      bool busy = false;
+      for (pni_uring_conn_t *conn = selector->conns; conn; conn = conn->next) {
+        if (conn->ops) busy = true;
+      }
+      pn_timestamp_t now = pn_i_now();
+      if (!busy || now >= deadline) break;
+      pni_uring_enter(selector, true, (int) (deadline - now));
+      pni_uring_reap(selector);
+    }
+  }
+
+  while (selector->conns) {
+    pni_uring_conn_t *conn = selector->conns;
+    selector->conns = conn->next;
+    if (conn->closing && conn->fd != PN_INVALID_SOCKET) close(conn->fd);
+    pni_free(PN_ALLOC_IO, conn->chunks);
+    pni_free(PN_ALLOC_IO, conn->flight);
+    pni_free(PN_ALLOC_IO, conn->staged);
+    pni_free(PN_ALLOC_IO, conn);
+  }
+  if (selector->sqes) munmap(selector->sqes, selector->sqes_size);
+  if (selector->cq_ring && selector->cq_ring != selector->sq_ring) munmap(selector->cq_ring, selector->cq_ring_size);
+  if (selector->sq_ring) munmap(selector->sq_ring, selector->sq_ring_size);
+  // closing the ring drops the kernel's hold on the buffers
+  if (selector->ring >= 0) close(selector->ring);
+  pni_free(PN_ALLOC_IO, selector->buf_ring);
+  pni_free(PN_ALLOC_IO, selector->buffers);
+  pni_free(PN_ALLOC_IO, selector->fds);
+  pni_free(PN_ALLOC_IO, selector->dirty);
+  pni_free(PN_ALLOC_IO, selector->starved);
+  pni_free(PN_ALLOC_IO, selector->slots);
+  pni_free(PN_ALLOC_IO, selector->ready);
+  pni_deadlines_fini(&selector->deadlines);
+  pn_free(selector->selectables);
+  pn_error_free(selector->error);
+}
+
+#define pn_selector_hashcode NULL
+#define pn_selector_compare NULL
+#define pn_selector_inspect NULL
+
+pn_selector_t *pni_selector(void)
+{
+  static const pn_class_t clazz = PN_CLASS(pn_selector);
+  pn_selector_t *selector = (pn_selector_t *) pn_class_new(&clazz, sizeof(pn_selector_t));
+  return selector;
+}
+
+static void pni_uring_detach(pn_selector_t *selector, pni_slot_t *slot)
+{
+  pni_uring_conn_t *conn = slot->conn;
+  if (!conn) return;
+  conn->slot = -1;
+  slot->conn = NULL;
+  pni_uring_dirty(selector, conn);
+}
+
+void pn_selector_add(pn_selector_t *selector, pn_selectable_t *selectable)
+{
+  assert(selector);
+  assert(selectable);
+  assert(pni_selectable_get_index(selectable) < 0);
+
+  if (pni_selectable_get_index(selectable) < 0) {
+    pn_list_add(selector->selectables, selectable);
+    size_t size = pn_list_size(selector->selectables);
+    PN_ENSURE(PN_ALLOC_IO, selector->slots, selector->capacity, size, pni_slot_t);
+
+    pni_slot_t *slot = &selector->slots[size - 1];
+    slot->conn = NULL;
+    slot->interest = 0;
+    slot->events = 0;
+    slot->epoch = 0;
+    pni_selectable_set_index(selectable, size - 1);
+  }
+
+  pn_selector_update(selector, selectable);
+}
+
+void pn_selector_update(pn_selector_t *selector, pn_selectable_t *selectable)
+{
+  int idx = pni_selectable_get_index(selectable);
+  assert(idx >= 0);
+  pni_slot_t *slot = &selector->slots[idx];
+  pn_socket_t fd = pn_selectable_get_fd(selectable);
+  int interest = 0;
+  if (pn_selectable_is_reading(selectable)) {
+    interest |= PN_READABLE;
+  }
+  if (pn_selectable_is_writing(selectable)) {
+    interest |= PN_WRITABLE;
+  }
+
+  if (slot->conn && slot->conn->fd != fd) {
+    pni_uring_detach(selector, slot);
+  }
+  // invalid sockets are ignored, just as poll does
+  if (!slot->conn && fd != PN_INVALID_SOCKET && selector->sqes) {
+    pni_uring_conn_t *conn = pni_uring_conn(selector, fd);
+    if (conn) {
+      conn->slot = idx;
+      slot->conn = conn;
+    }
+  }
+  slot->interest = interest;
+  // the kernel hears about it with the next select
+  if (slot->conn) pni_uring_dirty(selector, slot->conn);
+
+  pni_deadlines_set(&selector->deadlines, idx, pn_selectable_get_deadline(selectable));
+}
+
+void pn_selector_remove(pn_selector_t *selector, pn_selectable_t *selectable)
+{
+  assert(selector);
+  assert(selectable);
+
+  int idx = pni_selectable_get_index(selectable);
+  assert(idx >= 0);
+  pni_slot_t *slot = &selector->slots[idx];
+  pni_uring_detach(selector, slot);
+
+  // forget any pending readiness for this selectable
+  if (slot->epoch == selector->epoch) {
+    for (size_t i = 0; i < selector->ready_count; i++) {
+      if (selector->ready[i] == selectable) {
+        selector->ready[i] = NULL;
+      }
+    }
+  }
+
+  // swap the last selectable into the vacated slot
+  pni_deadlines_set(&selector->deadlines, idx, 0);
+  size_t last = pn_list_size(selector->selectables) - 1;
+  if ((size_t) idx != last) {
+    pn_selectable_t *moved = (pn_selectable_t *) pn_list_get(selector->selectables, last);
+    pn_list_set(selector->selectables, idx, moved);
+    selector->slots[idx] = selector->slots[last];
+    if (selector->slots[idx].conn) selector->slots[idx].conn->slot = idx;
+    pni_deadlines_move(&selector->deadlines, last, idx);
+    pni_selectable_set_index(moved, idx);
+  }
+  pn_list_pop(selector->selectables);
+
+  pni_selectable_set_index(selectable, -1);
+}
+
+size_t pn_selector_size(pn_selector_t *selector) {
+  assert(selector);
+  return pn_list_size(selector->selectables);
+}
+
+static void pni_selector_ready(pn_selector_t *selector, pn_selectable_t *selectable, int events)
+{
+  pni_slot_t *slot = &selector->slots[pni_selectable_get_index(selectable)];
+  if (slot->epoch != selector->epoch) {
+    PN_ENSURE(PN_ALLOC_IO, selector->ready, selector->ready_capacity, selector->ready_count + 1, pn_selectable_t *);
+    selector->ready[selector->ready_count++] = selectable;
+    slot->epoch = selector->epoch;
+    slot->events = 0;
+  }
+  slot->events |= events;
+}
+
+static void pni_selector_expired(void *context, size_t idx)
+{
+  pn_selector_t *selector = (pn_selector_t *) context;
+  pn_selectable_t *sel = (pn_selectable_t *) pn_list_get(selector->selectables, idx);
+  pni_selector_ready(selector, sel, PN_EXPIRED);
+}
+
+int pn_selector_select(pn_selector_t *selector, int timeout)
+{
+  assert(selector);
+  if (!selector->sqes) {
+    return pn_error_code(selector->error) ? pn_error_code(selector->error) : PN_ERR;
+  }
+
+  if (timeout) {
+    pn_timestamp_t deadline = pni_deadlines_next(&selector->deadlines);
+    if (deadline) {
+      pn_timestamp_t now = pn_i_now();
+      int64_t delta = deadline - now;
+      if (delta < 0) {
+        timeout = 0;
+      } else if (delta < timeout || timeout < 0) {
+        timeout = delta;
+      }
+    }
+  }
+
+  // anything left over from the previous select is discarded
+  selector->epoch++;
+  selector->ready_count = 0;
+  selector->current = 0;
+
+  // tell the kernel about everything touched since the last select, if
+  // any of it is ready already there is no point in waiting
+  bool ready = false;
+  for (size_t i = 0; i < selector->dirty_count; i++) {
+    pni_uring_conn_t *conn = selector->dirty[i];
+    pni_uring_sync(selector, conn);
+    if (pni_uring_events(selector, conn)) ready = true;
+  }
+
+  // with work in hand the kernel's completions can wait for the next
+  // select, unless there is something to submit anyway
+  int error = 0;
+  bool queued = selector->sq_queued != __atomic_load_n(selector->sq_head, __ATOMIC_ACQUIRE);
+  if (!ready || queued) {
+    error = pni_uring_enter(selector, true, ready ? 0 : timeout);
+  }
+  pni_uring_reap(selector);
+
+  // report and keep what is ready, or still needs the kernel told
+  size_t kept = 0;
+  for (size_t i = 0; i < selector->dirty_count; i++) {
+    pni_uring_conn_t *conn = selector->dirty[i];
+    int events = pni_uring_events(selector, conn);
+    if (events) {
+      pni_selector_ready(selector, (pn_selectable_t *) pn_list_get(selector->selectables, conn->slot), events);
+      conn->revents = 0;
+    }
+    if (events || pni_uring_unsynced(selector, conn)) {
+      selector->dirty[kept++] = conn;
+    } else {
+      conn->dirty = false;
+      pni_uring_release(selector, conn);
+    }
+  }
+  selector->dirty_count = kept;
+
+  selector->awoken = pn_i_now();
+  pni_deadlines_expired(&selector->deadlines, selector->awoken, pni_selector_expired, selector);
+  return error;
+}
+
+pn_selectable_t *pn_selector_next(pn_selector_t *selector, int *events)
+{
+  while (selector->current < selector->ready_count) {
+    pn_selectable_t *sel = selector->ready[selector->current++];
+    if (!sel) continue;
+    pni_slot_t *slot = &selector->slots[pni_selectable_get_index(sel)];
+    if (slot->events) {
+      *events = slot->events;
+      return sel;
+    }
+  }
+
+  return NULL;
+}
+
+void pn_selector_free(pn_selector_t *selector)
+{
+  assert(selector);
+  pn_free(selector);
+}
+
+bool pni_uring_recv(pn_selector_t *selector, pn_socket_t fd, void *buf, size_t size, ssize_t *result)
+{
+  pni_uring_conn_t *conn = pni_uring_lookup(selector, fd);
+  if (!conn || !conn->stream) return false;
+
+  size_t count = 0;
+  while (count < size && conn->chunk_count) {
+    pni_uring_chunk_t *chunk = &conn->chunks[conn->chunk_head];
+    size_t n = pn_min(size - count, (size_t) (chunk->size - chunk->offset));
+    memcpy((char *) buf + count, selector->buffers + (size_t) chunk->bid * URING_BUFFER_SIZE + chunk->offset, n);
+    count += n;
+    chunk->offset += n;
+    if (chunk->offset == chunk->size) {
+      conn->chunk_head++;
+      conn->chunk_count--;
+      pni_uring_recycle(selector, chunk->bid);
+    }
+  }
+  if (!conn->chunk_count) conn->chunk_head = 0;
+
+  if (count || !size) {
+    *result = count;
+  } else if (conn->recv_error) {
+    errno = conn->recv_error;
+    *result = -1;
+  } else if (conn->eof) {
+    *result = 0;
+  } else {
+    errno = EAGAIN;
+    *result = -1;
+  }
+  pni_uring_dirty(selector, conn);
+  return true;
+}
+
+bool pni_uring_send(pn_selector_t *selector, pn_socket_t fd, const void *buf, size_t size, ssize_t *result)
+{
+  pni_uring_conn_t *conn = pni_uring_lookup(selector, fd);
+  if (!conn || !conn->stream) return false;
+
+  if (conn->send_error) {
+    errno = conn->send_error;
+    *result = -1;
+    return true;
+  }
+  size_t n = pn_min(size, (size_t) URING_SEND_MAX - conn->staged_size);
+  if (!n && size) {
+    errno = EAGAIN;
+    *result = -1;
+    return true;
+  }
+  if (conn->staged_size + n > conn->staged_capacity) {
+    size_t capacity = pn_max(conn->staged_capacity * 2, (size_t) 4096);
+    while (capacity < conn->staged_size + n) capacity *= 2;
+    capacity = pn_min(capacity, (size_t) URING_SEND_MAX);
+    char *staged = (char *) pni_realloc(PN_ALLOC_IO, conn->staged, capacity);
+    if (!staged) {
+      errno = ENOMEM;
+      *result = -1;
+      return true;
+    }
+    conn->staged = staged;
+    conn->staged_capacity = capacity;
+  }
+  memcpy(conn->staged + conn->staged_size, buf, n);
+  conn->staged_size += n;
+  pni_uring_send_staged(selector, conn);
+  pni_uring_dirty(selector, conn);
+  *result = n;
+  return true;
+}
+
+bool pni_uring_close(pn_selector_t *selector, pn_socket_t fd)
+{
+  pni_uring_conn_t *conn = pni_uring_lookup(selector, fd);
+  if (!conn) return false;
+
+  pni_uring_quiesce(selector, conn);
+  // nothing queued for the fd may outlive it, its number can be reused
+  pni_uring_enter(selector, false, 0);
+  if (!conn->sending) pni_uring_close_fd(conn);
+  return true;
+}
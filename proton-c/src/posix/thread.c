@@ -0,0 +1,291 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <proton/error.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include "thread.h"
+#include "alloc_private.h"
+
+struct pni_thread_t {
+  pthread_t thread;
+  void (*run)(void *);
+  void *context;
+};
+
+struct pni_mutex_t {
+  pthread_mutex_t mutex;
+};
+
+struct pni_semaphore_t {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  size_t count;
+};
+
+static void *pni_thread_run(void *arg)
+{
+  pni_thread_t *thread = (pni_thread_t *) arg;
+  thread->run(thread->context);
+  return NULL;
+}
+
+pni_thread_t *pni_thread(void (*run)(void *), void *context)
+{
+  pni_thread_t *thread = (pni_thread_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pni_thread_t));
+  if (!thread) return NULL;
+  thread->run = run;
+  thread->context = context;
+  if (pthread_create(&thread->thread, NULL, pni_thread_run, thread)) {
+    pni_free(PN_ALLOC_OBJECT, thread);
+    return NULL;
+  }
+  return thread;
+}
+
+void pni_thread_join(pni_thread_t *thread)
+{
+  if (thread) {
+    pthread_join(thread->thread, NULL);
+    pni_free(PN_ALLOC_OBJECT, thread);
+  }
+}
+
+#ifdef __linux__
+
+static int pni_thread_pin(pni_thread_t *thread, cpu_set_t *set)
+{
+  int err = pthread_setaffinity_np(thread->thread, sizeof(cpu_set_t), set);
+  if (err) {
+    errno = err;
+    return PN_ERR;
+  }
+  return 0;
+}
+
+int pni_thread_pin_cpu(pni_thread_t *thread, int cpu)
+{
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {
+    errno = EINVAL;
+    return PN_ERR;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pni_thread_pin(thread, &set);
+}
+
+int pni_thread_pin_node(pni_thread_t *thread, int node)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  FILE *file = node < 0 ? NULL : fopen(path, "r");
+  if (!file) {
+    errno = EINVAL;
+    return PN_ERR;
+  }
+  // a list of ranges such as 0-7,16-23
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  int first, last;
+  int n;
+  while ((n = fscanf(file, "%d-%d", &first, &last)) >= 1) {
+    if (n == 1) last = first;
+    for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, &set);
+    }
+    if (fgetc(file) != ',') break;
+  }
+  fclose(file);
+  if (!CPU_COUNT(&set)) {
+    errno = EINVAL;
+    return PN_ERR;
+  }
+  return pni_thread_pin(thread, &set);
+}
+
+#else
+
+int pni_thread_pin_cpu(pni_thread_t *thread, int cpu)
+{
+  errno = ENOTSUP;
+  return PN_ERR;
+}
+
+int pni_thread_pin_node(pni_thread_t *thread, int node)
+{
+  errno = ENOTSUP;
+  return PN_ERR;
+}
+
+#endif
+
+pni_mutex_t *pni_mutex(void)
+{
+  pni_mutex_t *mutex = (pni_mutex_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pni_mutex_t));
+  if (mutex && pthread_mutex_init(&mutex->mutex, NULL)) {
+    pni_free(PN_ALLOC_OBJECT, mutex);
+    return NULL;
+  }
+  return mutex;
+}
+
+void pni_mutex_free(pni_mutex_t *mutex)
+{
+  if (mutex) {
+    pthread_mutex_destroy(&mutex->mutex);
+    pni_free(PN_ALLOC_OBJECT, mutex);
+  }
+}
+
+void pni_mutex_lock(pni_mutex_t *mutex)
+{
+  assert(mutex);
+  pthread_mutex_lock(&mutex->mutex);
+}
+
+void pni_mutex_unlock(pni_mutex_t *mutex)
+{
+  assert(mutex);
+  pthread_mutex_unlock(&mutex->mutex);
+}
+
+pni_semaphore_t *pni_semaphore(void)
+{
+  pni_semaphore_t *semaphore = (pni_semaphore_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pni_semaphore_t));
+  if (!semaphore) return NULL;
+  if (pthread_mutex_init(&semaphore->mutex, NULL)) {
+    pni_free(PN_ALLOC_OBJECT, semaphore);
+    return NULL;
+  }
+  if (pthread_cond_init(&semaphore->cond, NULL)) {
+    pthread_mutex_destroy(&semaphore->mutex);
+    pni_free(PN_ALLOC_OBJECT, semaphore);
+    return NULL;
+  }
+  semaphore->count = 0;
+  return semaphore;
+}
+
+void pni_semaphore_free(pni_semaphore_t *semaphore)
+{
+  if (semaphore) {
+    pthread_cond_destroy(&semaphore->cond);
+    pthread_mutex_destroy(&semaphore->mutex);
+    pni_free(PN_ALLOC_OBJECT, semaphore);
+  }
+}
+
+void pni_semaphore_post(pni_semaphore_t *semaphore)
+{
+  assert(semaphore);
+  pthread_mutex_lock(&semaphore->mutex);
+  semaphore->count++;
+  pthread_cond_signal(&semaphore->cond);
+  pthread_mutex_unlock(&semaphore->mutex);
+}
+
+void pni_semaphore_wait(pni_semaphore_t *semaphore)
+{
+  assert(semaphore);
+  pthread_mutex_lock(&semaphore->mutex);
+  while (!semaphore->count) {
+    pthread_cond_wait(&semaphore->cond, &semaphore->mutex);
+  }
+  semaphore->count--;
+  pthread_mutex_unlock(&semaphore->mutex);
+}
+
+bool pni_semaphore_wait_for(pni_semaphore_t *semaphore, int timeout)
+{
+  assert(semaphore);
+  if (timeout < 0) {
+    pni_semaphore_wait(semaphore);
+    return true;
+  }
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout / 1000;
+  deadline.tv_nsec += (long) (timeout % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&semaphore->mutex);
+  int err = 0;
+  while (!semaphore->count && err != ETIMEDOUT) {
+    err = pthread_cond_timedwait(&semaphore->cond, &semaphore->mutex, &deadline);
+  }
+  bool acquired = semaphore->count > 0;
+  if (acquired) semaphore->count--;
+  pthread_mutex_unlock(&semaphore->mutex);
+  return acquired;
+}
+
+void *pni_atomic_load(void *volatile *ptr)
+{
+  return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+void *pni_atomic_exchange(void *volatile *ptr, void *value)
+{
+  return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+bool pni_atomic_cas(void *volatile *ptr, void *expected, void *desired)
+{
+  return __atomic_compare_exchange_n(ptr, &expected, desired, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+int pni_atomic_add(int volatile *value, int delta)
+{
+  return __atomic_add_fetch(value, delta, __ATOMIC_SEQ_CST);
+}
+
+int pni_atomic_get(int volatile *value)
+{
+  return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+void pni_atomic_set(int volatile *value, int v)
+{
+  __atomic_store_n(value, v, __ATOMIC_SEQ_CST);
+}
+
+uint64_t pni_atomic_add64(uint64_t volatile *value, uint64_t delta)
+{
+  return __atomic_add_fetch(value, delta, __ATOMIC_SEQ_CST);
+}
+
+uint64_t pni_atomic_get64(uint64_t volatile *value)
+{
+  return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,45 @@
+#ifndef _PROTON_SRC_URING_H
+#define _PROTON_SRC_URING_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/selector.h>
+#include <proton/type_compat.h>
+
+/*
+ * With the io_uring selector a connected socket's data does not go
+ * through recv and send: the kernel receives into the selector's
+ * buffers and sends are queued until the next select submits them.
+ * The io layer hands such sockets to the selector with these calls,
+ * which return false for sockets the selector does not drive, so the
+ * caller can fall back to the system call.
+ *
+ * On failure the result is -1 and errno is set, as for the system call.
+ */
+
+bool pni_uring_recv(pn_selector_t *selector, pn_socket_t fd, void *buf, size_t size, ssize_t *result);
+bool pni_uring_send(pn_selector_t *selector, pn_socket_t fd, const void *buf, size_t size, ssize_t *result);
+
+/* Unsent output is still delivered, the fd is closed once it is gone. */
+bool pni_uring_close(pn_selector_t *selector, pn_socket_t fd);
+
+#endif /* uring.h */
@@ -0,0 +1,103 @@
+#ifndef _PROTON_PROBES_H
+#define _PROTON_PROBES_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Static probes at the phases a profiler wants to tell apart: reactor
+ * processing and event dispatch, transport processing, input, output
+ * and frames, and SSL encryption and decryption.
+ *
+ * With ENABLE_PROBES they are USDT probes where <sys/sdt.h> is found,
+ * for perf, bpftrace and SystemTap, and TraceLogging events on Windows,
+ * for ETW. A USDT probe nobody is attached to is a nop, and an event no
+ * session listens to a test of a flag. Otherwise they compile to
+ * nothing, arguments included, so a probe's arguments should be cheap
+ * and free of side effects.
+ *
+ * Phases have start and done probes, and the first argument of every
+ * probe is the reactor or transport it is about. The probes of the
+ * "proton" provider are:
+ *
+ *   reactor_process_start(reactor)     reactor_process_done(reactor, more)
+ *   dispatch_start(reactor, event, type, connection)
+ *                                      dispatch_done(reactor, event, type)
+ *   process_start(transport)           process_done(transport, err)
+ *   consume_start(transport, pending)  consume_done(transport, consumed)
+ *   produce_start(transport)           produce_done(transport, pending)
+ *   frame_in(transport, channel, size) frame_in_done(transport, channel, err)
+ *   frame_out(transport, channel, size)
+ *   ssl_decrypt_start(transport, size) ssl_decrypt_done(transport, result)
+ *   ssl_encrypt_start(transport, size) ssl_encrypt_done(transport, result)
+ *
+ * For example, the time spent dispatching each type of event:
+ *
+ *   bpftrace -e 'usdt:libqpid-proton.so:proton:dispatch_start { @start[tid] = nsecs; }
+ *       usdt:libqpid-proton.so:proton:dispatch_done /@start[tid]/ {
+ *         @nanos[arg2] = sum(nsecs - @start[tid]); delete(@start[tid]); }'
+ */
+
+#if defined(PN_USDT_PROBES)
+
+#include <sys/sdt.h>
+
+#define PNI_PROBES_REGISTER()
+#define PNI_PROBE1(name, a) DTRACE_PROBE1(proton, name, a)
+#define PNI_PROBE2(name, a, b) DTRACE_PROBE2(proton, name, a, b)
+#define PNI_PROBE3(name, a, b, c) DTRACE_PROBE3(proton, name, a, b, c)
+#define PNI_PROBE4(name, a, b, c, d) DTRACE_PROBE4(proton, name, a, b, c, d)
+
+#elif defined(PN_ETW_PROBES)
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+
+TRACELOGGING_DECLARE_PROVIDER(pni_probes);
+
+// the provider is registered when the first reactor or transport is
+// made, and unregistered at exit
+void pni_probes_register(void);
+
+#define PNI_PROBE_ARG(n, a) TraceLoggingUInt64((uint64_t) (uintptr_t) (a), n)
+#define PNI_PROBES_REGISTER() pni_probes_register()
+#define PNI_PROBE1(name, a) \
+  TraceLoggingWrite(pni_probes, #name, PNI_PROBE_ARG("arg1", a))
+#define PNI_PROBE2(name, a, b) \
+  TraceLoggingWrite(pni_probes, #name, PNI_PROBE_ARG("arg1", a), PNI_PROBE_ARG("arg2", b))
+#define PNI_PROBE3(name, a, b, c) \
+  TraceLoggingWrite(pni_probes, #name, PNI_PROBE_ARG("arg1", a), PNI_PROBE_ARG("arg2", b), \
+                    PNI_PROBE_ARG("arg3", c))
+#define PNI_PROBE4(name, a, b, c, d) \
+  TraceLoggingWrite(pni_probes, #name, PNI_PROBE_ARG("arg1", a), PNI_PROBE_ARG("arg2", b), \
+                    PNI_PROBE_ARG("arg3", c), PNI_PROBE_ARG("arg4", d))
+
+#else
+
+#define PNI_PROBES_REGISTER()
+#define PNI_PROBE1(name, a)
+#define PNI_PROBE2(name, a, b)
+#define PNI_PROBE3(name, a, b, c)
+#define PNI_PROBE4(name, a, b, c, d)
+
+#endif
+
+#endif /* probes.h */
@@ -22,10 +22,25 @@
 #include "pncompat/misc_funcs.inc"
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(_WIN32) && ! defined(__CYGWIN__)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 #include <proton/codec.h>
+#include <proton/engine.h>
 #include <proton/error.h>
 #include "buffer.h"
+#include "dispatch_actions.h"
 #include "framing/framing.h"
+#include "mapped.h"
+#include "platform.h"
+#include "platform_fmt.h"
+#include "protocol.h"
+#include "thread.h"
+#include "transport/capture.h"
 #include "util.h"
 
 void fatal_error(const char *msg, const char *arg, int err)
@@ -37,73 +52,1052 @@ void fatal_error(const char *msg, const char *arg, int err)
   exit(1);
 }
 
-int dump(const char *file)
+// a file mapped whole, so that a large one costs address space rather
+// than memory
+typedef struct {
+  const char *name;
+  const char *bytes;
+  size_t size;
+} source_t;
+
+static void trailing_data(const char *bytes, size_t size)
 {
-  FILE *in = fopen(file, "r");
-  if (!in) fatal_error("proton-dump: dump: opening %s", file, errno);
+  if (size > 0) {
+    fprintf(stderr, "Trailing data: ");
+    pn_fprint_data(stderr, bytes, size);
+    fprintf(stderr, "\n");
+  }
+}
 
-  pn_buffer_t *buf = pn_buffer(1024);
-  pn_data_t *data = pn_data(16);
-  bool header = false;
+typedef int (*frame_fn)(void *context, pn_frame_t *frame);
+
+// hand every whole frame at the start of bytes to on_frame, returning
+// the bytes they took up
+static size_t read_frames(const char *bytes, size_t size, frame_fn on_frame, void *context,
+                          int *err)
+{
+  size_t offset = 0;
+  *err = 0;
+  while (!*err) {
+    pn_frame_t frame;
+    size_t consumed = pn_read_frame(&frame, bytes + offset, size - offset);
+    if (!consumed) break;
+    *err = on_frame(context, &frame);
+    offset += consumed;
+  }
+  return offset;
+}
+
+// one direction of an AMQP connection, an AMQP header then frames
+typedef struct {
+  pn_buffer_t *buf;     // the start of a frame the next bytes finish
+  bool header;          // still to be read
+} stream_t;
 
-  char bytes[1024];
-  size_t n;
-  while ((n = fread(bytes, 1, 1024, in))) {
-    int err = pn_buffer_append(buf, bytes, n);
+// hand every whole frame in the stream's buffer to on_frame
+static int stream_frames(stream_t *stream, frame_fn on_frame, void *context)
+{
+  pn_bytes_t available = pn_buffer_bytes(stream->buf);
+  if (stream->header) {
+    if (available.size < 8) return 0;
+    pn_buffer_trim(stream->buf, 8, 0);
+    stream->header = false;
+    available = pn_buffer_bytes(stream->buf);
+  }
+  int err;
+  size_t consumed = read_frames(available.start, available.size, on_frame, context, &err);
+  pn_buffer_trim(stream->buf, consumed, 0);
+  return err;
+}
+
+// add bytes to the stream, reading the frames that lie whole within
+// them in place
+static int stream_feed(stream_t *stream, const char *bytes, size_t size, frame_fn on_frame,
+                       void *context)
+{
+  int err;
+  if (stream->header || pn_buffer_size(stream->buf)) {
+    err = pn_buffer_append(stream->buf, bytes, size);
     if (err) return err;
+    return stream_frames(stream, on_frame, context);
+  }
+  size_t consumed = read_frames(bytes, size, on_frame, context, &err);
+  if (err) return err;
+  return pn_buffer_append(stream->buf, bytes + consumed, size - consumed);
+}
 
-    while (true) {
-      pn_bytes_t available = pn_buffer_bytes(buf);
-      if (!available.size) break;
-
-      if (!header) {
-        if (available.size >= 8) {
-          pn_buffer_trim(buf, 8, 0);
-          available = pn_buffer_bytes(buf);
-          header = true;
-        } else {
-          break;
-        }
-      }
+typedef struct {
+  pn_data_t *data;
+  char prefix[48];
+} printer_t;
 
-      pn_frame_t frame;
-      size_t consumed = pn_read_frame(&frame, available.start, available.size);
-      if (consumed) {
-        pn_data_clear(data);
-        ssize_t dsize = pn_data_decode(data, frame.payload, frame.size);
-        if (dsize < 0) {
-          fprintf(stderr, "Error decoding frame: %s\n", pn_code(err));
-          pn_fprint_data(stderr, frame.payload, frame.size);
-          fprintf(stderr, "\n");
-          return err;
-        } else {
-          pn_data_print(data);
-          printf("\n");
-        }
-        pn_buffer_trim(buf, consumed, 0);
-      } else {
-        break;
+static int print_frame(void *context, pn_frame_t *frame)
+{
+  printer_t *printer = (printer_t *) context;
+  pn_data_clear(printer->data);
+  ssize_t dsize = pn_data_decode(printer->data, frame->payload, frame->size);
+  if (dsize < 0) {
+    fprintf(stderr, "Error decoding frame: %s\n", pn_code(dsize));
+    pn_fprint_data(stderr, frame->payload, frame->size);
+    fprintf(stderr, "\n");
+    return dsize;
+  }
+  printf("%s", printer->prefix);
+  pn_data_print(printer->data);
+  printf("\n");
+  return 0;
+}
+
+static int dump_raw(source_t *source)
+{
+  if (source->size < 8) {
+    trailing_data(source->bytes, source->size);
+    return 0;
+  }
+  printer_t printer = {pn_data(16), ""};
+  int err;
+  size_t consumed = 8 + read_frames(source->bytes + 8, source->size - 8, print_frame, &printer,
+                                    &err);
+  if (!err) trailing_data(source->bytes + consumed, source->size - consumed);
+  pn_data_free(printer.data);
+  return err;
+}
+
+typedef int (*record_fn)(void *context, pni_capture_record_t *record);
+
+// hand every record of a capture to on_record
+static int capture_records(source_t *source, record_fn on_record, void *context)
+{
+  size_t offset = PNI_CAPTURE_HEADER;
+  while (true) {
+    pni_capture_record_t record;
+    size_t n = pni_capture_read(source->bytes + offset, source->size - offset, &record);
+    if (!n) {
+      trailing_data(source->bytes + offset, source->size - offset);
+      return 0;
+    }
+    if (record.dir == PNI_CAPTURE_END) return 0;
+    int err = on_record(context, &record);
+    if (err) return err;
+    offset += n;
+  }
+}
+
+typedef struct {
+  stream_t streams[2];  // in, out
+  printer_t printer;
+} dumper_t;
+
+static int dump_record(void *context, pni_capture_record_t *record)
+{
+  dumper_t *dumper = (dumper_t *) context;
+  bool in = record->dir == PNI_CAPTURE_IN;
+  snprintf(dumper->printer.prefix, sizeof(dumper->printer.prefix), "[%12.6f] %s ",
+           record->nanos / 1e9, in ? "<-" : "->");
+  return stream_feed(&dumper->streams[in ? 0 : 1], record->bytes.start, record->bytes.size,
+                     print_frame, &dumper->printer);
+}
+
+static int dump_capture(source_t *source, uint32_t flags)
+{
+  // a partial capture may start in the middle of a frame, which
+  // shows as a decoding error
+  bool header = !(flags & PNI_CAPTURE_PARTIAL);
+  dumper_t dumper = {{{pn_buffer(1024), header}, {pn_buffer(1024), header}}, {pn_data(16), ""}};
+  int err = capture_records(source, dump_record, &dumper);
+  for (int i = 0; i < 2; i++) {
+    pn_bytes_t rest = pn_buffer_bytes(dumper.streams[i].buf);
+    if (!err) trailing_data(rest.start, rest.size);
+    pn_buffer_free(dumper.streams[i].buf);
+  }
+  pn_data_free(dumper.printer.data);
+  return err;
+}
+
+/*
+ * A replay feeds what a capture read into a transport of its own, and
+ * mirrors what the capture wrote by opening, crediting, sending,
+ * settling and closing on its own endpoints the way the captured
+ * application did. What the replaying transport writes is discarded.
+ */
+
+typedef struct {
+  pn_connection_t *connection;
+  pn_transport_t *transport;
+  pn_collector_t *collector;
+  pn_data_t *args;
+  pn_string_t *name;
+  pn_hash_t *sessions;   // by the channel the capture began them on
+  pn_list_t *incoming;   // unsettled deliveries received, oldest first
+  pn_list_t *outgoing;   // unsettled deliveries sent, oldest first
+  stream_t out;          // what the capture wrote
+  uint64_t start;
+  bool paced;
+  uint64_t bytes;
+  uint64_t skipped;      // frames written that could not be mirrored
+  char scratch[64*1024];
+} replay_t;
+
+PN_HANDLE(REPLAY_LINKS)
+
+// a session's links, by the handle the capture attached them with
+static pn_hash_t *replay_links(pn_session_t *ssn)
+{
+  pn_record_t *record = pn_session_attachments(ssn);
+  pn_hash_t *links = (pn_hash_t *) pn_record_get(record, REPLAY_LINKS);
+  if (!links) {
+    links = pn_hash(PN_WEAKREF, 16, 0.75);
+    pn_record_def(record, REPLAY_LINKS, PN_OBJECT);
+    pn_record_set(record, REPLAY_LINKS, links);
+    pn_decref(links);
+  }
+  return links;
+}
+
+static pn_link_t *replay_link(replay_t *replay, uint16_t channel, uint32_t handle)
+{
+  pn_session_t *ssn = (pn_session_t *) pn_hash_get(replay->sessions, channel);
+  return ssn ? (pn_link_t *) pn_hash_get(replay_links(ssn), handle) : NULL;
+}
+
+static const char *replay_cstr(replay_t *replay, pn_bytes_t bytes)
+{
+  pn_string_setn(replay->name, bytes.start, bytes.size);
+  return pn_string_get(replay->name);
+}
+
+static void replay_delivery(replay_t *replay, pn_delivery_t *delivery)
+{
+  pn_link_t *link = pn_delivery_link(delivery);
+  if (pn_link_is_receiver(link) && pn_link_current(link) == delivery) {
+    while (pn_link_recv(link, replay->scratch, sizeof(replay->scratch)) > 0) {}
+    if (pn_delivery_partial(delivery)) return;
+    pn_link_advance(link);
+    if (pn_delivery_settled(delivery)) {
+      pn_delivery_settle(delivery);
+    } else {
+      pn_list_add(replay->incoming, delivery);
+    }
+  } else if (pn_delivery_settled(delivery)) {
+    // settling what the peer settled writes nothing, so there is no
+    // frame in the capture to mirror
+    if (pn_list_remove(replay->incoming, delivery) ||
+        pn_list_remove(replay->outgoing, delivery)) {
+      pn_delivery_settle(delivery);
+    }
+  }
+}
+
+static void replay_drain(replay_t *replay)
+{
+  pn_event_t *event;
+  ssize_t pending;
+  do {
+    while ((event = pn_collector_peek(replay->collector))) {
+      if (pn_event_type(event) == PN_DELIVERY) {
+        replay_delivery(replay, pn_event_delivery(event));
       }
+      pn_collector_pop(replay->collector);
     }
+    pending = pn_transport_pending(replay->transport);
+    if (pending > 0) pn_transport_pop(replay->transport, pending);
+  } while (pending > 0 || pn_collector_peek(replay->collector));
+}
+
+static int replay_begin(replay_t *replay, pn_frame_t *frame)
+{
+  bool reply;
+  uint16_t remote_channel;
+  int err = pn_data_scan(replay->args, "D.[?H]", &reply, &remote_channel);
+  if (err) return err;
+  // a reply answers the oldest begin the peer sent
+  pn_session_t *ssn = reply ? pn_session_head(replay->connection, PN_LOCAL_UNINIT | PN_REMOTE_ACTIVE)
+                            : pn_session(replay->connection);
+  if (!ssn) return PN_STATE_ERR;
+  pn_hash_put(replay->sessions, frame->channel, ssn);
+  pn_session_open(ssn);
+  return 0;
+}
+
+static int replay_attach(replay_t *replay, pn_frame_t *frame)
+{
+  pn_bytes_t name;
+  uint32_t handle;
+  bool receiver, snd_q, rcv_q;
+  uint8_t snd_mode, rcv_mode;
+  int err = pn_data_scan(replay->args, "D.[SIo?B?B]", &name, &handle, &receiver, &snd_q,
+                         &snd_mode, &rcv_q, &rcv_mode);
+  if (err) return err;
+  pn_session_t *ssn = (pn_session_t *) pn_hash_get(replay->sessions, frame->channel);
+  if (!ssn) return PN_STATE_ERR;
+
+  // a link the peer attached first, or one of our own
+  const char *cname = replay_cstr(replay, name);
+  pn_link_t *link = pn_link_head(replay->connection, PN_LOCAL_UNINIT);
+  while (link && (pn_link_session(link) != ssn || pn_link_is_receiver(link) != receiver ||
+                  strcmp(pn_link_name(link), cname))) {
+    link = pn_link_next(link, PN_LOCAL_UNINIT);
+  }
+  if (!link) {
+    link = receiver ? pn_receiver(ssn, cname) : pn_sender(ssn, cname);
+  }
+  if (snd_q) pn_link_set_snd_settle_mode(link, (pn_snd_settle_mode_t) snd_mode);
+  if (rcv_q) pn_link_set_rcv_settle_mode(link, (pn_rcv_settle_mode_t) rcv_mode);
+  pn_hash_put(replay_links(ssn), handle, link);
+  pn_link_open(link);
+  return 0;
+}
+
+static int replay_flow(replay_t *replay, pn_frame_t *frame)
+{
+  bool inext_q, handle_q, count_q, drain;
+  uint32_t inext, iwin, onext, owin, handle, count, credit;
+  int err = pn_data_scan(replay->args, "D.[?IIII?I?II.o]", &inext_q, &inext, &iwin, &onext,
+                         &owin, &handle_q, &handle, &count_q, &count, &credit, &drain);
+  if (err) return err;
+  if (!handle_q) return 0;
+  pn_link_t *link = replay_link(replay, frame->channel, handle);
+  if (!link) return PN_STATE_ERR;
+  if (pn_link_is_receiver(link) && (int) credit > pn_link_credit(link)) {
+    pn_link_flow(link, credit - pn_link_credit(link));
   }
+  return 0;
+}
 
-  if (ferror(in)) fatal_error("proton-dump: dump: reading %s", file, errno);
-  if (pn_buffer_size(buf) > 0) {
-    fprintf(stderr, "Trailing data: ");
-    pn_bytes_t b = pn_buffer_bytes(buf);
-    pn_fprint_data(stderr, b.start, b.size);
-    fprintf(stderr, "\n");
+static int replay_transfer(replay_t *replay, pn_frame_t *frame, pn_bytes_t payload)
+{
+  uint32_t handle, id;
+  bool id_q, settled, more;
+  pn_bytes_t tag;
+  int err = pn_data_scan(replay->args, "D.[I?Iz.oo]", &handle, &id_q, &id, &tag, &settled, &more);
+  if (err) return err;
+  pn_link_t *link = replay_link(replay, frame->channel, handle);
+  if (!link || !pn_link_is_sender(link)) return PN_STATE_ERR;
+
+  pn_delivery_t *delivery = pn_link_current(link);
+  if (!delivery) delivery = pn_delivery(link, pn_dtag(tag.start, tag.size));
+  pn_link_send(link, payload.start, payload.size);
+  if (!more) {
+    pn_link_advance(link);
+    if (settled) {
+      pn_delivery_settle(delivery);
+    } else {
+      pn_list_add(replay->outgoing, delivery);
+    }
+  }
+  return 0;
+}
+
+static int replay_disposition(replay_t *replay)
+{
+  bool receiver, last_q, settled, state_q;
+  uint32_t first, last;
+  uint64_t state;
+  int err = pn_data_scan(replay->args, "D.[oI?IoD?L.]", &receiver, &first, &last_q, &last,
+                         &settled, &state_q, &state);
+  if (err) return err;
+
+  // the deliveries are settled in the order they were sent, so the
+  // oldest are the ones meant
+  pn_list_t *deliveries = receiver ? replay->incoming : replay->outgoing;
+  size_t count = (last_q ? last : first) - first + 1;
+  if (settled) {
+    for (size_t i = 0; i < count && pn_list_size(deliveries); i++) {
+      pn_delivery_t *delivery = (pn_delivery_t *) pn_list_get(deliveries, 0);
+      if (state_q) pn_delivery_update(delivery, state);
+      pn_list_del(deliveries, 0, 1);
+      pn_delivery_settle(delivery);
+    }
+  } else if (state_q) {
+    for (size_t i = 0; i < count && i < pn_list_size(deliveries); i++) {
+      pn_delivery_update((pn_delivery_t *) pn_list_get(deliveries, i), state);
+    }
+  }
+  return 0;
+}
+
+static int replay_detach(replay_t *replay, pn_frame_t *frame)
+{
+  uint32_t handle;
+  bool closed;
+  int err = pn_data_scan(replay->args, "D.[Io]", &handle, &closed);
+  if (err) return err;
+  pn_link_t *link = replay_link(replay, frame->channel, handle);
+  if (!link) return PN_STATE_ERR;
+  if (closed) {
+    pn_link_close(link);
+  } else {
+    pn_link_detach(link);
+  }
+  return 0;
+}
+
+static int replay_frame(void *context, pn_frame_t *frame)
+{
+  replay_t *replay = (replay_t *) context;
+  if (frame->type != AMQP_FRAME_TYPE || !frame->size) return 0;
+
+  pn_data_clear(replay->args);
+  ssize_t dsize = pn_data_decode(replay->args, frame->payload, frame->size);
+  if (dsize < 0) return dsize;
+  pn_bytes_t payload = pn_bytes(frame->size - dsize, frame->payload + dsize);
+  bool scanned;
+  uint64_t code;
+  int err = pn_data_scan(replay->args, "D?L.", &scanned, &code);
+  if (err) return err;
+  if (!scanned) return PN_ARG_ERR;
+
+  pn_session_t *ssn;
+  switch (code) {
+  case OPEN:
+    {
+      pn_bytes_t container;
+      err = pn_data_scan(replay->args, "D.[S]", &container);
+      if (err) return err;
+      pn_connection_set_container(replay->connection, replay_cstr(replay, container));
+      pn_connection_open(replay->connection);
+    }
+    break;
+  case BEGIN:
+    err = replay_begin(replay, frame);
+    break;
+  case ATTACH:
+    err = replay_attach(replay, frame);
+    break;
+  case FLOW:
+    err = replay_flow(replay, frame);
+    break;
+  case TRANSFER:
+    err = replay_transfer(replay, frame, payload);
+    break;
+  case DISPOSITION:
+    err = replay_disposition(replay);
+    break;
+  case DETACH:
+    err = replay_detach(replay, frame);
+    break;
+  case END:
+    ssn = (pn_session_t *) pn_hash_get(replay->sessions, frame->channel);
+    if (ssn) {
+      pn_session_close(ssn);
+    } else {
+      err = PN_STATE_ERR;
+    }
+    break;
+  case CLOSE:
+    pn_connection_close(replay->connection);
+    break;
+  default:
+    break;
   }
 
-  fclose(in);
+  // what refers to endpoints the replay does not have is left out
+  if (err == PN_STATE_ERR) {
+    replay->skipped++;
+    err = 0;
+  }
+  replay_drain(replay);
+  return err;
+}
 
+static int replay_input(replay_t *replay, const char *bytes, size_t size)
+{
+  while (size) {
+    ssize_t n = pn_transport_push(replay->transport, bytes, size);
+    if (n < 0) return n;
+    replay_drain(replay);
+    if (!n && pn_transport_capacity(replay->transport) <= 0) return PN_OVERFLOW;
+    bytes += n;
+    size -= n;
+    replay->bytes += n;
+  }
   return 0;
 }
 
+static void pause_nanos(uint64_t nanos)
+{
+#if defined(_WIN32) && ! defined(__CYGWIN__)
+  Sleep((DWORD) (nanos / 1000000));
+#else
+  struct timespec pause;
+  pause.tv_sec = nanos / 1000000000;
+  pause.tv_nsec = nanos % 1000000000;
+  nanosleep(&pause, NULL);
+#endif
+}
+
+static int replay_record(void *context, pni_capture_record_t *record)
+{
+  replay_t *replay = (replay_t *) context;
+  if (replay->paced) {
+    uint64_t now = pn_i_nanos() - replay->start;
+    if (record->nanos > now) pause_nanos(record->nanos - now);
+  }
+
+  if (record->dir == PNI_CAPTURE_IN) {
+    return replay_input(replay, record->bytes.start, record->bytes.size);
+  }
+  return stream_feed(&replay->out, record->bytes.start, record->bytes.size, replay_frame,
+                     replay);
+}
+
+static int replay(source_t *source, uint32_t flags, bool paced)
+{
+  if (flags & PNI_CAPTURE_PARTIAL) {
+    fprintf(stderr, "proton-dump: replay: %s started after the connection did\n", source->name);
+    return PN_ARG_ERR;
+  }
+
+  replay_t *replay = (replay_t *) malloc(sizeof(replay_t));
+  replay->connection = pn_connection();
+  replay->transport = pn_transport();
+  replay->collector = pn_collector();
+  replay->args = pn_data(16);
+  replay->name = pn_string("");
+  replay->sessions = pn_hash(PN_WEAKREF, 16, 0.75);
+  replay->incoming = pn_list(PN_WEAKREF, 0);
+  replay->outgoing = pn_list(PN_WEAKREF, 0);
+  replay->out.buf = pn_buffer(1024);
+  replay->out.header = true;
+  replay->paced = paced;
+  replay->bytes = 0;
+  replay->skipped = 0;
+  if (flags & PNI_CAPTURE_SERVER) pn_transport_set_server(replay->transport);
+  pn_connection_collect(replay->connection, replay->collector);
+  pn_transport_bind(replay->transport, replay->connection);
+
+  replay->start = pn_i_nanos();
+  int err = capture_records(source, replay_record, replay);
+  uint64_t elapsed = pn_i_nanos() - replay->start;
+
+  pn_condition_t *condition = pn_transport_condition(replay->transport);
+  if (err) {
+    fprintf(stderr, "proton-dump: replay: %s: %s\n", source->name, pn_code(err));
+  } else if (pn_condition_is_set(condition)) {
+    fprintf(stderr, "proton-dump: replay: %s: %s: %s\n", source->name,
+            pn_condition_get_name(condition), pn_condition_get_description(condition));
+    err = PN_ERR;
+  }
+  double secs = elapsed / 1e9;
+  uint64_t frames = pn_transport_get_frames_input(replay->transport);
+  printf("%s: replayed %" PRIu64 " bytes, %" PRIu64 " frames in %.3f s, %.1f MB/s, "
+         "%.0f frames/s", source->name, replay->bytes, frames, secs,
+         secs > 0 ? replay->bytes / secs / 1e6 : 0, secs > 0 ? frames / secs : 0);
+  if (replay->skipped) printf(", %" PRIu64 " frames not mirrored", replay->skipped);
+  printf("\n");
+
+  pn_transport_unbind(replay->transport);
+  pn_transport_free(replay->transport);
+  pn_connection_free(replay->connection);
+  pn_collector_free(replay->collector);
+  pn_data_free(replay->args);
+  pn_free(replay->name);
+  pn_free(replay->sessions);
+  pn_free(replay->incoming);
+  pn_free(replay->outgoing);
+  pn_buffer_free(replay->out.buf);
+  free(replay);
+  return err;
+}
+
+/*
+ * An index of where every frame of a file is, its channel, its
+ * performative and the deliveries it refers to, so that frames can be
+ * counted, filtered and found without decoding the whole file for
+ * each question. Where the frames are is found in one pass, as that
+ * needs only frame sizes, and then the frames are decoded in parallel.
+ */
+
+#define FRAME_IN 0x1        // read rather than written, every frame of a raw dump
+#define FRAME_WHOLE 0x2     // all in one place in the file
+#define FRAME_DELIVERY 0x4  // delivery and last are set
+#define FRAME_BAD 0x8       // could not be decoded
+
+// a frame with no body, a heartbeat
+#define PERFORMATIVE_EMPTY 0
+// a frame that is not an AMQP performative
+#define PERFORMATIVE_OTHER 0xff
+
+typedef struct {
+  uint64_t offset;    // of the frame, or of the capture record it starts in
+  uint32_t skip;      // from the start of that record's bytes
+  uint32_t size;
+  uint32_t delivery;  // the first delivery a transfer or disposition refers to
+  uint32_t last;
+  uint16_t channel;
+  uint8_t performative;
+  uint8_t flags;
+} entry_t;
+
+typedef struct {
+  source_t *source;
+  bool capture;
+  entry_t *entries;
+  size_t capacity;
+  size_t count;
+} index_t;
+
+static const char *performatives[] = {"open", "begin", "attach", "flow", "transfer",
+                                      "disposition", "detach", "end", "close"};
+
+#define PERFORMATIVE_SLOTS 11
+
+// empty, open to close, then other
+static int performative_slot(uint8_t performative)
+{
+  if (performative == PERFORMATIVE_EMPTY) return 0;
+  if (performative >= OPEN && performative <= CLOSE) return performative - OPEN + 1;
+  return PERFORMATIVE_SLOTS - 1;
+}
+
+static const char *slot_name(int slot)
+{
+  if (slot == 0) return "empty";
+  if (slot == PERFORMATIVE_SLOTS - 1) return "other";
+  return performatives[slot - 1];
+}
+
+static uint32_t read32(const char *bytes)
+{
+  const unsigned char *b = (const unsigned char *) bytes;
+  return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | b[3];
+}
+
+static entry_t *index_add(index_t *index)
+{
+  if (index->count == index->capacity) {
+    size_t capacity = index->capacity ? 2*index->capacity : 1024;
+    entry_t *entries = (entry_t *) realloc(index->entries, capacity*sizeof(entry_t));
+    if (!entries) fatal_error("proton-dump: indexing %s", index->source->name, ENOMEM);
+    index->entries = entries;
+    index->capacity = capacity;
+  }
+  entry_t *entry = &index->entries[index->count++];
+  memset(entry, 0, sizeof(*entry));
+  return entry;
+}
+
+static int bad_frame(index_t *index, uint64_t offset)
+{
+  fprintf(stderr, "proton-dump: %s: no frame at offset %" PRIu64 "\n", index->source->name,
+          offset);
+  return PN_ARG_ERR;
+}
+
+static int index_raw(index_t *index)
+{
+  source_t *source = index->source;
+  size_t offset = 8;
+  while (source->size >= offset + 8) {
+    uint32_t size = read32(source->bytes + offset);
+    if (size < 8) return bad_frame(index, offset);
+    if (source->size - offset < size) break;
+    entry_t *entry = index_add(index);
+    entry->offset = offset;
+    entry->size = size;
+    entry->flags = FRAME_IN | FRAME_WHOLE;
+    offset += size;
+  }
+  trailing_data(source->bytes + offset, source->size - offset);
+  return 0;
+}
+
+// where one direction of a capture has got to
+typedef struct {
+  size_t skip;      // of the AMQP header still to come
+  size_t pending;   // the entry of a frame whose bytes are still to come
+  size_t left;      // of the pending frame
+  char head[8];     // the frame header so far
+  size_t have;
+} scan_t;
+
+typedef struct {
+  index_t *index;
+  scan_t scans[2];  // in, out
+} scanner_t;
+
+static int index_record(void *context, pni_capture_record_t *record)
+{
+  scanner_t *scanner = (scanner_t *) context;
+  index_t *index = scanner->index;
+  bool in = record->dir == PNI_CAPTURE_IN;
+  scan_t *scan = &scanner->scans[in ? 0 : 1];
+  const char *bytes = record->bytes.start;
+  size_t size = record->bytes.size;
+  uint64_t offset = bytes - PNI_CAPTURE_RECORD - index->source->bytes;
+
+  size_t pos = 0;
+  while (pos < size) {
+    if (scan->skip || scan->left) {
+      size_t *rest = scan->skip ? &scan->skip : &scan->left;
+      size_t n = pn_min(*rest, size - pos);
+      *rest -= n;
+      pos += n;
+      continue;
+    }
+
+    if (!scan->have) {
+      entry_t *entry = index_add(index);
+      entry->offset = offset;
+      entry->skip = pos;
+      entry->flags = in ? FRAME_IN : 0;
+      scan->pending = index->count - 1;
+    }
+    size_t n = pn_min(8 - scan->have, size - pos);
+    memcpy(scan->head + scan->have, bytes + pos, n);
+    scan->have += n;
+    pos += n;
+    if (scan->have < 8) break;
+
+    entry_t *entry = &index->entries[scan->pending];
+    entry->size = read32(scan->head);
+    if (entry->size < 8) return bad_frame(index, offset + PNI_CAPTURE_RECORD + entry->skip);
+    if (entry->offset == offset && entry->skip + entry->size <= size) {
+      entry->flags |= FRAME_WHOLE;
+    }
+    scan->left = entry->size - 8;
+    scan->have = 0;
+  }
+  return 0;
+}
+
+static int index_capture(index_t *index, uint32_t flags)
+{
+  // a partial capture can start anywhere in a frame, so unless it
+  // happens to start on a boundary its frames cannot be found
+  size_t skip = (flags & PNI_CAPTURE_PARTIAL) ? 0 : 8;
+  scanner_t scanner;
+  memset(&scanner, 0, sizeof(scanner));
+  scanner.index = index;
+  scanner.scans[0].skip = scanner.scans[1].skip = skip;
+  int err = capture_records(index->source, index_record, &scanner);
+  if (err) return err;
+
+  // the frames the capture ends part way through are left out, along
+  // with any that follow them in the other direction
+  size_t count = index->count;
+  for (int i = 0; i < 2; i++) {
+    scan_t *scan = &scanner.scans[i];
+    if (scan->left || scan->have) count = pn_min(count, scan->pending);
+  }
+  if (count < index->count) {
+    fprintf(stderr, "proton-dump: %s ends part way through a frame\n", index->source->name);
+    index->count = count;
+  }
+  return 0;
+}
+
+// the bytes of a frame, gathered into scratch if they are not all in
+// one place
+static const char *index_frame(index_t *index, entry_t *entry, pn_buffer_t *scratch)
+{
+  const char *bytes = index->source->bytes + entry->offset;
+  if (!index->capture) return bytes;
+  if (entry->flags & FRAME_WHOLE) return bytes + PNI_CAPTURE_RECORD + entry->skip;
+
+  pni_capture_dir_t dir = (entry->flags & FRAME_IN) ? PNI_CAPTURE_IN : PNI_CAPTURE_OUT;
+  size_t offset = entry->offset;
+  size_t skip = entry->skip;
+  pn_buffer_clear(scratch);
+  while (pn_buffer_size(scratch) < entry->size) {
+    pni_capture_record_t record;
+    offset += pni_capture_read(index->source->bytes + offset, index->source->size - offset,
+                               &record);
+    if (record.dir != dir) continue;
+    size_t n = pn_min(record.bytes.size - skip, entry->size - pn_buffer_size(scratch));
+    if (pn_buffer_append(scratch, record.bytes.start + skip, n)) {
+      fatal_error("proton-dump: reading %s", index->source->name, ENOMEM);
+    }
+    skip = 0;
+  }
+  return pn_buffer_bytes(scratch).start;
+}
+
+static void index_decode(index_t *index, entry_t *entry, pn_data_t *data, pn_buffer_t *scratch)
+{
+  const char *bytes = index_frame(index, entry, scratch);
+  size_t doff = (uint8_t) bytes[4] * 4;
+  entry->channel = ((uint8_t) bytes[6] << 8) | (uint8_t) bytes[7];
+  if (bytes[5] != AMQP_FRAME_TYPE || doff < 8 || doff > entry->size) {
+    entry->performative = PERFORMATIVE_OTHER;
+    return;
+  }
+  if (doff == entry->size) {
+    entry->performative = PERFORMATIVE_EMPTY;
+    return;
+  }
+
+  pn_data_clear(data);
+  bool scanned = false;
+  uint64_t code = 0;
+  if (pn_data_decode(data, bytes + doff, entry->size - doff) < 0 ||
+      pn_data_scan(data, "D?L.", &scanned, &code) || !scanned || code > 0xff) {
+    entry->performative = PERFORMATIVE_OTHER;
+    entry->flags |= FRAME_BAD;
+    return;
+  }
+  entry->performative = code;
+
+  bool first_q = false, last_q = false;
+  uint32_t first = 0, last = 0;
+  if (code == TRANSFER) {
+    pn_data_scan(data, "D.[.?I]", &first_q, &first);
+  } else if (code == DISPOSITION) {
+    pn_data_scan(data, "D.[.?I?I]", &first_q, &first, &last_q, &last);
+  }
+  if (first_q) {
+    entry->delivery = first;
+    entry->last = last_q ? last : first;
+    entry->flags |= FRAME_DELIVERY;
+  }
+}
+
+typedef struct {
+  index_t *index;
+  size_t first;
+  size_t end;
+  pni_thread_t *thread;
+} worker_t;
+
+static void index_work(void *context)
+{
+  worker_t *worker = (worker_t *) context;
+  pn_data_t *data = pn_data(16);
+  pn_buffer_t *scratch = pn_buffer(1024);
+  for (size_t i = worker->first; i < worker->end; i++) {
+    index_decode(worker->index, &worker->index->entries[i], data, scratch);
+  }
+  pn_buffer_free(scratch);
+  pn_data_free(data);
+}
+
+static void index_decode_all(index_t *index, int threads)
+{
+  if (threads < 1) threads = 1;
+  if ((size_t) threads > index->count / 1024 + 1) threads = index->count / 1024 + 1;
+  worker_t *workers = (worker_t *) calloc(threads, sizeof(worker_t));
+  if (!workers) fatal_error("proton-dump: indexing %s", index->source->name, ENOMEM);
+  size_t slice = index->count / threads + 1;
+  for (int i = 0; i < threads; i++) {
+    workers[i].index = index;
+    workers[i].first = pn_min(i*slice, index->count);
+    workers[i].end = pn_min((i + 1)*slice, index->count);
+    // the first slice is decoded here, as are any a thread could not
+    // be started for
+    if (i > 0) workers[i].thread = pni_thread(index_work, &workers[i]);
+  }
+  for (int i = 0; i < threads; i++) {
+    if (!workers[i].thread) index_work(&workers[i]);
+  }
+  for (int i = 0; i < threads; i++) {
+    if (workers[i].thread) pni_thread_join(workers[i].thread);
+  }
+  free(workers);
+
+  // only the first frame of a transfer need carry its delivery-id, the
+  // rest belong to the same delivery
+  uint64_t *current = (uint64_t *) calloc(2*65536, sizeof(uint64_t));
+  if (!current) fatal_error("proton-dump: indexing %s", index->source->name, ENOMEM);
+  for (size_t i = 0; i < index->count; i++) {
+    entry_t *entry = &index->entries[i];
+    if (entry->performative != TRANSFER) continue;
+    uint64_t *id = &current[(entry->flags & FRAME_IN ? 65536 : 0) + entry->channel];
+    if (entry->flags & FRAME_DELIVERY) {
+      *id = (uint64_t) entry->delivery + 1;
+    } else if (*id) {
+      entry->delivery = entry->last = *id - 1;
+      entry->flags |= FRAME_DELIVERY;
+    }
+  }
+  free(current);
+}
+
+typedef struct {
+  int channel;          // or -1 for any
+  int performative;     // or -1 for any
+  int64_t delivery;     // or -1 for any
+  size_t first;         // frames before this one are not considered
+  size_t limit;         // at most this many frames are printed
+  bool summary;         // count the frames rather than print them
+  int threads;
+} query_t;
+
+static bool query_match(query_t *query, entry_t *entry)
+{
+  if (query->channel >= 0 && entry->channel != query->channel) return false;
+  if (query->performative >= 0 && entry->performative != query->performative) return false;
+  if (query->delivery >= 0) {
+    if (!(entry->flags & FRAME_DELIVERY)) return false;
+    if (query->delivery < entry->delivery || query->delivery > entry->last) return false;
+  }
+  return true;
+}
+
+static int query_print(index_t *index, query_t *query)
+{
+  printer_t printer = {pn_data(16), ""};
+  pn_buffer_t *scratch = pn_buffer(1024);
+  size_t printed = 0;
+  int err = 0;
+  for (size_t i = query->first; !err && i < index->count && printed < query->limit; i++) {
+    entry_t *entry = &index->entries[i];
+    if (!query_match(query, entry)) continue;
+    const char *arrow = entry->flags & FRAME_IN ? "<-" : "->";
+    if (index->capture) {
+      pni_capture_record_t record;
+      pni_capture_read(index->source->bytes + entry->offset,
+                       index->source->size - entry->offset, &record);
+      snprintf(printer.prefix, sizeof(printer.prefix), "#%" PRIu64 " [%12.6f] %s ",
+               (uint64_t) i, record.nanos / 1e9, arrow);
+    } else {
+      snprintf(printer.prefix, sizeof(printer.prefix), "#%" PRIu64 " ", (uint64_t) i);
+    }
+    pn_frame_t frame;
+    pn_read_frame(&frame, index_frame(index, entry, scratch), entry->size);
+    err = print_frame(&printer, &frame);
+    printed++;
+  }
+  pn_buffer_free(scratch);
+  pn_data_free(printer.data);
+  return err;
+}
+
+#define SIZE_BUCKETS 33
+
+static void query_summary(index_t *index, query_t *query, double secs)
+{
+  uint64_t frames[PERFORMATIVE_SLOTS][2];  // in, out
+  uint64_t bytes[PERFORMATIVE_SLOTS][2];
+  uint64_t sizes[SIZE_BUCKETS];            // of up to 2^i bytes
+  uint64_t total_frames = 0, total_bytes = 0, bad = 0;
+  memset(frames, 0, sizeof(frames));
+  memset(bytes, 0, sizeof(bytes));
+  memset(sizes, 0, sizeof(sizes));
+  for (size_t i = query->first; i < index->count; i++) {
+    entry_t *entry = &index->entries[i];
+    if (!query_match(query, entry)) continue;
+    int slot = performative_slot(entry->performative);
+    int dir = entry->flags & FRAME_IN ? 0 : 1;
+    frames[slot][dir]++;
+    bytes[slot][dir] += entry->size;
+    int bucket = 0;
+    while (bucket < SIZE_BUCKETS - 1 && ((uint64_t) 1 << bucket) < entry->size) bucket++;
+    sizes[bucket]++;
+    total_frames++;
+    total_bytes += entry->size;
+    if (entry->flags & FRAME_BAD) bad++;
+  }
+
+  printf("%s: %" PRIu64 " frames, %" PRIu64 " bytes, indexed in %.3f s\n",
+         index->source->name, total_frames, total_bytes, secs);
+  printf("  %-12s %12s %14s %12s %14s\n", "performative", "in frames", "in bytes",
+         "out frames", "out bytes");
+  for (int slot = 0; slot < PERFORMATIVE_SLOTS; slot++) {
+    if (!frames[slot][0] && !frames[slot][1]) continue;
+    printf("  %-12s %12" PRIu64 " %14" PRIu64 " %12" PRIu64 " %14" PRIu64 "\n",
+           slot_name(slot), frames[slot][0], bytes[slot][0], frames[slot][1], bytes[slot][1]);
+  }
+  printf("  %-12s %12s\n", "frame size", "frames");
+  for (int bucket = 0; bucket < SIZE_BUCKETS; bucket++) {
+    if (!sizes[bucket]) continue;
+    printf("  <= %-9" PRIu64 " %12" PRIu64 "\n", (uint64_t) 1 << bucket, sizes[bucket]);
+  }
+  if (bad) printf("  %" PRIu64 " frames could not be decoded\n", bad);
+}
+
+static int query(source_t *source, bool capture, uint32_t flags, query_t *query)
+{
+  index_t index = {source, capture, NULL, 0, 0};
+  uint64_t start = pn_i_nanos();
+  int err = capture ? index_capture(&index, flags) : index_raw(&index);
+  if (!err) {
+    index_decode_all(&index, query->threads);
+    double secs = (pn_i_nanos() - start) / 1e9;
+    if (query->summary) {
+      query_summary(&index, query, secs);
+    } else {
+      err = query_print(&index, query);
+    }
+  }
+  free(index.entries);
+  return err;
+}
+
+static int cpu_count(void)
+{
+#if defined(_WIN32) && ! defined(__CYGWIN__)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int) info.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int) n : 1;
+#endif
+}
+
+static int performative_code(const char *name)
+{
+  for (int slot = 0; slot < PERFORMATIVE_SLOTS; slot++) {
+    if (!strcmp(name, slot_name(slot))) {
+      if (slot == 0) return PERFORMATIVE_EMPTY;
+      if (slot == PERFORMATIVE_SLOTS - 1) return PERFORMATIVE_OTHER;
+      return OPEN + slot - 1;
+    }
+  }
+  return -1;
+}
+
+typedef enum {DUMP, REPLAY, REPLAY_PACED, QUERY} dump_mode_t;
+
+int dump(const char *file, dump_mode_t mode, int count, query_t *q)
+{
+  pni_view_t *view = pni_view(file);
+  if (!view) fatal_error("proton-dump: dump: opening %s", file, errno);
+  pn_bytes_t bytes = pni_view_bytes(view);
+  source_t source = {file, bytes.start, bytes.size};
+
+  int err = 0;
+  for (int i = 0; !err && i < count; i++) {
+    uint32_t flags;
+    uint64_t start;
+    bool capture = !pni_capture_read_header(source.bytes, source.size, &flags, &start);
+    if (mode == QUERY) {
+      err = query(&source, capture, flags, q);
+    } else if (!capture) {
+      if (mode != DUMP) {
+        fprintf(stderr, "proton-dump: replay: %s is not a capture\n", file);
+        err = PN_ARG_ERR;
+      } else {
+        err = dump_raw(&source);
+      }
+    } else if (mode == DUMP) {
+      err = dump_capture(&source, flags);
+    } else {
+      err = replay(&source, flags, mode == REPLAY_PACED);
+    }
+  }
+
+  pni_view_close(view);
+  return err;
+}
+
 void usage(char* prog) {
-  printf("Usage: %s [FILE1] [FILEn] ...\n", prog);
-  printf("Displays the content of an AMQP dump file containing frame data.\n");
-  printf("\n  [FILEn]  Dump file to be displayed.\n\n");
+  printf("Usage: %s [-r|-p] [-n COUNT] [-s] [-c CHANNEL] [-t PERFORMATIVE] [-d DELIVERY]\n"
+         "       [-f FRAME] [-m COUNT] [-j THREADS] [FILE1] [FILEn] ...\n", prog);
+  printf("Displays the content of an AMQP dump file containing frame data, or of a\n");
+  printf("capture made with pn_transport_capture().\n");
+  printf("\n  [FILEn]  Dump file or capture to be displayed.\n");
+  printf("  -r       Replay each capture through a transport as fast as it goes.\n");
+  printf("  -p       Replay each capture at the pace it was captured at.\n");
+  printf("  -n       Replay or display each file COUNT times.\n");
+  printf("\nThe options below index each file first, numbering its frames.\n\n");
+  printf("  -s       Count the frames by performative and size instead of displaying them.\n");
+  printf("  -c       Only frames on CHANNEL.\n");
+  printf("  -t       Only frames of PERFORMATIVE, e.g. transfer, or empty for heartbeats.\n");
+  printf("  -d       Only transfers and dispositions of DELIVERY.\n");
+  printf("  -f       Start at frame number FRAME.\n");
+  printf("  -m       Display at most COUNT frames.\n");
+  printf("  -j       Decode with THREADS threads, one per processor by default.\n\n");
 }
 
 int main(int argc, char **argv)
@@ -113,23 +1107,86 @@ int main(int argc, char **argv)
     return 0;
   }
 
+  dump_mode_t mode = DUMP;
+  int count = 1;
+  query_t q = {-1, -1, -1, 0, (size_t) -1, false, cpu_count()};
+  bool indexed = false;
   int c;
 
-  while ( (c = getopt(argc, argv, "h")) != -1 ) {
+  while ( (c = getopt(argc, argv, "hrpn:sc:t:d:f:m:j:")) != -1 ) {
     switch(c) {
     case 'h':
       usage(argv[0]);
       return 0;
       break;
 
+    case 'r':
+      mode = REPLAY;
+      break;
+
+    case 'p':
+      mode = REPLAY_PACED;
+      break;
+
+    case 'n':
+      count = atoi(optarg);
+      break;
+
+    case 's':
+      q.summary = true;
+      indexed = true;
+      break;
+
+    case 'c':
+      q.channel = atoi(optarg);
+      indexed = true;
+      break;
+
+    case 't':
+      q.performative = performative_code(optarg);
+      if (q.performative < 0) {
+        fprintf(stderr, "proton-dump: no performative %s\n", optarg);
+        return 1;
+      }
+      indexed = true;
+      break;
+
+    case 'd':
+      q.delivery = strtoll(optarg, NULL, 0);
+      indexed = true;
+      break;
+
+    case 'f':
+      q.first = strtoull(optarg, NULL, 0);
+      indexed = true;
+      break;
+
+    case 'm':
+      q.limit = strtoull(optarg, NULL, 0);
+      indexed = true;
+      break;
+
+    case 'j':
+      q.threads = atoi(optarg);
+      indexed = true;
+      break;
+
     case '?':
       usage(argv[0]);
       return 1;
     }
   }
 
-  for (int i = 1; i < argc; i++) {
-    int err = dump(argv[i]);
+  if (indexed) {
+    if (mode != DUMP) {
+      fprintf(stderr, "proton-dump: a capture is either replayed or indexed\n");
+      return 1;
+    }
+    mode = QUERY;
+  }
+
+  for (int i = optind; i < argc; i++) {
+    int err = dump(argv[i], mode, count, &q);
     if (err) return err;
   }
 
@@ -29,23 +29,44 @@
 pn_selectable_t *pn_reactor_selectable_transport(pn_reactor_t *reactor, pn_socket_t sock, pn_transport_t *transport);
 
 PN_HANDLE(PNI_ACCEPTOR_HANDLER)
+PN_HANDLE(PNI_ACCEPTOR_VERIFIER)
+PN_HANDLE(PNI_ACCEPTOR_SOCKET_OPTIONS)
 
-void pni_acceptor_readable(pn_selectable_t *sel) {
-  pn_reactor_t *reactor = (pn_reactor_t *) pni_selectable_get_context(sel);
-  char name[1024];
-  pn_socket_t sock = pn_accept(pn_reactor_io(reactor), pn_selectable_get_fd(sel), name, 1024);
-  pn_handler_t *handler = (pn_handler_t *) pn_record_get(pn_selectable_attachments(sel), PNI_ACCEPTOR_HANDLER);
-  if (!handler) { handler = pn_reactor_get_handler(reactor); }
+void pni_acceptor_setup(pn_reactor_t *reactor, pn_socket_t sock, pn_handler_t *handler,
+                        pn_sasl_verifier_t *verifier, pn_socket_options_t *options) {
   pn_connection_t *conn = pn_reactor_connection(reactor, handler);
   pn_transport_t *trans = pn_transport();
+  pni_reactor_setup_transport(reactor, trans);
   pn_transport_set_server(trans);
   pn_sasl_t *sasl = pn_sasl(trans);
   pn_sasl_allow_skip(sasl, true);
-  pn_sasl_mechanisms(sasl, "ANONYMOUS");
-  pn_sasl_done(sasl, PN_SASL_OK);
+  if (verifier) {
+    pn_sasl_set_verifier(sasl, verifier);
+  } else {
+    pn_sasl_mechanisms(sasl, "ANONYMOUS");
+    pn_sasl_done(sasl, PN_SASL_OK);
+  }
   pn_transport_bind(trans, conn);
   pn_decref(trans);
-  pn_reactor_selectable_transport(reactor, sock, trans);
+  pn_selectable_t *sel = pn_reactor_selectable_transport(reactor, sock, trans);
+  pni_connection_zerocopy(sel, options);
+}
+
+void pni_acceptor_readable(pn_selectable_t *sel) {
+  pn_reactor_t *reactor = (pn_reactor_t *) pni_selectable_get_context(sel);
+  pn_handler_t *handler = (pn_handler_t *) pn_record_get(pn_selectable_attachments(sel), PNI_ACCEPTOR_HANDLER);
+  if (!handler) { handler = pn_reactor_get_handler(reactor); }
+  pn_sasl_verifier_t *verifier = (pn_sasl_verifier_t *) pn_record_get(pn_selectable_attachments(sel), PNI_ACCEPTOR_VERIFIER);
+  pn_socket_options_t *options = (pn_socket_options_t *) pn_record_get(pn_selectable_attachments(sel), PNI_ACCEPTOR_SOCKET_OPTIONS);
+  // drain the listen queue, but leave the reactor time for the
+  // connections already set up
+  for (int i = 0; i < PNI_ACCEPT_BATCH; i++) {
+    char name[1024];
+    pn_socket_t sock = pn_accept(pn_reactor_io(reactor), pn_selectable_get_fd(sel), name, 1024);
+    if (sock == PN_INVALID_SOCKET) break;
+    pn_socket_options_apply(pn_reactor_io(reactor), options, sock);
+    pni_acceptor_setup(reactor, sock, handler, verifier, options);
+  }
 }
 
 void pni_acceptor_finalize(pn_selectable_t *sel) {
@@ -55,11 +76,7 @@ void pni_acceptor_finalize(pn_selectable_t *sel) {
   }
 }
 
-pn_acceptor_t *pn_reactor_acceptor(pn_reactor_t *reactor, const char *host, const char *port, pn_handler_t *handler) {
-  pn_socket_t socket = pn_listen(pn_reactor_io(reactor), host, port);
-  if (socket == PN_INVALID_SOCKET) {
-    return NULL;
-  }
+pn_acceptor_t *pni_acceptor(pn_reactor_t *reactor, pn_socket_t socket, pn_handler_t *handler) {
   pn_selectable_t *sel = pn_reactor_selectable(reactor);
   pn_selectable_set_fd(sel, socket);
   pn_selectable_on_readable(sel, pni_acceptor_readable);
@@ -68,11 +85,36 @@ pn_acceptor_t *pn_reactor_acceptor(pn_reactor_t *reactor, const char *host, cons
   pn_record_t *record = pn_selectable_attachments(sel);
   pn_record_def(record, PNI_ACCEPTOR_HANDLER, PN_OBJECT);
   pn_record_set(record, PNI_ACCEPTOR_HANDLER, handler);
+  pn_record_def(record, PNI_ACCEPTOR_VERIFIER, PN_OBJECT);
+  pn_record_def(record, PNI_ACCEPTOR_SOCKET_OPTIONS, PN_OBJECT);
   pn_selectable_set_reading(sel, true);
   pn_reactor_update(reactor, sel);
   return (pn_acceptor_t *) sel;
 }
 
+pn_acceptor_t *pn_reactor_acceptor(pn_reactor_t *reactor, const char *host, const char *port, pn_handler_t *handler) {
+  pn_socket_t socket = pn_listen(pn_reactor_io(reactor), host, port);
+  if (socket == PN_INVALID_SOCKET) {
+    return NULL;
+  }
+  return pni_acceptor(reactor, socket, handler);
+}
+
+void pn_acceptor_set_sasl_verifier(pn_acceptor_t *acceptor, pn_sasl_verifier_t *verifier) {
+  pn_record_set(pn_selectable_attachments((pn_selectable_t *) acceptor), PNI_ACCEPTOR_VERIFIER, verifier);
+}
+
+void pn_acceptor_set_socket_options(pn_acceptor_t *acceptor, pn_socket_options_t *options) {
+  pn_selectable_t *sel = (pn_selectable_t *) acceptor;
+  pn_record_set(pn_selectable_attachments(sel), PNI_ACCEPTOR_SOCKET_OPTIONS, options);
+  // accepted sockets inherit the listener's buffer sizes, which must be
+  // in place before the handshake to open a large window
+  if (options && pn_selectable_get_fd(sel) != PN_INVALID_SOCKET) {
+    pn_reactor_t *reactor = (pn_reactor_t *) pni_selectable_get_context(sel);
+    pn_socket_options_apply(pn_reactor_io(reactor), options, pn_selectable_get_fd(sel));
+  }
+}
+
 void pn_acceptor_close(pn_acceptor_t *acceptor) {
   pn_selectable_t *sel = (pn_selectable_t *) acceptor;
   if (!pn_selectable_is_terminal(sel)) {
@@ -29,21 +29,32 @@
 #include <string.h>
 #include "selectable.h"
 #include "reactor.h"
+#include "socket_options.h"
+#include "engine/engine-internal.h"
 
 // XXX: overloaded for both directions
 PN_HANDLE(PN_TRANCTX)
+PN_HANDLE(PNI_CONN_SOCKET_OPTIONS)
+PN_HANDLE(PNI_CONN_UNFLUSHED)
+PN_HANDLE(PNI_CONN_ZEROCOPY)
 
 static pn_transport_t *pni_transport(pn_selectable_t *sel) {
   pn_record_t *record = pn_selectable_attachments(sel);
   return (pn_transport_t *) pn_record_get(record, PN_TRANCTX);
 }
 
+// the socket is kept until the kernel is done with zerocopy sends, as
+// they read the transport's output buffer
+static bool pni_connection_done(pn_transport_t *transport) {
+  return pn_transport_closed(transport) && !pni_transport_output_pins(transport);
+}
+
 static ssize_t pni_connection_capacity(pn_selectable_t *sel)
 {
   pn_transport_t *transport = pni_transport(sel);
   ssize_t capacity = pn_transport_capacity(transport);
   if (capacity < 0) {
-    if (pn_transport_closed(transport)) {
+    if (pni_connection_done(transport)) {
       pn_selectable_terminate(sel);
     }
   }
@@ -55,7 +66,7 @@ static ssize_t pni_connection_pending(pn_selectable_t *sel)
   pn_transport_t *transport = pni_transport(sel);
   ssize_t pending = pn_transport_pending(transport);
   if (pending < 0) {
-    if (pn_transport_closed(transport)) {
+    if (pni_connection_done(transport)) {
       pn_selectable_terminate(sel);
     }
   }
@@ -70,17 +81,43 @@ static pn_timestamp_t pni_connection_deadline(pn_selectable_t *sel)
   return deadline;
 }
 
-static void pni_connection_update(pn_selectable_t *sel) {
+// Output is sent when the reactor flushes, the selector only watches
+// a socket for writing once a send could not take everything.
+static void pni_connection_update_io(pn_selectable_t *sel) {
   ssize_t c = pni_connection_capacity(sel);
   ssize_t p = pni_connection_pending(sel);
   pn_selectable_set_reading(sel, c > 0);
-  pn_selectable_set_writing(sel, p > 0);
+  if (p > 0 && !pn_selectable_is_writing(sel)) {
+    pn_record_t *record = pn_selectable_attachments(sel);
+    if (!pn_record_get(record, PNI_CONN_UNFLUSHED)) {
+      pn_record_def(record, PNI_CONN_UNFLUSHED, PN_VOID);
+      pn_record_set(record, PNI_CONN_UNFLUSHED, sel);
+      pni_reactor_defer_write((pn_reactor_t *) pni_selectable_get_context(sel), sel);
+    }
+  } else {
+    pn_selectable_set_writing(sel, p > 0);
+  }
+}
+
+static void pni_connection_update(pn_selectable_t *sel) {
+  pni_connection_update_io(sel);
   pn_selectable_set_deadline(sel, pni_connection_deadline(sel));
 }
 
-void pni_handle_transport(pn_reactor_t *reactor, pn_event_t *event) {
-  assert(reactor);
-  pn_transport_t *transport = pn_event_transport(event);
+// Reading input or sending output can change the interest in the socket
+// without any transport event, so the callbacks that do either check
+// for a change themselves. They leave the deadline alone: input and
+// output only ever push it back, and the expiry recomputes it.
+static void pni_connection_refresh(pn_selectable_t *sel, bool reading, bool writing) {
+  pni_connection_update_io(sel);
+  if (pn_selectable_is_terminal(sel) ||
+      pn_selectable_is_reading(sel) != reading ||
+      pn_selectable_is_writing(sel) != writing) {
+    pn_reactor_update((pn_reactor_t *) pni_selectable_get_context(sel), sel);
+  }
+}
+
+void pni_reactor_update_transport(pn_reactor_t *reactor, pn_transport_t *transport) {
   pn_record_t *record = pn_transport_attachments(transport);
   pn_selectable_t *sel = (pn_selectable_t *) pn_record_get(record, PN_TRANCTX);
   if (sel && !pn_selectable_is_terminal(sel)) {
@@ -89,6 +126,11 @@ void pni_handle_transport(pn_reactor_t *reactor, pn_event_t *event) {
   }
 }
 
+void pni_handle_transport(pn_reactor_t *reactor, pn_event_t *event) {
+  assert(reactor);
+  pni_reactor_update_transport(reactor, pn_event_transport(event));
+}
+
 pn_selectable_t *pn_reactor_selectable_transport(pn_reactor_t *reactor, pn_socket_t sock, pn_transport_t *transport);
 
 void pni_handle_open(pn_reactor_t *reactor, pn_event_t *event) {
@@ -101,12 +143,85 @@ void pni_handle_open(pn_reactor_t *reactor, pn_event_t *event) {
   }
 
   pn_transport_t *transport = pn_transport();
+  pni_reactor_setup_transport(reactor, transport);
   pn_sasl_t *sasl = pn_sasl(transport);
   pn_sasl_mechanisms(sasl, "ANONYMOUS");
   pn_transport_bind(transport, conn);
   pn_decref(transport);
 }
 
+// error is set if the host could not be resolved
+static void pni_connect_transport(pn_reactor_t *reactor, pn_transport_t *transport,
+                                  const char *host, const char *port, const char *error) {
+  pn_socket_t sock = PN_INVALID_SOCKET;
+  pn_connection_t *conn = pn_transport_connection(transport);
+  pn_socket_options_t *options = NULL;
+  if (!error && conn && !pn_transport_closed(transport)) {
+    options = (pn_socket_options_t *) pn_record_get(pn_connection_attachments(conn), PNI_CONN_SOCKET_OPTIONS);
+    sock = pni_connect(pn_reactor_io(reactor), host, port, options);
+    if (sock == PN_INVALID_SOCKET) error = pn_error_text(pn_io_error(pn_reactor_io(reactor)));
+  }
+  // invalid sockets are ignored by poll, so we need to do this manualy
+  if (error) {
+    pn_condition_t *cond = pn_transport_condition(transport);
+    pn_condition_set_name(cond, "proton:io");
+    pn_condition_set_description(cond, error);
+    pn_transport_close_tail(transport);
+    pn_transport_close_head(transport);
+  }
+  pn_selectable_t *sel = pn_reactor_selectable_transport(reactor, sock, transport);
+  if (!error) pni_connection_zerocopy(sel, options);
+}
+
+typedef struct {
+  pn_reactor_t *reactor;
+  pn_transport_t *transport;
+  pn_string_t *host;
+  pn_string_t *port;
+  bool failed;
+  char numeric[PNI_NUMERIC_HOST_MAX];
+  char error[256];
+} pni_resolution_t;
+
+static pni_resolution_t *pni_resolution(pn_handler_t *handler) {
+  return (pni_resolution_t *) pn_handler_mem(handler);
+}
+
+// on the resolver thread
+static void pni_resolved(void *context, const char *numeric, const char *error) {
+  pn_handler_t *handler = (pn_handler_t *) context;
+  pni_resolution_t *resolution = pni_resolution(handler);
+  if (numeric) {
+    snprintf(resolution->numeric, sizeof(resolution->numeric), "%s", numeric);
+  } else {
+    resolution->failed = true;
+    snprintf(resolution->error, sizeof(resolution->error), "%s", error);
+  }
+  pn_reactor_post(resolution->reactor, handler);
+}
+
+static void pni_resolved_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  if (type != PN_TIMER_TASK) return;
+  pni_resolution_t *resolution = pni_resolution(handler);
+  pn_reactor_t *reactor = resolution->reactor;
+  pni_reactor_resolved(reactor);
+  if (resolution->failed) {
+    pni_connect_transport(reactor, resolution->transport, NULL, NULL, resolution->error);
+  } else {
+    pni_addr_cache_put(pni_io_addr_cache(pn_reactor_io(reactor)), pn_string_get(resolution->host),
+                       resolution->numeric, pn_reactor_now(reactor));
+    pni_connect_transport(reactor, resolution->transport, resolution->numeric,
+                          pn_string_get(resolution->port), NULL);
+  }
+}
+
+static void pni_resolved_finalize(pn_handler_t *handler) {
+  pni_resolution_t *resolution = pni_resolution(handler);
+  pn_decref(resolution->transport);
+  pn_free(resolution->host);
+  pn_free(resolution->port);
+}
+
 void pni_handle_bound(pn_reactor_t *reactor, pn_event_t *event) {
   assert(reactor);
   assert(event);
@@ -124,18 +239,31 @@ void pni_handle_bound(pn_reactor_t *reactor, pn_event_t *event) {
     port = colon + 1;
     colon[0] = '\0';
   }
-  pn_socket_t sock = pn_connect(pn_reactor_io(reactor), host, port);
   pn_transport_t *transport = pn_event_transport(event);
-  // invalid sockets are ignored by poll, so we need to do this manualy
-  if (sock == PN_INVALID_SOCKET) {
-    pn_condition_t *cond = pn_transport_condition(transport);
-    pn_condition_set_name(cond, "proton:io");
-    pn_condition_set_description(cond, pn_error_text(pn_io_error(pn_reactor_io(reactor))));
-    pn_transport_close_tail(transport);
-    pn_transport_close_head(transport);
+
+  // a name lookup can block for as long as the DNS server takes, so it
+  // is done by the resolver thread unless the address is already known
+  char numeric[PNI_NUMERIC_HOST_MAX];
+  if (!pni_numeric_host(host) &&
+      !pni_addr_cache_get(pni_io_addr_cache(pn_reactor_io(reactor)), host, pn_reactor_now(reactor),
+                          numeric, sizeof(numeric))) {
+    pn_handler_t *handler = pn_handler_new(pni_resolved_dispatch, sizeof(pni_resolution_t), pni_resolved_finalize);
+    pni_resolution_t *resolution = pni_resolution(handler);
+    resolution->reactor = reactor;
+    resolution->transport = transport;
+    pn_incref(transport);
+    resolution->host = pn_string(host);
+    resolution->port = pn_string(port);
+    resolution->failed = false;
+    if (!pni_reactor_resolve(reactor, host, pni_resolved, handler)) {
+      pn_free(str);
+      return;
+    }
+    // no resolver thread, fall back to looking the name up here
+    pn_decref(handler);
   }
+  pni_connect_transport(reactor, transport, host, port, NULL);
   pn_free(str);
-  pn_reactor_selectable_transport(reactor, sock, transport);
 }
 
 void pni_handle_final(pn_reactor_t *reactor, pn_event_t *event) {
@@ -145,14 +273,26 @@ void pni_handle_final(pn_reactor_t *reactor, pn_event_t *event) {
   pn_list_remove(pn_reactor_children(reactor), conn);
 }
 
+// read and process until the socket runs dry, the transport wants no
+// more for now, or this much has been read in one go, which leaves the
+// other connections their turn
+#define PNI_READ_BUDGET (256*1024)
+
 static void pni_connection_readable(pn_selectable_t *sel)
 {
   pn_reactor_t *reactor = (pn_reactor_t *) pni_selectable_get_context(sel);
   pn_transport_t *transport = pni_transport(sel);
-  ssize_t capacity = pn_transport_capacity(transport);
-  if (capacity > 0) {
-    ssize_t n = pn_recv(pn_reactor_io(reactor), pn_selectable_get_fd(sel),
-                        pn_transport_tail(transport), capacity);
+  bool reading = pn_selectable_is_reading(sel);
+  bool writing = pn_selectable_is_writing(sel);
+  size_t total = 0;
+  ssize_t capacity;
+  while (total < PNI_READ_BUDGET && (capacity = pn_transport_capacity(transport)) > 0) {
+    // the ssl layer may give the socket's input to the kernel part way
+    ssize_t n = (pni_transport_kernel_tls(transport) & PNI_KTLS_RX)
+      ? pni_recv_tls(pn_reactor_io(reactor), pn_selectable_get_fd(sel),
+                     pn_transport_tail(transport), capacity)
+      : pn_recv(pn_reactor_io(reactor), pn_selectable_get_fd(sel),
+                pn_transport_tail(transport), capacity);
     if (n <= 0) {
       if (n == 0 || !pn_wouldblock(pn_reactor_io(reactor))) {
         if (n < 0) {
@@ -162,28 +302,37 @@ static void pni_connection_readable(pn_selectable_t *sel)
         }
         pn_transport_close_tail(transport);
       }
-    } else {
-      pn_transport_process(transport, (size_t)n);
+      break;
     }
+    pn_transport_process(transport, (size_t)n);
+    total += n;
+    // a short read has emptied the socket, no need for a read to say so
+    if (n < capacity) break;
   }
 
-  ssize_t newcap = pn_transport_capacity(transport);
-  //occasionally transport events aren't generated when expected, so
-  //the following hack ensures we always update the selector
-  if (1 || newcap != capacity) {
-    pni_connection_update(sel);
-    pn_reactor_update(reactor, sel);
-  }
+  pni_connection_refresh(sel, reading, writing);
 }
 
-static void pni_connection_writable(pn_selectable_t *sel)
+// send until the transport has nothing left or the socket pushes back
+static bool pni_connection_send(pn_selectable_t *sel)
 {
   pn_reactor_t *reactor = (pn_reactor_t *) pni_selectable_get_context(sel);
   pn_transport_t *transport = pni_transport(sel);
-  ssize_t pending = pn_transport_pending(transport);
-  if (pending > 0) {
-    ssize_t n = pn_send(pn_reactor_io(reactor), pn_selectable_get_fd(sel),
-                        pn_transport_head(transport), pending);
+  size_t zerocopy = (uintptr_t) pn_record_get(pn_selectable_attachments(sel), PNI_CONN_ZEROCOPY);
+  ssize_t pending;
+  while ((pending = pn_transport_pending(transport)) > 0) {
+    ssize_t n;
+    // a socket the kernel encrypts for refuses MSG_ZEROCOPY
+    if (zerocopy && (size_t) pending >= zerocopy &&
+        !(pni_transport_kernel_tls(transport) & PNI_KTLS_TX)) {
+      bool pinned;
+      n = pni_send_zerocopy(pn_reactor_io(reactor), pn_selectable_get_fd(sel),
+                            pn_transport_head(transport), pending, &pinned);
+      if (pinned) pni_transport_pin_output(transport);
+    } else {
+      n = pn_send(pn_reactor_io(reactor), pn_selectable_get_fd(sel),
+                  pn_transport_head(transport), pending);
+    }
     if (n < 0) {
       if (!pn_wouldblock(pn_reactor_io(reactor))) {
         pn_condition_t *cond = pn_transport_condition(transport);
@@ -192,21 +341,50 @@ static void pni_connection_writable(pn_selectable_t *sel)
           pn_condition_set_description(cond, pn_error_text(pn_io_error(pn_reactor_io(reactor))));
         }
         pn_transport_close_head(transport);
+        return false;
       }
-    } else {
-      pn_transport_pop(transport, n);
+      return true;
     }
+    pn_transport_pop(transport, n);
+    if (n < pending) return true;
   }
+  return false;
+}
 
-  ssize_t newpending = pn_transport_pending(transport);
-  if (newpending != pending) {
-    pni_connection_update(sel);
-    pn_reactor_update(reactor, sel);
-  }
+static void pni_connection_writable(pn_selectable_t *sel)
+{
+  bool reading = pn_selectable_is_reading(sel);
+  bool writing = pn_selectable_is_writing(sel);
+  pni_connection_send(sel);
+  pni_connection_refresh(sel, reading, writing);
+}
+
+void pni_connection_flush(pn_selectable_t *sel)
+{
+  pn_record_set(pn_selectable_attachments(sel), PNI_CONN_UNFLUSHED, NULL);
+  if (pn_selectable_is_terminal(sel)) return;
+  bool reading = pn_selectable_is_reading(sel);
+  bool writing = pn_selectable_is_writing(sel);
+  pn_selectable_set_writing(sel, pni_connection_send(sel));
+  pni_connection_refresh(sel, reading, writing);
 }
 
 static void pni_connection_error(pn_selectable_t *sel) {
   pn_reactor_t *reactor = (pn_reactor_t *) pni_selectable_get_context(sel);
+  pn_transport_t *transport = pni_transport(sel);
+  if (pni_transport_output_pins(transport)) {
+    // zerocopy completions come through the error queue, which is not
+    // an error of the socket
+    uint32_t done = pni_zerocopy_reap(pn_reactor_io(reactor), pn_selectable_get_fd(sel));
+    if (done) {
+      pni_transport_unpin_output(transport, done);
+      bool reading = pn_selectable_is_reading(sel);
+      bool writing = pn_selectable_is_writing(sel);
+      pn_selectable_set_writing(sel, pni_connection_send(sel));
+      pni_connection_refresh(sel, reading, writing);
+      return;
+    }
+  }
   pn_selectable_terminate(sel);
   pn_reactor_update(reactor, sel);
 }
@@ -216,10 +394,7 @@ static void pni_connection_expired(pn_selectable_t *sel) {
   pn_transport_t *transport = pni_transport(sel);
   pn_timestamp_t deadline = pn_transport_tick(transport, pn_reactor_now(reactor));
   pn_selectable_set_deadline(sel, deadline);
-  ssize_t c = pni_connection_capacity(sel);
-  ssize_t p = pni_connection_pending(sel);
-  pn_selectable_set_reading(sel, c > 0);
-  pn_selectable_set_writing(sel, p > 0);
+  pni_connection_update_io(sel);
   pn_reactor_update(reactor, sel);
 }
 
@@ -247,6 +422,7 @@ pn_selectable_t *pn_reactor_selectable_transport(pn_reactor_t *reactor, pn_socke
   pn_record_def(tr, PN_TRANCTX, PN_WEAKREF);
   pn_record_set(tr, PN_TRANCTX, sel);
   pni_record_init_reactor(tr, reactor);
+  if (pni_kernel_tls_enabled(pn_reactor_io(reactor))) pni_transport_set_socket(transport, sock);
   pni_connection_update(sel);
   pn_reactor_update(reactor, sel);
   return sel;
@@ -263,3 +439,20 @@ pn_connection_t *pn_reactor_connection(pn_reactor_t *reactor, pn_handler_t *hand
   pn_decref(connection);
   return connection;
 }
+
+void pni_connection_zerocopy(pn_selectable_t *sel, pn_socket_options_t *options) {
+  pn_io_t *io = pn_reactor_io((pn_reactor_t *) pni_selectable_get_context(sel));
+  if (!options || options->zerocopy < 0) options = pn_io_get_socket_options(io);
+  if (!options || options->zerocopy <= 0) return;
+  if (!pni_zerocopy_enabled(io, pn_selectable_get_fd(sel))) return;
+  pn_record_t *record = pn_selectable_attachments(sel);
+  pn_record_def(record, PNI_CONN_ZEROCOPY, PN_VOID);
+  pn_record_set(record, PNI_CONN_ZEROCOPY, (void *) (uintptr_t) options->zerocopy);
+}
+
+void pn_reactor_connection_set_socket_options(pn_connection_t *connection, pn_socket_options_t *options) {
+  assert(connection);
+  pn_record_t *record = pn_connection_attachments(connection);
+  pn_record_def(record, PNI_CONN_SOCKET_OPTIONS, PN_OBJECT);
+  pn_record_set(record, PNI_CONN_SOCKET_OPTIONS, options);
+}
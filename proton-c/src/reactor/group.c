@@ -0,0 +1,313 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/io.h>
+#include <proton/reactor.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "reactor.h"
+#include "selectable.h"
+#include "thread.h"
+#include "listener.h"
+#include "alloc_private.h"
+
+struct pn_reactor_group_t {
+  pn_list_t *reactors;
+  pn_list_t *acceptors;
+  pni_thread_t **threads;
+  int *cpus;     // each member's thread is pinned to, or -1
+  int *nodes;    // the same for NUMA nodes
+  size_t size;
+  size_t next;
+  bool started;
+};
+
+static void pn_reactor_group_initialize(pn_reactor_group_t *group) {
+  group->reactors = pn_list(PN_WEAKREF, 0);
+  group->acceptors = pn_list(PN_OBJECT, 0);
+  group->threads = NULL;
+  group->cpus = NULL;
+  group->nodes = NULL;
+  group->size = 0;
+  group->next = 0;
+  group->started = false;
+}
+
+static void pn_reactor_group_finalize(pn_reactor_group_t *group) {
+  pn_reactor_group_stop(group);
+  pn_free(group->acceptors);
+  for (size_t i = 0; i < group->size; i++) {
+    pn_reactor_free((pn_reactor_t *) pn_list_get(group->reactors, i));
+  }
+  pn_free(group->reactors);
+  pni_free(PN_ALLOC_REACTOR, group->threads);
+  pni_free(PN_ALLOC_REACTOR, group->cpus);
+  pni_free(PN_ALLOC_REACTOR, group->nodes);
+}
+
+#define pn_reactor_group_hashcode NULL
+#define pn_reactor_group_compare NULL
+#define pn_reactor_group_inspect NULL
+
+PN_CLASSDEF(pn_reactor_group)
+
+pn_reactor_group_t *pn_reactor_group(size_t size) {
+  assert(size > 0);
+  pn_reactor_group_t *group = pn_reactor_group_new();
+  for (size_t i = 0; i < size; i++) {
+    pn_reactor_t *reactor = pn_reactor();
+    if (!reactor) {
+      pn_free(group);
+      return NULL;
+    }
+    pn_list_add(group->reactors, reactor);
+    group->size++;
+  }
+  group->threads = (pni_thread_t **) pni_calloc(PN_ALLOC_REACTOR, size, sizeof(pni_thread_t *));
+  group->cpus = (int *) pni_malloc(PN_ALLOC_REACTOR, size * sizeof(int));
+  group->nodes = (int *) pni_malloc(PN_ALLOC_REACTOR, size * sizeof(int));
+  if (!group->threads || !group->cpus || !group->nodes) {
+    pn_free(group);
+    return NULL;
+  }
+  for (size_t i = 0; i < size; i++) {
+    group->cpus[i] = -1;
+    group->nodes[i] = -1;
+  }
+  return group;
+}
+
+void pn_reactor_group_free(pn_reactor_group_t *group) {
+  pn_free(group);
+}
+
+size_t pn_reactor_group_size(pn_reactor_group_t *group) {
+  assert(group);
+  return group->size;
+}
+
+pn_reactor_t *pn_reactor_group_get(pn_reactor_group_t *group, size_t index) {
+  assert(group);
+  assert(index < group->size);
+  return (pn_reactor_t *) pn_list_get(group->reactors, index);
+}
+
+int pn_reactor_group_set_cpu(pn_reactor_group_t *group, size_t index, int cpu) {
+  assert(group);
+  if (index >= group->size || cpu < -1) return PN_ARG_ERR;
+  if (group->started) return PN_STATE_ERR;
+  group->cpus[index] = cpu;
+  group->nodes[index] = -1;
+  return 0;
+}
+
+int pn_reactor_group_set_node(pn_reactor_group_t *group, size_t index, int node) {
+  assert(group);
+  if (index >= group->size || node < -1) return PN_ARG_ERR;
+  if (group->started) return PN_STATE_ERR;
+  group->nodes[index] = node;
+  group->cpus[index] = -1;
+  return 0;
+}
+
+// have the kernel send each shard the connections arriving on its
+// member's CPU, so they are accepted where their packets are handled
+static void pni_reactor_group_steer(pn_reactor_group_t *group) {
+  for (size_t i = 0; i < pn_list_size(group->acceptors); i++) {
+    pn_selectable_t *sel = (pn_selectable_t *) pn_list_get(group->acceptors, i);
+    pn_reactor_t *reactor = (pn_reactor_t *) pni_selectable_get_context(sel);
+    for (size_t j = 0; j < group->size; j++) {
+      if (pn_reactor_group_get(group, j) == reactor && group->cpus[j] >= 0) {
+        // only a hint, where it is not supported connections are spread as before
+        pni_listen_steer(pn_reactor_io(reactor), pn_selectable_get_fd(sel), group->cpus[j]);
+      }
+    }
+  }
+}
+
+static void pni_reactor_group_run(void *context) {
+  pn_reactor_t *reactor = (pn_reactor_t *) context;
+  pn_reactor_run(reactor);
+}
+
+int pn_reactor_group_start(pn_reactor_group_t *group) {
+  assert(group);
+  if (group->started) return PN_STATE_ERR;
+  group->started = true;
+  pni_reactor_group_steer(group);
+  for (size_t i = 0; i < group->size; i++) {
+    pn_reactor_t *reactor = pn_reactor_group_get(group, i);
+    pni_reactor_set_persistent(reactor, true);
+    group->threads[i] = pni_thread(pni_reactor_group_run, reactor);
+    // a reactor allocates the transports and buffers of its connections
+    // as they arrive, which once pinned is from memory on its node
+    int err = !group->threads[i] ? PN_ERR :
+      group->cpus[i] >= 0 ? pni_thread_pin_cpu(group->threads[i], group->cpus[i]) :
+      group->nodes[i] >= 0 ? pni_thread_pin_node(group->threads[i], group->nodes[i]) : 0;
+    if (err) {
+      pn_reactor_group_stop(group);
+      return err;
+    }
+  }
+  return 0;
+}
+
+static void pni_release_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  if (type == PN_TIMER_TASK) {
+    pn_reactor_group_t *group = *(pn_reactor_group_t **) pn_handler_mem(handler);
+    pn_reactor_t *reactor = pn_event_reactor(event);
+    for (size_t i = 0; i < pn_list_size(group->acceptors); i++) {
+      pn_selectable_t *sel = (pn_selectable_t *) pn_list_get(group->acceptors, i);
+      if (pni_selectable_get_context(sel) == reactor) {
+        pn_acceptor_close((pn_acceptor_t *) sel);
+      }
+    }
+    pni_reactor_set_persistent(reactor, false);
+  }
+}
+
+void pn_reactor_group_stop(pn_reactor_group_t *group) {
+  assert(group);
+  if (!group->started) return;
+  for (size_t i = 0; i < group->size; i++) {
+    if (group->threads[i]) {
+      pn_handler_t *handler = pn_handler_new(pni_release_dispatch, sizeof(pn_reactor_group_t *), NULL);
+      *(pn_reactor_group_t **) pn_handler_mem(handler) = group;
+      pn_reactor_post(pn_reactor_group_get(group, i), handler);
+    }
+  }
+  for (size_t i = 0; i < group->size; i++) {
+    pni_thread_join(group->threads[i]);
+    group->threads[i] = NULL;
+  }
+  group->started = false;
+}
+
+//
+// group acceptor
+//
+
+typedef struct {
+  pn_reactor_t *reactor;
+  pn_socket_t sock;
+} pni_handoff_t;
+
+static pni_handoff_t *pni_handoff(pn_handler_t *handler) {
+  return (pni_handoff_t *) pn_handler_mem(handler);
+}
+
+static void pni_handoff_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  if (type == PN_TIMER_TASK) {
+    pni_handoff_t *handoff = pni_handoff(handler);
+    pn_reactor_t *reactor = handoff->reactor;
+    pni_acceptor_setup(reactor, handoff->sock, pn_reactor_get_handler(reactor), NULL, NULL);
+    handoff->sock = PN_INVALID_SOCKET;
+  }
+}
+
+static void pni_handoff_finalize(pn_handler_t *handler) {
+  // the target reactor went away before it could take the connection
+  pni_handoff_t *handoff = pni_handoff(handler);
+  if (handoff->sock != PN_INVALID_SOCKET) {
+    pn_close(pn_reactor_io(handoff->reactor), handoff->sock);
+  }
+}
+
+PN_HANDLE(PNI_ACCEPTOR_GROUP)
+
+static void pni_group_acceptor_readable(pn_selectable_t *sel) {
+  pn_reactor_t *reactor = (pn_reactor_t *) pni_selectable_get_context(sel);
+  pn_reactor_group_t *group = (pn_reactor_group_t *) pn_record_get(pn_selectable_attachments(sel), PNI_ACCEPTOR_GROUP);
+  for (int i = 0; i < PNI_ACCEPT_BATCH; i++) {
+    char name[1024];
+    pn_socket_t sock = pn_accept(pn_reactor_io(reactor), pn_selectable_get_fd(sel), name, 1024);
+    if (sock == PN_INVALID_SOCKET) return;
+
+    pn_reactor_t *target = pn_reactor_group_get(group, group->next++ % group->size);
+    if (target == reactor) {
+      pni_acceptor_setup(reactor, sock, pn_reactor_get_handler(reactor), NULL, NULL);
+    } else {
+      pn_handler_t *handler = pn_handler_new(pni_handoff_dispatch, sizeof(pni_handoff_t), pni_handoff_finalize);
+      pni_handoff(handler)->reactor = target;
+      pni_handoff(handler)->sock = sock;
+      pn_reactor_post(target, handler);
+    }
+  }
+}
+
+static void pni_group_acceptor_finalize(pn_selectable_t *sel) {
+  pn_reactor_t *reactor = (pn_reactor_t *) pni_selectable_get_context(sel);
+  if (pn_selectable_get_fd(sel) != PN_INVALID_SOCKET) {
+    pn_close(pn_reactor_io(reactor), pn_selectable_get_fd(sel));
+  }
+}
+
+// one listener per member reactor, if the listener can be shared
+static bool pni_group_acceptor_shard(pn_reactor_group_t *group, pn_socket_t socket) {
+  pn_socket_t *shards =
+    (pn_socket_t *) pni_calloc(PN_ALLOC_REACTOR, group->size, sizeof(pn_socket_t));
+  if (!shards) return false;
+  shards[0] = socket;
+  for (size_t i = 1; i < group->size; i++) {
+    pn_io_t *io = pn_reactor_io(pn_reactor_group_get(group, i));
+    shards[i] = pni_listen_share(io, socket);
+    if (shards[i] == PN_INVALID_SOCKET) {
+      while (--i > 0) {
+        pn_close(pn_reactor_io(pn_reactor_group_get(group, i)), shards[i]);
+      }
+      pni_free(PN_ALLOC_REACTOR, shards);
+      return false;
+    }
+  }
+  for (size_t i = 0; i < group->size; i++) {
+    pn_acceptor_t *acceptor = pni_acceptor(pn_reactor_group_get(group, i), shards[i], NULL);
+    pn_list_add(group->acceptors, acceptor);
+  }
+  pni_free(PN_ALLOC_REACTOR, shards);
+  return true;
+}
+
+pn_acceptor_t *pn_reactor_group_acceptor(pn_reactor_group_t *group, const char *host, const char *port) {
+  assert(group);
+  assert(!group->started);
+  pn_reactor_t *reactor = pn_reactor_group_get(group, 0);
+  pn_socket_t socket = group->size > 1 ? pni_listen_shareable(pn_reactor_io(reactor), host, port)
+                                        : pn_listen(pn_reactor_io(reactor), host, port);
+  if (socket == PN_INVALID_SOCKET) {
+    return NULL;
+  }
+  if (group->size > 1 && pni_group_acceptor_shard(group, socket)) {
+    return (pn_acceptor_t *) pn_list_get(group->acceptors, pn_list_size(group->acceptors) - group->size);
+  }
+  pn_selectable_t *sel = pn_reactor_selectable(reactor);
+  pn_selectable_set_fd(sel, socket);
+  pn_selectable_on_readable(sel, pni_group_acceptor_readable);
+  pn_selectable_on_finalize(sel, pni_group_acceptor_finalize);
+  pni_record_init_reactor(pn_selectable_attachments(sel), reactor);
+  pn_record_t *record = pn_selectable_attachments(sel);
+  pn_record_def(record, PNI_ACCEPTOR_GROUP, PN_VOID);
+  pn_record_set(record, PNI_ACCEPTOR_GROUP, group);
+  pn_selectable_set_reading(sel, true);
+  pn_reactor_update(reactor, sel);
+  pn_list_add(group->acceptors, sel);
+  return (pn_acceptor_t *) sel;
+}
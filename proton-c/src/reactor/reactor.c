@@ -30,11 +30,22 @@
 #include <proton/delivery.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "reactor.h"
+#include "object/record.h"
 #include "selectable.h"
 #include "platform.h"
+#include "probes.h"
+#include "thread.h"
+#include "wakeup.h"
+#include "transport/frame_pool.h"
+#include "alloc_private.h"
+#include "engine/engine-internal.h"
+
+// how many idle io buffers the reactor keeps for new connections
+#define PNI_REACTOR_FRAMES (64)
 
 struct pn_reactor_t {
   pn_record_t *attachments;
@@ -44,26 +55,80 @@ struct pn_reactor_t {
   pn_handler_t *handler;
   pn_list_t *children;
   pn_timer_t *timer;
-  pn_socket_t wakeup[2];
+  pni_frame_pool_t *frames;
+  pni_wakeup_t wakeup;
   pn_selectable_t *selectable;
+  // connections with output waiting for the next flush
+  pn_list_t *unflushed;
+  pn_timestamp_t unflushed_since;
+  pn_millis_t flush_latency;
+  // how much one pass of pn_reactor_process may do, zero for no limit
+  int event_budget;
+  int connection_budget;
+  pn_millis_t time_budget;
+  // counts the rounds of each connection's share of events
+  unsigned int round;
+  bool deferred;
   pn_event_type_t previous;
   pn_timestamp_t now;
+  // handlers posted from other threads, most recent first
+  void *volatile posted;
+  // started by the first host name lookup
+  pni_resolver_t *resolver;
+  int resolving;
   int selectables;
   int timeout;
   bool yield;
+  bool persistent;
+  bool coarse_clock;
 };
 
+static inline pn_timestamp_t pni_reactor_clock(pn_reactor_t *reactor) {
+  return reactor->coarse_clock ? pn_i_now_coarse() : pn_i_now();
+}
+
 pn_timestamp_t pn_reactor_mark(pn_reactor_t *reactor) {
   assert(reactor);
-  reactor->now = pn_i_now();
+  reactor->now = pni_reactor_clock(reactor);
   return reactor->now;
 }
 
+static void pni_wake_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  pn_transport_t *transport = *(pn_transport_t **) pn_handler_mem(handler);
+  // the layers may have held input back until the work was done
+  pn_transport_process(transport, 0);
+  pni_reactor_update_transport(pn_event_reactor(event), transport);
+}
+
+static void pni_wake_finalize(pn_handler_t *handler) {
+  pn_decref(*(pn_transport_t **) pn_handler_mem(handler));
+}
+
+// called from whichever thread finished work for the transport, the
+// reactor thread picks it up from the posted handlers
+static void pni_reactor_wake_transport(pn_transport_t *transport, void *context) {
+  pn_reactor_t *reactor = (pn_reactor_t *) context;
+  pn_handler_t *handler = pn_handler_new(pni_wake_dispatch, sizeof(pn_transport_t *), pni_wake_finalize);
+  *(pn_transport_t **) pn_handler_mem(handler) = transport;
+  pn_reactor_post(reactor, handler);
+}
+
+void pni_reactor_setup_transport(pn_reactor_t *reactor, pn_transport_t *transport) {
+  assert(reactor);
+  pni_transport_set_frame_pool(transport, reactor->frames);
+  pni_transport_set_waker(transport, pni_reactor_wake_transport, reactor);
+}
+
 pn_timestamp_t pn_reactor_now(pn_reactor_t *reactor) {
   assert(reactor);
   return reactor->now;
 }
 
+typedef struct pni_post_t {
+  struct pni_post_t *next;
+  pn_handler_t *handler;
+} pni_post_t;
+
 static void pn_reactor_initialize(pn_reactor_t *reactor) {
   reactor->attachments = pn_record();
   reactor->io = pn_io();
@@ -72,29 +137,49 @@ static void pn_reactor_initialize(pn_reactor_t *reactor) {
   reactor->handler = pn_handler(NULL);
   reactor->children = pn_list(PN_OBJECT, 0);
   reactor->timer = pn_timer(reactor->collector);
-  reactor->wakeup[0] = PN_INVALID_SOCKET;
-  reactor->wakeup[1] = PN_INVALID_SOCKET;
+  reactor->frames = pni_frame_pool(PNI_REACTOR_FRAMES);
   reactor->selectable = NULL;
+  reactor->unflushed = pn_list(PN_OBJECT, 0);
+  reactor->unflushed_since = 0;
+  reactor->flush_latency = 0;
+  reactor->event_budget = 0;
+  reactor->connection_budget = 0;
+  reactor->time_budget = 0;
+  reactor->round = 0;
+  reactor->deferred = false;
   reactor->previous = PN_EVENT_NONE;
+  reactor->posted = NULL;
+  reactor->resolver = NULL;
+  reactor->resolving = 0;
   reactor->selectables = 0;
   reactor->timeout = 0;
   reactor->yield = false;
+  reactor->persistent = false;
+  reactor->coarse_clock = false;
   pn_reactor_mark(reactor);
 }
 
 static void pn_reactor_finalize(pn_reactor_t *reactor) {
-  for (int i = 0; i < 2; i++) {
-    if (reactor->wakeup[i] != PN_INVALID_SOCKET) {
-      pn_close(reactor->io, reactor->wakeup[i]);
-    }
-  }
+  // lookups still running post their results, which are released below
+  pni_resolver_free(reactor->resolver);
+  pni_wakeup_fini(reactor->io, &reactor->wakeup);
   pn_decref(reactor->attachments);
   pn_decref(reactor->collector);
   pn_decref(reactor->global);
   pn_decref(reactor->handler);
   pn_decref(reactor->children);
+  pn_decref(reactor->unflushed);
   pn_decref(reactor->timer);
+  pn_decref(reactor->frames);
   pn_decref(reactor->io);
+  // posted handlers that never got to run still hold the poster's reference
+  pni_post_t *post = (pni_post_t *) reactor->posted;
+  while (post) {
+    pni_post_t *next = post->next;
+    pn_decref(post->handler);
+    pni_free(PN_ALLOC_REACTOR, post);
+    post = next;
+  }
 }
 
 #define pn_reactor_hashcode NULL
@@ -104,8 +189,9 @@ static void pn_reactor_finalize(pn_reactor_t *reactor) {
 PN_CLASSDEF(pn_reactor)
 
 pn_reactor_t *pn_reactor() {
+  PNI_PROBES_REGISTER();
   pn_reactor_t *reactor = pn_reactor_new();
-  int err = pn_pipe(reactor->io, reactor->wakeup);
+  int err = pni_wakeup_init(reactor->io, &reactor->wakeup);
   if (err) {
     pn_free(reactor);
     return NULL;
@@ -129,6 +215,73 @@ void pn_reactor_set_timeout(pn_reactor_t *reactor, pn_millis_t timeout) {
   reactor->timeout = timeout;
 }
 
+pn_millis_t pn_reactor_get_flush_latency(pn_reactor_t *reactor) {
+  assert(reactor);
+  return reactor->flush_latency;
+}
+
+void pn_reactor_set_flush_latency(pn_reactor_t *reactor, pn_millis_t latency) {
+  assert(reactor);
+  reactor->flush_latency = latency;
+}
+
+int pn_reactor_get_event_budget(pn_reactor_t *reactor) {
+  assert(reactor);
+  return reactor->event_budget;
+}
+
+void pn_reactor_set_event_budget(pn_reactor_t *reactor, int events) {
+  assert(reactor);
+  reactor->event_budget = events > 0 ? events : 0;
+}
+
+pn_millis_t pn_reactor_get_time_budget(pn_reactor_t *reactor) {
+  assert(reactor);
+  return reactor->time_budget;
+}
+
+void pn_reactor_set_time_budget(pn_reactor_t *reactor, pn_millis_t time) {
+  assert(reactor);
+  reactor->time_budget = time;
+}
+
+int pn_reactor_get_connection_budget(pn_reactor_t *reactor) {
+  assert(reactor);
+  return reactor->connection_budget;
+}
+
+void pn_reactor_set_connection_budget(pn_reactor_t *reactor, int events) {
+  assert(reactor);
+  reactor->connection_budget = events > 0 ? events : 0;
+}
+
+bool pn_reactor_get_coarse_clock(pn_reactor_t *reactor) {
+  assert(reactor);
+  return reactor->coarse_clock;
+}
+
+void pn_reactor_set_coarse_clock(pn_reactor_t *reactor, bool coarse) {
+  assert(reactor);
+  reactor->coarse_clock = coarse;
+  pn_reactor_mark(reactor);
+}
+
+void pni_reactor_defer_write(pn_reactor_t *reactor, pn_selectable_t *sel) {
+  assert(reactor);
+  if (!pn_list_size(reactor->unflushed)) {
+    reactor->unflushed_since = reactor->flush_latency ? pni_reactor_clock(reactor) : 0;
+  }
+  pn_list_add(reactor->unflushed, sel);
+}
+
+static void pni_reactor_flush(pn_reactor_t *reactor) {
+  // flushing can generate events but never defers more output
+  for (size_t i = 0; i < pn_list_size(reactor->unflushed); i++) {
+    pni_connection_flush((pn_selectable_t *) pn_list_get(reactor->unflushed, i));
+  }
+  pn_list_clear(reactor->unflushed);
+}
+
 void pn_reactor_free(pn_reactor_t *reactor) {
   if (reactor) {
     pn_collector_release(reactor->collector);
@@ -177,6 +330,22 @@ pn_list_t *pn_reactor_children(pn_reactor_t *reactor) {
   return reactor->children;
 }
 
+void pn_reactor_metrics(pn_reactor_t *reactor, pn_transport_metrics_t *metrics) {
+  assert(reactor);
+  memset(metrics, 0, sizeof(*metrics));
+  size_t n = pn_list_size(reactor->children);
+  for (size_t i = 0; i < n; i++) {
+    void *child = pn_list_get(reactor->children, i);
+    if (pn_class_id(pn_object_reify(child)) != CID_pn_connection) continue;
+    pn_transport_t *transport = pn_connection_transport((pn_connection_t *) child);
+    if (transport) {
+      pn_transport_metrics_t connection;
+      pn_transport_metrics(transport, &connection);
+      pn_transport_metrics_add(metrics, &connection);
+    }
+  }
+}
+
 static void pni_selectable_release(pn_selectable_t *selectable) {
   pn_reactor_t *reactor = (pn_reactor_t *) pni_selectable_get_context(selectable);
   pn_incref(selectable);
@@ -228,20 +397,29 @@ static void pni_reactor_dispatch_post(pn_reactor_t *reactor, pn_event_t *event)
   }
 }
 
-PN_HANDLE(PN_HANDLER)
+#define PN_HANDLER PNI_RECORD_HANDLER
+
+// bumped whenever a handler is set, which makes the handlers endpoints
+// have cached stale
+static int volatile pni_handler_epoch = 1;
 
 pn_handler_t *pn_record_get_handler(pn_record_t *record) {
   assert(record);
   return (pn_handler_t *) pn_record_get(record, PN_HANDLER);
 }
 
-void pn_record_set_handler(pn_record_t *record, pn_handler_t *handler) {
-  assert(record);
+static void pni_record_put_handler(pn_record_t *record, pn_handler_t *handler) {
   pn_record_def(record, PN_HANDLER, PN_OBJECT);
   pn_record_set(record, PN_HANDLER, handler);
 }
 
-PN_HANDLE(PN_REACTOR)
+void pn_record_set_handler(pn_record_t *record, pn_handler_t *handler) {
+  assert(record);
+  pni_record_put_handler(record, handler);
+  pni_atomic_add(&pni_handler_epoch, 1);
+}
+
+#define PN_REACTOR PNI_RECORD_REACTOR
 
 pn_reactor_t *pni_record_get_reactor(pn_record_t *record) {
   return (pn_reactor_t *) pn_record_get(record, PN_REACTOR);
@@ -310,22 +488,54 @@ pn_reactor_t *pn_event_reactor(pn_event_t *event) {
   return pn_class_reactor(clazz, context);
 }
 
+// the handler of the innermost of an endpoint and its parents to have one
+static pn_handler_t *pni_endpoint_handler(pn_endpoint_t *endpoint) {
+  pn_link_t *link = endpoint->type == SENDER || endpoint->type == RECEIVER
+    ? (pn_link_t *) endpoint : NULL;
+  pn_session_t *session = link ? link->session
+    : endpoint->type == SESSION ? (pn_session_t *) endpoint : NULL;
+  pn_connection_t *connection = session ? session->connection : (pn_connection_t *) endpoint;
+  pn_handler_t *handler = NULL;
+  if (link) handler = pn_record_get_handler(link->context);
+  if (!handler && session) handler = pn_record_get_handler(session->context);
+  if (!handler) handler = pn_record_get_handler(connection->context);
+  return handler;
+}
+
 pn_handler_t *pn_event_handler(pn_event_t *event, pn_handler_t *default_handler) {
   pn_handler_t *handler = NULL;
-  pn_link_t *link = pn_event_link(event);
-  if (link) {
-    handler = pn_record_get_handler(pn_link_attachments(link));
-    if (handler) { return handler; }
-  }
-  pn_session_t *session = pn_event_session(event);
-  if (session) {
-    handler = pn_record_get_handler(pn_session_attachments(session));
-    if (handler) { return handler; }
+  void *context = pn_event_context(event);
+  pn_endpoint_t *endpoint = NULL;
+  switch (pn_class_id(pn_event_class(event))) {
+  case CID_pn_delivery:
+    if (((pn_delivery_t *) context)->link) endpoint = &((pn_delivery_t *) context)->link->endpoint;
+    break;
+  case CID_pn_link:
+    endpoint = &((pn_link_t *) context)->endpoint;
+    break;
+  case CID_pn_session:
+    endpoint = &((pn_session_t *) context)->endpoint;
+    break;
+  case CID_pn_connection:
+    endpoint = &((pn_connection_t *) context)->endpoint;
+    break;
+  case CID_pn_transport:
+    if (((pn_transport_t *) context)->connection) {
+      endpoint = &((pn_transport_t *) context)->connection->endpoint;
+    }
+    break;
+  default:
+    break;
   }
-  pn_connection_t *connection = pn_event_connection(event);
-  if (connection) {
-    handler = pn_record_get_handler(pn_connection_attachments(connection));
-    if (handler) { return handler; }
+  if (endpoint) {
+    // resolved again only after a handler has been set somewhere
+    int epoch = pni_atomic_get(&pni_handler_epoch);
+    if (endpoint->handler_epoch != epoch) {
+      endpoint->handler = pni_endpoint_handler(endpoint);
+      endpoint->handler_epoch = epoch;
+    }
+    handler = (pn_handler_t *) endpoint->handler;
+    return handler ? handler : default_handler;
   }
   switch (pn_class_id(pn_event_class(event))) {
   case CID_pn_task:
@@ -346,7 +556,8 @@ pn_task_t *pn_reactor_schedule(pn_reactor_t *reactor, int delay, pn_handler_t *h
   pn_task_t *task = pn_timer_schedule(reactor->timer, reactor->now + delay);
   pn_record_t *record = pn_task_attachments(task);
   pni_record_init_reactor(record, reactor);
-  pn_record_set_handler(record, handler);
+  // a task's handler is only its own, so endpoints' stay cached
+  pni_record_put_handler(record, handler);
   if (reactor->selectable) {
     pn_selectable_set_deadline(reactor->selectable, pn_timer_deadline(reactor->timer));
     pn_reactor_update(reactor, reactor->selectable);
@@ -363,7 +574,13 @@ void pni_event_print(pn_event_t *event) {
 
 bool pni_reactor_more(pn_reactor_t *reactor) {
   assert(reactor);
-  return pn_timer_tasks(reactor->timer) || reactor->selectables > 1;
+  return reactor->persistent || pn_timer_tasks(reactor->timer) || reactor->resolving ||
+    reactor->selectables > 1;
+}
+
+void pni_reactor_set_persistent(pn_reactor_t *reactor, bool persistent) {
+  assert(reactor);
+  reactor->persistent = persistent;
 }
 
 void pn_reactor_yield(pn_reactor_t *reactor) {
@@ -382,28 +599,125 @@ bool pn_reactor_quiesced(pn_reactor_t *reactor) {
   return pn_event_type(event) == PN_REACTOR_QUIESCED;
 }
 
-bool pn_reactor_process(pn_reactor_t *reactor) {
-  assert(reactor);
+static void pni_reactor_drain_posted(pn_reactor_t *reactor) {
+  // clear the signal first, so that a post racing with the drain
+  // either lands in this batch or wakes us again
+  if (!pni_wakeup_clear(&reactor->wakeup)) return;
+  pni_post_t *post = (pni_post_t *) pni_atomic_exchange(&reactor->posted, NULL);
+  pni_post_t *fifo = NULL;
+  while (post) {
+    pni_post_t *next = post->next;
+    post->next = fifo;
+    fifo = post;
+    post = next;
+  }
+  while (fifo) {
+    pni_post_t *next = fifo->next;
+    pn_reactor_schedule(reactor, 0, fifo->handler);
+    // the task now holds its own reference
+    pn_decref(fifo->handler);
+    pni_free(PN_ALLOC_REACTOR, fifo);
+    fifo = next;
+  }
+}
+
+void pni_collector_defer(pn_collector_t *collector, bool all);
+bool pni_collector_resume(pn_collector_t *collector);
+void pni_handle_poll(pn_reactor_t *reactor);
+
+// holds an event back once its connection has had its share of the
+// round, along with every later one of the connection so that they
+// stay in order
+static bool pni_reactor_defer(pn_reactor_t *reactor, pn_event_t *event) {
+  pn_connection_t *connection = pn_event_connection(event);
+  if (!connection) return false;
+  if (connection->dispatch_round != reactor->round) {
+    connection->dispatch_round = reactor->round;
+    connection->dispatched = 0;
+  }
+  if (connection->dispatched >= reactor->connection_budget) {
+    pni_collector_defer(reactor->collector, false);
+    reactor->deferred = true;
+    return true;
+  }
+  connection->dispatched++;
+  return false;
+}
+
+// the held back events go first in the next round
+static void pni_reactor_resume(pn_reactor_t *reactor) {
+  if (reactor->deferred) {
+    reactor->deferred = false;
+    pni_collector_resume(reactor->collector);
+  }
+  reactor->round++;
+}
+
+// stopping short of quiescing, output goes out and whatever input and
+// timers are ready elsewhere come in
+static void pni_reactor_interleave(pn_reactor_t *reactor) {
+  if (pn_list_size(reactor->unflushed)) {
+    pni_reactor_flush(reactor);
+  }
+  pni_handle_poll(reactor);
+  pni_reactor_resume(reactor);
+}
+
+static bool pni_reactor_spent(pn_reactor_t *reactor, int dispatched, pn_timestamp_t start) {
+  if (reactor->event_budget && dispatched >= reactor->event_budget) return true;
+  return reactor->time_budget && pni_reactor_clock(reactor) - start >= reactor->time_budget;
+}
+
+static bool pni_reactor_process(pn_reactor_t *reactor) {
   pn_reactor_mark(reactor);
+  pni_reactor_drain_posted(reactor);
   pn_event_type_t previous = PN_EVENT_NONE;
+  int dispatched = 0;
+  pn_timestamp_t start = reactor->time_budget ? pni_reactor_clock(reactor) : 0;
+  reactor->round++;
   while (true) {
     pn_event_t *event = pn_collector_peek(reactor->collector);
     //pni_event_print(event);
     if (event) {
       if (reactor->yield) {
         reactor->yield = false;
+        pni_reactor_resume(reactor);
         return true;
       }
       reactor->yield = false;
+      if (dispatched && pni_reactor_spent(reactor, dispatched, start)) {
+        // the collector takes its head as being handled, so nothing is
+        // left there for the input coming in to miss being coalesced with
+        pni_collector_defer(reactor->collector, true);
+        reactor->deferred = true;
+        pni_reactor_interleave(reactor);
+        return true;
+      }
+      if (reactor->connection_budget && pni_reactor_defer(reactor, event)) {
+        continue;
+      }
+      dispatched++;
       pn_incref(event);
       pn_handler_t *handler = pn_event_handler(event, reactor->handler);
       pn_event_type_t type = pn_event_type(event);
+      PNI_PROBE4(dispatch_start, reactor, event, type, pn_event_connection(event));
       pn_handler_dispatch(handler, event, type);
       pn_handler_dispatch(reactor->global, event, type);
+      PNI_PROBE3(dispatch_done, reactor, event, type);
       pni_reactor_dispatch_post(reactor, event);
       previous = reactor->previous = type;
       pn_decref(event);
       pn_collector_pop(reactor->collector);
+      if (reactor->flush_latency && pn_list_size(reactor->unflushed) &&
+          pni_reactor_clock(reactor) - reactor->unflushed_since >= reactor->flush_latency) {
+        pni_reactor_flush(reactor);
+      }
+    } else if (reactor->deferred) {
+      // the end of a round that held some connections back
+      pni_reactor_interleave(reactor);
+    } else if (pn_list_size(reactor->unflushed)) {
+      // the end of the cycle: send what its events produced
+      pni_reactor_flush(reactor);
     } else {
       if (pni_reactor_more(reactor)) {
         if (previous != PN_REACTOR_QUIESCED && reactor->previous != PN_REACTOR_FINAL) {
@@ -424,6 +738,14 @@ bool pn_reactor_process(pn_reactor_t *reactor) {
   }
 }
 
+bool pn_reactor_process(pn_reactor_t *reactor) {
+  assert(reactor);
+  PNI_PROBE1(reactor_process_start, reactor);
+  bool more = pni_reactor_process(reactor);
+  PNI_PROBE2(reactor_process_done, reactor, more);
+  return more;
+}
+
 static void pni_timer_expired(pn_selectable_t *sel) {
   pn_reactor_t *reactor = pni_reactor(sel);
   pn_timer_tick(reactor->timer, reactor->now);
@@ -432,24 +754,18 @@ static void pni_timer_expired(pn_selectable_t *sel) {
 }
 
 static void pni_timer_readable(pn_selectable_t *sel) {
-  char buf[64];
   pn_reactor_t *reactor = pni_reactor(sel);
-  pn_socket_t fd = pn_selectable_get_fd(sel);
-  pn_read(reactor->io, fd, buf, 64);
+  pni_wakeup_read(reactor->io, &reactor->wakeup);
+  pni_reactor_drain_posted(reactor);
   pni_timer_expired(sel);
 }
 
-static void pni_timer_finalize(pn_selectable_t *sel) {
-  pn_reactor_t *reactor = pni_reactor(sel);
-  pn_close(reactor->io, pn_selectable_get_fd(sel));
-}
-
 pn_selectable_t *pni_timer_selectable(pn_reactor_t *reactor) {
   pn_selectable_t *sel = pn_reactor_selectable(reactor);
-  pn_selectable_set_fd(sel, reactor->wakeup[0]);
+  // the wakeup's fd belongs to the reactor, so the selectable leaves it open
+  pn_selectable_set_fd(sel, pni_wakeup_fd(&reactor->wakeup));
   pn_selectable_on_readable(sel, pni_timer_readable);
   pn_selectable_on_expired(sel, pni_timer_expired);
-  pn_selectable_on_finalize(sel, pni_timer_finalize);
   pn_selectable_set_reading(sel, true);
   pn_selectable_set_deadline(sel, pn_timer_deadline(reactor->timer));
   pn_reactor_update(reactor, sel);
@@ -458,12 +774,36 @@ pn_selectable_t *pni_timer_selectable(pn_reactor_t *reactor) {
 
 int pn_reactor_wakeup(pn_reactor_t *reactor) {
   assert(reactor);
-  ssize_t n = pn_write(reactor->io, reactor->wakeup[1], "x", 1);
-  if (n < 0) {
-    return (int) n;
-  } else {
-    return 0;
+  return pni_wakeup_signal(reactor->io, &reactor->wakeup);
+}
+
+int pni_reactor_resolve(pn_reactor_t *reactor, const char *host, pni_resolved_t done, void *context) {
+  assert(reactor);
+  if (!reactor->resolver) {
+    reactor->resolver = pni_resolver();
+    if (!reactor->resolver) return PN_ERR;
   }
+  int err = pni_resolver_lookup(reactor->resolver, host, done, context);
+  if (!err) reactor->resolving++;
+  return err;
+}
+
+void pni_reactor_resolved(pn_reactor_t *reactor) {
+  assert(reactor);
+  assert(reactor->resolving > 0);
+  reactor->resolving--;
+}
+
+int pn_reactor_post(pn_reactor_t *reactor, pn_handler_t *handler) {
+  assert(reactor);
+  assert(handler);
+  pni_post_t *post = (pni_post_t *) pni_malloc(PN_ALLOC_REACTOR, sizeof(pni_post_t));
+  if (!post) return PN_ERR;
+  post->handler = handler;
+  do {
+    post->next = (pni_post_t *) pni_atomic_load(&reactor->posted);
+  } while (!pni_atomic_cas(&reactor->posted, post->next, post));
+  return pn_reactor_wakeup(reactor);
 }
 
 void pn_reactor_start(pn_reactor_t *reactor) {
@@ -23,8 +23,28 @@
  */
 
 #include <proton/reactor.h>
+#include "resolver.h"
+
+// the most connections an acceptor takes from its queue per readable
+#define PNI_ACCEPT_BATCH (64)
 
 void pni_record_init_reactor(pn_record_t *record, pn_reactor_t *reactor);
+void pni_reactor_set_persistent(pn_reactor_t *reactor, bool persistent);
+void pni_acceptor_setup(pn_reactor_t *reactor, pn_socket_t sock, pn_handler_t *handler,
+                        pn_sasl_verifier_t *verifier, pn_socket_options_t *options);
+pn_acceptor_t *pni_acceptor(pn_reactor_t *reactor, pn_socket_t socket, pn_handler_t *handler);
+void pni_reactor_setup_transport(pn_reactor_t *reactor, pn_transport_t *transport);
+void pni_reactor_update_transport(pn_reactor_t *reactor, pn_transport_t *transport);
+void pni_reactor_defer_write(pn_reactor_t *reactor, pn_selectable_t *sel);
+void pni_connection_flush(pn_selectable_t *sel);
+// turn zerocopy sends on for a connection's socket if the options, or
+// the io's without them, ask for it
+void pni_connection_zerocopy(pn_selectable_t *sel, pn_socket_options_t *options);
+
+// Look host up on the reactor's resolver thread, done is called there.
+// The reactor keeps running until the lookup is marked resolved.
+int pni_reactor_resolve(pn_reactor_t *reactor, const char *host, pni_resolved_t done, void *context);
+void pni_reactor_resolved(pn_reactor_t *reactor);
 
 
 #endif /* src/reactor.h */
@@ -22,17 +22,42 @@
 #include <proton/object.h>
 #include <proton/reactor.h>
 #include <assert.h>
+#include <string.h>
+
+// The timer is a hierarchical timing wheel: level k has 256 slots of
+// 256^k milliseconds each, so a task is scheduled or cancelled in
+// constant time, and tasks move down a level only when the wheel
+// reaches their slot. Tasks further out than the wheel reaches wait in
+// an overflow slot, and tasks at or before the current time in an
+// overdue one.
+#define PNI_WHEEL_BITS (8)
+#define PNI_WHEEL_SLOTS (1 << PNI_WHEEL_BITS)
+#define PNI_WHEEL_MASK (PNI_WHEEL_SLOTS - 1)
+#define PNI_WHEEL_LEVELS (4)
+
+typedef struct {
+  pn_task_t *head;
+  pn_task_t *tail;
+} pni_slot_t;
 
 struct pn_task_t {
   pn_list_t *pool;
   pn_record_t *attachments;
   pn_timestamp_t deadline;
+  pn_timer_t *timer; // set while scheduled
+  pni_slot_t *slot;
+  pn_task_t *prev;
+  pn_task_t *next;
 };
 
 void pn_task_initialize(pn_task_t *task) {
   task->pool = NULL;
   task->attachments = pn_record();
   task->deadline = 0;
+  task->timer = NULL;
+  task->slot = NULL;
+  task->prev = NULL;
+  task->next = NULL;
 }
 
 void pn_task_finalize(pn_task_t *task) {
@@ -49,10 +74,7 @@ void pn_task_finalize(pn_task_t *task) {
   }
 }
 
-intptr_t pn_task_compare(pn_task_t *a, pn_task_t *b) {
-  return a->deadline - b->deadline;
-}
-
+#define pn_task_compare NULL
 #define pn_task_inspect NULL
 #define pn_task_hashcode NULL
 
@@ -68,24 +90,81 @@ pn_record_t *pn_task_attachments(pn_task_t *task) {
   return task->attachments;
 }
 
+static void pni_slot_push(pni_slot_t *slot, pn_task_t *task) {
+  task->slot = slot;
+  task->next = NULL;
+  task->prev = slot->tail;
+  if (slot->tail) {
+    slot->tail->next = task;
+  } else {
+    slot->head = task;
+  }
+  slot->tail = task;
+}
+
+static void pni_slot_remove(pn_task_t *task) {
+  pni_slot_t *slot = task->slot;
+  if (task->prev) {
+    task->prev->next = task->next;
+  } else {
+    slot->head = task->next;
+  }
+  if (task->next) {
+    task->next->prev = task->prev;
+  } else {
+    slot->tail = task->prev;
+  }
+  task->slot = NULL;
+  task->prev = NULL;
+  task->next = NULL;
+}
+
 //
 // timer
 //
 
 struct pn_timer_t {
   pn_list_t *pool;
-  pn_list_t *tasks;
   pn_collector_t *collector;
+  pni_slot_t wheel[PNI_WHEEL_LEVELS][PNI_WHEEL_SLOTS];
+  pni_slot_t overdue;
+  pni_slot_t overflow;
+  pn_timestamp_t current; // every task in the wheel is due after this
+  pn_timestamp_t earliest;
+  bool stale;             // earliest must be found again
+  int count;
 };
 
 static void pn_timer_initialize(pn_timer_t *timer) {
   timer->pool = pn_list(PN_OBJECT, 0);
-  timer->tasks = pn_list(PN_OBJECT, 0);
+  timer->collector = NULL;
+  memset(timer->wheel, 0, sizeof(timer->wheel));
+  timer->overdue.head = timer->overdue.tail = NULL;
+  timer->overflow.head = timer->overflow.tail = NULL;
+  timer->current = 0;
+  timer->earliest = 0;
+  timer->stale = false;
+  timer->count = 0;
+}
+
+static void pni_slot_release(pni_slot_t *slot) {
+  while (slot->head) {
+    pn_task_t *task = slot->head;
+    pni_slot_remove(task);
+    task->timer = NULL;
+    pn_decref(task);
+  }
 }
 
 static void pn_timer_finalize(pn_timer_t *timer) {
   pn_decref(timer->pool);
-  pn_free(timer->tasks);
+  for (int level = 0; level < PNI_WHEEL_LEVELS; level++) {
+    for (int i = 0; i < PNI_WHEEL_SLOTS; i++) {
+      pni_slot_release(&timer->wheel[level][i]);
+    }
+  }
+  pni_slot_release(&timer->overdue);
+  pni_slot_release(&timer->overflow);
 }
 
 #define pn_timer_inspect NULL
@@ -100,6 +179,88 @@ pn_timer_t *pn_timer(pn_collector_t *collector) {
   return timer;
 }
 
+static inline int pni_wheel_index(pn_timestamp_t time, int level) {
+  return (int) ((uint64_t) time >> (level*PNI_WHEEL_BITS)) & PNI_WHEEL_MASK;
+}
+
+// puts a task in the slot for its deadline relative to the current time
+static void pni_timer_place(pn_timer_t *timer, pn_task_t *task) {
+  if (task->deadline <= timer->current) {
+    pni_slot_push(&timer->overdue, task);
+    return;
+  }
+  uint64_t delta = (uint64_t) (task->deadline - timer->current);
+  for (int level = 0; level < PNI_WHEEL_LEVELS; level++) {
+    if (delta < ((uint64_t) 1 << ((level + 1)*PNI_WHEEL_BITS))) {
+      pni_slot_push(&timer->wheel[level][pni_wheel_index(task->deadline, level)], task);
+      return;
+    }
+  }
+  pni_slot_push(&timer->overflow, task);
+}
+
+static void pni_timer_replace(pn_timer_t *timer, pni_slot_t *slot) {
+  pn_task_t *task = slot->head;
+  slot->head = slot->tail = NULL;
+  while (task) {
+    pn_task_t *next = task->next;
+    pni_timer_place(timer, task);
+    task = next;
+  }
+}
+
+// moves the current time on to now, when nothing is due before it,
+// bringing down the tasks of each slot whose span has been reached
+static void pni_timer_advance(pn_timer_t *timer, pn_timestamp_t now) {
+  pn_timestamp_t previous = timer->current;
+  if (now <= previous) return;
+  timer->current = now;
+  for (int level = PNI_WHEEL_LEVELS - 1; level > 0; level--) {
+    int shift = level*PNI_WHEEL_BITS;
+    uint64_t from = (uint64_t) previous >> shift;
+    uint64_t to = (uint64_t) now >> shift;
+    if (from == to) continue;
+    if (level == PNI_WHEEL_LEVELS - 1) {
+      pni_timer_replace(timer, &timer->overflow);
+    }
+    uint64_t crossed = to - from < PNI_WHEEL_SLOTS ? to - from : PNI_WHEEL_SLOTS;
+    for (uint64_t i = 1; i <= crossed; i++) {
+      pni_timer_replace(timer, &timer->wheel[level][(from + i) & PNI_WHEEL_MASK]);
+    }
+  }
+}
+
+static pn_timestamp_t pni_slot_earliest(pni_slot_t *slot, pn_timestamp_t earliest, bool *found) {
+  for (pn_task_t *task = slot->head; task; task = task->next) {
+    if (!*found || task->deadline < earliest) {
+      earliest = task->deadline;
+      *found = true;
+    }
+  }
+  return earliest;
+}
+
+// the first deadline: the first full level 0 slot from the current
+// time is exact, and each higher level can only be earlier by way of
+// its first full slot
+static pn_timestamp_t pni_timer_earliest(pn_timer_t *timer) {
+  pn_timestamp_t earliest = 0;
+  bool found = false;
+  earliest = pni_slot_earliest(&timer->overdue, earliest, &found);
+  for (int level = 0; level < PNI_WHEEL_LEVELS; level++) {
+    int start = pni_wheel_index(timer->current, level) + (level ? 1 : 0);
+    for (int i = 0; i < PNI_WHEEL_SLOTS; i++) {
+      pni_slot_t *slot = &timer->wheel[level][(start + i) & PNI_WHEEL_MASK];
+      if (slot->head) {
+        earliest = pni_slot_earliest(slot, earliest, &found);
+        break;
+      }
+    }
+  }
+  earliest = pni_slot_earliest(&timer->overflow, earliest, &found);
+  return earliest;
+}
+
 pn_task_t *pn_timer_schedule(pn_timer_t *timer,  pn_timestamp_t deadline) {
   pn_task_t *task = (pn_task_t *) pn_list_pop(timer->pool);
   if (!task) {
@@ -108,37 +269,72 @@ pn_task_t *pn_timer_schedule(pn_timer_t *timer,  pn_timestamp_t deadline) {
   task->pool = timer->pool;
   pn_incref(task->pool);
   task->deadline = deadline;
-  pn_list_minpush(timer->tasks, task);
-  pn_decref(task);
+  task->timer = timer;
+  // the timer keeps the reference, as the list of tasks used to
+  pni_timer_place(timer, task);
+  if (!timer->stale && (!timer->count || deadline < timer->earliest)) {
+    timer->earliest = deadline;
+  }
+  timer->count++;
   return task;
 }
 
+void pn_task_cancel(pn_task_t *task) {
+  assert(task);
+  pn_timer_t *timer = task->timer;
+  if (!timer) return;
+  pni_slot_remove(task);
+  task->timer = NULL;
+  timer->count--;
+  if (task->deadline == timer->earliest) {
+    timer->stale = true;
+  }
+  pn_decref(task);
+}
+
 pn_timestamp_t pn_timer_deadline(pn_timer_t *timer) {
   assert(timer);
-  if (pn_list_size(timer->tasks)) {
-    pn_task_t *task = (pn_task_t *) pn_list_get(timer->tasks, 0);
-    return task->deadline;
-  } else {
+  if (!timer->count) {
     return 0;
   }
+  if (timer->stale) {
+    timer->earliest = pni_timer_earliest(timer);
+    timer->stale = false;
+  }
+  return timer->earliest;
+}
+
+static void pni_timer_fire(pn_timer_t *timer, pni_slot_t *slot, pn_timestamp_t now) {
+  pn_task_t *task = slot->head;
+  while (task) {
+    pn_task_t *next = task->next;
+    if (task->deadline <= now) {
+      pni_slot_remove(task);
+      task->timer = NULL;
+      timer->count--;
+      timer->stale = true;
+      pn_collector_put(timer->collector, PN_OBJECT, task, PN_TIMER_TASK);
+      pn_decref(task);
+    }
+    task = next;
+  }
 }
 
 void pn_timer_tick(pn_timer_t *timer, pn_timestamp_t now) {
   assert(timer);
-  while (pn_list_size(timer->tasks)) {
-    pn_task_t *task = (pn_task_t *) pn_list_get(timer->tasks, 0);
-    if (now >= task->deadline) {
-      pn_task_t *min = (pn_task_t *) pn_list_minpop(timer->tasks);
-      assert(min == task);
-      pn_collector_put(timer->collector, PN_OBJECT, min, PN_TIMER_TASK);
-      pn_decref(min);
-    } else {
+  while (timer->count) {
+    pn_timestamp_t deadline = pn_timer_deadline(timer);
+    if (deadline > now) {
       break;
     }
+    pni_timer_advance(timer, deadline);
+    pni_timer_fire(timer, &timer->overdue, now);
+    pni_timer_fire(timer, &timer->wheel[0][pni_wheel_index(timer->current, 0)], now);
   }
+  pni_timer_advance(timer, now);
 }
 
 int pn_timer_tasks(pn_timer_t *timer) {
   assert(timer);
-  return pn_list_size(timer->tasks);
+  return timer->count;
 }
@@ -0,0 +1,249 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/object.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "resolver.h"
+#include "thread.h"
+#include "util.h"
+#include "alloc_private.h"
+
+// hosts a cache remembers at most
+#define PNI_ADDR_CACHE_MAX (256)
+
+typedef struct {
+  char *host;
+  char numeric[PNI_NUMERIC_HOST_MAX];
+  pn_timestamp_t expires;
+} pni_addr_entry_t;
+
+struct pni_addr_cache_t {
+  pni_addr_entry_t *entries;
+  size_t size;
+  pn_millis_t ttl;
+};
+
+pni_addr_cache_t *pni_addr_cache(void)
+{
+  pni_addr_cache_t *cache = (pni_addr_cache_t *) pni_calloc(PN_ALLOC_IO, 1, sizeof(pni_addr_cache_t));
+  return cache;
+}
+
+void pni_addr_cache_free(pni_addr_cache_t *cache)
+{
+  if (!cache) return;
+  for (size_t i = 0; i < cache->size; i++) {
+    pni_free(PN_ALLOC_IO, cache->entries[i].host);
+  }
+  pni_free(PN_ALLOC_IO, cache->entries);
+  pni_free(PN_ALLOC_IO, cache);
+}
+
+void pni_addr_cache_set_ttl(pni_addr_cache_t *cache, pn_millis_t ttl)
+{
+  assert(cache);
+  cache->ttl = ttl;
+  if (!ttl) {
+    for (size_t i = 0; i < cache->size; i++) {
+      pni_free(PN_ALLOC_IO, cache->entries[i].host);
+    }
+    cache->size = 0;
+  }
+}
+
+pn_millis_t pni_addr_cache_get_ttl(pni_addr_cache_t *cache)
+{
+  assert(cache);
+  return cache->ttl;
+}
+
+static pni_addr_entry_t *pni_addr_cache_find(pni_addr_cache_t *cache, const char *host)
+{
+  for (size_t i = 0; i < cache->size; i++) {
+    if (!strcmp(cache->entries[i].host, host)) return &cache->entries[i];
+  }
+  return NULL;
+}
+
+bool pni_addr_cache_get(pni_addr_cache_t *cache, const char *host, pn_timestamp_t now,
+                        char *numeric, size_t size)
+{
+  assert(cache);
+  if (!cache->ttl) return false;
+  pni_addr_entry_t *entry = pni_addr_cache_find(cache, host);
+  if (!entry || entry->expires <= now) return false;
+  snprintf(numeric, size, "%s", entry->numeric);
+  return true;
+}
+
+void pni_addr_cache_put(pni_addr_cache_t *cache, const char *host, const char *numeric,
+                        pn_timestamp_t now)
+{
+  assert(cache);
+  if (!cache->ttl || strlen(numeric) >= PNI_NUMERIC_HOST_MAX) return;
+  pni_addr_entry_t *entry = pni_addr_cache_find(cache, host);
+  if (!entry) {
+    if (!cache->entries) {
+      cache->entries = (pni_addr_entry_t *) pni_malloc(PN_ALLOC_IO, PNI_ADDR_CACHE_MAX * sizeof(pni_addr_entry_t));
+      if (!cache->entries) return;
+    }
+    if (cache->size < PNI_ADDR_CACHE_MAX) {
+      char *copy = pn_strdup(host);
+      if (!copy) return;
+      entry = &cache->entries[cache->size++];
+      entry->host = copy;
+    } else {
+      // full, replace the entry closest to expiry
+      entry = &cache->entries[0];
+      for (size_t i = 1; i < cache->size; i++) {
+        if (cache->entries[i].expires < entry->expires) entry = &cache->entries[i];
+      }
+      char *copy = pn_strdup(host);
+      if (!copy) return;
+      pni_free(PN_ALLOC_IO, entry->host);
+      entry->host = copy;
+    }
+  }
+  strcpy(entry->numeric, numeric);
+  entry->expires = now + cache->ttl;
+}
+
+typedef struct pni_lookup_t {
+  struct pni_lookup_t *next;
+  pni_resolved_t done;
+  void *context;
+  char host[1];
+} pni_lookup_t;
+
+struct pni_resolver_t {
+  pni_thread_t *thread;
+  pni_mutex_t *mutex;
+  pni_semaphore_t *semaphore;
+  pni_lookup_t *head;
+  pni_lookup_t *tail;
+  bool stopping;
+};
+
+static pni_lookup_t *pni_resolver_take(pni_resolver_t *resolver, bool *stopping)
+{
+  pni_mutex_lock(resolver->mutex);
+  pni_lookup_t *lookup = resolver->head;
+  if (lookup) {
+    resolver->head = lookup->next;
+    if (!resolver->head) resolver->tail = NULL;
+  }
+  *stopping = resolver->stopping;
+  pni_mutex_unlock(resolver->mutex);
+  return lookup;
+}
+
+static void pni_resolver_run(void *context)
+{
+  pni_resolver_t *resolver = (pni_resolver_t *) context;
+  while (true) {
+    pni_semaphore_wait(resolver->semaphore);
+    bool stopping;
+    pni_lookup_t *lookup = pni_resolver_take(resolver, &stopping);
+    if (stopping) {
+      // whatever is still queued is failed by pni_resolver_free()
+      if (lookup) {
+        lookup->done(lookup->context, NULL, "resolver stopped");
+        pni_free(PN_ALLOC_IO, lookup);
+      }
+      return;
+    }
+    if (!lookup) continue;
+    char numeric[PNI_NUMERIC_HOST_MAX];
+    char error[256];
+    if (pni_resolve_host(lookup->host, numeric, sizeof(numeric), error, sizeof(error))) {
+      lookup->done(lookup->context, NULL, error);
+    } else {
+      lookup->done(lookup->context, numeric, NULL);
+    }
+    pni_free(PN_ALLOC_IO, lookup);
+  }
+}
+
+pni_resolver_t *pni_resolver(void)
+{
+  pni_resolver_t *resolver = (pni_resolver_t *) pni_calloc(PN_ALLOC_IO, 1, sizeof(pni_resolver_t));
+  if (!resolver) return NULL;
+  resolver->mutex = pni_mutex();
+  resolver->semaphore = pni_semaphore();
+  if (resolver->mutex && resolver->semaphore) {
+    resolver->thread = pni_thread(pni_resolver_run, resolver);
+  }
+  if (!resolver->thread) {
+    if (resolver->mutex) pni_mutex_free(resolver->mutex);
+    if (resolver->semaphore) pni_semaphore_free(resolver->semaphore);
+    pni_free(PN_ALLOC_IO, resolver);
+    return NULL;
+  }
+  return resolver;
+}
+
+void pni_resolver_free(pni_resolver_t *resolver)
+{
+  if (!resolver) return;
+  pni_mutex_lock(resolver->mutex);
+  resolver->stopping = true;
+  pni_mutex_unlock(resolver->mutex);
+  pni_semaphore_post(resolver->semaphore);
+  pni_thread_join(resolver->thread);
+
+  pni_lookup_t *lookup = resolver->head;
+  while (lookup) {
+    pni_lookup_t *next = lookup->next;
+    lookup->done(lookup->context, NULL, "resolver stopped");
+    pni_free(PN_ALLOC_IO, lookup);
+    lookup = next;
+  }
+  pni_semaphore_free(resolver->semaphore);
+  pni_mutex_free(resolver->mutex);
+  pni_free(PN_ALLOC_IO, resolver);
+}
+
+int pni_resolver_lookup(pni_resolver_t *resolver, const char *host, pni_resolved_t done, void *context)
+{
+  assert(resolver);
+  assert(done);
+  size_t len = strlen(host);
+  pni_lookup_t *lookup = (pni_lookup_t *) pni_malloc(PN_ALLOC_IO, sizeof(pni_lookup_t) + len);
+  if (!lookup) return PN_ERR;
+  lookup->next = NULL;
+  lookup->done = done;
+  lookup->context = context;
+  memcpy(lookup->host, host, len + 1);
+
+  pni_mutex_lock(resolver->mutex);
+  if (resolver->tail)
+    resolver->tail->next = lookup;
+  else
+    resolver->head = lookup;
+  resolver->tail = lookup;
+  pni_mutex_unlock(resolver->mutex);
+  pni_semaphore_post(resolver->semaphore);
+  return 0;
+}
@@ -0,0 +1,102 @@
+#ifndef _PROTON_SRC_RESOLVER_H
+#define _PROTON_SRC_RESOLVER_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/io.h>
+#include <proton/types.h>
+
+/*
+ * Host name resolution off the event loop. A lookup can take as long
+ * as the slowest DNS server, so the reactor hands it to a resolver
+ * thread and connects once the address is posted back. Each io keeps
+ * the addresses it resolved for a while, so reconnecting to a host
+ * does not look it up again.
+ */
+
+// room for any numeric IPv4 or IPv6 address
+#define PNI_NUMERIC_HOST_MAX (64)
+
+typedef struct pni_addr_cache_t pni_addr_cache_t;
+
+pni_addr_cache_t *pni_addr_cache(void);
+void pni_addr_cache_free(pni_addr_cache_t *cache);
+
+/** How long a resolved address is used, 0 turns the cache off.
+ *
+ * getaddrinfo() does not expose the record's TTL, so this is chosen by
+ * the application.
+ *
+ * @internal
+ */
+void pni_addr_cache_set_ttl(pni_addr_cache_t *cache, pn_millis_t ttl);
+pn_millis_t pni_addr_cache_get_ttl(pni_addr_cache_t *cache);
+
+/** Copy the cached numeric address of host into numeric.
+ *
+ * @return true if an unexpired address was found
+ * @internal
+ */
+bool pni_addr_cache_get(pni_addr_cache_t *cache, const char *host, pn_timestamp_t now,
+                        char *numeric, size_t size);
+void pni_addr_cache_put(pni_addr_cache_t *cache, const char *host, const char *numeric,
+                        pn_timestamp_t now);
+
+/* Provided by the platform's io. */
+pni_addr_cache_t *pni_io_addr_cache(pn_io_t *io);
+bool pni_numeric_host(const char *host);
+
+/** Resolve host to a numeric address, blocking.
+ *
+ * @return 0 on success, or an error code with a description in error
+ * @internal
+ */
+int pni_resolve_host(const char *host, char *numeric, size_t size, char *error, size_t esize);
+
+/*
+ * A thread resolving host names one after the other.
+ */
+
+typedef struct pni_resolver_t pni_resolver_t;
+
+/** Called on the resolver thread with the numeric address, or with
+ * NULL and a description of the failure.
+ */
+typedef void (*pni_resolved_t)(void *context, const char *numeric, const char *error);
+
+pni_resolver_t *pni_resolver(void);
+
+/** Stop the resolver. A lookup in progress is waited for, those still
+ * queued complete with an error.
+ *
+ * @internal
+ */
+void pni_resolver_free(pni_resolver_t *resolver);
+
+/** Queue a lookup of host.
+ *
+ * @return 0 if done will be called, an error code otherwise
+ * @internal
+ */
+int pni_resolver_lookup(pni_resolver_t *resolver, const char *host, pni_resolved_t done, void *context);
+
+#endif /* resolver.h */
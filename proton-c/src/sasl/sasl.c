@@ -33,7 +33,10 @@
 #include "engine/engine-internal.h"
 #include "dispatcher/dispatcher.h"
 #include "util.h"
+#include "platform.h"
+#include "thread.h"
 #include "transport/autodetect.h"
+#include "alloc_private.h"
 
 
 struct pni_sasl_t {
@@ -51,8 +54,35 @@ struct pni_sasl_t {
   bool halt;
   bool input_bypass;
   bool output_bypass;
+  pn_sasl_verifier_t *verifier;
+  int verify_state;
+  pn_sasl_outcome_t verified;
+  bool verify_waker;
 };
 
+// a response that passed verification, kept as a keyed digest of the
+// mechanism and response until expiry
+typedef struct {
+  unsigned char digest[PNI_SHA256_SIZE];
+  pn_timestamp_t expiry;
+} pni_sasl_credential_t;
+
+struct pn_sasl_verifier_t {
+  char *mechanisms;
+  pn_sasl_verify_t verify;
+  void *context;
+  // guards the cache and the verify state of the transports using us
+  pni_mutex_t *lock;
+  pni_sasl_credential_t *cache;   // most recently used first
+  size_t cache_count;
+  size_t cache_size;
+  pn_millis_t cache_ttl;
+  unsigned char cache_key[PNI_SHA256_SIZE];   // random, set with the first cache size
+  bool cache_keyed;
+};
+
+enum { VERIFY_IDLE, VERIFY_RUNNING, VERIFY_DONE, VERIFY_SETTLED };
+
 static inline pn_transport_t *get_transport_internal(pn_sasl_t *sasl)
 {
     // The external pn_sasl_t is really a pointer to the internal pni_transport_t
@@ -109,7 +139,7 @@ static void pni_emit(pn_sasl_t *sasl) {
 pn_sasl_t *pn_sasl(pn_transport_t *transport)
 {
   if (!transport->sasl) {
-    pni_sasl_t *sasl = (pni_sasl_t *) malloc(sizeof(pni_sasl_t));
+    pni_sasl_t *sasl = (pni_sasl_t *) pni_malloc(PN_ALLOC_TRANSPORT, sizeof(pni_sasl_t));
 
     sasl->client = !transport->server;
     sasl->mechanisms = NULL;
@@ -125,6 +155,10 @@ pn_sasl_t *pn_sasl(pn_transport_t *transport)
     sasl->input_bypass = false;
     sasl->output_bypass = false;
     sasl->halt = false;
+    sasl->verifier = NULL;
+    sasl->verify_state = VERIFY_IDLE;
+    sasl->verified = PN_SASL_NONE;
+    sasl->verify_waker = false;
 
     transport->sasl = sasl;
   }
@@ -154,6 +188,7 @@ void pn_sasl_mechanisms(pn_sasl_t *sasl0, const char *mechanisms)
 {
   pni_sasl_t *sasl = get_sasl_internal(sasl0);
   if (!sasl) return;
+  pni_free(PN_ALLOC_TRANSPORT, sasl->mechanisms);
   sasl->mechanisms = pn_strdup(mechanisms);
   pni_emit(sasl0);
 }
@@ -241,7 +276,7 @@ void pn_sasl_plain(pn_sasl_t *sasl0, const char *username, const char *password)
   size_t usize = strlen(user);
   size_t psize = strlen(pass);
   size_t size = usize + psize + 2;
-  char *iresp = (char *) malloc(size);
+  char *iresp = (char *) pni_malloc(PN_ALLOC_TRANSPORT, size);
 
   iresp[0] = 0;
   memmove(iresp + 1, user, usize);
@@ -250,7 +285,7 @@ void pn_sasl_plain(pn_sasl_t *sasl0, const char *username, const char *password)
 
   pn_sasl_mechanisms(sasl0, "PLAIN");
   pn_sasl_send(sasl0, iresp, size);
-  free(iresp);
+  pni_free(PN_ALLOC_TRANSPORT, iresp);
 }
 
 void pn_sasl_done(pn_sasl_t *sasl0, pn_sasl_outcome_t outcome)
@@ -280,13 +315,262 @@ void pn_sasl_free(pn_transport_t *transport)
   if (transport) {
     pni_sasl_t *sasl = transport->sasl;
     if (sasl) {
-      free(sasl->mechanisms);
-      free(sasl->remote_mechanisms);
+      pni_free(PN_ALLOC_TRANSPORT, sasl->mechanisms);
+      pni_free(PN_ALLOC_TRANSPORT, sasl->remote_mechanisms);
       pn_buffer_free(sasl->send_data);
       pn_buffer_free(sasl->recv_data);
-      free(sasl);
+      pn_decref(sasl->verifier);
+      pni_free(PN_ALLOC_TRANSPORT, sasl);
+    }
+  }
+}
+
+static void pn_sasl_verifier_initialize(void *object)
+{
+  pn_sasl_verifier_t *verifier = (pn_sasl_verifier_t *) object;
+  verifier->mechanisms = NULL;
+  verifier->verify = NULL;
+  verifier->context = NULL;
+  verifier->lock = pni_mutex();
+  verifier->cache = NULL;
+  verifier->cache_count = 0;
+  verifier->cache_size = 0;
+  verifier->cache_ttl = 0;
+  verifier->cache_keyed = false;
+}
+
+static void pni_sasl_credential_free(pni_sasl_credential_t *credential)
+{
+  pni_cleanse(credential, sizeof(*credential));
+}
+
+static void pn_sasl_verifier_finalize(void *object)
+{
+  pn_sasl_verifier_t *verifier = (pn_sasl_verifier_t *) object;
+  for (size_t i = 0; i < verifier->cache_count; i++) {
+    pni_sasl_credential_free(&verifier->cache[i]);
+  }
+  pni_free(PN_ALLOC_TRANSPORT, verifier->cache);
+  pni_cleanse(verifier->cache_key, sizeof(verifier->cache_key));
+  pni_free(PN_ALLOC_TRANSPORT, verifier->mechanisms);
+  pni_mutex_free(verifier->lock);
+}
+
+#define pn_sasl_verifier_hashcode NULL
+#define pn_sasl_verifier_compare NULL
+#define pn_sasl_verifier_inspect NULL
+
+pn_sasl_verifier_t *pn_sasl_verifier(const char *mechanisms, pn_sasl_verify_t verify, void *context)
+{
+  static const pn_class_t clazz = PN_CLASS(pn_sasl_verifier);
+  pn_sasl_verifier_t *verifier = (pn_sasl_verifier_t *) pn_class_new(&clazz, sizeof(pn_sasl_verifier_t));
+  if (!verifier) return NULL;
+  verifier->mechanisms = pn_strdup(mechanisms);
+  verifier->verify = verify;
+  verifier->context = context;
+  return verifier;
+}
+
+void pn_sasl_verifier_free(pn_sasl_verifier_t *verifier)
+{
+  pn_decref(verifier);
+}
+
+void pn_sasl_verifier_cache(pn_sasl_verifier_t *verifier, size_t size, pn_millis_t ttl)
+{
+  if (!verifier) return;
+  pni_mutex_lock(verifier->lock);
+  if (!ttl) size = 0;
+  if (size && !verifier->cache_keyed) {
+    // without a key nothing is cached
+    verifier->cache_keyed = !pn_i_random(verifier->cache_key, sizeof(verifier->cache_key));
+    if (!verifier->cache_keyed) size = 0;
+  }
+  while (verifier->cache_count > size) {
+    pni_sasl_credential_free(&verifier->cache[--verifier->cache_count]);
+  }
+  if (size > verifier->cache_size) {
+    // not realloc, which would leave the old digests behind
+    pni_sasl_credential_t *cache = (pni_sasl_credential_t *)
+      pni_malloc(PN_ALLOC_TRANSPORT, size * sizeof(pni_sasl_credential_t));
+    if (cache) {
+      if (verifier->cache_count) {
+        memcpy(cache, verifier->cache, verifier->cache_count * sizeof(pni_sasl_credential_t));
+      }
+      if (verifier->cache) {
+        pni_cleanse(verifier->cache, verifier->cache_size * sizeof(pni_sasl_credential_t));
+        pni_free(PN_ALLOC_TRANSPORT, verifier->cache);
+      }
+      verifier->cache = cache;
+    } else {
+      size = verifier->cache_count;
     }
   }
+  verifier->cache_size = size;
+  verifier->cache_ttl = ttl;
+  pni_mutex_unlock(verifier->lock);
+}
+
+// HMAC-SHA256 of the mechanism, its terminating nul and the response
+static void pni_sasl_digest(pn_sasl_verifier_t *verifier, const char *mechanism,
+                            const char *response, size_t size,
+                            unsigned char digest[PNI_SHA256_SIZE])
+{
+  unsigned char pad[64];
+  pni_sha256_t sha;
+  memset(pad, 0x36, sizeof(pad));
+  for (size_t i = 0; i < sizeof(verifier->cache_key); i++) pad[i] ^= verifier->cache_key[i];
+  pni_sha256_init(&sha);
+  pni_sha256_update(&sha, pad, sizeof(pad));
+  pni_sha256_update(&sha, mechanism, strlen(mechanism) + 1);
+  pni_sha256_update(&sha, response, size);
+  pni_sha256_final(&sha, digest);
+  for (size_t i = 0; i < sizeof(pad); i++) pad[i] ^= 0x36 ^ 0x5c;
+  pni_sha256_init(&sha);
+  pni_sha256_update(&sha, pad, sizeof(pad));
+  pni_sha256_update(&sha, digest, PNI_SHA256_SIZE);
+  pni_sha256_final(&sha, digest);
+  pni_cleanse(pad, sizeof(pad));
+}
+
+// true if the digest passed verification recently, called with the lock
+// held
+static bool pni_sasl_cache_lookup(pn_sasl_verifier_t *verifier, const unsigned char *digest)
+{
+  pn_timestamp_t now = pn_i_now();
+  size_t i = 0;
+  while (i < verifier->cache_count) {
+    pni_sasl_credential_t *credential = &verifier->cache[i];
+    if (credential->expiry <= now) {
+      pni_sasl_credential_free(credential);
+      verifier->cache_count--;
+      memmove(credential, credential + 1, (verifier->cache_count - i) * sizeof(pni_sasl_credential_t));
+      pni_sasl_credential_free(&verifier->cache[verifier->cache_count]);
+      continue;
+    }
+    if (pni_equal_secret(credential->digest, digest, PNI_SHA256_SIZE)) {
+      pni_sasl_credential_t hit = *credential;
+      memmove(verifier->cache + 1, verifier->cache, i * sizeof(pni_sasl_credential_t));
+      verifier->cache[0] = hit;
+      pni_cleanse(&hit, sizeof(hit));
+      return true;
+    }
+    i++;
+  }
+  return false;
+}
+
+static void pni_sasl_cache_insert(pn_sasl_verifier_t *verifier, const char *mechanism,
+                                  const char *response, size_t size)
+{
+  if (!verifier->cache_size) return;
+  pni_sasl_credential_t credential;
+  pni_sasl_digest(verifier, mechanism, response, size, credential.digest);
+  if (pni_sasl_cache_lookup(verifier, credential.digest)) {
+    pni_sasl_credential_free(&credential);
+    return;
+  }
+  credential.expiry = pn_i_now() + verifier->cache_ttl;
+  if (verifier->cache_count == verifier->cache_size) {
+    pni_sasl_credential_free(&verifier->cache[--verifier->cache_count]);
+  }
+  memmove(verifier->cache + 1, verifier->cache, verifier->cache_count * sizeof(pni_sasl_credential_t));
+  verifier->cache[0] = credential;
+  verifier->cache_count++;
+  pni_sasl_credential_free(&credential);
+}
+
+void pn_sasl_set_verifier(pn_sasl_t *sasl0, pn_sasl_verifier_t *verifier)
+{
+  pni_sasl_t *sasl = get_sasl_internal(sasl0);
+  if (!sasl || sasl->verify_state != VERIFY_IDLE) return;
+  pn_incref(verifier);
+  pn_decref(sasl->verifier);
+  sasl->verifier = verifier;
+  if (verifier) pn_sasl_mechanisms(sasl0, verifier->mechanisms);
+}
+
+void pn_sasl_verified(pn_transport_t *transport, pn_sasl_outcome_t outcome)
+{
+  pni_sasl_t *sasl = transport->sasl;
+  // once the state is published the transport may be settled and freed
+  // by its own thread, unless the reference went to the waker
+  bool waker = sasl->verify_waker;
+  pni_transport_wake_t wake = transport->wake;
+  void *wake_context = transport->wake_context;
+  pn_sasl_verifier_t *verifier = sasl->verifier;
+  pni_mutex_lock(verifier->lock);
+  assert(sasl->verify_state == VERIFY_RUNNING);
+  sasl->verified = outcome;
+  sasl->verify_state = VERIFY_DONE;
+  pni_mutex_unlock(verifier->lock);
+  if (waker) wake(transport, wake_context);
+}
+
+// Verification runs outside the transport: the initial response is
+// handed to the verifier and the outcome is held back until it reports
+// back, possibly from another thread.
+static void pni_sasl_verify(pn_transport_t *transport)
+{
+  pni_sasl_t *sasl = transport->sasl;
+  pn_sasl_verifier_t *verifier = sasl->verifier;
+  if (sasl->verify_state == VERIFY_SETTLED) return;
+
+  if (sasl->verify_state == VERIFY_IDLE) {
+    // the application may still decide for itself
+    if (sasl->outcome != PN_SASL_NONE) {
+      sasl->verify_state = VERIFY_SETTLED;
+      return;
+    }
+    const char *mechanism = sasl->remote_mechanisms ? sasl->remote_mechanisms : "";
+    pn_buffer_memory_t bytes = pn_buffer_memory(sasl->recv_data);
+    pni_mutex_lock(verifier->lock);
+    bool cached = false;
+    if (verifier->cache_count) {
+      unsigned char digest[PNI_SHA256_SIZE];
+      pni_sasl_digest(verifier, mechanism, bytes.start, bytes.size, digest);
+      cached = pni_sasl_cache_lookup(verifier, digest);
+      pni_cleanse(digest, sizeof(digest));
+    }
+    pni_mutex_unlock(verifier->lock);
+    if (cached) {
+      sasl->outcome = PN_SASL_OK;
+      sasl->verify_state = VERIFY_SETTLED;
+      pni_emit((pn_sasl_t *) transport);
+      return;
+    }
+    // the verifier's reference goes to the waker when there is one,
+    // otherwise it is dropped once the result is picked up here
+    pn_incref(transport);
+    sasl->verify_waker = transport->wake != NULL;
+    sasl->verify_state = VERIFY_RUNNING;
+    verifier->verify(transport, mechanism, bytes.start, bytes.size, verifier->context);
+  }
+
+  pni_mutex_lock(verifier->lock);
+  bool done = sasl->verify_state == VERIFY_DONE;
+  if (done) {
+    sasl->verify_state = VERIFY_SETTLED;
+    if (sasl->verified == PN_SASL_OK) {
+      pn_buffer_memory_t bytes = pn_buffer_memory(sasl->recv_data);
+      pni_sasl_cache_insert(verifier, sasl->remote_mechanisms ? sasl->remote_mechanisms : "",
+                            bytes.start, bytes.size);
+    }
+  }
+  pni_mutex_unlock(verifier->lock);
+  if (!done) return;
+
+  if (sasl->outcome == PN_SASL_NONE) sasl->outcome = sasl->verified;
+  pni_emit((pn_sasl_t *) transport);
+  if (!sasl->verify_waker) pn_decref(transport);
+}
+
+// mechanisms that are over once the init frame is sent, the client can
+// follow it with the amqp header without waiting on the outcome
+static bool pni_sasl_single_step(const char *mechanism)
+{
+  return mechanism && (!strcmp(mechanism, "ANONYMOUS") || !strcmp(mechanism, "PLAIN") ||
+                       !strcmp(mechanism, "EXTERNAL"));
 }
 
 void pn_client_init(pn_transport_t *transport)
@@ -357,9 +641,14 @@ void pn_sasl_process(pn_transport_t *transport)
     pn_post_frame(transport, SASL_FRAME_TYPE, 0, "DL[z]", sasl->client ? SASL_RESPONSE : SASL_CHALLENGE,
                   bytes.size, bytes.start);
     pn_buffer_clear(sasl->send_data);
+    if (!sasl->client) sasl->halt = false;
     pni_emit((pn_sasl_t *) transport);
   }
 
+  if (!sasl->client && sasl->verifier && sasl->rcvd_init) {
+    pni_sasl_verify(transport);
+  }
+
   if (!sasl->client && sasl->outcome != PN_SASL_NONE && !sasl->sent_done) {
     pn_server_done((pn_sasl_t *)transport);
     sasl->sent_done = true;
@@ -383,6 +672,11 @@ ssize_t pn_sasl_input(pn_transport_t *transport, const char *bytes, size_t avail
 
   pn_sasl_process(transport);
 
+  if (sasl->halt && !sasl->rcvd_done && (size_t) n < available) {
+    // what follows is read once there is an outcome
+    transport->input_held = true;
+  }
+
   if (sasl->rcvd_done) {
     if (pn_sasl_state((pn_sasl_t *)transport) == PN_SASL_PASS) {
       if (n) {
@@ -391,7 +685,6 @@ ssize_t pn_sasl_input(pn_transport_t *transport, const char *bytes, size_t avail
         return PN_EOS;
       }
     } else {
-      // XXX: should probably do something better here
       return PN_ERR;
     }
   } else {
@@ -408,9 +701,12 @@ ssize_t pn_sasl_output(pn_transport_t *transport, char *bytes, size_t size)
     if (pn_sasl_state((pn_sasl_t *)transport) == PN_SASL_PASS) {
       return PN_EOS;
     } else {
-      // XXX: should probably do something better here
       return PN_ERR;
     }
+  } else if (transport->available == 0 && sasl->client && sasl->sent_init &&
+             pni_sasl_single_step(sasl->mechanisms)) {
+    // pipelined, the outcome is still read before any amqp input
+    return PN_EOS;
   } else {
     return pn_dispatcher_output(transport, bytes, size);
   }
@@ -427,6 +723,8 @@ int pn_do_init(pn_transport_t *transport, uint8_t frame_type, uint16_t channel,
   sasl->remote_mechanisms = pn_strndup(mech.start, mech.size);
   pn_buffer_append(sasl->recv_data, recv.start, recv.size);
   sasl->rcvd_init = true;
+  // the client may have pipelined amqp behind this, which waits for the outcome
+  sasl->halt = true;
   return 0;
 }
 
@@ -463,6 +761,7 @@ int pn_do_response(pn_transport_t *transport, uint8_t frame_type, uint16_t chann
   pni_sasl_t *sasl = transport->sasl;
   assert(sasl && !sasl->client);
 #endif
+  transport->sasl->halt = true;
   return pn_do_recv(transport, frame_type, channel, args, payload);
 }
 
@@ -512,16 +811,32 @@ static ssize_t pn_input_read_sasl_header(pn_transport_t* transport, unsigned int
   return PN_EOS;
 }
 
+// the outcome has told the peer, so a failure is only recorded, and
+// the stream ends there rather than going on to the next layer
+static ssize_t pni_sasl_failed(pn_transport_t *transport)
+{
+  pn_condition_t *condition = pn_transport_condition(transport);
+  if (!pn_condition_is_set(condition)) {
+    pn_condition_set_name(condition, "amqp:unauthorized-access");
+    pn_condition_set_description(condition, "SASL authentication failed");
+  }
+  return PN_EOS;
+}
+
 static ssize_t pn_input_read_sasl(pn_transport_t* transport, unsigned int layer, const char* bytes, size_t available)
 {
   pni_sasl_t *sasl = transport->sasl;
   if (!sasl->input_bypass) {
     ssize_t n = pn_sasl_input(transport, bytes, available);
+    if (n == PN_ERR) return pni_sasl_failed(transport);
     if (n != PN_EOS) return n;
 
     sasl->input_bypass = true;
-    if (sasl->output_bypass)
-        transport->io_layers[layer] = &pni_passthru_layer;
+    if (sasl->output_bypass) {
+        // done both ways, the leftover goes straight to the next layer
+        pni_io_layer_remove(transport, layer);
+        return transport->io_layers[layer]->process_input(transport, layer, bytes, available);
+    }
   }
   return pni_passthru_layer.process_input(transport, layer, bytes, available );
 }
@@ -551,11 +866,14 @@ static ssize_t pn_output_write_sasl(pn_transport_t* transport, unsigned int laye
     } else {
         n = pn_sasl_output(transport, bytes, available);
     }
+    if (n == PN_ERR) return pni_sasl_failed(transport);
     if (n != PN_EOS) return n;
 
     sasl->output_bypass = true;
-    if (sasl->input_bypass)
-        transport->io_layers[layer] = &pni_passthru_layer;
+    if (sasl->input_bypass) {
+        pni_io_layer_remove(transport, layer);
+        return transport->io_layers[layer]->process_output(transport, layer, bytes, available);
+    }
   }
   return pni_passthru_layer.process_output(transport, layer, bytes, available );
 }
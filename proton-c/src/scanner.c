@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "platform.h"
+#include "alloc_private.h"
 
 #define ERROR_SIZE (1024)
 
@@ -73,7 +74,7 @@ const char *pn_token_type(pn_token_type_t type)
 
 pn_scanner_t *pn_scanner()
 {
-  pn_scanner_t *scanner = (pn_scanner_t *) malloc(sizeof(pn_scanner_t));
+  pn_scanner_t *scanner = (pn_scanner_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pn_scanner_t));
   if (scanner) {
     scanner->input = NULL;
     scanner->error = pn_error();
@@ -85,7 +86,7 @@ void pn_scanner_free(pn_scanner_t *scanner)
 {
   if (scanner) {
     pn_error_free(scanner->error);
-    free(scanner);
+    pni_free(PN_ALLOC_OBJECT, scanner);
   }
 }
 
@@ -0,0 +1,112 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/io.h>
+#include <proton/object.h>
+#include <assert.h>
+
+#include "socket_options.h"
+
+static void pn_socket_options_initialize(void *object)
+{
+  pn_socket_options_t *options = (pn_socket_options_t *) object;
+  options->send_buffer = -1;
+  options->receive_buffer = -1;
+  options->nodelay = -1;
+  options->quickack = -1;
+  options->cork = -1;
+  options->notsent_lowat = -1;
+  options->busy_poll = -1;
+  options->keepalive = -1;
+  options->keepidle = -1;
+  options->keepintvl = -1;
+  options->keepcnt = -1;
+  options->zerocopy = -1;
+}
+
+#define pn_socket_options_finalize NULL
+#define pn_socket_options_hashcode NULL
+#define pn_socket_options_compare NULL
+#define pn_socket_options_inspect NULL
+
+pn_socket_options_t *pn_socket_options(void)
+{
+  static const pn_class_t clazz = PN_CLASS(pn_socket_options);
+  return (pn_socket_options_t *) pn_class_new(&clazz, sizeof(pn_socket_options_t));
+}
+
+void pn_socket_options_free(pn_socket_options_t *options)
+{
+  pn_decref(options);
+}
+
+void pn_socket_options_set_buffers(pn_socket_options_t *options, int send, int receive)
+{
+  assert(options);
+  options->send_buffer = send > 0 ? send : -1;
+  options->receive_buffer = receive > 0 ? receive : -1;
+}
+
+void pn_socket_options_set_nodelay(pn_socket_options_t *options, bool nodelay)
+{
+  assert(options);
+  options->nodelay = nodelay;
+}
+
+void pn_socket_options_set_quickack(pn_socket_options_t *options, bool quickack)
+{
+  assert(options);
+  options->quickack = quickack;
+}
+
+void pn_socket_options_set_cork(pn_socket_options_t *options, bool cork)
+{
+  assert(options);
+  options->cork = cork;
+}
+
+void pn_socket_options_set_notsent_lowat(pn_socket_options_t *options, int bytes)
+{
+  assert(options);
+  options->notsent_lowat = bytes >= 0 ? bytes : -1;
+}
+
+void pn_socket_options_set_busy_poll(pn_socket_options_t *options, int usecs)
+{
+  assert(options);
+  options->busy_poll = usecs >= 0 ? usecs : -1;
+}
+
+void pn_socket_options_set_keepalive(pn_socket_options_t *options, bool keepalive,
+                                     int idle, int interval, int count)
+{
+  assert(options);
+  options->keepalive = keepalive;
+  options->keepidle = keepalive && idle > 0 ? idle : -1;
+  options->keepintvl = keepalive && interval > 0 ? interval : -1;
+  options->keepcnt = keepalive && count > 0 ? count : -1;
+}
+
+void pn_socket_options_set_zerocopy(pn_socket_options_t *options, int threshold)
+{
+  assert(options);
+  options->zerocopy = threshold > 0 ? threshold : 0;
+}
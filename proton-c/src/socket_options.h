@@ -0,0 +1,88 @@
+#ifndef _PROTON_SRC_SOCKET_OPTIONS_H
+#define _PROTON_SRC_SOCKET_OPTIONS_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/io.h>
+
+// an option left at -1 is not applied
+struct pn_socket_options_t {
+  int send_buffer;
+  int receive_buffer;
+  int nodelay;
+  int quickack;
+  int cork;
+  int notsent_lowat;
+  int busy_poll;
+  int keepalive;
+  int keepidle;
+  int keepintvl;
+  int keepcnt;
+  int zerocopy;
+};
+
+/** Connect like pn_connect(), applying options on top of the io's own
+ * before the connection is made.
+ *
+ * @internal
+ */
+pn_socket_t pni_connect(pn_io_t *io, const char *host, const char *port, pn_socket_options_t *options);
+
+/** Send like pn_send(), with MSG_ZEROCOPY where the platform has it.
+ * The kernel may read buf until pni_zerocopy_reap() has counted the
+ * send as done, pinned says whether it has to be waited for.
+ *
+ * @internal
+ */
+ssize_t pni_send_zerocopy(pn_io_t *io, pn_socket_t socket, const void *buf, size_t size,
+                          bool *pinned);
+
+/** Whether zerocopy sends are on for a socket (SO_ZEROCOPY).
+ *
+ * @internal
+ */
+bool pni_zerocopy_enabled(pn_io_t *io, pn_socket_t socket);
+
+/** Take the completions of zerocopy sends off the socket's error
+ * queue.
+ *
+ * @return the number of sends the kernel is done with
+ * @internal
+ */
+uint32_t pni_zerocopy_reap(pn_io_t *io, pn_socket_t socket);
+
+/** Whether the ssl layer may give the record layer of an io's sockets
+ * to the kernel (see pn_ssl_domain_set_kernel_tls()).
+ *
+ * @internal
+ */
+bool pni_kernel_tls_enabled(pn_io_t *io);
+
+/** Receive like pn_recv() from a socket the kernel decrypts.  Only
+ * application data is returned, a close_notify reads as the end of
+ * the stream and any other record is an error.
+ *
+ * @internal
+ */
+ssize_t pni_recv_tls(pn_io_t *io, pn_socket_t socket, void *buf, size_t size);
+
+#endif /* socket_options.h */
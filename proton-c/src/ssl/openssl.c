@@ -23,7 +23,10 @@
 #include <proton/engine.h>
 #include "engine/engine-internal.h"
 #include "platform.h"
+#include "probes.h"
+#include "thread.h"
 #include "util.h"
+#include "alloc_private.h"
 
 // openssl on windows expects the user to have already included
 // winsock.h
@@ -45,6 +48,28 @@
 #include <openssl/dh.h>
 #include <openssl/err.h>
 #include <openssl/x509v3.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+#include <openssl/pem.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
+#if defined(USE_KTLS) && OPENSSL_VERSION_NUMBER >= 0x10101000L
+#include <openssl/kdf.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#define PNI_KTLS 1
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -59,9 +84,28 @@
 
 static int ssl_initialized;
 static int ssl_ex_data_index;
+static BIO_METHOD *transport_bio_method;
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+static DH *ssl_dh_params;
+#endif
+
+// PEM files parsed once for the whole process, see ssl_file_get()
+typedef struct pni_ssl_file_t pni_ssl_file_t;
+static pni_ssl_file_t *ssl_files;
+static pni_mutex_t *ssl_files_lock;
 
 typedef struct pn_ssl_session_t pn_ssl_session_t;
 
+// a session ticket key, laid out as given to
+// pn_ssl_domain_add_session_ticket_key
+typedef struct {
+  unsigned char name[16];
+  unsigned char hmac[16];
+  unsigned char aes[16];
+} pni_ticket_key_t;
+
+#define TICKET_KEY_MAX  4
+
 struct pn_ssl_domain_t {
 
   SSL_CTX       *ctx;
@@ -71,9 +115,34 @@ struct pn_ssl_domain_t {
   // settings used for all connections
   char *trusted_CAs;
 
-  // session cache
+  // session cache, hashed on id.  The list is kept oldest first, which
+  // makes it both the lru order and (near enough) the expiry order
   pn_ssl_session_t *ssn_cache_head;
   pn_ssl_session_t *ssn_cache_tail;
+  pn_ssl_session_t **ssn_buckets;
+  size_t ssn_bucket_count;
+  size_t ssn_count;
+  size_t ssn_limit;
+  uint64_t ssn_hits;
+  uint64_t ssn_misses;
+
+  // server session ticket keys, newest first
+  pni_ticket_key_t ticket_keys[TICKET_KEY_MAX];
+  int ticket_key_count;
+
+  // a domain may be shared by transports on different threads, so
+  // everything above that connections touch after setup is guarded
+  pni_mutex_t *lock;
+
+  // handshake workers and their queue of pending steps, hs_lock guards
+  // the queue and the hs_state of the queued connections
+  pni_mutex_t *hs_lock;
+  pni_semaphore_t *hs_ready;
+  pni_thread_t **hs_threads;
+  size_t hs_thread_count;
+  pni_ssl_t *hs_head;
+  pni_ssl_t *hs_tail;
+  bool hs_stopping;
 
   int   ref_count;
   pn_ssl_mode_t mode;
@@ -82,6 +151,7 @@ struct pn_ssl_domain_t {
   bool has_ca_db;       // true when CA database configured
   bool has_certificate; // true when certificate configured
   bool allow_unsecured;
+  bool kernel_tls;      // give established connections to the kernel
 };
 
 
@@ -92,10 +162,21 @@ struct pni_ssl_t {
   SSL *ssl;
 
   BIO *bio_ssl;         // i/o from/to SSL socket layer
-  BIO *bio_ssl_io;      // SSL "half" of network-facing BIO
-  BIO *bio_net_io;      // socket-side "half" of network-facing BIO
-  // buffers for holding I/O from "applications" above SSL
-#define APP_BUF_SIZE    (4*1024)
+  BIO *bio_ssl_io;      // network-facing BIO, over the transport's own buffers
+
+  // the windows bio_ssl_io reads and writes while a process_*_ssl call
+  // is in progress, and the encrypted output made with nowhere to go
+  const char *net_in;
+  size_t net_in_size;
+  bool net_in_closed;
+  char *net_out;
+  size_t net_out_size;
+  pn_buffer_t *net_pending;
+  // buffers for holding I/O from "applications" above SSL, allocated
+  // on first use so that they can come from the transport's pool.  The
+  // default size is also the largest TLS record.
+#define APP_BUF_SIZE    PNI_IO_BUFFER_SIZE
+#define NET_PENDING_MAX (4*(APP_BUF_SIZE + 512))
   char *outbuf;
   char *inbuf;
 
@@ -111,6 +192,30 @@ struct pni_ssl_t {
   bool ssl_closed;      // shutdown complete, or SSL error
   bool read_blocked;    // SSL blocked until more network data is read
   bool write_blocked;   // SSL blocked until data is written to network
+
+  // handshake steps handed to the domain's workers.  While hs_state is
+  // HS_RUNNING the worker owns the SSL object and net_pending, and the
+  // transport holds back its input until hs_consumed is reported
+  pn_transport_t *hs_transport;
+  pni_ssl_t *hs_next;
+  char *hs_in;          // private copy of the input given to the step
+  size_t hs_in_size;
+  size_t hs_in_capacity;
+  size_t hs_consumed;
+  int hs_state;
+  int hs_result;        // SSL_get_error() of the last step
+  char hs_reason[128];  // the worker's SSL error, if the step failed
+  bool hs_offload;
+  bool hs_started;
+
+  // kernel TLS: the records each way since the keys last changed, which
+  // the kernel numbers on from, the PNI_KTLS_* directions still to be
+  // given to it, and a close_notify it is to send for openssl
+  uint64_t ktls_write_seq;
+  uint64_t ktls_read_seq;
+  int ktls_wanted;
+  bool ktls_ulp;
+  bool ktls_notify;
 };
 
 static inline pn_transport_t *get_transport_internal(pn_ssl_t *ssl)
@@ -128,10 +233,18 @@ static inline pni_ssl_t *get_ssl_internal(pn_ssl_t *ssl)
 struct pn_ssl_session_t {
   const char       *id;
   SSL_SESSION      *session;
+  uintptr_t         hash;
+  pn_ssl_session_t *ssn_bucket_next;
   pn_ssl_session_t *ssn_cache_next;
   pn_ssl_session_t *ssn_cache_prev;
 };
 
+#define SSN_CACHE_DEFAULT_SIZE  4096
+
+// all server domains share one session id context, so that resumption
+// works whatever the verify mode and across processes given tickets
+#define SSN_ID_CONTEXT  "org.apache.qpid.proton"
+
 
 // define two sets of allowable ciphers: those that require authentication, and those
 // that do not require authentication (anonymous).  See ciphers(1).
@@ -146,7 +259,10 @@ static ssize_t process_input_done(pn_transport_t *transport, unsigned int layer,
 static ssize_t process_output_done(pn_transport_t *transport, unsigned int layer, char *input_data, size_t len);
 static int init_ssl_socket(pn_transport_t *, pni_ssl_t *);
 static void release_ssl_socket( pni_ssl_t * );
+static bool handshake_running( pni_ssl_t * );
 static pn_ssl_session_t *ssn_cache_find( pn_ssl_domain_t *, const char * );
+static void ssn_cache_add( pn_ssl_domain_t *, pn_ssl_session_t * );
+static void ssn_cache_remove( pn_ssl_domain_t *, pn_ssl_session_t * );
 static void ssl_session_free( pn_ssl_session_t *);
 static size_t buffered_output( pn_transport_t *transport );
 
@@ -203,7 +319,7 @@ static void ssl_log_clear_data(pn_transport_t *transport, const char *data, size
 }
 
 // unrecoverable SSL failure occured, notify transport and generate error code.
-static int ssl_failed(pn_transport_t *transport)
+static int ssl_fail(pn_transport_t *transport, const char *reason)
 {
   pni_ssl_t *ssl = transport->ssl;
   SSL_set_shutdown(ssl->ssl, SSL_SENT_SHUTDOWN|SSL_RECEIVED_SHUTDOWN);
@@ -211,15 +327,20 @@ static int ssl_failed(pn_transport_t *transport)
   ssl->app_input_closed = ssl->app_output_closed = PN_EOS;
   // fake a shutdown so the i/o processing code will close properly
   SSL_set_shutdown(ssl->ssl, SSL_SENT_SHUTDOWN|SSL_RECEIVED_SHUTDOWN);
+  ssl_log_flush(transport);    // spit out any remaining errors to the log file
+  pn_do_error(transport, "amqp:connection:framing-error", "SSL Failure: %s", reason);
+  return PN_EOS;
+}
+
+static int ssl_failed(pn_transport_t *transport)
+{
   // try to grab the first SSL error to add to the failure log
   char buf[128] = "Unknown error.";
   unsigned long ssl_err = ERR_get_error();
   if (ssl_err) {
     ERR_error_string_n( ssl_err, buf, sizeof(buf) );
   }
-  ssl_log_flush(transport);    // spit out any remaining errors to the log file
-  pn_do_error(transport, "amqp:connection:framing-error", "SSL Failure: %s", buf);
-  return PN_EOS;
+  return ssl_fail(transport, buf);
 }
 
 /* match the DNS name pattern from the peer certificate against our configured peer
@@ -364,6 +485,7 @@ static int verify_callback(int preverify_ok, X509_STORE_CTX *ctx)
 }
 
 
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
 // this code was generated using the command:
 // "openssl dhparam -C -2 2048"
 static DH *get_dh2048(void)
@@ -398,43 +520,617 @@ static DH *get_dh2048(void)
   DH *dh;
 
   if ((dh=DH_new()) == NULL) return(NULL);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  BIGNUM *p=BN_bin2bn(dh2048_p,sizeof(dh2048_p),NULL);
+  BIGNUM *g=BN_bin2bn(dh2048_g,sizeof(dh2048_g),NULL);
+  if ((p == NULL) || (g == NULL) || !DH_set0_pqg(dh, p, NULL, g))
+    { BN_free(p); BN_free(g); DH_free(dh); return(NULL); }
+#else
   dh->p=BN_bin2bn(dh2048_p,sizeof(dh2048_p),NULL);
   dh->g=BN_bin2bn(dh2048_g,sizeof(dh2048_g),NULL);
   if ((dh->p == NULL) || (dh->g == NULL))
     { DH_free(dh); return(NULL); }
+#endif
   return(dh);
 }
+#endif
+
+static uintptr_t ssn_cache_hash( const char *id )
+{
+  // FNV-1a
+  uintptr_t hash = 2166136261u;
+  for (const unsigned char *c = (const unsigned char *) id; *c; c++) {
+    hash = (hash ^ *c) * 16777619u;
+  }
+  return hash;
+}
+
+static bool ssn_expired( pn_ssl_session_t *ssn, long now_sec )
+{
+  long expire = SSL_SESSION_get_time( ssn->session )
+    + SSL_SESSION_get_timeout( ssn->session );
+  return expire < now_sec;
+}
+
+static pn_ssl_session_t **ssn_cache_bucket( pn_ssl_domain_t *domain, uintptr_t hash )
+{
+  return &domain->ssn_buckets[hash & (domain->ssn_bucket_count - 1)];
+}
+
+static void ssn_cache_remove( pn_ssl_domain_t *domain, pn_ssl_session_t *ssn )
+{
+  pn_ssl_session_t **link = ssn_cache_bucket( domain, ssn->hash );
+  while (*link != ssn) link = &(*link)->ssn_bucket_next;
+  *link = ssn->ssn_bucket_next;
+  LL_REMOVE( domain, ssn_cache, ssn );
+  domain->ssn_count--;
+}
+
+// sessions are added in time order, so anything expired is found at
+// the head of the list
+static void ssn_cache_expire( pn_ssl_domain_t *domain, long now_sec )
+{
+  pn_ssl_session_t *ssn;
+  while ((ssn = LL_HEAD( domain, ssn_cache )) && ssn_expired( ssn, now_sec )) {
+    ssn_cache_remove( domain, ssn );
+    ssl_session_free( ssn );
+  }
+}
+
+static int ssn_cache_rehash( pn_ssl_domain_t *domain, size_t count )
+{
+  pn_ssl_session_t **buckets = (pn_ssl_session_t **) pni_calloc(PN_ALLOC_TRANSPORT, count, sizeof(pn_ssl_session_t *) );
+  if (!buckets) return -1;
+  pni_free(PN_ALLOC_TRANSPORT, domain->ssn_buckets );
+  domain->ssn_buckets = buckets;
+  domain->ssn_bucket_count = count;
+  for (pn_ssl_session_t *ssn = LL_HEAD( domain, ssn_cache ); ssn; ssn = ssn->ssn_cache_next) {
+    pn_ssl_session_t **bucket = ssn_cache_bucket( domain, ssn->hash );
+    ssn->ssn_bucket_next = *bucket;
+    *bucket = ssn;
+  }
+  return 0;
+}
 
 static pn_ssl_session_t *ssn_cache_find( pn_ssl_domain_t *domain, const char *id )
 {
-  pn_timestamp_t now_msec = pn_i_now();
-  long now_sec = (long)(now_msec / 1000);
-  pn_ssl_session_t *ssn = LL_HEAD( domain, ssn_cache );
-  while (ssn) {
-    long expire = SSL_SESSION_get_time( ssn->session )
-      + SSL_SESSION_get_timeout( ssn->session );
-    if (expire < now_sec) {
-      pn_ssl_session_t *next = ssn->ssn_cache_next;
-      LL_REMOVE( domain, ssn_cache, ssn );
+  long now_sec = (long)(pn_i_now() / 1000);
+  ssn_cache_expire( domain, now_sec );
+
+  pn_ssl_session_t *ssn = NULL;
+  if (domain->ssn_count) {
+    uintptr_t hash = ssn_cache_hash( id );
+    ssn = *ssn_cache_bucket( domain, hash );
+    while (ssn && (ssn->hash != hash || strcmp( ssn->id, id ))) {
+      ssn = ssn->ssn_bucket_next;
+    }
+    // sessions with a shorter timeout than their elders slip past expire
+    if (ssn && ssn_expired( ssn, now_sec )) {
+      ssn_cache_remove( domain, ssn );
       ssl_session_free( ssn );
-      ssn = next;
-      continue;
+      ssn = NULL;
+    }
+  }
+
+  if (ssn) {
+    domain->ssn_hits++;
+  } else {
+    domain->ssn_misses++;
+  }
+  return ssn;
+}
+
+// takes ownership of ssn
+static void ssn_cache_add( pn_ssl_domain_t *domain, pn_ssl_session_t *ssn )
+{
+  if (!domain->ssn_limit) {
+    ssl_session_free( ssn );
+    return;
+  }
+
+  if (domain->ssn_count + 1 > domain->ssn_bucket_count) {
+    size_t count = domain->ssn_bucket_count ? 2*domain->ssn_bucket_count : 16;
+    if (ssn_cache_rehash( domain, count ) && !domain->ssn_buckets) {
+      ssl_session_free( ssn );
+      return;
     }
+  }
 
-    if (!strcmp(ssn->id, id)) {
+  ssn->hash = ssn_cache_hash( ssn->id );
+  pn_ssl_session_t **bucket = ssn_cache_bucket( domain, ssn->hash );
+  for (pn_ssl_session_t *old = *bucket; old; old = old->ssn_bucket_next) {
+    if (old->hash == ssn->hash && !strcmp( old->id, ssn->id )) {
+      ssn_cache_remove( domain, old );
+      ssl_session_free( old );
       break;
     }
-    ssn = ssn->ssn_cache_next;
   }
-  return ssn;
+
+  while (domain->ssn_count >= domain->ssn_limit) {
+    pn_ssl_session_t *lru = LL_HEAD( domain, ssn_cache );
+    ssn_cache_remove( domain, lru );
+    ssl_session_free( lru );
+  }
+
+  ssn->ssn_bucket_next = *bucket;
+  *bucket = ssn;
+  LL_ADD( domain, ssn_cache, ssn );
+  domain->ssn_count++;
+}
+
+// Certificate, key and CA files are parsed once and the result shared by
+// every domain that names them, which makes creating many domains with
+// the same credentials cheap.  An entry is reparsed when the file's
+// mtime or size changes.  The list is most recently used first.
+
+#define SSL_FILES_MAX 64
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define X509_up_ref(x) CRYPTO_add(&(x)->references, 1, CRYPTO_LOCK_X509)
+#endif
+
+struct pni_ssl_file_t {
+  pni_ssl_file_t *next;
+  char *path;
+  char *password;               // keys only, what the key was read with
+  time_t mtime;
+  off_t size;
+  STACK_OF(X509_INFO) *infos;   // certificates and CRLs, in file order
+  EVP_PKEY *key;
+};
+
+static void ssl_file_free(pni_ssl_file_t *file)
+{
+  sk_X509_INFO_pop_free(file->infos, X509_INFO_free);
+  if (file->key) EVP_PKEY_free(file->key);
+  pni_free(PN_ALLOC_TRANSPORT, file->password);
+  pni_free(PN_ALLOC_TRANSPORT, file->path);
+  pni_free(PN_ALLOC_TRANSPORT, file);
+}
+
+static bool ssl_file_match(pni_ssl_file_t *file, const char *path, const char *password,
+                           bool key, struct stat *sbuf)
+{
+  if (strcmp(file->path, path) || (file->key != NULL) != key) return false;
+  if (key && strcmp(file->password ? file->password : "", password ? password : "")) return false;
+  return file->mtime == sbuf->st_mtime && file->size == sbuf->st_size;
+}
+
+static pni_ssl_file_t *ssl_file_load(const char *path, const char *password, bool key)
+{
+  BIO *bio = BIO_new_file(path, "r");
+  if (!bio) return NULL;
+  pni_ssl_file_t *file = (pni_ssl_file_t *) pni_calloc(PN_ALLOC_TRANSPORT, 1, sizeof(pni_ssl_file_t));
+  if (file) {
+    if (key) {
+      file->key = PEM_read_bio_PrivateKey(bio, NULL, password ? keyfile_pw_cb : NULL, (void *) password);
+    } else {
+      file->infos = PEM_X509_INFO_read_bio(bio, NULL, NULL, NULL);
+    }
+    file->path = pn_strdup(path);
+    file->password = password ? pn_strdup(password) : NULL;
+    if (!(file->key || file->infos) || !file->path || (password && !file->password)) {
+      ssl_file_free(file);
+      file = NULL;
+    }
+  }
+  BIO_free(bio);
+  return file;
+}
+
+// look up the parsed contents of a file, with ssl_files_lock held
+static pni_ssl_file_t *ssl_file_get(const char *path, const char *password, bool key)
+{
+  struct stat sbuf;
+  if (stat(path, &sbuf) != 0) return NULL;
+
+  pni_ssl_file_t **prev = &ssl_files;
+  size_t count = 0;
+  for (pni_ssl_file_t *file = ssl_files; file; file = file->next) {
+    if (ssl_file_match(file, path, password, key, &sbuf)) {
+      *prev = file->next;
+      file->next = ssl_files;
+      ssl_files = file;
+      return file;
+    }
+    prev = &file->next;
+    count++;
+  }
+
+  pni_ssl_file_t *file = ssl_file_load(path, password, key);
+  if (!file) return NULL;
+  file->mtime = sbuf.st_mtime;
+  file->size = sbuf.st_size;
+  file->next = ssl_files;
+  ssl_files = file;
+
+  // drop the least recently used entry, and any stale copy of this file
+  prev = &ssl_files->next;
+  while (*prev) {
+    pni_ssl_file_t *old = *prev;
+    if (!strcmp(old->path, path) || (!old->next && count >= SSL_FILES_MAX)) {
+      *prev = old->next;
+      ssl_file_free(old);
+      count--;
+    } else {
+      prev = &old->next;
+    }
+  }
+  return file;
+}
+
+static int ssl_use_certificate_chain(SSL_CTX *ctx, pni_ssl_file_t *file)
+{
+  bool leaf = true;
+  for (int i = 0; i < sk_X509_INFO_num(file->infos); i++) {
+    X509 *x = sk_X509_INFO_value(file->infos, i)->x509;
+    if (!x) continue;
+    if (leaf) {
+      if (SSL_CTX_use_certificate(ctx, x) != 1) return -1;
+      SSL_CTX_clear_extra_chain_certs(ctx);
+      leaf = false;
+    } else {
+      X509_up_ref(x);
+      if (SSL_CTX_add_extra_chain_cert(ctx, x) != 1) {
+        X509_free(x);
+        return -1;
+      }
+    }
+  }
+  return leaf ? -1 : 0;
+}
+
+static int ssl_use_ca_file(SSL_CTX *ctx, pni_ssl_file_t *file)
+{
+  X509_STORE *store = SSL_CTX_get_cert_store(ctx);
+  int count = 0;
+  for (int i = 0; i < sk_X509_INFO_num(file->infos); i++) {
+    X509_INFO *info = sk_X509_INFO_value(file->infos, i);
+    if (info->x509 && X509_STORE_add_cert(store, info->x509)) count++;
+    if (info->crl && X509_STORE_add_crl(store, info->crl)) count++;
+  }
+  // adding a certificate the store already has is not an error
+  ERR_clear_error();
+  return count ? 0 : -1;
+}
+
+static STACK_OF(X509_NAME) *ssl_client_ca_names(pni_ssl_file_t *file)
+{
+  STACK_OF(X509_NAME) *names = sk_X509_NAME_new_null();
+  if (!names) return NULL;
+  for (int i = 0; i < sk_X509_INFO_num(file->infos); i++) {
+    X509 *x = sk_X509_INFO_value(file->infos, i)->x509;
+    if (!x) continue;
+    X509_NAME *name = X509_get_subject_name(x);
+    bool dup = false;
+    for (int j = 0; j < sk_X509_NAME_num(names) && !dup; j++) {
+      dup = !X509_NAME_cmp(sk_X509_NAME_value(names, j), name);
+    }
+    if (dup) continue;
+    X509_NAME *copy = X509_NAME_dup(name);
+    if (!copy || !sk_X509_NAME_push(names, copy)) {
+      if (copy) X509_NAME_free(copy);
+      sk_X509_NAME_pop_free(names, X509_NAME_free);
+      return NULL;
+    }
+  }
+  if (!sk_X509_NAME_num(names)) {
+    sk_X509_NAME_free(names);
+    return NULL;
+  }
+  return names;
+}
+
+// The network BIO reads straight out of the input that
+// process_input_ssl was given and writes straight into the buffer
+// process_output_ssl was given, so encrypted bytes are copied once on
+// their way between the socket and openssl.  Output made outside of
+// process_output_ssl (e.g. handshake replies) is held in net_pending.
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define BIO_get_data(bio) ((bio)->ptr)
+#define BIO_set_data(bio, data) ((bio)->ptr = (data))
+#define BIO_set_init(bio, value) ((bio)->init = (value))
+#endif
+
+static int transport_bio_write(BIO *bio, const char *data, int size)
+{
+  pni_ssl_t *ssl = (pni_ssl_t *) BIO_get_data(bio);
+  BIO_clear_retry_flags(bio);
+
+  size_t direct = 0;
+  size_t pending = pn_buffer_size(ssl->net_pending);
+  if (!pending) {
+    direct = pn_min((size_t) size, ssl->net_out_size);
+    if (direct) {
+      memcpy(ssl->net_out, data, direct);
+      ssl->net_out += direct;
+      ssl->net_out_size -= direct;
+    }
+  }
+
+  size_t held = pn_min((size_t) size - direct, NET_PENDING_MAX - pn_min(pending, (size_t) NET_PENDING_MAX));
+  if (held && pn_buffer_append(ssl->net_pending, data + direct, held)) {
+    held = 0;
+  }
+
+  if (!direct && !held) {
+    BIO_set_retry_write(bio);
+    return -1;
+  }
+  return (int) (direct + held);
+}
+
+static int transport_bio_read(BIO *bio, char *data, int size)
+{
+  pni_ssl_t *ssl = (pni_ssl_t *) BIO_get_data(bio);
+  BIO_clear_retry_flags(bio);
+
+  if (!ssl->net_in_size) {
+    if (ssl->net_in_closed) return 0;
+    BIO_set_retry_read(bio);
+    return -1;
+  }
+
+  size_t n = pn_min((size_t) size, ssl->net_in_size);
+  memcpy(data, ssl->net_in, n);
+  ssl->net_in += n;
+  ssl->net_in_size -= n;
+  return (int) n;
+}
+
+static long transport_bio_ctrl(BIO *bio, int cmd, long num, void *ptr)
+{
+  pni_ssl_t *ssl = (pni_ssl_t *) BIO_get_data(bio);
+  switch (cmd) {
+  case BIO_CTRL_FLUSH:
+    return 1;
+  case BIO_CTRL_PENDING:
+    return ssl ? (long) ssl->net_in_size : 0;
+  case BIO_CTRL_WPENDING:
+    return ssl ? (long) pn_buffer_size(ssl->net_pending) : 0;
+  case BIO_CTRL_EOF:
+    return ssl ? ssl->net_in_closed && !ssl->net_in_size : 1;
+  default:
+    return 0;
+  }
+}
+
+static int transport_bio_create(BIO *bio)
+{
+  BIO_set_init(bio, 1);
+  BIO_set_data(bio, NULL);
+  return 1;
+}
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static BIO_METHOD transport_bio_method_static = {
+  BIO_TYPE_SOURCE_SINK,
+  "proton transport",
+  transport_bio_write,
+  transport_bio_read,
+  NULL,
+  NULL,
+  transport_bio_ctrl,
+  transport_bio_create,
+  NULL,
+  NULL
+};
+#endif
+
+static BIO_METHOD *transport_bio_method_new(void)
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  return &transport_bio_method_static;
+#else
+  BIO_METHOD *method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "proton transport");
+  if (method) {
+    BIO_meth_set_write(method, transport_bio_write);
+    BIO_meth_set_read(method, transport_bio_read);
+    BIO_meth_set_ctrl(method, transport_bio_ctrl);
+    BIO_meth_set_create(method, transport_bio_create);
+  }
+  return method;
+#endif
+}
+
+// Handshake offload: the reactor thread hands each step of the handshake
+// over to one of the domain's workers, along with a copy of the input,
+// and parks the transport until the worker wakes it with the result.
+// Only the public key operations are worth moving, so once the handshake
+// is done the connection goes back to being driven inline.
+
+enum { HS_IDLE, HS_RUNNING, HS_DONE };
+
+static void handshake_step(pni_ssl_t *ssl)
+{
+  ssl->net_in = ssl->hs_in;
+  ssl->net_in_size = ssl->hs_in_size;
+  // the error queue is per thread, so anything wrong is captured here
+  ERR_clear_error();
+  int rc = SSL_do_handshake(ssl->ssl);
+  ssl->hs_result = rc == 1 ? SSL_ERROR_NONE : SSL_get_error(ssl->ssl, rc);
+  if (ssl->hs_result != SSL_ERROR_NONE && ssl->hs_result != SSL_ERROR_WANT_READ &&
+      ssl->hs_result != SSL_ERROR_WANT_WRITE) {
+    snprintf(ssl->hs_reason, sizeof(ssl->hs_reason), "Unknown error.");
+    unsigned long ssl_err = ERR_get_error();
+    if (ssl_err) {
+      ERR_error_string_n(ssl_err, ssl->hs_reason, sizeof(ssl->hs_reason));
+    }
+    ERR_clear_error();
+  }
+  ssl->hs_consumed = ssl->hs_in_size - ssl->net_in_size;
+  ssl->net_in = NULL;
+  ssl->net_in_size = 0;
+}
+
+static void handshake_worker(void *context)
+{
+  pn_ssl_domain_t *domain = (pn_ssl_domain_t *) context;
+  while (true) {
+    pni_semaphore_wait(domain->hs_ready);
+    pni_mutex_lock(domain->hs_lock);
+    pni_ssl_t *ssl = domain->hs_head;
+    if (!ssl) {
+      bool stopping = domain->hs_stopping;
+      pni_mutex_unlock(domain->hs_lock);
+      if (stopping) return;
+      continue;
+    }
+    domain->hs_head = ssl->hs_next;
+    if (!domain->hs_head) domain->hs_tail = NULL;
+    pni_mutex_unlock(domain->hs_lock);
+
+    handshake_step(ssl);
+
+    pn_transport_t *transport = ssl->hs_transport;
+    pni_mutex_lock(domain->hs_lock);
+    ssl->hs_state = HS_DONE;
+    pni_mutex_unlock(domain->hs_lock);
+    // hands the reference taken in handshake_submit to the waker
+    transport->wake(transport, transport->wake_context);
+  }
+}
+
+static void handshake_workers_stop(pn_ssl_domain_t *domain)
+{
+  if (!domain->hs_lock) return;
+  pni_mutex_lock(domain->hs_lock);
+  domain->hs_stopping = true;
+  pni_mutex_unlock(domain->hs_lock);
+  for (size_t i = 0; i < domain->hs_thread_count; i++) {
+    pni_semaphore_post(domain->hs_ready);
+  }
+  for (size_t i = 0; i < domain->hs_thread_count; i++) {
+    pni_thread_join(domain->hs_threads[i]);
+  }
+  pni_free(PN_ALLOC_TRANSPORT, domain->hs_threads);
+  pni_semaphore_free(domain->hs_ready);
+  pni_mutex_free(domain->hs_lock);
+  domain->hs_threads = NULL;
+  domain->hs_thread_count = 0;
+  domain->hs_ready = NULL;
+  domain->hs_lock = NULL;
+}
+
+// true while a worker has the connection, called on the transport's
+// own thread only
+static bool handshake_running(pni_ssl_t *ssl)
+{
+  if (!ssl->hs_offload) return false;
+  pn_ssl_domain_t *domain = ssl->domain;
+  pni_mutex_lock(domain->hs_lock);
+  int state = ssl->hs_state;
+  if (state == HS_DONE) ssl->hs_state = HS_IDLE;
+  pni_mutex_unlock(domain->hs_lock);
+  return state == HS_RUNNING;
+}
+
+// hand the next step to the workers, false if it has to be run inline
+static bool handshake_submit(pn_transport_t *transport, pni_ssl_t *ssl, const char *data, size_t size)
+{
+  if (size > ssl->hs_in_capacity) {
+    char *in = (char *) pni_realloc(PN_ALLOC_TRANSPORT, ssl->hs_in, size);
+    if (!in) {
+      ssl->hs_offload = false;
+      return false;
+    }
+    ssl->hs_in = in;
+    ssl->hs_in_capacity = size;
+  }
+  if (size) memcpy(ssl->hs_in, data, size);
+  ssl->hs_in_size = size;
+  ssl->hs_started = true;
+  pn_incref(transport);
+
+  pn_ssl_domain_t *domain = ssl->domain;
+  pni_mutex_lock(domain->hs_lock);
+  ssl->hs_state = HS_RUNNING;
+  ssl->hs_next = NULL;
+  if (domain->hs_tail) {
+    domain->hs_tail->hs_next = ssl;
+  } else {
+    domain->hs_head = ssl;
+  }
+  domain->hs_tail = ssl;
+  pni_mutex_unlock(domain->hs_lock);
+  pni_semaphore_post(domain->hs_ready);
+  return true;
+}
+
+// act on the result of the last step: once the handshake is over, or
+// has failed, the connection is driven inline again
+static void handshake_settle(pn_transport_t *transport, pni_ssl_t *ssl)
+{
+  switch (ssl->hs_result) {
+  case SSL_ERROR_WANT_READ:
+  case SSL_ERROR_WANT_WRITE:
+    break;
+  case SSL_ERROR_NONE:
+    ssl->hs_offload = false;
+    ssl_log(transport, "Handshake completed by worker");
+    break;
+  default:
+    ssl->hs_offload = false;
+    ssl_fail(transport, ssl->hs_reason);
+    break;
+  }
+}
+
+// network input while the handshake is offloaded, returns false when the
+// input should be run through the inline path instead
+static bool handshake_input(pn_transport_t *transport, pni_ssl_t *ssl,
+                            const char *input_data, size_t available, ssize_t *result)
+{
+  *result = 0;
+  if (handshake_running(ssl)) return true;
+  if (ssl->hs_consumed) {
+    // the input the last step used is still in front of us
+    *result = ssl->hs_consumed;
+    ssl->hs_consumed = 0;
+    return true;
+  }
+  if (ssl->hs_offload) handshake_settle(transport, ssl);
+  if (!ssl->hs_offload) return false;
+  if (!available) {
+    // let the inline path see the end of stream
+    ssl->hs_offload = false;
+    return false;
+  }
+  return handshake_submit(transport, ssl, input_data, available);
+}
+
+// network output while the handshake is offloaded, as above
+static bool handshake_output(pn_transport_t *transport, pni_ssl_t *ssl,
+                             char *buffer, size_t max_len, ssize_t *result)
+{
+  *result = 0;
+  if (handshake_running(ssl)) return true;
+  handshake_settle(transport, ssl);
+  if (!ssl->hs_offload) return false;
+
+  size_t pending = pn_min(pn_buffer_size(ssl->net_pending), max_len);
+  if (pending) {
+    pn_buffer_get(ssl->net_pending, 0, pending, buffer);
+    pn_buffer_trim(ssl->net_pending, pending, 0);
+    *result = pending;
+    return true;
+  }
+  // a client speaks first, and a step that filled net_pending carries on
+  // once it has been drained
+  if ((!ssl->hs_started && ssl->domain->mode == PN_SSL_MODE_CLIENT) ||
+      ssl->hs_result == SSL_ERROR_WANT_WRITE) {
+    return handshake_submit(transport, ssl, NULL, 0);
+  }
+  return true;
 }
 
 static void ssl_session_free( pn_ssl_session_t *ssn)
 {
   if (ssn) {
-    if (ssn->id) free( (void *)ssn->id );
+    if (ssn->id) pni_free(PN_ALLOC_TRANSPORT, (void *)ssn->id );
     if (ssn->session) SSL_SESSION_free( ssn->session );
-    free( ssn );
+    pni_free(PN_ALLOC_TRANSPORT, ssn );
   }
 }
 
@@ -455,13 +1151,24 @@ pn_ssl_domain_t *pn_ssl_domain( pn_ssl_mode_t mode )
     OpenSSL_add_all_algorithms();
     ssl_ex_data_index = SSL_get_ex_new_index( 0, (void *) "org.apache.qpid.proton.ssl",
                                               NULL, NULL, NULL);
+    transport_bio_method = transport_bio_method_new();
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    ssl_dh_params = get_dh2048();
+#endif
+    ssl_files_lock = pni_mutex();
   }
 
-  pn_ssl_domain_t *domain = (pn_ssl_domain_t *) calloc(1, sizeof(pn_ssl_domain_t));
+  pn_ssl_domain_t *domain = (pn_ssl_domain_t *) pni_calloc(PN_ALLOC_TRANSPORT, 1, sizeof(pn_ssl_domain_t));
   if (!domain) return NULL;
 
   domain->ref_count = 1;
   domain->mode = mode;
+  domain->ssn_limit = SSN_CACHE_DEFAULT_SIZE;
+  domain->lock = pni_mutex();
+  if (!domain->lock) {
+    pni_free(PN_ALLOC_TRANSPORT, domain);
+    return NULL;
+  }
 
   // enable all supported protocol versions, then explicitly disable the
   // known vulnerable ones.  This should allow us to use the latest version
@@ -471,7 +1178,8 @@ pn_ssl_domain_t *pn_ssl_domain( pn_ssl_mode_t mode )
     domain->ctx = SSL_CTX_new(SSLv23_client_method()); // and TLSv1+
     if (!domain->ctx) {
       ssl_log_error("Unable to initialize OpenSSL context.");
-      free(domain);
+      pni_mutex_free(domain->lock);
+      pni_free(PN_ALLOC_TRANSPORT, domain);
       return NULL;
     }
     break;
@@ -480,16 +1188,23 @@ pn_ssl_domain_t *pn_ssl_domain( pn_ssl_mode_t mode )
     domain->ctx = SSL_CTX_new(SSLv23_server_method()); // and TLSv1+
     if (!domain->ctx) {
       ssl_log_error("Unable to initialize OpenSSL context.");
-      free(domain);
+      pni_mutex_free(domain->lock);
+      pni_free(PN_ALLOC_TRANSPORT, domain);
       return NULL;
     }
     break;
 
   default:
     pn_transport_logf(NULL, "Invalid value for pn_ssl_mode_t: %d", mode);
-    free(domain);
+    pni_mutex_free(domain->lock);
+    pni_free(PN_ALLOC_TRANSPORT, domain);
     return NULL;
   }
+
+  if (mode == PN_SSL_MODE_SERVER) {
+    SSL_CTX_set_session_id_context(domain->ctx, (const unsigned char *) SSN_ID_CONTEXT,
+                                   sizeof(SSN_ID_CONTEXT) - 1);
+  }
   const long reject_insecure = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3;
   SSL_CTX_set_options(domain->ctx, reject_insecure);
 #ifdef SSL_OP_NO_COMPRESSION
@@ -510,32 +1225,50 @@ pn_ssl_domain_t *pn_ssl_domain( pn_ssl_mode_t mode )
     return NULL;
   }
 
-  DH *dh = get_dh2048();
-  if (dh) {
-    SSL_CTX_set_tmp_dh(domain->ctx, dh);
-    DH_free(dh);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  // the library picks DH parameters to match the certificate's key
+  SSL_CTX_set_dh_auto(domain->ctx, 1);
+#else
+  // the parameters are built once, the context takes its own reference
+  if (ssl_dh_params) {
+    SSL_CTX_set_tmp_dh(domain->ctx, ssl_dh_params);
     SSL_CTX_set_options(domain->ctx, SSL_OP_SINGLE_DH_USE);
   }
+#endif
+
+  // offer ECDHE: from 1.1.0 the library does so given the groups to
+  // prefer, 1.0.2 picks the curve once asked, and older ones go without
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  SSL_CTX_set1_groups_list(domain->ctx, "X25519:P-256:P-384");
+#elif defined(SSL_CTRL_SET_ECDH_AUTO)
+  SSL_CTX_set_ecdh_auto(domain->ctx, 1);
+  SSL_CTX_set_options(domain->ctx, SSL_OP_SINGLE_ECDH_USE);
+#endif
 
   return domain;
 }
 
 void pn_ssl_domain_free( pn_ssl_domain_t *domain )
 {
-  if (--domain->ref_count == 0) {
+  pni_mutex_lock(domain->lock);
+  int refs = --domain->ref_count;
+  pni_mutex_unlock(domain->lock);
+  if (refs == 0) {
 
     pn_ssl_session_t *ssn = LL_HEAD( domain, ssn_cache );
     while (ssn) {
       pn_ssl_session_t *next = ssn->ssn_cache_next;
-      LL_REMOVE( domain, ssn_cache, ssn );
       ssl_session_free( ssn );
       ssn = next;
     }
+    pni_free(PN_ALLOC_TRANSPORT, domain->ssn_buckets );
+    handshake_workers_stop( domain );
 
     if (domain->ctx) SSL_CTX_free(domain->ctx);
-    if (domain->keyfile_pw) free(domain->keyfile_pw);
-    if (domain->trusted_CAs) free(domain->trusted_CAs);
-    free(domain);
+    if (domain->keyfile_pw) pni_free(PN_ALLOC_TRANSPORT, domain->keyfile_pw);
+    if (domain->trusted_CAs) pni_free(PN_ALLOC_TRANSPORT, domain->trusted_CAs);
+    pni_mutex_free(domain->lock);
+    pni_free(PN_ALLOC_TRANSPORT, domain);
   }
 }
 
@@ -547,7 +1280,11 @@ int pn_ssl_domain_set_credentials( pn_ssl_domain_t *domain,
 {
   if (!domain || !domain->ctx) return -1;
 
-  if (SSL_CTX_use_certificate_chain_file(domain->ctx, certificate_file) != 1) {
+  pni_mutex_lock(ssl_files_lock);
+  pni_ssl_file_t *file = ssl_file_get(certificate_file, NULL, false);
+  int err = file ? ssl_use_certificate_chain(domain->ctx, file) : -1;
+  pni_mutex_unlock(ssl_files_lock);
+  if (err) {
     ssl_log_error("SSL_CTX_use_certificate_chain_file( %s ) failed", certificate_file);
     return -3;
   }
@@ -558,7 +1295,11 @@ int pn_ssl_domain_set_credentials( pn_ssl_domain_t *domain,
     SSL_CTX_set_default_passwd_cb_userdata(domain->ctx, domain->keyfile_pw);
   }
 
-  if (SSL_CTX_use_PrivateKey_file(domain->ctx, private_key_file, SSL_FILETYPE_PEM) != 1) {
+  pni_mutex_lock(ssl_files_lock);
+  file = ssl_file_get(private_key_file, password, true);
+  err = file && SSL_CTX_use_PrivateKey(domain->ctx, file->key) == 1 ? 0 : -1;
+  pni_mutex_unlock(ssl_files_lock);
+  if (err) {
     ssl_log_error("SSL_CTX_use_PrivateKey_file( %s ) failed", private_key_file);
     return -4;
   }
@@ -606,7 +1347,18 @@ int pn_ssl_domain_set_trusted_ca_db(pn_ssl_domain_t *domain,
     file = certificate_db;
   }
 
-  if (SSL_CTX_load_verify_locations( domain->ctx, file, dir ) != 1) {
+  // a directory is only searched as certificates are needed, so it is
+  // just the files that are worth keeping parsed
+  int err;
+  if (file) {
+    pni_mutex_lock(ssl_files_lock);
+    pni_ssl_file_t *cas = ssl_file_get(file, NULL, false);
+    err = cas ? ssl_use_ca_file(domain->ctx, cas) : -1;
+    pni_mutex_unlock(ssl_files_lock);
+  } else {
+    err = SSL_CTX_load_verify_locations( domain->ctx, NULL, dir ) == 1 ? 0 : -1;
+  }
+  if (err) {
     ssl_log_error("SSL_CTX_load_verify_locations( %s ) failed", certificate_db);
     return -1;
   }
@@ -645,10 +1397,13 @@ int pn_ssl_domain_set_peer_authentication(pn_ssl_domain_t *domain,
                    "       Use pn_ssl_domain_set_credentials()");
       }
 
-      if (domain->trusted_CAs) free(domain->trusted_CAs);
+      if (domain->trusted_CAs) pni_free(PN_ALLOC_TRANSPORT, domain->trusted_CAs);
       domain->trusted_CAs = pn_strdup( trusted_CAs );
       STACK_OF(X509_NAME) *cert_names;
-      cert_names = SSL_load_client_CA_file( domain->trusted_CAs );
+      pni_mutex_lock(ssl_files_lock);
+      pni_ssl_file_t *file = ssl_file_get( domain->trusted_CAs, NULL, false );
+      cert_names = file ? ssl_client_ca_names( file ) : NULL;
+      pni_mutex_unlock(ssl_files_lock);
       if (cert_names != NULL)
         SSL_CTX_set_client_CA_list(domain->ctx, cert_names);
       else {
@@ -712,7 +1467,9 @@ int pn_ssl_init(pn_ssl_t *ssl0, pn_ssl_domain_t *domain, const char *session_id)
   if (!ssl || !domain || ssl->domain) return -1;
 
   ssl->domain = domain;
+  pni_mutex_lock(domain->lock);
   domain->ref_count++;
+  pni_mutex_unlock(domain->lock);
   if (session_id && domain->mode == PN_SSL_MODE_CLIENT)
     ssl->session_id = pn_strdup(session_id);
 
@@ -720,6 +1477,174 @@ int pn_ssl_init(pn_ssl_t *ssl0, pn_ssl_domain_t *domain, const char *session_id)
 }
 
 
+int pn_ssl_domain_set_session_cache_size(pn_ssl_domain_t *domain, size_t size)
+{
+  if (!domain) return -1;
+  pni_mutex_lock(domain->lock);
+  domain->ssn_limit = size;
+  while (domain->ssn_count > size) {
+    pn_ssl_session_t *lru = LL_HEAD( domain, ssn_cache );
+    ssn_cache_remove( domain, lru );
+    ssl_session_free( lru );
+  }
+  pni_mutex_unlock(domain->lock);
+  return 0;
+}
+
+uint64_t pn_ssl_domain_session_cache_hits(pn_ssl_domain_t *domain)
+{
+  if (!domain) return 0;
+  pni_mutex_lock(domain->lock);
+  uint64_t hits = domain->ssn_hits;
+  pni_mutex_unlock(domain->lock);
+  return hits;
+}
+
+uint64_t pn_ssl_domain_session_cache_misses(pn_ssl_domain_t *domain)
+{
+  if (!domain) return 0;
+  pni_mutex_lock(domain->lock);
+  uint64_t misses = domain->ssn_misses;
+  pni_mutex_unlock(domain->lock);
+  return misses;
+}
+
+int pn_ssl_domain_set_server_session_cache(pn_ssl_domain_t *domain, size_t size)
+{
+  if (!domain || domain->mode != PN_SSL_MODE_SERVER) return -1;
+  // the SSL_CTX cache is locked by openssl and shared by every
+  // connection using the domain
+  SSL_CTX_set_session_cache_mode(domain->ctx, size ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+  SSL_CTX_sess_set_cache_size(domain->ctx, size);
+  return 0;
+}
+
+int pn_ssl_domain_set_handshake_workers(pn_ssl_domain_t *domain, size_t count)
+{
+  if (!domain || domain->hs_lock) return -1;
+  if (!count) return 0;
+
+  domain->hs_lock = pni_mutex();
+  domain->hs_ready = pni_semaphore();
+  domain->hs_threads = (pni_thread_t **) pni_calloc(PN_ALLOC_TRANSPORT, count, sizeof(pni_thread_t *));
+  if (domain->hs_lock && domain->hs_ready && domain->hs_threads) {
+    while (domain->hs_thread_count < count) {
+      pni_thread_t *thread = pni_thread(handshake_worker, domain);
+      if (!thread) break;
+      domain->hs_threads[domain->hs_thread_count++] = thread;
+    }
+    if (domain->hs_thread_count == count) return 0;
+  }
+  pn_transport_logf(NULL, "Unable to start %d SSL handshake workers", (int) count);
+  if (domain->hs_lock) {
+    handshake_workers_stop(domain);
+  } else {
+    pni_semaphore_free(domain->hs_ready);
+    pni_free(PN_ALLOC_TRANSPORT, domain->hs_threads);
+    domain->hs_ready = NULL;
+    domain->hs_threads = NULL;
+  }
+  return -1;
+}
+
+int pn_ssl_domain_set_kernel_tls(pn_ssl_domain_t *domain, bool enable)
+{
+  if (!domain) return -1;
+#ifdef PNI_KTLS
+  domain->kernel_tls = enable;
+  // the kernel keeps the keys it was given until the connection ends
+  if (enable) {
+    SSL_CTX_set_options(domain->ctx, SSL_OP_NO_RENEGOTIATION);
+  } else {
+    SSL_CTX_clear_options(domain->ctx, SSL_OP_NO_RENEGOTIATION);
+  }
+  return 0;
+#else
+  return enable ? -1 : 0;
+#endif
+}
+
+// OpenSSL 3 hands the ticket callback an EVP_MAC_CTX in place of the
+// deprecated HMAC_CTX
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX ticket_mac_ctx_t;
+
+static int ticket_mac_init(EVP_MAC_CTX *hctx, pni_ticket_key_t *key)
+{
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *) "SHA256", 0),
+    OSSL_PARAM_construct_end()
+  };
+  return EVP_MAC_init(hctx, key->hmac, sizeof(key->hmac), params);
+}
+#else
+typedef HMAC_CTX ticket_mac_ctx_t;
+
+static int ticket_mac_init(HMAC_CTX *hctx, pni_ticket_key_t *key)
+{
+  return HMAC_Init_ex(hctx, key->hmac, sizeof(key->hmac), EVP_sha256(), NULL);
+}
+#endif
+
+static int ticket_key_cb(SSL *s, unsigned char *name, unsigned char *iv,
+                         EVP_CIPHER_CTX *ectx, ticket_mac_ctx_t *hctx, int enc)
+{
+  pn_transport_t *transport = (pn_transport_t *) SSL_get_ex_data(s, ssl_ex_data_index);
+  if (!transport || !transport->ssl) return -1;
+  pn_ssl_domain_t *domain = transport->ssl->domain;
+
+  pni_mutex_lock(domain->lock);
+  int result = 0;
+  if (enc) {
+    if (domain->ticket_key_count && RAND_bytes(iv, EVP_MAX_IV_LENGTH) == 1) {
+      pni_ticket_key_t *key = &domain->ticket_keys[0];
+      memcpy(name, key->name, sizeof(key->name));
+      if (EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key->aes, iv) == 1 &&
+          ticket_mac_init(hctx, key) == 1) {
+        result = 1;
+      } else {
+        result = -1;
+      }
+    }
+  } else {
+    for (int i = 0; i < domain->ticket_key_count; i++) {
+      pni_ticket_key_t *key = &domain->ticket_keys[i];
+      if (!memcmp(name, key->name, sizeof(key->name))) {
+        if (ticket_mac_init(hctx, key) == 1 &&
+            EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key->aes, iv) == 1) {
+          // tickets under a retired key are reissued under the newest
+          result = i ? 2 : 1;
+        } else {
+          result = -1;
+        }
+        break;
+      }
+    }
+  }
+  pni_mutex_unlock(domain->lock);
+  return result;
+}
+
+int pn_ssl_domain_add_session_ticket_key(pn_ssl_domain_t *domain, const char *key, size_t size)
+{
+  if (!domain || domain->mode != PN_SSL_MODE_SERVER) return -1;
+  if (!key || size != sizeof(pni_ticket_key_t)) return -1;
+
+  pni_mutex_lock(domain->lock);
+  if (domain->ticket_key_count < TICKET_KEY_MAX) domain->ticket_key_count++;
+  memmove(&domain->ticket_keys[1], &domain->ticket_keys[0],
+          (domain->ticket_key_count - 1) * sizeof(pni_ticket_key_t));
+  memcpy(&domain->ticket_keys[0], key, size);
+  pni_mutex_unlock(domain->lock);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(domain->ctx, ticket_key_cb);
+#else
+  SSL_CTX_set_tlsext_ticket_key_cb(domain->ctx, ticket_key_cb);
+#endif
+  return 0;
+}
+
 int pn_ssl_domain_allow_unsecured_client(pn_ssl_domain_t *domain)
 {
   if (!domain) return -1;
@@ -742,6 +1667,7 @@ bool pn_ssl_get_cipher_name(pn_ssl_t *ssl0, char *buffer, size_t size )
 
   pni_ssl_t *ssl = get_ssl_internal(ssl0);
   *buffer = '\0';
+  if (handshake_running(ssl)) return false;
   if (ssl->ssl && (c = SSL_get_current_cipher( ssl->ssl ))) {
     const char *v = SSL_CIPHER_get_name(c);
     if (v) {
@@ -758,6 +1684,7 @@ bool pn_ssl_get_protocol_name(pn_ssl_t *ssl0, char *buffer, size_t size )
 
   pni_ssl_t *ssl = get_ssl_internal(ssl0);
   *buffer = '\0';
+  if (handshake_running(ssl)) return false;
   if (ssl->ssl && (c = SSL_get_current_cipher( ssl->ssl ))) {
     const char *v = SSL_CIPHER_get_version(c);
     if (v) {
@@ -776,11 +1703,13 @@ void pn_ssl_free(pn_transport_t *transport)
   ssl_log(transport, "SSL socket freed." );
   release_ssl_socket( ssl );
   if (ssl->domain) pn_ssl_domain_free(ssl->domain);
-  if (ssl->session_id) free((void *)ssl->session_id);
-  if (ssl->peer_hostname) free((void *)ssl->peer_hostname);
-  if (ssl->inbuf) free((void *)ssl->inbuf);
-  if (ssl->outbuf) free((void *)ssl->outbuf);
-  free(ssl);
+  if (ssl->session_id) pni_free(PN_ALLOC_TRANSPORT, (void *)ssl->session_id);
+  if (ssl->peer_hostname) pni_free(PN_ALLOC_TRANSPORT, (void *)ssl->peer_hostname);
+  pni_io_release(transport, ssl->inbuf, ssl->in_size);
+  pni_io_release(transport, ssl->outbuf, ssl->out_size);
+  pn_buffer_free(ssl->net_pending);
+  pni_free(PN_ALLOC_TRANSPORT, ssl->hs_in);
+  pni_free(PN_ALLOC_TRANSPORT, ssl);
 }
 
 pn_ssl_t *pn_ssl(pn_transport_t *transport)
@@ -788,22 +1717,8 @@ pn_ssl_t *pn_ssl(pn_transport_t *transport)
   if (!transport) return NULL;
   if (transport->ssl) return (pn_ssl_t *) transport;
 
-  pni_ssl_t *ssl = (pni_ssl_t *) calloc(1, sizeof(pni_ssl_t));
+  pni_ssl_t *ssl = (pni_ssl_t *) pni_calloc(PN_ALLOC_TRANSPORT, 1, sizeof(pni_ssl_t));
   if (!ssl) return NULL;
-  ssl->out_size = APP_BUF_SIZE;
-  uint32_t max_frame = pn_transport_get_max_frame(transport);
-  ssl->in_size =  max_frame ? max_frame : APP_BUF_SIZE;
-  ssl->outbuf = (char *)malloc(ssl->out_size);
-  if (!ssl->outbuf) {
-    free(ssl);
-    return NULL;
-  }
-  ssl->inbuf =  (char *)malloc(ssl->in_size);
-  if (!ssl->inbuf) {
-    free(ssl->outbuf);
-    free(ssl);
-    return NULL;
-  }
 
   transport->ssl = ssl;
 
@@ -828,24 +1743,260 @@ static int start_ssl_shutdown(pn_transport_t *transport)
     ssl_log(transport, "Shutting down SSL connection...");
     if (ssl->session_id) {
       // save the negotiated credentials before we close the connection
-      pn_ssl_session_t *ssn = (pn_ssl_session_t *)calloc( 1, sizeof(pn_ssl_session_t));
+      pn_ssl_session_t *ssn = (pn_ssl_session_t *)pni_calloc(PN_ALLOC_TRANSPORT, 1, sizeof(pn_ssl_session_t));
       if (ssn) {
         ssn->id = pn_strdup( ssl->session_id );
         ssn->session = SSL_get1_session( ssl->ssl );
         if (ssn->session) {
           ssl_log(transport, "Saving SSL session as %s", ssl->session_id );
-          LL_ADD( ssl->domain, ssn_cache, ssn );
+          pni_mutex_lock( ssl->domain->lock );
+          ssn_cache_add( ssl->domain, ssn );
+          pni_mutex_unlock( ssl->domain->lock );
         } else {
           ssl_session_free( ssn );
         }
       }
     }
     ssl->ssl_shutdown = true;
+#ifdef PNI_KTLS
+    if (transport->kernel_tls & PNI_KTLS_TX) {
+      // openssl's keys are out of date, the kernel sends it instead
+      SSL_set_shutdown(ssl->ssl, SSL_get_shutdown(ssl->ssl) | SSL_SENT_SHUTDOWN);
+      ssl->ktls_notify = true;
+      return 0;
+    }
+#endif
     BIO_ssl_shutdown( ssl->bio_ssl );
   }
   return 0;
 }
 
+// once the close_notify is out and the application is done with a
+// side, the transport is told that side of the layer has closed
+static ssize_t ssl_input_closed(pn_transport_t *transport, unsigned int layer)
+{
+  if (transport->io_layers[layer]==&ssl_output_closed_layer) {
+    transport->io_layers[layer] = &ssl_closed_layer;
+  } else {
+    transport->io_layers[layer] = &ssl_input_closed_layer;
+  }
+  return transport->ssl->app_input_closed;
+}
+
+static ssize_t ssl_output_closed(pn_transport_t *transport, unsigned int layer)
+{
+  if (transport->io_layers[layer]==&ssl_input_closed_layer) {
+    transport->io_layers[layer] = &ssl_closed_layer;
+  } else {
+    transport->io_layers[layer] = &ssl_output_closed_layer;
+  }
+  return transport->ssl->app_output_closed ? transport->ssl->app_output_closed : PN_EOS;
+}
+
+#ifdef PNI_KTLS
+
+// counts the records openssl reads and writes, the kernel carries on
+// with the sequence numbers where openssl left off
+static void ktls_msg_cb(int write_p, int version, int content_type, const void *buf,
+                        size_t len, SSL *s, void *arg)
+{
+  pni_ssl_t *ssl = (pni_ssl_t *) arg;
+  if (content_type != SSL3_RT_HEADER || !len) return;
+  // the records after a change_cipher_spec are numbered from zero, and
+  // it is only seen on the way in by its record header
+  uint64_t *seq = write_p ? &ssl->ktls_write_seq : &ssl->ktls_read_seq;
+  if (((const unsigned char *) buf)[0] == SSL3_RT_CHANGE_CIPHER_SPEC) {
+    *seq = 0;
+  } else {
+    (*seq)++;
+  }
+}
+
+// the TLS 1.2 key block of an AEAD session: the client's and the
+// server's write keys, then their implicit nonces
+static bool ktls_key_block(SSL *s, unsigned char *block, size_t size)
+{
+  unsigned char master[SSL_MAX_MASTER_KEY_LENGTH];
+  unsigned char seed[2*SSL3_RANDOM_SIZE];
+  size_t master_size = SSL_SESSION_get_master_key(SSL_get_session(s), master, sizeof(master));
+  SSL_get_server_random(s, seed, SSL3_RANDOM_SIZE);
+  SSL_get_client_random(s, seed + SSL3_RANDOM_SIZE, SSL3_RANDOM_SIZE);
+  const EVP_MD *md = SSL_CIPHER_get_handshake_digest(SSL_get_current_cipher(s));
+  EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, NULL);
+  bool ok = pctx && md && master_size
+    && EVP_PKEY_derive_init(pctx) > 0
+    && EVP_PKEY_CTX_set_tls1_prf_md(pctx, md) > 0
+    && EVP_PKEY_CTX_set1_tls1_prf_secret(pctx, master, (int) master_size) > 0
+    && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, (const unsigned char *) "key expansion", 13) > 0
+    && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, seed, (int) sizeof(seed)) > 0
+    && EVP_PKEY_derive(pctx, block, &size) > 0;
+  EVP_PKEY_CTX_free(pctx);
+  OPENSSL_cleanse(master, sizeof(master));
+  return ok;
+}
+
+// give one direction of the established session to the kernel.  This
+// is only called once every record openssl made that way has been
+// handed to the socket, or every record it read has been decrypted
+static void ktls_start(pn_transport_t *transport, pni_ssl_t *ssl, int direction)
+{
+  ssl->ktls_wanted &= ~direction;
+  if (transport->socket == PN_INVALID_SOCKET) {
+    ssl->ktls_wanted = 0;
+    return;
+  }
+
+  const SSL_CIPHER *cipher = SSL_get_current_cipher(ssl->ssl);
+  int nid = cipher ? SSL_CIPHER_get_cipher_nid(cipher) : NID_undef;
+  size_t key_size = nid == NID_aes_128_gcm ? 16 : nid == NID_aes_256_gcm ? 32 : 0;
+  if (SSL_version(ssl->ssl) != TLS1_2_VERSION || !key_size) {
+    ssl_log(transport, "Kernel TLS is only used for TLS 1.2 AES-GCM sessions");
+    ssl->ktls_wanted = 0;
+    return;
+  }
+  if (!ssl->ktls_ulp) {
+    if (setsockopt(transport->socket, SOL_TCP, TCP_ULP, "tls", sizeof("tls"))) {
+      ssl_log(transport, "Kernel TLS is not available (errno %d), staying in user space", errno);
+      ssl->ktls_wanted = 0;
+      return;
+    }
+    ssl->ktls_ulp = true;
+  }
+
+  unsigned char block[2*32 + 2*4];
+  if (!ktls_key_block(ssl->ssl, block, 2*key_size + 2*4)) {
+    ssl_log(transport, "Unable to derive the session keys, staying in user space");
+    ssl->ktls_wanted = 0;
+    return;
+  }
+  // we write with the client's keys when we are the client
+  bool client = (direction == PNI_KTLS_TX) == (ssl->domain->mode == PN_SSL_MODE_CLIENT);
+  const unsigned char *key = block + (client ? 0 : key_size);
+  const unsigned char *salt = block + 2*key_size + (client ? 0 : 4);
+  // the record number is both the sequence and the explicit nonce
+  uint64_t seq = direction == PNI_KTLS_TX ? ssl->ktls_write_seq : ssl->ktls_read_seq;
+  unsigned char rec_seq[8];
+  for (int i = 7; i >= 0; i--, seq >>= 8) rec_seq[i] = (unsigned char) seq;
+
+  union {
+    struct tls12_crypto_info_aes_gcm_128 gcm128;
+    struct tls12_crypto_info_aes_gcm_256 gcm256;
+  } info;
+  socklen_t info_size;
+  memset(&info, 0, sizeof(info));
+  if (key_size == 16) {
+    info.gcm128.info.version = TLS_1_2_VERSION;
+    info.gcm128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+    memcpy(info.gcm128.key, key, key_size);
+    memcpy(info.gcm128.salt, salt, 4);
+    memcpy(info.gcm128.iv, rec_seq, 8);
+    memcpy(info.gcm128.rec_seq, rec_seq, 8);
+    info_size = sizeof(info.gcm128);
+  } else {
+    info.gcm256.info.version = TLS_1_2_VERSION;
+    info.gcm256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+    memcpy(info.gcm256.key, key, key_size);
+    memcpy(info.gcm256.salt, salt, 4);
+    memcpy(info.gcm256.iv, rec_seq, 8);
+    memcpy(info.gcm256.rec_seq, rec_seq, 8);
+    info_size = sizeof(info.gcm256);
+  }
+  int rc = setsockopt(transport->socket, SOL_TLS, direction == PNI_KTLS_TX ? TLS_TX : TLS_RX,
+                      &info, info_size);
+  OPENSSL_cleanse(block, sizeof(block));
+  OPENSSL_cleanse(&info, sizeof(info));
+  if (rc) {
+    ssl_log(transport, "Kernel TLS refused the keys (errno %d), staying in user space", errno);
+    return;
+  }
+  transport->kernel_tls |= direction;
+  ssl_log(transport, "Kernel TLS now does the %s records", direction == PNI_KTLS_TX ? "outgoing" : "incoming");
+}
+
+static bool ktls_ready(pni_ssl_t *ssl)
+{
+  return SSL_is_init_finished(ssl->ssl) && !handshake_running(ssl) && !ssl->hs_offload &&
+    !ssl->ssl_shutdown && !ssl->ssl_closed;
+}
+
+// send a close_notify alert record through the kernel
+static void ktls_close_notify(pn_transport_t *transport, pni_ssl_t *ssl)
+{
+  unsigned char alert[2] = { 1, 0 };    // warning, close_notify
+  char control[CMSG_SPACE(sizeof(unsigned char))];
+  struct iovec iov = { alert, sizeof(alert) };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_TLS;
+  cm->cmsg_type = TLS_SET_RECORD_TYPE;
+  cm->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+  *CMSG_DATA(cm) = SSL3_RT_ALERT;
+  if (sendmsg(transport->socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) < 0 &&
+      (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;     // tried again with the next output
+  }
+  ssl_log(transport, "Kernel TLS sent close_notify");
+  ssl->ktls_notify = false;
+}
+
+// the kernel decrypts, so network input is the application's already
+static ssize_t ktls_input(pn_transport_t *transport, unsigned int layer, const char *input_data, size_t available)
+{
+  pni_ssl_t *ssl = transport->ssl;
+  ssize_t consumed = available;
+  if (!available && !ssl->net_in_closed) {
+    // a close_notify, or the end of the stream
+    ssl_log(transport, "SSL connection has closed");
+    ssl->net_in_closed = true;
+    start_ssl_shutdown(transport);
+    ssl->ssl_closed = true;
+  }
+  if (!ssl->app_input_closed) {
+    consumed = transport->io_layers[layer+1]->process_input(transport, layer+1, input_data, available);
+    if (consumed < 0) {
+      ssl_log(transport, "Application layer closed its input, error=%d", (int) consumed);
+      ssl->app_input_closed = consumed;
+      consumed = available;
+      if (ssl->app_output_closed && ssl->out_count == 0) start_ssl_shutdown(transport);
+    }
+  }
+  if (ssl->app_input_closed && (SSL_get_shutdown(ssl->ssl) & SSL_SENT_SHUTDOWN)) {
+    return ssl_input_closed(transport, layer);
+  }
+  return consumed;
+}
+
+// the kernel encrypts, so application output goes to the network as it is
+static ssize_t ktls_output(pn_transport_t *transport, unsigned int layer, char *buffer, size_t max_len)
+{
+  pni_ssl_t *ssl = transport->ssl;
+  // anything openssl writes now, such as an alert, has no keys to go out with
+  pn_buffer_clear(ssl->net_pending);
+  ssize_t written = 0;
+  if (!ssl->app_output_closed) {
+    written = transport->io_layers[layer+1]->process_output(transport, layer+1, buffer, max_len);
+    if (written < 0) {
+      ssl_log(transport, "Application layer closed its output, error=%d", (int) written);
+      ssl->app_output_closed = written;
+      written = 0;
+    }
+  }
+  if (ssl->app_input_closed && ssl->app_output_closed) start_ssl_shutdown(transport);
+  // the alert goes straight to the socket, so only once it is caught up
+  if (!written && ssl->ktls_notify && !transport->output_pending) ktls_close_notify(transport, ssl);
+  if (!written && !ssl->ktls_notify && (SSL_get_shutdown(ssl->ssl) & SSL_SENT_SHUTDOWN)) {
+    return ssl_output_closed(transport, layer);
+  }
+  return written;
+}
+
+#endif
+
 
 //////// SSL Connections
 
@@ -856,40 +2007,41 @@ static ssize_t process_input_ssl( pn_transport_t *transport, unsigned int layer,
 {
   pni_ssl_t *ssl = transport->ssl;
   if (ssl->ssl == NULL && init_ssl_socket(transport, ssl)) return PN_EOS;
+#ifdef PNI_KTLS
+  if (transport->kernel_tls & PNI_KTLS_RX) return ktls_input(transport, layer, input_data, available);
+#endif
+
+  if (ssl->hs_offload || ssl->hs_consumed) {
+    ssize_t result;
+    if (handshake_input(transport, ssl, input_data, available, &result)) return result;
+  }
 
   ssl_log( transport, "process_input_ssl( data size=%d )",available );
 
   ssize_t consumed = 0;
   bool work_pending;
-  bool shutdown_input = (available == 0);  // caller is closed
+
+  // let the network BIO read straight from the caller's data
+  ssl->net_in = input_data;
+  ssl->net_in_size = available;
+  if (available > 0) {
+    ssl->read_blocked = false;
+  } else if (!ssl->net_in_closed) {
+    // lower layer (caller) has closed.  SSL will see EOF once it has
+    // consumed all pending inbound data.
+    ssl_log( transport, "Lower layer closed - shutting down BIO read side");
+    ssl->net_in_closed = true;
+  }
 
   do {
     work_pending = false;
 
-    // Write to network bio as much as possible, consuming bytes/available
-
-    if (available > 0) {
-      int written = BIO_write( ssl->bio_net_io, input_data, available );
-      if (written > 0) {
-        input_data += written;
-        available -= written;
-        consumed += written;
-        ssl->read_blocked = false;
-        work_pending = (available > 0);
-        ssl_log( transport, "Wrote %d bytes to BIO Layer, %d left over", written, available );
-      }
-    } else if (shutdown_input) {
-      // lower layer (caller) has closed.  Close the WRITE side of the BIO.  This will cause
-      // an EOF to be passed to SSL once all pending inbound data has been consumed.
-      ssl_log( transport, "Lower layer closed - shutting down BIO write side");
-      (void)BIO_shutdown_wr( ssl->bio_net_io );
-      shutdown_input = false;
-    }
-
     // Read all available data from the SSL socket
 
     if (!ssl->ssl_closed && ssl->in_count < ssl->in_size) {
+      PNI_PROBE2(ssl_decrypt_start, transport, ssl->in_size - ssl->in_count);
       int read = BIO_read( ssl->bio_ssl, &ssl->inbuf[ssl->in_count], ssl->in_size - ssl->in_count );
+      PNI_PROBE2(ssl_decrypt_done, transport, read);
       if (read > 0) {
         ssl_log( transport, "Read %d bytes from SSL socket for app", read );
         ssl_log_clear_data(transport, &ssl->inbuf[ssl->in_count], read );
@@ -952,8 +2104,10 @@ static ssize_t process_input_ssl( pn_transport_t *transport, unsigned int layer,
             if (ssl->in_size < max_frame) {
               // no max frame limit - grow it.
               size_t newsize = pn_min(max_frame, ssl->in_size * 2);
-              char *newbuf = (char *)realloc( ssl->inbuf, newsize );
+              char *newbuf = pni_io_alloc( transport, newsize );
               if (newbuf) {
+                memcpy( newbuf, ssl->inbuf, ssl->in_count );
+                pni_io_release( transport, ssl->inbuf, ssl->in_size );
                 ssl->in_size = newsize;
                 ssl->inbuf = newbuf;
                 work_pending = true;  // can we get more input?
@@ -973,6 +2127,11 @@ static ssize_t process_input_ssl( pn_transport_t *transport, unsigned int layer,
 
   } while (work_pending);
 
+  consumed = available - ssl->net_in_size;
+  ssl->net_in = NULL;
+  ssl->net_in_size = 0;
+  ssl_log( transport, "Consumed %d bytes from the network", (int) consumed );
+
   //_log(ssl, "ssl_closed=%d in_count=%d app_input_closed=%d app_output_closed=%d",
   //     ssl->ssl_closed, ssl->in_count, ssl->app_input_closed, ssl->app_output_closed );
 
@@ -987,13 +2146,17 @@ static ssize_t process_input_ssl( pn_transport_t *transport, unsigned int layer,
   //  consumed = ssl->app_input_closed;
   //}
   if (ssl->app_input_closed && (SSL_get_shutdown(ssl->ssl) & SSL_SENT_SHUTDOWN) ) {
-    consumed = ssl->app_input_closed;
-    if (transport->io_layers[layer]==&ssl_output_closed_layer) {
-      transport->io_layers[layer] = &ssl_closed_layer;
-    } else {
-      transport->io_layers[layer] = &ssl_input_closed_layer;
-    }
+    consumed = ssl_input_closed(transport, layer);
+  }
+#ifdef PNI_KTLS
+  // the kernel can only take over input that openssl has read up to the
+  // end of a record, and handed all of up to the application
+  else if ((ssl->ktls_wanted & PNI_KTLS_RX) && consumed == (ssize_t) available &&
+           ktls_ready(ssl) && !SSL_has_pending(ssl->ssl) && !ssl->in_count &&
+           !ssl->net_in_closed && !ssl->app_input_closed) {
+    ktls_start(transport, ssl, PNI_KTLS_RX);
   }
+#endif
   ssl_log(transport, "process_input_ssl() returning %d", (int) consumed);
   return consumed;
 }
@@ -1004,14 +2167,40 @@ static ssize_t process_output_ssl( pn_transport_t *transport, unsigned int layer
   if (!ssl) return PN_EOS;
   if (ssl->ssl == NULL && init_ssl_socket(transport, ssl)) return PN_EOS;
 
+  if (ssl->hs_offload) {
+    ssize_t result;
+    if (handshake_output(transport, ssl, buffer, max_len, &result)) return result;
+  }
+#ifdef PNI_KTLS
+  // and output only once every record openssl made is in the socket
+  if ((ssl->ktls_wanted & PNI_KTLS_TX) && ktls_ready(ssl) && !transport->output_pending &&
+      !pn_buffer_size(ssl->net_pending) && !ssl->out_count && !ssl->write_blocked &&
+      !SSL_want_write(ssl->ssl)) {
+    ktls_start(transport, ssl, PNI_KTLS_TX);
+  }
+  if (transport->kernel_tls & PNI_KTLS_TX) return ktls_output(transport, layer, buffer, max_len);
+#endif
+
   ssize_t written = 0;
   bool work_pending;
 
+  // anything made while there was nowhere to put it goes first, then the
+  // network BIO writes straight into the caller's buffer
+  size_t pending = pn_min(pn_buffer_size(ssl->net_pending), max_len);
+  if (pending) {
+    pn_buffer_get(ssl->net_pending, 0, pending, buffer);
+    pn_buffer_trim(ssl->net_pending, pending, 0);
+  }
+  ssl->net_out = buffer + pending;
+  ssl->net_out_size = max_len - pending;
+
   do {
     work_pending = false;
     // first, get any pending application output, if possible
 
-    if (!ssl->app_output_closed && ssl->out_count < ssl->out_size) {
+    // keep gathering until there is a full record or the app runs dry,
+    // so that bulk data goes out in as few records as possible
+    while (!ssl->app_output_closed && ssl->out_count < ssl->out_size) {
       ssize_t app_bytes = transport->io_layers[layer+1]->process_output(transport, layer+1, &ssl->outbuf[ssl->out_count], ssl->out_size - ssl->out_count);
       if (app_bytes > 0) {
         ssl->out_count += app_bytes;
@@ -1023,6 +2212,7 @@ static ssize_t process_output_ssl( pn_transport_t *transport, unsigned int layer
                (int) app_bytes, (int) ssl->out_count);
           ssl->app_output_closed = app_bytes;
         }
+        break;
       }
     }
 
@@ -1031,7 +2221,9 @@ static ssize_t process_output_ssl( pn_transport_t *transport, unsigned int layer
     if (!ssl->ssl_closed) {
       char *data = ssl->outbuf;
       if (ssl->out_count > 0) {
+        PNI_PROBE2(ssl_encrypt_start, transport, ssl->out_count);
         int wrote = BIO_write( ssl->bio_ssl, data, ssl->out_count );
+        PNI_PROBE2(ssl_encrypt_done, transport, wrote);
         if (wrote > 0) {
           data += wrote;
           ssl->out_count -= wrote;
@@ -1076,39 +2268,29 @@ static ssize_t process_output_ssl( pn_transport_t *transport, unsigned int layer
       }
     }
 
-    // read from the network bio as much as possible, filling the buffer
-    if (max_len) {
-      int available = BIO_read( ssl->bio_net_io, buffer, max_len );
-      if (available > 0) {
-        max_len -= available;
-        buffer += available;
-        written += available;
-        ssl->write_blocked = false;
-        work_pending = work_pending || max_len > 0;
-        ssl_log(transport, "Read %d bytes from BIO Layer", available );
-      }
-    }
-
   } while (work_pending);
 
+  written = max_len - ssl->net_out_size;
+  ssl->net_out = NULL;
+  ssl->net_out_size = 0;
+  if (written > 0) {
+    ssl->write_blocked = false;
+    ssl_log(transport, "Wrote %d bytes to the network", (int) written );
+  }
+
   //_log(ssl, "written=%d ssl_closed=%d in_count=%d app_input_closed=%d app_output_closed=%d bio_pend=%d",
-  //     written, ssl->ssl_closed, ssl->in_count, ssl->app_input_closed, ssl->app_output_closed, BIO_pending(ssl->bio_net_io) );
+  //     written, ssl->ssl_closed, ssl->in_count, ssl->app_input_closed, ssl->app_output_closed, pn_buffer_size(ssl->net_pending) );
 
   // PROTON-82: close the output side as soon as we've sent the SSL close_notify.
   // We're not requiring the response, as some implementations never reply.
   // ----
   // Once no more data is available "below" the SSL socket, tell the transport we are
   // done.
-  //if (written == 0 && ssl->ssl_closed && BIO_pending(ssl->bio_net_io) == 0) {
+  //if (written == 0 && ssl->ssl_closed && pn_buffer_size(ssl->net_pending) == 0) {
   //  written = ssl->app_output_closed ? ssl->app_output_closed : PN_EOS;
   //}
-  if (written == 0 && (SSL_get_shutdown(ssl->ssl) & SSL_SENT_SHUTDOWN) && BIO_pending(ssl->bio_net_io) == 0) {
-    written = ssl->app_output_closed ? ssl->app_output_closed : PN_EOS;
-    if (transport->io_layers[layer]==&ssl_input_closed_layer) {
-      transport->io_layers[layer] = &ssl_closed_layer;
-    } else {
-      transport->io_layers[layer] = &ssl_output_closed_layer;
-    }
+  if (written == 0 && (SSL_get_shutdown(ssl->ssl) & SSL_SENT_SHUTDOWN) && pn_buffer_size(ssl->net_pending) == 0) {
+    written = ssl_output_closed(transport, layer);
   }
   ssl_log(transport, "process_output_ssl() returning %d", (int) written);
   return written;
@@ -1119,6 +2301,19 @@ static int init_ssl_socket(pn_transport_t* transport, pni_ssl_t *ssl)
   if (ssl->ssl) return 0;
   if (!ssl->domain) return -1;
 
+  if (!ssl->outbuf) {
+    ssl->out_size = APP_BUF_SIZE;
+    ssl->outbuf = pni_io_alloc(transport, ssl->out_size);
+  }
+  if (!ssl->inbuf) {
+    ssl->in_size = APP_BUF_SIZE;
+    ssl->inbuf = pni_io_alloc(transport, ssl->in_size);
+  }
+  if (!ssl->outbuf || !ssl->inbuf) {
+    pn_transport_logf(transport, "SSL buffer allocation failure." );
+    return -1;
+  }
+
   ssl->ssl = SSL_new(ssl->domain->ctx);
   if (!ssl->ssl) {
     pn_transport_logf(transport, "SSL socket setup failure." );
@@ -1136,14 +2331,16 @@ static int init_ssl_socket(pn_transport_t* transport, pni_ssl_t *ssl)
 
   // restore session, if available
   if (ssl->session_id) {
+    pni_mutex_lock( ssl->domain->lock );
     pn_ssl_session_t *ssn = ssn_cache_find( ssl->domain, ssl->session_id );
+    if (ssn) ssn_cache_remove( ssl->domain, ssn );
+    pni_mutex_unlock( ssl->domain->lock );
     if (ssn) {
       ssl_log( transport, "Restoring previous session id=%s", ssn->id );
       int rc = SSL_set_session( ssl->ssl, ssn->session );
       if (rc != 1) {
         ssl_log( transport, "Session restore failed, id=%s", ssn->id );
       }
-      LL_REMOVE( ssl->domain, ssn_cache, ssn );
       ssl_session_free( ssn );
     }
   }
@@ -1156,11 +2353,14 @@ static int init_ssl_socket(pn_transport_t* transport, pni_ssl_t *ssl)
   }
   (void)BIO_set_ssl(ssl->bio_ssl, ssl->ssl, BIO_NOCLOSE);
 
-  // create the "lower" BIO "pipe", and attach it below the SSL layer
-  if (!BIO_new_bio_pair(&ssl->bio_ssl_io, 0, &ssl->bio_net_io, 0)) {
+  // create the "lower" BIO over the transport's buffers, and attach it below the SSL layer
+  if (!ssl->net_pending) ssl->net_pending = pn_buffer(0);
+  ssl->bio_ssl_io = transport_bio_method ? BIO_new(transport_bio_method) : NULL;
+  if (!ssl->bio_ssl_io || !ssl->net_pending) {
     pn_transport_log(transport, "BIO setup failure." );
     return -1;
   }
+  BIO_set_data(ssl->bio_ssl_io, ssl);
   SSL_set_bio(ssl->ssl, ssl->bio_ssl_io, ssl->bio_ssl_io);
 
   if (ssl->domain->mode == PN_SSL_MODE_SERVER) {
@@ -1172,6 +2372,22 @@ static int init_ssl_socket(pn_transport_t* transport, pni_ssl_t *ssl)
     BIO_set_ssl_mode(ssl->bio_ssl, 1);  // client mode
     ssl_log( transport, "Client SSL socket created." );
   }
+
+#ifdef PNI_KTLS
+  // a reactor may only give the transport its socket after this
+  if (ssl->domain->kernel_tls) {
+    ssl->ktls_wanted = PNI_KTLS_TX | PNI_KTLS_RX;
+    SSL_set_msg_callback(ssl->ssl, ktls_msg_cb);
+    SSL_set_msg_callback_arg(ssl->ssl, ssl);
+  }
+#endif
+
+  // the handshake can only be parked when something will wake us
+  if (ssl->domain->hs_thread_count && transport->wake) {
+    ssl->hs_offload = true;
+    ssl->hs_transport = transport;
+    ssl->hs_result = SSL_ERROR_WANT_READ;
+  }
   return 0;
 }
 
@@ -1183,10 +2399,8 @@ static void release_ssl_socket(pni_ssl_t *ssl)
   } else {
     if (ssl->bio_ssl_io) BIO_free(ssl->bio_ssl_io);
   }
-  if (ssl->bio_net_io) BIO_free(ssl->bio_net_io);
   ssl->bio_ssl = NULL;
   ssl->bio_ssl_io = NULL;
-  ssl->bio_net_io = NULL;
   ssl->ssl = NULL;
 }
 
@@ -1195,7 +2409,7 @@ static void release_ssl_socket(pni_ssl_t *ssl)
 pn_ssl_resume_status_t pn_ssl_resume_status(pn_ssl_t *ssl0)
 {
   pni_ssl_t *ssl = get_ssl_internal(ssl0);
-  if (!ssl || !ssl->ssl) return PN_SSL_RESUME_UNKNOWN;
+  if (!ssl || !ssl->ssl || handshake_running(ssl)) return PN_SSL_RESUME_UNKNOWN;
   switch (SSL_session_reused( ssl->ssl )) {
   case 0: return PN_SSL_RESUME_NEW;
   case 1: return PN_SSL_RESUME_REUSED;
@@ -1210,13 +2424,13 @@ int pn_ssl_set_peer_hostname(pn_ssl_t *ssl0, const char *hostname)
   pni_ssl_t *ssl = get_ssl_internal(ssl0);
   if (!ssl) return -1;
 
-  if (ssl->peer_hostname) free((void *)ssl->peer_hostname);
+  if (ssl->peer_hostname) pni_free(PN_ALLOC_TRANSPORT, (void *)ssl->peer_hostname);
   ssl->peer_hostname = NULL;
   if (hostname) {
     ssl->peer_hostname = pn_strdup(hostname);
     if (!ssl->peer_hostname) return -2;
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
-    if (ssl->ssl && ssl->domain && ssl->domain->mode == PN_SSL_MODE_CLIENT) {
+    if (ssl->ssl && ssl->domain && ssl->domain->mode == PN_SSL_MODE_CLIENT && !handshake_running(ssl)) {
       SSL_set_tlsext_host_name(ssl->ssl, ssl->peer_hostname);
     }
 #endif
@@ -1258,8 +2472,8 @@ static size_t buffered_output(pn_transport_t *transport)
   pni_ssl_t *ssl = transport->ssl;
   if (ssl) {
     count += ssl->out_count;
-    if (ssl->bio_net_io) { // pick up any bytes waiting for network io
-      count += BIO_ctrl_pending(ssl->bio_net_io);
+    if (ssl->net_pending && !handshake_running(ssl) && !(transport->kernel_tls & PNI_KTLS_TX)) { // pick up any bytes waiting for network io
+      count += pn_buffer_size(ssl->net_pending);
     }
   }
   return count;
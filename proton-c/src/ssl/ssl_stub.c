@@ -113,6 +113,41 @@ int pn_ssl_domain_set_peer_authentication(pn_ssl_domain_t *domain,
   return -1;
 }
 
+int pn_ssl_domain_set_session_cache_size(pn_ssl_domain_t *domain, size_t size)
+{
+  return -1;
+}
+
+uint64_t pn_ssl_domain_session_cache_hits(pn_ssl_domain_t *domain)
+{
+  return 0;
+}
+
+uint64_t pn_ssl_domain_session_cache_misses(pn_ssl_domain_t *domain)
+{
+  return 0;
+}
+
+int pn_ssl_domain_set_server_session_cache(pn_ssl_domain_t *domain, size_t size)
+{
+  return -1;
+}
+
+int pn_ssl_domain_add_session_ticket_key(pn_ssl_domain_t *domain, const char *key, size_t size)
+{
+  return -1;
+}
+
+int pn_ssl_domain_set_handshake_workers(pn_ssl_domain_t *domain, size_t count)
+{
+  return -1;
+}
+
+int pn_ssl_domain_set_kernel_tls(pn_ssl_domain_t *domain, bool enable)
+{
+  return -1;
+}
+
 int pn_ssl_domain_allow_unsecured_client(pn_ssl_domain_t *domain)
 {
   return -1;
@@ -0,0 +1,237 @@
+#!/usr/bin/env python
+
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+"""
+Runs the codec, engine and TCP benchmarks of two build trees, a
+baseline and a candidate, several times each and reports every result
+with its 95% confidence interval, marking the differences that are
+statistically significant (Welch's t-test at 95%). The runs of the two
+builds are interleaved, so that drift in the machine's speed affects
+both alike.
+
+  bench-compare.py -B ../baseline-build -C . -n 10
+"""
+
+from __future__ import print_function
+import json, math, optparse, os, re, socket, subprocess, sys
+
+usage = """
+Usage: bench-compare.py -B <baseline build> [-C <candidate build>] [OPTIONS]
+ -B <dir> \tThe build tree to compare against
+ -C <dir> \tThe build tree being measured [.]
+ -n # \tRuns of each benchmark in each build [5]
+ -w # \tRuns of each beforehand that are not counted [1]
+ -b <names> \tBenchmarks to run, of codec,engine,tcp [codec,engine,tcp]
+ -f <text> \tOnly codec benchmarks whose name contains <text>
+ -q \tRun each benchmark briefly, to check that the comparison works
+ -F # \tExit with 1 if anything is significantly worse by more than # percent"""
+
+# two sided critical values of Student's t for 95%, by degrees of freedom
+T95 = [12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+       2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+       2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042]
+
+def t95(df):
+    if df < 1:
+        return float("inf")
+    if df <= len(T95):
+        # rounding the degrees of freedom down errs on the side of caution
+        return T95[int(df) - 1]
+    return 1.96 + 2.4 / df
+
+
+class Sample(object):
+    def __init__(self, values):
+        self.n = len(values)
+        self.mean = sum(values) / float(self.n)
+        if self.n > 1:
+            self.var = sum((v - self.mean) ** 2 for v in values) / (self.n - 1)
+        else:
+            self.var = 0.0
+        self.ci = t95(self.n - 1) * math.sqrt(self.var / self.n)
+
+
+def significant(a, b):
+    """Welch's t-test of whether two samples' means differ."""
+    if a.n < 2 or b.n < 2:
+        return False
+    va, vb = a.var / a.n, b.var / b.n
+    if va + vb == 0:
+        return a.mean != b.mean
+    t = abs(b.mean - a.mean) / math.sqrt(va + vb)
+    df = (va + vb) ** 2 / (va ** 2 / (a.n - 1) + vb ** 2 / (b.n - 1))
+    return t > t95(df)
+
+
+def program(build, directory, name):
+    for sub in ["", "Release", "RelWithDebInfo", "Debug"]:
+        for exe in [name, name + ".exe"]:
+            path = os.path.join(build, directory, sub, exe)
+            if os.path.isfile(path):
+                return path
+    raise SystemExit("bench-compare: no %s in %s" % (name, os.path.join(build, directory)))
+
+
+def output(args):
+    process = subprocess.Popen(args, stdout=subprocess.PIPE)
+    out = process.communicate()[0].decode("utf-8", "replace")
+    if process.returncode:
+        raise SystemExit("bench-compare: %s failed with %d" % (" ".join(args), process.returncode))
+    return out
+
+
+# A benchmark runs in a build and returns its results by name, each a
+# value, its unit and whether lower is better
+
+class Codec(object):
+    name = "codec"
+
+    def __init__(self, opts):
+        self.args = ["-t", "20" if opts.quick else "250", "-j"]
+        if opts.filter:
+            self.args.append(opts.filter)
+
+    def run(self, build):
+        results = {}
+        bench = program(build, "proton-c/src/tests", "codec-bench")
+        for line in output([bench] + self.args).splitlines():
+            r = json.loads(line)
+            results["codec %s" % r["benchmark"]] = (r["ns_per_op"], "ns/op", True)
+        return results
+
+
+class Engine(object):
+    name = "engine"
+
+    def __init__(self, opts):
+        self.args = ["-n", "2000" if opts.quick else "100000", "-j"]
+
+    def run(self, build):
+        results = {}
+        bench = program(build, "proton-c/src/tests", "engine-bench")
+        # with and without the codec, which -r leaves out
+        for raw in [[], ["-r"]]:
+            for line in output([bench] + self.args + raw).splitlines():
+                r = json.loads(line)
+                name = "engine s=%d l=%d m=%d %s%s" % (r["sessions"], r["links"], r["size"],
+                                                        "settled" if r["settled"] else "unsettled",
+                                                        "" if r["codec"] else " raw")
+                results[name] = (r["ns_per_msg"], "ns/msg", True)
+        return results
+
+
+class Tcp(object):
+    name = "tcp"
+
+    def __init__(self, opts):
+        self.count = "2000" if opts.quick else "100000"
+
+    def run(self, build):
+        apps = "tests/tools/apps/c"
+        # a port that was free a moment ago
+        s = socket.socket()
+        s.bind(("127.0.0.1", 0))
+        address = "127.0.0.1:%d" % s.getsockname()[1]
+        s.close()
+
+        recv = subprocess.Popen([program(build, apps, "reactor-recv"), "-c", self.count,
+                                 "-a", address, "-X", "ready"], stdout=subprocess.PIPE)
+        recv.stdout.readline()
+        sent = output([program(build, apps, "reactor-send"), "-c", self.count, "-a", address])
+        received = recv.communicate()[0].decode("utf-8", "replace")
+        if recv.returncode:
+            raise SystemExit("bench-compare: reactor-recv failed with %d" % recv.returncode)
+
+        results = {}
+        m = re.search(r"Throughput: ([0-9.]+)", sent)
+        if m:
+            results["tcp throughput"] = (float(m.group(1)), "msgs/s", False)
+        m = re.search(r"latency \(usec\): p50 ([0-9]+) p99 ([0-9]+)", received)
+        if m:
+            results["tcp latency p50"] = (float(m.group(1)), "usec", True)
+            results["tcp latency p99"] = (float(m.group(2)), "usec", True)
+        return results
+
+
+BENCHMARKS = [Codec, Engine, Tcp]
+
+
+def parse_options(argv):
+    parser = optparse.OptionParser(usage=usage)
+    parser.add_option("-B", dest="baseline", type="string")
+    parser.add_option("-C", dest="candidate", type="string", default=".")
+    parser.add_option("-n", dest="runs", type="int", default=5)
+    parser.add_option("-w", dest="warmup", type="int", default=1)
+    parser.add_option("-b", dest="benchmarks", type="string", default="codec,engine,tcp")
+    parser.add_option("-f", dest="filter", type="string")
+    parser.add_option("-q", dest="quick", action="store_true")
+    parser.add_option("-F", dest="fail", type="float")
+    opts, args = parser.parse_args(args=argv)
+    if not opts.baseline:
+        parser.error("no baseline build, see -B")
+    if opts.runs < 2:
+        parser.error("a confidence interval needs at least 2 runs")
+    return opts
+
+
+def main(argv=None):
+    opts = parse_options(argv)
+    names = opts.benchmarks.split(",")
+    benches = [b(opts) for b in BENCHMARKS if b.name in names]
+    unknown = set(names) - set(b.name for b in BENCHMARKS)
+    if unknown:
+        raise SystemExit("bench-compare: no benchmark %s" % ", ".join(sorted(unknown)))
+    builds = [opts.baseline, opts.candidate]
+
+    values = [{}, {}]
+    units = {}
+    for run in range(opts.warmup + opts.runs):
+        print("run %d of %d%s" % (run + 1, opts.warmup + opts.runs,
+                                   " (warm up)" if run < opts.warmup else ""), file=sys.stderr)
+        for b in benches:
+            for i, build in enumerate(builds):
+                for name, (value, unit, lower) in b.run(build).items():
+                    units[name] = (unit, lower)
+                    if run >= opts.warmup:
+                        values[i].setdefault(name, []).append(value)
+
+    print("%-42s %-8s %21s %21s %9s" % ("benchmark", "unit", "baseline", "candidate", "change"))
+    worse = 0
+    for name in sorted(units):
+        if name not in values[0] or name not in values[1]:
+            continue
+        a, b = Sample(values[0][name]), Sample(values[1][name])
+        unit, lower = units[name]
+        change = (b.mean - a.mean) / a.mean * 100 if a.mean else 0.0
+        verdict = ""
+        if significant(a, b):
+            better = (change < 0) == lower
+            verdict = "better" if better else "worse"
+            if not better and opts.fail is not None and abs(change) > opts.fail:
+                worse += 1
+        line = "%-42s %-8s %11.1f +- %-6.1f %11.1f +- %-6.1f %+8.1f%% %s" % \
+            (name, unit, a.mean, a.ci, b.mean, b.ci, change, verdict)
+        print(line.rstrip())
+    return 1 if worse else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,316 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Times the codec on fixed corpora, e.g.
+ *
+ *   codec-bench [-t millis] [-j] [filter]
+ *
+ * runs every benchmark whose name contains filter for at least millis
+ * (250 by default) and reports ns, bytes and allocations per
+ * operation. With -j each benchmark is a line of JSON instead, for
+ * tracking the numbers over time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <proton/codec.h>
+#include <proton/message.h>
+#include "framing/framing.h"
+#include "platform.h"
+
+#define assert(E) ((E) ? 0 : (abort(), 0))
+
+// allocations are counted by taking over malloc where the C library
+// allows it, and not under a sanitizer which takes it over itself
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define COUNT_ALLOCATIONS 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static uint64_t allocations;
+
+void *malloc(size_t size)
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  allocations++;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+#else
+static uint64_t allocations;
+#endif
+
+typedef struct {
+  const char *name;
+  pn_message_t *message;
+  pn_data_t *data;        // the section of message the corpus is about
+  pn_message_t *decoded;
+  pn_data_t *scratch;
+  char *encoded;          // message encoded
+  size_t size;
+  char *buffer;
+  size_t capacity;
+} corpus_t;
+
+// an operation returns the number of bytes it produced or consumed
+typedef size_t (*op_t)(corpus_t *corpus);
+
+static size_t data_encode(corpus_t *corpus)
+{
+  ssize_t n = pn_data_encode(corpus->data, corpus->buffer, corpus->capacity);
+  assert(n > 0);
+  return n;
+}
+
+static size_t data_decode(corpus_t *corpus)
+{
+  // the section's encoding is the start of the buffer, see setup
+  ssize_t n = pn_data_encoded_size(corpus->data);
+  pn_data_clear(corpus->scratch);
+  assert(pn_data_decode(corpus->scratch, corpus->buffer, n) == n);
+  return n;
+}
+
+static size_t message_encode(corpus_t *corpus)
+{
+  size_t size = corpus->capacity;
+  assert(pn_message_encode(corpus->message, corpus->buffer, &size) == 0);
+  return size;
+}
+
+static size_t message_decode(corpus_t *corpus)
+{
+  assert(pn_message_decode(corpus->decoded, corpus->encoded, corpus->size) == 0);
+  return corpus->size;
+}
+
+static size_t fill_scan(corpus_t *corpus)
+{
+  // a transfer performative, as the engine builds and reads them
+  pn_data_t *data = corpus->scratch;
+  pn_data_clear(data);
+  assert(!pn_data_fill(data, "DL[IIzIoo]", (uint64_t) 0x14, 1, 42, (size_t) 5, "tag-1", 0,
+                       false, false));
+  uint32_t handle, id, format;
+  pn_bytes_t tag;
+  bool settled, more;
+  assert(!pn_data_scan(data, "D.[IIzIoo]", &handle, &id, &tag, &format, &settled, &more));
+  assert(handle == 1 && id == 42);
+  return 0;
+}
+
+static size_t frame_write(corpus_t *corpus)
+{
+  pn_frame_t frame = {0};
+  frame.payload = corpus->encoded;
+  frame.size = corpus->size;
+  size_t n = pn_write_frame(corpus->buffer, corpus->capacity, frame);
+  assert(n);
+  return n;
+}
+
+static size_t frame_read(corpus_t *corpus)
+{
+  // the buffer holds the frame frame_write wrote, see setup
+  pn_frame_t frame;
+  size_t n = pn_read_frame(&frame, corpus->buffer, corpus->size + 8);
+  assert(n == corpus->size + 8);
+  return n;
+}
+
+static void corpus_small(pn_message_t *msg, pn_data_t **data)
+{
+  pn_message_set_address(msg, "amqp://localhost/queue");
+  pn_message_set_subject(msg, "greeting");
+  pn_data_put_string(pn_message_body(msg), pn_bytes(5, "hello"));
+  *data = pn_message_body(msg);
+}
+
+static void corpus_properties(pn_message_t *msg, pn_data_t **data)
+{
+  pn_message_set_address(msg, "amqp://localhost/queue");
+  pn_data_t *properties = pn_message_properties(msg);
+  pn_data_put_map(properties);
+  pn_data_enter(properties);
+  for (int i = 0; i < 32; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "property-%d", i);
+    pn_data_put_string(properties, pn_bytes(strlen(key), key));
+    switch (i % 4) {
+    case 0: pn_data_put_int(properties, i); break;
+    case 1: pn_data_put_long(properties, (int64_t) i << 40); break;
+    case 2: pn_data_put_bool(properties, i % 3); break;
+    default: pn_data_put_string(properties, pn_bytes(strlen(key), key)); break;
+    }
+  }
+  pn_data_exit(properties);
+  pn_data_put_string(pn_message_body(msg), pn_bytes(5, "hello"));
+  *data = properties;
+}
+
+static void corpus_array(pn_message_t *msg, pn_data_t **data)
+{
+  int64_t values[4096];
+  for (int i = 0; i < 4096; i++) values[i] = (int64_t) i * 7919;
+  pn_data_t *body = pn_message_body(msg);
+  pn_data_put_array_values(body, PN_LONG, values, 4096);
+  *data = body;
+}
+
+static void corpus_binary(pn_message_t *msg, pn_data_t **data)
+{
+  static char bytes[64*1024];
+  for (size_t i = 0; i < sizeof(bytes); i++) bytes[i] = (char) i;
+  pn_message_set_address(msg, "amqp://localhost/queue");
+  pn_data_t *body = pn_message_body(msg);
+  pn_data_put_binary(body, pn_bytes(sizeof(bytes), bytes));
+  *data = body;
+}
+
+static void corpus_setup(corpus_t *corpus, const char *name,
+                         void (*build)(pn_message_t *, pn_data_t **))
+{
+  corpus->name = name;
+  corpus->message = pn_message();
+  build(corpus->message, &corpus->data);
+  corpus->decoded = pn_message();
+  corpus->scratch = pn_data(16);
+  corpus->capacity = 128*1024;
+  corpus->buffer = (char *) malloc(corpus->capacity);
+  corpus->encoded = (char *) malloc(corpus->capacity);
+  corpus->size = corpus->capacity;
+  assert(pn_message_encode(corpus->message, corpus->encoded, &corpus->size) == 0);
+}
+
+static void corpus_free(corpus_t *corpus)
+{
+  pn_message_free(corpus->message);
+  pn_message_free(corpus->decoded);
+  pn_data_free(corpus->scratch);
+  free(corpus->buffer);
+  free(corpus->encoded);
+}
+
+typedef struct {
+  const char *name;
+  op_t op;
+  op_t setup;  // leaves in the buffer what op expects there
+} bench_t;
+
+static const bench_t benches[] = {
+  {"data-encode", data_encode, NULL},
+  {"data-decode", data_decode, data_encode},
+  {"message-encode", message_encode, NULL},
+  {"message-decode", message_decode, NULL},
+  {"fill-scan", fill_scan, NULL},
+  {"frame-write", frame_write, NULL},
+  {"frame-read", frame_read, frame_write},
+};
+
+static void run(corpus_t *corpus, const bench_t *bench, uint64_t millis, bool json)
+{
+  if (bench->setup) bench->setup(corpus);
+  // warm up, then double the batch until it runs long enough
+  size_t bytes = bench->op(corpus);
+  uint64_t iterations = 1, elapsed, allocated;
+  for (;;) {
+    allocated = allocations;
+    uint64_t start = pn_i_nanos();
+    for (uint64_t i = 0; i < iterations; i++) {
+      bench->op(corpus);
+    }
+    elapsed = pn_i_nanos() - start;
+    allocated = allocations - allocated;
+    if (elapsed >= millis * 1000000 || iterations >= ((uint64_t) 1 << 40)) break;
+    iterations *= 2;
+  }
+
+  double ns = (double) elapsed / iterations;
+#ifdef COUNT_ALLOCATIONS
+  double allocs = (double) allocated / iterations;
+#else
+  double allocs = -1;
+#endif
+  if (json) {
+    printf("{\"benchmark\": \"%s/%s\", \"iterations\": %lu, \"ns_per_op\": %.1f, "
+           "\"bytes_per_op\": %lu, \"allocs_per_op\": %.2f}\n",
+           bench->name, corpus->name, (unsigned long) iterations, ns,
+           (unsigned long) bytes, allocs);
+  } else {
+    printf("%-16s %-12s %12.1f ns/op %10lu B/op %8.2f allocs/op\n",
+           bench->name, corpus->name, ns, (unsigned long) bytes, allocs);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t millis = 250;
+  bool json = false;
+  const char *filter = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      millis = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-j")) {
+      json = true;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "usage: %s [-t millis] [-j] [filter]\n", argv[0]);
+      return 1;
+    } else {
+      filter = argv[i];
+    }
+  }
+
+  corpus_t corpora[4];
+  corpus_setup(&corpora[0], "small", corpus_small);
+  corpus_setup(&corpora[1], "properties", corpus_properties);
+  corpus_setup(&corpora[2], "array", corpus_array);
+  corpus_setup(&corpora[3], "binary", corpus_binary);
+
+  for (size_t b = 0; b < sizeof(benches)/sizeof(benches[0]); b++) {
+    for (size_t c = 0; c < 4; c++) {
+      // one corpus is enough for the fixed performative
+      if (benches[b].op == fill_scan && c) continue;
+      char name[64];
+      snprintf(name, sizeof(name), "%s/%s", benches[b].name, corpora[c].name);
+      if (filter && !strstr(name, filter)) continue;
+      run(&corpora[c], &benches[b], millis, json);
+    }
+  }
+
+  for (size_t c = 0; c < 4; c++) {
+    corpus_free(&corpora[c]);
+  }
+  return 0;
+}
@@ -0,0 +1,384 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Sends messages between two transports wired back to back in memory,
+ * so only the engine, the transport and the codec are measured:
+ *
+ *   engine-bench [-n messages] [-s sessions] [-l links] [-m sizes]
+ *                [-S modes] [-w credit] [-c capacity] [-r] [-j]
+ *
+ * Every option but -n, -r and -j takes a comma separated list and
+ * each combination is run in turn:
+ *
+ *   -s  sessions per connection (1)
+ *   -l  links per session (1)
+ *   -m  message body sizes in bytes (16,1024)
+ *   -S  settled, where the sender settles up front, or unsettled,
+ *       where the receiver accepts and settles (settled,unsettled)
+ *   -w  credit the receivers keep topped up (1000)
+ *   -c  incoming capacity of the receiving sessions in bytes, 0 for
+ *       the default (0)
+ *
+ * With -r the bodies are sent as they are rather than as encoded
+ * messages, which leaves the codec out. With -j each run is reported
+ * as a line of JSON. A library built with ENABLE_ALLOCATION_TRACKING
+ * also has its allocations per message reported by subsystem.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <proton/alloc.h>
+#include <proton/engine.h>
+#include <proton/message.h>
+#include "platform.h"
+
+#define assert(E) ((E) ? 0 : (abort(), 0))
+
+#define MAX_VALUES (16)
+
+typedef struct {
+  long values[MAX_VALUES];
+  int count;
+} option_t;
+
+typedef struct {
+  long messages;
+  long sessions;
+  long links;
+  long size;
+  bool settled;
+  long credit;
+  long capacity;
+  bool raw;
+} config_t;
+
+static uint64_t cycles(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static int xfer(pn_transport_t *src, pn_transport_t *dest)
+{
+  ssize_t out = pn_transport_pending(src);
+  if (out <= 0) return 0;
+  ssize_t in = pn_transport_capacity(dest);
+  if (in <= 0) return 0;
+  size_t count = (size_t) (out < in ? out : in);
+  pn_transport_push(dest, pn_transport_head(src), count);
+  pn_transport_pop(src, count);
+  return (int) count;
+}
+
+static void pump(pn_transport_t *t1, pn_transport_t *t2)
+{
+  while (xfer(t1, t2) + xfer(t2, t1));
+}
+
+static void open_endpoints(pn_connection_t *conn)
+{
+  for (pn_session_t *ssn = pn_session_head(conn, PN_LOCAL_UNINIT); ssn;
+       ssn = pn_session_next(ssn, PN_LOCAL_UNINIT)) {
+    pn_session_open(ssn);
+  }
+  for (pn_link_t *link = pn_link_head(conn, PN_LOCAL_UNINIT); link;
+       link = pn_link_next(link, PN_LOCAL_UNINIT)) {
+    pn_link_open(link);
+  }
+}
+
+typedef struct {
+  double seconds;
+  double cpu;
+  uint64_t cycles;
+  uint64_t allocations[PN_ALLOC_SUBSYSTEMS];
+} result_t;
+
+static void count_allocations(uint64_t *allocations)
+{
+  for (int i = 0; i < PN_ALLOC_SUBSYSTEMS; i++) {
+    pn_alloc_counters_t counters;
+    pn_alloc_counters((pn_alloc_subsystem_t) i, &counters);
+    allocations[i] = counters.allocations + counters.reallocations;
+  }
+}
+
+static result_t run(const config_t *config)
+{
+  pn_connection_t *c1 = pn_connection();
+  pn_transport_t *t1 = pn_transport();
+  pn_transport_bind(t1, c1);
+  pn_connection_t *c2 = pn_connection();
+  pn_transport_t *t2 = pn_transport();
+  pn_transport_set_server(t2);
+  pn_transport_bind(t2, c2);
+
+  pn_connection_open(c1);
+  pn_connection_open(c2);
+  size_t nlinks = config->sessions * config->links;
+  pn_link_t **senders = (pn_link_t **) malloc(nlinks * sizeof(pn_link_t *));
+  for (long s = 0; s < config->sessions; s++) {
+    pn_session_t *ssn = pn_session(c1);
+    pn_session_open(ssn);
+    for (long l = 0; l < config->links; l++) {
+      char name[64];
+      snprintf(name, sizeof(name), "link-%ld-%ld", s, l);
+      pn_link_t *link = pn_sender(ssn, name);
+      pn_link_set_snd_settle_mode(link, config->settled ? PN_SND_SETTLED : PN_SND_UNSETTLED);
+      pn_link_open(link);
+      senders[s * config->links + l] = link;
+    }
+  }
+  pump(t1, t2);
+  for (pn_session_t *ssn = pn_session_head(c2, PN_LOCAL_UNINIT); ssn;
+       ssn = pn_session_next(ssn, PN_LOCAL_UNINIT)) {
+    if (config->capacity) pn_session_set_incoming_capacity(ssn, config->capacity);
+  }
+  open_endpoints(c2);
+  for (pn_link_t *link = pn_link_head(c2, PN_LOCAL_ACTIVE); link;
+       link = pn_link_next(link, PN_LOCAL_ACTIVE)) {
+    pn_link_flow(link, config->credit);
+  }
+  pump(t1, t2);
+
+  // what goes on the wire for each message
+  char *body = (char *) calloc(1, config->size);
+  size_t size = config->size + 256;
+  char *encoded = (char *) malloc(size);
+  char *received = (char *) malloc(size);
+  pn_message_t *msg = pn_message();
+  pn_message_t *decoded = pn_message();
+  pn_message_set_address(msg, "amqp://localhost/queue");
+
+  result_t result;
+  count_allocations(result.allocations);
+  clock_t cpu = clock();
+  uint64_t start = pn_i_nanos();
+  uint64_t tsc = cycles();
+
+  long sent = 0, delivered = 0;
+  while (delivered < config->messages) {
+    for (size_t i = 0; i < nlinks && sent < config->messages; i++) {
+      pn_link_t *link = senders[i];
+      while (pn_link_credit(link) > 0 && sent < config->messages) {
+        pn_delivery_t *d = pn_delivery(link, pn_dtag((const char *) &sent, sizeof(sent)));
+        if (config->raw) {
+          pn_link_send(link, body, config->size);
+        } else {
+          pn_data_t *data = pn_message_body(msg);
+          pn_data_clear(data);
+          pn_data_put_binary(data, pn_bytes(config->size, body));
+          size_t n = size;
+          assert(pn_message_encode(msg, encoded, &n) == 0);
+          pn_link_send(link, encoded, n);
+        }
+        pn_link_advance(link);
+        if (config->settled) pn_delivery_settle(d);
+        sent++;
+      }
+    }
+    pump(t1, t2);
+
+    pn_delivery_t *d = pn_work_head(c2);
+    while (d) {
+      pn_delivery_t *next = pn_work_next(d);
+      if (pn_delivery_readable(d) && !pn_delivery_partial(d)) {
+        pn_link_t *link = pn_delivery_link(d);
+        ssize_t n = pn_link_recv(link, received, size);
+        assert(n >= 0);
+        if (!config->raw) {
+          assert(pn_message_decode(decoded, received, n) == 0);
+        }
+        pn_link_advance(link);
+        if (!config->settled) pn_delivery_update(d, PN_ACCEPTED);
+        pn_delivery_settle(d);
+        delivered++;
+        int credit = pn_link_credit(link);
+        if (credit < config->credit / 2) pn_link_flow(link, config->credit - credit);
+      }
+      d = next;
+    }
+    pump(t1, t2);
+
+    if (!config->settled) {
+      d = pn_work_head(c1);
+      while (d) {
+        pn_delivery_t *next = pn_work_next(d);
+        if (pn_delivery_updated(d) && pn_delivery_remote_state(d)) {
+          pn_delivery_settle(d);
+        }
+        d = next;
+      }
+    }
+  }
+  // let the last dispositions through as well
+  pump(t1, t2);
+
+  result.cycles = cycles() - tsc;
+  result.seconds = (pn_i_nanos() - start) / 1e9;
+  result.cpu = (double) (clock() - cpu) / CLOCKS_PER_SEC;
+  uint64_t allocations[PN_ALLOC_SUBSYSTEMS];
+  count_allocations(allocations);
+  for (int i = 0; i < PN_ALLOC_SUBSYSTEMS; i++) {
+    result.allocations[i] = allocations[i] - result.allocations[i];
+  }
+
+  pn_message_free(msg);
+  pn_message_free(decoded);
+  free(body);
+  free(encoded);
+  free(received);
+  free(senders);
+  pn_transport_unbind(t1);
+  pn_transport_free(t1);
+  pn_connection_free(c1);
+  pn_transport_unbind(t2);
+  pn_transport_free(t2);
+  pn_connection_free(c2);
+  return result;
+}
+
+static bool parse_list(const char *arg, option_t *option)
+{
+  option->count = 0;
+  while (*arg && option->count < MAX_VALUES) {
+    long value;
+    const char *end = strchr(arg, ',');
+    size_t length = end ? (size_t) (end - arg) : strlen(arg);
+    if (length == 7 && !strncmp(arg, "settled", 7)) {
+      value = 1;
+    } else if (length == 9 && !strncmp(arg, "unsettled", 9)) {
+      value = 0;
+    } else {
+      char *stop;
+      value = strtol(arg, &stop, 10);
+      if (stop != arg + length || value < 0) return false;
+    }
+    option->values[option->count++] = value;
+    arg += length + (end ? 1 : 0);
+  }
+  return option->count > 0;
+}
+
+static void usage(const char *program)
+{
+  fprintf(stderr, "usage: %s [-n messages] [-s sessions] [-l links] [-m sizes] "
+          "[-S settled,unsettled] [-w credit] [-c capacity] [-r] [-j]\n", program);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  long messages = 200000;
+  bool raw = false, json = false;
+  option_t sessions = {{1}, 1}, links = {{1}, 1}, sizes = {{16, 1024}, 2};
+  option_t modes = {{1, 0}, 2}, credits = {{1000}, 1}, capacities = {{0}, 1};
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (!strcmp(arg, "-r")) {
+      raw = true;
+    } else if (!strcmp(arg, "-j")) {
+      json = true;
+    } else if (arg[0] == '-' && arg[1] && !arg[2] && i + 1 < argc) {
+      const char *value = argv[++i];
+      option_t *option = NULL;
+      switch (arg[1]) {
+      case 'n': messages = strtol(value, NULL, 10); break;
+      case 's': option = &sessions; break;
+      case 'l': option = &links; break;
+      case 'm': option = &sizes; break;
+      case 'S': option = &modes; break;
+      case 'w': option = &credits; break;
+      case 'c': option = &capacities; break;
+      default: usage(argv[0]);
+      }
+      if (option && !parse_list(value, option)) usage(argv[0]);
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (messages <= 0) usage(argv[0]);
+
+  for (int s = 0; s < sessions.count; s++)
+  for (int l = 0; l < links.count; l++)
+  for (int m = 0; m < sizes.count; m++)
+  for (int S = 0; S < modes.count; S++)
+  for (int w = 0; w < credits.count; w++)
+  for (int c = 0; c < capacities.count; c++) {
+    config_t config;
+    config.messages = messages;
+    config.sessions = sessions.values[s] ? sessions.values[s] : 1;
+    config.links = links.values[l] ? links.values[l] : 1;
+    config.size = sizes.values[m];
+    config.settled = modes.values[S];
+    config.credit = credits.values[w] ? credits.values[w] : 1;
+    config.capacity = capacities.values[c];
+    config.raw = raw;
+
+    result_t result = run(&config);
+    double rate = messages / result.seconds;
+    double ns = result.seconds * 1e9 / messages;
+    double cpu = result.cpu * 1e9 / messages;
+    double per = result.cycles ? (double) result.cycles / messages : -1;
+    if (json) {
+      printf("{\"sessions\": %ld, \"links\": %ld, \"size\": %ld, \"settled\": %s, "
+             "\"credit\": %ld, \"capacity\": %ld, \"codec\": %s, \"messages\": %ld, "
+             "\"msgs_per_sec\": %.0f, \"ns_per_msg\": %.1f, \"cpu_ns_per_msg\": %.1f, "
+             "\"cycles_per_msg\": %.0f",
+             config.sessions, config.links, config.size, config.settled ? "true" : "false",
+             config.credit, config.capacity, raw ? "false" : "true", messages,
+             rate, ns, cpu, per);
+      if (pn_alloc_tracking()) {
+        printf(", \"allocs_per_msg\": {");
+        for (int i = 0; i < PN_ALLOC_SUBSYSTEMS; i++) {
+          printf("%s\"%s\": %.3f", i ? ", " : "", pn_alloc_subsystem_name((pn_alloc_subsystem_t) i),
+                 (double) result.allocations[i] / messages);
+        }
+        printf("}");
+      }
+      printf("}\n");
+    } else {
+      printf("sessions=%ld links=%ld size=%ld %s credit=%ld capacity=%ld: "
+             "%.0f msgs/s %.1f ns/msg %.1f cpu ns/msg %.0f cycles/msg\n",
+             config.sessions, config.links, config.size,
+             config.settled ? "settled" : "unsettled", config.credit, config.capacity,
+             rate, ns, cpu, per);
+      if (pn_alloc_tracking()) {
+        printf("  allocations/msg:");
+        for (int i = 0; i < PN_ALLOC_SUBSYSTEMS; i++) {
+          if (!result.allocations[i]) continue;
+          printf(" %s %.3f", pn_alloc_subsystem_name((pn_alloc_subsystem_t) i),
+                 (double) result.allocations[i] / messages);
+        }
+        printf("\n");
+      }
+    }
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -24,6 +24,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <proton/engine.h>
+#include <proton/connection_driver.h>
+#include <proton/log.h>
+#include <proton/sasl.h>
+#include "encodings.h"
+#include "protocol.h"
+#include "transport/performatives.h"
 
 // never remove 'assert()'
 #undef NDEBUG
@@ -293,17 +299,2690 @@ int test_free_link(int argc, char **argv)
 
     return 0;
 }
+// settle every delivery received so far, other than the one to hold
+static void settle_received(pn_link_t *rx, pn_delivery_t **held)
+{
+    pn_delivery_t *d;
+    while ((d = pn_link_current(rx)) && !pn_delivery_partial(d)) {
+        pn_link_advance(rx);
+        if (!*held) {
+            *held = d;
+        } else {
+            pn_delivery_update(d, PN_ACCEPTED);
+            pn_delivery_settle(d);
+        }
+    }
+}
+
+// count and settle the sender's deliveries the peer has settled
+static int count_settled(pn_connection_t *c)
+{
+    int settled = 0;
+    pn_delivery_t *d = pn_work_head(c);
+    while (d) {
+        pn_delivery_t *next = pn_work_next(d);
+        if (pn_link_is_sender(pn_delivery_link(d)) && pn_delivery_settled(d)) {
+            assert(pn_delivery_remote_state(d) == PN_ACCEPTED);
+            pn_delivery_settle(d);
+            settled++;
+        }
+        d = next;
+    }
+    return settled;
+}
+
+// deliveries settled out of order, with one of them held unsettled
+// while a great many others come and go, are all still found by their
+// dispositions
+int test_settle_out_of_order(int argc, char **argv)
+{
+    fprintf(stdout, "test_settle_out_of_order\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(tx);
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(rx);
+
+    const int count = 70000;
+    pn_link_flow(rx, count);
+    pump(t1, t2);
+
+    pn_delivery_t *held = NULL;
+    int settled = 0;
+    for (int i = 0; i < count; i++) {
+        char tag[16];
+        snprintf(tag, sizeof(tag), "%d", i);
+        pn_delivery(tx, pn_dtag(tag, strlen(tag)));
+        pn_link_send(tx, "x", 1);
+        pn_link_advance(tx);
+        if (i % 1000 == 999 || i == count - 1) {
+            pump(t1, t2);
+            settle_received(rx, &held);
+            pump(t1, t2);
+            settled += count_settled(c1);
+        }
+    }
+    assert(held);
+    assert(settled == count - 1);
+
+    pn_delivery_update(held, PN_ACCEPTED);
+    pn_delivery_settle(held);
+    pump(t1, t2);
+    assert(count_settled(c1) == 1);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+
+static int dispositions;
+
+static void count_dispositions(pn_transport_t *transport, const char *message)
+{
+    if (strstr(message, "@disposition")) {
+        dispositions++;
+    }
+}
+
+// settling a run of deliveries at once acknowledges them with a single
+// ranged disposition
+int test_settle_upto(int argc, char **argv)
+{
+    fprintf(stdout, "test_settle_upto\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(tx);
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(rx);
+
+    const int count = 100;
+    pn_link_flow(rx, count);
+    pump(t1, t2);
+    for (int i = 0; i < count; i++) {
+        char tag[16];
+        snprintf(tag, sizeof(tag), "%d", i);
+        pn_delivery(tx, pn_dtag(tag, strlen(tag)));
+        pn_link_send(tx, "x", 1);
+        pn_link_advance(tx);
+    }
+    pump(t1, t2);
+
+    pn_delivery_t *received[100];
+    for (int i = 0; i < count; i++) {
+        received[i] = pn_link_current(rx);
+        assert(received[i] && !pn_delivery_partial(received[i]));
+        pn_link_advance(rx);
+    }
+
+    pn_transport_trace(t2, PN_TRACE_FRM);
+    pn_transport_set_tracer(t2, count_dispositions);
+
+    dispositions = 0;
+    assert(pn_link_settle_upto(rx, received[59], PN_ACCEPTED) == 60);
+    assert(pn_link_unsettled(rx) == count - 60);
+    pump(t1, t2);
+    assert(dispositions == 1);
+    assert(count_settled(c1) == 60);
+
+    dispositions = 0;
+    assert(pn_link_settle_upto(rx, received[count - 1], PN_ACCEPTED) == (size_t) (count - 60));
+    pump(t1, t2);
+    assert(dispositions == 1);
+    assert(count_settled(c1) == count - 60);
+    assert(pn_link_unsettled(rx) == 0);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// deliveries settled in a scrambled order, as by parallel workers,
+// still go out as one disposition per outcome
+int test_settle_scrambled(int argc, char **argv)
+{
+    fprintf(stdout, "test_settle_scrambled\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(tx);
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(rx);
+
+    const int count = 100;
+    pn_link_flow(rx, count);
+    pump(t1, t2);
+    for (int i = 0; i < count; i++) {
+        char tag[16];
+        snprintf(tag, sizeof(tag), "%d", i);
+        pn_delivery(tx, pn_dtag(tag, strlen(tag)));
+        pn_link_send(tx, "x", 1);
+        pn_link_advance(tx);
+    }
+    pump(t1, t2);
+
+    pn_delivery_t *received[100];
+    for (int i = 0; i < count; i++) {
+        received[i] = pn_link_current(rx);
+        pn_link_advance(rx);
+    }
+
+    pn_transport_trace(t2, PN_TRACE_FRM);
+    pn_transport_set_tracer(t2, count_dispositions);
+
+    // every seventh delivery first, then the rest backwards
+    dispositions = 0;
+    for (int i = 0; i < count; i += 7) {
+        pn_delivery_update(received[i], PN_ACCEPTED);
+        pn_delivery_settle(received[i]);
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        if (i % 7) {
+            pn_delivery_update(received[i], PN_ACCEPTED);
+            pn_delivery_settle(received[i]);
+        }
+    }
+    pump(t1, t2);
+    assert(dispositions == 1);
+    assert(count_settled(c1) == count);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// outcomes that carry a condition or annotations reach the sender,
+// and those that don't leave the dispositions empty
+int test_disposition_outcomes(int argc, char **argv)
+{
+    fprintf(stdout, "test_disposition_outcomes\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(tx);
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(rx);
+
+    pn_link_flow(rx, 3);
+    pump(t1, t2);
+    pn_delivery_t *sent[3];
+    for (int i = 0; i < 3; i++) {
+        char tag = (char) ('a' + i);
+        sent[i] = pn_delivery(tx, pn_dtag(&tag, 1));
+        pn_link_send(tx, "x", 1);
+        pn_link_advance(tx);
+    }
+    pump(t1, t2);
+
+    pn_delivery_t *received[3];
+    for (int i = 0; i < 3; i++) {
+        received[i] = pn_link_current(rx);
+        assert(received[i]);
+        pn_link_advance(rx);
+    }
+    pn_delivery_update(received[0], PN_ACCEPTED);
+    pn_condition_t *cond = pn_disposition_condition(pn_delivery_local(received[1]));
+    pn_condition_set_name(cond, "amqp:invalid-field");
+    pn_condition_set_description(cond, "no good");
+    pn_data_put_map(pn_condition_info(cond));
+    pn_delivery_update(received[1], PN_REJECTED);
+    pn_disposition_t *local = pn_delivery_local(received[2]);
+    pn_disposition_set_failed(local, true);
+    pn_data_t *annotations = pn_disposition_annotations(local);
+    pn_data_put_map(annotations);
+    pn_data_enter(annotations);
+    pn_data_put_symbol(annotations, pn_bytes(3, "key"));
+    pn_data_put_int(annotations, 7);
+    pn_data_exit(annotations);
+    pn_delivery_update(received[2], PN_MODIFIED);
+    pump(t1, t2);
+
+    pn_disposition_t *remote = pn_delivery_remote(sent[0]);
+    assert(pn_disposition_type(remote) == PN_ACCEPTED);
+    assert(!pn_condition_is_set(pn_disposition_condition(remote)));
+    assert(!pn_condition_get_description(pn_disposition_condition(remote)));
+    assert(pn_data_size(pn_disposition_annotations(remote)) == 0);
+
+    remote = pn_delivery_remote(sent[1]);
+    assert(pn_disposition_type(remote) == PN_REJECTED);
+    cond = pn_disposition_condition(remote);
+    assert(!strcmp(pn_condition_get_name(cond), "amqp:invalid-field"));
+    assert(!strcmp(pn_condition_get_description(cond), "no good"));
+    pn_data_t *info = pn_condition_info(cond);
+    assert(pn_data_next(info) && pn_data_type(info) == PN_MAP);
+
+    remote = pn_delivery_remote(sent[2]);
+    assert(pn_disposition_type(remote) == PN_MODIFIED);
+    assert(pn_disposition_is_failed(remote) && !pn_disposition_is_undeliverable(remote));
+    annotations = pn_disposition_annotations(remote);
+    pn_data_rewind(annotations);
+    assert(pn_data_next(annotations) && pn_data_type(annotations) == PN_MAP);
+    assert(pn_data_get_map(annotations) == 2);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// short tags are held in the delivery and long ones on the heap, and
+// either kind survives the delivery being pooled and reused
+int test_delivery_tags(int argc, char **argv)
+{
+    fprintf(stdout, "test_delivery_tags\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(tx);
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(rx);
+
+    const size_t sizes[] = {1, 8, 16, 17, 32, 5, 100, 2};
+    const size_t count = sizeof(sizes)/sizeof(sizes[0]);
+    pn_link_flow(rx, count);
+    pump(t1, t2);
+    char tag[100];
+    for (size_t i = 0; i < count; i++) {
+        memset(tag, 'a' + i, sizes[i]);
+        pn_delivery_t *d = pn_delivery(tx, pn_dtag(tag, sizes[i]));
+        pn_delivery_tag_t t = pn_delivery_tag(d);
+        assert(t.size == sizes[i] && !memcmp(t.start, tag, t.size) && t.start != tag);
+        pn_link_send(tx, "x", 1);
+        pn_link_advance(tx);
+        pump(t1, t2);
+
+        pn_delivery_t *r = pn_link_current(rx);
+        assert(r);
+        t = pn_delivery_tag(r);
+        assert(t.size == sizes[i] && !memcmp(t.start, tag, t.size));
+        pn_link_advance(rx);
+        pn_delivery_update(r, PN_ACCEPTED);
+        pn_delivery_settle(r);
+        pump(t1, t2);
+        assert(count_settled(c1) == 1);
+    }
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+static unsigned max_handle;
+
+static void track_handles(pn_transport_t *transport, const char *message)
+{
+    const char *attach = strstr(message, "-> @attach");
+    const char *handle = attach ? strstr(attach, "handle=") : NULL;
+    if (handle) {
+        unsigned h = (unsigned) strtoul(handle + strlen("handle="), NULL, 10);
+        if (h > max_handle) max_handle = h;
+    }
+}
+
+// handles of detached links are given to the links attached after them
+int test_link_handles(int argc, char **argv)
+{
+    fprintf(stdout, "test_link_handles\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+    pn_session_t *s1 = pn_session_head(c1, PN_LOCAL_ACTIVE);
+    pn_transport_trace(t1, PN_TRACE_FRM);
+    pn_transport_set_tracer(t1, track_handles);
+
+    const int count = 200;
+    pn_link_t *links[200];
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < count; i++) {
+            if (round && i % 2) continue;
+            char name[16];
+            snprintf(name, sizeof(name), "link-%d-%d", round, i);
+            links[i] = pn_sender(s1, name);
+            pn_link_open(links[i]);
+        }
+        while (pump(t1, t2)) {
+            process_endpoints(c1);
+            process_endpoints(c2);
+        }
+        for (int i = 0; i < count; i++) {
+            assert(pn_link_state(links[i]) == (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+        }
+        // the first link is the one test_setup opened
+        assert(max_handle == (unsigned) count);
+
+        for (int i = 0; i < count; i += 2) {
+            pn_link_close(links[i]);
+        }
+        while (pump(t1, t2)) {
+            process_endpoints(c1);
+            process_endpoints(c2);
+        }
+        for (int i = 0; i < count; i += 2) {
+            assert(pn_link_state(links[i]) == (PN_LOCAL_CLOSED | PN_REMOTE_CLOSED));
+            pn_link_free(links[i]);
+        }
+    }
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// adopted bytes follow those already buffered and are released as soon
+// as they have been framed, or early when they have to be copied in
+static int released;
+
+static void count_release(void *context)
+{
+    released++;
+    free(context);
+}
+
+int test_link_adopt(int argc, char **argv)
+{
+    fprintf(stdout, "test_link_adopt\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(tx);
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(rx);
+    pn_link_flow(rx, 10);
+    pump(t1, t2);
+
+    // larger than a frame so it goes out in several
+    const size_t size = 100000;
+    char *body = (char *) malloc(size);
+    for (size_t i = 0; i < size; i++) body[i] = (char) i;
+
+    released = 0;
+    pn_delivery(tx, pn_dtag("adopt", 5));
+    assert(pn_link_send(tx, "head", 4) == 4);
+    assert(pn_link_adopt(tx, body, size, count_release, body) == (ssize_t) size);
+    assert(pn_delivery_pending(pn_link_current(tx)) == size + 4);
+    pn_link_advance(tx);
+    assert(!released);
+    pump(t1, t2);
+    assert(released == 1);
+
+    pn_delivery_t *d = pn_link_current(rx);
+    assert(d && !pn_delivery_partial(d));
+    assert(pn_delivery_pending(d) == size + 4);
+    char *got = (char *) malloc(size + 4);
+    assert(pn_link_recv(rx, got, size + 4) == (ssize_t) (size + 4));
+    assert(!memcmp(got, "head", 4));
+    for (size_t i = 0; i < size; i++) assert(got[i + 4] == (char) i);
+    free(got);
+    pn_delivery_settle(d);
+
+    // sending behind an adopted buffer copies it in first
+    released = 0;
+    char *copied = (char *) malloc(3);
+    memcpy(copied, "abc", 3);
+    pn_delivery(tx, pn_dtag("spill", 5));
+    assert(pn_link_adopt(tx, copied, 3, count_release, copied) == 3);
+    assert(pn_link_send(tx, "d", 1) == 1);
+    assert(released == 1);
+    pn_link_advance(tx);
+    pump(t1, t2);
+
+    d = pn_link_current(rx);
+    char buf[8];
+    assert(d && pn_link_recv(rx, buf, sizeof(buf)) == 4);
+    assert(!memcmp(buf, "abcd", 4));
+
+    // a delivery dropped before sending still releases its bytes
+    released = 0;
+    char *dropped = (char *) malloc(3);
+    pn_delivery(tx, pn_dtag("drop", 4));
+    assert(pn_link_adopt(tx, dropped, 3, count_release, dropped) == 3);
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+    assert(released == 1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// a file body is read a window at a time as it is framed, after what
+// was sent ahead of it, and nothing can be queued behind it
+int test_link_send_file(int argc, char **argv)
+{
+    fprintf(stdout, "test_link_send_file\n");
+    const size_t size = 3*1024*1024 + 123;
+    const size_t offset = 1000;  // not on a page
+    FILE *file = tmpfile();
+    assert(file);
+    for (size_t i = 0; i < offset + size + 10; i++) fputc((char) (i % 251), file);
+    assert(!fflush(file));
+    int fd = fileno(file);
+
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(tx);
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    assert(rx);
+    pn_link_flow(rx, 10);
+    pump(t1, t2);
+
+    pn_delivery(tx, pn_dtag("file", 4));
+    assert(pn_link_send_file(tx, fd, offset, size + 11) == PN_ARG_ERR);
+    assert(pn_link_send(tx, "head", 4) == 4);
+    assert(pn_link_send_file(tx, fd, offset, size) == (ssize_t) size);
+    assert(pn_delivery_pending(pn_link_current(tx)) == size + 4);
+    assert(pn_link_send(tx, "tail", 4) == PN_STATE_ERR);
+    assert(pn_link_send_file(tx, fd, 0, 1) == PN_STATE_ERR);
+    pn_link_advance(tx);
+
+    char *got = (char *) malloc(size + 4);
+    size_t count = 0;
+    pn_delivery_t *d = NULL;
+    do {
+        pump(t1, t2);
+        d = pn_link_current(rx);
+        assert(d);
+        ssize_t n = pn_link_recv(rx, got + count, size + 4 - count);
+        if (n > 0) count += n;
+    } while (count < size + 4 || pn_delivery_partial(d));
+    assert(count == size + 4);
+    assert(!memcmp(got, "head", 4));
+    for (size_t i = 0; i < size; i++) assert(got[i + 4] == (char) ((offset + i) % 251));
+    free(got);
+    pn_delivery_settle(d);
+
+    // a delivery dropped before sending closes its copy of the file
+    pn_delivery(tx, pn_dtag("drop", 4));
+    assert(pn_link_send_file(tx, fd, 0, size) == (ssize_t) size);
+    fclose(file);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// the connection lists only the links with work, and each link its own
+// deliveries, which are the ones the connection wide walk finds
+int test_work_links(int argc, char **argv)
+{
+    fprintf(stdout, "test_work_links\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+    pn_session_t *s1 = pn_session_head(c1, PN_LOCAL_ACTIVE);
+    pn_link_t *senders[3];
+    senders[0] = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    senders[1] = pn_sender(s1, "work-1");
+    senders[2] = pn_sender(s1, "work-2");
+    pn_link_open(senders[1]);
+    pn_link_open(senders[2]);
+    while (pump(t1, t2)) {
+        process_endpoints(c1);
+        process_endpoints(c2);
+    }
+    pn_link_t *receivers[3];
+    for (int i = 0; i < 3; i++) {
+        receivers[i] = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+        while (strcmp(pn_link_name(receivers[i]), pn_link_name(senders[i]))) {
+            receivers[i] = pn_link_next(receivers[i], (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+        }
+        pn_link_flow(receivers[i], 10);
+    }
+    pump(t1, t2);
+    // the senders have credit, so each has its current delivery listed
+    assert(!pn_work_head(c1));
+    for (int i = 0; i < 3; i++) pn_delivery(senders[i], pn_dtag("w", 1));
+    int count = 0;
+    for (pn_link_t *l = pn_work_link_head(c1); l; l = pn_work_link_next(l)) count++;
+    assert(count == 3);
+
+    for (int i = 0; i < 3; i += 2) {
+        assert(pn_link_send(senders[i], "abc", 3) == 3);
+        pn_link_advance(senders[i]);
+    }
+    pump(t1, t2);
+    assert(pn_work_link_head(c1) == senders[1]);
+
+    // only the receivers that were sent to have work
+    assert(pn_work_link_head(c2) == receivers[0]);
+    assert(pn_work_link_next(receivers[0]) == receivers[2]);
+    assert(!pn_work_link_next(receivers[2]));
+    assert(!pn_link_work_head(receivers[1]));
+    pn_delivery_t *d = pn_link_work_head(receivers[2]);
+    assert(d && pn_delivery_readable(d) && !pn_link_work_next(d));
+    assert(pn_work_head(c2) == pn_link_work_head(receivers[0]));
+    assert(pn_work_next(pn_work_head(c2)) == d);
+    assert(!pn_work_next(d));
+
+    // once its delivery is dealt with a link comes off the list
+    pn_delivery_t *first = pn_link_work_head(receivers[0]);
+    pn_link_advance(receivers[0]);
+    assert(!pn_link_work_head(receivers[0]));
+    assert(pn_work_link_head(c2) == receivers[2]);
+    // a walk from a link that has since come off starts over
+    assert(pn_work_link_next(receivers[0]) == receivers[2]);
+    pn_delivery_settle(first);
+    pn_delivery_settle(d);
+    assert(!pn_work_link_head(c2));
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// one payload sent on several links is referenced rather than copied,
+// and let go once every delivery has framed it; the message format
+// goes along with it
+int test_link_send_shared(int argc, char **argv)
+{
+    fprintf(stdout, "test_link_send_shared\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+    pn_session_t *s1 = pn_session_head(c1, PN_LOCAL_ACTIVE);
+    pn_link_t *senders[3];
+    senders[0] = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    senders[1] = pn_sender(s1, "fanout-1");
+    senders[2] = pn_sender(s1, "fanout-2");
+    pn_link_open(senders[1]);
+    pn_link_open(senders[2]);
+    while (pump(t1, t2)) {
+        process_endpoints(c1);
+        process_endpoints(c2);
+    }
+    for (pn_link_t *rx = pn_link_head(c2, 0); rx; rx = pn_link_next(rx, 0)) {
+        pn_link_flow(rx, 1);
+    }
+    pump(t1, t2);
+
+    const size_t size = 50000;
+    pn_string_t *payload = pn_string(NULL);
+    assert(pn_string_resize(payload, size) == 0);
+    char *bytes = pn_string_buffer(payload);
+    for (size_t i = 0; i < size; i++) bytes[i] = (char) i;
+
+    for (int i = 0; i < 3; i++) {
+        assert(pn_link_credit(senders[i]) == 1);
+        pn_delivery_t *d = pn_delivery(senders[i], pn_dtag("shared", 6));
+        pn_delivery_set_message_format(d, 7);
+        assert(pn_link_send_shared(senders[i], payload) == (ssize_t) size);
+        pn_link_advance(senders[i]);
+    }
+    assert(pn_refcount(payload) == 4);
+    assert(pn_link_send_shared(senders[0], NULL) == PN_ARG_ERR);
+    pump(t1, t2);
+    assert(pn_refcount(payload) == 1);
+
+    char *got = (char *) malloc(size);
+    int received = 0;
+    for (pn_link_t *rx = pn_link_head(c2, 0); rx; rx = pn_link_next(rx, 0)) {
+        pn_delivery_t *d = pn_link_current(rx);
+        assert(d && !pn_delivery_partial(d));
+        assert(pn_delivery_message_format(d) == 7);
+        assert(pn_link_recv(rx, got, size) == (ssize_t) size);
+        assert(!memcmp(got, bytes, size));
+        received++;
+    }
+    assert(received == 3);
+    free(got);
+    pn_free(payload);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+static int flows;
+
+static void count_flows(pn_transport_t *transport, const char *message)
+{
+    if (strstr(message, "@flow")) {
+        flows++;
+    }
+}
+
+// queue count deliveries of size bytes each on the sender
+static void send_many(pn_link_t *tx, int count, size_t size)
+{
+    static char body[1024];
+    assert(size <= sizeof(body));
+    for (int i = 0; i < count; i++) {
+        pn_delivery(tx, pn_dtag("w", 1));
+        pn_link_send(tx, body, size);
+        pn_link_advance(tx);
+    }
+}
+
+// read and settle every complete delivery on the receiver
+static int consume(pn_link_t *rx, int limit)
+{
+    char buf[1024];
+    int count = 0;
+    pn_delivery_t *d;
+    while (count < limit && (d = pn_link_current(rx)) && !pn_delivery_partial(d)) {
+        while (pn_link_recv(rx, buf, sizeof(buf)) > 0);
+        pn_link_advance(rx);
+        pn_delivery_settle(d);
+        count++;
+    }
+    return count;
+}
+
+// the incoming window is refreshed at the low-water mark rather than
+// only once it has closed, and autotuning grows a capacity the sender
+// keeps running into
+int test_session_window(int argc, char **argv)
+{
+    fprintf(stdout, "test_session_window\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_set_max_frame(t2, 512);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_session_t *ssn = pn_link_session(rx);
+    pn_session_set_incoming_capacity(ssn, 8*512);
+    pn_transport_trace(t2, PN_TRACE_FRM);
+    pn_transport_set_tracer(t2, count_flows);
+
+    // six single frame deliveries leave two frames of window
+    pn_link_flow(rx, 6);
+    pump(t1, t2);
+    send_many(tx, 6, 400);
+    pump(t1, t2);
+
+    flows = 0;
+    assert(consume(rx, 3) == 3);
+    pump(t1, t2);
+    assert(flows == 0);
+
+    pn_session_set_incoming_low_water(ssn, 4*512);
+    assert(pn_session_get_incoming_low_water(ssn) == 4*512);
+    assert(consume(rx, 1) == 1);
+    pump(t1, t2);
+    assert(flows == 1);
+    assert(consume(rx, 2) == 2);
+
+    // a sender that always has more runs into the window every round trip
+    pn_session_set_incoming_low_water(ssn, 0);
+    pn_session_set_incoming_capacity(ssn, 4*512);
+    pn_session_set_incoming_autotune(ssn, 64*512);
+    assert(pn_session_get_incoming_autotune(ssn) == 64*512);
+    pn_link_flow(rx, 1000);
+    send_many(tx, 1000, 400);
+    int received = 0;
+    while (received < 1000) {
+        pump(t1, t2);
+        int n = consume(rx, 1000);
+        assert(n);
+        received += n;
+    }
+    assert(pn_session_get_incoming_capacity(ssn) > 4*512);
+    assert(pn_session_get_incoming_capacity(ssn) <= 64*512);
+
+    pn_session_set_incoming_autotune(ssn, 0);
+    assert(pn_session_get_incoming_capacity(ssn) == 4*512);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// over its budget a connection closes the windows and holds back link
+// credit, and gives both out again once drained to half the budget
+int test_connection_budget(int argc, char **argv)
+{
+    fprintf(stdout, "test_connection_budget\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_set_max_frame(t2, 512);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+
+    pn_link_flow(rx, 20);
+    pump(t1, t2);
+    send_many(tx, 20, 400);
+    pump(t1, t2);
+    assert(pn_connection_incoming_bytes(c2) == 20*400);
+
+    pn_connection_set_incoming_budget(c2, 8*512);
+    assert(pn_connection_get_incoming_budget(c2) == 8*512);
+    pn_link_flow(rx, 50);
+    send_many(tx, 10, 400);
+    pump(t1, t2);
+    assert(pn_link_queued(tx) == 10);
+
+    // under the budget, but not yet down to half of it
+    assert(consume(rx, 10) == 10);
+    pump(t1, t2);
+    assert(pn_connection_incoming_bytes(c2) == 10*400);
+    assert(pn_link_queued(tx) == 10);
+
+    assert(consume(rx, 6) == 6);
+    pump(t1, t2);
+    assert(pn_link_queued(tx) < 10);
+    // every session may always take a frame, so that is the overshoot
+    assert(pn_connection_incoming_bytes(c2) > 4*400);
+    assert(pn_connection_incoming_bytes(c2) <= 9*512);
+
+    int received = 16;
+    while (received < 30) {
+        int n = consume(rx, 30);
+        assert(n);
+        received += n;
+        pump(t1, t2);
+        assert(pn_connection_incoming_bytes(c2) <= 9*512);
+    }
+    assert(pn_connection_incoming_bytes(c2) == 0);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// peeked data stays buffered and counts against the session window
+// until it is consumed
+int test_link_recv_peek(int argc, char **argv)
+{
+    fprintf(stdout, "test_link_recv_peek\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_session_t *ssn = pn_link_session(rx);
+    pn_bytes_t head, wrap;
+    assert(pn_link_recv_peek(rx, &head, &wrap) == PN_STATE_ERR);
+    assert(pn_link_recv_consume(rx, 1) == PN_STATE_ERR);
+
+    pn_link_flow(rx, 1);
+    pump(t1, t2);
+    pn_delivery(tx, pn_dtag("peek", 4));
+    assert(pn_link_send(tx, "hello world", 11) == 11);
+    pn_link_advance(tx);
+    pump(t1, t2);
+
+    pn_delivery_t *d = pn_link_current(rx);
+    assert(d && !pn_delivery_partial(d));
+    assert(pn_link_recv_peek(rx, &head, &wrap) == 11);
+    assert(head.size + wrap.size == 11);
+    assert(!memcmp(head.start, "hello world", head.size));
+    assert(pn_session_incoming_bytes(ssn) == 11);
+
+    assert(pn_link_recv_consume(rx, 6) == 6);
+    assert(pn_session_incoming_bytes(ssn) == 5);
+    pn_bytes_t rest = pn_delivery_pending_bytes(d);
+    assert(rest.size == 5 && !memcmp(rest.start, "world", 5));
+
+    assert(pn_link_recv_consume(rx, 100) == 5);
+    assert(pn_session_incoming_bytes(ssn) == 0);
+    assert(pn_link_recv_peek(rx, &head, &wrap) == PN_EOS);
+    assert(head.size == 0 && wrap.size == 0);
+    assert(pn_link_recv_consume(rx, 1) == PN_EOS);
+    pn_delivery_settle(d);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// large deliveries are held in segments that together read back as
+// the original data, and a size hint keeps the rest in one segment
+int test_delivery_segments(int argc, char **argv)
+{
+    fprintf(stdout, "test_delivery_segments\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_set_max_frame(t2, 16*1024);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_flow(rx, 2);
+    pump(t1, t2);
+
+    const size_t size = 300000;
+    char *body = (char *) malloc(size);
+    for (size_t i = 0; i < size; i++) body[i] = (char) (i % 251);
+
+    pn_delivery(tx, pn_dtag("big", 3));
+    assert(pn_link_send(tx, body, size) == (ssize_t) size);
+    pn_link_advance(tx);
+    pump(t1, t2);
+
+    pn_delivery_t *d = pn_link_current(rx);
+    assert(d && !pn_delivery_partial(d));
+    assert(pn_delivery_pending(d) == size);
+    size_t count = pn_delivery_segments(d);
+    assert(count > 1);
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        pn_bytes_t segment = pn_delivery_segment(d, i);
+        assert(!memcmp(segment.start, body + offset, segment.size));
+        offset += segment.size;
+    }
+    assert(offset == size);
+    assert(pn_delivery_segment(d, count).size == 0);
+
+    // reads cross segment boundaries
+    char *got = (char *) malloc(size);
+    assert(pn_link_recv(rx, got, 1000) == 1000);
+    assert(pn_link_recv_consume(rx, 70000) == 70000);
+    assert(pn_link_recv(rx, got + 71000, size) == (ssize_t) (size - 71000));
+    assert(!memcmp(got, body, 1000));
+    assert(!memcmp(got + 71000, body + 71000, size - 71000));
+    assert(pn_delivery_segments(d) == 1);
+    assert(pn_link_recv(rx, got, size) == PN_EOS);
+    pn_link_advance(rx);
+    pn_delivery_settle(d);
+
+    // announcing the size after the first part has arrived
+    pn_delivery(tx, pn_dtag("hint", 4));
+    assert(pn_link_send(tx, body, 1000) == 1000);
+    pump(t1, t2);
+    d = pn_link_current(rx);
+    assert(d && pn_delivery_pending(d) == 1000);
+    pn_delivery_expect(d, size);
+    assert(pn_link_send(tx, body + 1000, size - 1000) == (ssize_t) (size - 1000));
+    pn_link_advance(tx);
+    pump(t1, t2);
+    assert(!pn_delivery_partial(d));
+    assert(pn_delivery_segments(d) == 2);
+    pn_bytes_t all = pn_delivery_pending_bytes(d);
+    assert(all.size == size && !memcmp(all.start, body, size));
+    assert(pn_delivery_segments(d) == 1);
+    assert(pn_link_recv_consume(rx, size) == (ssize_t) size);
+    assert(pn_session_incoming_bytes(pn_link_session(rx)) == 0);
+    pn_delivery_settle(d);
+
+    free(got);
+    free(body);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// a message far larger than either side buffers streams through with
+// the sender writing only what there is room for and the receiver
+// holding back window at its high-water mark
+int test_delivery_streaming(int argc, char **argv)
+{
+    fprintf(stdout, "test_delivery_streaming\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_set_max_frame(t2, 1024);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_session_t *out = pn_link_session(tx);
+    pn_session_t *in = pn_link_session(rx);
+    pn_session_set_outgoing_high_water(out, 4096);
+    assert(pn_session_get_outgoing_high_water(out) == 4096);
+    pn_session_set_incoming_capacity(in, 64*1024);
+    pn_link_set_incoming_high_water(rx, 8*1024);
+    assert(pn_link_get_incoming_high_water(rx) == 8*1024);
+    pn_link_flow(rx, 1);
+    pump(t1, t2);
+
+    const size_t size = 1024*1024;
+    size_t written = 0, read = 0;
+    char chunk[4096];
+    pn_delivery(tx, pn_dtag("stream", 6));
+    while (read < size) {
+        size_t room = pn_session_outgoing_room(out);
+        assert(room <= 4096);
+        size_t n = room < size - written ? room : size - written;
+        for (size_t i = 0; i < n; i++) chunk[i] = (char) ((written + i) % 251);
+        if (n) {
+            assert(pn_link_send(tx, chunk, n) == (ssize_t) n);
+            written += n;
+            if (written == size) pn_link_advance(tx);
+        }
+        assert(pn_session_outgoing_bytes(out) <= 4096);
+        pump(t1, t2);
+
+        pn_delivery_t *d = pn_link_current(rx);
+        assert(d);
+        assert(pn_delivery_pending(d) <= 8*1024);
+        // a slow reader only takes a little each round
+        ssize_t got = pn_link_recv(rx, chunk, 1000);
+        if (got > 0) {
+            for (ssize_t i = 0; i < got; i++) assert(chunk[i] == (char) ((read + i) % 251));
+            read += got;
+        }
+    }
+    assert(written == size);
+    assert(pn_link_recv(rx, chunk, sizeof(chunk)) == PN_EOS);
+    pn_delivery_settle(pn_link_current(rx));
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+static int transfers;
+
+static void count_transfers(pn_transport_t *transport, const char *message)
+{
+    if (strstr(message, "@transfer")) {
+        transfers++;
+    }
+}
+
+// frames are bounded by default, so a large message is split up rather
+// than making the peer buffer it as one frame
+int test_default_max_frame(int argc, char **argv)
+{
+    fprintf(stdout, "test_default_max_frame\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+    assert(pn_transport_get_max_frame(t2) == 16*1024);
+
+    test_setup(c1, t1,
+               c2, t2);
+    assert(pn_transport_get_remote_max_frame(t1) == 16*1024);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_flow(rx, 1);
+    pump(t1, t2);
+
+    static char body[100000];
+    pn_transport_trace(t2, PN_TRACE_FRM);
+    pn_transport_set_tracer(t2, count_transfers);
+    transfers = 0;
+    pn_delivery(tx, pn_dtag("big", 3));
+    assert(pn_link_send(tx, body, sizeof(body)) == sizeof(body));
+    pn_link_advance(tx);
+    pump(t1, t2);
+    assert(transfers == 7);
+    pn_delivery_t *d = pn_link_current(rx);
+    assert(d && !pn_delivery_partial(d) && pn_delivery_pending(d) == sizeof(body));
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// an idle transport compacts from tick and carries on as normal once
+// there is io again
+int test_transport_compact(int argc, char **argv)
+{
+    fprintf(stdout, "test_transport_compact\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_flow(rx, 10);
+    pump(t1, t2);
+
+    assert(pn_transport_tick(t1, 1000) == 0);
+    pn_transport_set_compact_timeout(t1, 100);
+    pn_transport_set_compact_timeout(t2, 100);
+    assert(pn_transport_get_compact_timeout(t1) == 100);
+    for (int round = 0; round < 3; round++) {
+        pn_timestamp_t now = 1000 + round*1000;
+        assert(pn_transport_tick(t1, now) == now + 100);
+        assert(pn_transport_tick(t2, now) == now + 100);
+        assert(pn_transport_tick(t1, now + 50) == now + 100);
+        assert(pn_transport_tick(t1, now + 100) == 0);
+        assert(pn_transport_tick(t2, now + 100) == 0);
+        assert(pn_transport_pending(t1) == 0);
+        assert(pn_transport_capacity(t2) > 0);
+
+        char body[40000];
+        memset(body, round, sizeof(body));
+        pn_delivery(tx, pn_dtag("c", 1));
+        assert(pn_link_send(tx, body, sizeof(body)) == sizeof(body));
+        pn_link_advance(tx);
+        pump(t1, t2);
+
+        pn_delivery_t *d = pn_link_current(rx);
+        assert(d && !pn_delivery_partial(d));
+        char got[40000];
+        assert(pn_link_recv(rx, got, sizeof(got)) == sizeof(got));
+        assert(!memcmp(got, body, sizeof(body)));
+        pn_link_advance(rx);
+        pn_delivery_settle(d);
+        pump(t1, t2);
+    }
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+// once sasl is done it drops out of the layer stack and amqp traffic
+// flows as if it was never there
+int test_sasl_passthru(int argc, char **argv)
+{
+    fprintf(stdout, "test_sasl_passthru\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_sasl_t *s1 = pn_sasl(t1);
+    pn_sasl_mechanisms(s1, "ANONYMOUS");
+    pn_sasl_client(s1);
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_sasl_t *s2 = pn_sasl(t2);
+    pn_sasl_mechanisms(s2, "ANONYMOUS");
+    pn_sasl_server(s2);
+    pn_transport_bind(t2, c2);
+
+    for (int i = 0; i < 10 && pn_sasl_state(s1) != PN_SASL_PASS; i++) {
+        pump(t1, t2);
+        if (pn_sasl_state(s2) == PN_SASL_STEP)
+            pn_sasl_done(s2, PN_SASL_OK);
+    }
+    assert(pn_sasl_state(s1) == PN_SASL_PASS);
+    assert(pn_sasl_state(s2) == PN_SASL_PASS);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_flow(rx, 100);
+    pump(t1, t2);
+
+    for (int i = 0; i < 100; i++) {
+        char tag[8];
+        int len = snprintf(tag, sizeof(tag), "%d", i);
+        pn_delivery(tx, pn_dtag(tag, len));
+        assert(pn_link_send(tx, tag, len) == len);
+        pn_link_advance(tx);
+        pump(t1, t2);
+
+        pn_delivery_t *d = pn_link_current(rx);
+        assert(d && !pn_delivery_partial(d));
+        char got[8];
+        assert(pn_link_recv(rx, got, sizeof(got)) == len);
+        assert(!memcmp(got, tag, len));
+        pn_link_advance(rx);
+        pn_delivery_settle(d);
+    }
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    return 0;
+}
+
+typedef struct {
+    int calls;
+    bool defer;
+    pn_transport_t *pending;
+} verify_state_t;
+
+// PLAIN with the password "secret" passes, anything else fails
+static void verify_plain(pn_transport_t *transport, const char *mechanism,
+                         const char *response, size_t size, void *context)
+{
+    verify_state_t *state = (verify_state_t *) context;
+    state->calls++;
+    assert(!strcmp(mechanism, "PLAIN"));
+    const char *pass = response;
+    for (int i = 0; i < 2 && pass < response + size; i++)
+        pass += strlen(pass) + 1;
+    size_t psize = response + size - pass;
+    pn_sasl_outcome_t outcome = psize == 6 && !memcmp(pass, "secret", 6) ? PN_SASL_OK : PN_SASL_AUTH;
+    if (state->defer) {
+        state->pending = transport;
+    } else {
+        pn_sasl_verified(transport, outcome);
+    }
+}
+
+static pn_sasl_state_t authenticate(pn_sasl_verifier_t *verifier, verify_state_t *state,
+                                    const char *password)
+{
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_sasl_t *s1 = pn_sasl(t1);
+    pn_sasl_plain(s1, "user", password);
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_sasl_t *s2 = pn_sasl(t2);
+    pn_sasl_set_verifier(s2, verifier);
+    pn_transport_bind(t2, c2);
+
+    for (int i = 0; i < 10 && pn_sasl_state(s2) != PN_SASL_PASS &&
+             pn_sasl_state(s2) != PN_SASL_FAIL; i++) {
+        pump(t1, t2);
+        if (state->pending) {
+            // nothing is decided until the verifier reports back
+            assert(pn_sasl_outcome(s2) == PN_SASL_NONE);
+            pump(t1, t2);
+            assert(pn_sasl_outcome(s1) == PN_SASL_NONE);
+            pn_sasl_verified(state->pending, PN_SASL_OK);
+            state->pending = NULL;
+        }
+    }
+
+    pn_sasl_state_t result = pn_sasl_state(s2);
+    if (result == PN_SASL_PASS) {
+        pump(t1, t2);
+        assert(pn_sasl_state(s1) == PN_SASL_PASS);
+    } else {
+        // the failure ends the stream instead of falling through to amqp
+        pump(t1, t2);
+        assert(!strcmp(pn_condition_get_name(pn_transport_condition(t2)),
+                       "amqp:unauthorized-access"));
+        assert(pn_transport_capacity(t2) == PN_EOS);
+    }
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+    return result;
+}
+
+// credentials go to an external verifier which may answer later, the
+// ones it accepted are remembered for a while
+int test_sasl_verifier(int argc, char **argv)
+{
+    fprintf(stdout, "test_sasl_verifier\n");
+    verify_state_t state = {0, true, NULL};
+    pn_sasl_verifier_t *verifier = pn_sasl_verifier("PLAIN", verify_plain, &state);
+    pn_sasl_verifier_cache(verifier, 4, 60000);
+
+    assert(authenticate(verifier, &state, "secret") == PN_SASL_PASS);
+    assert(state.calls == 1);
+
+    state.defer = false;
+    assert(authenticate(verifier, &state, "secret") == PN_SASL_PASS);
+    assert(state.calls == 1);
+
+    assert(authenticate(verifier, &state, "wrong") == PN_SASL_FAIL);
+    assert(authenticate(verifier, &state, "wrong") == PN_SASL_FAIL);
+    assert(state.calls == 3);
+
+    pn_sasl_verifier_cache(verifier, 0, 0);
+    assert(authenticate(verifier, &state, "secret") == PN_SASL_PASS);
+    assert(state.calls == 4);
+
+    // turned back on, it starts empty and keeps working
+    pn_sasl_verifier_cache(verifier, 1, 60000);
+    assert(authenticate(verifier, &state, "secret") == PN_SASL_PASS);
+    assert(authenticate(verifier, &state, "secret") == PN_SASL_PASS);
+    assert(state.calls == 5);
+    assert(authenticate(verifier, &state, "secreT") == PN_SASL_FAIL);
+    assert(state.calls == 6);
+
+    pn_sasl_verifier_free(verifier);
+    return 0;
+}
+
+static bool contains(const char *bytes, size_t size, const char *what, size_t len)
+{
+    for (size_t i = 0; i + len <= size; i++) {
+        if (!memcmp(bytes + i, what, len)) return true;
+    }
+    return false;
+}
+
+// a client whose mechanism needs no challenge sends the amqp header and
+// everything it has queued right behind sasl-init, which the server holds
+// until it decides the outcome
+static void sasl_pipelined(pn_sasl_outcome_t outcome)
+{
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_sasl_t *s1 = pn_sasl(t1);
+    pn_sasl_mechanisms(s1, "ANONYMOUS");
+    pn_sasl_client(s1);
+    pn_transport_bind(t1, c1);
+    pn_connection_open(c1);
+    pn_session_t *ssn = pn_session(c1);
+    pn_session_open(ssn);
+    pn_link_t *tx = pn_sender(ssn, "tx");
+    pn_link_open(tx);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_sasl_t *s2 = pn_sasl(t2);
+    pn_sasl_mechanisms(s2, "ANONYMOUS");
+    pn_sasl_server(s2);
+    pn_transport_bind(t2, c2);
+
+    ssize_t pending = pn_transport_pending(t1);
+    assert(pending > 0);
+    assert(contains(pn_transport_head(t1), pending, "AMQP\x00\x01\x00\x00", 8));
+    assert(xfer(t1, t2) == pending);
+    assert(pn_sasl_state(s2) == PN_SASL_STEP);
+    assert(!(pn_connection_state(c2) & PN_REMOTE_ACTIVE));
+
+    pn_sasl_done(s2, outcome);
+    xfer(t2, t1);
+    if (outcome == PN_SASL_OK) {
+        // one write each way and the server has seen the whole setup
+        assert(pn_connection_state(c2) & PN_REMOTE_ACTIVE);
+        assert(pn_session_head(c2, PN_REMOTE_ACTIVE));
+        assert(pn_link_head(c2, PN_REMOTE_ACTIVE));
+        assert(pn_sasl_state(s1) == PN_SASL_PASS);
+
+        pn_connection_open(c2);
+        pump(t1, t2);
+        assert(pn_connection_state(c1) == (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    } else {
+        // nothing after the failed init got through on either side
+        assert(!(pn_connection_state(c2) & PN_REMOTE_ACTIVE));
+        assert(pn_sasl_state(s1) == PN_SASL_FAIL);
+        assert(!(pn_connection_state(c1) & PN_REMOTE_ACTIVE));
+        assert(!strcmp(pn_condition_get_name(pn_transport_condition(t1)),
+                       "amqp:unauthorized-access"));
+        assert(pn_transport_capacity(t1) == PN_EOS);
+    }
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+}
+
+int test_sasl_pipelined(int argc, char **argv)
+{
+    fprintf(stdout, "test_sasl_pipelined\n");
+    sasl_pipelined(PN_SASL_OK);
+    sasl_pipelined(PN_SASL_AUTH);
+    return 0;
+}
+
+// an attach goes to the local link of the same name, and only to it
+int test_link_names(int argc, char **argv)
+{
+    fprintf(stdout, "test_link_names\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    pn_connection_open(c1);
+    pn_connection_open(c2);
+    pn_session_t *s1 = pn_session(c1);
+    pn_session_open(s1);
+    while (pump(t1, t2)) {
+        process_endpoints(c1);
+        process_endpoints(c2);
+    }
+    pn_session_t *s2 = pn_session_head(c2, PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE);
+    assert(s2);
+    pn_link_t *longer = pn_receiver(s2, "linked");
+    pn_link_t *same = pn_receiver(s2, "link");
+
+    pn_link_t *tx = pn_sender(s1, "link");
+    pn_terminus_set_address(pn_link_target(tx), "queue");
+    pn_terminus_set_expiry_policy(pn_link_target(tx), PN_EXPIRE_NEVER);
+    pn_link_open(tx);
+    pn_link_t *other = pn_sender(s1, "lin");
+    pn_terminus_set_address(pn_link_target(other), "queue");
+    pn_link_open(other);
+    pump(t1, t2);
+
+    assert(pn_link_state(same) == (PN_LOCAL_UNINIT | PN_REMOTE_ACTIVE));
+    assert(pn_link_state(longer) == (PN_LOCAL_UNINIT | PN_REMOTE_UNINIT));
+    pn_terminus_t *target = pn_link_remote_target(same);
+    assert(!strcmp(pn_terminus_get_address(target), "queue"));
+    assert(pn_terminus_get_expiry_policy(target) == PN_EXPIRE_NEVER);
+
+    pn_link_t *lin = pn_link_head(c2, PN_LOCAL_UNINIT | PN_REMOTE_ACTIVE);
+    while (lin && strcmp(pn_link_name(lin), "lin")) {
+        lin = pn_link_next(lin, PN_LOCAL_UNINIT | PN_REMOTE_ACTIVE);
+    }
+    assert(lin && lin != same && lin != longer);
+    assert(!strcmp(pn_terminus_get_address(pn_link_remote_target(lin)), "queue"));
+
+    // the addresses are shared, changing one leaves the other alone
+    pn_terminus_set_address(target, "changed");
+    assert(!strcmp(pn_terminus_get_address(target), "changed"));
+    assert(!strcmp(pn_terminus_get_address(pn_link_remote_target(lin)), "queue"));
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+    return 0;
+}
+
+static int frames_out;
+static int frames_in;
+
+static void count_frames(pn_transport_t *transport, const char *frame, size_t size,
+                         bool outgoing)
+{
+    // frames are handed over whole, starting with their size
+    const unsigned char *header = (const unsigned char *) frame;
+    assert(size >= 8);
+    assert(((size_t) header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3]) == size);
+    if (outgoing) frames_out++; else frames_in++;
+}
+
+int test_trace_filters(int argc, char **argv)
+{
+    fprintf(stdout, "test_trace_filters\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_flow(rx, 10);
+    pump(t1, t2);
+
+    pn_transport_trace(t1, PN_TRACE_RAW);
+    pn_transport_set_frame_tracer(t1, count_frames);
+    pn_transport_trace_performatives(t1, PN_TRACE_TRANSFER);
+    send_many(tx, 4, 10);
+    pump(t1, t2);
+    assert(consume(rx, 4) == 4);
+    pump(t1, t2);
+    assert(frames_out == 4 && frames_in == 0);
+
+    // every other transfer
+    pn_transport_trace_sample(t1, 2);
+    frames_out = 0;
+    send_many(tx, 4, 10);
+    pump(t1, t2);
+    assert(frames_out == 2);
+    pn_transport_trace_sample(t1, 0);
+
+    pn_transport_trace_handle(t1, 1);
+    send_many(tx, 1, 10);
+    pump(t1, t2);
+    assert(frames_out == 2);
+    pn_transport_trace_handle(t1, -1);
+
+    // only the detach with a condition
+    pn_transport_trace_performatives(t1, 0);
+    pn_transport_trace_errors(t1, true);
+    frames_out = 0;
+    pn_condition_set_name(pn_link_condition(tx), "amqp:internal-error");
+    pn_link_close(tx);
+    pump(t1, t2);
+    pn_link_close(rx);
+    pump(t1, t2);
+    assert(frames_out == 1 && frames_in == 0);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+    return 0;
+}
+
+int test_metrics(int argc, char **argv)
+{
+    fprintf(stdout, "test_metrics\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_flow(rx, 2);
+    pump(t1, t2);
+
+    // the third delivery waits for credit, however often it is looked at
+    send_many(tx, 3, 100);
+    pump(t1, t2);
+    pump(t1, t2);
+    assert(consume(rx, 3) == 2);
+    pn_link_flow(rx, 1);
+    pump(t1, t2);
+    assert(consume(rx, 1) == 1);
+    pump(t1, t2);
+
+    pn_link_metrics_t sent, received;
+    pn_link_metrics(tx, &sent);
+    pn_link_metrics(rx, &received);
+    assert(sent.deliveries == 3 && received.deliveries == 3);
+    assert(sent.bytes == 300 && received.bytes == 300);
+    assert(sent.credit_stalls == 1 && received.credit_stalls == 0);
+
+    pn_session_metrics_t session;
+    pn_session_metrics(pn_link_session(tx), &session);
+    assert(session.outgoing_transfers == 3 && session.window_stalls == 0);
+    pn_session_metrics(pn_link_session(rx), &session);
+    assert(session.incoming_transfers == 3 && session.incoming_bytes == 0);
+
+    pn_transport_metrics_t metrics, total;
+    pn_transport_metrics(t1, &metrics);
+    assert(metrics.frames_output == pn_transport_get_frames_output(t1));
+    assert(metrics.output_frame_sizes.count == metrics.frames_output);
+    assert(metrics.input_frame_sizes.count == metrics.frames_input);
+    assert(metrics.output_frame_sizes.max > 100 && metrics.output_frame_sizes.max < 256);
+    assert(metrics.output_frame_sizes.buckets[7] == 3);
+    assert(metrics.output_high_water > 100 && metrics.input_high_water > 0);
+    assert(metrics.process_count > 0);
+
+    memset(&total, 0, sizeof(total));
+    pn_transport_metrics_add(&total, &metrics);
+    pn_transport_metrics(t2, &metrics);
+    pn_transport_metrics_add(&total, &metrics);
+    assert(total.frames_input == pn_transport_get_frames_input(t1) + metrics.frames_input);
+    assert(total.output_frame_sizes.buckets[7] == 3);
+    assert(total.input_frame_sizes.buckets[7] == 3);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+    return 0;
+}
+
+int test_latency(int argc, char **argv)
+{
+    fprintf(stdout, "test_latency\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_latency_t latency;
+    assert(!pn_link_latency(tx, &latency));
+    pn_link_track_latency(tx, true);
+    pn_link_track_latency(rx, true);
+    pn_link_flow(rx, 3);
+    pump(t1, t2);
+
+    send_many(tx, 3, 10);
+    pump(t1, t2);
+    assert(consume(rx, 3) == 3);
+    pump(t1, t2);
+
+    assert(pn_link_latency(tx, &latency));
+    assert(latency.queueing.count == 3 && latency.round_trip.count == 3);
+    assert(latency.processing.count == 0);
+    assert(pn_histogram_percentile(&latency.round_trip, 100) == latency.round_trip.max);
+    assert(pn_link_latency(rx, &latency));
+    assert(latency.processing.count == 3);
+    assert(latency.queueing.count == 0 && latency.round_trip.count == 0);
+
+    pn_link_track_latency(tx, false);
+    assert(!pn_link_latency(tx, &latency));
+
+    pn_histogram_t histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    histogram.count = 10;
+    histogram.buckets[0] = 5;
+    histogram.buckets[3] = 5;
+    histogram.max = 12;
+    assert(pn_histogram_percentile(&histogram, 40) == 1);
+    assert(pn_histogram_percentile(&histogram, 50) == 12);
+    assert(pn_histogram_percentile(&histogram, 99.9) == 12);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+    return 0;
+}
+
+static int logged;
+
+static void count_logged(const char *message)
+{
+    logged++;
+    fprintf(stderr, "%s\n", message);
+}
+
+// with the log thread a frame too big for the trace buffer is dropped
+// and counted rather than waited for
+int test_log_async(int argc, char **argv)
+{
+    fprintf(stdout, "test_log_async\n");
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_flow(rx, 1);
+    pump(t1, t2);
+
+    pn_log_logger(count_logged);
+    assert(pn_log_async(1024) == 0);
+    uint64_t dropped = pn_log_dropped();
+    pn_transport_trace(t1, PN_TRACE_FRM);
+    send_many(tx, 1, 1000);
+    pump(t1, t2);
+    assert(consume(rx, 1) == 1);
+    pn_transport_trace(t1, PN_TRACE_OFF);
+    assert(pn_log_dropped() == dropped + 1);
+
+    // stopping writes out what is buffered, the drop included
+    assert(pn_log_async(0) == 0);
+    assert(logged == 1);
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+    return 0;
+}
+
+// both ends of a connection captured, 50 transfers from the client
+// and their dispositions, which the proton-dump tests then read
+static int capture_exchange(const char *client, const char *server)
+{
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    pn_transport_bind(t2, c2);
+
+    assert(pn_transport_capture(t1, "no-such-directory/capture") == PN_ERR);
+    assert(!pn_transport_capture(t1, client));
+    assert(!pn_transport_capture(t2, server));
+
+    test_setup(c1, t1,
+               c2, t2);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_flow(rx, 100);
+    pump(t1, t2);
+    pn_delivery_t *held = NULL;
+    for (int i = 0; i < 5; i++) {
+        send_many(tx, 10, 100);
+        pump(t1, t2);
+        settle_received(rx, &held);
+        pump(t1, t2);
+        count_settled(c1);
+    }
+    pn_delivery_update(held, PN_ACCEPTED);
+    pn_delivery_settle(held);
+    pump(t1, t2);
+    count_settled(c1);
+
+    pn_connection_close(c1);
+    while (pump(t1, t2)) {
+        process_endpoints(c2);
+        if (pn_connection_state(c2) & PN_REMOTE_CLOSED) pn_connection_close(c2);
+    }
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+
+    char header[8];
+    FILE *f = fopen(server, "rb");
+    assert(f && fread(header, 1, 8, f) == 8);
+    assert(!memcmp(header, "PNCAPTR\x01", 8));
+    fseek(f, 0, SEEK_END);
+    assert(ftell(f) > 24 + 50*100);
+    fclose(f);
+    return 0;
+}
+
+int test_capture(int argc, char **argv)
+{
+    fprintf(stdout, "test_capture\n");
+    // nothing is left behind in the directory the tests run in
+    int rc = capture_exchange("test-capture-client.cap", "test-capture-server.cap");
+    remove("test-capture-client.cap");
+    remove("test-capture-server.cap");
+    return rc;
+}
+
+// send 50 compressible deliveries, returning the bytes it took
+static int send_compressed(int level1, int level2)
+{
+    pn_connection_t *c1 = pn_connection();
+    pn_transport_t  *t1 = pn_transport();
+    assert(!pn_transport_set_compression(t1, level1));
+    pn_transport_bind(t1, c1);
+
+    pn_connection_t *c2 = pn_connection();
+    pn_transport_t  *t2 = pn_transport();
+    pn_transport_set_server(t2);
+    assert(!pn_transport_set_compression(t2, level2));
+    pn_transport_bind(t2, c2);
+
+    test_setup(c1, t1,
+               c2, t2);
+    assert(pn_transport_set_compression(t1, 1) == PN_STATE_ERR);
+
+    pn_link_t *tx = pn_link_head(c1, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_t *rx = pn_link_head(c2, (PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE));
+    pn_link_flow(rx, 50);
+    pump(t1, t2);
+    send_many(tx, 50, 1000);
+    int bytes = pump(t1, t2);
+    assert(consume(rx, 50) == 50);
+    pump(t1, t2);
+
+    pn_connection_close(c1);
+    while (pump(t1, t2)) {
+        process_endpoints(c2);
+        if (pn_connection_state(c2) & PN_REMOTE_CLOSED) pn_connection_close(c2);
+    }
+    assert(pn_connection_state(c1) & PN_REMOTE_CLOSED);
+    assert(!pn_condition_is_set(pn_transport_condition(t1)));
+    assert(!pn_condition_is_set(pn_transport_condition(t2)));
+
+    pn_transport_unbind(t1);
+    pn_transport_free(t1);
+    pn_connection_free(c1);
+    pn_transport_unbind(t2);
+    pn_transport_free(t2);
+    pn_connection_free(c2);
+    return bytes;
+}
+
+// compression is only switched on where both ends offer it
+int test_transport_compress(int argc, char **argv)
+{
+    fprintf(stdout, "test_transport_compress\n");
+    pn_transport_t *t = pn_transport();
+    int err = pn_transport_set_compression(t, 6);
+    pn_transport_free(t);
+    if (err == PN_ERR) return 0;  // built without zlib
+    assert(!err);
+
+    t = pn_transport();
+    assert(pn_transport_set_compression(t, 10) == PN_ARG_ERR);
+    pn_transport_free(t);
+
+    assert(send_compressed(0, 0) > 50*1000);
+    assert(send_compressed(6, 0) > 50*1000);
+    assert(send_compressed(0, 6) > 50*1000);
+    assert(send_compressed(1, 9) < 50*1000/10);
+    return 0;
+}
+
+// move what one driver writes into what the other reads, a part at a
+// time as a socket might, returning the number of bytes moved
+static size_t drive(pn_connection_driver_t *from, pn_connection_driver_t *to)
+{
+    pn_bytes_t out = pn_connection_driver_write_buffer(from);
+    pn_rwbytes_t in = pn_connection_driver_read_buffer(to);
+    size_t n = out.size < in.size ? out.size : in.size;
+    if (n > 1) n = n/2 + 1;
+    memcpy(in.start, out.start, n);
+    pn_connection_driver_read_done(to, n);
+    pn_connection_driver_write_done(from, n);
+    return n;
+}
+
+// handle the events of a driver, opening on init and closing once the
+// peer has, returning whether there were any
+static bool drive_events(pn_connection_driver_t *d, bool *closed)
+{
+    bool any = false;
+    pn_event_t *event;
+    while ((event = pn_connection_driver_next_event(d))) {
+        any = true;
+        pn_connection_t *c = d->connection;
+        switch (pn_event_type(event)) {
+        case PN_CONNECTION_INIT:
+            pn_connection_set_container(c, "driver");
+            pn_connection_open(c);
+            break;
+        case PN_CONNECTION_REMOTE_CLOSE:
+            pn_connection_close(c);
+            break;
+        case PN_TRANSPORT_CLOSED:
+            *closed = true;
+            break;
+        default:
+            break;
+        }
+    }
+    return any;
+}
+
+int test_connection_driver(int argc, char **argv)
+{
+    fprintf(stdout, "test_connection_driver\n");
+    pn_connection_driver_t client, server;
+    assert(!pn_connection_driver_init(&client, NULL, NULL));
+    assert(!pn_connection_driver_init(&server, NULL, NULL));
+    pn_transport_set_server(server.transport);
+    assert(pn_connection_driver_has_event(&client));
+    assert(!pn_connection_driver_finished(&client));
+
+    bool client_closed = false, server_closed = false;
+    bool opened = false;
+    for (int i = 0; i < 1000; i++) {
+        bool any = drive_events(&client, &client_closed);
+        any = drive_events(&server, &server_closed) || any;
+        any = drive(&client, &server) || any;
+        any = drive(&server, &client) || any;
+        assert(any || pn_connection_driver_finished(&client));
+        if (!opened && (pn_connection_state(client.connection) & PN_REMOTE_ACTIVE)) {
+            assert(pn_connection_state(server.connection) & PN_REMOTE_ACTIVE);
+            assert(!strcmp(pn_connection_remote_container(server.connection), "driver"));
+            opened = true;
+            pn_connection_close(client.connection);
+        }
+        if (pn_connection_driver_finished(&client) && pn_connection_driver_finished(&server))
+            break;
+    }
+    assert(opened);
+    assert(client_closed && server_closed);
+    assert(pn_connection_driver_finished(&client));
+    assert(pn_connection_driver_finished(&server));
+    assert(!pn_condition_is_set(pn_transport_condition(client.transport)));
+    assert(!pn_connection_driver_next_event(&client));
+    assert(pn_connection_driver_tick(&client, 1000) == 0);
+    pn_connection_driver_destroy(&client);
+    pn_connection_driver_destroy(&server);
+
+    // an io error closes both sides and is reported on the transport
+    assert(!pn_connection_driver_init(&client, NULL, NULL));
+    assert(!pn_connection_driver_bind(&client));
+    pn_connection_driver_errorf(&client, "proton:io", "connect: %s", "refused");
+    assert(!pn_connection_driver_read_buffer(&client).size);
+    assert(!pn_connection_driver_write_buffer(&client).size);
+    client_closed = false;
+    drive_events(&client, &client_closed);
+    assert(client_closed);
+    assert(pn_connection_driver_finished(&client));
+    pn_condition_t *cond = pn_transport_condition(client.transport);
+    assert(!strcmp(pn_condition_get_name(cond), "proton:io"));
+    assert(!strcmp(pn_condition_get_description(cond), "connect: refused"));
+    pn_connection_driver_destroy(&client);
+    return 0;
+}
+
+static const uint32_t wire_values[] = {0, 1, 255, 256, 65535, 0x7fffffff, 0xffffffff};
+#define WIRE_VALUES (sizeof(wire_values)/sizeof(wire_values[0]))
+
+typedef ssize_t (*direct_t)(char *dst, size_t size, const void *fields);
+
+// the direct encoding is exactly what pn_data_encode makes of the
+// generic one, doesn't fit in anything less and writes nothing past the
+// space it is given
+static void expect_direct(direct_t direct, const void *fields, pn_data_t *generic)
+{
+    char bytes[1024], expected[1024];
+    ssize_t size = pn_data_encode(generic, expected, sizeof(expected));
+    assert(size > 0);
+    assert(direct(bytes, sizeof(bytes), fields) == size);
+    assert(!memcmp(bytes, expected, size));
+    memset(bytes, 0xAA, sizeof(bytes));
+    assert(direct(bytes, size - 1, fields) == PN_OVERFLOW);
+    assert(bytes[size - 1] == (char) 0xAA);
+    assert(direct(bytes, 0, fields) == PN_OVERFLOW);
+}
+
+static ssize_t transfer_direct(char *dst, size_t size, const void *fields)
+{
+    const pni_transfer_t *t = (const pni_transfer_t *) fields;
+    return pni_encode_transfer(dst, size, t->handle, t->id, &t->tag, t->format,
+                               t->settled, t->more, t->type);
+}
+
+// inext_init is whether the remote channel is known, handle_init
+// whether there is a link
+static ssize_t flow_direct(char *dst, size_t size, const void *fields)
+{
+    const pni_flow_t *f = (const pni_flow_t *) fields;
+    return pni_encode_flow(dst, size, f->inext_init, f->inext, f->iwin, f->onext, f->owin,
+                           f->handle_init, f->handle, f->delivery_count, f->link_credit,
+                           f->drain);
+}
+
+static ssize_t disposition_direct(char *dst, size_t size, const void *fields)
+{
+    const pni_disposition_t *d = (const pni_disposition_t *) fields;
+    return pni_encode_disposition(dst, size, d->role, d->first, d->last, d->settled, d->type);
+}
+
+// the direct encoders against the formats the transport falls back to
+// when it traces frames, for every field in each of its encodings
+int test_encode_direct(int argc, char **argv)
+{
+    fprintf(stdout, "test_encode_direct\n");
+    pn_data_t *generic = pn_data(0);
+    pn_data_t *empty = pn_data(0);
+    static char tag[300];
+    for (size_t i = 0; i < sizeof(tag); i++) tag[i] = (char) i;
+    const pn_bytes_t tags[] = {pn_bytes(0, NULL), pn_bytes(0, tag), pn_bytes(8, tag),
+                               pn_bytes(255, tag), pn_bytes(256, tag)};
+    const uint64_t codes[] = {0, PN_RECEIVED, PN_ACCEPTED, PN_REJECTED, PN_RELEASED,
+                              PN_MODIFIED, 0x100, 0x0000468C00000001ULL};
+    const size_t ntags = sizeof(tags)/sizeof(tags[0]);
+    const size_t ncodes = sizeof(codes)/sizeof(codes[0]);
+
+    for (size_t i = 0; i < WIRE_VALUES; i++) {
+        for (size_t j = 0; j < WIRE_VALUES; j++) {
+            for (size_t k = 0; k < ntags; k++) {
+                for (size_t c = 0; c < ncodes; c++) {
+                    for (int flags = 0; flags < 4; flags++) {
+                        pni_transfer_t t = {0};
+                        t.handle = wire_values[i];
+                        t.id = wire_values[j];
+                        t.tag = tags[k];
+                        t.format = wire_values[(i + j + k) % WIRE_VALUES];
+                        t.settled = flags & 1;
+                        t.more = flags & 2;
+                        t.type = codes[c];
+                        // the transport encodes directly when there is no
+                        // state or it is empty
+                        pn_data_clear(generic);
+                        assert(!pn_data_fill(generic, "DL[IIzIoon?DLC]", TRANSFER, t.handle, t.id,
+                                             t.tag.size, t.tag.start, t.format, t.settled, t.more,
+                                             (bool) t.type, t.type, (flags + c) % 2 ? empty : NULL));
+                        expect_direct(transfer_direct, &t, generic);
+                    }
+                }
+                pni_flow_t f = {0};
+                f.inext = wire_values[i];
+                f.iwin = wire_values[j];
+                f.onext = wire_values[(i + k) % WIRE_VALUES];
+                f.owin = wire_values[(j + k) % WIRE_VALUES];
+                f.handle = wire_values[(i + j) % WIRE_VALUES];
+                f.delivery_count = wire_values[(i + j + k) % WIRE_VALUES];
+                f.link_credit = wire_values[k];
+                for (int flags = 0; flags < 8; flags++) {
+                    f.inext_init = flags & 1;
+                    f.handle_init = flags & 2;
+                    f.drain = flags & 4;
+                    bool link = f.handle_init;
+                    pn_data_clear(generic);
+                    assert(!pn_data_fill(generic, "DL[?IIII?I?I?In?o]", FLOW, f.inext_init, f.inext,
+                                         f.iwin, f.onext, f.owin,
+                                         link, link ? f.handle : 0,
+                                         link, link ? f.delivery_count : 0,
+                                         link, link ? f.link_credit : 0,
+                                         link, link ? f.drain : false));
+                    expect_direct(flow_direct, &f, generic);
+                }
+            }
+            for (size_t c = 0; c < ncodes; c++) {
+                for (int flags = 0; flags < 4; flags++) {
+                    pni_disposition_t d = {0};
+                    d.role = flags & 1;
+                    d.first = wire_values[i];
+                    d.last = wire_values[j];
+                    d.settled = flags & 2;
+                    d.type = codes[c];
+                    pn_data_clear(generic);
+                    assert(!pn_data_fill(generic, "DL[oIIo?DL[]]", DISPOSITION, d.role, d.first,
+                                         d.last, d.settled, (bool) d.type, d.type));
+                    expect_direct(disposition_direct, &d, generic);
+                }
+            }
+        }
+    }
+
+    pn_data_free(generic);
+    pn_data_free(empty);
+    return 0;
+}
+
+// a performative written out by hand, each field in one of the
+// encodings the spec allows for its value as picked by a generator
+typedef struct {
+    char bytes[1024];
+    size_t size;
+    uint32_t seed;
+    uint32_t fields;    // fields left in the list being written
+} wire_t;
+
+static unsigned wire_pick(wire_t *w, unsigned n)
+{
+    w->seed = w->seed * 1103515245 + 12345;
+    return (w->seed >> 16) % n;
+}
+
+static void wire_put8(wire_t *w, uint8_t value)
+{
+    assert(w->size < sizeof(w->bytes));
+    w->bytes[w->size++] = (char) value;
+}
+
+static void wire_put32(wire_t *w, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8) wire_put8(w, (uint8_t) (value >> shift));
+}
+
+static uint32_t wire_value(wire_t *w)
+{
+    return wire_values[wire_pick(w, WIRE_VALUES)];
+}
+
+// whether there is room left in the list for the field, and if so
+// sometimes fills it with a null instead
+static bool wire_field(wire_t *w)
+{
+    if (!w->fields) return false;
+    w->fields--;
+    if (!wire_pick(w, 5)) {
+        wire_put8(w, PNE_NULL);
+        return false;
+    }
+    return true;
+}
+
+static void wire_uint(wire_t *w)
+{
+    if (!wire_field(w)) return;
+    uint32_t value = wire_value(w);
+    unsigned form = wire_pick(w, 3);
+    if (form == 0 && value == 0) {
+        wire_put8(w, PNE_UINT0);
+    } else if (form <= 1 && value < 256) {
+        wire_put8(w, PNE_SMALLUINT);
+        wire_put8(w, (uint8_t) value);
+    } else {
+        wire_put8(w, PNE_UINT);
+        wire_put32(w, value);
+    }
+}
 
+static void wire_ulong(wire_t *w, uint64_t value)
+{
+    unsigned form = wire_pick(w, 3);
+    if (form == 0 && value == 0) {
+        wire_put8(w, PNE_ULONG0);
+    } else if (form <= 1 && value < 256) {
+        wire_put8(w, PNE_SMALLULONG);
+        wire_put8(w, (uint8_t) value);
+    } else {
+        wire_put8(w, PNE_ULONG);
+        wire_put32(w, (uint32_t) (value >> 32));
+        wire_put32(w, (uint32_t) value);
+    }
+}
+
+static void wire_bool(wire_t *w)
+{
+    if (!wire_field(w)) return;
+    bool value = wire_pick(w, 2);
+    if (wire_pick(w, 2)) {
+        wire_put8(w, value ? PNE_TRUE : PNE_FALSE);
+    } else {
+        wire_put8(w, PNE_BOOLEAN);
+        wire_put8(w, value);
+    }
+}
+
+static void wire_binary(wire_t *w)
+{
+    if (!wire_field(w)) return;
+    size_t size = wire_pick(w, 2) ? wire_pick(w, 16) : 256 + wire_pick(w, 16);
+    if (size < 256 && wire_pick(w, 2)) {
+        wire_put8(w, PNE_VBIN8);
+        wire_put8(w, (uint8_t) size);
+    } else {
+        wire_put8(w, PNE_VBIN32);
+        wire_put32(w, (uint32_t) size);
+    }
+    for (size_t i = 0; i < size; i++) wire_put8(w, (uint8_t) wire_pick(w, 256));
+}
+
+// a list of count fields, written as list32 and moved down into list8
+// or list0 on the way out where it fits and the generator says so
+static size_t wire_enter(wire_t *w, uint32_t count)
+{
+    size_t start = w->size;
+    wire_put8(w, PNE_LIST32);
+    wire_put32(w, 0);
+    wire_put32(w, count);
+    w->fields = count;
+    return start;
+}
+
+static void wire_exit(wire_t *w, size_t start)
+{
+    char *list = w->bytes + start;
+    size_t size = w->size - start - 5;
+    uint32_t count = (uint32_t) (((uint8_t) list[5] << 24) | ((uint8_t) list[6] << 16) |
+                                 ((uint8_t) list[7] << 8) | (uint8_t) list[8]);
+    unsigned form = wire_pick(w, 3);
+    if (form == 0 && count == 0) {
+        list[0] = (char) PNE_LIST0;
+        w->size = start + 1;
+    } else if (form <= 1 && size - 3 < 256 && count < 256) {
+        list[0] = (char) PNE_LIST8;
+        list[1] = (char) (size - 3);
+        list[2] = (char) count;
+        memmove(list + 3, list + 9, size - 4);
+        w->size -= 6;
+    } else {
+        list[1] = (char) (size >> 24);
+        list[2] = (char) (size >> 16);
+        list[3] = (char) (size >> 8);
+        list[4] = (char) size;
+    }
+    w->fields = 0;
+}
+
+static void wire_descriptor(wire_t *w, uint64_t code)
+{
+    wire_put8(w, PNE_DESCRIPTOR);
+    wire_ulong(w, code);
+}
+
+// a delivery state: null, or described with a null, an empty list, or
+// a list of what is given as fields; returns whether it carries a
+// value
+static bool wire_state(wire_t *w, uint32_t fields, bool *described)
+{
+    *described = false;
+    if (!w->fields) return false;
+    w->fields--;
+    unsigned form = wire_pick(w, 4);
+    if (form == 0) {
+        wire_put8(w, PNE_NULL);
+        return false;
+    }
+    *described = true;
+    uint32_t outer = w->fields;
+    wire_descriptor(w, PN_RECEIVED + wire_pick(w, 5));
+    if (form < 3) fields = 0;
+    if (form == 1) {
+        wire_put8(w, PNE_NULL);
+    } else {
+        size_t list = wire_enter(w, fields);
+        for (uint32_t i = 0; i < fields; i++) wire_uint(w);
+        wire_exit(w, list);
+    }
+    w->fields = outer;
+    return fields;
+}
+
+// what pn_data_decode and the transport's scan make of the performative
+// is what the fast decoder does, wherever the fast decoder takes it on;
+// returns whether it did
+static bool expect_transfer(pn_data_t *data, pn_data_t *state, const char *bytes, size_t size)
+{
+    pn_data_clear(data);
+    pn_data_clear(state);
+    ssize_t n = pn_data_decode(data, bytes, size);
+    assert(n > 0);
+    pni_transfer_t slow, fast;
+    assert(!pn_data_scan(data, "D.[I?IzIoo.D?LC]", &slow.handle, &slow.id_init, &slow.id,
+                         &slow.tag, &slow.format, &slow.settled, &slow.more,
+                         &slow.type_init, &slow.type, state));
+    size_t m = pni_decode_transfer(bytes, size, &fast);
+    if (!m) return false;
+    assert(m == (size_t) n);
+    assert(fast.handle == slow.handle);
+    assert(fast.id_init == slow.id_init && fast.id == slow.id);
+    assert(fast.tag.size == slow.tag.size);
+    assert(!fast.tag.size || !memcmp(fast.tag.start, slow.tag.start, fast.tag.size));
+    assert(fast.format == slow.format);
+    assert(fast.settled == slow.settled && fast.more == slow.more);
+    // the fast path leaves any delivery state to the generic one
+    assert(!slow.type_init && !fast.type_init);
+    return true;
+}
+
+static bool expect_flow(pn_data_t *data, const char *bytes, size_t size)
+{
+    pn_data_clear(data);
+    ssize_t n = pn_data_decode(data, bytes, size);
+    assert(n > 0);
+    pni_flow_t slow, fast;
+    assert(!pn_data_scan(data, "D.[?IIII?I?II.o]", &slow.inext_init, &slow.inext, &slow.iwin,
+                         &slow.onext, &slow.owin, &slow.handle_init, &slow.handle,
+                         &slow.dcount_init, &slow.delivery_count, &slow.link_credit,
+                         &slow.drain));
+    size_t m = pni_decode_flow(bytes, size, &fast);
+    if (!m) return false;
+    assert(m == (size_t) n);
+    assert(fast.inext_init == slow.inext_init && fast.inext == slow.inext);
+    assert(fast.iwin == slow.iwin);
+    assert(fast.onext == slow.onext && fast.owin == slow.owin);
+    assert(fast.handle_init == slow.handle_init && fast.handle == slow.handle);
+    assert(fast.dcount_init == slow.dcount_init && fast.delivery_count == slow.delivery_count);
+    assert(fast.link_credit == slow.link_credit);
+    assert(fast.drain == slow.drain);
+    return true;
+}
+
+static bool expect_disposition(pn_data_t *data, pn_data_t *state, const char *bytes, size_t size)
+{
+    pn_data_clear(data);
+    pn_data_clear(state);
+    ssize_t n = pn_data_decode(data, bytes, size);
+    assert(n > 0);
+    pni_disposition_t slow, fast;
+    slow.type = 0;
+    assert(!pn_data_scan(data, "D.[oI?IoD?LC]", &slow.role, &slow.first, &slow.last_init,
+                         &slow.last, &slow.settled, &slow.type_init, &slow.type, state));
+    size_t m = pni_decode_disposition(bytes, size, &fast);
+    if (!m) return false;
+    assert(m == (size_t) n);
+    assert(fast.role == slow.role && fast.first == slow.first);
+    assert(fast.last_init == slow.last_init && fast.last == slow.last);
+    assert(fast.settled == slow.settled);
+    assert(fast.type_init == slow.type_init && fast.type == slow.type);
+    // the state carries nothing the transport would look at
+    pn_data_rewind(state);
+    assert(!pn_data_next(state) || pn_data_type(state) == PN_NULL ||
+           (pn_data_type(state) == PN_LIST && !pn_data_get_list(state)));
+    return true;
+}
+
+// cut short anywhere, the fast decoders leave a frame to the generic path
+static void expect_truncated(size_t (*decode)(const char *, size_t, void *), const char *bytes,
+                             size_t size)
+{
+    union {
+        pni_transfer_t transfer;
+        pni_flow_t flow;
+        pni_disposition_t disposition;
+    } fields;
+    for (size_t cut = 0; cut < size; cut++) {
+        char *copy = (char *) malloc(cut ? cut : 1);
+        memcpy(copy, bytes, cut);
+        assert(!decode(copy, cut, &fields));
+        free(copy);
+    }
+}
+
+static size_t transfer_fast(const char *bytes, size_t size, void *fields)
+{
+    return pni_decode_transfer(bytes, size, (pni_transfer_t *) fields);
+}
+
+static size_t flow_fast(const char *bytes, size_t size, void *fields)
+{
+    return pni_decode_flow(bytes, size, (pni_flow_t *) fields);
+}
+
+static size_t disposition_fast(const char *bytes, size_t size, void *fields)
+{
+    return pni_decode_disposition(bytes, size, (pni_disposition_t *) fields);
+}
+
+// the fast decoders take the encodings other peers write, and the
+// transport's own, the same way the generic scan does, and leave to it
+// exactly what they don't cover
+int test_decode_direct(int argc, char **argv)
+{
+    fprintf(stdout, "test_decode_direct\n");
+    pn_data_t *data = pn_data(0);
+    pn_data_t *state = pn_data(0);
+    int taken[3] = {0}, left[3] = {0};
+
+    for (uint32_t seed = 1; seed <= 3000; seed++) {
+        wire_t w = {{0}, 0, seed, 0};
+        uint64_t code;
+        size_t list;
+        bool described, valued;
+
+        // transfer, with a payload behind it
+        wire_descriptor(&w, TRANSFER);
+        list = wire_enter(&w, wire_pick(&w, 12));
+        wire_uint(&w);                  // handle
+        wire_uint(&w);                  // delivery-id
+        wire_binary(&w);                // delivery-tag
+        wire_uint(&w);                  // message-format
+        wire_bool(&w);                  // settled
+        wire_bool(&w);                  // more
+        if (wire_field(&w)) {           // rcv-settle-mode
+            wire_put8(&w, PNE_UBYTE);
+            wire_put8(&w, wire_pick(&w, 2));
+        }
+        valued = wire_state(&w, wire_pick(&w, 3), &described);
+        wire_bool(&w);                  // resume
+        wire_bool(&w);                  // aborted
+        wire_bool(&w);                  // batchable
+        wire_exit(&w, list);
+        size_t size = w.size;
+        for (unsigned i = wire_pick(&w, 3) * 10; i; i--) wire_put8(&w, 'x');
+        assert(pni_decode_descriptor(w.bytes, w.size, &code) && code == TRANSFER);
+        assert(expect_transfer(data, state, w.bytes, w.size) == !described);
+        described ? left[0]++ : taken[0]++;
+        expect_truncated(transfer_fast, w.bytes, size);
+
+        // flow
+        w.size = 0;
+        wire_descriptor(&w, FLOW);
+        list = wire_enter(&w, wire_pick(&w, 12));
+        for (int i = 0; i < 8; i++) wire_uint(&w);
+        wire_bool(&w);                  // drain
+        wire_bool(&w);                  // echo
+        valued = w.fields && wire_pick(&w, 2);
+        if (valued) {
+            // properties
+            w.fields--;
+            wire_put8(&w, PNE_MAP8);
+            wire_put8(&w, 1);
+            wire_put8(&w, 0);
+        } else if (w.fields) {
+            w.fields--;
+            wire_put8(&w, PNE_NULL);
+        }
+        wire_exit(&w, list);
+        assert(pni_decode_descriptor(w.bytes, w.size, &code) && code == FLOW);
+        assert(expect_flow(data, w.bytes, w.size) == !valued);
+        valued ? left[1]++ : taken[1]++;
+        expect_truncated(flow_fast, w.bytes, w.size);
+
+        // disposition
+        w.size = 0;
+        wire_descriptor(&w, DISPOSITION);
+        list = wire_enter(&w, wire_pick(&w, 7));
+        wire_bool(&w);                  // role
+        wire_uint(&w);                  // first
+        wire_uint(&w);                  // last
+        wire_bool(&w);                  // settled
+        valued = wire_state(&w, wire_pick(&w, 3), &described);
+        wire_bool(&w);                  // batchable
+        wire_exit(&w, list);
+        assert(pni_decode_descriptor(w.bytes, w.size, &code) && code == DISPOSITION);
+        assert(expect_disposition(data, state, w.bytes, w.size) == !valued);
+        valued ? left[2]++ : taken[2]++;
+        expect_truncated(disposition_fast, w.bytes, w.size);
+    }
+    // both ways were tried for each
+    for (int i = 0; i < 3; i++) assert(taken[i] > 10 && left[i] > 10);
+
+    // each is decoded straight from what the transport itself writes
+    char bytes[1024];
+    pni_transfer_t transfer;
+    pn_bytes_t tag = pn_bytes(3, "tag");
+    ssize_t n = pni_encode_transfer(bytes, sizeof(bytes), 1, 2, &tag, 0, true, false, 0);
+    assert(n > 0 && expect_transfer(data, state, bytes, n));
+    assert(pni_decode_transfer(bytes, n, &transfer) == (size_t) n);
+    assert(transfer.handle == 1 && transfer.id == 2 && transfer.settled && !transfer.more);
+    n = pni_encode_transfer(bytes, sizeof(bytes), 1, 2, &tag, 0, true, false, PN_ACCEPTED);
+    assert(n > 0 && !expect_transfer(data, state, bytes, n));
+    n = pni_encode_flow(bytes, sizeof(bytes), true, 1, 2, 3, 4, true, 5, 6, 7, true);
+    assert(n > 0 && expect_flow(data, bytes, n));
+    n = pni_encode_disposition(bytes, sizeof(bytes), true, 1, 2, true, PN_ACCEPTED);
+    assert(n > 0 && expect_disposition(data, state, bytes, n));
+
+    // a field in a type the generic scan wouldn't take either, a symbolic
+    // descriptor, or a described list not a list
+    static const char ulong_handle[] = {0x00, 0x53, 0x14, (char) 0xc0, 0x03, 0x01, 0x53, 0x01};
+    static const char symbolic[] = {0x00, (char) 0xa3, 0x04, 'f', 'l', 'o', 'w', 0x45};
+    static const char not_a_list[] = {0x00, 0x53, 0x15, 0x40};
+    uint64_t code;
+    assert(!pni_decode_transfer(ulong_handle, sizeof(ulong_handle), &transfer));
+    assert(!pni_decode_descriptor(symbolic, sizeof(symbolic), &code));
+    pni_disposition_t disposition;
+    assert(pni_decode_descriptor(not_a_list, sizeof(not_a_list), &code) && code == DISPOSITION);
+    assert(!pni_decode_disposition(not_a_list, sizeof(not_a_list), &disposition));
+
+    pn_data_free(data);
+    pn_data_free(state);
+    return 0;
+}
 
 typedef int (*test_ptr_t)(int argc, char **argv);
 
 test_ptr_t tests[] = {test_free_connection,
                       test_free_session,
                       test_free_link,
+                      test_settle_out_of_order,
+                      test_settle_upto,
+                      test_settle_scrambled,
+                      test_disposition_outcomes,
+                      test_delivery_tags,
+                      test_link_handles,
+                      test_link_adopt,
+                      test_link_send_shared,
+                      test_link_send_file,
+                      test_work_links,
+                      test_session_window,
+                      test_connection_budget,
+                      test_link_recv_peek,
+                      test_delivery_segments,
+                      test_delivery_streaming,
+                      test_default_max_frame,
+                      test_transport_compact,
+                      test_sasl_passthru,
+                      test_sasl_verifier,
+                      test_sasl_pipelined,
+                      test_link_names,
+                      test_trace_filters,
+                      test_metrics,
+                      test_latency,
+                      test_log_async,
+                      test_capture,
+                      test_transport_compress,
+                      test_connection_driver,
+                      test_encode_direct,
+                      test_decode_direct,
                       NULL};
 
 int main(int argc, char **argv)
 {
+    // c-engine-tests capture CLIENT SERVER only makes the captures
+    if (argc == 4 && !strcmp(argv[1], "capture")) {
+        return capture_exchange(argv[2], argv[3]);
+    }
+
     test_ptr_t *test = tests;
     while (*test) {
         int rc = (*test++)(argc, argv);
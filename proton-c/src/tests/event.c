@@ -96,6 +96,78 @@ static void test_event_incref(bool eventfirst) {
   }
 }
 
+static void test_event_attachments(void) {
+  SETUP_COLLECTOR;
+  pn_record_t *attachments = pn_event_attachments(event);
+  assert(attachments == pn_event_attachments(event));
+  pn_record_set(attachments, PN_LEGCTX, obj);
+  pn_collector_pop(collector);
+  void *obj2 = pn_class_new(PN_OBJECT, 0);
+  pn_event_t *event2 = pn_collector_put(collector, PN_OBJECT, obj2, (pn_event_type_t) 0);
+  pn_decref(obj2);
+  assert(event2 == event);
+  assert(!pn_record_get(pn_event_attachments(event2), PN_LEGCTX));
+  pn_free(collector);
+}
+
+static int count_events(pn_collector_t *collector, pn_event_type_t type, void *context) {
+  int count = 0;
+  while (pn_collector_peek(collector)) {
+    pn_event_t *event = pn_collector_peek(collector);
+    if (pn_event_type(event) == type && pn_event_context(event) == context) {
+      count++;
+    }
+    pn_collector_pop(collector);
+  }
+  return count;
+}
+
+static void test_collector_coalesce(void) {
+  void *a = pn_class_new(PN_OBJECT, 0);
+  void *b = pn_class_new(PN_OBJECT, 0);
+  pn_collector_t *collector = pn_collector();
+
+  // the head stays, but a pending event further back absorbs repeats
+  assert(pn_collector_put(collector, PN_OBJECT, a, PN_DELIVERY));
+  assert(pn_collector_put(collector, PN_OBJECT, b, PN_DELIVERY));
+  assert(pn_collector_put(collector, PN_OBJECT, a, PN_DELIVERY));
+  assert(pn_collector_put(collector, PN_OBJECT, b, PN_LINK_FLOW));
+  assert(!pn_collector_put(collector, PN_OBJECT, a, PN_DELIVERY));
+  assert(!pn_collector_put(collector, PN_OBJECT, b, PN_DELIVERY));
+  assert(count_events(collector, PN_DELIVERY, a) == 2);
+
+  // once popped an event no longer absorbs anything
+  assert(pn_collector_put(collector, PN_OBJECT, a, PN_DELIVERY));
+  pn_collector_pop(collector);
+  assert(pn_collector_put(collector, PN_OBJECT, a, PN_DELIVERY));
+  pn_collector_pop(collector);
+
+  // transitions are only elided when they repeat the last event
+  assert(pn_collector_put(collector, PN_OBJECT, a, PN_CONNECTION_BOUND));
+  assert(pn_collector_put(collector, PN_OBJECT, a, PN_CONNECTION_UNBOUND));
+  assert(pn_collector_put(collector, PN_OBJECT, a, PN_CONNECTION_BOUND));
+  assert(count_events(collector, PN_CONNECTION_BOUND, a) == 2);
+
+  pn_free(collector);
+  pn_decref(a);
+  pn_decref(b);
+}
+
+static void test_collector_subscribe(void) {
+  void *obj = pn_class_new(PN_OBJECT, 0);
+  pn_collector_t *collector = pn_collector();
+  assert(pn_collector_subscribed(collector, PN_LINK_FLOW));
+  pn_collector_subscribe(collector, PN_LINK_FLOW, false);
+  assert(!pn_collector_subscribed(collector, PN_LINK_FLOW));
+  assert(!pn_collector_put(collector, PN_OBJECT, obj, PN_LINK_FLOW));
+  assert(!pn_collector_peek(collector));
+  assert(pn_collector_put(collector, PN_OBJECT, obj, PN_DELIVERY));
+  pn_collector_subscribe(collector, PN_LINK_FLOW, true);
+  assert(pn_collector_put(collector, PN_OBJECT, obj, PN_LINK_FLOW));
+  pn_free(collector);
+  pn_decref(obj);
+}
+
 int main(int argc, char **argv)
 {
   test_collector();
@@ -105,5 +177,8 @@ int main(int argc, char **argv)
   test_collector_pool();
   test_event_incref(true);
   test_event_incref(false);
+  test_event_attachments();
+  test_collector_coalesce();
+  test_collector_subscribe();
   return 0;
 }
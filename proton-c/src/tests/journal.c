@@ -0,0 +1,340 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "messenger/journal.h"
+
+#define assert(E) ((E) ? 0 : (abort(), 0))
+
+#define MAX_RECOVERED (256)
+
+typedef struct {
+  int count;
+  uint64_t ids[MAX_RECOVERED];
+  uint32_t formats[MAX_RECOVERED];
+  char addresses[MAX_RECOVERED][32];
+  char bodies[MAX_RECOVERED][64];
+} recovered_t;
+
+static void recover(void *context, uint64_t id, const char *address, uint32_t format,
+                    pn_bytes_t encoded)
+{
+  recovered_t *r = (recovered_t *) context;
+  assert(r->count < MAX_RECOVERED);
+  assert(strlen(address) < sizeof(r->addresses[0]) && encoded.size < sizeof(r->bodies[0]));
+  r->ids[r->count] = id;
+  r->formats[r->count] = format;
+  strcpy(r->addresses[r->count], address);
+  memcpy(r->bodies[r->count], encoded.start, encoded.size);
+  r->bodies[r->count][encoded.size] = '\0';
+  r->count++;
+}
+
+static char directory[256];
+
+static void path_of(char *path, size_t size, const char *name)
+{
+  snprintf(path, size, "%s/%s", directory, name);
+}
+
+// an empty directory for the journal
+static void fresh(void)
+{
+  mkdir(directory, 0700);
+  DIR *dir = opendir(directory);
+  assert(dir);
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+    char path[512];
+    path_of(path, sizeof(path), entry->d_name);
+    assert(!remove(path));
+  }
+  closedir(dir);
+}
+
+static int segments(void)
+{
+  DIR *dir = opendir(directory);
+  assert(dir);
+  int count = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    size_t n = strlen(entry->d_name);
+    if (n > 4 && !strcmp(entry->d_name + n - 4, ".seg")) count++;
+  }
+  closedir(dir);
+  return count;
+}
+
+static bool exists(const char *name)
+{
+  char path[512];
+  path_of(path, sizeof(path), name);
+  struct stat st;
+  return !stat(path, &st);
+}
+
+static size_t read_file(const char *name, char *bytes, size_t capacity)
+{
+  char path[512];
+  path_of(path, sizeof(path), name);
+  FILE *file = fopen(path, "rb");
+  assert(file);
+  size_t n = fread(bytes, 1, capacity, file);
+  assert(feof(file));
+  fclose(file);
+  return n;
+}
+
+static void write_file(const char *name, const char *bytes, size_t size)
+{
+  char path[512];
+  path_of(path, sizeof(path), name);
+  FILE *file = fopen(path, "wb");
+  assert(file);
+  assert(fwrite(bytes, 1, size, file) == size);
+  fclose(file);
+}
+
+static uint64_t put(pni_journal_t *journal, int i)
+{
+  char address[32], body[64];
+  snprintf(address, sizeof(address), "queue-%d", i % 3);
+  snprintf(body, sizeof(body), "body of message %d", i);
+  uint64_t id = pni_journal_put(journal, address, (uint32_t) i, pn_bytes(strlen(body), body));
+  assert(id);
+  return id;
+}
+
+// the i-th recovered message is the one put as number
+static void expect(recovered_t *r, int i, int number)
+{
+  char address[32], body[64];
+  snprintf(address, sizeof(address), "queue-%d", number % 3);
+  snprintf(body, sizeof(body), "body of message %d", number);
+  assert(r->formats[i] == (uint32_t) number);
+  assert(!strcmp(r->addresses[i], address));
+  assert(!strcmp(r->bodies[i], body));
+}
+
+static pni_journal_t *reopen(recovered_t *r, size_t segment_size)
+{
+  memset(r, 0, sizeof(*r));
+  pni_journal_t *journal = pni_journal(directory);
+  assert(journal);
+  if (segment_size) pni_journal_set_segment_size(journal, segment_size);
+  assert(pni_journal_open(journal, recover, r) == r->count);
+  return journal;
+}
+
+// what was put and not done comes back in order, once
+static void test_reopen(void)
+{
+  fresh();
+  recovered_t r;
+  pni_journal_t *journal = reopen(&r, 0);
+  assert(r.count == 0);
+  uint64_t ids[10];
+  for (int i = 0; i < 10; i++) ids[i] = put(journal, i);
+  for (int i = 0; i < 10; i += 2) assert(!pni_journal_done(journal, ids[i]));
+  assert(!pni_journal_commit(journal));
+  pni_journal_free(journal);
+
+  journal = reopen(&r, 0);
+  assert(r.count == 5);
+  for (int i = 0; i < 5; i++) {
+    assert(r.ids[i] == ids[2*i + 1]);
+    expect(&r, i, 2*i + 1);
+  }
+  // ids carry on from the last run
+  uint64_t next = put(journal, 10);
+  assert(next > ids[9]);
+  for (int i = 0; i < r.count; i++) assert(!pni_journal_done(journal, r.ids[i]));
+  pni_journal_free(journal);
+
+  journal = reopen(&r, 0);
+  assert(r.count == 1 && r.ids[0] == next);
+  expect(&r, 0, 10);
+  assert(!pni_journal_done(journal, next));
+  pni_journal_free(journal);
+
+  journal = reopen(&r, 0);
+  assert(r.count == 0);
+  pni_journal_free(journal);
+}
+
+// a segment cut short or zeroed from any byte on, as a crash leaves it,
+// gives back the messages whose records were whole and nothing else
+static void test_torn(void)
+{
+  fresh();
+  recovered_t r;
+  pni_journal_t *journal = reopen(&r, 0);
+  uint64_t ids[4];
+  for (int i = 0; i < 4; i++) ids[i] = put(journal, i);
+  assert(!pni_journal_done(journal, ids[1]));
+  put(journal, 4);
+  pni_journal_free(journal);
+
+  // the records end where they do for their addresses and bodies
+  const char *name = "00000000000000000000.seg";
+  static char segment[4096], torn[4096];
+  size_t size = read_file(name, segment, sizeof(segment));
+  size_t ends[6];
+  size_t offset = 8;
+  for (int i = 0, k = 0; i < 6; i++) {
+    if (i == 4) {
+      offset += 17;
+    } else {
+      char body[64];
+      int n = k++;
+      snprintf(body, sizeof(body), "body of message %d", n);
+      offset += 25 + strlen("queue-0") + 1 + strlen(body);
+    }
+    ends[i] = offset;
+  }
+  assert(ends[5] == size);
+
+  for (int zeroed = 0; zeroed < 2; zeroed++) {
+    for (size_t cut = 0; cut <= size; cut++) {
+      fresh();
+      memcpy(torn, segment, cut);
+      memset(torn + cut, 0, size - cut);
+      write_file(name, torn, zeroed ? size : cut);
+
+      journal = reopen(&r, 0);
+      int expected[4], count = 0;
+      for (int i = 0; i < 5; i++) {
+        size_t end = ends[i < 4 ? i : 5];
+        if (end > cut) continue;
+        // message 1 is done once the record after message 3 is whole
+        if (i == 1 && ends[4] <= cut) continue;
+        expected[count++] = i;
+      }
+      assert(r.count == count);
+      for (int i = 0; i < count; i++) expect(&r, i, expected[i]);
+
+      // the journal goes on after the tear, and a second run finds the
+      // same messages and the new one
+      uint64_t id = put(journal, 9);
+      for (int i = 0; i < count; i++) assert(r.ids[i] < id);
+      pni_journal_free(journal);
+      journal = reopen(&r, 0);
+      assert(r.count == count + 1 && r.ids[count] == id);
+      expect(&r, count, 9);
+      pni_journal_free(journal);
+    }
+  }
+}
+
+// full segments are left behind, and go once nothing in them is live
+static void test_rotation(void)
+{
+  fresh();
+  recovered_t r;
+  pni_journal_t *journal = reopen(&r, 256);
+  uint64_t ids[40];
+  for (int i = 0; i < 40; i++) ids[i] = put(journal, i);
+  int many = segments();
+  assert(many > 4);
+
+  // the oldest messages done, their segments go
+  for (int i = 0; i < 20; i++) assert(!pni_journal_done(journal, ids[i]));
+  assert(segments() < many);
+  assert(exists("head") && !exists("head.new"));
+  pni_journal_free(journal);
+
+  journal = reopen(&r, 256);
+  assert(r.count == 20);
+  for (int i = 0; i < 20; i++) {
+    assert(r.ids[i] == ids[20 + i]);
+    expect(&r, i, 20 + i);
+  }
+  pni_journal_free(journal);
+
+  // a head written aside and never moved into place, the segments
+  // before it not yet removed: nothing is lost
+  char head[16];
+  assert(read_file("head", head, sizeof(head)) == 8);
+  head[7]++;
+  write_file("head.new", head, 8);
+  journal = reopen(&r, 256);
+  assert(r.count == 20 && r.ids[0] == ids[20]);
+
+  // retiring while it is there writes over it
+  for (int i = 0; i < 20; i++) assert(!pni_journal_done(journal, r.ids[i]));
+  assert(!exists("head.new"));
+  assert(segments() == 1);
+  pni_journal_free(journal);
+
+  journal = reopen(&r, 256);
+  assert(r.count == 0);
+  pni_journal_free(journal);
+}
+
+// a done for a message whose segment has gone changes nothing live
+static void test_done_retired(void)
+{
+  fresh();
+  recovered_t r;
+  pni_journal_t *journal = reopen(&r, 32);
+  uint64_t first = put(journal, 0);
+  uint64_t second = put(journal, 1);
+  uint64_t third = put(journal, 2);
+  assert(segments() >= 3);
+  assert(!pni_journal_done(journal, first));
+  assert(!exists("00000000000000000000.seg"));
+
+  int many = segments();
+  assert(!pni_journal_done(journal, first));
+  assert(!pni_journal_done(journal, 0));
+  assert(segments() == many);
+  pni_journal_free(journal);
+
+  // and after a restart, when the segment is known only by its absence
+  journal = reopen(&r, 32);
+  assert(r.count == 2 && r.ids[0] == second && r.ids[1] == third);
+  assert(!pni_journal_done(journal, first));
+  pni_journal_free(journal);
+
+  journal = reopen(&r, 32);
+  assert(r.count == 2 && r.ids[0] == second && r.ids[1] == third);
+  pni_journal_free(journal);
+}
+
+int main(int argc, char **argv)
+{
+  snprintf(directory, sizeof(directory), "%s/journal-test-%d",
+           argc > 1 ? argv[1] : ".", (int) getpid());
+  test_reopen();
+  test_torn();
+  test_rotation();
+  test_done_retired();
+  fresh();
+  rmdir(directory);
+  return 0;
+}
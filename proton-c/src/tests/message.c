@@ -23,8 +23,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <proton/alloc.h>
+#include <proton/connection.h>
 #include <proton/error.h>
+#include <proton/filter.h>
+#include <proton/link.h>
 #include <proton/message.h>
+#include <proton/session.h>
+#include "message/message.h"
 
 #define assert(E) ((E) ? 0 : (abort(), 0))
 
@@ -37,11 +43,803 @@ static void test_overflow_error(void)
   int err = pn_message_encode(message, buf, &size);
   assert(err == PN_OVERFLOW);
   assert(pn_message_errno(message) == 0);
+
+  // the required size is reported so one retry is enough
+  assert(size > 8);
+  char *big = (char *) malloc(size);
+  size_t required = size;
+  assert(pn_message_encode(message, big, &size) == 0);
+  assert(size == required);
+  free(big);
+  pn_message_free(message);
+}
+
+static void test_encode_growable(void)
+{
+  pn_message_t *message = pn_message();
+  pn_message_set_address(message, "queue");
+  char payload[4096];
+  memset(payload, 'x', sizeof(payload));
+  pn_data_put_binary(pn_message_body(message), pn_bytes(sizeof(payload), payload));
+
+  pn_rwbytes_t buf = pn_rwbytes(0, NULL);
+  ssize_t size = pn_message_encode2(message, &buf);
+  assert(size > (ssize_t) sizeof(payload) && buf.start && buf.size >= (size_t) size);
+
+  pn_message_t *decoded = pn_message();
+  assert(pn_message_decode(decoded, buf.start, size) == 0);
+  assert(strcmp(pn_message_get_address(decoded), "queue") == 0);
+
+  // an adequate buffer is reused as is
+  char *start = buf.start;
+  assert(pn_message_encode2(decoded, &buf) == size);
+  assert(buf.start == start);
+
+  free(buf.start);
+  pn_message_free(decoded);
+  pn_message_free(message);
+}
+
+// small and large messages packed one after another are found again in
+// order, and anything but a data section is refused
+static void test_batch(void)
+{
+  pn_message_t *message = pn_message();
+  pn_rwbytes_t buf = pn_rwbytes(0, NULL);
+  ssize_t end = 0;
+  static char large[1000];
+  for (int i = 0; i < 20; i++) {
+    char subject[16];
+    snprintf(subject, sizeof(subject), "msg-%d", i);
+    pn_message_set_subject(message, subject);
+    pn_data_t *body = pn_message_body(message);
+    pn_data_clear(body);
+    pn_data_put_binary(body, pn_bytes(i % 5 ? 10 : sizeof(large), large));
+    end = pn_message_encode_batch(message, &buf, end);
+    assert(end > 0 && buf.size >= (size_t) end);
+  }
+
+  pn_message_t *decoded = pn_message();
+  const char *bytes = buf.start;
+  size_t size = end;
+  for (int i = 0; i < 20; i++) {
+    pn_bytes_t encoded;
+    ssize_t n = pn_message_batch_next(bytes, size, &encoded);
+    assert(n > 0 && (size_t) n <= size);
+    assert(pn_message_decode(decoded, encoded.start, encoded.size) == 0);
+    char subject[16];
+    snprintf(subject, sizeof(subject), "msg-%d", i);
+    assert(strcmp(pn_message_get_subject(decoded), subject) == 0);
+    bytes += n;
+    size -= n;
+  }
+  pn_bytes_t encoded;
+  assert(pn_message_batch_next(bytes, size, &encoded) == PN_EOS);
+  assert(pn_message_batch_next(buf.start, 3, &encoded) == PN_UNDERFLOW);
+  assert(pn_message_batch_next(buf.start, end - 1, &encoded) > 0);
+  assert(pn_message_encode_batch(message, &buf, buf.size + 1) == PN_ARG_ERR);
+
+  // a plain message is no batch
+  pn_rwbytes_t plain = pn_rwbytes(0, NULL);
+  ssize_t len = pn_message_encode2(message, &plain);
+  assert(len > 0 && pn_message_batch_next(plain.start, len, &encoded) == PN_ERR);
+
+  free(plain.start);
+  free(buf.start);
+  pn_message_free(decoded);
+  pn_message_free(message);
+}
+
+static void test_properties_roundtrip(void)
+{
+  pn_message_t *message = pn_message();
+  pn_data_t *props = pn_message_properties(message);
+  pn_data_put_map(props);
+  pn_data_enter(props);
+  pn_data_put_string(props, pn_bytes(3, "key"));
+  pn_data_put_int(props, 42);
+  pn_data_exit(props);
+
+  char buf[256], buf2[256];
+  size_t size = sizeof(buf);
+  assert(pn_message_encode(message, buf, &size) == 0);
+
+  // the decoded properties are re-encoded without being looked at
+  pn_message_t *decoded = pn_message();
+  assert(pn_message_decode(decoded, buf, size) == 0);
+  size_t size2 = sizeof(buf2);
+  assert(pn_message_encode(decoded, buf2, &size2) == 0);
+  assert(size == size2 && memcmp(buf, buf2, size) == 0);
+
+  props = pn_message_properties(decoded);
+  pn_data_rewind(props);
+  assert(pn_data_next(props) && pn_data_get_map(props) == 2);
+  assert(pn_data_enter(props));
+  assert(pn_data_next(props) && pn_data_get_string(props).size == 3);
+  assert(pn_data_next(props) && pn_data_get_int(props) == 42);
+  assert(!pn_data_next(props));
+
+  pn_message_free(decoded);
+  pn_message_free(message);
+}
+
+static void test_decode_borrowed(void)
+{
+  pn_message_t *message = pn_message();
+  pn_message_set_address(message, "queue");
+  pn_data_put_string(pn_message_body(message), pn_bytes(5, "hello"));
+
+  char buf[256], buf2[256];
+  size_t size = sizeof(buf);
+  assert(pn_message_encode(message, buf, &size) == 0);
+
+  pn_message_t *borrowed = pn_message();
+  assert(pn_message_decode_borrowed(borrowed, buf, size) == 0);
+  pn_bytes_t address = pn_message_get_address_bytes(borrowed);
+  assert(address.size == 5 && address.start > buf && address.start < buf + size);
+  assert(memcmp(address.start, "queue", 5) == 0);
+
+  size_t size2 = sizeof(buf2);
+  assert(pn_message_encode(borrowed, buf2, &size2) == 0);
+  assert(size == size2 && memcmp(buf, buf2, size) == 0);
+
+  assert(strcmp(pn_message_get_address(borrowed), "queue") == 0);
+  pn_data_t *body = pn_message_body(borrowed);
+  assert(pn_data_next(body) && pn_data_get_string(body).size == 5);
+
+  pn_message_free(borrowed);
+  pn_message_free(message);
+}
+
+static void test_decode_head(void)
+{
+  pn_message_t *message = pn_message();
+  pn_message_set_address(message, "queue");
+  pn_message_set_ttl(message, 500);
+  pn_data_put_string(pn_message_body(message), pn_bytes(5, "hello"));
+
+  char buf[256];
+  size_t size = sizeof(buf);
+  assert(pn_message_encode(message, buf, &size) == 0);
+
+  pn_message_t *head = pn_message();
+  ssize_t offset = pn_message_decode_head(head, buf, size,
+                                          PN_MESSAGE_HEADER | PN_MESSAGE_PROPERTIES);
+  assert(offset > 0 && (size_t) offset < size);
+  assert(strcmp(pn_message_get_address(head), "queue") == 0);
+  assert(pn_message_get_ttl(head) == 500);
+  assert(pn_data_size(pn_message_body(head)) == 0);
+
+  // the tail is exactly the body section
+  pn_data_t *body = pn_data(0);
+  assert(pn_data_decode(body, buf + offset, size - offset) == (ssize_t) (size - offset));
+  pn_data_free(body);
+
+  pn_message_free(head);
+  pn_message_free(message);
+}
+
+static void test_reencode_unchanged(void)
+{
+  pn_message_t *message = pn_message();
+  pn_message_set_address(message, "queue");
+  pn_message_set_subject(message, "greeting");
+  pn_message_set_ttl(message, 500);
+  pn_data_put_string(pn_message_body(message), pn_bytes(5, "hello"));
+
+  char buf[256];
+  size_t size = sizeof(buf);
+  assert(pn_message_encode(message, buf, &size) == 0);
+
+  pn_message_t *copy = pn_message();
+  assert(pn_message_decode(copy, buf, size) == 0);
+  // clobbering the input must not disturb the decoded message
+  char saved[256];
+  memcpy(saved, buf, size);
+  memset(buf, 0, size);
+
+  char again[256];
+  size_t again_size = sizeof(again);
+  assert(pn_message_encode(copy, again, &again_size) == 0);
+  assert(again_size == size && memcmp(again, saved, size) == 0);
+
+  // a modified header is encoded from its fields
+  pn_message_set_ttl(copy, 1000);
+  again_size = sizeof(again);
+  assert(pn_message_encode(copy, again, &again_size) == 0);
+  pn_message_t *check = pn_message();
+  assert(pn_message_decode(check, again, again_size) == 0);
+  assert(pn_message_get_ttl(check) == 1000);
+  assert(strcmp(pn_message_get_address(check), "queue") == 0);
+  assert(strcmp(pn_message_get_subject(check), "greeting") == 0);
+
+  pn_message_free(check);
+  pn_message_free(copy);
+  pn_message_free(message);
+}
+
+static void test_move(void)
+{
+  pn_message_t *message = pn_message();
+  pn_message_set_address(message, "queue");
+  pn_message_set_ttl(message, 500);
+  pn_data_put_ulong(pn_message_id(message), 7);
+  pn_data_put_string(pn_message_body(message), pn_bytes(5, "hello"));
+
+  char buf[256];
+  size_t size = sizeof(buf);
+  assert(pn_message_encode(message, buf, &size) == 0);
+
+  pn_message_t *decoded = pn_message();
+  assert(pn_message_decode(decoded, buf, size) == 0);
+
+  pn_message_t *target = pn_message();
+  pn_message_set_subject(target, "stale");
+  pn_data_put_int(pn_message_body(target), 3);
+  pn_data_t *id = pn_message_id(target);
+  pn_data_t *body = pn_message_body(target);
+
+  pni_message_move(target, decoded);
+  assert(pn_message_id(target) == id && pn_message_body(target) == body);
+  assert(strcmp(pn_message_get_address(target), "queue") == 0);
+  assert(pn_message_get_subject(target) == NULL);
+  assert(pn_message_get_ttl(target) == 500);
+  pn_data_rewind(id);
+  assert(pn_data_next(id) && pn_data_get_ulong(id) == 7);
+  pn_data_rewind(body);
+  assert(pn_data_next(body) && pn_data_get_string(body).size == 5);
+
+  char again[256];
+  size_t again_size = sizeof(again);
+  assert(pn_message_encode(target, again, &again_size) == 0);
+  assert(again_size == size && memcmp(again, buf, size) == 0);
+
+  // what is left behind can be decoded into again
+  assert(pn_message_decode(decoded, buf, size) == 0);
+  assert(strcmp(pn_message_get_address(decoded), "queue") == 0);
+
+  pn_message_free(target);
+  pn_message_free(decoded);
+  pn_message_free(message);
+}
+
+static int allocations = 0;
+
+static void *count_allocate(void *context, size_t size)
+{
+  allocations++;
+  return malloc(size);
+}
+
+static void *count_reallocate(void *context, void *ptr, size_t size)
+{
+  return realloc(ptr, size);
+}
+
+static void count_deallocate(void *context, void *ptr)
+{
+  free(ptr);
+}
+
+static void test_lazy_fields(void)
+{
+  pn_allocator_t allocator = {count_allocate, count_reallocate, count_deallocate, NULL};
+  assert(!pn_set_allocator(&allocator));
+  allocations = 0;
+  pn_message_t *msg = pn_message();
+  assert(allocations == 1);
+
+  // unset fields read as they always have without being created
+  assert(!pn_message_get_address(msg));
+  assert(pn_message_get_subject_bytes(msg).start == NULL);
+  assert(pn_message_get_user_id(msg).size == 0);
+  assert(pn_message_get_id(msg).type == PN_NULL);
+  assert(pn_message_get_correlation_id(msg).type == PN_NULL);
+  assert(pn_message_errno(msg) == 0);
+  assert(!pn_message_set_reply_to(msg, NULL));
+  pn_message_clear(msg);
+  assert(allocations == 1);
+
+  pn_message_set_address(msg, "queue");
+  assert(!strcmp(pn_message_get_address(msg), "queue"));
+  pn_data_put_int(pn_message_body(msg), 42);
+  char buf[256];
+  size_t size = sizeof(buf);
+  assert(!pn_message_encode(msg, buf, &size));
+
+  // fields and sections that were created are kept for reuse
+  pn_message_clear(msg);
+  assert(!pn_message_get_address(msg) && !pn_data_size(pn_message_body(msg)));
+  int used = allocations;
+  pn_message_set_address(msg, "queue");
+  pn_data_put_int(pn_message_body(msg), 42);
+  assert(allocations == used);
+
+  pn_message_t *decoded = pn_message();
+  assert(!pn_message_decode(decoded, buf, size));
+  assert(!strcmp(pn_message_get_address(decoded), "queue"));
+  assert(!pn_message_get_subject(decoded));
+  pn_data_t *body = pn_message_body(decoded);
+  assert(pn_data_next(body) && pn_data_get_int(body) == 42);
+  pn_message_free(decoded);
+  pn_message_free(msg);
+  pn_set_allocator(NULL);
+}
+
+static void put_map(pn_data_t *data, int entries)
+{
+  char key[16];
+  pn_data_put_map(data);
+  pn_data_enter(data);
+  for (int i = 0; i < entries; i++) {
+    snprintf(key, sizeof(key), "key-%d", i);
+    pn_data_put_string(data, pn_bytes(strlen(key), key));
+    pn_data_put_int(data, i);
+  }
+  // a duplicate resolves to the first
+  pn_data_put_symbol(data, pn_bytes(5, "key-0"));
+  pn_data_put_int(data, -1);
+  pn_data_exit(data);
+}
+
+static int lookup_int(pn_data_t *data, const char *name)
+{
+  pn_data_rewind(data);
+  pn_data_next(data);
+  pn_data_enter(data);
+  return pn_data_lookup(data, name) ? pn_data_get_int(data) : -2;
+}
+
+static void test_map_lookup(void)
+{
+  int sizes[] = {4, 100};
+  for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+    int entries = sizes[s];
+    pn_data_t *built = pn_data(0);
+    put_map(built, entries);
+    char buf[4096];
+    ssize_t size = pn_data_encode(built, buf, sizeof(buf));
+    assert(size > 0);
+    pn_data_t *data = pn_data(0);
+    assert(pn_data_decode(data, buf, size) == size);
+
+    // the index is built on the second pass and agrees with a scan
+    for (int pass = 0; pass < 3; pass++) {
+      assert(lookup_int(data, "key-0") == 0);
+      assert(lookup_int(data, "key-3") == 3);
+      assert(lookup_int(data, "key-") == -2);
+      assert(lookup_int(data, "missing") == -2);
+      assert(pn_data_type(data) == PN_INT && pn_data_get_int(data) == -1);
+    }
+    assert(lookup_int(data, "key-1") == 1);
+    assert(!pn_data_lookup(data, "key-1"));
+
+    // changes drop the index
+    pn_data_rewind(data);
+    pn_data_next(data);
+    pn_data_enter(data);
+    assert(pn_data_lookup(data, "key-2") && pn_data_prev(data) && pn_data_prev(data));
+    pn_data_put_string(data, pn_bytes(7, "renamed"));
+    assert(lookup_int(data, "renamed") == 2);
+    assert(lookup_int(data, "key-2") == -2);
+
+    const char *names[] = {"key-3", "missing", "key-0", "key-3", "key-1"};
+    pn_handle_t values[5];
+    pn_data_rewind(data);
+    pn_data_next(data);
+    pn_data_enter(data);
+    pn_handle_t point = pn_data_point(data);
+    assert(pn_data_lookup_keys(data, names, 5, values) == 4);
+    assert(pn_data_point(data) == point);
+    assert(!values[1] && values[0] == values[3]);
+    assert(pn_data_restore(data, values[2]) && pn_data_get_int(data) == 0);
+    assert(pn_data_restore(data, values[4]) && pn_data_get_int(data) == 1);
+    assert(pn_data_restore(data, values[0]) && pn_data_get_int(data) == 3);
+
+    pn_data_free(data);
+    pn_data_free(built);
+  }
+}
+
+static void put_property(pn_data_t *data, const char *key)
+{
+  pn_data_put_string(data, pn_bytes(strlen(key), key));
+}
+
+// decodes and re-encodes a mangled message, which may only fail cleanly
+static void decode_mangled(const char *bytes, size_t size)
+{
+  pn_message_t *msg = pn_message();
+  if (!pn_message_decode(msg, bytes, size)) {
+    char out[1024];
+    size_t out_size = sizeof(out);
+    pn_message_encode(msg, out, &out_size);
+    pn_message_get_address(msg);
+    pn_data_t *props = pn_message_properties(msg);
+    pn_data_rewind(props);
+    if (pn_data_next(props)) pn_data_enter(props);
+  }
+  pn_message_free(msg);
+}
+
+static void test_malformed_input(void)
+{
+  pn_message_t *message = pn_message();
+  pn_message_set_durable(message, true);
+  pn_message_set_ttl(message, 500);
+  pn_message_set_address(message, "queue");
+  pn_data_t *props = pn_message_properties(message);
+  pn_data_put_map(props);
+  pn_data_enter(props);
+  pn_data_put_string(props, pn_bytes(3, "key"));
+  pn_data_put_int(props, 1000);
+  pn_data_exit(props);
+  pn_data_put_string(pn_message_body(message), pn_bytes(5, "hello"));
+  char buf[256];
+  size_t size = sizeof(buf);
+  assert(pn_message_encode(message, buf, &size) == 0);
+
+  // a list32 header where the ttl was, which runs past the header list
+  const char ttl[] = {0x70, 0x00, 0x00, 0x01, (char) 0xf4};
+  char *at = NULL;
+  for (size_t i = 0; i + sizeof(ttl) <= size && !at; i++) {
+    if (!memcmp(buf + i, ttl, sizeof(ttl))) at = buf + i;
+  }
+  assert(at);
+  char bad[256];
+  memcpy(bad, buf, size);
+  bad[at - buf] = (char) 0xd0;
+  pn_message_t *decoded = pn_message();
+  assert(pn_message_decode(decoded, bad, size) < 0);
+  pn_message_free(decoded);
+
+  // every byte turned into each constructor that carries a size
+  const unsigned char codes[] = {0xa0, 0xb0, 0xc0, 0xc1, 0xd0, 0xd1, 0xe0, 0xf0, 0xff, 0x00};
+  for (size_t i = 0; i < size; i++) {
+    for (size_t c = 0; c < sizeof(codes); c++) {
+      memcpy(bad, buf, size);
+      bad[i] = (char) codes[c];
+      decode_mangled(bad, size);
+      decode_mangled(bad, i + 1);
+    }
+  }
+  pn_message_free(message);
+}
+
+// a lazy map whose elements do not decode stays as it was, and can
+// neither be entered nor encoded nor copied
+static void test_malformed_lazy_map(void)
+{
+  pn_data_t *built = pn_data(0);
+  put_map(built, 80);
+  char buf[4096];
+  ssize_t size = pn_data_encode(built, buf, sizeof(buf));
+  assert(size > 0);
+  const char *key = "key-40";
+  char *at = NULL;
+  for (ssize_t i = 0; i + 6 <= size && !at; i++) {
+    if (!memcmp(buf + i, key, 6)) at = buf + i;
+  }
+  assert(at && at[-1] == 6);
+  at[-1] = (char) 0xff;
+
+  pn_data_t *data = pn_data(0);
+  pn_data_set_lazy(data, true);
+  assert(pn_data_decode(data, buf, size) == size);
+  size_t nodes = pn_data_size(data);
+  pn_data_rewind(data);
+  assert(pn_data_next(data) && pn_data_type(data) == PN_MAP);
+  for (int attempt = 0; attempt < 2; attempt++) {
+    assert(!pn_data_enter(data));
+    assert(pn_data_errno(data) != 0);
+    assert(pn_data_size(data) == nodes);
+  }
+  char out[4096];
+  assert(pn_data_encode(data, out, sizeof(out)) < 0);
+  pn_data_t *copy = pn_data(0);
+  assert(pn_data_copy(copy, data) != 0);
+  char text[8192];
+  size_t text_size = sizeof(text);
+  assert(pn_data_format(data, text, &text_size) != 0);
+
+  pn_data_free(copy);
+  pn_data_free(data);
+  pn_data_free(built);
+}
+
+// counts that cannot fit in the input are refused before anything is
+// allocated for them
+static void test_decode_counts(void)
+{
+  const char *bad[] = {
+    "\xf0\x00\x00\x00\x05\x08\x00\x00\x00\x43",      // array32 of 2^27 uint0
+    "\xe0\x02\xff\x40",                             // array8 of 255 nulls
+    "\xe0\x03\x05\xa1\x00",                         // array8 of 5 empty strings
+    "\xd0\x00\x00\x00\x08\x7f\xff\xff\xff\x40\x40", // list32 of 2^31 - 1
+    "\xd1\x00\x00\x00\x08\x00\x10\x00\x00\x40\x40", // map32 of 2^20
+    "\xc0\x01\x05\x40",                             // list8 of 5
+  };
+  const size_t sizes[] = {10, 4, 5, 11, 11, 4};
+  for (int lazy = 0; lazy < 2; lazy++) {
+    for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+      pn_data_t *data = pn_data(0);
+      pn_data_set_lazy(data, lazy);
+      assert(pn_data_decode(data, bad[i], sizes[i]) < 0);
+      pn_data_free(data);
+    }
+  }
+
+  // a short array of nulls still decodes
+  pn_data_t *data = pn_data(0);
+  assert(pn_data_decode(data, "\xe0\x02\x03\x40", 4) == 4);
+  pn_data_rewind(data);
+  assert(pn_data_next(data) && pn_data_get_array(data) == 3);
+  pn_data_free(data);
+}
+
+// puts the i-th value of the test pattern as a node of its own
+static void put_element(pn_data_t *data, pn_type_t type, size_t i)
+{
+  switch (type) {
+  case PN_UBYTE: pn_data_put_ubyte(data, (uint8_t) (i * 7)); break;
+  case PN_SHORT: pn_data_put_short(data, (int16_t) (i * 1001 - 3000)); break;
+  case PN_INT: pn_data_put_int(data, (int32_t) (i * 100003) - 5); break;
+  case PN_DOUBLE: pn_data_put_double(data, i * 0.25 - 1); break;
+  case PN_LONG: pn_data_put_long(data, (int64_t) i << 40 | i); break;
+  default: abort();
+  }
+}
+
+static void get_element(pn_data_t *data, pn_type_t type, size_t i, void *value)
+{
+  switch (type) {
+  case PN_UBYTE: *(uint8_t *) value = (uint8_t) (i * 7); break;
+  case PN_SHORT: *(int16_t *) value = (int16_t) (i * 1001 - 3000); break;
+  case PN_INT: *(int32_t *) value = (int32_t) (i * 100003) - 5; break;
+  case PN_DOUBLE: *(double *) value = i * 0.25 - 1; break;
+  case PN_LONG: *(int64_t *) value = (int64_t) i << 40 | i; break;
+  default: abort();
+  }
+}
+
+static bool is_element(pn_data_t *data, pn_type_t type, size_t i)
+{
+  char expected[8];
+  get_element(data, type, i, expected);
+  switch (type) {
+  case PN_UBYTE: return pn_data_get_ubyte(data) == *(uint8_t *) expected;
+  case PN_SHORT: return pn_data_get_short(data) == *(int16_t *) expected;
+  case PN_INT: return pn_data_get_int(data) == *(int32_t *) expected;
+  case PN_DOUBLE: return pn_data_get_double(data) == *(double *) expected;
+  case PN_LONG: return pn_data_get_long(data) == *(int64_t *) expected;
+  default: return false;
+  }
+}
+
+static bool is_string(pn_data_t *data, const char *expected)
+{
+  pn_bytes_t bytes = pn_data_get_string(data);
+  return pn_data_type(data) == PN_STRING && bytes.size == strlen(expected) &&
+    !memcmp(bytes.start, expected, bytes.size);
+}
+
+// a packed array reads back and encodes exactly as one put a node at a
+// time, and the strings around it survive the buffer growing under it
+static void test_array_values(void)
+{
+  const pn_type_t types[] = {PN_UBYTE, PN_SHORT, PN_INT, PN_DOUBLE, PN_LONG};
+  const size_t widths[] = {1, 2, 4, 8, 8};
+  const size_t counts[] = {0, 1, 3, 100, 5000};
+  for (size_t t = 0; t < sizeof(types)/sizeof(types[0]); t++) {
+    for (size_t c = 0; c < sizeof(counts)/sizeof(counts[0]); c++) {
+      pn_type_t type = types[t];
+      size_t width = widths[t];
+      size_t count = counts[c];
+      char *values = (char *) malloc(width * count + 1);
+      char *out = (char *) malloc(width * count + 1);
+      for (size_t i = 0; i < count; i++) get_element(NULL, type, i, values + i * width);
+
+      pn_data_t *packed = pn_data(0);
+      pn_data_put_string(packed, pn_bytes(6, "before"));
+      assert(!pn_data_put_array_values(packed, type, values, count));
+      pn_data_put_string(packed, pn_bytes(5, "after"));
+
+      pn_data_t *nodes = pn_data(0);
+      pn_data_put_string(nodes, pn_bytes(6, "before"));
+      pn_data_put_array(nodes, false, type);
+      pn_data_enter(nodes);
+      for (size_t i = 0; i < count; i++) put_element(nodes, type, i);
+      pn_data_exit(nodes);
+      pn_data_put_string(nodes, pn_bytes(5, "after"));
+
+      pn_data_rewind(packed);
+      assert(pn_data_next(packed) && is_string(packed, "before"));
+      assert(pn_data_next(packed) && pn_data_type(packed) == PN_ARRAY);
+      assert(pn_data_get_array(packed) == count);
+      assert(pn_data_get_array_type(packed) == type);
+      assert(!pn_data_is_array_described(packed));
+      assert(pn_data_get_array_values(packed, type, out, count) == (ssize_t) count);
+      assert(!memcmp(out, values, width * count));
+      if (count > 1) {
+        assert(pn_data_get_array_values(packed, type, out, 1) == 1);
+      }
+      assert(pn_data_get_array_values(packed, type == PN_INT ? PN_LONG : PN_INT, out, count) < 0);
+      assert(pn_data_next(packed) && is_string(packed, "after"));
+
+      size_t size = 16 + width * count + 32;
+      char *encoded = (char *) malloc(size);
+      char *expected = (char *) malloc(size);
+      ssize_t esize = pn_data_encode(nodes, expected, size);
+      assert(esize > 0);
+      assert(pn_data_encode(packed, encoded, size) == esize);
+      assert(!memcmp(encoded, expected, esize));
+
+      // decoded arrays are packed too, and expand when entered
+      for (int enter = 0; enter < 2; enter++) {
+        pn_data_t *decoded = pn_data(0);
+        for (ssize_t offset = 0; offset < esize; ) {
+          ssize_t n = pn_data_decode(decoded, expected + offset, esize - offset);
+          assert(n > 0);
+          offset += n;
+        }
+        pn_data_rewind(decoded);
+        assert(pn_data_next(decoded) && is_string(decoded, "before"));
+        assert(pn_data_next(decoded) && pn_data_get_array(decoded) == count);
+        assert(pn_data_get_array_values(decoded, type, out, count) == (ssize_t) count);
+        assert(!memcmp(out, values, width * count));
+        if (enter) {
+          pn_data_enter(decoded);
+          for (size_t i = 0; i < count; i++) {
+            assert(pn_data_next(decoded) && pn_data_type(decoded) == type);
+            assert(is_element(decoded, type, i));
+          }
+          assert(!pn_data_next(decoded));
+          pn_data_exit(decoded);
+          assert(pn_data_get_array_values(decoded, type, out, count) == (ssize_t) count);
+          assert(!memcmp(out, values, width * count));
+        }
+        assert(pn_data_next(decoded) && is_string(decoded, "after"));
+
+        pn_data_t *copy = pn_data(0);
+        assert(!pn_data_copy(copy, decoded));
+        assert(pn_data_encode(decoded, encoded, size) == esize);
+        assert(!memcmp(encoded, expected, esize));
+        assert(pn_data_encode(copy, encoded, size) == esize);
+        assert(!memcmp(encoded, expected, esize));
+        pn_data_free(copy);
+        pn_data_free(decoded);
+      }
+
+      free(encoded);
+      free(expected);
+      pn_data_free(nodes);
+      pn_data_free(packed);
+      free(out);
+      free(values);
+    }
+  }
+
+  // variable width elements cannot be packed
+  pn_data_t *data = pn_data(0);
+  assert(pn_data_put_array_values(data, PN_STRING, "", 1) != 0);
+  pn_data_free(data);
+}
+
+static void test_filter(void)
+{
+  pn_message_t *message = pn_message();
+  pn_message_set_durable(message, true);
+  pn_message_set_priority(message, 7);
+  pn_message_set_group_id(message, "orders");
+  pn_data_t *properties = pn_message_properties(message);
+  pn_data_put_map(properties);
+  pn_data_enter(properties);
+  put_property(properties, "color");
+  pn_data_put_string(properties, pn_bytes(3, "red"));
+  put_property(properties, "weight");
+  pn_data_put_int(properties, 15);
+  put_property(properties, "price");
+  pn_data_put_double(properties, 2.5);
+  put_property(properties, "flag");
+  pn_data_put_bool(properties, true);
+  put_property(properties, "code");
+  pn_data_put_string(properties, pn_bytes(3, "a%b"));
+  pn_data_exit(properties);
+  char payload[256];
+  memset(payload, 'x', sizeof(payload));
+  pn_data_put_binary(pn_message_body(message), pn_bytes(sizeof(payload), payload));
+  char buf[1024];
+  size_t size = sizeof(buf);
+  assert(pn_message_encode(message, buf, &size) == 0);
+
+  pn_filter_t *filter = pn_filter();
+  assert(pn_filter_match(filter, buf, size) == 1);
+
+  struct { const char *selector; int match; } cases[] = {
+    {"color = 'red'", 1},
+    {"color <> 'red'", 0},
+    {"weight BETWEEN 10 AND 20 AND color IN ('red', 'blue')", 1},
+    {"weight NOT BETWEEN 10 AND 20", 0},
+    {"weight * 2 + 1 = 31 and -weight < 0", 1},
+    {"price > 2 AND price < 3.0E0", 1},
+    {"weight / 0 = 1 OR flag", 1},
+    {"missing = 1", 0},
+    {"NOT (missing = 1)", 0},
+    {"missing IS NULL AND color IS NOT NULL", 1},
+    {"color LIKE 'r_d' AND color NOT LIKE 'b%'", 1},
+    {"code LIKE 'a!%%' ESCAPE '!'", 1},
+    {"code LIKE 'a!%' ESCAPE '!'", 0},
+    {"color = 'it''s' OR color = 1", 0},
+    {"flag = TRUE AND weight >= 0x0F", 1},
+    {"JMSPriority = 7 AND JMSDeliveryMode = 'PERSISTENT'", 1},
+    {"JMSXGroupID = 'orders' AND JMSXDeliveryCount = 1", 1},
+    {"JMSCorrelationID IS NULL", 1},
+    {"", 1}
+  };
+  for (size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+    assert(pn_filter_compile(filter, cases[i].selector) == 0);
+    assert(pn_filter_match(filter, buf, size) == cases[i].match);
+  }
+
+  // the body is never read
+  assert(pn_filter_compile(filter, "color = 'red'") == 0);
+  assert(pn_filter_match(filter, buf, size - sizeof(payload)) == 1);
+
+  const char *invalid[] = {"color =", "weight +", "1 + 2", "NOT weight * 2", "color LIKE",
+                           "(color = 'red'", "color IN ()", "color = 'red", "color = 'red')",
+                           "code LIKE 'a!' ESCAPE '!'", "weight = 08", "color # 1"};
+  for (size_t i = 0; i < sizeof(invalid)/sizeof(invalid[0]); i++) {
+    assert(pn_filter_compile(filter, invalid[i]) == PN_ARG_ERR);
+    assert(pn_error_code(pn_filter_error(filter)) == PN_ARG_ERR);
+    assert(pn_filter_match(filter, buf, size) == 1);
+  }
+
+  // a malformed section is only noticed when it is needed
+  const char malformed[] = {0x00, 0x53, 0x70, 0x45, 0x00, 0x53, 0x74, (char) 0xc1, 0x10, 0x02};
+  assert(pn_filter_compile(filter, "JMSPriority = 4") == 0);
+  assert(pn_filter_match(filter, malformed, sizeof(malformed)) == 1);
+  assert(pn_filter_compile(filter, "JMSPriority = 4 AND color = 'red'") == 0);
+  assert(pn_filter_match(filter, malformed, sizeof(malformed)) < 0);
+
+  pn_connection_t *connection = pn_connection();
+  pn_link_t *receiver = pn_receiver(pn_session(connection), "receiver");
+  pn_data_t *filters = pn_terminus_filter(pn_link_source(receiver));
+  assert(pn_filter_compile(filter, "color = 'red'") == 0);
+  assert(pn_filter_compile_terminus(filter, pn_link_source(receiver)) == 0);
+  assert(pn_filter_match(filter, buf, size) == 1);
+  pn_data_put_map(filters);
+  pn_data_enter(filters);
+  pn_data_put_symbol(filters, pn_bytes(12, "jms-selector"));
+  pn_data_put_described(filters);
+  pn_data_enter(filters);
+  pn_data_put_ulong(filters, 0x0000468C00000004ULL);
+  pn_data_put_string(filters, pn_bytes(14, "color = 'blue'"));
+  pn_data_exit(filters);
+  pn_data_exit(filters);
+  assert(pn_filter_compile_terminus(filter, pn_link_source(receiver)) == 0);
+  assert(pn_filter_match(filter, buf, size) == 0);
+  pn_connection_free(connection);
+
+  pn_filter_free(filter);
   pn_message_free(message);
 }
 
 int main(int argc, char **argv)
 {
   test_overflow_error();
+  test_encode_growable();
+  test_batch();
+  test_properties_roundtrip();
+  test_decode_borrowed();
+  test_decode_head();
+  test_reencode_unchanged();
+  test_move();
+  test_lazy_fields();
+  test_map_lookup();
+  test_filter();
+  test_malformed_input();
+  test_malformed_lazy_map();
+  test_decode_counts();
+  test_array_values();
   return 0;
 }
@@ -0,0 +1,88 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <proton/codec.h>
+#include <proton/error.h>
+#include <proton/message.h>
+#include <proton/messenger.h>
+
+#define assert(E) ((E) ? 0 : (abort(), 0))
+
+// both ends are pumped by hand until the server has n messages
+static void pump(pn_messenger_t *client, pn_messenger_t *server, int n)
+{
+  for (int i = 0; i < 1000 && pn_messenger_incoming(server) < n; i++) {
+    pn_messenger_work(client, 0);
+    pn_messenger_work(server, 10);
+  }
+  assert(pn_messenger_incoming(server) == n);
+}
+
+// a body larger than the default max frame arrives in several transfer
+// frames and must still come out of the incoming queue whole
+static void test_frame_spanning_message(void)
+{
+  const size_t size = 200000;
+  char *body = (char *) malloc(size);
+  for (size_t i = 0; i < size; i++) body[i] = 'a' + i % 26;
+
+  pn_messenger_t *server = pn_messenger("server");
+  pn_messenger_t *client = pn_messenger("client");
+  assert(!pn_messenger_set_blocking(server, false));
+  assert(!pn_messenger_set_blocking(client, false));
+  assert(!pn_messenger_start(server));
+  assert(!pn_messenger_start(client));
+  assert(pn_messenger_subscribe(server, "amqp://~127.0.0.1:5680"));
+  pn_messenger_recv(server, -1);
+
+  pn_message_t *msg = pn_message();
+  pn_message_set_address(msg, "amqp://127.0.0.1:5680/big");
+  pn_data_put_binary(pn_message_body(msg), pn_bytes(size, body));
+  assert(!pn_messenger_put(client, msg));
+  assert(!pn_messenger_put(client, msg));
+  pn_messenger_send(client, -1);
+
+  pump(client, server, 2);
+  for (int i = 0; i < 2; i++) {
+    pn_message_clear(msg);
+    assert(!pn_messenger_get(server, msg));
+    pn_data_t *data = pn_message_body(msg);
+    pn_data_rewind(data);
+    assert(pn_data_next(data) && pn_data_type(data) == PN_BINARY);
+    pn_bytes_t got = pn_data_get_binary(data);
+    assert(got.size == size && !memcmp(got.start, body, size));
+  }
+
+  pn_message_free(msg);
+  pn_messenger_stop(client);
+  pn_messenger_stop(server);
+  pn_messenger_free(client);
+  pn_messenger_free(server);
+  free(body);
+}
+
+int main(int argc, char **argv)
+{
+  test_frame_spanning_message();
+  return 0;
+}
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <proton/object.h>
+#include <proton/alloc.h>
 
 #define assert(E) ((E) ? 0 : (abort(), 0))
 
@@ -170,6 +171,96 @@ static void test_finalize(void)
   assert(called == 1);
 }
 
+static void *resurrected = NULL;
+static int resurrections = 0;
+
+static void resurrector(void *object)
+{
+  if (!resurrections++) {
+    resurrected = pn_incref(object);
+  }
+}
+
+#define CID_resurrector CID_pn_object
+#define resurrector_initialize NULL
+#define resurrector_finalize resurrector
+#define resurrector_hashcode NULL
+#define resurrector_compare NULL
+#define resurrector_inspect NULL
+
+static void test_resurrect(void)
+{
+  static pn_class_t clazz = PN_CLASS(resurrector);
+
+  void *obj = pn_class_new(&clazz, 8);
+  pn_incref(obj);
+  assert(pn_decref(obj) == 1);
+  assert(pn_decref(obj) == 0);
+  // the finalizer took a new reference, so the object lives on
+  assert(resurrections == 1 && resurrected == obj);
+  assert(pn_refcount(obj) == 1);
+  assert(pn_class_decref(&clazz, obj) == 0);
+  assert(resurrections == 2);
+}
+
+static void test_share(void)
+{
+  int called = 0;
+  static pn_class_t clazz = PN_CLASS(finalizer);
+  int **obj = (int **) pn_class_new(&clazz, sizeof(int **));
+  *obj = &called;
+  assert(!pn_shared(obj));
+  assert(pn_share(obj) == obj && pn_shared(obj));
+  assert(pn_incref(obj) == obj && pn_refcount(obj) == 2);
+  assert(pn_decref(obj) == 1 && called == 0);
+  assert(pn_decref(obj) == 0 && called == 1);
+
+  assert(pn_share(NULL) == NULL && !pn_shared(NULL));
+}
+
+#define CID_pooled CID_pn_object
+#define pooled_initialize NULL
+#define pooled_finalize NULL
+#define pooled_hashcode NULL
+#define pooled_compare NULL
+#define pooled_inspect NULL
+
+PN_POOL(pooled, 2)
+
+static void test_pool(void)
+{
+  static const pn_class_t clazz = PN_POOLED_CLASS(pooled);
+  assert(!pn_class_pool(&clazz));
+
+  void *a = pn_class_new(&clazz, sizeof(int));
+  void *b = pn_class_new(&clazz, sizeof(int));
+  void *c = pn_class_new(&clazz, sizeof(int));
+  pn_pool_t *pool = pn_class_pool(&clazz);
+  assert(pool && pn_pool_high_water(pool) == 2);
+  assert(pn_pool_hits(pool) == 0 && pn_pool_misses(pool) == 3);
+
+  pn_free(a);
+  pn_free(b);
+  pn_free(c);
+  assert(pn_pool_cached(pool) == 2);
+
+  // instances of another size bypass the pool
+  void *d = pn_class_new(&clazz, 2 * sizeof(int));
+  assert(pn_refcount(d) == 1 && pn_class(d) == &clazz);
+  pn_free(d);
+  assert(pn_pool_cached(pool) == 2 && pn_pool_misses(pool) == 3);
+
+  a = pn_class_new(&clazz, sizeof(int));
+  assert(a == b && pn_refcount(a) == 1 && pn_class(a) == &clazz);
+  assert(pn_pool_hits(pool) == 1 && pn_pool_cached(pool) == 1);
+
+  pn_pool_set_high_water(pool, 0);
+  assert(pn_pool_cached(pool) == 0);
+  pn_free(a);
+  assert(pn_pool_cached(pool) == 0);
+  pn_pool_set_high_water(pool, 2);
+}
+
 static void test_free(void)
 {
   // just to make sure it doesn't seg fault or anything
@@ -689,6 +780,51 @@ static void test_string_addf(void)
   pn_free(str);
 }
 
+static void test_string_inline(void)
+{
+  // 23 characters and the terminator still fit in the object
+  pn_string_t *str = pn_string("0123456789abcdefghijklm");
+  assert(pn_string_capacity(str) == 23);
+  char *inline_bytes = pn_string_buffer(str);
+  assert(pn_string_addf(str, "%s", "n") == 0);
+  assert(pn_string_buffer(str) != inline_bytes);
+  assert(pn_string_size(str) == 24);
+  assert(!strcmp(pn_string_get(str), "0123456789abcdefghijklmn"));
+  assert(pn_string_resize(str, 3) == 0);
+  assert(!strcmp(pn_string_get(str), "012"));
+  pn_free(str);
+}
+
+static void test_hash_del_iteration(int n)
+{
+  pn_hash_t *hash = pn_hash(PN_OBJECT, 0, 0.75);
+  for (int i = 0; i < n; i++) {
+    void *value = pn_class_new(PN_OBJECT, 0);
+    pn_hash_put(hash, i*8, value);
+    pn_decref(value);
+  }
+
+  // deleting the current entry must not disturb the rest of the walk
+  int seen = 0;
+  for (pn_handle_t entry = pn_hash_head(hash); entry; entry = pn_hash_next(hash, entry))
+  {
+    uintptr_t key = pn_hash_key(hash, entry);
+    assert(pn_hash_get(hash, key) == pn_hash_value(hash, entry));
+    if (key % 16 == 0) {
+      pn_hash_del(hash, key);
+    }
+    seen++;
+  }
+
+  assert(seen == n);
+  assert(pn_hash_size(hash) == (size_t) n/2);
+  for (int i = 0; i < n; i++) {
+    assert((pn_hash_get(hash, i*8) != NULL) == (i % 2 == 1));
+  }
+
+  pn_free(hash);
+}
+
 static void test_map_iteration(int n)
 {
   pn_list_t *pairs = pn_list(PN_OBJECT, 2*n);
@@ -781,7 +917,7 @@ void test_map_inspect(void)
                 pn_string("k1"), pn_string("v1"),
                 pn_string("k2"), pn_string("v2"),
                 END);
-  test_inspect(m, "{\"k1\": \"v1\", \"k2\": \"v2\"}");
+  test_inspect(m, "{\"k2\": \"v2\", \"k1\": \"v1\"}");
   pn_free(m);
 
   m = build_map(0, 0.75,
@@ -789,7 +925,7 @@ void test_map_inspect(void)
                 pn_string("k2"), pn_string("v2"),
                 pn_string("k3"), pn_string("v3"),
                 END);
-  test_inspect(m, "{\"k3\": \"v3\", \"k1\": \"v1\", \"k2\": \"v2\"}");
+  test_inspect(m, "{\"k3\": \"v3\", \"k2\": \"v2\", \"k1\": \"v1\"}");
   pn_free(m);
 }
 
@@ -905,6 +1041,121 @@ void test_heap(int seed, int size)
   pn_free(list);
 }
 
+PN_HANDLE(TEST_KEY)
+
+static void test_record(void)
+{
+  pn_record_t *record = pn_record();
+  void *value = pn_class_new(PN_OBJECT, 0);
+
+  assert(pn_record_has(record, PN_LEGCTX));
+  assert(!pn_record_has(record, TEST_KEY));
+  pn_record_set(record, TEST_KEY, value);
+  assert(pn_record_get(record, TEST_KEY) == NULL);
+
+  pn_record_def(record, TEST_KEY, PN_OBJECT);
+  pn_record_set(record, TEST_KEY, value);
+  pn_record_set(record, PN_LEGCTX, value);
+  assert(pn_record_get(record, TEST_KEY) == value);
+  assert(pn_record_get(record, PN_LEGCTX) == value);
+  assert(pn_refcount(value) == 2);
+
+  pn_record_clear(record);
+  assert(pn_refcount(value) == 1);
+  assert(pn_record_has(record, PN_LEGCTX));
+  assert(pn_record_get(record, PN_LEGCTX) == NULL);
+  assert(!pn_record_has(record, TEST_KEY));
+
+  pn_record_def(record, TEST_KEY, PN_OBJECT);
+  pn_record_set(record, TEST_KEY, value);
+  pn_free(record);
+  assert(pn_refcount(value) == 1);
+  pn_decref(value);
+}
+
+static void test_alloc_counters(void)
+{
+  pn_alloc_counters_t before, after, total;
+  pn_alloc_counters(PN_ALLOC_STRING, &before);
+  pn_string_t *str = pn_string("a string that will not stay inline");
+  pn_string_addf(str, "%s", " and grows past its first allocation");
+  pn_free(str);
+  pn_alloc_counters(PN_ALLOC_STRING, &after);
+  pn_alloc_counters(PN_ALLOC_SUBSYSTEMS, &total);
+
+  if (pn_alloc_tracking()) {
+    // the bytes at least, the string itself may come from its pool
+    assert(after.allocations > before.allocations);
+    assert(after.reallocations > before.reallocations);
+    assert(after.frees - before.frees == after.allocations - before.allocations);
+    assert(after.bytes > before.bytes);
+    assert(total.allocations >= after.allocations);
+  } else {
+    assert(!after.allocations && !after.frees && !total.allocations);
+  }
+
+  assert(!strcmp(pn_alloc_subsystem_name(PN_ALLOC_STRING), "string"));
+  assert(!strcmp(pn_alloc_subsystem_name(PN_ALLOC_SUBSYSTEMS), "total"));
+  pn_string_t *dump = pn_string("");
+  assert(!pn_alloc_dump(dump));
+  assert(strstr(pn_string_get(dump), "total"));
+  if (pn_alloc_tracking()) assert(strstr(pn_string_get(dump), "string"));
+  pn_free(dump);
+}
+
+typedef struct {
+  int allocations;
+  int reallocations;
+  int frees;
+} hooks_t;
+
+static void *hooks_allocate(void *context, size_t size)
+{
+  ((hooks_t *) context)->allocations++;
+  return malloc(size);
+}
+
+static void *hooks_reallocate(void *context, void *ptr, size_t size)
+{
+  ((hooks_t *) context)->reallocations++;
+  return realloc(ptr, size);
+}
+
+static void hooks_deallocate(void *context, void *ptr)
+{
+  assert(ptr);
+  ((hooks_t *) context)->frees++;
+  free(ptr);
+}
+
+static void test_allocator(void)
+{
+  pn_allocator_t allocator = {hooks_allocate, hooks_reallocate, NULL, NULL};
+  assert(pn_set_allocator(&allocator) == PN_ARG_ERR);
+
+  // the hooks wrap the C library's, so memory may cross over to them
+  hooks_t hooks = {0, 0, 0};
+  allocator.deallocate = hooks_deallocate;
+  allocator.context = &hooks;
+  assert(!pn_set_allocator(&allocator));
+  pn_list_t *list = pn_list(PN_OBJECT, 0);
+  for (int i = 0; i < 100; i++) {
+    pn_string_t *str = pn_string("a string that will not stay inline");
+    pn_list_add(list, str);
+    pn_decref(str);
+  }
+  pn_free(list);
+  pn_set_allocator(NULL);
+
+  assert(hooks.allocations > 0);
+  assert(hooks.reallocations > 0);
+  assert(hooks.frees > 0);
+
+  int allocations = hooks.allocations;
+  pn_free(pn_list(PN_OBJECT, 0));
+  assert(hooks.allocations == allocations);
+}
+
 int main(int argc, char **argv)
 {
   for (size_t i = 0; i < 128; i++) {
@@ -919,6 +1170,9 @@ int main(int argc, char **argv)
   }
 
   test_finalize();
+  test_resurrect();
+  test_share();
+  test_pool();
   test_free();
   test_hashcode();
   test_compare();
@@ -952,6 +1206,7 @@ int main(int argc, char **argv)
 
   test_string_format();
   test_string_addf();
+  test_string_inline();
 
   test_build_list();
   test_build_map();
@@ -960,12 +1215,16 @@ int main(int argc, char **argv)
   for (int i = 0; i < 64; i++)
   {
     test_map_iteration(i);
+    test_hash_del_iteration(i);
   }
 
   test_list_inspect();
   test_map_inspect();
   test_list_compare();
   test_iterator();
+  test_record();
+  test_alloc_counters();
+  test_allocator();
   for (int seed = 0; seed < 64; seed++) {
     for (int size = 1; size <= 64; size++) {
       test_heap(seed, size);
@@ -26,7 +26,13 @@
 #include <proton/session.h>
 #include <proton/link.h>
 #include <proton/delivery.h>
+#include <proton/ssl.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #define assert(E) ((E) ? 0 : (abort(), 0))
 
@@ -176,6 +182,58 @@ static void test_reactor_connection(void) {
   pn_free(revents);
 }
 
+// an endpoint's handler is cached once resolved, a handler set on it
+// or on a parent takes over from its next event
+typedef struct {
+  pn_list_t *events;
+  pn_handler_t *session_handler;
+} pni_cache_handler_t;
+
+static void cache_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  pni_cache_handler_t *ch = (pni_cache_handler_t *) pn_handler_mem(handler);
+  pn_list_add(ch->events, (void *) type);
+  pn_session_t *ssn = pn_event_session(event);
+  switch (type) {
+  case PN_CONNECTION_INIT:
+    pn_session(pn_event_connection(event));
+    break;
+  case PN_SESSION_INIT:
+    pn_record_set_handler(pn_session_attachments(ssn), ch->session_handler);
+    pn_session_open(ssn);
+    break;
+  case PN_SESSION_LOCAL_OPEN:
+    pn_sender(ssn, "cached");
+    break;
+  default:
+    break;
+  }
+}
+
+static pn_handler_t *cache_handler(pn_list_t *events, pn_handler_t *session_handler) {
+  pn_handler_t *handler = pn_handler_new(cache_dispatch, sizeof(pni_cache_handler_t), NULL);
+  pni_cache_handler_t *ch = (pni_cache_handler_t *) pn_handler_mem(handler);
+  ch->events = events;
+  ch->session_handler = session_handler;
+  return handler;
+}
+
+static void test_reactor_handler_cache(void) {
+  pn_reactor_t *reactor = pn_reactor();
+  pn_list_t *cevents = pn_list(PN_VOID, 0);
+  pn_list_t *sevents = pn_list(PN_VOID, 0);
+  pn_handler_t *sh = cache_handler(sevents, NULL);
+  pn_handler_t *ch = cache_handler(cevents, sh);
+  pn_reactor_connection(reactor, ch);
+  pn_reactor_run(reactor);
+  expect(cevents, PN_CONNECTION_INIT, PN_SESSION_INIT, END);
+  expect(sevents, PN_SESSION_LOCAL_OPEN, PN_LINK_INIT, END);
+  pn_reactor_free(reactor);
+  pn_decref(ch);
+  pn_decref(sh);
+  pn_free(cevents);
+  pn_free(sevents);
+}
+
 static void test_reactor_acceptor(void) {
   pn_reactor_t *reactor = pn_reactor();
   assert(reactor);
@@ -308,8 +366,152 @@ static void test_reactor_connect(void) {
   pn_reactor_free(reactor);
 }
 
+typedef struct {
+  pn_list_t *events;
+  const char *hostname;
+} named_client_t;
+
+static void named_client_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  named_client_t *cli = (named_client_t *) pn_handler_mem(handler);
+  pn_list_add(cli->events, (void *) type);
+  pn_connection_t *conn = pn_event_connection(event);
+  switch (type) {
+  case PN_CONNECTION_INIT:
+    pn_connection_set_hostname(conn, cli->hostname);
+    pn_connection_open(conn);
+    break;
+  case PN_CONNECTION_REMOTE_OPEN:
+    pn_connection_close(conn);
+    break;
+  case PN_TRANSPORT_CLOSED:
+    // once, whether or not the connect succeeded
+    pn_connection_release(conn);
+    break;
+  default:
+    break;
+  }
+}
+
+static void test_reactor_resolve(void) {
+  pn_reactor_t *reactor = pn_reactor();
+  pn_io_set_resolve_ttl(pn_reactor_io(reactor), 60000);
+  assert(pn_io_get_resolve_ttl(pn_reactor_io(reactor)) == 60000);
+  pn_handler_t *sh = pn_handler_new(server_dispatch, sizeof(server_t), NULL);
+  server_t *srv = smem(sh);
+  srv->reactor = reactor;
+  srv->acceptor = pn_reactor_acceptor(reactor, "0.0.0.0", "5678", sh);
+  srv->events = pn_list(PN_VOID, 0);
+  pn_handler_t *ch = pn_handler_new(named_client_dispatch, sizeof(named_client_t), NULL);
+  named_client_t *cli = (named_client_t *) pn_handler_mem(ch);
+  cli->events = pn_list(PN_VOID, 0);
+  cli->hostname = "localhost:5678";
+  pn_reactor_connection(reactor, ch);
+  pn_reactor_run(reactor);
+  // looked up off the loop, then connected
+  assert(pn_list_index(srv->events, (void *) PN_CONNECTION_REMOTE_CLOSE) >= 0);
+  assert(pn_list_index(cli->events, (void *) PN_CONNECTION_REMOTE_CLOSE) >= 0);
+  pn_free(srv->events);
+  pn_decref(sh);
+  pn_free(cli->events);
+  pn_decref(ch);
+  pn_reactor_free(reactor);
+
+  // a name that does not resolve fails the transport
+  reactor = pn_reactor();
+  ch = pn_handler_new(named_client_dispatch, sizeof(named_client_t), NULL);
+  cli = (named_client_t *) pn_handler_mem(ch);
+  cli->events = pn_list(PN_VOID, 0);
+  cli->hostname = "nonexistent.invalid:5678";
+  pn_reactor_connection(reactor, ch);
+  pn_reactor_run(reactor);
+  assert(pn_list_index(cli->events, (void *) PN_TRANSPORT_ERROR) >= 0);
+  assert(pn_list_index(cli->events, (void *) PN_CONNECTION_REMOTE_OPEN) < 0);
+  pn_free(cli->events);
+  pn_decref(ch);
+  pn_reactor_free(reactor);
+}
+
+static void test_reactor_socket_options(void) {
+  pn_reactor_t *reactor = pn_reactor();
+  pn_socket_options_t *options = pn_socket_options();
+  pn_socket_options_set_buffers(options, 256*1024, 256*1024);
+  pn_socket_options_set_keepalive(options, true, 60, 10, 3);
+  pn_io_set_socket_options(pn_reactor_io(reactor), options);
+  pn_socket_options_free(options);
+
+  pn_handler_t *sh = pn_handler_new(server_dispatch, sizeof(server_t), NULL);
+  server_t *srv = smem(sh);
+  pn_acceptor_t *acceptor = pn_reactor_acceptor(reactor, "0.0.0.0", "5678", sh);
+  options = pn_socket_options();
+  pn_socket_options_set_quickack(options, true);
+  pn_socket_options_set_notsent_lowat(options, 16*1024);
+  pn_acceptor_set_socket_options(acceptor, options);
+  pn_socket_options_free(options);
+  srv->reactor = reactor;
+  srv->acceptor = acceptor;
+  srv->events = pn_list(PN_VOID, 0);
+
+  pn_handler_t *ch = pn_handler_new(client_dispatch, sizeof(client_t), NULL);
+  client_t *cli = cmem(ch);
+  cli->events = pn_list(PN_VOID, 0);
+  pn_connection_t *conn = pn_reactor_connection(reactor, ch);
+  options = pn_socket_options();
+  pn_socket_options_set_nodelay(options, false);
+  pn_socket_options_set_busy_poll(options, 0);
+  pn_reactor_connection_set_socket_options(conn, options);
+  pn_socket_options_free(options);
+  pn_reactor_run(reactor);
+
+  // the options must not get in the way of the exchange
+  assert(pn_list_index(srv->events, (void *) PN_CONNECTION_REMOTE_CLOSE) >= 0);
+  assert(pn_list_index(cli->events, (void *) PN_CONNECTION_REMOTE_CLOSE) >= 0);
+  assert(pn_error_code(pn_io_error(pn_reactor_io(reactor))) == 0);
+  pn_free(srv->events);
+  pn_decref(sh);
+  pn_free(cli->events);
+  pn_decref(ch);
+  pn_reactor_free(reactor);
+}
+
+#ifndef _WIN32
+static void test_io_unix(void) {
+  pn_io_t *io = pn_io();
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/proton-test-%d.sock", (int) getpid());
+  pn_socket_t listener = pn_listen_unix(io, path);
+  assert(listener != PN_INVALID_SOCKET);
+  pn_socket_t client = pn_connect_unix(io, path);
+  assert(client != PN_INVALID_SOCKET);
+
+  char name[1024];
+  pn_socket_t server = pn_accept(io, listener, name, sizeof(name));
+  assert(server != PN_INVALID_SOCKET);
+  assert(!strcmp(name, path));
+
+  assert(pn_send(io, client, "hello", 5) == 5);
+  char buf[16];
+  ssize_t n;
+  while ((n = pn_recv(io, server, buf, sizeof(buf))) < 0 && pn_wouldblock(io));
+  assert(n == 5 && !memcmp(buf, "hello", 5));
+
+  // a second listener takes over the path
+  pn_close(io, listener);
+  listener = pn_listen_unix(io, path);
+  assert(listener != PN_INVALID_SOCKET);
+  assert(pn_connect_unix(io, "") == PN_INVALID_SOCKET);
+
+  pn_close(io, server);
+  pn_close(io, client);
+  pn_close(io, listener);
+  unlink(path);
+  pn_io_free(io);
+}
+#endif
+
 typedef struct {
   int received;
+  size_t offset;  // into the delivery being received
+  bool corrupt;
 } sink_t;
 
 static sink_t *sink(pn_handler_t *handler) {
@@ -321,9 +523,21 @@ void sink_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t typ
   pn_delivery_t *dlv = pn_event_delivery(event);
   switch (type) {
   case PN_DELIVERY:
+    {
+      // the payload repeats its offset, see source_dispatch
+      char buf[4096];
+      ssize_t n;
+      while ((n = pn_link_recv(pn_delivery_link(dlv), buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+          if (buf[i] != (char) ((snk->offset + i) % 251)) snk->corrupt = true;
+        }
+        snk->offset += n;
+      }
+    }
     if (!pn_delivery_partial(dlv)) {
       pn_delivery_settle(dlv);
       snk->received++;
+      snk->offset = 0;
     }
     break;
   default:
@@ -333,6 +547,7 @@ void sink_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t typ
 
 typedef struct {
   int remaining;
+  size_t size;    // of each message
 } source_t;
 
 static source_t *source(pn_handler_t *handler) {
@@ -360,6 +575,13 @@ void source_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t t
       while (pn_link_credit(link) > 0 && src->remaining > 0) {
         pn_delivery_t *dlv = pn_delivery(link, pn_dtag("", 0));
         assert(dlv);
+        // a whole number of cycles of the pattern, so it runs on
+        char chunk[251*16];
+        for (size_t i = 0; i < sizeof(chunk); i++) chunk[i] = (char) (i % 251);
+        for (size_t offset = 0; offset < src->size; offset += sizeof(chunk)) {
+          size_t n = src->size - offset < sizeof(chunk) ? src->size - offset : sizeof(chunk);
+          assert(pn_link_send(link, chunk, n) == (ssize_t) n);
+        }
         pn_delivery_settle(dlv);
         src->remaining--;
       }
@@ -377,8 +599,16 @@ void source_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t t
   }
 }
 
-static void test_reactor_transfer(int count, int window) {
+static void test_reactor_transfer_sized(int count, int window, bool autotune, pn_millis_t flush_latency,
+                                        size_t size, pn_socket_options_t *options, int budget) {
   pn_reactor_t *reactor = pn_reactor();
+  pn_reactor_set_flush_latency(reactor, flush_latency);
+  assert(pn_reactor_get_flush_latency(reactor) == flush_latency);
+  if (budget) {
+    pn_reactor_set_event_budget(reactor, budget);
+    pn_reactor_set_connection_budget(reactor, (budget + 1)/2);
+    pn_reactor_set_time_budget(reactor, 1);
+  }
 
   pn_handler_t *sh = pn_handler_new(server_dispatch, sizeof(server_t), NULL);
   server_t *srv = smem(sh);
@@ -389,19 +619,24 @@ static void test_reactor_transfer(int count, int window) {
   pn_handler_add(sh, pn_handshaker());
   // XXX: a window of 1 doesn't work unless the flowcontroller is
   // added after the thing that settles the delivery
-  pn_handler_add(sh, pn_flowcontroller(window));
+  pn_handler_add(sh, autotune ? pn_flowcontroller_autotune(window, 64*1024) : pn_flowcontroller(window));
   pn_handler_t *snk = pn_handler_new(sink_dispatch, sizeof(sink_t), NULL);
   sink(snk)->received = 0;
+  sink(snk)->offset = 0;
+  sink(snk)->corrupt = false;
   pn_handler_add(sh, snk);
 
   pn_handler_t *ch = pn_handler_new(source_dispatch, sizeof(source_t), NULL);
   source_t *src = source(ch);
   src->remaining = count;
-  pn_reactor_connection(reactor, ch);
+  src->size = size;
+  pn_connection_t *conn = pn_reactor_connection(reactor, ch);
+  if (options) pn_reactor_connection_set_socket_options(conn, options);
 
   pn_reactor_run(reactor);
 
   assert(sink(snk)->received == count);
+  assert(!sink(snk)->corrupt);
 
   pn_free(srv->events);
   pn_reactor_free(reactor);
@@ -409,6 +644,90 @@ static void test_reactor_transfer(int count, int window) {
   pn_handler_free(ch);
 }
 
+static void test_reactor_transfer(int count, int window, bool autotune, pn_millis_t flush_latency) {
+  test_reactor_transfer_sized(count, window, autotune, flush_latency, 0, NULL, 0);
+}
+
+static void tls_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  if (type == PN_CONNECTION_BOUND) {
+    pn_ssl_domain_t *domain = *(pn_ssl_domain_t **) pn_handler_mem(handler);
+    assert(!pn_ssl_init(pn_ssl(pn_event_transport(event)), domain, NULL));
+  }
+}
+
+static pn_handler_t *tls_handler(pn_ssl_domain_t *domain) {
+  pn_handler_t *handler = pn_handler_new(tls_dispatch, sizeof(pn_ssl_domain_t *), NULL);
+  *(pn_ssl_domain_t **) pn_handler_mem(handler) = domain;
+  return handler;
+}
+
+// messages cross a tls connection whole whether or not the domains ask
+// for kernel tls, which falls back to openssl where the kernel or the
+// build cannot take the session
+static void test_reactor_transfer_tls(bool kernel_tls) {
+  if (!pn_ssl_present()) return;
+  pn_ssl_domain_t *server_domain = pn_ssl_domain(PN_SSL_MODE_SERVER);
+  assert(!pn_ssl_domain_set_credentials(server_domain, PN_TEST_SSL_DB "/server-certificate.pem",
+                                        PN_TEST_SSL_DB "/server-private-key.pem", "server-password"));
+  pn_ssl_domain_t *client_domain = pn_ssl_domain(PN_SSL_MODE_CLIENT);
+  assert(!pn_ssl_domain_set_peer_authentication(client_domain, PN_SSL_ANONYMOUS_PEER, NULL));
+  if (kernel_tls) {
+    int err = pn_ssl_domain_set_kernel_tls(server_domain, true);
+    assert(pn_ssl_domain_set_kernel_tls(client_domain, true) == err);
+  }
+
+  pn_reactor_t *reactor = pn_reactor();
+  pn_handler_t *sh = pn_handler_new(server_dispatch, sizeof(server_t), NULL);
+  server_t *srv = smem(sh);
+  pn_acceptor_t *acceptor = pn_reactor_acceptor(reactor, "0.0.0.0", "5678", sh);
+  srv->reactor = reactor;
+  srv->acceptor = acceptor;
+  srv->events = pn_list(PN_VOID, 0);
+  pn_handler_add(sh, tls_handler(server_domain));
+  pn_handler_add(sh, pn_handshaker());
+  pn_handler_add(sh, pn_flowcontroller(16));
+  pn_handler_t *snk = pn_handler_new(sink_dispatch, sizeof(sink_t), NULL);
+  sink(snk)->received = 0;
+  sink(snk)->offset = 0;
+  sink(snk)->corrupt = false;
+  pn_handler_add(sh, snk);
+
+  pn_handler_t *ch = pn_handler_new(source_dispatch, sizeof(source_t), NULL);
+  source(ch)->remaining = 64;
+  source(ch)->size = 100*1000;
+  pn_handler_add(ch, tls_handler(client_domain));
+  pn_reactor_connection(reactor, ch);
+
+  pn_reactor_run(reactor);
+
+  assert(sink(snk)->received == 64);
+  assert(!sink(snk)->corrupt);
+
+  pn_free(srv->events);
+  pn_reactor_free(reactor);
+  pn_handler_free(sh);
+  pn_handler_free(ch);
+  pn_ssl_domain_free(server_domain);
+  pn_ssl_domain_free(client_domain);
+}
+
+// the kernel reads zerocopy output from the transport's buffer, which
+// must not change under it
+static void test_reactor_zerocopy(void) {
+  pn_socket_options_t *options = pn_socket_options();
+  pn_socket_options_set_zerocopy(options, 16*1024);
+  test_reactor_transfer_sized(64, 16, false, 0, 256*1024, options, 0);
+  pn_socket_options_set_zerocopy(options, 0);
+  test_reactor_transfer_sized(8, 16, false, 0, 256*1024, options, 0);
+  pn_socket_options_free(options);
+}
+
+// a pass stopping short for its budgets still delivers each message once
+static void test_reactor_transfer_budgets(void) {
+  test_reactor_transfer_sized(64, 16, false, 0, 256*1024, NULL, 5);
+  test_reactor_transfer_sized(1024, 64, false, 0, 0, NULL, 1);
+}
+
 static void test_reactor_schedule(void) {
   pn_reactor_t *reactor = pn_reactor();
   pn_handler_t *root = pn_reactor_get_handler(reactor);
@@ -422,6 +741,25 @@ static void test_reactor_schedule(void) {
   pn_free(events);
 }
 
+// the handlers see the time the loop read, a coarse clock lags the
+// precise one by at most a tick
+static void test_reactor_coarse_clock(void) {
+  pn_reactor_t *reactor = pn_reactor();
+  assert(!pn_reactor_get_coarse_clock(reactor));
+  pn_reactor_set_coarse_clock(reactor, true);
+  assert(pn_reactor_get_coarse_clock(reactor));
+  pn_timestamp_t start = pn_reactor_now(reactor);
+  assert(pn_reactor_now(reactor) == start);
+  pn_reactor_schedule(reactor, 20, NULL);
+  pn_reactor_run(reactor);
+  assert(pn_reactor_now(reactor) >= start + 20);
+  pn_timestamp_t now = pn_reactor_mark(reactor);
+  assert(now >= start + 20 && pn_reactor_now(reactor) == now);
+  pn_reactor_set_coarse_clock(reactor, false);
+  assert(pn_reactor_now(reactor) >= now);
+  pn_reactor_free(reactor);
+}
+
 static void test_reactor_schedule_handler(void) {
   pn_reactor_t *reactor = pn_reactor();
   pn_handler_t *root = pn_reactor_get_handler(reactor);
@@ -440,6 +778,315 @@ static void test_reactor_schedule_handler(void) {
   pn_free(tevents);
 }
 
+static void test_reactor_schedule_cancel(void) {
+  pn_reactor_t *reactor = pn_reactor();
+  pn_handler_t *root = pn_reactor_get_handler(reactor);
+  pn_list_t *events = pn_list(PN_VOID, 0);
+  pn_handler_add(root, test_handler(reactor, events));
+  pn_task_t *task = pn_reactor_schedule(reactor, 10000, NULL);
+  pn_incref(task);
+  pn_task_cancel(task);
+  // cancelling twice does nothing
+  pn_task_cancel(task);
+  pn_decref(task);
+  // with nothing left to wait for the reactor finishes at once
+  pn_reactor_run(reactor);
+  pn_reactor_free(reactor);
+  expect(events, PN_REACTOR_INIT, PN_SELECTABLE_INIT, PN_SELECTABLE_UPDATED, PN_SELECTABLE_FINAL,
+         PN_REACTOR_FINAL, END);
+  pn_free(events);
+}
+
+#define TIMER_TASKS (2000)
+
+// ticks the timer through deadlines spread over every level of the
+// wheel, cancelling every third task, and checks each fires once, in
+// order and on time
+static void test_timer_wheel(pn_timestamp_t start, int64_t scale) {
+  pn_collector_t *collector = pn_collector();
+  pn_timer_t *timer = pn_timer(collector);
+  pn_timer_tick(timer, start);
+  pn_task_t *tasks[TIMER_TASKS];
+  pn_timestamp_t deadlines[TIMER_TASKS];
+  bool fired[TIMER_TASKS];
+  uint64_t seed = 12345;
+  int pending = 0;
+  for (int i = 0; i < TIMER_TASKS; i++) {
+    seed = seed*6364136223846793005ULL + 1442695040888963407ULL;
+    deadlines[i] = start + (pn_timestamp_t) ((seed >> 33) % (uint64_t) scale);
+    tasks[i] = pn_timer_schedule(timer, deadlines[i]);
+    pn_incref(tasks[i]);
+    fired[i] = false;
+    pending++;
+  }
+  for (int i = 0; i < TIMER_TASKS; i += 3) {
+    pn_task_cancel(tasks[i]);
+    pending--;
+  }
+  assert(pn_timer_tasks(timer) == pending);
+
+  pn_timestamp_t now = start;
+  while (pn_timer_tasks(timer)) {
+    pn_timestamp_t expected = 0;
+    bool found = false;
+    for (int i = 0; i < TIMER_TASKS; i++) {
+      if (i % 3 && !fired[i] && (!found || deadlines[i] < expected)) {
+        expected = deadlines[i];
+        found = true;
+      }
+    }
+    assert(pn_timer_deadline(timer) == expected);
+    // step part of the way to the next deadline, then onto it
+    pn_timer_tick(timer, now + (expected - now)/2);
+    assert(!pn_collector_peek(collector) || expected == now);
+    now = expected;
+    pn_timer_tick(timer, now);
+    pn_event_t *event;
+    int count = 0;
+    while ((event = pn_collector_peek(collector))) {
+      assert(pn_event_type(event) == PN_TIMER_TASK);
+      pn_task_t *task = (pn_task_t *) pn_event_context(event);
+      int i = 0;
+      while (tasks[i] != task) i++;
+      assert(i % 3 && !fired[i] && deadlines[i] == now);
+      fired[i] = true;
+      count++;
+      pn_collector_pop(collector);
+    }
+    assert(count > 0);
+    pending -= count;
+    assert(pn_timer_tasks(timer) == pending);
+  }
+  assert(pn_timer_deadline(timer) == 0);
+  for (int i = 0; i < TIMER_TASKS; i++) {
+    assert(i % 3 == 0 || fired[i]);
+    pn_decref(tasks[i]);
+  }
+  pn_free(timer);
+  pn_collector_free(collector);
+}
+
+static void post_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  if (type == PN_TIMER_TASK) {
+    pn_reactor_t **ran = (pn_reactor_t **) pn_handler_mem(pn_reactor_get_handler(pn_event_reactor(event)));
+    *ran = pn_event_reactor(event);
+  }
+}
+
+static void test_reactor_group_post(void) {
+  pn_reactor_group_t *group = pn_reactor_group(2);
+  assert(pn_reactor_group_size(group) == 2);
+  for (size_t i = 0; i < 2; i++) {
+    pn_reactor_t *reactor = pn_reactor_group_get(group, i);
+    pn_handler_t *handler = pn_handler_new(NULL, sizeof(pn_reactor_t *), NULL);
+    pn_reactor_set_handler(reactor, handler);
+    pn_decref(handler);
+  }
+  assert(!pn_reactor_group_start(group));
+  for (size_t i = 0; i < 2; i++) {
+    assert(!pn_reactor_post(pn_reactor_group_get(group, i), pn_handler(post_dispatch)));
+  }
+  pn_reactor_group_stop(group);
+  for (size_t i = 0; i < 2; i++) {
+    pn_reactor_t *reactor = pn_reactor_group_get(group, i);
+    pn_reactor_t **ran = (pn_reactor_t **) pn_handler_mem(pn_reactor_get_handler(reactor));
+    assert(*ran == reactor);
+  }
+  pn_reactor_group_free(group);
+}
+
+static void group_server_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  pn_connection_t *conn = pn_event_connection(event);
+  switch (type) {
+  case PN_CONNECTION_REMOTE_OPEN:
+    (*(int *) pn_handler_mem(handler))++;
+    pn_connection_open(conn);
+    break;
+  case PN_CONNECTION_REMOTE_CLOSE:
+    pn_connection_close(conn);
+    pn_connection_release(conn);
+    break;
+  default:
+    break;
+  }
+}
+
+static void group_client_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  pn_connection_t *conn = pn_event_connection(event);
+  switch (type) {
+  case PN_CONNECTION_INIT:
+    pn_connection_set_hostname(conn, "127.0.0.1:5679");
+    pn_connection_open(conn);
+    break;
+  case PN_CONNECTION_REMOTE_OPEN:
+    pn_connection_close(conn);
+    break;
+  case PN_CONNECTION_REMOTE_CLOSE:
+    pn_connection_release(conn);
+    break;
+  default:
+    break;
+  }
+}
+
+static void test_reactor_group_acceptor(int count, bool pinned) {
+  pn_reactor_group_t *group = pn_reactor_group(2);
+  for (size_t i = 0; i < 2; i++) {
+    pn_handler_t *handler = pn_handler_new(group_server_dispatch, sizeof(int), NULL);
+    *(int *) pn_handler_mem(handler) = 0;
+    pn_reactor_set_handler(pn_reactor_group_get(group, i), handler);
+    pn_decref(handler);
+  }
+  if (pinned) {
+    // every machine has a CPU 0 on node 0, the second shard is steered
+    // nowhere so still gets its share
+    assert(!pn_reactor_group_set_cpu(group, 0, 0));
+    assert(!pn_reactor_group_set_node(group, 1, 0));
+  }
+  assert(pn_reactor_group_acceptor(group, "0.0.0.0", "5679"));
+  assert(!pn_reactor_group_start(group));
+  assert(pn_reactor_group_set_cpu(group, 0, -1) == PN_STATE_ERR);
+
+  // connect all at once, so the acceptors find a queue to drain
+  pn_reactor_t *client = pn_reactor();
+  pn_handler_t *ch = pn_handler_new(group_client_dispatch, 0, NULL);
+  for (int i = 0; i < count; i++) {
+    pn_reactor_connection(client, ch);
+  }
+  pn_decref(ch);
+  pn_reactor_run(client);
+  pn_reactor_free(client);
+
+  pn_reactor_group_stop(group);
+  int accepted = 0;
+  for (size_t i = 0; i < 2; i++) {
+    accepted += *(int *) pn_handler_mem(pn_reactor_get_handler(pn_reactor_group_get(group, i)));
+  }
+  assert(accepted == count);
+  pn_reactor_group_free(group);
+}
+
+#if defined(__linux__) || defined(_WIN32)
+// a member that cannot be pinned as asked stops the group starting
+static void test_reactor_group_pin_error(void) {
+  pn_reactor_group_t *group = pn_reactor_group(2);
+  assert(pn_reactor_group_set_cpu(group, 2, 0) == PN_ARG_ERR);
+  assert(pn_reactor_group_set_node(group, 0, -2) == PN_ARG_ERR);
+  assert(!pn_reactor_group_set_cpu(group, 1, 1 << 20));
+  assert(pn_reactor_group_start(group) == PN_ERR);
+  pn_reactor_group_free(group);
+}
+#endif
+
+static void count_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  if (type == PN_TIMER_TASK) {
+    int *count = (int *) pn_handler_mem(pn_reactor_get_handler(pn_event_reactor(event)));
+    (*count)++;
+  }
+}
+
+static void forward_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  if (type == PN_TIMER_TASK) {
+    pn_reactor_t *target = *(pn_reactor_t **) pn_handler_mem(handler);
+    assert(!pn_reactor_post(target, pn_handler(count_dispatch)));
+  }
+}
+
+// a connection's burst of events is served in turn with the others'
+static void record_dispatch(pn_handler_t *handler, pn_event_t *event, pn_event_type_t type) {
+  pn_list_t *events = *(pn_list_t **) pn_handler_mem(handler);
+  pn_list_add(events, pn_event_connection(event));
+  pn_list_add(events, (void *) type);
+}
+
+static void put_burst(pn_reactor_t *reactor, pn_connection_t *conn, int count) {
+  for (int i = 0; i < count; i++) {
+    pn_collector_put(pn_reactor_collector(reactor), PN_OBJECT, conn,
+                     i % 2 ? PN_CONNECTION_REMOTE_OPEN : PN_CONNECTION_LOCAL_OPEN);
+  }
+}
+
+static void test_reactor_budgets(void) {
+  pn_reactor_t *reactor = pn_reactor();
+  pn_handler_t *global = pn_handler(NULL);
+  pn_reactor_set_global_handler(reactor, global);
+  pn_decref(global);
+  pn_list_t *events = pn_list(PN_VOID, 0);
+  pn_handler_t *handler = pn_handler_new(record_dispatch, sizeof(pn_list_t *), NULL);
+  *(pn_list_t **) pn_handler_mem(handler) = events;
+  pn_reactor_set_handler(reactor, handler);
+  pn_decref(handler);
+
+  assert(!pn_reactor_get_connection_budget(reactor));
+  pn_reactor_set_connection_budget(reactor, 8);
+  assert(pn_reactor_get_connection_budget(reactor) == 8);
+  pn_connection_t *noisy = pn_connection();
+  pn_connection_t *quiet = pn_connection();
+  pn_connection_collect(noisy, pn_reactor_collector(reactor));
+  pn_connection_collect(quiet, pn_reactor_collector(reactor));
+  put_burst(reactor, noisy, 40);
+  put_burst(reactor, quiet, 4);
+  while (pn_reactor_process(reactor)) {}
+
+  // both INITs, then the noisy one's share, then all of the quiet one's
+  assert(pn_list_size(events) == 2*46);
+  size_t last_quiet = 0;
+  int noisy_seen = 0;
+  for (size_t i = 0; i < pn_list_size(events); i += 2) {
+    pn_event_type_t type = (pn_event_type_t) (uintptr_t) pn_list_get(events, i + 1);
+    if (pn_list_get(events, i) == quiet) {
+      last_quiet = i/2;
+    } else if (type != PN_CONNECTION_INIT) {
+      assert(type == (noisy_seen++ % 2 ? PN_CONNECTION_REMOTE_OPEN : PN_CONNECTION_LOCAL_OPEN));
+    }
+  }
+  assert(noisy_seen == 40);
+  assert(last_quiet == 12);
+
+  // a pass stops at the event budget
+  pn_reactor_set_connection_budget(reactor, 0);
+  pn_reactor_set_event_budget(reactor, 10);
+  assert(pn_reactor_get_event_budget(reactor) == 10);
+  pn_list_clear(events);
+  put_burst(reactor, noisy, 30);
+  assert(pn_reactor_process(reactor));
+  assert(pn_list_size(events) == 2*10);
+  while (pn_reactor_process(reactor)) {}
+  assert(pn_list_size(events) == 2*30);
+
+  pn_reactor_set_time_budget(reactor, 5);
+  assert(pn_reactor_get_time_budget(reactor) == 5);
+  pn_reactor_free(reactor);
+  pn_connection_free(noisy);
+  pn_connection_free(quiet);
+  pn_free(events);
+}
+
+static void test_reactor_post_many(int n) {
+  pn_reactor_t *target = pn_reactor();
+  pn_handler_t *counter = pn_handler_new(NULL, sizeof(int), NULL);
+  *(int *) pn_handler_mem(counter) = 0;
+  pn_reactor_set_handler(target, counter);
+  pn_decref(counter);
+
+  // both threads of the group post to the target at once
+  pn_reactor_group_t *group = pn_reactor_group(2);
+  assert(!pn_reactor_group_start(group));
+  for (int i = 0; i < 2*n; i++) {
+    pn_handler_t *forward = pn_handler_new(forward_dispatch, sizeof(pn_reactor_t *), NULL);
+    *(pn_reactor_t **) pn_handler_mem(forward) = target;
+    assert(!pn_reactor_post(pn_reactor_group_get(group, i % 2), forward));
+  }
+  pn_reactor_group_stop(group);
+  pn_reactor_group_free(group);
+
+  pn_reactor_start(target);
+  while (pn_reactor_process(target) && *(int *) pn_handler_mem(counter) < 2*n) {}
+  assert(*(int *) pn_handler_mem(counter) == 2*n);
+  pn_reactor_stop(target);
+  pn_reactor_free(target);
+}
+
 int main(int argc, char **argv)
 {
   test_reactor();
@@ -451,15 +1098,41 @@ int main(int argc, char **argv)
   test_reactor_handler_run();
   test_reactor_handler_run_free();
   test_reactor_connection();
+  test_reactor_handler_cache();
   test_reactor_acceptor();
   test_reactor_acceptor_run();
   test_reactor_connect();
+  test_reactor_socket_options();
+  test_reactor_resolve();
+#ifndef _WIN32
+  test_io_unix();
+#endif
   for (int i = 0; i < 64; i++) {
-    test_reactor_transfer(i, 2);
+    test_reactor_transfer(i, 2, false, 0);
   }
-  test_reactor_transfer(1024, 64);
-  test_reactor_transfer(4*1024, 1024);
+  test_reactor_transfer(1024, 64, false, 0);
+  test_reactor_transfer(4*1024, 1024, false, 0);
+  test_reactor_transfer(1024, 64, true, 0);
+  test_reactor_transfer(4*1024, 1024, true, 0);
+  test_reactor_transfer(4*1024, 1024, false, 1);
+  test_reactor_zerocopy();
+  test_reactor_transfer_tls(false);
+  test_reactor_transfer_tls(true);
+  test_reactor_transfer_budgets();
   test_reactor_schedule();
   test_reactor_schedule_handler();
+  test_reactor_schedule_cancel();
+  test_reactor_coarse_clock();
+  test_reactor_budgets();
+  test_timer_wheel(0, 1000);
+  test_timer_wheel(0, (int64_t) 1 << 40);
+  test_timer_wheel(1444000000000LL, (int64_t) 1 << 26);
+  test_reactor_group_post();
+  test_reactor_group_acceptor(200, false);
+#if defined(__linux__) || defined(_WIN32)
+  test_reactor_group_acceptor(200, true);
+  test_reactor_group_pin_error();
+#endif
+  test_reactor_post_many(10000);
   return 0;
 }
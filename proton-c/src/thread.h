@@ -0,0 +1,106 @@
+#ifndef _PROTON_SRC_THREAD_H
+#define _PROTON_SRC_THREAD_H 1
+
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/import_export.h>
+#include <proton/type_compat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Minimal portable threading primitives used internally by the
+ * library. None of the engine objects are thread safe; these exist so
+ * that the few places that do hand work between threads can do so.
+ */
+
+typedef struct pni_thread_t pni_thread_t;
+typedef struct pni_mutex_t pni_mutex_t;
+typedef struct pni_semaphore_t pni_semaphore_t;
+
+/** Start a new thread running run(context).
+ *
+ * @return the new thread, or NULL if the thread could not be started
+ * @internal
+ */
+PN_EXTERN pni_thread_t *pni_thread(void (*run)(void *), void *context);
+
+/** Wait for a thread to exit and release its resources.
+ *
+ * @internal
+ */
+PN_EXTERN void pni_thread_join(pni_thread_t *thread);
+
+/** Run a thread only on the given CPU, or on the CPUs of the given
+ * NUMA node. Memory the thread touches first is then usually placed
+ * on that node.
+ *
+ * @return zero, or PN_ERR with errno set if the CPU or node does not
+ * exist or the platform cannot pin threads
+ * @internal
+ */
+int pni_thread_pin_cpu(pni_thread_t *thread, int cpu);
+int pni_thread_pin_node(pni_thread_t *thread, int node);
+
+pni_mutex_t *pni_mutex(void);
+void pni_mutex_free(pni_mutex_t *mutex);
+void pni_mutex_lock(pni_mutex_t *mutex);
+void pni_mutex_unlock(pni_mutex_t *mutex);
+
+/*
+ * A counting semaphore, for threads that sleep until there is work.
+ */
+
+pni_semaphore_t *pni_semaphore(void);
+void pni_semaphore_free(pni_semaphore_t *semaphore);
+void pni_semaphore_post(pni_semaphore_t *semaphore);
+void pni_semaphore_wait(pni_semaphore_t *semaphore);
+
+/** Wait at most timeout milliseconds, forever if it is negative.
+ *
+ * @return false if the wait timed out
+ * @internal
+ */
+bool pni_semaphore_wait_for(pni_semaphore_t *semaphore, int timeout);
+
+/*
+ * Sequentially consistent atomic operations, for the lock free paths
+ * that hand work between threads.
+ */
+
+void *pni_atomic_load(void *volatile *ptr);
+void *pni_atomic_exchange(void *volatile *ptr, void *value);
+bool pni_atomic_cas(void *volatile *ptr, void *expected, void *desired);
+// adds delta to value, returning the new value
+int pni_atomic_add(int volatile *value, int delta);
+int pni_atomic_get(int volatile *value);
+void pni_atomic_set(int volatile *value, int v);
+// the same for counters that could overflow an int
+uint64_t pni_atomic_add64(uint64_t volatile *value, uint64_t delta);
+uint64_t pni_atomic_get64(uint64_t volatile *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* thread.h */
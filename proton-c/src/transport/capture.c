@@ -0,0 +1,123 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/error.h>
+#include <string.h>
+#include "capture.h"
+#include "mapped.h"
+#include "platform.h"
+#include "alloc_private.h"
+
+struct pni_capture_t {
+  pni_mapped_t *file;
+  uint64_t start;
+};
+
+static void pni_write32(char *bytes, uint32_t value)
+{
+  bytes[0] = (char) (value >> 24);
+  bytes[1] = (char) (value >> 16);
+  bytes[2] = (char) (value >> 8);
+  bytes[3] = (char) value;
+}
+
+static void pni_write64(char *bytes, uint64_t value)
+{
+  pni_write32(bytes, (uint32_t) (value >> 32));
+  pni_write32(bytes + 4, (uint32_t) value);
+}
+
+static uint32_t pni_read32(const char *bytes)
+{
+  const unsigned char *b = (const unsigned char *) bytes;
+  return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | b[3];
+}
+
+static uint64_t pni_read64(const char *bytes)
+{
+  return ((uint64_t) pni_read32(bytes) << 32) | pni_read32(bytes + 4);
+}
+
+pni_capture_t *pni_capture(const char *path, uint32_t flags)
+{
+  pni_mapped_t *file = pni_mapped(path);
+  if (!file) return NULL;
+
+  char header[PNI_CAPTURE_HEADER];
+  memcpy(header, PNI_CAPTURE_MAGIC, 8);
+  pni_write32(header + 8, flags);
+  pni_write32(header + 12, 0);
+  pni_write64(header + 16, pn_i_now());
+  pni_capture_t *capture = (pni_capture_t *) pni_malloc(PN_ALLOC_TRANSPORT,
+                                                        sizeof(pni_capture_t));
+  if (!capture || pni_mapped_append(file, header, PNI_CAPTURE_HEADER)) {
+    pni_free(PN_ALLOC_TRANSPORT, capture);
+    pni_mapped_close(file);
+    return NULL;
+  }
+  capture->file = file;
+  capture->start = pn_i_nanos();
+  return capture;
+}
+
+int pni_capture_append(pni_capture_t *capture, pni_capture_dir_t dir, const char *bytes,
+                       size_t size)
+{
+  char record[PNI_CAPTURE_RECORD];
+  pni_write64(record, pn_i_nanos() - capture->start);
+  pni_write32(record + 8, (uint32_t) size);
+  pni_write32(record + 12, (uint32_t) dir << 24);
+  int err = pni_mapped_append(capture->file, record, PNI_CAPTURE_RECORD);
+  if (!err) err = pni_mapped_append(capture->file, bytes, size);
+  return err;
+}
+
+void pni_capture_free(pni_capture_t *capture)
+{
+  if (!capture) return;
+  pni_mapped_close(capture->file);
+  pni_free(PN_ALLOC_TRANSPORT, capture);
+}
+
+int pni_capture_read_header(const char *bytes, size_t available, uint32_t *flags,
+                            uint64_t *start)
+{
+  if (memcmp(bytes, PNI_CAPTURE_MAGIC, available < 8 ? available : 8)) return PN_ARG_ERR;
+  if (available < PNI_CAPTURE_HEADER) return PN_UNDERFLOW;
+  *flags = pni_read32(bytes + 8);
+  *start = pni_read64(bytes + 16);
+  return 0;
+}
+
+size_t pni_capture_read(const char *bytes, size_t available, pni_capture_record_t *record)
+{
+  if (available < PNI_CAPTURE_RECORD) return 0;
+  record->nanos = pni_read64(bytes);
+  size_t size = pni_read32(bytes + 8);
+  record->dir = (pni_capture_dir_t) (pni_read32(bytes + 12) >> 24);
+  if (record->dir == PNI_CAPTURE_END) {
+    record->bytes = pn_bytes(0, NULL);
+    return PNI_CAPTURE_RECORD;
+  }
+  if (available - PNI_CAPTURE_RECORD < size) return 0;
+  record->bytes = pn_bytes(size, bytes + PNI_CAPTURE_RECORD);
+  return PNI_CAPTURE_RECORD + size;
+}
@@ -0,0 +1,79 @@
+#ifndef _PROTON_CAPTURE_H
+#define _PROTON_CAPTURE_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/import_export.h>
+#include <proton/types.h>
+
+/*
+ * A capture is the bytes a transport read and wrote at the AMQP
+ * layer, below any SASL or SSL, so that each direction is an AMQP
+ * header followed by frames. All integers are big endian:
+ *
+ *   header: "PNCAPTR\x01", 32 bit flags, 32 zero bits, 64 bit start
+ *           of the capture in milliseconds since the epoch
+ *   record: 64 bit nanoseconds since the start, 32 bit size, 8 bit
+ *           direction, 24 zero bits, then size bytes
+ *
+ * A record with direction PNI_CAPTURE_END ends the capture as does
+ * the end of the file, so a capture cut short by a crash is read up
+ * to the last record that was written.
+ */
+
+#define PNI_CAPTURE_MAGIC ("PNCAPTR\x01")
+#define PNI_CAPTURE_HEADER (24)
+#define PNI_CAPTURE_RECORD (16)
+
+// flags, the transport was a server
+#define PNI_CAPTURE_SERVER (0x1)
+// the capture started after the transport had exchanged bytes
+#define PNI_CAPTURE_PARTIAL (0x2)
+
+typedef enum {
+  PNI_CAPTURE_END = 0,
+  PNI_CAPTURE_IN = 1,
+  PNI_CAPTURE_OUT = 2
+} pni_capture_dir_t;
+
+typedef struct pni_capture_t pni_capture_t;
+
+typedef struct {
+  uint64_t nanos;
+  pni_capture_dir_t dir;
+  pn_bytes_t bytes;
+} pni_capture_record_t;
+
+// NULL with errno set if the file could not be created
+pni_capture_t *pni_capture(const char *path, uint32_t flags);
+int pni_capture_append(pni_capture_t *capture, pni_capture_dir_t dir, const char *bytes,
+                       size_t size);
+void pni_capture_free(pni_capture_t *capture);
+
+// PN_UNDERFLOW if there are too few bytes for a header, PN_ARG_ERR if
+// they are not one
+PN_EXTERN int pni_capture_read_header(const char *bytes, size_t available, uint32_t *flags,
+                                      uint64_t *start);
+// the size of the record at bytes, or 0 if it is not all there
+PN_EXTERN size_t pni_capture_read(const char *bytes, size_t available, pni_capture_record_t *record);
+
+#endif /* capture.h */
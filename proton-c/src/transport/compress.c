@@ -0,0 +1,334 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/error.h>
+#include <string.h>
+#include <zlib.h>
+#include "compress.h"
+#include "alloc_private.h"
+
+// plain bytes taken from the layer above in one go
+#define PNI_COMPRESS_CHUNK (16*1024)
+
+struct pni_compress_t {
+  int level;
+  pn_data_t *offered;
+  bool declined;     // the peer does not compress
+  // output, plain until out_passed reaches out_at, the end of the
+  // frame that says so
+  uint64_t out_passed;
+  uint64_t out_at;
+  bool out_on;
+  bool flush;        // a sync flush is under way
+  bool unflushed;    // deflate holds input that is not flushed yet
+  bool eos;
+  z_stream zout;
+  char *out_buf;     // plain bytes waiting to go into deflate
+  size_t out_size;
+  // input
+  bool in_on;
+  z_stream zin;
+  char *in_buf;      // inflated bytes the layer above has yet to take
+  size_t in_size;
+  size_t in_count;
+};
+
+void pni_compress_free(pni_compress_t *compress)
+{
+  if (!compress) return;
+  if (compress->out_on) deflateEnd(&compress->zout);
+  if (compress->in_on) inflateEnd(&compress->zin);
+  pn_data_free(compress->offered);
+  pni_free(PN_ALLOC_TRANSPORT, compress->out_buf);
+  pni_free(PN_ALLOC_TRANSPORT, compress->in_buf);
+  pni_free(PN_ALLOC_TRANSPORT, compress);
+}
+
+int pn_transport_set_compression(pn_transport_t *transport, int level)
+{
+  if (!transport) return PN_ARG_ERR;
+  if (level < 0 || level > 9) return PN_ARG_ERR;
+  // the layers are chosen on the first read or write
+  if (transport->io_layers[0] != &pni_setup_layer) return PN_STATE_ERR;
+  if (!level) {
+    pni_compress_free(transport->compress);
+    transport->compress = NULL;
+    return 0;
+  }
+  if (!transport->compress) {
+    transport->compress = (pni_compress_t *) pni_calloc(PN_ALLOC_TRANSPORT, 1, sizeof(pni_compress_t));
+    if (!transport->compress) return PN_ERR;
+  }
+  transport->compress->level = level;
+  return 0;
+}
+
+// a single symbol or an array of them, the first is entered
+static bool pni_capabilities_start(pn_data_t *capabilities)
+{
+  pn_data_rewind(capabilities);
+  if (!pn_data_next(capabilities)) return false;
+  if (pn_data_type(capabilities) == PN_ARRAY) {
+    pn_data_enter(capabilities);
+    return pn_data_next(capabilities);
+  }
+  return true;
+}
+
+static bool pni_capabilities_offer(pn_data_t *capabilities)
+{
+  size_t size = strlen(PNI_COMPRESS_CAPABILITY);
+  bool offered = false;
+  if (pni_capabilities_start(capabilities)) {
+    do {
+      if (pn_data_type(capabilities) != PN_SYMBOL) continue;
+      pn_bytes_t symbol = pn_data_get_symbol(capabilities);
+      if (symbol.size == size && !memcmp(symbol.start, PNI_COMPRESS_CAPABILITY, size)) {
+        offered = true;
+      }
+    } while (!offered && pn_data_next(capabilities));
+  }
+  pn_data_rewind(capabilities);
+  return offered;
+}
+
+pn_data_t *pni_compress_offered(pn_transport_t *transport, pn_data_t *offered)
+{
+  pni_compress_t *compress = transport->compress;
+  if (!compress) return offered;
+  if (!compress->offered) compress->offered = pn_data(4);
+  pn_data_t *data = compress->offered;
+  pn_data_clear(data);
+  pn_data_put_array(data, false, PN_SYMBOL);
+  pn_data_enter(data);
+  if (offered && pni_capabilities_start(offered)) {
+    do {
+      if (pn_data_type(offered) == PN_SYMBOL) {
+        pn_data_put_symbol(data, pn_data_get_symbol(offered));
+      }
+    } while (pn_data_next(offered));
+    pn_data_rewind(offered);
+  }
+  pn_data_put_symbol(data, pn_bytes(strlen(PNI_COMPRESS_CAPABILITY), PNI_COMPRESS_CAPABILITY));
+  pn_data_exit(data);
+  pn_data_rewind(data);
+  return data;
+}
+
+int pni_compress_opened(pn_transport_t *transport)
+{
+  pni_compress_t *compress = transport->compress;
+  if (!compress || compress->out_at || compress->declined) return 0;
+  if (!transport->open_sent || !transport->open_rcvd) return 0;
+  if (!pni_capabilities_offer(transport->remote_offered_capabilities)) {
+    compress->declined = true;
+    return 0;
+  }
+
+  if (deflateInit(&compress->zout, compress->level) != Z_OK) {
+    return pn_do_error(transport, "amqp:internal-error", "deflate: %s",
+                       compress->zout.msg ? compress->zout.msg : "init failed");
+  }
+  compress->out_buf = (char *) pni_malloc(PN_ALLOC_TRANSPORT, PNI_COMPRESS_CHUNK);
+  if (!compress->out_buf) {
+    deflateEnd(&compress->zout);
+    return PN_ERR;
+  }
+  compress->out_size = PNI_COMPRESS_CHUNK;
+  int err = pn_post_frame(transport, PNI_COMPRESS_FRAME_TYPE, 0, "");
+  if (err) return err;
+  // everything up to and including the frame just posted goes out plain
+  compress->out_at = compress->out_passed + transport->available;
+  if (transport->trace & PN_TRACE_FRM)
+    pn_transport_logf(transport, "  -> %s", "DEFLATE");
+  return 0;
+}
+
+int pni_compress_input_started(pn_transport_t *transport)
+{
+  pni_compress_t *compress = transport->compress;
+  // the frame means nothing to a transport that did not offer, e.g.
+  // one replaying a capture
+  if (!compress || compress->in_on) return 0;
+  memset(&compress->zin, 0, sizeof(compress->zin));
+  if (inflateInit(&compress->zin) != Z_OK) {
+    return pn_do_error(transport, "amqp:internal-error", "inflate: %s",
+                       compress->zin.msg ? compress->zin.msg : "init failed");
+  }
+  compress->in_on = true;
+  if (transport->trace & PN_TRACE_FRM)
+    pn_transport_logf(transport, "  <- %s", "DEFLATE");
+  return 0;
+}
+
+static bool pni_inflated_reserve(pni_compress_t *compress)
+{
+  if (compress->in_count < compress->in_size) return true;
+  size_t size = compress->in_size ? 2*compress->in_size : PNI_COMPRESS_CHUNK;
+  char *buf = (char *) pni_realloc(PN_ALLOC_TRANSPORT, compress->in_buf, size);
+  if (!buf) return false;
+  compress->in_buf = buf;
+  compress->in_size = size;
+  return true;
+}
+
+static ssize_t pni_compress_input(pn_transport_t *transport, unsigned int layer,
+                                  const char *bytes, size_t available)
+{
+  pni_compress_t *compress = transport->compress;
+  if (!compress->in_on) {
+    // the layer above stops after the frame that turns inflating on
+    return pni_passthru_layer.process_input(transport, layer, bytes, available);
+  }
+
+  if (!available) {
+    // the end of input, whatever is left goes up with it
+    return pni_passthru_layer.process_input(transport, layer, compress->in_buf,
+                                            compress->in_count);
+  }
+
+  z_stream *z = &compress->zin;
+  z->next_in = (Bytef *) bytes;
+  z->avail_in = available;
+  size_t produced;
+  do {
+    if (!pni_inflated_reserve(compress)) {
+      pn_do_error(transport, "amqp:resource-limit-exceeded", "inflate: out of memory");
+      return PN_EOS;
+    }
+    z->next_out = (Bytef *) compress->in_buf + compress->in_count;
+    z->avail_out = compress->in_size - compress->in_count;
+    int rc = inflate(z, Z_SYNC_FLUSH);
+    if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      pn_do_error(transport, "amqp:connection:framing-error", "inflate: %s",
+                  z->msg ? z->msg : "stream error");
+      return PN_EOS;
+    }
+    produced = compress->in_size - compress->in_count - z->avail_out;
+    compress->in_count += produced;
+
+    if (!compress->in_count) continue;
+    ssize_t n = pni_passthru_layer.process_input(transport, layer, compress->in_buf,
+                                                 compress->in_count);
+    if (n < 0) return n;
+    compress->in_count -= n;
+    memmove(compress->in_buf, compress->in_buf + n, compress->in_count);
+  } while (z->avail_in || produced);
+
+  return available;
+}
+
+// hand on the plain bytes up to the switch, keeping what came after it
+static ssize_t pni_compress_switch(pn_transport_t *transport, char *bytes, size_t n)
+{
+  pni_compress_t *compress = transport->compress;
+  size_t plain = compress->out_at - compress->out_passed;
+  if (n - plain > compress->out_size) {
+    char *buf = (char *) pni_realloc(PN_ALLOC_TRANSPORT, compress->out_buf, n - plain);
+    if (!buf) {
+      pn_do_error(transport, "amqp:resource-limit-exceeded", "deflate: out of memory");
+      return PN_EOS;
+    }
+    compress->out_buf = buf;
+    compress->out_size = n - plain;
+  }
+  memcpy(compress->out_buf, bytes + plain, n - plain);
+  compress->zout.next_in = (Bytef *) compress->out_buf;
+  compress->zout.avail_in = n - plain;
+  compress->unflushed = compress->zout.avail_in > 0;
+  compress->flush = compress->unflushed;
+  compress->out_passed = compress->out_at;
+  compress->out_on = true;
+  return plain;
+}
+
+static ssize_t pni_compress_output(pn_transport_t *transport, unsigned int layer,
+                                   char *bytes, size_t available)
+{
+  pni_compress_t *compress = transport->compress;
+  if (!compress->out_on) {
+    size_t limit = available;
+    if (compress->out_at && compress->out_at - compress->out_passed < limit) {
+      limit = compress->out_at - compress->out_passed;
+    }
+    if (!limit) {
+      pni_compress_switch(transport, bytes, 0);
+    } else {
+      ssize_t n = pni_passthru_layer.process_output(transport, layer, bytes, limit);
+      if (n <= 0) return n;
+      // the switch may have been posted while the layer above wrote this
+      if (!compress->out_at || compress->out_passed + n < compress->out_at) {
+        compress->out_passed += n;
+        return n;
+      }
+      return pni_compress_switch(transport, bytes, n);
+    }
+  }
+
+  z_stream *z = &compress->zout;
+  z->next_out = (Bytef *) bytes;
+  z->avail_out = available;
+  while (z->avail_out) {
+    if (!z->avail_in && !compress->flush) {
+      ssize_t n = compress->eos ? PN_EOS :
+        pni_passthru_layer.process_output(transport, layer, compress->out_buf,
+                                          compress->out_size);
+      if (n > 0) {
+        z->next_in = (Bytef *) compress->out_buf;
+        z->avail_in = n;
+        compress->unflushed = true;
+        // a short read means the frames queued so far are all in
+        compress->flush = (size_t) n < compress->out_size;
+      } else {
+        if (n < 0) compress->eos = true;
+        if (!compress->unflushed) break;
+        compress->flush = true;
+      }
+    }
+    int rc = deflate(z, compress->flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+    if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      pn_do_error(transport, "amqp:internal-error", "deflate: %s",
+                  z->msg ? z->msg : "stream error");
+      return PN_EOS;
+    }
+    if (compress->flush && !z->avail_in && z->avail_out) {
+      compress->flush = false;
+      compress->unflushed = false;
+    }
+  }
+
+  size_t n = available - z->avail_out;
+  if (!n && compress->eos) return PN_EOS;
+  return n;
+}
+
+static size_t pni_compress_buffered(pn_transport_t *transport)
+{
+  pni_compress_t *compress = transport->compress;
+  return compress->out_on ? compress->zout.avail_in + compress->unflushed : 0;
+}
+
+const pn_io_layer_t pni_compress_layer = {
+  pni_compress_input,
+  pni_compress_output,
+  NULL,
+  pni_compress_buffered
+};
@@ -0,0 +1,47 @@
+#ifndef _PROTON_COMPRESS_H
+#define _PROTON_COMPRESS_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "engine/engine-internal.h"
+
+/*
+ * A transport that compresses offers PNI_COMPRESS_CAPABILITY in its
+ * open. Once it has sent its open and seen the peer's offer the same,
+ * it sends an empty frame of type PNI_COMPRESS_FRAME_TYPE, and
+ * everything it sends after that is one deflate stream, flushed
+ * whenever the frames queued so far have all gone in. The two
+ * directions switch independently.
+ */
+
+#define PNI_COMPRESS_CAPABILITY ("PROTON-DEFLATE")
+#define PNI_COMPRESS_FRAME_TYPE (0x5a)
+
+void pni_compress_free(pni_compress_t *compress);
+// the capabilities to offer in the open, offered with ours added
+pn_data_t *pni_compress_offered(pn_transport_t *transport, pn_data_t *offered);
+// once both opens are through, switch the output over if the peer agreed
+int pni_compress_opened(pn_transport_t *transport);
+// the peer's input is compressed from after the frame just read
+int pni_compress_input_started(pn_transport_t *transport);
+
+#endif /* compress.h */
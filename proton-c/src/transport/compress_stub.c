@@ -0,0 +1,72 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/error.h>
+#include "compress.h"
+
+/** @file
+ * Stub implementations of transport compression, used where proton is
+ * built without zlib. A transport never offers to compress, so none
+ * of the rest is reached.
+ */
+
+int pn_transport_set_compression(pn_transport_t *transport, int level)
+{
+  return level ? PN_ERR : 0;
+}
+
+void pni_compress_free(pni_compress_t *compress)
+{
+}
+
+pn_data_t *pni_compress_offered(pn_transport_t *transport, pn_data_t *offered)
+{
+  return offered;
+}
+
+int pni_compress_opened(pn_transport_t *transport)
+{
+  return 0;
+}
+
+int pni_compress_input_started(pn_transport_t *transport)
+{
+  return 0;
+}
+
+static ssize_t pni_compress_input(pn_transport_t *transport, unsigned int layer,
+                                  const char *bytes, size_t available)
+{
+  return pni_passthru_layer.process_input(transport, layer, bytes, available);
+}
+
+static ssize_t pni_compress_output(pn_transport_t *transport, unsigned int layer,
+                                   char *bytes, size_t available)
+{
+  return pni_passthru_layer.process_output(transport, layer, bytes, available);
+}
+
+const pn_io_layer_t pni_compress_layer = {
+  pni_compress_input,
+  pni_compress_output,
+  NULL,
+  NULL
+};
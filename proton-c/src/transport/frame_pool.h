@@ -0,0 +1,56 @@
+#ifndef _PROTON_FRAME_POOL_H
+#define _PROTON_FRAME_POOL_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/io.h>
+#include <proton/transport.h>
+#include <stddef.h>
+
+typedef struct pni_frame_pool_t pni_frame_pool_t;
+
+// a pool of raw io buffers shared by the transports of one reactor, it
+// keeps up to limit free buffers and is itself reference counted
+pni_frame_pool_t *pni_frame_pool(size_t limit);
+void pni_transport_set_frame_pool(pn_transport_t *transport, pni_frame_pool_t *pool);
+
+// lets a layer that hands work to another thread have the transport
+// looked at again when the work is done, wake is called from that
+// thread and owns a reference to the transport the layer took for it
+typedef void (*pni_transport_wake_t)(pn_transport_t *transport, void *context);
+void pni_transport_set_waker(pn_transport_t *transport, pni_transport_wake_t wake, void *context);
+
+// the socket the owner does the transport's io on, which lets the ssl
+// layer give the record layer to the kernel.  The directions it has
+// given so far are PNI_KTLS_TX and PNI_KTLS_RX, input that arrives
+// once the kernel has RX is to be read with pni_recv_tls()
+#define PNI_KTLS_TX 1
+#define PNI_KTLS_RX 2
+void pni_transport_set_socket(pn_transport_t *transport, pn_socket_t socket);
+int pni_transport_kernel_tls(pn_transport_t *transport);
+
+// raw buffers for a transport and the layers above it, served from the
+// pool when they are PNI_IO_BUFFER_SIZE
+char *pni_io_alloc(pn_transport_t *transport, size_t size);
+void pni_io_release(pn_transport_t *transport, char *bytes, size_t size);
+
+#endif /* frame_pool.h */
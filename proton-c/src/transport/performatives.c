@@ -0,0 +1,474 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/error.h>
+#include <stddef.h>
+#include <string.h>
+#include "encodings.h"
+#include "protocol.h"
+#include "performatives.h"
+
+typedef struct {
+  char *position;
+  char *end;
+} pni_wire_t;
+
+// like the encoder, keep counting past the end so the caller learns
+// how much room is needed
+static inline void pni_wire_put8(pni_wire_t *wire, uint8_t value)
+{
+  if (wire->position < wire->end) {
+    wire->position[0] = value;
+  }
+  wire->position++;
+}
+
+static inline void pni_wire_put32(pni_wire_t *wire, uint32_t value)
+{
+  if (wire->end - wire->position >= 4) {
+    wire->position[0] = 0xFF & (value >> 24);
+    wire->position[1] = 0xFF & (value >> 16);
+    wire->position[2] = 0xFF & (value >>  8);
+    wire->position[3] = 0xFF & (value      );
+  }
+  wire->position += 4;
+}
+
+static inline void pni_wire_uint(pni_wire_t *wire, uint32_t value)
+{
+  if (value < 256) {
+    pni_wire_put8(wire, PNE_SMALLUINT);
+    pni_wire_put8(wire, value);
+  } else {
+    pni_wire_put8(wire, PNE_UINT);
+    pni_wire_put32(wire, value);
+  }
+}
+
+static inline void pni_wire_ulong(pni_wire_t *wire, uint64_t value)
+{
+  if (value < 256) {
+    pni_wire_put8(wire, PNE_SMALLULONG);
+    pni_wire_put8(wire, value);
+  } else {
+    pni_wire_put8(wire, PNE_ULONG);
+    pni_wire_put32(wire, value >> 32);
+    pni_wire_put32(wire, value);
+  }
+}
+
+static inline void pni_wire_bool(pni_wire_t *wire, bool value)
+{
+  pni_wire_put8(wire, value ? PNE_TRUE : PNE_FALSE);
+}
+
+static inline void pni_wire_null(pni_wire_t *wire)
+{
+  pni_wire_put8(wire, PNE_NULL);
+}
+
+static inline void pni_wire_binary(pni_wire_t *wire, const pn_bytes_t *value)
+{
+  if (value->size < 256) {
+    pni_wire_put8(wire, PNE_VBIN8);
+    pni_wire_put8(wire, value->size);
+  } else {
+    pni_wire_put8(wire, PNE_VBIN32);
+    pni_wire_put32(wire, value->size);
+  }
+  if (wire->end - wire->position >= (ptrdiff_t) value->size) {
+    memmove(wire->position, value->start, value->size);
+  }
+  wire->position += value->size;
+}
+
+static inline void pni_wire_descriptor(pni_wire_t *wire, uint64_t code)
+{
+  pni_wire_put8(wire, PNE_DESCRIPTOR);
+  pni_wire_ulong(wire, code);
+}
+
+// lists are always list32, the size is backfilled by pni_wire_exit
+static inline char *pni_wire_enter(pni_wire_t *wire, uint32_t count)
+{
+  pni_wire_put8(wire, PNE_LIST32);
+  char *start = wire->position;
+  wire->position += 4;
+  pni_wire_put32(wire, count);
+  return start;
+}
+
+static inline void pni_wire_exit(pni_wire_t *wire, char *start)
+{
+  char *pos = wire->position;
+  wire->position = start;
+  pni_wire_put32(wire, pos - start - 4);
+  wire->position = pos;
+}
+
+static inline ssize_t pni_wire_size(pni_wire_t *wire, char *dst)
+{
+  return wire->position > wire->end ? PN_OVERFLOW : wire->position - dst;
+}
+
+ssize_t pni_encode_transfer(char *dst, size_t size, uint32_t handle, pn_sequence_t id,
+                            const pn_bytes_t *tag, uint32_t message_format,
+                            bool settled, bool more, uint64_t code)
+{
+  pni_wire_t wire = {dst, dst + size};
+  pni_wire_descriptor(&wire, TRANSFER);
+  char *list = pni_wire_enter(&wire, 8);
+  pni_wire_uint(&wire, handle);
+  pni_wire_uint(&wire, id);
+  if (tag->start) {
+    pni_wire_binary(&wire, tag);
+  } else {
+    pni_wire_null(&wire);
+  }
+  pni_wire_uint(&wire, message_format);
+  pni_wire_bool(&wire, settled);
+  pni_wire_bool(&wire, more);
+  pni_wire_null(&wire);
+  if (code) {
+    pni_wire_descriptor(&wire, code);
+    pni_wire_null(&wire);
+  } else {
+    pni_wire_null(&wire);
+  }
+  pni_wire_exit(&wire, list);
+  return pni_wire_size(&wire, dst);
+}
+
+ssize_t pni_encode_flow(char *dst, size_t size, bool remote_channel, pn_sequence_t next_incoming_id,
+                        uint32_t incoming_window, pn_sequence_t next_outgoing_id,
+                        uint32_t outgoing_window, bool link, uint32_t handle,
+                        pn_sequence_t delivery_count, pn_sequence_t link_credit, bool drain)
+{
+  pni_wire_t wire = {dst, dst + size};
+  pni_wire_descriptor(&wire, FLOW);
+  char *list = pni_wire_enter(&wire, 9);
+  if (remote_channel) {
+    pni_wire_uint(&wire, next_incoming_id);
+  } else {
+    pni_wire_null(&wire);
+  }
+  pni_wire_uint(&wire, incoming_window);
+  pni_wire_uint(&wire, next_outgoing_id);
+  pni_wire_uint(&wire, outgoing_window);
+  if (link) {
+    pni_wire_uint(&wire, handle);
+    pni_wire_uint(&wire, delivery_count);
+    pni_wire_uint(&wire, link_credit);
+    pni_wire_null(&wire);
+    pni_wire_bool(&wire, drain);
+  } else {
+    pni_wire_null(&wire);
+    pni_wire_null(&wire);
+    pni_wire_null(&wire);
+    pni_wire_null(&wire);
+    pni_wire_null(&wire);
+  }
+  pni_wire_exit(&wire, list);
+  return pni_wire_size(&wire, dst);
+}
+
+ssize_t pni_encode_disposition(char *dst, size_t size, bool role, pn_sequence_t first,
+                               pn_sequence_t last, bool settled, uint64_t code)
+{
+  pni_wire_t wire = {dst, dst + size};
+  pni_wire_descriptor(&wire, DISPOSITION);
+  char *list = pni_wire_enter(&wire, 5);
+  pni_wire_bool(&wire, role);
+  pni_wire_uint(&wire, first);
+  pni_wire_uint(&wire, last);
+  pni_wire_bool(&wire, settled);
+  if (code) {
+    pni_wire_descriptor(&wire, code);
+    pni_wire_exit(&wire, pni_wire_enter(&wire, 0));
+  } else {
+    pni_wire_null(&wire);
+  }
+  pni_wire_exit(&wire, list);
+  return pni_wire_size(&wire, dst);
+}
+
+//
+// decoding
+//
+
+typedef struct {
+  const char *position;
+  const char *end;
+  bool error;
+} pni_cursor_t;
+
+static inline uint8_t pni_cursor_get8(pni_cursor_t *cursor)
+{
+  if (cursor->end - cursor->position < 1) {
+    cursor->error = true;
+    return 0;
+  }
+  return (uint8_t) *cursor->position++;
+}
+
+static inline uint32_t pni_cursor_get32(pni_cursor_t *cursor)
+{
+  if (cursor->end - cursor->position < 4) {
+    cursor->error = true;
+    return 0;
+  }
+  const uint8_t *b = (const uint8_t *) cursor->position;
+  cursor->position += 4;
+  return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | b[3];
+}
+
+static inline uint64_t pni_cursor_ulong(pni_cursor_t *cursor)
+{
+  switch (pni_cursor_get8(cursor)) {
+  case PNE_ULONG0: return 0;
+  case PNE_SMALLULONG: return pni_cursor_get8(cursor);
+  case PNE_ULONG:
+    {
+      uint64_t hi = pni_cursor_get32(cursor);
+      return (hi << 32) | pni_cursor_get32(cursor);
+    }
+  default:
+    cursor->error = true;
+    return 0;
+  }
+}
+
+// the list fields are read by position, anything past the encoded
+// count is treated as null
+typedef struct {
+  pni_cursor_t *cursor;
+  const char *end;
+  uint32_t remaining;
+} pni_fields_t;
+
+static inline bool pni_fields_enter(pni_fields_t *fields, pni_cursor_t *cursor)
+{
+  fields->cursor = cursor;
+  uint32_t size;
+  switch (pni_cursor_get8(cursor)) {
+  case PNE_LIST0:
+    size = 0;
+    fields->remaining = 0;
+    break;
+  case PNE_LIST8:
+    size = pni_cursor_get8(cursor);
+    if (size < 1) return false;
+    fields->remaining = pni_cursor_get8(cursor);
+    size -= 1;
+    break;
+  case PNE_LIST32:
+    size = pni_cursor_get32(cursor);
+    if (size < 4) return false;
+    fields->remaining = pni_cursor_get32(cursor);
+    size -= 4;
+    break;
+  default:
+    return false;
+  }
+  if (cursor->error || (size_t) (cursor->end - cursor->position) < size) return false;
+  fields->end = cursor->position + size;
+  return true;
+}
+
+static inline bool pni_fields_exit(pni_fields_t *fields)
+{
+  return !fields->cursor->error && fields->cursor->position == fields->end;
+}
+
+// the code of the next field, or PNE_NULL past the end of the list
+static inline uint8_t pni_fields_next(pni_fields_t *fields)
+{
+  if (!fields->remaining) return PNE_NULL;
+  fields->remaining--;
+  return pni_cursor_get8(fields->cursor);
+}
+
+static inline uint32_t pni_fields_uint(pni_fields_t *fields, bool *init)
+{
+  pni_cursor_t *cursor = fields->cursor;
+  uint8_t code = pni_fields_next(fields);
+  if (init) *init = code != PNE_NULL;
+  switch (code) {
+  case PNE_NULL:
+  case PNE_UINT0: return 0;
+  case PNE_SMALLUINT: return pni_cursor_get8(cursor);
+  case PNE_UINT: return pni_cursor_get32(cursor);
+  default:
+    cursor->error = true;
+    return 0;
+  }
+}
+
+static inline bool pni_fields_bool(pni_fields_t *fields)
+{
+  pni_cursor_t *cursor = fields->cursor;
+  switch (pni_fields_next(fields)) {
+  case PNE_NULL:
+  case PNE_FALSE: return false;
+  case PNE_TRUE: return true;
+  case PNE_BOOLEAN: return pni_cursor_get8(cursor);
+  default:
+    cursor->error = true;
+    return false;
+  }
+}
+
+static inline pn_bytes_t pni_fields_binary(pni_fields_t *fields)
+{
+  pni_cursor_t *cursor = fields->cursor;
+  size_t size;
+  switch (pni_fields_next(fields)) {
+  case PNE_NULL: return pn_bytes(0, NULL);
+  case PNE_VBIN8: size = pni_cursor_get8(cursor); break;
+  case PNE_VBIN32: size = pni_cursor_get32(cursor); break;
+  default:
+    cursor->error = true;
+    return pn_bytes(0, NULL);
+  }
+  if (cursor->error || (size_t) (cursor->end - cursor->position) < size) {
+    cursor->error = true;
+    return pn_bytes(0, NULL);
+  }
+  pn_bytes_t bytes = pn_bytes(size, cursor->position);
+  cursor->position += size;
+  return bytes;
+}
+
+static inline void pni_fields_ubyte(pni_fields_t *fields)
+{
+  pni_cursor_t *cursor = fields->cursor;
+  switch (pni_fields_next(fields)) {
+  case PNE_NULL: return;
+  case PNE_UBYTE: pni_cursor_get8(cursor); return;
+  default: cursor->error = true;
+  }
+}
+
+// a delivery state is only handled when it carries no value beyond its
+// descriptor
+static inline void pni_fields_state(pni_fields_t *fields, bool *init, uint64_t *type)
+{
+  pni_cursor_t *cursor = fields->cursor;
+  *init = false;
+  *type = 0;
+  switch (pni_fields_next(fields)) {
+  case PNE_NULL: return;
+  case PNE_DESCRIPTOR: break;
+  default:
+    cursor->error = true;
+    return;
+  }
+  *type = pni_cursor_ulong(cursor);
+  *init = true;
+  pni_fields_t value;
+  if (cursor->end - cursor->position >= 1 && *cursor->position == (char) PNE_NULL) {
+    cursor->position++;
+  } else if (!pni_fields_enter(&value, cursor) || value.remaining) {
+    cursor->error = true;
+  } else {
+    cursor->position = value.end;
+  }
+}
+
+static inline void pni_fields_reject(pni_fields_t *fields)
+{
+  // anything but null is beyond the fast path
+  if (pni_fields_next(fields) != PNE_NULL) {
+    fields->cursor->error = true;
+  }
+}
+
+bool pni_decode_descriptor(const char *bytes, size_t size, uint64_t *code)
+{
+  pni_cursor_t cursor = {bytes, bytes + size, false};
+  if (pni_cursor_get8(&cursor) != PNE_DESCRIPTOR) return false;
+  *code = pni_cursor_ulong(&cursor);
+  return !cursor.error;
+}
+
+static inline bool pni_decode_enter(pni_cursor_t *cursor, pni_fields_t *fields)
+{
+  pni_cursor_get8(cursor);
+  pni_cursor_ulong(cursor);
+  return !cursor->error && pni_fields_enter(fields, cursor);
+}
+
+size_t pni_decode_transfer(const char *bytes, size_t size, pni_transfer_t *transfer)
+{
+  pni_cursor_t cursor = {bytes, bytes + size, false};
+  pni_fields_t fields;
+  if (!pni_decode_enter(&cursor, &fields)) return 0;
+  transfer->handle = pni_fields_uint(&fields, NULL);
+  transfer->id = pni_fields_uint(&fields, &transfer->id_init);
+  transfer->tag = pni_fields_binary(&fields);
+  transfer->format = pni_fields_uint(&fields, NULL);
+  transfer->settled = pni_fields_bool(&fields);
+  transfer->more = pni_fields_bool(&fields);
+  pni_fields_ubyte(&fields);        // rcv-settle-mode
+  pni_fields_reject(&fields);       // state
+  transfer->type_init = false;
+  transfer->type = 0;
+  pni_fields_bool(&fields);         // resume
+  pni_fields_bool(&fields);         // aborted
+  pni_fields_bool(&fields);         // batchable
+  if (fields.remaining || !pni_fields_exit(&fields)) return 0;
+  return cursor.position - bytes;
+}
+
+size_t pni_decode_flow(const char *bytes, size_t size, pni_flow_t *flow)
+{
+  pni_cursor_t cursor = {bytes, bytes + size, false};
+  pni_fields_t fields;
+  if (!pni_decode_enter(&cursor, &fields)) return 0;
+  flow->inext = pni_fields_uint(&fields, &flow->inext_init);
+  flow->iwin = pni_fields_uint(&fields, NULL);
+  flow->onext = pni_fields_uint(&fields, NULL);
+  flow->owin = pni_fields_uint(&fields, NULL);
+  flow->handle = pni_fields_uint(&fields, &flow->handle_init);
+  flow->delivery_count = pni_fields_uint(&fields, &flow->dcount_init);
+  flow->link_credit = pni_fields_uint(&fields, NULL);
+  pni_fields_uint(&fields, NULL);   // available
+  flow->drain = pni_fields_bool(&fields);
+  pni_fields_bool(&fields);         // echo
+  pni_fields_reject(&fields);       // properties
+  if (fields.remaining || !pni_fields_exit(&fields)) return 0;
+  return cursor.position - bytes;
+}
+
+size_t pni_decode_disposition(const char *bytes, size_t size, pni_disposition_t *disposition)
+{
+  pni_cursor_t cursor = {bytes, bytes + size, false};
+  pni_fields_t fields;
+  if (!pni_decode_enter(&cursor, &fields)) return 0;
+  disposition->role = pni_fields_bool(&fields);
+  disposition->first = pni_fields_uint(&fields, NULL);
+  disposition->last = pni_fields_uint(&fields, &disposition->last_init);
+  disposition->settled = pni_fields_bool(&fields);
+  pni_fields_state(&fields, &disposition->type_init, &disposition->type);
+  pni_fields_bool(&fields);         // batchable
+  if (fields.remaining || !pni_fields_exit(&fields)) return 0;
+  return cursor.position - bytes;
+}
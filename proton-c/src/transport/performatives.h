@@ -0,0 +1,99 @@
+#ifndef _PROTON_PERFORMATIVES_INTERNAL_H
+#define _PROTON_PERFORMATIVES_INTERNAL_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/import_export.h>
+#include <proton/types.h>
+#include <sys/types.h>
+
+// Direct encoders for the hottest performatives. Each writes exactly the
+// bytes pn_data_encode would produce for the equivalent pn_data_fill
+// format, and returns the encoded size, PN_OVERFLOW if it doesn't fit.
+
+// "DL[IIzIoon?DLn]" with an empty delivery state
+#define PNI_TRANSFER_MAX(TAG_SIZE) (48 + (TAG_SIZE)) // largest encoding for a tag size
+PN_EXTERN ssize_t pni_encode_transfer(char *dst, size_t size, uint32_t handle, pn_sequence_t id,
+                                      const pn_bytes_t *tag, uint32_t message_format,
+                                      bool settled, bool more, uint64_t code);
+
+// "DL[?IIII?I?I?In?o]"
+PN_EXTERN ssize_t pni_encode_flow(char *dst, size_t size, bool remote_channel, pn_sequence_t next_incoming_id,
+                                  uint32_t incoming_window, pn_sequence_t next_outgoing_id,
+                                  uint32_t outgoing_window, bool link, uint32_t handle,
+                                  pn_sequence_t delivery_count, pn_sequence_t link_credit, bool drain);
+
+// "DL[oIIo?DL[]]"
+PN_EXTERN ssize_t pni_encode_disposition(char *dst, size_t size, bool role, pn_sequence_t first,
+                                         pn_sequence_t last, bool settled, uint64_t code);
+
+// Typed forms of the hot performatives for the dispatcher's fast path.
+// Fields that are absent on the wire are zero with their _init flag false.
+
+typedef struct {
+  uint32_t handle;
+  bool id_init;
+  pn_sequence_t id;
+  pn_bytes_t tag;
+  uint32_t format;
+  bool settled;
+  bool more;
+  bool type_init;
+  uint64_t type;
+} pni_transfer_t;
+
+typedef struct {
+  bool inext_init;
+  pn_sequence_t inext;
+  uint32_t iwin;
+  pn_sequence_t onext;
+  uint32_t owin;
+  bool handle_init;
+  uint32_t handle;
+  bool dcount_init;
+  pn_sequence_t delivery_count;
+  uint32_t link_credit;
+  bool drain;
+} pni_flow_t;
+
+typedef struct {
+  bool role;
+  pn_sequence_t first;
+  bool last_init;
+  pn_sequence_t last;
+  bool settled;
+  bool type_init;
+  uint64_t type;
+} pni_disposition_t;
+
+// Peek at the numeric descriptor of an encoded performative.
+PN_EXTERN bool pni_decode_descriptor(const char *bytes, size_t size, uint64_t *code);
+
+// Each returns the size of the encoded performative, or 0 if it uses
+// anything the fast path doesn't cover (e.g. a delivery state with a
+// value, properties, unexpected encodings), in which case the frame
+// must be decoded the generic way.
+PN_EXTERN size_t pni_decode_transfer(const char *bytes, size_t size, pni_transfer_t *transfer);
+PN_EXTERN size_t pni_decode_flow(const char *bytes, size_t size, pni_flow_t *flow);
+PN_EXTERN size_t pni_decode_disposition(const char *bytes, size_t size, pni_disposition_t *disposition);
+
+#endif /* performatives.h */
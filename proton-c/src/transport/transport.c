@@ -25,12 +25,17 @@
 #include "ssl/ssl-internal.h"
 
 #include "autodetect.h"
+#include "compress.h"
+#include "performatives.h"
 #include "protocol.h"
 #include "dispatch_actions.h"
 #include "proton/event.h"
 #include "platform.h"
 #include "platform_fmt.h"
+#include "probes.h"
 #include "../log_private.h"
+#include "codec/data.h"
+#include "alloc_private.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -42,20 +47,83 @@ static ssize_t transport_consume(pn_transport_t *transport);
 
 // delivery buffers
 
+// the widest span of ids the ring will grow to cover
+#define PNI_DELIVERY_RING_MAX (64*1024)
+
 void pn_delivery_map_init(pn_delivery_map_t *db, pn_sequence_t next)
 {
-  db->deliveries = pn_hash(PN_WEAKREF, 0, 0.75);
   db->next = next;
+  db->lwm = next;
+  db->ring = NULL;
+  db->capacity = 0;
+  db->count = 0;
+  db->overflow = NULL;
 }
 
 void pn_delivery_map_free(pn_delivery_map_t *db)
 {
-  pn_free(db->deliveries);
+  pni_free(PN_ALLOC_TRANSPORT, db->ring);
+  pn_free(db->overflow);
+}
+
+static inline bool pni_delivery_map_covers(pn_delivery_map_t *db, pn_sequence_t id)
+{
+  return (pn_sequence_t) (id - db->lwm) < (pn_sequence_t) (db->next - db->lwm);
+}
+
+static inline pn_delivery_t **pni_delivery_map_slot(pn_delivery_map_t *db, pn_sequence_t id)
+{
+  return &db->ring[id & (db->capacity - 1)];
 }
 
 pn_delivery_t *pn_delivery_map_get(pn_delivery_map_t *db, pn_sequence_t id)
 {
-  return (pn_delivery_t *) pn_hash_get(db->deliveries, id);
+  if (db->count && pni_delivery_map_covers(db, id)) {
+    return *pni_delivery_map_slot(db, id);
+  } else if (db->overflow) {
+    return (pn_delivery_t *) pn_hash_get(db->overflow, id);
+  } else {
+    return NULL;
+  }
+}
+
+// moves lwm past the ids that are no longer in the ring
+static void pni_delivery_map_trim(pn_delivery_map_t *db)
+{
+  while (db->lwm != db->next && !*pni_delivery_map_slot(db, db->lwm)) {
+    db->lwm++;
+  }
+}
+
+// makes room in the ring for the id after next
+static int pni_delivery_map_reserve(pn_delivery_map_t *db)
+{
+  size_t span = (pn_sequence_t) (db->next - db->lwm) + 1;
+  if (span <= db->capacity) return 0;
+
+  if (db->capacity < PNI_DELIVERY_RING_MAX) {
+    size_t capacity = db->capacity ? 2*db->capacity : 16;
+    pn_delivery_t **ring =
+      (pn_delivery_t **) pni_calloc(PN_ALLOC_TRANSPORT, capacity, sizeof(pn_delivery_t *));
+    if (!ring) return PN_ERR;
+    for (pn_sequence_t id = db->lwm; id != db->next; id++) {
+      ring[id & (capacity - 1)] = *pni_delivery_map_slot(db, id);
+    }
+    pni_free(PN_ALLOC_TRANSPORT, db->ring);
+    db->ring = ring;
+    db->capacity = capacity;
+    return 0;
+  }
+
+  // the ring is as wide as it gets, so the oldest delivery moves out
+  if (!db->overflow) db->overflow = pn_hash(PN_WEAKREF, 0, 0.75);
+  pn_delivery_t **slot = pni_delivery_map_slot(db, db->lwm);
+  pn_hash_put(db->overflow, db->lwm, *slot);
+  *slot = NULL;
+  db->count--;
+  db->lwm++;
+  pni_delivery_map_trim(db);
+  return 0;
 }
 
 static void pn_delivery_state_init(pn_delivery_state_t *ds, pn_delivery_t *delivery, pn_sequence_t id)
@@ -68,8 +136,17 @@ static void pn_delivery_state_init(pn_delivery_state_t *ds, pn_delivery_t *deliv
 pn_delivery_state_t *pn_delivery_map_push(pn_delivery_map_t *db, pn_delivery_t *delivery)
 {
   pn_delivery_state_t *ds = &delivery->state;
+  // an empty ring starts wherever next has been set to
+  if (!db->count) db->lwm = db->next;
+  if (pni_delivery_map_reserve(db)) {
+    if (!db->overflow) db->overflow = pn_hash(PN_WEAKREF, 0, 0.75);
+    pn_delivery_state_init(ds, delivery, db->next++);
+    pn_hash_put(db->overflow, ds->id, delivery);
+    return ds;
+  }
   pn_delivery_state_init(ds, delivery, db->next++);
-  pn_hash_put(db->deliveries, ds->id, delivery);
+  *pni_delivery_map_slot(db, ds->id) = delivery;
+  db->count++;
   return ds;
 }
 
@@ -78,21 +155,144 @@ void pn_delivery_map_del(pn_delivery_map_t *db, pn_delivery_t *delivery)
   if (delivery->state.init) {
     delivery->state.init = false;
     delivery->state.sent = false;
-    pn_hash_del(db->deliveries, delivery->state.id);
+    pn_sequence_t id = delivery->state.id;
+    if (db->count && pni_delivery_map_covers(db, id) && *pni_delivery_map_slot(db, id) == delivery) {
+      *pni_delivery_map_slot(db, id) = NULL;
+      db->count--;
+      pni_delivery_map_trim(db);
+    } else if (db->overflow) {
+      pn_hash_del(db->overflow, id);
+    }
   }
 }
 
 void pn_delivery_map_clear(pn_delivery_map_t *dm)
 {
-  pn_hash_t *hash = dm->deliveries;
-  for (pn_handle_t entry = pn_hash_head(hash);
-       entry;
-       entry = pn_hash_next(hash, entry))
-  {
-    pn_delivery_t *dlv = (pn_delivery_t *) pn_hash_value(hash, entry);
-    pn_delivery_map_del(dm, dlv);
+  while (dm->count) {
+    pn_delivery_map_del(dm, *pni_delivery_map_slot(dm, dm->lwm));
+  }
+  pn_hash_t *hash = dm->overflow;
+  if (hash) {
+    for (pn_handle_t entry = pn_hash_head(hash);
+         entry;
+         entry = pn_hash_next(hash, entry))
+    {
+      pn_delivery_t *dlv = (pn_delivery_t *) pn_hash_value(hash, entry);
+      dlv->state.init = false;
+      dlv->state.sent = false;
+    }
+    pn_free(hash);
+    dm->overflow = NULL;
   }
   dm->next = 0;
+  dm->lwm = 0;
+}
+
+// channels and handles
+
+// the most numbers an alias map holds in its array
+#define PNI_ALIAS_DENSE_MAX (64*1024)
+
+void pn_alias_map_init(pn_alias_map_t *map, bool allocates)
+{
+  map->slots = NULL;
+  map->free = NULL;
+  map->capacity = 0;
+  map->size = 0;
+  map->count = 0;
+  map->free_count = 0;
+  map->overflow = NULL;
+  map->allocates = allocates;
+}
+
+void pn_alias_map_free(pn_alias_map_t *map)
+{
+  pni_free(PN_ALLOC_TRANSPORT, map->slots);
+  pni_free(PN_ALLOC_TRANSPORT, map->free);
+  pn_free(map->overflow);
+}
+
+void *pn_alias_map_get(pn_alias_map_t *map, uint32_t alias)
+{
+  if (alias < map->capacity) {
+    return map->slots[alias];
+  } else if (map->overflow) {
+    return pn_hash_get(map->overflow, alias);
+  } else {
+    return NULL;
+  }
+}
+
+// grows the array to hold alias, false if it is beyond the limit
+static bool pni_alias_map_reserve(pn_alias_map_t *map, uint32_t alias)
+{
+  if (alias < map->capacity) return true;
+  if (alias >= PNI_ALIAS_DENSE_MAX) return false;
+
+  size_t capacity = map->capacity ? map->capacity : 8;
+  while (capacity <= alias) capacity *= 2;
+  void **slots = (void **) pni_realloc(PN_ALLOC_TRANSPORT, map->slots, capacity*sizeof(void *));
+  if (!slots) return false;
+  memset(slots + map->capacity, 0, (capacity - map->capacity)*sizeof(void *));
+  map->slots = slots;
+  if (map->allocates) {
+    uint32_t *free = (uint32_t *) pni_realloc(PN_ALLOC_TRANSPORT, map->free, capacity*sizeof(uint32_t));
+    if (!free) return false;
+    map->free = free;
+  }
+  map->capacity = capacity;
+  return true;
+}
+
+static void pn_alias_map_put(pn_alias_map_t *map, uint32_t alias, void *value)
+{
+  assert(value);
+  if (pni_alias_map_reserve(map, alias)) {
+    if (!map->slots[alias]) map->count++;
+    map->slots[alias] = value;
+    if (alias >= map->size) {
+      // numbers passed over are free to allocate
+      while (map->allocates && map->size < alias) {
+        map->free[map->free_count++] = map->size++;
+      }
+      map->size = alias + 1;
+    }
+  } else {
+    if (!map->overflow) map->overflow = pn_hash(PN_WEAKREF, 0, 0.75);
+    pn_hash_put(map->overflow, alias, value);
+  }
+}
+
+void pn_alias_map_del(pn_alias_map_t *map, uint32_t alias)
+{
+  if (alias < map->capacity) {
+    if (!map->slots[alias]) return;
+    map->slots[alias] = NULL;
+    if (!--map->count) {
+      map->size = 0;
+      map->free_count = 0;
+    } else if (map->allocates) {
+      map->free[map->free_count++] = alias;
+    }
+  } else if (map->overflow) {
+    pn_hash_del(map->overflow, alias);
+  }
+}
+
+// a number that is not in use
+static uint32_t pn_alias_map_allocate(pn_alias_map_t *map)
+{
+  assert(map->allocates);
+  while (map->free_count) {
+    uint32_t alias = map->free[--map->free_count];
+    if (!map->slots[alias]) return alias;
+  }
+  if (map->size < PNI_ALIAS_DENSE_MAX) {
+    return map->size;
+  }
+  uint32_t alias = PNI_ALIAS_DENSE_MAX;
+  while (pn_alias_map_get(map, alias)) alias++;
+  return alias;
 }
 
 static void pni_default_tracer(pn_transport_t *transport, const char *message)
@@ -114,6 +314,8 @@ static ssize_t pn_input_read_amqp(pn_transport_t *transport, unsigned int layer,
 static ssize_t pn_output_write_amqp_header(pn_transport_t *transport, unsigned int layer, char *bytes, size_t available);
 static ssize_t pn_output_write_amqp(pn_transport_t *transport, unsigned int layer, char *bytes, size_t available);
 static pn_timestamp_t pn_tick_amqp(pn_transport_t *transport, unsigned int layer, pn_timestamp_t now);
+static void pni_transport_capture(pn_transport_t *transport, pni_capture_dir_t dir,
+                                  const char *bytes, size_t size);
 
 static ssize_t pn_io_layer_input_autodetect(pn_transport_t *transport, unsigned int layer, const char *bytes, size_t available);
 static ssize_t pn_io_layer_output_null(pn_transport_t *transport, unsigned int layer, char *bytes, size_t available);
@@ -198,6 +400,9 @@ static void pn_io_layer_setup(pn_transport_t *transport, unsigned int layer)
   if (transport->sasl) {
     transport->io_layers[layer++] = &sasl_header_layer;
   }
+  if (transport->compress) {
+    transport->io_layers[layer++] = &pni_compress_layer;
+  }
   transport->io_layers[layer++] = &amqp_header_layer;
 }
 
@@ -266,9 +471,13 @@ ssize_t pn_io_layer_input_autodetect(pn_transport_t *transport, unsigned int lay
         return 8;
       }
     }
+    if (transport->compress) {
+      transport->io_layers[layer++] = &pni_compress_layer;
+    }
     transport->io_layers[layer] = &amqp_write_header_layer;
     if (transport->trace & PN_TRACE_FRM)
         pn_transport_logf(transport, "  <- %s", "AMQP");
+    if (transport->capture) pni_transport_capture(transport, PNI_CAPTURE_IN, bytes, 8);
     return 8;
   case PNI_PROTOCOL_INSUFFICIENT:
     if (!eos) return 0;
@@ -313,6 +522,20 @@ ssize_t pn_io_layer_output_passthru(pn_transport_t *transport, unsigned int laye
     return PN_EOS;
 }
 
+// A layer with nothing left to do (e.g. sasl after the exchange)
+// splices itself out so the layers either side of it talk to each
+// other directly.  The layers address each other by index, so this is
+// only safe from within the layer being removed, which must then hand
+// its bytes on to what is now io_layers[layer].
+void pni_io_layer_remove(pn_transport_t *transport, unsigned int layer)
+{
+  assert(layer + 1 < PN_IO_LAYER_CT && transport->io_layers[layer+1]);
+  for (unsigned int i = layer; i + 1 < PN_IO_LAYER_CT; i++) {
+    transport->io_layers[i] = transport->io_layers[i+1];
+  }
+  transport->io_layers[PN_IO_LAYER_CT-1] = NULL;
+}
+
 /** Input handler after detected error */
 ssize_t pn_io_layer_input_error(pn_transport_t *transport, unsigned int layer, const char *data, size_t available)
 {
@@ -325,24 +548,194 @@ ssize_t pn_io_layer_output_error(pn_transport_t *transport, unsigned int layer,
     return PN_EOS;
 }
 
+// a free list of raw io buffers so connections that come and go reuse
+// the same few blocks rather than each allocating their own
+typedef struct pni_frame_block_t {
+  struct pni_frame_block_t *next;
+} pni_frame_block_t;
+
+struct pni_frame_pool_t {
+  pni_frame_block_t *blocks;
+  size_t count;
+  size_t limit;
+};
+
+static void pni_frame_pool_initialize(void *object)
+{
+  pni_frame_pool_t *pool = (pni_frame_pool_t *) object;
+  pool->blocks = NULL;
+  pool->count = 0;
+  pool->limit = 0;
+}
+
+static void pni_frame_pool_finalize(void *object)
+{
+  pni_frame_pool_t *pool = (pni_frame_pool_t *) object;
+  while (pool->blocks) {
+    pni_frame_block_t *block = pool->blocks;
+    pool->blocks = block->next;
+    pni_free(PN_ALLOC_TRANSPORT, block);
+  }
+}
+
+#define CID_pni_frame_pool CID_pn_object
+#define pni_frame_pool_hashcode NULL
+#define pni_frame_pool_compare NULL
+#define pni_frame_pool_inspect NULL
+
+pni_frame_pool_t *pni_frame_pool(size_t limit)
+{
+  static const pn_class_t clazz = PN_CLASS(pni_frame_pool);
+  pni_frame_pool_t *pool = (pni_frame_pool_t *) pn_class_new(&clazz, sizeof(pni_frame_pool_t));
+  pool->limit = limit;
+  return pool;
+}
+
+char *pni_io_alloc(pn_transport_t *transport, size_t size)
+{
+  pni_frame_pool_t *pool = transport->frame_pool;
+  if (pool && size == PNI_IO_BUFFER_SIZE && pool->blocks) {
+    pni_frame_block_t *block = pool->blocks;
+    pool->blocks = block->next;
+    pool->count--;
+    return (char *) block;
+  }
+  return (char *) pni_malloc(PN_ALLOC_TRANSPORT, size);
+}
+
+void pni_io_release(pn_transport_t *transport, char *bytes, size_t size)
+{
+  pni_frame_pool_t *pool = transport->frame_pool;
+  if (pool && bytes && size == PNI_IO_BUFFER_SIZE && pool->count < pool->limit) {
+    pni_frame_block_t *block = (pni_frame_block_t *) bytes;
+    block->next = pool->blocks;
+    pool->blocks = block;
+    pool->count++;
+  } else {
+    pni_free(PN_ALLOC_TRANSPORT, bytes);
+  }
+}
+
+void pni_transport_set_waker(pn_transport_t *transport, pni_transport_wake_t wake, void *context)
+{
+  transport->wake = wake;
+  transport->wake_context = context;
+}
+
+void pni_transport_set_socket(pn_transport_t *transport, pn_socket_t socket)
+{
+  transport->socket = socket;
+}
+
+int pni_transport_kernel_tls(pn_transport_t *transport)
+{
+  return transport->kernel_tls;
+}
+
+// swap the raw buffers of a transport that has not done any io yet for
+// ones from the pool, and hand them back there when it is freed
+void pni_transport_set_frame_pool(pn_transport_t *transport, pni_frame_pool_t *pool)
+{
+  assert(!transport->input_pending && !transport->output_pending);
+  pni_io_release(transport, transport->input_buf, transport->input_size);
+  pni_io_release(transport, transport->output_buf, transport->output_size);
+  pn_decref(transport->frame_pool);
+  transport->frame_pool = pool;
+  pn_incref(pool);
+  transport->input_size = PNI_IO_BUFFER_SIZE;
+  transport->input_offset = 0;
+  transport->input_buf = pni_io_alloc(transport, transport->input_size);
+  transport->output_size = PNI_IO_BUFFER_SIZE;
+  transport->output_offset = 0;
+  transport->output_buf = pni_io_alloc(transport, transport->output_size);
+}
+
+// what an idle transport shrinks its staging buffers down to
+#define PNI_IDLE_STAGING (256)
+
+// scratch trees are swapped for fresh ones once they have grown
+static pn_data_t *pni_data_compact(pn_data_t *data)
+{
+  if (data->capacity > 16 || pn_buffer_capacity(data->buf) > 64) {
+    pn_data_free(data);
+    return pni_data_arena(16);
+  }
+  return data;
+}
+
+// hand back everything an idle transport can do without, the raw io
+// buffers are reacquired by pni_transport_wake when io resumes and the
+// rest grows again on demand
+static void pni_transport_compact(pn_transport_t *transport)
+{
+  pni_io_release(transport, transport->input_buf, transport->input_size);
+  transport->input_buf = NULL;
+  transport->input_size = 0;
+  transport->input_offset = 0;
+  pni_io_release(transport, transport->output_buf, transport->output_size);
+  transport->output_buf = NULL;
+  transport->output_size = 0;
+  transport->output_offset = 0;
+  if (transport->capacity > PNI_IDLE_STAGING) {
+    char *output = (char *) pni_realloc(PN_ALLOC_TRANSPORT, transport->output, PNI_IDLE_STAGING);
+    if (output) {
+      transport->output = output;
+      transport->capacity = PNI_IDLE_STAGING;
+      transport->offset = 0;
+    }
+  }
+  pn_buffer_shrink(transport->frame, PNI_IDLE_STAGING);
+  transport->args = pni_data_compact(transport->args);
+  transport->output_args = pni_data_compact(transport->output_args);
+  transport->compacted = true;
+}
+
+static void pni_transport_wake(pn_transport_t *transport)
+{
+  if (transport->compacted) {
+    transport->input_size = PNI_IO_BUFFER_SIZE;
+    transport->input_buf = pni_io_alloc(transport, transport->input_size);
+    transport->output_size = PNI_IO_BUFFER_SIZE;
+    transport->output_buf = pni_io_alloc(transport, transport->output_size);
+    transport->compacted = false;
+  }
+}
+
 static void pn_transport_initialize(void *object)
 {
+  PNI_PROBES_REGISTER();
   pn_transport_t *transport = (pn_transport_t *)object;
   transport->freed = false;
+  transport->frame_pool = NULL;
+  transport->wake = NULL;
+  transport->wake_context = NULL;
+  transport->socket = PN_INVALID_SOCKET;
+  transport->kernel_tls = 0;
   transport->output_buf = NULL;
-  transport->output_size = PN_DEFAULT_MAX_FRAME_SIZE ? PN_DEFAULT_MAX_FRAME_SIZE : 16 * 1024;
+  transport->output_size = PNI_IO_BUFFER_SIZE;
   transport->input_buf = NULL;
-  transport->input_size =  PN_DEFAULT_MAX_FRAME_SIZE ? PN_DEFAULT_MAX_FRAME_SIZE : 16 * 1024;
+  transport->input_size = PNI_IO_BUFFER_SIZE;
   transport->tracer = pni_default_tracer;
+  transport->log_ring = NULL;
+  transport->frame_tracer = NULL;
+  transport->trace_args = NULL;
+  transport->trace_sample = 0;
+  transport->trace_performatives = 0;
+  transport->trace_handle = -1;
+  transport->trace_channel = -1;
+  transport->trace_errors = false;
+  transport->capture = NULL;
   transport->sasl = NULL;
   transport->ssl = NULL;
+  transport->compress = NULL;
 
   transport->scratch = pn_string(NULL);
-  transport->args = pn_data(16);
-  transport->output_args = pn_data(16);
+  transport->args = pni_data_arena(16);
+  transport->output_args = pni_data_arena(16);
   transport->frame = pn_buffer(4*1024);
   transport->input_frames_ct = 0;
   transport->output_frames_ct = 0;
+  memset(&transport->metrics, 0, sizeof(transport->metrics));
 
   transport->connection = NULL;
   transport->context = pn_record();
@@ -372,22 +765,31 @@ static void pn_transport_initialize(void *object)
   transport->remote_idle_timeout = 0;
   transport->keepalive_deadline = 0;
   transport->last_bytes_output = 0;
+  transport->compact_timeout = 0;
+  transport->compact_deadline = 0;
+  transport->compact_bytes = 0;
+  transport->compacted = false;
   transport->remote_offered_capabilities = pn_data(0);
   transport->remote_desired_capabilities = pn_data(0);
   transport->remote_properties = pn_data(0);
-  transport->disp_data = pn_data(0);
+  transport->disp_data = pni_data_arena(16);
   pn_condition_init(&transport->remote_condition);
   pn_condition_init(&transport->condition);
   transport->error = pn_error();
 
-  transport->local_channels = pn_hash(PN_WEAKREF, 0, 0.75);
-  transport->remote_channels = pn_hash(PN_WEAKREF, 0, 0.75);
+  pn_alias_map_init(&transport->local_channels, true);
+  pn_alias_map_init(&transport->remote_channels, false);
 
   transport->bytes_input = 0;
   transport->bytes_output = 0;
 
+  transport->input_offset = 0;
   transport->input_pending = 0;
+  transport->output_offset = 0;
   transport->output_pending = 0;
+  transport->output_pins = 0;
+  transport->output_retired = NULL;
+  transport->output_retired_count = 0;
 
   transport->done_processing = false;
 
@@ -395,6 +797,7 @@ static void pn_transport_initialize(void *object)
 
   transport->server = false;
   transport->halt = false;
+  transport->input_held = false;
 
   transport->referenced = true;
 
@@ -406,32 +809,32 @@ static void pn_transport_initialize(void *object)
 
 pn_session_t *pn_channel_state(pn_transport_t *transport, uint16_t channel)
 {
-  return (pn_session_t *) pn_hash_get(transport->remote_channels, channel);
+  return (pn_session_t *) pn_alias_map_get(&transport->remote_channels, channel);
 }
 
 static void pni_map_remote_channel(pn_session_t *session, uint16_t channel)
 {
   pn_transport_t *transport = session->connection->transport;
-  pn_hash_put(transport->remote_channels, channel, session);
+  pn_alias_map_put(&transport->remote_channels, channel, session);
   session->state.remote_channel = channel;
   pn_ep_incref(&session->endpoint);
 }
 
-void pni_transport_unbind_handles(pn_hash_t *handles, bool reset_state);
+void pni_transport_unbind_handles(pn_alias_map_t *handles, bool reset_state);
 
 static void pni_unmap_remote_channel(pn_session_t *ssn)
 {
   // XXX: should really update link state also
   pn_delivery_map_clear(&ssn->state.incoming);
-  pni_transport_unbind_handles(ssn->state.remote_handles, false);
+  pni_transport_unbind_handles(&ssn->state.remote_handles, false);
   pn_transport_t *transport = ssn->connection->transport;
   uint16_t channel = ssn->state.remote_channel;
   ssn->state.remote_channel = -2;
-  if (pn_hash_get(transport->remote_channels, channel)) {
+  if (pn_alias_map_get(&transport->remote_channels, channel)) {
+    pn_alias_map_del(&transport->remote_channels, channel);
+    // note: may free the session:
     pn_ep_decref(&ssn->endpoint);
   }
-  // note: may free the session:
-  pn_hash_del(transport->remote_channels, channel);
 }
 
 static void pn_transport_incref(void *object)
@@ -467,21 +870,22 @@ pn_transport_t *pn_transport(void)
     (pn_transport_t *) pn_class_new(&clazz, sizeof(pn_transport_t));
   if (!transport) return NULL;
 
-  transport->output_buf = (char *) malloc(transport->output_size);
+  transport->output_buf = pni_io_alloc(transport, transport->output_size);
   if (!transport->output_buf) {
     pn_transport_free(transport);
     return NULL;
   }
 
-  transport->input_buf = (char *) malloc(transport->input_size);
+  transport->input_buf = pni_io_alloc(transport, transport->input_size);
   if (!transport->input_buf) {
     pn_transport_free(transport);
     return NULL;
   }
 
   transport->capacity = 4*1024;
+  transport->offset = 0;
   transport->available = 0;
-  transport->output = (char *) malloc(transport->capacity);
+  transport->output = (char *) pni_malloc(PN_ALLOC_TRANSPORT, transport->capacity);
   if (!transport->output) {
     pn_transport_free(transport);
     return NULL;
@@ -523,8 +927,9 @@ static void pn_transport_finalize(void *object)
   pn_free(transport->context);
   pn_ssl_free(transport);
   pn_sasl_free(transport);
-  free(transport->remote_container);
-  free(transport->remote_hostname);
+  pni_compress_free(transport->compress);
+  pni_free(PN_ALLOC_TRANSPORT, transport->remote_container);
+  pni_free(PN_ALLOC_TRANSPORT, transport->remote_hostname);
   pn_free(transport->remote_offered_capabilities);
   pn_free(transport->remote_desired_capabilities);
   pn_free(transport->remote_properties);
@@ -532,15 +937,23 @@ static void pn_transport_finalize(void *object)
   pn_condition_tini(&transport->remote_condition);
   pn_condition_tini(&transport->condition);
   pn_error_free(transport->error);
-  pn_free(transport->local_channels);
-  pn_free(transport->remote_channels);
-  if (transport->input_buf) free(transport->input_buf);
-  if (transport->output_buf) free(transport->output_buf);
+  pn_alias_map_free(&transport->local_channels);
+  pn_alias_map_free(&transport->remote_channels);
+  pni_io_release(transport, transport->input_buf, transport->input_size);
+  pni_io_release(transport, transport->output_buf, transport->output_size);
+  for (size_t i = 0; i < transport->output_retired_count; i++) {
+    pni_io_release(transport, transport->output_retired[i].buf, transport->output_retired[i].size);
+  }
+  pni_free(PN_ALLOC_TRANSPORT, transport->output_retired);
+  pn_decref(transport->frame_pool);
   pn_free(transport->scratch);
+  pni_log_ring_free(transport->log_ring);
   pn_data_free(transport->args);
   pn_data_free(transport->output_args);
+  pn_data_free(transport->trace_args);
   pn_buffer_free(transport->frame);
-  free(transport->output);
+  pni_free(PN_ALLOC_TRANSPORT, transport->output);
+  pni_capture_free(transport->capture);
 }
 
 static void pni_post_remote_open_events(pn_transport_t *transport, pn_connection_t *connection) {
@@ -575,31 +988,49 @@ int pn_transport_bind(pn_transport_t *transport, pn_connection_t *connection)
   return 0;
 }
 
-void pni_transport_unbind_handles(pn_hash_t *handles, bool reset_state)
+void pni_transport_unbind_handles(pn_alias_map_t *handles, bool reset_state)
 {
-  for (pn_handle_t h = pn_hash_head(handles); h; h = pn_hash_next(handles, h)) {
-    uintptr_t key = pn_hash_key(handles, h);
-    pn_link_t *link = (pn_link_t *) pn_hash_value(handles, h);
+  for (size_t i = 0; i < handles->size; i++) {
+    pn_link_t *link = (pn_link_t *) handles->slots[i];
+    if (!link) continue;
+    pn_alias_map_del(handles, i);
     if (reset_state) {
       pn_link_unbound(link);
     }
     pn_ep_decref(&link->endpoint);
-    pn_hash_del(handles, key);
+  }
+  pn_hash_t *overflow = handles->overflow;
+  if (overflow) {
+    for (pn_handle_t h = pn_hash_head(overflow); h; h = pn_hash_next(overflow, h)) {
+      uintptr_t key = pn_hash_key(overflow, h);
+      pn_link_t *link = (pn_link_t *) pn_hash_value(overflow, h);
+      if (reset_state) {
+        pn_link_unbound(link);
+      }
+      pn_ep_decref(&link->endpoint);
+      pn_hash_del(overflow, key);
+    }
   }
 }
 
-void pni_transport_unbind_channels(pn_hash_t *channels)
+static void pni_transport_unbind_session(pn_session_t *ssn)
 {
-  for (pn_handle_t h = pn_hash_head(channels); h; h = pn_hash_next(channels, h)) {
-    uintptr_t key = pn_hash_key(channels, h);
-    pn_session_t *ssn = (pn_session_t *) pn_hash_value(channels, h);
-    pn_delivery_map_clear(&ssn->state.incoming);
-    pn_delivery_map_clear(&ssn->state.outgoing);
-    pni_transport_unbind_handles(ssn->state.local_handles, true);
-    pni_transport_unbind_handles(ssn->state.remote_handles, true);
-    pn_session_unbound(ssn);
-    pn_ep_decref(&ssn->endpoint);
-    pn_hash_del(channels, key);
+  pn_delivery_map_clear(&ssn->state.incoming);
+  pn_delivery_map_clear(&ssn->state.outgoing);
+  pni_transport_unbind_handles(&ssn->state.local_handles, true);
+  pni_transport_unbind_handles(&ssn->state.remote_handles, true);
+  pn_session_unbound(ssn);
+  pn_ep_decref(&ssn->endpoint);
+}
+
+void pni_transport_unbind_channels(pn_alias_map_t *channels)
+{
+  // channels are at most 16 bits, so are never in the overflow
+  for (size_t i = 0; i < channels->size; i++) {
+    pn_session_t *ssn = (pn_session_t *) channels->slots[i];
+    if (!ssn) continue;
+    pn_alias_map_del(channels, i);
+    pni_transport_unbind_session(ssn);
   }
 }
 
@@ -630,8 +1061,8 @@ int pn_transport_unbind(pn_transport_t *transport)
     endpoint = endpoint->endpoint_next;
   }
 
-  pni_transport_unbind_channels(transport->local_channels);
-  pni_transport_unbind_channels(transport->remote_channels);
+  pni_transport_unbind_channels(&transport->local_channels);
+  pni_transport_unbind_channels(&transport->remote_channels);
 
   pn_connection_unbound(conn);
   if (was_referenced) {
@@ -662,24 +1093,24 @@ pn_condition_t *pn_transport_condition(pn_transport_t *transport)
 static void pni_map_remote_handle(pn_link_t *link, uint32_t handle)
 {
   link->state.remote_handle = handle;
-  pn_hash_put(link->session->state.remote_handles, handle, link);
+  pn_alias_map_put(&link->session->state.remote_handles, handle, link);
   pn_ep_incref(&link->endpoint);
 }
 
 static void pni_unmap_remote_handle(pn_link_t *link)
 {
-  uintptr_t handle = link->state.remote_handle;
+  uint32_t handle = link->state.remote_handle;
   link->state.remote_handle = -2;
-  if (pn_hash_get(link->session->state.remote_handles, handle)) {
+  if (pn_alias_map_get(&link->session->state.remote_handles, handle)) {
+    pn_alias_map_del(&link->session->state.remote_handles, handle);
+    // may delete link:
     pn_ep_decref(&link->endpoint);
   }
-  // may delete link:
-  pn_hash_del(link->session->state.remote_handles, handle);
 }
 
 pn_link_t *pn_handle_state(pn_session_t *ssn, uint32_t handle)
 {
-  return (pn_link_t *) pn_hash_get(ssn->state.remote_handles, handle);
+  return (pn_link_t *) pn_alias_map_get(&ssn->state.remote_handles, handle);
 }
 
 bool pni_disposition_batchable(pn_disposition_t *disposition)
@@ -712,7 +1143,7 @@ void pni_disposition_encode(pn_disposition_t *disposition, pn_data_t *data)
     pn_data_fill(data, "[?DL[sSC]]", pn_condition_is_set(cond), ERROR,
                  pn_condition_get_name(cond),
                  pn_condition_get_description(cond),
-                 pn_condition_info(cond));
+                 cond->info);
     break;
   case PN_MODIFIED:
     pn_data_fill(data, "[ooC]",
@@ -721,16 +1152,104 @@ void pni_disposition_encode(pn_disposition_t *disposition, pn_data_t *data)
                  disposition->annotations);
     break;
   default:
-    pn_data_copy(data, disposition->data);
+    if (disposition->data) pn_data_copy(data, disposition->data);
     break;
   }
 }
 
 
+// count is the frame's place in its direction, from 0
+static bool pni_trace_sampled(pn_transport_t *transport, uint16_t ch, uint64_t count)
+{
+  if (transport->trace_channel >= 0 && ch != transport->trace_channel) return false;
+  return transport->trace_sample <= 1 || count % transport->trace_sample == 0;
+}
+
+static bool pni_trace_needs_args(pn_transport_t *transport)
+{
+  return transport->trace_performatives || transport->trace_handle >= 0 ||
+    transport->trace_errors;
+}
+
+// the filters that look into the performative
+static bool pni_trace_matches(pn_transport_t *transport, pn_data_t *args)
+{
+  uint64_t code = 0;
+  int64_t handle = -1;
+  bool error = false;
+
+  pn_handle_t point = pn_data_point(args);
+  pn_data_rewind(args);
+  if (pn_data_next(args) && pn_data_type(args) == PN_DESCRIBED) {
+    pn_data_enter(args);
+    if (pn_data_next(args) && pn_data_type(args) == PN_ULONG) {
+      code = pn_data_get_ulong(args);
+    }
+    int handle_field = (code == TRANSFER || code == DETACH) ? 0 :
+      code == ATTACH ? 1 : code == FLOW ? 4 : -1;
+    int error_field = (code == END || code == CLOSE) ? 0 : code == DETACH ? 2 : -1;
+    if (pn_data_next(args) && pn_data_type(args) == PN_LIST) {
+      pn_data_enter(args);
+      for (int i = 0; pn_data_next(args); i++) {
+        if (i == handle_field && pn_data_type(args) == PN_UINT) {
+          handle = pn_data_get_uint(args);
+        } else if (i == error_field && pn_data_type(args) == PN_DESCRIBED) {
+          error = true;
+        }
+      }
+    }
+  }
+  pn_data_restore(args, point);
+
+  if (transport->trace_performatives) {
+    if (code < OPEN || code > CLOSE) return false;
+    if (!(transport->trace_performatives & (1 << (code - OPEN)))) return false;
+  }
+  if (transport->trace_handle >= 0 && handle != transport->trace_handle) return false;
+  if (transport->trace_errors && !error) return false;
+  return true;
+}
+
+void pn_do_raw_trace(pn_transport_t *transport, uint16_t ch, pn_dir_t dir,
+                     const char *performative, size_t size, const char *frame, size_t n)
+{
+  // by now the frame has been counted in either direction
+  uint64_t count = dir == OUT ? transport->output_frames_ct : transport->input_frames_ct;
+  if (!pni_trace_sampled(transport, ch, count - 1)) return;
+
+  if (pni_trace_needs_args(transport)) {
+    if (!transport->trace_args) transport->trace_args = pn_data(16);
+    pn_data_clear(transport->trace_args);
+    if (pn_data_decode(transport->trace_args, performative, size) < 0 ||
+        !pni_trace_matches(transport, transport->trace_args)) {
+      return;
+    }
+  }
+
+  if (transport->frame_tracer) {
+    transport->frame_tracer(transport, frame, n, dir == OUT);
+    return;
+  }
+
+  pn_string_set(transport->scratch, "RAW: \"");
+  pn_quote(transport->scratch, frame, n);
+  pn_string_addf(transport->scratch, "\"");
+  pn_transport_log(transport, pn_string_get(transport->scratch));
+}
+
 void pn_do_trace(pn_transport_t *transport, uint16_t ch, pn_dir_t dir,
                  pn_data_t *args, const char *payload, size_t size)
 {
   if (transport->trace & PN_TRACE_FRM) {
+    // outgoing frames are traced before they are encoded and counted
+    uint64_t count = dir == OUT ? transport->output_frames_ct : transport->input_frames_ct - 1;
+    if (!pni_trace_sampled(transport, ch, count)) return;
+    if (pni_trace_needs_args(transport) && !pni_trace_matches(transport, args)) return;
+    // formatted by the log thread if there is one
+    if (transport->tracer == pni_default_tracer &&
+        pni_log_frame(&transport->log_ring, transport, ch, dir == OUT, args, payload, size)) {
+      return;
+    }
     pn_string_format(transport->scratch, "%u %s ", ch, dir == OUT ? "->" : "<-");
     pn_inspect(args, transport->scratch);
 
@@ -749,17 +1268,89 @@ void pn_do_trace(pn_transport_t *transport, uint16_t ch, pn_dir_t dir,
   }
 }
 
-int pn_post_frame(pn_transport_t *transport, uint8_t type, uint16_t ch, const char *fmt, ...)
+// encoded frames are staged in transport->output until the amqp layer
+// hands them on, the space they leave behind at the front is only
+// reclaimed when the back fills up
+static char *pni_output_tail(pn_transport_t *transport)
+{
+  return transport->output + transport->offset + transport->available;
+}
+
+static size_t pni_output_space(pn_transport_t *transport)
+{
+  return transport->capacity - transport->offset - transport->available;
+}
+
+static void pni_output_grow(pn_transport_t *transport)
+{
+  if (transport->offset) {
+    memmove(transport->output, transport->output + transport->offset, transport->available);
+    transport->offset = 0;
+  } else {
+    transport->capacity *= 2;
+    transport->output =
+      (char *) pni_realloc(PN_ALLOC_TRANSPORT, transport->output, transport->capacity);
+  }
+}
+
+void pni_histogram_add(pn_histogram_t *histogram, uint64_t value)
+{
+  int bucket = 0;
+  for (uint64_t v = value >> 1; v && bucket < PN_HISTOGRAM_BUCKETS - 1; v >>= 1) bucket++;
+  histogram->buckets[bucket]++;
+  histogram->count++;
+  histogram->sum += value;
+  if (value > histogram->max) histogram->max = value;
+}
+
+// count a frame of n bytes about to be added to the output
+static void pni_output_frame(pn_transport_t *transport, uint16_t ch, size_t n)
+{
+  PNI_PROBE3(frame_out, transport, ch, n);
+  transport->output_frames_ct += 1;
+  pni_histogram_add(&transport->metrics.output_frame_sizes, n);
+  if (transport->available + n > transport->metrics.output_high_water) {
+    transport->metrics.output_high_water = transport->available + n;
+  }
+}
+
+static int pni_post_encoded(pn_transport_t *transport, uint8_t type, uint16_t ch,
+                            const char *performative, size_t size)
+{
+  pn_frame_t frame = {type};
+  frame.channel = ch;
+  frame.payload = performative;
+  frame.size = size;
+  size_t n;
+  while (!(n = pn_write_frame(pni_output_tail(transport), pni_output_space(transport), frame))) {
+    pni_output_grow(transport);
+  }
+  pni_output_frame(transport, ch, n);
+  if (transport->trace & PN_TRACE_RAW) {
+    pn_do_raw_trace(transport, ch, OUT, performative, size, pni_output_tail(transport), n);
+  }
+  transport->available += n;
+
+  return 0;
+}
+
+// The hot performatives are encoded straight into the frame buffer
+// rather than through output_args, unless frames are being traced, in
+// which case the generic path is used so the trace can show the args.
+static bool pni_encode_direct(pn_transport_t *transport)
+{
+  return !(transport->trace & PN_TRACE_FRM);
+}
+
+static int pni_vpost_frame(pn_transport_t *transport, uint8_t type, uint16_t ch,
+                           pni_format_t *format, va_list ap)
 {
   pn_buffer_t *frame_buf = transport->frame;
-  va_list ap;
-  va_start(ap, fmt);
   pn_data_clear(transport->output_args);
-  int err = pn_data_vfill(transport->output_args, fmt, ap);
-  va_end(ap);
+  int err = pni_data_vfill_format(transport->output_args, format, ap);
   if (err) {
     pn_transport_logf(transport,
-                      "error posting frame: %s, %s: %s", fmt, pn_code(err),
+                      "error posting frame: %s, %s: %s", format->fmt, pn_code(err),
                       pn_error_text(pn_data_error(transport->output_args)));
     return PN_ERR;
   }
@@ -782,26 +1373,26 @@ int pn_post_frame(pn_transport_t *transport, uint8_t type, uint16_t ch, const ch
     return PN_ERR;
   }
 
-  pn_frame_t frame = {type};
-  frame.channel = ch;
-  frame.payload = buf.start;
-  frame.size = wr;
-  size_t n;
-  while (!(n = pn_write_frame(transport->output + transport->available,
-                              transport->capacity - transport->available, frame))) {
-    transport->capacity *= 2;
-    transport->output = (char *) realloc(transport->output, transport->capacity);
-  }
-  transport->output_frames_ct += 1;
-  if (transport->trace & PN_TRACE_RAW) {
-    pn_string_set(transport->scratch, "RAW: \"");
-    pn_quote(transport->scratch, transport->output + transport->available, n);
-    pn_string_addf(transport->scratch, "\"");
-    pn_transport_log(transport, pn_string_get(transport->scratch));
-  }
-  transport->available += n;
+  return pni_post_encoded(transport, type, ch, buf.start, wr);
+}
 
-  return 0;
+int pn_post_frame(pn_transport_t *transport, uint8_t type, uint16_t ch, const char *fmt, ...)
+{
+  pni_format_t format = PNI_FORMAT(fmt);
+  va_list ap;
+  va_start(ap, fmt);
+  int err = pni_vpost_frame(transport, type, ch, &format, ap);
+  va_end(ap);
+  return err;
+}
+
+int pni_post_frame(pn_transport_t *transport, uint8_t type, uint16_t ch, pni_format_t *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  int err = pni_vpost_frame(transport, type, ch, format, ap);
+  va_end(ap);
+  return err;
 }
 
 int pn_post_amqp_transfer_frame(pn_transport_t *transport, uint16_t ch,
@@ -819,20 +1410,57 @@ int pn_post_amqp_transfer_frame(pn_transport_t *transport, uint16_t ch,
   bool more_flag = more;
   int framecount = 0;
   pn_buffer_t *frame = transport->frame;
+  bool direct = pni_encode_direct(transport) && (!code || !state || !pn_data_size(state));
+
+  // a transfer that fits in one frame is encoded straight into the
+  // output behind its frame header, with no staging in the frame buffer
+  if (direct) {
+    size_t bound = PNI_TRANSFER_MAX(tag->size);
+    if (!transport->remote_max_frame ||
+        AMQP_HEADER_SIZE + bound + payload->size <= transport->remote_max_frame) {
+      while (pni_output_space(transport) < AMQP_HEADER_SIZE + bound + payload->size) {
+        pni_output_grow(transport);
+      }
+      char *out = pni_output_tail(transport);
+      ssize_t wr = pni_encode_transfer(out + AMQP_HEADER_SIZE, bound, handle, id, tag,
+                                       message_format, settled, more, code);
+      assert(wr > 0);
+
+      // the performative is already in place, only the header and the
+      // payload get written around it
+      pn_frame_t frame = {AMQP_FRAME_TYPE};
+      frame.channel = ch;
+      frame.payload = out + AMQP_HEADER_SIZE;
+      frame.size = wr;
+      size_t n = pn_write_frame_body(out, pni_output_space(transport), frame,
+                                     payload->start, payload->size);
+      payload->start += payload->size;
+      payload->size = 0;
+      pni_output_frame(transport, ch, n);
+      if (transport->trace & PN_TRACE_RAW) {
+        pn_do_raw_trace(transport, ch, OUT, out + AMQP_HEADER_SIZE, wr, out, n);
+      }
+      transport->available += n;
+      return 1;
+    }
+  }
 
   // create preformatives, assuming 'more' flag need not change
 
  compute_performatives:
-  pn_data_clear(transport->output_args);
-  int err = pn_data_fill(transport->output_args, "DL[IIzIoon?DLC]", TRANSFER,
-                         handle, id, tag->size, tag->start,
-                         message_format,
-                         settled, more_flag, (bool)code, code, state);
-  if (err) {
-    pn_transport_logf(transport,
-                      "error posting transfer frame: %s: %s", pn_code(err),
-                      pn_error_text(pn_data_error(transport->output_args)));
-    return PN_ERR;
+  if (!direct) {
+    static pni_format_t format = PNI_FORMAT("DL[IIzIoon?DLC]");
+    pn_data_clear(transport->output_args);
+    int err = pni_data_fill_format(transport->output_args, &format, TRANSFER,
+                                   handle, id, tag->size, tag->start,
+                                   message_format,
+                                   settled, more_flag, (bool)code, code, state);
+    if (err) {
+      pn_transport_logf(transport,
+                        "error posting transfer frame: %s: %s", pn_code(err),
+                        pn_error_text(pn_data_error(transport->output_args)));
+      return PN_ERR;
+    }
   }
 
   do { // send as many frames as possible without changing the 'more' flag...
@@ -842,7 +1470,10 @@ int pn_post_amqp_transfer_frame(pn_transport_t *transport, uint16_t ch,
     pn_buffer_memory_t buf = pn_buffer_memory( frame );
     buf.size = pn_buffer_available( frame );
 
-    ssize_t wr = pn_data_encode(transport->output_args, buf.start, buf.size);
+    ssize_t wr = direct
+      ? pni_encode_transfer(buf.start, buf.size, handle, id, tag, message_format,
+                            settled, more_flag, code)
+      : pn_data_encode(transport->output_args, buf.start, buf.size);
     if (wr < 0) {
       if (wr == PN_OVERFLOW) {
         pn_buffer_ensure( frame, pn_buffer_available( frame ) * 2 );
@@ -869,37 +1500,25 @@ int pn_post_amqp_transfer_frame(pn_transport_t *transport, uint16_t ch,
       }
     }
 
-    if (pn_buffer_available( frame ) < (available + buf.size)) {
-      // not enough room for payload - try again...
-      pn_buffer_ensure( frame, available + buf.size );
-      goto encode_performatives;
-    }
-
     pn_do_trace(transport, ch, OUT, transport->output_args, payload->start, available);
 
-    memmove( buf.start + buf.size, payload->start, available);
-    payload->start += available;
-    payload->size -= available;
-    buf.size += available;
-
+    // the payload goes straight from the delivery into the output
     pn_frame_t frame = {AMQP_FRAME_TYPE};
     frame.channel = ch;
     frame.payload = buf.start;
     frame.size = buf.size;
 
     size_t n;
-    while (!(n = pn_write_frame(transport->output + transport->available,
-                                transport->capacity - transport->available, frame))) {
-      transport->capacity *= 2;
-      transport->output = (char *) realloc(transport->output, transport->capacity);
+    while (!(n = pn_write_frame_body(pni_output_tail(transport), pni_output_space(transport),
+                                     frame, payload->start, available))) {
+      pni_output_grow(transport);
     }
-    transport->output_frames_ct += 1;
+    payload->start += available;
+    payload->size -= available;
+    pni_output_frame(transport, ch, n);
     framecount++;
     if (transport->trace & PN_TRACE_RAW) {
-      pn_string_set(transport->scratch, "RAW: \"");
-      pn_quote(transport->scratch, transport->output + transport->available, n);
-      pn_string_addf(transport->scratch, "\"");
-      pn_transport_log(transport, pn_string_get(transport->scratch));
+      pn_do_raw_trace(transport, ch, OUT, buf.start, buf.size, pni_output_tail(transport), n);
     }
     transport->available += n;
   } while (payload->size > 0 && framecount < frame_limit);
@@ -1045,7 +1664,7 @@ int pn_do_open(pn_transport_t *transport, uint8_t frame_type, uint16_t channel,
     transport->halt = true;
   }
   transport->open_rcvd = true;
-  return 0;
+  return pni_compress_opened(transport);
 }
 
 int pn_do_begin(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload)
@@ -1059,7 +1678,7 @@ int pn_do_begin(pn_transport_t *transport, uint8_t frame_type, uint16_t channel,
   pn_session_t *ssn;
   if (reply) {
     // XXX: what if session is NULL?
-    ssn = (pn_session_t *) pn_hash_get(transport->local_channels, remote_channel);
+    ssn = (pn_session_t *) pn_alias_map_get(&transport->local_channels, remote_channel);
   } else {
     ssn = pn_session(transport->connection);
   }
@@ -1072,18 +1691,14 @@ int pn_do_begin(pn_transport_t *transport, uint8_t frame_type, uint16_t channel,
 
 pn_link_t *pn_find_link(pn_session_t *ssn, pn_bytes_t name, bool is_sender)
 {
-  pn_endpoint_type_t type = is_sender ? SENDER : RECEIVER;
+  // link names are interned, a name that is not has no link
+  pn_string_t *interned = pni_interned(ssn->connection->symbols, name);
+  return interned ? pni_session_link(ssn, interned, is_sender) : NULL;
+}
 
-  for (size_t i = 0; i < pn_list_size(ssn->links); i++)
-  {
-    pn_link_t *link = (pn_link_t *) pn_list_get(ssn->links, i);
-    if (link->endpoint.type == type &&
-        !strncmp(name.start, pn_string_get(link->name), name.size))
-    {
-      return link;
-    }
-  }
-  return NULL;
+static bool pni_symbol_is(pn_bytes_t symbol, const char *name)
+{
+  return symbol.size == strlen(name) && !memcmp(symbol.start, name, symbol.size);
 }
 
 static pn_expiry_policy_t symbol2policy(pn_bytes_t symbol)
@@ -1091,13 +1706,13 @@ static pn_expiry_policy_t symbol2policy(pn_bytes_t symbol)
   if (!symbol.start)
     return PN_EXPIRE_WITH_SESSION;
 
-  if (!strncmp(symbol.start, "link-detach", symbol.size))
+  if (pni_symbol_is(symbol, "link-detach"))
     return PN_EXPIRE_WITH_LINK;
-  if (!strncmp(symbol.start, "session-end", symbol.size))
+  if (pni_symbol_is(symbol, "session-end"))
     return PN_EXPIRE_WITH_SESSION;
-  if (!strncmp(symbol.start, "connection-close", symbol.size))
+  if (pni_symbol_is(symbol, "connection-close"))
     return PN_EXPIRE_WITH_CONNECTION;
-  if (!strncmp(symbol.start, "never", symbol.size))
+  if (pni_symbol_is(symbol, "never"))
     return PN_EXPIRE_NEVER;
 
   return PN_EXPIRE_WITH_SESSION;
@@ -1108,9 +1723,9 @@ static pn_distribution_mode_t symbol2dist_mode(const pn_bytes_t symbol)
   if (!symbol.start)
     return PN_DIST_MODE_UNSPECIFIED;
 
-  if (!strncmp(symbol.start, "move", symbol.size))
+  if (pni_symbol_is(symbol, "move"))
     return PN_DIST_MODE_MOVE;
-  if (!strncmp(symbol.start, "copy", symbol.size))
+  if (pni_symbol_is(symbol, "copy"))
     return PN_DIST_MODE_COPY;
 
   return PN_DIST_MODE_UNSPECIFIED;
@@ -1129,10 +1744,13 @@ static const char *dist_mode2symbol(const pn_distribution_mode_t mode)
   }
 }
 
-int pn_terminus_set_address_bytes(pn_terminus_t *terminus, pn_bytes_t address)
+// peers tend to attach to the same few addresses, so they are interned
+static void pni_terminus_intern_address(pn_terminus_t *terminus, pni_symtab_t *symbols,
+                                        pn_bytes_t address)
 {
   assert(terminus);
-  return pn_string_setn(terminus->address, address.start, address.size);
+  pn_decref(terminus->address);
+  terminus->address = pni_intern(symbols, address);
 }
 
 int pn_do_attach(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload)
@@ -1158,7 +1776,8 @@ int pn_do_attach(pn_transport_t *transport, uint8_t frame_type, uint16_t channel
                          &idc);
   if (err) return err;
   char strbuf[128];      // avoid malloc for most link names
-  char *strheap = (name.size >= sizeof(strbuf)) ? (char *) malloc(name.size + 1) : NULL;
+  char *strheap = (name.size >= sizeof(strbuf)) ?
+    (char *) pni_malloc(PN_ALLOC_TRANSPORT, name.size + 1) : NULL;
   char *strname = strheap ? strheap : strbuf;
   strncpy(strname, name.start, name.size);
   strname[name.size] = '\0';
@@ -1166,7 +1785,7 @@ int pn_do_attach(pn_transport_t *transport, uint8_t frame_type, uint16_t channel
   pn_session_t *ssn = pn_channel_state(transport, channel);
   if (!ssn) {
       pn_do_error(transport, "amqp:connection:no-session", "attach without a session");
-      if (strheap) free(strheap);
+      if (strheap) pni_free(PN_ALLOC_TRANSPORT, strheap);
       return PN_EOS;
   }
   pn_link_t *link = pn_find_link(ssn, name, is_sender);
@@ -1179,7 +1798,7 @@ int pn_do_attach(pn_transport_t *transport, uint8_t frame_type, uint16_t channel
   }
 
   if (strheap) {
-    free(strheap);
+    pni_free(PN_ALLOC_TRANSPORT, strheap);
   }
 
   pni_map_remote_handle(link, handle);
@@ -1187,7 +1806,7 @@ int pn_do_attach(pn_transport_t *transport, uint8_t frame_type, uint16_t channel
   pn_terminus_t *rsrc = &link->remote_source;
   if (source.start || src_dynamic) {
     pn_terminus_set_type(rsrc, PN_SOURCE);
-    pn_terminus_set_address_bytes(rsrc, source);
+    pni_terminus_intern_address(rsrc, transport->connection->symbols, source);
     pn_terminus_set_durability(rsrc, src_dr);
     pn_terminus_set_expiry_policy(rsrc, symbol2policy(src_exp));
     pn_terminus_set_timeout(rsrc, src_timeout);
@@ -1199,7 +1818,7 @@ int pn_do_attach(pn_transport_t *transport, uint8_t frame_type, uint16_t channel
   pn_terminus_t *rtgt = &link->remote_target;
   if (target.start || tgt_dynamic) {
     pn_terminus_set_type(rtgt, PN_TARGET);
-    pn_terminus_set_address_bytes(rtgt, target);
+    pni_terminus_intern_address(rtgt, transport->connection->symbols, target);
     pn_terminus_set_durability(rtgt, tgt_dr);
     pn_terminus_set_expiry_policy(rtgt, symbol2policy(tgt_exp));
     pn_terminus_set_timeout(rtgt, tgt_timeout);
@@ -1254,6 +1873,8 @@ int pn_do_attach(pn_transport_t *transport, uint8_t frame_type, uint16_t channel
 }
 
 int pn_post_flow(pn_transport_t *transport, pn_session_t *ssn, pn_link_t *link);
+static bool pni_session_window_refresh(pn_session_t *ssn);
+static void pni_session_tune(pn_session_t *ssn, size_t size);
 
 // free the delivery
 static void pn_full_settle(pn_delivery_map_t *db, pn_delivery_t *delivery)
@@ -1267,19 +1888,28 @@ static void pn_full_settle(pn_delivery_map_t *db, pn_delivery_t *delivery)
 
 int pn_do_transfer(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload)
 {
-  // XXX: multi transfer
-  uint32_t handle;
-  pn_bytes_t tag;
-  bool id_present;
-  pn_sequence_t id;
-  bool settled;
-  bool more;
-  bool has_type;
-  uint64_t type;
+  pni_transfer_t transfer;
   pn_data_clear(transport->disp_data);
-  int err = pn_data_scan(args, "D.[I?Iz.oo.D?LC]", &handle, &id_present, &id, &tag,
-                         &settled, &more, &has_type, &type, transport->disp_data);
+  static pni_format_t format = PNI_FORMAT("D.[I?IzIoo.D?LC]");
+  int err = pni_data_scan_format(args, &format, &transfer.handle, &transfer.id_init, &transfer.id,
+                                 &transfer.tag, &transfer.format, &transfer.settled, &transfer.more, &transfer.type_init,
+                                 &transfer.type, transport->disp_data);
   if (err) return err;
+  return pni_do_transfer(transport, channel, &transfer, payload);
+}
+
+// the delivery state, if any, is in transport->disp_data
+int pni_do_transfer(pn_transport_t *transport, uint16_t channel, const pni_transfer_t *transfer, const pn_bytes_t *payload)
+{
+  // XXX: multi transfer
+  uint32_t handle = transfer->handle;
+  pn_bytes_t tag = transfer->tag;
+  bool id_present = transfer->id_init;
+  pn_sequence_t id = transfer->id;
+  bool settled = transfer->settled;
+  bool more = transfer->more;
+  bool has_type = transfer->type_init;
+  uint64_t type = transfer->type;
   pn_session_t *ssn = pn_channel_state(transport, channel);
 
   if (!ssn->state.incoming_window) {
@@ -1300,6 +1930,7 @@ int pn_do_transfer(pn_transport_t *transport, uint8_t frame_type, uint16_t chann
     }
 
     delivery = pn_delivery(link, pn_dtag(tag.start, tag.size));
+    delivery->message_format = transfer->format;
     pn_delivery_state_t *state = pn_delivery_map_push(incoming, delivery);
     if (id_present && id != state->id) {
       return pn_do_error(transport, "amqp:session:invalid-field",
@@ -1308,7 +1939,7 @@ int pn_do_transfer(pn_transport_t *transport, uint8_t frame_type, uint16_t chann
     }
     if (has_type) {
       delivery->remote.type = type;
-      pn_data_copy(delivery->remote.data, transport->disp_data);
+      pn_data_copy(pn_disposition_data(&delivery->remote), transport->disp_data);
     }
 
     link->state.delivery_count++;
@@ -1323,15 +1954,23 @@ int pn_do_transfer(pn_transport_t *transport, uint8_t frame_type, uint16_t chann
     }
   }
 
-  pn_buffer_append(delivery->bytes, payload->start, payload->size);
-  ssn->incoming_bytes += payload->size;
+  pni_delivery_append(delivery, payload->start, payload->size);
+  pni_session_received(ssn, payload->size);
   delivery->done = !more;
+  link->metrics.bytes += payload->size;
+  if (!more) {
+    link->metrics.deliveries++;
+    if (link->latency) delivery->stamp = pn_i_nanos();
+  }
+  ssn->metrics.incoming_transfers++;
 
   ssn->state.incoming_transfer_count++;
   ssn->state.incoming_window--;
+  if (ssn->state.tune_pending) {
+    pni_session_tune(ssn, payload->size);
+  }
 
-  // XXX: need better policy for when to refresh window
-  if (!ssn->state.incoming_window && (int32_t) link->state.local_handle >= 0) {
+  if (pni_session_window_refresh(ssn) && (int32_t) link->state.local_handle >= 0) {
     pn_post_flow(transport, ssn, link);
   }
 
@@ -1341,16 +1980,25 @@ int pn_do_transfer(pn_transport_t *transport, uint8_t frame_type, uint16_t chann
 
 int pn_do_flow(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload)
 {
-  pn_sequence_t onext, inext, delivery_count;
-  uint32_t iwin, owin, link_credit;
-  uint32_t handle;
-  bool inext_init, handle_init, dcount_init, drain;
-  int err = pn_data_scan(args, "D.[?IIII?I?II.o]", &inext_init, &inext, &iwin,
-                         &onext, &owin, &handle_init, &handle, &dcount_init,
-                         &delivery_count, &link_credit, &drain);
+  pni_flow_t flow;
+  static pni_format_t format = PNI_FORMAT("D.[?IIII?I?II.o]");
+  int err = pni_data_scan_format(args, &format, &flow.inext_init, &flow.inext, &flow.iwin,
+                                 &flow.onext, &flow.owin, &flow.handle_init, &flow.handle, &flow.dcount_init,
+                                 &flow.delivery_count, &flow.link_credit, &flow.drain);
   if (err) return err;
+  return pni_do_flow(transport, channel, &flow);
+}
+
+int pni_do_flow(pn_transport_t *transport, uint16_t channel, const pni_flow_t *flow)
+{
+  pn_sequence_t inext = flow->inext, delivery_count = flow->delivery_count;
+  uint32_t iwin = flow->iwin, link_credit = flow->link_credit;
+  uint32_t handle = flow->handle;
+  bool inext_init = flow->inext_init, handle_init = flow->handle_init;
+  bool dcount_init = flow->dcount_init, drain = flow->drain;
 
   pn_session_t *ssn = pn_channel_state(transport, channel);
+  pn_sequence_t window = ssn->state.remote_incoming_window;
 
   if (inext_init) {
     ssn->state.remote_incoming_window = inext + iwin - ssn->state.outgoing_transfer_count;
@@ -1385,6 +2033,16 @@ int pn_do_flow(pn_transport_t *transport, uint8_t frame_type, uint16_t channel,
     }
 
     pn_collector_put(transport->connection->collector, PN_OBJECT, link, PN_LINK_FLOW);
+  } else if (ssn->state.remote_incoming_window > window) {
+    // a session only flow that opens the window wakes senders with
+    // something left to send
+    size_t count = pn_list_size(ssn->links);
+    for (size_t i = 0; i < count; i++) {
+      pn_link_t *link = (pn_link_t *) pn_list_get(ssn->links, i);
+      if (link->endpoint.type == SENDER && pn_link_current(link)) {
+        pn_collector_put(transport->connection->collector, PN_OBJECT, link, PN_LINK_FLOW);
+      }
+    }
   }
 
   return 0;
@@ -1394,31 +2052,48 @@ int pn_do_flow(pn_transport_t *transport, uint8_t frame_type, uint16_t channel,
 #define SCAN_ERROR_DETACH ("D.[..D.[sSC]")
 #define SCAN_ERROR_DISP ("[D.[sSC]")
 
-static int pn_scan_error(pn_data_t *data, pn_condition_t *condition, const char *fmt)
+static int pn_scan_error(pn_transport_t *transport, pn_data_t *data, pn_condition_t *condition,
+                         const char *fmt)
 {
   pn_bytes_t cond;
   pn_bytes_t desc;
   pn_condition_clear(condition);
-  int err = pn_data_scan(data, fmt, &cond, &desc, condition->info);
+  int err = pn_data_scan(data, fmt, &cond, &desc, pn_condition_info(condition));
   if (err) return err;
-  pn_string_setn(condition->name, cond.start, cond.size);
-  pn_string_setn(condition->description, desc.start, desc.size);
+  // the names are mostly the handful the specification defines
+  pn_decref(condition->name);
+  condition->name = pni_intern(transport->connection ? transport->connection->symbols : NULL,
+                               cond);
+  if (desc.start || condition->description) {
+    if (!condition->description) condition->description = pn_string(NULL);
+    pn_string_setn(condition->description, desc.start, desc.size);
+  }
   pn_data_rewind(condition->info);
   return 0;
 }
 
 int pn_do_disposition(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload)
 {
-  bool role;
-  pn_sequence_t first, last;
-  uint64_t type = 0;
-  bool last_init, settled, type_init;
+  pni_disposition_t disposition;
+  disposition.type = 0;
   pn_data_clear(transport->disp_data);
-  int err = pn_data_scan(args, "D.[oI?IoD?LC]", &role, &first, &last_init,
-                         &last, &settled, &type_init, &type,
-                         transport->disp_data);
+  static pni_format_t format = PNI_FORMAT("D.[oI?IoD?LC]");
+  int err = pni_data_scan_format(args, &format, &disposition.role, &disposition.first,
+                                 &disposition.last_init, &disposition.last, &disposition.settled,
+                                 &disposition.type_init, &disposition.type, transport->disp_data);
   if (err) return err;
-  if (!last_init) last = first;
+  return pni_do_disposition(transport, channel, &disposition);
+}
+
+// the delivery state's value, if any, is in transport->disp_data
+int pni_do_disposition(pn_transport_t *transport, uint16_t channel, const pni_disposition_t *disposition)
+{
+  int err;
+  bool role = disposition->role;
+  pn_sequence_t first = disposition->first;
+  pn_sequence_t last = disposition->last_init ? disposition->last : first;
+  uint64_t type = disposition->type;
+  bool settled = disposition->settled, type_init = disposition->type_init;
 
   pn_session_t *ssn = pn_channel_state(transport, channel);
   pn_delivery_map_t *deliveries;
@@ -1451,7 +2126,7 @@ int pn_do_disposition(pn_transport_t *transport, uint8_t frame_type, uint16_t ch
         case PN_ACCEPTED:
           break;
         case PN_REJECTED:
-          err = pn_scan_error(transport->disp_data, &remote->condition, SCAN_ERROR_DISP);
+          err = pn_scan_error(transport, transport->disp_data, &remote->condition, SCAN_ERROR_DISP);
           if (err) return err;
           break;
         case PN_RELEASED:
@@ -1466,15 +2141,18 @@ int pn_do_disposition(pn_transport_t *transport, uint8_t frame_type, uint16_t ch
             remote->undeliverable = pn_data_get_bool(transport->disp_data);
           pn_data_narrow(transport->disp_data);
           pn_data_clear(remote->data);
-          pn_data_appendn(remote->annotations, transport->disp_data, 1);
+          pn_data_appendn(pn_disposition_annotations(remote), transport->disp_data, 1);
           pn_data_widen(transport->disp_data);
           break;
         default:
-          pn_data_copy(remote->data, transport->disp_data);
+          pn_data_copy(pn_disposition_data(remote), transport->disp_data);
           break;
         }
       }
       remote->settled = settled;
+      if (delivery->stamp && delivery->state.sent) {
+        pni_delivery_stage(delivery, &delivery->link->latency->round_trip, false);
+      }
       delivery->updated = true;
       pn_work_update(transport->connection, delivery);
 
@@ -1501,7 +2179,7 @@ int pn_do_detach(pn_transport_t *transport, uint8_t frame_type, uint16_t channel
     return pn_do_error(transport, "amqp:invalid-field", "no such handle: %u", handle);
   }
 
-  err = pn_scan_error(args, &link->endpoint.remote_condition, SCAN_ERROR_DETACH);
+  err = pn_scan_error(transport, args, &link->endpoint.remote_condition, SCAN_ERROR_DETACH);
   if (err) return err;
 
   if (closed)
@@ -1519,7 +2197,7 @@ int pn_do_detach(pn_transport_t *transport, uint8_t frame_type, uint16_t channel
 int pn_do_end(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload)
 {
   pn_session_t *ssn = pn_channel_state(transport, channel);
-  int err = pn_scan_error(args, &ssn->endpoint.remote_condition, SCAN_ERROR_DEFAULT);
+  int err = pn_scan_error(transport, args, &ssn->endpoint.remote_condition, SCAN_ERROR_DEFAULT);
   if (err) return err;
   PN_SET_REMOTE(ssn->endpoint.state, PN_REMOTE_CLOSED);
   pn_collector_put(transport->connection->collector, PN_OBJECT, ssn, PN_SESSION_REMOTE_CLOSE);
@@ -1530,7 +2208,7 @@ int pn_do_end(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, p
 int pn_do_close(pn_transport_t *transport, uint8_t frame_type, uint16_t channel, pn_data_t *args, const pn_bytes_t *payload)
 {
   pn_connection_t *conn = transport->connection;
-  int err = pn_scan_error(args, &transport->remote_condition, SCAN_ERROR_DEFAULT);
+  int err = pn_scan_error(transport, args, &transport->remote_condition, SCAN_ERROR_DEFAULT);
   if (err) return err;
   transport->close_rcvd = true;
   PN_SET_REMOTE(conn->endpoint.state, PN_REMOTE_CLOSED);
@@ -1565,7 +2243,7 @@ ssize_t pn_transport_input(pn_transport_t *transport, const char *bytes, size_t
 }
 
 // process pending input until none remaining or EOS
-static ssize_t transport_consume(pn_transport_t *transport)
+static ssize_t pni_transport_consume(pn_transport_t *transport)
 {
   // This allows whatever is driving the I/O to set the error
   // condition on the transport before doing pn_transport_close_head()
@@ -1585,10 +2263,11 @@ static ssize_t transport_consume(pn_transport_t *transport)
     ssize_t n;
     n = transport->io_layers[0]->
       process_input( transport, 0,
-                     transport->input_buf + consumed,
+                     transport->input_buf + transport->input_offset,
                      transport->input_pending );
     if (n > 0) {
       consumed += n;
+      transport->input_offset += n;
       transport->input_pending -= n;
     } else if (n == 0) {
       break;
@@ -1596,18 +2275,29 @@ static ssize_t transport_consume(pn_transport_t *transport)
       assert(n == PN_EOS);
       if (transport->trace & (PN_TRACE_RAW | PN_TRACE_FRM))
         pn_transport_log(transport, "  <- EOS");
+      transport->input_offset = 0;
       transport->input_pending = 0;  // XXX ???
       return n;
     }
   }
 
-  if (transport->input_pending && consumed) {
-    memmove( transport->input_buf,  &transport->input_buf[consumed], transport->input_pending );
+  // leftover input stays where it is, the buffer is only compacted
+  // when the tail runs out of room (see pn_transport_capacity)
+  if (!transport->input_pending) {
+    transport->input_offset = 0;
   }
 
   return consumed;
 }
 
+static ssize_t transport_consume(pn_transport_t *transport)
+{
+  PNI_PROBE2(consume_start, transport, transport->input_pending);
+  ssize_t n = pni_transport_consume(transport);
+  PNI_PROBE2(consume_done, transport, n);
+  return n;
+}
+
 static ssize_t pn_input_read_amqp_header(pn_transport_t* transport, unsigned int layer, const char* bytes, size_t available)
 {
   bool eos = pn_transport_capacity(transport)==PN_EOS;
@@ -1621,6 +2311,7 @@ static ssize_t pn_input_read_amqp_header(pn_transport_t* transport, unsigned int
     }
     if (transport->trace & PN_TRACE_FRM)
       pn_transport_logf(transport, "  <- %s", "AMQP");
+    if (transport->capture) pni_transport_capture(transport, PNI_CAPTURE_IN, bytes, 8);
     return 8;
   case PNI_PROTOCOL_INSUFFICIENT:
     if (!eos) return 0;
@@ -1652,6 +2343,7 @@ static ssize_t pn_input_read_amqp(pn_transport_t* transport, unsigned int layer,
 
 
   ssize_t n = pn_dispatcher_input(transport, bytes, available, true, &transport->halt);
+  if (n > 0 && transport->capture) pni_transport_capture(transport, PNI_CAPTURE_IN, bytes, n);
   if (n < 0) {
     //return pn_error_set(transport->error, n, "dispatch error");
     return PN_EOS;
@@ -1723,27 +2415,34 @@ int pn_process_conn_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
                               (bool)transport->local_max_frame, transport->local_max_frame,
                               (bool)transport->channel_max, transport->channel_max,
                               (bool)idle_timeout, idle_timeout,
-                              connection->offered_capabilities,
+                              pni_compress_offered(transport, connection->offered_capabilities),
                               connection->desired_capabilities,
                               connection->properties);
       if (err) return err;
       transport->open_sent = true;
+      err = pni_compress_opened(transport);
+      if (err) return err;
     }
   }
 
   return 0;
 }
 
-static uint16_t allocate_alias(pn_hash_t *aliases)
+size_t pn_session_outgoing_room(pn_session_t *ssn)
 {
-  for (uint32_t i = 0; i < 65536; i++) {
-    if (!pn_hash_get(aliases, i)) {
-      return i;
-    }
+  uint64_t room = SIZE_MAX;
+  uint64_t queued = ssn->outgoing_bytes;
+  if (ssn->outgoing_high_water) {
+    room = ssn->outgoing_high_water > queued ? ssn->outgoing_high_water - queued : 0;
   }
-
-  assert(false);
-  return 0;
+  pn_transport_t *transport = ssn->connection->transport;
+  if (transport && transport->remote_max_frame) {
+    // what the peer will take once everything queued has been framed
+    uint64_t window = ssn->state.remote_incoming_window > 0 ? ssn->state.remote_incoming_window : 0;
+    window *= transport->remote_max_frame;
+    room = pn_min(room, window > queued ? window - queued : 0);
+  }
+  return (size_t) room;
 }
 
 size_t pn_session_outgoing_window(pn_session_t *ssn)
@@ -1760,13 +2459,100 @@ size_t pn_session_outgoing_window(pn_session_t *ssn)
   }
 }
 
+// the room left under the tightest incoming high-water mark of the
+// session's receivers, only the delivery a link is still receiving can
+// grow so that is the one measured
+static size_t pni_session_headroom(pn_session_t *ssn)
+{
+  size_t headroom = SIZE_MAX;
+  size_t count = pn_list_size(ssn->links);
+  for (size_t i = 0; i < count; i++) {
+    pn_link_t *link = (pn_link_t *) pn_list_get(ssn->links, i);
+    size_t high = link->incoming_high_water;
+    if (!high || link->endpoint.type != RECEIVER) continue;
+    pn_delivery_t *delivery = link->unsettled_tail;
+    size_t pending = delivery && !delivery->done ? pn_delivery_pending(delivery) : 0;
+    headroom = pn_min(headroom, high > pending ? high - pending : 0);
+  }
+  return headroom;
+}
+
+// the session's even share of what is left of the connection's budget,
+// at least a frame until the budget is reached
+static size_t pni_session_budget(pn_session_t *ssn, uint32_t frame)
+{
+  pn_connection_t *conn = ssn->connection;
+  if (!conn->incoming_budget) return SIZE_MAX;
+  if (conn->budget_stalled) return 0;
+  size_t left = conn->incoming_budget - conn->incoming_bytes;
+  size_t share = left/pn_max(pn_list_size(conn->sessions), (size_t) 1);
+  return pn_max(share, (size_t) frame);
+}
+
 size_t pn_session_incoming_window(pn_session_t *ssn)
 {
   uint32_t size = ssn->connection->transport->local_max_frame;
   if (!size) {
     return 2147483647; // biggest legal value
   } else {
-    return (ssn->incoming_capacity - ssn->incoming_bytes)/size;
+    // no capacity leaves the window wide open, as an unlimited frame does
+    size_t window = ssn->incoming_capacity ? (ssn->incoming_capacity - ssn->incoming_bytes)/size : 2147483647;
+    window = pn_min(window, pni_session_headroom(ssn)/size);
+    return pn_min(window, pni_session_budget(ssn, size)/size);
+  }
+}
+
+// the low-water mark in frames, autotuning keeps it at least at half
+// the capacity so the refresh goes out well ahead of the window closing
+static size_t pni_session_low_frames(pn_session_t *ssn)
+{
+  uint32_t size = ssn->connection->transport->local_max_frame;
+  if (!size) return 0;
+  size_t low = ssn->incoming_low_water;
+  if (ssn->incoming_max_capacity) {
+    low = pn_max(low, ssn->incoming_capacity/2);
+  }
+  return low/size;
+}
+
+bool pni_session_window_low(pn_session_t *ssn)
+{
+  if (!ssn->connection->transport) return !ssn->state.incoming_window;
+  return (size_t) ssn->state.incoming_window <= pni_session_low_frames(ssn);
+}
+
+// refresh once the window is used up, or once it is at the low-water
+// mark and the capacity freed since would lift it back above
+static bool pni_session_window_refresh(pn_session_t *ssn)
+{
+  if (!ssn->state.incoming_window) return pn_session_incoming_window(ssn) > 0;
+  size_t low = pni_session_low_frames(ssn);
+  return (size_t) ssn->state.incoming_window <= low && pn_session_incoming_window(ssn) > low;
+}
+
+// grow the capacity when the peer ran out of window before a refresh
+// reached it, and shrink it when a round trip carries far less than it
+static void pni_session_tune(pn_session_t *ssn, size_t size)
+{
+  pn_session_state_t *state = &ssn->state;
+  state->tune_bytes += size;
+  if (!state->incoming_window) {
+    state->tune_stalled = true;
+  }
+  if ((int32_t) ((uint32_t) state->incoming_transfer_count - (uint32_t) state->tune_limit) <= 0) {
+    return;
+  }
+
+  state->tune_pending = false;
+  if (state->tune_stalled) {
+    ssn->incoming_capacity = pn_min(ssn->incoming_capacity*2, ssn->incoming_max_capacity);
+  } else if (state->tune_bytes < ssn->incoming_capacity/8) {
+    // never below what the peer may already send
+    size_t capacity = pn_max(ssn->incoming_capacity/2, ssn->incoming_base_capacity);
+    uint32_t frame = ssn->connection->transport->local_max_frame;
+    if (ssn->incoming_bytes + (size_t) state->incoming_window*frame <= capacity) {
+      ssn->incoming_capacity = capacity;
+    }
   }
 }
 
@@ -1774,9 +2560,9 @@ static void pni_map_local_channel(pn_session_t *ssn)
 {
   pn_transport_t *transport = ssn->connection->transport;
   pn_session_state_t *state = &ssn->state;
-  uint16_t channel = allocate_alias(transport->local_channels);
+  uint16_t channel = (uint16_t) pn_alias_map_allocate(&transport->local_channels);
   state->local_channel = channel;
-  pn_hash_put(transport->local_channels, channel, ssn);
+  pn_alias_map_put(&transport->local_channels, channel, ssn);
   pn_ep_incref(&ssn->endpoint);
 }
 
@@ -1821,8 +2607,8 @@ static const char *expiry_symbol(pn_expiry_policy_t policy)
 static void pni_map_local_handle(pn_link_t *link) {
   pn_link_state_t *state = &link->state;
   pn_session_state_t *ssn_state = &link->session->state;
-  state->local_handle = allocate_alias(ssn_state->local_handles);
-  pn_hash_put(ssn_state->local_handles, state->local_handle, link);
+  state->local_handle = pn_alias_map_allocate(&ssn_state->local_handles);
+  pn_alias_map_put(&ssn_state->local_handles, state->local_handle, link);
   pn_ep_incref(&link->endpoint);
 }
 
@@ -1899,19 +2685,57 @@ int pn_process_link_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
 
 int pn_post_flow(pn_transport_t *transport, pn_session_t *ssn, pn_link_t *link)
 {
+  pn_sequence_t window = ssn->state.incoming_window;
   ssn->state.incoming_window = pn_session_incoming_window(ssn);
+  if (ssn->incoming_max_capacity && !ssn->state.tune_pending && ssn->state.incoming_window > window) {
+    ssn->state.tune_limit = ssn->state.incoming_transfer_count + window;
+    ssn->state.tune_bytes = 0;
+    ssn->state.tune_stalled = !window;
+    ssn->state.tune_pending = true;
+  }
   ssn->state.outgoing_window = pn_session_outgoing_window(ssn);
   bool linkq = (bool) link;
   pn_link_state_t *state = &link->state;
-  return pn_post_frame(transport, AMQP_FRAME_TYPE, ssn->state.local_channel, "DL[?IIII?I?I?In?o]", FLOW,
-                       (int16_t) ssn->state.remote_channel >= 0, ssn->state.incoming_transfer_count,
-                       ssn->state.incoming_window,
-                       ssn->state.outgoing_transfer_count,
-                       ssn->state.outgoing_window,
-                       linkq, linkq ? state->local_handle : 0,
-                       linkq, linkq ? state->delivery_count : 0,
-                       linkq, linkq ? state->link_credit : 0,
-                       linkq, linkq ? link->drain : false);
+  if (pni_encode_direct(transport)) {
+    pn_buffer_t *frame = transport->frame;
+    ssize_t wr;
+    pn_buffer_clear(frame);
+    while ((wr = pni_encode_flow(pn_buffer_memory(frame).start, pn_buffer_available(frame),
+                                 (int16_t) ssn->state.remote_channel >= 0,
+                                 ssn->state.incoming_transfer_count,
+                                 ssn->state.incoming_window,
+                                 ssn->state.outgoing_transfer_count,
+                                 ssn->state.outgoing_window,
+                                 linkq, linkq ? state->local_handle : 0,
+                                 linkq ? state->delivery_count : 0,
+                                 linkq ? state->link_credit : 0,
+                                 linkq ? link->drain : false)) == PN_OVERFLOW) {
+      pn_buffer_ensure(frame, pn_buffer_available(frame) * 2);
+    }
+    return pni_post_encoded(transport, AMQP_FRAME_TYPE, ssn->state.local_channel,
+                            pn_buffer_memory(frame).start, wr);
+  }
+  static pni_format_t format = PNI_FORMAT("DL[?IIII?I?I?In?o]");
+  return pni_post_frame(transport, AMQP_FRAME_TYPE, ssn->state.local_channel, &format, FLOW,
+                        (int16_t) ssn->state.remote_channel >= 0, ssn->state.incoming_transfer_count,
+                        ssn->state.incoming_window,
+                        ssn->state.outgoing_transfer_count,
+                        ssn->state.outgoing_window,
+                        linkq, linkq ? state->local_handle : 0,
+                        linkq, linkq ? state->delivery_count : 0,
+                        linkq, linkq ? state->link_credit : 0,
+                        linkq, linkq ? link->drain : false);
+}
+
+// the credit to give the peer, none beyond what it has while the
+// connection is over its budget
+static pn_sequence_t pni_link_credit(pn_link_t *rcv)
+{
+  pn_sequence_t credit = rcv->credit - rcv->queued;
+  if (rcv->session->connection->budget_stalled) {
+    return pn_min(credit, rcv->state.link_credit);
+  }
+  return credit;
 }
 
 int pn_process_flow_receiver(pn_transport_t *transport, pn_endpoint_t *endpoint)
@@ -1923,8 +2747,8 @@ int pn_process_flow_receiver(pn_transport_t *transport, pn_endpoint_t *endpoint)
     pn_link_state_t *state = &rcv->state;
     if ((int16_t) ssn->state.local_channel >= 0 &&
         (int32_t) state->local_handle >= 0 &&
-        ((rcv->drain || state->link_credit != rcv->credit - rcv->queued) || !ssn->state.incoming_window)) {
-      state->link_credit = rcv->credit - rcv->queued;
+        ((rcv->drain || state->link_credit != pni_link_credit(rcv)) || pni_session_window_refresh(ssn))) {
+      state->link_credit = pni_link_credit(rcv);
       return pn_post_flow(transport, ssn, rcv);
     }
   }
@@ -1932,25 +2756,65 @@ int pn_process_flow_receiver(pn_transport_t *transport, pn_endpoint_t *endpoint)
   return 0;
 }
 
+static int pni_post_disp_range(pn_transport_t *transport, pn_session_t *ssn, pni_disp_range_t *range)
+{
+  if (pni_encode_direct(transport)) {
+    pn_buffer_t *frame = transport->frame;
+    ssize_t wr;
+    pn_buffer_clear(frame);
+    while ((wr = pni_encode_disposition(pn_buffer_memory(frame).start, pn_buffer_available(frame),
+                                        range->role, range->first, range->last,
+                                        range->settled, range->code)) == PN_OVERFLOW) {
+      pn_buffer_ensure(frame, pn_buffer_available(frame) * 2);
+    }
+    return pni_post_encoded(transport, AMQP_FRAME_TYPE, ssn->state.local_channel,
+                            pn_buffer_memory(frame).start, wr);
+  } else {
+    static pni_format_t format = PNI_FORMAT("DL[oIIo?DL[]]");
+    return pni_post_frame(transport, AMQP_FRAME_TYPE, ssn->state.local_channel, &format, DISPOSITION,
+                          range->role, range->first, range->last,
+                          range->settled, (bool)range->code, range->code);
+  }
+}
+
 int pn_flush_disp(pn_transport_t *transport, pn_session_t *ssn)
 {
-  uint64_t code = ssn->state.disp_code;
-  bool settled = ssn->state.disp_settled;
-  if (ssn->state.disp) {
-    int err = pn_post_frame(transport, AMQP_FRAME_TYPE, ssn->state.local_channel, "DL[oIIo?DL[]]", DISPOSITION,
-                            ssn->state.disp_type, ssn->state.disp_first, ssn->state.disp_last,
-                            settled, (bool)code, code);
-    if (err) return err;
-    ssn->state.disp_type = 0;
-    ssn->state.disp_code = 0;
-    ssn->state.disp_settled = 0;
-    ssn->state.disp_first = 0;
-    ssn->state.disp_last = 0;
-    ssn->state.disp = false;
+  pn_session_state_t *state = &ssn->state;
+  for (size_t i = 0; i < state->disp_count; i++) {
+    int err = pni_post_disp_range(transport, ssn, &state->disp[i]);
+    if (err) {
+      memmove(state->disp, state->disp + i, (state->disp_count - i) * sizeof(pni_disp_range_t));
+      state->disp_count -= i;
+      return err;
+    }
   }
+  state->disp_count = 0;
   return 0;
 }
 
+static inline bool pni_disp_range_contains(pni_disp_range_t *range, pn_sequence_t id)
+{
+  return (uint32_t) id - (uint32_t) range->first <= (uint32_t) range->last - (uint32_t) range->first;
+}
+
+// whether a disposition other than a matching one is pending for id
+static bool pni_disp_pending(pn_session_state_t *state, bool role, pn_sequence_t id,
+                             uint64_t code, bool settled, bool *same)
+{
+  *same = false;
+  for (size_t i = 0; i < state->disp_count; i++) {
+    pni_disp_range_t *range = &state->disp[i];
+    if (range->role == role && pni_disp_range_contains(range, id)) {
+      if (range->code == code && range->settled == settled) {
+        *same = true;
+      } else {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 int pn_post_disp(pn_transport_t *transport, pn_delivery_t *delivery)
 {
   pn_link_t *link = delivery->link;
@@ -1961,44 +2825,79 @@ int pn_post_disp(pn_transport_t *transport, pn_delivery_t *delivery)
   assert(state->init);
   bool role = (link->endpoint.type == RECEIVER);
   uint64_t code = delivery->local.type;
+  bool settled = delivery->local.settled;
+  pn_sequence_t id = state->id;
 
-  if (!code && !delivery->local.settled) {
+  if (!code && !settled) {
     return 0;
   }
 
+  bool same;
+  bool other = pni_disp_pending(ssn_state, role, id, code, settled, &same);
+  // this delivery's earlier dispositions must reach the peer first
+  if (other) {
+    int err = pn_flush_disp(transport, ssn);
+    if (err) return err;
+    same = false;
+  }
+
   if (!pni_disposition_batchable(&delivery->local)) {
     pn_data_clear(transport->disp_data);
     pni_disposition_encode(&delivery->local, transport->disp_data);
-    return pn_post_frame(transport, AMQP_FRAME_TYPE, ssn->state.local_channel,
-                         "DL[oIIo?DLC]", DISPOSITION,
-                         role, state->id, state->id, delivery->local.settled,
-                         (bool)code, code, transport->disp_data);
+    static pni_format_t format = PNI_FORMAT("DL[oIIo?DLC]");
+    return pni_post_frame(transport, AMQP_FRAME_TYPE, ssn->state.local_channel,
+                          &format, DISPOSITION,
+                          role, id, id, settled,
+                          (bool)code, code, transport->disp_data);
   }
 
-  if (ssn_state->disp && code == ssn_state->disp_code &&
-      delivery->local.settled == ssn_state->disp_settled &&
-      ssn_state->disp_type == role) {
-    if (state->id == ssn_state->disp_first - 1) {
-      ssn_state->disp_first = state->id;
-      return 0;
-    } else if (state->id == ssn_state->disp_last + 1) {
-      ssn_state->disp_last = state->id;
-      return 0;
+  if (same) {
+    return 0;
+  }
+
+  // grow a range of the same outcome that id extends, merging it with
+  // any range it then meets
+  for (size_t i = 0; i < ssn_state->disp_count; i++) {
+    pni_disp_range_t *range = &ssn_state->disp[i];
+    if (range->role != role || range->code != code || range->settled != settled) continue;
+    pn_sequence_t meets;
+    if (id == range->last + 1) {
+      range->last = id;
+      meets = id + 1;
+    } else if (id == range->first - 1) {
+      range->first = id;
+      meets = id - 1;
+    } else {
+      continue;
+    }
+    for (size_t j = i + 1; j < ssn_state->disp_count; j++) {
+      pni_disp_range_t *later = &ssn_state->disp[j];
+      if (later->role != role || later->code != code || later->settled != settled) continue;
+      if (later->first == meets) {
+        range->last = later->last;
+      } else if (later->last == meets) {
+        range->first = later->first;
+      } else {
+        continue;
+      }
+      memmove(later, later + 1, (ssn_state->disp_count - j - 1) * sizeof(pni_disp_range_t));
+      ssn_state->disp_count--;
+      break;
     }
+    return 0;
   }
 
-  if (ssn_state->disp) {
+  if (ssn_state->disp_count == PNI_DISP_MAX) {
     int err = pn_flush_disp(transport, ssn);
     if (err) return err;
   }
 
-  ssn_state->disp_type = role;
-  ssn_state->disp_code = code;
-  ssn_state->disp_settled = delivery->local.settled;
-  ssn_state->disp_first = state->id;
-  ssn_state->disp_last = state->id;
-  ssn_state->disp = true;
-
+  pni_disp_range_t *range = &ssn_state->disp[ssn_state->disp_count++];
+  range->role = role;
+  range->code = code;
+  range->settled = settled;
+  range->first = id;
+  range->last = id;
   return 0;
 }
 
@@ -2011,37 +2910,82 @@ int pn_process_tpwork_sender(pn_transport_t *transport, pn_delivery_t *delivery,
   bool xfr_posted = false;
   if ((int16_t) ssn_state->local_channel >= 0 && (int32_t) link_state->local_handle >= 0) {
     pn_delivery_state_t *state = &delivery->state;
-    if (!state->sent && (delivery->done || pn_buffer_size(delivery->bytes) > 0) &&
-        ssn_state->remote_incoming_window > 0 && link_state->link_credit > 0) {
+    bool ready = !state->sent && (delivery->done || pn_delivery_pending(delivery) > 0);
+    // a stall is counted once, when it starts
+    if (ready && !ssn_state->remote_incoming_window && !link->session->window_stalled) {
+      link->session->window_stalled = true;
+      link->session->metrics.window_stalls++;
+    } else if (ready && !link_state->link_credit && !link->credit_stalled) {
+      link->credit_stalled = true;
+      link->metrics.credit_stalls++;
+    }
+    if (ready && ssn_state->remote_incoming_window > 0 && link_state->link_credit > 0) {
+      link->session->window_stalled = false;
+      link->credit_stalled = false;
       if (!state->init) {
         state = pn_delivery_map_push(&ssn_state->outgoing, delivery);
       }
 
-      pn_bytes_t bytes = pn_buffer_bytes(delivery->bytes);
-      size_t full_size = bytes.size;
-      pn_bytes_t tag = pn_buffer_bytes(delivery->tag);
+      // send straight out of the delivery buffer and then any adopted
+      // bytes, each run gets its own frames rather than being defragmented
+      if (pni_delivery_refill(delivery)) {
+        return pn_do_error(transport, "amqp:internal-error", "reading file body: %s",
+                           strerror(errno));
+      }
+      pn_bytes_t runs[3];
+      pn_buffer_segments(delivery->bytes, &runs[0], &runs[1]);
+      runs[2] = delivery->adopted;
+      size_t buffered = runs[0].size + runs[1].size;
+      // the last run is not the end of the delivery while a file has more
+      bool unread = delivery->file && pni_file_range_remaining(delivery->file);
+      size_t last = 2;
+      while (last > 0 && !runs[last].size) last--;
+      pn_bytes_t tag = delivery->tag;
       pn_data_clear(transport->disp_data);
       pni_disposition_encode(&delivery->local, transport->disp_data);
 
-      int count = pn_post_amqp_transfer_frame(transport,
-                                              ssn_state->local_channel,
-                                              link_state->local_handle,
-                                              state->id, &bytes, &tag,
-                                              0, // message-format
-                                              delivery->local.settled,
-                                              !delivery->done,
-                                              ssn_state->remote_incoming_window,
-                                              delivery->local.type, transport->disp_data);
-      if (count < 0) return count;
+      int count = 0;
+      for (size_t i = 0; i <= last; i++) {
+        if (!runs[i].size && i < last) continue;
+        if ((pn_sequence_t) count >= ssn_state->remote_incoming_window) break;
+        int n = pn_post_amqp_transfer_frame(transport,
+                                            ssn_state->local_channel,
+                                            link_state->local_handle,
+                                            state->id, &runs[i], &tag,
+                                            delivery->message_format,
+                                            delivery->local.settled,
+                                            !delivery->done || i < last || unread,
+                                            ssn_state->remote_incoming_window - count,
+                                            delivery->local.type, transport->disp_data);
+        if (n < 0) return n;
+        count += n;
+        if (runs[i].size) break;
+      }
       xfr_posted = true;
+      link->session->metrics.outgoing_transfers += count;
       ssn_state->outgoing_transfer_count += count;
       ssn_state->remote_incoming_window -= count;
 
-      int sent = full_size - bytes.size;
+      size_t sent = buffered - runs[0].size - runs[1].size;
       pn_buffer_trim(delivery->bytes, sent, 0);
+      sent += delivery->adopted.size - runs[2].size;
+      delivery->adopted = runs[2];
+      if (!delivery->adopted.size) {
+        pni_delivery_release(delivery);
+      }
       link->session->outgoing_bytes -= sent;
-      if (!pn_buffer_size(delivery->bytes) && delivery->done) {
+      link->metrics.bytes += sent;
+      // the next window of a file is read now, or the file closed after its last
+      if (pni_delivery_refill(delivery)) {
+        return pn_do_error(transport, "amqp:internal-error", "reading file body: %s",
+                           strerror(errno));
+      }
+      if (!pn_delivery_pending(delivery) && delivery->done) {
         state->sent = true;
+        link->metrics.deliveries++;
+        if (delivery->stamp) {
+          pni_delivery_stage(delivery, &link->latency->queueing, true);
+        }
         link_state->delivery_count++;
         link_state->link_credit--;
         link->queued--;
@@ -2074,8 +3018,7 @@ int pn_process_tpwork_receiver(pn_transport_t *transport, pn_delivery_t *deliver
     if (err) return err;
   }
 
-  // XXX: need to centralize this policy and improve it
-  if (!ssn->state.incoming_window) {
+  if (pni_session_window_refresh(ssn)) {
     int err = pn_post_flow(transport, ssn, link);
     if (err) return err;
   }
@@ -2160,13 +3103,13 @@ int pn_process_flow_sender(pn_transport_t *transport, pn_endpoint_t *endpoint)
 
 static void pni_unmap_local_handle(pn_link_t *link) {
   pn_link_state_t *state = &link->state;
-  uintptr_t handle = state->local_handle;
+  uint32_t handle = state->local_handle;
   state->local_handle = -2;
-  if (pn_hash_get(link->session->state.local_handles, handle)) {
+  if (pn_alias_map_get(&link->session->state.local_handles, handle)) {
+    pn_alias_map_del(&link->session->state.local_handles, handle);
+    // may delete link
     pn_ep_decref(&link->endpoint);
   }
-  // may delete link
-  pn_hash_del(link->session->state.local_handles, handle);
 }
 
 int pn_process_link_teardown(pn_transport_t *transport, pn_endpoint_t *endpoint)
@@ -2234,16 +3177,16 @@ bool pn_pointful_buffering(pn_transport_t *transport, pn_session_t *session)
 static void pni_unmap_local_channel(pn_session_t *ssn) {
   // XXX: should really update link state also
   pn_delivery_map_clear(&ssn->state.outgoing);
-  pni_transport_unbind_handles(ssn->state.local_handles, false);
+  pni_transport_unbind_handles(&ssn->state.local_handles, false);
   pn_transport_t *transport = ssn->connection->transport;
   pn_session_state_t *state = &ssn->state;
-  uintptr_t channel = state->local_channel;
+  uint16_t channel = state->local_channel;
   state->local_channel = -2;
-  if (pn_hash_get(transport->local_channels, channel)) {
+  if (pn_alias_map_get(&transport->local_channels, channel)) {
+    pn_alias_map_del(&transport->local_channels, channel);
+    // may delete session
     pn_ep_decref(&ssn->endpoint);
   }
-  // may delete session
-  pn_hash_del(transport->local_channels, channel);
 }
 
 int pn_process_ssn_teardown(pn_transport_t *transport, pn_endpoint_t *endpoint)
@@ -2296,10 +3239,10 @@ int pn_process_conn_teardown(pn_transport_t *transport, pn_endpoint_t *endpoint)
   return 0;
 }
 
-int pn_phase(pn_transport_t *transport, int (*phase)(pn_transport_t *, pn_endpoint_t *))
+int pn_phase(pn_transport_t *transport, pni_transport_queue_t *queue,
+             int (*phase)(pn_transport_t *, pn_endpoint_t *))
 {
-  pn_connection_t *conn = transport->connection;
-  pn_endpoint_t *endpoint = conn->transport_head;
+  pn_endpoint_t *endpoint = queue->transport_head;
   while (endpoint)
   {
     pn_endpoint_t *next = endpoint->transport_next;
@@ -2310,26 +3253,39 @@ int pn_phase(pn_transport_t *transport, int (*phase)(pn_transport_t *, pn_endpoi
   return 0;
 }
 
-int pn_process(pn_transport_t *transport)
+static int pni_process_link_open(pn_transport_t *transport, pn_endpoint_t *endpoint)
+{
+  int err = pn_process_link_setup(transport, endpoint);
+  if (err) return err;
+  return pn_process_flow_receiver(transport, endpoint);
+}
+
+static int pni_process_link_close(pn_transport_t *transport, pn_endpoint_t *endpoint)
+{
+  int err = pn_process_flow_sender(transport, endpoint);
+  if (err) return err;
+  return pn_process_link_teardown(transport, endpoint);
+}
+
+static int pni_process(pn_transport_t *transport)
 {
+  pn_connection_t *conn = transport->connection;
   int err;
-  if ((err = pn_phase(transport, pn_process_conn_setup))) return err;
-  if ((err = pn_phase(transport, pn_process_ssn_setup))) return err;
-  if ((err = pn_phase(transport, pn_process_link_setup))) return err;
-  if ((err = pn_phase(transport, pn_process_flow_receiver))) return err;
+  if ((err = pn_phase(transport, &conn->modified_connection, pn_process_conn_setup))) return err;
+  if ((err = pn_phase(transport, &conn->modified_sessions, pn_process_ssn_setup))) return err;
+  if ((err = pn_phase(transport, &conn->modified_links, pni_process_link_open))) return err;
 
   // XXX: this has to happen two times because we might settle stuff
   // on the first pass and create space for more work to be done on the
   // second pass
-  if ((err = pn_phase(transport, pn_process_tpwork))) return err;
-  if ((err = pn_phase(transport, pn_process_tpwork))) return err;
+  if ((err = pn_phase(transport, &conn->modified_connection, pn_process_tpwork))) return err;
+  if ((err = pn_phase(transport, &conn->modified_connection, pn_process_tpwork))) return err;
 
-  if ((err = pn_phase(transport, pn_process_flush_disp))) return err;
+  if ((err = pn_phase(transport, &conn->modified_sessions, pn_process_flush_disp))) return err;
 
-  if ((err = pn_phase(transport, pn_process_flow_sender))) return err;
-  if ((err = pn_phase(transport, pn_process_link_teardown))) return err;
-  if ((err = pn_phase(transport, pn_process_ssn_teardown))) return err;
-  if ((err = pn_phase(transport, pn_process_conn_teardown))) return err;
+  if ((err = pn_phase(transport, &conn->modified_links, pni_process_link_close))) return err;
+  if ((err = pn_phase(transport, &conn->modified_sessions, pn_process_ssn_teardown))) return err;
+  if ((err = pn_phase(transport, &conn->modified_connection, pn_process_conn_teardown))) return err;
 
   if (transport->connection->tpwork_head) {
     pn_modified(transport->connection, &transport->connection->endpoint, false);
@@ -2338,6 +3294,17 @@ int pn_process(pn_transport_t *transport)
   return 0;
 }
 
+int pn_process(pn_transport_t *transport)
+{
+  PNI_PROBE1(process_start, transport);
+  uint64_t start = pn_i_nanos();
+  int err = pni_process(transport);
+  transport->metrics.process_count++;
+  transport->metrics.process_nanos += pn_i_nanos() - start;
+  PNI_PROBE2(process_done, transport, err);
+  return err;
+}
+
 #define AMQP_HEADER ("AMQP\x00\x01\x00\x00")
 
 static ssize_t pn_output_write_amqp_header(pn_transport_t* transport, unsigned int layer, char* bytes, size_t available)
@@ -2346,6 +3313,7 @@ static ssize_t pn_output_write_amqp_header(pn_transport_t* transport, unsigned i
     pn_transport_logf(transport, "  -> %s", "AMQP");
   assert(available >= 8);
   memmove(bytes, AMQP_HEADER, 8);
+  if (transport->capture) pni_transport_capture(transport, PNI_CAPTURE_OUT, bytes, 8);
   if (transport->io_layers[layer] == &amqp_write_header_layer) {
     transport->io_layers[layer] = &amqp_layer;
   } else {
@@ -2371,7 +3339,9 @@ static ssize_t pn_output_write_amqp(pn_transport_t* transport, unsigned int laye
     return PN_EOS;
   }
 
-  return pn_dispatcher_output(transport, bytes, available);
+  ssize_t n = pn_dispatcher_output(transport, bytes, available);
+  if (n > 0 && transport->capture) pni_transport_capture(transport, PNI_CAPTURE_OUT, bytes, n);
+  return n;
 }
 
 static void pni_close_head(pn_transport_t *transport)
@@ -2385,33 +3355,77 @@ static void pni_close_head(pn_transport_t *transport)
 }
 
 // generate outbound data, return amount of pending output else error
-static ssize_t transport_produce(pn_transport_t *transport)
+static ssize_t pni_produce_eos(pn_transport_t *transport, ssize_t n)
+{
+  if (transport->trace & (PN_TRACE_RAW | PN_TRACE_FRM)) {
+    pn_transport_log(transport, "  -> EOS");
+  }
+  pni_close_head(transport);
+  return n;
+}
+
+// set a buffer zerocopy sends still read aside for a fresh one, the
+// unsent output coming along
+static void pni_transport_retire_output(pn_transport_t *transport)
+{
+  if (transport->output_retired_count == PNI_PINNED_BUFFERS) return;
+  if (!transport->output_retired) {
+    transport->output_retired = (pni_pinned_buffer_t *)
+      pni_malloc(PN_ALLOC_TRANSPORT, PNI_PINNED_BUFFERS*sizeof(pni_pinned_buffer_t));
+    if (!transport->output_retired) return;
+  }
+  char *buf = pni_io_alloc(transport, transport->output_size);
+  if (!buf) return;
+  memcpy(buf, transport->output_buf + transport->output_offset, transport->output_pending);
+  pni_pinned_buffer_t *retired = &transport->output_retired[transport->output_retired_count++];
+  retired->buf = transport->output_buf;
+  retired->size = transport->output_size;
+  retired->pins = transport->output_pins;
+  transport->output_buf = buf;
+  transport->output_offset = 0;
+  transport->output_pins = 0;
+}
+
+static ssize_t pni_transport_produce(pn_transport_t *transport)
 {
   if (transport->head_closed) return PN_EOS;
 
-  ssize_t space = transport->output_size - transport->output_pending;
+  if (transport->compacted) {
+    // only take the buffers back once there is something to write
+    char probe[64];
+    ssize_t n = transport->io_layers[0]->process_output(transport, 0, probe, sizeof(probe));
+    if (n == 0) return 0;
+    if (n < 0) return pni_produce_eos(transport, n);
+    pni_transport_wake(transport);
+    memcpy(transport->output_buf, probe, n);
+    transport->output_pending = n;
+  }
 
-  if (space <= 0) {     // can we expand the buffer?
-    int more = 0;
-    if (!transport->remote_max_frame)   // no limit, so double it
-      more = transport->output_size;
-    else if (transport->remote_max_frame > transport->output_size)
-      more = pn_min(transport->output_size, transport->remote_max_frame - transport->output_size);
-    if (more) {
-      char *newbuf = (char *)realloc( transport->output_buf, transport->output_size + more );
-      if (newbuf) {
-        transport->output_buf = newbuf;
-        transport->output_size += more;
-        space += more;
-      }
-    }
+  ssize_t space = transport->output_size - transport->output_offset - transport->output_pending;
+
+  if (transport->output_offset && (size_t) space < transport->output_offset &&
+      transport->output_pins) {
+    pni_transport_retire_output(transport);
+    space = transport->output_size - transport->output_offset - transport->output_pending;
   }
 
+  if (transport->output_offset && (size_t) space < transport->output_offset &&
+      !transport->output_pins) {
+    // reclaim the room freed by pn_transport_pop
+    memmove(transport->output_buf, transport->output_buf + transport->output_offset,
+            transport->output_pending);
+    transport->output_offset = 0;
+    space = transport->output_size - transport->output_pending;
+  }
+
+  // frames are copied out in pieces, so the output buffer never needs to
+  // be bigger than it is and is left to drain instead
+
   while (space > 0) {
     ssize_t n;
     n = transport->io_layers[0]->
       process_output( transport, 0,
-                      &transport->output_buf[transport->output_pending],
+                      &transport->output_buf[transport->output_offset + transport->output_pending],
                       space );
     if (n > 0) {
       space -= n;
@@ -2421,19 +3435,29 @@ static ssize_t transport_produce(pn_transport_t *transport)
     } else {
       if (transport->output_pending)
         break;   // return what is available
-      if (transport->trace & (PN_TRACE_RAW | PN_TRACE_FRM)) {
-        if (n < 0) {
-          pn_transport_log(transport, "  -> EOS");
-        }
-      }
-      pni_close_head(transport);
-      return n;
+      return pni_produce_eos(transport, n);
     }
   }
 
   return transport->output_pending;
 }
 
+static ssize_t transport_produce(pn_transport_t *transport)
+{
+  if (transport->input_held) {
+    // e.g. amqp pipelined behind a sasl exchange that has been decided since
+    transport->input_held = false;
+    if (transport_consume(transport) == PN_EOS) {
+      pni_close_tail(transport);
+    }
+  }
+
+  PNI_PROBE1(produce_start, transport);
+  ssize_t n = pni_transport_produce(transport);
+  PNI_PROBE2(produce_done, transport, n);
+  return n;
+}
+
 // deprecated
 ssize_t pn_transport_output(pn_transport_t *transport, char *bytes, size_t size)
 {
@@ -2453,6 +3477,67 @@ void pn_transport_trace(pn_transport_t *transport, pn_trace_t trace)
   transport->trace = trace;
 }
 
+void pn_transport_trace_sample(pn_transport_t *transport, uint32_t n)
+{
+  assert(transport);
+  transport->trace_sample = n;
+}
+
+void pn_transport_trace_performatives(pn_transport_t *transport, uint32_t mask)
+{
+  assert(transport);
+  transport->trace_performatives = mask;
+}
+
+void pn_transport_trace_channel(pn_transport_t *transport, int channel)
+{
+  assert(transport);
+  transport->trace_channel = channel;
+}
+
+void pn_transport_trace_handle(pn_transport_t *transport, int64_t handle)
+{
+  assert(transport);
+  transport->trace_handle = handle;
+}
+
+void pn_transport_trace_errors(pn_transport_t *transport, bool errors)
+{
+  assert(transport);
+  transport->trace_errors = errors;
+}
+
+void pn_transport_set_frame_tracer(pn_transport_t *transport, pn_frame_tracer_t tracer)
+{
+  assert(transport);
+  transport->frame_tracer = tracer;
+}
+
+int pn_transport_capture(pn_transport_t *transport, const char *path)
+{
+  assert(transport);
+  pni_capture_free(transport->capture);
+  transport->capture = NULL;
+  if (!path) return 0;
+
+  uint32_t flags = transport->server ? PNI_CAPTURE_SERVER : 0;
+  if (transport->bytes_input || transport->bytes_output) flags |= PNI_CAPTURE_PARTIAL;
+  transport->capture = pni_capture(path, flags);
+  if (!transport->capture) return pn_i_error_from_errno(transport->error, "capture");
+  return 0;
+}
+
+static void pni_transport_capture(pn_transport_t *transport, pni_capture_dir_t dir,
+                                  const char *bytes, size_t size)
+{
+  if (pni_capture_append(transport->capture, dir, bytes, size)) {
+    // what was captured so far is still good, so keep it and stop
+    pn_transport_logf(transport, "capture stopped: %s", strerror(errno));
+    pni_capture_free(transport->capture);
+    transport->capture = NULL;
+  }
+}
+
 void pn_transport_set_tracer(pn_transport_t *transport, pn_tracer_t tracer)
 {
   assert(transport);
@@ -2488,6 +3573,10 @@ pn_record_t *pn_transport_attachments(pn_transport_t *transport)
 void pn_transport_log(pn_transport_t *transport, const char *message)
 {
   assert(transport);
+  if (transport->tracer == pni_default_tracer &&
+      pni_log_text(&transport->log_ring, transport, message)) {
+    return;
+  }
   transport->tracer(transport, message);
 }
 
@@ -2558,6 +3647,38 @@ pn_millis_t pn_transport_get_remote_idle_timeout(pn_transport_t *transport)
   return transport->remote_idle_timeout;
 }
 
+pn_millis_t pn_transport_get_compact_timeout(pn_transport_t *transport)
+{
+  return transport->compact_timeout;
+}
+
+void pn_transport_set_compact_timeout(pn_transport_t *transport, pn_millis_t timeout)
+{
+  transport->compact_timeout = timeout;
+  transport->compact_deadline = 0;
+}
+
+// compact once there has been no io for the compaction timeout and
+// nothing is left half read or half written
+static pn_timestamp_t pni_transport_compact_tick(pn_transport_t *transport, pn_timestamp_t now)
+{
+  if (!transport->compact_timeout || transport->compacted) return 0;
+  uint64_t bytes = transport->bytes_input + transport->bytes_output;
+  if (!transport->compact_deadline || bytes != transport->compact_bytes) {
+    transport->compact_deadline = now + transport->compact_timeout;
+    transport->compact_bytes = bytes;
+  } else if (transport->compact_deadline <= now) {
+    if (!transport->input_pending && !transport->output_pending && !transport->available &&
+        !pni_transport_output_pins(transport)) {
+      pni_transport_compact(transport);
+      transport->compact_deadline = 0;
+      return 0;
+    }
+    transport->compact_deadline = now + transport->compact_timeout;
+  }
+  return transport->compact_deadline;
+}
+
 pn_timestamp_t pn_transport_tick(pn_transport_t *transport, pn_timestamp_t now)
 {
   pn_timestamp_t r = 0;
@@ -2565,7 +3686,61 @@ pn_timestamp_t pn_transport_tick(pn_transport_t *transport, pn_timestamp_t now)
     if (transport->io_layers[i] && transport->io_layers[i]->process_tick)
       r = pn_timestamp_min(r, transport->io_layers[i]->process_tick(transport, i, now));
   }
-  return r;
+  return pn_timestamp_min(r, pni_transport_compact_tick(transport, now));
+}
+
+void pn_transport_metrics(pn_transport_t *transport, pn_transport_metrics_t *metrics)
+{
+  assert(transport);
+  *metrics = transport->metrics;
+  metrics->bytes_input = transport->bytes_input;
+  metrics->bytes_output = transport->bytes_output;
+  metrics->frames_input = transport->input_frames_ct;
+  metrics->frames_output = transport->output_frames_ct;
+}
+
+uint64_t pn_histogram_percentile(const pn_histogram_t *histogram, double percentile)
+{
+  if (!histogram->count) return 0;
+  uint64_t rank = (uint64_t) (histogram->count * percentile / 100);
+  if (rank >= histogram->count) rank = histogram->count - 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < PN_HISTOGRAM_BUCKETS - 1; i++) {
+    seen += histogram->buckets[i];
+    if (seen > rank) {
+      uint64_t bound = ((uint64_t) 2 << i) - 1;
+      return bound < histogram->max ? bound : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+static void pni_histogram_sum(pn_histogram_t *total, const pn_histogram_t *histogram)
+{
+  total->count += histogram->count;
+  total->sum += histogram->sum;
+  if (histogram->max > total->max) total->max = histogram->max;
+  for (int i = 0; i < PN_HISTOGRAM_BUCKETS; i++) {
+    total->buckets[i] += histogram->buckets[i];
+  }
+}
+
+void pn_transport_metrics_add(pn_transport_metrics_t *total, const pn_transport_metrics_t *metrics)
+{
+  total->bytes_input += metrics->bytes_input;
+  total->bytes_output += metrics->bytes_output;
+  total->frames_input += metrics->frames_input;
+  total->frames_output += metrics->frames_output;
+  pni_histogram_sum(&total->input_frame_sizes, &metrics->input_frame_sizes);
+  pni_histogram_sum(&total->output_frame_sizes, &metrics->output_frame_sizes);
+  if (metrics->input_high_water > total->input_high_water) {
+    total->input_high_water = metrics->input_high_water;
+  }
+  if (metrics->output_high_water > total->output_high_water) {
+    total->output_high_water = metrics->output_high_water;
+  }
+  total->process_count += metrics->process_count;
+  total->process_nanos += metrics->process_nanos;
 }
 
 uint64_t pn_transport_get_frames_output(const pn_transport_t *transport)
@@ -2587,22 +3762,32 @@ ssize_t pn_transport_capacity(pn_transport_t *transport)  /* <0 == done */
 {
   if (transport->tail_closed) return PN_EOS;
   //if (pn_error_code(transport->error)) return pn_error_code(transport->error);
-
-  ssize_t capacity = transport->input_size - transport->input_pending;
-  if ( capacity<=0 ) {
-    // can we expand the size of the input buffer?
-    int more = 0;
-    if (!transport->local_max_frame) {  // no limit (ha!)
-      more = transport->input_size;
-    } else if (transport->local_max_frame > transport->input_size) {
-      more = pn_min(transport->input_size, transport->local_max_frame - transport->input_size);
-    }
-    if (more) {
-      char *newbuf = (char *) realloc( transport->input_buf, transport->input_size + more );
+  // a compacted transport has a whole buffer free, it is allocated
+  // when the input is actually written to
+  if (transport->compacted) return PNI_IO_BUFFER_SIZE;
+
+  ssize_t capacity = transport->input_size - transport->input_offset - transport->input_pending;
+  if (transport->input_offset && (size_t) capacity < transport->input_offset) {
+    // more room has been consumed at the front than is left at the
+    // back, so move the partial frame down once rather than after
+    // every pass
+    memmove(transport->input_buf, transport->input_buf + transport->input_offset, transport->input_pending);
+    transport->input_offset = 0;
+    capacity = transport->input_size - transport->input_pending;
+  }
+  if (capacity <= 0) {
+    // a frame has to be whole to be decoded, so grow straight to the
+    // largest frame we accept, or keep doubling when there is no limit
+    size_t size = transport->local_max_frame ? transport->local_max_frame : 2*transport->input_size;
+    if (size > transport->input_size) {
+      char *newbuf = (char *) pni_malloc(PN_ALLOC_TRANSPORT, size);
       if (newbuf) {
+        memcpy(newbuf, transport->input_buf + transport->input_offset, transport->input_pending);
+        pni_io_release(transport, transport->input_buf, transport->input_size);
         transport->input_buf = newbuf;
-        transport->input_size += more;
-        capacity += more;
+        transport->input_size = size;
+        transport->input_offset = 0;
+        capacity = size - transport->input_pending;
       }
     }
   }
@@ -2612,8 +3797,9 @@ ssize_t pn_transport_capacity(pn_transport_t *transport)  /* <0 == done */
 
 char *pn_transport_tail(pn_transport_t *transport)
 {
-  if (transport && transport->input_pending < transport->input_size) {
-    return &transport->input_buf[transport->input_pending];
+  if (transport && !transport->tail_closed) pni_transport_wake(transport);
+  if (transport && transport->input_offset + transport->input_pending < transport->input_size) {
+    return &transport->input_buf[transport->input_offset + transport->input_pending];
   }
   return NULL;
 }
@@ -2644,9 +3830,12 @@ ssize_t pn_transport_push(pn_transport_t *transport, const char *src, size_t siz
 int pn_transport_process(pn_transport_t *transport, size_t size)
 {
   assert(transport);
-  size = pn_min( size, (transport->input_size - transport->input_pending) );
+  size = pn_min( size, (transport->input_size - transport->input_offset - transport->input_pending) );
   transport->input_pending += size;
   transport->bytes_input += size;
+  if (transport->input_pending > transport->metrics.input_high_water) {
+    transport->metrics.input_high_water = transport->input_pending;
+  }
 
   ssize_t n = transport_consume( transport );
   if (n == PN_EOS) {
@@ -2676,7 +3865,7 @@ ssize_t pn_transport_pending(pn_transport_t *transport)      /* <0 == done */
 const char *pn_transport_head(pn_transport_t *transport)
 {
   if (transport && transport->output_pending) {
-    return transport->output_buf;
+    return transport->output_buf + transport->output_offset;
   }
   return NULL;
 }
@@ -2707,9 +3896,11 @@ void pn_transport_pop(pn_transport_t *transport, size_t size)
     assert( transport->output_pending >= size );
     transport->output_pending -= size;
     transport->bytes_output += size;
-    if (transport->output_pending) {
-      memmove( transport->output_buf,  &transport->output_buf[size],
-               transport->output_pending );
+    // whatever is left is moved down lazily by transport_produce
+    if (transport->output_pending || transport->output_pins) {
+      transport->output_offset += size;
+    } else {
+      transport->output_offset = 0;
     }
 
     if (!transport->output_pending && pn_transport_pending(transport) < 0) {
@@ -2718,6 +3909,45 @@ void pn_transport_pop(pn_transport_t *transport, size_t size)
   }
 }
 
+void pni_transport_pin_output(pn_transport_t *transport)
+{
+  transport->output_pins++;
+}
+
+void pni_transport_unpin_output(pn_transport_t *transport, uint32_t sends)
+{
+  // sends are done with in the order they were made, so the oldest
+  // buffers go first
+  size_t released = 0;
+  while (sends && released < transport->output_retired_count) {
+    pni_pinned_buffer_t *retired = &transport->output_retired[released];
+    uint32_t n = pn_min(sends, retired->pins);
+    retired->pins -= n;
+    sends -= n;
+    if (retired->pins) break;
+    pni_io_release(transport, retired->buf, retired->size);
+    released++;
+  }
+  if (released) {
+    transport->output_retired_count -= released;
+    memmove(transport->output_retired, transport->output_retired + released,
+            transport->output_retired_count*sizeof(pni_pinned_buffer_t));
+  }
+  transport->output_pins -= pn_min(sends, transport->output_pins);
+  if (!transport->output_pins && !transport->output_pending) {
+    transport->output_offset = 0;
+  }
+}
+
+uint32_t pni_transport_output_pins(pn_transport_t *transport)
+{
+  uint32_t pins = transport->output_pins;
+  for (size_t i = 0; i < transport->output_retired_count; i++) {
+    pins += transport->output_retired[i].pins;
+  }
+  return pins;
+}
+
 int pn_transport_close_head(pn_transport_t *transport)
 {
   ssize_t pending = pn_transport_pending(transport);
@@ -25,6 +25,10 @@
 void pn_delivery_map_init(pn_delivery_map_t *db, pn_sequence_t next);
 void pn_delivery_map_del(pn_delivery_map_t *db, pn_delivery_t *delivery);
 void pn_delivery_map_free(pn_delivery_map_t *db);
+void pn_alias_map_init(pn_alias_map_t *map, bool allocates);
+void pn_alias_map_free(pn_alias_map_t *map);
+void *pn_alias_map_get(pn_alias_map_t *map, uint32_t alias);
+void pn_alias_map_del(pn_alias_map_t *map, uint32_t alias);
 void pn_unmap_handle(pn_session_t *ssn, pn_link_t *link);
 void pn_unmap_channel(pn_transport_t *transport, pn_session_t *ssn);
 
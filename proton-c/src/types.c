@@ -28,3 +28,9 @@ pn_bytes_t pn_bytes(size_t size, const char *start)
   pn_bytes_t bytes = {size, start};
   return bytes;
 }
+
+pn_rwbytes_t pn_rwbytes(size_t size, char *start)
+{
+  pn_rwbytes_t bytes = {size, start};
+  return bytes;
+}
@@ -23,6 +23,7 @@
 #include "proton/object.h"
 #include "util.h"
 #include "platform.h"
+#include "alloc_private.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -30,11 +31,21 @@
 
 static char* copy(const char* str) {
     if (str ==  NULL) return NULL;
-    char *str2 = (char*)malloc(strlen(str)+1);
+    char *str2 = (char*)pni_malloc(PN_ALLOC_OBJECT, strlen(str)+1);
     if (str2) strcpy(str2, str);
     return str2;
 }
 
+static char* copy_bytes(pn_bytes_t part, bool decode) {
+    if (part.start == NULL) return NULL;
+    char *str = (char*)pni_malloc(PN_ALLOC_OBJECT, part.size+1);
+    if (!str) return NULL;
+    memcpy(str, part.start, part.size);
+    str[part.size] = '\0';
+    if (decode) pni_urldecode(str, str);
+    return str;
+}
+
 struct pn_url_t {
     char *scheme;
     char *username;
@@ -103,16 +114,14 @@ PN_EXTERN pn_url_t *pn_url_parse(const char *str) {
         return NULL;
 
     pn_url_t *url = pn_url();
-    char *str2 = copy(str);
-    pni_parse_url(str2, &url->scheme, &url->username, &url->password, &url->host, &url->port, &url->path);
-    url->scheme = copy(url->scheme);
-    url->username = copy(url->username);
-    url->password = copy(url->password);
-    url->host = (url->host && !*url->host) ? NULL : copy(url->host);
-    url->port = copy(url->port);
-    url->path = copy(url->path);
-
-    free(str2);
+    pni_url_parts_t parts;
+    pni_url_split(str, strlen(str), &parts);
+    url->scheme = copy_bytes(parts.scheme, false);
+    url->username = copy_bytes(parts.user, true);
+    url->password = copy_bytes(parts.pass, true);
+    url->host = parts.host.size ? copy_bytes(parts.host, pni_unix_scheme(url->scheme)) : NULL;
+    url->port = copy_bytes(parts.port, false);
+    url->path = copy_bytes(parts.path, false);
     return url;
 }
 
@@ -138,7 +147,12 @@ PN_EXTERN const char *pn_url_str(pn_url_t *url) {
         if (url->username) pn_string_addf(url->str, "%s", url->username);
         if (url->password) pn_string_addf(url->str, ":%s", url->password);
         if (url->username || url->password) pn_string_addf(url->str, "@");
-        if (url->host) {
+        if (url->host && pni_unix_scheme(url->scheme)) {
+            for (const char *c = url->host; *c; c++) {
+                if (*c == '/' || *c == '%') pn_string_addf(url->str, "%%%02X", *c);
+                else pn_string_addf(url->str, "%c", *c);
+            }
+        } else if (url->host) {
             if (strchr(url->host, ':')) pn_string_addf(url->str, "[%s]", url->host);
             else pn_string_addf(url->str, "%s", url->host);
         }
@@ -155,7 +169,7 @@ PN_EXTERN const char *pn_url_get_host(pn_url_t *url) { return url->host; }
 PN_EXTERN const char *pn_url_get_port(pn_url_t *url) { return url->port; }
 PN_EXTERN const char *pn_url_get_path(pn_url_t *url) { return url->path; }
 
-#define SET(part) free(url->part); url->part = copy(part); pn_string_clear(url->str)
+#define SET(part) pni_free(PN_ALLOC_OBJECT, url->part); url->part = copy(part); pn_string_clear(url->str)
 PN_EXTERN void pn_url_set_scheme(pn_url_t *url, const char *scheme) { SET(scheme); }
 PN_EXTERN void pn_url_set_username(pn_url_t *url, const char *username) { SET(username); }
 PN_EXTERN void pn_url_set_password(pn_url_t *url, const char *password) { SET(password); }
@@ -29,6 +29,7 @@
 #include <proton/error.h>
 #include <proton/types.h>
 #include "util.h"
+#include "alloc_private.h"
 
 ssize_t pn_quote_data(char *dst, size_t capacity, const char *src, size_t size)
 {
@@ -143,60 +144,100 @@ void pni_urldecode(const char *src, char *dst)
 // literal syntax). Otherwise it also cannot contain '@', ':', '/'
 // <host> is not optional but it can be null! If it is not present an empty string will be returned
 // <path> can contain any character
-void pni_parse_url(char *url, char **scheme, char **user, char **pass, char **host, char **port, char **path)
+// With a <scheme> ending in "+unix" <host> is the path of a local socket, with
+// any '/' in it escaped as %2F, and there is no <port>
+// The parts are views into url, absent parts have a NULL start, and
+// nothing is decoded, see pni_parse_url for that
+void pni_url_split(const char *url, size_t size, pni_url_parts_t *parts)
 {
+  memset(parts, 0, sizeof(*parts));
   if (!url) return;
 
-  char *slash = strchr(url, '/');
-
-  if (slash && slash>url) {
-    char *scheme_end = strstr(slash-1, "://");
+  const char *end = url + size;
+  const char *slash = (const char *) memchr(url, '/', size);
 
-    if (scheme_end && scheme_end<slash) {
-      *scheme_end = '\0';
-      *scheme = url;
-      url = scheme_end + 3;
-      slash = strchr(url, '/');
-    }
+  if (slash && slash > url && slash[-1] == ':' && slash + 1 < end && slash[1] == '/') {
+    parts->scheme = pn_bytes(slash - 1 - url, url);
+    url = slash + 2;
+    slash = (const char *) memchr(url, '/', end - url);
   }
 
   if (slash) {
-    *slash = '\0';
-    *path = slash + 1;
+    parts->path = pn_bytes(end - (slash + 1), slash + 1);
+    end = slash;
   }
 
-  char *at = strchr(url, '@');
+  const char *at = (const char *) memchr(url, '@', end - url);
   if (at) {
-    *at = '\0';
-    char *up = url;
-    *user = up;
-    url = at + 1;
-    char *colon = strchr(up, ':');
+    const char *colon = (const char *) memchr(url, ':', at - url);
     if (colon) {
-      *colon = '\0';
-      *pass = colon + 1;
+      parts->user = pn_bytes(colon - url, url);
+      parts->pass = pn_bytes(at - (colon + 1), colon + 1);
+    } else {
+      parts->user = pn_bytes(at - url, url);
     }
+    url = at + 1;
   }
 
-  *host = url;
-  char *open = (*url == '[') ? url : 0;
-  if (open) {
-    char *close = strchr(open, ']');
+  const char *host = url;
+  const char *host_end = NULL;
+  if (url < end && *url == '[') {
+    const char *close = (const char *) memchr(url, ']', end - url);
     if (close) {
-        *host = open + 1;
-        *close = '\0';
-        url = close + 1;
+      host = url + 1;
+      host_end = close;
+      url = close + 1;
     }
   }
 
-  char *colon = strchr(url, ':');
-  if (colon) {
-    *colon = '\0';
-    *port = colon + 1;
+  bool unix_scheme = false;
+  if (parts->scheme.start) {
+    static const char suffix[] = "+unix";
+    size_t n = sizeof(suffix) - 1;
+    unix_scheme = parts->scheme.size > n &&
+      !memcmp(parts->scheme.start + parts->scheme.size - n, suffix, n);
   }
+  if (!unix_scheme) {
+    const char *colon = (const char *) memchr(url, ':', end - url);
+    if (colon) {
+      parts->port = pn_bytes(end - (colon + 1), colon + 1);
+      if (!host_end) host_end = colon;
+    }
+  }
+  if (!host_end) host_end = end;
+  parts->host = pn_bytes(host_end - host, host);
+}
 
-  if (*user) pni_urldecode(*user, *user);
-  if (*pass) pni_urldecode(*pass, *pass);
+static char *pni_url_part(char *url, pn_bytes_t part, bool decode)
+{
+  if (!part.start) return NULL;
+  char *str = url + (part.start - url);
+  str[part.size] = '\0';
+  if (decode) pni_urldecode(str, str);
+  return str;
+}
+
+void pni_parse_url(char *url, char **scheme, char **user, char **pass, char **host, char **port, char **path)
+{
+  if (!url) return;
+
+  pni_url_parts_t parts;
+  pni_url_split(url, strlen(url), &parts);
+  // each part is followed by a separator or the end, so they can be
+  // terminated where they lie
+  *scheme = pni_url_part(url, parts.scheme, false);
+  *user = pni_url_part(url, parts.user, true);
+  *pass = pni_url_part(url, parts.pass, true);
+  *port = pni_url_part(url, parts.port, false);
+  *path = pni_url_part(url, parts.path, false);
+  *host = pni_url_part(url, parts.host, pni_unix_scheme(*scheme));
+}
+
+bool pni_unix_scheme(const char *scheme)
+{
+  static const char suffix[] = "+unix";
+  size_t len = scheme ? strlen(scheme) : 0;
+  return len >= sizeof(suffix) && !strcmp(scheme + len - (sizeof(suffix) - 1), suffix);
 }
 
 void pni_vfatal(const char *fmt, va_list ap)
@@ -241,7 +282,7 @@ bool pn_env_bool(const char *name)
 char *pn_strdup(const char *src)
 {
   if (src) {
-    char *dest = (char *) malloc((strlen(src)+1)*sizeof(char));
+    char *dest = (char *) pni_malloc(PN_ALLOC_OBJECT, (strlen(src)+1)*sizeof(char));
     if (!dest) return NULL;
     return strcpy(dest, src);
   } else {
@@ -257,7 +298,7 @@ char *pn_strndup(const char *src, size_t n)
       size++;
     }
 
-    char *dest = (char *) malloc(size + 1);
+    char *dest = (char *) pni_malloc(PN_ALLOC_OBJECT, size + 1);
     if (!dest) return NULL;
     strncpy(dest, src, n);
     dest[size] = '\0';
@@ -275,3 +316,95 @@ pn_timestamp_t pn_timestamp_min( pn_timestamp_t a, pn_timestamp_t b )
   return b;
 }
 
+
+static const uint32_t pni_sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define PNI_ROR(X, N) (((X) >> (N)) | ((X) << (32 - (N))))
+
+static void pni_sha256_block(pni_sha256_t *sha, const unsigned char *p)
+{
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t) p[4*i] << 24 | (uint32_t) p[4*i+1] << 16 | (uint32_t) p[4*i+2] << 8 | p[4*i+3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = PNI_ROR(w[i-15], 7) ^ PNI_ROR(w[i-15], 18) ^ (w[i-15] >> 3);
+    uint32_t s1 = PNI_ROR(w[i-2], 17) ^ PNI_ROR(w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+  uint32_t a = sha->state[0], b = sha->state[1], c = sha->state[2], d = sha->state[3];
+  uint32_t e = sha->state[4], f = sha->state[5], g = sha->state[6], h = sha->state[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = h + (PNI_ROR(e, 6) ^ PNI_ROR(e, 11) ^ PNI_ROR(e, 25)) + ((e & f) ^ (~e & g)) + pni_sha256_k[i] + w[i];
+    uint32_t t2 = (PNI_ROR(a, 2) ^ PNI_ROR(a, 13) ^ PNI_ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  sha->state[0] += a; sha->state[1] += b; sha->state[2] += c; sha->state[3] += d;
+  sha->state[4] += e; sha->state[5] += f; sha->state[6] += g; sha->state[7] += h;
+  pni_cleanse(w, sizeof(w));
+}
+
+void pni_sha256_init(pni_sha256_t *sha)
+{
+  static const uint32_t init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(sha->state, init, sizeof(init));
+  sha->length = 0;
+}
+
+void pni_sha256_update(pni_sha256_t *sha, const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  while (size) {
+    size_t used = sha->length % 64;
+    size_t n = pn_min(size, 64 - used);
+    memcpy(sha->block + used, p, n);
+    sha->length += n;
+    p += n;
+    size -= n;
+    if (used + n == 64) pni_sha256_block(sha, sha->block);
+  }
+}
+
+void pni_sha256_final(pni_sha256_t *sha, unsigned char digest[PNI_SHA256_SIZE])
+{
+  uint64_t bits = sha->length * 8;
+  unsigned char pad[72] = {0x80};
+  size_t used = sha->length % 64;
+  size_t n = (used < 56 ? 56 : 120) - used;
+  for (int i = 0; i < 8; i++) pad[n + i] = (unsigned char) (bits >> (56 - 8*i));
+  pni_sha256_update(sha, pad, n + 8);
+  for (int i = 0; i < 8; i++) {
+    digest[4*i] = (unsigned char) (sha->state[i] >> 24);
+    digest[4*i+1] = (unsigned char) (sha->state[i] >> 16);
+    digest[4*i+2] = (unsigned char) (sha->state[i] >> 8);
+    digest[4*i+3] = (unsigned char) sha->state[i];
+  }
+  pni_cleanse(sha, sizeof(*sha));
+}
+
+bool pni_equal_secret(const void *a, const void *b, size_t size)
+{
+  const unsigned char *x = (const unsigned char *) a;
+  const unsigned char *y = (const unsigned char *) b;
+  unsigned char diff = 0;
+  for (size_t i = 0; i < size; i++) diff |= x[i] ^ y[i];
+  return !diff;
+}
+
+void pni_cleanse(void *data, size_t size)
+{
+  volatile unsigned char *p = (volatile unsigned char *) data;
+  while (size--) *p++ = 0;
+}
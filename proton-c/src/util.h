@@ -32,8 +32,21 @@
 #include <sys/types.h>
 #include <proton/types.h>
 #include <proton/object.h>
+#include "alloc_private.h"
 
+typedef struct {
+  pn_bytes_t scheme;
+  pn_bytes_t user;
+  pn_bytes_t pass;
+  pn_bytes_t host;
+  pn_bytes_t port;
+  pn_bytes_t path;
+} pni_url_parts_t;
+
+PN_EXTERN void pni_url_split(const char *url, size_t size, pni_url_parts_t *parts);
+void pni_urldecode(const char *src, char *dst);
 PN_EXTERN void pni_parse_url(char *url, char **scheme, char **user, char **pass, char **host, char **port, char **path);
+PN_EXTERN bool pni_unix_scheme(const char *scheme);
 void pni_fatal(const char *fmt, ...);
 void pni_vfatal(const char *fmt, va_list ap);
 PN_EXTERN ssize_t pn_quote_data(char *dst, size_t capacity, const char *src, size_t size);
@@ -45,6 +58,23 @@ bool pni_eq_n_nocase(const char *a, const char *b, int len);
 bool pn_env_bool(const char *name);
 pn_timestamp_t pn_timestamp_min(pn_timestamp_t a, pn_timestamp_t b);
 
+// SHA-256, for the few places that need a digest without an ssl library
+#define PNI_SHA256_SIZE 32
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t length;
+  unsigned char block[64];
+} pni_sha256_t;
+
+void pni_sha256_init(pni_sha256_t *sha);
+void pni_sha256_update(pni_sha256_t *sha, const void *data, size_t size);
+void pni_sha256_final(pni_sha256_t *sha, unsigned char digest[PNI_SHA256_SIZE]);
+// compares without stopping at the first difference
+bool pni_equal_secret(const void *a, const void *b, size_t size);
+// zeroes memory holding a secret, where the compiler cannot drop it
+void pni_cleanse(void *data, size_t size);
+
 #define DIE_IFR(EXPR, STRERR)                                           \
   do {                                                                  \
     int __code__ = (EXPR);                                              \
@@ -110,16 +140,16 @@ char *pn_strndup(const char *src, size_t n);
 #define pn_min(X,Y) ((X) > (Y) ? (Y) : (X))
 #define pn_max(X,Y) ((X) < (Y) ? (Y) : (X))
 
-#define PN_ENSURE(ARRAY, CAPACITY, COUNT, TYPE)                 \
+#define PN_ENSURE(SUBSYSTEM, ARRAY, CAPACITY, COUNT, TYPE)       \
   while ((CAPACITY) < (COUNT)) {                                \
     (CAPACITY) = (CAPACITY) ? 2 * (CAPACITY) : 16;              \
-    (ARRAY) = (TYPE *) realloc((ARRAY), (CAPACITY) * sizeof (TYPE));    \
+    (ARRAY) = (TYPE *) pni_realloc(SUBSYSTEM, (ARRAY), (CAPACITY) * sizeof (TYPE)); \
   }                                                             \
 
-#define PN_ENSUREZ(ARRAY, CAPACITY, COUNT, TYPE)           \
+#define PN_ENSUREZ(SUBSYSTEM, ARRAY, CAPACITY, COUNT, TYPE)  \
   {                                                        \
     size_t _old_capacity = (CAPACITY);                     \
-    PN_ENSURE(ARRAY, CAPACITY, COUNT, TYPE);               \
+    PN_ENSURE(SUBSYSTEM, ARRAY, CAPACITY, COUNT, TYPE);    \
     memset((ARRAY) + _old_capacity, 0,                     \
            sizeof(TYPE)*((CAPACITY) - _old_capacity));     \
   }
@@ -0,0 +1,88 @@
+#ifndef _PROTON_SRC_WAKEUP_H
+#define _PROTON_SRC_WAKEUP_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A selectable fd that other threads can make readable, used by the
+ * reactor and messenger to interrupt a select. Where eventfd exists a
+ * single eventfd serves as both ends, otherwise it is a pipe.
+ *
+ * Signals are coalesced: once one is pending, further signals do not
+ * touch the fd until the owner clears the wakeup.
+ */
+
+typedef struct {
+  pn_socket_t fds[2];   // read and write ends, equal for an eventfd
+  void *volatile pending;
+} pni_wakeup_t;
+
+/** Create the wakeup's fds.
+ *
+ * @return 0 on success, or an error code also recorded on io
+ * @internal
+ */
+int pni_wakeup_init(pn_io_t *io, pni_wakeup_t *wakeup);
+void pni_wakeup_fini(pn_io_t *io, pni_wakeup_t *wakeup);
+
+/** The fd to select for reading on.
+ *
+ * @internal
+ */
+pn_socket_t pni_wakeup_fd(pni_wakeup_t *wakeup);
+
+/** Make the wakeup's fd readable, unless a signal is already pending.
+ *
+ * May be called from any thread.
+ *
+ * @return 0 on success, or an error code if the fd could not be written
+ * @internal
+ */
+int pni_wakeup_signal(pn_io_t *io, pni_wakeup_t *wakeup);
+
+/** Consume whatever has made the wakeup's fd readable.
+ *
+ * @internal
+ */
+void pni_wakeup_read(pn_io_t *io, pni_wakeup_t *wakeup);
+
+/** Clear the pending signal, so that the next signal writes the fd.
+ *
+ * Anything done by a thread before a signal that this clears is
+ * visible once it returns.
+ *
+ * @return true if a signal was pending
+ * @internal
+ */
+bool pni_wakeup_clear(pni_wakeup_t *wakeup);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* wakeup.h */
@@ -37,6 +37,11 @@
 #include <proton/selector.h>
 #include "iocp.h"
 #include "util.h"
+#include "thread.h"
+#include "wakeup.h"
+#include "listener.h"
+#include "socket_options.h"
+#include "resolver.h"
 
 #include <ctype.h>
 #include <errno.h>
@@ -68,6 +73,8 @@ struct pn_io_t {
   bool trace;
   bool wouldblock;
   iocp_t *iocp;
+  pn_socket_options_t *options;
+  pni_addr_cache_t *cache;
 };
 
 void pn_io_initialize(void *obj)
@@ -76,6 +83,8 @@ void pn_io_initialize(void *obj)
   io->error = pn_error();
   io->wouldblock = false;
   io->trace = pn_env_bool("PN_TRACE_DRV");
+  io->options = NULL;
+  io->cache = pni_addr_cache();
 
   /* Request WinSock 2.2 */
   WORD wsa_ver = MAKEWORD(2, 2);
@@ -93,6 +102,8 @@ void pn_io_finalize(void *obj)
   pn_io_t *io = (pn_io_t *) obj;
   pn_error_free(io->error);
   pn_free(io->iocp);
+  pn_decref(io->options);
+  pni_addr_cache_free(io->cache);
   WSACleanup();
 }
 
@@ -155,6 +166,48 @@ int pn_pipe(pn_io_t *io, pn_socket_t *dest)
   return n;
 }
 
+int pni_wakeup_init(pn_io_t *io, pni_wakeup_t *wakeup)
+{
+  wakeup->pending = NULL;
+  wakeup->fds[0] = wakeup->fds[1] = PN_INVALID_SOCKET;
+  return pn_pipe(io, wakeup->fds);
+}
+
+void pni_wakeup_fini(pn_io_t *io, pni_wakeup_t *wakeup)
+{
+  for (int i = 0; i < 2; i++) {
+    if (wakeup->fds[i] != PN_INVALID_SOCKET) {
+      pn_close(io, wakeup->fds[i]);
+      wakeup->fds[i] = PN_INVALID_SOCKET;
+    }
+  }
+}
+
+pn_socket_t pni_wakeup_fd(pni_wakeup_t *wakeup)
+{
+  return wakeup->fds[0];
+}
+
+int pni_wakeup_signal(pn_io_t *io, pni_wakeup_t *wakeup)
+{
+  if (pni_atomic_exchange(&wakeup->pending, wakeup)) {
+    return 0;
+  }
+  ssize_t n = pn_write(io, wakeup->fds[1], "x", 1);
+  return n < 0 ? PN_ERR : 0;
+}
+
+void pni_wakeup_read(pn_io_t *io, pni_wakeup_t *wakeup)
+{
+  char buf[64];
+  pn_read(io, wakeup->fds[0], buf, sizeof(buf));
+}
+
+bool pni_wakeup_clear(pni_wakeup_t *wakeup)
+{
+  return pni_atomic_exchange(&wakeup->pending, NULL) != NULL;
+}
+
 static void pn_configure_sock(pn_io_t *io, pn_socket_t sock) {
   //
   // Disable the Nagle algorithm on TCP connections.
@@ -170,6 +223,43 @@ static void pn_configure_sock(pn_io_t *io, pn_socket_t sock) {
   }
 }
 
+pn_socket_options_t *pn_io_get_socket_options(pn_io_t *io)
+{
+  assert(io);
+  return io->options;
+}
+
+void pn_io_set_socket_options(pn_io_t *io, pn_socket_options_t *options)
+{
+  assert(io);
+  pn_incref(options);
+  pn_decref(io->options);
+  io->options = options;
+}
+
+static int pni_setsockopt(pn_io_t *io, pn_socket_t sock, int level, int name, int value)
+{
+  if (setsockopt(sock, level, name, (const char *) &value, sizeof(value)) == SOCKET_ERROR) {
+    return pni_win32_error(io->error, "setsockopt", WSAGetLastError());
+  }
+  return 0;
+}
+
+// Windows has no quickack, cork, notsent_lowat, busy_poll or zerocopy, and sets
+// keepalive timing per socket only through WSAIoctl, so those are left
+// to the system
+int pn_socket_options_apply(pn_io_t *io, pn_socket_options_t *options, pn_socket_t sock)
+{
+  assert(io);
+  int err = 0;
+  if (!options) return 0;
+  if (options->send_buffer >= 0 && pni_setsockopt(io, sock, SOL_SOCKET, SO_SNDBUF, options->send_buffer)) err = PN_ERR;
+  if (options->receive_buffer >= 0 && pni_setsockopt(io, sock, SOL_SOCKET, SO_RCVBUF, options->receive_buffer)) err = PN_ERR;
+  if (options->nodelay >= 0 && pni_setsockopt(io, sock, IPPROTO_TCP, TCP_NODELAY, options->nodelay)) err = PN_ERR;
+  if (options->keepalive >= 0 && pni_setsockopt(io, sock, SOL_SOCKET, SO_KEEPALIVE, options->keepalive)) err = PN_ERR;
+  return err;
+}
+
 static inline pn_socket_t pni_create_socket(int domain);
 
 pn_socket_t pn_listen(pn_io_t *io, const char *host, const char *port)
@@ -196,6 +286,8 @@ pn_socket_t pn_listen(pn_io_t *io, const char *host, const char *port)
     return INVALID_SOCKET;
   }
 
+  pn_socket_options_apply(io, io->options, sock);
+
   if (bind(sock, addr->ai_addr, addr->ai_addrlen) == -1) {
     pni_win32_error(io->error, "bind", WSAGetLastError());
     freeaddrinfo(addr);
@@ -204,7 +296,7 @@ pn_socket_t pn_listen(pn_io_t *io, const char *host, const char *port)
   }
   freeaddrinfo(addr);
 
-  if (listen(sock, 50) == -1) {
+  if (listen(sock, SOMAXCONN) == -1) {
     pni_win32_error(io->error, "listen", WSAGetLastError());
     closesocket(sock);
     return INVALID_SOCKET;
@@ -223,17 +315,112 @@ pn_socket_t pn_listen(pn_io_t *io, const char *host, const char *port)
   return sock;
 }
 
+// SO_REUSEADDR on Windows lets a socket steal a bound address rather
+// than share its accept queue, so listeners are never shared
+pn_socket_t pni_listen_shareable(pn_io_t *io, const char *host, const char *port)
+{
+  return pn_listen(io, host, port);
+}
+
+pn_socket_t pni_listen_share(pn_io_t *io, pn_socket_t listener)
+{
+  pn_error_format(io->error, PN_ERR, "pni_listen_share: not supported");
+  return INVALID_SOCKET;
+}
+
+int pni_listen_steer(pn_io_t *io, pn_socket_t listener, int cpu)
+{
+  return pn_error_format(io->error, PN_ERR, "pni_listen_steer: not supported");
+}
+
+pni_addr_cache_t *pni_io_addr_cache(pn_io_t *io)
+{
+  return io->cache;
+}
+
+pn_millis_t pn_io_get_resolve_ttl(pn_io_t *io)
+{
+  assert(io);
+  return pni_addr_cache_get_ttl(io->cache);
+}
+
+void pn_io_set_resolve_ttl(pn_io_t *io, pn_millis_t ttl)
+{
+  assert(io);
+  pni_addr_cache_set_ttl(io->cache, ttl);
+}
+
+bool pni_numeric_host(const char *host)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_flags = AI_NUMERICHOST;
+  struct addrinfo *addr;
+  if (getaddrinfo(host, NULL, &hints, &addr)) return false;
+  freeaddrinfo(addr);
+  return true;
+}
+
+int pni_resolve_host(const char *host, char *numeric, size_t size, char *error, size_t esize)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *addr;
+  int code = getaddrinfo(host, NULL, &hints, &addr);
+  if (!code) {
+    code = getnameinfo(addr->ai_addr, addr->ai_addrlen, numeric, size, NULL, 0, NI_NUMERICHOST);
+    freeaddrinfo(addr);
+  }
+  if (code) {
+    snprintf(error, esize, "getaddrinfo(%s): %s", host, gai_strerror(code));
+    return PN_ERR;
+  }
+  return 0;
+}
+
+// remember what a name resolved to, for the next connect
+static void pni_remember(pn_io_t *io, const char *host, struct addrinfo *addr)
+{
+  char numeric[PNI_NUMERIC_HOST_MAX];
+  if (!pni_addr_cache_get_ttl(io->cache)) return;
+  if (getnameinfo(addr->ai_addr, addr->ai_addrlen, numeric, sizeof(numeric), NULL, 0, NI_NUMERICHOST))
+    return;
+  if (strcmp(numeric, host))
+    pni_addr_cache_put(io->cache, host, numeric, pn_i_now());
+}
+
+pn_socket_t pn_listen_unix(pn_io_t *io, const char *path)
+{
+  pn_error_format(io->error, PN_ERR, "pn_listen_unix: not supported");
+  return INVALID_SOCKET;
+}
+
+pn_socket_t pn_connect_unix(pn_io_t *io, const char *path)
+{
+  pn_error_format(io->error, PN_ERR, "pn_connect_unix: not supported");
+  return INVALID_SOCKET;
+}
+
 pn_socket_t pn_connect(pn_io_t *io, const char *hostarg, const char *port)
+{
+  return pni_connect(io, hostarg, port, NULL);
+}
+
+pn_socket_t pni_connect(pn_io_t *io, const char *hostarg, const char *port, pn_socket_options_t *options)
 {
   // convert "0.0.0.0" to "127.0.0.1" on Windows for outgoing sockets
   const char *host = strcmp("0.0.0.0", hostarg) ? hostarg : "127.0.0.1";
 
+  char numeric[PNI_NUMERIC_HOST_MAX];
+  bool cached = pni_addr_cache_get(io->cache, host, pn_i_now(), numeric, sizeof(numeric));
   struct addrinfo *addr;
-  int code = getaddrinfo(host, port, NULL, &addr);
+  int code = getaddrinfo(cached ? numeric : host, port, NULL, &addr);
   if (code) {
     pn_error_format(io->error, PN_ERR, "getaddrinfo(%s, %s): %s", host, port, gai_strerror(code));
     return INVALID_SOCKET;
   }
+  if (!cached) pni_remember(io, host, addr);
 
   pn_socket_t sock = pni_create_socket(addr->ai_family);
   if (sock == INVALID_SOCKET) {
@@ -244,6 +431,8 @@ pn_socket_t pn_connect(pn_io_t *io, const char *hostarg, const char *port)
 
   ensure_unique(io, sock);
   pn_configure_sock(io, sock);
+  pn_socket_options_apply(io, io->options, sock);
+  pn_socket_options_apply(io, options, sock);
 
   if (io->iocp->selector) {
     return pni_iocp_begin_connect(io->iocp, sock, addr, io->error);
@@ -293,6 +482,7 @@ pn_socket_t pn_accept(pn_io_t *io, pn_socket_t listen_sock, char *name, size_t s
     return INVALID_SOCKET;
   } else {
     pn_configure_sock(io, accept_sock);
+    pn_socket_options_apply(io, io->options, accept_sock);
     snprintf(name, size, "%s:%s", io->host, io->serv);
     if (listend) {
       pni_iocpdesc_start(pni_iocpdesc_map_get(io->iocp, accept_sock));
@@ -321,6 +511,34 @@ ssize_t pn_send(pn_io_t *io, pn_socket_t sockfd, const void *buf, size_t len) {
   return count;
 }
 
+// IOCP writes already go from the buffer they were given
+ssize_t pni_send_zerocopy(pn_io_t *io, pn_socket_t socket, const void *buf, size_t size,
+                          bool *pinned)
+{
+  *pinned = false;
+  return pn_send(io, socket, buf, size);
+}
+
+bool pni_zerocopy_enabled(pn_io_t *io, pn_socket_t socket)
+{
+  return false;
+}
+
+uint32_t pni_zerocopy_reap(pn_io_t *io, pn_socket_t socket)
+{
+  return 0;
+}
+
+bool pni_kernel_tls_enabled(pn_io_t *io)
+{
+  return false;
+}
+
+ssize_t pni_recv_tls(pn_io_t *io, pn_socket_t socket, void *buf, size_t size)
+{
+  return pn_recv(io, socket, buf, size);
+}
+
 ssize_t pn_recv(pn_io_t *io, pn_socket_t socket, void *buf, size_t size)
 {
   ssize_t count;
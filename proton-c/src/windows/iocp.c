@@ -38,6 +38,7 @@
 #include <proton/transport.h>
 #include "iocp.h"
 #include "util.h"
+#include "alloc_private.h"
 #include <assert.h>
 
 /*
@@ -58,6 +59,29 @@
 // IPv6 addresses, even if the socket is IPv4. The 16 bytes padding
 // per address is required by AcceptEx.
 #define IOCP_SOCKADDRMAXLEN (sizeof(sockaddr_in6) + 16)
+
+// Max number of completions taken from the port in one call
+#define IOCP_COMPLETION_BATCH 64
+
+#ifndef FILE_SKIP_COMPLETION_PORT_ON_SUCCESS
+#define FILE_SKIP_COMPLETION_PORT_ON_SUCCESS 0x1
+#endif
+
+// Batched dequeue and skipping the port on synchronous success need
+// Vista or later, look them up at run time to keep working on XP.
+// iocp_entry_t has the layout of OVERLAPPED_ENTRY.
+typedef struct {
+  ULONG_PTR completion_key;
+  LPOVERLAPPED overlapped;
+  ULONG_PTR internal;
+  DWORD num_transferred;
+} iocp_entry_t;
+
+typedef BOOL (WINAPI *iocp_dequeue_ex_fn)(HANDLE, iocp_entry_t *, ULONG, PULONG, DWORD, BOOL);
+typedef BOOL (WINAPI *iocp_notification_modes_fn)(HANDLE, UCHAR);
+
+static iocp_dequeue_ex_fn fn_dequeue_ex;
+static iocp_notification_modes_fn fn_notification_modes;
 #define IOCP_SOCKADDRBUFLEN (2 * IOCP_SOCKADDRMAXLEN)
 
 static void iocp_log(const char *fmt, ...)
@@ -81,6 +105,7 @@ static void set_iocp_error_status(pn_error_t *error, int code, HRESULT status)
 }
 
 static void reap_check(iocpdesc_t *);
+static void complete_later(iocp_result_t *result);
 static void bind_to_completion_port(iocpdesc_t *iocpd);
 static void iocp_shutdown(iocpdesc_t *iocpd);
 static void start_reading(iocpdesc_t *iocpd);
@@ -163,7 +188,7 @@ typedef struct {
 } accept_result_t;
 
 static accept_result_t *accept_result(iocpdesc_t *listen_sock) {
-  accept_result_t *result = (accept_result_t *)calloc(1, sizeof(accept_result_t));
+  accept_result_t *result = (accept_result_t *)pni_calloc(PN_ALLOC_IO, 1, sizeof(accept_result_t));
   if (result) {
     result->base.type = IOCP_ACCEPT;
     result->base.iocpd = listen_sock;
@@ -200,7 +225,7 @@ static void pni_acceptor_finalize(void *object)
   pni_acceptor_t *acceptor = (pni_acceptor_t *) object;
   size_t len = pn_list_size(acceptor->accepts);
   for (size_t i = 0; i < len; i++)
-    free(pn_list_get(acceptor->accepts, i));
+    pni_free(PN_ALLOC_IO, pn_list_get(acceptor->accepts, i));
   pn_free(acceptor->accepts);
 }
 
@@ -222,7 +247,7 @@ static void begin_accept(pni_acceptor_t *acceptor, accept_result_t *result)
 {
   if (acceptor->listen_sock->closing) {
     if (result) {
-      free(result);
+      pni_free(PN_ALLOC_IO, result);
       acceptor->accept_queue_size--;
     }
     if (acceptor->accept_queue_size == 0)
@@ -260,6 +285,8 @@ static void begin_accept(pni_acceptor_t *acceptor, accept_result_t *result)
       acceptor->listen_sock->ops_in_progress++;
       // This socket is equally involved in the async operation.
       result->new_sock->ops_in_progress++;
+      if (success)
+        complete_later(&result->base);
     }
   } else {
     iocpdesc_fail(acceptor->listen_sock, WSAGetLastError(), "create accept socket");
@@ -273,7 +300,7 @@ static void complete_accept(accept_result_t *result, HRESULT status)
   if (ld->read_closed) {
     if (!result->new_sock->closing)
       pni_iocp_begin_close(result->new_sock);
-    free(result);    // discard
+    pni_free(PN_ALLOC_IO, result);    // discard
     reap_check(ld);
   } else {
     result->base.status = status;
@@ -412,6 +439,8 @@ pn_socket_t pni_iocp_begin_connect(iocp_t *iocp, pn_socket_t sock, struct addrin
       iocp_log("%s\n", pn_error_text(error));
   } else {
     iocpd->ops_in_progress++;
+    if (success)
+      complete_later(&result->base);
   }
   return sock;
 }
@@ -450,7 +479,7 @@ static bool write_in_progress(iocpdesc_t *iocpd)
 
 write_result_t *pni_write_result(iocpdesc_t *iocpd, const char *buf, size_t buflen)
 {
-  write_result_t *result = (write_result_t *) calloc(sizeof(write_result_t), 1);
+  write_result_t *result = (write_result_t *) pni_calloc(PN_ALLOC_IO, sizeof(write_result_t), 1);
   if (result) {
     result->base.type = IOCP_WRITE;
     result->base.iocpd = iocpd;
@@ -522,6 +551,8 @@ ssize_t pni_iocp_begin_write(iocpdesc_t *iocpd, const void *buf, size_t len, boo
       return SOCKET_ERROR;
     }
     iocpd->ops_in_progress++;
+    if (!werror)
+      complete_later(&result->base);
   }
 
   if (!pni_write_pipeline_writable(iocpd->pipeline))
@@ -577,7 +608,7 @@ struct read_result_t {
 
 static read_result_t *read_result(iocpdesc_t *iocpd)
 {
-  read_result_t *result = (read_result_t *) calloc(sizeof(read_result_t), 1);
+  read_result_t *result = (read_result_t *) pni_calloc(PN_ALLOC_IO, sizeof(read_result_t), 1);
   if (result) {
     result->base.type = IOCP_READ;
     result->base.iocpd = iocpd;
@@ -607,6 +638,8 @@ static void begin_zero_byte_read(iocpdesc_t *iocpd)
   }
   iocpd->ops_in_progress++;
   iocpd->read_in_progress = true;
+  if (!rc)
+    complete_later(&result->base);
 }
 
 static void drain_until_closed(iocpdesc_t *iocpd) {
@@ -682,18 +715,25 @@ ssize_t pni_iocp_recv(iocpdesc_t *iocpd, void *buf, size_t size, bool *would_blo
     return SOCKET_ERROR;
   }
 
-  size_t count = recv(iocpd->socket, (char *) buf, size, 0);
+  int count = recv(iocpd->socket, (char *) buf, size, 0);
   if (count > 0) {
-    pni_events_update(iocpd, iocpd->events & ~PN_READABLE);
-    begin_zero_byte_read(iocpd);
+    // A full buffer means more is likely waiting, so a busy socket stays
+    // readable and is read again directly. Only once it is drained does
+    // it go back to a zero byte read, which holds no buffer while idle.
+    if ((size_t) count < size) {
+      pni_events_update(iocpd, iocpd->events & ~PN_READABLE);
+      begin_zero_byte_read(iocpd);
+    }
     return count;
   } else if (count == 0) {
     iocpd->read_closed = true;
     return 0;
   }
-  if (WSAGetLastError() == WSAEWOULDBLOCK)
+  if (WSAGetLastError() == WSAEWOULDBLOCK) {
     *would_block = true;
-  else
+    pni_events_update(iocpd, iocpd->events & ~PN_READABLE);
+    begin_zero_byte_read(iocpd);
+  } else
     set_iocp_error_status(error, PN_ERR, WSAGetLastError());
   return SOCKET_ERROR;
 }
@@ -726,7 +766,7 @@ static void pni_iocpdesc_finalize(void *object)
   if (iocpd->read_in_progress)
     iocp_log("iocp descriptor read leak\n");
   else
-    free(iocpd->read_result);
+    pni_free(PN_ALLOC_IO, iocpd->read_result);
 }
 
 static uintptr_t pni_iocpdesc_hashcode(void *object)
@@ -811,9 +851,12 @@ static void bind_to_completion_port(iocpdesc_t *iocpd)
     return;
   }
 
-  if (CreateIoCompletionPort ((HANDLE) iocpd->socket, iocpd->iocp->completion_port, 0, 0))
+  if (CreateIoCompletionPort ((HANDLE) iocpd->socket, iocpd->iocp->completion_port, 0, 0)) {
     iocpd->bound = true;
-  else {
+    if (iocpd->iocp->skip_on_success &&
+        fn_notification_modes((HANDLE) iocpd->socket, FILE_SKIP_COMPLETION_PORT_ON_SUCCESS))
+      iocpd->skip_port = true;
+  } else {
     iocpdesc_fail(iocpd, GetLastError(), "IOCP socket setup.");
   }
 }
@@ -862,44 +905,104 @@ static void complete(iocp_result_t *result, bool success, DWORD num_transferred)
   }
 }
 
-void pni_iocp_drain_completions(iocp_t *iocp)
+// An overlapped operation that succeeds at once on a socket skipping
+// the port posts no completion, it is completed with the next batch
+// instead of inline so that completion handlers never nest.
+static void complete_later(iocp_result_t *result)
 {
-  while (true) {
-    DWORD timeout_ms = 0;
-    DWORD num_transferred = 0;
-    ULONG_PTR completion_key = 0;
-    OVERLAPPED *overlapped = 0;
-
-    bool good_op = GetQueuedCompletionStatus (iocp->completion_port, &num_transferred,
-                                               &completion_key, &overlapped, timeout_ms);
-    if (!overlapped)
-      return;  // timed out
-    iocp_result_t *result = (iocp_result_t *) overlapped;
-    complete(result, good_op, num_transferred);
+  iocp_t *iocp = result->iocpd->iocp;
+  if (!result->iocpd->skip_port) return;
+  result->completed_next = NULL;
+  if (iocp->completed_tail)
+    iocp->completed_tail->completed_next = result;
+  else
+    iocp->completed_head = result;
+  iocp->completed_tail = result;
+}
+
+static int complete_synchronous(iocp_t *iocp)
+{
+  int count = 0;
+  while (iocp->completed_head) {
+    iocp_result_t *result = iocp->completed_head;
+    iocp->completed_head = result->completed_next;
+    if (!iocp->completed_head)
+      iocp->completed_tail = NULL;
+    complete(result, true, (DWORD) result->overlapped.InternalHigh);
+    count++;
   }
+  return count;
 }
 
-// returns: -1 on error, 0 on timeout, 1 successful completion
-int pni_iocp_wait_one(iocp_t *iocp, int timeout, pn_error_t *error) {
-  DWORD win_timeout = (timeout < 0) ? INFINITE : (DWORD) timeout;
-  DWORD num_transferred = 0;
-  ULONG_PTR completion_key = 0;
-  OVERLAPPED *overlapped = 0;
-
-  bool good_op = GetQueuedCompletionStatus (iocp->completion_port, &num_transferred,
-                                            &completion_key, &overlapped, win_timeout);
-  if (!overlapped)
-    if (GetLastError() == WAIT_TIMEOUT)
+// Take up to a batch of completions from the port and complete them all
+// before the selector looks at events.
+// returns: -1 on error, 0 on timeout, else the number of completions
+static int dequeue_completions(iocp_t *iocp, DWORD timeout, pn_error_t *error)
+{
+  iocp_entry_t entries[IOCP_COMPLETION_BATCH];
+  ULONG count = 0;
+
+  if (fn_dequeue_ex) {
+    if (!fn_dequeue_ex(iocp->completion_port, entries, IOCP_COMPLETION_BATCH, &count, timeout, FALSE))
+      count = 0;
+  } else {
+    entries[0].overlapped = 0;
+    entries[0].num_transferred = 0;
+    BOOL good_op = GetQueuedCompletionStatus(iocp->completion_port, &entries[0].num_transferred,
+                                             &entries[0].completion_key, &entries[0].overlapped, timeout);
+    if (entries[0].overlapped) {
+      if (!good_op) {
+        // Failed operation: complete it here, GetLastError() has its status
+        complete((iocp_result_t *) entries[0].overlapped, false, entries[0].num_transferred);
+        return 1;
+      }
+      count = 1;
+    }
+  }
+  if (!count) {
+    DWORD status = GetLastError();
+    if (status == WAIT_TIMEOUT)
       return 0;
-    else {
-      if (error)
-        pni_win32_error(error, "GetQueuedCompletionStatus", GetLastError());
-      return -1;
+    if (error)
+      pni_win32_error(error, "GetQueuedCompletionStatus", status);
+    return -1;
+  }
+
+  for (ULONG i = 0; i < count; i++) {
+    iocp_result_t *result = (iocp_result_t *) entries[i].overlapped;
+    bool good_op = true;
+    DWORD num_transferred = entries[i].num_transferred;
+    if (result->overlapped.Internal) {
+      // Map the status for complete() via the thread's last error
+      DWORD flags;
+      good_op = WSAGetOverlappedResult(result->iocpd->socket, &result->overlapped,
+                                       &num_transferred, FALSE, &flags);
     }
+    complete(result, good_op, num_transferred);
+  }
+  return count;
+}
+
+void pni_iocp_drain_completions(iocp_t *iocp)
+{
+  while (true) {
+    complete_synchronous(iocp);
+    if (dequeue_completions(iocp, 0, NULL) < IOCP_COMPLETION_BATCH && !iocp->completed_head)
+      return;
+  }
+}
 
-  iocp_result_t *result = (iocp_result_t *) overlapped;
-  complete(result, good_op, num_transferred);
-  return 1;
+// returns: -1 on error, 0 on timeout, else the number of completions
+int pni_iocp_wait(iocp_t *iocp, int timeout, pn_error_t *error)
+{
+  int count = complete_synchronous(iocp);
+  if (count)
+    return count;
+  DWORD win_timeout = (timeout < 0) ? INFINITE : (DWORD) timeout;
+  count = dequeue_completions(iocp, win_timeout, error);
+  if (count > 0)
+    complete_synchronous(iocp);
+  return count;
 }
 
 // === Close (graceful and otherwise)
@@ -996,7 +1099,7 @@ static void drain_zombie_completions(iocp_t *iocp)
   while (pn_list_size(iocp->zombie_list)) {
     if (now >= deadline)
       break;
-    int rv = pni_iocp_wait_one(iocp, deadline - now, NULL);
+    int rv = pni_iocp_wait(iocp, deadline - now, NULL);
     if (rv < 0) {
       iocp_log("unexpected IOCP failure on Proton IO shutdown %d\n", GetLastError());
       break;
@@ -1122,6 +1225,30 @@ void pni_iocp_begin_close(iocpdesc_t *iocpd)
 
 // === iocp_t
 
+// Skipping the port on success is only safe when every installed TCP
+// provider hands out real kernel handles, layered providers that do not
+// can lose or duplicate completions when it is set.
+static bool ifs_providers_only(void)
+{
+  DWORD size = 0;
+  if (WSAEnumProtocols(NULL, NULL, &size) != SOCKET_ERROR || WSAGetLastError() != WSAENOBUFS)
+    return false;
+  WSAPROTOCOL_INFO *protocols = (WSAPROTOCOL_INFO *) pni_malloc(PN_ALLOC_IO, size);
+  if (!protocols)
+    return false;
+  bool ifs = true;
+  int count = WSAEnumProtocols(NULL, protocols, &size);
+  if (count == SOCKET_ERROR)
+    ifs = false;
+  for (int i = 0; i < count; i++) {
+    if (protocols[i].iProtocol == IPPROTO_TCP &&
+        !(protocols[i].dwServiceFlags1 & XP1_IFS_HANDLES))
+      ifs = false;
+  }
+  pni_free(PN_ALLOC_IO, protocols);
+  return ifs;
+}
+
 #define pni_iocp_hashcode NULL
 #define pni_iocp_compare NULL
 #define pni_iocp_inspect NULL
@@ -1137,6 +1264,13 @@ void pni_iocp_initialize(void *obj)
   iocp->zombie_list = pn_list(PN_OBJECT, 0);
   iocp->iocp_trace = pn_env_bool("PN_TRACE_DRV");
   iocp->selector = NULL;
+  HMODULE kernel32 = GetModuleHandleA("kernel32.dll");
+  if (kernel32) {
+    fn_dequeue_ex = (iocp_dequeue_ex_fn) GetProcAddress(kernel32, "GetQueuedCompletionStatusEx");
+    fn_notification_modes = (iocp_notification_modes_fn)
+      GetProcAddress(kernel32, "SetFileCompletionNotificationModes");
+  }
+  iocp->skip_on_success = fn_notification_modes && ifs_providers_only();
 }
 
 void pni_iocp_finalize(void *obj)
@@ -35,6 +35,7 @@ typedef struct write_result_t write_result_t;
 typedef struct read_result_t read_result_t;
 typedef struct write_pipeline_t write_pipeline_t;
 typedef struct iocpdesc_t iocpdesc_t;
+typedef struct iocp_result_t iocp_result_t;
 
 
 // One per pn_io_t.
@@ -48,9 +49,14 @@ struct iocp_t {
   write_result_t **shared_results;
   write_result_t **available_results;
   size_t shared_available_count;
+  char **idle_buffers;        // primary write buffers of idle sockets
+  size_t idle_buffer_count;
   size_t writer_count;
   int loopback_bufsize;
   bool iocp_trace;
+  bool skip_on_success;       // port notification skipped for synchronous completions
+  iocp_result_t *completed_head;  // synchronous completions not yet processed
+  iocp_result_t *completed_tail;
   pn_selector_t *selector;
 };
 
@@ -71,6 +77,7 @@ struct iocpdesc_t {
   read_result_t *read_result;
   bool external;       // true if socket set up outside Proton
   bool bound;          // associted with the completion port
+  bool skip_port;      // synchronous completions are not queued to the port
   bool closing;        // pn_close called by application
   bool read_closed;    // EOF or read error
   bool write_closed;   // shutdown sent or write error
@@ -90,12 +97,13 @@ struct iocpdesc_t {
 
 typedef enum { IOCP_ACCEPT, IOCP_CONNECT, IOCP_READ, IOCP_WRITE } iocp_type_t;
 
-typedef struct {
+struct iocp_result_t {
   OVERLAPPED overlapped;
   iocp_type_t type;
   iocpdesc_t *iocpd;
   HRESULT status;
-} iocp_result_t;
+  iocp_result_t *completed_next;
+};
 
 struct write_result_t {
   iocp_result_t base;
@@ -111,7 +119,7 @@ void pni_iocpdesc_map_del(iocp_t *, pn_socket_t s);
 void pni_iocpdesc_map_push(iocpdesc_t *iocpd);
 void pni_iocpdesc_start(iocpdesc_t *iocpd);
 void pni_iocp_drain_completions(iocp_t *);
-int pni_iocp_wait_one(iocp_t *, int timeout, pn_error_t *);
+int pni_iocp_wait(iocp_t *, int timeout, pn_error_t *);
 void pni_iocp_start_accepting(iocpdesc_t *iocpd);
 pn_socket_t pni_iocp_end_accept(iocpdesc_t *ld, sockaddr *addr, socklen_t *addrlen, bool *would_block, pn_error_t *error);
 pn_socket_t pni_iocp_begin_connect(iocp_t *, pn_socket_t sock, struct addrinfo *addr, pn_error_t *error);
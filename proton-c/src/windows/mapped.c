@@ -0,0 +1,218 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/error.h>
+#include <errno.h>
+#include <io.h>
+#include <stdio.h>
+#include <windows.h>
+#include "mapped.h"
+#include "alloc_private.h"
+
+// appended through a large stdio buffer rather than a mapping, which
+// costs about the same copy and a write every PNI_MAPPED_BUFFER bytes
+#define PNI_MAPPED_BUFFER (1024*1024)
+
+struct pni_mapped_t {
+  FILE *file;
+};
+
+pni_mapped_t *pni_mapped(const char *path)
+{
+  FILE *file = fopen(path, "wb");
+  if (!file) return NULL;
+  pni_mapped_t *mapped = (pni_mapped_t *) pni_malloc(PN_ALLOC_TRANSPORT, sizeof(pni_mapped_t));
+  if (!mapped) {
+    fclose(file);
+    errno = ENOMEM;
+    return NULL;
+  }
+  setvbuf(file, NULL, _IOFBF, PNI_MAPPED_BUFFER);
+  mapped->file = file;
+  return mapped;
+}
+
+int pni_mapped_append(pni_mapped_t *mapped, const char *bytes, size_t size)
+{
+  return fwrite(bytes, 1, size, mapped->file) == size ? 0 : PN_ERR;
+}
+
+int pni_mapped_sync(pni_mapped_t *mapped)
+{
+  if (fflush(mapped->file)) return PN_ERR;
+  return _commit(_fileno(mapped->file)) ? PN_ERR : 0;
+}
+
+void pni_mapped_close(pni_mapped_t *mapped)
+{
+  if (!mapped) return;
+  fclose(mapped->file);
+  pni_free(PN_ALLOC_TRANSPORT, mapped);
+}
+
+struct pni_view_t {
+  HANDLE mapping;
+  const char *start;
+  size_t size;
+};
+
+static void pni_view_errno(void)
+{
+  DWORD code = GetLastError();
+  errno = (code == ERROR_FILE_NOT_FOUND || code == ERROR_PATH_NOT_FOUND) ? ENOENT :
+          code == ERROR_ACCESS_DENIED ? EACCES :
+          code == ERROR_NOT_ENOUGH_MEMORY ? ENOMEM : EIO;
+}
+
+pni_view_t *pni_view(const char *path)
+{
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    pni_view_errno();
+    return NULL;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    pni_view_errno();
+    CloseHandle(file);
+    return NULL;
+  }
+  if ((uint64_t) size.QuadPart > (size_t) -1) {
+    CloseHandle(file);
+    errno = EFBIG;
+    return NULL;
+  }
+  pni_view_t *view = (pni_view_t *) pni_malloc(PN_ALLOC_IO, sizeof(pni_view_t));
+  if (!view) {
+    CloseHandle(file);
+    errno = ENOMEM;
+    return NULL;
+  }
+  view->mapping = NULL;
+  view->start = NULL;
+  view->size = (size_t) size.QuadPart;
+  // an empty file cannot be mapped, and need not be
+  if (view->size) {
+    view->mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (view->mapping) {
+      view->start = (const char *) MapViewOfFile(view->mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!view->start) {
+      pni_view_errno();
+      if (view->mapping) CloseHandle(view->mapping);
+      CloseHandle(file);
+      pni_free(PN_ALLOC_IO, view);
+      return NULL;
+    }
+  }
+  // the mapping outlives the file handle
+  CloseHandle(file);
+  return view;
+}
+
+pn_bytes_t pni_view_bytes(pni_view_t *view)
+{
+  return pn_bytes(view->size, view->start);
+}
+
+void pni_view_close(pni_view_t *view)
+{
+  if (!view) return;
+  if (view->start) UnmapViewOfFile(view->start);
+  if (view->mapping) CloseHandle(view->mapping);
+  pni_free(PN_ALLOC_IO, view);
+}
+
+// read into a buffer, a window at a time
+struct pni_file_range_t {
+  int fd;
+  int64_t offset;     // of the next byte to read
+  size_t remaining;
+  char *buf;
+};
+
+pni_file_range_t *pni_file_range(int fd, int64_t offset, size_t size)
+{
+  int64_t length = _filelengthi64(fd);
+  if (length < 0) return NULL;
+  if (offset < 0 || (uint64_t) length < (uint64_t) offset + size) {
+    errno = EINVAL;
+    return NULL;
+  }
+  pni_file_range_t *range = (pni_file_range_t *) pni_malloc(PN_ALLOC_IO, sizeof(pni_file_range_t));
+  if (!range) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  range->fd = _dup(fd);
+  if (range->fd < 0) {
+    int err = errno;
+    pni_free(PN_ALLOC_IO, range);
+    errno = err;
+    return NULL;
+  }
+  range->offset = offset;
+  range->remaining = size;
+  range->buf = NULL;
+  return range;
+}
+
+int pni_file_range_next(pni_file_range_t *range, pn_bytes_t *window)
+{
+  *window = pn_bytes(0, NULL);
+  if (!range->remaining) return 0;
+  if (!range->buf) {
+    range->buf = (char *) pni_malloc(PN_ALLOC_IO, PNI_MAPPED_BUFFER);
+    if (!range->buf) {
+      errno = ENOMEM;
+      return PN_ERR;
+    }
+  }
+  size_t n = range->remaining < PNI_MAPPED_BUFFER ? range->remaining : PNI_MAPPED_BUFFER;
+  if (_lseeki64(range->fd, range->offset, SEEK_SET) < 0) return PN_ERR;
+  size_t got = 0;
+  while (got < n) {
+    int r = _read(range->fd, range->buf + got, (unsigned int) (n - got));
+    if (r <= 0) {
+      if (!r) errno = EIO;
+      return PN_ERR;
+    }
+    got += r;
+  }
+  range->offset += n;
+  range->remaining -= n;
+  *window = pn_bytes(n, range->buf);
+  return 0;
+}
+
+size_t pni_file_range_remaining(pni_file_range_t *range)
+{
+  return range->remaining;
+}
+
+void pni_file_range_close(pni_file_range_t *range)
+{
+  if (!range) return;
+  _close(range->fd);
+  pni_free(PN_ALLOC_IO, range->buf);
+  pni_free(PN_ALLOC_IO, range);
+}
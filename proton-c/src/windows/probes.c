@@ -0,0 +1,43 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include "probes.h"
+
+// sessions enable the provider by its GUID, e.g.
+//   tracelog -start proton -guid #10b3babb-24d5-4b7b-a680-4188ea8ab7d7 -f proton.etl
+TRACELOGGING_DEFINE_PROVIDER(pni_probes, "Apache.Qpid.Proton",
+  (0x10b3babb, 0x24d5, 0x4b7b, 0xa6, 0x80, 0x41, 0x88, 0xea, 0x8a, 0xb7, 0xd7));
+
+static volatile LONG pni_probes_registered = 0;
+
+static void pni_probes_unregister(void)
+{
+  TraceLoggingUnregister(pni_probes);
+}
+
+void pni_probes_register(void)
+{
+  if (InterlockedCompareExchange(&pni_probes_registered, 1, 0) == 0) {
+    TraceLoggingRegister(pni_probes);
+    atexit(pni_probes_unregister);
+  }
+}
@@ -36,8 +36,10 @@
 #include <proton/engine.h>
 #include "engine/engine-internal.h"
 #include "platform.h"
+#include "probes.h"
 #include "util.h"
 #include "transport/autodetect.h"
+#include "alloc_private.h"
 
 #include <assert.h>
 
@@ -106,7 +108,7 @@ static void win_credential_finalize(void *object)
     CertCloseStore(c->trust_store, 0);
   if (c->server_CA_certs)
     CertCloseStore(c->server_CA_certs, 0);
-  free(c->trust_store_name);
+  pni_free(PN_ALLOC_TRANSPORT, c->trust_store_name);
 }
 
 static win_credential_t *win_credential(pn_ssl_mode_t m)
@@ -133,7 +135,7 @@ static int win_credential_load_cert(win_credential_t *cred, const char *store_na
   PCCERT_CONTEXT found_ctx = NULL;
   int cert_count = 0;
   int name_len = cert_name ? strlen(cert_name) : 0;
-  char *fn = name_len ? (char *) malloc(name_len + 1) : 0;
+  char *fn = name_len ? (char *) pni_malloc(PN_ALLOC_TRANSPORT, name_len + 1) : 0;
   while (tmpctx = CertEnumCertificatesInStore(cert_store, tmpctx)) {
     cert_count++;
     if (cert_name) {
@@ -168,7 +170,7 @@ static int win_credential_load_cert(win_credential_t *cred, const char *store_na
     ssl_log_error("Could not find certificate %s in store %s\n", cert_name, store_name);
   cred->cert_context = found_ctx;
 
-  free(fn);
+  pni_free(PN_ALLOC_TRANSPORT, fn);
   CertCloseStore(cert_store, 0);
   return found_ctx ? 0 : -8;
 }
@@ -222,6 +224,8 @@ static bool win_credential_has_certificate(win_credential_t *cred)
 
 #define SSL_DATA_SIZE 16384
 #define SSL_BUF_SIZE (SSL_DATA_SIZE + 5 + 2048 + 32)
+// the least app data worth building a record for in the caller's buffer
+#define DIRECT_DATA_MIN 4096
 
 typedef enum { UNKNOWN_CONNECTION, SSL_CONNECTION, CLEAR_CONNECTION } connection_mode_t;
 typedef struct pn_ssl_session_t pn_ssl_session_t;
@@ -401,8 +405,8 @@ static pn_ssl_session_t *ssn_cache_find( pn_ssl_domain_t *domain, const char *id
 static void ssl_session_free( pn_ssl_session_t *ssn)
 {
   if (ssn) {
-    if (ssn->id) free( (void *)ssn->id );
-    free( ssn );
+    if (ssn->id) pni_free(PN_ALLOC_TRANSPORT, (void *)ssn->id );
+    pni_free(PN_ALLOC_TRANSPORT, ssn );
   }
 }
 
@@ -416,7 +420,7 @@ bool pn_ssl_present(void)
 
 pn_ssl_domain_t *pn_ssl_domain( pn_ssl_mode_t mode )
 {
-  pn_ssl_domain_t *domain = (pn_ssl_domain_t *) calloc(1, sizeof(pn_ssl_domain_t));
+  pn_ssl_domain_t *domain = (pn_ssl_domain_t *) pni_calloc(PN_ALLOC_TRANSPORT, 1, sizeof(pn_ssl_domain_t));
   if (!domain) return NULL;
 
   domain->ref_count = 1;
@@ -428,7 +432,7 @@ pn_ssl_domain_t *pn_ssl_domain( pn_ssl_mode_t mode )
 
   default:
     ssl_log_error("Invalid mode for pn_ssl_mode_t: %d\n", mode);
-    free(domain);
+    pni_free(PN_ALLOC_TRANSPORT, domain);
     return NULL;
   }
   domain->cred = win_credential(mode);
@@ -441,7 +445,7 @@ void pn_ssl_domain_free( pn_ssl_domain_t *domain )
 
   if (--domain->ref_count == 0) {
     pn_decref(domain->cred);
-    free(domain);
+    pni_free(PN_ALLOC_TRANSPORT, domain);
   }
 }
 
@@ -629,6 +633,41 @@ int pn_ssl_init(pn_ssl_t *ssl0, pn_ssl_domain_t *domain, const char *session_id)
 }
 
 
+int pn_ssl_domain_set_session_cache_size(pn_ssl_domain_t *domain, size_t size)
+{
+  return -1;
+}
+
+uint64_t pn_ssl_domain_session_cache_hits(pn_ssl_domain_t *domain)
+{
+  return 0;
+}
+
+uint64_t pn_ssl_domain_session_cache_misses(pn_ssl_domain_t *domain)
+{
+  return 0;
+}
+
+int pn_ssl_domain_set_server_session_cache(pn_ssl_domain_t *domain, size_t size)
+{
+  return -1;
+}
+
+int pn_ssl_domain_add_session_ticket_key(pn_ssl_domain_t *domain, const char *key, size_t size)
+{
+  return -1;
+}
+
+int pn_ssl_domain_set_handshake_workers(pn_ssl_domain_t *domain, size_t count)
+{
+  return -1;
+}
+
+int pn_ssl_domain_set_kernel_tls(pn_ssl_domain_t *domain, bool enable)
+{
+  return -1;
+}
+
 int pn_ssl_domain_allow_unsecured_client(pn_ssl_domain_t *domain)
 {
   if (!domain) return -1;
@@ -707,13 +746,13 @@ void pn_ssl_free( pn_transport_t *transport)
   }
 
   if (ssl->domain) pn_ssl_domain_free(ssl->domain);
-  if (ssl->session_id) free((void *)ssl->session_id);
-  if (ssl->peer_hostname) free((void *)ssl->peer_hostname);
-  if (ssl->sc_inbuf) free((void *)ssl->sc_inbuf);
-  if (ssl->sc_outbuf) free((void *)ssl->sc_outbuf);
+  if (ssl->session_id) pni_free(PN_ALLOC_TRANSPORT, (void *)ssl->session_id);
+  if (ssl->peer_hostname) pni_free(PN_ALLOC_TRANSPORT, (void *)ssl->peer_hostname);
+  if (ssl->sc_inbuf) pni_free(PN_ALLOC_TRANSPORT, (void *)ssl->sc_inbuf);
+  if (ssl->sc_outbuf) pni_free(PN_ALLOC_TRANSPORT, (void *)ssl->sc_outbuf);
   if (ssl->inbuf2) pn_buffer_free(ssl->inbuf2);
 
-  free(ssl);
+  pni_free(PN_ALLOC_TRANSPORT, ssl);
 }
 
 pn_ssl_t *pn_ssl(pn_transport_t *transport)
@@ -721,27 +760,27 @@ pn_ssl_t *pn_ssl(pn_transport_t *transport)
   if (!transport) return NULL;
   if (transport->ssl) return (pn_ssl_t *)transport;
 
-  pni_ssl_t *ssl = (pni_ssl_t *) calloc(1, sizeof(pni_ssl_t));
+  pni_ssl_t *ssl = (pni_ssl_t *) pni_calloc(PN_ALLOC_TRANSPORT, 1, sizeof(pni_ssl_t));
   if (!ssl) return NULL;
   ssl->sc_out_size = ssl->sc_in_size = SSL_BUF_SIZE;
 
-  ssl->sc_outbuf = (char *)malloc(ssl->sc_out_size);
+  ssl->sc_outbuf = (char *)pni_malloc(PN_ALLOC_TRANSPORT, ssl->sc_out_size);
   if (!ssl->sc_outbuf) {
-    free(ssl);
+    pni_free(PN_ALLOC_TRANSPORT, ssl);
     return NULL;
   }
-  ssl->sc_inbuf = (char *)malloc(ssl->sc_in_size);
+  ssl->sc_inbuf = (char *)pni_malloc(PN_ALLOC_TRANSPORT, ssl->sc_in_size);
   if (!ssl->sc_inbuf) {
-    free(ssl->sc_outbuf);
-    free(ssl);
+    pni_free(PN_ALLOC_TRANSPORT, ssl->sc_outbuf);
+    pni_free(PN_ALLOC_TRANSPORT, ssl);
     return NULL;
   }
 
   ssl->inbuf2 = pn_buffer(0);
   if (!ssl->inbuf2) {
-    free(ssl->sc_inbuf);
-    free(ssl->sc_outbuf);
-    free(ssl);
+    pni_free(PN_ALLOC_TRANSPORT, ssl->sc_inbuf);
+    pni_free(PN_ALLOC_TRANSPORT, ssl->sc_outbuf);
+    pni_free(PN_ALLOC_TRANSPORT, ssl);
     return NULL;
   }
 
@@ -768,7 +807,7 @@ int pn_ssl_set_peer_hostname( pn_ssl_t *ssl0, const char *hostname )
   pni_ssl_t *ssl = get_ssl_internal(ssl0);
   if (!ssl) return -1;
 
-  if (ssl->peer_hostname) free((void *)ssl->peer_hostname);
+  if (ssl->peer_hostname) pni_free(PN_ALLOC_TRANSPORT, (void *)ssl->peer_hostname);
   ssl->peer_hostname = NULL;
   if (hostname) {
     ssl->peer_hostname = pn_strdup(hostname);
@@ -808,15 +847,24 @@ const char *tls_version_check(pni_ssl_t *ssl)
     "peer does not support TLS 1.0 security" : NULL;
 }
 
-static void ssl_encrypt(pn_transport_t *transport, char *app_data, size_t count)
+// the length of the TLS record starting at data, header included
+static size_t tls_record_size(const char *data)
+{
+  return ((unsigned char) data[3] << 8 | (unsigned char) data[4]) + 5;
+}
+
+// Encrypt the count bytes of app data that follow the header space at
+// the front of record, returning the length of the finished record.
+static size_t ssl_encrypt(pn_transport_t *transport, char *record, size_t count)
 {
   pni_ssl_t *ssl = transport->ssl;
+  char *app_data = record + ssl->sc_sizes.cbHeader;
 
   // Get SChannel to encrypt exactly one Record.
   SecBuffer buffs[4];
   buffs[0].cbBuffer = ssl->sc_sizes.cbHeader;
   buffs[0].BufferType = SECBUFFER_STREAM_HEADER;
-  buffs[0].pvBuffer = ssl->sc_outbuf;
+  buffs[0].pvBuffer = record;
   buffs[1].cbBuffer = count;
   buffs[1].BufferType = SECBUFFER_DATA;
   buffs[1].pvBuffer = app_data;
@@ -830,20 +878,23 @@ static void ssl_encrypt(pn_transport_t *transport, char *app_data, size_t count)
   buff_desc.ulVersion = SECBUFFER_VERSION;
   buff_desc.cBuffers = 4;
   buff_desc.pBuffers = buffs;
+  PNI_PROBE2(ssl_encrypt_start, transport, count);
   SECURITY_STATUS status = EncryptMessage(&ssl->ctxt_handle, 0, &buff_desc, 0);
+  PNI_PROBE2(ssl_encrypt_done, transport, status);
   assert(status == SEC_E_OK);
 
   // EncryptMessage encrypts the data in place. The header and trailer
   // areas were reserved previously and must now be included in the updated
   // count of bytes to write to the peer.
-  ssl->sc_out_count = buffs[0].cbBuffer + buffs[1].cbBuffer + buffs[2].cbBuffer;
-  ssl->network_outp = ssl->sc_outbuf;
-  ssl->network_out_pending = ssl->sc_out_count;
-  ssl_log(transport, "ssl_encrypt %d network bytes\n", ssl->network_out_pending);
+  size_t size = buffs[0].cbBuffer + buffs[1].cbBuffer + buffs[2].cbBuffer;
+  ssl_log(transport, "ssl_encrypt %d network bytes\n", (int) size);
+  return size;
 }
 
-// Returns true if decryption succeeded (even for empty content)
-static bool ssl_decrypt(pn_transport_t *transport)
+// Returns true if decryption succeeded (even for empty content).  The
+// data is normally sc_inbuf, but may be a whole record still sitting in
+// the transport's input.
+static bool ssl_decrypt(pn_transport_t *transport, char *data, size_t count)
 {
   pni_ssl_t *ssl = transport->ssl;
   // Get SChannel to decrypt input.  May have an incomplete Record,
@@ -851,9 +902,9 @@ static bool ssl_decrypt(pn_transport_t *transport)
   // session renegotiation.
 
   SecBuffer recv_buffs[4];
-  recv_buffs[0].cbBuffer = ssl->sc_in_count;
+  recv_buffs[0].cbBuffer = count;
   recv_buffs[0].BufferType = SECBUFFER_DATA;
-  recv_buffs[0].pvBuffer = ssl->sc_inbuf;
+  recv_buffs[0].pvBuffer = data;
   recv_buffs[1].BufferType = SECBUFFER_EMPTY;
   recv_buffs[2].BufferType = SECBUFFER_EMPTY;
   recv_buffs[3].BufferType = SECBUFFER_EMPTY;
@@ -861,7 +912,9 @@ static bool ssl_decrypt(pn_transport_t *transport)
   buff_desc.ulVersion = SECBUFFER_VERSION;
   buff_desc.cBuffers = 4;
   buff_desc.pBuffers = recv_buffs;
+  PNI_PROBE2(ssl_decrypt_start, transport, count);
   SECURITY_STATUS status = DecryptMessage(&ssl->ctxt_handle, &buff_desc, 0, NULL);
+  PNI_PROBE2(ssl_decrypt_done, transport, status);
 
   if (status == SEC_E_INCOMPLETE_MESSAGE) {
     // Less than a full Record, come back later with more network data
@@ -911,6 +964,29 @@ static bool ssl_decrypt(pn_transport_t *transport)
   return true;
 }
 
+// The record buffers start out big enough for the handshake, and grow
+// to whatever the negotiated stream sizes call for.
+static bool size_record_buffers(pni_ssl_t *ssl, size_t max)
+{
+  if (max > ssl->sc_out_size) {
+    size_t outp = ssl->network_outp ? ssl->network_outp - ssl->sc_outbuf : 0;
+    char *buf = (char *) pni_realloc(PN_ALLOC_TRANSPORT, ssl->sc_outbuf, max);
+    if (!buf) return false;
+    if (ssl->network_outp) ssl->network_outp = buf + outp;
+    ssl->sc_outbuf = buf;
+    ssl->sc_out_size = max;
+  }
+  if (max > ssl->sc_in_size) {
+    size_t extra = ssl->inbuf_extra ? ssl->inbuf_extra - ssl->sc_inbuf : 0;
+    char *buf = (char *) pni_realloc(PN_ALLOC_TRANSPORT, ssl->sc_inbuf, max);
+    if (!buf) return false;
+    if (ssl->inbuf_extra) ssl->inbuf_extra = buf + extra;
+    ssl->sc_inbuf = buf;
+    ssl->sc_in_size = max;
+  }
+  return true;
+}
+
 static void client_handshake_init(pn_transport_t *transport)
 {
   pni_ssl_t *ssl = transport->ssl;
@@ -1051,8 +1127,8 @@ static void client_handshake( pn_transport_t* transport) {
     QueryContextAttributes(&ssl->ctxt_handle,
                              SECPKG_ATTR_STREAM_SIZES, &ssl->sc_sizes);
     max = ssl->sc_sizes.cbMaximumMessage + ssl->sc_sizes.cbHeader + ssl->sc_sizes.cbTrailer;
-    if (max > ssl->sc_out_size) {
-      ssl_log_error("Buffer size mismatch have %d, need %d\n", (int) ssl->sc_out_size, (int) max);
+    if (!size_record_buffers(ssl, max)) {
+      ssl_log_error("Buffer allocation failed, have %d, need %d\n", (int) ssl->sc_out_size, (int) max);
       ssl->state = SHUTTING_DOWN;
       ssl->app_input_closed = ssl->app_output_closed = PN_ERR;
       start_ssl_shutdown(transport);
@@ -1194,8 +1270,8 @@ static void server_handshake(pn_transport_t* transport)
     QueryContextAttributes(&ssl->ctxt_handle,
                              SECPKG_ATTR_STREAM_SIZES, &ssl->sc_sizes);
     max = ssl->sc_sizes.cbMaximumMessage + ssl->sc_sizes.cbHeader + ssl->sc_sizes.cbTrailer;
-    if (max > ssl->sc_out_size) {
-      ssl_log_error("Buffer size mismatch have %d, need %d\n", (int) ssl->sc_out_size, (int) max);
+    if (!size_record_buffers(ssl, max)) {
+      ssl_log_error("Buffer allocation failed, have %d, need %d\n", (int) ssl->sc_out_size, (int) max);
       ssl->state = SHUTTING_DOWN;
       ssl->app_input_closed = ssl->app_output_closed = PN_ERR;
       start_ssl_shutdown(transport);
@@ -1477,9 +1553,39 @@ static ssize_t process_input_ssl(pn_transport_t *transport, unsigned int layer,
     // i.e. no straggling decrypted bytes pending.
     assert(ssl->in_data_count == 0 && ssl->decrypting);
     new_app_input = false;
-    size_t count;
+    bool in_place = false;
+    size_t count = 0;
+
+    if (ssl->state == RUNNING && ssl->sc_in_count == 0 && available >= 5 &&
+        tls_record_size(input_data) <= _pni_min(available, ssl->sc_in_size)) {
+      // A whole record is already in the transport's input, so decrypt
+      // it where it is.  Whatever the app leaves of it is double
+      // buffered below, before the input is given back.
+      size_t rec_len = tls_record_size(input_data);
+      ssl->sc_in_incomplete = false;
+      bool decrypted = ssl_decrypt(transport, const_cast<char *>(input_data), rec_len);
+      if (!ssl->sc_in_incomplete) {
+        size_t used = rec_len - ssl->extra_count;
+        ssl->inbuf_extra = 0;
+        ssl->extra_count = 0;
+        input_data += used;
+        available -= used;
+        consumed += used;
+        if (decrypted) {
+          if (ssl->in_data_size > 0) {
+            new_app_input = true;
+            app_inbytes_add(transport);
+          } else {
+            rewind_sc_inbuf(ssl);
+          }
+        }
+        in_place = true;
+      }
+    }
 
-    if (ssl->state != RUNNING) {
+    if (in_place) {
+      // nothing to copy
+    } else if (ssl->state != RUNNING) {
       count = _pni_min(ssl->sc_in_size - ssl->sc_in_count, available);
     } else {
       // look for TLS record boundaries
@@ -1518,11 +1624,11 @@ static ssize_t process_input_ssl(pn_transport_t *transport, unsigned int layer,
 
     // Try to decrypt another TLS Record.
 
-    if (ssl->sc_in_count > 0 && ssl->state <= SHUTTING_DOWN) {
+    if (!in_place && ssl->sc_in_count > 0 && ssl->state <= SHUTTING_DOWN) {
       if (ssl->state == NEGOTIATING) {
         ssl_handshake(transport);
       } else {
-        if (ssl_decrypt(transport)) {
+        if (ssl_decrypt(transport, ssl->sc_inbuf, ssl->sc_in_count)) {
           // Ignore TLS Record with 0 length data (does not mean EOS)
           if (ssl->in_data_size > 0) {
             new_app_input = true;
@@ -1621,11 +1727,16 @@ static ssize_t process_output_ssl( pn_transport_t *transport, unsigned int layer
     }
 
     if (ssl->network_out_pending == 0 && ssl->state == RUNNING  && !ssl->app_output_closed) {
-      // refill the buffer with app data and encrypt it
-
-      char *app_data = ssl->sc_outbuf + ssl->sc_sizes.cbHeader;
+      // refill the buffer with app data and encrypt it.  When a decent
+      // sized record fits in the caller's buffer it is built right
+      // there, otherwise in sc_outbuf to be copied out.
+
+      size_t overhead = ssl->sc_sizes.cbHeader + ssl->sc_sizes.cbTrailer;
+      bool direct = max_len >= overhead + _pni_min(ssl->max_data_size, DIRECT_DATA_MIN);
+      char *record = direct ? buffer : ssl->sc_outbuf;
+      char *app_data = record + ssl->sc_sizes.cbHeader;
       char *app_outp = app_data;
-      size_t remaining = ssl->max_data_size;
+      size_t remaining = direct ? _pni_min(ssl->max_data_size, max_len - overhead) : ssl->max_data_size;
       ssize_t app_bytes;
       do {
         app_bytes = transport->io_layers[layer+1]->process_output(transport, layer+1, app_outp, remaining);
@@ -1649,8 +1760,17 @@ static ssize_t process_output_ssl( pn_transport_t *transport, unsigned int layer
         }
       } while (app_bytes > 0);
       if (app_outp > app_data) {
+        size_t size = ssl_encrypt(transport, record, app_outp - app_data);
+        if (direct) {
+          buffer += size;
+          max_len -= size;
+          written += size;
+        } else {
+          ssl->sc_out_count = size;
+          ssl->network_outp = ssl->sc_outbuf;
+          ssl->network_out_pending = size;
+        }
         work_pending = (max_len > 0);
-        ssl_encrypt(transport, app_data, app_outp - app_data);
       }
     }
 
@@ -1749,12 +1869,12 @@ static HCERTSTORE open_cert_db(const char *store_name, const char *passwd, int *
     const DWORD file_size = GetFileSize(cert_file, NULL);
     char *buf = NULL;
     if (INVALID_FILE_SIZE != file_size)
-      buf = (char *) malloc(file_size);
+      buf = (char *) pni_malloc(PN_ALLOC_TRANSPORT, file_size);
     if (!buf || !ReadFile(cert_file, buf, file_size, &nread, NULL)
         || file_size != nread) {
       HRESULT status = GetLastError();
       CloseHandle(cert_file);
-      free(buf);
+      pni_free(PN_ALLOC_TRANSPORT, buf);
       ssl_log_error_status(status, "Reading the private key from file failed %s", store_name);
       *error = -5;
       return NULL;
@@ -1770,12 +1890,12 @@ static HCERTSTORE open_cert_db(const char *store_name, const char *passwd, int *
     if (passwd) {
       // convert passwd to null terminated wchar_t (Windows UCS2)
       pwlen = strlen(passwd);
-      pwUCS2 = (wchar_t *) calloc(pwlen + 1, sizeof(wchar_t));
+      pwUCS2 = (wchar_t *) pni_calloc(PN_ALLOC_TRANSPORT, pwlen + 1, sizeof(wchar_t));
       int nwc = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, passwd, pwlen, &pwUCS2[0], pwlen);
       if (!nwc) {
         ssl_log_error_status(GetLastError(), "Error converting password from UTF8");
-        free(buf);
-        free(pwUCS2);
+        pni_free(PN_ALLOC_TRANSPORT, buf);
+        pni_free(PN_ALLOC_TRANSPORT, pwUCS2);
         *error = -6;
         return NULL;
       }
@@ -1784,16 +1904,16 @@ static HCERTSTORE open_cert_db(const char *store_name, const char *passwd, int *
     cert_store = PFXImportCertStore(&blob, pwUCS2, 0);
     if (pwUCS2) {
       SecureZeroMemory(pwUCS2, pwlen * sizeof(wchar_t));
-      free(pwUCS2);
+      pni_free(PN_ALLOC_TRANSPORT, pwUCS2);
     }
     if (cert_store == NULL) {
       ssl_log_error_status(GetLastError(), "Failed to import the file based certificate store");
-      free(buf);
+      pni_free(PN_ALLOC_TRANSPORT, buf);
       *error = -7;
       return NULL;
     }
 
-    free(buf);
+    pni_free(PN_ALLOC_TRANSPORT, buf);
   }
 
   return cert_store;
@@ -1873,7 +1993,7 @@ static char* wide_to_utf8(LPWSTR wstring)
     ssl_log_error_status(GetLastError(), "converting UCS2 to UTF8");
     return NULL;
   }
-  char *p = (char *) malloc(len);
+  char *p = (char *) pni_malloc(PN_ALLOC_TRANSPORT, len);
   if (!p) return NULL;
   if (WideCharToMultiByte(CP_UTF8, 0, wstring, -1, p, len, 0, 0))
     return p;
@@ -1904,7 +2024,7 @@ static bool server_name_matches(const char *server_name, CERT_EXTENSION *alt_nam
         char *alt_name = wide_to_utf8(alt_name_info->rgAltEntry[i].pwszDNSName);
         if (alt_name) {
           matched = match_dns_pattern(server_name, (const char *) alt_name, strlen(alt_name));
-          free(alt_name);
+          pni_free(PN_ALLOC_TRANSPORT, alt_name);
         }
       }
     }
@@ -1914,12 +2034,12 @@ static bool server_name_matches(const char *server_name, CERT_EXTENSION *alt_nam
   if (!matched) {
     PCERT_INFO info = cert->pCertInfo;
     DWORD len = CertGetNameString(cert, CERT_NAME_ATTR_TYPE, 0, szOID_COMMON_NAME, 0, 0);
-    char *name = (char *) malloc(len);
+    char *name = (char *) pni_malloc(PN_ALLOC_TRANSPORT, len);
     if (name) {
       int count = CertGetNameString(cert, CERT_NAME_ATTR_TYPE, 0, szOID_COMMON_NAME, name, len);
       if (count)
         matched = match_dns_pattern(server_name, (const char *) name, strlen(name));
-      free(name);
+      pni_free(PN_ALLOC_TRANSPORT, name);
     }
   }
   return matched;
@@ -2074,7 +2194,7 @@ static HRESULT verify_peer(pni_ssl_t *ssl, HCERTSTORE root_store, const char *se
 
     if (server_name) {
       int len = strlen(server_name);
-      nameUCS2 = (wchar_t *) calloc(len + 1, sizeof(wchar_t));
+      nameUCS2 = (wchar_t *) pni_calloc(PN_ALLOC_TRANSPORT, len + 1, sizeof(wchar_t));
       int nwc = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, server_name, len, &nameUCS2[0], len);
       if (!nwc) {
         error = GetLastError();
@@ -2151,6 +2271,6 @@ static HRESULT verify_peer(pni_ssl_t *ssl, HCERTSTORE root_store, const char *se
     CertFreeCertificateContext(trust_anchor);
   if (chain_context)
     CertFreeCertificateChain(chain_context);
-  free(nameUCS2);
+  pni_free(PN_ALLOC_TRANSPORT, nameUCS2);
   return error;
 }
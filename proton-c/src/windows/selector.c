@@ -254,7 +254,7 @@ int pn_selector_select(pn_selector_t *selector, int timeout)
       completion_deadline = completion_deadline ? pn_min(zd, completion_deadline) : zd;
 
     int completion_timeout = (!completion_deadline) ? -1 : completion_deadline - now;
-    int rv = pni_iocp_wait_one(selector->iocp, completion_timeout, selector->error);
+    int rv = pni_iocp_wait(selector->iocp, completion_timeout, selector->error);
     if (rv < 0)
       return pn_error_code(selector->error);
 
@@ -0,0 +1,213 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0501
+#endif
+#if _WIN32_WINNT < 0x0501
+#error "Proton requires Windows API support for XP or later."
+#endif
+#include <winsock2.h>
+#include <windows.h>
+#include <process.h>
+#include <proton/error.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+#include "thread.h"
+#include "alloc_private.h"
+
+struct pni_thread_t {
+  HANDLE handle;
+  void (*run)(void *);
+  void *context;
+};
+
+struct pni_mutex_t {
+  CRITICAL_SECTION section;
+};
+
+struct pni_semaphore_t {
+  HANDLE handle;
+};
+
+static unsigned __stdcall pni_thread_run(void *arg)
+{
+  pni_thread_t *thread = (pni_thread_t *) arg;
+  thread->run(thread->context);
+  return 0;
+}
+
+pni_thread_t *pni_thread(void (*run)(void *), void *context)
+{
+  pni_thread_t *thread = (pni_thread_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pni_thread_t));
+  if (!thread) return NULL;
+  thread->run = run;
+  thread->context = context;
+  thread->handle = (HANDLE) _beginthreadex(NULL, 0, pni_thread_run, thread, 0, NULL);
+  if (!thread->handle) {
+    pni_free(PN_ALLOC_OBJECT, thread);
+    return NULL;
+  }
+  return thread;
+}
+
+void pni_thread_join(pni_thread_t *thread)
+{
+  if (thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    pni_free(PN_ALLOC_OBJECT, thread);
+  }
+}
+
+int pni_thread_pin_cpu(pni_thread_t *thread, int cpu)
+{
+  // one processor group only
+  if (cpu < 0 || cpu >= (int) (sizeof(DWORD_PTR) * CHAR_BIT)) {
+    errno = EINVAL;
+    return PN_ERR;
+  }
+  if (!SetThreadAffinityMask(thread->handle, (DWORD_PTR) 1 << cpu)) {
+    errno = EINVAL;
+    return PN_ERR;
+  }
+  return 0;
+}
+
+int pni_thread_pin_node(pni_thread_t *thread, int node)
+{
+  ULONGLONG mask;
+  if (node < 0 || !GetNumaNodeProcessorMask((UCHAR) node, &mask) || !mask ||
+      !SetThreadAffinityMask(thread->handle, (DWORD_PTR) mask)) {
+    errno = EINVAL;
+    return PN_ERR;
+  }
+  return 0;
+}
+
+pni_mutex_t *pni_mutex(void)
+{
+  pni_mutex_t *mutex = (pni_mutex_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pni_mutex_t));
+  if (mutex) {
+    InitializeCriticalSection(&mutex->section);
+  }
+  return mutex;
+}
+
+void pni_mutex_free(pni_mutex_t *mutex)
+{
+  if (mutex) {
+    DeleteCriticalSection(&mutex->section);
+    pni_free(PN_ALLOC_OBJECT, mutex);
+  }
+}
+
+void pni_mutex_lock(pni_mutex_t *mutex)
+{
+  assert(mutex);
+  EnterCriticalSection(&mutex->section);
+}
+
+void pni_mutex_unlock(pni_mutex_t *mutex)
+{
+  assert(mutex);
+  LeaveCriticalSection(&mutex->section);
+}
+
+pni_semaphore_t *pni_semaphore(void)
+{
+  pni_semaphore_t *semaphore = (pni_semaphore_t *) pni_malloc(PN_ALLOC_OBJECT, sizeof(pni_semaphore_t));
+  if (!semaphore) return NULL;
+  semaphore->handle = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+  if (!semaphore->handle) {
+    pni_free(PN_ALLOC_OBJECT, semaphore);
+    return NULL;
+  }
+  return semaphore;
+}
+
+void pni_semaphore_free(pni_semaphore_t *semaphore)
+{
+  if (semaphore) {
+    CloseHandle(semaphore->handle);
+    pni_free(PN_ALLOC_OBJECT, semaphore);
+  }
+}
+
+void pni_semaphore_post(pni_semaphore_t *semaphore)
+{
+  assert(semaphore);
+  ReleaseSemaphore(semaphore->handle, 1, NULL);
+}
+
+void pni_semaphore_wait(pni_semaphore_t *semaphore)
+{
+  assert(semaphore);
+  WaitForSingleObject(semaphore->handle, INFINITE);
+}
+
+bool pni_semaphore_wait_for(pni_semaphore_t *semaphore, int timeout)
+{
+  assert(semaphore);
+  return WaitForSingleObject(semaphore->handle, timeout < 0 ? INFINITE : (DWORD) timeout) == WAIT_OBJECT_0;
+}
+
+void *pni_atomic_load(void *volatile *ptr)
+{
+  return InterlockedCompareExchangePointer(ptr, NULL, NULL);
+}
+
+void *pni_atomic_exchange(void *volatile *ptr, void *value)
+{
+  return InterlockedExchangePointer(ptr, value);
+}
+
+bool pni_atomic_cas(void *volatile *ptr, void *expected, void *desired)
+{
+  return InterlockedCompareExchangePointer(ptr, desired, expected) == expected;
+}
+
+int pni_atomic_add(int volatile *value, int delta)
+{
+  return InterlockedExchangeAdd((LONG volatile *) value, delta) + delta;
+}
+
+int pni_atomic_get(int volatile *value)
+{
+  return InterlockedCompareExchange((LONG volatile *) value, 0, 0);
+}
+
+void pni_atomic_set(int volatile *value, int v)
+{
+  InterlockedExchange((LONG volatile *) value, v);
+}
+
+uint64_t pni_atomic_add64(uint64_t volatile *value, uint64_t delta)
+{
+  return InterlockedExchangeAdd64((LONGLONG volatile *) value, (LONGLONG) delta) + delta;
+}
+
+uint64_t pni_atomic_get64(uint64_t volatile *value)
+{
+  return InterlockedCompareExchange64((LONGLONG volatile *) value, 0, 0);
+}
@@ -20,8 +20,10 @@
  */
 
 /*
- * A simple write buffer pool.  Each socket has a dedicated "primary"
+ * A simple write buffer pool.  Each writing socket has a "primary"
  * buffer and can borrow from a shared pool with limited size tuning.
+ * The primary is only held while writes are in flight, idle sockets
+ * return it to the iocp for the next writer.
  * Could enhance e.g. with separate pools per network interface and fancier
  * memory tuning based on interface speed, system resources, and
  * number of connections, etc.
@@ -46,11 +48,14 @@
 #include "selectable.h"
 #include "util.h"
 #include "iocp.h"
+#include "alloc_private.h"
 
 // Max overlapped writes per socket
 #define IOCP_MAX_OWRITES 16
 // Write buffer size
 #define IOCP_WBUFSIZE 16384
+// Max idle primary buffers kept for reuse
+#define IOCP_IDLE_WBUFS 64
 
 static void pipeline_log(const char *fmt, ...)
 {
@@ -81,6 +86,9 @@ void pni_shared_pool_create(iocp_t *iocp)
     }
   }
 
+  iocp->idle_buffers = (char **) pni_malloc(PN_ALLOC_IO, IOCP_IDLE_WBUFS * sizeof(char *));
+  iocp->idle_buffer_count = 0;
+
   if (iocp->shared_pool_size) {
     iocp->shared_pool_memory = (char *) VirtualAlloc(NULL, IOCP_WBUFSIZE * iocp->shared_pool_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
     HRESULT status = GetLastError();
@@ -91,8 +99,8 @@ void pni_shared_pool_create(iocp_t *iocp)
       return;
     }
 
-    iocp->shared_results = (write_result_t **) malloc(iocp->shared_pool_size * sizeof(write_result_t *));
-    iocp->available_results = (write_result_t **) malloc(iocp->shared_pool_size * sizeof(write_result_t *));
+    iocp->shared_results = (write_result_t **) pni_malloc(PN_ALLOC_IO, iocp->shared_pool_size * sizeof(write_result_t *));
+    iocp->available_results = (write_result_t **) pni_malloc(PN_ALLOC_IO, iocp->shared_pool_size * sizeof(write_result_t *));
     iocp->shared_available_count = iocp->shared_pool_size;
     char *mem = iocp->shared_pool_memory;
     for (int i = 0; i < iocp->shared_pool_size; i++) {
@@ -104,16 +112,22 @@ void pni_shared_pool_create(iocp_t *iocp)
 
 void pni_shared_pool_free(iocp_t *iocp)
 {
+  for (size_t i = 0; i < iocp->idle_buffer_count; i++)
+    pni_free(PN_ALLOC_IO, iocp->idle_buffers[i]);
+  pni_free(PN_ALLOC_IO, iocp->idle_buffers);
+  iocp->idle_buffers = NULL;
+  iocp->idle_buffer_count = 0;
+
   for (int i = 0; i < iocp->shared_pool_size; i++) {
     write_result_t *result = iocp->shared_results[i];
     if (result->in_use)
       pipeline_log("Proton buffer pool leak\n");
     else
-      free(result);
+      pni_free(PN_ALLOC_IO, result);
   }
   if (iocp->shared_pool_size) {
-    free(iocp->shared_results);
-    free(iocp->available_results);
+    pni_free(PN_ALLOC_IO, iocp->shared_results);
+    pni_free(PN_ALLOC_IO, iocp->available_results);
     if (iocp->shared_pool_memory) {
       if (!VirtualFree(iocp->shared_pool_memory, 0, MEM_RELEASE)) {
         perror("write buffers release failed");
@@ -143,6 +157,7 @@ struct write_pipeline_t {
   size_t next_primary_index;
   size_t depth;
   bool is_writer;
+  bool dedicated;    // the primary is sized for this socket and kept
 };
 
 #define write_pipeline_compare NULL
@@ -153,17 +168,17 @@ static void write_pipeline_initialize(void *object)
 {
   write_pipeline_t *pl = (write_pipeline_t *) object;
   pl->pending_count = 0;
-  const char *pribuf = (const char *) malloc(IOCP_WBUFSIZE);
-  pl->primary = pni_write_result(NULL, pribuf, IOCP_WBUFSIZE);
+  pl->primary = pni_write_result(NULL, NULL, 0);
   pl->depth = 0;
   pl->is_writer = false;
+  pl->dedicated = false;
 }
 
 static void write_pipeline_finalize(void *object)
 {
   write_pipeline_t *pl = (write_pipeline_t *) object;
-  free((void *)pl->primary->buffer.start);
-  free(pl->primary);
+  pni_free(PN_ALLOC_IO, (void *)pl->primary->buffer.start);
+  pni_free(PN_ALLOC_IO, pl->primary);
 }
 
 write_pipeline_t *pni_write_pipeline(iocpdesc_t *iocpd)
@@ -176,6 +191,35 @@ write_pipeline_t *pni_write_pipeline(iocpdesc_t *iocpd)
   return pipeline;
 }
 
+static bool primary_acquire(write_pipeline_t *pl)
+{
+  write_result_t *primary = pl->primary;
+  if (primary->buffer.start)
+    return true;
+  iocp_t *iocp = pl->iocpd->iocp;
+  char *buf = iocp->idle_buffer_count ? iocp->idle_buffers[--iocp->idle_buffer_count]
+                                      : (char *) pni_malloc(PN_ALLOC_IO, IOCP_WBUFSIZE);
+  if (!buf)
+    return false;
+  primary->buffer.start = buf;
+  primary->buffer.size = IOCP_WBUFSIZE;
+  return true;
+}
+
+static void primary_release(write_pipeline_t *pl)
+{
+  write_result_t *primary = pl->primary;
+  if (pl->dedicated || primary->in_use || !primary->buffer.start)
+    return;
+  iocp_t *iocp = pl->iocpd->iocp;
+  if (iocp->idle_buffers && iocp->idle_buffer_count < IOCP_IDLE_WBUFS)
+    iocp->idle_buffers[iocp->idle_buffer_count++] = (char *) primary->buffer.start;
+  else
+    pni_free(PN_ALLOC_IO, (void *) primary->buffer.start);
+  primary->buffer.start = NULL;
+  primary->buffer.size = 0;
+}
+
 static void confirm_as_writer(write_pipeline_t *pl)
 {
   if (!pl->is_writer) {
@@ -218,10 +262,12 @@ static void set_depth(write_pipeline_t *pl)
     } else {
       iocp_t *iocp = pl->iocpd->iocp;
       if (iocp->loopback_bufsize) {
-        const char *p = (const char *) realloc((void *) pl->primary->buffer.start, iocp->loopback_bufsize);
+        primary_release(pl);
+        const char *p = (const char *) pni_malloc(PN_ALLOC_IO, iocp->loopback_bufsize);
         if (p) {
           pl->primary->buffer.start = p;
           pl->primary->buffer.size = iocp->loopback_bufsize;
+          pl->dedicated = true;
         }
       }
     }
@@ -235,6 +281,8 @@ size_t pni_write_pipeline_reserve(write_pipeline_t *pl, size_t count)
     return 0;  // I.e. io->wouldblock
   if (!pl->depth)
     set_depth(pl);
+  if (!primary_acquire(pl))
+    return 0;
   if (pl->depth == 1) {
     // always use the primary
     pl->reserved_count = 1;
@@ -297,8 +345,10 @@ void pni_write_pipeline_return(write_pipeline_t *pl, write_result_t *result)
   pl->reserved_count = 0;
   if (result != pl->primary)
     shared_pool_push(result);
-  if (pl->pending_count == 0)
+  if (pl->pending_count == 0) {
     remove_as_writer(pl);
+    primary_release(pl);
+  }
 }
 
 bool pni_write_pipeline_writable(write_pipeline_t *pl)
@@ -349,6 +349,31 @@ class DataTest(Test):
     copy = data.get_object()
     assert copy == obj, (copy, obj)
 
+  def testRoundTripNested(self):
+    # builtins inside python classes inside builtins
+    obj = {u"props": dict((u"key%d" % i, i) for i in range(50)),
+           u"mixed": [1, 2**40, -3, 1.5, False, None, "bin", u"str",
+                      (u"tuple", symbol("sym")),
+                      Described(symbol("d"), [ulong(5), {u"x": [char("c")]}])],
+           symbol("big"): -2**63}
+    self.data.put_object(obj)
+    enc = self.data.encode()
+    data = Data()
+    data.decode(enc)
+    data.rewind()
+    assert data.next()
+    copy = data.get_object()
+    obj[u"mixed"][8] = list(obj[u"mixed"][8])
+    assert copy == obj, (copy, obj)
+    assert type(copy[u"mixed"][8][1]) is symbol, type(copy[u"mixed"][8][1])
+
+  def testPutUnmapped(self):
+    try:
+      self.data.put_object([1, object()])
+      assert False, "expected KeyError"
+    except KeyError:
+      pass
+
   def testLookup(self):
     obj = {symbol("key"): u"value",
            symbol("pi"): 3.14159,
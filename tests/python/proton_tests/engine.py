@@ -766,6 +766,25 @@ class TransferTest(Test):
     bytes = self.rcv.recv(1024)
     assert bytes is None
 
+  def test_buffers(self):
+    self.rcv.flow(1)
+    self.snd.delivery("tag")
+    msg = bytearray("xxthis is a testxx")
+    n = self.snd.send(memoryview(msg)[2:-2])
+    assert n == len(msg) - 4
+    assert self.snd.advance()
+
+    self.pump()
+
+    d = self.rcv.current
+    assert d
+    assert d.pending == n, (d.pending, n)
+
+    buf = bytearray(1024)
+    n = self.rcv.recv_into(buf)
+    assert buf[:n] == "this is a test", buf[:n]
+    assert self.rcv.recv_into(buf) is None
+
   def test_disposition(self):
     self.rcv.flow(1)
 
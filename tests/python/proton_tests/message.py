@@ -126,3 +126,27 @@ class CodecTest(Test):
     assert self.msg.address == msg2.address, (self.msg.address, msg2.address)
     assert self.msg.subject == msg2.subject, (self.msg.subject, msg2.subject)
     assert self.msg.body == msg2.body, (self.msg.body, msg2.body)
+
+  def testLargeRoundTrip(self):
+    self.msg.body = "x" * (1024 * 1024)
+    data = self.msg.encode()
+    assert len(data) > 1024 * 1024, len(data)
+
+    msg2 = Message()
+    msg2.decode(data)
+    assert msg2.body == self.msg.body
+
+  def testDecodeBuffer(self):
+    self.msg.subject = "subject"
+    self.msg.body = "Hello World!"
+    data = self.msg.encode()
+
+    msg2 = Message()
+    msg2.decode(bytearray(data))
+    assert msg2.subject == self.msg.subject, (msg2.subject, self.msg.subject)
+    assert msg2.body == self.msg.body, (msg2.body, self.msg.body)
+
+    # a view of part of a larger buffer
+    msg3 = Message()
+    msg3.decode(memoryview(bytearray("junk" + data + "junk"))[4:-4])
+    assert msg3.body == self.msg.body, (msg3.body, self.msg.body)
@@ -151,6 +151,27 @@ class MessengerTest(Test):
     rbod = reply.body
     assert rbod == body, (rbod, body)
 
+  def testBatch(self):
+    self.start()
+    msgs = []
+    for i in range(10):
+      msg = Message()
+      msg.address="amqp://127.0.0.1:12345"
+      msg.reply_to = "~"
+      msg.body = "message %s" % i
+      msgs.append(msg)
+    self.client.put_batch(msgs)
+    self.client.send()
+
+    replies = [Message() for i in range(10)]
+    got = 0
+    while got < 10:
+      self.client.recv(10 - got)
+      got += self.client.get_batch(replies[got:])
+    assert self.client.get_batch([Message()]) == 0
+    for i in range(10):
+      assert replies[i].body == "message %s" % i, (i, replies[i].body)
+
   def testSendReceive1K(self):
     self.testSendReceive(1024)
 
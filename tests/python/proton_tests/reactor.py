@@ -17,6 +17,8 @@
 # under the License.
 #
 
+import time
+from threading import Thread
 from common import Test
 from proton.reactor import Reactor
 
@@ -170,3 +172,29 @@ class ExceptionTest(Test):
             assert False, "expected to barf"
         except Barf:
             pass
+
+class Ticker:
+
+    def __init__(self):
+        self.fired = False
+
+    def on_timer_task(self, event):
+        self.fired = True
+
+class ThreadTest(Test):
+
+    def test_wait_releases_gil(self):
+        # this thread keeps running while the reactor waits for its timer
+        ticker = Ticker()
+        reactor = Reactor()
+        reactor.schedule(0.5, ticker)
+        thread = Thread(target=reactor.run)
+        thread.start()
+        last = time.time()
+        gap = 0
+        while not ticker.fired:
+            now = time.time()
+            gap = max(gap, now - last)
+            last = now
+        thread.join()
+        assert gap < 0.25, gap
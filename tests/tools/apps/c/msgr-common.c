@@ -50,6 +50,24 @@ pn_timestamp_t msgr_now()
   return time_now();
 }
 
+// wall clock time so that one-way latencies can be taken between
+// processes, or hosts with synchronized clocks
+uint64_t msgr_now_usec()
+{
+#if defined(_WIN32) && ! defined(__CYGWIN__)
+  FILETIME now;
+  ULARGE_INTEGER t;
+  GetSystemTimeAsFileTime(&now);
+  t.u.HighPart = now.dwHighDateTime;
+  t.u.LowPart = now.dwLowDateTime;
+  return t.QuadPart / 10 - 11644473600000000ULL;
+#else
+  struct timeval now;
+  if (gettimeofday(&now, NULL)) msgr_die(__FILE__, __LINE__, "gettimeofday failed");
+  return ((uint64_t)now.tv_sec) * 1000000 + now.tv_usec;
+#endif
+}
+
 void addresses_init( Addresses_t *a )
 {
   a->size = 10; // whatever
@@ -103,14 +121,136 @@ void addresses_merge( Addresses_t *a, const char *list )
 }
 
 
+void histogram_init( Histogram_t *h )
+{
+  // the counts are allocated on the first sample
+  h->counts = NULL;
+  h->total = 0;
+  h->max = 0;
+}
+
+void histogram_free( Histogram_t *h )
+{
+  free(h->counts);
+  h->counts = NULL;
+}
+
+static int histogram_index( uint64_t value )
+{
+  if (value < 2 * HISTOGRAM_SUB_BUCKETS) return (int) value;
+  int shift = 0;
+  while ((value >> shift) >= 2 * HISTOGRAM_SUB_BUCKETS) shift++;
+  return 2 * HISTOGRAM_SUB_BUCKETS + (shift - 1) * HISTOGRAM_SUB_BUCKETS +
+    (int) (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+}
+
+// the highest value that shares a bucket with index
+static uint64_t histogram_value( int index )
+{
+  if (index < 2 * HISTOGRAM_SUB_BUCKETS) return index;
+  int shift = (index - 2 * HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_SUB_BUCKETS + 1;
+  uint64_t sub = (index - 2 * HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+  return ((sub + 1) << shift) - 1;
+}
+
+void histogram_record( Histogram_t *h, uint64_t value )
+{
+  if (!h->counts) {
+    h->counts = (uint64_t *) calloc(HISTOGRAM_BUCKETS, sizeof(uint64_t));
+    check( h->counts, "malloc failure" );
+  }
+  h->counts[histogram_index(value)]++;
+  h->total++;
+  if (value > h->max) h->max = value;
+}
+
+uint64_t histogram_percentile( Histogram_t *h, double percentile )
+{
+  if (!h->total) return 0;
+  uint64_t rank = (uint64_t) (percentile / 100.0 * h->total + 0.5);
+  if (rank < 1) rank = 1;
+  uint64_t seen = 0;
+  int i;
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= rank) {
+      uint64_t value = histogram_value(i);
+      return value < h->max ? value : h->max;
+    }
+  }
+  return h->max;
+}
+
+static void histogram_report( Histogram_t *h, const char *name )
+{
+  if (!h->total) return;
+  fprintf(stdout, "%s latency (usec): p50 %" PRIu64 " p99 %" PRIu64 " p99.9 %" PRIu64
+          " max %" PRIu64 " (%" PRIu64 " samples)\n", name,
+          histogram_percentile(h, 50), histogram_percentile(h, 99),
+          histogram_percentile(h, 99.9), h->max, h->total);
+}
+
+#define STAMP_KEY "sent-usec"
+
+void statistics_stamp( pn_message_t *message, uint64_t usec )
+{
+  pn_data_t *props = pn_message_properties(message);
+  pn_data_clear(props);
+  pn_data_put_map(props);
+  pn_data_enter(props);
+  pn_data_put_symbol(props, pn_bytes(strlen(STAMP_KEY), STAMP_KEY));
+  pn_data_put_ulong(props, usec);
+  pn_data_exit(props);
+}
+
+static bool statistics_stamped( pn_message_t *message, uint64_t *usec )
+{
+  pn_data_t *props = pn_message_properties(message);
+  pn_data_rewind(props);
+  if (!pn_data_next(props) || pn_data_type(props) != PN_MAP) return false;
+  pn_data_enter(props);
+  bool found = false;
+  while (pn_data_next(props)) {
+    pn_bytes_t key = pn_data_get_bytes(props);
+    if (!pn_data_next(props)) break;
+    if (key.size == strlen(STAMP_KEY) && !memcmp(key.start, STAMP_KEY, key.size) &&
+        pn_data_type(props) == PN_ULONG) {
+      *usec = pn_data_get_ulong(props);
+      found = true;
+      break;
+    }
+  }
+  pn_data_rewind(props);
+  return found;
+}
+
+static void statistics_latency( Histogram_t *h, pn_message_t *message )
+{
+  uint64_t sent;
+  if (statistics_stamped(message, &sent)) {
+    uint64_t now = msgr_now_usec();
+    histogram_record(h, now > sent ? now - sent : 0);
+  }
+}
+
 void statistics_start( Statistics_t *s )
 {
   s->latency_samples = 0;
   s->latency_total = s->latency_min = s->latency_max = 0.0;
+  histogram_init(&s->one_way);
+  histogram_init(&s->round_trip);
   s->start = msgr_now();
 }
 
-void statistics_msg_received( Statistics_t *s, pn_message_t *message )
+void statistics_free( Statistics_t *s )
+{
+  histogram_free(&s->one_way);
+  histogram_free(&s->round_trip);
+}
+
+// the mean from the creation time, which is to the millisecond and
+// reset by a peer that replies or forwards
+static void statistics_creation_time( Statistics_t *s, pn_message_t *message )
 {
   pn_timestamp_t ts = pn_message_get_creation_time( message );
   if (ts) {
@@ -129,6 +269,18 @@ void statistics_msg_received( Statistics_t *s, pn_message_t *message )
   }
 }
 
+void statistics_msg_received( Statistics_t *s, pn_message_t *message )
+{
+  statistics_latency(&s->one_way, message);
+  statistics_creation_time(s, message);
+}
+
+void statistics_reply_received( Statistics_t *s, pn_message_t *message )
+{
+  statistics_latency(&s->round_trip, message);
+  statistics_creation_time(s, message);
+}
+
 void statistics_report( Statistics_t *s, uint64_t sent, uint64_t received )
 {
   pn_timestamp_t end = msgr_now() - s->start;
@@ -140,6 +292,8 @@ void statistics_report( Statistics_t *s, uint64_t sent, uint64_t received )
   fprintf(stdout, "Latency (sec): %f min %f max %f avg\n",
           s->latency_min/1000.0, s->latency_max/1000.0,
           (s->latency_samples) ? (s->latency_total/s->latency_samples)/1000.0 : 0);
+  histogram_report(&s->one_way, "One-way");
+  histogram_report(&s->round_trip, "Round-trip");
 }
 
 void parse_password( const char *input, char **password )
@@ -51,6 +51,7 @@
 void msgr_die(const char *file, int line, const char *message);
 char *msgr_strdup( const char *src );
 pn_timestamp_t msgr_now(void);
+uint64_t msgr_now_usec(void);
 void parse_password( const char *, char ** );
 
 #define check_messenger(m)  \
@@ -74,6 +75,24 @@ void addresses_free( Addresses_t *a );
 void addresses_add( Addresses_t *a, const char *addr );
 void addresses_merge( Addresses_t *a, const char *list );
 
+// HDR style histogram of latencies in microseconds: exact below
+// 128, within 1/64 of the value above that
+
+#define HISTOGRAM_SUB_BUCKETS 64
+#define HISTOGRAM_BUCKETS (2 * HISTOGRAM_SUB_BUCKETS + 57 * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+  uint64_t *counts;
+  uint64_t total;
+  uint64_t max;
+} Histogram_t;
+
+void histogram_init( Histogram_t *h );
+void histogram_free( Histogram_t *h );
+void histogram_record( Histogram_t *h, uint64_t value );
+// the highest value recorded at or below the given percentile
+uint64_t histogram_percentile( Histogram_t *h, double percentile );
+
 // Statistics handling
 
 typedef struct {
@@ -82,11 +101,18 @@ typedef struct {
   double latency_total;
   double latency_min;
   double latency_max;
+  Histogram_t one_way;
+  Histogram_t round_trip;
 } Statistics_t;
 
+// stamp a message with the time it is (or was meant to be) sent, in
+// microseconds, replies carry the stamp back
+void statistics_stamp( pn_message_t *message, uint64_t usec );
 void statistics_start( Statistics_t *s );
 void statistics_msg_received( Statistics_t *s, pn_message_t *message );
+void statistics_reply_received( Statistics_t *s, pn_message_t *message );
 void statistics_report( Statistics_t *s, uint64_t sent, uint64_t received );
+void statistics_free( Statistics_t *s );
 
 void enable_logging(void);
 void LOG( const char *fmt, ... );
@@ -33,6 +33,8 @@ typedef struct {
     uint64_t msg_count;
     int recv_count;
     int incoming_window;
+    int threads;
+    int prefetch;
     int timeout;  // seconds
     unsigned int report_interval;  // in seconds
     int   outgoing_window;
@@ -61,6 +63,8 @@ static void usage(int rc)
            " -F <addr>[,<addr>]* \tAddresses used for forwarding received messages\n"
            " -N <name> \tSet the container name to <name>\n"
            " -X <text> \tPrint '<text>\\n' to stdout after all subscriptions are created\n"
+           " -H # \tNumber of I/O threads [1]\n"
+           " -Q # \tMessages decoded ahead by the I/O threads [0]\n"
            " -V \tEnable debug logging\n"
            " SSL options:\n"
            " -T <path> \tDatabase of trusted CA certificates for validating peer\n"
@@ -83,7 +87,7 @@ static void parse_options( int argc, char **argv, Options_t *opts )
     addresses_init(&opts->forwarding_targets);
 
     while ((c = getopt(argc, argv,
-                       "a:c:b:w:t:e:RW:F:VN:X:T:C:K:P:")) != -1) {
+                       "a:c:b:w:t:e:RW:F:VN:X:T:C:K:P:H:Q:")) != -1) {
         switch (c) {
         case 'a': addresses_merge( &opts->subscriptions, optarg ); break;
         case 'c':
@@ -125,6 +129,18 @@ static void parse_options( int argc, char **argv, Options_t *opts )
             }
             break;
         case 'F': addresses_merge( &opts->forwarding_targets, optarg ); break;
+        case 'H':
+            if (sscanf( optarg, "%d", &opts->threads ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
+        case 'Q':
+            if (sscanf( optarg, "%d", &opts->prefetch ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
         case 'V': enable_logging(); break;
         case 'N': opts->name = optarg; break;
         case 'X': opts->ready_text = optarg; break;
@@ -196,6 +212,14 @@ int main(int argc, char** argv)
 
     pn_messenger_set_timeout( messenger, opts.timeout );
 
+    if (opts.threads > 1) {
+        rc = pn_messenger_set_threads( messenger, opts.threads );
+        check( rc == 0, "Failed to set threads" );
+    }
+    if (opts.prefetch) {
+        rc = pn_messenger_set_prefetch( messenger, opts.prefetch );
+        check( rc == 0, "Failed to set prefetch" );
+    }
     pn_messenger_start(messenger);
     check_messenger(messenger);
 
@@ -271,6 +295,7 @@ int main(int argc, char** argv)
     check_messenger(messenger);
 
     statistics_report( &stats, sent, received );
+    statistics_free( &stats );
 
     pn_messenger_free(messenger);
     pn_message_free(message);
@@ -34,6 +34,7 @@ typedef struct {
     uint64_t msg_count;
     uint32_t msg_size;  // of body
     uint32_t send_batch;
+    uint32_t pack;      // messages packed into each delivery, 0 = off
     int   outgoing_window;
     unsigned int report_interval;      // in seconds
     //Addresses_t subscriptions;
@@ -41,8 +42,11 @@ typedef struct {
     int   get_replies;
     int   timeout;      // in seconds
     int   incoming_window;
+    int   threads;
     int   recv_count;
+    uint64_t rate;      // messages per second, 0 = as fast as possible
     const char *name;
+    const char *journal;  // directory, NULL = none
     char *certificate;
     char *privatekey;   // used to sign certificate
     char *password;     // for private key file
@@ -57,6 +61,7 @@ static void usage(int rc)
            " -c # \tNumber of messages to send before exiting [0=forever]\n"
            " -b # \tSize of message body in bytes [1024]\n"
            " -p # \tSend batches of # messages (wait for replies before sending next batch if -R) [1024]\n"
+           " -k # \tPack # messages into each delivery [0=off]\n"
            " -w # \t# outgoing window size [0]\n"
            " -e # \t# seconds to report statistics, 0 = end of test [0]\n"
            " -R \tWait for a reply to each sent message\n"
@@ -64,6 +69,9 @@ static void usage(int rc)
            " -W # \tIncoming window size [0]\n"
            " -B # \tArgument to Messenger::recv(n) [-1]\n"
            " -N <name> \tSet the container name to <name>\n"
+           " -H # \tNumber of I/O threads [1]\n"
+           " -r # \tSend at a fixed rate of # messages/sec, latency counts from when each was due [0]\n"
+           " -J <dir> \tKeep outgoing messages in a journal in <dir> [none]\n"
            " -V \tEnable debug logging\n"
            " SSL options:\n"
            " -T <path> \tDatabase of trusted CA certificates for validating peer\n"
@@ -88,7 +96,7 @@ static void parse_options( int argc, char **argv, Options_t *opts )
     addresses_init(&opts->targets);
 
     while ((c = getopt(argc, argv,
-                       "a:c:b:p:w:e:l:Rt:W:B:VN:T:C:K:P:")) != -1) {
+                       "a:c:b:p:k:w:e:l:Rt:W:B:VN:T:C:K:P:H:r:J:")) != -1) {
         switch(c) {
         case 'a': addresses_merge( &opts->targets, optarg ); break;
         case 'c':
@@ -109,6 +117,12 @@ static void parse_options( int argc, char **argv, Options_t *opts )
                 usage(1);
             }
             break;
+        case 'k':
+            if (sscanf( optarg, "%u", &opts->pack ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
         case 'w':
             if (sscanf( optarg, "%d", &opts->outgoing_window ) != 1) {
                 fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
@@ -141,8 +155,21 @@ static void parse_options( int argc, char **argv, Options_t *opts )
                 usage(1);
             }
             break;
+        case 'H':
+            if (sscanf( optarg, "%d", &opts->threads ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
+        case 'r':
+            if (sscanf( optarg, "%" SCNu64, &opts->rate ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
         case 'V': enable_logging(); break;
         case 'N': opts->name = optarg; break;
+        case 'J': opts->journal = optarg; break;
         case 'T': opts->ca_db = optarg; break;
         case 'C': opts->certificate = optarg; break;
         case 'K': opts->privatekey = optarg; break;
@@ -158,6 +185,18 @@ static void parse_options( int argc, char **argv, Options_t *opts )
 }
 
 
+static pn_message_t *new_message( uint32_t size )
+{
+    pn_message_t *message = pn_message();
+    check(message, "failed to allocate a message");
+    pn_message_set_reply_to(message, "~");
+    pn_data_t *body = pn_message_body(message);
+    char *data = (char *)calloc(1, size);
+    pn_data_put_binary(body, pn_bytes(size, data));
+    free(data);
+    return message;
+}
+
 // return the # of reply messages received
 static int process_replies( pn_messenger_t *messenger,
                             pn_message_t *message,
@@ -174,7 +213,7 @@ static int process_replies( pn_messenger_t *messenger,
         check_messenger(messenger);
         received++;
         // TODO: header decoding?
-        statistics_msg_received( stats, message );
+        statistics_reply_received( stats, message );
         // uint64_t id = pn_message_get_correlation_id( message ).u.as_ulong;
     }
     return received;
@@ -223,15 +262,29 @@ int main(int argc, char** argv)
         pn_messenger_set_outgoing_window( messenger, opts.outgoing_window );
     }
     pn_messenger_set_timeout( messenger, opts.timeout );
+    if (opts.threads > 1) {
+        rc = pn_messenger_set_threads( messenger, opts.threads );
+        check( rc == 0, "Failed to set threads" );
+    }
+    if (opts.pack) {
+        rc = pn_messenger_set_flags( messenger, PN_FLAGS_BATCH_MESSAGES );
+        check( rc == 0, "Failed to set flags" );
+    }
     pn_messenger_start(messenger);
+    if (opts.journal) {
+        rc = pn_messenger_set_journal( messenger, opts.journal );
+        check( rc >= 0, "Failed to set journal" );
+        if (rc > 0) LOG("Recovered %d messages from the journal\n", rc);
+    }
 
-    message = pn_message();
-    check(message, "failed to allocate a message");
-    pn_message_set_reply_to(message, "~");
-    pn_data_t *body = pn_message_body(message);
-    char *data = (char *)calloc(1, opts.msg_size);
-    pn_data_put_binary(body, pn_bytes(opts.msg_size, data));
-    free(data);
+    message = new_message( opts.msg_size );
+    // messages are put together once this many have been filled in
+    pn_message_t **packed = (pn_message_t **) calloc(opts.pack ? opts.pack : 1, sizeof(pn_message_t *));
+    check(packed, "failed to allocate messages");
+    for (uint32_t i = 0; i < opts.pack; i++) {
+        packed[i] = new_message( opts.msg_size );
+    }
+    uint32_t held = 0;
     pn_atom_t id;
     id.type = PN_ULONG;
 
@@ -261,17 +314,50 @@ int main(int argc, char** argv)
     }
 
     statistics_start( &stats );
+    const uint64_t start = msgr_now_usec();
     while (!opts.msg_count || (sent < opts.msg_count)) {
 
+        // at a fixed rate each message is stamped with when it was due
+        // rather than when it could be sent, so that a stall shows in
+        // the latency of every message it held up
+        uint64_t stamp = msgr_now_usec();
+        if (opts.rate) {
+            const uint64_t due = start + sent * 1000000 / opts.rate;
+            while (stamp < due) {
+                rc = pn_messenger_work( messenger, (int) ((due - stamp) / 1000) );
+                check((rc >= 0 || rc == PN_TIMEOUT), "pn_messenger_work() failed");
+                stamp = msgr_now_usec();
+            }
+            stamp = due;
+        }
+
         // setup the message to send
-        pn_message_set_address(message, opts.targets.addresses[target_index]);
+        pn_message_t *next = opts.pack ? packed[held] : message;
+        pn_message_set_address(next, opts.targets.addresses[target_index]);
         target_index = NEXT_ADDRESS(opts.targets, target_index);
         id.u.as_ulong = sent;
-        pn_message_set_correlation_id( message, id );
-        pn_message_set_creation_time( message, msgr_now() );
-        pn_messenger_put(messenger, message);
+        pn_message_set_correlation_id( next, id );
+        pn_message_set_creation_time( next, msgr_now() );
+        statistics_stamp( next, stamp );
         sent++;
-        if (opts.send_batch && (pn_messenger_outgoing(messenger) >= (int)opts.send_batch)) {
+        if (!opts.pack) {
+            pn_messenger_put(messenger, next);
+        } else if (++held == opts.pack || sent == opts.msg_count) {
+            rc = pn_messenger_put_batch(messenger, packed, held);
+            check(rc == (int) held, "pn_messenger_put_batch() failed");
+            held = 0;
+        }
+        if (opts.rate) {
+            // push it out without waiting, and take any replies there are
+            rc = pn_messenger_work( messenger, 0 );
+            check((rc >= 0 || rc == PN_TIMEOUT), "pn_messenger_work() failed");
+            if (get_replies) {
+                pn_messenger_set_timeout( messenger, 0 );
+                received += process_replies( messenger, reply_message,
+                                             &stats, opts.recv_count );
+                pn_messenger_set_timeout( messenger, opts.timeout );
+            }
+        } else if (opts.send_batch && (pn_messenger_outgoing(messenger) >= (int)opts.send_batch)) {
             if (get_replies) {
                 while (received < sent) {
                     // this will also transmit any pending sent messages
@@ -310,9 +396,14 @@ int main(int argc, char** argv)
     check_messenger(messenger);
 
     statistics_report( &stats, sent, received );
+    statistics_free( &stats );
 
     pn_messenger_free(messenger);
     pn_message_free(message);
+    for (uint32_t i = 0; i < opts.pack; i++) {
+        pn_message_free(packed[i]);
+    }
+    free(packed);
     if (reply_message) pn_message_free( reply_message );
     addresses_free( &opts.targets );
 
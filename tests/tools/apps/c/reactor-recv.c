@@ -425,6 +425,7 @@ int main(int argc, char** argv)
   Options_t opts;
   Statistics_t stats;
   parse_options( argc, argv, &opts );
+  statistics_start( &stats );
   pn_reactor_t *reactor = pn_reactor();
 
   // set up default handlers for our reactor
@@ -442,6 +443,7 @@ int main(int argc, char** argv)
   pn_reactor_run(reactor);
   pn_reactor_free(reactor);
 
+  statistics_free( &stats );
   addresses_free( &opts.subscriptions );
   return 0;
 }
@@ -0,0 +1,504 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Measures what idle connections cost a reactor as their number grows.
+ *
+ * Opens the first count of connections, mostly idle apart from their
+ * heartbeats and a few that keep sending, measures for a while and
+ * reports, then grows to the next count. Each step reports the cpu
+ * used, how late the reactor ran a timer, the jitter of the heartbeats
+ * received and the memory each connection added. Unless given an
+ * address the connections are made to a listener in the same process,
+ * so both of their ends are counted.
+ */
+
+#include "proton/error.h"
+#include "proton/types.h"
+#include "proton/reactor.h"
+#include "proton/handlers.h"
+#include "proton/engine.h"
+#include "proton/url.h"
+#include "msgr-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#define MAX_STEPS 16
+#define TICK 10         // milliseconds between ticks
+
+typedef struct {
+  const char *address;  // to connect to, or NULL to listen in process
+  uint64_t counts[MAX_STEPS];
+  int steps;
+  int active;
+  int idle_timeout;     // milliseconds
+  int duration;         // seconds to measure each step
+  int rate;             // messages/sec for each active connection
+  int batch;            // connections opening at once
+  uint32_t msg_size;
+} Options_t;
+
+static void usage(int rc)
+{
+    printf("Usage: reactor-scale [OPTIONS] \n"
+           " -a <addr> \tConnect to <addr> [listen on amqp://127.0.0.1:5680 in process]\n"
+           " -n #[,#]* \tConnection counts to step through [100,1000,10000]\n"
+           " -A # \tConnections that keep sending [10]\n"
+           " -r # \tMessages/sec sent by each active connection [100]\n"
+           " -b # \tSize of message body in bytes [64]\n"
+           " -i # \tIdle timeout in milliseconds, a peer sends heartbeats at a quarter of it [2000]\n"
+           " -d # \tSeconds to measure at each count [5]\n"
+           " -B # \tConnections opening at once [256]\n"
+           );
+    exit(rc);
+}
+
+typedef enum {
+  RAMPING,
+  MEASURING,
+  DONE
+} phase_t;
+
+// an end of a connection
+typedef struct {
+  uint64_t last_heartbeat;
+} end_t;
+
+typedef struct {
+  Options_t *opts;
+  const char *host;
+  const char *port;
+  pn_acceptor_t *acceptor;
+  phase_t phase;
+  int step;
+
+  pn_connection_t **connections;   // the ends made here
+  uint64_t created;
+  uint64_t opened;
+  pn_link_t **senders;
+  char *body;
+
+  end_t *ends;                     // of every transport seen, both sides
+  uint64_t bound;
+
+  uint64_t phase_start;            // microseconds
+  uint64_t step_rss;
+  uint64_t step_created;
+  clock_t step_cpu;
+  uint64_t tick_due;
+  uint64_t sent;
+  uint64_t received;
+  Histogram_t late;
+  Histogram_t jitter;
+} scale_context_t;
+
+// the tracer has nothing but the transport to go on
+static scale_context_t *the_context;
+
+static uint64_t resident_bytes(void)
+{
+#if defined(__linux__)
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f) return 0;
+  unsigned long size, resident;
+  int n = fscanf(f, "%lu %lu", &size, &resident);
+  fclose(f);
+  return n == 2 ? (uint64_t) resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+  return 0;
+#endif
+}
+
+static void raise_fd_limit(uint64_t needed)
+{
+#if !defined(_WIN32) || defined(__CYGWIN__)
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit)) return;
+  if (limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  if ((uint64_t) limit.rlim_cur < needed) {
+    fprintf(stderr, "warning: %" PRIu64 " descriptors are needed, the limit is %" PRIu64 "\n",
+            needed, (uint64_t) limit.rlim_cur);
+  }
+#endif
+}
+
+static void heartbeat_tracer(pn_transport_t *transport, const char *frame, size_t size,
+                             bool outgoing)
+{
+  // an empty frame is a frame header alone
+  if (outgoing || size != 8) return;
+  scale_context_t *sc = the_context;
+  end_t *end = (end_t *) pn_transport_get_context(transport);
+  uint64_t now = msgr_now_usec();
+  if (end->last_heartbeat && sc->phase == MEASURING) {
+    // half the idle timeout is advertised, the peer sends at half that
+    int64_t expected = (int64_t) sc->opts->idle_timeout * 1000 / 4;
+    int64_t interval = (int64_t) (now - end->last_heartbeat);
+    histogram_record(&sc->jitter, interval > expected ? interval - expected : expected - interval);
+  }
+  end->last_heartbeat = now;
+}
+
+static void report(scale_context_t *sc)
+{
+  uint64_t count = sc->opts->counts[sc->step];
+  double secs = (msgr_now_usec() - sc->phase_start) / 1e6;
+  double cpu = (double) (clock() - sc->step_cpu) / CLOCKS_PER_SEC;
+  uint64_t added = sc->created - sc->step_created;
+  uint64_t rss = resident_bytes();
+
+  fprintf(stdout, "Connections: %" PRIu64 " active: %d\n", count, sc->opts->active);
+  fprintf(stdout, "  CPU: %.1f%% (%.2f usec/sec per connection)\n", 100 * cpu / secs,
+          1e6 * cpu / secs / count);
+  fprintf(stdout, "  Timer lateness (usec): p50 %" PRIu64 " p99 %" PRIu64 " max %" PRIu64 "\n",
+          histogram_percentile(&sc->late, 50), histogram_percentile(&sc->late, 99),
+          sc->late.max);
+  fprintf(stdout, "  Heartbeat jitter (usec): p50 %" PRIu64 " p99 %" PRIu64 " max %" PRIu64
+          " (%" PRIu64 " heartbeats)\n", histogram_percentile(&sc->jitter, 50),
+          histogram_percentile(&sc->jitter, 99), sc->jitter.max, sc->jitter.total);
+  if (rss && sc->step_rss && added) {
+    fprintf(stdout, "  Memory: %" PRIu64 " bytes per connection%s\n",
+            rss > sc->step_rss ? (rss - sc->step_rss) / added : 0,
+            sc->opts->address ? "" : " (both ends)");
+  }
+  fprintf(stdout, "  Messages: %.0f/sec\n", sc->received ? sc->received / secs : sc->sent / secs);
+  fflush(stdout);
+}
+
+static void start_measuring(scale_context_t *sc)
+{
+  sc->phase = MEASURING;
+  sc->phase_start = msgr_now_usec();
+  sc->step_cpu = clock();
+  sc->sent = 0;
+  sc->received = 0;
+  histogram_free(&sc->late);
+  histogram_free(&sc->jitter);
+  histogram_init(&sc->late);
+  histogram_init(&sc->jitter);
+}
+
+static void start_step(scale_context_t *sc, int step)
+{
+  sc->phase = RAMPING;
+  sc->step = step;
+  sc->step_rss = resident_bytes();
+  sc->step_created = sc->created;
+}
+
+static void send_messages(scale_context_t *sc)
+{
+  // what each active connection owes since the step started
+  uint64_t elapsed = msgr_now_usec() - sc->phase_start;
+  uint64_t owed = elapsed * sc->opts->rate / 1000000;
+  uint64_t total = owed * sc->opts->active;
+  // round robin, so that a sender short of credit does not hold up
+  // the others
+  bool progress = true;
+  while (sc->sent < total && progress) {
+    progress = false;
+    int i;
+    for (i = 0; i < sc->opts->active && sc->sent < total; i++) {
+      pn_link_t *snd = sc->senders[i];
+      if (!snd || pn_link_credit(snd) <= 0) continue;
+      uint64_t tag = sc->sent;
+      pn_delivery_t *dlv = pn_delivery(snd, pn_dtag((const char *) &tag, sizeof(tag)));
+      pn_link_send(snd, sc->body, sc->opts->msg_size);
+      pn_link_advance(snd);
+      pn_delivery_settle(dlv);
+      sc->sent++;
+      progress = true;
+    }
+  }
+}
+
+static void tick(pn_handler_t *h, pn_reactor_t *reactor)
+{
+  scale_context_t *sc = (scale_context_t *) pn_handler_mem(h);
+  uint64_t now = msgr_now_usec();
+  if (sc->phase == MEASURING) histogram_record(&sc->late, now > sc->tick_due ? now - sc->tick_due : 0);
+
+  uint64_t target = sc->opts->counts[sc->step];
+  switch (sc->phase) {
+  case RAMPING:
+    while (sc->created < target && sc->created - sc->opened < (uint64_t) sc->opts->batch) {
+      pn_connection_t *conn = pn_reactor_connection(reactor, h);
+      // marks the connection as made here, see PN_CONNECTION_INIT
+      pn_connection_set_context(conn, &sc->connections[sc->created]);
+      sc->connections[sc->created++] = conn;
+    }
+    if (sc->opened == target) start_measuring(sc);
+    break;
+  case MEASURING:
+    if (sc->opts->active) send_messages(sc);
+    if (now - sc->phase_start >= (uint64_t) sc->opts->duration * 1000000) {
+      report(sc);
+      if (sc->step + 1 < sc->opts->steps) {
+        start_step(sc, sc->step + 1);
+      } else {
+        sc->phase = DONE;
+      }
+    }
+    break;
+  case DONE:
+    return;
+  }
+
+  sc->tick_due = msgr_now_usec() + TICK * 1000;
+  pn_reactor_schedule(reactor, TICK, h);
+}
+
+static void scale_dispatch(pn_handler_t *h, pn_event_t *event, pn_event_type_t type)
+{
+  scale_context_t *sc = (scale_context_t *) pn_handler_mem(h);
+
+  switch (type) {
+  case PN_REACTOR_INIT:
+    {
+      pn_reactor_t *reactor = pn_event_reactor(event);
+      if (!sc->opts->address) {
+        sc->acceptor = pn_reactor_acceptor(reactor, sc->host, sc->port, h);
+        check(sc->acceptor, "acceptor creation failed");
+      }
+      start_step(sc, 0);
+      tick(h, reactor);
+    }
+    break;
+  case PN_TIMER_TASK:
+    tick(h, pn_event_reactor(event));
+    break;
+  case PN_CONNECTION_INIT:
+    {
+      // only the connections made here, accepted ones are opened by
+      // the handshaker
+      pn_connection_t *conn = pn_event_connection(event);
+      pn_connection_t **slot = (pn_connection_t **) pn_connection_get_context(conn);
+      if (!slot) break;
+      uint64_t index = slot - sc->connections;
+      pn_string_t *hostname = pn_string(sc->host);
+      pn_string_addf(hostname, ":%s", sc->port);
+      pn_connection_set_hostname(conn, pn_string_get(hostname));
+      pn_free(hostname);
+      pn_connection_set_container(conn, "reactor-scale");
+      pn_connection_open(conn);
+      if (index < (uint64_t) sc->opts->active) {
+        pn_session_t *ssn = pn_session(conn);
+        pn_session_open(ssn);
+        pn_link_t *snd = pn_sender(ssn, "sender");
+        pn_link_set_snd_settle_mode(snd, PN_SND_SETTLED);
+        pn_link_open(snd);
+        sc->senders[index] = snd;
+      }
+    }
+    break;
+  case PN_CONNECTION_BOUND:
+    {
+      pn_transport_t *transport = pn_event_transport(event);
+      check(sc->bound < 2 * sc->opts->counts[sc->opts->steps - 1], "too many transports");
+      end_t *end = &sc->ends[sc->bound++];
+      end->last_heartbeat = 0;
+      pn_transport_set_context(transport, end);
+      pn_transport_set_idle_timeout(transport, sc->opts->idle_timeout);
+      pn_transport_set_frame_tracer(transport, heartbeat_tracer);
+      pn_transport_trace(transport, PN_TRACE_RAW);
+    }
+    break;
+  case PN_CONNECTION_REMOTE_OPEN:
+    {
+      pn_connection_t *conn = pn_event_connection(event);
+      if (pn_connection_state(conn) & PN_LOCAL_ACTIVE) sc->opened++;
+    }
+    break;
+  case PN_DELIVERY:
+    {
+      pn_link_t *link = pn_event_link(event);
+      pn_delivery_t *dlv = pn_event_delivery(event);
+      if (pn_link_is_receiver(link) && !pn_delivery_partial(dlv)) {
+        char buffer[1024];
+        while (pn_link_recv(link, buffer, sizeof(buffer)) > 0);
+        pn_link_advance(link);
+        pn_delivery_settle(dlv);
+        sc->received++;
+      }
+    }
+    break;
+  case PN_TRANSPORT_ERROR:
+    {
+      pn_condition_t *cond = pn_transport_condition(pn_event_transport(event));
+      fprintf(stderr, "transport error: %s: %s\n", pn_condition_get_name(cond),
+              pn_condition_get_description(cond));
+      exit(1);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void scale_cleanup(pn_handler_t *h)
+{
+  scale_context_t *sc = (scale_context_t *) pn_handler_mem(h);
+  histogram_free(&sc->late);
+  histogram_free(&sc->jitter);
+  free(sc->connections);
+  free(sc->senders);
+  free(sc->ends);
+  free(sc->body);
+}
+
+static void parse_counts( const char *list, Options_t *opts )
+{
+    opts->steps = 0;
+    while (*list) {
+        check( opts->steps < MAX_STEPS, "too many connection counts" );
+        char *end;
+        opts->counts[opts->steps] = strtoul( list, &end, 10 );
+        if (end == list || (*end && *end != ',')) {
+            fprintf(stderr, "Option -n requires a list of integers.\n");
+            usage(1);
+        }
+        if (opts->steps && opts->counts[opts->steps] < opts->counts[opts->steps - 1]) {
+            fprintf(stderr, "Option -n requires growing counts.\n");
+            usage(1);
+        }
+        opts->steps++;
+        list = *end ? end + 1 : end;
+    }
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    parse_counts( "100,1000,10000", opts );
+    opts->active = 10;
+    opts->rate = 100;
+    opts->msg_size = 64;
+    opts->idle_timeout = 2000;
+    opts->duration = 5;
+    opts->batch = 256;
+
+    while ((c = getopt(argc, argv, "a:n:A:r:b:i:d:B:")) != -1) {
+        switch(c) {
+        case 'a': opts->address = optarg; break;
+        case 'n': parse_counts( optarg, opts ); break;
+        case 'A':
+            if (sscanf( optarg, "%d", &opts->active ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
+        case 'r':
+            if (sscanf( optarg, "%d", &opts->rate ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
+        case 'b':
+            if (sscanf( optarg, "%u", &opts->msg_size ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
+        case 'i':
+            if (sscanf( optarg, "%d", &opts->idle_timeout ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
+        case 'd':
+            if (sscanf( optarg, "%d", &opts->duration ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
+        case 'B':
+            if (sscanf( optarg, "%d", &opts->batch ) != 1 || opts->batch < 1) {
+                fprintf(stderr, "Option -%c requires a positive integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
+        default:
+            usage(1);
+        }
+    }
+    check( opts->steps > 0, "no connection counts" );
+}
+
+int main(int argc, char** argv)
+{
+  Options_t opts;
+  parse_options( argc, argv, &opts );
+
+  uint64_t most = opts.counts[opts.steps - 1];
+  raise_fd_limit((opts.address ? 1 : 2) * most + 64);
+
+  pn_reactor_t *reactor = pn_reactor();
+  pn_handler_t *h = pn_handler_new(scale_dispatch, sizeof(scale_context_t), scale_cleanup);
+  scale_context_t *sc = (scale_context_t *) pn_handler_mem(h);
+  memset(sc, 0, sizeof(*sc));
+  sc->opts = &opts;
+  the_context = sc;
+
+  pn_url_t *url = pn_url_parse(opts.address ? opts.address : "amqp://127.0.0.1:5680");
+  check(url, "invalid address");
+  sc->host = pn_url_get_host(url);
+  sc->port = pn_url_get_port(url);
+  if (!sc->host || !*sc->host) sc->host = "127.0.0.1";
+  if (!sc->port || !*sc->port) sc->port = "5672";
+
+  sc->connections = (pn_connection_t **) calloc(most, sizeof(pn_connection_t *));
+  sc->senders = (pn_link_t **) calloc(opts.active ? opts.active : 1, sizeof(pn_link_t *));
+  sc->ends = (end_t *) calloc(2 * most, sizeof(end_t));
+  sc->body = (char *) calloc(1, opts.msg_size ? opts.msg_size : 1);
+  check(sc->connections && sc->senders && sc->ends && sc->body, "malloc failure");
+  histogram_init(&sc->late);
+  histogram_init(&sc->jitter);
+
+  pn_handshaker_t *handshaker = pn_handshaker();
+  pn_handler_add(h, handshaker);
+  pn_decref(handshaker);
+  pn_flowcontroller_t *fc = pn_flowcontroller(1024);
+  pn_handler_add(h, fc);
+  pn_decref(fc);
+  // the reactor's handler takes over h
+  pn_handler_add(pn_reactor_get_handler(reactor), h);
+
+  pn_reactor_set_timeout(reactor, 3141);
+  pn_reactor_start(reactor);
+  while (sc->phase != DONE && pn_reactor_process(reactor));
+
+  pn_reactor_free(reactor);
+  pn_url_free(url);
+  return 0;
+}
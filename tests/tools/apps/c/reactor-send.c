@@ -50,6 +50,7 @@ typedef struct {
     int   timeout;      // in seconds
     int   incoming_window;
     int   recv_count;
+    uint64_t rate;      // messages per second, 0 = as fast as credit allows
     const char *name;
     char *certificate;
     char *privatekey;   // used to sign certificate
@@ -65,6 +66,7 @@ static void usage(int rc)
            " -c # \tNumber of messages to send before exiting [0=forever]\n"
            " -b # \tSize of message body in bytes [1024]\n"
            " -R \tWait for a reply to each sent message\n"
+           " -r # \tSend at a fixed rate of # messages/sec, latency counts from when each was due [0]\n"
            " -V \tEnable debug logging\n"
            );
     exit(rc);
@@ -84,6 +86,9 @@ typedef struct {
   pn_url_t *send_url;
   pn_string_t *hostname;
   pn_string_t *container_id;
+  pn_link_t *snd;
+  uint64_t start;      // in microseconds, for the fixed rate
+  bool scheduled;
 } sender_context_t;
 
 void sender_context_init(sender_context_t *sc, Options_t *opts, Statistics_t *stats)
@@ -94,6 +99,9 @@ void sender_context_init(sender_context_t *sc, Options_t *opts, Statistics_t *st
   sc->received = 0;
   sc->id.type = PN_ULONG;
   sc->reply_message = 0;
+  sc->snd = 0;
+  sc->start = 0;
+  sc->scheduled = false;
   // 4096 extra bytes should easily cover the message metadata
   sc->encoded_data_size = sc->opts->msg_size + 4096;
   sc->encoded_data = (char *)calloc(1, sc->encoded_data_size);
@@ -139,6 +147,64 @@ void sender_cleanup(pn_handler_t *h)
 
 pn_handler_t *replyto_handler(sender_context_t *sc);
 
+static void send_message(sender_context_t *sc, uint64_t stamp)
+{
+  pn_link_t *snd = sc->snd;
+  char tag[8];
+  void *ptr = &tag;
+  *((uint64_t *) ptr) = sc->sent;
+  pn_delivery_t *dlv = pn_delivery(snd, pn_dtag(tag, 8));
+
+  // setup the message to send
+  pn_message_t *msg = sc->message;
+  pn_message_set_address(msg, sc->opts->targets.addresses[0]);
+  sc->id.u.as_ulong = sc->sent;
+  pn_message_set_correlation_id(msg, sc->id);
+  pn_message_set_creation_time(msg, msgr_now());
+  statistics_stamp(msg, stamp);
+
+  size_t size = sc->encoded_data_size;
+  int err = pn_message_encode(msg, sc->encoded_data, &size);
+  check(err == 0, "message encoding error");
+  pn_link_send(snd, sc->encoded_data, size);
+  pn_delivery_settle(dlv);
+  sc->sent++;
+}
+
+// send what credit allows, at a fixed rate only the messages that are
+// due, each stamped with when it was due so that a stall shows in the
+// latency of every message it held up
+static void send_messages(pn_handler_t *h, pn_reactor_t *reactor)
+{
+  sender_context_t *sc = sender_context(h);
+  pn_link_t *snd = sc->snd;
+  uint64_t now = msgr_now_usec();
+  if (sc->sent == 0) {
+    statistics_start(sc->stats);
+    sc->start = now;
+  }
+  while (pn_link_credit(snd) > 0 && sc->sent < sc->opts->msg_count) {
+    if (!sc->opts->rate) {
+      send_message(sc, msgr_now_usec());
+      continue;
+    }
+    uint64_t due = sc->start + sc->sent * 1000000 / sc->opts->rate;
+    if (due > now) {
+      // the reactor's timers are to the millisecond
+      if (!sc->scheduled) {
+        pn_reactor_schedule(reactor, (int) ((due - now + 999) / 1000), h);
+        sc->scheduled = true;
+      }
+      break;
+    }
+    send_message(sc, due);
+  }
+  if (sc->sent == sc->opts->msg_count && !sc->opts->get_replies) {
+    pn_link_close(snd);
+    pn_connection_close(pn_session_connection(pn_link_session(snd)));
+  }
+}
+
 void sender_dispatch(pn_handler_t *h, pn_event_t *event, pn_event_type_t type)
 {
   sender_context_t *sc = sender_context(h);
@@ -153,6 +219,7 @@ void sender_dispatch(pn_handler_t *h, pn_event_t *event, pn_event_type_t type)
       pn_session_t *ssn = pn_session(conn);
       pn_session_open(ssn);
       pn_link_t *snd = pn_sender(ssn, "sender");
+      sc->snd = snd;
       const char *path = pn_url_get_path(sc->send_url);
       if (path && strlen(path)) {
         pn_terminus_set_address(pn_link_target(snd), path);
@@ -163,35 +230,15 @@ void sender_dispatch(pn_handler_t *h, pn_event_t *event, pn_event_type_t type)
     break;
   case PN_LINK_FLOW:
     {
-      pn_link_t *snd = pn_event_link(event);
-      while (pn_link_credit(snd) > 0 && sc->sent < sc->opts->msg_count) {
-        if (sc->sent == 0)
-          statistics_start(sc->stats);
-
-        char tag[8];
-        void *ptr = &tag;
-        *((uint64_t *) ptr) = sc->sent;
-        pn_delivery_t *dlv = pn_delivery(snd, pn_dtag(tag, 8));
-
-        // setup the message to send
-        pn_message_t *msg = sc->message;
-        pn_message_set_address(msg, sc->opts->targets.addresses[0]);
-        sc->id.u.as_ulong = sc->sent;
-        pn_message_set_correlation_id(msg, sc->id);
-        pn_message_set_creation_time(msg, msgr_now());
-
-        size_t size = sc->encoded_data_size;
-        int err = pn_message_encode(msg, sc->encoded_data, &size);
-        check(err == 0, "message encoding error");
-        pn_link_send(snd, sc->encoded_data, size);
-        pn_delivery_settle(dlv);
-        sc->sent++;
-      }
-      if (sc->sent == sc->opts->msg_count && !sc->opts->get_replies) {
-        pn_link_close(snd);
-        pn_connection_t *conn = pn_event_connection(event);
-        pn_connection_close(conn);
-      }
+      if (pn_event_link(event) == sc->snd)
+        send_messages(h, pn_event_reactor(event));
+    }
+    break;
+  case PN_TIMER_TASK:
+    {
+      sc->scheduled = false;
+      if (!(pn_link_state(sc->snd) & PN_LOCAL_CLOSED))
+        send_messages(h, pn_event_reactor(event));
     }
     break;
   case PN_LINK_INIT:
@@ -257,7 +304,7 @@ void replyto_dispatch(pn_handler_t *h, pn_event_t *event, pn_event_type_t type)
         pn_message_t *msg = sc->reply_message;
         int err = pn_message_decode(msg, sc->encoded_data, n);
         check(err == 0, "message decode error");
-        statistics_msg_received(sc->stats, msg);
+        statistics_reply_received(sc->stats, msg);
         sc->received++;
         pn_delivery_settle(dlv);
       }
@@ -294,7 +341,7 @@ static void parse_options( int argc, char **argv, Options_t *opts )
     addresses_init(&opts->targets);
 
     while ((c = getopt(argc, argv,
-                       "a:c:b:p:w:e:l:Rt:W:B:VN:T:C:K:P:")) != -1) {
+                       "a:c:b:p:w:e:l:Rt:W:B:VN:T:C:K:P:r:")) != -1) {
         switch(c) {
         case 'a':
           {
@@ -334,6 +381,12 @@ static void parse_options( int argc, char **argv, Options_t *opts )
             }
             break;
         case 'R': opts->get_replies = 1; break;
+        case 'r':
+            if (sscanf( optarg, "%" SCNu64, &opts->rate ) != 1) {
+                fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
+                usage(1);
+            }
+            break;
         case 't':
             if (sscanf( optarg, "%d", &opts->timeout ) != 1) {
                 fprintf(stderr, "Option -%c requires an integer argument.\n", optopt);
@@ -375,6 +428,7 @@ int main(int argc, char** argv)
   Options_t opts;
   Statistics_t stats;
   parse_options( argc, argv, &opts );
+  statistics_start(&stats);
 
   pn_reactor_t *reactor = pn_reactor();
   pn_handler_t *sh = sender_handler(&opts, &stats);
@@ -384,6 +438,7 @@ int main(int argc, char** argv)
   pn_reactor_free(reactor);
 
   pn_handler_free(sh);
+  statistics_free(&stats);
   addresses_free(&opts.targets);
   return 0;
 }